@@ -0,0 +1,536 @@
+// A microbenchmark of the kernels of the solver and of the star extraction, each one timed on its own, so that a change to one of them
+// can be measured, and a regression caught, without the noise of the rest of a solve.  The solver kernels are the range searches of the
+// star and code trees, verify_hit, check_inbox and the healpix conversions, and they run on the stars of a real index file in a field
+// around the Pleiades.  The star extraction kernels are sep_background, the convolution and sep_sum_ellipse, and they run on a real frame.
+// The noise added to the stars and the random positions come from a fixed seed, so the inputs are the same every time.
+// It reports the nanoseconds per call of each kernel, and with -o, the same in JSON to compare between versions.
+//
+// Build with:
+// mkdir build
+// cd build
+// cmake -DCMAKE_BUILD_TYPE=RelWithDebInfo -DBUILD_BENCHMARKS=ON ..
+// make -j 4
+//
+// Examples:
+// StellarSolverKernelBenchmark
+// StellarSolverKernelBenchmark --rounds 200 --kernels verify,inbox
+// StellarSolverKernelBenchmark --index astrometry/index-4110.fits --image myimage.fits -o kernels.json
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <vector>
+
+//Includes for this project
+#include "stellarsolver.h"
+#include "sep/sep.h"
+#include "sep/sepcore.h"
+
+//CFitsio Includes
+#include <fitsio.h>
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/healpix.h"
+#include "astrometry/index.h"
+#include "astrometry/kdtree.h"
+#include "astrometry/matchobj.h"
+#include "astrometry/sip.h"
+#include "astrometry/solver.h"
+#include "astrometry/starkd.h"
+#include "astrometry/starutil.h"
+#include "astrometry/starxy.h"
+#include "astrometry/verify.h"
+#include "pquad.h"
+}
+
+using namespace SEP;
+
+// The sums are printed so that the results of the kernels are not optimized away
+static double checksum = 0;
+
+static QStringList selectedKernels;
+static QJsonArray results;
+
+// This times a kernel: round makes calls calls of it, it is run once to warm up and then rounds times
+static void timeKernel(const char *name, int rounds, double calls, const std::function<void()> &round)
+{
+    if(!selectedKernels.isEmpty())
+    {
+        bool selected = false;
+        for(const QString &kernel : selectedKernels)
+            selected |= QString(name).contains(kernel, Qt::CaseInsensitive);
+        if(!selected)
+            return;
+    }
+    round();
+    QElapsedTimer timer;
+    timer.start();
+    for(int r = 0; r < rounds; r++)
+        round();
+    const double ns = timer.nsecsElapsed() / (calls * rounds);
+    printf("%-32s %12.1f ns per call   %10.3f million calls per second\n", name, ns, ns > 0 ? 1000.0 / ns : 0.0);
+    QJsonObject result;
+    result["kernel"] = name;
+    result["nsPerCall"] = ns;
+    result["calls"] = calls * rounds;
+    results.append(result);
+}
+
+// This is the field of a solve: the stars of the index in the image of a TAN WCS, with some noise, and distractors between them
+struct Field
+{
+    int width { 0 }, height { 0 };
+    tan_t wcs;
+    double center[3];
+    double radiusDeg { 0 };
+    std::vector<double> x, y;
+    std::vector<int> starIds;   // The index star of each field star, -1 for the distractors
+};
+
+static bool makeField(index_t *index, double ra, double dec, double arcsecPerPixel, int width, int height, int maxStars,
+                      std::mt19937 &random, Field &field)
+{
+    const double scale = arcsecPerPixel / 3600.0;
+    memset(&field.wcs, 0, sizeof(tan_t));
+    field.wcs.crval[0] = ra;
+    field.wcs.crval[1] = dec;
+    field.wcs.crpix[0] = width / 2.0 + 0.5;
+    field.wcs.crpix[1] = height / 2.0 + 0.5;
+    field.wcs.cd[0][0] = -scale;
+    field.wcs.cd[1][1] = scale;
+    field.wcs.imagew = width;
+    field.wcs.imageh = height;
+    field.width = width;
+    field.height = height;
+    field.radiusDeg = std::hypot(width, height) / 2.0 * scale;
+    radecdeg2xyzarr(ra, dec, field.center);
+
+    double *xyz = nullptr;
+    int *inds = nullptr;
+    int n = 0;
+    startree_search_for(index->starkd, field.center, deg2distsq(field.radiusDeg), &xyz, nullptr, &inds, &n);
+    // The stars of a field are tried brightest first, and the sweeps of the index are in the order of brightness
+    struct Found
+    {
+        int sweep, id;
+        double x, y;
+    };
+    std::vector<Found> found;
+    for(int i = 0; i < n; i++)
+    {
+        double px, py;
+        if(!tan_xyzarr2pixelxy(&field.wcs, xyz + 3 * i, &px, &py) || px < 0 || py < 0 || px >= width || py >= height)
+            continue;
+        found.push_back({startree_get_sweep(index->starkd, inds[i]), inds[i], px, py});
+    }
+    free(xyz);
+    free(inds);
+    std::sort(found.begin(), found.end(), [](const Found & a, const Found & b)
+    {
+        return a.sweep != b.sweep ? a.sweep < b.sweep : a.id < b.id;
+    });
+
+    // A quarter of the field stars are distractors, which are not in the index, like DEFAULT_DISTRACTOR_RATIO
+    std::normal_distribution<double> noise(0, 0.3);
+    std::uniform_real_distribution<double> anyX(0, width), anyY(0, height);
+    for(const Found &star : found)
+    {
+        if(static_cast<int>(field.x.size()) >= maxStars)
+            break;
+        field.x.push_back(star.x + noise(random));
+        field.y.push_back(star.y + noise(random));
+        field.starIds.push_back(star.id);
+        if(field.x.size() % 4 == 3)
+        {
+            field.x.push_back(anyX(random));
+            field.y.push_back(anyY(random));
+            field.starIds.push_back(-1);
+        }
+    }
+    return found.size() >= 4;
+}
+
+static void benchmarkStarTree(index_t *index, const Field &field, int rounds)
+{
+    std::vector<double> queries;
+    for(int id : field.starIds)
+    {
+        double xyz[3];
+        if(id >= 0 && startree_get(index->starkd, id, xyz) == 0)
+            queries.insert(queries.end(), xyz, xyz + 3);
+    }
+    const int n = static_cast<int>(queries.size() / 3);
+    // Like the searches of the verification, of a tenth of the field at a time
+    const double maxd2 = deg2distsq(field.radiusDeg / 10);
+    kdtree_qres_t *res = nullptr;
+    timeKernel("kdtree star range search", rounds, n, [&]()
+    {
+        for(int i = 0; i < n; i++)
+        {
+            res = kdtree_rangesearch_options_reuse(index->starkd->tree, res, queries.data() + 3 * i, maxd2,
+                                                   KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_RETURN_POINTS);
+            checksum += res->nres;
+        }
+    });
+    if(res)
+        kdtree_free_query(res);
+}
+
+static void benchmarkCodeTree(index_t *index, int queriesCount, int rounds, std::mt19937 &random)
+{
+    const int ncodes = codetree_N(index->codekd);
+    const int dim = codetree_D(index->codekd);
+    if(ncodes <= 0 || dim <= 0)
+        return;
+    // The codes of the quads of the index with the noise of the field stars, so most of them find their quad and a few others
+    std::uniform_int_distribution<int> anyCode(0, ncodes - 1);
+    std::normal_distribution<double> noise(0, DEFAULT_CODE_TOL / 3);
+    std::vector<double> queries(queriesCount * dim);
+    for(int i = 0; i < queriesCount; i++)
+    {
+        codetree_get(index->codekd, anyCode(random), queries.data() + dim * i);
+        for(int d = 0; d < dim; d++)
+            queries[dim * i + d] += noise(random);
+    }
+    const double tol2 = DEFAULT_CODE_TOL * DEFAULT_CODE_TOL;
+    kdtree_qres_t *res = nullptr;
+    timeKernel("kdtree code range search", rounds, queriesCount, [&]()
+    {
+        for(int i = 0; i < queriesCount; i++)
+        {
+            // The options of search_codes in solver.c
+            res = kdtree_rangesearch_options_reuse(index->codekd->tree, res, queries.data() + dim * i, tol2,
+                                                   KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_COMPUTE_DISTS | KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_USE_SPLIT);
+            checksum += res->nres;
+        }
+    });
+    if(res)
+        kdtree_free_query(res);
+}
+
+static void benchmarkVerify(index_t *index, const Field &field, starxy_t *xy, int rounds)
+{
+    // The quad is the first four stars of the field that are in the index
+    MatchObj quad;
+    memset(&quad, 0, sizeof(MatchObj));
+    quad.dimquads = 0;
+    for(size_t i = 0; i < field.starIds.size() && quad.dimquads < 4; i++)
+    {
+        if(field.starIds[i] < 0)
+            continue;
+        quad.field[quad.dimquads] = static_cast<unsigned int>(i);
+        quad.star[quad.dimquads] = field.starIds[i];
+        quad.dimquads++;
+    }
+    if(quad.dimquads < 4)
+        return;
+    quad.wcs_valid = TRUE;
+    quad.wcstan = field.wcs;
+    memcpy(quad.center, field.center, sizeof(quad.center));
+    quad.radius_deg = field.radiusDeg;
+    matchobj_compute_derived(&quad);
+
+    verify_field_t *vf = verify_field_preprocess(xy);
+    // The verification settings of solver_set_default_values
+    const double pix2 = DEFAULT_VERIFY_PIX * DEFAULT_VERIFY_PIX;
+    timeKernel("verify_hit", rounds, 1, [&]()
+    {
+        MatchObj mo = quad;
+        verify_hit(index->starkd, index->cutnside, &mo, nullptr, vf, pix2, DEFAULT_DISTRACTOR_RATIO, field.width, field.height,
+                   log(1e-100), log(1e9), HUGE_VAL, TRUE, FALSE);
+        checksum += mo.logodds;
+        verify_free_matchobj(&mo);
+    });
+    verify_field_free(vf);
+}
+
+static void benchmarkCheckInbox(const Field &field, starxy_t *xy, int rounds)
+{
+    solver_t *solver = solver_new();
+    solver->fieldxy = xy;
+    solver->codetol = DEFAULT_CODE_TOL;
+    const int n = static_cast<int>(field.x.size());
+    const int words = (n + 63) / 64;
+    std::vector<uint64_t> inbox(words);
+    // Every pair of the brightest stars is the A and B of a quad, and the inbox starts with all of the stars, like for the last B star
+    std::vector<pquad> pairs;
+    const int bright = std::min(n, 20);
+    for(int b = 1; b < bright; b++)
+    {
+        for(int a = 0; a < b; a++)
+        {
+            pquad pq;
+            memset(&pq, 0, sizeof(pquad));
+            pq.fieldA = a;
+            pq.fieldB = b;
+            const double dx = field.x[b] - field.x[a];
+            const double dy = field.y[b] - field.y[a];
+            pq.scale = dx * dx + dy * dy;
+            if(pq.scale <= 0)
+                continue;
+            pq.costheta = (dy + dx) / pq.scale;
+            pq.sintheta = (dy - dx) / pq.scale;
+            pq.inbox = inbox.data();
+            pq.ninbox = n;
+            pairs.push_back(pq);
+        }
+    }
+    timeKernel("check_inbox", rounds, pairs.size(), [&]()
+    {
+        for(pquad &pq : pairs)
+        {
+            std::fill(inbox.begin(), inbox.end(), ~static_cast<uint64_t>(0));
+            solver_check_inbox(&pq, 0, solver);
+            checksum += inbox[0] & 0xff;
+        }
+    });
+    solver->fieldxy = nullptr;
+    solver_free(solver);
+}
+
+static void benchmarkHealpix(index_t *index, int pointsCount, int rounds, std::mt19937 &random)
+{
+    const int nstars = startree_N(index->starkd);
+    if(nstars <= 0)
+        return;
+    // The positions of stars of the index, all over its part of the sky
+    std::uniform_int_distribution<int> anyStar(0, nstars - 1);
+    std::vector<double> xyz(3 * pointsCount), radec(2 * pointsCount);
+    for(int i = 0; i < pointsCount; i++)
+    {
+        startree_get(index->starkd, anyStar(random), xyz.data() + 3 * i);
+        xyzarr2radecdeg(xyz.data() + 3 * i, &radec[2 * i], &radec[2 * i + 1]);
+    }
+    const int nside = index->cutnside > 0 ? index->cutnside : 16;
+    std::vector<int> hps(pointsCount);
+    timeKernel("radecdegtohealpix", rounds, pointsCount, [&]()
+    {
+        for(int i = 0; i < pointsCount; i++)
+            hps[i] = radecdegtohealpix(radec[2 * i], radec[2 * i + 1], nside);
+        checksum += hps[pointsCount - 1];
+    });
+    timeKernel("radecdegarrtohealpixmany", rounds, pointsCount, [&]()
+    {
+        radecdegarrtohealpixmany(radec.data(), pointsCount, nside, hps.data());
+        checksum += hps[pointsCount - 1];
+    });
+    timeKernel("xyzarrtohealpix", rounds, pointsCount, [&]()
+    {
+        for(int i = 0; i < pointsCount; i++)
+            hps[i] = xyzarrtohealpix(xyz.data() + 3 * i, nside);
+        checksum += hps[pointsCount - 1];
+    });
+    timeKernel("healpix_to_radecdeg", rounds, pointsCount, [&]()
+    {
+        double ra, dec;
+        for(int i = 0; i < pointsCount; i++)
+        {
+            healpix_to_radecdeg(hps[i], nside, 0.5, 0.5, &ra, &dec);
+            checksum += dec;
+        }
+    });
+}
+
+static bool loadFrame(const QString &fileName, std::vector<float> &pixels, int &width, int &height)
+{
+    fitsfile *fptr = nullptr;
+    int status = 0, naxis = 0;
+    long naxes[3] = {0, 0, 0};
+    if(fits_open_diskfile(&fptr, fileName.toLocal8Bit(), READONLY, &status) ||
+            fits_get_img_dim(fptr, &naxis, &status) || fits_get_img_size(fptr, 3, naxes, &status) || naxis < 2)
+    {
+        if(fptr)
+            fits_close_file(fptr, &status);
+        return false;
+    }
+    width = naxes[0];
+    height = naxes[1];
+    // Only the first channel of a color image
+    pixels.resize(size_t(width) * height);
+    long first[3] = {1, 1, 1};
+    int anynull = 0;
+    fits_read_pix(fptr, TFLOAT, first, pixels.size(), nullptr, pixels.data(), &anynull, &status);
+    int closeStatus = 0;
+    fits_close_file(fptr, &closeStatus);
+    return status == 0;
+}
+
+static void benchmarkExtraction(std::vector<float> &pixels, int width, int height, int positionsCount, int rounds,
+                                std::mt19937 &random)
+{
+    sep_image im = {pixels.data(), nullptr, nullptr, nullptr, SEP_TFLOAT, 0, 0, 0, width, height, width, height, 0, SEP_NOISE_NONE, 1.0, 0};
+    timeKernel("sep_background", rounds, 1, [&]()
+    {
+        sep_bkg *bkg = nullptr;
+        if(sep_background(&im, 64, 64, 3, 3, 0.0, &bkg) == RETURN_OK)
+        {
+            checksum += bkg->global;
+            sep_bkg_free(bkg);
+        }
+    });
+
+    // The default filter of the star extraction, and a 7 x 7 Gaussian with a FWHM of 3 pixels, which convolve separates
+    float conv3[9] = {1, 2, 1, 2, 4, 2, 1, 2, 1};
+    for(float &c : conv3)
+        c /= 16;
+    float conv7[49];
+    const double sigma = 3 / 2.355;
+    double sum = 0;
+    for(int j = 0; j < 7; j++)
+        for(int i = 0; i < 7; i++)
+            sum += conv7[7 * j + i] = exp(-((i - 3) * (i - 3) + (j - 3) * (j - 3)) / (2 * sigma * sigma));
+    for(float &c : conv7)
+        c /= sum;
+    float col[7], row[7];
+    const bool separable = separate_kernel(conv7, 7, 7, col, row);
+    std::vector<PIXTYPE> work(width), out(width);
+    timeKernel("convolve 3x3", rounds, height, [&]()
+    {
+        for(int y = 0; y < height; y++)
+            convolve_rows(pixels.data(), width, width, height, y, conv3, 3, 3, nullptr, nullptr, work.data(), out.data());
+        checksum += out[width / 2];
+    });
+    timeKernel("convolve 7x7", rounds, height, [&]()
+    {
+        for(int y = 0; y < height; y++)
+            convolve_rows(pixels.data(), width, width, height, y, conv7, 7, 7, nullptr, nullptr, work.data(), out.data());
+        checksum += out[width / 2];
+    });
+    if(separable)
+    {
+        timeKernel("convolve 7x7 separable", rounds, height, [&]()
+        {
+            for(int y = 0; y < height; y++)
+                convolve_rows(pixels.data(), width, width, height, y, conv7, 7, 7, col, row, work.data(), out.data());
+            checksum += out[width / 2];
+        });
+    }
+
+    // The apertures of stars of a few pixels, all over the frame, with the subpixels and flags of the default profile
+    SSolver::Parameters params;
+    std::uniform_real_distribution<double> anyX(10, width - 10), anyY(10, height - 10), anyTheta(-M_PI / 2, M_PI / 2);
+    std::uniform_real_distribution<double> anyA(1.5, 4);
+    std::vector<double> x(positionsCount), y(positionsCount), a(positionsCount), b(positionsCount), theta(positionsCount),
+        r(positionsCount, 2.5), sums(positionsCount), errs(positionsCount), areas(positionsCount);
+    std::vector<short> flags(positionsCount);
+    for(int i = 0; i < positionsCount; i++)
+    {
+        x[i] = anyX(random);
+        y[i] = anyY(random);
+        a[i] = anyA(random);
+        b[i] = a[i] * 0.8;
+        theta[i] = anyTheta(random);
+    }
+    timeKernel("sep_sum_ellipse", rounds, positionsCount, [&]()
+    {
+        for(int i = 0; i < positionsCount; i++)
+        {
+            sep_sum_ellipse(&im, x[i], y[i], a[i], b[i], theta[i], r[i], 0, params.subpix, params.inflags, &sums[i], &errs[i],
+                            &areas[i], &flags[i]);
+            checksum += sums[i];
+        }
+    });
+    timeKernel("sep_sum_ellipse_batch", rounds, positionsCount, [&]()
+    {
+        sep_sum_ellipse_batch(&im, positionsCount, x.data(), y.data(), a.data(), b.data(), theta.data(), r.data(), nullptr,
+                              params.subpix, params.inflags, sums.data(), errs.data(), areas.data(), flags.data(), 1);
+        checksum += sums[positionsCount - 1];
+    });
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("StellarSolverKernelBenchmark");
+    QCoreApplication::setApplicationVersion(StellarSolver::getVersionNumber());
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times the kernels of the solver and the star extraction on their own.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption indexOption("index", "The index file the solver kernels use, astrometry/index-4107.fits by default.", "file",
+                                   "astrometry/index-4107.fits");
+    QCommandLineOption imageOption("image", "The FITS frame the star extraction kernels use, randomsky.fits by default.", "file",
+                                   "randomsky.fits");
+    QCommandLineOption roundsOption(QStringList() << "r" << "rounds", "How many times each kernel is run over its inputs, 20 by default.",
+                                    "number", "20");
+    QCommandLineOption kernelsOption(QStringList() << "k" << "kernels",
+                                     "Only the kernels whose names contain one of these words, separated by commas, like verify,healpix.", "list");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Writes the results in JSON to this file.", "file");
+    parser.addOptions(QList<QCommandLineOption>() << indexOption << imageOption << roundsOption << kernelsOption << outputOption);
+    parser.process(app);
+
+    const int rounds = std::max(1, parser.value(roundsOption).toInt());
+    if(parser.isSet(kernelsOption))
+    {
+        selectedKernels = parser.value(kernelsOption).split(',');
+        selectedKernels.removeAll(QString());
+    }
+    std::mt19937 random(42);
+
+    // The field is about 1 x 0.75 degrees around the Pleiades, which the index files of the benchmarks solve
+    const QString indexFile = parser.value(indexOption);
+    index_t *index = index_load(indexFile.toLocal8Bit().constData(), 0, nullptr);
+    if(index)
+    {
+        Field field;
+        if(makeField(index, 56.75, 24.12, 2.4, 1500, 1125, 300, random, field))
+        {
+            printf("%s: %i field stars, %i of them distractors\n", qPrintable(indexFile), int(field.x.size()),
+                   int(std::count(field.starIds.begin(), field.starIds.end(), -1)));
+            starxy_t *xy = starxy_new(field.x.size(), FALSE, FALSE);
+            for(size_t i = 0; i < field.x.size(); i++)
+                starxy_set(xy, i, field.x[i], field.y[i]);
+            benchmarkStarTree(index, field, rounds);
+            benchmarkCodeTree(index, 10000, rounds, random);
+            benchmarkVerify(index, field, xy, rounds);
+            benchmarkCheckInbox(field, xy, rounds);
+            starxy_free(xy);
+        }
+        else
+            printf("%s has too few stars around the Pleiades, so the kernels that need a field are left out\n", qPrintable(indexFile));
+        benchmarkHealpix(index, 100000, rounds, random);
+        index_free(index);
+    }
+    else
+        printf("The index file %s could not be loaded, so the solver kernels are left out\n", qPrintable(indexFile));
+
+    const QString imageFile = parser.value(imageOption);
+    std::vector<float> pixels;
+    int width = 0, height = 0;
+    if(loadFrame(imageFile, pixels, width, height) && width >= 64 && height >= 64)
+    {
+        printf("%s: %i x %i\n", qPrintable(imageFile), width, height);
+        benchmarkExtraction(pixels, width, height, 10000, rounds, random);
+    }
+    else
+        printf("The frame %s could not be loaded, so the star extraction kernels are left out\n", qPrintable(imageFile));
+
+    if(parser.isSet(outputOption))
+    {
+        QFile file(parser.value(outputOption));
+        if(!file.open(QIODevice::WriteOnly))
+        {
+            printf("Could not write %s\n", qPrintable(parser.value(outputOption)));
+            return 1;
+        }
+        QJsonObject report;
+        report["version"] = StellarSolver::getVersionNumber();
+        report["rounds"] = rounds;
+        report["kernels"] = results;
+        file.write(QJsonDocument(report).toJson());
+    }
+    printf("(%g)\n", checksum);
+    return 0;
+}
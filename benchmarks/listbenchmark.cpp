@@ -0,0 +1,198 @@
+// A microbenchmark of the block lists of the astrometry code (bl.h) against the growable arrays (garray.h) that the solver and
+// the verification use in their inner loops now.  Each case is timed with both on the same data: appending the elements,
+// reading them in order and in a random order, and sorting stars into bins and sweeping through the bins the way
+// verify_uniformize_field does.  It reports the nanoseconds per element of each case and how many times faster the arrays were.
+//
+// Build with:
+// mkdir build
+// cd build
+// cmake -DCMAKE_BUILD_TYPE=RelWithDebInfo -DBUILD_BENCHMARKS=ON ..
+// make -j 4
+//
+// Examples:
+// StellarSolverListBenchmark
+// StellarSolverListBenchmark --elements 100000 --bins 64 --iterations 50
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+//Includes for this project
+#include "stellarsolver.h"
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/bl.h"
+#include "astrometry/garray.h"
+}
+
+// The sums are printed so that the reads are not optimized away
+static long long checksum = 0;
+
+static double appendList(int n, int iterations)
+{
+    QElapsedTimer timer;
+    timer.start();
+    for(int it = 0; it < iterations; it++)
+    {
+        il* list = il_new(256);
+        for(int i = 0; i < n; i++)
+            il_append(list, i);
+        checksum += il_size(list);
+        il_free(list);
+    }
+    return timer.nsecsElapsed();
+}
+
+static double appendArray(int n, int iterations)
+{
+    QElapsedTimer timer;
+    timer.start();
+    for(int it = 0; it < iterations; it++)
+    {
+        iarray array;
+        iarray_init(&array);
+        for(int i = 0; i < n; i++)
+            iarray_append(&array, i);
+        checksum += iarray_size(&array);
+        iarray_free(&array);
+    }
+    return timer.nsecsElapsed();
+}
+
+static double readList(const std::vector<int> &order, int iterations)
+{
+    il* list = il_new(256);
+    for(size_t i = 0; i < order.size(); i++)
+        il_append(list, int(i));
+    QElapsedTimer timer;
+    timer.start();
+    for(int it = 0; it < iterations; it++)
+        for(int index : order)
+            checksum += il_get(list, index);
+    const double elapsed = timer.nsecsElapsed();
+    il_free(list);
+    return elapsed;
+}
+
+static double readArray(const std::vector<int> &order, int iterations)
+{
+    iarray array;
+    iarray_init(&array);
+    for(size_t i = 0; i < order.size(); i++)
+        iarray_append(&array, int(i));
+    QElapsedTimer timer;
+    timer.start();
+    for(int it = 0; it < iterations; it++)
+        for(int index : order)
+            checksum += iarray_get(&array, index);
+    const double elapsed = timer.nsecsElapsed();
+    iarray_free(&array);
+    return elapsed;
+}
+
+// This is what verify_uniformize_field did with a block list per bin
+static double binList(const std::vector<int> &bins, int nbins, int iterations)
+{
+    QElapsedTimer timer;
+    timer.start();
+    for(int it = 0; it < iterations; it++)
+    {
+        std::vector<il*> lists(nbins);
+        for(int b = 0; b < nbins; b++)
+            lists[b] = il_new(16);
+        for(size_t i = 0; i < bins.size(); i++)
+            il_append(lists[bins[i]], int(i));
+        size_t p = 0;
+        for(size_t k = 0; p < bins.size(); k++)
+            for(int b = 0; b < nbins; b++)
+                if(k < il_size(lists[b]))
+                {
+                    checksum += il_get(lists[b], k);
+                    p++;
+                }
+        for(int b = 0; b < nbins; b++)
+            il_free(lists[b]);
+    }
+    return timer.nsecsElapsed();
+}
+
+// This is what it does now with an array per bin
+static double binArray(const std::vector<int> &bins, int nbins, int iterations)
+{
+    QElapsedTimer timer;
+    timer.start();
+    for(int it = 0; it < iterations; it++)
+    {
+        iarray* lists = (iarray*)calloc(nbins, sizeof(iarray));
+        for(size_t i = 0; i < bins.size(); i++)
+            iarray_append(lists + bins[i], int(i));
+        size_t p = 0;
+        for(size_t k = 0; p < bins.size(); k++)
+            for(int b = 0; b < nbins; b++)
+                if(k < iarray_size(lists + b))
+                {
+                    checksum += iarray_get(lists + b, k);
+                    p++;
+                }
+        for(int b = 0; b < nbins; b++)
+            iarray_free(lists + b);
+        free(lists);
+    }
+    return timer.nsecsElapsed();
+}
+
+static void report(const char *name, double listNs, double arrayNs, double elements)
+{
+    printf("%-16s block list %8.2f ns   array %8.2f ns   %5.2fx\n", name, listNs / elements, arrayNs / elements,
+           arrayNs > 0 ? listNs / arrayNs : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("StellarSolverListBenchmark");
+    QCoreApplication::setApplicationVersion(StellarSolver::getVersionNumber());
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Compares the block lists of the astrometry code with the growable arrays.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption elementsOption(QStringList() << "n" << "elements", "The number of elements in each list, 1000 by default.", "number", "1000");
+    QCommandLineOption binsOption("bins", "The number of bins the elements are sorted into, 100 by default.", "number", "100");
+    QCommandLineOption iterationsOption(QStringList() << "i" << "iterations", "How many times each case is run, 2000 by default.", "number", "2000");
+    parser.addOptions(QList<QCommandLineOption>() << elementsOption << binsOption << iterationsOption);
+    parser.process(app);
+
+    const int n = std::max(1, parser.value(elementsOption).toInt());
+    const int nbins = std::max(1, parser.value(binsOption).toInt());
+    const int iterations = std::max(1, parser.value(iterationsOption).toInt());
+    const double elements = double(n) * iterations;
+
+    std::mt19937 random(42);
+    std::vector<int> sequential(n);
+    for(int i = 0; i < n; i++)
+        sequential[i] = i;
+    std::vector<int> shuffled = sequential;
+    std::shuffle(shuffled.begin(), shuffled.end(), random);
+    std::vector<int> bins(n);
+    for(int i = 0; i < n; i++)
+        bins[i] = int(random() % nbins);
+
+    printf("%i elements, %i bins, %i iterations\n", n, nbins, iterations);
+    // Each case is run once before it is timed
+    appendList(n, 1);
+    appendArray(n, 1);
+    report("append", appendList(n, iterations), appendArray(n, iterations), elements);
+    report("read in order", readList(sequential, iterations), readArray(sequential, iterations), elements);
+    report("read randomly", readList(shuffled, iterations), readArray(shuffled, iterations), elements);
+    binList(bins, nbins, 1);
+    binArray(bins, nbins, 1);
+    report("bin and sweep", binList(bins, nbins, iterations), binArray(bins, nbins, iterations), elements);
+    printf("(%lld)\n", checksum);
+    return 0;
+}
@@ -0,0 +1,144 @@
+// A program that makes synthetic star fields with the StarfieldGenerator and saves them as FITS files with their WCS,
+// for testing the star extraction and the plate solving on images whose stars are known.
+// The stars come from an index file around the field center, or are put at random positions, and the stars that
+// were drawn can be saved in a CSV file to compare with the stars that are found.
+//
+// Examples:
+// StarfieldGenerator -o pleiades.fits --index astrometry/index-4107.fits --ra 56.75 --dec 24.12 --scale 3
+// StarfieldGenerator -o dense.fits --width 6248 --height 4176 --bits 8 --stars 20000 --fwhm 5 --truth dense.csv
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QTextStream>
+
+//Includes for this project
+#include "structuredefinitions.h"
+#include "stellarsolver.h"
+#include "starfieldgenerator.h"
+#include "ssolverutils/fileio.h"
+
+//CFitsio Includes
+#include <fitsio.h>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+    QCoreApplication::setApplicationName("StarfieldGenerator");
+    QCoreApplication::setApplicationVersion(StellarSolver::getVersionNumber());
+
+    StarfieldGenerator generator;
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Makes a synthetic star field and saves it as a FITS file with its WCS.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "The FITS file to save.", "file");
+    QCommandLineOption truthOption("truth", "Also save the stars that were drawn in a CSV file.", "file");
+    QCommandLineOption widthOption("width", "The width of the image in pixels.", "pixels", QString::number(generator.width));
+    QCommandLineOption heightOption("height", "The height of the image in pixels.", "pixels", QString::number(generator.height));
+    QCommandLineOption bitsOption("bits", "The data type of the image, 8, 16 or -32 for floating point.", "bits", "16");
+    QCommandLineOption raOption("ra", "The Right Ascension of the center of the field in degrees.", "degrees", QString::number(generator.ra));
+    QCommandLineOption decOption("dec", "The Declination of the center of the field in degrees.", "degrees", QString::number(generator.dec));
+    QCommandLineOption scaleOption("scale", "The pixel scale in arcseconds per pixel.", "arcsec", QString::number(generator.pixelScale));
+    QCommandLineOption orientationOption("orientation", "The orientation of the field in degrees E of N.", "degrees", QString::number(generator.orientation));
+    QCommandLineOption negativeOption("negative-parity", "Make a field with negative parity, like most JPEG images.");
+    QCommandLineOption fwhmOption("fwhm", "The full width at half maximum of the stars in pixels.", "pixels", QString::number(generator.fwhm));
+    QCommandLineOption starsOption("stars", "Add this many stars at random positions.", "count", "0");
+    QCommandLineOption indexOption("index", "Add the stars of this index file that are in the field.", "file");
+    QCommandLineOption maxStarsOption("max-stars", "The most stars to add from the index file, the brightest ones, all of them by default.", "count", "0");
+    QCommandLineOption backgroundOption("background", "The level of the background, as a part of the full range.", "level", QString::number(generator.background));
+    QCommandLineOption noiseOption("noise", "The sigma of the read noise, as a part of the full range.", "level", QString::number(generator.readNoise));
+    QCommandLineOption gainOption("gain", "The electrons for each unit of the image for the photon noise, 0 turns it off.", "gain", QString::number(generator.gain));
+    QCommandLineOption seedOption("seed", "The seed of the random numbers.", "seed", QString::number(generator.seed));
+    parser.addOptions(QList<QCommandLineOption>() << outputOption << truthOption << widthOption << heightOption << bitsOption
+                      << raOption << decOption << scaleOption << orientationOption << negativeOption << fwhmOption << starsOption
+                      << indexOption << maxStarsOption << backgroundOption << noiseOption << gainOption << seedOption);
+    parser.process(app);
+
+    if(!parser.isSet(outputOption))
+    {
+        fprintf(stderr, "Please give the FITS file to save with -o\n");
+        return 1;
+    }
+    if(!parser.isSet(indexOption) && parser.value(starsOption).toInt() <= 0)
+    {
+        fprintf(stderr, "Please give an index file with --index or a number of random stars with --stars\n");
+        return 1;
+    }
+
+    generator.width = parser.value(widthOption).toUShort();
+    generator.height = parser.value(heightOption).toUShort();
+    const int bits = parser.value(bitsOption).toInt();
+    if(bits == 8)
+        generator.dataType = TBYTE;
+    else if(bits == 16)
+        generator.dataType = TUSHORT;
+    else if(bits == -32)
+        generator.dataType = TFLOAT;
+    else
+    {
+        fprintf(stderr, "The data type has to be 8, 16 or -32\n");
+        return 1;
+    }
+    generator.ra = parser.value(raOption).toDouble();
+    generator.dec = parser.value(decOption).toDouble();
+    generator.pixelScale = parser.value(scaleOption).toDouble();
+    generator.orientation = parser.value(orientationOption).toDouble();
+    generator.parity = parser.isSet(negativeOption) ? FITSImage::NEGATIVE : FITSImage::POSITIVE;
+    generator.fwhm = parser.value(fwhmOption).toDouble();
+    generator.background = parser.value(backgroundOption).toDouble();
+    generator.readNoise = parser.value(noiseOption).toDouble();
+    generator.gain = parser.value(gainOption).toDouble();
+    generator.seed = parser.value(seedOption).toUInt();
+    if(generator.width == 0 || generator.height == 0 || generator.pixelScale <= 0 || generator.fwhm <= 0)
+    {
+        fprintf(stderr, "The size of the image, the pixel scale and the FWHM have to be more than 0\n");
+        return 1;
+    }
+
+    if(parser.isSet(indexOption))
+    {
+        const int added = generator.addIndexStars(parser.value(indexOption), parser.value(maxStarsOption).toInt());
+        if(added < 0)
+        {
+            fprintf(stderr, "Unable to read the index file %s\n", parser.value(indexOption).toUtf8().data());
+            return 1;
+        }
+        fprintf(stderr, "Added %d stars from the index file\n", added);
+    }
+    generator.addRandomStars(parser.value(starsOption).toInt());
+
+    FITSImage::Statistic stats;
+    uint8_t *buffer = generator.render(stats);
+    const WCSData wcs = generator.getWCSData();
+    QList<fileio::Record> records;
+    fileio imageSaver;
+    const bool saved = imageSaver.saveAsFITS(parser.value(outputOption), stats, buffer, generator.getSolution(), records, true, &wcs);
+    delete[] buffer;
+    if(!saved)
+    {
+        fprintf(stderr, "Unable to save %s\n", parser.value(outputOption).toUtf8().data());
+        return 1;
+    }
+    fprintf(stderr, "Saved %s with %d stars\n", parser.value(outputOption).toUtf8().data(), generator.getStars().count());
+
+    if(parser.isSet(truthOption))
+    {
+        QFile file(parser.value(truthOption));
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        {
+            fprintf(stderr, "Unable to write the stars to %s\n", file.fileName().toUtf8().data());
+            return 1;
+        }
+        QTextStream out(&file);
+        out << "x,y,ra,dec,mag,peak,flux,hfr\n";
+        for(const FITSImage::Star &star : generator.getStars())
+            out << star.x << "," << star.y << "," << QString::number(star.ra, 'f', 6) << "," << QString::number(star.dec, 'f', 6) << ","
+                << star.mag << "," << star.peak << "," << star.flux << "," << star.HFR << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,520 @@
+// A benchmark of the star extraction, the HFR measurement and the plate solving, for tracking how fast they are between versions.
+// It runs each of them with each built in profile over a corpus of synthetic frames of several sizes, bit depths, star densities
+// and star sizes, which are the same every time since they are made from a fixed seed, and of real images, and reports the throughput,
+// the median and 99th percentile latencies and the peak memory of each case in JSON.  The synthetic frames come from the
+// StarfieldGenerator, so the report also has how many of the drawn stars each extraction found.  When the index files have an
+// index-4107.fits, there are synthetic frames of its stars around the Pleiades too, which are solved.  With --sweep, it runs
+// the extraction over a range of thresholds and minimum areas instead, to compare the completeness with the runtime.
+//
+// Build with:
+// mkdir build
+// cd build
+// cmake -DCMAKE_BUILD_TYPE=RelWithDebInfo -DBUILD_BENCHMARKS=ON ..
+// make -j 4
+//
+// Examples:
+// StellarSolverBenchmark -o results.json
+// StellarSolverBenchmark --iterations 20 --profiles 4,5 --no-solve
+// StellarSolverBenchmark -I /usr/share/astrometry myimage.fits
+// StellarSolverBenchmark --sweep --iterations 3
+// StellarSolverBenchmark --warmup 0 --iterations 1 --index-hints   (the page faults of the first solve, to compare with a run without the hints)
+// StellarSolverBenchmark --hardware-events --profiles 4   (the cycles, instructions and cache and branch misses of the stages, on Linux)
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+//Includes for this project
+#include "structuredefinitions.h"
+#include "stellarsolver.h"
+#include "starfieldgenerator.h"
+#include "tracer.h"
+#include "indexcatalog.h"
+#include "ssolverutils/fileio.h"
+
+//CFitsio Includes
+#include <fitsio.h>
+
+// This is one image of the corpus
+struct Frame
+{
+    QString name;
+    QString kind;                       // synthetic or real
+    FITSImage::Statistic stats;
+    uint8_t *buffer { nullptr };
+    bool synthetic { false };
+    bool solvable { true };             // The synthetic frames of random stars can't be solved, so they are only used for the star extraction
+    QList<FITSImage::Star> truth;       // The stars drawn in a synthetic frame
+    double fwhm { 0 };                  // Their full width at half maximum in pixels
+};
+
+// The peak resident memory of the process so far in bytes, or -1 if it is not known.
+// It never goes down, so for each case it is the most the process used up to the end of that case.
+static qint64 peakRSS()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return -1;
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#if defined(__APPLE__)
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024LL;
+#endif
+#endif
+}
+
+// The nearest rank percentile of the sorted values
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if(sorted.empty())
+        return 0;
+    const size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+static QString dataTypeName(int dataType)
+{
+    switch(dataType)
+    {
+        case TBYTE:
+            return "8bit";
+        case TUSHORT:
+            return "16bit";
+        case TFLOAT:
+            return "float";
+        default:
+            return QString::number(dataType);
+    }
+}
+
+// This makes a synthetic frame with the generator, the random numbers come from its seed, so the frames are the same every time.
+static Frame makeSyntheticFrame(const StarfieldGenerator &generator, const QString &name)
+{
+    Frame frame;
+    frame.synthetic = true;
+    frame.kind = "synthetic";
+    frame.truth = generator.getStars();
+    frame.fwhm = generator.fwhm;
+    frame.name = QString("synthetic_%1x%2_%3_%4").arg(generator.width).arg(generator.height).arg(dataTypeName(generator.dataType)).arg(name);
+    frame.buffer = generator.render(frame.stats);
+    return frame;
+}
+
+static bool loadRealFrame(const QString &fileName, Frame &frame)
+{
+    fileio imageLoader;
+    imageLoader.generatePreview = false;
+    if(!imageLoader.loadImage(fileName))
+        return false;
+    frame.kind = "real";
+    frame.name = QFileInfo(fileName).fileName();
+    frame.stats = imageLoader.getStats();
+    frame.buffer = imageLoader.getImageBuffer();
+    return true;
+}
+
+// How many levels of the code trees --index-hints reads ahead, about the top thousand nodes
+static const int INDEX_HINT_LEVELS = 10;
+
+// This runs one operation with one profile on one frame for the warm up runs and then the timed ones, with the same StellarSolver,
+// so that the index files and the buffers are already loaded like when a program solves one image after the other.
+static QJsonObject runCase(const Frame &frame, const SSolver::Parameters &profile, int profileNumber, ProcessType operation,
+                           const QStringList &indexFolders, int warmup, int iterations, bool indexHints = false,
+                           bool hardwareEvents = false)
+{
+    StellarSolver solver(frame.stats, frame.buffer);
+    solver.setParameters(profile);
+    solver.setIndexFolderPaths(indexFolders);
+    if(indexHints)
+    {
+        QSharedPointer<IndexCatalog> catalog(new IndexCatalog());
+        catalog->setHugePages(true);
+        catalog->setPrefetchLevels(INDEX_HINT_LEVELS);
+        solver.setIndexCatalog(catalog);
+    }
+    solver.setSSLogLevel(SSolver::LOG_OFF);
+    solver.setCountHardwareEvents(hardwareEvents);
+    // The parallel solves pick the same range every run, so the runs and the reports of two builds can be compared
+    solver.setDeterministicParallelSolve(true);
+
+    std::vector<double> latencies;
+    QList<FITSImage::SolveMetrics> metrics;
+    int succeeded = 0, stars = 0;
+    QElapsedTimer total;
+    for(int i = 0; i < warmup + iterations; i++)
+    {
+        if(i == warmup)
+            total.start();
+        QElapsedTimer timer;
+        timer.start();
+        bool success = false;
+        if(operation == SOLVE)
+            success = solver.solve();
+        else
+            success = solver.extract(operation == EXTRACT_WITH_HFR);
+        const double latency = timer.nsecsElapsed() / 1e6;
+        if(i < warmup)
+            continue;
+        latencies.push_back(latency);
+        metrics.append(solver.getSolveMetrics());
+        if(success)
+            succeeded++;
+        stars = operation == SOLVE ? solver.getStarListFromSolve().count() : solver.getStarList().count();
+    }
+    // A found star is the drawn one if it is within a FWHM of it
+    const double completeness = frame.synthetic && operation != SOLVE ?
+                                StarfieldGenerator::completeness(frame.truth, solver.getStarList(), frame.fwhm) : 0;
+    const double seconds = total.nsecsElapsed() / 1e9;
+    std::sort(latencies.begin(), latencies.end());
+
+    // The medians of the stages show which one changed when the latency did
+    auto medianOf = [&metrics](double FITSImage::SolveMetrics::*stage)
+    {
+        std::vector<double> values;
+        for(const FITSImage::SolveMetrics &oneMetrics : metrics)
+            values.push_back(oneMetrics.*stage);
+        std::sort(values.begin(), values.end());
+        return percentile(values, 0.5);
+    };
+    QJsonObject stages;
+    stages["prepareMs"] = medianOf(&FITSImage::SolveMetrics::prepareMs);
+    stages["backgroundMs"] = medianOf(&FITSImage::SolveMetrics::backgroundMs);
+    stages["detectionMs"] = medianOf(&FITSImage::SolveMetrics::detectionMs);
+    stages["deblendMs"] = medianOf(&FITSImage::SolveMetrics::deblendMs);
+    stages["photometryMs"] = medianOf(&FITSImage::SolveMetrics::photometryMs);
+    stages["filterMs"] = medianOf(&FITSImage::SolveMetrics::filterMs);
+    if(operation == SOLVE)
+    {
+        stages["indexLoadMs"] = medianOf(&FITSImage::SolveMetrics::indexLoadMs);
+        stages["searchMs"] = medianOf(&FITSImage::SolveMetrics::searchMs);
+        stages["verifyMs"] = medianOf(&FITSImage::SolveMetrics::verifyMs);
+        stages["tweakMs"] = medianOf(&FITSImage::SolveMetrics::tweakMs);
+    }
+    // The medians of the hardware events of the stages, with the instructions per cycle, which are low when a stage waits for memory
+    auto medianCountersOf = [&metrics](FITSImage::HardwareCounters FITSImage::SolveMetrics::*stage)
+    {
+        QJsonObject counters;
+        auto medianEvent = [&](uint64_t FITSImage::HardwareCounters::*event)
+        {
+            std::vector<double> values;
+            for(const FITSImage::SolveMetrics &oneMetrics : metrics)
+                values.push_back(static_cast<double>((oneMetrics.*stage).*event));
+            std::sort(values.begin(), values.end());
+            return percentile(values, 0.5);
+        };
+        const double cycles = medianEvent(&FITSImage::HardwareCounters::cycles);
+        const double instructions = medianEvent(&FITSImage::HardwareCounters::instructions);
+        counters["cycles"] = cycles;
+        counters["instructions"] = instructions;
+        counters["cacheMisses"] = medianEvent(&FITSImage::HardwareCounters::cacheMisses);
+        counters["branchMisses"] = medianEvent(&FITSImage::HardwareCounters::branchMisses);
+        counters["instructionsPerCycle"] = cycles > 0 ? instructions / cycles : 0;
+        return counters;
+    };
+    QJsonObject hardwareEventsP50;
+    if(!metrics.isEmpty() && metrics.last().hardwareCounted)
+    {
+        hardwareEventsP50["extraction"] = medianCountersOf(&FITSImage::SolveMetrics::extractionCounters);
+        if(operation == SOLVE)
+        {
+            hardwareEventsP50["search"] = medianCountersOf(&FITSImage::SolveMetrics::searchCounters);
+            hardwareEventsP50["verify"] = medianCountersOf(&FITSImage::SolveMetrics::verifyCounters);
+        }
+    }
+    // The page faults of the searches are added up, since only the first one usually has any
+    int minorPageFaults = 0, majorPageFaults = 0;
+    for(const FITSImage::SolveMetrics &oneMetrics : metrics)
+    {
+        minorPageFaults += oneMetrics.minorPageFaults;
+        majorPageFaults += oneMetrics.majorPageFaults;
+    }
+
+    const double megapixels = frame.stats.width * static_cast<double>(frame.stats.height) / 1e6;
+    QJsonObject result;
+    result["frame"] = frame.name;
+    result["kind"] = frame.kind;
+    result["width"] = frame.stats.width;
+    result["height"] = frame.stats.height;
+    result["channels"] = frame.stats.channels;
+    result["dataType"] = dataTypeName(frame.stats.dataType);
+    if(!metrics.isEmpty())
+    {
+        result["extractionSimd"] = metrics.last().extractionSimd;
+        if(operation == SOLVE)
+            result["solverSimd"] = metrics.last().solverSimd;
+    }
+    if(frame.synthetic)
+    {
+        result["starsDrawn"] = frame.truth.count();
+        result["fwhm"] = frame.fwhm;
+        if(operation != SOLVE)
+            result["completeness"] = completeness;
+    }
+    result["operation"] = operation == SOLVE ? "solve" : operation == EXTRACT_WITH_HFR ? "hfr" : "extract";
+    result["profile"] = profile.listName;
+    result["profileNumber"] = profileNumber;
+    result["iterations"] = iterations;
+    result["succeeded"] = succeeded;
+    result["starsFound"] = stars;
+    result["framesPerSecond"] = seconds > 0 ? iterations / seconds : 0;
+    result["megapixelsPerSecond"] = seconds > 0 ? iterations * megapixels / seconds : 0;
+    result["p50Ms"] = percentile(latencies, 0.5);
+    result["p99Ms"] = percentile(latencies, 0.99);
+    result["minMs"] = latencies.empty() ? 0 : latencies.front();
+    result["maxMs"] = latencies.empty() ? 0 : latencies.back();
+    result["stagesP50"] = stages;
+    if(!hardwareEventsP50.isEmpty())
+        result["hardwareEventsP50"] = hardwareEventsP50;
+    if(operation == SOLVE)
+    {
+        result["indexHints"] = indexHints;
+        result["minorPageFaults"] = minorPageFaults;
+        result["majorPageFaults"] = majorPageFaults;
+    }
+    result["peakRSSBytes"] = peakRSS();
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+    QCoreApplication::setApplicationName("StellarSolverBenchmark");
+    QCoreApplication::setApplicationVersion(StellarSolver::getVersionNumber());
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks the star extraction, the HFR and the plate solving with each built in profile "
+                                     "over synthetic frames and real images, and reports the results in JSON.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("images", "The real images to benchmark, pleiades.jpg and randomsky.fits by default.", "[images...]");
+    QCommandLineOption indexOption(QStringList() << "I" << "index", "Add a directory of index files for the solves, astrometry by default.", "directory");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Write the JSON report to a file instead of the standard output.", "file");
+    QCommandLineOption iterationsOption("iterations", "How many timed runs there are of each case, 10 by default.", "count", "10");
+    QCommandLineOption warmupOption("warmup", "How many runs of each case there are before the timed ones, 1 by default.", "count", "1");
+    QCommandLineOption profilesOption("profiles", "The numbers of the built in profiles to run, separated by commas, all of them by default.", "profiles");
+    QCommandLineOption noSyntheticOption("no-synthetic", "Leave out the synthetic frames.");
+    QCommandLineOption noSolveOption("no-solve", "Leave out the plate solves.");
+    QCommandLineOption quickOption("quick", "Only use the smallest synthetic frames.");
+    QCommandLineOption sweepOption("sweep", "Instead of the corpus, run the extraction of a synthetic frame over a range of thresholds and minimum "
+                                   "areas, to compare the completeness with the runtime.");
+    QCommandLineOption indexHintsOption("index-hints", "Ask for huge pages for the indexes of the solves and read the top levels of their code trees "
+                                        "ahead when they are loaded.");
+    QCommandLineOption traceOption("trace", "Also record a trace of the runs and write it to a Chrome trace file.", "file");
+    QCommandLineOption hardwareEventsOption("hardware-events", "Also report the medians of the CPU cycles, instructions, cache misses and branch misses "
+                                            "of the stages, on Linux.");
+    parser.addOptions(QList<QCommandLineOption>() << indexOption << outputOption << iterationsOption << warmupOption << profilesOption
+                      << noSyntheticOption << noSolveOption << quickOption << sweepOption << indexHintsOption << traceOption
+                      << hardwareEventsOption);
+    parser.process(app);
+    if(parser.isSet(traceOption))
+        Tracer::setEnabled(true);
+    if(parser.isSet(hardwareEventsOption) && !StellarSolver::hardwareEventsAvailable())
+        fprintf(stderr, "The hardware events can't be counted on this system, so they are left out\n");
+
+    const int iterations = std::max(1, parser.value(iterationsOption).toInt());
+    const int warmup = std::max(0, parser.value(warmupOption).toInt());
+    QStringList indexFolders = parser.values(indexOption);
+    if(indexFolders.isEmpty())
+        indexFolders << "astrometry";
+
+    const QList<SSolver::Parameters> profiles = StellarSolver::getBuiltInProfiles();
+    QList<int> profileNumbers;
+    if(parser.isSet(profilesOption))
+    {
+        for(const QString &number : parser.value(profilesOption).split(','))
+        {
+            bool ok = false;
+            const int profileNumber = number.trimmed().toInt(&ok);
+            if(ok && profileNumber >= 0 && profileNumber < profiles.count())
+                profileNumbers.append(profileNumber);
+        }
+    }
+    else
+    {
+        for(int i = 0; i < profiles.count(); i++)
+            profileNumbers.append(i);
+    }
+
+    QJsonArray cases;
+    auto benchmarkFrame = [&](const Frame &frame)
+    {
+        for(int profileNumber : qAsConst(profileNumbers))
+        {
+            QList<ProcessType> operations = QList<ProcessType>() << EXTRACT << EXTRACT_WITH_HFR;
+            if(frame.solvable && !parser.isSet(noSolveOption))
+                operations << SOLVE;
+            for(ProcessType operation : operations)
+            {
+                fprintf(stderr, "%s, %s, %s\n", frame.name.toUtf8().data(), profiles.at(profileNumber).listName.toUtf8().data(),
+                        operation == SOLVE ? "solve" : operation == EXTRACT_WITH_HFR ? "hfr" : "extract");
+                cases.append(runCase(frame, profiles.at(profileNumber), profileNumber, operation, indexFolders, warmup, iterations,
+                                     parser.isSet(indexHintsOption), parser.isSet(hardwareEventsOption)));
+            }
+        }
+    };
+
+    // The index file of the solvable synthetic frames, its stars are used around the Pleiades like in pleiades.jpg
+    QString fieldIndex;
+    for(const QString &folder : qAsConst(indexFolders))
+    {
+        if(QFile::exists(QDir(folder).filePath("index-4107.fits")))
+        {
+            fieldIndex = QDir(folder).filePath("index-4107.fits");
+            break;
+        }
+    }
+
+    if(parser.isSet(sweepOption))
+    {
+        // The thresholds and minimum areas are swept around the ones of the default profile, on a dense frame of faint soft stars
+        StarfieldGenerator generator;
+        generator.width = 3008;
+        generator.height = 2008;
+        generator.fwhm = 4;
+        generator.addRandomStars(5000);
+        const Frame frame = makeSyntheticFrame(generator, "sweep");
+        for(double threshold : QList<double>() << 1.0 << 1.5 << 2.0 << 3.0 << 4.0)
+        {
+            for(double minarea : QList<double>() << 3 << 5 << 10 << 20)
+            {
+                SSolver::Parameters parameters = profiles.at(0);
+                parameters.threshold_bg_multiple = threshold;
+                parameters.minarea = minarea;
+                fprintf(stderr, "%s, threshold %g, minarea %g\n", frame.name.toUtf8().data(), threshold, minarea);
+                QJsonObject result = runCase(frame, parameters, 0, EXTRACT, indexFolders, warmup, iterations);
+                result["threshold_bg_multiple"] = threshold;
+                result["minarea"] = minarea;
+                cases.append(result);
+            }
+        }
+        delete[] frame.buffer;
+    }
+
+    // The corpus: the sizes of small guide cameras up to big main cameras, in the usual bit depths, with sparse and dense fields
+    // of sharp and soft stars.  Each frame is only made when it is benchmarked, since the big ones take hundreds of megabytes.
+    if(!parser.isSet(noSyntheticOption) && !parser.isSet(sweepOption))
+    {
+        QList<QPair<int, int>> sizes = QList<QPair<int, int>>() << qMakePair(1280, 960) << qMakePair(3008, 2008) << qMakePair(6248, 4176);
+        if(parser.isSet(quickOption))
+            sizes = sizes.mid(0, 1);
+        unsigned int seed = 1;
+        for(const auto &size : qAsConst(sizes))
+        {
+            for(int dataType : QList<int>() << TBYTE << TUSHORT << TFLOAT)
+            {
+                for(int density : QList<int>() << 200 << 2000)
+                {
+                    for(double fwhm : QList<double>() << 2.5 << 6.0)
+                    {
+                        // The density is for the smallest frame, the bigger ones have as many stars for each pixel
+                        const int stars = static_cast<int>(density * (size.first * static_cast<double>(size.second)) / (1280 * 960));
+                        StarfieldGenerator generator;
+                        generator.width = size.first;
+                        generator.height = size.second;
+                        generator.dataType = dataType;
+                        generator.fwhm = fwhm;
+                        generator.seed = seed++;
+                        generator.addRandomStars(stars);
+                        Frame frame = makeSyntheticFrame(generator, QString("%1stars_fwhm%2").arg(stars).arg(fwhm));
+                        frame.solvable = false;
+                        benchmarkFrame(frame);
+                        delete[] frame.buffer;
+                    }
+                }
+            }
+        }
+
+        // The fields of the index stars, one for each size, at about the scale of the index so they solve with it alone
+        if(!fieldIndex.isEmpty())
+        {
+            for(const auto &size : qAsConst(sizes))
+            {
+                StarfieldGenerator generator;
+                generator.width = size.first;
+                generator.height = size.second;
+                generator.ra = 56.75;
+                generator.dec = 24.12;
+                generator.pixelScale = 3600.0 / size.first;
+                generator.orientation = 30;
+                generator.seed = seed++;
+                if(generator.addIndexStars(fieldIndex) <= 0)
+                    continue;
+                Frame frame = makeSyntheticFrame(generator, "pleiades");
+                benchmarkFrame(frame);
+                delete[] frame.buffer;
+            }
+        }
+    }
+
+    QStringList imageFiles = parser.positionalArguments();
+    if(parser.isSet(sweepOption))
+        imageFiles.clear();
+    else if(imageFiles.isEmpty())
+        imageFiles << "pleiades.jpg" << "randomsky.fits";
+    for(const QString &fileName : qAsConst(imageFiles))
+    {
+        Frame frame;
+        if(!loadRealFrame(fileName, frame))
+        {
+            fprintf(stderr, "Unable to load %s, it is left out of the benchmark\n", fileName.toUtf8().data());
+            continue;
+        }
+        benchmarkFrame(frame);
+        fileio::releaseImageBuffer(frame.buffer);
+    }
+
+    QJsonObject report;
+    report["version"] = StellarSolver::getVersionNumber();
+    report["date"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report["threads"] = QThread::idealThreadCount();
+    report["iterations"] = iterations;
+    report["warmup"] = warmup;
+    report["cases"] = cases;
+    const QByteArray json = QJsonDocument(report).toJson();
+
+    if(parser.isSet(traceOption) && !Tracer::writeChromeTrace(parser.value(traceOption)))
+        fprintf(stderr, "Unable to write the trace to %s\n", parser.value(traceOption).toUtf8().data());
+
+    if(parser.isSet(outputOption))
+    {
+        QFile file(parser.value(outputOption));
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            fprintf(stderr, "Unable to write the report to %s\n", file.fileName().toUtf8().data());
+            return 1;
+        }
+        file.write(json);
+    }
+    else
+        fwrite(json.constData(), 1, json.size(), stdout);
+    return 0;
+}
@@ -0,0 +1,364 @@
+/*  pystellarsolver, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+// These are the Python bindings of StellarSolver.  An image is any object with the buffer protocol, like a NumPy array, and it is
+// processed where it is, with its strides, instead of being written to a FITS file first.  The star lists come back as NumPy arrays.
+//
+//     import numpy, pystellarsolver
+//     solver = pystellarsolver.Solver()
+//     solver.load_image(frame)            # a 2D array, or 3D with the colors first (planes) or last (interleaved)
+//     solver.set_index_folder_paths(paths)
+//     if solver.solve():
+//         print(solver.solution())
+//     stars = solver.stars()              # a structured array with the fields of FITSImage::Star
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include <memory>
+#include <vector>
+
+//QT Includes
+#include <QCoreApplication>
+
+#include <fitsio.h>
+
+#include "stellarsolver.h"
+#include "starcatalog.h"
+
+namespace py = pybind11;
+
+PYBIND11_NUMPY_DTYPE(FITSImage::Star, x, y, mag, flux, peak, HFR, a, b, theta, ra, dec, numPixels);
+
+namespace
+{
+
+// The synchronous extract and solve wait in an event loop, which needs an application.  A Python process doesn't have one.
+void ensureApplication()
+{
+    static int argc = 1;
+    static char name[] = "pystellarsolver";
+    static char *argv[] = { name, nullptr };
+    if(!QCoreApplication::instance())
+        new QCoreApplication(argc, argv);
+}
+
+// The FITS data type of the NumPy dtype, or 0 if the library can't process it
+int fitsDataType(const py::dtype &dtype)
+{
+    const char kind = dtype.kind();
+    const py::ssize_t size = dtype.itemsize();
+    if(kind == 'u' && size == 1)
+        return TBYTE;
+    if(kind == 'i' && size == 2)
+        return TSHORT;
+    if(kind == 'u' && size == 2)
+        return TUSHORT;
+    if(kind == 'i' && size == 4)
+        return TLONG;
+    if(kind == 'u' && size == 4)
+        return TULONG;
+    if(kind == 'i' && size == 8)
+        return TLONGLONG;
+    if(kind == 'f' && size == 4)
+        return TFLOAT;
+    if(kind == 'f' && size == 8)
+        return TDOUBLE;
+    return 0;
+}
+
+// This describes the layout of the array as an image view, if it has one the library can read.  Three dimensions are
+// (height, width, 3) with interleaved colors, or (3, height, width) with the colors in planes.
+bool describeLayout(const py::array &array, FITSImage::Statistic &stats, FITSImage::ImageView &view)
+{
+    const py::ssize_t item = array.itemsize();
+    for(py::ssize_t d = 0; d < array.ndim(); d++)
+        if(array.strides(d) < 0 || array.strides(d) % item != 0)
+            return false;
+
+    py::ssize_t width, height;
+    if(array.ndim() == 2 && array.strides(1) == item)
+    {
+        height = array.shape(0);
+        width = array.shape(1);
+        stats.channels = 1;
+        view.rowStride = array.strides(0) / item;
+    }
+    else if(array.ndim() == 3 && array.shape(2) == 3 && array.strides(2) == item && array.strides(1) == 3 * item)
+    {
+        height = array.shape(0);
+        width = array.shape(1);
+        stats.channels = 3;
+        view.interleaved = true;
+        view.rowStride = array.strides(0) / item;
+    }
+    else if(array.ndim() == 3 && array.shape(0) == 3 && array.strides(2) == item)
+    {
+        height = array.shape(1);
+        width = array.shape(2);
+        stats.channels = 3;
+        view.rowStride = array.strides(1) / item;
+        view.channelStride = array.strides(0) / item;
+    }
+    else
+        return false;
+
+    if(width > 65535 || height > 65535)
+        throw py::value_error("The image is too big, the width and the height can be at most 65535 pixels");
+    stats.width = width;
+    stats.height = height;
+    stats.samples_per_channel = width * height;
+    stats.ndim = stats.channels == 1 ? 2 : 3;
+    stats.size = static_cast<int64_t>(width) * height * stats.channels * item;
+    return true;
+}
+
+// This hands the column to NumPy without copying it, the capsule keeps the catalog alive as long as the array is
+template <typename T>
+py::array column(const T *data, int count, const py::capsule &owner)
+{
+    py::array_t<T> array(count, data, owner);
+    array.attr("flags").attr("writeable") = false;
+    return array;
+}
+
+py::object toPython(const QVariant &value)
+{
+    switch(static_cast<QMetaType::Type>(value.type()))
+    {
+        case QMetaType::Bool:
+            return py::bool_(value.toBool());
+        case QMetaType::Int:
+        case QMetaType::UInt:
+        case QMetaType::LongLong:
+        case QMetaType::ULongLong:
+            return py::int_(value.toLongLong());
+        case QMetaType::Double:
+        case QMetaType::Float:
+            return py::float_(value.toDouble());
+        default:
+            return py::str(value.toString().toStdString());
+    }
+}
+
+QVariant fromPython(const py::handle &value)
+{
+    // bool is a subclass of int in Python, so it is checked first
+    if(py::isinstance<py::bool_>(value))
+        return value.cast<bool>();
+    if(py::isinstance<py::int_>(value))
+        return value.cast<qlonglong>();
+    if(py::isinstance<py::float_>(value))
+        return value.cast<double>();
+    return QString::fromStdString(py::str(value).cast<std::string>());
+}
+
+/**
+ * @brief The Solver class is a StellarSolver for Python.  It keeps a reference to the image it was given, since the StellarSolver
+ * reads the pixels where they are until the next image is loaded.  extract and solve let other Python threads run while they work.
+ */
+class Solver
+{
+    public:
+        Solver()
+        {
+            ensureApplication();
+            m_Solver.reset(new StellarSolver());
+        }
+
+        bool loadImage(py::array array)
+        {
+            // The pixels have to be in the byte order of the machine, FITS files from astropy are big endian
+            if(!array.dtype().attr("isnative").cast<bool>())
+                array = array.attr("astype")(array.dtype().attr("newbyteorder")("="));
+            const int dataType = fitsDataType(array.dtype());
+            if(dataType == 0)
+                throw py::type_error("The image has to have 8, 16, 32 or 64 bit integer or 32 or 64 bit float pixels");
+
+            FITSImage::Statistic stats;
+            FITSImage::ImageView view;
+            if(!describeLayout(array, stats, view))
+            {
+                // The strides of this view can't be described to the library, so it gets a packed copy
+                array = py::module::import("numpy").attr("ascontiguousarray")(array);
+                stats = FITSImage::Statistic();
+                view = FITSImage::ImageView();
+                if(!describeLayout(array, stats, view))
+                    throw py::value_error("The image has to be 2D, or 3D with 3 colors first or last");
+            }
+            stats.dataType = dataType;
+            stats.bytesPerPixel = array.itemsize();
+
+            m_Image = array;
+            return m_Solver->loadNewImageView(stats, view, static_cast<const uint8_t *>(array.data()));
+        }
+
+        void setParameters(const py::dict &settings)
+        {
+            QMap<QString, QVariant> map = SSolver::Parameters::convertToMap(m_Solver->getCurrentParameters());
+            for(auto item : settings)
+                map[QString::fromStdString(py::str(item.first).cast<std::string>())] = fromPython(item.second);
+            m_Solver->setParameters(SSolver::Parameters::convertFromMap(map));
+        }
+
+        py::dict parameters() const
+        {
+            py::dict settings;
+            const QMap<QString, QVariant> map = SSolver::Parameters::convertToMap(m_Solver->getCurrentParameters());
+            for(auto it = map.constBegin(); it != map.constEnd(); ++it)
+                settings[py::str(it.key().toStdString())] = toPython(it.value());
+            return settings;
+        }
+
+        void setIndexFolderPaths(const std::vector<std::string> &paths)
+        {
+            QStringList list;
+            for(const std::string &path : paths)
+                list.append(QString::fromStdString(path));
+            m_Solver->setIndexFolderPaths(list);
+        }
+
+        void setSearchScale(double low, double high, const std::string &units)
+        {
+            m_Solver->setSearchScale(low, high, QString::fromStdString(units));
+        }
+
+        void setSearchPosition(double ra, double dec)
+        {
+            m_Solver->setSearchPositionInDegrees(ra, dec);
+        }
+
+        bool extract(bool calculateHFR)
+        {
+            checkImage();
+            py::gil_scoped_release release;
+            return m_Solver->extract(calculateHFR);
+        }
+
+        bool solve()
+        {
+            checkImage();
+            py::gil_scoped_release release;
+            return m_Solver->solve();
+        }
+
+        py::array stars() const
+        {
+            return starArray(m_Solver->getStarList());
+        }
+
+        py::array solverStars() const
+        {
+            return starArray(m_Solver->getStarListFromSolve());
+        }
+
+        // The columns of the star list, as arrays that are views of one StarCatalog
+        py::dict starCatalog() const
+        {
+            StarCatalog *catalog = new StarCatalog(m_Solver->getStarCatalog());
+            py::capsule owner(catalog, [](void *p)
+            {
+                delete static_cast<StarCatalog *>(p);
+            });
+            const int count = catalog->count();
+            py::dict columns;
+            columns["x"] = column(catalog->x(), count, owner);
+            columns["y"] = column(catalog->y(), count, owner);
+            columns["mag"] = column(catalog->mag(), count, owner);
+            columns["flux"] = column(catalog->flux(), count, owner);
+            columns["peak"] = column(catalog->peak(), count, owner);
+            columns["HFR"] = column(catalog->HFR(), count, owner);
+            columns["a"] = column(catalog->a(), count, owner);
+            columns["b"] = column(catalog->b(), count, owner);
+            columns["theta"] = column(catalog->theta(), count, owner);
+            columns["ra"] = column(catalog->ra(), count, owner);
+            columns["dec"] = column(catalog->dec(), count, owner);
+            columns["numPixels"] = column(catalog->numPixels(), count, owner);
+            return columns;
+        }
+
+        py::object solution() const
+        {
+            if(!m_Solver->solvingDone() || m_Solver->failed())
+                return py::none();
+            const FITSImage::Solution &solution = m_Solver->getSolution();
+            py::dict result;
+            result["ra"] = solution.ra;
+            result["dec"] = solution.dec;
+            result["fieldWidth"] = solution.fieldWidth;
+            result["fieldHeight"] = solution.fieldHeight;
+            result["orientation"] = solution.orientation;
+            result["pixscale"] = solution.pixscale;
+            result["parity"] = FITSImage::getShortParityText(solution.parity).toStdString();
+            result["raError"] = solution.raError;
+            result["decError"] = solution.decError;
+            result["logOdds"] = m_Solver->getSolutionLogOdds();
+            return result;
+        }
+
+        py::tuple pixelsToWCS(py::array_t<double, py::array::c_style | py::array::forcecast> x,
+                              py::array_t<double, py::array::c_style | py::array::forcecast> y)
+        {
+            if(x.size() != y.size())
+                throw py::value_error("x and y need the same number of points");
+            if(!m_Solver->hasWCSData())
+                throw py::value_error("There is no WCS, the image has to be solved first");
+            const int count = static_cast<int>(x.size());
+            py::array_t<double> ra(count), dec(count);
+            WCSData wcs = m_Solver->getWCSData();
+            if(!wcs.pixelsToWCS(x.data(), y.data(), ra.mutable_data(), dec.mutable_data(), count))
+                throw py::value_error("The points could not be converted");
+            return py::make_tuple(ra, dec);
+        }
+
+    private:
+        void checkImage() const
+        {
+            if(m_Image.is_none())
+                throw py::value_error("No image was loaded, see load_image");
+        }
+
+        // The QList keeps each star by itself, so they are copied once into a contiguous array of FITSImage::Star records
+        static py::array starArray(const QList<FITSImage::Star> &stars)
+        {
+            py::array_t<FITSImage::Star> array(stars.size());
+            FITSImage::Star *records = array.mutable_data();
+            for(int i = 0; i < stars.size(); i++)
+                records[i] = stars.at(i);
+            return array;
+        }
+
+        std::unique_ptr<StellarSolver> m_Solver;
+        py::object m_Image = py::none();
+};
+
+}  // namespace
+
+PYBIND11_MODULE(pystellarsolver, m)
+{
+    m.doc() = "StellarSolver star extraction and plate solving of NumPy images";
+
+    py::class_<Solver>(m, "Solver")
+    .def(py::init<>())
+    .def("load_image", &Solver::loadImage, py::arg("image"),
+         "Loads an image from an object with the buffer protocol, without copying it when the library can read its strides")
+    .def("set_parameters", &Solver::setParameters, py::arg("settings"),
+         "Changes the parameters with the same names as in Parameters::convertToMap")
+    .def("parameters", &Solver::parameters)
+    .def("set_index_folder_paths", &Solver::setIndexFolderPaths, py::arg("paths"))
+    .def("set_search_scale", &Solver::setSearchScale, py::arg("low"), py::arg("high"), py::arg("units") = "app")
+    .def("set_search_position", &Solver::setSearchPosition, py::arg("ra"), py::arg("dec"))
+    .def("extract", &Solver::extract, py::arg("calculate_hfr") = false)
+    .def("solve", &Solver::solve)
+    .def("stars", &Solver::stars, "The stars of the last extraction as a structured array")
+    .def("solver_stars", &Solver::solverStars, "The stars the last solve used as a structured array")
+    .def("star_catalog", &Solver::starCatalog, "The stars of the last extraction as a dict of read only column arrays")
+    .def("solution", &Solver::solution, "The solution of the last solve as a dict, or None")
+    .def("pixels_to_wcs", &Solver::pixelsToWCS, py::arg("x"), py::arg("y"));
+}
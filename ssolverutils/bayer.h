@@ -275,6 +275,18 @@ dc1394error_t dc1394_bayer_decoding_8bit(const uint8_t *bayer, uint8_t *rgb, uin
 dc1394error_t dc1394_bayer_decoding_16bit(const uint16_t *bayer, uint16_t *rgb, uint32_t width, uint32_t height,
         dc1394color_filter_t tile, dc1394bayer_method_t method, uint32_t bits);
 
+/**
+ * Make the luminance of the rows first_row to last_row - 1 of a bayered 8-bit image, without an RGB image
+ */
+dc1394error_t dc1394_bayer_luminance_8bit(const uint8_t *bayer, uint8_t *lum, uint32_t width, uint32_t height,
+        uint32_t first_row, uint32_t last_row);
+
+/**
+ * Make the luminance of the rows first_row to last_row - 1 of a bayered 16-bit image, without an RGB image
+ */
+dc1394error_t dc1394_bayer_luminance_16bit(const uint16_t *bayer, uint16_t *lum, uint32_t width, uint32_t height,
+        uint32_t first_row, uint32_t last_row);
+
 /* Bayer to RGBX */
 dc1394error_t dc1394_bayer16_RGBX_NearestNeighbor(const uint16_t *bayer, uint16_t *rgbx, int sx, int sy, int tile);
 #ifdef __cplusplus
@@ -1,5 +1,28 @@
 #include "fileio.h"
+#include "imagestatistics.h"
 #include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QtEndian>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <climits>
+#include <cstring>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// These are the image buffers that were mapped from the files by mapFitsData, so that they get unmapped instead of deleted
+struct MappedBuffer
+{
+    void *mapping;      // The start of the mapping, on the page before the pixels
+    size_t length;      // The length of the mapping
+};
+static QHash<uint8_t *, MappedBuffer> mappedBuffers;
+static QMutex mappedBuffersMutex;
 
 
 fileio::fileio()
@@ -11,6 +34,9 @@ fileio::fileio()
 
 fileio::~fileio()
 {
+    closeFitsStream();
+    if(!imageBufferTaken)
+        m_RefinedImage.waitForFinished();
     if(m_ImageBuffer && !imageBufferTaken)
         deleteImageBuffer();
 }
@@ -19,21 +45,43 @@ void fileio::deleteImageBuffer()
 {
     if(m_ImageBuffer)
     {
-        delete[] m_ImageBuffer;
+        m_RefinedImage.waitForFinished();
+        releaseImageBuffer(m_ImageBuffer);
         m_ImageBuffer = nullptr;
     }
 }
 
+void fileio::releaseImageBuffer(uint8_t *buffer)
+{
+    if(!buffer)
+        return;
+#ifndef _WIN32
+    {
+        QMutexLocker locker(&mappedBuffersMutex);
+        auto mapped = mappedBuffers.find(buffer);
+        if(mapped != mappedBuffers.end())
+        {
+            munmap(mapped.value().mapping, mapped.value().length);
+            mappedBuffers.erase(mapped);
+            return;
+        }
+    }
+#endif
+    delete[] buffer;
+}
+
 bool fileio::loadImage(QString fileName)
 {
     justLoadBuffer = false;
     QFileInfo newFileInfo(fileName);
     bool success = false;
-    if(newFileInfo.suffix() == "fits" || newFileInfo.suffix() == "fit")
+    if(newFileInfo.suffix() == "fits" || newFileInfo.suffix() == "fit" || newFileInfo.suffix() == "fz")
         success = loadFits(fileName);
     else
         success = loadOtherFormat(fileName);
     if(success)
+        ImageStatistics::calculate(stats, m_ImageBuffer);
+    if(success && generatePreview)
         generateQImage();
     return success;
 }
@@ -43,20 +91,23 @@ bool fileio::loadImageBufferOnly(QString fileName)
     justLoadBuffer = true;
     QFileInfo newFileInfo(fileName);
     bool success = false;
-    if(newFileInfo.suffix() == "fits" || newFileInfo.suffix() == "fit")
+    if(newFileInfo.suffix() == "fits" || newFileInfo.suffix() == "fit" || newFileInfo.suffix() == "fz")
         success = loadFits(fileName);
     else
         success = loadOtherFormat(fileName);
+    if(success)
+        ImageStatistics::calculate(stats, m_ImageBuffer);
 
     return success;
 }
 
 //This method was copied and pasted and modified from the method privateLoad in fitsdata in KStars
-//It loads a FITS file, reads the FITS Headers, and loads the data from the image
-bool fileio::loadFits(QString fileName)
-{   
+//It opens a FITS file and reads the information about the image, the file is left open for reading the data
+//The image is in the HDU given, or else in the primary HDU or the first extension
+bool fileio::openFits(QString fileName, int hdu)
+{
     file = fileName;
-    int status = 0, anynullptr = 0;
+    int status = 0;
     long naxes[3];
 
     // Use open diskfile as it does not use extended file names which has problems opening
@@ -69,12 +120,23 @@ bool fileio::loadFits(QString fileName)
     else
         stats.size = QFile(file).size();
 
-    if (fits_movabs_hdu(fptr, 1, IMAGE_HDU, &status))
+    int hduType = IMAGE_HDU;
+    if (fits_movabs_hdu(fptr, hdu > 0 ? hdu : 1, &hduType, &status) || hduType != IMAGE_HDU)
+    {
+        logIssue(QString("Could not locate image HDU."));
+        fits_close_file(fptr, &status);
+        return false;
+    }
+
+    // The tile compressed images made by fpack are in the first extension, after an empty primary HDU
+    if (hdu <= 0 && fits_get_img_dim(fptr, &(stats.ndim), &status) == 0 && stats.ndim == 0 &&
+            (fits_movabs_hdu(fptr, 2, &hduType, &status) || hduType != IMAGE_HDU))
     {
         logIssue(QString("Could not locate image HDU."));
         fits_close_file(fptr, &status);
         return false;
     }
+    fits_get_hdu_num(fptr, &m_HDU);
 
     int fitsBitPix = 0;
     if (fits_get_img_param(fptr, 3, &fitsBitPix, &(stats.ndim), naxes, &status))
@@ -144,23 +206,366 @@ bool fileio::loadFits(QString fileName)
     stats.width               = static_cast<uint16_t>(naxes[0]);
     stats.height              = static_cast<uint16_t>(naxes[1]);
     stats.channels            = static_cast<uint8_t>(naxes[2]);
-    stats.samples_per_channel = stats.width * stats.height;
+    stats.samples_per_channel = static_cast<uint32_t>(stats.width) * stats.height;
+
+    return true;
+}
+
+// This converts the pixels of a FITS file to the ones fits_read_img would give, in place and in one pass.
+// The pixels in the file are big endian, the ones decoded from compressed tiles are already in the byte order of the computer.
+// The unsigned images are stored as signed numbers with an offset of BZERO, which flipping the sign bit takes off,
+// and the signed integer images are read as unsigned ones, so their negative pixels become 0 like CFITSIO clips them.
+enum SignConversion { KEEP_SIGN, FLIP_SIGN, CLIP_NEGATIVE };
+
+template <typename T>
+static void convertFitsPixels(T *pixels, size_t n, SignConversion sign, bool bigEndian = true)
+{
+    const T signBit = static_cast<T>(T(1) << (sizeof(T) * 8 - 1));
+    for (size_t i = 0; i < n; i++)
+    {
+        T value = bigEndian ? qFromBigEndian(pixels[i]) : pixels[i];
+        if (sign == FLIP_SIGN)
+            value ^= signBit;
+        else if (sign == CLIP_NEGATIVE && (value & signBit))
+            value = 0;
+        pixels[i] = value;
+    }
+}
+
+//This maps the pixels of an uncompressed FITS image straight from the file instead of reading them into a new buffer with CFITSIO.
+//The mapping is private, so the pages stay shared with the file cache until they are written, and the pixels are converted in place.
+//The pixels that need no conversion, like the ones of 8 bit images, are never copied, so their file must not be truncated while the buffer is used.
+//It returns false if the image has to be read with CFITSIO, for instance because it is compressed or scaled.
+bool fileio::mapFitsData()
+{
+#ifdef _WIN32
+    return false;
+#else
+    int status = 0;
+    if (fits_is_compressed_image(fptr, &status) || status)
+        return false;
+
+    // Only the scaling that the conversion below does can be mapped
+    int bitpix = 0;
+    double bscale = 1, bzero = 0;
+    fits_get_img_type(fptr, &bitpix, &status);
+    if (fits_read_key_dbl(fptr, "BSCALE", &bscale, nullptr, &status) == KEY_NO_EXIST)
+        status = 0;
+    if (fits_read_key_dbl(fptr, "BZERO", &bzero, nullptr, &status) == KEY_NO_EXIST)
+        status = 0;
+    if (status || bscale != 1)
+        return false;
+    bool flipSign = false;
+    switch (bitpix)
+    {
+        case BYTE_IMG:
+        case LONGLONG_IMG:
+        case FLOAT_IMG:
+        case DOUBLE_IMG:
+            if (bzero != 0)
+                return false;
+            break;
+        case SHORT_IMG:
+            flipSign = bzero == 32768.0;
+            if (!flipSign && bzero != 0)
+                return false;
+            break;
+        case LONG_IMG:
+            flipSign = bzero == 2147483648.0;
+            if (!flipSign && bzero != 0)
+                return false;
+            break;
+        default:
+            return false;
+    }
+
+    LONGLONG headStart = 0, dataStart = 0, dataEnd = 0;
+    if (fits_get_hduaddrll(fptr, &headStart, &dataStart, &dataEnd, &status) || dataStart + m_ImageBufferSize > stats.size)
+        return false;
+
+    // The mapping has to start on a page, the data starts on a block of 2880 bytes
+    const int fd = open(file.toLocal8Bit().constData(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    const off_t pageOffset = dataStart - dataStart % sysconf(_SC_PAGESIZE);
+    const size_t length = static_cast<size_t>(dataStart - pageOffset) + m_ImageBufferSize;
+    void *mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, pageOffset);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+    uint8_t *pixels = static_cast<uint8_t *>(mapping) + (dataStart - pageOffset);
+
+    // The floating point and 64 bit pixels only need to be swapped, which big endian computers don't have to do
+    const size_t n = static_cast<size_t>(stats.samples_per_channel) * stats.channels;
+    const SignConversion sign = flipSign ? FLIP_SIGN : CLIP_NEGATIVE;
+    const bool swap = QSysInfo::ByteOrder == QSysInfo::LittleEndian;
+    switch (bitpix)
+    {
+        case SHORT_IMG:
+            convertFitsPixels(reinterpret_cast<uint16_t *>(pixels), n, sign);
+            break;
+        case LONG_IMG:
+            convertFitsPixels(reinterpret_cast<uint32_t *>(pixels), n, sign);
+            break;
+        case FLOAT_IMG:
+            if (swap)
+                convertFitsPixels(reinterpret_cast<uint32_t *>(pixels), n, KEEP_SIGN);
+            break;
+        case LONGLONG_IMG:
+        case DOUBLE_IMG:
+            if (swap)
+                convertFitsPixels(reinterpret_cast<uint64_t *>(pixels), n, KEEP_SIGN);
+            break;
+        default:
+            break;
+    }
+
+    // The start of the pixels is what is handed out, so that is what gets looked up to unmap the pages in releaseImageBuffer
+    {
+        QMutexLocker locker(&mappedBuffersMutex);
+        mappedBuffers.insert(pixels, MappedBuffer { mapping, length });
+    }
+    m_ImageBuffer = pixels;
+    return true;
+#endif
+}
+
+// These are the Rice decoders of CFITSIO, which fitsio.h doesn't declare
+extern "C" {
+    int fits_rdecomp(unsigned char *c, int clen, unsigned int array[], int nx, int nblock);
+    int fits_rdecomp_short(unsigned char *c, int clen, unsigned short array[], int nx, int nblock);
+    int fits_rdecomp_byte(unsigned char *c, int clen, unsigned char array[], int nx, int nblock);
+}
+
+//CFITSIO decompresses the tiles of a compressed image one after the other, which is most of the time it takes to load the big images of an archive.
+//This reads the compressed bytes of all the tiles with CFITSIO, since it can't be used by several threads at once,
+//and then decodes the tiles straight into the image buffer in several threads.
+//It only decodes Rice compressed integer images whose tiles are whole rows, which is what fpack makes by default.
+//It returns false if the image has to be decompressed by CFITSIO.
+bool fileio::readRiceTiles()
+{
+    int status = 0;
+    const int threads = decompressionThreads > 0 ? decompressionThreads : QThread::idealThreadCount();
+    if (threads < 2 || !fits_is_compressed_image(fptr, &status) || status)
+        return false;
+
+    int compressionType = 0;
+    if (fits_get_compression_type(fptr, &compressionType, &status) || compressionType != RICE_1)
+        return false;
+
+    // These are in the header of the table the tiles are in
+    int zbitpix = 0;
+    long tileWidth = stats.width, tileRows = 1, tileChannels = 1;
+    double bscale = 1, bzero = 0;
+    int blockSize = 32, bytePix = 4;
+    if (fits_read_key(fptr, TINT, "ZBITPIX", &zbitpix, nullptr, &status))
+        return false;
+    fits_read_key(fptr, TLONG, "ZTILE1", &tileWidth, nullptr, &status);
+    fits_read_key(fptr, TLONG, "ZTILE2", &tileRows, nullptr, &status);
+    fits_read_key(fptr, TLONG, "ZTILE3", &tileChannels, nullptr, &status);
+    fits_read_key(fptr, TDOUBLE, "BSCALE", &bscale, nullptr, &status);
+    fits_read_key(fptr, TDOUBLE, "BZERO", &bzero, nullptr, &status);
+    status = 0;
+    for (int i = 1; ; i++)
+    {
+        char name[FLEN_VALUE];
+        int value = 0;
+        if (fits_read_key(fptr, TSTRING, QString("ZNAME%1").arg(i).toLatin1().constData(), name, nullptr, &status) ||
+                fits_read_key(fptr, TINT, QString("ZVAL%1").arg(i).toLatin1().constData(), &value, nullptr, &status))
+            break;
+        if (QString(name).trimmed().toUpper() == "BLOCKSIZE")
+            blockSize = value;
+        else if (QString(name).trimmed().toUpper() == "BYTEPIX")
+            bytePix = value;
+    }
+    status = 0;
+
+    bool flipSign = false;
+    if (zbitpix == BYTE_IMG)
+        flipSign = false;
+    else if (zbitpix == SHORT_IMG)
+        flipSign = bzero == 32768.0;
+    else if (zbitpix == LONG_IMG)
+        flipSign = bzero == 2147483648.0;
+    else
+        return false;
+    if (bscale != 1 || (bzero != 0 && !flipSign) || bytePix != zbitpix / 8 || bytePix != stats.bytesPerPixel ||
+            tileWidth != stats.width || tileRows < 1 || tileChannels != 1)
+        return false;
+
+    // The tiles that are scaled, or that could not be compressed and were stored as they are, are in other columns
+    int column = 0, otherColumn = 0;
+    if (fits_get_colnum(fptr, CASEINSEN, const_cast<char *>("COMPRESSED_DATA"), &column, &status))
+        return false;
+    for (const char *otherName : { "ZSCALE", "ZZERO", "UNCOMPRESSED_DATA", "GZIP_COMPRESSED_DATA" })
+    {
+        if (fits_get_colnum(fptr, CASEINSEN, const_cast<char *>(otherName), &otherColumn, &status) == 0)
+            return false;
+        status = 0;
+    }
+
+    // The tiles go through the rows of the first channel, then the ones of the next, and there is a row of the table for each
+    const long tilesPerChannel = (stats.height + tileRows - 1) / tileRows;
+    const long tiles = tilesPerChannel * stats.channels;
+    LONGLONG tableRows = 0;
+    if (fits_get_num_rowsll(fptr, &tableRows, &status) || tableRows != tiles)
+        return false;
+
+    QVector<LONGLONG> tileOffsets(tiles + 1);
+    for (long tile = 0; tile < tiles; tile++)
+    {
+        LONGLONG length = 0, heapOffset = 0;
+        if (fits_read_descriptll(fptr, column, tile + 1, &length, &heapOffset, &status) || length == 0 || length > INT_MAX)
+            return false;
+        tileOffsets[tile + 1] = tileOffsets[tile] + length;
+    }
+    QByteArray compressed;
+    compressed.resize(tileOffsets[tiles]);
+    for (long tile = 0; tile < tiles; tile++)
+    {
+        int anynull = 0;
+        if (fits_read_col(fptr, TBYTE, column, tile + 1, 1, tileOffsets[tile + 1] - tileOffsets[tile], nullptr,
+                          compressed.data() + tileOffsets[tile], &anynull, &status))
+            return false;
+    }
+
+    auto decodeTiles = [&](long firstTile, long lastTile)
+    {
+        for (long tile = firstTile; tile < lastTile; tile++)
+        {
+            const long channel = tile / tilesPerChannel;
+            const long firstRow = (tile % tilesPerChannel) * tileRows;
+            const int pixels = static_cast<int>(qMin(tileRows, static_cast<long>(stats.height) - firstRow) * stats.width);
+            uint8_t *destination = m_ImageBuffer + (static_cast<size_t>(channel) * stats.samples_per_channel + static_cast<size_t>(firstRow) *
+                                   stats.width) * stats.bytesPerPixel;
+            unsigned char *source = reinterpret_cast<unsigned char *>(compressed.data() + tileOffsets[tile]);
+            const int length = static_cast<int>(tileOffsets[tile + 1] - tileOffsets[tile]);
+            int failed = 0;
+            switch (bytePix)
+            {
+                case 1:
+                    failed = fits_rdecomp_byte(source, length, destination, pixels, blockSize);
+                    break;
+                case 2:
+                    failed = fits_rdecomp_short(source, length, reinterpret_cast<unsigned short *>(destination), pixels, blockSize);
+                    if (!failed)
+                        convertFitsPixels(reinterpret_cast<uint16_t *>(destination), pixels, flipSign ? FLIP_SIGN : CLIP_NEGATIVE, false);
+                    break;
+                default:
+                    failed = fits_rdecomp(source, length, reinterpret_cast<unsigned int *>(destination), pixels, blockSize);
+                    if (!failed)
+                        convertFitsPixels(reinterpret_cast<uint32_t *>(destination), pixels, flipSign ? FLIP_SIGN : CLIP_NEGATIVE, false);
+                    break;
+            }
+            if (failed)
+                return false;
+        }
+        return true;
+    };
+
+    // The first tile is decoded before the threads start, since older versions of CFITSIO set up the tables of the decoder the first time it is used
+    if (!decodeTiles(0, 1))
+        return false;
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    QList<QFuture<bool>> bands;
+    const long tilesPerThread = (tiles - 1 + threads - 1) / threads;
+    for (long firstTile = 1; firstTile < tiles; firstTile += tilesPerThread)
+        bands.append(QtConcurrent::run(&pool, decodeTiles, firstTile, qMin(tiles, firstTile + tilesPerThread)));
+    bool success = true;
+    for (auto &band : bands)
+        success = band.result() && success;
+    if (!success)
+        logIssue("Error decoding the compressed tiles of the image, trying CFITSIO.");
+    return success;
+}
+
+//This loads a FITS file, reads the FITS Headers, and loads the data from the image
+bool fileio::loadFits(QString fileName)
+{
+    int status = 0, anynullptr = 0;
+    if (!openFits(fileName))
+        return false;
 
-    m_ImageBufferSize = stats.samples_per_channel * stats.channels * static_cast<uint16_t>(stats.bytesPerPixel);
+    m_ImageBufferSize = static_cast<size_t>(stats.samples_per_channel) * stats.channels * stats.bytesPerPixel;
     deleteImageBuffer();
-    m_ImageBuffer = new uint8_t[m_ImageBufferSize];
-    if (m_ImageBuffer == nullptr)
+    if (!useMemoryMapping || !mapFitsData())
     {
-        logIssue(QString("FITSData: Not enough memory for image_buffer channel. Requested: %1 bytes ").arg(m_ImageBufferSize));
+        m_ImageBuffer = new uint8_t[m_ImageBufferSize];
+        if (m_ImageBuffer == nullptr)
+        {
+            logIssue(QString("FITSData: Not enough memory for image_buffer channel. Requested: %1 bytes ").arg(m_ImageBufferSize));
+            fits_close_file(fptr, &status);
+            return false;
+        }
+
+        long nelements = static_cast<long>(stats.samples_per_channel) * stats.channels;
+
+        if (!readRiceTiles() && fits_read_img(fptr, static_cast<uint16_t>(stats.dataType), 1, nelements, nullptr, m_ImageBuffer, &anynullptr, &status))
+        {
+            logIssue("Error reading image.");
+            fits_close_file(fptr, &status);
+            return false;
+        }
+    }
+
+    if( !justLoadBuffer )
+    {
+        if(checkDebayer())
+            debayer();
+
+        getSolverOptionsFromFITS();
+
+        parseHeader();
+    }
+    else if(debayerToLuminance && checkDebayer())
+        debayerLuminance();
+
+    fits_close_file(fptr, &status);
+
+    return true;
+}
+
+//This loads only a subframe of a FITS file, for instance the box around a guide star or a focus star in a big image.
+//CFITSIO reads just the rows and columns of the subframe, or only the tiles it is in for a compressed image.
+//The statistics are the ones of the subframe, and their offsets are where it is in the file, so that the positions of
+//the stars found in it can be put back in the coordinates of the whole image, see StellarSolver::getStarListInFile.
+bool fileio::loadFitsSubframe(QString fileName, QRect frame)
+{
+    int status = 0, anynullptr = 0;
+    if (!openFits(fileName))
+        return false;
+
+    // The subframe starts on an even pixel of a bayered image, so that it has the bayer pattern of the file
+    char bayerPattern[FLEN_VALUE];
+    if (fits_read_keyword(fptr, "BAYERPAT", bayerPattern, nullptr, &status) == 0)
+        frame.setTopLeft(QPoint(frame.left() & ~1, frame.top() & ~1));
+    status = 0;
+
+    frame = frame.intersected(QRect(0, 0, stats.width, stats.height));
+    if (frame.isEmpty())
+    {
+        logIssue(QString("The subframe is not in the %1x%2 image.").arg(stats.width).arg(stats.height));
         fits_close_file(fptr, &status);
         return false;
     }
 
-    long nelements = stats.samples_per_channel * stats.channels;
+    stats.xOffset             = static_cast<uint16_t>(frame.x());
+    stats.yOffset             = static_cast<uint16_t>(frame.y());
+    stats.width               = static_cast<uint16_t>(frame.width());
+    stats.height              = static_cast<uint16_t>(frame.height());
+    stats.samples_per_channel = static_cast<uint32_t>(stats.width) * stats.height;
 
-    if (fits_read_img(fptr, static_cast<uint16_t>(stats.dataType), 1, nelements, nullptr, m_ImageBuffer, &anynullptr, &status))
+    m_ImageBufferSize = static_cast<size_t>(stats.samples_per_channel) * stats.channels * stats.bytesPerPixel;
+    deleteImageBuffer();
+    m_ImageBuffer = new uint8_t[m_ImageBufferSize];
+
+    long firstPixel[3] = {frame.left() + 1, frame.top() + 1, 1};
+    long lastPixel[3] = {frame.right() + 1, frame.bottom() + 1, stats.channels};
+    long increment[3] = {1, 1, 1};
+    if (fits_read_subset(fptr, static_cast<uint16_t>(stats.dataType), firstPixel, lastPixel, increment, nullptr, m_ImageBuffer, &anynullptr, &status))
     {
-        logIssue("Error reading image.");
+        logIssue("Error reading the subframe of the image.");
         fits_close_file(fptr, &status);
         return false;
     }
@@ -174,15 +579,199 @@ bool fileio::loadFits(QString fileName)
 
         parseHeader();
     }
+    else if(debayerToLuminance && checkDebayer())
+        debayerLuminance();
 
     fits_close_file(fptr, &status);
+    ImageStatistics::calculate(stats, m_ImageBuffer);
 
     return true;
 }
 
+QList<fileio::Plane> fileio::listFitsPlanes(const QString &fileName)
+{
+    QList<Plane> planes;
+    int status = 0, hdus = 0;
+    fitsfile *file = nullptr;
+    if (fits_open_diskfile(&file, fileName.toLocal8Bit(), READONLY, &status))
+        return planes;
+    fits_get_num_hdus(file, &hdus, &status);
+    for (int hdu = 1; hdu <= hdus && status == 0; hdu++)
+    {
+        // CFITSIO shows the tile compressed images as image HDUs, the other tables are left out
+        int hduType = 0, bitpix = 0, naxis = 0;
+        long naxes[3] = {0, 0, 1};
+        if (fits_movabs_hdu(file, hdu, &hduType, &status) || hduType != IMAGE_HDU)
+            continue;
+        if (fits_get_img_param(file, 3, &bitpix, &naxis, naxes, &status) || naxis < 2 || naxes[0] == 0 || naxes[1] == 0)
+        {
+            status = 0;
+            continue;
+        }
+        const long depth = naxis >= 3 ? naxes[2] : 1;
+        for (long plane = 0; plane < depth; plane++)
+            planes.append(Plane { hdu, static_cast<int>(plane) });
+    }
+    status = 0;
+    fits_close_file(file, &status);
+    return planes;
+}
+
+//This loads one plane of an image HDU, for instance one frame of a data cube, which CFITSIO reads on its own from the file
+bool fileio::loadFitsPlane(QString fileName, int hdu, int plane)
+{
+    int status = 0, anynullptr = 0;
+    if (!openFits(fileName, hdu))
+        return false;
+
+    long naxes[3] = {0, 0, 1};
+    int naxis = 0;
+    fits_get_img_dim(fptr, &naxis, &status);
+    fits_get_img_size(fptr, 3, naxes, &status);
+    const long depth = naxis >= 3 ? naxes[2] : 1;
+    if (status || plane < 0 || plane >= depth)
+    {
+        logIssue(QString("The HDU %1 has no plane %2.").arg(hdu).arg(plane));
+        fits_close_file(fptr, &status);
+        return false;
+    }
+
+    stats.channels            = 1;
+    stats.ndim                = 2;
+    m_ImageBufferSize = static_cast<size_t>(stats.samples_per_channel) * stats.bytesPerPixel;
+    deleteImageBuffer();
+    m_ImageBuffer = new uint8_t[m_ImageBufferSize];
+
+    long firstPixel[3] = {1, 1, plane + 1};
+    if (fits_read_pix(fptr, static_cast<uint16_t>(stats.dataType), firstPixel, stats.samples_per_channel, nullptr, m_ImageBuffer,
+                      &anynullptr, &status))
+    {
+        logIssue(QString("Error reading the plane %1 of the HDU %2.").arg(plane).arg(hdu));
+        fits_close_file(fptr, &status);
+        return false;
+    }
+
+    if( !justLoadBuffer )
+    {
+        getSolverOptionsFromFITS();
+        parseHeader();
+    }
+
+    fits_close_file(fptr, &status);
+    ImageStatistics::calculate(stats, m_ImageBuffer);
+
+    return true;
+}
+
+//This loads a FITS file without its data, which is read a few rows at a time with the row reader, see getRowReader.
+//It is for images that are too big to load.  Bayered images are not debayered, since that needs the whole image.
+bool fileio::loadFitsStream(QString fileName)
+{
+    closeFitsStream();
+
+    if (!openFits(fileName))
+        return false;
+    // This opens and closes the file by itself, in the HDU openFits found
+    getSolverOptionsFromFITS();
+    parseHeader();
+
+    m_Streaming = true;
+    return true;
+}
+
+FITSImage::RowReader fileio::getRowReader()
+{
+    return [this](int channel, uint32_t firstRow, uint32_t rows, uint8_t *buffer)
+    {
+        if (!m_Streaming)
+            return false;
+        int status = 0, anynullptr = 0;
+        long firstPixel[3] = {1, static_cast<long>(firstRow) + 1, channel + 1};
+        const long nelements = static_cast<long>(stats.width) * rows;
+        if (fits_read_pix(fptr, static_cast<uint16_t>(stats.dataType), firstPixel, nelements, nullptr, buffer, &anynullptr, &status))
+        {
+            logIssue(QString("Error reading the rows %1 to %2 of the image.").arg(firstRow).arg(firstRow + rows - 1));
+            return false;
+        }
+        return true;
+    };
+}
+
+void fileio::closeFitsStream()
+{
+    if (!m_Streaming)
+        return;
+    int status = 0;
+    fits_close_file(fptr, &status);
+    fptr = nullptr;
+    m_Streaming = false;
+}
+
 //This method I wrote combining code from the fits loading method above, the fits debayering method below, and QT
 //I also consulted the ImageToFITS method in fitsdata in KStars
 //The goal of this method is to load the data from a file that is not FITS format
+//Qt loads the 16 bit PNG and TIFF images as Grayscale16 or RGBA64 images since Qt 5.12 and 5.13.  This copies their
+//pixels straight into a planar TUSHORT buffer, instead of converting them to RGB32, which would lose their precision.
+//It returns false for the other images, which are loaded as 8 bit ones.
+bool fileio::load16BitImage(QImage &image)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    bool mono = false;
+    switch (image.format())
+    {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+        case QImage::Format_Grayscale16:
+            mono = true;
+            break;
+#endif
+        case QImage::Format_RGBX64:
+        case QImage::Format_RGBA64:
+            break;
+        case QImage::Format_RGBA64_Premultiplied:
+            image = image.convertToFormat(QImage::Format_RGBA64);
+            break;
+        default:
+            return false;
+    }
+
+    stats.dataType = TUSHORT;
+    stats.bytesPerPixel = sizeof(uint16_t);
+    stats.width = static_cast<uint16_t>(image.width());
+    stats.height = static_cast<uint16_t>(image.height());
+    stats.channels = mono ? 1 : 3;
+    stats.ndim = mono ? 2 : 3;
+    stats.samples_per_channel = static_cast<uint32_t>(stats.width) * stats.height;
+    m_ImageBufferSize = static_cast<size_t>(stats.samples_per_channel) * stats.channels * stats.bytesPerPixel;
+    deleteImageBuffer();
+    m_ImageBuffer = new uint8_t[m_ImageBufferSize];
+
+    uint16_t *rBuff = reinterpret_cast<uint16_t *>(m_ImageBuffer);
+    uint16_t *gBuff = rBuff + stats.samples_per_channel;
+    uint16_t *bBuff = gBuff + stats.samples_per_channel;
+    for (int y = 0; y < stats.height; y++)
+    {
+        // The lines of a QImage are padded to 4 bytes, so they are copied one at a time
+        if (mono)
+        {
+            memcpy(rBuff, image.constScanLine(y), stats.width * sizeof(uint16_t));
+            rBuff += stats.width;
+            continue;
+        }
+        const QRgba64 *line = reinterpret_cast<const QRgba64 *>(image.constScanLine(y));
+        for (int x = 0; x < stats.width; x++)
+        {
+            *rBuff++ = line[x].red();
+            *gBuff++ = line[x].green();
+            *bBuff++ = line[x].blue();
+        }
+    }
+    return true;
+#else
+    Q_UNUSED(image);
+    return false;
+#endif
+}
+
 bool fileio::loadOtherFormat(QString fileName)
 {
     file = fileName;
@@ -202,6 +791,9 @@ bool fileio::loadOtherFormat(QString fileName)
         return false;
     }
 
+    if (load16BitImage(imageFromFile))
+        return true;
+
     imageFromFile = imageFromFile.convertToFormat(QImage::Format_RGB32);
 
     int fitsBitPix =
@@ -251,8 +843,8 @@ bool fileio::loadOtherFormat(QString fileName)
     stats.height = static_cast<uint16_t>(imageFromFile.height());
     stats.channels = 3;
     stats.ndim = 3;
-    stats.samples_per_channel = stats.width * stats.height;
-    m_ImageBufferSize = stats.samples_per_channel * stats.channels * static_cast<uint16_t>(stats.bytesPerPixel);
+    stats.samples_per_channel = static_cast<uint32_t>(stats.width) * stats.height;
+    m_ImageBufferSize = static_cast<size_t>(stats.samples_per_channel) * stats.channels * stats.bytesPerPixel;
     deleteImageBuffer();
     m_ImageBuffer = new uint8_t[m_ImageBufferSize];
     if (m_ImageBuffer == nullptr)
@@ -267,11 +859,11 @@ bool fileio::loadOtherFormat(QString fileName)
     // Data in RGB32, with bytes in the order of B,G,R,A, we need to copy them into 3 layers for FITS
 
     uint8_t * rBuff = debayered_buffer;
-    uint8_t * gBuff = debayered_buffer + (stats.width * stats.height);
-    uint8_t * bBuff = debayered_buffer + (stats.width * stats.height * 2);
+    uint8_t * gBuff = debayered_buffer + stats.samples_per_channel;
+    uint8_t * bBuff = debayered_buffer + static_cast<size_t>(stats.samples_per_channel) * 2;
 
-    int imax = stats.samples_per_channel * 4 - 4;
-    for (int i = 0; i <= imax; i += 4)
+    const size_t imax = static_cast<size_t>(stats.samples_per_channel) * 4 - 4;
+    for (size_t i = 0; i <= imax; i += 4)
     {
         *rBuff++ = original_bayered_buffer[i + 2];
         *gBuff++ = original_bayered_buffer[i + 1];
@@ -327,6 +919,9 @@ bool fileio::checkDebayer()
 //It debayers the image using the methods below
 bool fileio::debayer()
 {
+    if (debayerToLuminance)
+        return debayerLuminance();
+
     switch (stats.dataType)
     {
         case SEP_TBYTE:
@@ -340,13 +935,50 @@ bool fileio::debayer()
     }
 }
 
+//This makes a bayered image into one luminance channel of the same data type, in bands of rows in parallel
+//It is what solving and star extraction need, without making the RGB image that would be merged back into one channel
+bool fileio::debayerLuminance()
+{
+    if ((stats.dataType != SEP_TBYTE && stats.dataType != TUSHORT) || stats.channels != 1 || stats.width < 2 || stats.height < 2)
+        return false;
+
+    uint8_t *luminanceBuffer = new uint8_t[m_ImageBufferSize];
+    const int bandCount = qMax(1, qMin(QThread::idealThreadCount(), static_cast<int>(stats.height)));
+    QVector<QPair<uint32_t, uint32_t>> bands;
+    for (int band = 0; band < bandCount; band++)
+        bands.append(qMakePair(static_cast<uint32_t>(stats.height * band / bandCount), static_cast<uint32_t>(stats.height * (band + 1) / bandCount)));
+
+    const QList<dc1394error_t> results = QtConcurrent::blockingMapped<QList<dc1394error_t>>(bands, [this, luminanceBuffer](const QPair<uint32_t, uint32_t> &rows)
+    {
+        if (stats.dataType == SEP_TBYTE)
+            return dc1394_bayer_luminance_8bit(m_ImageBuffer, luminanceBuffer, stats.width, stats.height, rows.first, rows.second);
+        return dc1394_bayer_luminance_16bit(reinterpret_cast<uint16_t *>(m_ImageBuffer), reinterpret_cast<uint16_t *>(luminanceBuffer),
+                                            stats.width, stats.height, rows.first, rows.second);
+    });
+    for (dc1394error_t result : results)
+    {
+        if (result != DC1394_SUCCESS)
+        {
+            logIssue(QString("Debayer failed (%1)").arg(result));
+            delete[] luminanceBuffer;
+            return false;
+        }
+    }
+
+    const size_t size = m_ImageBufferSize;
+    deleteImageBuffer();
+    m_ImageBuffer = luminanceBuffer;
+    m_ImageBufferSize = size;
+    return true;
+}
+
 //This method was copied and pasted from Fitsdata in KStars
 //This method debayers 8 bit images
 bool fileio::debayer_8bit()
 {
     dc1394error_t error_code;
 
-    uint32_t rgb_size = stats.samples_per_channel * 3 * stats.bytesPerPixel;
+    const size_t rgb_size = static_cast<size_t>(stats.samples_per_channel) * 3 * stats.bytesPerPixel;
     auto * destinationBuffer = new uint8_t[rgb_size];
 
     auto * bayer_source_buffer      = reinterpret_cast<uint8_t *>(m_ImageBuffer);
@@ -386,7 +1018,7 @@ bool fileio::debayer_8bit()
 
     if (m_ImageBufferSize != rgb_size)
     {
-        delete[] m_ImageBuffer;
+        deleteImageBuffer();
         m_ImageBuffer = new uint8_t[rgb_size];
 
         if (m_ImageBuffer == nullptr)
@@ -404,11 +1036,11 @@ bool fileio::debayer_8bit()
     // Data in R1G1B1, we need to copy them into 3 layers for FITS
 
     uint8_t * rBuff = bayered_buffer;
-    uint8_t * gBuff = bayered_buffer + (stats.width * stats.height);
-    uint8_t * bBuff = bayered_buffer + (stats.width * stats.height * 2);
+    uint8_t * gBuff = bayered_buffer + stats.samples_per_channel;
+    uint8_t * bBuff = bayered_buffer + static_cast<size_t>(stats.samples_per_channel) * 2;
 
-    int imax = stats.samples_per_channel * 3 - 3;
-    for (int i = 0; i <= imax; i += 3)
+    const size_t imax = static_cast<size_t>(stats.samples_per_channel) * 3 - 3;
+    for (size_t i = 0; i <= imax; i += 3)
     {
         *rBuff++ = bayer_destination_buffer[i];
         *gBuff++ = bayer_destination_buffer[i + 1];
@@ -425,7 +1057,7 @@ bool fileio::debayer_16bit()
 {
     dc1394error_t error_code;
 
-    uint32_t rgb_size = stats.samples_per_channel * 3 * stats.bytesPerPixel;
+    const size_t rgb_size = static_cast<size_t>(stats.samples_per_channel) * 3 * stats.bytesPerPixel;
     auto * destinationBuffer = new uint8_t[rgb_size];
 
     auto * bayer_source_buffer      = reinterpret_cast<uint16_t *>(m_ImageBuffer);
@@ -465,7 +1097,7 @@ bool fileio::debayer_16bit()
 
     if (m_ImageBufferSize != rgb_size)
     {
-        delete[] m_ImageBuffer;
+        deleteImageBuffer();
         m_ImageBuffer = new uint8_t[rgb_size];
 
         if (m_ImageBuffer == nullptr)
@@ -483,11 +1115,11 @@ bool fileio::debayer_16bit()
     // Data in R1G1B1, we need to copy them into 3 layers for FITS
 
     uint16_t * rBuff = bayered_buffer;
-    uint16_t * gBuff = bayered_buffer + (stats.width * stats.height);
-    uint16_t * bBuff = bayered_buffer + (stats.width * stats.height * 2);
+    uint16_t * gBuff = bayered_buffer + stats.samples_per_channel;
+    uint16_t * bBuff = bayered_buffer + static_cast<size_t>(stats.samples_per_channel) * 2;
 
-    int imax = stats.samples_per_channel * 3 - 3;
-    for (int i = 0; i <= imax; i += 3)
+    const size_t imax = static_cast<size_t>(stats.samples_per_channel) * 3 - 3;
+    for (size_t i = 0; i <= imax; i += 3)
     {
         *rBuff++ = bayer_destination_buffer[i];
         *gBuff++ = bayer_destination_buffer[i + 1];
@@ -523,7 +1155,7 @@ bool fileio::getSolverOptionsFromFITS()
     }
 
     status = 0;
-    if (fits_movabs_hdu(fptr, 1, IMAGE_HDU, &status))
+    if (fits_movabs_hdu(fptr, m_HDU, nullptr, &status))
     {
         fits_report_error(stderr, status);
         fits_get_errstatus(status, error_status);
@@ -532,8 +1164,11 @@ bool fileio::getSolverOptionsFromFITS()
         return false;
     }
 
+    // The header of a tile compressed image is the one of the table the tiles are in, with the size of the image in ZNAXIS1 and ZNAXIS2
+    const bool compressed = fits_is_compressed_image(fptr, &status);
+
     status = 0;
-    if (fits_read_key(fptr, TINT, "NAXIS1", &fits_ccd_width, comment, &status))
+    if (fits_read_key(fptr, TINT, compressed ? "ZNAXIS1" : "NAXIS1", &fits_ccd_width, comment, &status))
     {
         fits_report_error(stderr, status);
         fits_get_errstatus(status, error_status);
@@ -543,7 +1178,7 @@ bool fileio::getSolverOptionsFromFITS()
     }
 
     status = 0;
-    if (fits_read_key(fptr, TINT, "NAXIS2", &fits_ccd_height, comment, &status))
+    if (fits_read_key(fptr, TINT, compressed ? "ZNAXIS2" : "NAXIS2", &fits_ccd_height, comment, &status))
     {
         fits_report_error(stderr, status);
         fits_get_errstatus(status, error_status);
@@ -748,7 +1383,7 @@ bool fileio::parseHeader()
 }
 
 //This was copied and pasted and modified from ImageToFITS and injectWCS in fitsdata in KStars
-bool fileio::saveAsFITS(QString fileName, FITSImage::Statistic &imageStats, uint8_t *imageBuffer, FITSImage::Solution solution, QList<Record> &records, bool hasSolution)
+bool fileio::saveAsFITS(QString fileName, FITSImage::Statistic &imageStats, uint8_t *imageBuffer, FITSImage::Solution solution, QList<Record> &records, bool hasSolution, const WCSData *wcs)
 {
     int status = 0;
     fitsfile * new_fptr;
@@ -776,7 +1411,7 @@ bool fileio::saveAsFITS(QString fileName, FITSImage::Statistic &imageStats, uint
     if(newFileInfo.exists())
         QFile(fileName).remove();
 
-    nelements = imageStats.samples_per_channel * channels;
+    nelements = static_cast<long>(imageStats.samples_per_channel) * channels;
 
     /* Create a new File, overwriting existing*/
     if (fits_create_file(&new_fptr, fileName.toLocal8Bit(), &status))
@@ -915,72 +1550,259 @@ bool fileio::saveAsFITS(QString fileName, FITSImage::Statistic &imageStats, uint
     }
 
     if(hasSolution)
+        writeSolutionKeys(fptr, imageStats.width, imageStats.height, solution, wcs, status);
+
+    // ISO Date
+    if (fits_write_date(fptr, &status))
     {
+        fits_report_error(stderr, status);
+        return false;
+    }
 
-        fits_update_key(fptr, TDOUBLE, "OBJCTRA", &solution.ra, "Object RA", &status);
-        fits_update_key(fptr, TDOUBLE, "OBJCTDEC", &solution.dec, "Object DEC", &status);
+    fits_flush_file(fptr, &status);
 
-        int epoch = 2000;
+    if(fits_close_file(fptr, &status))
+    {
+        emit logOutput(QString("Error closing file."));
+        return false;
+    }
 
-        fits_update_key(fptr, TINT, "EQUINOX", &epoch, "Equinox", &status);
+    emit logOutput("Saved FITS file:" + fileName);
 
-        fits_update_key(fptr, TDOUBLE, "CRVAL1", &solution.ra, "CRVAL1", &status);
-        fits_update_key(fptr, TDOUBLE, "CRVAL2", &solution.dec, "CRVAL1", &status);
+    return true;
+}
+
+//This writes the keywords of a plate solution, which saveAsFITS, stampSolution and saveWCSFile all use
+//With the WCS of the internal solver, the CD matrix and the SIP distortion are written instead of CDELT and CROTA
+void fileio::writeSolutionKeys(fitsfile *file, long width, long height, FITSImage::Solution &solution, const WCSData *wcs, int &status)
+{
+    sip_t sip;
+    if (wcs && wcs->getSIP(sip))
+    {
+        writeSIPKeys(file, width, height, solution, sip, status);
+        return;
+    }
+
+    fits_update_key(file, TDOUBLE, "OBJCTRA", &solution.ra, "Object RA", &status);
+    fits_update_key(file, TDOUBLE, "OBJCTDEC", &solution.dec, "Object DEC", &status);
+
+    int epoch = 2000;
+
+    fits_update_key(file, TINT, "EQUINOX", &epoch, "Equinox", &status);
+
+    fits_update_key(file, TDOUBLE, "CRVAL1", &solution.ra, "CRVAL1", &status);
+    fits_update_key(file, TDOUBLE, "CRVAL2", &solution.dec, "CRVAL1", &status);
+
+    char radecsys[8] = "FK5";
+    char ctype1[16]  = "RA---TAN";
+    char ctype2[16]  = "DEC--TAN";
+
+    fits_update_key(file, TSTRING, "RADECSYS", radecsys, "RADECSYS", &status);
+    fits_update_key(file, TSTRING, "CTYPE1", ctype1, "CTYPE1", &status);
+    fits_update_key(file, TSTRING, "CTYPE2", ctype2, "CTYPE2", &status);
 
-        char radecsys[8] = "FK5";
-        char ctype1[16]  = "RA---TAN";
-        char ctype2[16]  = "DEC--TAN";
+    double crpix1 = width / 2.0;
+    double crpix2 = height / 2.0;
 
-        fits_update_key(fptr, TSTRING, "RADECSYS", radecsys, "RADECSYS", &status);
-        fits_update_key(fptr, TSTRING, "CTYPE1", ctype1, "CTYPE1", &status);
-        fits_update_key(fptr, TSTRING, "CTYPE2", ctype2, "CTYPE2", &status);
+    fits_update_key(file, TDOUBLE, "CRPIX1", &crpix1, "CRPIX1", &status);
+    fits_update_key(file, TDOUBLE, "CRPIX2", &crpix2, "CRPIX2", &status);
 
-        double crpix1 = imageStats.width / 2.0;
-        double crpix2 = imageStats.height / 2.0;
+    // Arcsecs per Pixel
+    double secpix1 = solution.parity == FITSImage::NEGATIVE ? solution.pixscale : -solution.pixscale;
+    double secpix2 = solution.pixscale;
 
-        fits_update_key(fptr, TDOUBLE, "CRPIX1", &crpix1, "CRPIX1", &status);
-        fits_update_key(fptr, TDOUBLE, "CRPIX2", &crpix2, "CRPIX2", &status);
+    fits_update_key(file, TDOUBLE, "SECPIX1", &secpix1, "SECPIX1", &status);
+    fits_update_key(file, TDOUBLE, "SECPIX2", &secpix2, "SECPIX2", &status);
 
-        // Arcsecs per Pixel
-        double secpix1 = solution.parity == FITSImage::NEGATIVE ? solution.pixscale : -solution.pixscale;
-        double secpix2 = solution.pixscale;
+    double degpix1 = secpix1 / 3600.0;
+    double degpix2 = secpix2 / 3600.0;
 
-        fits_update_key(fptr, TDOUBLE, "SECPIX1", &secpix1, "SECPIX1", &status);
-        fits_update_key(fptr, TDOUBLE, "SECPIX2", &secpix2, "SECPIX2", &status);
+    fits_update_key(file, TDOUBLE, "CDELT1", &degpix1, "CDELT1", &status);
+    fits_update_key(file, TDOUBLE, "CDELT2", &degpix2, "CDELT2", &status);
 
-        double degpix1 = secpix1 / 3600.0;
-        double degpix2 = secpix2 / 3600.0;
+    // Rotation is CW, we need to convert it to CCW per CROTA1 definition
+    double rotation = 360 - solution.orientation;
+    if (rotation > 360)
+        rotation -= 360;
 
-        fits_update_key(fptr, TDOUBLE, "CDELT1", &degpix1, "CDELT1", &status);
-        fits_update_key(fptr, TDOUBLE, "CDELT2", &degpix2, "CDELT2", &status);
+    fits_update_key(file, TDOUBLE, "CROTA1", &rotation, "CROTA1", &status);
+    fits_update_key(file, TDOUBLE, "CROTA2", &rotation, "CROTA2", &status);
+}
 
-        // Rotation is CW, we need to convert it to CCW per CROTA1 definition
-        double rotation = 360 - solution.orientation;
-        if (rotation > 360)
-            rotation -= 360;
+//This deletes a keyword if the header has it, for the keywords of an earlier solution that the new one doesn't have
+static void deleteKeyIfPresent(fitsfile *file, const char *key, int &status)
+{
+    if (status)
+        return;
+    if (fits_delete_key(file, const_cast<char *>(key), &status) == KEY_NO_EXIST)
+        status = 0;
+}
 
-        fits_update_key(fptr, TDOUBLE, "CROTA1", &rotation, "CROTA1", &status);
-        fits_update_key(fptr, TDOUBLE, "CROTA2", &rotation, "CROTA2", &status);
+//This writes the keywords of the WCS of the internal solver like astrometry.net writes them in its .wcs files
+void fileio::writeSIPKeys(fitsfile *file, long width, long height, FITSImage::Solution &solution, sip_t &sip, int &status)
+{
+    fits_update_key(file, TDOUBLE, "OBJCTRA", &solution.ra, "Object RA", &status);
+    fits_update_key(file, TDOUBLE, "OBJCTDEC", &solution.dec, "Object DEC", &status);
+
+    double equinox = 2000.0;
+    char radesys[8] = "FK5";
+    const bool distorted = sip.a_order > 0 || sip.b_order > 0;
+    char ctype1[16];
+    char ctype2[16];
+    strcpy(ctype1, distorted ? "RA---TAN-SIP" : "RA---TAN");
+    strcpy(ctype2, distorted ? "DEC--TAN-SIP" : "DEC--TAN");
+
+    fits_update_key(file, TDOUBLE, "EQUINOX", &equinox, "Equatorial coordinates definition (yr)", &status);
+    fits_update_key(file, TSTRING, "RADESYS", radesys, "Reference frame", &status);
+    fits_update_key(file, TSTRING, "CTYPE1", ctype1, "TAN (gnomic) projection", &status);
+    fits_update_key(file, TSTRING, "CTYPE2", ctype2, "TAN (gnomic) projection", &status);
+    fits_update_key(file, TDOUBLE, "CRVAL1", &sip.wcstan.crval[0], "RA  of reference point", &status);
+    fits_update_key(file, TDOUBLE, "CRVAL2", &sip.wcstan.crval[1], "DEC of reference point", &status);
+    fits_update_key(file, TDOUBLE, "CRPIX1", &sip.wcstan.crpix[0], "X reference pixel", &status);
+    fits_update_key(file, TDOUBLE, "CRPIX2", &sip.wcstan.crpix[1], "Y reference pixel", &status);
+    fits_update_key(file, TDOUBLE, "CD1_1", &sip.wcstan.cd[0][0], "Transformation matrix", &status);
+    fits_update_key(file, TDOUBLE, "CD1_2", &sip.wcstan.cd[0][1], "no comment", &status);
+    fits_update_key(file, TDOUBLE, "CD2_1", &sip.wcstan.cd[1][0], "no comment", &status);
+    fits_update_key(file, TDOUBLE, "CD2_2", &sip.wcstan.cd[1][1], "no comment", &status);
+    fits_update_key(file, TLONG, "IMAGEW", &width, "Image width,  in pixels.", &status);
+    fits_update_key(file, TLONG, "IMAGEH", &height, "Image height, in pixels.", &status);
+
+    // A header with a CD matrix must not have the keywords of the other ways to give the scale and rotation
+    for (const char *key : { "CDELT1", "CDELT2", "CROTA1", "CROTA2", "PC1_1", "PC1_2", "PC2_1", "PC2_2", "RADECSYS" })
+        deleteKeyIfPresent(file, key, status);
+
+    // The terms of an earlier solution of a higher order are deleted, since they would still be read with the new ones
+    const char *prefixes[4] = { "A", "B", "AP", "BP" };
+    const int orders[4] = { sip.a_order, sip.b_order, sip.ap_order, sip.bp_order };
+    const double (*terms[4])[SIP_MAXORDER] = { sip.a, sip.b, sip.ap, sip.bp };
+    for (int t = 0; t < 4; t++)
+    {
+        const QByteArray orderKey = QByteArray(prefixes[t]) + "_ORDER";
+        if (orders[t] > 0)
+        {
+            int order = orders[t];
+            fits_update_key(file, TINT, orderKey.constData(), &order, "Polynomial order", &status);
+        }
+        else
+            deleteKeyIfPresent(file, orderKey.constData(), status);
+        for (int p = 0; p < SIP_MAXORDER; p++)
+        {
+            for (int q = 0; p + q < SIP_MAXORDER; q++)
+            {
+                const QByteArray key = QString("%1_%2_%3").arg(prefixes[t]).arg(p).arg(q).toLatin1();
+                if (orders[t] > 0 && p + q <= orders[t])
+                {
+                    double value = terms[t][p][q];
+                    fits_update_key(file, TDOUBLE, key.constData(), &value, "", &status);
+                }
+                else
+                    deleteKeyIfPresent(file, key.constData(), status);
+            }
+        }
     }
+}
 
-    // ISO Date
-    if (fits_write_date(fptr, &status))
+//This copies a FITS file and adds the keywords of the plate solution to the copy, without loading the image
+//If the output file is the same as the input file, the keywords are added to it instead.  CFITSIO writes them in
+//the blank space at the end of the header, and it only has to move the data of the file down when there isn't enough.
+bool fileio::stampSolution(QString fileName, QString outputFileName, FITSImage::Solution solution, const WCSData *wcs)
+{
+    int status = 0;
+    fitsfile *inputFile = nullptr;
+    fitsfile *outputFile = nullptr;
+    const bool inPlace = QFileInfo(fileName).absoluteFilePath() == QFileInfo(outputFileName).absoluteFilePath();
+
+    if (fits_open_diskfile(&inputFile, fileName.toLocal8Bit(), inPlace ? READWRITE : READONLY, &status))
     {
         fits_report_error(stderr, status);
         return false;
     }
 
-    fits_flush_file(fptr, &status);
+    if(inPlace)
+        outputFile = inputFile;
+    else
+    {
+        if(QFileInfo::exists(outputFileName))
+            QFile(outputFileName).remove();
+        if (fits_create_file(&outputFile, outputFileName.toLocal8Bit(), &status) ||
+                fits_copy_file(inputFile, outputFile, 1, 1, 1, &status) ||
+                fits_movabs_hdu(outputFile, 1, nullptr, &status))
+        {
+            fits_report_error(stderr, status);
+            status = 0;
+            if(outputFile)
+                fits_close_file(outputFile, &status);
+            fits_close_file(inputFile, &status);
+            return false;
+        }
+    }
 
-    if(fits_close_file(fptr, &status))
+    // The tile compressed images made by fpack are in the first extension, after an empty primary HDU
+    int naxis = 0;
+    if (fits_get_img_dim(outputFile, &naxis, &status) == 0 && naxis == 0)
+        fits_movabs_hdu(outputFile, 2, nullptr, &status);
+
+    if (inPlace)
     {
-        emit logOutput(QString("Error closing file."));
+        // The space for 36 more keywords is what is left in a header block on average, the SIP terms need more
+        int keysExist = 0, moreKeys = 0;
+        fits_get_hdrspace(outputFile, &keysExist, &moreKeys, &status);
+        if (status == 0 && moreKeys < 36)
+            emit logOutput("The header of " + fileName + " is almost full, so the data of the file has to be moved to make room for the solution.");
+    }
+
+    long naxes[2] = {0, 0};
+    fits_get_img_size(outputFile, 2, naxes, &status);
+    writeSolutionKeys(outputFile, naxes[0], naxes[1], solution, wcs, status);
+    fits_write_date(outputFile, &status);
+    const bool written = status == 0;
+    if(!written)
+        fits_report_error(stderr, status);
+
+    status = 0;
+    fits_close_file(outputFile, &status);
+    if(!inPlace)
+        fits_close_file(inputFile, &status);
+    if(written)
+        emit logOutput("Saved the solution to FITS file:" + outputFileName);
+    return written;
+}
+
+//This writes the plate solution to a FITS file with just a header, like the .wcs files astrometry.net makes,
+//so that the images of an archive don't have to be copied or changed to keep their solutions
+bool fileio::saveWCSFile(QString fileName, long width, long height, FITSImage::Solution solution, const WCSData *wcs)
+{
+    int status = 0;
+    fitsfile *wcsFile = nullptr;
+
+    if(QFileInfo::exists(fileName))
+        QFile(fileName).remove();
+    if (fits_create_file(&wcsFile, fileName.toLocal8Bit(), &status) ||
+            fits_create_img(wcsFile, BYTE_IMG, 0, nullptr, &status))
+    {
+        fits_report_error(stderr, status);
+        status = 0;
+        if(wcsFile)
+            fits_close_file(wcsFile, &status);
         return false;
     }
 
-    emit logOutput("Saved FITS file:" + fileName);
+    writeSolutionKeys(wcsFile, width, height, solution, wcs, status);
+    if (!wcs)
+    {
+        fits_update_key(wcsFile, TLONG, "IMAGEW", &width, "Image width,  in pixels.", &status);
+        fits_update_key(wcsFile, TLONG, "IMAGEH", &height, "Image height, in pixels.", &status);
+    }
+    fits_write_date(wcsFile, &status);
+    const bool written = status == 0;
+    if(!written)
+        fits_report_error(stderr, status);
 
-    return true;
+    status = 0;
+    fits_close_file(wcsFile, &status);
+    if(written)
+        emit logOutput("Saved the solution to WCS file:" + fileName);
+    return written;
 }
 
 //This method was copied and pasted from Fitsview in KStars
@@ -988,34 +1810,64 @@ bool fileio::saveAsFITS(QString fileName, FITSImage::Statistic &imageStats, uint
 void fileio::generateQImage()
 {
     int sampling = 2;
+
+    m_RefinedImage.waitForFinished();
+    Stretch stretch(static_cast<int>(stats.width),
+                    static_cast<int>(stats.height),
+                    stats.channels, static_cast<uint16_t>(stats.dataType));
+
+    // Compute new auto-stretch params.
+    StretchParams stretchParams = stretch.computeParams(m_ImageBuffer);
+
+    stretch.setParams(stretchParams);
+    if(!progressivePreview)
+    {
+        rawImage = makePreviewImage(stats.width, stats.height, stats.channels, sampling);
+        stretch.run(m_ImageBuffer, &rawImage, sampling);
+        m_RefinedImage = QFuture<QImage>();
+        return;
+    }
+
+    // The quick preview only stretches every 8th pixel of every 8th row, so it is ready right away even for very large images.
+    // The full preview is stretched with the same parameters in the background, so that the loading doesn't wait for it.
+    constexpr int quickSampling = 8;
+    rawImage = makePreviewImage(stats.width, stats.height, stats.channels, quickSampling);
+    stretch.run(m_ImageBuffer, &rawImage, quickSampling);
+
+    uint8_t *buffer = m_ImageBuffer;
+    const int width = stats.width;
+    const int height = stats.height;
+    const int channels = stats.channels;
+    m_RefinedImage = QtConcurrent::run([ = ]() mutable
+    {
+        QImage image = makePreviewImage(width, height, channels, sampling);
+        stretch.run(buffer, &image, sampling);
+        return image;
+    });
+}
+
+QImage fileio::makePreviewImage(int width, int height, int channels, int sampling)
+{
     // Account for leftover when sampling. Thus a 5-wide image sampled by 2
     // would result in a width of 3 (samples 0, 2 and 4).
 
-    int w = (stats.width + sampling - 1) / sampling;
-    int h = (stats.height + sampling - 1) / sampling;
+    int w = (width + sampling - 1) / sampling;
+    int h = (height + sampling - 1) / sampling;
 
-    if (stats.channels == 1)
+    QImage image;
+    if (channels == 1)
     {
-        rawImage = QImage(w, h, QImage::Format_Indexed8);
+        image = QImage(w, h, QImage::Format_Indexed8);
 
-        rawImage.setColorCount(256);
+        image.setColorCount(256);
         for (int i = 0; i < 256; i++)
-            rawImage.setColor(i, qRgb(i, i, i));
+            image.setColor(i, qRgb(i, i, i));
     }
     else
     {
-        rawImage = QImage(w, h, QImage::Format_RGB32);
+        image = QImage(w, h, QImage::Format_RGB32);
     }
-
-    Stretch stretch(static_cast<int>(stats.width),
-                    static_cast<int>(stats.height),
-                    stats.channels, static_cast<uint16_t>(stats.dataType));
-
-    // Compute new auto-stretch params.
-    StretchParams stretchParams = stretch.computeParams(m_ImageBuffer);
-
-    stretch.setParams(stretchParams);
-    stretch.run(m_ImageBuffer, &rawImage, sampling);
+    return image;
 }
 
 void fileio::logIssue(QString message){
@@ -1032,4 +1884,19 @@ uint8_t *fileio::getImageBuffer()
     return m_ImageBuffer;
 }
 
+StellarSolver::ImageLoader fileio::batchImageLoader()
+{
+    return [](const QString &fileName, FITSImage::Statistic &imageStats) -> uint8_t *
+    {
+        // StellarSolver deletes the buffers of the batch images when it is done with them, so they can't be mapped
+        fileio imageLoader;
+        imageLoader.useMemoryMapping = false;
+        imageLoader.debayerToLuminance = true;
+        if(!imageLoader.loadImageBufferOnly(fileName))
+            return nullptr;
+        imageStats = imageLoader.getStats();
+        return imageLoader.getImageBuffer();
+    };
+}
+
 
@@ -5,6 +5,7 @@
 #include <QImageReader>
 #include <QFile>
 #include <QVariant>
+#include <QFuture>
 
 //CFitsio Includes
 #include "longnam.h"
@@ -18,6 +19,7 @@
 
 #include "parameters.h"
 #include "structuredefinitions.h"
+#include "stellarsolver.h"
 #include "stellarsolver/sep/sep.h"
 
 class fileio : public QObject
@@ -41,13 +43,34 @@ public:
     bool loadImage(QString fileName);
     bool loadImageBufferOnly(QString fileName);
     bool loadFits(QString fileName);
+    bool loadFitsSubframe(QString fileName, QRect frame);
+    bool loadFitsStream(QString fileName);
+
+    /** One 2D plane of a FITS file, an image HDU and the position of the plane along its third axis */
+    typedef struct
+    {
+        int hdu;          /** The HDU, the primary HDU is 1 */
+        int plane;        /** The plane in the HDU, from 0 */
+    } Plane;
+
+    /// This lists the planes of all of the image HDUs of a FITS file, so that the frames of a data cube and the images of a multi-extension
+    /// file can be loaded one at a time with loadFitsPlane and extracted together with StellarSolver::extractPlanes.
+    /// An HDU with 3 planes is listed as 3 planes too, even though loadFits reads it as an RGB image.
+    static QList<Plane> listFitsPlanes(const QString &fileName);
+    /// This loads one plane of a FITS file as an image with one channel, see listFitsPlanes.  It is not debayered.
+    bool loadFitsPlane(QString fileName, int hdu, int plane);
+    FITSImage::RowReader getRowReader();
+    void closeFitsStream();
     bool parseHeader();
-    bool saveAsFITS(QString fileName, FITSImage::Statistic &imageStats, uint8_t *m_ImageBuffer, FITSImage::Solution solution, QList<Record> &records, bool hasSolution);
+    bool saveAsFITS(QString fileName, FITSImage::Statistic &imageStats, uint8_t *m_ImageBuffer, FITSImage::Solution solution, QList<Record> &records, bool hasSolution, const WCSData *wcs = nullptr);
+    bool stampSolution(QString fileName, QString outputFileName, FITSImage::Solution solution, const WCSData *wcs = nullptr);
+    bool saveWCSFile(QString fileName, long width, long height, FITSImage::Solution solution, const WCSData *wcs = nullptr);
     bool loadOtherFormat(QString fileName);
     bool checkDebayer();
     bool debayer();
     bool debayer_8bit();
     bool debayer_16bit();
+    bool debayerLuminance();
     bool getSolverOptionsFromFITS();
 
     bool position_given = false;
@@ -62,6 +85,25 @@ public:
     bool imageBufferTaken = false;
     uint8_t *getImageBuffer();
 
+    /// Whether loadFits maps the pixels of uncompressed FITS files into memory instead of reading them, see mapFitsData
+    /// A mapped buffer taken with getImageBuffer can't be deleted, it has to be freed with releaseImageBuffer, so it is off unless asked for
+    bool useMemoryMapping = false;
+    /// Whether a bayered image is made into one luminance channel instead of being debayered to RGB, see debayerLuminance
+    /// It is all that solving and star extraction need, and the images loaded with loadImageBufferOnly get it too
+    bool debayerToLuminance = false;
+    /// How many threads loadFits decodes the tiles of Rice compressed FITS files with, 0 for one on each core, see readRiceTiles
+    int decompressionThreads = 0;
+    /// Whether loadImage generates the preview QImage of getRawQImage, which takes a while for big images that are only solved
+    bool generatePreview = true;
+    /// Whether loadImage makes a quick preview from every 8th pixel and the full one in the background, see getRefinedQImage
+    bool progressivePreview = false;
+
+    // This frees an image buffer that was taken with getImageBuffer, whether it was allocated or mapped from the file
+    static void releaseImageBuffer(uint8_t *buffer);
+
+    // This loads the image files of a batch for StellarSolver::solveBatch, without generating the QImages
+    static StellarSolver::ImageLoader batchImageLoader();
+
     FITSImage::Statistic getStats(){
         return stats;
     }
@@ -81,6 +123,13 @@ public:
         return rawImage;
     }
 
+    // This is the full preview that is made in the background when progressivePreview is on, getRawQImage has the quick one until it is done.
+    // It reads the image buffer, so whoever takes the buffer with getImageBuffer must wait for it before releasing the buffer.
+    QFuture<QImage> getRefinedQImage() const
+    {
+        return m_RefinedImage;
+    }
+
 private:
     QString file;
     fitsfile *fptr { nullptr };
@@ -89,14 +138,26 @@ private:
     /// Generic data image buffer
     uint8_t *m_ImageBuffer { nullptr };
     /// Above buffer size in bytes
-    uint32_t m_ImageBufferSize { 0 };
+    size_t m_ImageBufferSize { 0 };
     bool justLoadBuffer = false;
+    /// Whether the FITS file is kept open to read its rows, see loadFitsStream
+    bool m_Streaming = false;
+    bool openFits(QString fileName, int hdu = 0);
+    bool mapFitsData();
+    bool readRiceTiles();
+    bool load16BitImage(QImage &image);
+    /// The HDU of the image, which is the first extension in the files made by fpack
+    int m_HDU = 1;
+    void writeSolutionKeys(fitsfile *file, long width, long height, FITSImage::Solution &solution, const WCSData *wcs, int &status);
+    void writeSIPKeys(fitsfile *file, long width, long height, FITSImage::Solution &solution, sip_t &sip, int &status);
     StretchParams stretchParams;
     BayerParams debayerParams;
     void logIssue(QString messsage);
 
     QImage rawImage;
+    QFuture<QImage> m_RefinedImage;
     void generateQImage();
+    static QImage makePreviewImage(int width, int height, int channels, int sampling);
 
 signals:
     void logOutput(QString logText);
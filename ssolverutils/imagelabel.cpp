@@ -19,3 +19,21 @@ void ImageLabel::mouseReleaseEvent(QMouseEvent *ev)
 {
     emit mouseClicked(ev->pos());
 }
+
+void ImageLabel::setRenderer(std::function<void(QPainter &, const QRect &)> renderer)
+{
+    m_Renderer = renderer;
+    update();
+}
+
+void ImageLabel::paintEvent(QPaintEvent *ev)
+{
+    if(!m_Renderer)
+    {
+        QLabel::paintEvent(ev);
+        return;
+    }
+    QPainter painter(this);
+    painter.setClipRect(ev->rect());
+    m_Renderer(painter, ev->rect());
+}
@@ -1,8 +1,12 @@
 #ifndef IMAGELABEL_H
 #define IMAGELABEL_H
 
+#include <functional>
+
 #include <QLabel>
 #include <QMouseEvent>
+#include <QPaintEvent>
+#include <QPainter>
 #include <QPoint>
 
 class ImageLabel : public QLabel
@@ -14,11 +18,20 @@ public:
     void mousePressEvent(QMouseEvent *ev) override;
     void mouseReleaseEvent(QMouseEvent *ev) override;
 
+    // With a renderer, the label doesn't show a pixmap, it asks the renderer to draw just the part of it that needs painting,
+    // which is only the part that is visible in a scroll area
+    void setRenderer(std::function<void(QPainter &painter, const QRect &exposed)> renderer);
+
+protected:
+    void paintEvent(QPaintEvent *ev) override;
+
 signals:
     void mouseDown(QPoint location);
     void mouseClicked(QPoint location);
     void mouseMoved(QPoint location);
 
+private:
+    std::function<void(QPainter &, const QRect &)> m_Renderer;
 };
 
 #endif // IMAGELABEL_H
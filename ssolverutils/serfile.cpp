@@ -0,0 +1,146 @@
+/*  SerFile
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+#include "serfile.h"
+
+#include <QtEndian>
+
+#include <cstring>
+
+//CFitsio Includes
+#include "fitsio.h"
+
+#include "stellarsolver/sep/sep.h"
+
+namespace
+{
+// The strings of the header are padded with zeros or spaces
+QString headerString(const uchar *text, int size)
+{
+    return QString::fromLatin1(reinterpret_cast<const char *>(text), static_cast<int>(qstrnlen(reinterpret_cast<const char *>(text),
+                               size))).trimmed();
+}
+}
+
+SerFile::SerFile()
+{
+}
+
+SerFile::~SerFile()
+{
+    close();
+}
+
+bool SerFile::fail(const QString &error)
+{
+    m_LastError = error;
+    close();
+    return false;
+}
+
+bool SerFile::open(const QString &fileName)
+{
+    close();
+    m_File.setFileName(fileName);
+    if(!m_File.open(QIODevice::ReadOnly))
+        return fail(QString("Could not open %1: %2").arg(fileName, m_File.errorString()));
+
+    uchar header[HEADER_SIZE];
+    if(m_File.read(reinterpret_cast<char *>(header), HEADER_SIZE) != HEADER_SIZE || memcmp(header, "LUCAM-RECORDER", 14) != 0)
+        return fail(QString("%1 is not a SER file").arg(fileName));
+
+    // The fields of the header are always little endian, whatever LittleEndian says about the pixels
+    m_ColorID = static_cast<ColorID>(qFromLittleEndian<qint32>(header + 18));
+    m_LittleEndian = qFromLittleEndian<qint32>(header + 22) != 0;
+    m_Width = qFromLittleEndian<qint32>(header + 26);
+    m_Height = qFromLittleEndian<qint32>(header + 30);
+    m_PixelDepth = qFromLittleEndian<qint32>(header + 34);
+    const int headerFrames = qFromLittleEndian<qint32>(header + 38);
+    m_Observer = headerString(header + 42, 40);
+    m_Instrument = headerString(header + 82, 40);
+    m_Telescope = headerString(header + 122, 40);
+
+    if(m_ColorID != MONO && m_ColorID != RGB && m_ColorID != BGR && !isBayer())
+        return fail(QString("%1 has the unknown color ID %2").arg(fileName).arg(m_ColorID));
+    if(m_Width <= 0 || m_Height <= 0 || m_Width > 65535 || m_Height > 65535 || m_PixelDepth < 1 || m_PixelDepth > 16)
+        return fail(QString("%1 has frames of %2 x %3 pixels with %4 bits, which can't be read").arg(fileName).arg(m_Width).arg(m_Height).arg(
+                        m_PixelDepth));
+
+    // The trailer of time stamps follows the frames, and a capture that was cut short has fewer frames than its header says
+    const qint64 dataSize = m_File.size() - HEADER_SIZE;
+    m_FrameCount = static_cast<int>(qMin<qint64>(qMax(0, headerFrames), dataSize / frameSize()));
+    if(m_FrameCount == 0)
+        return fail(QString("%1 has no frames").arg(fileName));
+
+    m_Frames = m_File.map(HEADER_SIZE, m_FrameCount * frameSize());
+    if(!m_Frames)
+        return fail(QString("Could not map %1: %2").arg(fileName, m_File.errorString()));
+    m_LastError.clear();
+    return true;
+}
+
+void SerFile::close()
+{
+    if(m_Frames)
+        m_File.unmap(const_cast<uchar *>(m_Frames));
+    m_Frames = nullptr;
+    m_File.close();
+    m_FrameCount = 0;
+}
+
+FITSImage::Statistic SerFile::stats() const
+{
+    FITSImage::Statistic stats;
+    stats.width = m_Width;
+    stats.height = m_Height;
+    stats.channels = channels();
+    stats.ndim = channels() == 3 ? 3 : 2;
+    stats.bytesPerPixel = bytesPerPixel();
+    stats.dataType = bytesPerPixel() == 1 ? SEP_TBYTE : TUSHORT;
+    stats.samples_per_channel = m_Width * m_Height;
+    stats.size = frameSize();
+    return stats;
+}
+
+FITSImage::ImageView SerFile::view() const
+{
+    FITSImage::ImageView view;
+    view.interleaved = channels() == 3;
+    return view;
+}
+
+bool SerFile::needsSwap() const
+{
+    return bytesPerPixel() == 2 && m_LittleEndian != (Q_BYTE_ORDER == Q_LITTLE_ENDIAN);
+}
+
+const uint8_t *SerFile::mappedFrame(int frame) const
+{
+    if(!m_Frames || frame < 0 || frame >= m_FrameCount || needsSwap())
+        return nullptr;
+    return m_Frames + frame * frameSize();
+}
+
+bool SerFile::readFrame(int frame, uint8_t *buffer) const
+{
+    if(!m_Frames || frame < 0 || frame >= m_FrameCount)
+        return false;
+    const uint8_t *pixels = m_Frames + frame * frameSize();
+    if(!needsSwap())
+    {
+        memcpy(buffer, pixels, frameSize());
+        return true;
+    }
+    const qint64 values = frameSize() / 2;
+    for(qint64 i = 0; i < values; i++)
+    {
+        buffer[2 * i] = pixels[2 * i + 1];
+        buffer[2 * i + 1] = pixels[2 * i];
+    }
+    return true;
+}
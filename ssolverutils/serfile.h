@@ -0,0 +1,148 @@
+/*  SerFile
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+#pragma once
+
+#include <QFile>
+#include <QString>
+
+#include "structuredefinitions.h"
+
+// This reads the frames of a SER video, the format of the planetary and lucky imaging capture programs, without copying them.
+// The file is mapped into memory, so a frame is a pointer into the file, and the frames that are read are paged in by the system.
+// The only frames that have to be copied are the 16 bit ones in the other byte order than the one of this machine, see readFrame.
+class SerFile
+{
+public:
+    // The ColorID of the header
+    enum ColorID
+    {
+        MONO = 0,
+        BAYER_RGGB = 8,
+        BAYER_GRBG = 9,
+        BAYER_GBRG = 10,
+        BAYER_BGGR = 11,
+        BAYER_CYYM = 16,
+        BAYER_YCMY = 17,
+        BAYER_YMCY = 18,
+        BAYER_MYYC = 19,
+        RGB = 100,
+        BGR = 101
+    };
+
+    static const int HEADER_SIZE = 178;
+
+    SerFile();
+    ~SerFile();
+
+    SerFile(const SerFile &) = delete;
+    SerFile &operator=(const SerFile &) = delete;
+
+    // This reads the header and maps the frames of the file, it returns false with the reason in lastError if it isn't a SER file
+    bool open(const QString &fileName);
+    void close();
+
+    bool isOpen() const
+    {
+        return m_Frames != nullptr;
+    }
+    QString lastError() const
+    {
+        return m_LastError;
+    }
+
+    int width() const
+    {
+        return m_Width;
+    }
+    int height() const
+    {
+        return m_Height;
+    }
+    int pixelDepth() const
+    {
+        return m_PixelDepth;
+    }
+    ColorID colorID() const
+    {
+        return m_ColorID;
+    }
+    bool isBayer() const
+    {
+        return m_ColorID >= BAYER_RGGB && m_ColorID <= BAYER_MYYC;
+    }
+    // The frames that are in the file, which can be fewer than the header says if the capture was cut short
+    int frameCount() const
+    {
+        return m_FrameCount;
+    }
+    QString observer() const
+    {
+        return m_Observer;
+    }
+    QString instrument() const
+    {
+        return m_Instrument;
+    }
+    QString telescope() const
+    {
+        return m_Telescope;
+    }
+
+    // The spec says that LittleEndian is 1 for little endian 16 bit pixels, but a lot of the capture programs write it the other way
+    // around, so this can override it for the files of one of those.  It doesn't matter for the 8 bit files.
+    bool isLittleEndian() const
+    {
+        return m_LittleEndian;
+    }
+    void setLittleEndian(bool littleEndian)
+    {
+        m_LittleEndian = littleEndian;
+    }
+
+    // The size of one frame in bytes
+    qint64 frameSize() const
+    {
+        return static_cast<qint64>(m_Width) * m_Height * channels() * bytesPerPixel();
+    }
+
+    // This is the statistic of a frame for StellarSolver::loadNewImageView, the Bayer frames are one channel of the raw pixels
+    FITSImage::Statistic stats() const;
+    // This is the layout of a frame, the colors of the RGB and BGR ones are interleaved
+    FITSImage::ImageView view() const;
+
+    // This is the frame in the mapped file, or nullptr if it is out of the file or its 16 bit pixels have to be swapped, see readFrame
+    const uint8_t *mappedFrame(int frame) const;
+    // This copies the frame into buffer, which must hold frameSize bytes, and swaps the bytes of its pixels if they have to be swapped
+    bool readFrame(int frame, uint8_t *buffer) const;
+
+private:
+    int channels() const
+    {
+        return (m_ColorID == RGB || m_ColorID == BGR) ? 3 : 1;
+    }
+    int bytesPerPixel() const
+    {
+        return m_PixelDepth <= 8 ? 1 : 2;
+    }
+    bool needsSwap() const;
+    bool fail(const QString &error);
+
+    QFile m_File;
+    const uint8_t *m_Frames { nullptr };    // The first frame in the mapped file
+    QString m_LastError;
+    ColorID m_ColorID { MONO };
+    bool m_LittleEndian { true };
+    int m_Width { 0 };
+    int m_Height { 0 };
+    int m_PixelDepth { 8 };
+    int m_FrameCount { 0 };
+    QString m_Observer;
+    QString m_Instrument;
+    QString m_Telescope;
+};
@@ -0,0 +1,77 @@
+/*  StarGrid
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+#include "stargrid.h"
+
+#include <algorithm>
+#include <cmath>
+
+void StarGrid::build(const QList<FITSImage::Star> &stars, int width, int height)
+{
+    clear();
+    if(stars.isEmpty() || width <= 0 || height <= 0)
+        return;
+    m_CellSize = std::max(8.0, sqrt(static_cast<double>(width) * height * STARS_PER_CELL / stars.size()));
+    m_Columns = static_cast<int>(ceil(width / m_CellSize));
+    m_Rows = static_cast<int>(ceil(height / m_CellSize));
+
+    // The stars are counted in their cells first, so each cell knows where its stars start in the one list of all of them
+    QVector<int> cells(stars.size());
+    m_Positions.resize(stars.size());
+    m_CellStart.fill(0, m_Columns * m_Rows + 1);
+    for(int i = 0; i < stars.size(); i++)
+    {
+        m_Positions[i] = QPointF(stars.at(i).x, stars.at(i).y);
+        const int column = std::max(0, std::min(m_Columns - 1, static_cast<int>(stars.at(i).x / m_CellSize)));
+        const int row = std::max(0, std::min(m_Rows - 1, static_cast<int>(stars.at(i).y / m_CellSize)));
+        cells[i] = row * m_Columns + column;
+        m_CellStart[cells[i] + 1]++;
+    }
+    for(int cell = 0; cell < m_Columns * m_Rows; cell++)
+        m_CellStart[cell + 1] += m_CellStart[cell];
+    m_CellStars.resize(stars.size());
+    QVector<int> next = m_CellStart;
+    for(int i = 0; i < stars.size(); i++)
+        m_CellStars[next[cells[i]]++] = i;
+}
+
+void StarGrid::clear()
+{
+    m_Columns = 0;
+    m_Rows = 0;
+    m_Positions.clear();
+    m_CellStart.clear();
+    m_CellStars.clear();
+}
+
+QVector<int> StarGrid::find(const QRectF &area) const
+{
+    QVector<int> found;
+    if(m_Columns == 0 || area.isEmpty())
+        return found;
+    // The first and last cells hold the stars off the edges of the image too, so they are always searched if the area reaches them
+    const int firstColumn = std::max(0, std::min(m_Columns - 1, static_cast<int>(floor(area.left() / m_CellSize))));
+    const int lastColumn = std::max(0, std::min(m_Columns - 1, static_cast<int>(floor(area.right() / m_CellSize))));
+    const int firstRow = std::max(0, std::min(m_Rows - 1, static_cast<int>(floor(area.top() / m_CellSize))));
+    const int lastRow = std::max(0, std::min(m_Rows - 1, static_cast<int>(floor(area.bottom() / m_CellSize))));
+    for(int row = firstRow; row <= lastRow; row++)
+    {
+        for(int column = firstColumn; column <= lastColumn; column++)
+        {
+            const int cell = row * m_Columns + column;
+            for(int i = m_CellStart[cell]; i < m_CellStart[cell + 1]; i++)
+            {
+                const int star = m_CellStars[i];
+                if(area.contains(m_Positions[star]))
+                    found.append(star);
+            }
+        }
+    }
+    std::sort(found.begin(), found.end());
+    return found;
+}
@@ -0,0 +1,38 @@
+/*  StarGrid
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+#pragma once
+
+#include <QList>
+#include <QRectF>
+#include <QVector>
+
+#include "structuredefinitions.h"
+
+// This is a grid over the stars of an image, so the stars in a part of the image are found without going through all of them.
+// Each cell has about the same number of stars in it on average, and the stars of the cells are in one list, cell after cell.
+class StarGrid
+{
+public:
+    void build(const QList<FITSImage::Star> &stars, int width, int height);
+    void clear();
+
+    // This finds the indexes of the stars centered inside area, in the pixels of the image, in the order of the list of stars
+    QVector<int> find(const QRectF &area) const;
+
+    // The cells have about this many stars on average
+    static const int STARS_PER_CELL = 4;
+
+private:
+    double m_CellSize { 1 };
+    int m_Columns { 0 };
+    int m_Rows { 0 };
+    QVector<QPointF> m_Positions;
+    QVector<int> m_CellStart;       // The stars of cell i are m_CellStars[m_CellStart[i]] to m_CellStars[m_CellStart[i + 1] - 1]
+    QVector<int> m_CellStars;
+};
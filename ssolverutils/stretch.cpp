@@ -10,6 +10,9 @@
 
 #include <fitsio.h>
 #include <math.h>
+#include <limits>
+#include <type_traits>
+#include <QThread>
 #include <QtConcurrent>
 #include "sep/sep.h"
 
@@ -48,11 +51,111 @@ T median(T *values, int size, int sampleBy)
   return median(samples);
 }
 
-// This stretches one channel given the input parameters.
+// The 8 and 16 bit integer types have at most 65536 values, so they are stretched with a lookup table
+// of every value, and the medians of their pixels are found with a histogram instead of sorting samples.
+template <typename T>
+using HasFewValues = std::integral_constant<bool, std::is_integral<T>::value && sizeof(T) <= 2>;
+
+// The stretch is run on blocks of the output rows, this many for each thread, so that the threads stay busy
+// without queueing a job for every row of the image.
+constexpr int BLOCKS_PER_THREAD = 4;
+
+// This calls stretchRows(first, last) for blocks of the rows 0 to numRows on all of the threads, and blocks until done.
+template <typename Function>
+void forRowBlocks(int numRows, const Function &stretchRows)
+{
+  const int numBlocks = qMax(1, qMin(numRows, QThread::idealThreadCount() * BLOCKS_PER_THREAD));
+  QVector<int> blocks(numBlocks);
+  for (int b = 0; b < numBlocks; b++)
+    blocks[b] = b;
+  QtConcurrent::blockingMap(blocks, [numRows, numBlocks, &stretchRows](int b)
+  {
+    stretchRows(static_cast<qint64>(numRows) * b / numBlocks, static_cast<qint64>(numRows) * (b + 1) / numBlocks);
+  });
+}
+
+// This stretches the values of one channel given the input parameters.
 // Based on the spec in section 8.5.6
 // https://pixinsight.com/doc/docs/XISF-1.0-spec/XISF-1.0-spec.html
-// Uses multiple threads, blocks until done.
 // The extension parameters are not used.
+template <typename T>
+class ChannelStretch
+{
+  public:
+    ChannelStretch(const StretchParams1Channel &params, int input_range)
+    {
+      // Maximum possible input value (e.g. 1024*64 - 1 for a 16 bit unsigned int).
+      const float maxInput = input_range > 1 ? input_range - 1 : input_range;
+
+      midtones = params.midtones;
+      // Precomputed expressions moved out of the loop.
+      // hightlights - shadows, protecting for divide-by-0, in a 0->1.0 scale.
+      const float hsRangeFactor = params.highlights == params.shadows ? 1.0f : 1.0f / (params.highlights - params.shadows);
+      // Shadow and highlight values translated to the ADU scale.
+      nativeShadows = params.shadows * maxInput;
+      nativeHighlights = params.highlights * maxInput;
+      // Constants based on above needed for the stretch calculations.
+      k1 = (midtones - 1) * hsRangeFactor * maxOutput / maxInput;
+      k2 = ((2 * midtones) - 1) * hsRangeFactor / maxInput;
+    }
+
+    uint8_t operator()(T input) const
+    {
+      if (input < nativeShadows) return 0;
+      if (input >= nativeHighlights) return maxOutput;
+      const T inputFloored = (input - nativeShadows);
+      return (inputFloored * k1) / (inputFloored * k2 - midtones);
+    }
+
+  private:
+    // We're outputting uint8, so the max output is 255.
+    static constexpr int maxOutput = 255;
+    float midtones;
+    T nativeShadows;
+    T nativeHighlights;
+    float k1;
+    float k2;
+};
+
+// This is the stretch of one channel that is used for each pixel.  For the types with few values
+// the stretch is worked out once for every possible value, so each pixel is just a lookup in the table.
+template <typename T, bool = HasFewValues<T>::value>
+class ChannelLookup
+{
+  public:
+    ChannelLookup(const StretchParams1Channel &params, int input_range) : stretch(params, input_range) {}
+    uint8_t operator()(T input) const
+    {
+      return stretch(input);
+    }
+
+  private:
+    ChannelStretch<T> stretch;
+};
+
+template <typename T>
+class ChannelLookup<T, true>
+{
+  public:
+    ChannelLookup(const StretchParams1Channel &params, int input_range) : table(1 << (8 * sizeof(T)))
+    {
+      const ChannelStretch<T> stretch(params, input_range);
+      for (int i = 0; i < table.size(); i++)
+        table[i] = stretch(static_cast<T>(i - offset));
+    }
+    uint8_t operator()(T input) const
+    {
+      return table[static_cast<int>(input) + offset];
+    }
+
+  private:
+    // The table starts at the lowest value of the type, which is negative for short.
+    static constexpr int offset = -static_cast<int>(std::numeric_limits<T>::min());
+    std::vector<uint8_t> table;
+};
+
+// This stretches one channel given the input parameters.
+// Uses multiple threads, blocks until done.
 // Sampling is applied to the output (that is, with sampling=2, we compute every other output
 // sample both in width and height, so the output would have about 4X fewer pixels.
 template <typename T>
@@ -60,57 +163,29 @@ void stretchOneChannel(T *input_buffer, QImage *output_image,
                        const StretchParams& stretch_params, 
                        int input_range, int image_height, int image_width, int sampling)
 {
-  QVector<QFuture<void>> futures;
-
-  // We're outputting uint8, so the max output is 255.
-  constexpr int maxOutput = 255;
-
-  // Maximum possible input value (e.g. 1024*64 - 1 for a 16 bit unsigned int).
-  const float maxInput = input_range > 1 ? input_range - 1 : input_range;
-  
-  const float midtones   = stretch_params.grey_red.midtones;
-  const float highlights = stretch_params.grey_red.highlights;
-  const float shadows    = stretch_params.grey_red.shadows;
-
-  // Precomputed expressions moved out of the loop.
-  // hightlights - shadows, protecting for divide-by-0, in a 0->1.0 scale.
-  const float hsRangeFactor = highlights == shadows ? 1.0f : 1.0f / (highlights - shadows);
-  // Shadow and highlight values translated to the ADU scale.
-  const T nativeShadows = shadows * maxInput;
-  const T nativeHighlights = highlights * maxInput;
-  // Constants based on above needed for the stretch calculations.
-  const float k1 = (midtones - 1) * hsRangeFactor * maxOutput / maxInput;
-  const float k2 = ((2 * midtones) - 1) * hsRangeFactor / maxInput;
-  
-  // Increment the input index by the sampling, the output index increments by 1.
-  for (int j = 0, jout = 0; j < image_height; j+=sampling, jout++)
+  const ChannelLookup<T> stretch(stretch_params.grey_red, input_range);
+  const int outputWidth = (image_width + sampling - 1) / sampling;
+  const int outputHeight = (image_height + sampling - 1) / sampling;
+  // The scan lines are found from the bits, since scanLine can detach the image and shouldn't be called from the threads.
+  uint8_t *bits = output_image->bits();
+  const int bytesPerLine = output_image->bytesPerLine();
+
+  forRowBlocks(outputHeight, [ = , &stretch](int firstRow, int lastRow)
   {
-    futures.append(QtConcurrent::run([ = ]()
+    // Increment the input index by the sampling, the output index increments by 1.
+    for (int jout = firstRow; jout < lastRow; jout++)
     {
-        T * inputLine  = input_buffer + j * image_width;
-        auto * scanLine = output_image->scanLine(jout);
-        
-    for (int i = 0, iout = 0; i < image_width; i+=sampling, iout++)
-        {
-          const T input = inputLine[i];
-          if (input < nativeShadows) scanLine[iout] = 0;
-          else if (input >= nativeHighlights) scanLine[iout] = maxOutput;
-          else 
-          {
-            const T inputFloored = (input - nativeShadows);
-            scanLine[iout] = (inputFloored * k1) / (inputFloored * k2 - midtones);
-	  }
-        }
-    }));
-  }
-  for(QFuture<void> future : futures)
-    future.waitForFinished();
+      const T * inputLine  = input_buffer + static_cast<size_t>(jout) * sampling * image_width;
+      uint8_t * scanLine = bits + static_cast<size_t>(jout) * bytesPerLine;
+      for (int iout = 0; iout < outputWidth; iout++)
+        scanLine[iout] = stretch(inputLine[iout * sampling]);
+    }
+  });
 }
 
 // This is like the above 1-channel stretch, but extended for 3 channels.
-// This could have been more modular, but the three channels are combined
-// into a single qRgb value at the end, so it seems the simplest thing is to
-// replicate the code. It is assume the colors are not interleaved--the red image
+// The three channels are combined into a single qRgb value at the end.
+// It is assume the colors are not interleaved--the red image
 // is stored fully, then the green, then the blue.
 // Sampling is applied to the output (that is, with sampling=2, we compute every other output
 // sample both in width and height, so the output would have about 4X fewer pixels.
@@ -119,94 +194,33 @@ void stretchThreeChannels(T *inputBuffer, QImage *outputImage,
                           const StretchParams& stretchParams, 
                           int inputRange, int imageHeight, int imageWidth, int sampling)
 {
-  QVector<QFuture<void>> futures;
-
-  // We're outputting uint8, so the max output is 255.
-  constexpr int maxOutput = 255;
-
-  // Maximum possible input value (e.g. 1024*64 - 1 for a 16 bit unsigned int).
-  const float maxInput = inputRange > 1 ? inputRange - 1 : inputRange;
-  
-  const float midtonesR   = stretchParams.grey_red.midtones;
-  const float highlightsR = stretchParams.grey_red.highlights;
-  const float shadowsR    = stretchParams.grey_red.shadows;
-  const float midtonesG   = stretchParams.green.midtones;
-  const float highlightsG = stretchParams.green.highlights;
-  const float shadowsG    = stretchParams.green.shadows;
-  const float midtonesB   = stretchParams.blue.midtones;
-  const float highlightsB = stretchParams.blue.highlights;
-  const float shadowsB    = stretchParams.blue.shadows;
-
-  // Precomputed expressions moved out of the loop.
-  // hightlights - shadows, protecting for divide-by-0, in a 0->1.0 scale.
-  const float hsRangeFactorR = highlightsR == shadowsR ? 1.0f : 1.0f / (highlightsR - shadowsR);
-  const float hsRangeFactorG = highlightsG == shadowsG ? 1.0f : 1.0f / (highlightsG - shadowsG);
-  const float hsRangeFactorB = highlightsB == shadowsB ? 1.0f : 1.0f / (highlightsB - shadowsB);
-  // Shadow and highlight values translated to the ADU scale.
-  const T nativeShadowsR = shadowsR * maxInput;
-  const T nativeShadowsG = shadowsG * maxInput;
-  const T nativeShadowsB = shadowsB * maxInput;
-  const T nativeHighlightsR = highlightsR * maxInput;
-  const T nativeHighlightsG = highlightsG * maxInput;
-  const T nativeHighlightsB = highlightsB * maxInput;
-  // Constants based on above needed for the stretch calculations.
-  const float k1R = (midtonesR - 1) * hsRangeFactorR * maxOutput / maxInput;
-  const float k1G = (midtonesG - 1) * hsRangeFactorG * maxOutput / maxInput;
-  const float k1B = (midtonesB - 1) * hsRangeFactorB * maxOutput / maxInput;
-  const float k2R = ((2 * midtonesR) - 1) * hsRangeFactorR / maxInput;
-  const float k2G = ((2 * midtonesG) - 1) * hsRangeFactorG / maxInput;
-  const float k2B = ((2 * midtonesB) - 1) * hsRangeFactorB / maxInput;
-  
-  const int size = imageWidth * imageHeight;
-  
-  for (int j = 0, jout = 0; j < imageHeight; j+=sampling, jout++)
+  const ChannelLookup<T> stretchR(stretchParams.grey_red, inputRange);
+  const ChannelLookup<T> stretchG(stretchParams.green, inputRange);
+  const ChannelLookup<T> stretchB(stretchParams.blue, inputRange);
+  const size_t size = static_cast<size_t>(imageWidth) * imageHeight;
+  const int outputWidth = (imageWidth + sampling - 1) / sampling;
+  const int outputHeight = (imageHeight + sampling - 1) / sampling;
+  uint8_t *bits = outputImage->bits();
+  const int bytesPerLine = outputImage->bytesPerLine();
+
+  forRowBlocks(outputHeight, [ =, &stretchR, &stretchG, &stretchB](int firstRow, int lastRow)
   {
-    futures.append(QtConcurrent::run([ = ]()
+    for (int jout = firstRow; jout < lastRow; jout++)
     {
-        // R, G, B input images are stored one after another.
-        T * inputLineR  = inputBuffer + j * imageWidth;
-        T * inputLineG  = inputLineR + size;
-        T * inputLineB  = inputLineG + size;
-        
-        auto * scanLine = reinterpret_cast<QRgb*>(outputImage->scanLine(jout));
-        
-    for (int i = 0, iout = 0; i < imageWidth; i+=sampling, iout++)
-        {
-          const T inputR = inputLineR[i];
-          const T inputG = inputLineG[i];
-          const T inputB = inputLineB[i];
-
-          uint8_t red, green, blue;
-          
-          if (inputR < nativeShadowsR) red = 0;
-          else if (inputR >= nativeHighlightsR) red = maxOutput;
-          else 
-          {
-            const T inputFloored = (inputR - nativeShadowsR);
-            red = (inputFloored * k1R) / (inputFloored * k2R - midtonesR);
-	  }
-
-          if (inputG < nativeShadowsG) green = 0;
-          else if (inputG >= nativeHighlightsG) green = maxOutput;
-          else 
-          {
-            const T inputFloored = (inputG - nativeShadowsG);
-            green = (inputFloored * k1G) / (inputFloored * k2G - midtonesG);
-	  }
-
-          if (inputB < nativeShadowsB) blue = 0;
-          else if (inputB >= nativeHighlightsB) blue = maxOutput;
-          else 
-          {
-            const T inputFloored = (inputB - nativeShadowsB);
-            blue = (inputFloored * k1B) / (inputFloored * k2B - midtonesB);
-	  }
-          scanLine[iout] = qRgb(red, green, blue);
-        }
-    }));
-  }
-  for(QFuture<void> future : futures)
-    future.waitForFinished();
+      // R, G, B input images are stored one after another.
+      const T * inputLineR  = inputBuffer + static_cast<size_t>(jout) * sampling * imageWidth;
+      const T * inputLineG  = inputLineR + size;
+      const T * inputLineB  = inputLineG + size;
+
+      auto * scanLine = reinterpret_cast<QRgb*>(bits + static_cast<size_t>(jout) * bytesPerLine);
+
+      for (int iout = 0; iout < outputWidth; iout++)
+      {
+        const int i = iout * sampling;
+        scanLine[iout] = qRgb(stretchR(inputLineR[i]), stretchG(inputLineG[i]), stretchB(inputLineB[i]));
+      }
+    }
+  });
 }
 
 template <typename T>
@@ -221,19 +235,18 @@ void stretchChannels(T *input_buffer, QImage *output_image,
       stretchThreeChannels(input_buffer, output_image, stretch_params, input_range,
                            image_height, image_width, sampling);
 }
-  
-// See section 8.5.7 in above link  https://pixinsight.com/doc/docs/XISF-1.0-spec/XISF-1.0-spec.html
+
+// This finds the median of a channel and the median of the deviations from it
+// from up to 500000 samples of the pixels.
 template <typename T>
-void computeParamsOneChannel(T *buffer, StretchParams1Channel *params, 
-                             int inputRange, int height, int width)
+void medianAndDeviation(T *buffer, int size, std::false_type, T &medianSample, float &medDev)
 {
-  // Find the median sample.
   constexpr int maxSamples = 500000;
-  const int sampleBy = width * height < maxSamples ? 1 : width * height / maxSamples;
+  const int sampleBy = size < maxSamples ? 1 : size / maxSamples;
 
-  T medianSample = median(buffer, width * height, sampleBy);
-  // Find the Median deviation: 1.4826 * median of abs(sample[i] - median).
-  const int numSamples = width * height / sampleBy;
+  medianSample = median(buffer, size, sampleBy);
+  // Find the Median deviation: median of abs(sample[i] - median).
+  const int numSamples = size / sampleBy;
   std::vector<T> deviations(numSamples);
   for (int index = 0, i = 0; i < numSamples; ++i, index += sampleBy)
   {
@@ -242,9 +255,69 @@ void computeParamsOneChannel(T *buffer, StretchParams1Channel *params,
     else
       deviations[i] = buffer[index] - medianSample;
   }
+  medDev = median(deviations);
+}
+
+// This finds the same medians for the types with few values from a histogram of all of the pixels.
+// The threads each count a part of the channel, then the deviations are counted outwards from the
+// median in the same histogram, the pixels at a deviation d being in the bins at median - d and median + d.
+template <typename T>
+void medianAndDeviation(T *buffer, int size, std::true_type, T &medianSample, float &medDev)
+{
+  constexpr int offset = -static_cast<int>(std::numeric_limits<T>::min());
+  constexpr int numBins = 1 << (8 * sizeof(T));
+  const int numParts = qMax(1, qMin(QThread::idealThreadCount(), size / numBins));
+  QVector<std::vector<int>> partHistograms(numParts);
+  QVector<int> parts(numParts);
+  for (int p = 0; p < numParts; p++)
+    parts[p] = p;
+  QtConcurrent::blockingMap(parts, [buffer, size, numParts, &partHistograms](int p)
+  {
+    std::vector<int> &histogram = partHistograms[p];
+    histogram.assign(numBins, 0);
+    const int last = static_cast<qint64>(size) * (p + 1) / numParts;
+    for (int i = static_cast<qint64>(size) * p / numParts; i < last; i++)
+      histogram[static_cast<int>(buffer[i]) + offset]++;
+  });
+  std::vector<int> histogram(numBins, 0);
+  for (const std::vector<int> &part : qAsConst(partHistograms))
+    for (int bin = 0; bin < numBins; bin++)
+      histogram[bin] += part[bin];
+
+  // The median is the value at index size / 2 of the sorted pixels, as in median() above.
+  const int middle = size / 2;
+  int bin = 0;
+  for (int count = 0; bin < numBins - 1; bin++)
+  {
+    count += histogram[bin];
+    if (count > middle)
+      break;
+  }
+  medianSample = static_cast<T>(bin - offset);
+
+  int deviation = 0;
+  for (int count = histogram[bin]; count <= middle && deviation < numBins; )
+  {
+    deviation++;
+    if (bin + deviation < numBins)
+      count += histogram[bin + deviation];
+    if (bin - deviation >= 0)
+      count += histogram[bin - deviation];
+  }
+  medDev = deviation;
+}
+
+// See section 8.5.7 in above link  https://pixinsight.com/doc/docs/XISF-1.0-spec/XISF-1.0-spec.html
+template <typename T>
+void computeParamsOneChannel(T *buffer, StretchParams1Channel *params, 
+                             int inputRange, int height, int width)
+{
+  // Find the median sample and the Median deviation: 1.4826 * median of abs(sample[i] - median).
+  T medianSample;
+  float medDev;
+  medianAndDeviation(buffer, width * height, HasFewValues<T>(), medianSample, medDev);
 
   // Shift everything to 0 -> 1.0.
-  const float medDev = median(deviations);
   const float normalizedMedian = medianSample / static_cast<float>(inputRange);
   const float MADN = 1.4826 * medDev / static_cast<float>(inputRange);
 
@@ -379,7 +452,7 @@ StretchParams Stretch::computeParams(uint8_t *input)
   StretchParams result;
   for (int channel = 0; channel < image_channels; ++channel)
   {
-    int offset = channel * image_width * image_height;
+    const size_t offset = static_cast<size_t>(channel) * image_width * image_height;
     StretchParams1Channel *params = channel == 0 ? &result.grey_red :
       (channel == 1 ? &result.green : &result.blue);
     switch (dataType)
@@ -0,0 +1,85 @@
+/*  TiledImage
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+#include "tiledimage.h"
+
+#include <algorithm>
+
+TiledImage::TiledImage() : m_Tiles(CACHE_KB)
+{
+}
+
+void TiledImage::setImage(const QImage &image)
+{
+    m_Tiles.clear();
+    m_Levels.clear();
+    if(!image.isNull())
+        m_Levels.append(image);
+}
+
+const QImage &TiledImage::level(int number)
+{
+    // Each level is averaged down from the one before, which is what a smooth scale does when it halves an image
+    while(m_Levels.size() <= number)
+    {
+        const QImage &last = m_Levels.last();
+        m_Levels.append(last.scaled(std::max(1, last.width() / 2), std::max(1, last.height() / 2), Qt::IgnoreAspectRatio,
+                                    Qt::SmoothTransformation));
+    }
+    return m_Levels.at(number);
+}
+
+QPixmap TiledImage::renderTile(const QSize &size, const QRect &tile)
+{
+    // The smallest level that still has at least as many pixels as the screen, so the tile is scaled by less than 2
+    int number = 0;
+    while((image().width() >> (number + 1)) >= size.width() && (image().height() >> (number + 1)) >= size.height())
+        number++;
+    const QImage &source = level(number);
+    const double scaleX = static_cast<double>(source.width()) / size.width();
+    const double scaleY = static_cast<double>(source.height()) / size.height();
+    const QRectF sourceRect(tile.x() * scaleX, tile.y() * scaleY, tile.width() * scaleX, tile.height() * scaleY);
+
+    QPixmap rendered(tile.size());
+    rendered.fill(Qt::black);
+    QPainter painter(&rendered);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.drawImage(QRectF(0, 0, tile.width(), tile.height()), source, sourceRect);
+    painter.end();
+    return rendered;
+}
+
+void TiledImage::draw(QPainter &painter, const QSize &size, const QRect &exposed)
+{
+    if(m_Levels.isEmpty() || size.isEmpty())
+        return;
+    const QRect visible = exposed.intersected(QRect(QPoint(0, 0), size));
+    if(visible.isEmpty())
+        return;
+
+    const int firstColumn = visible.left() / TILE_SIZE, lastColumn = visible.right() / TILE_SIZE;
+    const int firstRow = visible.top() / TILE_SIZE, lastRow = visible.bottom() / TILE_SIZE;
+    for(int row = firstRow; row <= lastRow; row++)
+    {
+        for(int column = firstColumn; column <= lastColumn; column++)
+        {
+            // The tiles of every zoom are cached together, the width of the scaled image tells the zooms apart
+            const quint64 key = static_cast<quint64>(size.width()) << 40 | static_cast<quint64>(column) << 20 | row;
+            const QRect tile = QRect(column * TILE_SIZE, row * TILE_SIZE, TILE_SIZE, TILE_SIZE).intersected(QRect(QPoint(0, 0), size));
+            const QPixmap *cached = m_Tiles.object(key);
+            if(cached)
+            {
+                painter.drawPixmap(tile.topLeft(), *cached);
+                continue;
+            }
+            const QPixmap rendered = renderTile(size, tile);
+            painter.drawPixmap(tile.topLeft(), rendered);
+            m_Tiles.insert(key, new QPixmap(rendered), std::max(1, tile.width() * tile.height() * 4 / 1024));
+        }
+    }
+}
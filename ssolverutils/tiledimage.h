@@ -0,0 +1,48 @@
+/*  TiledImage
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+#pragma once
+
+#include <QCache>
+#include <QImage>
+#include <QPainter>
+#include <QPixmap>
+#include <QRect>
+#include <QVector>
+
+// This draws an image at any zoom from tiles, so only the tiles that are visible are ever scaled, and the tiles that were drawn
+// are cached for when they are visible again.  The tiles are scaled from a pyramid of the image halved again and again, from the
+// level that is just bigger than the zoom, so no tile ever samples more than a few pixels of the image for each of its pixels,
+// however big the image is.  The levels are made the first time a zoom needs them.
+class TiledImage
+{
+public:
+    TiledImage();
+
+    void setImage(const QImage &image);
+    const QImage &image() const
+    {
+        return m_Levels.isEmpty() ? m_Null : m_Levels.first();
+    }
+
+    // This draws the part of the image that is scaled to size which is inside exposed, where (0, 0) is the corner of the image
+    void draw(QPainter &painter, const QSize &size, const QRect &exposed);
+
+    // The tiles are this many pixels on each side on the screen
+    static const int TILE_SIZE = 256;
+    // The tiles take at most this many kilobytes
+    static const int CACHE_KB = 256 * 1024;
+
+private:
+    const QImage &level(int number);
+    QPixmap renderTile(const QSize &size, const QRect &tile);
+
+    QImage m_Null;
+    QVector<QImage> m_Levels;       // Level 0 is the image, each one after is half the size of the one before
+    QCache<quint64, QPixmap> m_Tiles;
+};
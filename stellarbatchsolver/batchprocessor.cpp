@@ -0,0 +1,503 @@
+#include "batchprocessor.h"
+#include "starcatalog.h"
+#include "starsummary.h"
+#include <QtConcurrent>
+#include <QFileInfo>
+#include <QTextStream>
+
+BatchProcessor::BatchProcessor(QList<Image> &images, QObject *parent) : QObject(parent), images(images)
+{
+    m_IOThreads.setMaxThreadCount(fits_is_reentrant() ? 2 : 1);
+    connect(&stellarSolver, &StellarSolver::logOutput, this, &BatchProcessor::logOutput);
+}
+
+BatchProcessor::~BatchProcessor()
+{
+    aborted = true;
+    stellarSolver.abortAndWait();
+    m_IOThreads.waitForDone();
+}
+
+void BatchProcessor::start(const BatchOptions &options)
+{
+    if(m_Running)
+        return;
+    m_Options = options;
+    m_Options.queueDepth = qMax(1, m_Options.queueDepth);
+    m_Running = true;
+    aborted = false;
+    m_NextImageToLoad = 0;
+    m_ImagesLoading = 0;
+    m_LoadedImages.clear();
+    m_ImagesSaving = 0;
+    currentImageNum = -1;
+    currentProgress = 0;
+    m_Times = QVector<StageTimes>(images.count());
+    m_Results = QVector<ResultsDatabase::ImageResult>(images.count());
+    m_BatchTimer.start();
+
+    // The results are written on this thread in transactions of many images, so the database costs next to nothing per image
+    if(!m_Options.resultsDatabase.isEmpty() && !m_Database.open(m_Options.resultsDatabase))
+        emit logOutput("The results database could not be opened, the results will not be written to it: " + m_Database.lastError());
+
+    if(m_Options.saveResults && !QFileInfo(m_Options.outputDirectory).exists())
+    {
+        emit logOutput("File output directory does not exist, output files will not be written.");
+        m_Options.saveResults = false;
+    }
+
+    emit progress(currentProgress);
+    loadImages();
+    checkFinished();
+}
+
+void BatchProcessor::abort()
+{
+    if(!m_Running)
+        return;
+    aborted = true;
+    stellarSolver.abort();
+}
+
+// This keeps the I/O threads reading the next images until the queue in front of the solver is full
+void BatchProcessor::loadImages()
+{
+    while(!aborted && m_NextImageToLoad < images.count() && m_ImagesLoading + m_LoadedImages.count() < m_Options.queueDepth)
+    {
+        int num = m_NextImageToLoad++;
+        const Image &image = images.at(num);
+        if(image.hasSolved && image.hasExtracted)
+        {
+            currentProgress += 2;
+            emit progress(currentProgress);
+            // The image only needs to be loaded again if it is to be saved
+            if(!m_Options.saveResults)
+                continue;
+        }
+
+        m_ImagesLoading++;
+        QFutureWatcher<LoadedImage> *watcher = new QFutureWatcher<LoadedImage>(this);
+        connect(watcher, &QFutureWatcher<LoadedImage>::finished, this, [this, watcher, num]()
+        {
+            watcher->deleteLater();
+            imageLoaded(num, watcher->result());
+        });
+        const QString fileName = image.fileName;
+        watcher->setFuture(QtConcurrent::run(&m_IOThreads, [this, fileName]()
+        {
+            return readImage(fileName);
+        }));
+    }
+}
+
+BatchProcessor::LoadedImage BatchProcessor::readImage(const QString &fileName)
+{
+    LoadedImage loaded;
+    QElapsedTimer timer;
+    timer.start();
+    fileio imageLoader;
+    imageLoader.logToSignal = true;
+    // The buffers are freed with releaseImageBuffer, so they can be mapped from the files
+    imageLoader.useMemoryMapping = true;
+    imageLoader.decompressionThreads = m_Options.decompressionThreads;
+    imageLoader.debayerToLuminance = true;
+    connect(&imageLoader, &fileio::logOutput, this, &BatchProcessor::logOutput);
+    if(!imageLoader.loadImageBufferOnly(fileName))
+    {
+        emit logOutput("Error in loading image file " + fileName);
+        return loaded;
+    }
+    loaded.m_ImageBuffer = imageLoader.getImageBuffer();
+    loaded.stats = imageLoader.getStats();
+    loaded.m_HeaderRecords = imageLoader.getRecords();
+    loaded.positionGiven = imageLoader.position_given;
+    loaded.searchPosition.ra = imageLoader.ra;
+    loaded.searchPosition.dec = imageLoader.dec;
+    loaded.scaleGiven = imageLoader.scale_given;
+    loaded.searchScale.scale_low = imageLoader.scale_low;
+    loaded.searchScale.scale_high = imageLoader.scale_high;
+    loaded.searchScale.scale_units = imageLoader.scale_units;
+    loaded.elapsed = timer.elapsed();
+    return loaded;
+}
+
+void BatchProcessor::imageLoaded(int num, const LoadedImage &loaded)
+{
+    m_ImagesLoading--;
+    if(aborted || !loaded.m_ImageBuffer)
+    {
+        fileio::releaseImageBuffer(loaded.m_ImageBuffer);
+        // The progress of an image that was already processed was counted when it was queued
+        const Image &image = images.at(num);
+        if(!aborted && !(image.hasSolved && image.hasExtracted))
+        {
+            emit imageSolved(num);
+            emit imageExtracted(num);
+            currentProgress += 2;
+            emit progress(currentProgress);
+        }
+        loadImages();
+        checkFinished();
+        return;
+    }
+
+    Image &image = images[num];
+    image.m_ImageBuffer = loaded.m_ImageBuffer;
+    image.stats = loaded.stats;
+    image.m_HeaderRecords = loaded.m_HeaderRecords;
+    if(loaded.positionGiven && !image.searchPosition)
+        image.searchPosition = new FITSImage::wcs_point(loaded.searchPosition);
+    if(loaded.scaleGiven && !image.searchScale)
+        image.searchScale = new ImageScale(loaded.searchScale);
+    m_Times[num].load = loaded.elapsed;
+
+    m_LoadedImages.enqueue(num);
+    solveNextImage();
+}
+
+// The solver takes the next loaded image unless as many images as the queue depth are still waiting to be saved
+void BatchProcessor::solveNextImage()
+{
+    while(!aborted && currentImageNum < 0 && !m_LoadedImages.isEmpty() && m_ImagesSaving < m_Options.queueDepth)
+    {
+        int num = m_LoadedImages.dequeue();
+        const Image &image = images.at(num);
+        if(image.hasSolved && image.hasExtracted)
+        {
+            finishImage(num);
+            continue;
+        }
+        currentImageNum = num;
+        solvingBlind = false;
+        m_Results[num].fileName = image.fileName;
+        m_Results[num].width = image.stats.width;
+        m_Results[num].height = image.stats.height;
+        m_StageTimer.start();
+        solveImage();
+    }
+    // Taking the image out of the queue makes room to load another one
+    loadImages();
+}
+
+void BatchProcessor::solveImage()
+{
+    const Image &currentImage = images.at(currentImageNum);
+    stellarSolver.loadNewImageBuffer(currentImage.stats, currentImage.m_ImageBuffer);
+    stellarSolver.setProperty("ProcessType", SSolver::SOLVE);
+    stellarSolver.setParameterProfile(m_Options.solveProfile);
+    stellarSolver.setIndexFolderPaths(m_Options.indexFolderPaths);
+
+    if(solvingBlind)
+    {
+        stellarSolver.clearSearchPosition();
+        stellarSolver.clearSearchScale();
+    }
+    else
+    {
+        if(currentImage.searchPosition)
+            stellarSolver.setSearchPositionRaDec(currentImage.searchPosition->ra, currentImage.searchPosition->dec);
+        else
+            stellarSolver.clearSearchPosition();
+        if(currentImage.searchScale)
+            stellarSolver.setSearchScale(currentImage.searchScale->scale_low, currentImage.searchScale->scale_high, currentImage.searchScale->scale_units);
+        else
+            stellarSolver.clearSearchScale();
+    }
+    stellarSolver.setColorChannel(m_Options.colorChannel);
+    connect(&stellarSolver, &StellarSolver::finished, this, &BatchProcessor::solverComplete);
+    stellarSolver.start();
+}
+
+void BatchProcessor::solverComplete()
+{
+    disconnect(&stellarSolver, &StellarSolver::finished, this, &BatchProcessor::solverComplete);
+    int num = currentImageNum;
+    if(aborted)
+    {
+        emit logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
+        emit logOutput("Solving was Aborted");
+        releaseImage(num);
+        currentImageNum = -1;
+        checkFinished();
+        return;
+    }
+    Image &currentImage = images[num];
+    if(stellarSolver.solvingDone())
+    {
+        currentImage.solution = stellarSolver.getSolution();
+        if(stellarSolver.hasWCSData())
+        {
+            currentImage.wcsData = stellarSolver.getWCSData();
+            currentImage.hasWCSData = true;
+        }
+        currentImage.hasSolved = true;
+    }
+    else if(!solvingBlind && ( currentImage.searchScale || currentImage.searchPosition))
+    {
+        emit logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
+        emit logOutput("Solving failed with position/scale, trying again with a blind solve.");
+        emit logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
+        solvingBlind = true;
+        solveImage();
+        return;
+    }
+    m_Times[num].solve = m_StageTimer.restart();
+    ResultsDatabase::ImageResult &result = m_Results[num];
+    result.solved = currentImage.hasSolved;
+    result.solution = currentImage.solution;
+    result.solveMs = m_Times[num].solve;
+    result.quadsTried = stellarSolver.getSolveMetrics().quadsTried;
+    result.verifications = stellarSolver.getSolveMetrics().verifications;
+    emit imageSolved(num);
+    currentProgress++;
+    emit progress(currentProgress);
+    solvingBlind = false;
+    extractImage();
+}
+
+void BatchProcessor::extractImage()
+{
+    if(m_Options.calculateHFR)
+        stellarSolver.setProperty("ProcessType", SSolver::EXTRACT_WITH_HFR);
+    else
+        stellarSolver.setProperty("ProcessType", SSolver::EXTRACT);
+    stellarSolver.setColorChannel(m_Options.colorChannel);
+    stellarSolver.setParameterProfile(m_Options.extractProfile);
+    connect(&stellarSolver, &StellarSolver::finished, this, &BatchProcessor::extractorComplete);
+    stellarSolver.start();
+}
+
+void BatchProcessor::extractorComplete()
+{
+    disconnect(&stellarSolver, &StellarSolver::finished, this, &BatchProcessor::extractorComplete);
+    int num = currentImageNum;
+    currentImageNum = -1;
+    if(aborted)
+    {
+        emit logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
+        emit logOutput("Extraction was Aborted");
+        releaseImage(num);
+        checkFinished();
+        return;
+    }
+    Image &currentImage = images[num];
+    if(stellarSolver.extractionDone())
+    {
+        currentImage.stars = stellarSolver.getStarList();
+        currentImage.hasHFRData = stellarSolver.isCalculatingHFR();
+        currentImage.hasExtracted = true;
+        m_Results[num].extracted = true;
+        m_Results[num].quality = StarSummary::summarize(currentImage.stars, stellarSolver.getBackground());
+    }
+    m_Times[num].extract = m_StageTimer.elapsed();
+    m_Results[num].extractMs = m_Times[num].extract;
+    emit imageExtracted(num);
+    currentProgress++;
+    emit progress(currentProgress);
+
+    finishImage(num);
+    solveNextImage();
+}
+
+// This hands the image over to the I/O threads to be saved, while the solver goes on with the next one
+void BatchProcessor::finishImage(int num)
+{
+    const Image &image = images.at(num);
+    if(m_Database.isOpen() && !m_Results.at(num).fileName.isEmpty() && !m_Database.add(m_Results.at(num)))
+        emit logOutput("The result could not be written to the results database: " + m_Database.lastError());
+    if(!m_Options.saveResults || (!image.hasSolved && !image.hasExtracted))
+    {
+        logTimes(num);
+        releaseImage(num);
+        checkFinished();
+        return;
+    }
+
+    m_ImagesSaving++;
+    QFutureWatcher<qint64> *watcher = new QFutureWatcher<qint64>(this);
+    connect(watcher, &QFutureWatcher<qint64>::finished, this, [this, watcher, num]()
+    {
+        watcher->deleteLater();
+        imageSaved(num, watcher->result());
+    });
+    // The copy shares its lists with the image, and the buffer is not deleted until the save is done
+    const Image imageCopy = image;
+    const QString outputDirectory = m_Options.outputDirectory;
+    const SolutionOutput solutionOutput = m_Options.solutionOutput;
+    const StarListFormat starListFormat = m_Options.starListFormat;
+    watcher->setFuture(QtConcurrent::run(&m_IOThreads, [this, imageCopy, outputDirectory, solutionOutput, starListFormat]()
+    {
+        QElapsedTimer timer;
+        timer.start();
+        if(imageCopy.hasSolved)
+            saveImage(imageCopy, outputDirectory, solutionOutput);
+        if(imageCopy.hasExtracted)
+            saveStarList(imageCopy, outputDirectory, starListFormat);
+        return timer.elapsed();
+    }));
+}
+
+void BatchProcessor::imageSaved(int num, qint64 elapsed)
+{
+    m_ImagesSaving--;
+    m_Times[num].save = elapsed;
+    logTimes(num);
+    releaseImage(num);
+    // A save finishing can let the solver take the next image
+    if(!aborted)
+        solveNextImage();
+    checkFinished();
+}
+
+void BatchProcessor::logTimes(int num)
+{
+    const StageTimes &times = m_Times.at(num);
+    emit logOutput(QString("%1: loaded in %2 ms, solved in %3 ms, extracted in %4 ms, saved in %5 ms")
+                   .arg(QFileInfo(images.at(num).fileName).fileName()).arg(times.load).arg(times.solve)
+                   .arg(times.extract).arg(times.save));
+}
+
+void BatchProcessor::releaseImage(int num)
+{
+    Image &image = images[num];
+    fileio::releaseImageBuffer(image.m_ImageBuffer);
+    image.m_ImageBuffer = nullptr;
+}
+
+void BatchProcessor::checkFinished()
+{
+    if(!m_Running || m_ImagesLoading > 0 || m_ImagesSaving > 0 || currentImageNum >= 0)
+        return;
+    if(!aborted && (m_NextImageToLoad < images.count() || !m_LoadedImages.isEmpty()))
+        return;
+
+    // The images that were loaded but never solved because of an abort still have their buffers
+    while(!m_LoadedImages.isEmpty())
+        releaseImage(m_LoadedImages.dequeue());
+
+    StageTimes total;
+    for(const StageTimes &times : m_Times)
+    {
+        total.load += times.load;
+        total.solve += times.solve;
+        total.extract += times.extract;
+        total.save += times.save;
+    }
+    m_Running = false;
+    m_Database.close();
+    emit logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
+    emit logOutput(QString("Total time in each stage: loading %1 s, solving %2 s, extracting %3 s, saving %4 s")
+                   .arg(total.load / 1000.0).arg(total.solve / 1000.0).arg(total.extract / 1000.0).arg(total.save / 1000.0));
+    emit logOutput(QString("The whole batch took %1 s with the stages overlapping").arg(m_BatchTimer.elapsed() / 1000.0));
+    emit logOutput(aborted ? "Processing was Aborted" : "Processing Complete!");
+    emit finished();
+}
+
+// Rewriting a whole image just to add its solution is most of the I/O of a big archive, so the solution can
+// instead be written to the header of the file itself, or to a small .wcs file next to the other results
+void BatchProcessor::saveImage(const Image &image, const QString &outputDirectory, SolutionOutput solutionOutput)
+{
+    QFileInfo outputDirInfo = QFileInfo(outputDirectory);
+    const WCSData *wcs = image.hasWCSData ? &image.wcsData : nullptr;
+    const QString suffix = QFileInfo(image.fileName).suffix().toLower();
+    const bool isFITS = suffix == "fits" || suffix == "fit" || suffix == "fz";
+    if(solutionOutput == UPDATE_IN_PLACE && isFITS)
+    {
+        emit logOutput("Writing the solution to the header of: " + image.fileName);
+        fileio stamper;
+        stamper.logToSignal = false;
+        stamper.stampSolution(image.fileName, image.fileName, image.solution, wcs);
+        return;
+    }
+    if(solutionOutput == SAVE_WCS_FILE)
+    {
+        QString wcsPath = outputDirInfo.absoluteFilePath() + QDir::separator() + QFileInfo(image.fileName).baseName() + ".wcs";
+        emit logOutput("Saving the solution to: " + wcsPath);
+        fileio wcsSaver;
+        wcsSaver.logToSignal = false;
+        wcsSaver.saveWCSFile(wcsPath, image.stats.width, image.stats.height, image.solution, wcs);
+        return;
+    }
+    // The other image formats don't have a header to write the solution to, so they are saved as a FITS copy
+    QString savePath = outputDirInfo.absoluteFilePath() + QDir::separator() + QFileInfo(image.fileName).baseName() + "_solved.fits";
+    emit logOutput("Saving solved image to: " + savePath);
+    fileio imageSaver;
+    imageSaver.logToSignal = false;
+    QList<fileio::Record> records = image.m_HeaderRecords;
+    FITSImage::Statistic stats = image.stats;
+    imageSaver.saveAsFITS(savePath, stats, image.m_ImageBuffer, image.solution, records, image.hasWCSData, wcs);
+}
+
+// Formatting every value as text is most of the time of saving a big star list, so it can be saved with its columns as they are
+void BatchProcessor::saveStarList(const Image &image, const QString &outputDirectory, StarListFormat format)
+{
+    QFileInfo outputDirInfo = QFileInfo(outputDirectory);
+    if(format == STAR_LIST_BINARY)
+    {
+        QString savePath = outputDirInfo.absoluteFilePath() + QDir::separator() + QFileInfo(image.fileName).baseName() + "_extracted.starcat";
+        emit logOutput("Saving starList to: " + savePath);
+        int columns = StarCatalog::NO_OPTIONAL_COLUMNS;
+        if(image.hasHFRData)
+            columns |= StarCatalog::HFR_COLUMN;
+        if(image.hasSolved)
+            columns |= StarCatalog::SKY_COLUMNS;
+        if(!StarCatalog(image.stars).save(savePath, columns))
+            emit logOutput("Unable to write to file" + savePath);
+        return;
+    }
+    QString savePath = outputDirInfo.absoluteFilePath() + QDir::separator() + QFileInfo(image.fileName).baseName() + "_extracted.csv";
+    emit logOutput("Saving starList to: " + savePath);
+
+    QFile file;
+    file.setFileName(savePath);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        emit logOutput("Unable to write to file" + savePath);
+        return;
+    }
+
+    QTextStream outstream(&file);
+    outstream << "MAG_AUTO" << ",";
+    if(image.hasSolved)
+    {
+        outstream << "RA (J2000)" << ",";
+        outstream << "DEC (J2000)" << ",";
+    }
+    outstream << "X_IMAGE" << ",";
+    outstream << "Y_IMAGE" << ",";
+    outstream << "FLUX_AUTO" << ",";
+    outstream << "PEAK" << ",";
+    if(image.hasHFRData)
+         outstream << "HFR" << ",";
+    outstream << "a" << ",";
+    outstream << "b" << ",";
+    outstream << "theta";
+    outstream << "\n";
+
+    for(int i = 0; i < image.stars.size(); i ++)
+    {
+        const FITSImage::Star &star = image.stars.at(i);
+        outstream << QString::number(star.mag) << ",";
+        if(image.hasSolved)
+        {
+            outstream << " " << StellarSolver::raString(star.ra) << " " << ",";
+            outstream << " " << StellarSolver::decString(star.dec) << " " << ",";
+        }
+        outstream << QString::number(star.x) << ",";
+        outstream << QString::number(star.y) << ",";
+        outstream << QString::number(star.flux) << ",";
+        outstream << QString::number(star.peak) << ",";
+        if(image.hasHFRData)
+             outstream << QString::number(star.HFR) << ",";
+        outstream << QString::number(star.a) << ",";
+        outstream << QString::number(star.b) << ",";
+        outstream << QString::number(star.theta);
+        outstream << "\n";
+    }
+
+    #if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        outstream << Qt::endl;
+    #else
+        outstream << endl;
+    #endif
+}
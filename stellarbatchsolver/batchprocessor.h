@@ -0,0 +1,189 @@
+#ifndef BATCHPROCESSOR_H
+#define BATCHPROCESSOR_H
+
+#include <QObject>
+#include <QQueue>
+#include <QVector>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include "structuredefinitions.h"
+#include "ssolverutils/fileio.h"
+#include "stellarsolver.h"
+#include "wcsdata.h"
+#include "resultsdatabase.h"
+
+// This is a struct with the estimated Image Scales
+typedef struct ImageScale
+{
+    double scale_low;
+    double scale_high;
+    ScaleUnits scale_units;
+
+} ImageScale;
+
+typedef struct Image
+{
+    QString fileName;
+    FITSImage::Statistic stats;
+    bool hasSolved = false;
+    FITSImage::Solution solution;
+    bool hasExtracted = false;
+    bool hasHFRData = false;
+    QList<FITSImage::Star> stars;
+    QList<fileio::Record> m_HeaderRecords;
+    QImage rawImage;
+    bool hasWCSData = false;
+    WCSData wcsData;
+
+    uint8_t *m_ImageBuffer { nullptr };
+    FITSImage::wcs_point *searchPosition { nullptr };
+    ImageScale *searchScale{ nullptr };
+
+}Image;
+
+// These are the ways the solutions of a batch can be saved
+typedef enum SolutionOutput
+{
+    SAVE_SOLVED_COPY,   // A copy of the image with the solution in its header goes to the output directory
+    UPDATE_IN_PLACE,    // The solution is written to the header of the FITS file itself, without rewriting its data
+    SAVE_WCS_FILE       // The solution goes to a .wcs file with just a header in the output directory
+} SolutionOutput;
+
+// These are the formats the star lists of a batch can be saved in
+typedef enum StarListFormat
+{
+    STAR_LIST_CSV,      // A _extracted.csv file with the values as text, for spreadsheets
+    STAR_LIST_BINARY    // A _extracted.starcat file with the columns as they are in memory, see StarCatalog::save
+} StarListFormat;
+
+// These are the options for processing a batch of images
+typedef struct BatchOptions
+{
+    SSolver::Parameters::ParametersProfile solveProfile = SSolver::Parameters::PARALLEL_SMALLSCALE;
+    SSolver::Parameters::ParametersProfile extractProfile = SSolver::Parameters::ALL_STARS;
+    QStringList indexFolderPaths;
+    int colorChannel = FITSImage::GREEN;
+    bool calculateHFR = false;
+    bool saveResults = false;
+    QString outputDirectory;
+    int queueDepth = 2;     // How many images can wait between the stages, see BatchProcessor
+    int decompressionThreads = 0;   // How many threads decode the tiles of a compressed FITS image, 0 is one for each core
+    SolutionOutput solutionOutput = SAVE_SOLVED_COPY;   // How the solved images are saved when the results are saved
+    StarListFormat starListFormat = STAR_LIST_CSV;      // How the star lists are saved when the results are saved
+    QString resultsDatabase;    // If it is set, the results of the images also go to this SQLite file, see ResultsDatabase
+
+} BatchOptions;
+
+// This is how long each stage of the pipeline took for an image, in milliseconds
+typedef struct StageTimes
+{
+    qint64 load = 0;
+    qint64 solve = 0;
+    qint64 extract = 0;
+    qint64 save = 0;
+
+} StageTimes;
+
+/**
+ * @brief The BatchProcessor class solves and extracts the stars of a list of images in a pipeline of three stages.
+ * The files are read and decoded on the I/O threads, the images are solved and extracted one at a time with a StellarSolver,
+ * and the solved images and star lists are written on the I/O threads again, so that loading image N+1, solving image N
+ * and saving image N-1 happen at the same time.  The queue depth limits how many images are loaded ahead of the solver
+ * and how many are waiting to be saved, which is how many image buffers are in memory.
+ * The images already solved and extracted are not done again, but they are still saved.
+ */
+class BatchProcessor : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief BatchProcessor makes a processor for a list of images
+     * @param images is the list of images, which must not change while it is running
+     */
+    explicit BatchProcessor(QList<Image> &images, QObject *parent = nullptr);
+    ~BatchProcessor();
+
+    /**
+     * @brief start processes all of the images with the given options
+     */
+    void start(const BatchOptions &options);
+
+    /**
+     * @brief abort stops the processing.  The images being loaded and saved are finished first, the others are left as they were.
+     */
+    void abort();
+
+    bool isRunning() const
+    {
+        return m_Running;
+    }
+
+signals:
+    void logOutput(QString text);
+    // These are emitted when the solve and the star extraction of an image are done, whether they succeeded or not
+    void imageSolved(int num);
+    void imageExtracted(int num);
+    // This counts two steps for each image, the solve and the star extraction
+    void progress(int value);
+    void finished();
+
+private:
+    // This is what the I/O threads read from an image file
+    typedef struct LoadedImage
+    {
+        uint8_t *m_ImageBuffer { nullptr };
+        FITSImage::Statistic stats;
+        QList<fileio::Record> m_HeaderRecords;
+        bool positionGiven = false;
+        FITSImage::wcs_point searchPosition;
+        bool scaleGiven = false;
+        ImageScale searchScale;
+        qint64 elapsed = 0;
+    } LoadedImage;
+
+    // The pipeline stages
+    void loadImages();
+    void imageLoaded(int num, const LoadedImage &loaded);
+    void solveNextImage();
+    void solveImage();
+    void solverComplete();
+    void extractImage();
+    void extractorComplete();
+    void finishImage(int num);
+    void imageSaved(int num, qint64 elapsed);
+    void checkFinished();
+
+    // These are run on the I/O threads
+    LoadedImage readImage(const QString &fileName);
+    void saveImage(const Image &image, const QString &outputDirectory, SolutionOutput solutionOutput);
+    void saveStarList(const Image &image, const QString &outputDirectory, StarListFormat format);
+
+    void logTimes(int num);
+    void releaseImage(int num);
+
+    QList<Image> &images;
+    BatchOptions m_Options;
+    StellarSolver stellarSolver;
+
+    // The loads and the saves run on these threads.  CFITSIO may not be built to be used by two threads at once, then there is only one.
+    QThreadPool m_IOThreads;
+
+    bool m_Running = false;
+    bool aborted = false;
+    int m_NextImageToLoad = 0;                  // The next image of the list to load
+    int m_ImagesLoading = 0;                    // The number of images being read by the I/O threads
+    QQueue<int> m_LoadedImages;                 // The images that were loaded and are waiting for the solver
+    int m_ImagesSaving = 0;                     // The number of images being written by the I/O threads
+    int currentImageNum = -1;                   // The image that is being solved, or -1
+    bool solvingBlind = false;
+    int currentProgress = 0;
+
+    QVector<StageTimes> m_Times;                // How long each stage took for each image
+    ResultsDatabase m_Database;                 // The results of the images, if there is a results database
+    QVector<ResultsDatabase::ImageResult> m_Results;    // The result of each image for the database, the file is only set if it was processed
+    QElapsedTimer m_StageTimer;                 // This times the solve and the extraction of the current image
+    QElapsedTimer m_BatchTimer;                 // This times the whole batch
+};
+
+#endif // BATCHPROCESSOR_H
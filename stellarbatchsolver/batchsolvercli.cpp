@@ -0,0 +1,308 @@
+// A command line program that solves and extracts the stars of batches of images, without a display.
+//
+// Build with:
+// mkdir build
+// cd build
+// cmake -DCMAKE_BUILD_TYPE=RelWithDebInfo -DBUILD_BATCH_SOLVER_CLI=ON ..
+// make -j 4
+//
+// Examples:
+// StellarBatchSolverCLI -I /usr/share/astrometry -o results img1.fits img2.fits
+// StellarBatchSolverCLI -I /usr/share/astrometry -o results --list images.txt
+// StellarBatchSolverCLI -I /usr/share/astrometry -o results --watch /data/incoming
+// StellarBatchSolverCLI -I /usr/share/astrometry --hot-folder /data/camera
+
+#include "batchsolvercli.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+
+// These are the image files that fileio can read
+static const QStringList imageFilters = QStringList() << "*.fits" << "*.fit" << "*.fz" << "*.bmp" << "*.gif" << "*.jpg" << "*.jpeg"
+                                        << "*.png" << "*.tif" << "*.tiff";
+
+BatchSolverCLI::BatchSolverCLI(const BatchOptions &options, bool quiet, QObject *parent) : QObject(parent),
+    m_Options(options), m_Quiet(quiet)
+{
+    connect(&processor, &BatchProcessor::logOutput, this, &BatchSolverCLI::logOutput);
+    connect(&processor, &BatchProcessor::imageExtracted, this, &BatchSolverCLI::imageExtracted);
+    connect(&processor, &BatchProcessor::finished, this, &BatchSolverCLI::processingFinished);
+    connect(&m_WatchTimer, &QTimer::timeout, this, &BatchSolverCLI::scanDirectory);
+}
+
+void BatchSolverCLI::logOutput(QString text)
+{
+    if(!m_Quiet)
+        printf("%s\n", text.toUtf8().data());
+    fflush(stdout);
+}
+
+void BatchSolverCLI::solveFiles(const QStringList &fileNames)
+{
+    addImages(fileNames);
+}
+
+// The directory is scanned on a timer rather than with a QFileSystemWatcher, which misses the files
+// written to network and container volumes, and a file is only queued once it stops growing.
+void BatchSolverCLI::watchDirectory(const QString &directory)
+{
+    m_WatchDirectory = directory;
+    logOutput("Watching " + directory + " for new images");
+    scanDirectory();
+    m_WatchTimer.start(2000);
+}
+
+bool BatchSolverCLI::hotFolder(const QString &directory)
+{
+    // The solved files must not be written to the watched directory, or they would be solved again
+    m_StampDirectory = m_Options.saveResults ? m_Options.outputDirectory : QString();
+    if(m_StampDirectory.isEmpty() || QFileInfo(m_StampDirectory).absoluteFilePath() == QFileInfo(directory).absoluteFilePath())
+        m_StampDirectory = QDir(directory).filePath("solved");
+    QDir().mkpath(m_StampDirectory);
+
+    m_HotFolderSettings.setParameterProfile(m_Options.solveProfile);
+    m_HotFolderSettings.setIndexFolderPaths(m_Options.indexFolderPaths);
+    m_HotFolderSettings.setColorChannel(m_Options.colorChannel);
+    if(m_Quiet)
+        m_HotFolderSettings.setSSLogLevel(SSolver::LOG_OFF);
+    connect(&m_HotFolderSettings, &StellarSolver::logOutput, this, &BatchSolverCLI::logOutput);
+
+    m_HotFolder = new HotFolderSolver(&m_HotFolderSettings, fileio::batchImageLoader(), this);
+    connect(m_HotFolder, &HotFolderSolver::logOutput, this, &BatchSolverCLI::logOutput);
+    connect(m_HotFolder, &HotFolderSolver::imageSolved, this, &BatchSolverCLI::hotFolderImageSolved);
+    return m_HotFolder->start(directory);
+}
+
+void BatchSolverCLI::hotFolderImageSolved(const QString &fileName, bool solved, StellarSolver *solver, qint64 latency)
+{
+    if(!solved)
+    {
+        printf("%s: not solved\n", fileName.toUtf8().data());
+        fflush(stdout);
+        return;
+    }
+    const FITSImage::Solution solution = solver->getSolution();
+    const QString savePath = QDir(m_StampDirectory).filePath(QFileInfo(fileName).completeBaseName() + "_solved.fits");
+    fileio stamper;
+    stamper.logToSignal = !m_Quiet;
+    connect(&stamper, &fileio::logOutput, this, &BatchSolverCLI::logOutput);
+    stamper.stampSolution(fileName, savePath, solution);
+    // The latency counts from the end of the exposure, when the file was last written, to the solution being saved
+    printf("%s: solved, RA %s, DEC %s, %lld ms after it was written\n", fileName.toUtf8().data(),
+           StellarSolver::raString(solution.ra).toUtf8().data(), StellarSolver::decString(solution.dec).toUtf8().data(),
+           static_cast<long long>(latency));
+    fflush(stdout);
+}
+
+void BatchSolverCLI::scanDirectory()
+{
+    QStringList readyFiles;
+    const QFileInfoList files = QDir(m_WatchDirectory).entryInfoList(imageFilters, QDir::Files, QDir::Time | QDir::Reversed);
+    for(const QFileInfo &file : files)
+    {
+        const QString fileName = file.absoluteFilePath();
+        // These are the results of this program, in case they are saved to the watched directory
+        if(m_SeenFiles.contains(fileName) || file.completeBaseName().endsWith("_solved"))
+            continue;
+        if(m_GrowingFiles.contains(fileName) && m_GrowingFiles.value(fileName) == file.size())
+        {
+            m_GrowingFiles.remove(fileName);
+            m_SeenFiles.insert(fileName);
+            readyFiles.append(fileName);
+        }
+        else
+            m_GrowingFiles.insert(fileName, file.size());
+    }
+    if(!readyFiles.isEmpty())
+        addImages(readyFiles);
+}
+
+// The list of images can't change while the processor works on it, so the new files wait for the next batch
+void BatchSolverCLI::addImages(const QStringList &fileNames)
+{
+    m_PendingFiles.append(fileNames);
+    if(!processor.isRunning())
+        startProcessing();
+}
+
+void BatchSolverCLI::startProcessing()
+{
+    clearImages();
+    for(const QString &fileName : m_PendingFiles)
+    {
+        Image newImage;
+        newImage.fileName = fileName;
+        images.append(newImage);
+    }
+    m_PendingFiles.clear();
+    if(images.isEmpty())
+    {
+        processingFinished();
+        return;
+    }
+    processor.start(m_Options);
+}
+
+void BatchSolverCLI::imageExtracted(int num)
+{
+    const Image &image = images.at(num);
+    if(!image.hasSolved)
+        m_FailedImages++;
+    // This goes to stdout even in the quiet mode, so that the results can be collected
+    if(image.hasSolved)
+        printf("%s: solved, RA %s, DEC %s, %d stars\n", image.fileName.toUtf8().data(),
+               StellarSolver::raString(image.solution.ra).toUtf8().data(), StellarSolver::decString(image.solution.dec).toUtf8().data(),
+               image.stars.count());
+    else
+        printf("%s: not solved, %d stars\n", image.fileName.toUtf8().data(), image.stars.count());
+    fflush(stdout);
+}
+
+void BatchSolverCLI::processingFinished()
+{
+    if(!m_PendingFiles.isEmpty())
+    {
+        startProcessing();
+        return;
+    }
+    clearImages();
+    if(m_WatchDirectory.isEmpty())
+        QCoreApplication::exit(m_FailedImages > 0 ? 1 : 0);
+}
+
+void BatchSolverCLI::clearImages()
+{
+    for(Image &image : images)
+    {
+        fileio::releaseImageBuffer(image.m_ImageBuffer);
+        delete image.searchPosition;
+        delete image.searchScale;
+    }
+    images.clear();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+    QCoreApplication::setApplicationName("StellarBatchSolverCLI");
+    QCoreApplication::setApplicationVersion(StellarSolver::getVersionNumber());
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Plate solves and extracts the stars of batches of images without a display.\n"
+                                     "The image files can be FITS, tile compressed FITS, JPG, PNG, TIFF, BMP and GIF.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("images", "The image files to process.", "[images...]");
+    QCommandLineOption indexOption(QStringList() << "I" << "index", "Add a directory of index files, the default ones are used if there are none.", "directory");
+    QCommandLineOption listOption(QStringList() << "l" << "list", "Process the image files listed in a file, one on each line.", "file");
+    QCommandLineOption watchOption(QStringList() << "w" << "watch", "Keep processing the image files written to a directory.", "directory");
+    QCommandLineOption hotFolderOption("hot-folder", "Keep solving the FITS files written to a directory as soon as they are done, and save copies "
+                                       "of them with the solution in their headers to the output directory, or to a solved directory in it.", "directory");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Save the solved images and the star lists to a directory.", "directory");
+    QCommandLineOption solveProfileOption("solve-profile", "The number of the built in profile to solve with, 3 by default.", "profile", "3");
+    QCommandLineOption extractProfileOption("extract-profile", "The number of the built in profile to extract the stars with, 4 by default.", "profile", "4");
+    QCommandLineOption channelOption("channel", "The color channel of RGB images: 0 red, 1 green, 2 blue, 3 average, 4 integrated.", "channel", "1");
+    QCommandLineOption hfrOption("hfr", "Measure the HFR of the stars, which takes longer.");
+    QCommandLineOption queueOption("queue-depth", "How many images can wait between the loading, the solving and the saving.", "depth", "2");
+    QCommandLineOption solutionOutputOption("solution-output", "How the solutions are saved: copy writes a solved copy of each image to the output directory, "
+                                            "header writes the solution into the header of the FITS file itself, wcs writes a .wcs file to the output directory.", "mode", "copy");
+    QCommandLineOption starListOption("star-list-format", "How the star lists are saved: csv writes a text file that spreadsheets can open, "
+                                      "binary writes the columns of the stars as they are in memory, which is much faster to write and to load, "
+                                      "see StarCatalog::load.", "format", "csv");
+    QCommandLineOption resultsOption("results-db", "Also keep the results of the images in a SQLite database, which is much faster to query "
+                                     "for a report on a big batch than the files of each image.", "file");
+    QCommandLineOption decodeThreadsOption("decode-threads", "How many threads decode the tiles of a compressed FITS image, 0 by default, which is one for each core.", "threads", "0");
+    QCommandLineOption quietOption(QStringList() << "q" << "quiet", "Only print the result of each image.");
+    parser.addOptions(QList<QCommandLineOption>() << indexOption << listOption << watchOption << hotFolderOption << outputOption << solveProfileOption
+                      << extractProfileOption << channelOption << hfrOption << queueOption << solutionOutputOption << starListOption << resultsOption << decodeThreadsOption << quietOption);
+    parser.process(app);
+
+    BatchOptions options;
+    options.indexFolderPaths = parser.values(indexOption);
+    if(options.indexFolderPaths.isEmpty())
+        options.indexFolderPaths = StellarSolver::getDefaultIndexFolderPaths();
+    const int profiles = StellarSolver::getBuiltInProfiles().count();
+    options.solveProfile = (SSolver::Parameters::ParametersProfile) qBound(0, parser.value(solveProfileOption).toInt(), profiles - 1);
+    options.extractProfile = (SSolver::Parameters::ParametersProfile) qBound(0, parser.value(extractProfileOption).toInt(), profiles - 1);
+    options.colorChannel = parser.value(channelOption).toInt();
+    options.calculateHFR = parser.isSet(hfrOption);
+    options.queueDepth = parser.value(queueOption).toInt();
+    options.decompressionThreads = qMax(0, parser.value(decodeThreadsOption).toInt());
+    const QString solutionOutput = parser.value(solutionOutputOption);
+    if(solutionOutput == "header")
+        options.solutionOutput = UPDATE_IN_PLACE;
+    else if(solutionOutput == "wcs")
+        options.solutionOutput = SAVE_WCS_FILE;
+    else if(solutionOutput != "copy")
+    {
+        fprintf(stderr, "Unknown solution output %s, it can be copy, header or wcs\n", solutionOutput.toUtf8().data());
+        return 1;
+    }
+    const QString starListFormat = parser.value(starListOption);
+    if(starListFormat == "binary")
+        options.starListFormat = STAR_LIST_BINARY;
+    else if(starListFormat != "csv")
+    {
+        fprintf(stderr, "Unknown star list format %s, it can be csv or binary\n", starListFormat.toUtf8().data());
+        return 1;
+    }
+    if(parser.isSet(resultsOption))
+    {
+        if(!ResultsDatabase::isAvailable())
+        {
+            fprintf(stderr, "StellarSolver was built without the results database, see USE_RESULTS_DATABASE\n");
+            return 1;
+        }
+        options.resultsDatabase = parser.value(resultsOption);
+    }
+    if(parser.isSet(outputOption))
+    {
+        options.saveResults = true;
+        options.outputDirectory = parser.value(outputOption);
+        QDir().mkpath(options.outputDirectory);
+    }
+
+    QStringList fileNames = parser.positionalArguments();
+    if(parser.isSet(listOption))
+    {
+        QFile list(parser.value(listOption));
+        if(!list.open(QIODevice::ReadOnly | QIODevice::Text))
+        {
+            fprintf(stderr, "Unable to read the list of images %s\n", list.fileName().toUtf8().data());
+            return 1;
+        }
+        QTextStream stream(&list);
+        while(!stream.atEnd())
+        {
+            const QString line = stream.readLine().trimmed();
+            if(!line.isEmpty())
+                fileNames.append(line);
+        }
+    }
+    if(fileNames.isEmpty() && !parser.isSet(watchOption) && !parser.isSet(hotFolderOption))
+        parser.showHelp(1);
+
+    BatchSolverCLI cli(options, parser.isSet(quietOption));
+    if(parser.isSet(hotFolderOption))
+    {
+        if(!cli.hotFolder(parser.value(hotFolderOption)))
+            return 1;
+    }
+    else if(parser.isSet(watchOption))
+    {
+        // The files that were listed are processed first, then the ones in the directory
+        if(!fileNames.isEmpty())
+            cli.solveFiles(fileNames);
+        cli.watchDirectory(parser.value(watchOption));
+    }
+    else
+        cli.solveFiles(fileNames);
+
+    return app.exec();
+}
@@ -0,0 +1,76 @@
+#ifndef BATCHSOLVERCLI_H
+#define BATCHSOLVERCLI_H
+
+#include <QObject>
+#include <QTimer>
+#include <QSet>
+#include <QMap>
+#include "batchprocessor.h"
+#include "hotfoldersolver.h"
+
+/**
+ * @brief The BatchSolverCLI class runs the batch processing of StellarBatchSolver without a window.
+ * It solves a list of files, or keeps watching a directory and solves the image files that get written to it.
+ * The images are not displayed, so they are never converted to QImages or stretched.
+ */
+class BatchSolverCLI : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BatchSolverCLI(const BatchOptions &options, bool quiet, QObject *parent = nullptr);
+
+    /**
+     * @brief solveFiles processes the files and quits the application when they are done
+     */
+    void solveFiles(const QStringList &fileNames);
+
+    /**
+     * @brief watchDirectory processes the image files that are in the directory or get written to it, until the application is stopped
+     */
+    void watchDirectory(const QString &directory);
+
+    /**
+     * @brief hotFolder only solves the FITS files written to the directory, as soon as they are done being written,
+     * and saves a copy of each solved one with the solution in its header to the output directory, or to a solved directory in it.
+     * The index files stay loaded between the images.  It goes on until the application is stopped.
+     */
+    bool hotFolder(const QString &directory);
+
+    // The number of images that could not be solved
+    int failedImages() const
+    {
+        return m_FailedImages;
+    }
+
+public slots:
+    void logOutput(QString text);
+
+private:
+    void addImages(const QStringList &fileNames);
+    void startProcessing();
+    void imageExtracted(int num);
+    void processingFinished();
+    void scanDirectory();
+    void clearImages();
+    void hotFolderImageSolved(const QString &fileName, bool solved, StellarSolver *solver, qint64 latency);
+
+    BatchOptions m_Options;
+    bool m_Quiet = false;
+    QList<Image> images;
+    BatchProcessor processor { images };
+    QStringList m_PendingFiles;                 // The files that are waiting for the current batch to finish
+    int m_FailedImages = 0;
+
+    // Directory watching
+    QString m_WatchDirectory;
+    QTimer m_WatchTimer;
+    QSet<QString> m_SeenFiles;                  // The files that were already queued
+    QMap<QString, qint64> m_GrowingFiles;       // The new files and their sizes, they are queued once their size stops changing
+
+    // Hot folder solving
+    StellarSolver m_HotFolderSettings;          // The StellarSolver whose settings and index files the hot folder uses
+    HotFolderSolver *m_HotFolder = nullptr;
+    QString m_StampDirectory;                   // Where the solved files get saved
+};
+
+#endif // BATCHSOLVERCLI_H
@@ -1,7 +1,6 @@
 #include "stellarbatchsolver.h"
 #include "ui_stellarbatchsolver.h"
 #include <QFileDialog>
-#include <QTextStream>
 
 StellarBatchSolver::StellarBatchSolver():
     QMainWindow(),
@@ -17,8 +16,17 @@ StellarBatchSolver::StellarBatchSolver():
     connect(ui->processB, &QPushButton::clicked, this, &StellarBatchSolver::startProcessing);
     connect(ui->abortB, &QPushButton::clicked, this, &StellarBatchSolver::abortProcessing);
     connect(ui->clearB, &QPushButton::clicked, this, &StellarBatchSolver::clearLog);
-    connect(&stellarSolver, &StellarSolver::logOutput, this, &StellarBatchSolver::logOutput);
+    connect(&processor, &BatchProcessor::logOutput, this, &StellarBatchSolver::logOutput);
+    connect(&processor, &BatchProcessor::imageSolved, this, &StellarBatchSolver::imageSolved);
+    connect(&processor, &BatchProcessor::imageExtracted, this, &StellarBatchSolver::imageExtracted);
+    connect(&processor, &BatchProcessor::progress, ui->processProgress, &QProgressBar::setValue);
+    connect(&processor, &BatchProcessor::finished, this, &StellarBatchSolver::finishProcessing);
     connect(ui->imagesList,&QTableWidget::itemSelectionChanged, this, &StellarBatchSolver::displayImage);
+    connect(ui->showPreview, &QCheckBox::toggled, this, [this]()
+    {
+        currentRow = -1;
+        displayImage();
+    });
 
     ui->indexDirectories->addItems(indexFileDirectories);
 
@@ -65,7 +73,7 @@ int main(int argc, char *argv[])
 void StellarBatchSolver::addImages()
 {
     QStringList fileURLs = QFileDialog::getOpenFileNames(nullptr, "Load Image", dirPath,
-                      "Images (*.fits *.fit *.bmp *.gif *.jpg *.jpeg *.png *.tif *.tiff)");
+                      "Images (*.fits *.fit *.fz *.bmp *.gif *.jpg *.jpeg *.png *.tif *.tiff)");
     if (fileURLs.isEmpty())
         return;
     for(int i = 0; i< fileURLs.count(); i++)
@@ -73,7 +81,7 @@ void StellarBatchSolver::addImages()
         Image newImage;
         newImage.fileName=fileURLs.at(i);
         images.append(newImage);
-        loadImage(i);
+        loadImage(images.count() - 1);
         int row = ui->imagesList->rowCount();
         QString name = QFileInfo(newImage.fileName).fileName();
         ui->imagesList->insertRow(row);
@@ -110,6 +118,11 @@ void StellarBatchSolver::resetImages()
 
 void StellarBatchSolver::removeAllImages()
 {
+    if(processor.isRunning())
+    {
+        logOutput("The images cannot be removed while they are being processed");
+        return;
+    }
     while(images.count() > 0)
         removeImage(0);
     ui->imageDisplay->clear();
@@ -117,6 +130,11 @@ void StellarBatchSolver::removeAllImages()
 
 void StellarBatchSolver::removeSelectedImage()
 {
+    if(processor.isRunning())
+    {
+        logOutput("The images cannot be removed while they are being processed");
+        return;
+    }
     removeImage(ui->imagesList->currentRow());
 }
 
@@ -124,7 +142,7 @@ void StellarBatchSolver::removeImage(int index)
 {
     Image &image = images[index];
     if(image.m_ImageBuffer)
-        delete[] image.m_ImageBuffer;
+        fileio::releaseImageBuffer(image.m_ImageBuffer);
     if(image.searchPosition)
         delete image.searchPosition;
     if(image.searchScale)
@@ -137,6 +155,8 @@ void StellarBatchSolver::loadImage(int num)
 {
     fileio imageLoader;
     imageLoader.logToSignal = true;
+    //The preview is only made when the image is displayed, see loadPreview
+    imageLoader.generatePreview = false;
     connect(&imageLoader, &fileio::logOutput, this, &StellarBatchSolver::logOutput);
     Image &image = images[num];
     if(!imageLoader.loadImage(image.fileName))
@@ -146,7 +166,6 @@ void StellarBatchSolver::loadImage(int num)
     }
     image.stats = imageLoader.getStats();
     //No need to get the imageBuffer now.
-    image.rawImage = imageLoader.getRawQImage();
     if(imageLoader.position_given)
     {
         FITSImage::wcs_point *position = new FITSImage::wcs_point;
@@ -165,6 +184,21 @@ void StellarBatchSolver::loadImage(int num)
     image.m_HeaderRecords = imageLoader.getRecords();
 }
 
+//This makes the preview of an image the first time it is displayed, so that a batch that is only solved doesn't
+//spend time on stretching previews that nobody looks at.  The image file is loaded again for it.
+void StellarBatchSolver::loadPreview(Image &image)
+{
+    fileio imageLoader;
+    imageLoader.logToSignal = true;
+    connect(&imageLoader, &fileio::logOutput, this, &StellarBatchSolver::logOutput);
+    if(!imageLoader.loadImage(image.fileName))
+    {
+        logOutput("Error in loading the preview of the image file");
+        return;
+    }
+    image.rawImage = imageLoader.getRawQImage();
+}
+
 void StellarBatchSolver::displayImage()
 {
     if(images.count() == 0)
@@ -173,9 +207,21 @@ void StellarBatchSolver::displayImage()
          return;
     }
     int num = ui->imagesList->currentRow();
-    if(currentRow == num)
+    if(currentRow == num || num < 0)
+        return;
+    if(!ui->showPreview->isChecked())
+    {
+        ui->imageDisplay->clear();
         return;
-    Image image = images.at(num);
+    }
+    if(images.at(num).rawImage.isNull())
+        loadPreview(images[num]);
+    const Image &image = images.at(num);
+    if(image.rawImage.isNull())
+    {
+        ui->imageDisplay->clear();
+        return;
+    }
     int sampling = 2;
     double currentZoom = 1;
 
@@ -236,283 +282,54 @@ void StellarBatchSolver::startProcessing()
         logOutput("No images to process");
         return;
     }
-    aborted = false;
-    currentImageNum = 0;
-    currentProgress = 0;
+    if(processor.isRunning())
+        return;
+
+    BatchOptions options;
+    options.solveProfile = (SSolver::Parameters::ParametersProfile) ui->solveProfile->currentIndex();
+    options.extractProfile = (SSolver::Parameters::ParametersProfile) ui->extractProfile->currentIndex();
+    options.indexFolderPaths = indexFileDirectories;
+    options.colorChannel = ui->colorChannel->currentIndex();
+    options.calculateHFR = ui->getHFR->isChecked();
+    options.saveResults = ui->saveImages->isChecked();
+    options.outputDirectory = ui->outputDirectory->text();
+    options.queueDepth = ui->queueDepth->value();
+    options.decompressionThreads = ui->decompressionThreads->value();
+    options.solutionOutput = (SolutionOutput) ui->solutionOutput->currentIndex();
+    options.starListFormat = (StarListFormat) ui->starListFormat->currentIndex();
 
-    ui->processProgress->setValue(currentProgress);
+    ui->processProgress->setValue(0);
     ui->processProgress->setMaximum(images.count() * 2);
-    processImage(currentImageNum);
+    processor.start(options);
 }
 
 void StellarBatchSolver::abortProcessing()
 {
-    aborted = true;
-    stellarSolver.abort();
+    processor.abort();
     ui->processProgress->setValue(0);
 }
 
-void StellarBatchSolver::clearCurrentImageBuffer()
-{
-    if(currentImage && currentImage->m_ImageBuffer)
-    {
-        delete[] currentImage->m_ImageBuffer;
-        currentImage->m_ImageBuffer = nullptr;
-    }
-}
-
-void StellarBatchSolver::processImage(int num)
-{
-    currentImageNum = num;
-    currentImage = &images[currentImageNum];
-    if(currentImage->hasSolved && currentImage->hasExtracted)
-    {
-        currentProgress += 2;
-        ui->processProgress->setValue(currentProgress);
-        finishProcessing();
-        return;
-    }
-    clearCurrentImageBuffer();
-    fileio imageLoader;
-    imageLoader.logToSignal = true;
-    connect(&imageLoader, &fileio::logOutput, this, &StellarBatchSolver::logOutput);
-
-    if(!imageLoader.loadImageBufferOnly(currentImage->fileName))
-    {
-        logOutput("Error in loading image file");
-        return;
-    }
-    currentImage->m_ImageBuffer = imageLoader.getImageBuffer();
-    stellarSolver.loadNewImageBuffer(currentImage->stats, currentImage->m_ImageBuffer);
-
-    solvingBlind = false;
-    solveImage();
-}
-
-void StellarBatchSolver::solveImage()
-{
-    if(!currentImage || !currentImage->m_ImageBuffer)
-        return;
-
-    stellarSolver.setProperty("ProcessType", SSolver::SOLVE);
-    stellarSolver.setParameterProfile((SSolver::Parameters::ParametersProfile) ui->solveProfile->currentIndex());
-    stellarSolver.setIndexFolderPaths(indexFileDirectories);
-
-    if(solvingBlind)
-    {
-        stellarSolver.clearSearchPosition();
-        stellarSolver.clearSearchScale();
-    }
-    else
-    {
-        if(currentImage->searchPosition)
-            stellarSolver.setSearchPositionRaDec(currentImage->searchPosition->ra, currentImage->searchPosition->dec);
-        if(currentImage->searchScale)
-            stellarSolver.setSearchScale(currentImage->searchScale->scale_low, currentImage->searchScale->scale_high, currentImage->searchScale->scale_units);
-    }
-    stellarSolver.setColorChannel(ui->colorChannel->currentIndex());
-    connect(&stellarSolver, &StellarSolver::finished, this, &StellarBatchSolver::solverComplete);
-    stellarSolver.start();
-}
-
-void StellarBatchSolver::solverComplete()
+void StellarBatchSolver::imageSolved(int num)
 {
-    if(!currentImage || !currentImage->m_ImageBuffer)
-        return;
-    disconnect(&stellarSolver, &StellarSolver::finished, this, &StellarBatchSolver::solverComplete);
-    if(aborted)
-    {
-        logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
-        logOutput("Solving was Aborted");
-        clearCurrentImageBuffer();
-        currentImage = nullptr;
-        return;
-    }
-    if(stellarSolver.solvingDone())
+    const Image &image = images.at(num);
+    QBrush color = image.hasSolved ? QBrush(Qt::darkGreen) : QBrush(Qt::darkRed);
+    for(int col = 0; col< ui->imagesList->columnCount(); col++)
+        ui->imagesList->item(num,col)->setForeground(color);
+    if(image.hasSolved)
     {
-        currentImage->solution = stellarSolver.getSolution();
-        if(stellarSolver.hasWCSData())
-        {
-            currentImage->wcsData = stellarSolver.getWCSData();
-            currentImage->hasWCSData = true;
-        }
-        currentImage->hasSolved = true;
-        for(int col = 0; col< ui->imagesList->columnCount(); col++)
-            ui->imagesList->item(currentImageNum,col)->setForeground(QBrush(Qt::darkGreen));
-        ui->imagesList->item(currentImageNum,1)->setText(StellarSolver::raString(currentImage->solution.ra));
-        ui->imagesList->item(currentImageNum,2)->setText(StellarSolver::decString(currentImage->solution.dec));
-    }
-    else
-    {
-        if(!solvingBlind && ( currentImage->searchScale || currentImage->searchPosition))
-        {
-            logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
-            logOutput("Solving failed with position/scale, trying again with a blind solve.");
-            logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
-            solvingBlind = true;
-            solveImage();
-            return;
-        }
-        for(int col = 0; col< ui->imagesList->columnCount(); col++)
-            ui->imagesList->item(currentImageNum,col)->setForeground(QBrush(Qt::darkRed));
+        ui->imagesList->item(num,1)->setText(StellarSolver::raString(image.solution.ra));
+        ui->imagesList->item(num,2)->setText(StellarSolver::decString(image.solution.dec));
     }
-    currentProgress++;
-    ui->processProgress->setValue(currentProgress);
-    solvingBlind = false;
-    extractImage();
 }
 
-void StellarBatchSolver::extractImage()
+void StellarBatchSolver::imageExtracted(int num)
 {
-    if(!currentImage || !currentImage->m_ImageBuffer)
-        return;
-    if(ui->getHFR->isChecked())
-        stellarSolver.setProperty("ProcessType", SSolver::EXTRACT_WITH_HFR);
-    else
-        stellarSolver.setProperty("ProcessType", SSolver::EXTRACT);
-    stellarSolver.setColorChannel(ui->colorChannel->currentIndex());
-    stellarSolver.setParameterProfile((SSolver::Parameters::ParametersProfile) ui->extractProfile->currentIndex());
-    connect(&stellarSolver, &StellarSolver::finished, this, &StellarBatchSolver::extractorComplete);
-    stellarSolver.start();
-}
-
-void StellarBatchSolver::extractorComplete()
-{
-    if(!currentImage || !currentImage->m_ImageBuffer)
-        return;
-    disconnect(&stellarSolver, &StellarSolver::finished, this, &StellarBatchSolver::extractorComplete);
-    if(aborted)
-    {
-        logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
-        logOutput("Extraction was Aborted");
-        clearCurrentImageBuffer();
-        currentImage = nullptr;
-        return;
-    }
-    if(stellarSolver.extractionDone())
-    {
-        currentImage->stars = stellarSolver.getStarList();
-        ui->imagesList->item(currentImageNum,3)->setText(QString::number(currentImage->stars.count()));
-        currentImage->hasExtracted = true;
-    }
-    currentProgress++;
-    ui->processProgress->setValue(currentProgress);
-
-    finishProcessing();
+    const Image &image = images.at(num);
+    if(image.hasExtracted)
+        ui->imagesList->item(num,3)->setText(QString::number(image.stars.count()));
 }
 
 void StellarBatchSolver::finishProcessing()
 {
-    if(ui->saveImages->isChecked() && currentImage->hasSolved)
-        saveImage();
-    if(ui->saveImages->isChecked() && currentImage->hasExtracted)
-        saveStarList();
-    clearCurrentImageBuffer();
-    currentImage = nullptr;
-    processNextImage();
-}
-
-void StellarBatchSolver::saveImage()
-{
-    if(!currentImage || !currentImage->m_ImageBuffer)
-        return;
-    QString outputDirectory = ui->outputDirectory->text();
-    QFileInfo outputDirInfo = QFileInfo(outputDirectory);
-    if(outputDirInfo.exists())
-    {
-        QString savePath = outputDirInfo.absoluteFilePath() + QDir::separator() + QFileInfo(currentImage->fileName).baseName() + "_solved.fits";
-        logOutput("Saving solved image to: " + savePath);
-        fileio imageSaver;
-        imageSaver.logToSignal = false;
-        //connect(&imageSaver, &fileio::logOutput, this, &StellarBatchSolver::logOutput);
-        if(currentImage->hasWCSData)
-            imageSaver.saveAsFITS(savePath, currentImage->stats, currentImage->m_ImageBuffer, stellarSolver.getSolution(), currentImage->m_HeaderRecords, true);
-        else
-            imageSaver.saveAsFITS(savePath, currentImage->stats, currentImage->m_ImageBuffer, stellarSolver.getSolution(), currentImage->m_HeaderRecords, false);
-
-    }
-    else
-        logOutput("File output directory does not exist, output files were not written.");
-}
-
-void StellarBatchSolver::saveStarList()
-{
-    QString outputDirectory = ui->outputDirectory->text();
-    QFileInfo outputDirInfo = QFileInfo(outputDirectory);
-    if(outputDirInfo.exists())
-    {
-        QString savePath = outputDirInfo.absoluteFilePath() + QDir::separator() + QFileInfo(currentImage->fileName).baseName() + "_extracted.csv";
-        logOutput("Saving starList to: " + savePath);
-        fileio imageSaver;
-        imageSaver.logToSignal = true;
-        connect(&imageSaver, &fileio::logOutput, this, &StellarBatchSolver::logOutput);
-
-        QFile file;
-        file.setFileName(savePath);
-        if (!file.open(QIODevice::WriteOnly))
-        {
-            logOutput("Unable to write to file" + savePath);
-            return;
-        }
-
-        QTextStream outstream(&file);
-        outstream << "MAG_AUTO" << ",";
-        if(currentImage->hasSolved)
-        {
-            outstream << "RA (J2000)" << ",";
-            outstream << "DEC (J2000)" << ",";
-        }
-        outstream << "X_IMAGE" << ",";
-        outstream << "Y_IMAGE" << ",";
-        outstream << "FLUX_AUTO" << ",";
-        outstream << "PEAK" << ",";
-        if(currentImage->hasHFRData)
-             outstream << "HFR" << ",";
-        outstream << "a" << ",";
-        outstream << "b" << ",";
-        outstream << "theta";
-        outstream << "\n";
-
-        for(int i = 0; i < currentImage->stars.size(); i ++)
-        {
-            FITSImage::Star star = currentImage->stars.at(i);
-            outstream << QString::number(star.mag) << ",";
-            if(currentImage->hasSolved)
-            {
-                outstream << " " << StellarSolver::raString(star.ra) << " " << ",";
-                outstream << " " << StellarSolver::decString(star.dec) << " " << ",";
-            }
-            outstream << QString::number(star.x) << ",";
-            outstream << QString::number(star.y) << ",";
-            outstream << QString::number(star.flux) << ",";
-            outstream << QString::number(star.peak) << ",";
-            if(currentImage->hasHFRData)
-                 outstream << QString::number(star.HFR) << ",";
-            outstream << QString::number(star.a) << ",";
-            outstream << QString::number(star.b) << ",";
-            outstream << QString::number(star.theta);
-            outstream << "\n";
-        }
-
-        #if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
-            outstream << Qt::endl;
-        #else
-            outstream << endl;
-        #endif
-
-    }
-}
-
-void StellarBatchSolver::processNextImage()
-{
-    if(currentImageNum < images.count() - 1)
-        processImage(currentImageNum + 1);
-    else
-    {
-        logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
-        logOutput("Processing Complete!");
-        ui->processProgress->setValue(0);
-    }
-
+    ui->processProgress->setValue(0);
 }
-
@@ -57,6 +57,7 @@ struct timeval {
 //#include "scamp-catalog.h" //# Modified by Robert Lancaster for the StellarSolver Internal Library, removed includes
 #include "permutedsort.h"
 #include "bl-sort.h"
+#include "starsort.h" //# Modified for the StellarSolver Internal Library
 
 static anbool record_match_callback(MatchObj* mo, void* userdata);
 static time_t timer_callback(void* user_data);
@@ -64,6 +65,7 @@ static time_t timer_callback(void* user_data);
 //static void get_fields_from_solvedserver(blind_t* bp, solver_t* sp); //# Modified by Robert Lancaster for the StellarSolver Internal Library
 //static void load_and_parse_wcsfiles(blind_t* bp); //# Modified by Robert Lancaster for the StellarSolver Internal Library
 static void solve_fields(blind_t* bp, sip_t* verify_wcs);
+static void search_index(blind_t* bp, const index_t* index); //# Modified for the StellarSolver Internal Library
 //static void remove_invalid_fields(il* fieldlist, int maxfield); //# Modified by Robert Lancaster for the StellarSolver Internal Library
 //static anbool is_field_solved(blind_t* bp, int fieldnum); //# Modified by Robert Lancaster for the StellarSolver Internal Library
 //static int write_solutions(blind_t* bp); //# Modified by Robert Lancaster for the StellarSolver Internal Library
@@ -309,7 +311,7 @@ void blind_add_field_range(blind_t* bp, int lo, int hi) {
 
 static void check_time_limits(blind_t* bp) {
     if (bp->total_timelimit || bp->timelimit) {
-        double now = timenow();
+        double now = timenow_monotonic(); //# Modified for the StellarSolver Internal Library
         if (bp->total_timelimit && (now - bp->time_total_start > bp->total_timelimit)) {
             logmsg("Total wall-clock time limit reached!\n");
             bp->hit_total_timelimit = TRUE;
@@ -341,13 +343,26 @@ static void check_time_limits(blind_t* bp) {
         bp->solver.quit_now = TRUE;
 }
 
+//# Modified for the StellarSolver Internal Library
+// The time limits are also given to the solver as a deadline, which it checks
+// often enough that limits below a second are kept.
+static void set_solver_deadline(blind_t* bp) {
+    double deadline = 0;
+    if (bp->total_timelimit)
+        deadline = bp->time_total_start + bp->total_timelimit;
+    if (bp->timelimit && (!deadline || bp->time_start + bp->timelimit < deadline))
+        deadline = bp->time_start + bp->timelimit;
+    bp->solver.deadline = deadline;
+    bp->solver.hit_deadline = FALSE;
+}
+
 void blind_run(blind_t* bp) {
     solver_t* sp = &(bp->solver);
     size_t I; //# Modified by Robert Lancaster for the StellarSolver Internal Library
     size_t Nindexes;
 
     // Record current time for total wall-clock time limit.
-    bp->time_total_start = timenow();
+    bp->time_total_start = timenow_monotonic(); //# Modified for the StellarSolver Internal Library
 
     // Record current CPU usage for total cpu-usage limit.
 #ifndef _WIN32 //# Modified by Robert Lancaster for the StellarSolver Internal Library
@@ -453,6 +468,10 @@ void blind_run(blind_t* bp) {
     if (bp->single_field_solved)
         goto cleanup;
 
+    //# Modified for the StellarSolver Internal Library, the prior WCS could not be verified, so the caller decides whether to search
+    if (bp->verify_only)
+        goto cleanup;
+
     // Start solving...
     if (bp->indexes_inparallel) {
 
@@ -467,10 +486,11 @@ void blind_run(blind_t* bp) {
         bp->cpu_start = get_cpu_usage();
 #endif
         // Record current wall-clock time.
-        bp->time_start = time(NULL);
+        bp->time_start = timenow_monotonic(); //# Modified for the StellarSolver Internal Library
+        set_solver_deadline(bp);
 
         // Do it!
-        solve_fields(bp, NULL);
+        search_index(bp, NULL); //# Modified for the StellarSolver Internal Library
 
         // Clean up the indices...
         for (I=0; I<Nindexes; I++) {
@@ -490,6 +510,8 @@ void blind_run(blind_t* bp) {
                 break;
             if (bp->cancelled)
                 break;
+            if (cancel_requested(sp->cancel_token)) //# Modified for the StellarSolver Internal Library
+                break;
 
             // Load the index...
             index = get_index(bp, I);
@@ -501,10 +523,11 @@ void blind_run(blind_t* bp) {
             bp->cpu_start = get_cpu_usage();
 #endif
             // Record current wall-clock time.
-            bp->time_start = time(NULL);
+            bp->time_start = timenow_monotonic(); //# Modified for the StellarSolver Internal Library
+            set_solver_deadline(bp);
 
             // Do it!
-            solve_fields(bp, NULL);
+            search_index(bp, index); //# Modified for the StellarSolver Internal Library
 
             // Clean up this index...
             done_with_index(bp, I, index);
@@ -699,7 +722,7 @@ void blind_log_run_parameters(blind_t* bp) {
     logverb("maxquads %i\n", sp->maxquads);
     logverb("maxmatches %i\n", sp->maxmatches);
     logverb("cpulimit %f\n", bp->cpulimit);
-    logverb("timelimit %i\n", bp->timelimit);
+    logverb("timelimit %g\n", bp->timelimit); //# Modified for the StellarSolver Internal Library
     logverb("total_timelimit %g\n", bp->total_timelimit);
     logverb("total_cpulimit %f\n", bp->total_cpulimit);
 }
@@ -774,9 +797,8 @@ static int sort_rdls(MatchObj* mymo, blind_t* bp) {
         ERROR("Failed to read data for column \"%s\" in index", colname);
         return -1;
     }
-    perm = permutation_init(NULL, mymo->nindex);
-    permuted_sort(sortdata, sizeof(double), asc ? compare_doubles_asc : compare_doubles_desc,
-                  perm, mymo->nindex);
+    //# Modified for the StellarSolver Internal Library, to sort the keys inline and in parallel for big fields
+    perm = sssort_doubles(sortdata, mymo->nindex, !asc, NULL);
     free(sortdata);
 
     if (mymo->refxyz)
@@ -839,10 +861,9 @@ static anbool record_match_callback(MatchObj* mo, void* userdata) {
 
         logdebug("Converting %i reference stars from xyz to radec\n", mymo->nindex);
         mymo->refradec = malloc(mymo->nindex * 2 * sizeof(double));
-        for (i=0; i<mymo->nindex; i++) {
-            xyzarr2radecdegarr(mymo->refxyz+i*3, mymo->refradec+i*2);
+        xyzarr2radecdegarrmany(mymo->refxyz, mymo->refradec, mymo->nindex); //# Modified for the StellarSolver Internal Library
+        for (i=0; i<mymo->nindex; i++)
             logdebug("  %i: radec %.2f,%.2f\n", i, mymo->refradec[i*2], mymo->refradec[i*2+1]);
-        }
 
         mymo->fieldxy = malloc(mymo->nfield * 2 * sizeof(double));
         // whew!
@@ -894,6 +915,8 @@ static time_t timer_callback(void* user_data) {
     //# Modified by Robert Lancaster for the StellarSolver Internal Library since I got rid of the cancel file and I am just using the boolean
     if(bp->cancelled)
         return 0;
+    if(cancel_requested(bp->solver.cancel_token)) //# Modified for the StellarSolver Internal Library
+        return 0;
     check_time_limits(bp);
 
     /* Modified by Robert Lancaster for the StellarSolver Internal Library since we aren't using any files in the internal library
@@ -951,7 +974,7 @@ static void add_blind_params(blind_t* bp, qfits_header* hdr) {
     fits_add_long_comment(hdr, "Maxquads: %i", sp->maxquads);
     fits_add_long_comment(hdr, "Maxmatches: %i", sp->maxmatches);
     fits_add_long_comment(hdr, "Cpu limit: %f s", bp->cpulimit);
-    fits_add_long_comment(hdr, "Time limit: %i s", bp->timelimit);
+    fits_add_long_comment(hdr, "Time limit: %g s", bp->timelimit); //# Modified for the StellarSolver Internal Library
     fits_add_long_comment(hdr, "Total time limit: %g s", bp->total_timelimit);
     fits_add_long_comment(hdr, "Total CPU limit: %f s", bp->total_cpulimit);
 
@@ -981,6 +1004,20 @@ static void remove_invalid_fields(il* fieldlist, int maxfield) {
     }
 }
 */
+//# Modified for the StellarSolver Internal Library, so that the search time of each index can be reported.
+static void search_index(blind_t* bp, const index_t* index) {
+    int tries = bp->total_quads_tried;
+    double start = timenow_monotonic();
+    double seconds;
+
+    solve_fields(bp, NULL);
+
+    seconds = timenow_monotonic() - start;
+    bp->search_time += seconds;
+    if (bp->index_callback)
+        bp->index_callback(bp, index, seconds, bp->total_quads_tried - tries, bp->index_userdata);
+}
+
 static void solve_fields(blind_t* bp, sip_t* verify_wcs) {
     solver_t* sp = &(bp->solver);
     double last_utime, last_stime;
@@ -1069,8 +1106,15 @@ static void solve_fields(blind_t* bp, sip_t* verify_wcs) {
                        sp->nummatches, sp->maxmatches);
             if (bp->cancelled)
                 logmsg("  cancelled at user request.\n");
+            //# Modified for the StellarSolver Internal Library, so that the limit that was hit is recorded
+            if (sp->hit_deadline)
+                check_time_limits(bp);
         }
 
+        //# Modified for the StellarSolver Internal Library, so that the work of the whole job can be reported.
+        bp->total_quads_tried += sp->numtries;
+        bp->total_codes_matched += sp->nummatches;
+        bp->total_verified += sp->num_verified;
 
         if (sp->best_match_solves) {
             bp->single_field_solved = TRUE; //solved_field(bp, fieldnum); //# Modified by Robert Lancaster for the StellarSolver Internal Library
@@ -1099,7 +1143,10 @@ static void solve_fields(blind_t* bp, sip_t* verify_wcs) {
             }
         }
 
-        solver_free_field(sp);
+        //# Modified for the StellarSolver Internal Library
+        // The preprocessed field is kept for the next index, solver_set_field
+        // and solver_cleanup free it.
+        //solver_free_field(sp);
 
         get_resource_stats(&utime, &stime, NULL);
         gettimeofday(&wtime, NULL);
@@ -212,11 +212,22 @@ int engine_add_index(engine_t* engine, char* path) {
     return 0;
 }
 
+//# Modified for the StellarSolver Internal Library
+//Adds an index that is owned by something else (for example the persistent IndexCatalog) without taking ownership of it,
+//so engine_free will not free it.  The index must outlive this engine.
+int engine_add_loaded_index(engine_t* engine, index_t* ind) {
+    if (add_index(engine, ind)) {
+        ERROR("Failed to add index \"%s\"", ind->indexname);
+        return -1;
+    }
+    return 0;
+}
 static void add_index_to_blind(engine_t* engine, blind_t* bp,
                                int i) {
     index_t* index;
     index = pl_get(engine->indexes, i);
-    if (engine->inparallel) {
+    //# Modified for the StellarSolver Internal Library, an index that is already fully loaded is used directly instead of reloading it by name
+    if (engine->inparallel || index->codekd) {
         blind_add_loaded_index(bp, index);
     } else {
         blind_add_index(bp, index->indexname);
@@ -417,6 +428,68 @@ static double job_imageh(job_t* job) {
     return job->bp.solver.field_maxy;
 }
 
+//# Modified for the StellarSolver Internal Library, moved out of engine_run_job so engine_select_indexes_for_job can use it too
+static il* indexes_for_quad_range(engine_t* engine, double fmin, double fmax) {
+    int k;
+    il* indexlist = il_new(16);
+    for (k = 0; k < pl_size(engine->indexes); k++) {
+        index_t* index = pl_get(engine->indexes, k);
+        if (!index_overlaps_scale_range(index, fmin, fmax))
+            continue;
+        il_append(indexlist, k);
+    }
+
+    // Use the (list of) smallest or largest indices if no other one fits.
+    if (!il_size(indexlist)) {
+        il* list = NULL;
+        if (fmin > engine->sizebiggest) {
+            list = engine->ibiggest;
+        } else if (fmax < engine->sizesmallest) {
+            list = engine->ismallest;
+        } else {
+            assert(0);
+        }
+        il_append_list(indexlist, list);
+    }
+    return indexlist;
+}
+
+//# Modified for the StellarSolver Internal Library
+//This does the same index selection as engine_run_job, but just reports the positions of the selected indexes in engine->indexes.
+//It lets the indexes be loaded on demand, since only the metadata is needed to select them.
+void engine_select_indexes_for_job(engine_t* engine, job_t* job, il* selected) {
+    blind_t* bp = &(job->bp);
+    double app_min_default = deg2arcsec(engine->minwidth) / job_imagew(job);
+    double app_max_default = deg2arcsec(engine->maxwidth) / job_imagew(job);
+    double quadsize_min = bp->quad_size_fraction_lo * MIN(job_imagew(job), job_imageh(job));
+    int j, k;
+
+    for (j=0; j<dl_size(job->scales) / 2; j++) {
+        double fmin, fmax;
+        double app_min = dl_get(job->scales, j * 2);
+        double app_max = dl_get(job->scales, j * 2 + 1);
+        il* indexlist;
+        if (app_min == 0.0)
+            app_min = app_min_default;
+        if (app_max == 0.0)
+            app_max = app_max_default;
+
+        fmax = bp->quad_size_fraction_hi * hypot(job_imagew(job), job_imageh(job)) * app_max;
+        fmin = quadsize_min * app_min;
+
+        indexlist = indexes_for_quad_range(engine, fmin, fmax);
+        for (k=0; k<il_size(indexlist); k++) {
+            int ii = il_get(indexlist, k);
+            index_t* index = pl_get(engine->indexes, ii);
+            if (job->use_radec_center &&
+                !index_is_within_range(index, job->ra_center, job->dec_center, job->search_radius))
+                continue;
+            il_insert_unique_ascending(selected, ii);
+        }
+        il_free(indexlist);
+    }
+}
+
 int engine_run_job(engine_t* engine, job_t* job) {
     blind_t* bp = &(job->bp);
     solver_t* sp = &(bp->solver);
@@ -448,6 +521,10 @@ int engine_run_job(engine_t* engine, job_t* job) {
         int endobj = il_get(job->depths, i*2+1);
         int j;
 
+        //# Modified for the StellarSolver Internal Library, lets the field grow before each depth range
+        if (bp->field_callback)
+            bp->field_callback(bp, endobj, bp->field_userdata);
+
         if (startobj || endobj) {
             // make depth ranges be inclusive.
             endobj++;
@@ -464,6 +541,8 @@ int engine_run_job(engine_t* engine, job_t* job) {
             double app_max, app_min;
             int k;
             il* indexlist;
+            anbool verifying;
+            int budget, endobj_before_budget; //# Modified for the StellarSolver Internal Library
 
             // arcsec per pixel range
             app_min = dl_get(job->scales, j * 2);
@@ -491,27 +570,12 @@ int engine_run_job(engine_t* engine, job_t* job) {
             fmin = sp->quadsize_min * app_min;
 
             // Select the indices that should be checked.
-            indexlist = il_new(16);
-            for (k = 0; k < pl_size(engine->indexes); k++) {
-                index_t* index = pl_get(engine->indexes, k);
-                if (!index_overlaps_scale_range(index, fmin, fmax))
-                    continue;
-                il_append(indexlist, k);
-            }
-
-            // Use the (list of) smallest or largest indices if no other one fits.
-            if (!il_size(indexlist)) {
-                il* list = NULL;
-                if (fmin > engine->sizebiggest) {
-                    list = engine->ibiggest;
-                } else if (fmax < engine->sizesmallest) {
-                    list = engine->ismallest;
-                } else {
-                    assert(0);
-                }
-                il_append_list(indexlist, list);
-            }
+            indexlist = indexes_for_quad_range(engine, fmin, fmax);
 
+            //# Modified for the StellarSolver Internal Library, an index only has the brightest cutnsweep stars of each healpix of cutnside,
+            // so the field objects after the ones that many cells can hold can't be in it, and the quads made of them are wasted.
+            // The budget is for the biggest field of the band, and it is 0 if an index doesn't record its cut.
+            budget = 0;
             for (k=0; k<il_size(indexlist); k++) {
                 int ii = il_get(indexlist, k);
                 index_t* index = pl_get(engine->indexes, ii);
@@ -524,14 +588,36 @@ int engine_run_job(engine_t* engine, job_t* job) {
                     continue;
                 }
                 add_index_to_blind(engine, bp, ii);
+                if (engine->star_budget > 0 && budget >= 0) {
+                    if (index->cutnside > 0 && index->cutnsweep > 0) {
+                        double cell = healpix_side_length_arcmin(index->cutnside) * 60.0;
+                        double cells = job_imagew(job) * app_max * job_imageh(job) * app_max / (cell * cell);
+                        budget = MAX(budget, (int)ceil(engine->star_budget * index->cutnsweep * cells));
+                    } else
+                        budget = -1;
+                }
             }
 
             il_free(indexlist);
 
+            endobj_before_budget = sp->endobj;
+            if (budget > 0) {
+                // a few stars always make quads, however small the field
+                budget = MAX(budget, 20);
+                if (!sp->endobj || sp->endobj > budget) {
+                    sp->endobj = budget;
+                    logverb("The indexes of scales [%g, %g] arcsec/pixel can only have %i of the field objects\n", app_min, app_max, budget);
+                }
+            }
+
             logverb("Running blind solver:\n");
             blind_log_run_parameters(bp);
 
+            //# Modified for the StellarSolver Internal Library, a verified WCS is the solution, so the other scales and depths are not searched
+            verifying = (bl_size(bp->verify_wcs_list) > 0);
+
             blind_run(bp);
+            sp->endobj = endobj_before_budget;
 
             // we only want to try using the verify_wcses the first time.
             blind_clear_verify_wcses(bp);
@@ -541,6 +627,11 @@ int engine_run_job(engine_t* engine, job_t* job) {
             //blind_clear_indexes(bp); //Repetitive?
             solver_clear_indexes(sp);
 
+            if (bp->verify_only || (verifying && bp->single_field_solved)) {
+                solved = TRUE;
+                break;
+            }
+
             //# Modified by Robert Lancaster for the StellarSolver Internal Library
             //if (blind_is_run_obsolete(bp, sp)) {
             //    solved = TRUE;
@@ -6,6 +6,8 @@
 #ifndef PQUAD_H
 #define PQUAD_H
 
+#include <stdint.h>
+
 /**
  This file is just required for testing purposes (of solver.c)
  */
@@ -19,10 +21,19 @@ struct potential_quad
 	double costheta, sintheta;
 	// (field pixel noise / quad scale in pixels)^2
 	double rel_field_noise2;
-	anbool* inbox;
+	//# Modified for the StellarSolver Internal Library, the inbox is a bitset
+	// of the field stars and the code coordinates of C and D are computed
+	// when a quad is tried instead of being kept for every star.
+	uint64_t* inbox;
 	int ninbox;
-	double* xy;
 };
 typedef struct potential_quad pquad;
 
+//# Modified for the StellarSolver Internal Library
+// Clears the bits of the stars from "start" on that are outside of the
+// circle of the quad's A and B stars, like solver_run() does, see the
+// kernel benchmark.  The stars are the field of the solver.
+struct solver_t;
+void solver_check_inbox(pquad* pq, int start, struct solver_t* solver);
+
 #endif
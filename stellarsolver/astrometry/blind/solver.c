@@ -33,11 +33,33 @@
 #include "sip-utils.h"
 #include "keywords.h"
 #include "log.h"
+
+//# Modified for the StellarSolver Internal Library
+// Vector instructions for building the pquads.  The AVX2 functions are
+// compiled with a target attribute, so no special compiler flags are needed,
+// and they are only called when the CPU has AVX2.  NEON is always there on
+// 64 bit ARM, which also has the double precision vectors they need.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SOLVER_SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SOLVER_TARGET_AVX2
+#else
+#define SOLVER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define SOLVER_SIMD_ARM
+#include <arm_neon.h>
+#endif
 #include "pquad.h"
 #include "kdtree.h"
 #include "quad-utils.h"
 #include "errors.h"
 #include "tweak2.h"
+#include "tracer.h" //# Modified for the StellarSolver Internal Library
+#include "perfcounters.h" //# Modified for the StellarSolver Internal Library
+#include "healpix.h" //# Modified for the StellarSolver Internal Library
 
 #if TESTING_TRYALLCODES
 #define DEBUGSOLVER 1
@@ -146,11 +168,11 @@ void solver_tweak2(solver_t* sp, MatchObj* mo, int order, sip_t* verifysip) {
     int* theta;
     double* odds;
     double* refradec;
-    int i;
     double newodds;
     int nm, nc, nd;
     int besti;
     int startorder;
+    double start, trace; //# Modified for the StellarSolver Internal Library
 
     indexjitter = mo->index_jitter; // ref cat positional error, in arcsec.
     xy = starxy_to_xy_array(sp->fieldxy, NULL);
@@ -168,8 +190,7 @@ void solver_tweak2(solver_t* sp, MatchObj* mo, int order, sip_t* verifysip) {
 
     // mo->refradec may be NULL at this point, so get it from refxyz instead...
     refradec = malloc(3 * mo->nindex * sizeof(double));
-    for (i=0; i<mo->nindex; i++)
-        xyzarr2radecdegarr(mo->refxyz + i*3, refradec + i*2);
+    xyzarr2radecdegarrmany(mo->refxyz, refradec, mo->nindex); //# Modified for the StellarSolver Internal Library
 
     // Verifying an existing WCS?
     if (verifysip) {
@@ -190,6 +211,8 @@ void solver_tweak2(solver_t* sp, MatchObj* mo, int order, sip_t* verifysip) {
 
     logverb("solver_tweak2: set_crpix %i, crpix (%.1f,%.1f)\n",
             sp->set_crpix, sp->crpix[0], sp->crpix[1]);
+    start = timenow_monotonic(); //# Modified for the StellarSolver Internal Library
+    trace = sstrace_begin(); //# Modified for the StellarSolver Internal Library
     mo->sip = tweak2(xy, Nxy,
                      sp->verify_pix, // pixel positional noise sigma
                      solver_field_width(sp),
@@ -201,7 +224,10 @@ void solver_tweak2(solver_t* sp, MatchObj* mo, int order, sip_t* verifysip) {
                      order, sp->tweak_abporder,
                      &startsip, NULL, &theta, &odds,
                      sp->set_crpix ? sp->crpix : NULL,
-                     &newodds, &besti, mo->testperm, startorder);
+                     &newodds, &besti, mo->testperm, startorder,
+                     sp->tweak_timelimit, sp->tweak_min_improvement);
+    sstrace_end("tweak2", trace); //# Modified for the StellarSolver Internal Library
+    sp->tweak_time += timenow_monotonic() - start; //# Modified for the StellarSolver Internal Library
     free(refradec);
 
     // FIXME -- update refxy?  Nobody uses it, right?
@@ -268,6 +294,10 @@ void solver_log_params(const solver_t* sp) {
     if (sp->do_tweak) {
         logverb("    Forward order %i\n", sp->tweak_aborder);
         logverb("    Reverse order %i\n", sp->tweak_abporder);
+        if (sp->tweak_timelimit > 0) //# Modified for the StellarSolver Internal Library
+            logverb("    Time limit %g s\n", sp->tweak_timelimit);
+        if (sp->tweak_min_improvement > 0)
+            logverb("    Minimum improvement %g\n", sp->tweak_min_improvement);
     }
     logverb("  Indexes: %zu\n", pl_size(sp->indexes));
     for (i=0; i<pl_size(sp->indexes); i++) {
@@ -367,8 +397,28 @@ static void get_field_ll_corner(solver_t* s, double* lx, double* ly) {
     *ly = s->field_miny;
 }
 
+//# Modified for the StellarSolver Internal Library
+// This is checked wherever quit_now is, so that setting the shared cancel token
+// stops the solver within one quad instead of waiting for the timer callback.
+// The deadline is checked here too, but only reads the clock every
+// SOLVER_DEADLINE_CHECK_INTERVAL calls.
+static anbool solver_should_quit(solver_t* s) {
+    if (unlikely(cancel_requested(s->cancel_token)))
+        s->quit_now = TRUE;
+    if (s->deadline > 0 && --s->deadline_countdown <= 0) {
+        s->deadline_countdown = SOLVER_DEADLINE_CHECK_INTERVAL;
+        if (timenow_monotonic() > s->deadline) {
+            s->hit_deadline = TRUE;
+            s->quit_now = TRUE;
+        }
+    }
+    return s->quit_now;
+}
+
 void solver_reset_counters(solver_t* s) {
     s->quit_now = FALSE;
+    s->hit_deadline = FALSE; //# Modified for the StellarSolver Internal Library
+    s->deadline_countdown = 0;
     s->have_best_match = FALSE;
     s->best_match_solves = FALSE;
     s->numtries = 0;
@@ -415,9 +465,31 @@ static void set_center_and_radius(solver_t* solver, MatchObj* mo,
     mo->radius_deg = dist2deg(mo->radius);
 }
 
+//# Modified for the StellarSolver Internal Library
+// Finds the healpixes of the split up code tree of the current index that
+// can have quads within the search radius.
+static void set_shard_cells(solver_t* s) {
+    const codetree_shards_t* shards = s->index->codekd ? s->index->codekd->shards : NULL;
+    double radius_deg;
+    int i, ncells;
+
+    iarray_remove_all(&s->shard_cells);
+    if (!s->use_radec || !shards)
+        return;
+    radius_deg = distsq2deg(s->r2);
+    ncells = 12 * shards->nside * shards->nside;
+    for (i=0; i<ncells; i++)
+        if (shards->trees[i] &&
+            healpix_within_range_of_xyz(i, shards->nside, s->centerxyz, radius_deg))
+            iarray_append(&s->shard_cells, i);
+    debug("Searching the codes of %zu of the healpixes of nside %i.\n",
+          iarray_size(&s->shard_cells), shards->nside);
+}
+
 static void set_index(solver_t* s, index_t* index) {
     s->index = index;
     s->rel_index_noise2 = square(index->index_jitter / index->index_scale_lower);
+    set_shard_cells(s); //# Modified for the StellarSolver Internal Library
 }
 
 static void set_diag(solver_t* s) {
@@ -428,6 +500,7 @@ void solver_set_field(solver_t* s, starxy_t* field) {
     if (s->fieldxy)
         starxy_free(s->fieldxy);
     s->fieldxy = field;
+    solver_free_field(s); //# Modified for the StellarSolver Internal Library, the preprocessing was for the old field
     // Preprocessing happens in "solver_preprocess_field()".
 }
 
@@ -533,13 +606,25 @@ void solver_compute_quad_range(const solver_t* sp, const index_t* index,
     }
 }
 
+//# Modified for the StellarSolver Internal Library
+// The codes of one quad, in all of the permutations of its stars, its two
+// backbone orientations and both parities, which get searched for together.
+#define CODEBATCH_MAX SOLVER_CODEBATCH_MAX
+typedef struct {
+    int n;
+    double codes[CODEBATCH_MAX * DCMAX];
+    int stars[CODEBATCH_MAX * DQMAX];
+    anbool parity[CODEBATCH_MAX];
+} codebatch;
+
 static void try_all_codes(const pquad* pq,
                           const int* fieldstars, int dimquad,
                           solver_t* solver, double tol2);
 
 static void try_all_codes_2(const int* fieldstars, int dimquad,
                             const double* code, solver_t* solver,
-                            anbool current_parity, double tol2);
+                            anbool current_parity, double tol2,
+                            codebatch* batch);
 
 static void try_permutations(const int* origstars, int dimquad,
                              const double* origcode,
@@ -547,16 +632,141 @@ static void try_permutations(const int* origstars, int dimquad,
                              double tol2,
                              int* stars, double* code,
                              int slot, anbool* placed,
-                             kdtree_qres_t** presult);
+                             codebatch* batch);
+
+static void search_codes(const codebatch* batch, int dimquad,
+                         solver_t* solver, double tol2);
+
+static void defer_codes(const codebatch* batch, int dimquad,
+                        solver_t* solver, double tol2);
+
+static void flush_pending_codes(solver_t* solver);
+
+static void try_index_group(const pquad* pq, int* field, int dimquad,
+                            solver_t* solver, index_t** group, int ngroup);
 
 static void resolve_matches(kdtree_qres_t* krez, const double *field,
                             const int* fstars, int dimquads,
                             solver_t* solver, anbool current_parity);
 
-static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip, anbool fake_match);
+//# Modified for the StellarSolver Internal Library, "verified" is whether verify_match() was already run on the match
+static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip, anbool fake_match,
+                             anbool verified);
+
+//# Modified for the StellarSolver Internal Library
+static void verify_match(const solver_t* sp, const verify_field_t* vf, MatchObj* mo,
+                         sip_t* sip, anbool fake_match);
+
+//# Modified for the StellarSolver Internal Library
+static void handle_matches(solver_t* sp, MatchObj* matches, int nmatches);
+
+//# Modified for the StellarSolver Internal Library
+static void free_worker_fields(solver_t* solver);
+
+//# Modified for the StellarSolver Internal Library
+#if defined(SOLVER_SIMD_X86)
+static anbool detect_avx2(void) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return FALSE;
+    __cpuid(info, 1);
+    // AVX and OSXSAVE, and the OS has to save the YMM registers
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+        return FALSE;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) ? TRUE : FALSE;
+#else
+    return __builtin_cpu_supports("avx2") ? TRUE : FALSE;
+#endif
+}
+
+static anbool have_avx2(void) {
+    // Several solvers may ask at the same time, they all get the same answer.
+    static volatile int detected = -1;
+    if (detected < 0)
+        detected = detect_avx2();
+    return detected;
+}
+#endif
+
+//# Modified for the StellarSolver Internal Library
+int solver_simd(void) {
+#if defined(SOLVER_SIMD_X86)
+    return have_avx2() ? SOLVER_SIMD_AVX2 : SOLVER_SIMD_NONE;
+#elif defined(SOLVER_SIMD_ARM)
+    return SOLVER_SIMD_NEON;
+#else
+    return SOLVER_SIMD_NONE;
+#endif
+}
+
+//# Modified for the StellarSolver Internal Library
+// The inboxes are bitsets of the field stars, see pquad_store.
+#define INBOX_WORDS(nstars) (((nstars) + 63) / 64)
+
+static inline int inbox_get(const pquad* pq, int i) {
+    return (pq->inbox[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void inbox_set(pquad* pq, int i) {
+    pq->inbox[i >> 6] |= (uint64_t)1 << (i & 63);
+}
+
+static inline void inbox_clear(pquad* pq, int i) {
+    pq->inbox[i >> 6] &= ~((uint64_t)1 << (i & 63));
+}
+
+// Sets the bits of stars [0, n) and clears the ones after them.
+static void inbox_fill(pquad* pq, int n, int words) {
+    int w;
+    for (w = 0; w < words; w++) {
+        int bits = n - w * 64;
+        pq->inbox[w] = bits >= 64 ? ~(uint64_t)0 : bits > 0 ? ((uint64_t)1 << bits) - 1 : 0;
+    }
+}
+
+// The bits of stars i to i+n-1, n at most 8, as the low bits of an int.
+static inline int inbox_bits(const pquad* pq, int i, int n) {
+    int bits = 0, k;
+    for (k = 0; k < n; k++)
+        bits |= inbox_get(pq, i + k) << k;
+    return bits;
+}
+
+//# Modified for the StellarSolver Internal Library
+/*
+ The float versions of check_scale, check_scales and check_inbox for
+ float_search, which read the field star positions from field_xf and
+ field_yf, so the loops over the field stars read half as much memory and
+ the vectors hold twice as many stars.  The scale and rotation of a pquad
+ are still stored as doubles, and the codes are computed from the double
+ positions.
+ */
+static void check_scale_f(pquad* pq, solver_t* s) {
+    float dx, dy, scale;
+    dx = s->field_xf[pq->fieldB] - s->field_xf[pq->fieldA];
+    dy = s->field_yf[pq->fieldB] - s->field_yf[pq->fieldA];
+    scale = dx*dx + dy*dy;
+    pq->scale = scale;
+    if ((scale < (float)s->minminAB2) ||
+        (scale > (float)s->maxmaxAB2)) {
+        pq->scale_ok = FALSE;
+        return;
+    }
+    pq->costheta = (dy + dx) / scale;
+    pq->sintheta = (dy - dx) / scale;
+    pq->rel_field_noise2 = (float)(s->verify_pix * s->verify_pix) / scale;
+    pq->scale_ok = TRUE;
+}
 
 static void check_scale(pquad* pq, solver_t* s) {
     double dx, dy;
+    if (s->float_search) { //# Modified for the StellarSolver Internal Library
+        check_scale_f(pq, s);
+        return;
+    }
     dx = field_getx(s, pq->fieldB) - field_getx(s, pq->fieldA);
     dy = field_gety(s, pq->fieldB) - field_gety(s, pq->fieldA);
     pq->scale = dx*dx + dy*dy;
@@ -571,18 +781,391 @@ static void check_scale(pquad* pq, solver_t* s) {
     pq->scale_ok = TRUE;
 }
 
+//# Modified for the StellarSolver Internal Library
+/*
+ The vector versions of check_scale, for the pquads of all of the A stars
+ before B at once.  The field star coordinates are read straight from the
+ x and y arrays of the starxy_t.  They compute the same values as
+ check_scale, each one returns how many of the A stars it did.
+ */
+#if defined(SOLVER_SIMD_X86)
+SOLVER_TARGET_AVX2
+static int check_scales_avx2(pquad* row, int B, int nA, const double* fx,
+                             const double* fy, solver_t* s) {
+    const __m256d bx = _mm256_set1_pd(fx[B]);
+    const __m256d by = _mm256_set1_pd(fy[B]);
+    const __m256d minAB2 = _mm256_set1_pd(s->minminAB2);
+    const __m256d maxAB2 = _mm256_set1_pd(s->maxmaxAB2);
+    const __m256d noise = _mm256_set1_pd(s->verify_pix * s->verify_pix);
+    int a = 0;
+    for (; a + 4 <= nA; a += 4) {
+        double scale[4], costheta[4], sintheta[4], relnoise[4];
+        __m256d dx = _mm256_sub_pd(bx, _mm256_loadu_pd(fx + a));
+        __m256d dy = _mm256_sub_pd(by, _mm256_loadu_pd(fy + a));
+        __m256d sc = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+        // The scale is bad if it's below the minimum or above the maximum
+        int ok = _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(sc, minAB2, _CMP_NLT_UQ),
+                                                  _mm256_cmp_pd(sc, maxAB2, _CMP_NGT_UQ)));
+        int k;
+        _mm256_storeu_pd(scale, sc);
+        _mm256_storeu_pd(costheta, _mm256_div_pd(_mm256_add_pd(dy, dx), sc));
+        _mm256_storeu_pd(sintheta, _mm256_div_pd(_mm256_sub_pd(dy, dx), sc));
+        _mm256_storeu_pd(relnoise, _mm256_div_pd(noise, sc));
+        for (k = 0; k < 4; k++) {
+            pquad* pq = row + a + k;
+            pq->fieldA = a + k;
+            pq->fieldB = B;
+            pq->scale = scale[k];
+            pq->scale_ok = (ok >> k) & 1;
+            pq->costheta = costheta[k];
+            pq->sintheta = sintheta[k];
+            pq->rel_field_noise2 = relnoise[k];
+        }
+    }
+    return a;
+}
+#endif
+
+#if defined(SOLVER_SIMD_ARM)
+static int check_scales_neon(pquad* row, int B, int nA, const double* fx,
+                             const double* fy, solver_t* s) {
+    const float64x2_t bx = vdupq_n_f64(fx[B]);
+    const float64x2_t by = vdupq_n_f64(fy[B]);
+    const float64x2_t minAB2 = vdupq_n_f64(s->minminAB2);
+    const float64x2_t maxAB2 = vdupq_n_f64(s->maxmaxAB2);
+    const float64x2_t noise = vdupq_n_f64(s->verify_pix * s->verify_pix);
+    int a = 0;
+    for (; a + 2 <= nA; a += 2) {
+        double scale[2], costheta[2], sintheta[2], relnoise[2];
+        uint64_t bad[2];
+        float64x2_t dx = vsubq_f64(bx, vld1q_f64(fx + a));
+        float64x2_t dy = vsubq_f64(by, vld1q_f64(fy + a));
+        float64x2_t sc = vaddq_f64(vmulq_f64(dx, dx), vmulq_f64(dy, dy));
+        int k;
+        vst1q_u64(bad, vorrq_u64(vcltq_f64(sc, minAB2), vcgtq_f64(sc, maxAB2)));
+        vst1q_f64(scale, sc);
+        vst1q_f64(costheta, vdivq_f64(vaddq_f64(dy, dx), sc));
+        vst1q_f64(sintheta, vdivq_f64(vsubq_f64(dy, dx), sc));
+        vst1q_f64(relnoise, vdivq_f64(noise, sc));
+        for (k = 0; k < 2; k++) {
+            pquad* pq = row + a + k;
+            pq->fieldA = a + k;
+            pq->fieldB = B;
+            pq->scale = scale[k];
+            pq->scale_ok = bad[k] ? FALSE : TRUE;
+            pq->costheta = costheta[k];
+            pq->sintheta = sintheta[k];
+            pq->rel_field_noise2 = relnoise[k];
+        }
+    }
+    return a;
+}
+#endif
+
+#if defined(SOLVER_SIMD_X86)
+SOLVER_TARGET_AVX2
+static int check_scales_avx2f(pquad* row, int B, int nA, const float* fx,
+                              const float* fy, solver_t* s) {
+    const __m256 bx = _mm256_set1_ps(fx[B]);
+    const __m256 by = _mm256_set1_ps(fy[B]);
+    const __m256 minAB2 = _mm256_set1_ps((float)s->minminAB2);
+    const __m256 maxAB2 = _mm256_set1_ps((float)s->maxmaxAB2);
+    const __m256 noise = _mm256_set1_ps((float)(s->verify_pix * s->verify_pix));
+    int a = 0;
+    for (; a + 8 <= nA; a += 8) {
+        float scale[8], costheta[8], sintheta[8], relnoise[8];
+        __m256 dx = _mm256_sub_ps(bx, _mm256_loadu_ps(fx + a));
+        __m256 dy = _mm256_sub_ps(by, _mm256_loadu_ps(fy + a));
+        __m256 sc = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        int ok = _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(sc, minAB2, _CMP_NLT_UQ),
+                                                  _mm256_cmp_ps(sc, maxAB2, _CMP_NGT_UQ)));
+        int k;
+        _mm256_storeu_ps(scale, sc);
+        _mm256_storeu_ps(costheta, _mm256_div_ps(_mm256_add_ps(dy, dx), sc));
+        _mm256_storeu_ps(sintheta, _mm256_div_ps(_mm256_sub_ps(dy, dx), sc));
+        _mm256_storeu_ps(relnoise, _mm256_div_ps(noise, sc));
+        for (k = 0; k < 8; k++) {
+            pquad* pq = row + a + k;
+            pq->fieldA = a + k;
+            pq->fieldB = B;
+            pq->scale = scale[k];
+            pq->scale_ok = (ok >> k) & 1;
+            pq->costheta = costheta[k];
+            pq->sintheta = sintheta[k];
+            pq->rel_field_noise2 = relnoise[k];
+        }
+    }
+    return a;
+}
+#endif
+
+#if defined(SOLVER_SIMD_ARM)
+static int check_scales_neonf(pquad* row, int B, int nA, const float* fx,
+                              const float* fy, solver_t* s) {
+    const float32x4_t bx = vdupq_n_f32(fx[B]);
+    const float32x4_t by = vdupq_n_f32(fy[B]);
+    const float32x4_t minAB2 = vdupq_n_f32((float)s->minminAB2);
+    const float32x4_t maxAB2 = vdupq_n_f32((float)s->maxmaxAB2);
+    const float32x4_t noise = vdupq_n_f32((float)(s->verify_pix * s->verify_pix));
+    int a = 0;
+    for (; a + 4 <= nA; a += 4) {
+        float scale[4], costheta[4], sintheta[4], relnoise[4];
+        uint32_t bad[4];
+        float32x4_t dx = vsubq_f32(bx, vld1q_f32(fx + a));
+        float32x4_t dy = vsubq_f32(by, vld1q_f32(fy + a));
+        float32x4_t sc = vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy));
+        int k;
+        vst1q_u32(bad, vorrq_u32(vcltq_f32(sc, minAB2), vcgtq_f32(sc, maxAB2)));
+        vst1q_f32(scale, sc);
+        vst1q_f32(costheta, vdivq_f32(vaddq_f32(dy, dx), sc));
+        vst1q_f32(sintheta, vdivq_f32(vsubq_f32(dy, dx), sc));
+        vst1q_f32(relnoise, vdivq_f32(noise, sc));
+        for (k = 0; k < 4; k++) {
+            pquad* pq = row + a + k;
+            pq->fieldA = a + k;
+            pq->fieldB = B;
+            pq->scale = scale[k];
+            pq->scale_ok = bad[k] ? FALSE : TRUE;
+            pq->costheta = costheta[k];
+            pq->sintheta = sintheta[k];
+            pq->rel_field_noise2 = relnoise[k];
+        }
+    }
+    return a;
+}
+#endif
+
+/*
+ check_scale for the pquads of all the A stars before B, "row" is the
+ row of the pquads array for B.
+ */
+static void check_scales(pquad* row, int B, int nA, solver_t* s) {
+    int a = 0;
+    //# Modified for the StellarSolver Internal Library
+    if (s->float_search) {
+#if defined(SOLVER_SIMD_X86)
+        if (have_avx2())
+            a = check_scales_avx2f(row, B, nA, s->field_xf, s->field_yf, s);
+#elif defined(SOLVER_SIMD_ARM)
+        a = check_scales_neonf(row, B, nA, s->field_xf, s->field_yf, s);
+#endif
+        for (; a < nA; a++) {
+            row[a].fieldA = a;
+            row[a].fieldB = B;
+            check_scale_f(row + a, s);
+        }
+        return;
+    }
+#if defined(SOLVER_SIMD_X86)
+    if (have_avx2())
+        a = check_scales_avx2(row, B, nA, s->fieldxy->x, s->fieldxy->y, s);
+#elif defined(SOLVER_SIMD_ARM)
+    a = check_scales_neon(row, B, nA, s->fieldxy->x, s->fieldxy->y, s);
+#endif
+    for (; a < nA; a++) {
+        row[a].fieldA = a;
+        row[a].fieldB = B;
+        check_scale(row + a, s);
+    }
+}
+
+/*
+ The vector versions of the loop of check_inbox, for the stars from "start"
+ on, which return where they stopped.
+ */
+#if defined(SOLVER_SIMD_X86)
+SOLVER_TARGET_AVX2
+static int check_inbox_avx2(pquad* pq, int start, const double* fx,
+                            const double* fy, double Ax, double Ay, double maxr) {
+    const __m256d ax = _mm256_set1_pd(Ax);
+    const __m256d ay = _mm256_set1_pd(Ay);
+    const __m256d c = _mm256_set1_pd(pq->costheta);
+    const __m256d s = _mm256_set1_pd(pq->sintheta);
+    const __m256d limit = _mm256_set1_pd(maxr);
+    int i = start;
+    for (; i + 4 <= pq->ninbox; i += 4) {
+        int out, k;
+        __m256d cx, cy, x, y, r;
+        int inbox = inbox_bits(pq, i, 4);
+        if (!inbox)
+            continue;
+        cx = _mm256_sub_pd(_mm256_loadu_pd(fx + i), ax);
+        cy = _mm256_sub_pd(_mm256_loadu_pd(fy + i), ay);
+        x = _mm256_add_pd(_mm256_mul_pd(cx, c), _mm256_mul_pd(cy, s));
+        y = _mm256_sub_pd(_mm256_mul_pd(cy, c), _mm256_mul_pd(cx, s));
+        r = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(x, x), x),
+                          _mm256_sub_pd(_mm256_mul_pd(y, y), y));
+        out = _mm256_movemask_pd(_mm256_cmp_pd(r, limit, _CMP_GT_OQ)) & inbox;
+        for (k = 0; k < 4; k++)
+            if ((out >> k) & 1)
+                inbox_clear(pq, i + k);
+    }
+    return i;
+}
+#endif
+
+#if defined(SOLVER_SIMD_ARM)
+static int check_inbox_neon(pquad* pq, int start, const double* fx,
+                            const double* fy, double Ax, double Ay, double maxr) {
+    const float64x2_t ax = vdupq_n_f64(Ax);
+    const float64x2_t ay = vdupq_n_f64(Ay);
+    const float64x2_t c = vdupq_n_f64(pq->costheta);
+    const float64x2_t s = vdupq_n_f64(pq->sintheta);
+    const float64x2_t limit = vdupq_n_f64(maxr);
+    int i = start;
+    for (; i + 2 <= pq->ninbox; i += 2) {
+        uint64_t out[2];
+        float64x2x2_t xy;
+        float64x2_t cx, cy, r;
+        if (!inbox_bits(pq, i, 2))
+            continue;
+        cx = vsubq_f64(vld1q_f64(fx + i), ax);
+        cy = vsubq_f64(vld1q_f64(fy + i), ay);
+        xy.val[0] = vaddq_f64(vmulq_f64(cx, c), vmulq_f64(cy, s));
+        xy.val[1] = vsubq_f64(vmulq_f64(cy, c), vmulq_f64(cx, s));
+        r = vaddq_f64(vsubq_f64(vmulq_f64(xy.val[0], xy.val[0]), xy.val[0]),
+                      vsubq_f64(vmulq_f64(xy.val[1], xy.val[1]), xy.val[1]));
+        vst1q_u64(out, vcgtq_f64(r, limit));
+        if (out[0])
+            inbox_clear(pq, i);
+        if (out[1])
+            inbox_clear(pq, i + 1);
+    }
+    return i;
+}
+#endif
+
+#if defined(SOLVER_SIMD_X86)
+SOLVER_TARGET_AVX2
+static int check_inbox_avx2f(pquad* pq, int start, const float* fx,
+                             const float* fy, float Ax, float Ay, float maxr) {
+    const __m256 ax = _mm256_set1_ps(Ax);
+    const __m256 ay = _mm256_set1_ps(Ay);
+    const __m256 c = _mm256_set1_ps((float)pq->costheta);
+    const __m256 s = _mm256_set1_ps((float)pq->sintheta);
+    const __m256 limit = _mm256_set1_ps(maxr);
+    int i = start;
+    for (; i + 8 <= pq->ninbox; i += 8) {
+        int out, k;
+        __m256 cx, cy, x, y, r;
+        int inbox = inbox_bits(pq, i, 8);
+        if (!inbox)
+            continue;
+        cx = _mm256_sub_ps(_mm256_loadu_ps(fx + i), ax);
+        cy = _mm256_sub_ps(_mm256_loadu_ps(fy + i), ay);
+        x = _mm256_add_ps(_mm256_mul_ps(cx, c), _mm256_mul_ps(cy, s));
+        y = _mm256_sub_ps(_mm256_mul_ps(cy, c), _mm256_mul_ps(cx, s));
+        r = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(x, x), x),
+                          _mm256_sub_ps(_mm256_mul_ps(y, y), y));
+        out = _mm256_movemask_ps(_mm256_cmp_ps(r, limit, _CMP_GT_OQ)) & inbox;
+        for (k = 0; k < 8; k++)
+            if ((out >> k) & 1)
+                inbox_clear(pq, i + k);
+    }
+    return i;
+}
+#endif
+
+#if defined(SOLVER_SIMD_ARM)
+static int check_inbox_neonf(pquad* pq, int start, const float* fx,
+                             const float* fy, float Ax, float Ay, float maxr) {
+    const float32x4_t ax = vdupq_n_f32(Ax);
+    const float32x4_t ay = vdupq_n_f32(Ay);
+    const float32x4_t c = vdupq_n_f32((float)pq->costheta);
+    const float32x4_t s = vdupq_n_f32((float)pq->sintheta);
+    const float32x4_t limit = vdupq_n_f32(maxr);
+    int i = start;
+    for (; i + 4 <= pq->ninbox; i += 4) {
+        uint32_t out[4];
+        float32x4_t cx, cy, x, y, r;
+        int k;
+        if (!inbox_bits(pq, i, 4))
+            continue;
+        cx = vsubq_f32(vld1q_f32(fx + i), ax);
+        cy = vsubq_f32(vld1q_f32(fy + i), ay);
+        x = vaddq_f32(vmulq_f32(cx, c), vmulq_f32(cy, s));
+        y = vsubq_f32(vmulq_f32(cy, c), vmulq_f32(cx, s));
+        r = vaddq_f32(vsubq_f32(vmulq_f32(x, x), x),
+                      vsubq_f32(vmulq_f32(y, y), y));
+        vst1q_u32(out, vcgtq_f32(r, limit));
+        for (k = 0; k < 4; k++)
+            if (out[k])
+                inbox_clear(pq, i + k);
+    }
+    return i;
+}
+#endif
+
+static void check_inbox_f(pquad* pq, int start, solver_t* solver) {
+    int i;
+    const float* fx = solver->field_xf;
+    const float* fy = solver->field_yf;
+    const float tol = solver->codetol;
+    const float maxr = tol * (M_SQRT2 + tol);
+    const float Ax = fx[pq->fieldA];
+    const float Ay = fy[pq->fieldA];
+    const float costheta = pq->costheta;
+    const float sintheta = pq->sintheta;
+    i = start;
+#if defined(SOLVER_SIMD_X86)
+    if (have_avx2())
+        i = check_inbox_avx2f(pq, start, fx, fy, Ax, Ay, maxr);
+#elif defined(SOLVER_SIMD_ARM)
+    i = check_inbox_neonf(pq, start, fx, fy, Ax, Ay, maxr);
+#endif
+    for (; i < pq->ninbox; i++) {
+        float r, Cx, Cy, xxtmp;
+        if (!(i & 63) && !pq->inbox[i >> 6]) {
+            i += 63;
+            continue;
+        }
+        if (!inbox_get(pq, i))
+            continue;
+        Cx = fx[i] - Ax;
+        Cy = fy[i] - Ay;
+        xxtmp = Cx;
+        Cx = Cx * costheta + Cy * sintheta;
+        Cy = -xxtmp * sintheta + Cy * costheta;
+        // the circle of check_inbox
+        r = (Cx * Cx - Cx) + (Cy * Cy - Cy);
+        if (r > maxr)
+            inbox_clear(pq, i);
+    }
+}
+
 static void check_inbox(pquad* pq, int start, solver_t* solver) {
     int i;
     double Ax, Ay;
-    field_getxy(solver, pq->fieldA, &Ax, &Ay);
+    const double* fx = solver->fieldxy->x;
+    const double* fy = solver->fieldxy->y;
+    double tol = solver->codetol;
+    double maxr = tol * (M_SQRT2 + tol);
+    if (solver->float_search) { //# Modified for the StellarSolver Internal Library
+        check_inbox_f(pq, start, solver);
+        return;
+    }
+    Ax = fx[pq->fieldA];
+    Ay = fy[pq->fieldA];
+    i = start;
+#if defined(SOLVER_SIMD_X86)
+    if (have_avx2())
+        i = check_inbox_avx2(pq, start, fx, fy, Ax, Ay, maxr);
+#elif defined(SOLVER_SIMD_ARM)
+    i = check_inbox_neon(pq, start, fx, fy, Ax, Ay, maxr);
+#endif
     // check which C, D points are inside the circle.
-    for (i = start; i < pq->ninbox; i++) {
+    for (; i < pq->ninbox; i++) {
         double r;
         double Cx, Cy, xxtmp;
-        double tol = solver->codetol;
-        if (!pq->inbox[i])
+        // whole words of stars that are out can be skipped
+        if (!(i & 63) && !pq->inbox[i >> 6]) {
+            i += 63;
             continue;
-        field_getxy(solver, i, &Cx, &Cy);
+        }
+        if (!inbox_get(pq, i))
+            continue;
+        Cx = fx[i];
+        Cy = fy[i];
         Cx -= Ax;
         Cy -= Ay;
         xxtmp = Cx;
@@ -596,21 +1179,23 @@ static void check_inbox(pquad* pq, int start, solver_t* solver) {
         // x^2-x + y^2-y + 1/2     <=   1/2 + sqrt(2)*codetol + codetol^2
         // x^2-x + y^2-y           <=   sqrt(2)*codetol + codetol^2
         r = (Cx * Cx - Cx) + (Cy * Cy - Cy);
-        if (r > (tol * (M_SQRT2 + tol))) {
-            pq->inbox[i] = FALSE;
-            continue;
-        }
-        setx(pq->xy, i, Cx);
-        sety(pq->xy, i, Cy);
+        if (r > maxr)
+            inbox_clear(pq, i);
     }
 }
 
+//# Modified for the StellarSolver Internal Library
+// check_inbox for the kernel benchmark, which times it on its own.
+void solver_check_inbox(pquad* pq, int start, solver_t* solver) {
+    check_inbox(pq, start, solver);
+}
+
 #if defined DEBUGSOLVER
 static void print_inbox(pquad* pq) {
     int i;
     debug("[ ");
     for (i = 0; i < pq->ninbox; i++) {
-        if (pq->inbox[i])
+        if (inbox_get(pq, i))
             debug("%i ", i);
     }
     debug("] (n %i)\n", pq->ninbox);
@@ -642,13 +1227,38 @@ static void find_field_boundaries(solver_t* solver) {
     set_diag(solver);
 }
 
+//# Modified for the StellarSolver Internal Library
+static void free_field_verify(solver_t* solver) {
+    if (solver->vf_is_shared)
+        verify_field_free_shared(solver->vf);
+    else
+        verify_field_free(solver->vf);
+    solver->vf = NULL;
+    solver->vf_is_shared = FALSE;
+}
+
 void solver_preprocess_field(solver_t* solver) {
     find_field_boundaries(solver);
+    free_worker_fields(solver); //# Modified for the StellarSolver Internal Library
     // precompute a kdtree over the field
-    solver->vf = verify_field_preprocess(solver->fieldxy);
+    //# Modified for the StellarSolver Internal Library
+    // When the indexes are tried one at a time, the field stays the same
+    // for all of them, so it only gets preprocessed once.
+    if (!solver->vf || solver->vf->field != solver->fieldxy) {
+        free_field_verify(solver);
+        if (solver->shared_vf && solver->shared_vf->field == solver->fieldxy) {
+            solver->vf = verify_field_share(solver->shared_vf);
+            solver->vf_is_shared = TRUE;
+        } else
+            solver->vf = verify_field_preprocess(solver->fieldxy);
+    } else
+        verify_field_clear_star_cache(solver->vf);
 
     solver->vf->do_uniformize = solver->verify_uniformize;
     solver->vf->do_dedup = solver->verify_dedup;
+    solver->vf->do_grid = solver->verify_grid; //# Modified for the StellarSolver Internal Library
+    solver->vf->cancel_token = solver->cancel_token; //# Modified for the StellarSolver Internal Library
+    solver->vf->refcatalog = solver->refcatalog; //# Modified for the StellarSolver Internal Library
 }
 
 void solver_free_field(solver_t* solver) {
@@ -656,9 +1266,8 @@ void solver_free_field(solver_t* solver) {
     //if (solver->fieldxy)
     //    starxy_free(solver->fieldxy);
     //solver->fieldxy = NULL;
-    if (solver->vf)
-        verify_field_free(solver->vf);
-    solver->vf = NULL;
+    free_worker_fields(solver); //# Modified for the StellarSolver Internal Library
+    free_field_verify(solver); //# Modified for the StellarSolver Internal Library
 }
 
 starxy_t* solver_get_field(solver_t* solver) {
@@ -691,12 +1300,13 @@ static double get_tolerance(solver_t* solver) {
  n_to_add - number of stars to add
  adding - the star we're currently adding; in [0, n_to_add).
  fieldtop - the maximum field star number to build quads out of.
- dimquad, solver, tol2 - passed to try_all_codes.
+ dimquad, solver - passed to try_all_codes.
+ group, ngroup - the indexes to try each quad with, see try_index_group.
  */
 static void add_stars(const pquad* pq, int* field, int fieldoffset,
                       int n_to_add, int adding, int fieldtop,
                       int dimquad,
-                      solver_t* solver, double tol2) {
+                      solver_t* solver, index_t** group, int ngroup) {
     int bottom;
     int* f = field + fieldoffset;
     // When we're adding the first star, we start from index zero.
@@ -708,41 +1318,252 @@ static void add_stars(const pquad* pq, int* field, int fieldoffset,
     // it's required because try_all_codes needs to know which field stars
     // were used to create the quad (which are stored in the "f" array)
     for (f[adding]=bottom; f[adding]<fieldtop; f[adding]++) {
-        if (!pq->inbox[f[adding]])
+        if (!inbox_get(pq, f[adding]))
             continue;
-        if (unlikely(solver->quit_now))
+        if (solver_should_quit(solver))
             return;
 
         // If we've hit the end of the recursion (we're adding the last star),
         // call try_all_codes to try the quad we've built.
         if (adding == n_to_add-1) {
-            // (when not testing, TRY_ALL_CODES is just try_all_codes.)
-            TRY_ALL_CODES(pq, field, dimquad, solver, tol2);
+            try_index_group(pq, field, dimquad, solver, group, ngroup);
         } else {
             // Else recurse.
             add_stars(pq, field, fieldoffset, n_to_add, adding+1,
-                      fieldtop, dimquad, solver, tol2);
+                      fieldtop, dimquad, solver, group, ngroup);
+        }
+    }
+}
+
+//# Modified for the StellarSolver Internal Library
+/*
+ The field stars of the quad have all been chosen: try it with each of the
+ indexes in "group", which all take quads of the same size and dimension,
+ so the field side of the quad is only enumerated once for all of them.
+ */
+static void try_index_group(const pquad* pq, int* field, int dimquad,
+                            solver_t* solver, index_t** group, int ngroup) {
+    int k;
+    for (k=0; k<ngroup; k++) {
+        set_index(solver, group[k]);
+        // (when not testing, TRY_ALL_CODES is just try_all_codes.)
+        TRY_ALL_CODES(pq, field, dimquad, solver, get_tolerance(solver));
+        if (solver_should_quit(solver))
+            return;
+    }
+}
+
+//# Modified for the StellarSolver Internal Library
+/*
+ Bins the indexes that take quads of the same dimension and the same range
+ of sizes in pixels^2, so that each quad of field stars is built once per
+ bin instead of once per index.  An index series split into healpix tiles
+ has many indexes of the same scale, which all end up in one bin.
+
+ "groupindexes" gets the indexes bin by bin, each in their original order,
+ and the indexes of bin g are groupindexes[groupstart[g]] up to
+ groupindexes[groupstart[g+1]].  Returns the number of bins.
+ */
+static int group_indexes(solver_t* solver, const double* minAB2s,
+                         const double* maxAB2s, index_t** groupindexes,
+                         int* groupstart, double* groupminAB2,
+                         double* groupmaxAB2, int* groupdimquads) {
+    int num_indexes = pl_size(solver->indexes);
+    int ngroups = 0;
+    int n = 0;
+    int i, j;
+    anbool* grouped = calloc(num_indexes, sizeof(anbool));
+
+    for (i=0; i<num_indexes; i++) {
+        int dimquads;
+        if (grouped[i])
+            continue;
+        dimquads = index_dimquads(pl_get(solver->indexes, i));
+        groupstart[ngroups] = n;
+        groupminAB2[ngroups] = minAB2s[i];
+        groupmaxAB2[ngroups] = maxAB2s[i];
+        groupdimquads[ngroups] = dimquads;
+        for (j=i; j<num_indexes; j++) {
+            index_t* index = pl_get(solver->indexes, j);
+            if (grouped[j] || minAB2s[j] != minAB2s[i] || maxAB2s[j] != maxAB2s[i] ||
+                index_dimquads(index) != dimquads)
+                continue;
+            grouped[j] = TRUE;
+            groupindexes[n++] = index;
         }
+        ngroups++;
     }
+    groupstart[ngroups] = n;
+    free(grouped);
+    return ngroups;
 }
 
 
+//# Modified for the StellarSolver Internal Library
+// The quads whose codes wait for the code matcher, in the order they were
+// built, with their codes, stars and parities one after the other.
+typedef struct {
+    index_t* index;
+    int dimquad;
+    double tol2;
+    // The codes of the quad are pending_codes.codes[first] up to [first + n].
+    int first;
+    int n;
+} pendingquad;
+
+struct pending_codes {
+    int nquads;
+    int ncodes;
+    pendingquad quads[SOLVER_MATCHER_QUADS_MAX];
+    double codes[SOLVER_MATCHER_QUADS_MAX * CODEBATCH_MAX * DCMAX];
+    int stars[SOLVER_MATCHER_QUADS_MAX * CODEBATCH_MAX * DQMAX];
+    anbool parity[SOLVER_MATCHER_QUADS_MAX * CODEBATCH_MAX];
+};
+
+//# Modified for the StellarSolver Internal Library
+/*
+ The inboxes of the pquads, "words" 64 bit words for each pair of A and B
+ stars whose scale is ok.  They are handed out a row of B at a time from big
+ blocks, which are all freed together when solver_run() is done, instead of a
+ malloc for each pair.  Once "maxbytes" of them are in use, each further row
+ gets the scratch row, which the next B star reuses: its quads with B on the
+ diagonal are still tried, but the pair is gone for the quads with a later
+ C star.  The stars are in order of brightness, so the pairs that are dropped
+ are the ones of the faintest B stars, which are the least likely to solve.
+ */
+#define PQUAD_STORE_BLOCK_WORDS (1 << 17)
+
+typedef struct {
+    int numxy;
+    int words;
+    size_t maxbytes;
+    size_t usedbytes;
+    pl* blocks;
+    uint64_t* block;
+    size_t blockfree;
+    uint64_t* scratch;
+    anbool* rowkept;
+} pquad_store;
+
+static void pquad_store_init(pquad_store* st, int numxy, size_t maxbytes) {
+    memset(st, 0, sizeof(pquad_store));
+    st->numxy = numxy;
+    st->words = INBOX_WORDS(numxy);
+    st->maxbytes = maxbytes;
+    st->blocks = pl_new(16);
+    st->rowkept = calloc(numxy, sizeof(anbool));
+}
+
+static void pquad_store_free(pquad_store* st) {
+    size_t i;
+    for (i = 0; i < pl_size(st->blocks); i++)
+        free(pl_get(st->blocks, i));
+    pl_free(st->blocks);
+    free(st->scratch);
+    free(st->rowkept);
+}
+
+// The pairs of the row of star B are at "row" in the pquads array, the A
+// stars before B.  This hands out the inboxes of the ones whose scale is ok.
+static void pquad_store_row(pquad_store* st, pquad* row, int B) {
+    size_t n = 0, words, bytes;
+    uint64_t* inboxes;
+    int a;
+    for (a = 0; a < B; a++)
+        if (row[a].scale_ok)
+            n++;
+    words = n * st->words;
+    bytes = words * sizeof(uint64_t);
+    if (st->maxbytes && st->usedbytes + bytes > st->maxbytes) {
+        if (!st->scratch) {
+            logverb("The pquads have reached %zu bytes, the pairs of star %i on are only kept for star %i\n",
+                    st->usedbytes, B, B);
+            st->scratch = malloc((size_t)st->numxy * st->words * sizeof(uint64_t));
+        }
+        inboxes = st->scratch;
+        st->rowkept[B] = FALSE;
+    } else {
+        if (words > st->blockfree) {
+            size_t blockwords = MAX(words, (size_t)PQUAD_STORE_BLOCK_WORDS);
+            st->block = malloc(blockwords * sizeof(uint64_t));
+            pl_append(st->blocks, st->block);
+            st->blockfree = blockwords;
+        }
+        inboxes = st->block;
+        st->block += words;
+        st->blockfree -= words;
+        st->usedbytes += bytes;
+        st->rowkept[B] = TRUE;
+    }
+    for (a = 0; a < B; a++) {
+        if (!row[a].scale_ok)
+            continue;
+        row[a].inbox = inboxes;
+        inboxes += st->words;
+    }
+}
+
+// The row of star B in the pquads array, which keeps the pairs A < B.
+#define PQUAD_ROW(pquads, B) ((pquads) + (size_t)(B) * ((B) - 1) / 2)
+
 // The real deal
+//# Modified for the StellarSolver Internal Library
+// Whether any of the indexes has the code tree of its bright quads.
+static anbool have_bright_codes(const solver_t* solver) {
+    size_t i;
+    for (i = 0; i < pl_size(solver->indexes); i++) {
+        const index_t* index = pl_get(solver->indexes, i);
+        if (index->codekd && index->codekd->bright)
+            return TRUE;
+    }
+    return FALSE;
+}
+
 void solver_run(solver_t* solver) {
+    double trace = sstrace_begin(); //# Modified for the StellarSolver Internal Library
     int numxy, newpoint;
     double usertime, systime;
     // first timer callback is called after 1 second
-    time_t next_timer_callback_time = time(NULL) + 1;
+    //# Modified for the StellarSolver Internal Library, on the monotonic clock instead of time()
+    double next_timer_callback_time = timenow_monotonic() + 1;
     pquad* pquads;
+    pquad_store store; //# Modified for the StellarSolver Internal Library
     size_t i, num_indexes;
-    double tol2;
     int field[DQMAX];
+    index_t** groupindexes;
+    int* groupstart;
+    double* groupminAB2;
+    double* groupmaxAB2;
+    int* groupdimquads;
+    int g, ngroups;
 
     get_resource_stats(&usertime, &systime, NULL);
 
     if (!solver->vf)
         solver_preprocess_field(solver);
 
+    //# Modified for the StellarSolver Internal Library
+    // The bright pass runs first, over the quads of the brightest stars of
+    // the field and of the indexes, and the whole run only follows if it
+    // didn't solve the field.  A pipelined solve only does it on its first run.
+    if (solver->bright_pass_stars > 0 && !solver->bright_pass && solver->startobj == 0 &&
+        have_bright_codes(solver)) {
+        int endobj = solver->endobj;
+        solver->bright_pass = TRUE;
+        if (!endobj || endobj > solver->bright_pass_stars)
+            solver->endobj = solver->bright_pass_stars;
+        solver_run(solver);
+        solver->bright_pass = FALSE;
+        solver->endobj = endobj;
+        logverb("The bright pass over %i stars %s the field after %i quads.\n",
+                solver->bright_pass_stars, solver->best_match_solves ? "solved" : "did not solve",
+                solver->numtries);
+        if (solver->best_match_solves || solver_should_quit(solver)) {
+            sstrace_end("solver_run", trace);
+            return;
+        }
+    }
+
     memset(field, 0, sizeof(field));
 
     solver->starttime = usertime + systime;
@@ -750,13 +1571,28 @@ void solver_run(solver_t* solver) {
     numxy = starxy_n(solver->fieldxy);
     if (solver->endobj && (numxy > solver->endobj))
         numxy = solver->endobj;
-    if (solver->startobj >= numxy)
+    if (solver->startobj >= numxy) { //# Modified for the StellarSolver Internal Library
+        sstrace_end("solver_run", trace);
         return;
+    }
     if (numxy >= 1000) {
         logverb("Limiting search to first 1000 objects\n");
         numxy = 1000;
     }
 
+    //# Modified for the StellarSolver Internal Library, the float copies of
+    // the field for float_search.  A pipelined solve grows the field between
+    // the runs, so they are made for each run.
+    if (solver->float_search) {
+        int j;
+        solver->field_xf = malloc(sizeof(float) * numxy);
+        solver->field_yf = malloc(sizeof(float) * numxy);
+        for (j = 0; j < numxy; j++) {
+            solver->field_xf[j] = field_getx(solver, j);
+            solver->field_yf[j] = field_gety(solver, j);
+        }
+    }
+
     if (solver->set_crpix && solver->set_crpix_center) {
         solver->crpix[0] = wcs_pixel_center_for_size(solver_field_width(solver));
         solver->crpix[1] = wcs_pixel_center_for_size(solver_field_height(solver));
@@ -799,6 +1635,16 @@ void solver_run(solver_t* solver) {
             solver->maxmaxAB2 = MIN(solver->maxmaxAB2, square(solver->quadsize_max));
         logverb("Quad scale range: [%g, %g] pixels\n", sqrt(solver->minminAB2), sqrt(solver->maxmaxAB2));
 
+        groupindexes = malloc(sizeof(index_t*) * num_indexes);
+        groupstart = malloc(sizeof(int) * (num_indexes + 1));
+        groupminAB2 = malloc(sizeof(double) * num_indexes);
+        groupmaxAB2 = malloc(sizeof(double) * num_indexes);
+        groupdimquads = malloc(sizeof(int) * num_indexes);
+        ngroups = group_indexes(solver, minAB2s, maxAB2s, groupindexes, groupstart,
+                                groupminAB2, groupmaxAB2, groupdimquads);
+        if (ngroups < (int)num_indexes)
+            logverb("Building the quads once for %i groups of indexes with the same quad sizes\n", ngroups);
+
         // quick-n-dirty scale estimate using stars A,B.
         solver->abscale_high = square(arcsec2rad(solver->funits_upper) * (1.0 + solver->codetol));
         solver->abscale_low  = square(arcsec2rad(solver->funits_lower) * (1.0 - solver->codetol));
@@ -813,21 +1659,27 @@ void solver_run(solver_t* solver) {
          MIN(M_PI, arcsec2rad(field_diag * solver->funits_upper)) ...
          */
 
-        pquads = calloc(numxy * numxy, sizeof(pquad));
+        //# Modified for the StellarSolver Internal Library, only the pairs
+        // A < B are kept, and their inboxes come from the pquad_store
+        pquads = calloc((size_t)numxy * (numxy - 1) / 2 + 1, sizeof(pquad));
+        pquad_store_init(&store, numxy, solver->pquad_bytes_max);
+
+        //# Modified for the StellarSolver Internal Library
+        // The bright pass searches its small trees as it goes
+        if (solver->code_matcher && !solver->bright_pass)
+            solver->pending_codes = calloc(1, sizeof(struct pending_codes));
 
         /* We maintain an array of "potential quads" (pquad) structs, where
          * each struct corresponds to one choice of stars A and B; the struct
-         * at index (B * numxy + A) holds information about quads that could be
-         * created using stars A,B.
+         * at index (B * (B - 1) / 2 + A) holds information about quads that
+         * could be created using stars A,B, see PQUAD_ROW.
          *
-         * (We only use the above-diagonal elements of this 2D array because
-         * A<B.)
+         * (We only keep the lower triangle of this 2D array because A<B.)
          *
          * For each AB pair, we cache the scale and the rotation parameters,
-         * and we keep an array "inbox" of length "numxy" of booleans, one for
-         * each star, which say whether that star is eligible to be star C or D
-         * of a quad with AB at the corners.  (Obviously A and B aren't
-         * eligible).
+         * and we keep a bitset "inbox" of "numxy" bits, one for each star,
+         * which say whether that star is eligible to be star C or D of a quad
+         * with AB at the corners.  (Obviously A and B aren't eligible).
          *
          * The "ninbox" parameter is somewhat misnamed - it says that "inbox"
          * elements in the range [0, ninbox) have been initialized.
@@ -839,22 +1691,27 @@ void solver_run(solver_t* solver) {
         if (solver->startobj) {
             debug("startobj > 0; priming pquad arrays.\n");
             for (field[B] = 0; field[B] < solver->startobj; field[B]++) {
+                pquad* row = PQUAD_ROW(pquads, field[B]);
                 for (field[A] = 0; field[A] < field[B]; field[A]++) {
-                    pquad* pq = pquads + field[B] * numxy + field[A];
+                    pquad* pq = row + field[A];
                     pq->fieldA = field[A];
                     pq->fieldB = field[B];
-                    debug("trying A=%i, B=%i\n", field[A], field[B]);
                     check_scale(pq, solver);
+                }
+                pquad_store_row(&store, row, field[B]);
+                if (!store.rowkept[field[B]])
+                    continue;
+                for (field[A] = 0; field[A] < field[B]; field[A]++) {
+                    pquad* pq = row + field[A];
+                    debug("trying A=%i, B=%i\n", field[A], field[B]);
                     if (!pq->scale_ok) {
                         debug("  bad scale for A=%i, B=%i\n", field[A], field[B]);
                         continue;
                     }
-                    pq->xy = malloc(numxy * 2 * sizeof(double));
-                    pq->inbox = malloc(numxy * sizeof(anbool));
-                    memset(pq->inbox, TRUE, solver->startobj);
+                    inbox_fill(pq, solver->startobj, store.words);
                     pq->ninbox = solver->startobj;
-                    pq->inbox[field[A]] = FALSE;
-                    pq->inbox[field[B]] = FALSE;
+                    inbox_clear(pq, field[A]);
+                    inbox_clear(pq, field[B]);
                     check_inbox(pq, 0, solver);
                     debug("  inbox(A=%i, B=%i): ", field[A], field[B]);
                     print_inbox(pq);
@@ -878,10 +1735,13 @@ void solver_run(solver_t* solver) {
 
             // Give our caller a chance to cancel us midway. The callback
             // returns how long to wait before calling again.
+            //# Modified for the StellarSolver Internal Library, the cancel token doesn't wait for the callback
+            if (solver_should_quit(solver))
+                break;
 
             if (solver->timer_callback) {
                 time_t delay;
-                time_t now = time(NULL);
+                double now = timenow_monotonic();
                 if (now > next_timer_callback_time) {
                     update_timeused(solver);
                     delay = solver->timer_callback(solver->userdata);
@@ -896,59 +1756,52 @@ void solver_run(solver_t* solver) {
             field[B] = newpoint;
             debug("Trying quads with B=%i\n", newpoint);
 	
-            // first do an index-independent scale check...
+            // first do an index-independent scale check, for all of the A stars at once...
+            check_scales(PQUAD_ROW(pquads, field[B]), field[B], newpoint, solver);
+            pquad_store_row(&store, PQUAD_ROW(pquads, field[B]), field[B]);
             for (field[A] = 0; field[A] < newpoint; field[A]++) {
                 // initialize the "pquad" struct for this AB combo.
-                pquad* pq = pquads + field[B] * numxy + field[A];
-                pq->fieldA = field[A];
-                pq->fieldB = field[B];
+                pquad* pq = PQUAD_ROW(pquads, field[B]) + field[A];
                 debug("  trying A=%i, B=%i\n", field[A], field[B]);
-                check_scale(pq, solver);
                 if (!pq->scale_ok) {
                     debug("    bad scale for A=%i, B=%i\n", field[A], field[B]);
                     continue;
                 }
-                // initialize the "inbox" array:
-                pq->inbox = malloc(numxy * sizeof(anbool));
-                pq->xy = malloc(numxy * 2 * sizeof(double));
+                // initialize the "inbox" bitset:
                 // -try all stars up to "newpoint"...
-                assert(sizeof(anbool) == 1);
-                memset(pq->inbox, TRUE, newpoint + 1);
+                inbox_fill(pq, newpoint + 1, store.words);
                 pq->ninbox = newpoint + 1;
                 // -except A and B.
-                pq->inbox[field[A]] = FALSE;
-                pq->inbox[field[B]] = FALSE;
+                inbox_clear(pq, field[A]);
+                inbox_clear(pq, field[B]);
                 check_inbox(pq, 0, solver);
                 debug("    inbox(A=%i, B=%i): ", field[A], field[B]);
                 print_inbox(pq);
             }
 
-            // Now iterate through the different indices
-            for (i = 0; i < num_indexes; i++) {
-                index_t* index = pl_get(solver->indexes, i);
-                int dimquads;
-                set_index(solver, index);
-                dimquads = index_dimquads(index);
+            // Now iterate through the groups of indices with the same quad sizes
+            for (g = 0; g < ngroups; g++) {
+                int dimquads = groupdimquads[g];
                 for (field[A] = 0; field[A] < newpoint; field[A]++) {
                     // initialize the "pquad" struct for this AB combo.
-                    pquad* pq = pquads + field[B] * numxy + field[A];
+                    pquad* pq = PQUAD_ROW(pquads, field[B]) + field[A];
                     if (!pq->scale_ok)
                         continue;
-                    if ((pq->scale < minAB2s[i]) ||
-                        (pq->scale > maxAB2s[i]))
+                    if ((pq->scale < groupminAB2[g]) ||
+                        (pq->scale > groupmaxAB2[g]))
                         continue;
-                    // set code tolerance for this index and AB pair...
+                    // set code tolerance for this AB pair...
                     solver->rel_field_noise2 = pq->rel_field_noise2;
-                    tol2 = get_tolerance(solver);
                     // Now look at all sets of (C, D, ...) stars (subject to field[C] < field[D] < ...)
                     // ("dimquads - 2" because we've set stars A and B at this point)
-                    add_stars(pq, field, C, dimquads-2, 0, newpoint, dimquads, solver, tol2);
-                    if (solver->quit_now)
+                    add_stars(pq, field, C, dimquads-2, 0, newpoint, dimquads, solver,
+                              groupindexes + groupstart[g], groupstart[g+1] - groupstart[g]);
+                    if (solver_should_quit(solver))
                         goto quitnow;
                 }
             }
 
-            if (solver->quit_now)
+            if (solver_should_quit(solver))
                 goto quitnow;
 
             // Now try building quads with the new star not on the diagonal:
@@ -958,16 +1811,20 @@ void solver_run(solver_t* solver) {
             for (field[A] = 0; field[A] < newpoint; field[A]++) {
                 for (field[B] = field[A] + 1; field[B] < newpoint; field[B]++) {
                     // grab the "pquad" for this AB combo
-                    pquad* pq = pquads + field[B] * numxy + field[A];
+                    pquad* pq = PQUAD_ROW(pquads, field[B]) + field[A];
                     if (!pq->scale_ok) {
                         debug("  bad scale for A=%i, B=%i\n", field[A], field[B]);
                         continue;
                     }
+                    //# Modified for the StellarSolver Internal Library
+                    // the pairs of this B star were dropped, see pquad_store
+                    if (!store.rowkept[field[B]])
+                        continue;
                     // test if this C is in the box:
-                    pq->inbox[field[C]] = TRUE;
+                    inbox_set(pq, field[C]);
                     pq->ninbox = field[C] + 1;
                     check_inbox(pq, field[C], solver);
-                    if (!pq->inbox[field[C]]) {
+                    if (!inbox_get(pq, field[C])) {
                         debug("  C is not in the box for A=%i, B=%i\n", field[A], field[B]);
                         continue;
                     }
@@ -978,50 +1835,65 @@ void solver_run(solver_t* solver) {
 
                     solver->rel_field_noise2 = pq->rel_field_noise2;
 
-                    for (i = 0; i < pl_size(solver->indexes); i++) {
-                        int dimquads;
-                        index_t* index = pl_get(solver->indexes, i);
-                        if ((pq->scale < minAB2s[i]) ||
-                            (pq->scale > maxAB2s[i]))
+                    for (g = 0; g < ngroups; g++) {
+                        int dimquads = groupdimquads[g];
+                        index_t** group = groupindexes + groupstart[g];
+                        int ngroup = groupstart[g+1] - groupstart[g];
+                        if ((pq->scale < groupminAB2[g]) ||
+                            (pq->scale > groupmaxAB2[g]))
                             continue;
-                        set_index(solver, index);
-                        dimquads = index_dimquads(index);
-
-                        tol2 = get_tolerance(solver);
 
                         if (dimquads > 3) {
                             // ("dimquads - 3" because we've set stars A, B, and C at this point)
-                            add_stars(pq, field, D, dimquads-3, 0, newpoint, dimquads, solver, tol2);
+                            add_stars(pq, field, D, dimquads-3, 0, newpoint, dimquads, solver, group, ngroup);
                         } else {
-                            TRY_ALL_CODES(pq, field, dimquads, solver, tol2);
+                            try_index_group(pq, field, dimquads, solver, group, ngroup);
                         }
-                        if (solver->quit_now)
+                        if (solver_should_quit(solver))
                             goto quitnow;
                     }
                 }
             }
+            //# Modified for the StellarSolver Internal Library
+            // The matches of the quads of this star are all resolved before
+            // the limits below are checked.
+            flush_pending_codes(solver);
             logverb("object %u of %u: %i quads tried, %i matched.\n",
                     newpoint + 1, numxy, solver->numtries, solver->nummatches);
 
             if ((solver->maxquads && (solver->numtries >= solver->maxquads))
                 || (solver->maxmatches && (solver->nummatches >= solver->maxmatches))
-                || solver->quit_now)
+                || solver_should_quit(solver))
                 break;
         }
 
     quitnow:
-        for (i = 0; i < (numxy*numxy); i++) {
-            pquad* pq = pquads + i;
-            free(pq->inbox);
-            free(pq->xy);
+        //# Modified for the StellarSolver Internal Library
+        // The codes that still wait when the solver quits are never searched.
+        free(solver->pending_codes);
+        solver->pending_codes = NULL;
+        for (i = 0; i < SOLVER_CODEBATCH_MAX; i++) {
+            kdtree_free_query(solver->code_results[i]);
+            solver->code_results[i] = NULL;
         }
+        pquad_store_free(&store);
         free(pquads);
+        free(groupindexes);
+        free(groupstart);
+        free(groupminAB2);
+        free(groupmaxAB2);
+        free(groupdimquads);
 
 #ifdef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
         free(minAB2s);
         free(maxAB2s);
 #endif
     }
+    //# Modified for the StellarSolver Internal Library
+    free(solver->field_xf);
+    free(solver->field_yf);
+    solver->field_xf = solver->field_yf = NULL;
+    sstrace_end("solver_run", trace); //# Modified for the StellarSolver Internal Library
 }
 
 /**
@@ -1035,8 +1907,10 @@ static void try_all_codes(const pquad* pq,
     double code[DCMAX];
     double flipcode[DCMAX];
     int i;
+    codebatch batch;
 
     solver->numtries++;
+    batch.n = 0;
 
     debug("  trying quad [");
     for (i=0; i<dimquad; i++) {
@@ -1044,9 +1918,13 @@ static void try_all_codes(const pquad* pq,
     }
     debug("]\n");
 
+    //# Modified for the StellarSolver Internal Library, the code coordinates
+    // are computed the same way as in check_inbox() instead of being kept
     for (i=0; i<dimquad-NBACK; i++) {
-        code[2*i  ] = getx(pq->xy, fieldstars[NBACK+i]);
-        code[2*i+1] = gety(pq->xy, fieldstars[NBACK+i]);
+        double Cx = field_getx(solver, fieldstars[NBACK+i]) - field_getx(solver, pq->fieldA);
+        double Cy = field_gety(solver, fieldstars[NBACK+i]) - field_gety(solver, pq->fieldA);
+        code[2*i  ] = Cx * pq->costheta + Cy * pq->sintheta;
+        code[2*i+1] = -Cx * pq->sintheta + Cy * pq->costheta;
     }
 
     if (solver->parity == PARITY_NORMAL ||
@@ -1057,7 +1935,7 @@ static void try_all_codes(const pquad* pq,
             debug("%s%g", (i?", ":""), code[i]);
         debug("].\n");
 
-        try_all_codes_2(fieldstars, dimquad, code, solver, FALSE, tol2);
+        try_all_codes_2(fieldstars, dimquad, code, solver, FALSE, tol2, &batch);
     }
     if (solver->parity == PARITY_FLIP ||
         solver->parity == PARITY_BOTH) {
@@ -1069,8 +1947,14 @@ static void try_all_codes(const pquad* pq,
             debug("%s%g", (i?", ":""), flipcode[i]);
         debug("].\n");
 
-        try_all_codes_2(fieldstars, dimquad, flipcode, solver, TRUE, tol2);
+        try_all_codes_2(fieldstars, dimquad, flipcode, solver, TRUE, tol2, &batch);
     }
+
+    //# Modified for the StellarSolver Internal Library
+    if (solver->pending_codes)
+        defer_codes(&batch, dimquad, solver, tol2);
+    else
+        search_codes(&batch, dimquad, solver, tol2);
 }
 
 /**
@@ -1079,9 +1963,9 @@ static void try_all_codes(const pquad* pq,
  */
 static void try_all_codes_2(const int* fieldstars, int dimquad,
                             const double* code, solver_t* solver,
-                            anbool current_parity, double tol2) {
+                            anbool current_parity, double tol2,
+                            codebatch* batch) {
     int i;
-    kdtree_qres_t* result = NULL;
     int dimcode = (dimquad - 2) * 2;
     int stars[DQMAX];
     double flipcode[DCMAX];
@@ -1097,9 +1981,7 @@ static void try_all_codes_2(const int* fieldstars, int dimquad,
         placed[i] = FALSE;
 
     try_permutations(fieldstars, dimquad, code, solver, current_parity,
-                     tol2, stars, NULL, 0, placed, &result);
-    if (unlikely(solver->quit_now))
-        goto bailout;
+                     tol2, stars, NULL, 0, placed, batch);
 
     // Flipped:
     stars[0] = fieldstars[1];
@@ -1112,10 +1994,7 @@ static void try_all_codes_2(const int* fieldstars, int dimquad,
         placed[i] = FALSE;
 
     try_permutations(fieldstars, dimquad, flipcode, solver, current_parity,
-                     tol2, stars, NULL, 0, placed, &result);
-
- bailout:
-    kdtree_free_query(result);
+                     tol2, stars, NULL, 0, placed, batch);
 }
 
 /**
@@ -1128,10 +2007,8 @@ static void try_permutations(const int* origstars, int dimquad,
                              double tol2,
                              int* stars, double* code,
                              int slot, anbool* placed,
-                             kdtree_qres_t** presult) {
+                             codebatch* batch) {
     int i;
-    int options = KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_COMPUTE_DISTS |
-        KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_USE_SPLIT;
     double mycode[DCMAX];
     int Nstars = dimquad - NBACK;
     int lastslot = dimquad - NBACK - 1;
@@ -1156,6 +2033,9 @@ static void try_permutations(const int* origstars, int dimquad,
      AB ECD
      AB EDC
 
+     The codes are added to "batch", to be searched for with the
+     codes of the other permutations.
+
      This call will try to put each star in "slot" in turn, then for
      each one recurse to "slot" in the rest of the stars.
 
@@ -1212,7 +2092,7 @@ static void try_permutations(const int* origstars, int dimquad,
             placed[i] = TRUE;
             try_permutations(origstars, dimquad, origcode, solver,
                              current_parity, tol2, stars, code, 
-                             slot+1, placed, presult);
+                             slot+1, placed, batch);
             placed[i] = FALSE;
 
         } else {
@@ -1221,37 +2101,276 @@ static void try_permutations(const int* origstars, int dimquad,
             continue;
 #endif
 				
-            // Search with the code we've built.
-            *presult = kdtree_rangesearch_options_reuse
-                (solver->index->codekd->tree, *presult, code, tol2, options);
-            //debug("      trying ABCD = [%i %i %i %i]: %i results.\n",
-            //fstars[A], fstars[B], fstars[C], fstars[D], result->nres);
+            // Queue the code we've built, it is searched for with the others.
+            {
+                int dimcode = (dimquad - NBACK) * 2;
+                assert(batch->n < CODEBATCH_MAX);
+                memcpy(batch->codes + batch->n * dimcode, code, dimcode * sizeof(double));
+                memcpy(batch->stars + batch->n * DQMAX, stars, dimquad * sizeof(int));
+                batch->parity[batch->n] = current_parity;
+                batch->n++;
+            }
+        }
+    }
+}
 
-            if ((*presult)->nres) {
+/**
+ Searches the code tree for all of the codes of a quad in one traversal,
+ so its top nodes aren't read again for each permutation, and then
+ resolves the matches of each code in the order they were built.
+ */
+static void search_codes(const codebatch* batch, int dimquad,
+                         solver_t* solver, double tol2) {
+    int options = KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_COMPUTE_DISTS |
+        KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_USE_SPLIT;
+    kdtree_qres_t** results = solver->code_results;
+    const codetree_shards_t* shards = solver->index->codekd->shards;
+    const codetree_subset_t* bright = solver->index->codekd->bright;
+    int i, k, ncells = 1;
+
+    if (!batch->n)
+        return;
+    //# Modified for the StellarSolver Internal Library
+    // The pass over the bright codes only searches their tree, and skips the
+    // indexes that don't have one.
+    if (solver->bright_pass && !bright)
+        return;
+    //# Modified for the StellarSolver Internal Library
+    // When the code tree is split up by healpix and there is a position,
+    // only the trees of the healpixes within the search radius are searched.
+    if (shards && solver->use_radec && !solver->bright_pass)
+        ncells = iarray_size(&solver->shard_cells);
+    else
+        shards = NULL;
+    for (k=0; k<ncells; k++) {
+        kdtree_t* tree = codetree_search_tree(solver->index->codekd);
+        const int* quadids = NULL;
+        if (solver->bright_pass) {
+            tree = bright->tree;
+            quadids = bright->quadids;
+        } else if (shards) {
+            int cell = iarray_get(&solver->shard_cells, k);
+            tree = shards->trees[cell];
+            quadids = shards->quadids[cell];
+        }
+        if (kdtree_rangesearch_batch(tree, results, batch->codes, batch->n, tol2, options))
+            continue;
+        for (i=0; i<batch->n; i++) {
+            const int* stars = batch->stars + i * DQMAX;
+            //debug("      trying ABCD = [%i %i %i %i]: %i results.\n",
+            //stars[A], stars[B], stars[C], stars[D], results[i]->nres);
+            if (results[i]->nres) {
                 double pixvals[DQMAX*2];
                 int j;
+                if (quadids)
+                    for (j=0; j<results[i]->nres; j++)
+                        results[i]->inds[j] = quadids[results[i]->inds[j]];
                 for (j=0; j<dimquad; j++) {
                     setx(pixvals, j, field_getx(solver, stars[j]));
                     sety(pixvals, j, field_gety(solver, stars[j]));
                 }
-                resolve_matches(*presult, pixvals, stars, dimquad, solver,
-                                current_parity);
+                resolve_matches(results[i], pixvals, stars, dimquad, solver,
+                                batch->parity[i]);
             }
-            if (unlikely(solver->quit_now))
+            if (solver_should_quit(solver))
                 return;
         }
     }
 }
 
+//# Modified for the StellarSolver Internal Library
+/*
+ Adds the codes of a quad to those that wait for the code matcher, after
+ searching for the ones that are already waiting if there is no room.
+ */
+static void defer_codes(const codebatch* batch, int dimquad,
+                        solver_t* solver, double tol2) {
+    struct pending_codes* pc = solver->pending_codes;
+    int dimcode = (dimquad - 2) * 2;
+    pendingquad* pq;
+    int i;
+
+    if (!batch->n)
+        return;
+    if (pc->nquads == SOLVER_MATCHER_QUADS_MAX)
+        flush_pending_codes(solver);
+    pq = pc->quads + pc->nquads;
+    pq->index = solver->index;
+    pq->dimquad = dimquad;
+    pq->tol2 = tol2;
+    pq->first = pc->ncodes;
+    pq->n = batch->n;
+    for (i=0; i<batch->n; i++) {
+        int k = pc->ncodes + i;
+        memcpy(pc->codes + k * DCMAX, batch->codes + i * dimcode, dimcode * sizeof(double));
+        memcpy(pc->stars + k * DQMAX, batch->stars + i * DQMAX, DQMAX * sizeof(int));
+        pc->parity[k] = batch->parity[i];
+    }
+    pc->ncodes += batch->n;
+    pc->nquads++;
+}
+
+//# Modified for the StellarSolver Internal Library
+/*
+ Searches for the codes of the waiting quads with the code matcher, all of
+ the codes of each index at once, and then resolves the matches of the quads
+ in the order they were built, like search_codes would have.  The codes of
+ an index that the matcher fails on are searched for in its tree instead.
+ */
+static void flush_pending_codes(solver_t* solver) {
+    struct pending_codes* pc = solver->pending_codes;
+    index_t* original;
+    anbool* gathered;
+    int* counts;
+    u32** codeinds;
+    double** codedists;
+    void** buffers;
+    double* codes;
+    int nbuffers = 0;
+    int q, r, i;
+
+    if (!pc || !pc->nquads)
+        return;
+    original = solver->index;
+    gathered = calloc(pc->nquads, sizeof(anbool));
+    counts = malloc(pc->ncodes * sizeof(int));
+    codeinds = malloc(pc->ncodes * sizeof(u32*));
+    codedists = malloc(pc->ncodes * sizeof(double*));
+    buffers = malloc(2 * pc->nquads * sizeof(void*));
+    codes = malloc(pc->ncodes * DCMAX * sizeof(double));
+
+    for (q=0; q<pc->nquads; q++) {
+        index_t* index = pc->quads[q].index;
+        int dimcode = (pc->quads[q].dimquad - 2) * 2;
+        double tol2 = 0;
+        int n = 0;
+        int* found;
+        u32* matches = NULL;
+        double* dists2 = NULL;
+        if (gathered[q])
+            continue;
+        // All of the codes of this index, at the largest of their tolerances.
+        for (r=q; r<pc->nquads; r++) {
+            const pendingquad* pr = pc->quads + r;
+            if (pr->index != index)
+                continue;
+            gathered[r] = TRUE;
+            tol2 = MAX(tol2, pr->tol2);
+            for (i=0; i<pr->n; i++, n++)
+                memcpy(codes + n * dimcode, pc->codes + (pr->first + i) * DCMAX,
+                       dimcode * sizeof(double));
+        }
+        found = malloc(n * sizeof(int));
+        if (solver->code_matcher(solver->code_matcher_data, codetree_search_tree(index->codekd),
+                                 codes, n, dimcode, tol2, found, &matches, &dists2)) {
+            for (r=q; r<pc->nquads; r++)
+                if (pc->quads[r].index == index)
+                    for (i=0; i<pc->quads[r].n; i++)
+                        counts[pc->quads[r].first + i] = -1;
+            free(found);
+            free(matches);
+            free(dists2);
+            continue;
+        }
+        buffers[nbuffers++] = matches;
+        buffers[nbuffers++] = dists2;
+        // Give each code its matches, without those beyond the tolerance of its own quad.
+        n = 0;
+        for (r=q; r<pc->nquads; r++) {
+            const pendingquad* pr = pc->quads + r;
+            if (pr->index != index)
+                continue;
+            for (i=0; i<pr->n; i++, n++) {
+                int k = pr->first + i;
+                int j, nkept = 0;
+                codeinds[k] = matches;
+                codedists[k] = dists2;
+                for (j=0; j<found[n]; j++) {
+                    if (dists2[j] > pr->tol2)
+                        continue;
+                    matches[nkept] = matches[j];
+                    dists2[nkept] = dists2[j];
+                    nkept++;
+                }
+                counts[k] = nkept;
+                matches += found[n];
+                dists2 += found[n];
+            }
+        }
+        free(found);
+    }
+
+    for (q=0; q<pc->nquads; q++) {
+        const pendingquad* pq = pc->quads + q;
+        if (solver->index != pq->index)
+            set_index(solver, pq->index);
+        if (counts[pq->first] < 0) {
+            codebatch batch;
+            int dimcode = (pq->dimquad - 2) * 2;
+            batch.n = pq->n;
+            for (i=0; i<pq->n; i++) {
+                int k = pq->first + i;
+                memcpy(batch.codes + i * dimcode, pc->codes + k * DCMAX, dimcode * sizeof(double));
+                memcpy(batch.stars + i * DQMAX, pc->stars + k * DQMAX, DQMAX * sizeof(int));
+                batch.parity[i] = pc->parity[k];
+            }
+            search_codes(&batch, pq->dimquad, solver, pq->tol2);
+        } else {
+            for (i=0; i<pq->n; i++) {
+                int k = pq->first + i;
+                const int* stars = pc->stars + k * DQMAX;
+                if (counts[k]) {
+                    kdtree_qres_t res;
+                    double pixvals[DQMAX*2];
+                    int j;
+                    memset(&res, 0, sizeof(res));
+                    res.nres = res.capacity = counts[k];
+                    res.inds = codeinds[k];
+                    res.sdists = codedists[k];
+                    for (j=0; j<pq->dimquad; j++) {
+                        setx(pixvals, j, field_getx(solver, stars[j]));
+                        sety(pixvals, j, field_gety(solver, stars[j]));
+                    }
+                    resolve_matches(&res, pixvals, stars, pq->dimquad, solver,
+                                    pc->parity[k]);
+                }
+                if (solver_should_quit(solver))
+                    break;
+            }
+        }
+        if (solver_should_quit(solver))
+            break;
+    }
+
+    if (original && solver->index != original)
+        set_index(solver, original);
+    pc->nquads = 0;
+    pc->ncodes = 0;
+    for (i=0; i<nbuffers; i++)
+        free(buffers[i]);
+    free(buffers);
+    free(codes);
+    free(codedists);
+    free(codeinds);
+    free(counts);
+    free(gathered);
+}
+
 // "field" contains the xy pixel coordinates of stars A,B,C,D.
 static void resolve_matches(kdtree_qres_t* krez, const double *field,
                             const int* fieldstars, int dimquads,
                             solver_t* solver, anbool current_parity) {
     int jj, thisquadno;
     MatchObj mo;
+    //# Modified for the StellarSolver Internal Library
+    // With a verify runner, the matches are collected and verified together
+    MatchObj* matches = NULL;
+    int nmatches = 0;
 
     if(dimquads <= 0) //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
         return;
+    if (solver->verify_runner && solver->verify_workers > 1 && krez->nres > 1) //# Modified for the StellarSolver Internal Library
+        matches = malloc(krez->nres * sizeof(MatchObj));
 #ifndef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
         unsigned int star[dimquads];
 #else
@@ -1349,36 +2468,136 @@ static void resolve_matches(kdtree_qres_t* krez, const double *field,
 
         set_center_and_radius(solver, &mo, &(mo.wcstan), NULL);
 
-        if (solver_handle_hit(solver, &mo, NULL, FALSE))
-            solver->quit_now = TRUE;
-
-        if (unlikely(solver->quit_now))
-        {
-            #ifdef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
-             free(starxyz);
-             free(star);
-            #endif
-            return;
+        if (matches) //# Modified for the StellarSolver Internal Library
+            memcpy(matches + nmatches++, &mo, sizeof(MatchObj));
+        else {
+            if (solver_handle_hit(solver, &mo, NULL, FALSE, FALSE))
+                solver->quit_now = TRUE;
+
+            if (solver_should_quit(solver))
+            {
+                #ifdef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
+                 free(starxyz);
+                 free(star);
+                #endif
+                return;
+            }
         }
 
 #ifdef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
         free(starxyz);
 #endif
     }
+    //# Modified for the StellarSolver Internal Library
+    if (matches) {
+        handle_matches(solver, matches, nmatches);
+        free(matches);
+    }
 #ifdef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
         free(star);
 #endif
 }
 
+//# Modified for the StellarSolver Internal Library
+// The matches of a quad that the threads of the verify runner verify.
+// "verified" and "solves" are set by the threads as they go.
+struct match_batch {
+    solver_t* solver;
+    MatchObj* matches;
+    volatile anbool* verified;
+    volatile anbool* solves;
+};
+
+//# Modified for the StellarSolver Internal Library
+static void verify_batch_match(void* arg, int worker, int i) {
+    struct match_batch* batch = arg;
+    const solver_t* sp = batch->solver;
+    int j;
+    // The solver would stop at an earlier match that solves, so this one is
+    // only verified later if that one is turned down.
+    for (j=0; j<i; j++)
+        if (batch->solves[j])
+            return;
+    if (cancel_requested(sp->cancel_token))
+        return;
+    verify_match(sp, sp->worker_vf[worker], batch->matches + i, NULL, FALSE);
+    batch->verified[i] = TRUE;
+    if (batch->matches[i].logodds >= sp->logratio_tokeep)
+        batch->solves[i] = TRUE;
+}
+
+//# Modified for the StellarSolver Internal Library
+// Verifies the matches on the threads of the verify runner, then handles them
+// in order the way resolve_matches() does one at a time.
+static void handle_matches(solver_t* sp, MatchObj* matches, int nmatches) {
+    struct match_batch batch;
+    int i, nworkers;
+    anbool stop = FALSE;
+    double start;
+
+    nworkers = MIN(MIN(sp->verify_workers, SOLVER_VERIFY_WORKERS_MAX), nmatches);
+    for (i=0; i<nworkers; i++) {
+        if (!sp->worker_vf[i])
+            sp->worker_vf[i] = verify_field_share(sp->vf);
+        if (!sp->worker_vf[i]) {
+            nworkers = i;
+            break;
+        }
+    }
+    batch.solver = sp;
+    batch.matches = matches;
+    batch.verified = calloc(nmatches, sizeof(anbool));
+    batch.solves = calloc(nmatches, sizeof(anbool));
+
+    start = timenow_monotonic();
+    if (nworkers > 1 &&
+        sp->verify_runner(sp->verify_runner_data, nmatches, nworkers,
+                          verify_batch_match, &batch)) {
+        // The runner didn't run them, so they are all verified below
+        for (i=0; i<nmatches; i++) {
+            if (batch.verified[i])
+                verify_free_matchobj(matches + i);
+            batch.verified[i] = FALSE;
+        }
+    }
+    sp->verify_time += timenow_monotonic() - start;
+
+    for (i=0; i<nmatches; i++) {
+        if (stop) {
+            if (batch.verified[i])
+                verify_free_matchobj(matches + i);
+            continue;
+        }
+        if (solver_handle_hit(sp, matches + i, NULL, FALSE, batch.verified[i]))
+            sp->quit_now = TRUE;
+        stop = solver_should_quit(sp);
+    }
+    free((void*)batch.verified);
+    free((void*)batch.solves);
+}
+
+//# Modified for the StellarSolver Internal Library
+static void free_worker_fields(solver_t* solver) {
+    int i;
+    for (i=0; i<SOLVER_VERIFY_WORKERS_MAX; i++) {
+        verify_field_free_shared(solver->worker_vf[i]);
+        solver->worker_vf[i] = NULL;
+    }
+}
+
 void solver_inject_match(solver_t* solver, MatchObj* mo, sip_t* sip) {
-    solver_handle_hit(solver, mo, sip, TRUE);
+    solver_handle_hit(solver, mo, sip, TRUE, FALSE);
 }
 
-static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
-                             anbool fake_match) {
+//# Modified for the StellarSolver Internal Library, the first verification of solver_handle_hit(),
+// which only reads the solver so that the threads of the verify runner can run it at the same time.
+static void verify_match(const solver_t* sp, const verify_field_t* vf, MatchObj* mo,
+                         sip_t* sip, anbool fake_match) {
     double match_distance_in_pixels2;
-    anbool solved;
     double logaccept;
+    double trace;
+    uint64_t counters[SSCOUNTERS_N];
+    anbool counting;
 
     mo->indexid = sp->index->indexid;
     mo->healpix = sp->index->healpix;
@@ -1392,14 +2611,38 @@ static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
 
     logaccept = MIN(sp->logratio_tokeep, sp->logratio_totune);
 
+    counting = sp->verify_counters && sscounters_begin(counters);
+    trace = sstrace_begin();
     verify_hit(sp->index->starkd, sp->index->cutnside,
-               mo, sip, sp->vf, match_distance_in_pixels2,
+               mo, sip, vf, match_distance_in_pixels2,
                sp->distractor_ratio, sp->field_maxx, sp->field_maxy,
                sp->logratio_bail_threshold, logaccept,
                sp->logratio_stoplooking,
                sp->distance_from_quad_bonus, fake_match);
+    sstrace_end("verify_hit", trace);
+    if (counting)
+        sscounters_end(sp->verify_counters, counters);
+}
+
+static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
+                             anbool fake_match, anbool verified) { //# Modified for the StellarSolver Internal Library
+    double match_distance_in_pixels2;
+    anbool solved;
+    double start, trace; //# Modified for the StellarSolver Internal Library
+    uint64_t counters[SSCOUNTERS_N]; //# Modified for the StellarSolver Internal Library
+    anbool counting;
+
+    //# Modified for the StellarSolver Internal Library
+    if (!verified) {
+        start = timenow_monotonic();
+        verify_match(sp, sp->vf, mo, sip, fake_match);
+        sp->verify_time += timenow_monotonic() - start;
+    }
     mo->nverified = sp->num_verified++;
 
+    match_distance_in_pixels2 = square(sp->verify_pix) +
+        square(sp->index->index_jitter / mo->scale);
+
     if (mo->logodds >= sp->best_logodds) {
         sp->best_logodds = mo->logodds;
         logverb("Got a new best match: logodds %g.\n", mo->logodds);
@@ -1416,6 +2659,9 @@ static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
         // Since we tuned up this solution, we can't just accept the
         // resulting log-odds at face value.
         if (!fake_match) {
+            start = timenow_monotonic(); //# Modified for the StellarSolver Internal Library
+            counting = sp->verify_counters && sscounters_begin(counters); //# Modified for the StellarSolver Internal Library
+            trace = sstrace_begin(); //# Modified for the StellarSolver Internal Library
             verify_hit(sp->index->starkd, sp->index->cutnside,
                        mo, mo->sip, sp->vf, match_distance_in_pixels2,
                        sp->distractor_ratio,
@@ -1425,11 +2671,26 @@ static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
                        sp->logratio_stoplooking,
                        sp->distance_from_quad_bonus,
                        fake_match);
+            sstrace_end("verify_hit", trace); //# Modified for the StellarSolver Internal Library
+            if (counting) //# Modified for the StellarSolver Internal Library
+                sscounters_end(sp->verify_counters, counters);
+            sp->verify_time += timenow_monotonic() - start; //# Modified for the StellarSolver Internal Library
             logverb("Checking tuned result: logodds = %g (%g)\n",
                     mo->logodds, exp(mo->logodds));
         }
     }
 
+    //# Modified for the StellarSolver Internal Library
+    // Another solver working on the same field may already have a better
+    // solution, then this match can't be the one that is used.
+    if (sp->best_logodds_callback) {
+        double shared = sp->best_logodds_callback(mo->logodds, sp->best_logodds_userdata);
+        if (mo->logodds < shared) {
+            logverb("Dropping this match, another solver has a solution with logodds %g.\n", shared);
+            return FALSE;
+        }
+    }
+
     if (mo->logodds < sp->logratio_toprint)
         return FALSE;
 
@@ -1619,9 +2880,13 @@ void solver_set_default_values(solver_t* solver) {
     solver->verify_pix = DEFAULT_VERIFY_PIX;
     solver->verify_uniformize = TRUE;
     solver->verify_dedup = TRUE;
+    solver->verify_grid = TRUE; //# Modified for the StellarSolver Internal Library
     solver->distance_from_quad_bonus = TRUE;
     solver->tweak_aborder = DEFAULT_TWEAK_ABORDER;
     solver->tweak_abporder = DEFAULT_TWEAK_ABPORDER;
+    solver->tweak_timelimit = 0; //# Modified for the StellarSolver Internal Library
+    solver->pquad_bytes_max = SOLVER_PQUAD_BYTES_MAX; //# Modified for the StellarSolver Internal Library
+    solver->tweak_min_improvement = 0;
 }
 
 void solver_clear_indexes(solver_t* solver) {
@@ -1640,6 +2905,7 @@ void solver_cleanup(solver_t* solver) {
     if (solver->predistort)
         sip_free(solver->predistort);
     solver->predistort = NULL;
+    iarray_free(&solver->shard_cells); //# Modified for the StellarSolver Internal Library
 }
 
 void solver_free(solver_t* solver) {
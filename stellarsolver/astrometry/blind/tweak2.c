@@ -23,6 +23,7 @@
 #include "mathutil.h"
 #include "verify.h"
 #include "fitsioutils.h"
+#include "tic.h"
 
 
 // Tweak debug plots?
@@ -188,8 +189,43 @@ static char* tdebugfn(const char* name) {
 
 #endif
 
+//# Modified for the StellarSolver Internal Library, the reference stars are projected from their xyz positions,
+// which are computed once instead of going from RA,Dec to xyz again for every star in every iteration.
+// Project reference sources into pixel space; keep the ones inside image bounds.
+static int project_index_stars(const sip_t* sip, const double* indexxyz, int Nindex,
+                               double* indexpix, int* indexin) {
+    int i, Nin = 0;
+    for (i=0; i<Nindex; i++) {
+        double x,y;
+        if (!tan_xyzarr2pixelxy(&(sip->wcstan), indexxyz + 3*i, &x, &y))
+            continue;
+        sip_pixel_undistortion(sip, x, y, &x, &y);
+        if (!sip_pixel_is_inside_image(sip, x, y))
+            continue;
+        indexpix[Nin*2+0] = x;
+        indexpix[Nin*2+1] = y;
+        indexin[Nin] = i;
+        Nin++;
+    }
+    return Nin;
+}
 
-
+//# Modified for the StellarSolver Internal Library, the weighted RMS distance between the matched field and
+// reference stars, in radians, through the forward SIP polynomials so that it doesn't depend on the inverse ones.
+static double match_residual(const sip_t* sip, const double* matchxyz, const double* matchxy,
+                             const double* weights, int Nmatch) {
+    double r2 = 0.0, wsum = 0.0;
+    int i;
+    for (i=0; i<Nmatch; i++) {
+        double xyz[3];
+        sip_pixelxy2xyzarr(sip, matchxy[2*i+0], matchxy[2*i+1], xyz);
+        r2 += weights[i] * distsq(xyz, matchxyz + 3*i, 3);
+        wsum += weights[i];
+    }
+    if (wsum == 0.0)
+        return HUGE_VAL;
+    return sqrt(r2 / wsum);
+}
 
 
 sip_t* tweak2(const double* fieldxy, int Nfield,
@@ -209,7 +245,9 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
               double* p_logodds,
               int* p_besti,
               int* testperm,
-              int startorder) {
+              int startorder,
+              double timelimit,
+              double min_improvement) {
     int order;
     sip_t* sipout;
     int* indexin;
@@ -225,6 +263,12 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
     double* odds = NULL;
     int* refperm = NULL;
     double qc[2];
+    //# Modified for the StellarSolver Internal Library
+    double* indexxyz;
+    int* matchind;
+    fit_sip_cache_t fitcache;
+    double tstart = (timelimit > 0) ? timenow() : 0;
+    anbool outoftime = FALSE;
 
     memcpy(qc, quadcenter, 2*sizeof(double));
 
@@ -239,6 +283,11 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
     weights = malloc(Nfield * sizeof(double));
     matchxyz = malloc(Nfield * 3 * sizeof(double));
     matchxy = malloc(Nfield * 2 * sizeof(double));
+    //# Modified for the StellarSolver Internal Library
+    matchind = malloc(Nfield * sizeof(int));
+    indexxyz = malloc(3 * Nindex * sizeof(double));
+    radecdegarr2xyzarrmany(indexradec, indexxyz, Nindex); //# Modified for the StellarSolver Internal Library
+    fit_sip_cache_init(&fitcache, fieldxy, Nfield, W, H);
 
     // FIXME --- hmmm, how do the annealing steps and iterating up to
     // higher orders interact?
@@ -262,12 +311,13 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
         int STEPS = 100;
         // variance growth rate wrt radius.
         double gamma = 1.0;
+        //# Modified for the StellarSolver Internal Library, for min_improvement
+        double lastresid = HUGE_VAL;
         //logverb("Starting tweak2 order=%i\n", order);
 
         for (step=0; step<STEPS; step++) {
             double iscale;
             double ijitter;
-            double ra, dec;
             double R2;
             int Nmatch;
             int nmatch, nconf, ndist;
@@ -294,27 +344,15 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
                 sip_print_to(sipout); //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve conflict
 
             // Project reference sources into pixel space; keep the ones inside image bounds.
-            Nin = 0;
-            for (i=0; i<Nindex; i++) {
-                anbool ok;
-                double x,y;
-                ra  = indexradec[2*i + 0];
-                dec = indexradec[2*i + 1];
-                ok = sip_radec2pixelxy(sipout, ra, dec, &x, &y);
-                if (!ok)
-                    continue;
-                if (!sip_pixel_is_inside_image(sipout, x, y))
-                    continue;
-                indexpix[Nin*2+0] = x;
-                indexpix[Nin*2+1] = y;
-                indexin[Nin] = i;
-                Nin++;
-            }
+            Nin = project_index_stars(sipout, indexxyz, Nindex, indexpix, indexin);
             logverb("%i reference sources within the image.\n", Nin);
             //logverb("CRPIX is (%g,%g)\n", sip.wcstan.crpix[0], sip.wcstan.crpix[1]);
 
             if (Nin == 0) {
                 sip_free(sipout);
+                free(indexxyz); //# Modified for the StellarSolver Internal Library
+                free(matchind);
+                fit_sip_cache_free(&fitcache);
                 free(matchxy);
                 free(matchxyz);
                 free(weights);
@@ -398,7 +436,6 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
             Nmatch = 0;
             debug("Weights:");
             for (i=0; i<Nfield; i++) {
-                double ra,dec;
                 if (theta[i] < 0)
                     continue;
                 assert(theta[i] < Nin);
@@ -406,10 +443,9 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
                 assert(ii < Nindex);
                 assert(ii >= 0);
 
-                ra  = indexradec[ii*2+0];
-                dec = indexradec[ii*2+1];
-                radecdeg2xyzarr(ra, dec, matchxyz + Nmatch*3);
+                memcpy(matchxyz + Nmatch*3, indexxyz + ii*3, 3*sizeof(double)); //# Modified for the StellarSolver Internal Library
                 memcpy(matchxy + Nmatch*2, fieldxy + i*2, 2*sizeof(double));
+                matchind[Nmatch] = i;
                 weights[Nmatch] = verify_logodds_to_weight(odds[i]);
                 debug(" %.2f", weights[Nmatch]);
                 Nmatch++;
@@ -431,6 +467,9 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
                 logverb("No matches -- aborting tweak attempt\n");
                 free(theta);
                 sip_free(sipout);
+                free(indexxyz); //# Modified for the StellarSolver Internal Library
+                free(matchind);
+                fit_sip_cache_free(&fitcache);
                 free(matchxy);
                 free(matchxyz);
                 free(weights);
@@ -471,9 +510,10 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
             }
 
             int doshift = 1;
-            fit_sip_wcs(matchxyz, matchxy, weights, Nmatch,
-                        &(sipout->wcstan), order, sip_invorder,
-                        doshift, sipout);
+            //# Modified for the StellarSolver Internal Library, the polynomial terms of the field stars are the same in every step
+            fit_sip_wcs_cached(matchxyz, matchind, weights, Nmatch,
+                               &(sipout->wcstan), order, sip_invorder,
+                               doshift, &fitcache, sipout);
 
             debug("Got SIP:\n");
             if (log_get_level() > LOG_VERB)
@@ -484,7 +524,27 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
                 free(testperm); //# Modified by Robert Lancaster for the StellarSolver Internal Library, Fix Memory Leak
                 testperm = NULL; //# Modified by Robert Lancaster for the StellarSolver Internal Library, Fix Memory Leak
             }
+
+            //# Modified for the StellarSolver Internal Library, the annealing skips to its last step (gamma = 0) once the fit
+            // stops getting better, and no higher orders are fit once the time limit is up.
+            if (min_improvement > 0 && step < STEPS-1) {
+                double resid = match_residual(sipout, matchxyz, matchxy, weights, Nmatch);
+                if (lastresid - resid < min_improvement * lastresid) {
+                    logverb("Residual %g arcsec improved by less than %g; finishing order %i\n",
+                            rad2arcsec(resid), min_improvement, order);
+                    step = STEPS-2;
+                }
+                lastresid = resid;
+            }
+            if (timelimit > 0 && !outoftime && timenow() - tstart > timelimit) {
+                logverb("Tweak time limit of %g s reached at order %i, step %i\n", timelimit, order, step);
+                outoftime = TRUE;
+                if (step < STEPS-2)
+                    step = STEPS-2;
+            }
         }
+        if (outoftime)
+            break;
     }
 
     //logverb("Final logodds: %g\n", logodds);
@@ -495,7 +555,6 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
         double gamma = 1.0;
         double iscale;
         double ijitter;
-        double ra, dec;
         double R2;
         int nmatch, nconf, ndist;
         double pix2;
@@ -508,22 +567,7 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
         refperm = NULL; //# Modified by Robert Lancaster for the StellarSolver Internal Library, Fix Memory Leak
         gamma = 1.0;
         // Project reference sources into pixel space; keep the ones inside image bounds.
-        Nin = 0;
-        for (i=0; i<Nindex; i++) {
-            anbool ok;
-            double x,y;
-            ra  = indexradec[2*i + 0];
-            dec = indexradec[2*i + 1];
-            ok = sip_radec2pixelxy(sipout, ra, dec, &x, &y);
-            if (!ok)
-                continue;
-            if (!sip_pixel_is_inside_image(sipout, x, y))
-                continue;
-            indexpix[Nin*2+0] = x;
-            indexpix[Nin*2+1] = y;
-            indexin[Nin] = i;
-            Nin++;
-        }
+        Nin = project_index_stars(sipout, indexxyz, Nindex, indexpix, indexin);
         logverb("%i reference sources within the image.\n", Nin);
 
         iscale = sip_pixel_scale(sipout);
@@ -599,6 +643,9 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
     free(weights);
     free(matchxyz);
     free(matchxy);
+    free(indexxyz); //# Modified for the StellarSolver Internal Library
+    free(matchind);
+    fit_sip_cache_free(&fitcache);
 
     return sipout;
 }
@@ -22,6 +22,7 @@
 #include "sip-utils.h"
 #include "healpix.h"
 #include "datalog.h"
+#include "garray.h" //# Modified for the StellarSolver Internal Library
 
 #define DEBUGVERIFY 0
 
@@ -62,11 +63,390 @@ struct verify_s {
     // temp storage
     int* tbadguys;
 
+    // if set to non-zero, stop verifying //# Modified for the StellarSolver Internal Library
+    const int* cancel_token;
 };
 typedef struct verify_s verify_t;
 
 static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t* vf, double nsigmas);
 
+//# Modified for the StellarSolver Internal Library
+static int get_grid_cell(double x, double x0, double cell, int n) {
+    int c = (int)floor((x - x0) / cell);
+    return MAX(0, MIN(n-1, c));
+}
+
+// Sorts the field stars into square cells of about two stars each, so the
+// stars near a point can be found by looking at the cells around it.
+static void build_field_grid(verify_field_t* vf) {
+    int N = starxy_n(vf->field);
+    double xlo = HUGE_VAL, xhi = -HUGE_VAL, ylo = HUGE_VAL, yhi = -HUGE_VAL;
+    int* cursor;
+    int i, c, ncells;
+
+    vf->gridstart = NULL;
+    vf->gridstars = NULL;
+    vf->gridnx = vf->gridny = 0;
+    if (N <= 0)
+        return;
+    for (i=0; i<N; i++) {
+        xlo = MIN(xlo, vf->xy[2*i+0]);
+        xhi = MAX(xhi, vf->xy[2*i+0]);
+        ylo = MIN(ylo, vf->xy[2*i+1]);
+        yhi = MAX(yhi, vf->xy[2*i+1]);
+    }
+    if (!isfinite(xlo) || !isfinite(xhi) || !isfinite(ylo) || !isfinite(yhi))
+        return;
+    vf->gridx0 = xlo;
+    vf->gridy0 = ylo;
+    vf->gridcell = MAX(1.0, sqrt(2.0 * MAX(xhi - xlo, 1.0) * MAX(yhi - ylo, 1.0) / N));
+    vf->gridnx = 1 + (int)((xhi - xlo) / vf->gridcell);
+    vf->gridny = 1 + (int)((yhi - ylo) / vf->gridcell);
+    ncells = vf->gridnx * vf->gridny;
+
+    vf->gridstart = calloc(ncells + 1, sizeof(int));
+    vf->gridstars = malloc(N * sizeof(int));
+    cursor = malloc(ncells * sizeof(int));
+    if (!vf->gridstart || !vf->gridstars || !cursor) {
+        free(vf->gridstart);
+        free(vf->gridstars);
+        free(cursor);
+        vf->gridstart = NULL;
+        vf->gridstars = NULL;
+        vf->gridnx = vf->gridny = 0;
+        return;
+    }
+    for (i=0; i<N; i++) {
+        c = get_grid_cell(vf->xy[2*i+1], vf->gridy0, vf->gridcell, vf->gridny) * vf->gridnx +
+            get_grid_cell(vf->xy[2*i+0], vf->gridx0, vf->gridcell, vf->gridnx);
+        vf->gridstart[c+1]++;
+    }
+    for (c=0; c<ncells; c++) {
+        vf->gridstart[c+1] += vf->gridstart[c];
+        cursor[c] = vf->gridstart[c];
+    }
+    for (i=0; i<N; i++) {
+        c = get_grid_cell(vf->xy[2*i+1], vf->gridy0, vf->gridcell, vf->gridny) * vf->gridnx +
+            get_grid_cell(vf->xy[2*i+0], vf->gridx0, vf->gridcell, vf->gridnx);
+        vf->gridstars[cursor[c]++] = i;
+    }
+    free(cursor);
+}
+
+// Finds the field stars within distance-squared "r2" of "xy", like a kdtree
+// range search would; their indices go in "inds" and the number is returned.
+static int field_grid_search(const verify_field_t* vf, const double* xy, double r2, int* inds) {
+    // The range is padded a little so rounding can't leave out a cell; the distances are exact.
+    double r = sqrt(r2) * (1.0 + 1e-9) + 1e-9;
+    int x0, x1, y0, y1, cx, cy, k, n = 0;
+
+    x0 = get_grid_cell(xy[0] - r, vf->gridx0, vf->gridcell, vf->gridnx);
+    x1 = get_grid_cell(xy[0] + r, vf->gridx0, vf->gridcell, vf->gridnx);
+    y0 = get_grid_cell(xy[1] - r, vf->gridy0, vf->gridcell, vf->gridny);
+    y1 = get_grid_cell(xy[1] + r, vf->gridy0, vf->gridcell, vf->gridny);
+    for (cy=y0; cy<=y1; cy++) {
+        const int row = cy * vf->gridnx;
+        for (cx=x0; cx<=x1; cx++) {
+            for (k=vf->gridstart[row+cx]; k<vf->gridstart[row+cx+1]; k++) {
+                int j = vf->gridstars[k];
+                double dx = xy[0] - vf->xy[2*j+0];
+                double dy = xy[1] - vf->xy[2*j+1];
+                double d2 = 0;
+                d2 += dx*dx;
+                d2 += dy*dy;
+                if (d2 <= r2)
+                    inds[n++] = j;
+            }
+        }
+    }
+    return n;
+}
+
+//# Modified for the StellarSolver Internal Library
+/*
+ The index stars in a circle around a healpix cell.  The quads that match
+ near the true solution all look up about the same part of the sky, so the
+ stars of the last few cells are kept and the later look-ups that fall
+ inside one of them just filter its stars.  The kdtree returns the stars in
+ the same order for any circle, so the filtered ones come out exactly as a
+ new search would give them.
+ */
+#define VERIFY_STAR_CACHE_SIZE 16
+
+typedef struct {
+    const startree_t* skdt;
+    // the healpix cell it was made for
+    int nside;
+    int hp;
+    double center[3];
+    // the stars within this distance of the center are in the entry
+    double radius;
+    double* xyz;
+    int* starid;
+    int N;
+    int lastused;
+} star_cache_entry_t;
+
+struct verify_star_cache {
+    star_cache_entry_t entries[VERIFY_STAR_CACHE_SIZE];
+    int clock;
+    int nhits;
+    int nmisses;
+};
+
+static void free_star_cache(struct verify_star_cache* cache) {
+    int i;
+    if (!cache)
+        return;
+    if (cache->nhits || cache->nmisses)
+        logverb("Index star cache: %i hits, %i misses\n", cache->nhits, cache->nmisses);
+    for (i=0; i<VERIFY_STAR_CACHE_SIZE; i++) {
+        free(cache->entries[i].xyz);
+        free(cache->entries[i].starid);
+    }
+    free(cache);
+}
+
+//# Modified for the StellarSolver Internal Library
+verify_ref_catalog_t* verify_ref_catalog_new(void) {
+    return calloc(1, sizeof(verify_ref_catalog_t));
+}
+
+//# Modified for the StellarSolver Internal Library
+int verify_ref_catalog_add(verify_ref_catalog_t* catalog, const startree_t* skdt,
+                           int indexid, int healpix,
+                           const double* center, double radius2) {
+    verify_ref_region_t* regions;
+    verify_ref_region_t* region;
+    double* xyz = NULL;
+    int* starid = NULL;
+    double* mag = NULL;
+    double* z;
+    int* perm;
+    int i, N = 0;
+
+    regions = realloc(catalog->regions, (catalog->nregions + 1) * sizeof(verify_ref_region_t));
+    if (!regions)
+        return -1;
+    catalog->regions = regions;
+
+    startree_search_for(skdt, center, radius2, &xyz, NULL, &starid, &N);
+    if (N > 0 && startree_get_tagalong((startree_t*)skdt))
+        mag = startree_get_data_column((startree_t*)skdt, "mag", starid, N);
+
+    // sorted by z, the stars within r of a point with z = cz have cz - r <= z <= cz + r
+    z = malloc(MAX(1, N) * sizeof(double));
+    perm = malloc(MAX(1, N) * sizeof(int));
+    region = regions + catalog->nregions;
+    memset(region, 0, sizeof(verify_ref_region_t));
+    region->xyz = malloc(MAX(1, N) * 3 * sizeof(double));
+    region->starid = malloc(MAX(1, N) * sizeof(int));
+    region->mag = mag ? malloc(N * sizeof(double)) : NULL;
+    if (!z || !perm || !region->xyz || !region->starid || (mag && !region->mag)) {
+        free(z);
+        free(perm);
+        free(region->xyz);
+        free(region->starid);
+        free(region->mag);
+        free(xyz);
+        free(starid);
+        free(mag);
+        return -1;
+    }
+    for (i=0; i<N; i++)
+        z[i] = xyz[3*i+2];
+    permutation_init(perm, N);
+    permuted_sort(z, sizeof(double), compare_doubles_asc, perm, N);
+    for (i=0; i<N; i++) {
+        memcpy(region->xyz + 3*i, xyz + 3*perm[i], 3 * sizeof(double));
+        region->starid[i] = starid[perm[i]];
+        if (mag)
+            region->mag[i] = mag[perm[i]];
+    }
+    region->indexid = indexid;
+    region->healpix = healpix;
+    memcpy(region->center, center, 3 * sizeof(double));
+    region->radius = sqrt(radius2);
+    region->N = N;
+    catalog->nregions++;
+    free(z);
+    free(perm);
+    free(xyz);
+    free(starid);
+    free(mag);
+    return N;
+}
+
+//# Modified for the StellarSolver Internal Library
+// The first star of a region whose z is at least z
+static int ref_region_lower_bound(const verify_ref_region_t* region, double z) {
+    int lo = 0, hi = region->N;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (region->xyz[3*mid+2] < z)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+//# Modified for the StellarSolver Internal Library
+anbool verify_ref_catalog_search(const verify_ref_catalog_t* catalog,
+                                 int indexid, int healpix,
+                                 const double* center, double radius2,
+                                 double** p_xyz, int** p_starid, int* p_N) {
+    const verify_ref_region_t* region = NULL;
+    double r = sqrt(radius2);
+    int i, j, first, last, n;
+
+    if (!catalog)
+        return FALSE;
+    for (i=0; i<catalog->nregions; i++) {
+        const verify_ref_region_t* reg = catalog->regions + i;
+        if (reg->indexid == indexid && reg->healpix == healpix &&
+            sqrt(distsq(center, reg->center, 3)) + r <= reg->radius) {
+            region = reg;
+            break;
+        }
+    }
+    if (!region)
+        return FALSE;
+
+    first = ref_region_lower_bound(region, center[2] - r);
+    last = ref_region_lower_bound(region, center[2] + r);
+    n = 0;
+    for (i=first; i<last; i++)
+        if (distsq(region->xyz + 3*i, center, 3) <= radius2)
+            n++;
+    *p_N = n;
+    if (!n) {
+        *p_xyz = NULL;
+        *p_starid = NULL;
+        return TRUE;
+    }
+    *p_xyz = malloc(n * 3 * sizeof(double));
+    *p_starid = malloc(n * sizeof(int));
+    if (!*p_xyz || !*p_starid) {
+        free(*p_xyz);
+        free(*p_starid);
+        return FALSE;
+    }
+    j = 0;
+    for (i=first; i<last; i++) {
+        if (distsq(region->xyz + 3*i, center, 3) > radius2)
+            continue;
+        memcpy(*p_xyz + 3*j, region->xyz + 3*i, 3 * sizeof(double));
+        (*p_starid)[j] = region->starid[i];
+        j++;
+    }
+    return TRUE;
+}
+
+//# Modified for the StellarSolver Internal Library
+void verify_ref_catalog_free(verify_ref_catalog_t* catalog) {
+    int i;
+    if (!catalog)
+        return;
+    for (i=0; i<catalog->nregions; i++) {
+        free(catalog->regions[i].xyz);
+        free(catalog->regions[i].starid);
+        free(catalog->regions[i].mag);
+    }
+    free(catalog->regions);
+    free(catalog);
+}
+
+// Like startree_search_for, but through the reference catalog and the cache of the field.
+// The stars of the index "indexid" in "healpix" come from the reference catalog if it has them.
+static void get_index_stars(const verify_field_t* vf, const startree_t* skdt,
+                            int indexid, int healpix,
+                            const double* center, double r2,
+                            double** p_xyz, int** p_starid, int* p_N) {
+    struct verify_star_cache* cache = vf->starcache;
+    star_cache_entry_t* entry = NULL;
+    double r, side;
+    int nside, hp, i, n;
+
+    //# Modified for the StellarSolver Internal Library
+    if (vf->refcatalog && verify_ref_catalog_search(vf->refcatalog, indexid, healpix, center, r2, p_xyz, p_starid, p_N))
+        return;
+
+    if (!cache) {
+        startree_search_for(skdt, center, r2, p_xyz, NULL, p_starid, p_N);
+        return;
+    }
+
+    // Any entry that holds the whole circle will do.  Otherwise a new one is made
+    // around the healpix cell of the center, which is about half as wide as the
+    // circle, so the circles centered in the same cell can share it.
+    r = sqrt(r2);
+
+    for (i=0; i<VERIFY_STAR_CACHE_SIZE; i++) {
+        star_cache_entry_t* e = cache->entries + i;
+        if (e->skdt == skdt && sqrt(distsq(center, e->center, 3)) + r <= e->radius) {
+            entry = e;
+            break;
+        }
+    }
+    if (entry)
+        cache->nhits++;
+    else {
+        double cellr;
+        cache->nmisses++;
+        nside = (int)ceil(healpix_nside_for_side_length_arcmin(0.5 * distsq2arcsec(r2) / 60.0));
+        nside = MAX(1, MIN(8192, nside));
+        hp = xyzarrtohealpix(center, nside);
+        // Replace the least recently used entry
+        entry = cache->entries;
+        for (i=1; i<VERIFY_STAR_CACHE_SIZE; i++)
+            if (cache->entries[i].lastused < entry->lastused)
+                entry = cache->entries + i;
+        free(entry->xyz);
+        free(entry->starid);
+        entry->skdt = skdt;
+        entry->nside = nside;
+        entry->hp = hp;
+        healpix_to_xyzarr(hp, nside, 0.5, 0.5, entry->center);
+        side = healpix_side_length_arcmin(nside);
+        cellr = MAX(arcmin2dist(0.75 * side), sqrt(distsq(center, entry->center, 3)));
+        // with some room for the matches that come out a little larger
+        entry->radius = 1.1 * r + cellr;
+        startree_search_for(skdt, entry->center, square(entry->radius),
+                            &entry->xyz, NULL, &entry->starid, &entry->N);
+    }
+    entry->lastused = ++cache->clock;
+
+    n = 0;
+    for (i=0; i<entry->N; i++)
+        if (distsq(entry->xyz + 3*i, center, 3) <= r2)
+            n++;
+    *p_N = n;
+    if (!n) {
+        *p_xyz = NULL;
+        *p_starid = NULL;
+        return;
+    }
+    *p_xyz = malloc(n * 3 * sizeof(double));
+    *p_starid = malloc(n * sizeof(int));
+    n = 0;
+    for (i=0; i<entry->N; i++) {
+        if (distsq(entry->xyz + 3*i, center, 3) > r2)
+            continue;
+        memcpy(*p_xyz + 3*n, entry->xyz + 3*i, 3 * sizeof(double));
+        (*p_starid)[n] = entry->starid[i];
+        n++;
+    }
+}
+
+void verify_field_clear_star_cache(verify_field_t* vf) {
+    struct verify_star_cache* cache = vf->starcache;
+    if (!cache)
+        return;
+    free_star_cache(cache);
+    vf->starcache = calloc(1, sizeof(struct verify_star_cache));
+}
+
 verify_field_t* verify_field_preprocess(const starxy_t* fieldxy) {
     verify_field_t* vf;
     int Nleaf = 5;
@@ -95,6 +475,11 @@ verify_field_t* verify_field_preprocess(const starxy_t* fieldxy) {
     vf->do_uniformize = TRUE;
     vf->do_dedup = TRUE;
     vf->do_ror = TRUE;
+    vf->cancel_token = NULL; //# Modified for the StellarSolver Internal Library
+    vf->do_grid = TRUE; //# Modified for the StellarSolver Internal Library
+    build_field_grid(vf); //# Modified for the StellarSolver Internal Library
+    vf->starcache = calloc(1, sizeof(struct verify_star_cache)); //# Modified for the StellarSolver Internal Library
+    vf->refcatalog = NULL; //# Modified for the StellarSolver Internal Library
 
     return vf;
 }
@@ -103,11 +488,32 @@ void verify_field_free(verify_field_t* vf) {
     if (!vf)
         return;
     kdtree_free(vf->ftree);
+    free(vf->gridstart); //# Modified for the StellarSolver Internal Library
+    free(vf->gridstars); //# Modified for the StellarSolver Internal Library
+    free_star_cache(vf->starcache); //# Modified for the StellarSolver Internal Library
     free(vf->xy);
     free(vf->fieldcopy);
     free(vf);
 }
 
+//# Modified for the StellarSolver Internal Library
+verify_field_t* verify_field_share(const verify_field_t* vf) {
+    verify_field_t* shared = malloc(sizeof(verify_field_t));
+    if (!shared)
+        return NULL;
+    memcpy(shared, vf, sizeof(verify_field_t));
+    shared->starcache = calloc(1, sizeof(struct verify_star_cache));
+    return shared;
+}
+
+//# Modified for the StellarSolver Internal Library
+void verify_field_free_shared(verify_field_t* shared) {
+    if (!shared)
+        return;
+    free_star_cache(shared->starcache);
+    free(shared);
+}
+
 static double get_sigma2_at_radius(double verify_pix2, double r2, double quadr2) {
     return verify_pix2 * (1.0 + r2/quadr2);
 }
@@ -458,6 +864,7 @@ static double real_verify_star_lists(verify_t* v,
                                      double effective_area,
                                      double distractors,
                                      double logodds_bail,
+                                     double logodds_accept,
                                      double logodds_stoplooking,
                                      int* p_besti,
                                      double** p_logodds, int** p_theta,
@@ -481,6 +888,7 @@ static double real_verify_star_lists(verify_t* v,
     int* theta = NULL;
     int mu;
     int* rperm;
+    double* reachable = NULL; //# Modified for the StellarSolver Internal Library
 
     if (!v->NR || !v->NT) {
         logerr("real_verify_star_lists: NR=%i, NT=%i\n", v->NR, v->NT);
@@ -525,6 +933,21 @@ static double real_verify_star_lists(verify_t* v,
 
     logbg = log(1.0 / effective_area);
 
+    //# Modified for the StellarSolver Internal Library
+    // A test star can at best add the peak of its Gaussian to the log-odds;
+    // distractors and conflicts only lower them.  "reachable[i]" is the most
+    // the log-odds can still rise from test star i on, so the verification
+    // can stop as soon as the match can't be accepted anymore.
+    if (logodds_accept > -HUGE_VAL) {
+        reachable = malloc((v->NT + 1) * sizeof(double));
+        reachable[v->NT] = 0.0;
+        for (i=v->NT-1; i>=0; i--) {
+            double sig2 = v->testsigma[v->testperm[i]];
+            double gain = log((1.0 - distractors) / (2.0 * M_PI * sig2 * v->NR)) - logbg;
+            reachable[i] = reachable[i+1] + MAX(0.0, gain);
+        }
+    }
+
     worstlogodds = 0;
     bestlogodds = -HUGE_VAL;
     bestworstlogodds = -HUGE_VAL;
@@ -541,6 +964,18 @@ static double real_verify_star_lists(verify_t* v,
         double logfg;
         int ti;
 
+        //# Modified for the StellarSolver Internal Library
+        // When the solve was cancelled, this gets treated as a bail out with no match,
+        // so that a long verification doesn't hold the solver up.
+        if (cancel_requested(v->cancel_token)) {
+            debug2("  cancelled after %i test stars\n", i);
+            if (p_ibailed)
+                *p_ibailed = i;
+            bestlogodds = -HUGE_VAL;
+            besti = -1;
+            break;
+        }
+
         ti = v->testperm[i];
         testxy = v->testxy + 2*ti;
         sig2 = v->testsigma[ti];
@@ -703,7 +1138,17 @@ static double real_verify_star_lists(verify_t* v,
                 *p_istopped = i;
             break;
         }
+
+        //# Modified for the StellarSolver Internal Library
+        if (reachable && bestlogodds < logodds_accept &&
+            logodds + reachable[i+1] < logodds_accept) {
+            debug2("  logodds %g can't reach %g anymore\n", logodds, logodds_accept);
+            if (p_ibailed)
+                *p_ibailed = i;
+            break;
+        }
     }
+    free(reachable); //# Modified for the StellarSolver Internal Library
 
     if (bestlogodds > DLOG_ODDS_MIN) {
         // when the loop stopped...
@@ -821,10 +1266,11 @@ void verify_get_index_stars(const double* fieldcenter, double fieldr2,
     // Compute index RA,Decs if requested.
     if (p_indexradec) {
         radec = malloc(2 * NI * sizeof(double));
-        for (i=0; i<NI; i++)
-            // note that the "inbounds" permutation is applied to "indxyz" here.
-            // we will apply the sweep permutation below.
-            xyzarr2radecdegarr(indxyz + 3*inbounds[i], radec + 2*i);
+        //# Modified for the StellarSolver Internal Library
+        // the "inbounds" permutation is applied to "indxyz" first, so that all of
+        // them are converted in one loop.  we will apply the sweep permutation below.
+        permutation_apply(inbounds, NI, indxyz, indxyz, 3 * sizeof(double));
+        xyzarr2radecdegarrmany(indxyz, radec, NI);
         *p_indexradec = radec;
     }
     free(indxyz);
@@ -872,6 +1318,10 @@ static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t*
     kdtree_qres_t* res = NULL;
     double nsig2 = nsigmas*nsigmas;
     int options = KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_SMALL_RADIUS;
+    //# Modified for the StellarSolver Internal Library
+    int* near = NULL;
+    int nnear;
+    anbool use_grid = vf->do_grid && vf->gridstart;
 
     // default to FALSE
     keepers = calloc(v->NTall, sizeof(anbool));
@@ -885,9 +1335,17 @@ static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t*
         if (!keepers[ti])
             continue;
         starxy_get(vf->field, ti, sxy);
-        res = kdtree_rangesearch_options_reuse(vf->ftree, res, sxy, nsig2 * v->testsigma[ti], options);
-        for (j=0; j<res->nres; j++) {
-            int ind = res->inds[j];
+        //# Modified for the StellarSolver Internal Library
+        if (use_grid) {
+            if (!near)
+                near = malloc(v->NTall * sizeof(int));
+            nnear = field_grid_search(vf, sxy, nsig2 * v->testsigma[ti], near);
+        } else {
+            res = kdtree_rangesearch_options_reuse(vf->ftree, res, sxy, nsig2 * v->testsigma[ti], options);
+            nnear = res->nres;
+        }
+        for (j=0; j<nnear; j++) {
+            int ind = use_grid ? near[j] : (int)res->inds[j];
             if (ind > i) {
                 keepers[ind] = FALSE;
                 if (DEBUGVERIFY) {
@@ -901,6 +1359,7 @@ static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t*
         }
     }
     kdtree_free_query(res);
+    free(near); //# Modified for the StellarSolver Internal Library
     return keepers;
 }
 
@@ -937,7 +1396,7 @@ void verify_uniformize_field(const double* xy,
                              int nw, int nh,
                              int** p_bincounts,
                              int** p_binids) {
-    il** lists;
+    iarray* lists; //# Modified for the StellarSolver Internal Library, contiguous arrays instead of block lists
     int i,j,k,p;
     int* bincounts = NULL;
     int* binids = NULL;
@@ -950,9 +1409,7 @@ void verify_uniformize_field(const double* xy,
     if(N <=0 || nw <=0 || nh <=0) //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
         return;
 
-    lists = malloc(nw * nh * sizeof(il*));
-    for (i=0; i<(nw*nh); i++)
-        lists[i] = il_new(16);
+    lists = calloc(nw * nh, sizeof(iarray));
 
     // put the stars in the appropriate bins.
     debug2("Test star bins:\n");
@@ -962,7 +1419,7 @@ void verify_uniformize_field(const double* xy,
         ind = perm[i];
         bin = get_xy_bin(xy + 2*ind, fieldW, fieldH, nw, nh);
         debug2("%i ", bin);
-        il_append(lists[bin], ind);
+        iarray_append(lists + bin, ind);
     }
     debug2("\n");
 
@@ -970,7 +1427,7 @@ void verify_uniformize_field(const double* xy,
         // note the bin occupancies.
         bincounts = malloc(nw * nh * sizeof(int));
         for (i=0; i<(nw*nh); i++) {
-            bincounts[i] = il_size(lists[i]);
+            bincounts[i] = iarray_size(lists + i);
             //logverb("bin %i has %i stars\n", i, bincounts[i]);
         }
         *p_bincounts = bincounts;
@@ -982,10 +1439,10 @@ void verify_uniformize_field(const double* xy,
         for (j=0; j<nh; j++) {
             for (i=0; i<nw; i++) {
                 int binid = j*nw + i;
-                il* lst = lists[binid];
-                if (k >= il_size(lst))
+                const iarray* lst = lists + binid;
+                if (k >= iarray_size(lst))
                     continue;
-                perm[p] = il_get(lst, k);
+                perm[p] = iarray_get(lst, k);
                 if (binids)
                     binids[p] = binid;
                 p++;
@@ -997,7 +1454,7 @@ void verify_uniformize_field(const double* xy,
     assert(p == N);
 
     for (i=0; i<(nw*nh); i++)
-        il_free(lists[i]);
+        iarray_free(lists + i);
     free(lists);
 }
 
@@ -1257,6 +1714,7 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
     assert(isfinite(logbail));
 
     memset(v, 0, sizeof(verify_t));
+    v->cancel_token = vf->cancel_token; //# Modified for the StellarSolver Internal Library
 
     if (sip)
         v->wcs = sip;
@@ -1303,7 +1761,7 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
      */
     assert(skdt->sweep);
     // Find all index stars within the bounding circle of the field.
-    startree_search_for(skdt, fieldcenter, fieldr2, &refxyz, NULL, &v->refstarid, &v->NRall);
+    get_index_stars(vf, skdt, mo->indexid, mo->healpix, fieldcenter, fieldr2, &refxyz, &v->refstarid, &v->NRall); //# Modified for the StellarSolver Internal Library
     debug2("%i reference stars in the bounding circle\n", v->NRall);
     if (!refxyz) {
         // no stars in range.
@@ -1410,7 +1868,7 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
 
     worst = -HUGE_VAL;
     K = real_verify_star_lists(v, effA, distractors,
-                               logbail, logstoplooking, &besti, &allodds, &theta, &worst,
+                               logbail, logaccept, logstoplooking, &besti, &allodds, &theta, &worst,
                                &ibailed, &istopped);
     mo->logodds = K;
     mo->worstlogodds = worst;
@@ -1588,7 +2046,7 @@ double verify_star_lists(double* refxys, int NR,
     v.testperm = permutation_init(NULL, NT);
 
     X = real_verify_star_lists(&v, effective_area, distractors,
-                               logodds_bail, logodds_stoplooking, &besti,
+                               logodds_bail, -HUGE_VAL, logodds_stoplooking, &besti,
                                &allodds, &theta,
                                p_worstlogodds, &ibailed, &istopped);
     fixup_theta(theta, allodds, ibailed, istopped, &v, besti, NR, NULL,
@@ -1739,7 +2197,7 @@ double verify_star_lists_ror(double* refxys, int NR,
 
     if (v.NR) {
         X = real_verify_star_lists(&v, effective_area, distractors,
-                                   logodds_bail, logodds_stoplooking, &besti,
+                                   logodds_bail, -HUGE_VAL, logodds_stoplooking, &besti,
                                    &allodds, &theta,
                                    p_worstlogodds, &ibailed, &istopped);
         fixup_theta(theta, allodds, ibailed, istopped, &v, besti, NR, NULL,
@@ -105,8 +105,10 @@ struct blind_params {
     float cpu_start;
     anbool hit_cpulimit;
 
-    int timelimit;
-    time_t time_start;
+    //# Modified for the StellarSolver Internal Library, the wall-clock limits are in
+    // (fractional) seconds on the monotonic clock, see timenow_monotonic()
+    double timelimit;
+    double time_start;
     anbool hit_timelimit;
 
     float total_cpulimit;
@@ -124,6 +126,27 @@ struct blind_params {
     anbool cancelled;
 
     anbool best_hit_only;
+
+    //# Modified for the StellarSolver Internal Library, so that a known pointing can be checked without searching for quads.
+    // If this is set, blind_run only verifies the WCSes in verify_wcs_list and engine_run_job stops after that.
+    anbool verify_only;
+
+    //# Modified for the StellarSolver Internal Library, so that the field can grow while its stars are still being extracted.
+    // engine_run_job calls this before each depth range with the last field object it needs (1-indexed, 0 for all of them).
+    void (*field_callback)(struct blind_params* bp, int endobj, void* userdata);
+    void* field_userdata;
+
+    //# Modified for the StellarSolver Internal Library, so that the work of a solve can be reported.
+    // The counters of the solver are reset for every field and index, these add them up over the whole job.
+    // search_time is the wall time in seconds that blind_run spent searching the indexes.
+    int total_quads_tried;
+    int total_codes_matched;
+    int total_verified;
+    double search_time;
+    // If set, blind_run calls this after each index was searched with the wall time of its search in seconds
+    // and the number of quads tried.  When the indexes are searched in parallel, it is called once with a NULL index.
+    void (*index_callback)(struct blind_params* bp, const index_t* index, double seconds, int quads_tried, void* userdata);
+    void* index_userdata;
 };
 typedef struct blind_params blind_t;
 /* //# Modified by Robert Lancaster for the StellarSolver Internal Library, these are not used.
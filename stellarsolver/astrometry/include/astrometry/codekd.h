@@ -9,15 +9,48 @@
 #include "astrometry/kdtree.h"
 #include "astrometry/qfits_header.h"
 #include "astrometry/anqfits.h"
+#include "astrometry/an-bool.h"
 
 #define AN_FILETYPE_CODETREE "CKDT"
 
 #define CODETREE_NAME "codes"
 
+//# Modified for the StellarSolver Internal Library
+/*
+ The codes of an index split up by the healpix of the first star of their
+ quads, so a solve near a known position only searches the codes of the
+ quads that can be near it.  See codetree_shard.
+ */
+typedef struct {
+    int nside;
+    // 12 * nside^2 trees, NULL for the healpixes without quads.
+    kdtree_t** trees;
+    // For each tree, the quad id of each of its codes.
+    int** quadids;
+} codetree_shards_t;
+
+//# Modified for the StellarSolver Internal Library
+/*
+ The codes of some of the quads of an index, in a tree of their own.  See
+ codetree_bright.
+ */
+typedef struct {
+    kdtree_t* tree;
+    // The quad id of each code of the tree.
+    int* quadids;
+} codetree_subset_t;
+
 typedef struct {
     kdtree_t* tree;
     qfits_header* header;
     int* inverse_perm;
+    //# Modified for the StellarSolver Internal Library
+    // An in-memory copy of the tree that is faster to search, or NULL.  See codetree_compact.
+    kdtree_t* compact;
+    // The codes split up by healpix, or NULL.  See codetree_shard.
+    codetree_shards_t* shards;
+    // The codes of the quads of the brightest stars, or NULL.  See codetree_bright.
+    codetree_subset_t* bright;
 } codetree_t;
 
 codetree_t* codetree_open(const char* fn);
@@ -38,6 +71,68 @@ qfits_header* codetree_header(codetree_t* s);
 
 int codetree_close(codetree_t* s);
 
+//# Modified for the StellarSolver Internal Library
+/*
+ Builds an in-memory copy of a code tree that keeps the codes as doubles
+ but only stores a 16-bit split value at each node, so the nodes near the
+ top of the tree share a few cache lines.  Both trees are timed on a
+ sample of the codes within "codetol", and the copy is only kept (in
+ s->compact) if it finds the same codes faster.  The file is not changed.
+
+ Only trees with double data are converted, the integer ones are already
+ compact.  Returns how many times faster the copy was, or 0 if the tree
+ could not be converted.  If "nbytes" is not NULL, it gets the memory
+ the copy used.
+ */
+double codetree_compact(codetree_t* s, double codetol, size_t* nbytes);
+
+//# Modified for the StellarSolver Internal Library
+/*
+ Builds an in-memory copy of a code tree whose codes are stored as 16-bit
+ integers, a quarter of the memory of the doubles of most index files, and
+ keeps it in s->compact in place of any compact copy.  The codes move by
+ less than 1/65535 of their range, so only the codes right at the edge of
+ "codetol" can be found or missed differently, and the solver verifies
+ every match anyway.  The file is not changed.
+
+ Returns 1 if the tree was converted, 0 if it does not store doubles.  If
+ "nbytes" is not NULL, it gets the memory the copy used.
+ */
+int codetree_quantize(codetree_t* s, size_t* nbytes);
+
+/*
+ Builds one in-memory code tree for each healpix of "nside" that has
+ quads, where "cells" gives the healpix of each code.  A quad whose stars
+ are all within some radius of a position has its first star there, so
+ if "cells" has the healpix of the first star, only the trees of the
+ healpixes within the radius need to be searched.
+
+ Returns the number of trees, or 0 if the tree could not be split.  If
+ "nbytes" is not NULL, it gets the memory the trees used.
+ */
+int codetree_shard(codetree_t* s, const int* cells, int nside, size_t* nbytes);
+
+void codetree_free_shards(codetree_t* s);
+
+/*
+ Builds a small in-memory code tree of the codes of the quads for which
+ "keep" is set, which are the quads of the brightest stars of the index,
+ and keeps it in s->bright.  The solver can search it first with the
+ brightest stars of the field, since most fields solve with those quads,
+ and then the whole tree only if that fails.  See index_bright_codes.
+
+ Returns the number of codes in the tree, or 0 if it could not be built.
+ If "nbytes" is not NULL, it gets the memory the tree used.
+ */
+int codetree_bright(codetree_t* s, const anbool* keep, size_t* nbytes);
+
+void codetree_free_bright(codetree_t* s);
+
+// The tree the solver searches: the compact copy if there is one.
+static inline kdtree_t* codetree_search_tree(const codetree_t* s) {
+    return s->compact ? s->compact : s->tree;
+}
+
 // for writing
 codetree_t* codetree_new(void);
 
@@ -36,6 +36,9 @@ struct engine {
     double minwidth;
     double maxwidth;
     float cpulimit;
+    //# Modified for the StellarSolver Internal Library, if more than 0, the field objects of each band of scales are limited to this many
+    // times the stars its indexes can have in a field of that size, from the cut of the indexes
+    double star_budget;
     //# Modified by Robert Lancaster for the StellarSolver Internal Library since we aren't using any files in the internal library
     //char* cancelfn;
     //char* solvedfn;
@@ -59,11 +62,15 @@ void engine_add_search_path(engine_t* engine, const char* path);
 char* engine_find_index(engine_t*, const char* name);
 // note that "path" must be a full path name.
 int engine_add_index(engine_t* engine, char* path);
+// adds an index without taking ownership of it. //# Modified for the StellarSolver Internal Library
+int engine_add_loaded_index(engine_t* engine, index_t* ind);
 // look in all the search path directories for index files.
 int engine_autoindex_search_paths(engine_t* engine);
 int engine_parse_config_file_stream(engine_t* engine, FILE* fconf);
 int engine_parse_config_file(engine_t* engine, const char* fn);
 int engine_run_job(engine_t* engine, job_t* job);
+// appends the positions in engine->indexes of the indexes engine_run_job would use for the job. //# Modified for the StellarSolver Internal Library
+void engine_select_indexes_for_job(engine_t* engine, job_t* job, il* selected);
 void engine_free(engine_t* engine);
 
 //# Modified by Robert Lancaster for the StellarSolver Internal Library since we aren't using any files in the internal library
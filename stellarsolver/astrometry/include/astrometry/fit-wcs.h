@@ -52,6 +52,57 @@ int fit_sip_wcs_2(const double* starxyz,
                   sip_t* sipout
                   );
 
+//# Modified for the StellarSolver Internal Library, so that tweak2 doesn't rebuild the same matrices for every iteration.
+/**
+ The polynomial terms of a fixed list of field objects and the normal
+ equation buffers for fit_sip_wcs_cached.  The terms only depend on
+ the pixel positions, the order and CRPIX, which stay the same for the
+ iterations of a tweak, so they are computed once and reused.
+ */
+typedef struct {
+    const double* fieldxy;
+    int Nfield;
+    // order and CRPIX the terms were computed for; -1 when there are none
+    int sip_order;
+    double crpix[2];
+    // the pixel offsets are divided by this to keep the normal equations
+    // well conditioned
+    double scale;
+    // Nfield x N polynomial terms, N = (sip_order+1)(sip_order+2)/2
+    double* terms;
+    // N x N normal matrix and the two N right hand sides
+    double* ata;
+    double* atb;
+    // the same for the fit of the inverse polynomials, of order inv_order
+    int inv_order;
+    double* inv_ata;
+    double* inv_atb;
+} fit_sip_cache_t;
+
+void fit_sip_cache_init(fit_sip_cache_t* cache, const double* fieldxy,
+                        int Nfield, int W, int H);
+
+void fit_sip_cache_free(fit_sip_cache_t* cache);
+
+/**
+ The same fit as fit_sip_wcs, for correspondences given as indices
+ into the field objects of the cache.  It solves the normal equations
+ with a Cholesky decomposition instead of a QR decomposition of the
+ full matrix, and falls back to fit_sip_wcs if they are singular.
+ The inverse polynomials are fit the same way, on the grid that
+ sip_compute_inverse_polynomials uses.
+ */
+int fit_sip_wcs_cached(const double* starxyz,
+                       const int* fieldinds,
+                       const double* weights,
+                       int M,
+                       const tan_t* tanin,
+                       int sip_order,
+                       int inv_order,
+                       int doshift,
+                       fit_sip_cache_t* cache,
+                       sip_t* sipout);
+
 /**
  Move the tangent point to the given CRPIX, keeping the corresponding
  stars in "starxyz" and "fieldxy" aligned.  It's assumed that "tanin"
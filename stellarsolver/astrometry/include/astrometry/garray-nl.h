@@ -0,0 +1,82 @@
+/*
+ # This file is part of the Astrometry.net suite.
+ # Licensed under a 3-clause BSD style license - see LICENSE
+ */
+
+//# Modified for the StellarSolver Internal Library
+/**
+ Growable arrays of numerical types, see garray.h.
+
+ Expects "ga" to be #defined to the array type.
+
+ Expects "number" to be #defined to the element type.
+ */
+
+#define GAFGLUE2(n,f) n ## _ ## f
+#define GAFGLUE(n,f) GAFGLUE2(n,f)
+#define GAF(func) GAFGLUE(ga, func)
+
+typedef struct {
+    number* data;
+    size_t N;
+    size_t capacity;
+} ga;
+
+static inline void GAF(init)(ga* a) {
+    a->data = NULL;
+    a->N = 0;
+    a->capacity = 0;
+}
+
+static inline void GAF(free)(ga* a) {
+    free(a->data);
+    GAF(init)(a);
+}
+
+static inline size_t GAF(size)(const ga* a) {
+    return a->N;
+}
+
+static inline number GAF(get)(const ga* a, size_t i) {
+    assert(i < a->N);
+    return a->data[i];
+}
+
+static inline void GAF(set)(ga* a, size_t i, number value) {
+    assert(i < a->N);
+    a->data[i] = value;
+}
+
+// Makes room for at least "n" elements; returns 0 on success.
+static inline int GAF(reserve)(ga* a, size_t n) {
+    number* data;
+    size_t capacity;
+    if (n <= a->capacity)
+        return 0;
+    capacity = a->capacity ? a->capacity : GA_INITIAL_CAPACITY;
+    while (capacity < n)
+        capacity *= 2;
+    data = (number*)realloc(a->data, capacity * sizeof(number));
+    if (!data)
+        return -1;
+    a->data = data;
+    a->capacity = capacity;
+    return 0;
+}
+
+// Returns a pointer to the new element, or NULL if there was no memory for it.
+static inline number* GAF(append)(ga* a, number value) {
+    if (a->N == a->capacity && GAF(reserve)(a, a->N + 1))
+        return NULL;
+    a->data[a->N] = value;
+    return a->data + a->N++;
+}
+
+// Empties the array but keeps its memory, so it can be filled again without allocating.
+static inline void GAF(remove_all)(ga* a) {
+    a->N = 0;
+}
+
+#undef GAF
+#undef GAFGLUE
+#undef GAFGLUE2
@@ -0,0 +1,49 @@
+/*
+ # This file is part of the Astrometry.net suite.
+ # Licensed under a 3-clause BSD style license - see LICENSE
+ */
+
+//# Modified for the StellarSolver Internal Library
+#ifndef GARRAY_H
+#define GARRAY_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <assert.h>
+
+/*
+ Growable arrays of ints (iarray), doubles (darray) and pointers
+ (parray).
+
+ A block list (bl.h) keeps its elements in a linked list of blocks, so
+ getting an element can walk the list and every call goes through the
+ library.  These keep their elements in one array that doubles in size
+ when it is full, and all of the functions are inline, so in an inner
+ loop an element is one load.  The struct can live on the stack or in
+ another struct: init it (or zero it) before use and free it after.
+
+ The pointers to the elements are only good until the next append, which
+ can move the array.
+ */
+
+#define GA_INITIAL_CAPACITY 16
+
+#define ga iarray
+#define number int
+#include "astrometry/garray-nl.h"
+#undef ga
+#undef number
+
+#define ga darray
+#define number double
+#include "astrometry/garray-nl.h"
+#undef ga
+#undef number
+
+#define ga parray
+#define number void*
+#include "astrometry/garray-nl.h"
+#undef ga
+#undef number
+
+#endif
@@ -258,6 +258,20 @@ int64_t xyzarrtohealpixl(const double* xyz, int Nside);
 
 int xyzarrtohealpixf(const double* xyz,int Nside, double* p_dx, double* p_dy);
 
+//# Modified for the StellarSolver Internal Library
+/**
+   Converts "n" points on the unit sphere, stored as xyzxyzxyz, into their
+   healpix indexes, like xyzarrtohealpix() for each of them.
+*/
+void xyzarrtohealpixmany(const double* xyz, int n, int Nside, int* hps);
+
+//# Modified for the StellarSolver Internal Library
+/**
+   Converts "n" RA,Dec points in degrees, stored as radecradec, into their
+   healpix indexes, like radecdegtohealpix() for each of them.
+*/
+void radecdegarrtohealpixmany(const double* radec, int n, int Nside, int* hps);
+
 /**
    Converts a healpix index, plus fractional offsets (dx,dy), into (x,y,z)
    coordinates on the unit sphere.  (dx,dy) must be in [0, 1].  (0.5, 0.5)
@@ -73,6 +73,10 @@ typedef struct {
     int dimquads;
     int nstars;
     int nquads;
+
+    //# Modified for the StellarSolver Internal Library
+    // The mapping of a native index file while it is loaded, see ssindex.h, or NULL
+    void* native;
 } index_t;
 
 /**
@@ -105,6 +109,16 @@ anbool index_is_within_range(index_t* indx, double ra, double dec, double radius
  */
 int index_get_meta(const char* filename, index_t* indx);
 
+/**
+ Creates an index for 'indexname' with the metadata copied from 'meta',
+ as if it had been loaded with INDEX_ONLY_LOAD_METADATA, but without
+ opening the index file.  This is for metadata that was cached earlier.
+ The components of the index can be loaded later with index_reload().
+
+ //# Modified for the StellarSolver Internal Library
+ */
+index_t* index_from_metadata(const char* indexname, const index_t* meta);
+
 anbool index_is_file_index(const char* filename);
 
 char* index_get_quad_filename(const char* indexname);
@@ -123,6 +137,33 @@ int index_nstars(const index_t* index);
 
 index_t* index_build_from(codetree_t* codekd, quadfile_t* quads, startree_t* starkd);
 
+/**
+ Splits the code tree of a loaded index by the healpix of the first star
+ of each quad (see codetree_shard), so the solves with a position only
+ search the codes of the quads near it.  If "nside" is 0, it is chosen
+ so the healpixes have a few thousand quads each; nothing is done if
+ that would be fewer than 48 healpixes.  Returns the number of code trees
+ it was split into, or 0 if it wasn't.  If "nbytes" is not NULL, it gets
+ the memory the trees used.
+
+ //# Modified for the StellarSolver Internal Library
+ */
+int index_shard_codes(index_t* index, int nside, size_t* nbytes);
+
+/**
+ Builds the small code tree of the quads of the brightest stars of a
+ loaded index (see codetree_bright), with "fraction" of its quads.  The
+ quads are ranked by the faintest of their stars, by the sweep of the
+ brightness cuts the star is in, and then by their quad id, since the
+ quads are built in passes over the brightest stars that are left.  An
+ index without sweeps keeps the quads of the first passes.  Returns the
+ number of codes in the tree, or 0 if it wasn't built.  If "nbytes" is
+ not NULL, it gets the memory the tree used.
+
+ //# Modified for the StellarSolver Internal Library
+ */
+int index_bright_codes(index_t* index, double fraction, size_t* nbytes);
+
 /**
  * Load an index from disk
  *
@@ -139,6 +139,7 @@ struct kdtree_funcs {
 
     void  (*nearest_neighbour_internal)(const kdtree_t* kd, const void* query, double* bestd2, int* pbest);
     kdtree_qres_t* (*rangesearch)(const kdtree_t* kd, kdtree_qres_t* res, const void* pt, double maxd2, int options);
+    int (*rangesearch_batch)(const kdtree_t* kd, kdtree_qres_t** results, const void* pts, int N, double maxd2, int options); //# Modified for the StellarSolver Internal Library
 
     void (*nodes_contained)(const kdtree_t* kd,
                             const void* querylow, const void* queryhi,
@@ -315,6 +316,17 @@ void* kdtree_get_data(const kdtree_t* kd, int i);
 
 void kdtree_copy_data_double(const kdtree_t* kd, int i, int N, double* dest);
 
+//# Modified for the StellarSolver Internal Library
+/*
+ Builds an in-memory copy of "kd" that keeps its data as the integers of
+ "treetype", KDTT_DSS for 16 bits or KDTT_DUU for 32 bits.  The copy is
+ built from the data in its original order, so the permutation of the
+ copy maps to the same ids as the one of "kd".  Returns NULL if the data
+ of "kd" aren't doubles or the copy can't be built, free it with
+ kdtree_free.
+ */
+kdtree_t* kdtree_quantize(const kdtree_t* kd, int treetype);
+
 const char* kdtree_kdtype_to_string(int kdtype);
 
 const char* kdtree_build_options_to_string(int opts);
@@ -586,6 +598,17 @@ kdtree_t* KDFUNC(kdtree_build)
                                                                                                                                                      */
                                                                                                                                                     kdtree_qres_t* KDFUNC(kdtree_rangesearch_options_reuse)(const kdtree_t *kd, kdtree_qres_t* res, const void *pt, double maxd2, int options);
 
+/*
+ //# Modified for the StellarSolver Internal Library
+ Like kdtree_rangesearch_options_reuse, for the N query points in "pts",
+ which are searched together in one traversal of the tree.  results[i]
+ gets the results of the i-th point, it is reused if it isn't NULL.
+ Unless they are sorted, the results of a point may be in a different
+ order than kdtree_rangesearch_options_reuse would give them.
+ Returns 0 on success.
+ */
+int KDFUNC(kdtree_rangesearch_batch)(const kdtree_t *kd, kdtree_qres_t** results, const void *pts, int N, double maxd2, int options);
+
 #if !defined(KD_DIM)
 #undef KD_DIM_GENERIC
 #endif
@@ -143,6 +143,17 @@ anbool sip_radec2pixelxy(const sip_t* sip, double a, double d, double *px, doubl
 WarnUnusedResult
 anbool sip_radec2pixelxy_check(const sip_t* sip, double ra, double dec, double *px, double *py);
 
+//# Modified for the StellarSolver Internal Library, to convert arrays of points with the terms
+//# that are the same for all of them computed once instead of for each point.
+// Pixels to RA,Dec in degrees, for N points.
+void   sip_pixelxy2radec_array(const sip_t* sip, const double* px, const double* py, int N,
+                               double* ra, double* dec);
+
+// RA,Dec in degrees to Pixels, for N points.  The points that don't project onto the
+// tangent plane get FALSE in "ok", which can be NULL.  Returns how many did.
+int    sip_radec2pixelxy_array(const sip_t* sip, const double* ra, const double* dec, int N,
+                               double* px, double* py, anbool* ok);
+
 WarnUnusedResult
 anbool sip_xyzarr2pixelxy(const sip_t* sip, const double* xyz, double *px, double *py);
 
@@ -12,6 +12,7 @@
 #include "astrometry/starxy.h"
 #include "astrometry/kdtree.h"
 #include "astrometry/bl.h"
+#include "astrometry/garray.h" //# Modified for the StellarSolver Internal Library
 #include "astrometry/matchobj.h"
 #include "astrometry/quadfile.h"
 #include "astrometry/starkd.h"
@@ -21,6 +22,67 @@
 #include "astrometry/sip.h"
 #include "astrometry/an-bool.h"
 
+//# Modified for the StellarSolver Internal Library
+// The most codes a quad can make: its 3! permutations of stars C, D and E,
+// its two backbone orientations and both parities.
+#define SOLVER_CODEBATCH_MAX 24
+
+//# Modified for the StellarSolver Internal Library
+// How many quit checks go by between readings of the clock for the deadline.
+#define SOLVER_DEADLINE_CHECK_INTERVAL 64
+
+//# Modified for the StellarSolver Internal Library
+// The most quads whose codes wait for the code matcher together.
+#define SOLVER_MATCHER_QUADS_MAX 512
+
+//# Modified for the StellarSolver Internal Library
+// The default limit on the memory of the inboxes of the pairs of A and B stars
+// in solver_run(), see pquad_bytes_max.  The first 1000 stars need under 64MB.
+#define SOLVER_PQUAD_BYTES_MAX (64 * 1024 * 1024)
+
+//# Modified for the StellarSolver Internal Library
+/*
+ A code matcher searches a code tree for many codes at once, like on a GPU,
+ instead of one traversal of the tree for each quad.  With one, the solver
+ collects the codes of up to SOLVER_MATCHER_QUADS_MAX quads, searches for them
+ together, and then resolves and verifies the matches on the CPU in the order
+ the quads were built.
+
+ It gets "ncodes" codes of "dimcode" values each and finds the codes of the
+ tree within squared distance "tol2" of each of them.  counts[i] gets how many
+ matched code i, and *matches and *dists2 get malloc'd arrays of all of the
+ matches, those of code 0 first, then those of code 1 and so on: the indexes
+ into the original data of the tree, like the "inds" of a kdtree range search,
+ and the squared distances.  It returns 0 on success, otherwise the codes are
+ searched for in the tree as usual.
+ */
+typedef int (*solver_code_matcher_t)(void* userdata, const kdtree_t* tree,
+                                     const double* codes, int ncodes, int dimcode,
+                                     double tol2, int* counts, u32** matches,
+                                     double** dists2);
+
+//# Modified for the StellarSolver Internal Library
+// The most threads that verify the matches of a quad at the same time.
+#define SOLVER_VERIFY_WORKERS_MAX 16
+
+//# Modified for the StellarSolver Internal Library
+/*
+ A verify runner verifies the matches of a quad on several threads at once,
+ while the solver waits for them.  It calls verify(arg, worker, i) once for
+ each i from 0 to n-1, with up to "nworkers" of them at the same time, taking
+ the i's in order.  "worker" is from 0 to nworkers-1, and no two of the calls
+ that run at the same time get the same one.  It returns 0 once they have all
+ returned, otherwise the solver verifies the matches itself one at a time.
+
+ The solver then handles the matches in their order, as if it had verified
+ them one at a time, so it finds the same solution.  Once a match is good
+ enough to solve, the matches after it are not verified, unless it is turned
+ down in the end.
+ */
+typedef int (*solver_verify_runner_t)(void* userdata, int n, int nworkers,
+                                      void (*verify)(void* arg, int worker, int i),
+                                      void* arg);
+
 enum {
     PARITY_NORMAL,
     PARITY_FLIP,
@@ -72,11 +134,29 @@ struct solver_t {
 
     anbool verify_uniformize;
     anbool verify_dedup;
+    //# Modified for the StellarSolver Internal Library
+    // find nearby field stars during verification with a grid hash instead of a kdtree
+    anbool verify_grid;
+    //# Modified for the StellarSolver Internal Library
+    // if non-NULL, the verifications get the index stars from this catalog
+    // where it has them, instead of searching the star kdtrees
+    const verify_ref_catalog_t* refcatalog;
+    //# Modified for the StellarSolver Internal Library
+    // check the scales and the boxes of the quads with float copies of the
+    // field star positions, which solver_run() makes in field_xf and field_yf
+    anbool float_search;
+    float* field_xf;
+    float* field_yf;
 
     anbool do_tweak;
 
     int tweak_aborder;
     int tweak_abporder;
+    //# Modified for the StellarSolver Internal Library, see tweak2(); 0 turns them off
+    // the time limit of each tweak, in seconds
+    double tweak_timelimit;
+    // the relative improvement of the tweak residual below which the annealing of an order is finished
+    double tweak_min_improvement;
 
 
     // OPTIONAL FIELDS WITH SENSIBLE DEFAULTS
@@ -142,6 +222,54 @@ struct solver_t {
     // Bail out ASAP.
     anbool quit_now;
 
+    //# Modified for the StellarSolver Internal Library
+    // If non-NULL, this is checked as often as quit_now, so another thread can
+    // stop the solver by setting it to non-zero.  Several solvers may share it.
+    const int* cancel_token;
+
+    //# Modified for the StellarSolver Internal Library
+    // If non-NULL, this is called with the log odds of each verified match and
+    // returns the best log odds of a solution that this or any other solver
+    // working on the same field has found, so a match that can't beat it is
+    // dropped.  The second parameter is "best_logodds_userdata".
+    double (*best_logodds_callback)(double logodds, void* userdata);
+    void* best_logodds_userdata;
+
+    //# Modified for the StellarSolver Internal Library
+    // If non-NULL, the codes of many quads are searched for together with it,
+    // see solver_code_matcher_t.
+    solver_code_matcher_t code_matcher;
+    void* code_matcher_data;
+
+    //# Modified for the StellarSolver Internal Library
+    // If non-NULL and verify_workers is more than 1, the matches of a quad are
+    // verified on that many threads at once, see solver_verify_runner_t.
+    solver_verify_runner_t verify_runner;
+    void* verify_runner_data;
+    int verify_workers;
+
+    //# Modified for the StellarSolver Internal Library
+    // The most bytes that the inboxes of the pairs of A and B stars may take
+    // in solver_run(), 0 for no limit.  Once they are full, the pairs of the
+    // fainter B stars are only tried with the stars before them.
+    size_t pquad_bytes_max;
+
+    //# Modified for the StellarSolver Internal Library
+    // If non-zero, solver_run() first builds the quads of this many of the
+    // brightest field stars and only searches the small code trees of the
+    // quads of the brightest index stars (see codetree_bright), then runs
+    // again over the whole code trees if that did not solve the field.  The
+    // indexes without the small tree are only searched in the second run.
+    int bright_pass_stars;
+
+    //# Modified for the StellarSolver Internal Library
+    // If non-zero, the solver stops once timenow_monotonic() passes this.  The
+    // clock is read every SOLVER_DEADLINE_CHECK_INTERVAL quit checks, so the
+    // limit holds to a small fraction of a second instead of the timer
+    // callback's one second.
+    double deadline;
+    anbool hit_deadline;
+
     // SOLVER OUTPUTS
     // ==============
     // NOTE: these are only incremented, not initialized.  It's up to you to set
@@ -161,6 +289,15 @@ struct solver_t {
     int num_abscale_skipped;
     // The number of times we ran verification on a quad.
     int num_verified;
+    //# Modified for the StellarSolver Internal Library, so that the work of a solve can be reported.
+    // The wall time in seconds spent verifying matches and tweaking solutions.
+    // Unlike the counters above, these are never reset and add up over all of the fields and indexes.
+    double verify_time;
+    double tweak_time;
+    //# Modified for the StellarSolver Internal Library, so that the hardware events of the verifications can be reported.
+    // If set, the events of each verification are added to these SSCOUNTERS_N counts, see perfcounters.h.
+    // The verifications can run on several threads, so they are added atomically.
+    uint64_t* verify_counters;
 
     // INTERNAL PARAMETERS; DO NOT MODIFY
     // ==================================
@@ -178,6 +315,25 @@ struct solver_t {
     // The relative noise of the current quad, squared:
     double rel_field_noise2;
 
+    //# Modified for the StellarSolver Internal Library
+    // The results of the code tree searches for the codes of a quad, which are
+    // reused for the next quad and freed at the end of solver_run.
+    kdtree_qres_t* code_results[SOLVER_CODEBATCH_MAX];
+
+    //# Modified for the StellarSolver Internal Library
+    // The healpixes of the code trees of the current index that are within
+    // the search radius, when its code tree is split up by healpix and there
+    // is a position to search around.  See codetree_shard.
+    iarray shard_cells;
+
+    //# Modified for the StellarSolver Internal Library
+    // The quads whose codes wait for the code matcher, while solver_run runs.
+    struct pending_codes* pending_codes;
+
+    //# Modified for the StellarSolver Internal Library
+    // Whether solver_run() is in the pass over the bright code trees.
+    anbool bright_pass;
+
     double abscale_low;
     double abscale_high;
 
@@ -195,6 +351,10 @@ struct solver_t {
     double starttime;
     double timeused;
 
+    //# Modified for the StellarSolver Internal Library
+    // Quit checks left before the deadline is compared with the clock again.
+    int deadline_countdown;
+
     // Best match so far
     double   best_logodds;
     MatchObj best_match;
@@ -204,6 +364,18 @@ struct solver_t {
 
     // Cached data about this field, for verify_hit().
     verify_field_t* vf;
+
+    //# Modified for the StellarSolver Internal Library
+    // if non-NULL and made for fieldxy, vf is a verify_field_share() copy of
+    // this one instead of a field preprocessed again, so the solvers of one
+    // field share its kdtree and grid hash.  It must outlive the solve.
+    const verify_field_t* shared_vf;
+    anbool vf_is_shared;
+
+    //# Modified for the StellarSolver Internal Library
+    // The copies of vf, with their own index star caches, for the threads of
+    // the verify runner.  They are made when they are first needed.
+    verify_field_t* worker_vf[SOLVER_VERIFY_WORKERS_MAX];
 };
 typedef struct solver_t solver_t;
 
@@ -376,6 +548,17 @@ void solver_verify_sip_wcs(solver_t* solver, sip_t* sip); //, MatchObj* mo);
 
 void solver_run(solver_t* solver);
 
+//# Modified for the StellarSolver Internal Library
+enum {
+    SOLVER_SIMD_NONE = 0,
+    SOLVER_SIMD_AVX2,
+    SOLVER_SIMD_NEON
+};
+
+// The vector instructions that the quad building of solver_run uses on this
+// CPU, SOLVER_SIMD_NONE means the scalar code.
+int solver_simd(void);
+
 #define SOLVER_TWEAK2_AVAILABLE 1
 void solver_tweak2(solver_t* solver, MatchObj* mo, int order, sip_t* verifysip);
 
@@ -0,0 +1,65 @@
+/*
+ # This file is part of the Astrometry.net suite.
+ # Licensed under a 3-clause BSD style license - see LICENSE
+ */
+
+//# Modified for the StellarSolver Internal Library
+#ifndef SSINDEX_H
+#define SSINDEX_H
+
+#include "astrometry/index.h"
+#include "astrometry/an-bool.h"
+
+/*
+ The native index format of StellarSolver.
+
+ An Astrometry.net index file keeps the star kd-tree, the quads and the
+ code kd-tree in FITS extensions, each of which has to be found and
+ parsed before it can be mapped.  A native index file has the same
+ trees and quads, but:
+
+ - A header page at the start gives where every array is, so loading it
+   is one read of the header and one mapping of the file.
+ - The arrays come in the order the solver reads them: the code tree,
+   then the quads, then the star tree.  Each one starts on a page, so
+   the mapping shares no pages between them.
+ - The quads are in the order of the codes in the code tree, so the code
+   tree needs no permutation and the quads of the codes found near each
+   other are next to each other.
+ - Optionally the codes are quantized to 16 bits, which makes the code
+   tree a quarter of the size.
+
+ The arrays are in the byte order of the machine that wrote the file.
+ The tag-along columns of the stars are not copied: they are only read
+ for the extra columns of the rdls output.
+ */
+
+#define SSINDEX_SUFFIX ".ssindex"
+
+/*
+ Whether "filename" is a native index file, from the magic number at its
+ start.
+ */
+anbool ssindex_is_file(const char* filename);
+
+/*
+ Writes the index, which has to be fully loaded, to the native index
+ file "outfn".  If "quantize" is set and the codes are doubles, the code
+ tree is rebuilt with 16-bit codes.  Returns 0 on success.
+ */
+int ssindex_write(index_t* index, const char* outfn, anbool quantize);
+
+/*
+ Maps the native index file of "index" (its quadfn) and points its
+ codekd, quads and starkd at the arrays in the mapping.  Returns 0 on
+ success.  index_reload calls this for native index files.
+ */
+int ssindex_load(index_t* index);
+
+/*
+ Frees the codekd, quads and starkd of an index loaded by ssindex_load
+ and unmaps the file.  index_unload calls this for native index files.
+ */
+void ssindex_unload(index_t* index);
+
+#endif
@@ -101,6 +101,10 @@ InlineDeclare Flatten void xyzarr2radecdegarr(double* xyz, double *radec);
 InlineDeclare void radecdeg2xyzarr(double ra, double dec, double* p_xyz);
 InlineDeclare void radecdegarr2xyzarr(double* radec, double* xyz);
 InlineDeclare void radecdeg2xyzarrmany(double *ra, double *dec, double* xyz, int n);
+//# Modified for the StellarSolver Internal Library
+// Converts "n" points at once, xyz stored as xyzxyzxyz and RA,Dec as radecradec.
+InlineDeclare void xyzarr2radecdegarrmany(const double* xyz, double* radec, int n);
+InlineDeclare void radecdegarr2xyzarrmany(const double* radec, double* xyz, int n);
 
 // RA,Dec in degrees.
 // Puts the xyz unit vector pointing in positive-RA direction in "dra",
@@ -24,4 +24,10 @@ double millis_between(struct timeval* tv1, struct timeval* tv2);
 // You probably only want to look at differences in the values returned by this function.
 double timenow();
 
+//# Modified for the StellarSolver Internal Library
+// Returns the number of seconds on a monotonic clock with (at least) microsecond
+// resolution, for time limits that mustn't jump when the system clock is set.
+// Only differences in the values returned by this function mean anything.
+double timenow_monotonic();
+
 #endif
@@ -40,6 +40,9 @@
  newtheta: "theta" maps field stars to reference stars in the final matching that we produce.  Set this non-NULL to pull it out.
  newodds: this tells the confidence in the matches.  Use verify_logodds_to_weight() to turn these into a weight in [0,1].
  crpix: if you want to keep the reference point fixed, set this to a (2-element) array of the image reference position.
+ timelimit: (StellarSolver) stop fitting higher orders after this many seconds; 0 for no limit.
+ min_improvement: (StellarSolver) finish the annealing of an order once an iteration improves the weighted RMS
+ residual of the matches by less than this fraction of it; 0 to always do all of the steps.
  */
 sip_t* tweak2(const double* fieldxy, int Nfield,
               double fieldjitter,
@@ -57,7 +60,8 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
               double* crpix,
               double* p_logodds,
               int* p_besti,
-              int* testperm, int startorder);
+              int* testperm, int startorder,
+              double timelimit, double min_improvement); //# Modified for the StellarSolver Internal Library
 
 
 #endif
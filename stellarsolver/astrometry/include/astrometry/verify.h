@@ -14,6 +14,68 @@
 #include "astrometry/bl.h"
 #include "astrometry/starxy.h"
 
+struct verify_star_cache; //# Modified for the StellarSolver Internal Library
+
+//# Modified for the StellarSolver Internal Library
+// Whether another thread has set a cancel token.  The token is written by the
+// library with an atomic store, so it is read here with an atomic load.
+#ifdef _MSC_VER
+#include <intrin.h>
+#define cancel_requested(token) ((token) && _InterlockedCompareExchange((volatile long*)(token), 0, 0))
+#else
+#define cancel_requested(token) ((token) && __atomic_load_n((token), __ATOMIC_ACQUIRE))
+#endif
+
+//# Modified for the StellarSolver Internal Library
+/*
+ A reference catalog holds the index stars of some indexes around a target,
+ so that all of the verifications of a session, like the solves of the
+ images of one target over a night, get them from memory instead of the
+ kdtrees of the indexes.  The stars of each index are sorted by their z,
+ so the stars in a circle are found in a range of them.  It is only read
+ by the verifications, so any number of solves can use it at once.
+ */
+typedef struct {
+    int indexid;
+    int healpix;
+    double center[3];
+    // the stars within this distance of the center are in the region
+    double radius;
+    int N;
+    double* xyz;
+    int* starid;
+    // the catalog magnitudes, or NULL if the index has none
+    double* mag;
+} verify_ref_region_t;
+
+typedef struct verify_ref_catalog_t {
+    int nregions;
+    verify_ref_region_t* regions;
+} verify_ref_catalog_t;
+
+verify_ref_catalog_t* verify_ref_catalog_new(void);
+
+/*
+ Adds the stars of the star kdtree of an index (identified by its index id
+ and healpix) within radius2 (on the unit sphere) of the center.
+ Returns the number of stars, or -1 if there was no memory for them.
+ */
+int verify_ref_catalog_add(verify_ref_catalog_t* catalog, const startree_t* skdt,
+                           int indexid, int healpix,
+                           const double* center, double radius2);
+
+/*
+ Gets the stars of an index within radius2 of the center, like
+ startree_search_for().  Returns FALSE if the catalog doesn't have the
+ whole circle for that index, then nothing is returned.
+ */
+anbool verify_ref_catalog_search(const verify_ref_catalog_t* catalog,
+                                 int indexid, int healpix,
+                                 const double* center, double radius2,
+                                 double** p_xyz, int** p_starid, int* p_N);
+
+void verify_ref_catalog_free(verify_ref_catalog_t* catalog);
+
 struct verify_field_t {
     const starxy_t* field;
     // this copy is normal.
@@ -28,14 +90,38 @@ struct verify_field_t {
     anbool do_dedup;
     // apply radius-of-relevance filtering
     anbool do_ror;
+
+    //# Modified for the StellarSolver Internal Library
+    // if non-NULL and set to non-zero, verification stops early and reports no match
+    const int* cancel_token;
+
+    //# Modified for the StellarSolver Internal Library
+    // find nearby field stars with the grid hash rather than the kdtree
+    anbool do_grid;
+    // grid hash of the field stars: the stars in cell c are
+    // gridstars[gridstart[c]] to gridstars[gridstart[c+1]-1].
+    int gridnx, gridny;
+    double gridx0, gridy0, gridcell;
+    int* gridstart;
+    int* gridstars;
+
+    //# Modified for the StellarSolver Internal Library
+    // the index stars found around the recent matches, or NULL
+    struct verify_star_cache* starcache;
+
+    //# Modified for the StellarSolver Internal Library
+    // the index stars of the session, which are used before the kdtrees, or NULL
+    const verify_ref_catalog_t* refcatalog;
 };
 typedef struct verify_field_t verify_field_t;
 
 
 /*
  This function must be called once for each field before verification
- begins.  We build a kdtree out of the field stars (in pixel space)
- which will be used during deduplication.
+ begins.  We build a kdtree and a grid hash out of the field stars (in
+ pixel space) which will be used during deduplication.  Nothing in it
+ depends on the match being verified, so it can be kept for all the
+ indexes that are tried on the field.
  */
 verify_field_t* verify_field_preprocess(const starxy_t* fieldxy);
 
@@ -46,6 +132,25 @@ verify_field_t* verify_field_preprocess(const starxy_t* fieldxy);
  */
 void verify_field_free(verify_field_t* vf);
 
+//# Modified for the StellarSolver Internal Library
+/*
+ Forgets the index stars cached in the field, for when the indexes that
+ they came from might have been closed.
+ */
+void verify_field_clear_star_cache(verify_field_t* vf);
+
+//# Modified for the StellarSolver Internal Library
+/*
+ Makes a verify_field_t that shares the field, its kdtree and its grid hash
+ with "vf" but has its own cache of index stars, so that another thread can
+ verify matches with it at the same time as "vf" is used.  It must be freed
+ with verify_field_free_shared() before "vf" is freed.
+ */
+verify_field_t* verify_field_share(const verify_field_t* vf);
+
+//# Modified for the StellarSolver Internal Library
+void verify_field_free_shared(verify_field_t* shared);
+
 
 
 
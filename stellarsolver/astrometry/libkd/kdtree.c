@@ -25,6 +25,64 @@ kdtree_t* kdtree_build(kdtree_t* kd, void *data, int N, int D, int Nleaf,
                           NULL, NULL);
 }
 
+//# Modified for the StellarSolver Internal Library
+kdtree_t* kdtree_quantize(const kdtree_t* kd, int treetype) {
+    kdtree_t* quantized;
+    double* data;
+    double* points;
+    double* lo;
+    double* hi;
+    int N, D, i, d;
+
+    if (!kd || kdtree_datatype(kd) != KDT_DATA_DOUBLE || kd->ndata <= 0)
+        return NULL;
+    N = kd->ndata;
+    D = kd->ndim;
+    data = malloc((size_t)N * D * sizeof(double));
+    points = malloc((size_t)N * D * sizeof(double));
+    lo = malloc(D * sizeof(double));
+    hi = malloc(D * sizeof(double));
+    if (!data || !points || !lo || !hi) {
+        free(data);
+        free(points);
+        free(lo);
+        free(hi);
+        ERROR("Failed to allocate the %i points of a kd-tree to quantize them", N);
+        return NULL;
+    }
+    // The points go back into their original order, so the ids the new tree finds are the same
+    kdtree_copy_data_double(kd, 0, N, data);
+    for (i=0; i<N; i++) {
+        int orig = kd->perm ? kd->perm[i] : i;
+        memcpy(points + (size_t)orig * D, data + (size_t)i * D, D * sizeof(double));
+    }
+    free(data);
+    // The range gets a margin, a point at the edge of it would be quantized to the largest value and a search
+    // that converts a query just past it couldn't use the integer splits
+    for (d=0; d<D; d++) {
+        lo[d] = HUGE_VAL;
+        hi[d] = -HUGE_VAL;
+    }
+    for (i=0; i<N; i++) {
+        for (d=0; d<D; d++) {
+            lo[d] = MIN(lo[d], points[(size_t)i * D + d]);
+            hi[d] = MAX(hi[d], points[(size_t)i * D + d]);
+        }
+    }
+    for (d=0; d<D; d++) {
+        double margin = MAX(1e-6, 1e-3 * (hi[d] - lo[d]));
+        lo[d] -= margin;
+        hi[d] += margin;
+    }
+    quantized = kdtree_build_2(NULL, points, N, D, MAX(1, N / MAX(1, kd->nbottom)), treetype, KD_BUILD_SPLIT, lo, hi);
+    free(points);
+    free(lo);
+    free(hi);
+    if (!quantized)
+        ERROR("Failed to build the quantized copy of a kd-tree of %i points", N);
+    return quantized;
+}
+
 void kdtree_print(kdtree_t* kd) {
     printf("kdtree:\n");
     printf("  type 0x%x\n", kd->treetype);
@@ -1445,6 +1445,204 @@ kdtree_qres_t* MANGLE(kdtree_rangesearch_options)
 }
 
 
+//# Modified for the StellarSolver Internal Library, a range search for many query points in one traversal
+/*
+ Range search for the N query points in "vqueries" (N*D etypes) at once,
+ such as all of the codes that can be made from one quad.  The tree is
+ traversed once, and each node is visited with the list of queries that can
+ still have results under it, so the top of the tree is read once for all of
+ them and the leaves stay in the cache while each query checks them.
+
+ results[i] gets the results of query i: it is reused if it isn't NULL,
+ as in kdtree_rangesearch_options_reuse, otherwise it is allocated.  These
+ are the same results kdtree_rangesearch_options finds, but unless they are
+ sorted they may come in a different order.  Only the split values are used
+ to prune the tree, so a tree with only bounding boxes is searched one query
+ at a time.
+
+ Returns 0 on success, -1 if the results could not be allocated.
+ */
+int MANGLE(kdtree_rangesearch_batch)
+     (const kdtree_t* kd, kdtree_qres_t** results, const void* vqueries,
+      int N, double maxd2, int options)
+{
+    const etype* queries = vqueries;
+    int nodestack[100];
+    int liststack[100];     // where the list of queries of each node on the stack starts in "lists"
+    int countstack[100];    // and how many there are
+    int stackpos = 0;
+    int listtop = 0;
+    int* lists;
+    int* current;
+    int D;
+    int q;
+    double maxdist;
+    anbool do_dists;
+    anbool do_points = TRUE;
+
+    if (!kd || !queries || N <= 0)
+        return 0;
+#if defined(KD_DIM)
+    assert(kd->ndim == KD_DIM);
+    D = KD_DIM;
+#else
+    D = kd->ndim;
+#endif
+
+    if (!kd->split.any) {
+        for (q=0; q<N; q++) {
+            results[q] = MANGLE(kdtree_rangesearch_options)(kd, results[q], queries + q*D, maxd2, options);
+            if (!results[q])
+                return -1;
+        }
+        return 0;
+    }
+
+    if (options & KD_OPTIONS_SORT_DISTS)
+        options |= KD_OPTIONS_COMPUTE_DISTS;
+    do_dists = options & KD_OPTIONS_COMPUTE_DISTS;
+    maxdist = sqrt(maxd2);
+
+    for (q=0; q<N; q++) {
+        kdtree_qres_t* res = results[q];
+        if (res) {
+            resize_results(res, res->capacity ? res->capacity : KDTREE_MAX_RESULTS, D, do_dists, do_points);
+            res->nres = 0;
+        } else {
+            res = CALLOC(1, sizeof(kdtree_qres_t));
+            if (!res) {
+                SYSERROR("Failed to allocate kdtree_qres_t struct");
+                return -1;
+            }
+            resize_results(res, KDTREE_MAX_RESULTS, D, do_dists, do_points);
+            results[q] = res;
+        }
+    }
+
+    // Each node on the stack has a list of at most N queries.  The list of the
+    // node that gets popped is copied to "current", and its children's lists
+    // are written from where it started, the left one after the right one, so
+    // each level of the tree needs room for N more.
+    lists = malloc(sizeof(int) * N * (kd->nlevels + 2));
+    current = malloc(sizeof(int) * N);
+    if (!lists || !current) {
+        free(lists);
+        free(current);
+        SYSERROR("Failed to allocate the query lists");
+        return -1;
+    }
+
+    // queue root, with all of the queries.
+    for (q=0; q<N; q++)
+        lists[q] = q;
+    nodestack[0] = 0;
+    liststack[0] = 0;
+    countstack[0] = N;
+
+    while (stackpos >= 0) {
+        int nodeid = nodestack[stackpos];
+        int ncurrent = countstack[stackpos];
+        int k, i;
+
+        memcpy(current, lists + liststack[stackpos], sizeof(int) * ncurrent);
+        listtop = liststack[stackpos];
+        stackpos--;
+
+        if (KD_IS_LEAF(kd, nodeid)) {
+            int L = kdtree_left(kd, nodeid);
+            int R = kdtree_right(kd, nodeid);
+            for (k=0; k<ncurrent; k++) {
+                const etype* query = queries + current[k]*D;
+                kdtree_qres_t* res = results[current[k]];
+                for (i=L; i<=R; i++) {
+                    dtype* data = KD_DATA(kd, D, i);
+                    if (do_dists) {
+                        anbool bailedout = FALSE;
+                        double dsqd;
+                        dist2_bailout(kd, query, data, D, maxd2, &bailedout, &dsqd);
+                        if (bailedout)
+                            continue;
+                        if (!add_result(kd, res, dsqd, KD_PERM(kd, i), data, D, do_dists, do_points))
+                            goto bailout;
+                    } else {
+                        if (dist2_exceeds(kd, query, data, D, maxd2))
+                            continue;
+                        if (!add_result(kd, res, HUGE_VAL, KD_PERM(kd, i), data, D, do_dists, do_points))
+                            goto bailout;
+                    }
+                }
+            }
+            continue;
+        }
+
+        {
+            int dim = -1;
+            ttype split = *KD_SPLIT(kd, nodeid);
+            etype rsplit;
+            int* left;
+            int* right;
+            int nleft = 0, nright = 0;
+
+            if (kd->splitdim)
+                dim = kd->splitdim[nodeid];
+            else if (TTYPE_INTEGER) {
+                bigint tmpsplit;
+                tmpsplit = split;
+                dim = tmpsplit & kd->dimmask;
+                split = tmpsplit & kd->splitmask;
+            }
+            rsplit = POINT_TE(kd, dim, split);
+
+            // Split the queries between the children, each goes to the side
+            // it is on and also to the other one if the split is in range.
+            right = lists + listtop;
+            left = right + ncurrent;
+            for (k=0; k<ncurrent; k++) {
+                etype qd = queries[current[k]*D + dim];
+                if (qd < rsplit) {
+                    left[nleft++] = current[k];
+                    if (rsplit - qd <= maxdist)
+                        right[nright++] = current[k];
+                } else {
+                    right[nright++] = current[k];
+                    if (qd - rsplit <= maxdist)
+                        left[nleft++] = current[k];
+                }
+            }
+
+            // The left child is popped first.
+            if (nright) {
+                stackpos++;
+                nodestack[stackpos] = KD_CHILD_RIGHT(nodeid);
+                liststack[stackpos] = listtop;
+                countstack[stackpos] = nright;
+            }
+            if (nleft) {
+                stackpos++;
+                nodestack[stackpos] = KD_CHILD_LEFT(nodeid);
+                liststack[stackpos] = listtop + ncurrent;
+                countstack[stackpos] = nleft;
+            }
+        }
+    }
+
+    free(lists);
+    free(current);
+
+    for (q=0; q<N; q++) {
+        if (!(options & KD_OPTIONS_NO_RESIZE_RESULTS))
+            resize_results(results[q], results[q]->nres, D, do_dists, do_points);
+        if (options & KD_OPTIONS_SORT_DISTS)
+            kdtree_qsort_results(results[q], kd->ndim);
+    }
+    return 0;
+
+ bailout:
+    free(lists);
+    free(current);
+    return -1;
+}
+
 static void* get_data(const kdtree_t* kd, int i) {
     return KD_DATA(kd, kd->ndim, i);
 }
@@ -2261,7 +2459,9 @@ kdtree_t* MANGLE(kdtree_build_2)
             }
         }
     }
-    if (needs_data_conversion()) {
+    //# Modified for the StellarSolver Internal Library
+    // Integer trees of double data (ddu, dds) need the scale for their split values too.
+    if (needs_data_conversion() || TTYPE_INTEGER) {
         // compute scaling params
         if (!kd->minval || !kd->maxval) {
             free(kd->minval);
@@ -2271,6 +2471,8 @@ kdtree_t* MANGLE(kdtree_build_2)
             assert(kd->minval);
             assert(kd->maxval);
             kd->scale = compute_scale(kd->data.any, N, D, kd->minval, kd->maxval);
+            if (!DTYPE_INTEGER)
+                kd->scale = (double)TTYPE_MAX / maxrange(kd->minval, kd->maxval, D);
         } else {
             // limits were pre-set by the user.  just compute scale.
             double range;
@@ -2999,6 +3201,7 @@ void MANGLE(kdtree_update_funcs)(kdtree_t* kd) {
     kd->fun.fix_bounding_boxes = MANGLE(kdtree_fix_bounding_boxes);
     kd->fun.nearest_neighbour_internal = MANGLE(kdtree_nn);
     kd->fun.rangesearch = MANGLE(kdtree_rangesearch_options);
+    kd->fun.rangesearch_batch = MANGLE(kdtree_rangesearch_batch); //# Modified for the StellarSolver Internal Library
     kd->fun.nodes_contained = MANGLE(kdtree_nodes_contained);
 }
 
@@ -47,6 +47,12 @@ struct qfits_header {
     /* For efficient looping internally */
     void    *   current;
     int         current_idx;
+    //# Modified for the StellarSolver Internal Library
+    // The cards are also kept in a hashed table of their keys, so that looking up a key doesn't walk the whole list
+    // and compare every key on the way.  It holds the first card with each key, which is the card the walks found.
+    void    **  table;         /* Open addressing table of cards, NULL for an empty slot */
+    int         tablesize;     /* Number of slots, a power of 2, or 0 if there is no table yet */
+    int         tablecount;    /* Number of cards in the table */
 };
 
 
@@ -149,6 +155,10 @@ static void keytuple_del(keytuple *);
 //static void keytuple_dmp(const keytuple *);
 static keytype keytuple_type(const char *);
 static int qfits_header_makeline(char *, const keytuple *, int);
+//# Modified for the StellarSolver Internal Library
+static void header_table_insert(qfits_header *, keytuple *);
+static void header_table_rebuild(qfits_header *);
+static keytuple * header_table_find(const qfits_header *, const char *);
 
 /*----------------------------------------------------------------------------*/
 /**
@@ -202,6 +212,10 @@ qfits_header * qfits_header_new(void)
 
     h->current = NULL;
     h->current_idx = -1;
+    //# Modified for the StellarSolver Internal Library
+    h->table = NULL;
+    h->tablesize = 0;
+    h->tablecount = 0;
 
     return h;
 }
@@ -301,6 +315,8 @@ void qfits_header_add(
     k->prev = kbf;
 
     hdr->n ++;
+    //# Modified for the StellarSolver Internal Library, the card is only before END so a card with its key is still the first one
+    header_table_insert(hdr, k);
     return;
 }
 
@@ -336,11 +352,7 @@ void qfits_header_add_after(
 
     qfits_expand_keyword_r(after, exp_after);
     /* Locate where the entry is requested */
-    kreq = (keytuple*)(hdr->first);
-    while (kreq!=NULL) {
-        if (!strcmp(kreq->key, exp_after)) break;
-        kreq = kreq->next;
-    }
+    kreq = header_table_find(hdr, exp_after); //# Modified for the StellarSolver Internal Library
     if (kreq==NULL) return;
     k = keytuple_new(key, val, com, lin);
 
@@ -349,6 +361,8 @@ void qfits_header_add_after(
     kreq->next = k;
     k->prev = kreq;
     hdr->n ++;
+    //# Modified for the StellarSolver Internal Library, the card can be before another one with the same key
+    header_table_rebuild(hdr);
     return;
 }
 
@@ -379,6 +393,7 @@ void qfits_header_append(
     if (hdr==NULL || key==NULL) return;
 
     k = keytuple_new(key, val, com, lin);
+    header_table_insert(hdr, k); //# Modified for the StellarSolver Internal Library
     if (hdr->n==0) {
         hdr->first = hdr->last = k;
         hdr->n = 1;
@@ -411,11 +426,7 @@ void qfits_header_del(qfits_header * hdr, const char * key)
     if (hdr==NULL || key==NULL) return;
 
     qfits_expand_keyword_r(key, xkey);
-    k = (keytuple*)hdr->first;
-    while (k!=NULL) {
-        if (!strcmp(k->key, xkey)) break;
-        k = k->next;
-    }
+    k = header_table_find(hdr, xkey); //# Modified for the StellarSolver Internal Library
     if (k==NULL)
         return;
     if(k == hdr->first) {
@@ -425,6 +436,8 @@ void qfits_header_del(qfits_header * hdr, const char * key)
         k->next->prev = k->prev;
     }
     keytuple_del(k);
+    //# Modified for the StellarSolver Internal Library, the next card with the key becomes the first one
+    header_table_rebuild(hdr);
     return;
 }
 
@@ -454,11 +467,7 @@ void qfits_header_mod(
     if (hdr==NULL || key==NULL) return;
 
     qfits_expand_keyword_r(key, xkey);
-    k = (keytuple*)hdr->first;
-    while (k!=NULL) {
-        if (!strcmp(k->key, xkey)) break;
-        k=k->next;
-    }
+    k = header_table_find(hdr, xkey); //# Modified for the StellarSolver Internal Library
     if (k==NULL) return;
     
     if (k->val) qfits_free(k->val);
@@ -540,6 +549,7 @@ int qfits_header_sort(qfits_header ** hdr)
     /* Replace the input header by the sorted one */
     (*hdr)->first = (*hdr)->last = NULL;
     qfits_header_destroy(*hdr);
+    header_table_rebuild(sorted); //# Modified for the StellarSolver Internal Library
     *hdr = sorted;
     
     return 0;
@@ -593,6 +603,7 @@ void qfits_header_destroy(qfits_header * hdr)
         keytuple_del(k);
         k = kn;
     }
+    if (hdr->table) qfits_free(hdr->table); //# Modified for the StellarSolver Internal Library
     qfits_free(hdr);
     return;
 }
@@ -619,11 +630,7 @@ char * qfits_header_getstr(const qfits_header * hdr, const char * key)
     if (hdr==NULL || key==NULL) return NULL;
 
     qfits_expand_keyword_r(key, xkey);
-    k = (keytuple*)hdr->first;
-    while (k!=NULL) {
-        if (!strcmp(k->key, xkey)) break;
-        k=k->next;
-    }
+    k = header_table_find(hdr, xkey); //# Modified for the StellarSolver Internal Library
     if (k==NULL) return NULL;
     return k->val;
 }
@@ -776,7 +783,10 @@ int qfits_header_setitem(
         memcpy(k->lin, lin, 80);
     } else
         k->lin = NULL;
-        
+
+    //# Modified for the StellarSolver Internal Library, the key of the card can have changed
+    if (key)
+        header_table_rebuild(hdr);
     return 0;
 }
 
@@ -803,11 +813,7 @@ char * qfits_header_getcom(const qfits_header * hdr, const char * key)
     if (hdr==NULL || key==NULL) return NULL;
 
     qfits_expand_keyword_r(key, xkey);
-    k = (keytuple*)hdr->first;
-    while (k!=NULL) {
-        if (!strcmp(k->key, xkey)) break;
-        k=k->next;
-    }
+    k = header_table_find(hdr, xkey); //# Modified for the StellarSolver Internal Library
     if (k==NULL) return NULL;
     return k->com;
 }
@@ -1074,6 +1080,81 @@ static keytuple * keytuple_new(
 
  */
 /*----------------------------------------------------------------------------*/
+//# Modified for the StellarSolver Internal Library
+// The FNV-1a hash of a key
+static unsigned int header_key_hash(const char * key)
+{
+    unsigned int h = 2166136261u;
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// This puts a card in the slot of its key, unless an earlier card with the key is there already.  The table
+// is kept at most half full so the probes stay short.
+static void header_table_insert(qfits_header * hdr, keytuple * k)
+{
+    unsigned int mask;
+    unsigned int i;
+
+    if (k->key==NULL) return;
+    if (2 * (hdr->tablecount + 1) > hdr->tablesize) {
+        void ** old = hdr->table;
+        int oldsize = hdr->tablesize;
+        int j;
+        hdr->tablesize = oldsize ? 2 * oldsize : 64;
+        hdr->table = qfits_calloc(hdr->tablesize, sizeof(void*));
+        mask = hdr->tablesize - 1;
+        for (j=0; j<oldsize; j++) {
+            if (old[j]==NULL) continue;
+            i = header_key_hash(((keytuple*)old[j])->key) & mask;
+            while (hdr->table[i]!=NULL) i = (i + 1) & mask;
+            hdr->table[i] = old[j];
+        }
+        if (old) qfits_free(old);
+    }
+    mask = hdr->tablesize - 1;
+    i = header_key_hash(k->key) & mask;
+    while (hdr->table[i]!=NULL) {
+        if (!strcmp(((keytuple*)hdr->table[i])->key, k->key)) return;
+        i = (i + 1) & mask;
+    }
+    hdr->table[i] = k;
+    hdr->tablecount++;
+}
+
+// This makes the table again from the list, after cards were inserted in the middle of it, removed or changed
+static void header_table_rebuild(qfits_header * hdr)
+{
+    keytuple * k;
+
+    if (hdr->table) qfits_free(hdr->table);
+    hdr->table = NULL;
+    hdr->tablesize = 0;
+    hdr->tablecount = 0;
+    for (k = (keytuple*)hdr->first; k!=NULL; k = k->next)
+        header_table_insert(hdr, k);
+}
+
+// This finds the first card with an expanded key, or NULL
+static keytuple * header_table_find(const qfits_header * hdr, const char * xkey)
+{
+    unsigned int mask;
+    unsigned int i;
+
+    if (hdr->tablesize==0) return NULL;
+    mask = hdr->tablesize - 1;
+    i = header_key_hash(xkey) & mask;
+    while (hdr->table[i]!=NULL) {
+        keytuple * k = (keytuple*)hdr->table[i];
+        if (!strcmp(k->key, xkey)) return k;
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
 static keytype keytuple_type(const char * key)
 {
     keytype kt;
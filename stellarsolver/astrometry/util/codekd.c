@@ -5,12 +5,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "codekd.h"
 #include "kdtree_fits_io.h"
 #include "starutil.h"
 #include "errors.h"
 #include "log.h" //# Modified by Robert Lancaster for the StellarSolver Internal Library for logging
+#include "tic.h"
 
 static codetree_t* codetree_alloc() {
     codetree_t* s = calloc(1, sizeof(codetree_t));
@@ -98,10 +100,306 @@ int codetree_close(codetree_t* s) {
         qfits_header_destroy(s->header);
     if (s->tree)
         kdtree_fits_close(s->tree);
+    kdtree_free(s->compact); //# Modified for the StellarSolver Internal Library
+    codetree_free_shards(s); //# Modified for the StellarSolver Internal Library
+    codetree_free_bright(s); //# Modified for the StellarSolver Internal Library
     free(s);
     return 0;
 }
 
+//# Modified for the StellarSolver Internal Library
+// Searches "kd" for each of the "nq" codes and returns how long it took;
+// "nres" gets the total number of codes found.
+static double time_searches(const kdtree_t* kd, const double* codes, int D,
+                            int nq, int stride, double tol2, int* nres) {
+    int options = KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_COMPUTE_DISTS |
+        KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_USE_SPLIT;
+    kdtree_qres_t* res = NULL;
+    double t0;
+    int i;
+
+    *nres = 0;
+    t0 = timenow();
+    for (i=0; i<nq; i++) {
+        res = kdtree_rangesearch_options_reuse(kd, res, codes + (size_t)i * stride * D,
+                                               tol2, options);
+        if (res)
+            *nres += res->nres;
+    }
+    t0 = timenow() - t0;
+    kdtree_free_query(res);
+    return t0;
+}
+
+double codetree_compact(codetree_t* s, double codetol, size_t* nbytes) {
+    kdtree_t* kd = s->tree;
+    kdtree_t* compact;
+    double* data;
+    double* codes;
+    double tfile, tcompact;
+    int N, D, i, nq, stride, nfile, ncompact;
+
+    if (nbytes)
+        *nbytes = 0;
+    if (!kd || s->compact)
+        return 0;
+    if (kdtree_datatype(kd) != KDT_DATA_DOUBLE || kdtree_treetype(kd) == KDT_TREE_U16 ||
+        !kd->split.any)
+        return 0;
+
+    N = kd->ndata;
+    D = kd->ndim;
+    data = malloc((size_t)N * D * sizeof(double));
+    codes = malloc((size_t)N * D * sizeof(double));
+    if (!data || !codes) {
+        free(data);
+        free(codes);
+        return 0;
+    }
+    // The codes go back into their original order, so the copy finds the same code ids.
+    kdtree_copy_data_double(kd, 0, N, data);
+    for (i=0; i<N; i++) {
+        int orig = kd->perm ? kd->perm[i] : i;
+        memcpy(codes + (size_t)orig * D, data + (size_t)i * D, D * sizeof(double));
+    }
+    free(data);
+
+    compact = kdtree_build(NULL, codes, N, D, MAX(1, N / kd->nbottom),
+                           KDTT_DOUBLE_U16, KD_BUILD_SPLIT);
+    if (!compact) {
+        free(codes);
+        return 0;
+    }
+    compact->free_data = TRUE;
+
+    // Each tree is searched once before it is timed, so the pages of the file are mapped for both.
+    nq = MIN(N, 2000);
+    stride = MAX(1, N / nq);
+    time_searches(kd, compact->data.d, D, nq, stride, codetol * codetol, &nfile);
+    tfile = time_searches(kd, compact->data.d, D, nq, stride, codetol * codetol, &nfile);
+    time_searches(compact, compact->data.d, D, nq, stride, codetol * codetol, &ncompact);
+    tcompact = time_searches(compact, compact->data.d, D, nq, stride, codetol * codetol, &ncompact);
+
+    if (nfile != ncompact || tcompact <= 0 || tcompact >= tfile) {
+        if (nfile != ncompact)
+            debug("The compact code tree found %i codes instead of %i, it is not used.\n", ncompact, nfile);
+        kdtree_free(compact);
+        return (tcompact > 0 && nfile == ncompact) ? tfile / tcompact : 0;
+    }
+    if (nbytes)
+        *nbytes = kdtree_sizeof_data(compact) + kdtree_sizeof_split(compact) +
+            kdtree_sizeof_perm(compact) + kdtree_sizeof_lr(compact);
+    s->compact = compact;
+    return tfile / tcompact;
+}
+
+//# Modified for the StellarSolver Internal Library
+int codetree_quantize(codetree_t* s, size_t* nbytes) {
+    kdtree_t* quantized;
+
+    if (nbytes)
+        *nbytes = 0;
+    if (!s->tree || kdtree_datatype(s->tree) != KDT_DATA_DOUBLE)
+        return 0;
+    quantized = kdtree_quantize(s->tree, KDTT_DSS);
+    if (!quantized)
+        return 0;
+    // The 16-bit tree replaces the compact copy, it always has less memory to go through
+    kdtree_free(s->compact);
+    s->compact = quantized;
+    if (nbytes)
+        *nbytes = kdtree_sizeof_data(quantized) + kdtree_sizeof_split(quantized) +
+            kdtree_sizeof_perm(quantized) + kdtree_sizeof_lr(quantized);
+    return 1;
+}
+
+//# Modified for the StellarSolver Internal Library
+void codetree_free_shards(codetree_t* s) {
+    int i, ncells;
+    if (!s || !s->shards)
+        return;
+    ncells = 12 * s->shards->nside * s->shards->nside;
+    for (i=0; i<ncells; i++) {
+        kdtree_free(s->shards->trees[i]);
+        free(s->shards->quadids[i]);
+    }
+    free(s->shards->trees);
+    free(s->shards->quadids);
+    free(s->shards);
+    s->shards = NULL;
+}
+
+int codetree_shard(codetree_t* s, const int* cells, int nside, size_t* nbytes) {
+    kdtree_t* kd = s->tree;
+    codetree_shards_t* shards;
+    double* data;
+    double** codes = NULL;
+    int* counts = NULL;
+    int N, D, i, ncells, ntrees = 0;
+
+    if (nbytes)
+        *nbytes = 0;
+    if (!kd || s->shards || nside < 1)
+        return 0;
+    N = kd->ndata;
+    D = kd->ndim;
+    ncells = 12 * nside * nside;
+
+    shards = calloc(1, sizeof(codetree_shards_t));
+    data = malloc((size_t)N * D * sizeof(double));
+    codes = calloc(ncells, sizeof(double*));
+    counts = calloc(ncells, sizeof(int));
+    if (!shards || !data || !codes || !counts)
+        goto bailout;
+    shards->nside = nside;
+    shards->trees = calloc(ncells, sizeof(kdtree_t*));
+    shards->quadids = calloc(ncells, sizeof(int*));
+    if (!shards->trees || !shards->quadids)
+        goto bailout;
+
+    // The codes are in the order of the tree, perm gives the quad of each one.
+    kdtree_copy_data_double(kd, 0, N, data);
+    for (i=0; i<N; i++) {
+        int quad = kd->perm ? kd->perm[i] : i;
+        if (cells[quad] < 0 || cells[quad] >= ncells) {
+            debug("Code %i has healpix %i, out of range for nside %i.\n", quad, cells[quad], nside);
+            goto bailout;
+        }
+        counts[cells[quad]]++;
+    }
+    for (i=0; i<ncells; i++) {
+        if (!counts[i])
+            continue;
+        shards->quadids[i] = malloc(counts[i] * sizeof(int));
+        codes[i] = malloc((size_t)counts[i] * D * sizeof(double));
+        if (!shards->quadids[i] || !codes[i])
+            goto bailout;
+        counts[i] = 0;
+    }
+    // The codes of each healpix are copied out in the order of the tree, so
+    // each tree is built from codes that are already mostly sorted.
+    for (i=0; i<N; i++) {
+        int quad = kd->perm ? kd->perm[i] : i;
+        int cell = cells[quad];
+        memcpy(codes[cell] + (size_t)counts[cell] * D, data + (size_t)i * D, D * sizeof(double));
+        shards->quadids[cell][counts[cell]++] = quad;
+    }
+    free(data);
+    data = NULL;
+
+    for (i=0; i<ncells; i++) {
+        int n = counts[i];
+        kdtree_t* tree;
+        if (!n)
+            continue;
+        // The leaves get as many codes as the leaves of the whole tree.
+        tree = kdtree_build(NULL, codes[i], n, D, MAX(1, N / MAX(1, kd->nbottom)),
+                            KDTT_DOUBLE, KD_BUILD_SPLIT);
+        if (!tree)
+            goto bailout;
+        tree->free_data = TRUE;
+        codes[i] = NULL;
+        shards->trees[i] = tree;
+        ntrees++;
+        if (nbytes)
+            *nbytes += kdtree_sizeof_data(tree) + kdtree_sizeof_split(tree) +
+                kdtree_sizeof_perm(tree) + kdtree_sizeof_lr(tree) + n * sizeof(int);
+    }
+    free(codes);
+    free(counts);
+    s->shards = shards;
+    return ntrees;
+
+ bailout:
+    if (codes)
+        for (i=0; i<ncells; i++)
+            free(codes[i]);
+    free(codes);
+    free(data);
+    free(counts);
+    if (shards && (!shards->trees || !shards->quadids)) {
+        free(shards->trees);
+        free(shards->quadids);
+        free(shards);
+    } else if (shards) {
+        s->shards = shards;
+        codetree_free_shards(s);
+    }
+    if (nbytes)
+        *nbytes = 0;
+    return 0;
+}
+
+void codetree_free_bright(codetree_t* s) {
+    if (!s || !s->bright)
+        return;
+    kdtree_free(s->bright->tree);
+    free(s->bright->quadids);
+    free(s->bright);
+    s->bright = NULL;
+}
+
+int codetree_bright(codetree_t* s, const anbool* keep, size_t* nbytes) {
+    kdtree_t* kd = s->tree;
+    codetree_subset_t* bright;
+    double* data;
+    double* codes;
+    int N, D, i, n = 0;
+
+    if (nbytes)
+        *nbytes = 0;
+    if (!kd || s->bright)
+        return 0;
+    N = kd->ndata;
+    D = kd->ndim;
+    for (i=0; i<N; i++)
+        if (keep[kd->perm ? kd->perm[i] : i])
+            n++;
+    if (!n)
+        return 0;
+
+    bright = calloc(1, sizeof(codetree_subset_t));
+    data = malloc((size_t)N * D * sizeof(double));
+    codes = malloc((size_t)n * D * sizeof(double));
+    if (bright)
+        bright->quadids = malloc(n * sizeof(int));
+    if (!bright || !bright->quadids || !data || !codes) {
+        if (bright)
+            free(bright->quadids);
+        free(bright);
+        free(data);
+        free(codes);
+        return 0;
+    }
+    // The codes are copied out in the order of the tree, like those of the
+    // shards, so the tree is built from codes that are mostly sorted.
+    kdtree_copy_data_double(kd, 0, N, data);
+    n = 0;
+    for (i=0; i<N; i++) {
+        int quad = kd->perm ? kd->perm[i] : i;
+        if (!keep[quad])
+            continue;
+        memcpy(codes + (size_t)n * D, data + (size_t)i * D, D * sizeof(double));
+        bright->quadids[n++] = quad;
+    }
+    free(data);
+
+    bright->tree = kdtree_build(NULL, codes, n, D, MAX(1, N / MAX(1, kd->nbottom)),
+                                KDTT_DOUBLE, KD_BUILD_SPLIT);
+    if (!bright->tree) {
+        free(codes);
+        free(bright->quadids);
+        free(bright);
+        return 0;
+    }
+    bright->tree->free_data = TRUE;
+    s->bright = bright;
+    if (nbytes)
+        *nbytes = kdtree_sizeof_data(bright->tree) + kdtree_sizeof_split(bright->tree) +
+            kdtree_sizeof_perm(bright->tree) + kdtree_sizeof_lr(bright->tree) + n * sizeof(int);
+    return n;
+}
+
 static int Ndata(codetree_t* s) {
     return s->tree->ndata;
 }
@@ -20,6 +20,104 @@
 #include "gslutils.h"
 #include "sip-utils.h"
 
+//# Modified for the StellarSolver Internal Library, this is the end of fit_sip_wcs, shared with fit_sip_wcs_cached.
+// x1 and x2 are the solutions of the x and y least squares problems.
+// The inverse polynomials are fit with fit_sip_cache_inverse if there is a cache.
+static int fit_sip_cache_inverse(fit_sip_cache_t* cache, sip_t* sip);
+
+static void fit_sip_apply(const double* x1, const double* x2,
+                          int sip_order, int doshift,
+                          fit_sip_cache_t* cache, sip_t* sipout) {
+    double cdinv[2][2];
+    double sx = 0, sy = 0, sU, sV, su, sv;
+    int i, j, p, q, order;
+    VarUnused int N = (sip_order + 1) * (sip_order + 2) / 2;
+
+    // Row 0 of X are the shift (p=0, q=0) terms.
+    // Row 1 of X are the terms that multiply "u".
+    // Row 2 of X are the terms that multiply "v".
+
+    if (doshift) {
+        // Grab CD.
+        sipout->wcstan.cd[0][0] = x1[1];
+        sipout->wcstan.cd[0][1] = x1[2];
+        sipout->wcstan.cd[1][0] = x2[1];
+        sipout->wcstan.cd[1][1] = x2[2];
+
+        // Compute inv(CD)
+        i = invert_2by2_arr((const double*)(sipout->wcstan.cd),
+                            (double*)cdinv);
+        assert(i == 0);
+
+        // Grab the shift.
+        sx = x1[0];
+        sy = x2[0];
+
+    } else {
+        // Compute inv(CD)
+        i = invert_2by2_arr((const double*)(sipout->wcstan.cd),
+                            (double*)cdinv);
+        assert(i == 0);
+    }
+
+    // Extract the SIP coefficients.
+    //  (this includes the 0 and 1 order terms, which we later overwrite)
+    j = 0;
+    for (order=0; order<=sip_order; order++) {
+        for (q=0; q<=order; q++) {
+            p = order - q;
+            assert(j >= 0);
+            assert(j < N);
+            assert(p >= 0);
+            assert(q >= 0);
+            assert(p + q <= sip_order);
+
+            sipout->a[p][q] =
+                cdinv[0][0] * x1[j] +
+                cdinv[0][1] * x2[j];
+
+            sipout->b[p][q] =
+                cdinv[1][0] * x1[j] +
+                cdinv[1][1] * x2[j];
+            j++;
+        }
+    }
+    assert(j == N);
+
+    if (doshift) {
+        // We have already dealt with the shift and linear terms, so zero them out
+        // in the SIP coefficient matrix.
+        sipout->a[0][0] = 0.0;
+        sipout->a[0][1] = 0.0;
+        sipout->a[1][0] = 0.0;
+        sipout->b[0][0] = 0.0;
+        sipout->b[0][1] = 0.0;
+        sipout->b[1][0] = 0.0;
+    }
+
+    if (!cache || fit_sip_cache_inverse(cache, sipout))
+        sip_compute_inverse_polynomials(sipout, 0, 0, 0, 0, 0, 0);
+
+    if (doshift) {
+        sU =
+            cdinv[0][0] * sx +
+            cdinv[0][1] * sy;
+        sV =
+            cdinv[1][0] * sx +
+            cdinv[1][1] * sy;
+        logverb("Applying shift of sx,sy = %g,%g deg (%g,%g pix) to CRVAL and CD.\n",
+                sx, sy, sU, sV);
+
+        sip_calc_inv_distortion(sipout, sU, sV, &su, &sv);
+
+        debug("sx = %g, sy = %g\n", sx, sy);
+        debug("sU = %g, sV = %g\n", sU, sV);
+        debug("su = %g, sv = %g\n", su, sv);
+
+        wcs_shift(&(sipout->wcstan), -su, -sv);
+    }
+}
+
 int fit_sip_wcs_2(const double* starxyz,
                   const double* fieldxy,
                   const double* weights,
@@ -84,8 +182,6 @@ int fit_sip_wcs(const double* starxyz,
                 sip_t* sipout) {
     int sip_coeffs;
     double xyzcrval[3];
-    double cdinv[2][2];
-    double sx, sy, sU, sV, su, sv;
     int N;
     int i, j, p, q, order;
     double totalweight;
@@ -326,107 +422,309 @@ int fit_sip_wcs(const double* starxyz,
         return -1;
     }
 
-    // Row 0 of X are the shift (p=0, q=0) terms.
-    // Row 1 of X are the terms that multiply "u".
-    // Row 2 of X are the terms that multiply "v".
+    fit_sip_apply(x1->data, x2->data, sip_order, doshift, NULL, sipout);
 
-    if (doshift) {
-        // Grab CD.
-        sipout->wcstan.cd[0][0] = gsl_vector_get(x1, 1);
-        sipout->wcstan.cd[0][1] = gsl_vector_get(x1, 2);
-        sipout->wcstan.cd[1][0] = gsl_vector_get(x2, 1);
-        sipout->wcstan.cd[1][1] = gsl_vector_get(x2, 2);
+    if (r1)
+        gsl_vector_free(r1);
+    if (r2)
+        gsl_vector_free(r2);
 
-        // Compute inv(CD)
-        i = invert_2by2_arr((const double*)(sipout->wcstan.cd),
-                            (double*)cdinv);
-        assert(i == 0);
+    gsl_matrix_free(mA);
+    gsl_vector_free(b1);
+    gsl_vector_free(b2);
+    gsl_vector_free(x1);
+    gsl_vector_free(x2);
 
-        // Grab the shift.
-        sx = gsl_vector_get(x1, 0);
-        sy = gsl_vector_get(x2, 0);
+    return 0;
+}
 
-    } else {
-        // Compute inv(CD)
-        i = invert_2by2_arr((const double*)(sipout->wcstan.cd),
-                            (double*)cdinv);
-        assert(i == 0);
+
+
+
+
+//# Modified for the StellarSolver Internal Library, the cached fit used by tweak2.
+void fit_sip_cache_init(fit_sip_cache_t* cache, const double* fieldxy,
+                        int Nfield, int W, int H) {
+    int i;
+    memset(cache, 0, sizeof(fit_sip_cache_t));
+    cache->fieldxy = fieldxy;
+    cache->Nfield = Nfield;
+    cache->sip_order = -1;
+    cache->inv_order = -1;
+    cache->scale = 0.5 * MAX(W, H);
+    if (cache->scale <= 0) {
+        for (i=0; i<2*Nfield; i++)
+            cache->scale = MAX(cache->scale, fabs(fieldxy[i]));
     }
+    if (cache->scale <= 0)
+        cache->scale = 1.0;
+}
 
-    // Extract the SIP coefficients.
-    //  (this includes the 0 and 1 order terms, which we later overwrite)
-    j = 0;
-    for (order=0; order<=sip_order; order++) {
-        for (q=0; q<=order; q++) {
-            p = order - q;
-            assert(j >= 0);
-            assert(j < N);
-            assert(p >= 0);
-            assert(q >= 0);
-            assert(p + q <= sip_order);
+void fit_sip_cache_free(fit_sip_cache_t* cache) {
+    free(cache->terms);
+    free(cache->ata);
+    free(cache->atb);
+    free(cache->inv_ata);
+    free(cache->inv_atb);
+    cache->terms = cache->ata = cache->atb = NULL;
+    cache->inv_ata = cache->inv_atb = NULL;
+    cache->sip_order = cache->inv_order = -1;
+}
 
-            sipout->a[p][q] =
-                cdinv[0][0] * gsl_vector_get(x1, j) +
-                cdinv[0][1] * gsl_vector_get(x2, j);
+static void fit_sip_cache_terms(fit_sip_cache_t* cache, int sip_order,
+                                const double* crpix) {
+    int N = (sip_order + 1) * (sip_order + 2) / 2;
+    int i, q, order;
+    if (cache->sip_order == sip_order &&
+        cache->crpix[0] == crpix[0] && cache->crpix[1] == crpix[1])
+        return;
+    if (cache->sip_order != sip_order) {
+        free(cache->terms);
+        free(cache->ata);
+        free(cache->atb);
+        cache->terms = malloc((size_t)cache->Nfield * N * sizeof(double));
+        cache->ata = malloc((size_t)N * N * sizeof(double));
+        cache->atb = malloc(2 * (size_t)N * sizeof(double));
+    }
+    cache->sip_order = sip_order;
+    cache->crpix[0] = crpix[0];
+    cache->crpix[1] = crpix[1];
+    // Same order as the columns of fit_sip_wcs, built up by multiplying
+    // instead of with pow().
+    for (i=0; i<cache->Nfield; i++) {
+        double* t = cache->terms + (size_t)i * N;
+        double u = (cache->fieldxy[2*i + 0] - crpix[0]) / cache->scale;
+        double v = (cache->fieldxy[2*i + 1] - crpix[1]) / cache->scale;
+        int j = 0, prev = 0;
+        t[j++] = 1.0;
+        for (order=1; order<=sip_order; order++) {
+            // The terms of the order before start at prev: u^(order-1) first.
+            for (q=0; q<order; q++)
+                t[j++] = t[prev + q] * u;
+            t[j++] = t[prev + order - 1] * v;
+            prev += order;
+        }
+    }
+}
 
-            sipout->b[p][q] =
-                cdinv[1][0] * gsl_vector_get(x1, j) +
-                cdinv[1][1] * gsl_vector_get(x2, j);
-            j++;
+// Solves A x = b for the nb right hand sides in b, where A is symmetric
+// positive definite with its upper triangle in "a" (row-major, n x n).
+// "a" and "b" are overwritten.  Returns -1 if A is not positive definite.
+static int cholesky_solve(double* a, int n, double* b, int nb) {
+    int i, j, k, r;
+    for (j=0; j<n; j++) {
+        double d = a[j*n + j];
+        for (k=0; k<j; k++)
+            d -= a[k*n + j] * a[k*n + j];
+        if (!(d > 1e-13 * a[j*n + j]))
+            return -1;
+        d = sqrt(d);
+        a[j*n + j] = d;
+        for (i=j+1; i<n; i++) {
+            double s = a[j*n + i];
+            for (k=0; k<j; k++)
+                s -= a[k*n + j] * a[k*n + i];
+            a[j*n + i] = s / d;
         }
     }
-    assert(j == N);
+    for (r=0; r<nb; r++) {
+        double* x = b + r*n;
+        for (i=0; i<n; i++) {
+            double s = x[i];
+            for (k=0; k<i; k++)
+                s -= a[k*n + i] * x[k];
+            x[i] = s / a[i*n + i];
+        }
+        for (i=n-1; i>=0; i--) {
+            double s = x[i];
+            for (k=i+1; k<n; k++)
+                s -= a[i*n + k] * x[k];
+            x[i] = s / a[i*n + i];
+        }
+    }
+    return 0;
+}
 
-    if (doshift) {
-        // We have already dealt with the shift and linear terms, so zero them out
-        // in the SIP coefficient matrix.
-        sipout->a[0][0] = 0.0;
-        sipout->a[0][1] = 0.0;
-        sipout->a[1][0] = 0.0;
-        sipout->b[0][0] = 0.0;
-        sipout->b[0][1] = 0.0;
-        sipout->b[1][0] = 0.0;
+// The same fit as sip_compute_inverse_polynomials(sip, 0, 0, 0, 0, 0, 0),
+// through the normal equations.  Returns -1 if they are singular.
+static int fit_sip_cache_inverse(fit_sip_cache_t* cache, sip_t* sip) {
+    int inv_order = sip->ap_order;
+    int N = (inv_order + 1) * (inv_order + 2) / 2;
+    int NX = 10 * (inv_order + 1);
+    int NY = 10 * (inv_order + 1);
+    double minu = 0 - sip->wcstan.crpix[0];
+    double maxu = sip->wcstan.imagew - sip->wcstan.crpix[0];
+    double minv = 0 - sip->wcstan.crpix[1];
+    double maxv = sip->wcstan.imageh - sip->wcstan.crpix[1];
+    double Up[SIP_MAXORDER], Vp[SIP_MAXORDER];
+    double t[(SIP_MAXORDER + 1) * (SIP_MAXORDER + 2) / 2];
+    double *ata, *atb;
+    int gu, gv, a, b, p, q;
+
+    assert(sip->ap_order == sip->bp_order);
+    if (inv_order < 0 || inv_order >= SIP_MAXORDER)
+        return -1;
+    if (cache->inv_order != inv_order) {
+        free(cache->inv_ata);
+        free(cache->inv_atb);
+        cache->inv_ata = malloc((size_t)N * N * sizeof(double));
+        cache->inv_atb = malloc(2 * (size_t)N * sizeof(double));
+        cache->inv_order = inv_order;
+    }
+    ata = cache->inv_ata;
+    atb = cache->inv_atb;
+    memset(ata, 0, (size_t)N * N * sizeof(double));
+    memset(atb, 0, 2 * (size_t)N * sizeof(double));
+
+    for (gu=0; gu<NX; gu++) {
+        for (gv=0; gv<NY; gv++) {
+            double u = (gu * (maxu - minu) / (NX-1)) + minu;
+            double v = (gv * (maxv - minv) / (NY-1)) + minv;
+            double U, V, fuv, guv;
+            sip_calc_distortion(sip, u, v, &U, &V);
+            fuv = U - u;
+            guv = V - v;
+            Up[0] = Vp[0] = 1.0;
+            for (p=1; p<=inv_order; p++) {
+                Up[p] = Up[p-1] * U / cache->scale;
+                Vp[p] = Vp[p-1] * V / cache->scale;
+            }
+            // Same order as sip_compute_inverse_polynomials
+            a = 0;
+            for (p=0; p<=inv_order; p++)
+                for (q=0; q<=inv_order-p; q++)
+                    t[a++] = Up[p] * Vp[q];
+            for (a=0; a<N; a++) {
+                double* row = ata + a*N;
+                atb[a]     -= t[a] * fuv;
+                atb[N + a] -= t[a] * guv;
+                for (b=a; b<N; b++)
+                    row[b] += t[a] * t[b];
+            }
+        }
     }
+    if (cholesky_solve(ata, N, atb, 2))
+        return -1;
 
-    sip_compute_inverse_polynomials(sipout, 0, 0, 0, 0, 0, 0);
+    a = 0;
+    for (p=0; p<=inv_order; p++)
+        for (q=0; q<=inv_order-p; q++) {
+            double f = pow(cache->scale, -(p + q));
+            sip->ap[p][q] = atb[a] * f;
+            sip->bp[p][q] = atb[N + a] * f;
+            a++;
+        }
+    return 0;
+}
 
-    if (doshift) {
-        sU =
-            cdinv[0][0] * sx +
-            cdinv[0][1] * sy;
-        sV =
-            cdinv[1][0] * sx +
-            cdinv[1][1] * sy;
-        logverb("Applying shift of sx,sy = %g,%g deg (%g,%g pix) to CRVAL and CD.\n",
-                sx, sy, sU, sV);
+int fit_sip_wcs_cached(const double* starxyz,
+                       const int* fieldinds,
+                       const double* weights,
+                       int M,
+                       const tan_t* tanin1,
+                       int sip_order,
+                       int inv_order,
+                       int doshift,
+                       fit_sip_cache_t* cache,
+                       sip_t* sipout) {
+    double xyzcrval[3];
+    double totalweight = 0.0;
+    double *ata, *atb;
+    int N, i, a, b, ngood, order, q;
+    tan_t tanin;
 
-        sip_calc_inv_distortion(sipout, sU, sV, &su, &sv);
+    if (sip_order < 1)
+        sip_order = 1;
+    N = (sip_order + 1) * (sip_order + 2) / 2;
+    if (M < N) {
+        ERROR("Too few correspondences for the SIP order specified (%i < %i)\n", M, N);
+        return -1;
+    }
 
-        debug("sx = %g, sy = %g\n", sx, sy);
-        debug("sU = %g, sV = %g\n", sU, sV);
-        debug("su = %g, sv = %g\n", su, sv);
+    // tanin1 may be &(sipout->wcstan)
+    memcpy(&tanin, tanin1, sizeof(tan_t));
+    fit_sip_cache_terms(cache, sip_order, tanin.crpix);
+    ata = cache->ata;
+    atb = cache->atb;
+    memset(ata, 0, (size_t)N * N * sizeof(double));
+    memset(atb, 0, 2 * (size_t)N * sizeof(double));
+
+    // Accumulate the normal equations of the weighted least squares
+    // problems of fit_sip_wcs: each row is weighted by "weight", so the
+    // normal equations are weighted by weight^2.
+    radecdeg2xyzarr(tanin.crval[0], tanin.crval[1], xyzcrval);
+    ngood = 0;
+    for (i=0; i<M; i++) {
+        double x=0, y=0;
+        double w2 = 1.0;
+        const double* t;
+        if (!star_coords(starxyz + 3*i, xyzcrval, TRUE, &x, &y)) {
+            logverb("Skipping star that cannot be projected to tangent plane\n");
+            continue;
+        }
+        if (weights) {
+            assert(weights[i] >= 0.0);
+            assert(weights[i] <= 1.0);
+            totalweight += weights[i];
+            if (weights[i] == 0.0)
+                continue;
+            w2 = weights[i] * weights[i];
+        }
+        x = rad2deg(x);
+        y = rad2deg(y);
+        t = cache->terms + (size_t)fieldinds[i] * N;
+        for (a=0; a<N; a++) {
+            double wt = w2 * t[a];
+            double* row = ata + a*N;
+            atb[a]     += wt * x;
+            atb[N + a] += wt * y;
+            for (b=a; b<N; b++)
+                row[b] += wt * t[b];
+        }
+        ngood++;
+    }
+    if (ngood == 0) {
+        ERROR("No stars projected within the image\n");
+        return -1;
+    }
+    if (weights)
+        logverb("Total weight: %g\n", totalweight);
 
-        wcs_shift(&(sipout->wcstan), -su, -sv);
+    if (ngood < N || cholesky_solve(ata, N, atb, 2)) {
+        // Let the QR decomposition deal with it.
+        double* fieldxy = malloc(2 * (size_t)M * sizeof(double));
+        int rtn;
+        logverb("Normal equations are singular; using the QR fit\n");
+        for (i=0; i<M; i++) {
+            fieldxy[2*i + 0] = cache->fieldxy[2*fieldinds[i] + 0];
+            fieldxy[2*i + 1] = cache->fieldxy[2*fieldinds[i] + 1];
+        }
+        rtn = fit_sip_wcs(starxyz, fieldxy, weights, M, &tanin,
+                          sip_order, inv_order, doshift, sipout);
+        free(fieldxy);
+        return rtn;
     }
 
-    if (r1)
-        gsl_vector_free(r1);
-    if (r2)
-        gsl_vector_free(r2);
+    // Undo the scaling of the pixel offsets.
+    a = 0;
+    for (order=0; order<=sip_order; order++) {
+        double f = pow(cache->scale, -order);
+        for (q=0; q<=order; q++) {
+            atb[a]     *= f;
+            atb[N + a] *= f;
+            a++;
+        }
+    }
 
-    gsl_matrix_free(mA);
-    gsl_vector_free(b1);
-    gsl_vector_free(b2);
-    gsl_vector_free(x1);
-    gsl_vector_free(x2);
+    memset(sipout, 0, sizeof(sip_t));
+    memcpy(&(sipout->wcstan), &tanin, sizeof(tan_t));
+    sipout->a_order  = sipout->b_order  = sip_order;
+    sipout->ap_order = sipout->bp_order = inv_order;
 
+    fit_sip_apply(atb, atb + N, sip_order, doshift, cache, sipout);
     return 0;
 }
 
-
-
-
-
 int fit_sip_coefficients(const double* starxyz,
                          const double* fieldxy,
                          const double* weights,
@@ -997,6 +997,27 @@ int xyzarrtohealpixf(const double* xyz,int Nside, double* p_dx, double* p_dy) {
     return xyztohealpixf(xyz[0], xyz[1], xyz[2], Nside, p_dx, p_dy);
 }
 
+//# Modified for the StellarSolver Internal Library
+void xyzarrtohealpixmany(const double* xyz, int n, int Nside, int* hps) {
+    int i;
+    for (i=0; i<n; i++) {
+        hp_t hp = xyztohp(xyz[3*i + 0], xyz[3*i + 1], xyz[3*i + 2], Nside, NULL, NULL);
+        hps[i] = hptoint(hp, Nside);
+    }
+}
+
+//# Modified for the StellarSolver Internal Library
+// The points are converted to xyz a block at a time, in a loop that can be vectorized
+void radecdegarrtohealpixmany(const double* radec, int n, int Nside, int* hps) {
+    double xyz[3 * 256];
+    int i, nblock;
+    for (i=0; i<n; i+=nblock) {
+        nblock = MIN(256, n - i);
+        radecdegarr2xyzarrmany(radec + 2*i, xyz, nblock);
+        xyzarrtohealpixmany(xyz, nblock, Nside, hps + i);
+    }
+}
+
 static void hp_to_xyz(hp_t* hp, int Nside,
                       double dx, double dy, 
                       double* rx, double *ry, double *rz) {
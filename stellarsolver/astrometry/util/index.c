@@ -3,6 +3,8 @@
  # Licensed under a 3-clause BSD style license - see LICENSE
  */
 
+#include <math.h> //# Modified for the StellarSolver Internal Library
+
 #include "index.h"
 #include "log.h"
 #include "errors.h"
@@ -13,6 +15,7 @@
 #include "anqfits.h"
 #include "qfits_rw.h"
 #include "starutil.h"
+#include "ssindex.h" //# Modified for the StellarSolver Internal Library
 
 anbool index_overlaps_scale_range(index_t* meta,
                                   double quadlo, double quadhi) {
@@ -136,6 +139,9 @@ anbool index_is_file_index(const char* filename) {
     //index_t meta;
     anbool rtn = TRUE;
 
+    if (ssindex_is_file(filename)) //# Modified for the StellarSolver Internal Library
+        return TRUE;
+
     get_filenames(filename, &quadfn, &ckdtfn, &skdtfn, &singlefile);
     if (!file_readable(quadfn)) {
         ERROR("Index file %s is not readable.", quadfn);
@@ -191,6 +197,36 @@ int index_get_meta(const char* filename, index_t* meta) {
     return 0;
 }
 
+//# Modified for the StellarSolver Internal Library
+index_t* index_from_metadata(const char* indexname, const index_t* meta) {
+    anbool singlefile;
+    index_t* dest = calloc(1, sizeof(index_t));
+
+    get_filenames(indexname, &(dest->quadfn), &(dest->codefn), &(dest->starfn),
+                  &singlefile);
+    // index_load names the index after its quad file.
+    dest->indexname = strdup(dest->quadfn);
+
+    dest->indexid = meta->indexid;
+    dest->healpix = meta->healpix;
+    dest->hpnside = meta->hpnside;
+    dest->index_jitter = meta->index_jitter;
+    dest->cutnside = meta->cutnside;
+    dest->cutnsweep = meta->cutnsweep;
+    dest->cutdedup = meta->cutdedup;
+    dest->cutband = strdup_safe(meta->cutband);
+    dest->cutmargin = meta->cutmargin;
+    dest->circle = meta->circle;
+    dest->cx_less_than_dx = meta->cx_less_than_dx;
+    dest->meanx_less_than_half = meta->meanx_less_than_half;
+    dest->index_scale_upper = meta->index_scale_upper;
+    dest->index_scale_lower = meta->index_scale_lower;
+    dest->dimquads = meta->dimquads;
+    dest->nstars = meta->nstars;
+    dest->nquads = meta->nquads;
+    return dest;
+}
+
 int index_get_missing_cut_params(int indexid, int* hpnside, int* nsweep,
                                  double* dedup, int* margin, char** pband) {
     // The 200-series indices use cut 100 (usnob)
@@ -334,6 +370,117 @@ index_t* index_build_from(codetree_t* codekd, quadfile_t* quads, startree_t* sta
     return index;
 }
 
+//# Modified for the StellarSolver Internal Library
+int index_shard_codes(index_t* index, int nside, size_t* nbytes) {
+    unsigned int stars[DQMAX];
+    double xyz[3 * 256];
+    int* cells;
+    int i, j, N, ntrees;
+
+    if (nbytes)
+        *nbytes = 0;
+    if (!index->codekd || !index->quads || !index->starkd)
+        return 0;
+    if (index->codekd->shards)
+        return 0;
+    N = index_nquads(index);
+    if (N <= 0 || codetree_N(index->codekd) != N)
+        return 0;
+    if (!nside) {
+        // About 4096 quads in each healpix.
+        nside = (int)sqrt(N / (12.0 * 4096.0));
+        if (nside < 2)
+            return 0;
+        nside = MIN(nside, 32);
+    }
+    cells = malloc(N * sizeof(int));
+    if (!cells)
+        return 0;
+    // The first stars of the quads are looked up a block at a time, and the
+    // healpixes of the block are found in one loop
+    for (i=0; i<N; i+=256) {
+        int nblock = MIN(256, N - i);
+        for (j=0; j<nblock; j++) {
+            if (quadfile_get_stars(index->quads, i + j, stars) ||
+                startree_get(index->starkd, stars[0], xyz + 3*j)) {
+                free(cells);
+                return 0;
+            }
+        }
+        xyzarrtohealpixmany(xyz, nblock, nside, cells + i);
+    }
+    ntrees = codetree_shard(index->codekd, cells, nside, nbytes);
+    free(cells);
+    if (ntrees)
+        debug("Split the %i codes of %s over %i healpixes of nside %i.\n",
+              N, index->indexname, ntrees, nside);
+    return ntrees;
+}
+
+//# Modified for the StellarSolver Internal Library
+int index_bright_codes(index_t* index, double fraction, size_t* nbytes) {
+    unsigned int stars[DQMAX];
+    int counts[257];
+    int* sweeps;
+    anbool* keep;
+    int i, j, N, n, quota, cut, ncodes;
+
+    if (nbytes)
+        *nbytes = 0;
+    if (!index->codekd || !index->quads || !index->starkd)
+        return 0;
+    if (index->codekd->bright)
+        return 0;
+    N = index_nquads(index);
+    if (N <= 0 || codetree_N(index->codekd) != N || fraction <= 0 || fraction >= 1)
+        return 0;
+    quota = MAX(1, (int)(N * fraction));
+
+    // The sweep of the faintest star of each quad, 0 to 255, or 256 without sweeps
+    sweeps = malloc(N * sizeof(int));
+    keep = calloc(N, sizeof(anbool));
+    if (!sweeps || !keep) {
+        free(sweeps);
+        free(keep);
+        return 0;
+    }
+    memset(counts, 0, sizeof(counts));
+    for (i=0; i<N; i++) {
+        int faintest = 0;
+        if (quadfile_get_stars(index->quads, i, stars)) {
+            free(sweeps);
+            free(keep);
+            return 0;
+        }
+        for (j=0; j<index->dimquads; j++) {
+            int sweep = startree_get_sweep(index->starkd, stars[j]);
+            faintest = MAX(faintest, sweep < 0 ? 256 : sweep);
+        }
+        sweeps[i] = faintest;
+        counts[faintest]++;
+    }
+    // The quads of the sweeps below the cut are all kept, and those of the
+    // cut until there are enough, in the order they were built
+    n = 0;
+    for (cut=0; cut<256 && n + counts[cut] < quota; cut++)
+        n += counts[cut];
+    for (i=0; i<N; i++) {
+        if (sweeps[i] < cut)
+            keep[i] = TRUE;
+        else if (sweeps[i] == cut && n < quota) {
+            keep[i] = TRUE;
+            n++;
+        }
+    }
+    free(sweeps);
+    ncodes = codetree_bright(index->codekd, keep, nbytes);
+    free(keep);
+    if (ncodes)
+        debug("Kept the %i codes of the brightest quads of %s in their own tree.\n",
+              ncodes, index->indexname);
+    return ncodes;
+}
+
 index_t* index_load(const char* indexname, int flags, index_t* dest) {
     index_t* allocd = NULL;
     anbool singlefile;
@@ -350,7 +497,8 @@ index_t* index_load(const char* indexname, int flags, index_t* dest) {
 
     get_filenames(indexname, &(dest->quadfn), &(dest->codefn), &(dest->starfn),
                   &singlefile);
-    if (singlefile) {
+    //# Modified for the StellarSolver Internal Library, native index files are not FITS
+    if (singlefile && !ssindex_is_file(dest->quadfn)) {
         dest->fits = anqfits_open(dest->quadfn);
         if (!dest->fits) {
             ERROR("Failed to open FITS file %s", dest->quadfn);
@@ -361,8 +509,11 @@ index_t* index_load(const char* indexname, int flags, index_t* dest) {
     if (index_reload(dest)) {
         goto bailout;
     }
-    free(dest->indexname);
-    dest->indexname = strdup(quadfile_get_filename(dest->quads));
+    //# Modified for the StellarSolver Internal Library, the quads of a native index file have no file of their own
+    if (!dest->native) {
+        free(dest->indexname);
+        dest->indexname = strdup(quadfile_get_filename(dest->quads));
+    }
     set_meta(dest);
 
     logverb("Index scale: [%g, %g] arcmin, [%g, %g] arcsec\n",
@@ -391,6 +542,13 @@ index_t* index_load(const char* indexname, int flags, index_t* dest) {
 }
 
 int index_reload(index_t* index) {
+    //# Modified for the StellarSolver Internal Library, a native index file is mapped all at once
+    if (index->native)
+        return 0;
+    if (!index->fits && !index->starkd && !index->quads && !index->codekd &&
+        ssindex_is_file(index->quadfn))
+        return ssindex_load(index);
+
     // Read .skdt file...
     if (!index->starkd) {
         if (index->fits)
@@ -439,6 +597,11 @@ int index_reload(index_t* index) {
 }
 
 void index_unload(index_t* index) {
+    //# Modified for the StellarSolver Internal Library
+    if (index->native) {
+        ssindex_unload(index);
+        return;
+    }
     if (index->starkd) {
         startree_close(index->starkd);
         index->starkd = NULL;
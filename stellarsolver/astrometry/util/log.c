@@ -54,7 +54,12 @@ __declspec(thread) log_t g_logger;
 #else
 _Thread_local log_t g_logger;
 #endif
-int astrometryLogToFile = 0; //# Modified by Robert Lancaster for the StellarSolver Internal Library
+//# Modified for the StellarSolver Internal Library, this is for each thread like the logger, so the solvers of other threads don't log to the file
+#ifdef _MSC_VER
+__declspec(thread) int astrometryLogToFile = 0;
+#else
+_Thread_local int astrometryLogToFile = 0;
+#endif
 /* //# Modified by Robert Lancaster for the StellarSolver Internal Library
 void log_set_thread_specific() {
     g_thread_specific = 1;
@@ -81,6 +86,7 @@ void log_init_structure(log_t* logger, enum log_level level) {
     logger->t0 = timenow();
     logger->logfunc = NULL;
     logger->baton = NULL;
+    astrometryLogToFile = 0; //# Modified for the StellarSolver Internal Library
 }
 
 void log_init(enum log_level level) {
@@ -184,12 +190,10 @@ void log_this(const char* text, enum log_level level, va_list va){
         vfprintf(logger->f, text, va);
         fflush(logger->f);
     }
-    else{
+    else if(logger->astroLogger){ //# Modified for the StellarSolver Internal Library, the logger takes the text and frees it
         char *formatted = NULL;
-        vasprintf(&formatted, text, va);
-        if(get_logger()->astroLogger)
-            logFromAstrometry(get_logger()->astroLogger, formatted);
-        free(formatted);
+        if(vasprintf(&formatted, text, va) >= 0 && formatted)
+            logFromAstrometry(logger->astroLogger, formatted);
     }
 }
 
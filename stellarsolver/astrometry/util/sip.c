@@ -244,6 +244,92 @@ anbool sip_radec2pixelxy(const sip_t* sip, double ra, double dec, double *px, do
     return TRUE;
 }
 
+//# Modified for the StellarSolver Internal Library, to convert arrays of points.
+// This is the same as sip_pixelxy2radec for each point, but the vectors of the tangent
+// plane are only computed from CRVAL once, instead of with the trigonometry of each point.
+void sip_pixelxy2radec_array(const sip_t* sip, const double* px, const double* py, int N,
+                             double* ra, double* dec) {
+    const tan_t* tan = &(sip->wcstan);
+    double rx, ry, rz;
+    double ix, iy, norm;
+    double jx, jy, jz;
+    int i;
+
+    radecdeg2xyz(tan->crval[0], tan->crval[1], &rx, &ry, &rz);
+    ix = ry;
+    iy = -rx;
+    norm = hypot(ix, iy);
+    ix /= norm;
+    iy /= norm;
+    jx = iy * rz;
+    jy =         - ix * rz;
+    jz = ix * ry - iy * rx;
+    normalize(&jx, &jy, &jz);
+
+    for (i=0; i<N; i++) {
+        double U = px[i], V = py[i];
+        double x, y;
+        double xyz[3];
+        if (has_distortions(sip))
+            sip_distortion(sip, px[i], py[i], &U, &V);
+        U -= tan->crpix[0];
+        V -= tan->crpix[1];
+        x = -deg2rad(tan->cd[0][0] * U + tan->cd[0][1] * V);
+        y =  deg2rad(tan->cd[1][0] * U + tan->cd[1][1] * V);
+        if (tan->sin) {
+            double rfrac = sqrt(1.0 - (x*x + y*y));
+            xyz[0] = ix*x + jx*y + rx * rfrac;
+            xyz[1] = iy*x + jy*y + ry * rfrac;
+            xyz[2] =        jz*y + rz * rfrac;
+        } else {
+            xyz[0] = ix*x + jx*y + rx;
+            xyz[1] = iy*x + jy*y + ry;
+            xyz[2] =        jz*y + rz;
+            normalize_3(xyz);
+        }
+        xyzarr2radecdeg(xyz, ra + i, dec + i);
+    }
+}
+
+//# Modified for the StellarSolver Internal Library, to convert arrays of points.
+// This is the same as sip_radec2pixelxy for each point, but CRVAL and the inverse of the
+// CD matrix are only computed once.
+int sip_radec2pixelxy_array(const sip_t* sip, const double* ra, const double* dec, int N,
+                            double* px, double* py, anbool* ok) {
+    const tan_t* tan = &(sip->wcstan);
+    double xyzcrval[3];
+    double cdi[2][2];
+    int i, good = 0;
+
+    radecdeg2xyzarr(tan->crval[0], tan->crval[1], xyzcrval);
+    if (invert_2by2_arr((const double*)tan->cd, (double*)cdi)) {
+        for (i=0; i<N; i++)
+            if (ok)
+                ok[i] = FALSE;
+        return 0;
+    }
+
+    for (i=0; i<N; i++) {
+        double xyz[3];
+        double iwx, iwy, x, y;
+        radecdeg2xyzarr(ra[i], dec[i], xyz);
+        if (!star_coords(xyz, xyzcrval, !tan->sin, &iwx, &iwy)) {
+            if (ok)
+                ok[i] = FALSE;
+            continue;
+        }
+        iwx = rad2deg(iwx);
+        iwy = rad2deg(iwy);
+        x = cdi[0][0]*iwx + cdi[0][1]*iwy + tan->crpix[0];
+        y = cdi[1][0]*iwx + cdi[1][1]*iwy + tan->crpix[1];
+        sip_pixel_undistortion(sip, x, y, px + i, py + i);
+        if (ok)
+            ok[i] = TRUE;
+        good++;
+    }
+    return good;
+}
+
 void sip_iwc2radec(const sip_t* sip, double x, double y, double *p_ra, double *p_dec) {
     tan_iwc2radec(&(sip->wcstan), x, y, p_ra, p_dec);
 }
@@ -0,0 +1,476 @@
+/*
+ # This file is part of the Astrometry.net suite.
+ # Licensed under a 3-clause BSD style license - see LICENSE
+ */
+
+//# Modified for the StellarSolver Internal Library
+// The native index format of StellarSolver, see ssindex.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "os-features.h"
+#include "ssindex.h"
+#include "kdtree.h"
+#include "codekd.h"
+#include "starkd.h"
+#include "quadfile.h"
+#include "qfits_rw.h"
+#include "mathutil.h"
+#include "errors.h"
+#include "log.h"
+
+#define SSINDEX_MAGIC "SSINDEX1"
+#define SSINDEX_VERSION 1
+#define SSINDEX_ENDIAN 0x01020304
+#define SSINDEX_PAGE 4096
+
+// Where one array is in the file, a size of 0 means the array is not there
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} ssindex_section_t;
+
+// The fields of a kd-tree that are not arrays, and where its arrays and the FITS cards of its header are
+typedef struct {
+    uint32_t treetype;
+    int32_t ndata;
+    int32_t ndim;
+    int32_t nnodes;
+    int32_t n_bb;
+    int32_t has_linear_lr;
+    uint32_t dimbits;
+    uint32_t dimmask;
+    uint32_t splitmask;
+    uint32_t unused;
+    double scale;
+    ssindex_section_t header;
+    ssindex_section_t range;
+    ssindex_section_t split;
+    ssindex_section_t splitdim;
+    ssindex_section_t bb;
+    ssindex_section_t lr;
+    ssindex_section_t data;
+    ssindex_section_t perm;
+} ssindex_tree_t;
+
+// The header page at the start of the file, the sections after it are in the order they are written
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t numquads;
+    uint32_t numstars;
+    int32_t dimquads;
+    int32_t indexid;
+    int32_t healpix;
+    int32_t hpnside;
+    double index_scale_upper;
+    double index_scale_lower;
+    ssindex_tree_t codetree;
+    ssindex_section_t quads;
+    ssindex_tree_t startree;
+    ssindex_section_t sweep;
+} ssindex_header_t;
+
+// The mapping of a loaded native index file, it is kept in index->native
+typedef struct {
+    char* map;
+    size_t size;
+} ssindex_map_t;
+
+static size_t tree_type_size(const kdtree_t* kd) {
+    switch (kdtree_treetype(kd)) {
+    case KDT_TREE_DOUBLE: return sizeof(double);
+    case KDT_TREE_FLOAT:  return sizeof(float);
+    case KDT_TREE_U32:    return sizeof(uint32_t);
+    case KDT_TREE_U16:    return sizeof(uint16_t);
+    }
+    return 0;
+}
+
+static size_t data_type_size(const kdtree_t* kd) {
+    switch (kdtree_datatype(kd)) {
+    case KDT_DATA_DOUBLE: return sizeof(double);
+    case KDT_DATA_FLOAT:  return sizeof(float);
+    case KDT_DATA_U32:    return sizeof(uint32_t);
+    case KDT_DATA_U16:    return sizeof(uint16_t);
+    }
+    return 0;
+}
+
+// Pads the file to the next page, so the next section starts on a page of the mapping
+static int pad_to_page(FILE* fid) {
+    static const char zeros[SSINDEX_PAGE] = { 0 };
+    off_t pos = ftello(fid);
+    size_t pad;
+    if (pos < 0)
+        return -1;
+    pad = (size_t)((SSINDEX_PAGE - pos % SSINDEX_PAGE) % SSINDEX_PAGE);
+    if (pad && fwrite(zeros, 1, pad, fid) != pad)
+        return -1;
+    return 0;
+}
+
+static int write_section(FILE* fid, const void* data, size_t size,
+                         ssindex_section_t* section) {
+    memset(section, 0, sizeof(ssindex_section_t));
+    if (!data || !size)
+        return 0;
+    if (pad_to_page(fid))
+        return -1;
+    section->offset = (uint64_t)ftello(fid);
+    section->size = size;
+    if (fwrite(data, 1, size, fid) != size)
+        return -1;
+    return 0;
+}
+
+static int write_header_section(FILE* fid, const qfits_header* hdr,
+                                ssindex_section_t* section) {
+    memset(section, 0, sizeof(ssindex_section_t));
+    if (!hdr)
+        return 0;
+    if (pad_to_page(fid))
+        return -1;
+    section->offset = (uint64_t)ftello(fid);
+    if (qfits_header_dump(hdr, fid))
+        return -1;
+    section->size = (uint64_t)ftello(fid) - section->offset;
+    return 0;
+}
+
+// The arrays come in the order a search reads them: the range to convert the query, the split values from the top
+// of the tree down, the leaves, and the data of the leaves.
+static int write_tree(FILE* fid, const kdtree_t* kd, const qfits_header* hdr,
+                      anbool with_perm, ssindex_tree_t* t) {
+    size_t tsize = tree_type_size(kd);
+    double* range = NULL;
+    int rtn = -1;
+
+    memset(t, 0, sizeof(ssindex_tree_t));
+    t->treetype = kd->treetype;
+    t->ndata = kd->ndata;
+    t->ndim = kd->ndim;
+    t->nnodes = kd->nnodes;
+    t->n_bb = kd->bb.any ? kd->n_bb : 0;
+    t->has_linear_lr = kd->has_linear_lr;
+    t->dimbits = kd->dimbits;
+    t->dimmask = kd->dimmask;
+    t->splitmask = kd->splitmask;
+    t->scale = kd->scale;
+
+    if (kd->minval && kd->maxval) {
+        range = malloc((2 * kd->ndim + 1) * sizeof(double));
+        memcpy(range, kd->minval, kd->ndim * sizeof(double));
+        memcpy(range + kd->ndim, kd->maxval, kd->ndim * sizeof(double));
+        range[2 * kd->ndim] = kd->scale;
+    }
+
+    if (write_header_section(fid, hdr, &t->header) ||
+        write_section(fid, range, range ? (2 * kd->ndim + 1) * sizeof(double) : 0, &t->range) ||
+        write_section(fid, kd->split.any, kd->split.any ? tsize * kd->ninterior : 0, &t->split) ||
+        write_section(fid, kd->splitdim, kd->splitdim ? (size_t)kd->ninterior : 0, &t->splitdim) ||
+        write_section(fid, kd->bb.any, (size_t)t->n_bb * 2 * kd->ndim * tsize, &t->bb) ||
+        write_section(fid, kd->lr, kd->lr ? kd->nbottom * sizeof(int32_t) : 0, &t->lr) ||
+        write_section(fid, kd->data.any, (size_t)kd->ndata * kd->ndim * data_type_size(kd), &t->data) ||
+        write_section(fid, with_perm ? kd->perm : NULL, kd->ndata * sizeof(uint32_t), &t->perm))
+        goto finish;
+    rtn = 0;
+
+ finish:
+    free(range);
+    return rtn;
+}
+
+anbool ssindex_is_file(const char* filename) {
+    char magic[8];
+    anbool rtn = FALSE;
+    FILE* fid = fopen(filename, "rb");
+    if (!fid)
+        return FALSE;
+    if (fread(magic, 1, sizeof(magic), fid) == sizeof(magic) &&
+        memcmp(magic, SSINDEX_MAGIC, sizeof(magic)) == 0)
+        rtn = TRUE;
+    fclose(fid);
+    return rtn;
+}
+
+int ssindex_write(index_t* index, const char* outfn, anbool quantize) {
+    kdtree_t* codetree;
+    kdtree_t* quantized = NULL;
+    quadfile_t* qf = index->quads;
+    startree_t* starkd = index->starkd;
+    ssindex_header_t hdr;
+    uint32_t* quads = NULL;
+    FILE* fid = NULL;
+    int i, dimquads;
+    int rtn = -1;
+
+    if (!index->codekd || !qf || !starkd) {
+        ERROR("Index %s has to be loaded to be written as a native index", index->indexname);
+        return -1;
+    }
+    codetree = index->codekd->tree;
+    dimquads = qf->dimquads;
+    if (codetree->ndata != (int)qf->numquads) {
+        ERROR("Index %s has %i codes but %u quads", index->indexname, codetree->ndata, qf->numquads);
+        return -1;
+    }
+
+    if (quantize && kdtree_datatype(codetree) == KDT_DATA_DOUBLE) {
+        quantized = kdtree_quantize(codetree, KDTT_DSS);
+        if (!quantized) {
+            ERROR("Failed to build the 16-bit code tree of index %s", index->indexname);
+            return -1;
+        }
+        logverb("Quantized the %i codes of index %s to 16 bits\n", codetree->ndata, index->indexname);
+        codetree = quantized;
+    }
+
+    // The quads go in the order of their codes in the tree, so the tree doesn't need its permutation
+    quads = malloc((size_t)qf->numquads * dimquads * sizeof(uint32_t));
+    if (!quads) {
+        ERROR("Failed to allocate the quads of index %s", index->indexname);
+        goto finish;
+    }
+    for (i=0; i<codetree->ndata; i++) {
+        int orig = codetree->perm ? codetree->perm[i] : i;
+        memcpy(quads + (size_t)i * dimquads, qf->quadarray + (size_t)orig * dimquads,
+               dimquads * sizeof(uint32_t));
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SSINDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = SSINDEX_VERSION;
+    hdr.endian = SSINDEX_ENDIAN;
+    hdr.numquads = qf->numquads;
+    hdr.numstars = qf->numstars;
+    hdr.dimquads = dimquads;
+    hdr.indexid = qf->indexid;
+    hdr.healpix = qf->healpix;
+    hdr.hpnside = qf->hpnside;
+    hdr.index_scale_upper = qf->index_scale_upper;
+    hdr.index_scale_lower = qf->index_scale_lower;
+
+    fid = fopen(outfn, "wb");
+    if (!fid) {
+        SYSERROR("Failed to open %s for writing", outfn);
+        goto finish;
+    }
+    // The header page is written last, when the sections are known
+    if (fwrite(&hdr, 1, sizeof(hdr), fid) != sizeof(hdr) ||
+        write_tree(fid, codetree, index->codekd->header, FALSE, &hdr.codetree) ||
+        write_section(fid, quads, (size_t)qf->numquads * dimquads * sizeof(uint32_t), &hdr.quads) ||
+        write_tree(fid, starkd->tree, starkd->header, TRUE, &hdr.startree) ||
+        write_section(fid, starkd->sweep, starkd->sweep ? (size_t)starkd->tree->ndata : 0, &hdr.sweep) ||
+        fseeko(fid, 0, SEEK_SET) ||
+        fwrite(&hdr, 1, sizeof(hdr), fid) != sizeof(hdr)) {
+        SYSERROR("Failed to write the native index %s", outfn);
+        goto finish;
+    }
+    if (fclose(fid)) {
+        fid = NULL;
+        SYSERROR("Failed to close the native index %s", outfn);
+        goto finish;
+    }
+    fid = NULL;
+    rtn = 0;
+
+ finish:
+    if (fid)
+        fclose(fid);
+    free(quads);
+    kdtree_free(quantized);
+    return rtn;
+}
+
+static anbool section_fits(const ssindex_section_t* s, size_t filesize) {
+    return s->size == 0 || (s->offset <= filesize && s->size <= filesize - s->offset);
+}
+
+static void* section_data(const ssindex_map_t* m, const ssindex_section_t* s) {
+    return s->size ? m->map + s->offset : NULL;
+}
+
+static qfits_header* read_header(const ssindex_map_t* m, const ssindex_section_t* s) {
+    if (!s->size)
+        return qfits_header_new();
+    return qfits_header_read_hdr_string((const unsigned char*)section_data(m, s), (int)s->size);
+}
+
+// This makes a kd-tree whose arrays are in the mapping, kdtree_fits_close frees it without freeing them
+static kdtree_t* map_tree(const ssindex_map_t* m, const ssindex_tree_t* t, const char* fn) {
+    const ssindex_section_t* sections[] = { &t->header, &t->range, &t->split, &t->splitdim,
+                                            &t->bb, &t->lr, &t->data, &t->perm };
+    kdtree_t* kd;
+    size_t tsize, dsize;
+    int i;
+
+    for (i=0; i<(int)(sizeof(sections) / sizeof(sections[0])); i++) {
+        if (!section_fits(sections[i], m->size)) {
+            ERROR("Native index %s is truncated", fn);
+            return NULL;
+        }
+    }
+    if (t->ndata <= 0 || t->ndim <= 0 || t->nnodes <= 0) {
+        ERROR("Native index %s has an empty kd-tree", fn);
+        return NULL;
+    }
+
+    kd = calloc(1, sizeof(kdtree_t));
+    kd->treetype = t->treetype;
+    kd->ndata = t->ndata;
+    kd->ndim = t->ndim;
+    kd->nnodes = t->nnodes;
+    kd->nbottom = (t->nnodes + 1) / 2;
+    kd->ninterior = kd->nnodes - kd->nbottom;
+    kd->nlevels = kdtree_nnodes_to_nlevels(kd->nnodes);
+    kd->has_linear_lr = t->has_linear_lr;
+    kd->dimbits = (u8)t->dimbits;
+    kd->dimmask = t->dimmask;
+    kd->splitmask = t->splitmask;
+    kd->n_bb = t->n_bb;
+    kd->lr = section_data(m, &t->lr);
+    kd->perm = section_data(m, &t->perm);
+    kd->bb.any = section_data(m, &t->bb);
+    kd->split.any = section_data(m, &t->split);
+    kd->splitdim = section_data(m, &t->splitdim);
+    kd->data.any = section_data(m, &t->data);
+    if (t->range.size) {
+        kd->minval = section_data(m, &t->range);
+        kd->maxval = kd->minval + kd->ndim;
+        kd->scale = t->scale;
+        kd->invscale = 1.0 / kd->scale;
+    }
+
+    tsize = tree_type_size(kd);
+    dsize = data_type_size(kd);
+    if (!tsize || !dsize ||
+        t->data.size != (uint64_t)kd->ndata * kd->ndim * dsize ||
+        (t->range.size && t->range.size != (2 * (uint64_t)kd->ndim + 1) * sizeof(double)) ||
+        (t->split.size && t->split.size != (uint64_t)kd->ninterior * tsize) ||
+        (t->splitdim.size && t->splitdim.size != (uint64_t)kd->ninterior) ||
+        (t->bb.size && t->bb.size != (uint64_t)kd->n_bb * 2 * kd->ndim * tsize) ||
+        (t->lr.size && t->lr.size != (uint64_t)kd->nbottom * sizeof(int32_t)) ||
+        (t->perm.size && t->perm.size != (uint64_t)kd->ndata * sizeof(uint32_t)) ||
+        !(kd->bb.any || kd->split.any)) {
+        ERROR("Native index %s has a kd-tree with arrays of the wrong size", fn);
+        free(kd);
+        return NULL;
+    }
+    kdtree_update_funcs(kd);
+    return kd;
+}
+
+int ssindex_load(index_t* index) {
+    const char* fn = index->quadfn;
+    ssindex_header_t hdr;
+    ssindex_map_t m = { NULL, 0 };
+    codetree_t* codekd = NULL;
+    quadfile_t* quads = NULL;
+    startree_t* starkd = NULL;
+    FILE* fid;
+    off_t size;
+
+    if (index->native)
+        return 0;
+
+    fid = fopen(fn, "rb");
+    if (!fid) {
+        SYSERROR("Failed to open native index %s", fn);
+        return -1;
+    }
+    if (fread(&hdr, 1, sizeof(hdr), fid) != sizeof(hdr) ||
+        memcmp(hdr.magic, SSINDEX_MAGIC, sizeof(hdr.magic)) != 0) {
+        ERROR("File %s is not a native index", fn);
+        fclose(fid);
+        return -1;
+    }
+    if (hdr.version != SSINDEX_VERSION || hdr.endian != SSINDEX_ENDIAN) {
+        ERROR("Native index %s was written by another version or on a machine of another byte order, it has to be repacked", fn);
+        fclose(fid);
+        return -1;
+    }
+    if (fseeko(fid, 0, SEEK_END) || (size = ftello(fid)) <= 0) {
+        SYSERROR("Failed to get the size of native index %s", fn);
+        fclose(fid);
+        return -1;
+    }
+    // All of the index is one mapping, so loading it reads the file in one sequential pass as its pages are touched
+    m.size = (size_t)size;
+    m.map = mmap(0, m.size, PROT_READ, MAP_SHARED, fileno(fid), 0);
+    fclose(fid);
+    if (m.map == MAP_FAILED) {
+        SYSERROR("Failed to map native index %s", fn);
+        return -1;
+    }
+
+    if (!section_fits(&hdr.quads, m.size) || !section_fits(&hdr.sweep, m.size) ||
+        hdr.quads.size != (uint64_t)hdr.numquads * hdr.dimquads * sizeof(uint32_t)) {
+        ERROR("Native index %s is truncated", fn);
+        goto bailout;
+    }
+
+    codekd = calloc(1, sizeof(codetree_t));
+    codekd->tree = map_tree(&m, &hdr.codetree, fn);
+    if (!codekd->tree || hdr.codetree.ndata != (int32_t)hdr.numquads)
+        goto bailout;
+    codekd->header = read_header(&m, &hdr.codetree.header);
+
+    quads = calloc(1, sizeof(quadfile_t));
+    quads->numquads = hdr.numquads;
+    quads->numstars = hdr.numstars;
+    quads->dimquads = hdr.dimquads;
+    quads->index_scale_upper = hdr.index_scale_upper;
+    quads->index_scale_lower = hdr.index_scale_lower;
+    quads->indexid = hdr.indexid;
+    quads->healpix = hdr.healpix;
+    quads->hpnside = hdr.hpnside;
+    quads->quadarray = section_data(&m, &hdr.quads);
+
+    starkd = calloc(1, sizeof(startree_t));
+    starkd->tree = map_tree(&m, &hdr.startree, fn);
+    if (!starkd->tree)
+        goto bailout;
+    if (hdr.sweep.size && hdr.sweep.size != (uint64_t)starkd->tree->ndata) {
+        ERROR("Native index %s has a sweep array of the wrong size", fn);
+        goto bailout;
+    }
+    starkd->header = read_header(&m, &hdr.startree.header);
+    starkd->sweep = section_data(&m, &hdr.sweep);
+
+    index->codekd = codekd;
+    index->quads = quads;
+    index->starkd = starkd;
+    index->native = malloc(sizeof(ssindex_map_t));
+    memcpy(index->native, &m, sizeof(ssindex_map_t));
+    return 0;
+
+ bailout:
+    codetree_close(codekd);
+    quadfile_close(quads);
+    startree_close(starkd);
+    munmap(m.map, m.size);
+    return -1;
+}
+
+void ssindex_unload(index_t* index) {
+    ssindex_map_t* m = index->native;
+    if (!m)
+        return;
+    codetree_close(index->codekd);
+    quadfile_close(index->quads);
+    startree_close(index->starkd);
+    index->codekd = NULL;
+    index->quads = NULL;
+    index->starkd = NULL;
+    munmap(m->map, m->size);
+    free(m);
+    index->native = NULL;
+}
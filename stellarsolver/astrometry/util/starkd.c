@@ -162,8 +162,7 @@ void startree_search_for(const startree_t* s, const double* xyzcenter, double ra
 
     if (radecresults) {
         *radecresults = malloc(N * 2 * sizeof(double));
-        for (i=0; i<N; i++)
-            xyzarr2radecdegarr(xyz + i*3, (*radecresults) + i*2);
+        xyzarr2radecdegarrmany(xyz, *radecresults, N); //# Modified for the StellarSolver Internal Library
     }
     if (xyzresults) {
         // Steal the results array.
@@ -10,6 +10,7 @@
 #include "os-features.h"
 #include "starxy.h"
 #include "permutedsort.h"
+#include "starsort.h" //# Modified for the StellarSolver Internal Library
 
 void starxy_set_xy_array(starxy_t* s, const double* xy) {
     int i,N;
@@ -162,8 +163,8 @@ double* starxy_copy_xy(const starxy_t* xy) {
 
 void starxy_sort_by_flux(starxy_t* s) {
     int* perm;
-    perm = permuted_sort(s->flux, sizeof(double), compare_doubles_desc,
-                         NULL, s->N);
+    //# Modified for the StellarSolver Internal Library, to sort the keys inline and in parallel for big fields
+    perm = sssort_doubles(s->flux, s->N, TRUE, NULL);
     permutation_apply(perm, s->N, s->x, s->x, sizeof(double));
     permutation_apply(perm, s->N, s->y, s->y, sizeof(double));
     if (s->flux)
@@ -7,35 +7,231 @@
 */
 #include "astrometrylogger.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+
+/**
+ * @brief The AstrometryLogQueue class is the queue that all of the AstrometryLoggers share.
+ * It is a bounded lock free queue for many producers, after Dmitry Vyukov's, so the solver threads never wait on a lock to log.
+ * Only the thread of the queue takes text out of it, or a logger that is flushed, and they take turns with the consumer lock.
+ * The thread only runs while there are loggers.
+ */
+class AstrometryLogQueue
+{
+    public:
+        static AstrometryLogQueue &instance()
+        {
+            static AstrometryLogQueue queue;
+            return queue;
+        }
+
+        /**
+         * @brief push puts the text of a logger in the queue, it takes the text and frees it if the queue is full
+         * @return false if the queue was full
+         */
+        bool push(quint64 id, char *text)
+        {
+            size_t position = m_Head.load(std::memory_order_relaxed);
+            Cell *cell;
+            for(;;)
+            {
+                cell = &m_Cells[position & (Capacity - 1)];
+                const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+                if(difference == 0)
+                {
+                    if(m_Head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if(difference < 0)
+                {
+                    free(text);
+                    return false;
+                }
+                else
+                    position = m_Head.load(std::memory_order_relaxed);
+            }
+            cell->id = id;
+            cell->text = text;
+            cell->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        void add(AstrometryLogger *logger)
+        {
+            std::lock_guard<std::mutex> threadLocker(m_ThreadMutex);
+            {
+                QMutexLocker locker(&m_ConsumerMutex);
+                logger->m_ID = ++m_LastID;
+                m_Loggers.insert(logger->m_ID, logger);
+            }
+            if(!m_Thread.joinable())
+            {
+                m_Stop = false;
+                m_Thread = std::thread(&AstrometryLogQueue::run, this);
+            }
+        }
+
+        void remove(AstrometryLogger *logger)
+        {
+            std::lock_guard<std::mutex> threadLocker(m_ThreadMutex);
+            bool last;
+            {
+                QMutexLocker locker(&m_ConsumerMutex);
+                m_Loggers.remove(logger->m_ID);
+                last = m_Loggers.isEmpty();
+            }
+            if(last && m_Thread.joinable())
+            {
+                {
+                    std::lock_guard<std::mutex> wakeLocker(m_WakeMutex);
+                    m_Stop = true;
+                }
+                m_Wake.notify_one();
+                m_Thread.join();
+                // The text of the loggers that are gone is freed
+                drain(nullptr);
+            }
+        }
+
+        void setPrefix(AstrometryLogger *logger, const QString &prefix)
+        {
+            QMutexLocker locker(&m_ConsumerMutex);
+            logger->m_Prefix = prefix;
+        }
+
+        /**
+         * @brief drain takes all of the text out of the queue for the loggers and emits it for the ones that are due.
+         * @param flushed The logger whose text is emitted now, if it is flushed, all of the others wait for their turn
+         */
+        void drain(AstrometryLogger *flushed)
+        {
+            QMutexLocker locker(&m_ConsumerMutex);
+            for(;;)
+            {
+                Cell &cell = m_Cells[m_Tail & (Capacity - 1)];
+                const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                if(static_cast<intptr_t>(sequence) - static_cast<intptr_t>(m_Tail + 1) < 0)
+                    break;
+                AstrometryLogger *logger = m_Loggers.value(cell.id, nullptr);
+                if(logger)
+                    logger->m_LogText += logger->m_Prefix + QString::fromUtf8(cell.text);
+                free(cell.text);
+                cell.text = nullptr;
+                cell.sequence.store(m_Tail + Capacity, std::memory_order_release);
+                m_Tail++;
+            }
+
+            for(AstrometryLogger *logger : qAsConst(m_Loggers))
+            {
+                const int dropped = logger->m_Dropped.exchange(0);
+                if(dropped > 0)
+                    logger->m_LogText += logger->m_Prefix + QString("%1 log messages were dropped, since astrometry.net logged them faster than they could be shown\n").arg(dropped);
+                if(logger->m_LogText.isEmpty())
+                    continue;
+                if(logger != flushed && logger->m_SinceLastOutput.elapsed() <= 100)
+                    continue;
+                emit logger->logOutput(logger->m_LogText);
+                logger->m_LogText.clear();
+                logger->m_SinceLastOutput.restart();
+            }
+        }
+
+    private:
+        AstrometryLogQueue() : m_Cells(new Cell[Capacity])
+        {
+            for(size_t i = 0; i < Capacity; i++)
+                m_Cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        ~AstrometryLogQueue()
+        {
+            if(m_Thread.joinable())
+            {
+                {
+                    std::lock_guard<std::mutex> wakeLocker(m_WakeMutex);
+                    m_Stop = true;
+                }
+                m_Wake.notify_one();
+                m_Thread.join();
+            }
+            for(size_t i = 0; i < Capacity; i++)
+                free(m_Cells[i].text);
+        }
+
+        // This wakes up every 100 ms to drain the queue, the solver threads don't wake it so they stay lock free
+        void run()
+        {
+            std::unique_lock<std::mutex> wakeLocker(m_WakeMutex);
+            while(!m_Stop)
+            {
+                m_Wake.wait_for(wakeLocker, std::chrono::milliseconds(100));
+                wakeLocker.unlock();
+                drain(nullptr);
+                wakeLocker.lock();
+            }
+        }
+
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            quint64 id { 0 };
+            char *text { nullptr };
+        };
+
+        static const size_t Capacity = 8192;        // This has to be a power of 2
+        std::unique_ptr<Cell[]> m_Cells;
+        std::atomic<size_t> m_Head { 0 };           // The next cell to put text in
+        size_t m_Tail { 0 };                        // The next cell to take text out of, with the consumer lock
+
+        QMutex m_ConsumerMutex;                     // This is held while taking the text out of the queue and while the loggers are changed
+        QHash<quint64, AstrometryLogger *> m_Loggers;
+        quint64 m_LastID { 0 };
+
+        std::mutex m_ThreadMutex;                   // This is held while the thread is started or stopped
+        std::mutex m_WakeMutex;
+        std::condition_variable m_Wake;
+        bool m_Stop { false };
+        std::thread m_Thread;
+};
+
 AstrometryLogger::AstrometryLogger()
 {
-    timeSinceLastOutput.start();
-    connect(&logUpdater, &QTimer::timeout, this, &AstrometryLogger::updateLog);
-    logUpdater.start(100);
+    m_SinceLastOutput.start();
+    AstrometryLogQueue::instance().add(this);
+}
+
+AstrometryLogger::~AstrometryLogger()
+{
+    AstrometryLogQueue::instance().remove(this);
 }
 
 void AstrometryLogger::logFromAstrometry(char* text)
 {
-    logText += text;
-    updateLog();
+    if(!AstrometryLogQueue::instance().push(m_ID, text))
+        m_Dropped.fetch_add(1, std::memory_order_relaxed);
 }
 
-EXPORT_C void logFromAstrometry(AstrometryLogger* astroLogger, char* text)
+void AstrometryLogger::setPrefix(const QString &prefix)
 {
-    return astroLogger->logFromAstrometry(text);
+    AstrometryLogQueue::instance().setPrefix(this, prefix);
 }
 
-void AstrometryLogger::updateLog()
+void AstrometryLogger::flush()
 {
-    if(readyToLog())
-    {
-        emit logOutput(logText);
-        timeSinceLastOutput.restart();
-        logText = "";
-    }
+    AstrometryLogQueue::instance().drain(this);
 }
 
-bool AstrometryLogger::readyToLog()
+EXPORT_C void logFromAstrometry(AstrometryLogger* astroLogger, char* text)
 {
-    return timeSinceLastOutput.elapsed() > 100 && logText.length() > 0;
+    return astroLogger->logFromAstrometry(text);
 }
@@ -11,35 +11,49 @@
 #ifdef __cplusplus
 #include <QObject>
 #include <QElapsedTimer>
-#include <QTimer>
+#include <atomic>
 
+class AstrometryLogQueue;
+
+/**
+ * @brief The AstrometryLogger class gets the log of astrometry.net to StellarSolver.
+ * The solver threads don't format or emit anything, they only put the text in a lock free queue that all of the loggers share,
+ * so that verbose logging doesn't slow down the solves, even with the child solvers of a parallel solve all logging at once.
+ * One thread takes the text out of the queue and emits it with logOutput at most every 100 ms for each logger.
+ * If the queue is full because the solvers log faster than that, the text is dropped and the log says how much was dropped.
+ */
 class AstrometryLogger: public QObject
 {
     Q_OBJECT
 public:
 
     AstrometryLogger();
+    ~AstrometryLogger();
 
     /**
      * @brief logFromAstrometry is the C++ method called by astrometry.net to get the text so that the logging can happen
-     * @param text is the information to be logged when ready
+     * @param text is the information to be logged when ready.  It was allocated with malloc and the logger frees it.
      */
     void logFromAstrometry(char* text);
-private:
-
-    QString logText;                    // The current text waiting to be logged
-    QElapsedTimer timeSinceLastOutput;  // A record of how long ago logging last happened so we know if it is ready to log
-    QTimer logUpdater;                  // A timer that times out periodically to log any waiting text
 
     /**
-     * @brief updateLog actually emits the signal to the logger to put the text into a file or scrolling log if it is ready.
+     * @brief setPrefix sets a text to put before each message, like the number of a child solver
+     * @param prefix The text
      */
-    void updateLog();
+    void setPrefix(const QString &prefix);
+
     /**
-     * @brief readyToLog keeps track of how long it has been since logging was last done so it doesn't overwhelm the logging file or scrolling log
-     * @return true if it is ready
+     * @brief flush emits all of the text of this logger that is waiting in the queue now, for instance when a solve is done
      */
-    bool readyToLog();
+    void flush();
+private:
+    friend class AstrometryLogQueue;
+
+    quint64 m_ID;                       // The number of this logger in the queue, the text of a logger that is gone is dropped
+    QString m_Prefix;                   // The text before each message
+    QString m_LogText;                  // The text taken out of the queue and waiting to be logged
+    QElapsedTimer m_SinceLastOutput;    // A record of how long ago logging last happened so it doesn't overwhelm the logging file or scrolling log
+    std::atomic<int> m_Dropped { 0 };   // The number of messages dropped since the last output because the queue was full
 signals:
     /**
      * @brief logOutput signals that there is infomation that should be printed to a log file or log window
@@ -0,0 +1,114 @@
+/*  ExternalDatabaseCache, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "externaldatabasecache.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+#include <QtConcurrent>
+
+ExternalDatabaseCache::~ExternalDatabaseCache()
+{
+    m_Warming.waitForFinished();
+    QMutexLocker locker(&m_Mutex);
+    unmap();
+}
+
+void ExternalDatabaseCache::warm(const QStringList &folders, const QStringList &nameFilters)
+{
+    QMutexLocker locker(&m_Mutex);
+    if(m_Warming.isRunning())
+        return;
+    m_Warming = QtConcurrent::run(this, &ExternalDatabaseCache::mapAndTouch, folders, nameFilters);
+}
+
+void ExternalDatabaseCache::clear()
+{
+    m_Warming.waitForFinished();
+    QMutexLocker locker(&m_Mutex);
+    unmap();
+}
+
+void ExternalDatabaseCache::setMemoryBudget(qint64 bytes)
+{
+    QMutexLocker locker(&m_Mutex);
+    m_MemoryBudget = bytes;
+}
+
+qint64 ExternalDatabaseCache::mappedBytes()
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_MappedBytes;
+}
+
+void ExternalDatabaseCache::mapAndTouch(const QStringList &folders, const QStringList &nameFilters)
+{
+    QFileInfoList files;
+    for(const QString &folder : folders)
+        files.append(QDir(folder).entryInfoList(nameFilters, QDir::Files | QDir::Readable, QDir::Name));
+
+    QMutexLocker locker(&m_Mutex);
+
+    // The files that were removed or changed since they were mapped are unmapped, the changed ones get mapped again below
+    QSet<QString> paths;
+    for(const QFileInfo &info : files)
+        paths.insert(info.absoluteFilePath());
+    for(auto it = m_Files.begin(); it != m_Files.end();)
+    {
+        QFileInfo info(it.key());
+        if(!paths.contains(it.key()) || info.size() != it->size || info.lastModified() != it->modified)
+        {
+            m_MappedBytes -= it->size;
+            it->file->unmap(const_cast<uchar *>(it->data));
+            it = m_Files.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    for(const QFileInfo &info : files)
+    {
+        const QString path = info.absoluteFilePath();
+        if(m_Files.contains(path) || info.size() == 0)
+            continue;
+        if(m_MemoryBudget > 0 && m_MappedBytes + info.size() > m_MemoryBudget)
+            continue;
+        MappedFile mapped;
+        mapped.file.reset(new QFile(path));
+        if(!mapped.file->open(QIODevice::ReadOnly))
+            continue;
+        mapped.data = mapped.file->map(0, info.size());
+        // The mapping stays valid after the file is closed, so the file handle doesn't stay open
+        mapped.file->close();
+        if(!mapped.data)
+            continue;
+        mapped.size = info.size();
+        mapped.modified = info.lastModified();
+        m_Files.insert(path, mapped);
+        m_MappedBytes += mapped.size;
+    }
+
+    for(const MappedFile &mapped : qAsConst(m_Files))
+        touch(mapped);
+}
+
+void ExternalDatabaseCache::touch(const MappedFile &mapped)
+{
+    // 4096 bytes is the smallest page size of the systems StellarSolver runs on, so no page gets skipped
+    volatile uchar sum = 0;
+    for(qint64 offset = 0; offset < mapped.size; offset += 4096)
+        sum += mapped.data[offset];
+    Q_UNUSED(sum);
+}
+
+void ExternalDatabaseCache::unmap()
+{
+    for(MappedFile &mapped : m_Files)
+        mapped.file->unmap(const_cast<uchar *>(mapped.data));
+    m_Files.clear();
+    m_MappedBytes = 0;
+}
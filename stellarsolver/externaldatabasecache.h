@@ -0,0 +1,98 @@
+/*  ExternalDatabaseCache, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QStringList>
+#include <QMutex>
+#include <QHash>
+#include <QFile>
+#include <QDateTime>
+#include <QFuture>
+#include <QSharedPointer>
+
+/**
+ * @brief The ExternalDatabaseCache class keeps the star databases of the external solvers in memory between solves.
+ * solve-field, ASTAP and Watney are started again for every image and read their index files or star databases from disk each time,
+ * which is most of their start up time on the slow SD cards of small field computers.  None of them can be given jobs once it is running,
+ * so instead this memory maps the database files read-only in the StellarSolver's process and reads one byte of every page of them.
+ * The pages stay in the page cache as long as they are mapped and used, so the external programs that read the same files find them in memory.
+ * The files are mapped in a background thread so that the first solve doesn't wait for them, and they are touched again before every solve.
+ * The cache is owned by the StellarSolver (and can be shared between several StellarSolvers), like the IndexCatalog.  It is thread safe.
+ */
+class ExternalDatabaseCache
+{
+    public:
+        ExternalDatabaseCache() = default;
+        ~ExternalDatabaseCache();
+
+        /**
+         * @brief warm maps the database files that are not mapped yet and touches the pages of all of them, in a background thread.
+         * If the previous call is still working, this does nothing.
+         * @param folders is the list of folders the databases are in.  The subfolders are not searched.
+         * @param nameFilters are the patterns of the database file names, such as "*.fits" for the index files
+         */
+        void warm(const QStringList &folders, const QStringList &nameFilters);
+
+        /**
+         * @brief clear unmaps all of the files, for instance after the databases were replaced
+         */
+        void clear();
+
+        /**
+         * @brief setMemoryBudget sets how much of the databases may be kept in memory
+         * @param bytes is the budget in bytes, 0 means there is no limit
+         */
+        void setMemoryBudget(qint64 bytes);
+
+        /**
+         * @brief getMemoryBudget gets how much of the databases may be kept in memory
+         * @return The budget in bytes, 0 means there is no limit
+         */
+        qint64 getMemoryBudget() const
+        {
+            return m_MemoryBudget;
+        }
+
+        /**
+         * @brief mappedBytes gets how much of the databases is mapped
+         * @return The size of the mapped files in bytes
+         */
+        qint64 mappedBytes();
+
+    private:
+        // This is one database file that is kept mapped
+        struct MappedFile
+        {
+            QSharedPointer<QFile> file;
+            const uchar *data { nullptr };
+            qint64 size { 0 };
+            QDateTime modified;
+        };
+
+        /**
+         * @brief mapAndTouch does the work of warm in the background thread
+         */
+        void mapAndTouch(const QStringList &folders, const QStringList &nameFilters);
+
+        /**
+         * @brief touch reads one byte of every page of a mapped file, so the pages get read from disk if they aren't in memory
+         */
+        static void touch(const MappedFile &mapped);
+
+        /**
+         * @brief unmap unmaps the files.  The mutex must be held.
+         */
+        void unmap();
+
+        QMutex m_Mutex;                             // This protects the mapped files and the budget
+        QHash<QString, MappedFile> m_Files;         // The mapped files, keyed by their paths
+        qint64 m_MappedBytes { 0 };                 // The size of the mapped files
+        qint64 m_MemoryBudget { 2LL * 1024 * 1024 * 1024 }; // How much of the databases may be mapped
+        QFuture<void> m_Warming;                    // The background work of the last call to warm
+};
@@ -7,10 +7,22 @@
 */
 #include "externalextractorsolver.h"
 #include <QTextStream>
-#include <QMessageBox>
+#include <QCryptographicHash>
+#include <QSaveFile>
+#include <QDateTime>
+#include <QEventLoop>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QCoreApplication>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
 #include <qmath.h>
 #include <wcshdr.h>
 #include <wcsfix.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 //CFitsio Includes
 #include <fitsio.h>
@@ -268,7 +280,7 @@ void ExternalExtractorSolver::run()
                         cleanupTempFiles();
                         emit finished(result);
                     }
-                    if(m_SolverType == SOLVER_WATNEYASTROMETRY)
+                    else if(m_SolverType == SOLVER_WATNEYASTROMETRY)
                     {
                         int result = runExternalWatneySolver();
                         cleanupTempFiles();
@@ -342,12 +354,15 @@ ExtractorSolver* ExternalExtractorSolver::spawnChildSolver(int n)
     return solver;
 }
 
-//This is the abort method.  For the external SExtractor and solver, it uses the kill method to abort the processes and writes a cancel file for astrometry-engine to stop.
+//This is the abort method.  For the external SExtractor and solver, it ends the event loop waiting for the processes, which kills them, and writes a cancel file for astrometry-engine to stop.
+//The processes belong to the solver's thread, so they are only killed from this thread if it is the one waiting for them.
 void ExternalExtractorSolver::abort()
 {
+    m_WasAborted = true;
     if(solver)
     {
-        solver->kill();
+        if(solver->thread() == QThread::currentThread())
+            solver->kill();
         if(m_SolverType == SSolver::SOLVER_LOCALASTROMETRY)
         {
             QFile file(cancelfn);
@@ -359,12 +374,52 @@ void ExternalExtractorSolver::abort()
             }
         }
     }
-    if(extractorProcess)
+    if(extractorProcess && extractorProcess->thread() == QThread::currentThread())
         extractorProcess->kill();
     if(!isChildSolver)
         emit logOutput("Aborting ...");
     quit();
-    m_WasAborted = true;
+}
+
+ExternalExtractorSolver::ProcessResult ExternalExtractorSolver::waitForProcess(QProcess *process, int timeout)
+{
+    if(process->state() == QProcess::Starting)
+        process->waitForStarted();
+    QElapsedTimer elapsed;
+    elapsed.start();
+    if(QThread::currentThread() == this)
+    {
+        //QThread::quit in abort ends every event loop of this thread, including this one
+        QEventLoop loop;
+        QTimer timer;
+        timer.setSingleShot(true);
+        connect(process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), &loop, &QEventLoop::quit);
+        connect(&timer, &QTimer::timeout, &loop, &QEventLoop::quit);
+        if(timeout > 0)
+            timer.start(timeout);
+        if(process->state() != QProcess::NotRunning && !m_WasAborted)
+            loop.exec();
+    }
+    else
+    {
+        //This is not the solver's thread, such as when the stars are extracted before a parallel solve, so it waits in short steps to notice an abort
+        while(process->state() != QProcess::NotRunning && !m_WasAborted && (timeout <= 0 || elapsed.elapsed() < timeout))
+            process->waitForFinished(100);
+    }
+
+    if(process->state() == QProcess::NotRunning)
+        return PROCESS_FINISHED;
+    process->kill();
+    process->waitForFinished(1000);
+    return m_WasAborted ? PROCESS_ABORTED : PROCESS_TIMED_OUT;
+}
+
+int ExternalExtractorSolver::solverTimeout() const
+{
+    //Set to timeout in a little longer than the time limit
+    if(m_ActiveParameters.solverTimeLimitMS > 0)
+        return m_ActiveParameters.solverTimeLimitMS * 1.2;
+    return m_ActiveParameters.solverTimeLimit * 1000 * 1.2;
 }
 
 void ExternalExtractorSolver::cleanupTempFiles()
@@ -377,11 +432,6 @@ void ExternalExtractorSolver::cleanupTempFiles()
         temp.remove(m_BaseName + ".fit");
         temp.remove(m_BaseName + ".fits");
 
-        //SExtractor Files
-        temp.remove(m_BaseName + ".param");
-        temp.remove(m_BaseName + ".conv");
-        temp.remove(m_BaseName + ".cfg");
-
         //ASTAP files
         temp.remove(m_BaseName + ".ini");
 
@@ -399,8 +449,6 @@ void ExternalExtractorSolver::cleanupTempFiles()
         QFile solvedFile(solvedfn);
         solvedFile.setPermissions(solvedFile.permissions() | QFileDevice::WriteOther);
         solvedFile.remove();
-        if(autoGenerateAstroConfig)
-            QFile(externalPaths.confPath).remove();
         QFile(solutionFile).remove();
         //I wish we could remove the cancel file, but if we do this in a parallel solve, the other solvers might not stop.
         //if(!isChildSolver)
@@ -437,16 +485,9 @@ int ExternalExtractorSolver::runExternalExtractor()
     //SExtractor needs a default.param file in the working directory
     //This creates that file with the options we need for astrometry.net and SExtractor
 
-    QString paramPath =  m_BasePath + "/" + m_BaseName + ".param";
-    QFile paramFile(paramPath);
-    if (paramFile.open(QIODevice::WriteOnly) == false)
-    {
-        QMessageBox::critical(nullptr, "Message", "SExtractor file write error.");
-        return -1;
-    }
-    else
+    QByteArray params;
     {
-        QTextStream out(&paramFile);
+        QTextStream out(&params);
         out << "X_IMAGE\n";//                  Object position along x                                   [pixel]
         out << "Y_IMAGE\n";//                  Object position along y                                   [pixel]
         out << "MAG_AUTO\n";//                 Kron-like elliptical aperture magnitude                   [mag]
@@ -457,7 +498,12 @@ int ExternalExtractorSolver::runExternalExtractor()
         out << "CXY_IMAGE\n";//                Cxy object ellipse parameter                              [pixel**(-2)]
         if(m_ProcessType == EXTRACT_WITH_HFR)
             out << "FLUX_RADIUS\n";//              Fraction-of-light radii                                   [pixel]
-        paramFile.close();
+    }
+    const QString paramPath = cachedConfigFile("param", params);
+    if (paramPath.isEmpty())
+    {
+        emit logOutput("Could not write the SExtractor parameters file to " + m_BasePath);
+        return -1;
     }
     sextractorArgs << "-PARAMETERS_NAME" << paramPath;
 
@@ -465,16 +511,9 @@ int ExternalExtractorSolver::runExternalExtractor()
     //SExtractor needs a default.conv file in the working directory
     //This creates the default one
 
-    QString convPath =  m_BasePath + "/" + m_BaseName + ".conv";
-    QFile convFile(convPath);
-    if (convFile.open(QIODevice::WriteOnly) == false)
-    {
-        QMessageBox::critical(nullptr, "Message", "SExtractor CONV filter write error.");
-        return -1;
-    }
-    else
+    QByteArray conv;
     {
-        QTextStream out(&convFile);
+        QTextStream out(&conv);
         out << "CONV Filter Generated by StellarSolver Internal Library\n";
         int c = 0;
         for(int i = 0; i < convFilter.size(); i++)
@@ -493,7 +532,12 @@ int ExternalExtractorSolver::runExternalExtractor()
                 c = 0;
             }
         }
-        convFile.close();
+    }
+    const QString convPath = cachedConfigFile("conv", conv);
+    if (convPath.isEmpty())
+    {
+        emit logOutput("Could not write the SExtractor CONV filter file to " + m_BasePath);
+        return -1;
     }
 
     //Arguments from the default.sex file
@@ -533,8 +577,15 @@ int ExternalExtractorSolver::runExternalExtractor()
     emit logOutput(externalPaths.sextractorBinaryPath + " " + sextractorArgs.join(' '));
 
     extractorProcess->start(externalPaths.sextractorBinaryPath, sextractorArgs);
-    extractorProcess->waitForFinished(30000); //Will timeout after 30 seconds
+    ProcessResult result = waitForProcess(extractorProcess, m_ActiveParameters.externalExtractorTimeLimit * 1000);
     emit logOutput(extractorProcess->readAllStandardError().trimmed());
+    if(result == PROCESS_ABORTED)
+        return -1;
+    if(result == PROCESS_TIMED_OUT)
+    {
+        emit logOutput(QString("SExtractor timed out after %1 seconds").arg(m_ActiveParameters.externalExtractorTimeLimit));
+        return -1;
+    }
 
     if(extractorProcess->exitCode() != 0 || extractorProcess->exitStatus() == QProcess::CrashExit)
         return extractorProcess->exitCode();
@@ -648,15 +699,13 @@ int ExternalExtractorSolver::runExternalAstrometrySolver()
     emit logOutput("Starting external Astrometry.net solver with the " + m_ActiveParameters.listName + " profile...");
     emit logOutput("Command: " + externalPaths.solverPath + " " + solverArgs.join(" "));
 
-    //Set to timeout in a little longer than the timeout
-    solver->waitForFinished(m_ActiveParameters.solverTimeLimit * 1000 * 1.2);
-    if(m_WasAborted)
+    ProcessResult result = waitForProcess(solver, solverTimeout());
+    if(result == PROCESS_ABORTED)
         return -1;
-    if(solver->error() == QProcess::Timedout)
+    if(result == PROCESS_TIMED_OUT)
     {
         emit logOutput("Solver timed out, aborting");
-        abort();
-        return solver->exitCode();
+        return -1;
     }
     if(solver->exitCode() != 0)
     {
@@ -732,8 +781,7 @@ int ExternalExtractorSolver::runExternalASTAPSolver()
     emit logOutput("Starting external ASTAP Solver with the " + m_ActiveParameters.listName + " profile...");
     emit logOutput("Command: " + externalPaths.astapBinaryPath + " " + solverArgs.join(" "));
 
-    solver->waitForFinished(m_ActiveParameters.solverTimeLimit * 1000 *
-                            1.2); //Set to timeout in a little longer than the timeout
+    ProcessResult result = waitForProcess(solver, solverTimeout());
 
     if(m_AstrometryLogLevel != LOG_NONE)
     {
@@ -760,13 +808,12 @@ int ExternalExtractorSolver::runExternalASTAPSolver()
             emit logOutput("ASTAP log file " + logFile.fileName() + " does not exist.");
     }
 
-    if(m_WasAborted)
+    if(result == PROCESS_ABORTED)
         return -1;
-    if(solver->error() == QProcess::Timedout)
+    if(result == PROCESS_TIMED_OUT)
     {
         emit logOutput("Solver timed out, aborting");
-        abort();
-        return solver->exitCode();
+        return -1;
     }
     if(solver->exitCode() != 0)
     {
@@ -785,6 +832,30 @@ int ExternalExtractorSolver::runExternalASTAPSolver()
     return 0;
 }
 
+int ExternalExtractorSolver::prepareStarList()
+{
+    //The stars were given to this solver instead of being extracted, for instance when they are reused, so the list isn't written yet
+    if(!isChildSolver && m_ExtractorType == EXTRACTOR_INTERNAL && !QFileInfo::exists(starXYLSFilePath))
+    {
+        if(writeStarExtractorTable() != 0)
+            return -1;
+    }
+    QFileInfo sextractorFile(starXYLSFilePath);
+    if(!sextractorFile.exists())
+    {
+        emit logOutput("Please Star Extract the image first");
+        return -1;
+    }
+    if(isChildSolver)
+    {
+        QString newFileURL = m_BasePath + "/" + m_BaseName + "." + sextractorFile.suffix();
+        QFile::copy(starXYLSFilePath, newFileURL);
+        starXYLSFilePath = newFileURL;
+        starXYLSFilePathIsTempFile = true;
+    }
+    return 0;
+}
+
 int ExternalExtractorSolver::runExternalWatneySolver()
 {
     emit logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
@@ -799,21 +870,8 @@ int ExternalExtractorSolver::runExternalWatneySolver()
             return ret;
         }
     }
-    else
-    {
-        QFileInfo sextractorFile(starXYLSFilePath);
-        if(!sextractorFile.exists())
-        {
-            emit logOutput("Please Star Extract the image first");
-        }
-        if(isChildSolver)
-        {
-            QString newFileURL = m_BasePath + "/" + m_BaseName + "." + sextractorFile.suffix();
-            QFile::copy(starXYLSFilePath, newFileURL);
-            starXYLSFilePath = newFileURL;
-            starXYLSFilePathIsTempFile = true;
-        }
-    }
+    else if(prepareStarList() != 0)
+        return -1;
 
     QStringList solverArgs;
 
@@ -849,7 +907,8 @@ int ExternalExtractorSolver::runExternalWatneySolver()
     else
     {
         solverArgs << "-i" << fileToProcess;
-        solverArgs << "--max-stars" << QString::number(m_ActiveParameters.keepNum);
+        if(m_ActiveParameters.keepNum != 0)
+            solverArgs << "--max-stars" << QString::number(m_ActiveParameters.keepNum);
     }
     if(m_ActiveParameters.multiAlgorithm == SSolver::NOT_MULTI)
         solverArgs << "--use-parallelism" << "false";
@@ -886,8 +945,7 @@ int ExternalExtractorSolver::runExternalWatneySolver()
     emit logOutput("Starting external Watney Solver with the " + m_ActiveParameters.listName + " profile...");
     emit logOutput("Command: " + externalPaths.watneyBinaryPath + " " + solverArgs.join(" "));
 
-    solver->waitForFinished(m_ActiveParameters.solverTimeLimit * 1000 *
-                            1.2); //Set to timeout in a little longer than the timeout
+    ProcessResult result = waitForProcess(solver, solverTimeout());
 
     if(m_AstrometryLogLevel != LOG_NONE)
     {
@@ -914,13 +972,12 @@ int ExternalExtractorSolver::runExternalWatneySolver()
             emit logOutput("Watney log file " + logFile.fileName() + " does not exist.");
     }
 
-    if(m_WasAborted)
+    if(result == PROCESS_ABORTED)
         return -1;
-    if(solver->error() == QProcess::Timedout)
+    if(result == PROCESS_TIMED_OUT)
     {
         emit logOutput("Solver timed out, aborting");
-        abort();
-        return solver->exitCode();
+        return -1;
     }
     if(solver->exitCode() != 0)
     {
@@ -1051,16 +1108,9 @@ bool ExternalExtractorSolver::generateAstrometryConfigFile()
         if(QFile(externalPaths.confPath).exists())
             return false;
     }
-    externalPaths.confPath =  m_BasePath + "/" + m_BaseName + ".cfg";
-    QFile configFile(externalPaths.confPath);
-    if (configFile.open(QIODevice::WriteOnly) == false)
-    {
-        QMessageBox::critical(nullptr, "Message", "Config file write error.");
-        return false;
-    }
-    else
+    QByteArray config;
     {
-        QTextStream out(&configFile);
+        QTextStream out(&config);
         if(m_ActiveParameters.inParallel)
             out << "inparallel\n";
         out << "minwidth " << m_ActiveParameters.minwidth << "\n";
@@ -1076,11 +1126,31 @@ bool ExternalExtractorSolver::generateAstrometryConfigFile()
         {
             out << "index " << file << "\n";
         }
-        configFile.close();
     }
+    const QString confPath = cachedConfigFile("cfg", config);
+    if (confPath.isEmpty())
+    {
+        emit logOutput("Could not write the astrometry.net config file to " + m_BasePath);
+        return false;
+    }
+    externalPaths.confPath = confPath;
     return true;
 }
 
+QString ExternalExtractorSolver::cachedConfigFile(const QString &suffix, const QByteArray &contents)
+{
+    const QString path = m_BasePath + "/stellarsolver-"
+                         + QString::fromLatin1(QCryptographicHash::hash(contents, QCryptographicHash::Sha1).toHex()) + "." + suffix;
+    const QFileInfo existing(path);
+    if(existing.exists() && existing.size() == contents.size())
+        return path;
+    // QSaveFile replaces the file in one step, so a parallel solver that writes the same one never reads half of it
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly) || file.write(contents) != contents.size() || !file.commit())
+        return QString();
+    return path;
+}
+
 
 //These methods are for the logging of information to the textfield at the bottom of the window.
 
@@ -1141,6 +1211,170 @@ void ExternalExtractorSolver::logSolver()
     }
 }
 
+// The FITS files are made of blocks of 2880 bytes, and the headers of cards of 80 characters
+static const int FITS_BLOCK = 2880;
+static const int FITS_CARD = 80;
+
+static qint64 fitsBlocks(qint64 bytes)
+{
+    return (bytes + FITS_BLOCK - 1) / FITS_BLOCK * FITS_BLOCK;
+}
+
+// This reads the cards of a header that starts at offset into a map of the keywords and their values, without the quotes and comments.
+// It returns the offset of the data after the header, or -1 if the header doesn't end inside of the file.
+static qint64 readFITSHeader(const QByteArray &file, qint64 offset, QHash<QByteArray, QByteArray> &keywords)
+{
+    keywords.clear();
+    for(; offset + FITS_BLOCK <= file.size(); offset += FITS_BLOCK)
+    {
+        for(int card = 0; card < FITS_BLOCK; card += FITS_CARD)
+        {
+            const QByteArray line = file.mid(offset + card, FITS_CARD);
+            const QByteArray keyword = line.left(8).trimmed();
+            if(keyword == "END")
+                return offset + FITS_BLOCK;
+            if(line.mid(8, 2) != "= ")
+                continue;
+            QByteArray value = line.mid(10).trimmed();
+            if(value.startsWith('\''))
+            {
+                int end = 1;
+                while((end = value.indexOf('\'', end)) >= 0 && value.mid(end, 2) == "''")
+                    end += 2;
+                value = value.mid(1, end - 1).replace("''", "'").trimmed();
+            }
+            else if(value.contains('/'))
+                value = value.left(value.indexOf('/')).trimmed();
+            keywords.insert(keyword, value);
+        }
+    }
+    return -1;
+}
+
+//This reads the star table that SExtractor or the internal writer made without CFITSIO, since the whole table is read in one go
+//and the columns are converted right from their bytes.  It only reads binary tables of plain numeric columns,
+//it returns false for anything else so that the CFITSIO reader below can read it.
+bool ExternalExtractorSolver::readStarsFromBinaryTable()
+{
+    QFile sextractorFile(starXYLSFilePath);
+    if(!sextractorFile.open(QIODevice::ReadOnly))
+        return false;
+    const QByteArray file = sextractorFile.readAll();
+    sextractorFile.close();
+
+    // The table is in the first extension, so the primary HDU is skipped
+    QHash<QByteArray, QByteArray> keywords;
+    qint64 offset = readFITSHeader(file, 0, keywords);
+    if(offset < 0 || keywords.value("SIMPLE") != "T")
+        return false;
+    const int naxis = keywords.value("NAXIS").toInt();
+    if(naxis > 0)
+    {
+        qint64 pixels = 1;
+        for(int axis = 1; axis <= naxis; axis++)
+            pixels *= keywords.value("NAXIS" + QByteArray::number(axis)).toLongLong();
+        offset += fitsBlocks(qAbs(keywords.value("BITPIX").toInt()) / 8 * pixels);
+    }
+
+    offset = readFITSHeader(file, offset, keywords);
+    if(offset < 0 || keywords.value("XTENSION") != "BINTABLE")
+        return false;
+    const qint64 rowBytes = keywords.value("NAXIS1").toLongLong();
+    const qint64 nrows = keywords.value("NAXIS2").toLongLong();
+    const int ncols = keywords.value("TFIELDS").toInt();
+    if(rowBytes <= 0 || nrows < 0 || offset + rowBytes * nrows > file.size())
+        return false;
+
+    // Only the first 9 columns are used. Scaled, unsigned or null valued columns are left to CFITSIO.
+    const int usedCols = qMin(ncols, 9);
+    QVector<char> types(usedCols);
+    QVector<int> offsets(usedCols);
+    int colOffset = 0;
+    for(int col = 1; col <= ncols; col++)
+    {
+        const QByteArray number = QByteArray::number(col);
+        if(col <= usedCols && (keywords.contains("TSCAL" + number) || keywords.contains("TZERO" + number) || keywords.contains("TNULL" + number)))
+            return false;
+        const QByteArray tform = keywords.value("TFORM" + number);
+        int digits = 0;
+        while(digits < tform.size() && tform.at(digits) >= '0' && tform.at(digits) <= '9')
+            digits++;
+        if(digits == tform.size())
+            return false;
+        const int repeat = digits > 0 ? tform.left(digits).toInt() : 1;
+        const char type = tform.at(digits);
+        int size;
+        switch(type)
+        {
+            case 'L': case 'B': case 'A': size = 1; break;
+            case 'X': size = 0; break;
+            case 'I': size = 2; break;
+            case 'J': case 'E': size = 4; break;
+            case 'K': case 'D': case 'C': case 'P': size = 8; break;
+            case 'M': case 'Q': size = 16; break;
+            default: return false;
+        }
+        if(col <= usedCols)
+        {
+            if(repeat != 1 || !QByteArray("BIJKED").contains(type))
+                return false;
+            types[col - 1] = type;
+            offsets[col - 1] = colOffset;
+        }
+        colOffset += type == 'X' ? (repeat + 7) / 8 : size * repeat;
+    }
+    if(colOffset != rowBytes)
+        return false;
+
+    m_ExtractedStars.clear();
+    m_ExtractedStars.reserve(nrows);
+    const uchar *data = reinterpret_cast<const uchar *>(file.constData()) + offset;
+    for(qint64 row = 0; row < nrows; row++, data += rowBytes)
+    {
+        float columns[9] = {0};
+        for(int col = 0; col < usedCols; col++)
+        {
+            const uchar *cell = data + offsets[col];
+            switch(types[col])
+            {
+                case 'B':
+                    columns[col] = *cell;
+                    break;
+                case 'I':
+                    columns[col] = qFromBigEndian<qint16>(cell);
+                    break;
+                case 'J':
+                    columns[col] = qFromBigEndian<qint32>(cell);
+                    break;
+                case 'K':
+                    columns[col] = qFromBigEndian<qint64>(cell);
+                    break;
+                case 'E':
+                {
+                    const quint32 bits = qFromBigEndian<quint32>(cell);
+                    float value;
+                    memcpy(&value, &bits, sizeof(value));
+                    columns[col] = value;
+                    break;
+                }
+                case 'D':
+                {
+                    const quint64 bits = qFromBigEndian<quint64>(cell);
+                    double value;
+                    memcpy(&value, &bits, sizeof(value));
+                    columns[col] = value;
+                    break;
+                }
+            }
+            // CFITSIO reads the undefined values as "*", which became 0
+            if(qIsNaN(columns[col]))
+                columns[col] = 0;
+        }
+        m_ExtractedStars.append(starFromColumns(columns, usedCols));
+    }
+    return true;
+}
+
 //This method is copied and pasted and modified from tablist.c in astrometry.net
 //This is needed to load in the stars sextracted by an external SExtractor to get them into the table
 int ExternalExtractorSolver::getStarsFromXYLSFile()
@@ -1152,6 +1386,9 @@ int ExternalExtractorSolver::getStarsFromXYLSFile()
         return -1;
     }
 
+    if(readStarsFromBinaryTable())
+        return 0;
+
     fitsfile * new_fptr;
     char error_status[512];
 
@@ -1195,15 +1432,7 @@ int ExternalExtractorSolver::getStarsFromXYLSFile()
     val = value;
     for (jj = 1; jj <= nrows && !status; jj++)
     {
-        float starx = 0;
-        float stary = 0;
-        float mag = 0;
-        float flux = 0;
-        float peak = 0;
-        float xx = 0;
-        float yy = 0;
-        float xy = 0;
-        float HFR = 0;
+        float columns[9] = {0};
 
         for (ii = 1; ii <= ncols; ii++)
         {
@@ -1213,67 +1442,12 @@ int ExternalExtractorSolver::getStarsFromXYLSFile()
                 if (fits_read_col_str (new_fptr, ii, jj, kk, 1, nullptrstr,
                                        &val, &anynul, &status) )
                     break;  /* jump out of loop on error */
-                if(m_SolverType == SOLVER_LOCALASTROMETRY || m_SolverType == SOLVER_ONLINEASTROMETRY)
-                {
-                    if(ii == 1)
-                        starx = QString(value).trimmed().toFloat();
-                    if(ii == 2)
-                        stary = QString(value).trimmed().toFloat();
-                    if(ii == 3)
-                        flux = QString(value).trimmed().toFloat();
-                }
-                else if(m_SolverType == SOLVER_ASTAP)
-                {
-                    if(ii == 1)
-                        starx = QString(value).trimmed().toFloat();
-                    if(ii == 2)
-                        stary = QString(value).trimmed().toFloat();
-                }
-                else
-                {
-                    if(ii == 1)
-                        starx = QString(value).trimmed().toFloat();
-                    if(ii == 2)
-                        stary = QString(value).trimmed().toFloat();
-                    if(ii == 3)
-                        mag = QString(value).trimmed().toFloat();
-                    if(ii == 4)
-                        flux = QString(value).trimmed().toFloat();
-                    if(ii == 5)
-                        peak = QString(value).trimmed().toFloat();
-                    if(ii == 6)
-                        xx = QString(value).trimmed().toFloat();
-                    if(ii == 7)
-                        yy = QString(value).trimmed().toFloat();
-                    if(ii == 8)
-                        xy = QString(value).trimmed().toFloat();
-                    if(m_ProcessType == EXTRACT_WITH_HFR && ii == 9)
-                        HFR = QString(value).trimmed().toFloat();
-                }
+                if(ii <= 9)
+                    columns[ii - 1] = QString(value).trimmed().toFloat();
             }
         }
 
-        //  xx  xy      or     a   b
-        //  xy  yy             b   c
-        //Note, I got this translation from these two sources which agree:
-        //https://books.google.com/books?id=JNEn23UyHuAC&pg=PA84&lpg=PA84&dq=ellipse+xx+yy+xy&source=bl&ots=ynAWge4jlb&sig=ACfU3U1pqZTkx8Teu9pBTygI9F-WcTncrg&hl=en&sa=X&ved=2ahUKEwj0s-7C3I7oAhXblnIEHacAAf0Q6AEwBHoECAUQAQ#v=onepage&q=ellipse%20xx%20yy%20xy&f=false
-        //https://cookierobotics.com/007/
-        float a = 0;
-        float b = 0;
-        float theta = 0;
-        if(m_SolverType != SOLVER_LOCALASTROMETRY && m_SolverType != SOLVER_ONLINEASTROMETRY && m_SolverType != SOLVER_ASTAP)
-        {
-            float thing = sqrt( pow(xx - yy, 2) + 4 * pow(xy, 2) );
-            float lambda1 = (xx + yy + thing) / 2;
-            float lambda2 = (xx + yy - thing) / 2;
-            a = sqrt(lambda1);
-            b = sqrt(lambda2);
-            theta = qRadiansToDegrees(atan(xy / (lambda1 - yy)));
-        }
-
-        FITSImage::Star star = {starx, stary, mag, flux, peak, HFR, a, b, theta, 0, 0, (int)(a*b * 3.14)};
-
-        m_ExtractedStars.append(star);
+        m_ExtractedStars.append(starFromColumns(columns, qMin(ncols, 9)));
     }
     fits_close_file(new_fptr, &status);
 
@@ -1282,6 +1456,83 @@ int ExternalExtractorSolver::getStarsFromXYLSFile()
     return 0;
 }
 
+FITSImage::Star ExternalExtractorSolver::starFromColumns(const float *columns, int ncols) const
+{
+    float starx = 0;
+    float stary = 0;
+    float mag = 0;
+    float flux = 0;
+    float peak = 0;
+    float xx = 0;
+    float yy = 0;
+    float xy = 0;
+    float HFR = 0;
+
+    for (int ii = 1; ii <= ncols; ii++)
+    {
+        const float value = columns[ii - 1];
+        if(m_SolverType == SOLVER_LOCALASTROMETRY || m_SolverType == SOLVER_ONLINEASTROMETRY)
+        {
+            if(ii == 1)
+                starx = value;
+            if(ii == 2)
+                stary = value;
+            if(ii == 3)
+                flux = value;
+        }
+        else if(m_SolverType == SOLVER_ASTAP)
+        {
+            if(ii == 1)
+                starx = value;
+            if(ii == 2)
+                stary = value;
+        }
+        else
+        {
+            if(ii == 1)
+                starx = value;
+            if(ii == 2)
+                stary = value;
+            if(ii == 3)
+                mag = value;
+            if(ii == 4)
+                flux = value;
+            if(ii == 5)
+                peak = value;
+            if(ii == 6)
+                xx = value;
+            if(ii == 7)
+                yy = value;
+            if(ii == 8)
+                xy = value;
+            if(m_ProcessType == EXTRACT_WITH_HFR && ii == 9)
+                HFR = value;
+        }
+    }
+
+    //  xx  xy      or     a   b
+    //  xy  yy             b   c
+    //Note, I got this translation from these two sources which agree:
+    //https://books.google.com/books?id=JNEn23UyHuAC&pg=PA84&lpg=PA84&dq=ellipse+xx+yy+xy&source=bl&ots=ynAWge4jlb&sig=ACfU3U1pqZTkx8Teu9pBTygI9F-WcTncrg&hl=en&sa=X&ved=2ahUKEwj0s-7C3I7oAhXblnIEHacAAf0Q6AEwBHoECAUQAQ#v=onepage&q=ellipse%20xx%20yy%20xy&f=false
+    //https://cookierobotics.com/007/
+    float a = 0;
+    float b = 0;
+    float theta = 0;
+    if(m_SolverType != SOLVER_LOCALASTROMETRY && m_SolverType != SOLVER_ONLINEASTROMETRY && m_SolverType != SOLVER_ASTAP)
+    {
+        float thing = sqrt( pow(xx - yy, 2) + 4 * pow(xy, 2) );
+        float lambda1 = (xx + yy + thing) / 2;
+        float lambda2 = (xx + yy - thing) / 2;
+        a = sqrt(lambda1);
+        b = sqrt(lambda2);
+        theta = qRadiansToDegrees(atan(xy / (lambda1 - yy)));
+    }
+
+    FITSImage::Star star = {starx, stary, mag, flux, peak, HFR, a, b, theta, 0, 0, (int)(a*b * 3.14)};
+
+    return star;
+}
+
 //This method was based on a method in KStars.
 //It reads the information from the Solution file from Astrometry.net and puts it into the solution
 bool ExternalExtractorSolver::getSolutionInformation()
@@ -1306,7 +1557,8 @@ bool ExternalExtractorSolver::getSolutionInformation()
 #endif
 
     wcsProcess.start(externalPaths.wcsPath, QStringList(solutionFile));
-    wcsProcess.waitForFinished(30000); //Will timeout after 30 seconds
+    if(waitForProcess(&wcsProcess, m_ActiveParameters.externalExtractorTimeLimit * 1000) != PROCESS_FINISHED)
+        return false;
     QString wcsinfo_stdout = wcsProcess.readAllStandardOutput();
 
     //This is a quick way to find out what keys are available
@@ -1591,17 +1843,41 @@ bool ExternalExtractorSolver::getWatneySolutionInformation()
 }
 
 
+// These make the header cards, with the values in the fixed format of the FITS standard
+static void appendFITSCard(QByteArray &header, const char *keyword, const QByteArray &value)
+{
+    header.append(QByteArray(keyword).leftJustified(8, ' ') + "= " + value.leftJustified(FITS_CARD - 10, ' ', true));
+}
+
+static QByteArray fitsValue(qint64 value)
+{
+    return QByteArray::number(value).rightJustified(20, ' ');
+}
+
+static QByteArray fitsLogical(bool value)
+{
+    return QByteArray(value ? "T" : "F").rightJustified(20, ' ');
+}
+
+static QByteArray fitsString(const char *value)
+{
+    return "'" + QByteArray(value).leftJustified(8, ' ') + "'";
+}
+
+static void endFITSHeader(QByteArray &header)
+{
+    header.append(QByteArray("END").leftJustified(FITS_CARD, ' '));
+    header.append(QByteArray(fitsBlocks(header.size()) - header.size(), ' '));
+}
+
 //This method writes the table to the file
-//I had to create it from the examples on NASA's website
 //When I first made this program, I needed it to generate an xyls file from the internal star extraction
 //Now it is just used on Windows for the external solving because it needs to use the internal star extractor and the external solver.
-//https://heasarc.gsfc.nasa.gov/docs/software/fitsio/quick/node10.html
-//https://heasarc.gsfc.nasa.gov/docs/software/fitsio/cookbook/node16.html
+//It used to copy the stars into an array for each column and write them through CFITSIO.
+//The file is just a header and the rows of big endian floats, so now it is put together in memory straight from the star list and written in one go.
+//https://fits.gsfc.nasa.gov/fits_standard.html
 int ExternalExtractorSolver::writeStarExtractorTable()
 {
-    int status = 0;
-    fitsfile * new_fptr;
-
     if(starXYLSFilePath == "")
     {
         starXYLSFilePathIsTempFile = true;
@@ -1612,80 +1888,88 @@ int ExternalExtractorSolver::writeStarExtractorTable()
     if(sextractorFile.exists())
         sextractorFile.remove();
 
-    if (fits_create_file(&new_fptr, starXYLSFilePath.toLocal8Bit(), &status))
-    {
-        fits_report_error(stderr, status);
-        return status;
-    }
-
-    int tfields = 3;
-    int nrows = m_ExtractedStars.size();
-
-    //Columns: X_IMAGE, double, pixels, Y_IMAGE, double, pixels, MAG_AUTO, double, mag
-    char* ttype[] = { xcol, ycol, magcol };
-    char* tform[] = { colFormat, colFormat, colFormat };
-    char* tunit[] = { colUnits, colUnits, magUnits };
-    const char* extfile = "SExtractor_File";
-
-    float *xArray = new float[m_ExtractedStars.size()];
-    float *yArray = new float[m_ExtractedStars.size()];
-    float *magArray = new float[m_ExtractedStars.size()];
-
-    for (int i = 0; i < m_ExtractedStars.size(); i++)
-    {
-        xArray[i] = m_ExtractedStars.at(i).x;
-        yArray[i] = m_ExtractedStars.at(i).y;
-        magArray[i] = m_ExtractedStars.at(i).mag;
-    }
-
-    int firstrow  = 1;  /* first row in table to write   */
-    int firstelem = 1;
-    int column = 1;
-
-    if(fits_create_tbl(new_fptr, BINARY_TBL, nrows, tfields,
-                       ttype, tform, tunit, extfile, &status))
-    {
-        emit logOutput(QString("Could not create binary table."));
-        goto exit;
-    }
-
-    if(fits_write_col(new_fptr, TFLOAT, column, firstrow, firstelem, nrows, xArray, &status))
-    {
-        emit logOutput(QString("Could not write x pixels in binary table."));
-        goto exit;
-    }
-
-    column = 2;
-    if(fits_write_col(new_fptr, TFLOAT, column, firstrow, firstelem, nrows, yArray, &status))
-    {
-        emit logOutput(QString("Could not write y pixels in binary table."));
-        goto exit;
+    const int tfields = 3;
+    const int rowBytes = tfields * sizeof(float);
+    const int nrows = m_ExtractedStars.size();
+
+    QByteArray file;
+    file.reserve(2 * FITS_BLOCK + fitsBlocks(nrows * rowBytes));
+    appendFITSCard(file, "SIMPLE", fitsLogical(true));
+    appendFITSCard(file, "BITPIX", fitsValue(8));
+    appendFITSCard(file, "NAXIS", fitsValue(0));
+    appendFITSCard(file, "EXTEND", fitsLogical(true));
+    endFITSHeader(file);
+
+    //Columns: X_IMAGE, float, pixels, Y_IMAGE, float, pixels, MAG_AUTO, float, mag
+    const char* ttype[] = { xcol, ycol, magcol };
+    const char* tunit[] = { colUnits, colUnits, magUnits };
+    QByteArray header;
+    appendFITSCard(header, "XTENSION", fitsString("BINTABLE"));
+    appendFITSCard(header, "BITPIX", fitsValue(8));
+    appendFITSCard(header, "NAXIS", fitsValue(2));
+    appendFITSCard(header, "NAXIS1", fitsValue(rowBytes));
+    appendFITSCard(header, "NAXIS2", fitsValue(nrows));
+    appendFITSCard(header, "PCOUNT", fitsValue(0));
+    appendFITSCard(header, "GCOUNT", fitsValue(1));
+    appendFITSCard(header, "TFIELDS", fitsValue(tfields));
+    for(int col = 0; col < tfields; col++)
+    {
+        const QByteArray number = QByteArray::number(col + 1);
+        appendFITSCard(header, ("TTYPE" + number).constData(), fitsString(ttype[col]));
+        appendFITSCard(header, ("TFORM" + number).constData(), fitsString(colFormat));
+        appendFITSCard(header, ("TUNIT" + number).constData(), fitsString(tunit[col]));
+    }
+    appendFITSCard(header, "EXTNAME", fitsString("SExtractor_File"));
+    endFITSHeader(header);
+    file.append(header);
+
+    // The rows go right after the header, and the data is padded with zeros to the end of the block
+    const int dataStart = file.size();
+    file.resize(dataStart + fitsBlocks(nrows * rowBytes));
+    uchar *data = reinterpret_cast<uchar *>(file.data()) + dataStart;
+    for(int i = 0; i < nrows; i++)
+    {
+        const FITSImage::Star &star = m_ExtractedStars.at(i);
+        const float row[tfields] = { star.x, star.y, star.mag };
+        for(int col = 0; col < tfields; col++, data += sizeof(float))
+        {
+            quint32 bits;
+            memcpy(&bits, &row[col], sizeof(bits));
+            qToBigEndian(bits, data);
+        }
     }
+    memset(data, 0, reinterpret_cast<uchar *>(file.data()) + file.size() - data);
 
-    column = 3;
-    if(fits_write_col(new_fptr, TFLOAT, column, firstrow, firstelem, nrows, magArray, &status))
+    if(!sextractorFile.open(QIODevice::WriteOnly) || sextractorFile.write(file) != file.size())
     {
-        emit logOutput(QString("Could not write magnitudes in binary table."));
-        goto exit;
+        emit logOutput(QString("Could not write the star table: %1").arg(sextractorFile.errorString()));
+        sextractorFile.close();
+        sextractorFile.remove();
+        return -1;
     }
+    sextractorFile.close();
+    return 0;
+}
 
-    if(fits_close_file(new_fptr, &status))
+// This swaps the pixels into the big endian order of FITS, flipping the sign bit of the unsigned ones, which FITS stores as
+// signed values with a BZERO that moves them back
+template <typename T>
+static void fitsPixels(const uint8_t *pixels, uchar *data, qint64 count, T signBit)
+{
+    for(qint64 i = 0; i < count; i++)
     {
-        emit logOutput(QString("Error closing file."));
-        goto exit;
+        T value;
+        memcpy(&value, pixels + i * sizeof(T), sizeof(T));
+        qToBigEndian<T>(value ^ signBit, data + i * sizeof(T));
     }
-    status = 0;
-
-exit:
-    delete[] xArray;
-    delete[] yArray;
-    delete[] magArray;
-
-    return status;
 }
 
 //This is very necessary for solving non-fits images with the external Star Extractor
-//This was copied and pasted and modified from ImageToFITS in fitsdata in KStars
+//It used to be copied from ImageToFITS in fitsdata in KStars and write the image through CFITSIO, which is not reentrant in most builds,
+//so the images of parallel solvers and batches had to be converted one at a time.  A single image with a few keywords is just a header
+//and the big endian pixels, so now it is written straight from the image buffer like writeStarExtractorTable, and any number of
+//solvers can convert their images at the same time.
+//https://fits.gsfc.nasa.gov/fits_standard.html
 int ExternalExtractorSolver::saveAsFITS()
 {
     //Only merge image channels if it is an RGB image and we are either averaging or integrating the channels
@@ -1694,117 +1978,194 @@ int ExternalExtractorSolver::saveAsFITS()
 
     QString newFilename = m_BasePath + "/" + m_BaseName + ".fit";
 
-    int status = 0;
-    fitsfile * new_fptr;
-
-    // We are only going to export a monochromatic image because SExtractor and most solvers don't use all three channels
-    // We will export the selected channel if it is an RGB image
-    long naxis = 2;
-    long channelShift = (m_Statistics.channels < 3
-                         || usingMergedChannelImage) ? 0 : m_Statistics.samples_per_channel * m_Statistics.bytesPerPixel * m_ColorChannel;
-    long nelements, exposure;
-    long naxes[3] = { m_Statistics.width, m_Statistics.height, 1 };
-    char error_status[512] = {0};
-
-    QFileInfo newFileInfo(newFilename);
-    if(newFileInfo.exists())
-        QFile(newFilename).remove();
-
-    nelements = m_Statistics.samples_per_channel;
+    //This file was already written for this image, for instance by the parent of this child solver
+    if(fileToProcessIsTempFile && QFileInfo(fileToProcess) == QFileInfo(newFilename) && QFileInfo::exists(newFilename))
+        return 0;
 
-    /* Create a new File, overwriting existing*/
-    if (fits_create_file(&new_fptr, newFilename.toLocal8Bit(), &status))
+    //If the image was loaded from a plain FITS file, the external programs can read that one, so it is only linked
+    //to the temp directory, where their outputs and the temp files get cleaned up, instead of being written again.
+    if(originalFileMatchesBuffer() && linkOriginalFile(newFilename))
     {
-        fits_report_error(stderr, status);
-        return status;
+        emit logOutput("Linked the original FITS file:" + fileToProcess + " to " + newFilename);
+        fileToProcess = newFilename;
+        fileToProcessIsTempFile = true;
+        return 0;
     }
 
-    int bitpix;
+    // We are only going to export a monochromatic image because SExtractor and most solvers don't use all three channels
+    // We will export the selected channel if it is an RGB image
+    const qint64 channelShift = (m_Statistics.channels < 3
+                                 || usingMergedChannelImage) ? 0 : m_Statistics.samples_per_channel * m_Statistics.bytesPerPixel * m_ColorChannel;
+    const uint8_t *pixels = m_ImageBuffer + channelShift;
+    const qint64 nelements = m_Statistics.samples_per_channel;
+
+    int bitpix = 0;
+    qint64 bzero = 0;
     switch(m_Statistics.dataType)
     {
         case SEP_TBYTE:
-            bitpix = BYTE_IMG;
+            bitpix = 8;
             break;
         case TSHORT:
-            bitpix = SHORT_IMG;
+            bitpix = 16;
             break;
         case TUSHORT:
-            bitpix = USHORT_IMG;
+            bitpix = 16;
+            bzero = 32768;
             break;
         case TLONG:
-            bitpix = LONG_IMG;
+            bitpix = 32;
             break;
         case TULONG:
-            bitpix = ULONG_IMG;
+            bitpix = 32;
+            bzero = 2147483648LL;
+            break;
+        case TLONGLONG:
+            bitpix = 64;
             break;
         case TFLOAT:
-            bitpix = FLOAT_IMG;
+            bitpix = -32;
             break;
         case TDOUBLE:
-            bitpix = DOUBLE_IMG;
+            bitpix = -64;
             break;
         default:
-            bitpix = BYTE_IMG;
+            break;
     }
-
-    fitsfile *fptr = new_fptr;
-    if (fits_create_img(fptr, bitpix, naxis, naxes, &status))
+    const int pixelBytes = qAbs(bitpix) / 8;
+    if(bitpix == 0 || pixelBytes != m_Statistics.bytesPerPixel)
     {
-        emit logOutput(QString("fits_create_img failed: %1").arg(error_status));
-        status = 0;
-        fits_flush_file(fptr, &status);
-        fits_close_file(fptr, &status);
-        return status;
+        emit logOutput(QString("Images of data type %1 with %2 bytes per pixel can't be saved as FITS files.").arg(m_Statistics.dataType).arg(
+                           m_Statistics.bytesPerPixel));
+        return -1;
     }
 
-    /* Write Data */
-    if (fits_write_img(fptr, m_Statistics.dataType, 1, nelements,
-                       const_cast<void *>(reinterpret_cast<const void *>(m_ImageBuffer + channelShift)), &status))
+    QByteArray header;
+    appendFITSCard(header, "SIMPLE", fitsLogical(true));
+    appendFITSCard(header, "BITPIX", fitsValue(bitpix));
+    appendFITSCard(header, "NAXIS", fitsValue(2));
+    appendFITSCard(header, "NAXIS1", fitsValue(m_Statistics.width));
+    appendFITSCard(header, "NAXIS2", fitsValue(m_Statistics.height));
+    appendFITSCard(header, "EXTEND", fitsLogical(true));
+    if(bzero != 0)
     {
-        fits_report_error(stderr, status);
-        return status;
+        appendFITSCard(header, "BZERO", fitsValue(bzero));
+        appendFITSCard(header, "BSCALE", fitsValue(1));
     }
+    appendFITSCard(header, "EXPOSURE", fitsValue(1));
+    appendFITSCard(header, "DATE", fitsString(QDateTime::currentDateTimeUtc().toString("yyyy-MM-ddThh:mm:ss").toLatin1().constData()));
+    endFITSHeader(header);
 
-    /* Write keywords */
-
-    exposure = 1;
-    fits_update_key(fptr, TLONG, "EXPOSURE", &exposure, "Total Exposure Time", &status);
-
-    // NAXIS1
-    if (fits_update_key(fptr, TUSHORT, "NAXIS1", &(m_Statistics.width), "length of data axis 1", &status))
+    // The pixels are swapped a chunk at a time, so the file never needs a second copy of the image in memory
+    QSaveFile file(newFilename);
+    if(!file.open(QIODevice::WriteOnly) || file.write(header) != header.size())
     {
-        fits_report_error(stderr, status);
-        return status;
+        emit logOutput(QString("Could not write the FITS file %1: %2").arg(newFilename, file.errorString()));
+        return -1;
     }
-
-    // NAXIS2
-    if (fits_update_key(fptr, TUSHORT, "NAXIS2", &(m_Statistics.height), "length of data axis 2", &status))
+    const qint64 CHUNK_PIXELS = 1 << 18;
+    QByteArray chunk(static_cast<int>(std::min(nelements, CHUNK_PIXELS) * pixelBytes), 0);
+    uchar *data = reinterpret_cast<uchar *>(chunk.data());
+    for(qint64 first = 0; first < nelements; first += CHUNK_PIXELS)
     {
-        fits_report_error(stderr, status);
-        return status;
+        const qint64 count = std::min(CHUNK_PIXELS, nelements - first);
+        const uint8_t *chunkPixels = pixels + first * pixelBytes;
+        switch(pixelBytes)
+        {
+            case 1:
+                memcpy(data, chunkPixels, count);
+                break;
+            case 2:
+                fitsPixels<quint16>(chunkPixels, data, count, bzero ? 0x8000 : 0);
+                break;
+            case 4:
+                fitsPixels<quint32>(chunkPixels, data, count, bzero ? 0x80000000u : 0);
+                break;
+            default:
+                fitsPixels<quint64>(chunkPixels, data, count, 0);
+                break;
+        }
+        if(file.write(chunk.constData(), count * pixelBytes) != count * pixelBytes)
+        {
+            emit logOutput(QString("Could not write the FITS file %1: %2").arg(newFilename, file.errorString()));
+            file.cancelWriting();
+            return -1;
+        }
     }
-
-    // ISO Date
-    if (fits_write_date(fptr, &status))
+    const qint64 dataBytes = nelements * pixelBytes;
+    const QByteArray padding(static_cast<int>(fitsBlocks(dataBytes) - dataBytes), 0);
+    if(file.write(padding) != padding.size() || !file.commit())
     {
-        fits_report_error(stderr, status);
-        return status;
+        emit logOutput(QString("Could not write the FITS file %1: %2").arg(newFilename, file.errorString()));
+        return -1;
     }
 
     fileToProcess = newFilename;
     fileToProcessIsTempFile = true;
 
-    fits_flush_file(fptr, &status);
+    emit logOutput("Saved FITS file:" + fileToProcess);
+
+    return 0;
+}
+
+bool ExternalExtractorSolver::originalFileMatchesBuffer()
+{
+    //Only a mono image is the same as the file that saveAsFITS would write, the others get one channel or the merged channels written
+    if(m_Statistics.channels != 1 || usingMergedChannelImage || !m_ImageBuffer)
+        return false;
+    QFileInfo file(fileToProcess);
+    const QString suffix = file.suffix().toLower();
+    if(!file.exists() || (suffix != "fits" && suffix != "fit" && suffix != "fts"))
+        return false;
+
+    int status = 0;
+    fitsfile *fptr;
+    if(fits_open_diskfile(&fptr, fileToProcess.toLocal8Bit(), READONLY, &status))
+        return false;
+
+    int bitpix = 0;
+    int naxis = 0;
+    long naxes[3] = {0, 0, 0};
+    fits_get_img_param(fptr, 3, &bitpix, &naxis, naxes, &status);
+    bool matches = status == 0 && (naxis == 2 || (naxis == 3 && naxes[2] == 1)) && naxes[0] == m_Statistics.width
+                   && naxes[1] == m_Statistics.height;
 
-    if(fits_close_file(fptr, &status))
+    //The first, middle and last rows are compared, which is enough to tell a different image apart without reading all of it
+    if(matches)
     {
-        emit logOutput(QString("Error closing file."));
-        return status;
+        const long rowBytes = m_Statistics.width * m_Statistics.bytesPerPixel;
+        QByteArray row(rowBytes, 0);
+        const long rows[3] = {1, (m_Statistics.height + 1) / 2, m_Statistics.height};
+        for(long y : rows)
+        {
+            long firstPixel[3] = {1, y, 1};
+            int anyNull = 0;
+            if(fits_read_pix(fptr, m_Statistics.dataType, firstPixel, m_Statistics.width, nullptr, row.data(), &anyNull, &status)
+                    || memcmp(row.constData(), m_ImageBuffer + (y - 1) * rowBytes, rowBytes) != 0)
+            {
+                matches = false;
+                break;
+            }
+        }
     }
+    status = 0;
+    fits_close_file(fptr, &status);
+    return matches;
+}
 
-    emit logOutput("Saved FITS file:" + fileToProcess);
-
-    return 0;
+bool ExternalExtractorSolver::linkOriginalFile(const QString &newFilename)
+{
+#ifndef _WIN32
+    if(QFileInfo::exists(newFilename))
+        QFile(newFilename).remove();
+    if(link(QFile::encodeName(fileToProcess).constData(), QFile::encodeName(newFilename).constData()) == 0)
+        return true;
+    return QFile::link(QFileInfo(fileToProcess).absoluteFilePath(), newFilename);
+#else
+    //QFile::link makes a shortcut on Windows, which the external programs can't read as a FITS file
+    Q_UNUSED(newFilename);
+    return false;
+#endif
 }
 
 //This was essentially copied from KStars' loadWCS method and split in half with some modifications.
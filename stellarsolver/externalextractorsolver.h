@@ -112,7 +112,8 @@ class ExternalExtractorSolver : public InternalExtractorSolver
         WCSData getWCSData() override;
 
         /**
-         * @brief saveAsFITS will save the image buffer to a FITS file for solving by external solvers
+         * @brief saveAsFITS will save the image buffer to a FITS file for solving by external solvers.
+         * The file is written without CFITSIO, so the solvers of different images can save them at the same time.
          * @return 0 if it succeeds
          */
         int saveAsFITS();
@@ -146,6 +147,40 @@ class ExternalExtractorSolver : public InternalExtractorSolver
         QPointer<QProcess> solver;
         QPointer<QProcess> extractorProcess;
 
+        // This is how waiting for an external process ended
+        enum ProcessResult
+        {
+            PROCESS_FINISHED,
+            PROCESS_TIMED_OUT,
+            PROCESS_ABORTED
+        };
+
+        /**
+         * @brief waitForProcess waits for an external process that was started to finish, time out, or get aborted.
+         * In the solver's own thread it runs an event loop instead of blocking in waitForFinished, and abort ends the loop, so the process gets killed right away.
+         * The process is killed if it doesn't finish.
+         * @param process is the process to wait for
+         * @param timeout is how long it may run in milliseconds, 0 for no limit
+         * @return How the wait ended
+         */
+        ProcessResult waitForProcess(QProcess *process, int timeout);
+
+        /**
+         * @brief solverTimeout gets how long the external solvers may run, a little longer than the time limit in the parameters so they can stop on their own
+         * @return The time in milliseconds
+         */
+        int solverTimeout() const;
+
+        /**
+         * @brief cachedConfigFile gets a configuration file for the external programs with these contents, which is named by the hash
+         * of them in m_BasePath.  It is only written if no earlier solve wrote the same one, so the files that only change with the
+         * parameters aren't written again for every solve, and all of the solvers with the same settings share them.
+         * @param suffix The suffix of the file, like param or conv
+         * @param contents The contents of the file
+         * @return The path of the file, or an empty string if it couldn't be written
+         */
+        QString cachedConfigFile(const QString &suffix, const QByteArray &contents);
+
         /**
          * @brief getSolverArgsList gets the list of arguments to pass to the local astrometry.net solver
          * @return the QStringList full of arguments
@@ -175,6 +210,13 @@ class ExternalExtractorSolver : public InternalExtractorSolver
          */
         int runExternalWatneySolver();
 
+        /**
+         * @brief prepareStarList gets the xylist of the extracted stars ready to be handed to Watney instead of the image,
+         * so the image isn't written and Watney doesn't detect the stars again.  A child solver gets its own copy of the list.
+         * @return 0 if the list is there
+         */
+        int prepareStarList();
+
         /**
          * @brief getSolutionInformation gets the Solution Info from the local astrometry.net solution file (WCS)
          * @return
@@ -193,6 +235,34 @@ class ExternalExtractorSolver : public InternalExtractorSolver
          */
         bool getWatneySolutionInformation();
 
+        /**
+         * @brief originalFileMatchesBuffer checks whether fileToProcess is a plain FITS file with the same image as the buffer,
+         * so that saveAsFITS doesn't have to write the image again
+         * @return true if its primary image has the same size and type, and a sample of its rows has the same pixels
+         */
+        bool originalFileMatchesBuffer();
+
+        /**
+         * @brief linkOriginalFile makes a hard link to the original file at the temp file path, or a symbolic link if they are on different file systems
+         * @param newFilename is the path of the temporary FITS file
+         * @return true if it was linked
+         */
+        bool linkOriginalFile(const QString &newFilename);
+
+        /**
+         * @brief readStarsFromBinaryTable reads the star list from a FITS binary table of plain numeric columns directly, without CFITSIO
+         * @return true if it read the stars, false if the file has to be read with CFITSIO
+         */
+        bool readStarsFromBinaryTable();
+
+        /**
+         * @brief starFromColumns makes a star from the values of the first columns of a row of the xylist file
+         * @param columns are the values of the columns, as floats
+         * @param ncols is how many of the columns there are, at most 9
+         * @return The star, whose columns depend on the solver type
+         */
+        FITSImage::Star starFromColumns(const float *columns, int ncols) const;
+
         /**
          * @brief logSolver will log the output of the solver to a file or program output
          */
@@ -7,6 +7,10 @@
 */
 #include "extractorsolver.h"
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 //Astrometry.net includes
 extern "C" {
 #include "astrometry/starutil.h"
@@ -26,6 +30,69 @@ ExtractorSolver::~ExtractorSolver()
 
 }
 
+FITSImage::FrameViability ExtractorSolver::checkViability()
+{
+    // The spread is the part of the cells of a GRID x GRID grid over the frame that have stars
+    const int GRID = 4;
+    const Parameters &p = m_ActiveParameters;
+    const int count = m_ExtractedStars.size();
+    FITSImage::FrameViability viability = FITSImage::FRAME_VIABLE;
+    QString reason;
+    double medianSize = 0, spread = 1;
+    if (count > 0 && (p.viabilityMinStarSize > 0 || p.viabilityMaxStarSize > 0))
+    {
+        std::vector<double> sizes;
+        sizes.reserve(count);
+        for (const FITSImage::Star &star : m_ExtractedStars)
+            sizes.push_back(sqrt(star.a * star.b));
+        std::nth_element(sizes.begin(), sizes.begin() + count / 2, sizes.end());
+        medianSize = sizes[count / 2];
+    }
+    if (count > 0 && p.viabilityMinSpread > 0)
+    {
+        const QRect frame = m_UseSubframe ? m_SubFrameRect : QRect(0, 0, m_Statistics.width, m_Statistics.height);
+        bool cells[GRID * GRID] = {};
+        for (const FITSImage::Star &star : m_ExtractedStars)
+        {
+            const int column = qBound(0, static_cast<int>((star.x - frame.x()) * GRID / std::max(1, frame.width())), GRID - 1);
+            const int row = qBound(0, static_cast<int>((star.y - frame.y()) * GRID / std::max(1, frame.height())), GRID - 1);
+            cells[row * GRID + column] = true;
+        }
+        spread = std::count(cells, cells + GRID * GRID, true) / static_cast<double>(GRID * GRID);
+    }
+
+    if (p.viabilityMinStars > 0 && count < p.viabilityMinStars)
+    {
+        viability = FITSImage::FRAME_TOO_FEW_STARS;
+        reason = QString("only %1 stars were found, it takes %2").arg(count).arg(p.viabilityMinStars);
+    }
+    else if (p.viabilityMaxBackgroundRMS > 0 && m_Background.globalrms > p.viabilityMaxBackgroundRMS)
+    {
+        viability = FITSImage::FRAME_TOO_NOISY;
+        reason = QString("the background RMS is %1, more than %2").arg(m_Background.globalrms).arg(p.viabilityMaxBackgroundRMS);
+    }
+    else if (p.viabilityMinStarSize > 0 && count > 0 && medianSize < p.viabilityMinStarSize)
+    {
+        viability = FITSImage::FRAME_SPURIOUS_STARS;
+        reason = QString("the median star size is %1 pixels, less than %2").arg(medianSize, 0, 'f', 2).arg(p.viabilityMinStarSize);
+    }
+    else if (p.viabilityMaxStarSize > 0 && count > 0 && medianSize > p.viabilityMaxStarSize)
+    {
+        viability = FITSImage::FRAME_BLURRED_STARS;
+        reason = QString("the median star size is %1 pixels, more than %2").arg(medianSize, 0, 'f', 2).arg(p.viabilityMaxStarSize);
+    }
+    else if (p.viabilityMinSpread > 0 && spread < p.viabilityMinSpread)
+    {
+        viability = FITSImage::FRAME_STARS_CLUSTERED;
+        reason = QString("the stars are in only %1% of the frame").arg(spread * 100, 0, 'f', 0);
+    }
+
+    m_Metrics.viability = viability;
+    if (viability != FITSImage::FRAME_VIABLE)
+        emit logOutput(QString("The image is not worth solving, %1").arg(reason));
+    return viability;
+}
+
 //This is a convenience function used to set all the scale parameters based on the FOV high and low values wit their units.
 void ExtractorSolver::setSearchScale(double fov_low, double fov_high, ScaleUnits units)
 {
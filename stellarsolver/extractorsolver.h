@@ -12,12 +12,16 @@
 #include <QRect>
 #include <QDir>
 #include <QVector>
+#include <QSharedPointer>
 #include "structuredefinitions.h"
 #include "parameters.h"
 #include "wcsdata.h"
 
 using namespace SSolver;
 
+class IndexCatalog;
+class SolverThreadPool;
+
 class ExtractorSolver : public QThread
 {
         Q_OBJECT
@@ -46,6 +50,9 @@ class ExtractorSolver : public QThread
         // Index File Options
         QStringList indexFolderPaths;       // This is the list of folder paths that the solver will use to search for index files
         QStringList indexFiles;             // This is an alternative to the indexFolderPaths variable.  We can just load individual index files instead of searching for them
+        QSharedPointer<IndexCatalog> indexCatalog;  // This keeps the index files loaded between solves, it is shared with the StellarSolver and any child solvers
+        QSharedPointer<SolverThreadPool> threadPool;    // This limits the threads of the extraction and the solves if it is set, it is shared like the indexCatalog
+        SolveUrgency urgency { URGENCY_NORMAL };        // How soon the partitions and the solves get a slot of the threadPool when they wait for one
 
         // The currently set parameters for StellarSolver
         Parameters m_ActiveParameters;      // The currently set parameters for StellarSolver
@@ -108,7 +115,7 @@ class ExtractorSolver : public QThread
          * @brief getScaleUnitString gets a string for the scale units used in the scale for plate solving
          * @return The string for the scale units used.
          */
-        inline QString getScaleUnitString()
+        inline QString getScaleUnitString() const
         {
             switch(scaleunit)
             {
@@ -154,6 +161,62 @@ class ExtractorSolver : public QThread
             return m_Background;
         }
 
+        /**
+         * @brief setSummaryOnly sets whether the extraction only summarizes the stars in an ImageQuality instead of listing them.
+         * The extractors that can summarize the stars while they are measured leave the star list empty, see getImageQuality.
+         */
+        void setSummaryOnly(bool summaryOnly)
+        {
+            m_SummaryOnly = summaryOnly;
+        }
+
+        /**
+         * @brief setStreamPartitionStars sets whether the extractor emits partitionStarsReady as each part of the image is done,
+         * and partitionStarsComplete with the final list.  Only the internal star extractor streams the stars, the others only finish.
+         */
+        void setStreamPartitionStars(bool stream)
+        {
+            m_StreamPartitionStars = stream;
+        }
+
+        /**
+         * @brief setCountHardwareEvents sets whether the hardware events of the stages are counted in the solve metrics, see PerfCounters.
+         * Only the internal star extractor and solver count them.
+         */
+        void setCountHardwareEvents(bool count)
+        {
+            m_CountHardwareEvents = count;
+        }
+
+        /**
+         * @brief setRegions sets the small regions of the image to extract the stars of, instead of the whole image or the subframe.
+         * The extractors that can't extract regions on their own extract the whole image, and leave getRegionStars empty.
+         */
+        void setRegions(const QList<QRect> &regions)
+        {
+            m_Regions = regions;
+        }
+
+        /**
+         * @brief getRegionStars gets the stars of each of the regions of a region extraction, in the order of the regions
+         */
+        const QList<QList<FITSImage::Star>> &getRegionStars() const
+        {
+            return m_RegionStars;
+        }
+
+        /**
+         * @brief getImageQuality gets the summary of the stars of a summary extraction
+         * @param quality Set to the summary if there was one
+         * @return Whether this extractor made the summary, otherwise it made a star list to summarize
+         */
+        bool getImageQuality(FITSImage::ImageQuality &quality) const
+        {
+            if (m_HasImageQuality)
+                quality = m_ImageQuality;
+            return m_HasImageQuality;
+        }
+
         /**
          * @brief getNumStarsFound gets the number of stars found in the star extraction
          * @return The number of stars found
@@ -172,6 +235,14 @@ class ExtractorSolver : public QThread
             return m_ExtractedStars;
         }
 
+        /**
+         * @brief checkViability checks whether the extracted stars can solve the image before it is solved, with the viability checks
+         * of the parameters.  It takes no time next to the extraction, so a frame the clouds came in on fails right away instead of
+         * after the whole solverTimeLimit.  The reason is logged and kept in the viability of the solve metrics.
+         * @return FRAME_VIABLE if the stars can solve it, otherwise why they can't
+         */
+        FITSImage::FrameViability checkViability();
+
         /**
          * @brief getSolution gets the Solution information from the latest plate solve
          * @return The Solution information
@@ -205,6 +276,24 @@ class ExtractorSolver : public QThread
             return solutionHealpix;
         };
 
+        /**
+         * @brief getSolutionLogOdds gets the log odds of the match in the latest plate solve, which tells how good the solution is
+         * @return The log odds, or 0 if the solver doesn't report them
+         */
+        double getSolutionLogOdds()
+        {
+            return solutionLogOdds;
+        };
+
+        /**
+         * @brief getSolveMetrics gets how long the stages of the latest extraction and solve took and how much work the solver did
+         * @return The metrics, the stages this solver doesn't report are 0
+         */
+        const FITSImage::SolveMetrics &getSolveMetrics() const
+        {
+            return m_Metrics;
+        }
+
         /**
          * @brief hasWCSData gets whether or not WCS Data has been retrieved for the image after plate solving
          * @return true means we have WCS data
@@ -271,9 +360,18 @@ class ExtractorSolver : public QThread
 
         FITSImage::Background m_Background;     // This is a report on the background levels found during star extraction
         QList<FITSImage::Star> m_ExtractedStars;// This is the list of stars that get extracted from the image
+        bool m_SummaryOnly = false;             // Whether the extraction only needs the summary of the stars, see setSummaryOnly
+        bool m_StreamPartitionStars = false;    // Whether the stars of each partition are emitted as it is done, see setStreamPartitionStars
+        bool m_CountHardwareEvents = false;     // Whether the hardware events of the stages are counted, see setCountHardwareEvents
+        bool m_HasImageQuality = false;         // Whether the extraction summarized the stars in m_ImageQuality instead of listing them
+        FITSImage::ImageQuality m_ImageQuality; // The summary of the stars of a summary extraction
+        QList<QRect> m_Regions;                 // The regions to extract the stars of, see setRegions
+        QList<QList<FITSImage::Star>> m_RegionStars;    // The stars of each of the regions
         FITSImage::Solution m_Solution;         // This is the solution that comes back from the Solver
         short solutionIndexNumber = -1;         // This is the index number of the index used to solve the image.
         short solutionHealpix = -1;             // This is the healpix of the index used to solve the image.
+        double solutionLogOdds = 0;             // This is the log odds of the match that solved the image.
+        FITSImage::SolveMetrics m_Metrics;      // This is how long the stages of the extraction and solve took
 
         // This is the cancel file path that astrometry.net monitors.  If it detects this file, it aborts the solve
         QString cancelfn;           //Filename whose creation signals the process to stop
@@ -308,5 +406,21 @@ class ExtractorSolver : public QThread
          */
         void finished(int exit_code);
 
+        /**
+         * @brief partitionStarsReady signals the stars of a partition of the image as soon as it is done, when setStreamPartitionStars is on.
+         * It is emitted from the extraction thread.
+         * @param stars The new stars of the partition, in the coordinates of the image, that passed the filters that judge each star on its own
+         * @param partition The number of the partition, they are emitted in order
+         * @param partitions How many partitions there are
+         */
+        void partitionStarsReady(const QList<FITSImage::Star> &stars, int partition, int partitions);
+
+        /**
+         * @brief partitionStarsComplete signals the star list after the partitions were merged and all of the filters applied,
+         * when setStreamPartitionStars is on.  It is emitted from the extraction thread before finished.
+         * @param stars The final star list, the same as getStarList
+         */
+        void partitionStarsComplete(const QList<FITSImage::Star> &stars);
+
 };
 
@@ -0,0 +1,176 @@
+/*  HotFolderSolver, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "hotfoldersolver.h"
+#include <QDir>
+
+HotFolderSolver::HotFolderSolver(StellarSolver *solver, const StellarSolver::ImageLoader &loader, QObject *parent)
+    : QObject(parent), m_Solver(solver), m_Loader(loader)
+{
+    m_SettleTimer.setSingleShot(true);
+    connect(&m_Watcher, &QFileSystemWatcher::directoryChanged, this, &HotFolderSolver::scanDirectory);
+    connect(&m_PollTimer, &QTimer::timeout, this, &HotFolderSolver::scanDirectory);
+    connect(&m_SettleTimer, &QTimer::timeout, this, &HotFolderSolver::scanDirectory);
+    connect(m_Solver, &StellarSolver::batchImageSolved, this, &HotFolderSolver::batchImageSolved);
+    connect(m_Solver, &StellarSolver::batchFinished, this, &HotFolderSolver::solverBatchFinished);
+}
+
+bool HotFolderSolver::start(const QString &directory)
+{
+    if(!QFileInfo(directory).isDir())
+    {
+        emit logOutput(QString("The directory %1 does not exist").arg(directory));
+        return false;
+    }
+    stop();
+    m_Directory = QFileInfo(directory).absoluteFilePath();
+    m_KnownFiles.clear();
+    m_PendingFiles.clear();
+    m_WaitingFiles.clear();
+    m_WaitingWritten.clear();
+    for(const QFileInfo &file : QDir(m_Directory).entryInfoList(m_NameFilters, QDir::Files))
+        m_KnownFiles.insert(file.absoluteFilePath());
+
+    m_Watcher.addPath(m_Directory);
+    if(m_PollInterval > 0)
+        m_PollTimer.start(m_PollInterval);
+    m_Watching = true;
+    emit logOutput(QString("Watching %1 for new images").arg(m_Directory));
+    return true;
+}
+
+void HotFolderSolver::stop()
+{
+    if(!m_Watching)
+        return;
+    m_Watching = false;
+    m_Watcher.removePath(m_Directory);
+    m_PollTimer.stop();
+    m_SettleTimer.stop();
+    if(m_Solver)
+        m_Solver->abort();
+}
+
+// The directory changes many times while a file is written, so each scan only notes the sizes of the new files,
+// and they are queued by a later scan once they have stopped changing for the settle time.
+void HotFolderSolver::scanDirectory()
+{
+    if(!m_Watching)
+        return;
+
+    QStringList readyFiles;
+    QList<qint64> writtenTimes;
+    const QFileInfoList files = QDir(m_Directory).entryInfoList(m_NameFilters, QDir::Files, QDir::Time | QDir::Reversed);
+    for(const QFileInfo &file : files)
+    {
+        const QString fileName = file.absoluteFilePath();
+        if(m_KnownFiles.contains(fileName) || m_WaitingFiles.contains(fileName))
+            continue;
+        PendingFile &pending = m_PendingFiles[fileName];
+        if(isComplete(file, pending))
+        {
+            writtenTimes.append(pending.modified.toMSecsSinceEpoch());
+            m_PendingFiles.remove(fileName);
+            readyFiles.append(fileName);
+        }
+    }
+
+    // A file that was deleted before it was done is forgotten
+    for(auto it = m_PendingFiles.begin(); it != m_PendingFiles.end();)
+    {
+        if(!QFileInfo::exists(it.key()))
+            it = m_PendingFiles.erase(it);
+        else
+            ++it;
+    }
+
+    // The files the StellarSolver was too busy for are tried again with the new ones
+    if(!readyFiles.isEmpty() || !m_WaitingFiles.isEmpty())
+        solveFiles(readyFiles, writtenTimes);
+    // The files still being written are checked again as soon as they could have settled, not at the next poll
+    if(!m_PendingFiles.isEmpty() && !m_SettleTimer.isActive())
+        m_SettleTimer.start(m_SettleTime);
+}
+
+bool HotFolderSolver::isComplete(const QFileInfo &file, PendingFile &pending) const
+{
+    if(file.size() != pending.size || file.lastModified() != pending.modified)
+    {
+        pending.size = file.size();
+        pending.modified = file.lastModified();
+        pending.unchanged.start();
+        return false;
+    }
+    if(pending.unchanged.elapsed() < m_SettleTime)
+        return false;
+
+    // A FITS file is written in blocks of 2880 bytes, so one that isn't a whole number of blocks is not done
+    const QString suffix = file.suffix().toLower();
+    if((suffix == "fits" || suffix == "fit" || suffix == "fts") && (pending.size == 0 || pending.size % 2880 != 0))
+        return false;
+    return true;
+}
+
+void HotFolderSolver::solveFiles(const QStringList &newFiles, const QList<qint64> &newWritten)
+{
+    if(!m_Solver)
+        return;
+
+    // The files that waited go first, so the images are still solved in the order they were written
+    const QStringList fileNames = m_WaitingFiles + newFiles;
+    const QList<qint64> writtenTimes = m_WaitingWritten + newWritten;
+    m_WaitingFiles.clear();
+    m_WaitingWritten.clear();
+    QList<StellarSolver::BatchImage> images;
+    for(const QString &fileName : fileNames)
+    {
+        StellarSolver::BatchImage image;
+        image.fileName = fileName;
+        images.append(image);
+    }
+
+    // The files join the batch that is running, so they don't wait for it to be done
+    if(m_BatchFiles.isEmpty() || !m_Solver->addBatchImages(images))
+    {
+        batchFinished();
+        if(!m_Solver->solveBatch(images, m_Loader))
+        {
+            // They are only known once they are in a batch, until then every scan and the end of the batch try them again
+            if(!newFiles.isEmpty())
+                emit logOutput(QString("%1 images wait to be solved since the StellarSolver is busy").arg(fileNames.count()));
+            m_WaitingFiles = fileNames;
+            m_WaitingWritten = writtenTimes;
+            return;
+        }
+    }
+    for(const QString &fileName : fileNames)
+        m_KnownFiles.insert(fileName);
+    // The images are loaded before they are solved, so this is done before any of them can be reported
+    m_BatchFiles.append(fileNames);
+    m_BatchWritten.append(writtenTimes);
+}
+
+void HotFolderSolver::batchImageSolved(int imageNumber, bool solved, StellarSolver *solver)
+{
+    if(imageNumber < 0 || imageNumber >= m_BatchFiles.count())
+        return;
+    const qint64 latency = QDateTime::currentMSecsSinceEpoch() - m_BatchWritten.value(imageNumber);
+    emit imageSolved(m_BatchFiles.at(imageNumber), solved, solver, latency);
+}
+
+void HotFolderSolver::batchFinished()
+{
+    m_BatchFiles.clear();
+    m_BatchWritten.clear();
+}
+
+void HotFolderSolver::solverBatchFinished()
+{
+    batchFinished();
+    if(m_Watching && !m_WaitingFiles.isEmpty())
+        solveFiles(QStringList(), QList<qint64>());
+}
@@ -0,0 +1,156 @@
+/*  HotFolderSolver, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QObject>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QPointer>
+
+#include "stellarsolver.h"
+
+/**
+ * @brief The HotFolderSolver class plate solves the images that get written to a directory, such as the output directory of a camera.
+ * It watches the directory, waits for each new file to be completely written, and adds it to the batch of its StellarSolver (see solveBatch),
+ * so the image is solved as soon as there is a free thread, with the index files that stay loaded in the IndexCatalog between images.
+ * The StellarSolver is not changed apart from that, so its settings, its index folders and its SolverThreadPool are the ones used,
+ * but it should not be used for anything else while the directory is watched.
+ */
+class HotFolderSolver : public QObject
+{
+        Q_OBJECT
+
+    public:
+        /**
+         * @brief HotFolderSolver makes a hot folder that solves its images with the settings of a StellarSolver
+         * @param solver is the StellarSolver, which must exist for as long as the HotFolderSolver does
+         * @param loader loads the image files, for instance fileio::batchImageLoader
+         * @param parent The parent of this HotFolderSolver
+         */
+        HotFolderSolver(StellarSolver *solver, const StellarSolver::ImageLoader &loader, QObject *parent = nullptr);
+
+        /**
+         * @brief start watches a directory.  The image files already in it are not solved, only the ones written to it from now on.
+         * @param directory is the directory to watch
+         * @return false if the directory doesn't exist
+         */
+        bool start(const QString &directory);
+
+        /**
+         * @brief stop stops watching the directory and aborts the solves that are still running
+         */
+        void stop();
+
+        /**
+         * @brief setNameFilters sets which files in the directory are images, the FITS files by default
+         */
+        void setNameFilters(const QStringList &filters)
+        {
+            m_NameFilters = filters;
+        }
+
+        /**
+         * @brief setSettleTime sets how long a new file must stay the same before it is considered completely written, 500 ms by default.
+         * A FITS file also has to be a whole number of 2880 byte blocks, which it is not while it is being written.
+         * @param milliseconds The time in milliseconds
+         */
+        void setSettleTime(int milliseconds)
+        {
+            m_SettleTime = milliseconds;
+        }
+
+        /**
+         * @brief setPollInterval sets how often the directory is scanned in case its change notifications don't arrive, as on some network file systems.
+         * @param milliseconds The time in milliseconds, 2000 by default, 0 to only use the notifications
+         */
+        void setPollInterval(int milliseconds)
+        {
+            m_PollInterval = milliseconds;
+        }
+
+    signals:
+        /**
+         * @brief logOutput signals that there is infomation that should be printed to a log file or log window
+         */
+        void logOutput(QString logText);
+
+        /**
+         * @brief imageSolved a new image of the directory is done, whether it was solved or not
+         * @param fileName is the path of the image file
+         * @param solved is whether it was solved
+         * @param solver is the StellarSolver that solved it, to get the solution and the WCS data from, or nullptr if the image could not be loaded.
+         * It is deleted after the signal, so it should only be used in a direct connection.
+         * @param latency is how long it took from the moment the file was last changed to the end of the solve, in milliseconds
+         */
+        void imageSolved(const QString &fileName, bool solved, StellarSolver *solver, qint64 latency);
+
+    private:
+        // This is what is known about a file that is being written
+        struct PendingFile
+        {
+            qint64 size { -1 };
+            QDateTime modified;
+            QElapsedTimer unchanged;    // How long the size and the modification time have stayed the same
+        };
+
+        /**
+         * @brief scanDirectory looks for the new files and the ones that are done being written, and queues those to be solved
+         */
+        void scanDirectory();
+
+        /**
+         * @brief isComplete checks whether a file looks completely written
+         */
+        bool isComplete(const QFileInfo &file, PendingFile &pending) const;
+
+        /**
+         * @brief solveFiles hands the new files and the ones that waited to the batch of the StellarSolver, or keeps them
+         * waiting if it is busy
+         * @param newWritten is when each new file was last changed, in milliseconds since the epoch
+         */
+        void solveFiles(const QStringList &newFiles, const QList<qint64> &newWritten);
+
+        /**
+         * @brief batchImageSolved reports an image of the batch of the StellarSolver that is done
+         */
+        void batchImageSolved(int imageNumber, bool solved, StellarSolver *solver);
+
+        /**
+         * @brief batchFinished forgets the files of the batch that is done, the next files start a new one
+         */
+        void batchFinished();
+
+        /**
+         * @brief solverBatchFinished is batchFinished for the batch of the StellarSolver, then it tries the files that waited
+         */
+        void solverBatchFinished();
+
+        QPointer<StellarSolver> m_Solver;
+        StellarSolver::ImageLoader m_Loader;
+        QString m_Directory;
+        QStringList m_NameFilters { QStringList() << "*.fits" << "*.fit" << "*.fts" };
+        int m_SettleTime { 500 };
+        int m_PollInterval { 2000 };
+        bool m_Watching { false };
+
+        QFileSystemWatcher m_Watcher;
+        QTimer m_PollTimer;                         // This scans the directory every m_PollInterval
+        QTimer m_SettleTimer;                       // This scans the directory again when the pending files should have settled
+        QSet<QString> m_KnownFiles;                 // The files that were there at the start or were already queued
+        QStringList m_WaitingFiles;                 // The files that are done but were refused since the StellarSolver was busy
+        QList<qint64> m_WaitingWritten;             // When each of the waiting files was last changed
+        QHash<QString, PendingFile> m_PendingFiles; // The new files that are still being written
+        QStringList m_BatchFiles;                   // The files of the batch of the StellarSolver, in the order of their imageNumbers
+        QList<qint64> m_BatchWritten;               // When each file of the batch was last changed, in milliseconds since the epoch
+};
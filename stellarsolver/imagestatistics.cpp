@@ -0,0 +1,241 @@
+/*  ImageStatistics, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "imagestatistics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+//QT Includes
+#include <QThread>
+#include <QVector>
+#include <QtConcurrent>
+
+#include <fitsio.h>
+
+namespace
+{
+template <typename T>
+struct Traits
+{
+    // The 8 and 16 bit values are counted in a histogram for the median, and their sums fit in 64 bit integers
+    static const bool histogram = std::is_integral<T>::value && sizeof(T) <= 2;
+    static const size_t bins = histogram ? static_cast<size_t>(1) << (8 * (histogram ? sizeof(T) : 1)) : 0;
+    typedef typename std::conditional<histogram, int64_t, double>::type Sum;
+};
+
+// What one chunk of the rows of a channel adds up to
+template <typename T>
+struct Partial
+{
+    T min {}, max {};
+    double sum = 0, sumSquares = 0;
+    int64_t count = 0;
+    std::vector<uint32_t> histogram;    // The counts of the values, from the lowest value of the type
+    std::vector<T> values;              // The values for the selection of the median, for the types without a histogram
+};
+
+template <typename T>
+inline int histogramBin(T value)
+{
+    return static_cast<int>(value) - static_cast<int>(std::numeric_limits<T>::min());
+}
+
+// This adds one row to the partial, the sums first so that they vectorize, and then the values for the median while they are in the cache
+template <typename T>
+void addRow(const T *row, int width, int step, Partial<T> &partial)
+{
+    typedef typename Traits<T>::Sum Sum;
+    Sum sum = 0, sumSquares = 0;
+    T low = std::numeric_limits<T>::max(), high = std::numeric_limits<T>::lowest();
+    int count = 0;
+    if(step == 1 && std::is_integral<T>::value)
+    {
+        for(int x = 0; x < width; x++)
+        {
+            const T value = row[x];
+            low = std::min(low, value);
+            high = std::max(high, value);
+            sum += value;
+            sumSquares += static_cast<Sum>(value) * value;
+        }
+        count = width;
+    }
+    else
+    {
+        for(int x = 0; x < width; x += step)
+        {
+            const T value = row[x];
+            // The blank pixels of float images are NaN
+            if(value != value)
+                continue;
+            low = std::min(low, value);
+            high = std::max(high, value);
+            sum += value;
+            sumSquares += static_cast<Sum>(value) * value;
+            count++;
+        }
+    }
+    if(count == 0)
+        return;
+
+    if(partial.count == 0)
+    {
+        partial.min = low;
+        partial.max = high;
+    }
+    else
+    {
+        partial.min = std::min(partial.min, low);
+        partial.max = std::max(partial.max, high);
+    }
+    partial.sum += static_cast<double>(sum);
+    partial.sumSquares += static_cast<double>(sumSquares);
+    partial.count += count;
+
+    if(Traits<T>::histogram)
+    {
+        for(int x = 0; x < width; x += step)
+            partial.histogram[histogramBin(row[x])]++;
+    }
+    else
+    {
+        for(int x = 0; x < width; x += step)
+            if(row[x] == row[x])
+                partial.values.push_back(row[x]);
+    }
+}
+
+template <typename T>
+void calculateType(FITSImage::Statistic &stats, uint8_t const *imageBuffer, int step)
+{
+    const int width = stats.width, height = stats.height, channels = stats.channels;
+    const size_t channelSize = stats.samples_per_channel > 0 ? stats.samples_per_channel : static_cast<size_t>(width) * height;
+    const int rows = (height + step - 1) / step;
+    const int64_t sampledPixels = static_cast<int64_t>(rows) * ((width + step - 1) / step);
+    const int numChunks = static_cast<int>(qBound<int64_t>(1, QThread::idealThreadCount(),
+                                           std::min<int64_t>(rows, sampledPixels / ImageStatistics::ParallelThreshold)));
+    const int chunkRows = (rows + numChunks - 1) / numChunks;
+
+    std::vector<Partial<T>> partials(static_cast<size_t>(numChunks) * channels);
+    QVector<int> chunks;
+    for(int chunk = 0; chunk < numChunks * channels; chunk++)
+        chunks.append(chunk);
+    auto addChunk = [&](int chunk)
+    {
+        const int channel = chunk / numChunks, first = (chunk % numChunks) * chunkRows;
+        const int last = std::min(rows, first + chunkRows);
+        Partial<T> &partial = partials[chunk];
+        if(Traits<T>::histogram)
+            partial.histogram.assign(Traits<T>::bins, 0);
+        else
+            partial.values.reserve(static_cast<size_t>(last - first) * ((width + step - 1) / step));
+        const T *data = reinterpret_cast<const T *>(imageBuffer) + channel * channelSize;
+        for(int row = first; row < last; row++)
+            addRow(data + static_cast<size_t>(row) * step * width, width, step, partial);
+    };
+    if(chunks.size() == 1)
+        addChunk(0);
+    else
+        QtConcurrent::blockingMap(chunks, addChunk);
+
+    for(int channel = 0; channel < channels; channel++)
+    {
+        double minimum = 0, maximum = 0, sum = 0, sumSquares = 0;
+        int64_t count = 0;
+        for(int chunk = 0; chunk < numChunks; chunk++)
+        {
+            const Partial<T> &partial = partials[channel * numChunks + chunk];
+            if(partial.count == 0)
+                continue;
+            minimum = count == 0 ? partial.min : std::min<double>(minimum, partial.min);
+            maximum = count == 0 ? partial.max : std::max<double>(maximum, partial.max);
+            sum += partial.sum;
+            sumSquares += partial.sumSquares;
+            count += partial.count;
+        }
+
+        double median = 0;
+        if(count > 0 && Traits<T>::histogram)
+        {
+            // The chunks are merged one bin at a time until the bin with the middle value
+            const int64_t middle = count / 2;
+            int64_t below = 0;
+            for(size_t bin = 0; bin < Traits<T>::bins; bin++)
+            {
+                for(int chunk = 0; chunk < numChunks; chunk++)
+                    below += partials[channel * numChunks + chunk].histogram[bin];
+                if(below > middle)
+                {
+                    median = static_cast<double>(bin) + static_cast<double>(std::numeric_limits<T>::min());
+                    break;
+                }
+            }
+        }
+        else if(count > 0)
+        {
+            std::vector<T> &values = partials[channel * numChunks].values;
+            for(int chunk = 1; chunk < numChunks; chunk++)
+            {
+                std::vector<T> &more = partials[channel * numChunks + chunk].values;
+                values.insert(values.end(), more.begin(), more.end());
+                std::vector<T>().swap(more);
+            }
+            std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+            median = values[values.size() / 2];
+        }
+
+        stats.min[channel] = minimum;
+        stats.max[channel] = maximum;
+        stats.mean[channel] = count > 0 ? sum / count : 0;
+        stats.stddev[channel] = count > 0 ? std::sqrt(std::max(0.0, sumSquares / count - stats.mean[channel] * stats.mean[channel])) : 0;
+        stats.median[channel] = median;
+    }
+    stats.SNR = stats.stddev[0] > 0 ? stats.mean[0] / stats.stddev[0] : 0;
+}
+}
+
+bool ImageStatistics::calculate(FITSImage::Statistic &stats, uint8_t const *imageBuffer, int sampling)
+{
+    if(imageBuffer == nullptr || stats.width == 0 || stats.height == 0 || stats.channels < 1 || stats.channels > 3)
+        return false;
+    const int step = std::max(1, sampling);
+
+    switch(stats.dataType)
+    {
+        case TBYTE:
+            calculateType<uint8_t>(stats, imageBuffer, step);
+            break;
+        case TSHORT:
+            calculateType<int16_t>(stats, imageBuffer, step);
+            break;
+        case TUSHORT:
+            calculateType<uint16_t>(stats, imageBuffer, step);
+            break;
+        case TLONG:
+            calculateType<int32_t>(stats, imageBuffer, step);
+            break;
+        case TULONG:
+            calculateType<uint32_t>(stats, imageBuffer, step);
+            break;
+        case TLONGLONG:
+            calculateType<int64_t>(stats, imageBuffer, step);
+            break;
+        case TFLOAT:
+            calculateType<float>(stats, imageBuffer, step);
+            break;
+        case TDOUBLE:
+            calculateType<double>(stats, imageBuffer, step);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+/*  ImageStatistics, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include <cstdint>
+
+#include "structuredefinitions.h"
+
+/**
+ * @brief ImageStatistics fills the minimum, maximum, mean, standard deviation and median of each channel of a FITSImage::Statistic
+ * from its image buffer in one pass over the pixels, which is split between the threads of the global pool for big images.
+ * The medians of 8 and 16 bit images come from a histogram of the values, so they aren't sorted at all, and the ones of the other
+ * types are selected with std::nth_element.  Like the rest of the library, the median is the upper one of an even number of values.
+ */
+namespace ImageStatistics
+{
+// The images with this many sampled pixels or more are split between threads
+static const int ParallelThreshold = 1 << 18;
+
+/**
+ * @brief calculate calculates the statistics of the image and sets the SNR to the mean over the standard deviation of the first channel
+ * @param stats The statistics to fill, its data type, width, height and channels describe the image buffer, whose channels are one after the other
+ * @param imageBuffer The image buffer
+ * @param sampling Only every sampling-th pixel of every sampling-th row is used when it is more than 1, which is much faster for a big image,
+ * but the minimum and the maximum might be missed
+ * @return false if the data type isn't supported or the image is empty, the statistics aren't changed then
+ */
+bool calculate(FITSImage::Statistic &stats, uint8_t const *imageBuffer, int sampling = 1);
+}
@@ -0,0 +1,863 @@
+/*  IndexCatalog, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "indexcatalog.h"
+#include <QFileInfo>
+#include <QDir>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/engine.h"
+#include "astrometry/log.h"
+#include "astrometry/ssindex.h"
+#include "astrometry/starutil.h"
+#include "astrometry/verify.h"
+}
+
+// This gets the size of the files that make up an index, which is how much memory it will map when it gets loaded
+static qint64 indexFileSize(const index_t *index)
+{
+    qint64 size = QFileInfo(index->quadfn).size();
+    if(strcmp(index->codefn, index->quadfn) != 0)
+        size += QFileInfo(index->codefn).size();
+    if(strcmp(index->starfn, index->quadfn) != 0 && strcmp(index->starfn, index->codefn) != 0)
+        size += QFileInfo(index->starfn).size();
+    return size;
+}
+
+// This reads a byte of each page of a block of a memory mapped file, so its page faults happen now instead of during a solve
+static quint64 touchPages(const void *data, size_t bytes)
+{
+    if(!data || bytes == 0)
+        return 0;
+    const volatile uint8_t *pages = static_cast<const volatile uint8_t *>(data);
+    quint64 sum = 0;
+    for(size_t i = 0; i < bytes; i += 4096)
+        sum += pages[i];
+    return sum + pages[bytes - 1];
+}
+
+static quint64 touchTree(const kdtree_t *kd)
+{
+    if(!kd)
+        return 0;
+    return touchPages(kd->lr, kdtree_sizeof_lr(kd)) + touchPages(kd->perm, kdtree_sizeof_perm(kd)) +
+           touchPages(kd->bb.any, kdtree_sizeof_bb(kd)) + touchPages(kd->split.any, kdtree_sizeof_split(kd)) +
+           touchPages(kd->splitdim, kdtree_sizeof_splitdim(kd)) + touchPages(kd->data.any, kdtree_sizeof_data(kd));
+}
+
+static size_t treeBytes(const kdtree_t *kd)
+{
+    return kdtree_sizeof_lr(kd) + kdtree_sizeof_perm(kd) + kdtree_sizeof_bb(kd) + kdtree_sizeof_split(kd) +
+           kdtree_sizeof_splitdim(kd) + kdtree_sizeof_data(kd);
+}
+
+// This gives the kernel a hint about how a block of an index is used.  madvise needs the start of a page, and the rest of that page is the same mapping.
+static void adviseMemory(const void *data, size_t bytes, int advice)
+{
+#ifndef _WIN32
+    if(!data || bytes == 0)
+        return;
+    static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    const uintptr_t start = reinterpret_cast<uintptr_t>(data) & ~(pageSize - 1);
+    const uintptr_t end = reinterpret_cast<uintptr_t>(data) + bytes;
+    madvise(reinterpret_cast<void *>(start), end - start, advice);
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(bytes);
+    Q_UNUSED(advice);
+#endif
+}
+
+// The nodes of a kd-tree are stored a level after the other, so the top levels are the start of the arrays of the nodes
+static void adviseTree(const kdtree_t *kd, bool hugePages, int prefetchLevels)
+{
+    if(!kd)
+        return;
+#ifdef MADV_HUGEPAGE
+    if(hugePages)
+    {
+        adviseMemory(kd->lr, kdtree_sizeof_lr(kd), MADV_HUGEPAGE);
+        adviseMemory(kd->perm, kdtree_sizeof_perm(kd), MADV_HUGEPAGE);
+        adviseMemory(kd->bb.any, kdtree_sizeof_bb(kd), MADV_HUGEPAGE);
+        adviseMemory(kd->split.any, kdtree_sizeof_split(kd), MADV_HUGEPAGE);
+        adviseMemory(kd->splitdim, kdtree_sizeof_splitdim(kd), MADV_HUGEPAGE);
+        adviseMemory(kd->data.any, kdtree_sizeof_data(kd), MADV_HUGEPAGE);
+    }
+#else
+    Q_UNUSED(hugePages);
+#endif
+#ifdef MADV_WILLNEED
+    if(prefetchLevels > 0 && kd->nnodes > 0)
+    {
+        const size_t nodes = std::min<size_t>(kd->nnodes, (size_t(1) << std::min(prefetchLevels, 30)) - 1);
+        if(kd->bb.any)
+            adviseMemory(kd->bb.any, kdtree_sizeof_bb(kd) / kd->nnodes * nodes, MADV_WILLNEED);
+        if(kd->split.any)
+            adviseMemory(kd->split.any, kdtree_sizeof_split(kd) / kd->nnodes * nodes, MADV_WILLNEED);
+        if(kd->splitdim)
+            adviseMemory(kd->splitdim, kdtree_sizeof_splitdim(kd) / kd->nnodes * nodes, MADV_WILLNEED);
+    }
+#else
+    Q_UNUSED(prefetchLevels);
+#endif
+}
+
+// A tree that was replaced by an in-memory copy is only read again if a code is looked up, so its pages go first when memory runs low
+static void adviseFileTree(const kdtree_t *kd)
+{
+#ifdef MADV_COLD
+    adviseMemory(kd->lr, kdtree_sizeof_lr(kd), MADV_COLD);
+    adviseMemory(kd->perm, kdtree_sizeof_perm(kd), MADV_COLD);
+    adviseMemory(kd->bb.any, kdtree_sizeof_bb(kd), MADV_COLD);
+    adviseMemory(kd->split.any, kdtree_sizeof_split(kd), MADV_COLD);
+    adviseMemory(kd->splitdim, kdtree_sizeof_splitdim(kd), MADV_COLD);
+    adviseMemory(kd->data.any, kdtree_sizeof_data(kd), MADV_COLD);
+#else
+    Q_UNUSED(kd);
+#endif
+}
+
+IndexCatalog::IndexCatalog()
+{
+    m_ManifestPath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/stellarsolver/indexmanifest.json";
+}
+
+IndexCatalog::~IndexCatalog()
+{
+    m_Trim.waitForFinished();
+    QWriteLocker locker(&m_Lock);
+    unload();
+}
+
+int IndexCatalog::acquire(const QStringList &folderPaths, const QStringList &filePaths)
+{
+    forever
+    {
+        m_Lock.lockForRead();
+        if(matches(folderPaths, filePaths))
+        {
+            QMutexLocker loadLocker(&m_LoadMutex);
+            m_ActiveSolves++;
+            return pl_size(m_Engine->indexes);
+        }
+        m_Lock.unlock();
+
+        // The settings changed, so the indexes need to be reloaded.  Another solve may have done it while we waited for the write lock.
+        m_Lock.lockForWrite();
+        if(!matches(folderPaths, filePaths))
+            load(folderPaths, filePaths);
+        m_Lock.unlock();
+    }
+}
+
+void IndexCatalog::release()
+{
+    bool trim;
+    {
+        QMutexLocker loadLocker(&m_LoadMutex);
+        m_ActiveSolves--;
+        trim = m_ActiveSolves == 0 && m_MemoryBudget > 0 && m_LoadedBytes.load() > m_MemoryBudget;
+    }
+    m_Lock.unlock();
+    if(!trim)
+        return;
+
+    // Unmapping the indexes takes a while, so it is done on another thread and the solve can report its result first.
+    // A solve that acquires the catalog meanwhile waits for the load lock, and the trim is skipped if one got it first.
+    // A release during a trim has it check again before it ends, since indexes may have been loaded after it looked.
+    QMutexLocker trimLocker(&m_TrimMutex);
+    if(m_Trimming)
+    {
+        m_TrimAgain = true;
+        return;
+    }
+    m_Trimming = true;
+    m_Trim = QtConcurrent::run(QThreadPool::globalInstance(), [this]()
+    {
+        while(true)
+        {
+            {
+                QReadLocker locker(&m_Lock);
+                QMutexLocker loadLocker(&m_LoadMutex);
+                if(m_ActiveSolves == 0)
+                    trimToBudget();
+            }
+            QMutexLocker trimLocker(&m_TrimMutex);
+            if(!m_TrimAgain)
+            {
+                m_Trimming = false;
+                return;
+            }
+            m_TrimAgain = false;
+        }
+    });
+}
+
+int IndexCatalog::addIndexesTo(struct engine *solveEngine, struct job_t *job)
+{
+    if(!m_Engine)
+        return 0;
+
+    il* selected = il_new(16);
+    engine_select_indexes_for_job(m_Engine, job, selected);
+    QList<int> positions;
+    for(size_t i = 0; i < il_size(selected); i++)
+        positions.append(il_get(selected, i));
+    il_free(selected);
+
+    loadIndexes(positions, job->bp.solver.codetol > 0 ? job->bp.solver.codetol : DEFAULT_CODE_TOL);
+
+    QMutexLocker loadLocker(&m_LoadMutex);
+    int added = 0;
+    for(int position : positions)
+    {
+        index_t* index = (index_t*)pl_get(m_Engine->indexes, position);
+        // It failed to load
+        if(!index->codekd)
+            continue;
+        // This moves it to the front of the least recently used list
+        m_LoadedIndexes.removeOne(position);
+        m_LoadedIndexes.prepend(position);
+        if(engine_add_loaded_index(solveEngine, index) == 0)
+            added++;
+    }
+    return added;
+}
+
+int IndexCatalog::preload(const QStringList &folderPaths, const QStringList &filePaths, const std::function<void(int, int)> &progress,
+                          const std::atomic<bool> *cancel)
+{
+    const int total = acquire(folderPaths, filePaths);
+    QList<int> positions;
+    for(int position = 0; position < total; position++)
+        positions.append(position);
+
+    // The pages are touched by the threads that read the indexes, so they are read at the same time too.
+    // Nothing unloads an index while the catalog is acquired, so they can be touched without the load lock.
+    QMutex progressMutex;
+    int done = 0;
+    std::atomic<quint64> touched { 0 };
+    loadIndexes(positions, DEFAULT_CODE_TOL, [&](int position, bool loaded)
+    {
+        if(loaded)
+        {
+            const index_t* index = (const index_t*)pl_get(m_Engine->indexes, position);
+            quint64 sum = touchTree(codetree_search_tree(index->codekd));
+            if(index->starkd)
+                sum += touchTree(index->starkd->tree);
+            if(index->quads)
+                sum += touchPages(index->quads->quadarray, size_t(index->quads->numquads) * index->quads->dimquads * sizeof(uint32_t));
+            touched += sum;
+        }
+        if(progress)
+        {
+            // The progress goes up one at a time, whichever thread gets there first
+            QMutexLocker progressLocker(&progressMutex);
+            progress(++done, total);
+        }
+    }, cancel);
+
+    int pinned = 0;
+    {
+        QMutexLocker loadLocker(&m_LoadMutex);
+        for(int position : positions)
+        {
+            const index_t* index = (const index_t*)pl_get(m_Engine->indexes, position);
+            if(!index->codekd)
+                continue;
+            if(!m_LoadedIndexes.contains(position))
+                m_LoadedIndexes.append(position);
+            m_PinnedIndexes.insert(position);
+            pinned++;
+        }
+    }
+    // The sum is only logged so that the reads of the pages are not optimized away
+    logverb("Preloaded %i of %i indexes (%llu)\n", pinned, total, (unsigned long long)touched.load());
+    release();
+    return pinned;
+}
+
+void IndexCatalog::loadIndexes(const QList<int> &positions, double codetol, const std::function<void(int, bool)> &loaded,
+                               const std::atomic<bool> *cancel)
+{
+    if(positions.isEmpty())
+        return;
+    int threads, prefetchLevels;
+    bool hugePages, quantize;
+    {
+        QMutexLocker loadLocker(&m_LoadMutex);
+        threads = m_LoadThreads > 0 ? m_LoadThreads : std::min(QThread::idealThreadCount(), int(DEFAULT_LOAD_THREADS));
+        hugePages = m_HugePages;
+        prefetchLevels = m_PrefetchLevels;
+        quantize = m_QuantizeIndexes;
+    }
+    threads = qBound(1, threads, positions.size());
+
+    // Each thread claims the next index that isn't loaded and reads it without the load lock.  An index that another thread
+    // is loading is skipped and waited for at the end, so two threads that wait for each other's indexes can't get stuck.
+    std::atomic<int> next { 0 };
+    QMutex claimedMutex;
+    QList<int> claimed, skipped;
+    QHash<int, qint64> quantizedSizes;
+    const auto work = [&]()
+    {
+        forever
+        {
+            const int item = next++;
+            if(item >= positions.size() || (cancel && cancel->load()))
+                return;
+            const int position = positions.at(item);
+            index_t* index;
+            {
+                QMutexLocker loadLocker(&m_LoadMutex);
+                index = (index_t*)pl_get(m_Engine->indexes, position);
+                if(m_LoadingIndexes.contains(position))
+                {
+                    QMutexLocker claimedLocker(&claimedMutex);
+                    skipped.append(position);
+                    continue;
+                }
+                if(index->codekd)
+                {
+                    loadLocker.unlock();
+                    if(loaded)
+                        loaded(position, true);
+                    continue;
+                }
+                m_LoadingIndexes.insert(position);
+            }
+            logverb("Loading index %s...\n", index->indexname);
+            const bool failed = index_reload(index) != 0;
+            // index_reload could have loaded part of it before it failed
+            if(failed)
+                index_unload(index);
+            else if(hugePages || prefetchLevels > 0)
+            {
+                adviseTree(index->codekd->tree, hugePages, prefetchLevels);
+                if(hugePages && index->starkd)
+                    adviseTree(index->starkd->tree, true, 0);
+#ifdef MADV_HUGEPAGE
+                if(hugePages && index->quads)
+                    adviseMemory(index->quads->quadarray, size_t(index->quads->numquads) * index->quads->dimquads * sizeof(uint32_t), MADV_HUGEPAGE);
+#endif
+            }
+            qint64 quantizedSize = -1;
+            // The native indexes are unloaded with their file, so they keep the trees in it
+            if(!failed && quantize && !index->native)
+            {
+                size_t bytes = 0;
+                if(codetree_quantize(index->codekd, &bytes))
+                {
+                    const kdtree_t* fileTree = index->codekd->tree;
+                    quantizedSize = qint64(bytes) - qint64(treeBytes(fileTree));
+                    adviseFileTree(fileTree);
+                    adviseTree(index->codekd->compact, hugePages, prefetchLevels);
+                }
+            }
+            {
+                QMutexLocker claimedLocker(&claimedMutex);
+                claimed.append(position);
+                if(quantizedSize != -1)
+                    quantizedSizes.insert(position, quantizedSize);
+            }
+            if(loaded)
+                loaded(position, !failed);
+        }
+    };
+    QList<QFuture<void>> helpers;
+    for(int helper = 1; helper < threads; helper++)
+        helpers.append(QtConcurrent::run(QThreadPool::globalInstance(), work));
+    work();
+    for(QFuture<void> &helper : helpers)
+        helper.waitForFinished();
+
+    // The code trees are compacted here, so what they log goes to the log of the solve
+    QMutexLocker loadLocker(&m_LoadMutex);
+    for(int position : claimed)
+    {
+        const index_t* index = (const index_t*)pl_get(m_Engine->indexes, position);
+        if(index->codekd)
+        {
+            if(quantizedSizes.contains(position))
+            {
+                m_CompactSizes.insert(position, quantizedSizes.value(position));
+                logverb("Index %s: the %i codes are quantized to 16 bits, which saves %.1f MB\n", index->indexname, index->codekd->tree->ndata,
+                        -quantizedSizes.value(position) / (1024.0 * 1024.0));
+            }
+            else if(m_CompactCodeTrees)
+            {
+                compactCodeTree(position, codetol);
+                // The compact tree is in memory, so it can always be in huge pages
+                adviseTree(index->codekd->compact, hugePages, 0);
+            }
+            if(m_PositionalShards)
+                shardCodeTree(position);
+            if(m_BrightCodeTrees)
+                brightCodeTree(position);
+            m_LoadedBytes += indexFileSize(index) + m_CompactSizes.value(position);
+        }
+        m_LoadingIndexes.remove(position);
+    }
+    m_IndexesLoaded.wakeAll();
+    QList<bool> skippedLoaded;
+    for(int position : skipped)
+    {
+        while(m_LoadingIndexes.contains(position))
+            m_IndexesLoaded.wait(&m_LoadMutex);
+        skippedLoaded.append(((const index_t*)pl_get(m_Engine->indexes, position))->codekd != nullptr);
+    }
+    loadLocker.unlock();
+    for(int i = 0; i < skipped.size() && loaded; i++)
+        loaded(skipped.at(i), skippedLoaded.at(i));
+}
+
+QStringList IndexCatalog::coveringIndexFiles(const QStringList &folderPaths, const QStringList &filePaths, double arcsecPerPixelLow,
+        double arcsecPerPixelHigh, int width, int height, double ra, double dec, double radius, double quadFractionLow, double quadFractionHigh)
+{
+    if(arcsecPerPixelLow > arcsecPerPixelHigh)
+        std::swap(arcsecPerPixelLow, arcsecPerPixelHigh);
+    // These are the quad sizes of engine_select_indexes_for_job
+    const double quadLow = quadFractionLow * std::min(width, height) * arcsecPerPixelLow;
+    const double quadHigh = quadFractionHigh * std::hypot(width, height) * arcsecPerPixelHigh;
+
+    struct Covering
+    {
+        double scale;
+        QString path;
+    };
+    QList<Covering> covering;
+    const int count = acquire(folderPaths, filePaths);
+    for(int position = 0; position < count; position++)
+    {
+        index_t* index = (index_t*)pl_get(m_Engine->indexes, position);
+        if(!index_overlaps_scale_range(index, quadLow, quadHigh))
+            continue;
+        if(radius > 0 && !index_is_within_range(index, ra, dec, radius))
+            continue;
+        covering.append({index->index_scale_lower, QString::fromUtf8(index->indexname)});
+    }
+    release();
+
+    std::sort(covering.begin(), covering.end(), [](const Covering & a, const Covering & b)
+    {
+        return a.scale != b.scale ? a.scale < b.scale : a.path < b.path;
+    });
+    QStringList paths;
+    for(const Covering &index : covering)
+        paths.append(index.path);
+    logverb("%i of %i index files cover quads of %g to %g arcsec\n", int(paths.count()), count, quadLow, quadHigh);
+    return paths;
+}
+
+int IndexCatalog::addReferenceStars(const QStringList &folderPaths, const QStringList &filePaths, double ra, double dec, double radius,
+                                    struct verify_ref_catalog_t *catalog)
+{
+    const int count = acquire(folderPaths, filePaths);
+    QList<int> positions;
+    for(int position = 0; position < count; position++)
+    {
+        index_t* index = (index_t*)pl_get(m_Engine->indexes, position);
+        if(index_is_within_range(index, ra, dec, radius))
+            positions.append(position);
+    }
+    loadIndexes(positions, DEFAULT_CODE_TOL);
+
+    double center[3];
+    radecdeg2xyzarr(ra, dec, center);
+    const double radius2 = deg2distsq(radius);
+    int stars = 0, indexes = 0;
+    {
+        QMutexLocker loadLocker(&m_LoadMutex);
+        for(int position : positions)
+        {
+            index_t* index = (index_t*)pl_get(m_Engine->indexes, position);
+            if(!index->codekd || !index->starkd)
+                continue;
+            const int added = verify_ref_catalog_add(catalog, index->starkd, index->indexid, index->healpix, center, radius2);
+            if(added < 0)
+                continue;
+            stars += added;
+            indexes++;
+            m_LoadedIndexes.removeOne(position);
+            m_LoadedIndexes.prepend(position);
+        }
+    }
+    release();
+    logverb("The reference catalog has %i stars of %i indexes within %g degrees of %g, %g\n", stars, indexes, radius, ra, dec);
+    return stars;
+}
+
+void IndexCatalog::unpin()
+{
+    QMutexLocker loadLocker(&m_LoadMutex);
+    m_PinnedIndexes.clear();
+}
+
+void IndexCatalog::clear()
+{
+    QWriteLocker locker(&m_Lock);
+    unload();
+}
+
+void IndexCatalog::setMemoryBudget(qint64 bytes)
+{
+    QMutexLocker loadLocker(&m_LoadMutex);
+    m_MemoryBudget = bytes;
+}
+
+void IndexCatalog::setLoadThreads(int threads)
+{
+    QMutexLocker loadLocker(&m_LoadMutex);
+    m_LoadThreads = std::max(0, threads);
+}
+
+void IndexCatalog::setHugePages(bool hugePages)
+{
+    QMutexLocker loadLocker(&m_LoadMutex);
+    m_HugePages = hugePages;
+}
+
+void IndexCatalog::setPrefetchLevels(int levels)
+{
+    QMutexLocker loadLocker(&m_LoadMutex);
+    m_PrefetchLevels = std::max(0, levels);
+}
+
+void IndexCatalog::setCompactCodeTrees(bool compact)
+{
+    QMutexLocker loadLocker(&m_LoadMutex);
+    m_CompactCodeTrees = compact;
+}
+
+void IndexCatalog::setQuantizeIndexes(bool quantize)
+{
+    QMutexLocker loadLocker(&m_LoadMutex);
+    m_QuantizeIndexes = quantize;
+}
+
+void IndexCatalog::setPositionalShards(bool shards)
+{
+    QMutexLocker loadLocker(&m_LoadMutex);
+    m_PositionalShards = shards;
+}
+
+void IndexCatalog::setBrightCodeTrees(bool bright)
+{
+    QMutexLocker loadLocker(&m_LoadMutex);
+    m_BrightCodeTrees = bright;
+}
+
+void IndexCatalog::setManifestPath(const QString &path)
+{
+    QWriteLocker locker(&m_Lock);
+    m_ManifestPath = path;
+}
+
+bool IndexCatalog::matches(const QStringList &folderPaths, const QStringList &filePaths) const
+{
+    return m_Engine && m_FolderPaths == folderPaths && m_FilePaths == filePaths;
+}
+
+void IndexCatalog::load(const QStringList &folderPaths, const QStringList &filePaths)
+{
+    unload();
+
+    m_Engine = engine_new();
+    // With this turned off, the indexes just have their metadata.  The rest is loaded on demand in addIndexesTo.
+    m_Engine->inparallel = FALSE;
+
+    QJsonObject manifest = readManifest();
+    bool manifestChanged = false;
+
+    for(const auto &onePath : filePaths)
+    {
+        addIndex(onePath, manifest, manifestChanged, false);
+    }
+
+    //This searches the index folders for index files, like engine_autoindex_search_paths does, but checks the manifest before opening any of them.
+    for(const auto &onePath : folderPaths)
+    {
+        QDir dir(onePath);
+        if(!dir.exists())
+        {
+            logmsg("Warning: failed to open index directory: \"%s\"\n", onePath.toUtf8().constData());
+            continue;
+        }
+        logverb("Auto-indexing directory \"%s\" ...\n", onePath.toUtf8().constData());
+        const QFileInfoList files = dir.entryInfoList(QDir::Files, QDir::Name);
+        // An index file that was repacked next to itself is skipped, so the same index isn't loaded twice
+        QSet<QString> repacked;
+        for(const QFileInfo &file : files)
+        {
+            if(file.fileName().endsWith(SSINDEX_SUFFIX))
+                repacked.insert(file.completeBaseName());
+        }
+        // They get added in reverse order, the same as engine_autoindex_search_paths
+        for(int i = files.count() - 1; i >= 0; i--)
+        {
+            const QFileInfo &file = files.at(i);
+            if(!file.fileName().endsWith(SSINDEX_SUFFIX) && repacked.contains(file.completeBaseName()))
+            {
+                logverb("Using the native index of %s\n", file.fileName().toUtf8().constData());
+                continue;
+            }
+            addIndex(file.absoluteFilePath(), manifest, manifestChanged, true);
+        }
+    }
+
+    if(manifestChanged)
+        writeManifest(manifest);
+
+    m_FolderPaths = folderPaths;
+    m_FilePaths = filePaths;
+}
+
+void IndexCatalog::addIndex(const QString &path, QJsonObject &manifest, bool &manifestChanged, bool checkIsIndex)
+{
+    const QFileInfo info(path);
+    const QString key = info.absoluteFilePath();
+    const QByteArray pathBytes = path.toUtf8();
+    const double size = info.size();
+    const double modified = info.lastModified().toMSecsSinceEpoch();
+    index_t* ind = nullptr;
+
+    QJsonObject entry = manifest.value(key).toObject();
+    if(!entry.isEmpty() && entry.value("size").toDouble() == size && entry.value("modified").toDouble() == modified)
+    {
+        if(!entry.value("index").toBool())
+            return;
+
+        const QByteArray cutband = entry.value("cutband").toString().toUtf8();
+        index_t meta = {};
+        meta.indexid = entry.value("indexid").toInt();
+        meta.healpix = entry.value("healpix").toInt();
+        meta.hpnside = entry.value("hpnside").toInt();
+        meta.index_jitter = entry.value("jitter").toDouble();
+        meta.cutnside = entry.value("cutnside").toInt();
+        meta.cutnsweep = entry.value("cutnsweep").toInt();
+        meta.cutdedup = entry.value("cutdedup").toDouble();
+        meta.cutband = entry.contains("cutband") ? (char*)cutband.constData() : nullptr;
+        meta.cutmargin = entry.value("cutmargin").toInt();
+        meta.circle = entry.value("circle").toBool() ? TRUE : FALSE;
+        meta.cx_less_than_dx = entry.value("cxdx").toBool() ? TRUE : FALSE;
+        meta.meanx_less_than_half = entry.value("meanx").toBool() ? TRUE : FALSE;
+        meta.index_scale_upper = entry.value("scaleupper").toDouble();
+        meta.index_scale_lower = entry.value("scalelower").toDouble();
+        meta.dimquads = entry.value("dimquads").toInt();
+        meta.nstars = entry.value("nstars").toInt();
+        meta.nquads = entry.value("nquads").toInt();
+        ind = index_from_metadata(pathBytes.constData(), &meta);
+    }
+    else
+    {
+        entry = QJsonObject();
+        entry.insert("size", size);
+        entry.insert("modified", modified);
+
+        if(checkIsIndex && !index_is_file_index(pathBytes.constData()))
+        {
+            logverb("File is not an index: %s\n", pathBytes.constData());
+            entry.insert("index", false);
+            manifest.insert(key, entry);
+            manifestChanged = true;
+            return;
+        }
+
+        ind = index_load(pathBytes.constData(), INDEX_ONLY_LOAD_METADATA, NULL);
+        if(!ind)
+        {
+            logmsg("Failed to add index \"%s\".\n", pathBytes.constData());
+            return;
+        }
+
+        entry.insert("index", true);
+        entry.insert("indexid", ind->indexid);
+        entry.insert("healpix", ind->healpix);
+        entry.insert("hpnside", ind->hpnside);
+        entry.insert("jitter", ind->index_jitter);
+        entry.insert("cutnside", ind->cutnside);
+        entry.insert("cutnsweep", ind->cutnsweep);
+        entry.insert("cutdedup", ind->cutdedup);
+        if(ind->cutband)
+            entry.insert("cutband", QString::fromUtf8(ind->cutband));
+        entry.insert("cutmargin", ind->cutmargin);
+        entry.insert("circle", ind->circle ? true : false);
+        entry.insert("cxdx", ind->cx_less_than_dx ? true : false);
+        entry.insert("meanx", ind->meanx_less_than_half ? true : false);
+        entry.insert("scaleupper", ind->index_scale_upper);
+        entry.insert("scalelower", ind->index_scale_lower);
+        entry.insert("dimquads", ind->dimquads);
+        entry.insert("nstars", ind->nstars);
+        entry.insert("nquads", ind->nquads);
+        manifest.insert(key, entry);
+        manifestChanged = true;
+    }
+
+    engine_add_loaded_index(m_Engine, ind);
+    // The catalog's engine owns the index, so engine_free will free it
+    pl_append(m_Engine->free_indexes, ind);
+}
+
+bool IndexCatalog::repackIndex(const QString &source, const QString &destination, bool quantizeCodes)
+{
+    const QByteArray sourceBytes = source.toUtf8();
+    index_t* index = index_load(sourceBytes.constData(), 0, NULL);
+    if(!index)
+    {
+        logmsg("Failed to load index \"%s\" to repack it.\n", sourceBytes.constData());
+        return false;
+    }
+    if(index->native)
+    {
+        logmsg("Index \"%s\" is already a native index.\n", sourceBytes.constData());
+        index_free(index);
+        return false;
+    }
+    // It is written next to the destination and then renamed, so a solve never loads half of it
+    const QString partial = destination + ".part";
+    QFile::remove(partial);
+    const bool written = ssindex_write(index, partial.toUtf8().constData(), quantizeCodes ? TRUE : FALSE) == 0;
+    index_free(index);
+    if(!written)
+    {
+        QFile::remove(partial);
+        return false;
+    }
+    QFile::remove(destination);
+    return QFile::rename(partial, destination);
+}
+
+QJsonObject IndexCatalog::readManifest() const
+{
+    if(m_ManifestPath.isEmpty())
+        return QJsonObject();
+    QFile file(m_ManifestPath);
+    if(!file.open(QIODevice::ReadOnly))
+        return QJsonObject();
+    return QJsonDocument::fromJson(file.readAll()).object();
+}
+
+void IndexCatalog::writeManifest(const QJsonObject &manifest) const
+{
+    if(m_ManifestPath.isEmpty())
+        return;
+    QDir().mkpath(QFileInfo(m_ManifestPath).absolutePath());
+    // QSaveFile replaces the manifest in one step, so another program reading it never sees half of it
+    QSaveFile file(m_ManifestPath);
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        logmsg("Failed to write the index manifest \"%s\".\n", m_ManifestPath.toUtf8().constData());
+        return;
+    }
+    file.write(QJsonDocument(manifest).toJson(QJsonDocument::Compact));
+    file.commit();
+}
+
+void IndexCatalog::unload()
+{
+    engine_free(m_Engine);
+    m_Engine = nullptr;
+    m_FolderPaths.clear();
+    m_FilePaths.clear();
+    m_LoadedIndexes.clear();
+    m_CompactSizes.clear();
+    m_PinnedIndexes.clear();
+    m_LoadedBytes = 0;
+}
+
+void IndexCatalog::compactCodeTree(int position, double codetol)
+{
+    index_t* index = (index_t*)pl_get(m_Engine->indexes, position);
+    size_t bytes = 0;
+    const double speedup = codetree_compact(index->codekd, codetol, &bytes);
+    if(index->codekd->compact)
+    {
+        m_CompactSizes.insert(position, bytes);
+        logmsg("Index %s: the compact code tree searches %.2f times as fast, it uses %.1f MB\n", index->indexname, speedup,
+               bytes / (1024.0 * 1024.0));
+    }
+    else if(speedup > 0)
+        logmsg("Index %s: the compact code tree searches %.2f times as fast, the tree in the file is kept\n", index->indexname, speedup);
+    else
+        logverb("Index %s: the code tree can't be made more compact\n", index->indexname);
+}
+
+void IndexCatalog::shardCodeTree(int position)
+{
+    index_t* index = (index_t*)pl_get(m_Engine->indexes, position);
+    size_t bytes = 0;
+    const int trees = index_shard_codes(index, 0, &bytes);
+    if(trees > 0)
+    {
+        m_CompactSizes[position] += bytes;
+        logverb("Index %s: the codes are split up over %i healpixes, they use %.1f MB\n", index->indexname, trees,
+                bytes / (1024.0 * 1024.0));
+    }
+    else
+        logverb("Index %s: the codes are not split up by healpix\n", index->indexname);
+}
+
+void IndexCatalog::brightCodeTree(int position)
+{
+    index_t* index = (index_t*)pl_get(m_Engine->indexes, position);
+    // The quads of the first sweeps of most indexes are about an eighth of them
+    constexpr double BRIGHT_FRACTION = 1.0 / 8;
+    size_t bytes = 0;
+    const int codes = index_bright_codes(index, BRIGHT_FRACTION, &bytes);
+    if(codes > 0)
+    {
+        m_CompactSizes[position] += bytes;
+        logverb("Index %s: the %i codes of the bright quads have their own tree, it uses %.1f MB\n", index->indexname, codes,
+                bytes / (1024.0 * 1024.0));
+    }
+    else
+        logverb("Index %s: the codes of the bright quads don't have their own tree\n", index->indexname);
+}
+
+void IndexCatalog::trimToBudget()
+{
+    if(!m_Engine || m_MemoryBudget <= 0)
+        return;
+
+    qint64 loadedSize = 0;
+    QList<qint64> sizes;
+    for(int position : m_LoadedIndexes)
+    {
+        sizes.append(indexFileSize((index_t*)pl_get(m_Engine->indexes, position)) + m_CompactSizes.value(position));
+        loadedSize += sizes.last();
+    }
+
+    // The preloaded indexes are pinned, so they are skipped
+    for(int i = m_LoadedIndexes.count() - 1; i >= 0 && loadedSize > m_MemoryBudget; i--)
+    {
+        const int position = m_LoadedIndexes.at(i);
+        if(m_PinnedIndexes.contains(position))
+            continue;
+        m_LoadedIndexes.removeAt(i);
+        index_t* index = (index_t*)pl_get(m_Engine->indexes, position);
+        logverb("Unloading least recently used index %s\n", index->indexname);
+        m_CompactSizes.remove(position);
+        index_unload(index);
+        loadedSize -= sizes.takeAt(i);
+        m_LoadedBytes = loadedSize;
+    }
+}
@@ -0,0 +1,424 @@
+/*  IndexCatalog, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QStringList>
+#include <QReadWriteLock>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include <QJsonObject>
+#include <QFuture>
+#include <atomic>
+#include <functional>
+
+// These are the Astrometry.net engine that holds the indexes and the job being solved, see astrometry/engine.h
+struct engine;
+struct job_t;
+// The index stars of a session, see astrometry/verify.h and ReferenceCatalog
+struct verify_ref_catalog_t;
+
+/**
+ * @brief The IndexCatalog class keeps the Astrometry.net index files loaded between solves.
+ * Without it, every internal solve creates a new engine, opens every index file in the index folders, and frees it all again at the end.
+ * The catalog is owned by the StellarSolver (and can be shared between several StellarSolvers) and is handed to each ExtractorSolver,
+ * including the child solvers of a parallel solve, so the indexes only get loaded again when the index settings change.
+ * Only the metadata of each index is read up front.  The kd-trees of an index are loaded the first time a solve's scale range and search position
+ * need it, and they stay loaded for later solves until the memory budget is exceeded, then the least recently used ones are unloaded.
+ * The metadata is cached in a manifest file keyed by the path, size and modification time of each file, so the index files
+ * don't need to be opened again to build the catalog unless they changed.
+ * It is thread safe, any number of solves can use it at the same time while a reload waits for them to finish.
+ * Besides the Astrometry.net index files, it loads the native index files that repackIndex writes, and when an index folder
+ * has both a native file and the index file it was repacked from, only the native one is used.
+ */
+class IndexCatalog
+{
+    public:
+        IndexCatalog();
+        ~IndexCatalog();
+
+        /**
+         * @brief acquire makes sure the catalog holds the indexes for the given settings and locks it for use by a solve.
+         * If the settings are different from the ones that were loaded last time, the index metadata is reloaded first.
+         * Every call to acquire must be matched by a call to release when the solve is done with the indexes.
+         * @param folderPaths is the list of folders to search for index files
+         * @param filePaths is the list of individual index files to load
+         * @return The number of indexes in the catalog
+         */
+        int acquire(const QStringList &folderPaths, const QStringList &filePaths);
+
+        /**
+         * @brief release unlocks the catalog after a solve that called acquire is done with the indexes.
+         * When no solves are using the catalog anymore, the least recently used indexes are unloaded until the loaded ones fit in the memory budget.
+         * They are unloaded on a thread of the global thread pool, so the solve doesn't wait for it before reporting its result.
+         */
+        void release();
+
+        /**
+         * @brief addIndexesTo loads the indexes that are needed for the job's scale range and search position, and adds them to an engine for the solve.
+         * The engine does not take ownership of them.  This should only be called between acquire and release,
+         * after the job's scales, search position and image size have been set.
+         * @param solveEngine is the engine for the solve
+         * @param job is the job that will be run
+         * @return The number of indexes that were added
+         */
+        int addIndexesTo(struct engine *solveEngine, struct job_t *job);
+
+        /**
+         * @brief addReferenceStars adds the stars of the indexes around a target to a reference catalog, see ReferenceCatalog.
+         * The indexes whose healpix is within the radius are loaded if they aren't yet, of every scale, since the catalog is for all of the
+         * solves of a session.  The stars are copied, so the indexes can be unloaded later.
+         * @param folderPaths is the list of folders to search for index files
+         * @param filePaths is the list of individual index files to load
+         * @param ra is the right ascension of the target in degrees
+         * @param dec is the declination of the target in degrees
+         * @param radius is the radius around the target in degrees
+         * @param catalog is the catalog to add the stars to
+         * @return The number of stars added, from all of the indexes
+         */
+        int addReferenceStars(const QStringList &folderPaths, const QStringList &filePaths, double ra, double dec, double radius,
+                              struct verify_ref_catalog_t *catalog);
+
+        /**
+         * @brief clear unloads all of the indexes, for instance after index files were added to or removed from the index folders.
+         * They will get loaded again the next time the catalog is acquired.
+         */
+        void clear();
+
+        /**
+         * @brief preload loads all of the indexes for the given settings now, instead of the first time a solve needs them, and pins them
+         * so they are not unloaded to fit in the memory budget.  It also reads a byte of each page of their kd-trees and quads,
+         * so the pages of the memory mapped files are in memory and the first solve doesn't have to wait for the disk.
+         * Solves can use the catalog while it preloads, it only holds the load lock while it claims and finishes each index.
+         * The indexes are read by several threads at once, see setLoadThreads.
+         * @param folderPaths is the list of folders to search for index files
+         * @param filePaths is the list of individual index files to load
+         * @param progress is called after each index with how many are done and how many there are, it can be empty
+         * @param cancel stops the preload before the next index if it gets set, it can be null
+         * @return The number of indexes that are loaded and pinned
+         */
+        int preload(const QStringList &folderPaths, const QStringList &filePaths, const std::function<void(int, int)> &progress = nullptr,
+                    const std::atomic<bool> *cancel = nullptr);
+
+        /**
+         * @brief coveringIndexFiles plans which of the index files can solve the images of an optical setup, the same way a solve picks its indexes.
+         * An index is needed if the sizes of its quads overlap the sizes of the quads the image can have, from the quad fractions of the smaller side
+         * at the smallest scale to those of the diagonal at the largest one, and if its healpix is within the search radius of the position.
+         * So the files of the other scale series are left out, and with a position, the healpix tiles of the rest of the sky too.
+         * It only needs the metadata of the indexes, which the catalog loads from its manifest if the settings changed, nothing else is loaded.
+         * @param folderPaths is the list of folders to search for index files
+         * @param filePaths is the list of individual index files to consider
+         * @param arcsecPerPixelLow is the smallest image scale, in arcseconds per pixel
+         * @param arcsecPerPixelHigh is the largest image scale, in arcseconds per pixel
+         * @param width is the width of the images in pixels
+         * @param height is the height of the images in pixels
+         * @param ra is the right ascension of the center of the sky region in degrees, it is only used with a radius
+         * @param dec is the declination of the center of the sky region in degrees
+         * @param radius is the radius of the sky region in degrees, or 0 or less for the whole sky
+         * @param quadFractionLow is the smallest quad the solver looks for, as a fraction of the smaller side of the image
+         * @param quadFractionHigh is the largest quad the solver looks for, as a fraction of the diagonal of the image
+         * @return The paths of the index files, sorted by the size of their quads and then by their path
+         */
+        QStringList coveringIndexFiles(const QStringList &folderPaths, const QStringList &filePaths, double arcsecPerPixelLow, double arcsecPerPixelHigh,
+                                       int width, int height, double ra = 0, double dec = 0, double radius = 0,
+                                       double quadFractionLow = DEFAULT_QUAD_FRACTION_LOW, double quadFractionHigh = DEFAULT_QUAD_FRACTION_HIGH);
+
+        // The quad sizes the solver looks for by default, the same as the Astrometry.net defaults
+        static constexpr double DEFAULT_QUAD_FRACTION_LOW = 0.1;
+        static constexpr double DEFAULT_QUAD_FRACTION_HIGH = 1.0;
+
+        /**
+         * @brief unpin lets the indexes that were preloaded be unloaded again to fit in the memory budget
+         */
+        void unpin();
+
+        /**
+         * @brief setMemoryBudget sets how much memory the loaded indexes may use between solves
+         * @param bytes is the budget in bytes, 0 means the indexes are never unloaded
+         */
+        void setMemoryBudget(qint64 bytes);
+
+        /**
+         * @brief getMemoryBudget gets how much memory the loaded indexes may use between solves
+         * @return The budget in bytes, 0 means the indexes are never unloaded
+         */
+        qint64 getMemoryBudget() const
+        {
+            return m_MemoryBudget;
+        }
+
+        /**
+         * @brief loadedBytes gets how much memory the indexes that are loaded now use, the sizes of their files and of their compact, quantized and split up code trees
+         * @return The bytes
+         */
+        qint64 loadedBytes() const
+        {
+            return m_LoadedBytes.load();
+        }
+
+        /**
+         * @brief setLoadThreads sets how many index files get read at the same time when a solve or the preload loads several of them.
+         * Opening, mapping and reading an index takes more time waiting for the disk and parsing it than moving the bytes, so on an SSD
+         * and several cores a few of them at once finish sooner.  More of them at once only make a hard disk seek back and forth.
+         * @param threads is the most index files read at once, 1 reads them one after the other, 0 uses DEFAULT_LOAD_THREADS or fewer if the CPU has fewer cores
+         */
+        void setLoadThreads(int threads);
+
+        /**
+         * @brief getLoadThreads gets how many index files get read at the same time, 0 if it depends on the CPU
+         * @return The most index files read at once
+         */
+        int getLoadThreads() const
+        {
+            return m_LoadThreads;
+        }
+
+        // The most index files read at once by default
+        static const int DEFAULT_LOAD_THREADS = 4;
+
+        /**
+         * @brief setHugePages sets whether the kd-trees and quads of each index are asked to be kept in huge pages when the index is loaded,
+         * with madvise(MADV_HUGEPAGE).  The searches jump around the trees, so with 4 KB pages most steps miss the TLB.  The kernel only does it
+         * for the compact code trees, which are in memory, and for the mapped index files if it can put read only files in transparent huge pages.
+         * MAP_HUGETLB can't map regular files.  It does nothing except on Linux.  It is off by default.
+         * @param hugePages is whether to ask for huge pages, it applies to the indexes loaded from now on
+         */
+        void setHugePages(bool hugePages);
+
+        /**
+         * @brief getHugePages gets whether the indexes are asked to be kept in huge pages
+         * @return true if they are
+         */
+        bool getHugePages() const
+        {
+            return m_HugePages;
+        }
+
+        /**
+         * @brief setPrefetchLevels sets how many of the top levels of the code kd-tree of each index are read ahead with madvise(MADV_WILLNEED)
+         * when the index is loaded.  Every search starts at the top of the tree, so those pages are needed by the first solve, and reading
+         * them with the load takes their page faults out of the search, see SolveMetrics::majorPageFaults.  The whole tree is read by the preload anyway.
+         * It is 0 by default, which doesn't read any of them ahead.
+         * @param levels is the number of levels, it applies to the indexes loaded from now on
+         */
+        void setPrefetchLevels(int levels);
+
+        /**
+         * @brief getPrefetchLevels gets how many of the top levels of the code kd-trees are read ahead when the indexes are loaded
+         * @return The number of levels
+         */
+        int getPrefetchLevels() const
+        {
+            return m_PrefetchLevels;
+        }
+
+        /**
+         * @brief setCompactCodeTrees sets whether the code kd-tree of each index gets copied into a compact in-memory tree when the index is loaded.
+         * The copy keeps the codes as doubles but only has a 16 bit split value at each node, so the top of the tree fits in a few cache lines.
+         * Both trees are timed on a sample of the codes and the copy is only used if it is faster, the speedup of each index is logged.
+         * The index files are not changed, and the copies count towards the memory budget.  It is off by default.
+         * @param compact is whether to make the copies, it applies to the indexes loaded from now on
+         */
+        void setCompactCodeTrees(bool compact);
+
+        /**
+         * @brief getCompactCodeTrees gets whether the code kd-trees get copied into compact in-memory trees when the indexes are loaded
+         * @return true if they do
+         */
+        bool getCompactCodeTrees() const
+        {
+            return m_CompactCodeTrees;
+        }
+
+        /**
+         * @brief setQuantizeIndexes sets whether the codes of each index get copied into an in-memory kd-tree of 16 bit integers when the index is loaded,
+         * which is searched in place of the tree in the file.  Most index files store the codes as doubles, so the copy is a quarter of their size and
+         * more of it stays in the caches.  The codes move by less than 1/65535 of their range, which the verification of the matches doesn't notice.
+         * The pages of the file tree are left for the kernel to drop, so the loaded bytes count the copy instead of them.  The native indexes and
+         * the files that already store integer codes are left as they are.  It replaces the compact code trees, and it is off by default.
+         * @param quantize is whether to make the copies, it applies to the indexes loaded from now on
+         */
+        void setQuantizeIndexes(bool quantize);
+
+        /**
+         * @brief getQuantizeIndexes gets whether the codes get copied into 16 bit kd-trees when the indexes are loaded
+         * @return true if they do
+         */
+        bool getQuantizeIndexes() const
+        {
+            return m_QuantizeIndexes;
+        }
+
+        /**
+         * @brief setPositionalShards sets whether the codes of each index get split up by the healpix of their quads when the index is loaded.
+         * The solves with a position and a search radius then only search the codes of the healpixes within the radius,
+         * instead of searching the whole code kd-tree and throwing away the quads that are out of range.  The solves without a position
+         * search the whole tree as before.  Only the indexes with enough quads for a few thousand in each healpix are split up,
+         * and the split up codes count towards the memory budget.  It is off by default.
+         * @param shards is whether to split up the codes, it applies to the indexes loaded from now on
+         */
+        void setPositionalShards(bool shards);
+
+        /**
+         * @brief getPositionalShards gets whether the codes of the indexes get split up by healpix when the indexes are loaded
+         * @return true if they do
+         */
+        bool getPositionalShards() const
+        {
+            return m_PositionalShards;
+        }
+
+        /**
+         * @brief setBrightCodeTrees sets whether the codes of the quads of the brightest stars of each index get copied into a small code kd-tree of their own
+         * when the index is loaded.  The quads are ranked by the brightness sweep of their faintest star, and the brightest eighth of them are kept.
+         * The internal solver searches those trees first with the brightest stars of the field, see Parameters::brightPassStars, which solves most
+         * fields in a fraction of the time, and the whole code kd-trees only if that fails.  The small trees count towards the memory budget.  It is off by default.
+         * @param bright is whether to make the small trees, it applies to the indexes loaded from now on
+         */
+        void setBrightCodeTrees(bool bright);
+
+        /**
+         * @brief getBrightCodeTrees gets whether the codes of the bright quads get copied into small code kd-trees when the indexes are loaded
+         * @return true if they do
+         */
+        bool getBrightCodeTrees() const
+        {
+            return m_BrightCodeTrees;
+        }
+
+        /**
+         * @brief setManifestPath sets the file used to cache the metadata of the index files between sessions
+         * @param path is the path to the manifest file, an empty path turns the manifest off
+         */
+        void setManifestPath(const QString &path);
+
+        /**
+         * @brief getManifestPath gets the file used to cache the metadata of the index files between sessions
+         * @return The path to the manifest file, by default it is in the generic cache folder
+         */
+        QString getManifestPath() const
+        {
+            return m_ManifestPath;
+        }
+
+        /**
+         * @brief repackIndex writes an Astrometry.net index file as a native index file, see astrometry/ssindex.h.
+         * The native file has the code kd-tree, the quads and the star kd-tree one after the other in the order a solve reads them,
+         * each starting on its own page, with the quads in the order of their codes in the tree, so a cold load is one sequential read
+         * of one mapping and the quads of the codes a search finds are next to each other.
+         * @param source is the index file to repack
+         * @param destination is the native index file to write, usually the source with the .ssindex suffix instead of .fits
+         * @param quantizeCodes is whether to rebuild the code kd-tree with 16 bit codes, which makes it a quarter of the size
+         * @return true if the file was written
+         */
+        static bool repackIndex(const QString &source, const QString &destination, bool quantizeCodes = false);
+
+    private:
+
+        /**
+         * @brief matches checks whether the currently loaded indexes were loaded with the given settings
+         * @return true if they match
+         */
+        bool matches(const QStringList &folderPaths, const QStringList &filePaths) const;
+
+        /**
+         * @brief load unloads any current indexes and then loads the metadata for the ones for the given settings.  The write lock must be held.
+         */
+        void load(const QStringList &folderPaths, const QStringList &filePaths);
+
+        /**
+         * @brief addIndex adds one index file to the engine, using the metadata in the manifest if the file has not changed since it was cached.
+         * @param path is the index file
+         * @param manifest is the manifest read from the manifest file, it gets updated if the file was not in it or changed
+         * @param manifestChanged gets set to true if the manifest was updated
+         * @param checkIsIndex determines whether files that are not index files should be skipped, like when searching the index folders
+         */
+        void addIndex(const QString &path, QJsonObject &manifest, bool &manifestChanged, bool checkIsIndex);
+
+        /**
+         * @brief readManifest reads the manifest file
+         * @return The cached metadata keyed by file path, it is empty if there is no manifest
+         */
+        QJsonObject readManifest() const;
+
+        /**
+         * @brief writeManifest saves the manifest file
+         * @param manifest is the cached metadata keyed by file path
+         */
+        void writeManifest(const QJsonObject &manifest) const;
+
+        /**
+         * @brief unload frees the engine holding the indexes.  The write lock must be held.
+         */
+        void unload();
+
+        /**
+         * @brief loadIndexes loads the indexes at the positions that aren't loaded yet, reading up to the load threads of them at once.
+         * The ones another thread is loading are left to it and waited for.  The catalog must be acquired and the load mutex must not be held.
+         * @param positions are the positions of the indexes in the engine
+         * @param codetol is the code tolerance the compact code trees get timed with
+         * @param loaded is called for each index with whether it is loaded, on the thread that read it and before its code tree is compacted,
+         * or after the wait for the ones another thread loaded.  It can be empty.
+         * @param cancel stops reading more indexes if it gets set, it can be null
+         */
+        void loadIndexes(const QList<int> &positions, double codetol, const std::function<void(int, bool)> &loaded = nullptr,
+                         const std::atomic<bool> *cancel = nullptr);
+
+        /**
+         * @brief compactCodeTree makes the compact copy of the code kd-tree of an index that was just loaded, if it is faster.  The load mutex must be held.
+         * @param position is the position of the index in the engine
+         * @param codetol is the code tolerance the copy gets timed with
+         */
+        void compactCodeTree(int position, double codetol);
+
+        /**
+         * @brief shardCodeTree splits up the codes of an index that was just loaded by healpix, if it has enough of them.  The load mutex must be held.
+         * @param position is the position of the index in the engine
+         */
+        void shardCodeTree(int position);
+
+        /**
+         * @brief brightCodeTree copies the codes of the bright quads of an index that was just loaded into their own tree.  The load mutex must be held.
+         * @param position is the position of the index in the engine
+         */
+        void brightCodeTree(int position);
+
+        /**
+         * @brief trimToBudget unloads the least recently used indexes until the rest fit in the memory budget.  The load mutex must be held and no solves may be using the catalog.
+         */
+        void trimToBudget();
+
+        QFuture<void> m_Trim;                   // The unloading of the indexes that no longer fit in the memory budget, see release
+        QMutex m_TrimMutex;                     // This protects m_Trim, m_Trimming and m_TrimAgain
+        bool m_Trimming { false };              // Whether m_Trim is running, it is cleared by the trim itself as it ends
+        bool m_TrimAgain { false };             // A release asked for a trim while one was running, so that one trims once more
+        QReadWriteLock m_Lock;                  // Solves hold this for reading while they use the indexes, loading them holds it for writing
+        QMutex m_LoadMutex;                     // This protects the loading and unloading of individual indexes while solves are using the catalog
+        QWaitCondition m_IndexesLoaded;         // This wakes the threads waiting for the indexes another thread is loading
+        QSet<int> m_LoadingIndexes;             // The positions of the indexes that a thread is loading without the load mutex
+        int m_LoadThreads { 0 };                // The most index files read at once, 0 for DEFAULT_LOAD_THREADS or the number of cores
+        bool m_HugePages { false };             // Whether the trees and quads of the indexes are asked to be kept in huge pages when they are loaded
+        int m_PrefetchLevels { 0 };             // How many of the top levels of the code kd-trees are read ahead when they are loaded
+        struct engine *m_Engine { nullptr };    // The engine that owns the indexes
+        QStringList m_FolderPaths;              // The index folders used to load the current indexes
+        QStringList m_FilePaths;                // The individual index files used to load the current indexes
+        QString m_ManifestPath;                 // The file used to cache the metadata of the index files
+        QList<int> m_LoadedIndexes;             // The positions of the fully loaded indexes in the engine, the most recently used first
+        int m_ActiveSolves { 0 };               // The number of solves that currently have the catalog acquired
+        qint64 m_MemoryBudget { 2LL * 1024 * 1024 * 1024 }; // How much memory the loaded indexes may use between solves
+        bool m_CompactCodeTrees { false };      // Whether the code kd-trees get copied into compact in-memory trees when they are loaded
+        bool m_PositionalShards { false };      // Whether the codes get split up by healpix when they are loaded
+        bool m_BrightCodeTrees { false };       // Whether the codes of the bright quads get their own trees when they are loaded
+        bool m_QuantizeIndexes { false };       // Whether the codes get copied into 16 bit kd-trees when they are loaded
+        QHash<int, qint64> m_CompactSizes;      // The memory used by the compact, quantized and split up code kd-trees, less the file trees they replace, keyed by the position of their index
+        QSet<int> m_PinnedIndexes;              // The positions of the indexes that were preloaded, they are not unloaded to fit in the memory budget
+        std::atomic<qint64> m_LoadedBytes { 0 };// The memory used by the loaded indexes, so it can be read without waiting for a load
+};
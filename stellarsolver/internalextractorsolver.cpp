@@ -12,15 +12,38 @@
 #include "windows.h"
 #else //Linux
 #include <sys/stat.h>
+#include <sys/resource.h>
 #endif
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
 #include <memory>
+#include <queue>
+#include <thread>
+#include <vector>
 
 #include "internalextractorsolver.h"
+#include "indexcatalog.h"
+#include "referencecatalog.h"
+#include "solverthreadpool.h"
+#include "tracer.h"
+#include "starsort.h"
+#include "psffit.h"
+#include "starsummary.h"
+#include "starmerger.h"
+#include "openclfilter.h"
+#include "openclcodematcher.h"
+#include "matchverifier.h"
 #include "stellarsolver.h"
 #include "sep/extract.h"
+#include "sep/arena.h"
+#include "sep/simd.h"
 #include "qmath.h"
 #include <QMutexLocker>
+#include <QWaitCondition>
+#include <QElapsedTimer>
 
 //CFitsio Includes
 #include <fitsio.h>
@@ -29,6 +52,9 @@
 extern "C" {
 #include "astrometry/log.h"
 #include "astrometry/sip-utils.h"
+#include "astrometry/starxy.h"
+#include "astrometry/starutil.h"
+#include "astrometry/fit-wcs.h"
 }
 
 using namespace SSolver;
@@ -36,6 +62,70 @@ using namespace SEP;
 
 static int solverNum = 1;
 
+namespace
+{
+
+// This adds the nanoseconds from its creation until it goes out of scope to the time of a stage of the extraction, see StageTimes
+class StageTimer
+{
+    public:
+        explicit StageTimer(std::atomic<qint64> &time) : m_Time(time)
+        {
+            m_Timer.start();
+        }
+        ~StageTimer()
+        {
+            m_Time += m_Timer.nsecsElapsed();
+        }
+
+    private:
+        std::atomic<qint64> &m_Time;
+        QElapsedTimer m_Timer;
+};
+
+// The name of the vector instructions of sep_simd or solver_simd for the solve metrics
+QString simdName(int simd, int avx2, int neon)
+{
+    if (simd == avx2)
+        return "AVX2";
+    if (simd == neon)
+        return "NEON";
+    return "none";
+}
+
+// The page faults of the calling thread so far, which only Linux counts for each thread
+void threadPageFaults(int &minor, int &major)
+{
+#if defined(__linux__) && defined(RUSAGE_THREAD)
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) == 0)
+    {
+        minor = usage.ru_minflt;
+        major = usage.ru_majflt;
+        return;
+    }
+#endif
+    minor = major = 0;
+}
+
+}
+
+// The extraction thread of a pipelined solve adds the stars here as the partitions finish, and growField takes them for the solver.
+// The stars are kept brightest first, except that the ones the solver was given never change, so the depth ranges it has done stay the same.
+struct InternalExtractorSolver::StarPipeline
+{
+    QMutex mutex;
+    QWaitCondition added;   // Woken when stars are added or the extraction is done
+    QVector<double> x, y;
+    QVector<float> mag;
+    int given { 0 };        // The stars at the start that the solver's field has
+    bool done { false };
+    // A progressive extraction waits on needed until the solver wants more than this many stars, or the solve is over
+    QWaitCondition needed;
+    int wanted { 0 };
+    bool stopped { false };
+};
+
 InternalExtractorSolver::InternalExtractorSolver(ProcessType pType, ExtractorType eType, SolverType sType,
         const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer, QObject *parent) : ExtractorSolver(pType, eType, sType,
                     imagestats, imageBuffer, parent)
@@ -43,21 +133,15 @@ InternalExtractorSolver::InternalExtractorSolver(ProcessType pType, ExtractorTyp
     //This sets the base name used for the temp files.
     m_BaseName = "internalExtractorSolver_" + QString::number(solverNum++);
     m_PartitionThreads = QThread::idealThreadCount();
+    m_CancelToken.reset(new std::atomic<int>(0));
+    m_FloatBuffers.reset(new ExtractionBuffers());
+    m_ImageView = resolveImageView(imagestats, FITSImage::ImageView());
+    m_FrameKernels = frameKernelsFor(imagestats.dataType);
 }
 
 InternalExtractorSolver::~InternalExtractorSolver()
 {
     waitSEP(); // Just in case it has not shut down
-    if(downSampledBuffer)
-    {
-        delete [] downSampledBuffer;
-        downSampledBuffer = 0;
-    }
-    if(mergedChannelBuffer)
-    {
-        delete [] mergedChannelBuffer;
-        mergedChannelBuffer = 0;
-    }
     if(isRunning())
     {
         quit();
@@ -66,9 +150,64 @@ InternalExtractorSolver::~InternalExtractorSolver()
     }
 }
 
+bool InternalExtractorSolver::loadNextFrame(const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer,
+        const FITSImage::ImageView &view)
+{
+    if(isRunning() || m_RowReader)
+        return false;
+    m_Statistics = imagestats;
+    m_ImageBuffer = imageBuffer;
+    m_ImageView = resolveImageView(imagestats, view);
+    m_FrameKernels = frameKernelsFor(imagestats.dataType);
+
+    //Everything that was about the frame before, the settings of the next run are set again by the StellarSolver
+    usingDownsampledImage = false;
+    usingMergedChannelImage = false;
+    m_PreparedFrame = nullptr;
+    m_ViewBinning = 0;
+    m_DetectionBinning = 0;
+    m_HasExtracted = false;
+    m_HasSolved = false;
+    m_HasWCS = false;
+    m_WasAborted = false;
+    m_CancelToken->store(0);
+    m_UseSubframe = false;
+    m_UseScale = false;
+    m_UsePosition = false;
+    m_Background = FITSImage::Background();
+    m_ExtractedStars.clear();
+    m_HasImageQuality = false;
+    m_ImageQuality = FITSImage::ImageQuality();
+    m_Solution = FITSImage::Solution();
+    m_Metrics = FITSImage::SolveMetrics();
+    m_StarsToTrack.clear();
+    m_FullExtractionStars = 0;
+    m_WasTracked = false;
+    m_StageTimes.prepare = 0;
+    m_StageTimes.background = 0;
+    m_StageTimes.detection = 0;
+    m_StageTimes.deblend = 0;
+    m_StageTimes.photometry = 0;
+    m_StageTimes.filter = 0;
+    std::fill(m_ExtractionCounters, m_ExtractionCounters + SSCOUNTERS_N, 0);
+    return true;
+}
+
 //This is the abort method.  For the internal solver it sets a cancel variable. It quits the thread.  And it cancels any SEP threads that are in progress.
+//The cancel token is checked throughout the quad search and verification.  The tokens of the child solvers are set too, so aborting this solver
+//stops all of them, while aborting a child solver only stops that one.
 void InternalExtractorSolver::abort()
 {
+    m_CancelToken->store(1);
+    {
+        QMutexLocker locker(&m_ChildCancelMutex);
+        for (const auto &childToken : m_ChildCancelTokens)
+        {
+            const QSharedPointer<std::atomic<int>> token = childToken.toStrongRef();
+            if (token)
+                token->store(1);
+        }
+    }
     waitSEP();
     quit();
 
@@ -93,15 +232,30 @@ void InternalExtractorSolver::waitSEP()
     futures.clear();
 }
 
+SEP::sep_task_runner InternalExtractorSolver::poolRunner() const
+{
+    if (!threadPool || threadPool->maxThreads() <= 1)
+        return sep_task_runner();
+    SolverThreadPool *pool = threadPool.data();
+    const SolveUrgency slotUrgency = urgency;
+    return [pool, slotUrgency](const std::function<void()> &thread)
+    {
+        return pool->tryRun(thread, slotUrgency);
+    };
+}
+
 //This method generates child solvers with the options of the current solver
 ExtractorSolver* InternalExtractorSolver::spawnChildSolver(int n)
 {
-    Q_UNUSED(n);
-
     InternalExtractorSolver *solver = new InternalExtractorSolver(m_ProcessType, m_ExtractorType, m_SolverType, m_Statistics,
             m_ImageBuffer, nullptr);
+    solver->m_ChildNumber = n;
     solver->setParent(this->parent());  //This makes the parent the StellarSolver
     solver->m_ExtractedStars = m_ExtractedStars;
+    //The children solve the same field, so its stars are converted and preprocessed for the verifications once for all of them
+    if(!m_SharedField || !m_SharedField->isFor(m_ExtractedStars))
+        m_SharedField = SharedField::create(m_ExtractedStars);
+    solver->m_SharedField = m_SharedField;
     solver->m_BasePath = m_BasePath;
     //They will all share the same basename
     solver->m_HasExtracted = true;
@@ -109,6 +263,32 @@ ExtractorSolver* InternalExtractorSolver::spawnChildSolver(int n)
     solver->m_ActiveParameters = m_ActiveParameters;
     solver->indexFolderPaths = indexFolderPaths;
     solver->indexFiles = indexFiles;
+    //All of the child solvers share one copy of the indexes, even if this solver was not given a catalog to use
+    if(!indexCatalog)
+        indexCatalog.reset(new IndexCatalog());
+    solver->indexCatalog = indexCatalog;
+    solver->threadPool = threadPool;
+    solver->urgency = urgency;
+    //The child that solves remembers the solution for the next time
+    solver->m_SolutionCache = m_SolutionCache;
+    solver->m_ReferenceCatalog = m_ReferenceCatalog;
+    //Aborting this solver stops all of them, but a child solver can be stopped alone, like the ranges after the one that solved
+    {
+        QMutexLocker locker(&m_ChildCancelMutex);
+        m_ChildCancelTokens.erase(std::remove_if(m_ChildCancelTokens.begin(), m_ChildCancelTokens.end(),
+                                                 [](const QWeakPointer<std::atomic<int>> &token)
+        {
+            return token.isNull();
+        }), m_ChildCancelTokens.end());
+        m_ChildCancelTokens.append(solver->m_CancelToken);
+    }
+    //It is only read after it is in the list, so an abort that comes now still reaches it
+    solver->m_CancelToken->store(m_CancelToken->load());
+    solver->m_SharedBestLogOdds = m_SharedBestLogOdds;
+    solver->m_CountHardwareEvents = m_CountHardwareEvents;
+    //The child solvers only log astrometry.net to the log window, since they would all write the same log file
+    solver->m_AstrometryLogLevel = m_LogToFile ? SSolver::LOG_NONE : m_AstrometryLogLevel;
+    solver->astroLogger.setPrefix(QString("Child Solver # %1: ").arg(n));
     //Set the log level one less than the main solver
     if(m_SSLogLevel == LOG_VERBOSE )
         solver->m_SSLogLevel = LOG_NORMAL;
@@ -127,7 +307,69 @@ ExtractorSolver* InternalExtractorSolver::spawnChildSolver(int n)
 
 int InternalExtractorSolver::extract()
 {
-    return(runSEPExtractor());
+    Tracer::Span span("extract");
+    m_WasTracked = false;
+    // Only runSEPExtractor detects on the binned view of detectionBinning, it sets this again
+    m_DetectionBinning = 0;
+    m_RegionStars.clear();
+    if(!m_StarsToTrack.isEmpty() && m_ProcessType != SOLVE && m_Regions.isEmpty())
+    {
+        if(trackStars() == 0)
+        {
+            m_WasTracked = true;
+            return 0;
+        }
+        emit logOutput("Too many stars were lost while tracking them, so they will be extracted again.");
+    }
+    //The partitions and the threads within SEP are only as many as the thread pool allows
+    if(threadPool)
+        m_PartitionThreads = threadPool->maxThreads();
+    // SEP's threads for the frame's background and the binning start on the free slots of the pool as well
+    RunnerScope runnerScope(poolRunner());
+    if(m_Calibration && !calibration())
+        emit logOutput("The calibration frames only calibrate images with one channel that are inside them, so this image is not calibrated.");
+    int result;
+    if(!m_Regions.isEmpty() && m_ProcessType != SOLVE)
+        result = runRegionExtractor();
+    else
+        result = m_RowReader ? runStreamingExtractor() : runSEPExtractor();
+    updateExtractionMetrics();
+    return result;
+}
+
+int InternalExtractorSolver::trackStars()
+{
+    // This is the smallest part of the stars that has to be found again to keep on tracking
+    const double TRACK_MIN_FOUND = 0.8;
+
+    // The stars are expected where they were, moved as much as they moved in the frame before
+    QList<FITSImage::Star> predicted = m_StarsToTrack;
+    for (auto &star : predicted)
+    {
+        star.x += m_TrackShift.x();
+        star.y += m_TrackShift.y();
+    }
+
+    // The stars lost are counted from the last full extraction, not from the frame before, or they could be lost a few at a time
+    const int baseline = std::max(m_FullExtractionStars, static_cast<int>(m_StarsToTrack.size()));
+    QVector<int> measured;
+    if (measureFocus(predicted, &measured) != 0 || m_ExtractedStars.size() < TRACK_MIN_FOUND * baseline)
+        return -1;
+
+    // The median of how far the stars moved is where they likely are in the next frame
+    std::vector<double> shiftX, shiftY;
+    for (int i = 0; i < m_ExtractedStars.size(); i++)
+    {
+        shiftX.push_back(m_ExtractedStars[i].x - m_StarsToTrack[measured[i]].x);
+        shiftY.push_back(m_ExtractedStars[i].y - m_StarsToTrack[measured[i]].y);
+    }
+    if (!shiftX.empty())
+    {
+        std::nth_element(shiftX.begin(), shiftX.begin() + shiftX.size() / 2, shiftX.end());
+        std::nth_element(shiftY.begin(), shiftY.begin() + shiftY.size() / 2, shiftY.end());
+        m_TrackShift = QPointF(shiftX[shiftX.size() / 2], shiftY[shiftY.size() / 2]);
+    }
+    return 0;
 }
 
 //This is the method that runs the solver or star extractor.  Do not call it, use the methods above instead, so that it can start a new thread.
@@ -153,6 +395,13 @@ void InternalExtractorSolver::run()
 
         case SOLVE:
         {
+            if(!m_HasExtracted && m_ActiveParameters.pipelineSolve)
+            {
+                int result = runPipelinedSolve();
+                cleanupTempFiles();
+                emit finished(result);
+                break;
+            }
             if(!m_HasExtracted)
             {
                 extract();
@@ -164,9 +413,15 @@ void InternalExtractorSolver::run()
                     return;
                 }
             }
-            if(m_HasExtracted)
+            // The child solvers solve the stars of the StellarSolver, which were checked before they were made
+            if(m_HasExtracted && !isChildSolver && checkViability() != FITSImage::FRAME_VIABLE)
+            {
+                cleanupTempFiles();
+                emit finished(-1);
+            }
+            else if(m_HasExtracted)
             {
-                int result = runInternalSolver();
+                int result = m_ActiveParameters.center_first_fraction > 0 && !m_HasPriorWCS ? runCenterFirstSolve() : runInternalSolver();
                 cleanupTempFiles();
                 emit finished(result);
             }
@@ -188,36 +443,145 @@ void InternalExtractorSolver::cleanupTempFiles()
     //There are NO temp files anymore for the internal SEP or Astrometry builds!!!
 }
 
+// This clamps the pixels of a w x h buffer that stand out from all but one of their 8 neighbours, like hot pixels and the cosmic ray hits
+// of one or two pixels, to their second brightest neighbour.  Even a star in sharp focus has several bright neighbours around its peak.
+// A pixel is clamped if it is more than ratio times the spread of the other neighbours above the second brightest one, so it doesn't
+// depend on the background.  Each row is filtered from copies of the row above and of itself, so the inner loop has no branches and
+// no dependencies between the pixels and gets vectorized.  The pixels at the edges are left as they are.
+static void rejectHotPixels(float *data, int w, int h, float ratio)
+{
+    if (w < 3 || h < 3 || ratio <= 0)
+        return;
+    std::vector<float> above(data, data + w), current(w);
+    for (int y = 1; y < h - 1; y++)
+    {
+        float *row = data + static_cast<size_t>(y) * w;
+        const float *below = row + w;
+        std::copy(row, row + w, current.begin());
+        for (int x = 1; x < w - 1; x++)
+        {
+            const float neighbours[8] = { above[x - 1], above[x], above[x + 1], current[x - 1], current[x + 1], below[x - 1], below[x], below[x + 1] };
+            float first = neighbours[0], second = -HUGE_VALF, lowest = neighbours[0];
+            for (int i = 1; i < 8; i++)
+            {
+                second = std::max(second, std::min(first, neighbours[i]));
+                first = std::max(first, neighbours[i]);
+                lowest = std::min(lowest, neighbours[i]);
+            }
+            row[x] = current[x] - second > ratio * (second - lowest) ? second : current[x];
+        }
+        above.swap(current);
+    }
+}
+
 bool InternalExtractorSolver::allocateDataBuffer(float *data, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
 {
-    switch (m_Statistics.dataType)
+    StageTimer timer(m_StageTimes.prepare);
+    // The prepared frame already had its hot pixels rejected, see prepareFrameType
+    if (m_PreparedFrame)
+        return getFloatBuffer<float>(data, x, y, w, h);
+    bool converted;
+    if (m_ViewBinning > 1)
+        converted = m_FrameKernels.binnedBuffer && (this->*m_FrameKernels.binnedBuffer)(data, x, y, w, h);
+    else
+        converted = m_FrameKernels.floatBuffer && (this->*m_FrameKernels.floatBuffer)(data, x, y, w, h);
+    if (converted)
+        rejectHotPixels(data, w, h, m_ActiveParameters.hotPixelRejection);
+    return converted;
+}
+
+bool InternalExtractorSolver::readDataBuffer(float *data, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    StageTimer timer(m_StageTimes.prepare);
+    const bool converted = m_FrameKernels.streamedFloatBuffer && (this->*m_FrameKernels.streamedFloatBuffer)(data, x, y, w, h);
+    if (converted)
+        rejectHotPixels(data, w, h, m_ActiveParameters.hotPixelRejection);
+    return converted;
+}
+
+template <typename T>
+InternalExtractorSolver::FrameKernels InternalExtractorSolver::frameKernelsFor()
+{
+    FrameKernels kernels;
+    kernels.floatBuffer = &InternalExtractorSolver::getFloatBuffer<T>;
+    kernels.streamedFloatBuffer = &InternalExtractorSolver::getStreamedFloatBuffer<T>;
+    kernels.binnedBuffer = &InternalExtractorSolver::getBinnedBuffer<T>;
+    kernels.prepareFrame = &InternalExtractorSolver::prepareFrameType<T>;
+    return kernels;
+}
+
+InternalExtractorSolver::FrameKernels InternalExtractorSolver::frameKernelsFor(int dataType)
+{
+    switch (dataType)
     {
         case SEP_TBYTE:
-            return getFloatBuffer<uint8_t>(data, x, y, w, h);
+            return frameKernelsFor<uint8_t>();
         case TSHORT:
-            return getFloatBuffer<int16_t>(data, x, y, w, h);
+            return frameKernelsFor<int16_t>();
         case TUSHORT:
-            return getFloatBuffer<uint16_t>(data, x, y, w, h);
+            return frameKernelsFor<uint16_t>();
         case TLONG:
-            return getFloatBuffer<int32_t>(data, x, y, w, h);
+            return frameKernelsFor<int32_t>();
         case TULONG:
-            return getFloatBuffer<uint32_t>(data, x, y, w, h);
+            return frameKernelsFor<uint32_t>();
         case TFLOAT:
-            return getFloatBuffer<float>(data, x, y, w, h);
+            return frameKernelsFor<float>();
         case TDOUBLE:
-            return getFloatBuffer<double>(data, x, y, w, h);
+            return frameKernelsFor<double>();
         default:
-            delete [] data;
-            data = 0;
-            return false;
+            return FrameKernels();
     }
-
-    return false;
 }
 
 namespace
 {
 
+// The most pixels sampledLevel looks at
+const int LEVEL_SAMPLES = 4096;
+
+// This gets the level of the sky of a float image from the median of a grid of about LEVEL_SAMPLES of its pixels, which the stars
+// hardly change, so that a shared background can tell whether the sky of the image moved away from the one it was made from
+float sampledLevel(const float *data, uint32_t w, uint32_t h)
+{
+    const uint32_t step = std::max<uint32_t>(1, static_cast<uint32_t>(std::sqrt(static_cast<double>(w) * h / LEVEL_SAMPLES)));
+    std::vector<float> samples;
+    samples.reserve((w / step + 1) * (h / step + 1));
+    for (uint32_t y = step / 2; y < h; y += step)
+        for (uint32_t x = step / 2; x < w; x += step)
+            samples.push_back(data[static_cast<size_t>(y) * w + x]);
+    if (samples.empty())
+        return 0;
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return samples[samples.size() / 2];
+}
+
+// This copies a background map with its level moved by delta.  The splines of the levels are the same for every level, so only the
+// levels of the mesh change.  It returns nullptr if there is no memory for it.
+sep_bkg *shiftedBackground(const sep_bkg *map, float delta)
+{
+    sep_bkg *shifted = static_cast<sep_bkg *>(calloc(1, sizeof(sep_bkg)));
+    if (!shifted)
+        return nullptr;
+    *shifted = *map;
+    const size_t bytes = sizeof(float) * map->n;
+    shifted->back = static_cast<float *>(malloc(bytes));
+    shifted->dback = static_cast<float *>(malloc(bytes));
+    shifted->sigma = static_cast<float *>(malloc(bytes));
+    shifted->dsigma = static_cast<float *>(malloc(bytes));
+    if (!shifted->back || !shifted->dback || !shifted->sigma || !shifted->dsigma)
+    {
+        sep_bkg_free(shifted);
+        return nullptr;
+    }
+    memcpy(shifted->dback, map->dback, bytes);
+    memcpy(shifted->sigma, map->sigma, bytes);
+    memcpy(shifted->dsigma, map->dsigma, bytes);
+    for (int i = 0; i < map->n; i++)
+        shifted->back[i] = map->back[i] + delta;
+    shifted->global += delta;
+    return shifted;
+}
+
 // This function adds a margin around the rectangle with corners x1,y1 x2,y2 for the image
 // with the given width and height, making sure the margin doesn't go outside the image.
 // It returns the expanded rectangle defined by corner startX,startY and width, height.
@@ -251,8 +615,208 @@ void computeMargin(uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2,
     *height = endY - *startY + 1;
 }
 
+// This picks how many columns and rows of partitions to cut a w x h area into for the given number of threads.
+// Every grid with partitions of at least minSize on a side, and up to MAX_TILES_PER_THREAD partitions per thread, is scored
+// by the time it should take to finish.  The partitions go to the thread pool as a queue, so with more partitions than threads,
+// a thread that finishes early just takes the next one.  That time is then about the total work divided by the threads,
+// plus the biggest partition, since the last one to start can finish that much later.  The work includes the margins that
+// get processed twice, and the biggest partition counts double, since a part of the image dense with stars can take that
+// much longer than the others.  Each partition also costs about PARTITION_OVERHEAD pixels of work to set up.
+// So fewer, bigger partitions lose on stragglers, and more, smaller ones lose on margins and overhead.
+// On a machine with fast and slow cores, the threads get capacity fastest cores of work done together, and any partition can land
+// on the slowest core, which takes 1 / slowest times as long with it.  That favors more, smaller partitions, which the fast cores
+// take more of, so the slow ones don't hold up the end.  With cores that are all alike, capacity is threads and slowest is 1.
+// Returns 1 x 1 if the area should not be partitioned at all.
+void planPartitions(uint32_t w, uint32_t h, uint32_t threads, double capacity, double slowest, uint32_t margin, uint32_t minSize,
+                    uint32_t *columns, uint32_t *rows)
+{
+    constexpr uint32_t MAX_TILES_PER_THREAD = 4;
+    constexpr double STRAGGLER_FACTOR = 2.0;
+    constexpr double PARTITION_OVERHEAD = 20000;
+
+    *columns = 1;
+    *rows = 1;
+    if (threads < 2)
+        return;
+
+    const uint32_t maxColumns = std::max(1u, w / minSize);
+    const uint32_t maxRows = std::max(1u, h / minSize);
+    const uint32_t maxTiles = threads * MAX_TILES_PER_THREAD;
+
+    // The last partition in a row or column gets the remainder, and the ones in the middle have a margin on both sides
+    auto biggestSide = [margin](uint32_t length, uint32_t count)
+    {
+        if (count == 1)
+            return static_cast<double>(length);
+        const double last = length / count + length % count + margin;
+        return count > 2 ? std::max(last, static_cast<double>(length / count + 2 * margin)) : last;
+    };
+
+    double bestTime = -1;
+    for (uint32_t c = 1; c <= maxColumns; c++)
+    {
+        for (uint32_t r = 1; r <= maxRows && c * r <= maxTiles; r++)
+        {
+            const uint32_t tiles = c * r;
+            const double tileW = biggestSide(w, c);
+            const double tileH = biggestSide(h, r);
+            const double work = (w + 2.0 * margin * (c - 1)) * (h + 2.0 * margin * (r - 1)) + PARTITION_OVERHEAD * tiles;
+            const double biggest = (STRAGGLER_FACTOR * tileW * tileH + PARTITION_OVERHEAD) / slowest;
+            const double time = tiles <= threads ? biggest : work / capacity + biggest * (1.0 - 1.0 / threads);
+            // Ties go to the grid with fewer partitions, since that is less overhead
+            if (bestTime < 0 || time < bestTime)
+            {
+                bestTime = time;
+                *columns = c;
+                *rows = r;
+            }
+        }
+    }
+}
+
+// SEP indexes the pixels of an image with int, so no partition, margins included, can have more pixels than this
+const uint64_t MAX_SEP_PIXELS = std::numeric_limits<int>::max();
+
+// This adds rows to a columns x rows grid of partitions of a w x h area until each partition, with its margins, has at most maxPixels.
+// It is a no-op for any image that isn't bigger than about 46000 x 46000 pixels, while a plate or a mosaic that is gets cut into bands.
+void limitPartitions(uint32_t w, uint32_t h, uint32_t margin, uint64_t maxPixels, uint32_t *columns, uint32_t *rows)
+{
+    auto biggestSide = [margin](uint32_t length, uint32_t count)
+    {
+        return static_cast<uint64_t>(length / count + length % count + (count > 1 ? 2 * margin : 0));
+    };
+    while (*rows < h && biggestSide(w, *columns) * biggestSide(h, *rows) > maxPixels)
+        (*rows)++;
+}
+
+// The margin is extra image placed around partitions, so we can detect large stars near
+// the edges of the partitions. The margin size needs to be about half the size of a star to
+// be detected, since the other half of the star would be internal to the partition.
+// Below determines the margin size used.  If maxSize == 0, that means that the max
+// star size is unspecified.  In this case we use a margin of 10, so stars of size > 20 may be missed
+// on the edge of a partition. If the max-star size is given very large, we limit the size of the margin
+// used to 50 (e.g. corresponding to a 100-pixel-wide star).
+uint32_t partitionMargin(double maxSize)
+{
+    int margin = maxSize / 2;
+    if (margin <= 20)
+        margin = 20;
+    else if (margin > 50)
+        margin = 50;
+    return margin;
+}
+
+// Solving only needs clean positions, so the deblending can be limited to the objects that look blended, for a time per image.
+// This returns the limits that all of the partitions of the image share, or nullptr if the deblending is not limited.
+// Whether the deblending is limited, which is only done for solving
+bool limitsDeblending(ProcessType processType, const Parameters &parameters)
+{
+    return processType == SOLVE && (parameters.deblend_min_pixels > 0 || parameters.deblend_min_elongation > 0 ||
+                                    parameters.deblend_time_limit > 0);
+}
+
+// The limits are always made, since they also measure the time spent deblending for the solve metrics.
+// When the deblending is not limited, they are all 0 and every object is deblended.
+// They also carry the deadline of the extraction time limit, which starts when they are made, at the start of the extraction.
+// The saturated objects are not deblended for any process type, when the saturation filter throws them away anyway.
+std::unique_ptr<sep_deblend_limits> createDeblendLimits(ProcessType processType, const Parameters &parameters, double saturation)
+{
+    std::unique_ptr<sep_deblend_limits> limits(new sep_deblend_limits());
+    limits->saturation = saturation;
+    if (limitsDeblending(processType, parameters))
+    {
+        limits->minpix = parameters.deblend_min_pixels;
+        limits->minelong = parameters.deblend_min_elongation;
+        limits->maxtime = parameters.deblend_time_limit;
+    }
+    if (parameters.extractionTimeLimit > 0)
+        limits->deadline = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+                           + static_cast<long long>(parameters.extractionTimeLimit * 1e6);
+    return limits;
+}
+
 }  // namespace
 
+// This is shared by all of the partitions when globalKeep is on.  It holds the oval sizes of the biggest stars found so far in the
+// whole image, so a partition can tell when the rest of its stars are too small to be kept, and skip their photometry.
+class InternalExtractorSolver::StarSelector
+{
+    public:
+        explicit StarSelector(uint32_t keep) : m_Keep(keep) {}
+
+        // Returns false if a star this size can't be one of the biggest.  Otherwise it counts as one of them for now.
+        bool offer(double size)
+        {
+            QMutexLocker locker(&m_Mutex);
+            if (m_Sizes.size() < m_Keep)
+            {
+                m_Sizes.push(size);
+                return true;
+            }
+            if (m_Keep == 0 || size <= m_Sizes.top())
+                return false;
+            m_Sizes.pop();
+            m_Sizes.push(size);
+            return true;
+        }
+
+        uint32_t keep() const
+        {
+            return m_Keep;
+        }
+
+    private:
+        QMutex m_Mutex;
+        std::priority_queue<double, std::vector<double>, std::greater<double>> m_Sizes;
+        const uint32_t m_Keep;
+};
+
+// This is the size used to pick the stars that are kept, it correlates very well with HFR and likely magnitude
+static double ovalSize(float a, float b)
+{
+    return a * a + b * b;
+}
+
+// This moves a star found in an image binned by d x d to the pixels of the full resolution image.  Binned pixel i covers
+// the pixels i * d to i * d + d - 1, so its center is at i * d + (d - 1) / 2.  The bins are averages, so the flux is d * d times bigger.
+static void toFullResolution(FITSImage::Star &star, int d)
+{
+    star.x = star.x * d + (d - 1) / 2.0f;
+    star.y = star.y * d + (d - 1) / 2.0f;
+    star.a *= d;
+    star.b *= d;
+    star.HFR *= d;
+    star.numPixels *= d * d;
+    star.flux *= d * d;
+    star.mag -= 2.5 * log10(d * d);
+}
+
+// The partitions may have kept stars that were pushed out later by bigger ones in other partitions, this keeps the biggest of them
+static void keepBiggestStars(QList<FITSImage::Star> &stars, uint32_t keep)
+{
+    if (static_cast<uint32_t>(stars.size()) <= keep)
+        return;
+    std::vector<double> sizes(stars.size());
+    for (int i = 0; i < stars.size(); i++)
+        sizes[i] = ovalSize(stars.at(i).a, stars.at(i).b);
+    QList<FITSImage::Star> biggest;
+    biggest.reserve(keep);
+    for (int i : StarSort::order(sizes.data(), stars.size(), true, static_cast<int>(keep)))
+        biggest.append(stars.at(i));
+    stars = biggest;
+}
+
+void InternalExtractorSolver::logDeblending(const sep_deblend_limits &limits)
+{
+    emit logOutput(QString("Deblended %1 objects and skipped %2 in %3 ms").arg(limits.ndeblended.load())
+                   .arg(limits.nskipped.load()).arg(limits.spent.load() / 1e6, 0, 'f', 1));
+    if (limits.nsaturated > 0)
+        emit logOutput(QString("Left out %1 saturated objects before deblending and photometry").arg(limits.nsaturated.load()));
+    if (limits.expired)
+        emit logOutput(QString("The extraction ran out of its time limit of %1 ms, the stars are the ones found until then")
+                       .arg(m_ActiveParameters.extractionTimeLimit));
+}
+
 //The code in this section is my attempt at running an internal star extractor program based on SEP
 //I used KStars and the SEP website as a guide for creating these functions
 int InternalExtractorSolver::runSEPExtractor()
@@ -269,37 +833,53 @@ int InternalExtractorSolver::runSEPExtractor()
 
     emit logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
     emit logOutput("Starting Internal StellarSolver Star Extractor with the " + m_ActiveParameters.listName + " profile . . .");
+    if(m_ActiveParameters.useGPU)
+        emit logOutput(OpenCLFilter::instance().isAvailable() ? OpenCLFilter::instance().description() :
+                       OpenCLFilter::instance().description() + " The image is filtered on the CPU.");
     //Only merge image channels if it is an RGB image and we are either averaging or integrating the channels
-    if(m_Statistics.channels == 3 && (m_ColorChannel == FITSImage::AVERAGE_RGB || m_ColorChannel == FITSImage::INTEGRATED_RGB))
+    const bool mergeChannels = m_Statistics.channels == 3 && (m_ColorChannel == FITSImage::AVERAGE_RGB || m_ColorChannel == FITSImage::INTEGRATED_RGB);
+    //Only downsample images before SEP if the Sextraction is being used for plate solving
+    const int downsample = (m_ProcessType == SOLVE && m_SolverType == SOLVER_STELLARSOLVER) ? m_ActiveParameters.downsample : 1;
+    //With downsampleView, each partition is binned while it is converted to float, and the stars are scaled back to full resolution.
+    //Otherwise both are done at once for the whole image, while it is converted to float for SEP, unless an earlier extraction already did it
+    //With detectionBinning, the stars are detected on a binned view the same way, and then measured again at full resolution.
+    //The merged channels of a full resolution frame and the stars that are only summarized can't be measured again, so they are detected at full resolution.
+    const int detectionBinning = m_ActiveParameters.detectionBinning;
+    if(m_ProcessType != SOLVE && detectionBinning > 1 && !mergeChannels && !m_SummaryOnly && m_PreparedFrame == nullptr)
+        m_ViewBinning = m_DetectionBinning = detectionBinning;
+    else if(downsample > 1 && m_ActiveParameters.downsampleView && m_PreparedFrame == nullptr)
+        m_ViewBinning = downsample;
+    else if((mergeChannels || downsample > 1) && m_PreparedFrame == nullptr)
     {
-        if (mergeImageChannels() == false)
+        if (prepareFrame(std::max(1, downsample)) == false)
         {
-            emit logOutput("Merging image channels failed.");
+            emit logOutput("Merging image channels and downsampling failed.");
             return -1;
         }
     }
-    //Only downsample images before SEP if the Sextraction is being used for plate solving
-    if(m_ProcessType == SOLVE && m_SolverType == SOLVER_STELLARSOLVER && m_ActiveParameters.downsample != 1)
+    //The size of the image SEP sees, which is the binned view if there is one
+    const uint32_t binning = std::max(1, m_ViewBinning);
+    const uint32_t imageWidth = m_Statistics.width / binning, imageHeight = m_Statistics.height / binning;
+    if (imageWidth == 0 || imageHeight == 0)
     {
-        if (downsampleImage(m_ActiveParameters.downsample) == false)
-        {
-            emit logOutput("Downsampling failed.");
-            return -1;
-        }
+        emit logOutput("The image is too small to downsample.");
+        return -1;
     }
     uint32_t x = 0, y = 0;
-    uint32_t w = m_Statistics.width, h = m_Statistics.height;
-    uint32_t raw_w = m_Statistics.width, raw_h = m_Statistics.height;
+    uint32_t w = imageWidth, h = imageHeight;
+    uint32_t raw_w = imageWidth, raw_h = imageHeight;
     if(m_UseSubframe && m_SubFrameRect.isValid())
     {
         // JM 2021-08-21 Max sure frame is within acceptable parameters.
-        x = std::max(0, m_SubFrameRect.x());
-        w = std::min(static_cast<int>(raw_w), m_SubFrameRect.width());
-        y = std::max(0, m_SubFrameRect.y());
-        h = std::min(static_cast<int>(raw_h), m_SubFrameRect.height());
+        x = std::max(0, m_SubFrameRect.x()) / binning;
+        w = std::min(static_cast<int>(raw_w), m_SubFrameRect.width() / static_cast<int>(binning));
+        y = std::max(0, m_SubFrameRect.y()) / binning;
+        h = std::min(static_cast<int>(raw_h), m_SubFrameRect.height() / static_cast<int>(binning));
 
     }
 
+    m_ExtractionArea = static_cast<double>(w) * h;
+
     // This data structure defines partitions of the full image processed to parallelize computation.
     // startX and startY define the x,y coordinates in the full image where this partition starts.
     // innerStartX and Y, and innerEndX and Y are the corners of the image patch of interest,
@@ -318,56 +898,239 @@ int InternalExtractorSolver::runSEPExtractor()
 
     QVector<float *> dataBuffers;
     QList<StartupOffset> startupOffsets;
-    QList<FITSImage::Background> backgrounds;
-
-    // The margin is extra image placed around partitions, so we can detect large stars near
-    // the edges of the partitions. The margin size needs to be about half the size of a star to
-    // be detected, since the other half of the star would be internal to the partition.
-    // Below determines the margin size used.  If m_ActiveParameters.maxSize == 0, that means that the max
-    // star size is unspecified.  In this case we use a margin of 10, so stars of size > 20 may be missed
-    // on the edge of a partition. If the max-star size is given very large, we limit the size of the margin
-    // used to 50 (e.g. corresponding to a 100-pixel-wide star).
-    int DEFAULT_MARGIN = m_ActiveParameters.maxSize / 2;
-    if (DEFAULT_MARGIN <= 20)
-        DEFAULT_MARGIN = 20;
-    else if (DEFAULT_MARGIN > 50)
-        DEFAULT_MARGIN = 50;
+    sep_bkg *globalBackground = nullptr;   // The background for the whole frame when the partitions share one
+    std::unique_ptr<StarSelector> selector; // This picks the stars to keep from the whole frame when globalKeep is on
+
+    std::unique_ptr<sep_deblend_limits> deblendLimits = createDeblendLimits(m_ProcessType, m_ActiveParameters, detectionSaturation());
+
+    // The margin around the partitions, so that the stars on their edges are found whole
+    const int DEFAULT_MARGIN = partitionMargin(m_ActiveParameters.maxSize);
 
     // Only partition if:
     // We have 2 or more threads.
-    // The image width and height is larger than partition size.
+    // The image is big enough that partitions of at least PARTITION_SIZE pay off, see planPartitions.
     constexpr int PARTITION_SIZE = 200;
-    if (m_ActiveParameters.partition &&  w > PARTITION_SIZE && h > PARTITION_SIZE && (m_PartitionThreads % 2) == 0)
+    uint32_t horizontalPartitions = 1, verticalPartitions = 1;
+    if (m_ActiveParameters.partition)
     {
-        // Partition the image to regions.
-        // If there is extra at the end, we add an offset.
-        // e.g. 500x400 image with patitions sized 200x200 would have 4 paritions
-        // #1 0, 0, 200, 200 (200 x 200)
-        // #2 200, 0, 200 + 100, 200 (300 x 200)
-        // #3 0, 200, 200, 200 (200 x 200)
-        // #4 200, 200, 200 + 100, 200 (300 x 200)
+        // Without a pool the partitions run on all of the cores, like the threads of processPool
+        const SolverThreadPool *cores = threadPool ? threadPool.data() : SolverThreadPool::processPool().data();
+        planPartitions(w, h, m_PartitionThreads, std::min<double>(cores->capacity(), m_PartitionThreads), cores->slowestSpeed(), DEFAULT_MARGIN,
+                       PARTITION_SIZE, &horizontalPartitions, &verticalPartitions);
+    }
+    // A gigapixel image is partitioned even when partitioning is off, so that SEP never sees more pixels than it can index
+    const uint32_t plannedRows = verticalPartitions;
+    limitPartitions(w, h, DEFAULT_MARGIN, MAX_SEP_PIXELS, &horizontalPartitions, &verticalPartitions);
+    if (verticalPartitions != plannedRows && m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("The image is too big for SEP to extract at once, it is cut into %1 rows of partitions").arg(verticalPartitions));
+    const uint32_t numPartitions = horizontalPartitions * verticalPartitions;
+
+    // A summary extraction gives each partition a summary to add its stars to, instead of a list of them to merge
+    std::vector<StarSummary> summaries(m_SummaryOnly ? numPartitions : 0);
+    // Each partition that is started writes its background into the next of these
+    std::vector<FITSImage::Background> backgrounds(numPartitions);
+    uint32_t launched = 0;
+
+    // Each partition owns the pixels inside its margins, and the stars within PARTITION_OVERLAP of the boundaries are taken from
+    // both sides, so a star whose centroid moves across a boundary between the partitions is neither lost nor counted twice.
+    constexpr double PARTITION_OVERLAP = 2;
+    StarMerger merger(QRect(x, y, w, h), numPartitions > 1 ? PARTITION_OVERLAP : 0);
+
+    // A progressive extraction hands the stars of each wave of partitions to the solver together, brightest first,
+    // instead of those of each partition as it finishes
+    const bool progressive = m_Pipeline && m_ActiveParameters.progressiveExtraction && numPartitions > 1;
+    int collected = 0;
+    auto collectPartitions = [&]()
+    {
+        QList<FITSImage::Star> waveStars;
+        for (; collected < futures.size(); collected++)
+        {
+            QFuture<QList<FITSImage::Star>> &oneFuture = futures[collected];
+            oneFuture.waitForFinished();
+            const QList<FITSImage::Star> partitionStars = oneFuture.result();
+            // The partitions find about the same number of stars, so the first one tells how much room the merge needs
+            if (merger.count() == 0)
+                merger.reserve(partitionStars.size() * numPartitions);
+            if (startupOffsets.empty())
+                continue;
+            const StartupOffset oneOffset = startupOffsets.takeFirst();
+            QList<FITSImage::Star> acceptedStars = merger.addPartition(partitionStars, oneOffset.startX, oneOffset.startY,
+                                                   QRect(QPoint(oneOffset.innerStartX, oneOffset.innerStartY), QPoint(oneOffset.innerEndX, oneOffset.innerEndY)),
+                                                   QRect(oneOffset.startX, oneOffset.startY, oneOffset.width, oneOffset.height));
+            if (binning > 1)
+            {
+                for (auto &oneStar : acceptedStars)
+                    toFullResolution(oneStar, binning);
+            }
+            streamStars(acceptedStars, collected, numPartitions);
+            if (progressive)
+                waveStars.append(acceptedStars);
+            else
+                publishStars(acceptedStars);
+        }
+        publishStars(waveStars);
+    };
 
-        int W_PARTITION_SIZE = PARTITION_SIZE;
-        int H_PARTITION_SIZE = PARTITION_SIZE;
+    // Unless the stars of each partition are handed on as it finishes, each thread takes the stars of its partition into a slot of the
+    // merger itself, and they are merged once all of the partitions are done, so only the stars near the boundaries are merged here
+    const bool slotted = !progressive && !m_Pipeline && !m_StreamPartitionStars;
+    if (slotted)
+        merger.setPartitions(numPartitions);
+    auto startPartition = [&](const ImageParams & parameters, const StartupOffset & offset)
+    {
+        const int slot = launched++;
+        if (!slotted)
+        {
+            futures.append(runPartition(parameters));
+            return;
+        }
+        futures.append(runPartition(parameters, [&merger, offset, slot](const QList<FITSImage::Star> &partitionStars)
+        {
+            merger.fillPartition(slot, partitionStars, offset.startX, offset.startY,
+                                 QRect(QPoint(offset.innerStartX, offset.innerStartY), QPoint(offset.innerEndX, offset.innerEndY)),
+                                 QRect(offset.startX, offset.startY, offset.width, offset.height));
+        }));
+    };
 
-        // Limit it to PARTITION_THREADS
-        if ( (w * h) / (W_PARTITION_SIZE * H_PARTITION_SIZE) > m_PartitionThreads)
+    // With a global background, the background is computed once for the whole area, margins included, and subtracted from it.
+    // Then the partitions just point into that frame, so they all share one background map and one threshold and nothing is copied.
+    // This only works because the background is subtracted once, otherwise each partition would subtract its own from the overlapping margins.
+    // A background shared with the extractions of other images is subtracted from the frame the same way, even for a single partition.
+    float *frameData = nullptr;
+    uint32_t frameX = 0, frameY = 0, frameW = 0, frameH = 0;
+    std::shared_ptr<sep_bkg> sharedMap;    // The shared background, which is kept until this extraction is done
+    bool wholeFrame = (m_ActiveParameters.globalBackground && numPartitions > 1) || m_SharedBackground;
+    if (wholeFrame)
+    {
+        computeMargin(x, y, x + w - 1, y + h - 1, imageWidth, imageHeight, DEFAULT_MARGIN,
+                      &frameX, &frameY, &frameW, &frameH);
+        // SEP can't make the background of a frame that it can't index, so then each partition makes its own
+        if (static_cast<uint64_t>(frameW) * frameH > MAX_SEP_PIXELS)
+        {
+            wholeFrame = false;
+            if (m_SSLogLevel != LOG_OFF)
+                emit logOutput("The image is too big for one background of the whole frame, each partition has its own");
+        }
+    }
+    if (wholeFrame)
+    {
+        frameData = floatBuffer(static_cast<size_t>(frameW) * frameH);
+        if (allocateDataBuffer(frameData, frameX, frameY, frameW, frameH) == false)
+        {
+            emit logOutput("Failed to allocate memory.");
+            return -1;
+        }
+        sep_image frame = {frameData, nullptr, nullptr, nullptr, SEP_TFLOAT, 0, 0, 0,
+                           static_cast<int>(frameW), static_cast<int>(frameH), static_cast<int>(frameW), static_cast<int>(frameH),
+                           0, SEP_NOISE_NONE, 1.0, 0
+                          };
+        int status = 0;
+        {
+            StageTimer timer(m_StageTimes.background);
+            // The first of the extractions that share a background makes the map, the others wait for it
+            QMutexLocker sharedLocker(m_SharedBackground ? &m_SharedBackground->m_Mutex : nullptr);
+            SharedBackground *shared = m_SharedBackground.data();
+            const bool followLevel = shared && shared->m_LevelShift > 0;
+            const float level = followLevel ? sampledLevel(frameData, frameW, frameH) : 0;
+            // The map is made again after it was used refreshFrames times, or for a sky that moved too far from the one it was made from
+            if (shared && shared->m_Map && shared->m_Map->w == static_cast<int>(frameW) && shared->m_Map->h == static_cast<int>(frameH)
+                    && (shared->m_RefreshFrames <= 0 || shared->m_Uses < shared->m_RefreshFrames)
+                    && (!followLevel || std::fabs(level - shared->m_Level) <= shared->m_LevelShift * shared->m_Map->globalrms))
+            {
+                shared->m_Uses++;
+                sharedMap = shared->m_Map;
+                // A sky that moved less than that is followed by moving the whole map to its level
+                if (followLevel && level != shared->m_Level)
+                {
+                    sep_bkg *shifted = shiftedBackground(sharedMap.get(), level - shared->m_Level);
+                    if (shifted)
+                        sharedMap.reset(shifted, sep_bkg_free);
+                }
+            }
+            else
+            {
+                status = sep_background_sampled(&frame, 64, 64, 3, 3, 0.0, m_ActiveParameters.backgroundSampling,
+                                                m_PartitionThreads, &globalBackground);
+                if (status == 0 && shared)
+                {
+                    sharedMap.reset(globalBackground, sep_bkg_free);
+                    globalBackground = nullptr;
+                    shared->m_Map = sharedMap;
+                    shared->m_Uses = 1;
+                    shared->m_Level = level;
+                }
+            }
+            sharedLocker.unlock();
+            if (status == 0)
+                status = sep_bkg_subarray_mt(sharedMap ? sharedMap.get() : globalBackground, frameData, SEP_TFLOAT, m_PartitionThreads);
+        }
+        if (status != 0)
         {
-            W_PARTITION_SIZE = w / (m_PartitionThreads / 2);
-            H_PARTITION_SIZE = h / 2;
+            char errorMessage[512];
+            sep_get_errmsg(status, errorMessage);
+            emit logOutput(errorMessage);
+            sep_bkg_free(globalBackground);
+            globalBackground = nullptr;
+            return -1;
         }
+    }
+    const sep_bkg *frameBackground = sharedMap ? sharedMap.get() : globalBackground;
 
-        int horizontalPartitions = w / W_PARTITION_SIZE;
-        int verticalPartitions = h / H_PARTITION_SIZE;
-        int horizontalOffset = w - (W_PARTITION_SIZE * horizontalPartitions);
-        int verticalOffset = h - (H_PARTITION_SIZE * verticalPartitions);
+    if (numPartitions > 1)
+    {
+        // Partition the image to regions.
+        // If there is extra at the end, we add an offset.
+        // e.g. 500x400 image split into 2 x 2 paritions sized 250x200 would have
+        // #1 0, 0, 250, 200 (250 x 200)
+        // #2 250, 0, 250, 200 (250 x 200)
+        // #3 0, 200, 250, 200 (250 x 200)
+        // #4 250, 200, 250, 200 (250 x 200)
+        // and a 501 pixel wide image would give the last column the extra pixel.
+        if (m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Extracting in %1 x %2 partitions on %3 threads").arg(horizontalPartitions).arg(verticalPartitions).arg(m_PartitionThreads));
+
+        const uint32_t W_PARTITION_SIZE = w / horizontalPartitions;
+        const uint32_t H_PARTITION_SIZE = h / verticalPartitions;
+        const uint32_t horizontalOffset = w - (W_PARTITION_SIZE * horizontalPartitions);
+        const uint32_t verticalOffset = h - (H_PARTITION_SIZE * verticalPartitions);
+
+        // With globalKeep, each partition can keep up to initialKeep stars, and the selector makes sure that only the
+        // initialKeep biggest of the whole frame get photometry.  Otherwise initialKeep is split evenly between the partitions.
+        uint32_t partitionKeep = std::max(1u, static_cast<uint32_t>(m_ActiveParameters.initialKeep) / numPartitions);
+        if (m_ActiveParameters.globalKeep)
+        {
+            selector.reset(new StarSelector(static_cast<uint32_t>(m_ActiveParameters.initialKeep)));
+            partitionKeep = selector->keep();
+        }
 
-        for (int i = 0; i < verticalPartitions; i++)
+        // A progressive extraction does as many partitions at a time as there are threads.  Each wave takes every waves-th partition,
+        // so even the first one has stars from all over the image, which is what the solver needs for its quads.
+        const uint32_t waveSize = std::max(1u, static_cast<uint32_t>(m_PartitionThreads));
+        const uint32_t waves = progressive ? (numPartitions + waveSize - 1) / waveSize : 1;
+        std::vector<uint32_t> order;
+        order.reserve(numPartitions);
+        for (uint32_t first = 0; first < waves; first++)
+            for (uint32_t partition = first; partition < numPartitions; partition += waves)
+                order.push_back(partition);
+
+        // There can be more partitions than threads.  QtConcurrent queues them on the thread pool, so each thread takes the next
+        // partition when it is done, and one slow partition doesn't hold up the ones that would have come after it on its thread.
+        for (uint32_t n = 0; n < numPartitions; n++)
         {
-            for (int j = 0; j < horizontalPartitions; j++)
+            if (progressive && n > 0 && n % waveSize == 0)
+            {
+                collectPartitions();
+                if (!waitForStarDemand())
+                {
+                    if (m_SSLogLevel != LOG_OFF)
+                        emit logOutput(QString("The solve was over after %1 of the %2 partitions were extracted").arg(n).arg(numPartitions));
+                    break;
+                }
+            }
             {
-                int offsetW = (j == horizontalPartitions - 1) ? horizontalOffset : 0;
-                int offsetH = (i == verticalPartitions - 1) ? verticalOffset : 0;
+                const uint32_t i = order[n] / horizontalPartitions, j = order[n] % horizontalPartitions;
+                uint32_t offsetW = (j == horizontalPartitions - 1) ? horizontalOffset : 0;
+                uint32_t offsetH = (i == verticalPartitions - 1) ? verticalOffset : 0;
 
                 const uint32_t rawStartX = x + j * W_PARTITION_SIZE;
                 const uint32_t rawStartY = y + i * H_PARTITION_SIZE;
@@ -376,35 +1139,58 @@ int InternalExtractorSolver::runSEPExtractor()
 
                 uint32_t startX, startY, subWidth, subHeight;
                 computeMargin(rawStartX, rawStartY, rawEndX - 1, rawEndY - 1,
-                              m_Statistics.width, m_Statistics.height, DEFAULT_MARGIN,
+                              imageWidth, imageHeight, DEFAULT_MARGIN,
                               &startX, &startY, &subWidth, &subHeight);
 
                 startupOffsets.append(StartupOffset(startX, startY, subWidth, subHeight,
                                                     rawStartX, rawStartY, rawEndX - 1, rawEndY - 1));
 
-                auto *data = new float[subWidth * subHeight];
-                if (allocateDataBuffer(data, startX, startY, subWidth, subHeight) == false)
+                float *data = nullptr;
+                uint32_t dataWidth = subWidth, dataHeight = subHeight;
+                if (frameData)
                 {
-                    for (auto *buffer : dataBuffers)
-                        delete [] buffer;
-                    emit logOutput("Failed to allocate memory.");
-                    return -1;
+                    // The partition is inside the global frame since they have the same margin, so SEP reads it in place with the frame's row stride
+                    data = frameData + static_cast<size_t>(startY - frameY) * frameW + (startX - frameX);
+                    dataWidth = frameW;
+                    dataHeight = frameH - (startY - frameY);
+                }
+                else
+                {
+                    data = new float[static_cast<size_t>(subWidth) * subHeight];
+                    if (allocateDataBuffer(data, startX, startY, subWidth, subHeight) == false)
+                    {
+                        // The partitions that were started write into the buffers and the slots of this extraction
+                        for (auto &oneFuture : futures)
+                            oneFuture.waitForFinished();
+                        futures.clear();
+                        delete [] data;
+                        for (auto *buffer : dataBuffers)
+                            delete [] buffer;
+                        emit logOutput("Failed to allocate memory.");
+                        return -1;
+                    }
+                    dataBuffers.append(data);
                 }
-                dataBuffers.append(data);
-                FITSImage::Background tempBackground;
-                backgrounds.append(tempBackground);
-
                 ImageParams parameters = {data,
-                                          subWidth,
-                                          subHeight,
+                                          dataWidth,
+                                          dataHeight,
                                           0,
                                           0,
                                           subWidth,
                                           subHeight,
-                                          m_ActiveParameters.initialKeep / m_PartitionThreads,
-                                          &backgrounds[backgrounds.size() - 1]
+                                          partitionKeep,
+                                          &backgrounds[launched],
+                                          1, // The partitions already run in parallel
+                                          frameBackground,
+                                          selector.get(),
+                                          rawStartX - startX,
+                                          rawStartY - startY,
+                                          rawEndX - 1 - startX,
+                                          rawEndY - 1 - startY,
+                                          deblendLimits.get(),
+                                          summaries.empty() ? nullptr : &summaries[i * horizontalPartitions + j]
                                          };
-                futures.append(QtConcurrent::run(this, &InternalExtractorSolver::extractPartition, parameters));
+                startPartition(parameters, startupOffsets.last());
             }
         }
     }
@@ -413,82 +1199,355 @@ int InternalExtractorSolver::runSEPExtractor()
         // In this case, there is no partitioning, but it is still possible that margins apply.
         // E.g. a subframe rectangle with enough space around it to have margins.
         uint32_t startX, startY, subWidth, subHeight;
-        computeMargin(x, y, x + w - 1, y + h - 1, m_Statistics.width, m_Statistics.height, DEFAULT_MARGIN,
+        computeMargin(x, y, x + w - 1, y + h - 1, imageWidth, imageHeight, DEFAULT_MARGIN,
                       &startX, &startY, &subWidth, &subHeight);
 
-        auto *data = new float[subWidth * subHeight];
-        if (allocateDataBuffer(data, startX, startY, subWidth, subHeight) == false)
+        // There is only one buffer, so it can be the pooled one.  A prepared frame is only used by this partition, so SEP can work on it in place.
+        float *data = nullptr;
+        uint32_t dataWidth = subWidth, dataHeight = subHeight;
+        if (frameData)
         {
-            for (auto *buffer : dataBuffers)
-                delete [] buffer;
-            emit logOutput("Failed to allocate memory.");
-            return -1;
+            // The frame of the shared background has the same margins as this partition
+            data = frameData;
+            dataWidth = frameW;
+            dataHeight = frameH;
+        }
+        else if (m_PreparedFrame)
+        {
+            data = m_PreparedFrame + static_cast<size_t>(startY) * raw_w + startX;
+            dataWidth = raw_w;
+            dataHeight = raw_h - startY;
+        }
+        else
+        {
+            data = floatBuffer(static_cast<size_t>(subWidth) * subHeight);
+            if (allocateDataBuffer(data, startX, startY, subWidth, subHeight) == false)
+            {
+                emit logOutput("Failed to allocate memory.");
+                return -1;
+            }
         }
-        dataBuffers.append(data);
         startupOffsets.append(StartupOffset(startX, startY, subWidth, subHeight, x, y, x + w - 1, y + h - 1));
-        FITSImage::Background tempBackground;
-        backgrounds.append(tempBackground);
 
-        ImageParams parameters = {data, subWidth, subHeight, 0, 0, subWidth, subHeight, static_cast<uint32_t>(m_ActiveParameters.initialKeep), &backgrounds[backgrounds.size() - 1]};
-        futures.append(QtConcurrent::run(this, &InternalExtractorSolver::extractPartition, parameters));
+        ImageParams parameters = {data, dataWidth, dataHeight, 0, 0, subWidth, subHeight, static_cast<uint32_t>(m_ActiveParameters.initialKeep), &backgrounds[0], static_cast<int>(m_PartitionThreads), frameBackground, nullptr,
+                                  x - startX, y - startY, x + w - 1 - startX, y + h - 1 - startY, deblendLimits.get(),
+                                  summaries.empty() ? nullptr : &summaries[0]
+                                 };
+        startPartition(parameters, startupOffsets.last());
     }
 
-    for (auto &oneFuture : futures)
+    if (slotted)
     {
-        oneFuture.waitForFinished();
-        QList<FITSImage::Star> partitionStars = oneFuture.result();
-        QList<FITSImage::Star> acceptedStars;
-        if (!startupOffsets.empty())
-        {
-            const StartupOffset oneOffset = startupOffsets.takeFirst();
-            const int startX = oneOffset.startX;
-            const int startY = oneOffset.startY;
-            for (auto &oneStar : partitionStars)
-            {
-                // Don't use stars from the margins (they're detected in other partitions).
-                if (oneStar.x < (oneOffset.innerStartX - startX) ||
-                        oneStar.y < (oneOffset.innerStartY - startY) ||
-                        oneStar.x > (oneOffset.innerEndX   - startX) ||
-                        oneStar.y > (oneOffset.innerEndY   - startY))
-                    continue;
-                oneStar.x += startX;
-                oneStar.y += startY;
-                acceptedStars.append(oneStar);
-            }
-        }
-        m_ExtractedStars.append(acceptedStars);
+        for (auto &oneFuture : futures)
+            oneFuture.waitForFinished();
+        m_ExtractedStars = merger.mergePartitions();
+    }
+    else
+    {
+        collectPartitions();
+        m_ExtractedStars = merger.stars();
+    }
+    if (binning > 1)
+    {
+        for (auto &oneStar : m_ExtractedStars)
+            toFullResolution(oneStar, binning);
     }
 
+    if (selector)
+        keepBiggestStars(m_ExtractedStars, selector->keep());
+
     double sumGlobal = 0, sumRmsSq = 0;
-    for (const auto &bg : qAsConst(backgrounds))
+    for (uint32_t i = 0; i < launched; i++)
     {
-        sumGlobal += bg.global;
-        sumRmsSq += bg.globalrms * bg.globalrms;
+        sumGlobal += backgrounds[i].global;
+        sumRmsSq += backgrounds[i].globalrms * backgrounds[i].globalrms;
     }
-    if (!backgrounds.empty())
+    if (launched > 0)
     {
         m_Background.bw = backgrounds[0].bw;
         m_Background.bh = backgrounds[0].bh;
     }
     m_Background.num_stars_detected = m_ExtractedStars.size();
-    m_Background.global = sumGlobal / backgrounds.size();
-    m_Background.globalrms = sqrt( sumRmsSq / backgrounds.size() );
+    m_Background.global = sumGlobal / launched;
+    m_Background.globalrms = sqrt( sumRmsSq / launched );
+    if (!summaries.empty())
+    {
+        StarSummary summary;
+        for (const StarSummary &partitionSummary : summaries)
+            summary.merge(partitionSummary);
+        m_Background.num_stars_detected = summary.count();
+        m_ImageQuality = summary.quality(m_Background);
+        m_HasImageQuality = true;
+    }
 
+    m_StageTimes.deblend += deblendLimits->spent.load();
+    m_Metrics.extractionTimedOut = deblendLimits->expired.load();
+    if ((limitsDeblending(m_ProcessType, m_ActiveParameters) || deblendLimits->nsaturated > 0 || deblendLimits->expired)
+            && m_SSLogLevel != LOG_OFF)
+        logDeblending(*deblendLimits);
+
+    if (m_DetectionBinning > 1)
+        measureAtFullResolution(m_ExtractedStars, deblendLimits.get());
     applyStarFilters(m_ExtractedStars);
+    if (m_StreamPartitionStars)
+        emit partitionStarsComplete(m_ExtractedStars);
 
     for (auto * buffer : dataBuffers)
         delete [] buffer;
     dataBuffers.clear();
     futures.clear();
+    sep_bkg_free(globalBackground);
+    globalBackground = nullptr;
 
     m_HasExtracted = true;
 
     return 0;
 }
 
+// This extracts the stars of an image that is read with the row reader, one band of rows after the other.  Each band is a partition
+// with margins, like in runSEPExtractor, but only the rows of one band and its margins are read and converted to float at a time,
+// so neither the image nor the float frame of the whole image are ever in memory.  The bands share the stars to keep like with globalKeep.
+int InternalExtractorSolver::runStreamingExtractor()
+{
+    QMutexLocker locker(&futuresMutex);
+    if(convFilter.size() == 0)
+    {
+        emit logOutput("No convFilter included.");
+        return -1;
+    }
+
+    emit logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
+    emit logOutput("Starting Internal StellarSolver Star Extractor with the " + m_ActiveParameters.listName + " profile on a streamed image . . .");
+
+    uint32_t x = 0, y = 0;
+    uint32_t w = m_Statistics.width, h = m_Statistics.height;
+    if(m_UseSubframe && m_SubFrameRect.isValid())
+    {
+        x = std::max(0, m_SubFrameRect.x());
+        w = std::min(static_cast<int>(m_Statistics.width), m_SubFrameRect.width());
+        y = std::max(0, m_SubFrameRect.y());
+        h = std::min(static_cast<int>(m_Statistics.height), m_SubFrameRect.height());
+    }
+    m_ExtractionArea = static_cast<double>(w) * h;
+
+    const uint32_t margin = partitionMargin(m_ActiveParameters.maxSize);
+    const uint32_t bandRows = std::max(1u, m_StreamBandRows);
+    StarSelector selector(static_cast<uint32_t>(m_ActiveParameters.initialKeep));
+    std::unique_ptr<sep_deblend_limits> deblendLimits = createDeblendLimits(m_ProcessType, m_ActiveParameters, detectionSaturation());
+
+    if (m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Extracting in bands of %1 rows on %2 threads").arg(bandRows).arg(m_PartitionThreads));
+
+    double sumGlobal = 0, sumRmsSq = 0;
+    int numBands = 0;
+    StarSummary summary;
+    StarMerger merger(QRect(x, y, w, h));
+    for (uint32_t bandY = y; bandY < y + h; bandY += bandRows)
+    {
+        if (m_CancelToken->load())
+            return -1;
+
+        const uint32_t bandEnd = std::min(y + h, bandY + bandRows);
+        uint32_t startX, startY, subWidth, subHeight;
+        computeMargin(x, bandY, x + w - 1, bandEnd - 1, m_Statistics.width, m_Statistics.height, margin,
+                      &startX, &startY, &subWidth, &subHeight);
+
+        // The pooled buffer only ever needs to hold one band
+        float *data = floatBuffer(static_cast<size_t>(subWidth) * subHeight);
+        if (readDataBuffer(data, startX, startY, subWidth, subHeight) == false)
+        {
+            emit logOutput(QString("Failed to read the rows %1 to %2 of the image.").arg(startY).arg(startY + subHeight - 1));
+            return -1;
+        }
+
+        FITSImage::Background bandBackground = {};
+        ImageParams parameters = {data, subWidth, subHeight, 0, 0, subWidth, subHeight, selector.keep(), &bandBackground,
+                                  static_cast<int>(m_PartitionThreads), nullptr, &selector,
+                                  x - startX, bandY - startY, x + w - 1 - startX, bandEnd - 1 - startY, deblendLimits.get(),
+                                  m_SummaryOnly ? &summary : nullptr
+                                 };
+        const QList<FITSImage::Star> bandStars = extractPartition(parameters);
+        // Don't use stars from the margins (they're detected in the other bands).
+        const QList<FITSImage::Star> acceptedStars = merger.addPartition(bandStars, startX, startY, QRect(x, bandY, w, bandEnd - bandY),
+                QRect(startX, startY, subWidth, subHeight));
+        streamStars(acceptedStars, numBands, (h + bandRows - 1) / bandRows);
+        publishStars(acceptedStars);
+
+        if (numBands == 0)
+        {
+            m_Background.bw = bandBackground.bw;
+            m_Background.bh = bandBackground.bh;
+        }
+        sumGlobal += bandBackground.global;
+        sumRmsSq += bandBackground.globalrms * bandBackground.globalrms;
+        numBands++;
+    }
+
+    m_ExtractedStars = merger.stars();
+    keepBiggestStars(m_ExtractedStars, selector.keep());
+
+    m_Background.num_stars_detected = m_ExtractedStars.size();
+    if (numBands > 0)
+    {
+        m_Background.global = sumGlobal / numBands;
+        m_Background.globalrms = sqrt(sumRmsSq / numBands);
+    }
+    if (m_SummaryOnly)
+    {
+        m_Background.num_stars_detected = summary.count();
+        m_ImageQuality = summary.quality(m_Background);
+        m_HasImageQuality = true;
+    }
+
+    m_StageTimes.deblend += deblendLimits->spent.load();
+    m_Metrics.extractionTimedOut = deblendLimits->expired.load();
+    if ((limitsDeblending(m_ProcessType, m_ActiveParameters) || deblendLimits->nsaturated > 0 || deblendLimits->expired)
+            && m_SSLogLevel != LOG_OFF)
+        logDeblending(*deblendLimits);
+
+    applyStarFilters(m_ExtractedStars);
+    if (m_StreamPartitionStars)
+        emit partitionStarsComplete(m_ExtractedStars);
+
+    m_HasExtracted = true;
+
+    return 0;
+}
+
+// This extracts the stars of several small regions of an image, like the guide stars or the stars a focuser watches, in one pass.
+// Each region is a partition with margins, like in runSEPExtractor, so only its pixels and its margins are converted to float and it
+// gets the background around it.  They are all queued on the thread pool at once, instead of one extraction with its setup after the other.
+int InternalExtractorSolver::runRegionExtractor()
+{
+    QMutexLocker locker(&futuresMutex);
+    if(convFilter.size() == 0)
+    {
+        emit logOutput("No convFilter included.");
+        return -1;
+    }
+
+    emit logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
+    emit logOutput(QString("Starting Internal StellarSolver Star Extractor with the %1 profile on %2 regions . . .").arg(
+                       m_ActiveParameters.listName).arg(m_Regions.count()));
+    //The channels are merged once for all of the regions, a streamed image merges them while its rows are read
+    const bool mergeChannels = m_Statistics.channels == 3 && (m_ColorChannel == FITSImage::AVERAGE_RGB || m_ColorChannel == FITSImage::INTEGRATED_RGB);
+    if(mergeChannels && !m_RowReader && m_PreparedFrame == nullptr && prepareFrame(1) == false)
+    {
+        emit logOutput("Merging image channels failed.");
+        return -1;
+    }
+
+    struct Region
+    {
+        QRect inner;
+        uint32_t startX = 0, startY = 0, width = 0, height = 0;
+        std::vector<float> data;
+        FITSImage::Background background;
+        int future = -1;
+    };
+    const QRect image(0, 0, m_Statistics.width, m_Statistics.height);
+    const uint32_t margin = partitionMargin(m_ActiveParameters.maxSize);
+    m_ExtractionArea = 0;
+    std::unique_ptr<sep_deblend_limits> deblendLimits = createDeblendLimits(m_ProcessType, m_ActiveParameters, detectionSaturation());
+    // The regions don't move once the backgrounds of the partitions point into them
+    std::vector<Region> regions(m_Regions.size());
+    QList<QFuture<QList<FITSImage::Star>>> futures;
+    for (size_t i = 0; i < regions.size(); i++)
+    {
+        Region &region = regions[i];
+        region.inner = m_Regions.at(static_cast<int>(i)).intersected(image);
+        if (region.inner.isEmpty())
+            continue;
+        computeMargin(region.inner.left(), region.inner.top(), region.inner.right(), region.inner.bottom(), image.width(), image.height(),
+                      margin, &region.startX, &region.startY, &region.width, &region.height);
+        region.data.resize(static_cast<size_t>(region.width) * region.height);
+        const bool converted = m_RowReader ? readDataBuffer(region.data.data(), region.startX, region.startY, region.width, region.height)
+                               : allocateDataBuffer(region.data.data(), region.startX, region.startY, region.width, region.height);
+        if (converted == false)
+        {
+            for (auto &future : futures)
+                future.waitForFinished();
+            emit logOutput("Failed to allocate memory.");
+            return -1;
+        }
+        ImageParams parameters = {region.data.data(), region.width, region.height, 0, 0, region.width, region.height,
+                                  static_cast<uint32_t>(m_ActiveParameters.initialKeep), &region.background, 1, nullptr, nullptr,
+                                  region.inner.left() - region.startX, region.inner.top() - region.startY,
+                                  region.inner.right() - region.startX, region.inner.bottom() - region.startY, deblendLimits.get(), nullptr
+                                 };
+        region.future = futures.size();
+        futures.append(runPartition(parameters));
+    }
+
+    double sumGlobal = 0, sumRmsSq = 0;
+    int numRegions = 0;
+    m_ExtractedStars.clear();
+    for (Region &region : regions)
+    {
+        QList<FITSImage::Star> regionStars;
+        if (region.future >= 0)
+        {
+            // Don't use the stars in the margins, they belong to the pixels around the region
+            StarMerger merger(region.inner);
+            merger.addPartition(futures[region.future].result(), region.startX, region.startY, region.inner,
+                                QRect(region.startX, region.startY, region.width, region.height));
+            regionStars = merger.stars();
+            applyStarFilters(regionStars);
+            if (numRegions == 0)
+            {
+                m_Background.bw = region.background.bw;
+                m_Background.bh = region.background.bh;
+            }
+            sumGlobal += region.background.global;
+            sumRmsSq += region.background.globalrms * region.background.globalrms;
+            numRegions++;
+        }
+        m_ExtractedStars.append(regionStars);
+        m_RegionStars.append(regionStars);
+    }
+    futures.clear();
+
+    m_Background.num_stars_detected = m_ExtractedStars.size();
+    if (numRegions > 0)
+    {
+        m_Background.global = sumGlobal / numRegions;
+        m_Background.globalrms = sqrt(sumRmsSq / numRegions);
+    }
+    m_StageTimes.deblend += deblendLimits->spent.load();
+    m_Metrics.extractionTimedOut = deblendLimits->expired.load();
+    if ((limitsDeblending(m_ProcessType, m_ActiveParameters) || deblendLimits->nsaturated > 0 || deblendLimits->expired)
+            && m_SSLogLevel != LOG_OFF)
+        logDeblending(*deblendLimits);
+
+    m_HasExtracted = true;
+
+    return 0;
+}
+
+QFuture<QList<FITSImage::Star>> InternalExtractorSolver::runPartition(const ImageParams &parameters,
+        const std::function<void(const QList<FITSImage::Star> &)> &collect)
+{
+    auto run = [this, parameters, collect]()
+    {
+        if(!collect)
+            return extractPartition(parameters);
+        collect(extractPartition(parameters));
+        return QList<FITSImage::Star>();
+    };
+    if(threadPool)
+        return threadPool->run(run, urgency);
+    return QtConcurrent::run(run);
+}
+
 QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImageParams &parameters)
 {
-    float *imback = nullptr;
+    Tracer::Span span("extractPartition");
+    PerfCounters::Scope counters(m_ExtractionCounters, m_CountHardwareEvents);
+    // SEP's temporaries and the catalog come from this thread's arena, which is kept for the next image.
+    // It is reset when this goes out of scope, after cleanup has run and the stars were copied out of the catalog.
+    ArenaScope arenaScope;
+    // The background, filter, extraction and photometry threads of SEP only take the free slots of the pool
+    RunnerScope runnerScope(poolRunner());
     double *fluxerr = nullptr, *area = nullptr;
     short *flag = nullptr;
     int status = 0;
@@ -497,14 +1556,16 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
     QList<FITSImage::Star> partitionStars;
     const uint32_t maxRadius = 50;
 
+    // A partition that starts after the time limit has nothing to add in time
+    if (sep_limits_expired(parameters.deblendLimits))
+        return partitionStars;
+
     auto cleanup = [ & ]()
     {
         sep_bkg_free(bkg);
         bkg = nullptr;
         Extract::sep_catalog_free(catalog);
         catalog = nullptr;
-        free(imback);
-        imback = nullptr;
         free(fluxerr);
         fluxerr = nullptr;
         free(area);
@@ -522,8 +1583,6 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
 
     //These are for the HFR
     double requested_frac[2] = { 0.5, 0.99 };
-    double flux_fractions[2] = {0};
-    short flux_flag = 0;
     std::vector<std::pair<int, double>> ovals;
     int numToProcess = 0;
 
@@ -546,54 +1605,104 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
                     0
                    };
 
-    // #1 Background estimate
-    status = sep_background(&im, 64, 64, 3, 3, 0.0, &bkg);
-    if (status != 0)
+    // The shared background was already subtracted from the data for the whole frame
+    const sep_bkg *background = parameters.sharedBackground;
+    if (!background)
     {
-        cleanup();
-        return partitionStars;
-    }
+        StageTimer timer(m_StageTimes.background);
+        // #1 Background estimate
+        status = sep_background_sampled(&im, 64, 64, 3, 3, 0.0, m_ActiveParameters.backgroundSampling, parameters.threads, &bkg);
+        if (status != 0)
+        {
+            cleanup();
+            return partitionStars;
+        }
 
-    // #2 Background evaluation
-    imback = (float *)malloc((parameters.subW * parameters.subH) * sizeof(float));
-    status = sep_bkg_array(bkg, imback, SEP_TFLOAT);
-    if (status != 0)
-    {
-        cleanup();
-        return partitionStars;
+        // #2 Background subtraction, this evaluates the background one line at a time and subtracts it in place
+        status = sep_bkg_subarray_mt(bkg, im.data, im.dtype, parameters.threads);
+        if (status != 0)
+        {
+            cleanup();
+            return partitionStars;
+        }
+        background = bkg;
     }
 
     //Saving some background information
-    parameters.background->bh = bkg->bh;
-    parameters.background->bw = bkg->bw;
-    parameters.background->global = bkg->global;
-    parameters.background->globalrms = bkg->globalrms;
-
-    // #3 Background subtraction
-    status = sep_bkg_subarray(bkg, im.data, im.dtype);
-    if (status != 0)
-    {
-        cleanup();
-        return partitionStars;
-    }
+    parameters.background->bh = background->bh;
+    parameters.background->bw = background->bw;
+    parameters.background->global = background->global;
+    parameters.background->globalrms = background->globalrms;
 
     std::unique_ptr<Extract> extractor;
     extractor.reset(new Extract());
-    // #4 Source Extraction
+    extractor->sep_set_deblend_limits(parameters.deblendLimits);
+    // The objects are deblended on the free slots of the pool while the partition is scanned, or on its own thread if there are none
+    if (threadPool && threadPool->maxThreads() > 1 && m_ActiveParameters.deblend_contrast < 1)
+        extractor->sep_set_deblend_threads(threadPool->maxThreads(), poolRunner());
+    // #3 Source Extraction
     // Note that we set deblend_cont = 1.0 to turn off deblending.
-    const double extractionThreshold = m_ActiveParameters.threshold_bg_multiple * bkg->globalrms +
+    const double extractionThreshold = m_ActiveParameters.threshold_bg_multiple * background->globalrms +
                                        m_ActiveParameters.threshold_offset;
     //fprintf(stderr, "Using %.1f =  %.1f * %.1f + %.1f\n", extractionThreshold, m_ActiveParameters.threshold_bg_multiple, bkg->globalrms,  m_ActiveParameters.threshold_offset);
-    status = extractor->sep_extract(&im, extractionThreshold, SEP_THRESH_ABS, m_ActiveParameters.minarea,
-                                    convFilter.data(),
-                                    sqrt(convFilter.size()), sqrt(convFilter.size()), SEP_FILTER_CONV,
-                                    m_ActiveParameters.deblend_thresh,
-                                    m_ActiveParameters.deblend_contrast, m_ActiveParameters.clean, m_ActiveParameters.clean_param, &catalog);
+    // With more than one thread for this partition, the detection is split into strips that are labeled at the same time
+    QElapsedTimer stageTimer;
+    stageTimer.start();
+    // The image can be convolved on the GPU, then the detection reads the lines of the filtered image instead of convolving them
+    std::vector<float> filtered;
+    bool convolved = false;
+    if (m_ActiveParameters.useGPU && OpenCLFilter::instance().isAvailable())
+    {
+        const int convSize = sqrt(convFilter.size());
+        filtered.resize(static_cast<size_t>(im.w) * im.h);
+        if (OpenCLFilter::instance().convolve(static_cast<const float *>(im.data), im.raw_w, im.w, im.h, convFilter.data(), convSize,
+                                              convSize, filtered.data()))
+        {
+            extractor->sep_set_filtered_image(filtered.data(), im.w);
+            convolved = true;
+        }
+    }
+    // The threshold ladder detects the stars again at lower thresholds from the same image, so it is convolved once up front
+    const int convSize = sqrt(convFilter.size());
+    const double partitionArea = (static_cast<double>(parameters.innerX2) - parameters.innerX1 + 1) *
+                                 (static_cast<double>(parameters.innerY2) - parameters.innerY1 + 1);
+    const int ladderTarget = m_ActiveParameters.thresholdLadderStars > 0 && m_ExtractionArea > 0 ?
+                             static_cast<int>(ceil(m_ActiveParameters.thresholdLadderStars * std::min(1.0, partitionArea / m_ExtractionArea))) : 0;
+    if (ladderTarget > 0 && m_ActiveParameters.thresholdLadderSteps > 0 && !convolved)
+    {
+        filtered.resize(static_cast<size_t>(im.w) * im.h);
+        if (Extract::sep_filter_image(&im, convFilter.data(), convSize, convSize, filtered.data(), parameters.threads) == 0)
+            extractor->sep_set_filtered_image(filtered.data(), im.w);
+    }
+    double thresholdMultiple = m_ActiveParameters.threshold_bg_multiple;
+    status = extractor->sep_extract_mt(&im, extractionThreshold, SEP_THRESH_ABS, m_ActiveParameters.minarea,
+                                       convFilter.data(),
+                                       sqrt(convFilter.size()), sqrt(convFilter.size()), SEP_FILTER_CONV,
+                                       m_ActiveParameters.deblend_thresh,
+                                       m_ActiveParameters.deblend_contrast, m_ActiveParameters.clean, m_ActiveParameters.clean_param,
+                                       parameters.threads, &catalog);
+    for (int step = 0; status == 0 && step < m_ActiveParameters.thresholdLadderSteps && catalog->nobj < ladderTarget
+            && !sep_limits_expired(parameters.deblendLimits); step++)
+    {
+        thresholdMultiple *= m_ActiveParameters.thresholdLadderFactor;
+        Extract::sep_catalog_free(catalog);
+        catalog = nullptr;
+        status = extractor->sep_extract_mt(&im, thresholdMultiple * background->globalrms + m_ActiveParameters.threshold_offset,
+                                           SEP_THRESH_ABS, m_ActiveParameters.minarea, convFilter.data(), convSize, convSize,
+                                           SEP_FILTER_CONV, m_ActiveParameters.deblend_thresh, m_ActiveParameters.deblend_contrast,
+                                           m_ActiveParameters.clean, m_ActiveParameters.clean_param, parameters.threads, &catalog);
+    }
+    if (thresholdMultiple != m_ActiveParameters.threshold_bg_multiple && m_SSLogLevel == LOG_VERBOSE)
+        emit logOutput(QString("A partition lowered its threshold to %1 times the background RMS for %2 stars")
+                       .arg(thresholdMultiple, 0, 'f', 2).arg(status == 0 ? catalog->nobj : 0));
+    m_StageTimes.detection += stageTimer.nsecsElapsed();
     if (status != 0)
     {
         cleanup();
         return partitionStars;
     }
+    // The photometry is the rest of the partition, from picking the stars to measure to the list of stars
+    StageTimer photometryTimer(m_StageTimes.photometry);
 
     // Record the number of stars detected.
     parameters.background->num_stars_detected = catalog->nobj;
@@ -602,63 +1711,97 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
     // correlates very well with HFR and likely magnitude.
     for (int i = 0; i < catalog->nobj; i++)
     {
-        const double ovalSizeSq = catalog->a[i] * catalog->a[i] + catalog->b[i] * catalog->b[i];
-        ovals.push_back(std::pair<int, double>(i, ovalSizeSq));
+        // The saturation filter would throw these away, so they don't need photometry or a place among the stars that are kept
+        if (catalog->flag[i] & SEP_OBJ_SATUR)
+            continue;
+        if (parameters.selector)
+        {
+            // Only the stars this partition will really return can compete with the other partitions,
+            // so the ones that go over the boundary or are in the margins are left out here.
+            const float x = catalog->x[i] + 1;
+            const float y = catalog->y[i] + 1;
+            if ((catalog->flag[i] & SEP_OBJ_TRUNC) ||
+                    !StarMerger::owns(x, y, parameters.innerX1, parameters.innerY1, parameters.innerX2, parameters.innerY2))
+                continue;
+        }
+        ovals.push_back(std::pair<int, double>(i, ovalSize(catalog->a[i], catalog->b[i])));
     }
-    if(catalog->nobj > 0)
-        std::sort(ovals.begin(), ovals.end(), [](const std::pair<int, double> &o1, const std::pair<int, double> &o2) -> bool { return o1.second > o2.second;});
 
-    numToProcess = std::min(static_cast<uint32_t>(catalog->nobj), parameters.keep);
+    // Only the detections that will be processed need to be sorted
+    numToProcess = std::min(static_cast<uint32_t>(ovals.size()), parameters.keep);
+    std::vector<double> sizes(ovals.size());
+    for (size_t k = 0; k < ovals.size(); k++)
+        sizes[k] = ovals[k].second;
+    const std::vector<int> bySize = StarSort::order(sizes.data(), static_cast<int>(sizes.size()), true, numToProcess);
+
+    // Pick the detections to measure first, so that the photometry can be done for all of them at once.
+    std::vector<int> picked;
+    picked.reserve(numToProcess);
     for (int index = 0; index < numToProcess; index++)
     {
         // Processing detections in the order of the sort above.
-        int i = ovals[index].first;
+        int i = ovals[bySize[index]].first;
+
+        // The rest are even smaller, so if this one can't be kept, none of them can, and they don't need photometry.
+        if (parameters.selector && !parameters.selector->offer(ovals[bySize[index]].second))
+            break;
 
         if (catalog->flag[i] & SEP_OBJ_TRUNC)
         {
             // Don't accept detections that go over the boundary.
             continue;
         }
+        picked.push_back(i);
+    }
 
-        //Variables that are obtained from the catalog
-        //FOR SOME REASON, I FOUND THAT THE POSITIONS WERE OFF BY 1 PIXEL??
-        //This might be because of this: https://sextractor.readthedocs.io/en/latest/Param.html
-        //" Following the FITS convention, in SExtractor the center of the first image pixel has coordinates (1.0,1.0). "
-        float xPos = catalog->x[i] + 1;
-        float yPos = catalog->y[i] + 1;
-        float a = catalog->a[i];
-        float b = catalog->b[i];
-        float theta = catalog->theta[i];
-        float cxx = catalog->cxx[i];
-        float cyy = catalog->cxx[i];
-        float cxy = catalog->cxy[i];
-        double flux = catalog->flux[i];
-        double peak = catalog->peak[i];
-        int numPixels = catalog->npix[i];
-
-        //Variables that will be obtained through methods
-        double kronrad;
-        short kron_flag;
-        double sum = 0;
-        double sumerr;
-        double kron_area;
+    //Variables that are obtained from the catalog
+    //FOR SOME REASON, I FOUND THAT THE POSITIONS WERE OFF BY 1 PIXEL??
+    //This might be because of this: https://sextractor.readthedocs.io/en/latest/Param.html
+    //" Following the FITS convention, in SExtractor the center of the first image pixel has coordinates (1.0,1.0). "
+    const int numPicked = static_cast<int>(picked.size());
+    std::vector<double> xPos(numPicked), yPos(numPicked), a(numPicked), b(numPicked), theta(numPicked);
+    std::vector<double> cxx(numPicked), cyy(numPicked), cxy(numPicked);
+    for (int k = 0; k < numPicked; k++)
+    {
+        const int i = picked[k];
+        xPos[k] = static_cast<float>(catalog->x[i] + 1);
+        yPos[k] = static_cast<float>(catalog->y[i] + 1);
+        a[k] = catalog->a[i];
+        b[k] = catalog->b[i];
+        theta[k] = catalog->theta[i];
+        cxx[k] = catalog->cxx[i];
+        cyy[k] = catalog->cxx[i];
+        cxy[k] = catalog->cxy[i];
+    }
 
-        //This will need to be done for both auto and ellipse
-        if(m_ActiveParameters.apertureShape != SHAPE_CIRCLE)
-        {
-            //Constant values
-            //The instructions say to use a fixed value of 6: https://sep.readthedocs.io/en/v1.0.x/api/sep.kron_radius.html
-            //Finding the kron radius for the sextraction
+    //Variables that will be obtained through methods
+    std::vector<double> kronrad(numPicked, 0), sum(numPicked, 0), sumerr(numPicked), kron_area(numPicked);
+    std::vector<short> kron_flag(numPicked);
 
-            sep_kron_radius(&im, xPos, yPos, cxx, cyy, cxy, 6, 0, &kronrad, &kron_flag);
-        }
+    // The windowed centroids only need the positions, so the stars keep their isophotal fluxes instead of aperture photometry
+    const bool windowed = m_ActiveParameters.windowedCentroids;
 
+    //This will need to be done for both auto and ellipse
+    if(!windowed && m_ActiveParameters.apertureShape != SHAPE_CIRCLE)
+    {
+        //Constant values
+        //The instructions say to use a fixed value of 6: https://sep.readthedocs.io/en/v1.0.x/api/sep.kron_radius.html
+        //Finding the kron radius for the sextraction
+
+        sep_kron_radius_batch(&im, numPicked, xPos.data(), yPos.data(), cxx.data(), cyy.data(), cxy.data(), 6, nullptr,
+                              kronrad.data(), kron_flag.data(), parameters.threads);
+    }
+
+    // The stars that are measured with a circle, and the ones measured with an ellipse
+    std::vector<int> circles, ellipses;
+    for (int k = 0; k < numPicked && !windowed; k++)
+    {
         bool use_circle;
 
         switch(m_ActiveParameters.apertureShape)
         {
             case SHAPE_AUTO:
-                use_circle = kronrad * sqrt(a * b) < m_ActiveParameters.r_min;
+                use_circle = kronrad[k] * sqrt(static_cast<float>(a[k]) * static_cast<float>(b[k])) < m_ActiveParameters.r_min;
                 break;
 
             case SHAPE_CIRCLE:
@@ -666,48 +1809,164 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
                 break;
 
             case SHAPE_ELLIPSE:
+            default:
                 use_circle = false;
                 break;
 
         }
+        (use_circle ? circles : ellipses).push_back(k);
+    }
 
-        if(use_circle)
+    // This measures the stars in subset together and puts the results back with the other values of each star
+    auto measureApertures = [&](const std::vector<int> &subset, bool circle)
+    {
+        const int n = static_cast<int>(subset.size());
+        if (n == 0)
+            return;
+        std::vector<double> sx(n), sy(n), sa(n), sb(n), stheta(n), sr(n), ssum(n), ssumerr(n), sarea(n);
+        std::vector<short> sflag(n);
+        for (int k = 0; k < n; k++)
+        {
+            const int j = subset[k];
+            sx[k] = xPos[j];
+            sy[k] = yPos[j];
+            sa[k] = a[j];
+            sb[k] = b[j];
+            stheta[k] = theta[j];
+            sr[k] = circle ? m_ActiveParameters.r_min : m_ActiveParameters.kron_fact * kronrad[j];
+        }
+        if (circle)
         {
-            sep_sum_circle(&im, xPos, yPos, m_ActiveParameters.r_min, 0, m_ActiveParameters.subpix, m_ActiveParameters.inflags, &sum,
-                           &sumerr, &kron_area, &kron_flag);
+            sep_set_aper_mask_buckets(m_ActiveParameters.apertureMaskBuckets);
+            sep_sum_circle_batch(&im, n, sx.data(), sy.data(), sr.data(), nullptr, m_ActiveParameters.subpix,
+                                 m_ActiveParameters.inflags, ssum.data(), ssumerr.data(), sarea.data(), sflag.data(), parameters.threads);
         }
         else
+            sep_sum_ellipse_batch(&im, n, sx.data(), sy.data(), sa.data(), sb.data(), stheta.data(), sr.data(), nullptr,
+                                  m_ActiveParameters.subpix, m_ActiveParameters.inflags, ssum.data(), ssumerr.data(), sarea.data(),
+                                  sflag.data(), parameters.threads);
+        for (int k = 0; k < n; k++)
         {
-            sep_sum_ellipse(&im, xPos, yPos, a, b, theta, m_ActiveParameters.kron_fact * kronrad, 0, m_ActiveParameters.subpix,
-                            m_ActiveParameters.inflags, &sum, &sumerr,
-                            &kron_area, &kron_flag);
+            const int j = subset[k];
+            sum[j] = ssum[k];
+            sumerr[j] = ssumerr[k];
+            kron_area[j] = sarea[k];
+            kron_flag[j] = sflag[k];
         }
+    };
+    measureApertures(circles, true);
+    measureApertures(ellipses, false);
+    if (windowed)
+        for (int k = 0; k < numPicked; k++)
+            sum[k] = catalog->flux[picked[k]];
+
+    //Get HFR
+    // Once the time limit ran out, the stars are returned with their aperture fluxes, without the HFRs and PSF fits that take the longest
+    std::vector<double> flux_fractions;
+    // The HFRs of the stars detected on the binned view of detectionBinning are measured at full resolution afterwards
+    if(m_ProcessType == EXTRACT_WITH_HFR && m_DetectionBinning <= 1 && !sep_limits_expired(parameters.deblendLimits))
+    {
+        std::vector<double> hfrX(numPicked), hfrY(numPicked), flux(numPicked);
+        std::vector<short> flux_flag(numPicked);
+        for (int k = 0; k < numPicked; k++)
+        {
+            hfrX[k] = catalog->x[picked[k]];
+            hfrY[k] = catalog->y[picked[k]];
+            flux[k] = catalog->flux[picked[k]];
+        }
+        flux_fractions.resize(2 * numPicked);
+        if (m_ActiveParameters.psfModel != PSF_NONE)
+        {
+            // The fit starts from the size of the detection, and the stars it does not fit fall back to the flux radius
+            std::vector<double> sigma(numPicked);
+            for (int k = 0; k < numPicked; k++)
+                sigma[k] = std::max(0.5, sqrt(a[k] * b[k]));
+            const std::vector<PSFFit::Result> fits = PSFFit::fitStars(parameters.data, parameters.subW, parameters.subH,
+                    parameters.width, hfrX.data(), hfrY.data(), sigma.data(), numPicked,
+                    m_ActiveParameters.psfModel == PSF_MOFFAT ? PSFFit::MOFFAT : PSFFit::GAUSSIAN, parameters.threads);
+            std::vector<int> unfitted;
+            for (int k = 0; k < numPicked; k++)
+            {
+                if (fits[k].converged)
+                {
+                    flux_fractions[2 * k] = fits[k].HFR;
+                    a[k] = fits[k].majorFWHM / 2.3548;
+                    b[k] = fits[k].minorFWHM / 2.3548;
+                    theta[k] = fits[k].theta;
+                }
+                else
+                    unfitted.push_back(k);
+            }
+            const int numUnfitted = static_cast<int>(unfitted.size());
+            std::vector<double> ux(numUnfitted), uy(numUnfitted), uflux(numUnfitted), ufractions(2 * numUnfitted);
+            for (int u = 0; u < numUnfitted; u++)
+            {
+                ux[u] = hfrX[unfitted[u]];
+                uy[u] = hfrY[unfitted[u]];
+                uflux[u] = flux[unfitted[u]];
+            }
+            sep_flux_radius_batch(&im, numUnfitted, ux.data(), uy.data(), maxRadius, nullptr, m_ActiveParameters.subpix, 0,
+                                  uflux.data(), requested_frac, 2, ufractions.data(), flux_flag.data(), parameters.threads);
+            for (int u = 0; u < numUnfitted; u++)
+                flux_fractions[2 * unfitted[u]] = ufractions[2 * u];
+        }
+        else
+            sep_flux_radius_batch(&im, numPicked, hfrX.data(), hfrY.data(), maxRadius, nullptr, m_ActiveParameters.subpix, 0,
+                                  flux.data(), requested_frac, 2, flux_fractions.data(), flux_flag.data(), parameters.threads);
+    }
 
-        float mag = m_ActiveParameters.magzero - 2.5 * log10(sum);
-        float HFR = 0;
-
-        if(m_ProcessType == EXTRACT_WITH_HFR)
+    // The windowed centroids weight the pixels by a Gaussian, like SExtractor's XWIN_IMAGE and YWIN_IMAGE.
+    // Its sigma is the one of a Gaussian star with the HFR if it was measured, otherwise the size of the detection.
+    if (windowed && numPicked > 0)
+    {
+        std::vector<double> isoX(numPicked), isoY(numPicked), winX(numPicked), winY(numPicked), sig(numPicked);
+        std::vector<short> win_flag(numPicked);
+        for (int k = 0; k < numPicked; k++)
+        {
+            isoX[k] = catalog->x[picked[k]];
+            isoY[k] = catalog->y[picked[k]];
+            const double hfr = flux_fractions.empty() ? 0 : flux_fractions[2 * k];
+            sig[k] = std::max(0.5, hfr > 0 ? hfr / 1.1774 : sqrt(a[k] * b[k]));
+        }
+        sep_windowed_batch(&im, numPicked, isoX.data(), isoY.data(), sig.data(), m_ActiveParameters.subpix, 0, winX.data(),
+                           winY.data(), nullptr, win_flag.data(), parameters.threads);
+        for (int k = 0; k < numPicked; k++)
         {
-            //Get HFR
-            sep_flux_radius(&im, catalog->x[i], catalog->y[i], maxRadius, 0, m_ActiveParameters.subpix, 0, &flux, requested_frac, 2,
-                            flux_fractions,
-                            &flux_flag);
-            HFR = flux_fractions[0];
+            xPos[k] = winX[k] + 1;
+            yPos[k] = winY[k] + 1;
         }
+    }
+
+    for (int k = 0; k < numPicked; k++)
+    {
+        const int i = picked[k];
+        float mag = m_ActiveParameters.magzero - 2.5 * log10(sum[k]);
+        float HFR = flux_fractions.empty() ? 0 : flux_fractions[2 * k];
 
-        FITSImage::Star oneStar = {xPos,
-                                   yPos,
+        FITSImage::Star oneStar = {static_cast<float>(xPos[k]),
+                                   static_cast<float>(yPos[k]),
                                    mag,
-                                   static_cast<float>(sum),
-                                   static_cast<float>(peak),
+                                   static_cast<float>(sum[k]),
+                                   static_cast<float>(catalog->peak[i]),
                                    HFR,
-                                   a,
-                                   b,
-                                   qRadiansToDegrees(theta),
+                                   static_cast<float>(a[k]),
+                                   static_cast<float>(b[k]),
+                                   qRadiansToDegrees(static_cast<float>(theta[k])),
                                    0,
                                    0,
-                                   numPixels
+                                   catalog->npix[i]
                                   };
+        if (parameters.summary)
+        {
+            // Only the summary is needed, so the star is judged here like the merge and applyStarFilters would
+            if (!StarMerger::owns(oneStar.x, oneStar.y, parameters.innerX1, parameters.innerY1, parameters.innerX2, parameters.innerY2))
+                continue;
+            if (m_ViewBinning > 1)
+                toFullResolution(oneStar, m_ViewBinning);
+            if (passesStarFilters(oneStar))
+                parameters.summary->add(oneStar);
+            continue;
+        }
         // Make a copy and add it to QList
         partitionStars.append(oneStar);
     }
@@ -717,274 +1976,1235 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
     return partitionStars;
 }
 
-void InternalExtractorSolver::applyStarFilters(QList<FITSImage::Star> &starList)
+namespace
+{
+
+// The smallest and largest radius that the focus mode measures the HFR in
+const int MIN_FOCUS_RADIUS = 8;
+const int MAX_FOCUS_RADIUS = 50;
+
+// The fewest stars that measureAtFullResolution gives a thread, the windows are small so fewer aren't worth the thread
+const int MIN_REMEASURED_STARS = 64;
+
+// This finds the median of the pixels on the edge of a w x h box, which is the local background for the focus mode.
+float boxEdgeMedian(const float *data, int w, int h)
+{
+    std::vector<float> edge;
+    edge.reserve(2 * (w + h));
+    for (int x = 0; x < w; x++)
+    {
+        edge.push_back(data[x]);
+        edge.push_back(data[static_cast<size_t>(h - 1) * w + x]);
+    }
+    for (int y = 1; y < h - 1; y++)
+    {
+        edge.push_back(data[static_cast<size_t>(y) * w]);
+        edge.push_back(data[static_cast<size_t>(y) * w + w - 1]);
+    }
+    std::nth_element(edge.begin(), edge.begin() + edge.size() / 2, edge.end());
+    return edge[edge.size() / 2];
+}
+
+// This replaces the pixels that are much brighter than all of their neighbours, like hot pixels, by the brightest neighbour.
+// Even a star in sharp focus spreads over more than one pixel, so its peak is never that much brighter than the pixels around it.
+void removeHotPixels(float *data, int w, int h)
 {
-    if(starList.size() > 1)
+    const float HOT_PIXEL_RATIO = 4;
+    for (int y = 1; y < h - 1; y++)
     {
-        emit logOutput(QString("Stars Found before Filtering: %1").arg(starList.size()));
-        if(m_ActiveParameters.resort)
+        for (int x = 1; x < w - 1; x++)
         {
-            //Note that a star is dimmer when the mag is greater!
-            //We want to sort in decreasing order though!
-            std::sort(starList.begin(), starList.end(), [](const FITSImage::Star & s1, const FITSImage::Star & s2)
-            {
-                return s1.mag < s2.mag;
-            });
+            float *pixel = data + static_cast<size_t>(y) * w + x;
+            if (*pixel <= 0)
+                continue;
+            float neighbour = -HUGE_VALF;
+            for (int j = -1; j <= 1; j++)
+                for (int i = -1; i <= 1; i++)
+                    if (i != 0 || j != 0)
+                        neighbour = std::max(neighbour, pixel[j * w + i]);
+            if (*pixel > HOT_PIXEL_RATIO * std::max(neighbour, 0.0f))
+                *pixel = neighbour;
         }
+    }
+}
 
-        if(m_ActiveParameters.maxSize > 0.0)
+// This finds the center of the 3x3 block with the most flux within radius of cx,cy in a w x h box.
+void brightestBlock(const float *data, int w, int h, double cx, double cy, int radius, int *bx, int *by)
+{
+    double best = -HUGE_VAL;
+    *bx = std::min(std::max(static_cast<int>(cx + 0.5), 1), w - 2);
+    *by = std::min(std::max(static_cast<int>(cy + 0.5), 1), h - 2);
+    const int x1 = std::max(1, static_cast<int>(cx) - radius), x2 = std::min(w - 2, static_cast<int>(cx) + radius);
+    const int y1 = std::max(1, static_cast<int>(cy) - radius), y2 = std::min(h - 2, static_cast<int>(cy) + radius);
+    for (int y = y1; y <= y2; y++)
+    {
+        for (int x = x1; x <= x2; x++)
         {
-            emit logOutput(QString("Removing stars wider than %1 pixels").arg(m_ActiveParameters.maxSize));
-            starList.erase(std::remove_if(starList.begin(), starList.end(), [&](FITSImage::Star & oneStar)
+            double sum = 0;
+            for (int j = -1; j <= 1; j++)
+                for (int i = -1; i <= 1; i++)
+                    sum += data[static_cast<size_t>(y + j) * w + x + i];
+            if (sum > best)
             {
-                return (oneStar.a > m_ActiveParameters.maxSize || oneStar.b > m_ActiveParameters.maxSize);
-            }), starList.end());
+                best = sum;
+                *bx = x;
+                *by = y;
+            }
         }
+    }
+}
+
+}
 
-        if(m_ActiveParameters.minSize > 0.0)
+// This measures a star in a small window of the full resolution image around where it is expected, for measureFocus and
+// measureAtFullResolution.  The window is read, its background is subtracted, and the star is found again near x, y.
+// It sets the position, flux, magnitude, peak, HFR and area of star and leaves the rest of it as it was.
+InternalExtractorSolver::WindowMeasurement InternalExtractorSolver::measureInWindow(double x, double y, int radius, FITSImage::Star &star,
+        float *background, std::vector<float> *buffer)
+{
+    const int imageW = m_Statistics.width, imageH = m_Statistics.height;
+    double requested_frac[1] = { 0.5 };
+    // The box has room for the star to have moved a bit, and for the interpolation at the edge of the annuli
+    const int half = radius + radius / 2 + 2;
+    const int x1 = std::max(0, static_cast<int>(x) - half), x2 = std::min(imageW - 1, static_cast<int>(x) + half);
+    const int y1 = std::max(0, static_cast<int>(y) - half), y2 = std::min(imageH - 1, static_cast<int>(y) + half);
+    const int w = x2 - x1 + 1, h = y2 - y1 + 1;
+    if (w < 3 || h < 3)
+        return WINDOW_TOO_SMALL;
+
+    if (buffer && buffer->size() < static_cast<size_t>(w) * h)
+        buffer->resize(static_cast<size_t>(w) * h);
+    float *data = buffer ? buffer->data() : floatBuffer(static_cast<size_t>(w) * h);
+    if (allocateDataBuffer(data, x1, y1, w, h) == false)
+        return WINDOW_UNREADABLE;
+
+    *background = boxEdgeMedian(data, w, h);
+    for (size_t i = 0; i < static_cast<size_t>(w) * h; i++)
+        data[i] -= *background;
+    removeHotPixels(data, w, h);
+    const float peak = *std::max_element(data, data + static_cast<size_t>(w) * h);
+
+    // Find the star again near where it was, then refine that with the flux weighted centroid of the pixels around it
+    int bx, by;
+    brightestBlock(data, w, h, x - x1, y - y1, radius / 2, &bx, &by);
+    double cx = bx, cy = by;
+    const int window = std::max(3, radius / 2);
+    bool found = false;
+    for (int iteration = 0; iteration < 2; iteration++)
+    {
+        double sum = 0, sumX = 0, sumY = 0;
+        const int wx1 = std::max(0, static_cast<int>(cx) - window), wx2 = std::min(w - 1, static_cast<int>(cx) + window);
+        const int wy1 = std::max(0, static_cast<int>(cy) - window), wy2 = std::min(h - 1, static_cast<int>(cy) + window);
+        for (int wy = wy1; wy <= wy2; wy++)
         {
-            emit logOutput(QString("Removing stars smaller than %1 pixels").arg(m_ActiveParameters.minSize));
-            starList.erase(std::remove_if(starList.begin(), starList.end(), [&](FITSImage::Star & oneStar)
+            for (int wx = wx1; wx <= wx2; wx++)
             {
-                return ((oneStar.a < m_ActiveParameters.minSize || oneStar.b < m_ActiveParameters.minSize));
-            }), starList.end());
+                const float value = data[static_cast<size_t>(wy) * w + wx];
+                if (value > 0)
+                {
+                    sum += value;
+                    sumX += value * wx;
+                    sumY += value * wy;
+                }
+            }
         }
+        if (sum <= 0)
+            break;
+        cx = sumX / sum;
+        cy = sumY / sum;
+        found = true;
+    }
+    if (!found)
+        return STAR_NOT_FOUND;
+
+    sep_image im = {data, nullptr, nullptr, nullptr, SEP_TFLOAT, 0, 0, 0, w, h, w, h, 0, SEP_NOISE_NONE, 1.0, 0};
+    double flux = 0, fluxerr, area;
+    short flag = 0;
+    if (sep_sum_circle(&im, cx, cy, radius, 0, m_ActiveParameters.subpix, 0, &flux, &fluxerr, &area, &flag) != 0
+            || flux <= 0)
+        return STAR_NOT_FOUND;
+    double hfr = 0;
+    if (sep_flux_radius(&im, cx, cy, radius, 0, m_ActiveParameters.subpix, 0, &flux, requested_frac, 1, &hfr, &flag) != 0)
+        return STAR_NOT_FOUND;
+
+    star.x = static_cast<float>(cx + x1 + 1);
+    star.y = static_cast<float>(cy + y1 + 1);
+    star.mag = static_cast<float>(m_ActiveParameters.magzero - 2.5 * log10(flux));
+    star.flux = static_cast<float>(flux);
+    star.peak = peak;
+    star.HFR = static_cast<float>(hfr);
+    star.numPixels = static_cast<int>(area + 0.5);
+    return STAR_MEASURED;
+}
+
+int InternalExtractorSolver::measureFocus(const QList<FITSImage::Star> &stars, QVector<int> *measured)
+{
+    QMutexLocker locker(&futuresMutex);
+    QElapsedTimer timer;
+    timer.start();
 
-        if(m_ActiveParameters.resort && m_ActiveParameters.removeBrightest > 0.0 && m_ActiveParameters.removeBrightest < 100.0)
+    m_ExtractedStars.clear();
+    m_HasExtracted = false;
+
+    //The channels are merged while the image is converted to float, the boxes around the stars are then read from that
+    if(m_Statistics.channels == 3 && (m_ColorChannel == FITSImage::AVERAGE_RGB || m_ColorChannel == FITSImage::INTEGRATED_RGB)
+            && m_PreparedFrame == nullptr && m_ViewBinning <= 1)
+    {
+        if (prepareFrame(1) == false)
         {
-            int numToRemove = starList.count() * (m_ActiveParameters.removeBrightest / 100.0);
-            emit logOutput(QString("Removing the %1 brightest stars").arg(numToRemove));
-            if(numToRemove > 1)
-            {
-                for(int i = 0; i < numToRemove; i++)
-                    starList.removeFirst();
-            }
+            emit logOutput("Merging image channels failed.");
+            return -1;
         }
+    }
+
+    const int imageW = m_Statistics.width, imageH = m_Statistics.height;
+    QRect frame(0, 0, imageW, imageH);
+    if(m_UseSubframe && m_SubFrameRect.isValid())
+        frame = m_SubFrameRect.intersected(frame);
+
+    // These are where to measure, in 0 based pixels, and how far out
+    struct FocusTarget
+    {
+        double x, y;
+        int radius;
+        float a, b, theta;
+        int index;          // The star in the list it came from, or -1 for the one found in the subframe
+    };
+    QVector<FocusTarget> targets;
+    if (measured)
+        measured->clear();
+    for (int index = 0; index < stars.size(); index++)
+    {
+        const auto &star = stars[index];
+        // The star positions follow the FITS convention of the star extraction, where the first pixel is at 1,1
+        const double x = star.x - 1, y = star.y - 1;
+        if (!frame.contains(static_cast<int>(x), static_cast<int>(y)))
+            continue;
+        const int radius = std::min(std::max(static_cast<int>(std::ceil(4 * std::max(star.HFR, star.a))), MIN_FOCUS_RADIUS),
+                                    MAX_FOCUS_RADIUS);
+        targets.append({x, y, radius, star.a, star.b, star.theta, index});
+    }
+
+    if (stars.isEmpty())
+    {
+        if (!m_UseSubframe || frame.width() < 3 || frame.height() < 3)
+        {
+            emit logOutput("The focus mode needs the positions of the stars to measure or a subframe around a star.");
+            return -1;
+        }
+        // Without any positions, the star to measure is the brightest one in the subframe
+        float *data = floatBuffer(static_cast<size_t>(frame.width()) * frame.height());
+        if (allocateDataBuffer(data, frame.x(), frame.y(), frame.width(), frame.height()) == false)
+        {
+            emit logOutput("Failed to allocate memory.");
+            return -1;
+        }
+        int bx, by;
+        brightestBlock(data, frame.width(), frame.height(), frame.width() / 2.0, frame.height() / 2.0,
+                       std::max(frame.width(), frame.height()), &bx, &by);
+        const int radius = std::min(std::max(std::min(frame.width(), frame.height()) / 2, MIN_FOCUS_RADIUS), MAX_FOCUS_RADIUS);
+        targets.append({static_cast<double>(frame.x() + bx), static_cast<double>(frame.y() + by), radius, 0, 0, 0, -1});
+    }
+
+    double backgroundSum = 0;
+    for (const auto &target : targets)
+    {
+        FITSImage::Star oneStar = {0, 0, 0, 0, 0, 0, target.a, target.b, target.theta, 0, 0, 0};
+        float background = 0;
+        const WindowMeasurement result = measureInWindow(target.x, target.y, target.radius, oneStar, &background);
+        if (result == WINDOW_UNREADABLE)
+        {
+            emit logOutput("Failed to allocate memory.");
+            return -1;
+        }
+        if (result != WINDOW_TOO_SMALL)
+            backgroundSum += background;
+        if (result != STAR_MEASURED)
+            continue;
+        m_ExtractedStars.append(oneStar);
+        if (measured)
+            measured->append(target.index);
+    }
+
+    m_Background = FITSImage::Background();
+    m_Background.global = targets.isEmpty() ? 0 : backgroundSum / targets.size();
+    m_Background.num_stars_detected = m_ExtractedStars.size();
+
+    emit logOutput(QString("Measured the HFR of %1 of %2 stars in %3 ms").arg(m_ExtractedStars.size()).arg(targets.size()).arg(
+                       timer.elapsed()));
+    m_HasExtracted = true;
+    return 0;
+}
+
+void InternalExtractorSolver::measureAtFullResolution(QList<FITSImage::Star> &stars, sep_deblend_limits *limits)
+{
+    // Past the time limit, the stars keep the measurements of the binned view
+    if (stars.isEmpty() || sep_limits_expired(limits))
+        return;
+    StageTimer timer(m_StageTimes.photometry);
+    QElapsedTimer elapsed;
+    elapsed.start();
+    // The windows are read from the full resolution image instead of the binned view.  The view is switched
+    // before the threads start and back after they are done, the partitions that read the binned view are over.
+    const int binning = m_ViewBinning;
+    m_ViewBinning = 0;
+    std::atomic<int> remeasured { 0 };
+    auto measureStars = [this, &stars, &remeasured, binning, limits](int first, int last)
+    {
+        // Each thread reads its windows into a buffer of its own
+        std::vector<float> buffer;
+        for (int i = first; i < last && !sep_limits_expired(limits); i++)
+        {
+            FITSImage::Star &star = stars[i];
+            // The binned size of the star is scaled up already, and the window has room for the star to be off by a binned pixel
+            const int radius = std::min(std::max(static_cast<int>(std::ceil(4 * std::max(star.HFR, star.a))),
+                                                 std::max(MIN_FOCUS_RADIUS, 2 * binning)), MAX_FOCUS_RADIUS);
+            FITSImage::Star measured = star;
+            float background;
+            if (measureInWindow(star.x - 1, star.y - 1, radius, measured, &background, &buffer) != STAR_MEASURED)
+                continue;
+            // The area stays the one of the detection, the HFR is only kept if it was asked for
+            measured.numPixels = star.numPixels;
+            if (m_ProcessType != EXTRACT_WITH_HFR)
+                measured.HFR = 0;
+            star = measured;
+            remeasured++;
+        }
+    };
+    // The list is detached once here, so the threads only write to the stars of their own ranges
+    stars.detach();
+    const int threads = std::max(1, std::min(m_PartitionThreads, stars.size() / MIN_REMEASURED_STARS));
+    QList<QFuture<void>> futures;
+    for (int t = 1; t < threads; t++)
+    {
+        const int first = stars.size() * t / threads, last = stars.size() * (t + 1) / threads;
+        auto run = [measureStars, first, last]()
+        {
+            measureStars(first, last);
+        };
+        futures.append(threadPool ? threadPool->run(run, urgency) : QtConcurrent::run(run));
+    }
+    measureStars(0, stars.size() / threads);
+    for (auto &future : futures)
+        future.waitForFinished();
+    m_ViewBinning = binning;
+    if (m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Detected the stars binned %1x, and measured %2 of %3 of them at full resolution in %4 ms").arg(binning)
+                       .arg(remeasured.load()).arg(stars.size()).arg(elapsed.elapsed()));
+}
+
+// The filters work in the order they always did, the size filters, the brightest and dimmest percentages of the stars left,
+// the shape and saturation filters, and then keepNum, but on arrays of the indices and magnitudes of the stars instead of erasing
+// from the list at each step.  All of the filters that only depend on each star are worked out in one sweep, the percentage cuts
+// partition the stars with nth_element, and only the stars that are kept get sorted, then the list is made once at the end.
+void InternalExtractorSolver::applyStarFilters(QList<FITSImage::Star> &starList)
+{
+    StageTimer timer(m_StageTimes.filter);
+    if(starList.size() <= 1)
+        return;
+
+    emit logOutput(QString("Stars Found before Filtering: %1").arg(starList.size()));
+    const Parameters &params = m_ActiveParameters;
+    const bool checkMaxSize = params.maxSize > 0.0;
+    const bool checkMinSize = params.minSize > 0.0;
+    const bool checkEllipse = params.maxEllipse > 1;
+    const bool useSaturation = params.saturationLimit > 0.0 && params.saturationLimit < 100.0;
+    const double maxSizeofDataType = useSaturation ? saturationLevel() : -1;
+    const bool checkSaturation = useSaturation && maxSizeofDataType != -1;
+    const double saturation = (params.saturationLimit / 100.0) * maxSizeofDataType;
+    if(checkMaxSize)
+        emit logOutput(QString("Removing stars wider than %1 pixels").arg(params.maxSize));
+    if(checkMinSize)
+        emit logOutput(QString("Removing stars smaller than %1 pixels").arg(params.minSize));
+    // The percentages are of the stars that pass the size filters, so those are gathered with whether they pass the others
+    const int count = starList.size();
+    QVector<int> sized;
+    sized.reserve(count);
+    QVector<float> mags(count);
+    QVector<char> shapeOK(count);
+    for(int i = 0; i < count; i++)
+    {
+        const FITSImage::Star &oneStar = starList.at(i);
+        if(checkMaxSize && (oneStar.a > params.maxSize || oneStar.b > params.maxSize))
+            continue;
+        if(checkMinSize && (oneStar.a < params.minSize || oneStar.b < params.minSize))
+            continue;
+        sized.append(i);
+        mags[i] = oneStar.mag;
+        shapeOK[i] = !(checkEllipse && oneStar.b != 0 && oneStar.a / oneStar.b > params.maxEllipse) &&
+                     !(checkSaturation && oneStar.peak > saturation);
+    }
+
+    //Note that a star is dimmer when the mag is greater!
+    auto brighter = [&mags](int s1, int s2)
+    {
+        return mags[s1] < mags[s2];
+    };
+    int first = 0;
+    int last = sized.size();
+    if(params.resort && params.removeBrightest > 0.0 && params.removeBrightest < 100.0)
+    {
+        int numToRemove = last * (params.removeBrightest / 100.0);
+        emit logOutput(QString("Removing the %1 brightest stars").arg(numToRemove));
+        if(numToRemove > 1)
+        {
+            std::nth_element(sized.begin(), sized.begin() + numToRemove, sized.end(), brighter);
+            first = numToRemove;
+        }
+    }
+    if(params.resort && params.removeDimmest > 0.0 && params.removeDimmest < 100.0)
+    {
+        int numToRemove = (last - first) * (params.removeDimmest / 100.0);
+        emit logOutput(QString("Removing the %1 dimmest stars").arg(numToRemove));
+        if(numToRemove > 1)
+        {
+            std::nth_element(sized.begin() + first, sized.begin() + last - numToRemove, sized.begin() + last, brighter);
+            last -= numToRemove;
+        }
+    }
+    if(checkEllipse)
+        emit logOutput(QString("Removing the stars with a/b ratios greater than %1").arg(params.maxEllipse));
+    if(useSaturation && !checkSaturation)
+        emit logOutput("Skipping Saturation filter");
+    else if(checkSaturation)
+        emit logOutput(QString("Removing the saturated stars with peak values greater than %1 Percent of %2").arg(
+                           params.saturationLimit).arg(maxSizeofDataType));
+
+    QVector<int> kept;
+    kept.reserve(last - first);
+    for(int k = first; k < last; k++)
+    {
+        if(shapeOK[sized[k]])
+            kept.append(sized[k]);
+    }
+
+    if(params.resort)
+    {
+        int keepCount = kept.size();
+        if(params.keepNum > 0)
+        {
+            emit logOutput(QString("Keeping just the %1 brightest stars").arg(params.keepNum));
+            if(kept.size() - params.keepNum > 1)
+                keepCount = params.keepNum;
+        }
+        std::vector<float> keptMags(kept.size());
+        for(int k = 0; k < kept.size(); k++)
+            keptMags[k] = mags[kept[k]];
+        QVector<int> brightest;
+        brightest.reserve(keepCount);
+        for(int k : StarSort::order(keptMags.data(), kept.size(), false, keepCount))
+            brightest.append(kept[k]);
+        kept = brightest;
+    }
+
+    QList<FITSImage::Star> filtered;
+    filtered.reserve(kept.size());
+    for(int i : kept)
+        filtered.append(starList.at(i));
+    starList = filtered;
+    emit logOutput(QString("Stars Found after Filtering: %1").arg(starList.size()));
+}
+
+double InternalExtractorSolver::saturationLevel() const
+{
+    if(m_Statistics.dataType == TSHORT || m_Statistics.dataType == TLONG || m_Statistics.dataType == TLONGLONG)
+        return pow(2, m_Statistics.bytesPerPixel * 8) / 2 - 1;
+    else if(m_Statistics.dataType == TUSHORT || m_Statistics.dataType == TULONG)
+        return pow(2, m_Statistics.bytesPerPixel * 8) - 1;
+    else // Float and Double Images saturation level is not so easy to determine, especially since they were probably processed by another program and the saturation level is now changed.
+        return -1;
+}
+
+double InternalExtractorSolver::detectionSaturation() const
+{
+    const Parameters &params = m_ActiveParameters;
+    if(params.saturationLimit <= 0.0 || params.saturationLimit >= 100.0 || saturationLevel() == -1)
+        return 0;
+    // Removing the brightest stars takes a percentage of all of the stars, saturated ones included, so they have to be found
+    if(params.resort && params.removeBrightest > 0.0 && params.removeBrightest < 100.0)
+        return 0;
+    return (params.saturationLimit / 100.0) * saturationLevel();
+}
+
+bool InternalExtractorSolver::passesStarFilters(const FITSImage::Star &oneStar) const
+{
+    const double saturation = (m_ActiveParameters.saturationLimit > 0.0 && m_ActiveParameters.saturationLimit < 100.0) ?
+                              saturationLevel() : -1;
+    if (m_ActiveParameters.maxSize > 0.0 && (oneStar.a > m_ActiveParameters.maxSize || oneStar.b > m_ActiveParameters.maxSize))
+        return false;
+    if (m_ActiveParameters.minSize > 0.0 && (oneStar.a < m_ActiveParameters.minSize || oneStar.b < m_ActiveParameters.minSize))
+        return false;
+    if (m_ActiveParameters.maxEllipse > 1 && oneStar.b != 0 && oneStar.a / oneStar.b > m_ActiveParameters.maxEllipse)
+        return false;
+    return !(saturation > 0 && oneStar.peak > (m_ActiveParameters.saturationLimit / 100.0) * saturation);
+}
+
+int InternalExtractorSolver::runPipelinedSolve()
+{
+    m_Pipeline.reset(new StarPipeline());
+    int extractResult = -1;
+    std::thread extraction([this, &extractResult]()
+    {
+        extractResult = extract();
+        QMutexLocker locker(&m_Pipeline->mutex);
+        m_Pipeline->done = true;
+        m_Pipeline->added.wakeAll();
+    });
+
+    // The solve waits for the first stars.  By then the image statistics and the scale are final, since prepareFrame changes them before SEP runs.
+    bool haveStars = false;
+    {
+        QMutexLocker locker(&m_Pipeline->mutex);
+        while (!m_Pipeline->done && m_Pipeline->x.isEmpty())
+            m_Pipeline->added.wait(&m_Pipeline->mutex);
+        haveStars = !m_Pipeline->x.isEmpty();
+    }
+
+    int result = -1;
+    if (haveStars)
+        result = runInternalSolver();
+    else
+        emit logOutput("No stars were found, so the image cannot be solved");
+    {
+        QMutexLocker locker(&m_Pipeline->mutex);
+        m_Pipeline->stopped = true;
+        m_Pipeline->needed.wakeAll();
+    }
+    extraction.join();
+    m_Pipeline.reset();
+
+    if (extractResult != 0 && result != 0)
+        emit logOutput("The star extraction failed during the pipelined solve.");
+    return result;
+}
+
+void InternalExtractorSolver::publishStars(QList<FITSImage::Star> stars)
+{
+    if (!m_Pipeline || stars.isEmpty())
+        return;
+
+    stars.erase(std::remove_if(stars.begin(), stars.end(), [this](const FITSImage::Star & oneStar)
+    {
+        return !passesStarFilters(oneStar);
+    }), stars.end());
+    std::vector<float> mags(stars.size());
+    for (int i = 0; i < stars.size(); i++)
+        mags[i] = stars.at(i).mag;
+    const std::vector<int> brightestFirst = StarSort::order(mags.data(), stars.size(), false);
+
+    // The stars the solver doesn't have yet are merged with these, so a bright star of a later partition comes before the faint ones of earlier partitions
+    QMutexLocker locker(&m_Pipeline->mutex);
+    StarPipeline &pipeline = *m_Pipeline;
+    const int total = pipeline.x.size() + stars.size();
+    QVector<double> x = pipeline.x.mid(0, pipeline.given), y = pipeline.y.mid(0, pipeline.given);
+    QVector<float> mag = pipeline.mag.mid(0, pipeline.given);
+    x.reserve(total);
+    y.reserve(total);
+    mag.reserve(total);
+    int i = pipeline.given;
+    size_t j = 0;
+    while (i < pipeline.x.size() || j < brightestFirst.size())
+    {
+        if (j == brightestFirst.size() || (i < pipeline.x.size() && pipeline.mag[i] <= mags[brightestFirst[j]]))
+        {
+            x.append(pipeline.x[i]);
+            y.append(pipeline.y[i]);
+            mag.append(pipeline.mag[i]);
+            i++;
+        }
+        else
+        {
+            const FITSImage::Star &star = stars.at(brightestFirst[j]);
+            x.append(star.x);
+            y.append(star.y);
+            mag.append(star.mag);
+            j++;
+        }
+    }
+    pipeline.x.swap(x);
+    pipeline.y.swap(y);
+    pipeline.mag.swap(mag);
+    pipeline.added.wakeAll();
+}
+
+void InternalExtractorSolver::streamStars(QList<FITSImage::Star> stars, int partition, int partitions)
+{
+    if (!m_StreamPartitionStars)
+        return;
+    stars.erase(std::remove_if(stars.begin(), stars.end(), [this](const FITSImage::Star & oneStar)
+    {
+        return !passesStarFilters(oneStar);
+    }), stars.end());
+    emit partitionStarsReady(stars, partition, partitions);
+}
+
+bool InternalExtractorSolver::waitForStarDemand()
+{
+    if (!m_Pipeline)
+        return true;
+    QMutexLocker locker(&m_Pipeline->mutex);
+    while (!m_Pipeline->stopped && !m_CancelToken->load() && !m_Pipeline->x.isEmpty() && m_Pipeline->x.size() >= m_Pipeline->wanted)
+        m_Pipeline->needed.wait(&m_Pipeline->mutex, 100);
+    return !m_Pipeline->stopped && !m_CancelToken->load();
+}
+
+void InternalExtractorSolver::growField(blind_t *bp, int endobj, void *userdata)
+{
+    auto *solver = static_cast<InternalExtractorSolver *>(userdata);
+    StarPipeline &pipeline = *solver->m_Pipeline;
+    QMutexLocker locker(&pipeline.mutex);
+
+    // The solver never uses more than keepNum stars, so a progressive extraction doesn't have to find more
+    int wanted = endobj == 0 ? std::numeric_limits<int>::max() : endobj;
+    if (solver->m_ActiveParameters.keepNum > 0)
+        wanted = std::min(wanted, solver->m_ActiveParameters.keepNum);
+    if (wanted > pipeline.wanted)
+    {
+        pipeline.wanted = wanted;
+        pipeline.needed.wakeAll();
+    }
+
+    // There is no point in waiting for more stars once it has solved or was aborted
+    while (!pipeline.done && !bp->single_field_solved && !solver->m_CancelToken->load()
+            && (endobj == 0 || pipeline.x.size() < wanted))
+        pipeline.added.wait(&pipeline.mutex, 100);
+
+    int numStars = pipeline.x.size();
+    if (solver->m_ActiveParameters.keepNum > 0)
+        numStars = std::min(numStars, solver->m_ActiveParameters.keepNum);
+    if (numStars <= (bp->solver.fieldxy ? starxy_n(bp->solver.fieldxy) : 0))
+        return;
+
+    starxy_t *field = starxy_new(numStars, FALSE, FALSE);
+    for (int i = 0; i < numStars; i++)
+        starxy_set(field, i, pipeline.x[i], pipeline.y[i]);
+    solver_set_field(&bp->solver, field);
+    pipeline.given = numStars;
+    if (solver->m_SSLogLevel == LOG_VERBOSE)
+        emit solver->logOutput(QString("Solving with the %1 stars extracted so far").arg(numStars));
+}
+
+void InternalExtractorSolver::recordIndexSearch(blind_t *bp, const index_t *index, double seconds, int quadsTried, void *userdata)
+{
+    Q_UNUSED(bp);
+    auto *solver = static_cast<InternalExtractorSolver *>(userdata);
+    FITSImage::IndexSearch search;
+    search.indexNumber = index ? index->indexid : -1;
+    search.healpix = index ? index->healpix : -1;
+    search.searchMs = seconds * 1000;
+    search.quadsTried = quadsTried;
+    solver->m_Metrics.indexSearches.append(search);
+}
+
+double InternalExtractorSolver::updateBestLogOdds(double logodds, void *userdata)
+{
+    auto *solver = static_cast<InternalExtractorSolver *>(userdata);
+    std::atomic<double> &best = *solver->m_SharedBestLogOdds;
+    double current = best.load(std::memory_order_relaxed);
+    //Only a match that solves the image can be used instead of the others, so only those raise the bar for the other child solvers
+    if(logodds < solver->job->bp.logratio_tosolve)
+        return current;
+    while(logodds > current && !best.compare_exchange_weak(current, logodds, std::memory_order_relaxed))
+        ;
+    return std::max(current, logodds);
+}
+
+void InternalExtractorSolver::updateExtractionMetrics()
+{
+    // The deblending is done within the detection, so it is taken out of it.  It is added up over the threads of the detection,
+    // so with more than one thread for a partition it can take out more than the detection took.
+    const qint64 deblend = m_StageTimes.deblend;
+    m_Metrics.prepareMs = m_StageTimes.prepare / 1e6;
+    m_Metrics.backgroundMs = m_StageTimes.background / 1e6;
+    m_Metrics.detectionMs = std::max<qint64>(0, m_StageTimes.detection - deblend) / 1e6;
+    m_Metrics.deblendMs = deblend / 1e6;
+    m_Metrics.photometryMs = m_StageTimes.photometry / 1e6;
+    m_Metrics.filterMs = m_StageTimes.filter / 1e6;
+    m_Metrics.extractionSimd = simdName(sep_simd(), SEP_SIMD_AVX2, SEP_SIMD_NEON);
+    if (m_CountHardwareEvents && PerfCounters::isAvailable())
+    {
+        m_Metrics.hardwareCounted = true;
+        m_Metrics.extractionCounters = PerfCounters::toCounters(m_ExtractionCounters);
+    }
+}
+
+// These convert a run of pixels to float for getFloatBuffer.
+// Float images are just copied, and the 16 bit types, which most cameras produce, get vector versions.
+template <typename T>
+static void convertToFloat(T const * in, float * out, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = in[i];
+}
+
+static void convertToFloat(float const * in, float * out, size_t n)
+{
+    memcpy(out, in, n * sizeof(float));
+}
+
+#if defined(SEP_SIMD_X86)
+SEP_TARGET_AVX2 static void convertToFloatAVX2(int16_t const * in, float * out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)));
+        _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(v));
+    }
+    for (; i < n; i++)
+        out[i] = in[i];
+}
+
+SEP_TARGET_AVX2 static void convertToFloatAVX2(uint16_t const * in, float * out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)));
+        _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(v));
+    }
+    for (; i < n; i++)
+        out[i] = in[i];
+}
+#endif
+
+static void convertToFloat(int16_t const * in, float * out, size_t n)
+{
+    size_t i = 0;
+#if defined(SEP_SIMD_X86)
+    if (sep_simd() == SEP_SIMD_AVX2)
+    {
+        convertToFloatAVX2(in, out, n);
+        return;
+    }
+#elif defined(SEP_SIMD_ARM)
+    if (sep_simd() == SEP_SIMD_NEON)
+    {
+        for (; i + 8 <= n; i += 8)
+        {
+            const int16x8_t v = vld1q_s16(in + i);
+            vst1q_f32(out + i, vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))));
+            vst1q_f32(out + i + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))));
+        }
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = in[i];
+}
+
+static void convertToFloat(uint16_t const * in, float * out, size_t n)
+{
+    size_t i = 0;
+#if defined(SEP_SIMD_X86)
+    if (sep_simd() == SEP_SIMD_AVX2)
+    {
+        convertToFloatAVX2(in, out, n);
+        return;
+    }
+#elif defined(SEP_SIMD_ARM)
+    if (sep_simd() == SEP_SIMD_NEON)
+    {
+        for (; i + 8 <= n; i += 8)
+        {
+            const uint16x8_t v = vld1q_u16(in + i);
+            vst1q_f32(out + i, vcvtq_f32_u32(vmovl_u16(vget_low_u16(v))));
+            vst1q_f32(out + i + 4, vcvtq_f32_u32(vmovl_u16(vget_high_u16(v))));
+        }
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = in[i];
+}
+
+// This converts n pixels that are step apart, like the ones of one channel of an interleaved image, to float
+template <typename T>
+static void convertToFloat(T const * in, float * out, size_t n, size_t step)
+{
+    if (step == 1)
+    {
+        convertToFloat(in, out, n);
+        return;
+    }
+    for (size_t i = 0; i < n; i++)
+        out[i] = in[i * step];
+}
+
+// These calibrate n float pixels in place with the offsets and gains of CalibrationFrames
+static void calibratePixels(float * pixels, const float * offset, const float * gain, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        pixels[i] = (pixels[i] - offset[i]) * gain[i];
+}
+
+#if defined(SEP_SIMD_X86)
+SEP_TARGET_AVX2 static void calibratePixelsAVX2(float * pixels, const float * offset, const float * gain, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 v = _mm256_sub_ps(_mm256_loadu_ps(pixels + i), _mm256_loadu_ps(offset + i));
+        _mm256_storeu_ps(pixels + i, _mm256_mul_ps(v, _mm256_loadu_ps(gain + i)));
+    }
+    calibratePixels(pixels + i, offset + i, gain + i, n - i);
+}
+#endif
+
+// The pixels of a row are converted and calibrated this many at a time, so that they are calibrated while they are still in the L1 cache
+static const size_t CALIBRATION_CHUNK = 1024;
 
-        if(m_ActiveParameters.resort && m_ActiveParameters.removeDimmest > 0.0 && m_ActiveParameters.removeDimmest < 100.0)
+// This converts n pixels that are step apart to float and calibrates them with the offsets and gains of their pixels in the masters
+template <typename T>
+static void convertCalibrated(T const * in, float * out, size_t n, size_t step, const float * offset, const float * gain)
+{
+    for (size_t start = 0; start < n; start += CALIBRATION_CHUNK)
+    {
+        const size_t count = std::min(CALIBRATION_CHUNK, n - start);
+        convertToFloat(in + start * step, out + start, count, step);
+#if defined(SEP_SIMD_X86)
+        if (sep_simd() == SEP_SIMD_AVX2)
         {
-            int numToRemove = starList.count() * (m_ActiveParameters.removeDimmest / 100.0);
-            emit logOutput(QString("Removing the %1 dimmest stars").arg(numToRemove));
-            if(numToRemove > 1)
+            calibratePixelsAVX2(out + start, offset + start, gain + start, count);
+            continue;
+        }
+#elif defined(SEP_SIMD_ARM)
+        if (sep_simd() == SEP_SIMD_NEON)
+        {
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4)
             {
-                for(int i = 0; i < numToRemove; i++)
-                    starList.removeLast();
+                float * p = out + start + i;
+                vst1q_f32(p, vmulq_f32(vsubq_f32(vld1q_f32(p), vld1q_f32(offset + start + i)), vld1q_f32(gain + start + i)));
             }
+            calibratePixels(out + start + i, offset + start + i, gain + start + i, count - i);
+            continue;
         }
+#endif
+        calibratePixels(out + start, offset + start, gain + start, count);
+    }
+}
+
+// This converts the w x h rectangle at x, y of an image with the given row and pixel strides to float.
+// With calibration, the pixel at 0, 0 of the image is the one at calibrationX, calibrationY of the masters.
+template <typename T>
+static void rectToFloat(T const * rawBuffer, size_t rowStride, size_t pixelStride, float * buffer, int x, int y, int w, int h,
+                        const CalibrationFrames * calibration = nullptr, int calibrationX = 0, int calibrationY = 0)
+{
+    if (calibration)
+    {
+        for (int y1 = 0; y1 < h; y1++)
+            convertCalibrated(rawBuffer + (y + y1) * rowStride + x * pixelStride, buffer + static_cast<size_t>(y1) * w, w, pixelStride,
+                              calibration->offset(calibrationX + x, calibrationY + y + y1), calibration->gain(calibrationX + x, calibrationY + y + y1));
+        return;
+    }
+
+    // Whole rows are contiguous in the image, so they can be converted all at once
+    if (x == 0 && static_cast<size_t>(w) == rowStride && pixelStride == 1)
+    {
+        convertToFloat(rawBuffer + y * rowStride, buffer, rowStride * h);
+        return;
+    }
+
+    for (int y1 = 0; y1 < h; y1++)
+        convertToFloat(rawBuffer + (y + y1) * rowStride + x * pixelStride, buffer + static_cast<size_t>(y1) * w, w, pixelStride);
+}
 
-        if(m_ActiveParameters.maxEllipse > 1)
-        {
-            emit logOutput(QString("Removing the stars with a/b ratios greater than %1").arg(m_ActiveParameters.maxEllipse));
-            starList.erase(std::remove_if(starList.begin(), starList.end(), [&](FITSImage::Star & oneStar)
-            {
-                return (oneStar.b != 0 && oneStar.a / oneStar.b > m_ActiveParameters.maxEllipse);
-            }), starList.end());
-        }
+// This merges n pixels of the R, G, and B channels, which are step apart, into dest, which can be one of them, for getStreamedFloatBuffer
+template <typename T>
+static void mergeChannels(T const * r, T const * g, T const * b, T * dest, size_t n, int colorChannel, size_t step = 1)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        double total  = 0;
+        if(colorChannel == FITSImage::INTEGRATED_RGB)
+            total = r[i * step] + g[i * step] + b[i * step];
+        if(colorChannel == FITSImage::AVERAGE_RGB)
+            total = (r[i * step] + g[i * step] + b[i * step]) / 3.0;
+        dest[i] = static_cast<T>(total);
+    }
+}
 
-        if(m_ActiveParameters.saturationLimit > 0.0 && m_ActiveParameters.saturationLimit < 100.0)
-        {
-            double maxSizeofDataType;
-            if(m_Statistics.dataType == TSHORT || m_Statistics.dataType == TLONG || m_Statistics.dataType == TLONGLONG)
-                maxSizeofDataType = pow(2, m_Statistics.bytesPerPixel * 8) / 2 - 1;
-            else if(m_Statistics.dataType == TUSHORT || m_Statistics.dataType == TULONG)
-                maxSizeofDataType = pow(2, m_Statistics.bytesPerPixel * 8) - 1;
-            else // Float and Double Images saturation level is not so easy to determine, especially since they were probably processed by another program and the saturation level is now changed.
-                maxSizeofDataType = -1;
+// The fewest rows of the prepared frame worth a thread of their own
+static const int MIN_THREAD_ROWS = 64;
 
-            if(maxSizeofDataType == -1)
-            {
-                emit logOutput("Skipping Saturation filter");
-            }
-            else
+// This merges the channels, bins the pixels and converts them to float in one pass over the image, for prepareFrame.
+// Each row of the result comes from d rows of each channel, which are converted to float and added up a whole row at a time,
+// so that the conversion and the sums are vectorized, and then every d pixels of the sum are added up into one.
+template <typename T>
+struct BinningKernel
+{
+    T const * source;       // The first channel to use
+    size_t channelSize;     // The distance from one channel to the next
+    int numChannels;        // 3 to merge the channels, otherwise 1
+    int width;              // The number of pixels of each source row to bin
+    int stride;             // The distance from one row of the image to the next
+    int pixelStride;        // The distance from one pixel of a channel to the next
+    int d;                  // The factor to bin by in both dimensions
+    float scale;            // What the sum of a bin gets multiplied by
+    float * dest;           // The binned image
+    int destWidth;          // and its width
+    const CalibrationFrames * calibration;  // The masters to calibrate the pixels with before they are binned, or nullptr
+    int calibrationX;       // The pixel of the masters under the first pixel of source
+    int calibrationY;
+
+    // This makes the rows firstRow to lastRow - 1 of the binned image
+    void run(int firstRow, int lastRow) const
+    {
+        std::vector<float> row(width), sum(width);
+        for (int y = firstRow; y < lastRow; y++)
+        {
+            std::fill(sum.begin(), sum.end(), 0.0f);
+            for (int y2 = 0; y2 < d; y2++)
             {
-                emit logOutput(QString("Removing the saturated stars with peak values greater than %1 Percent of %2").arg(
-                                   m_ActiveParameters.saturationLimit).arg(maxSizeofDataType));
-                starList.erase(std::remove_if(starList.begin(), starList.end(), [&](FITSImage::Star & oneStar)
+                for (int c = 0; c < numChannels; c++)
                 {
-                    return (oneStar.peak > (m_ActiveParameters.saturationLimit / 100.0) * maxSizeofDataType);
-                }), starList.end());
+                    T const * in = source + c * channelSize + static_cast<size_t>(y * d + y2) * stride;
+                    if (calibration)
+                        convertCalibrated(in, row.data(), width, pixelStride, calibration->offset(calibrationX, calibrationY + y * d + y2),
+                                          calibration->gain(calibrationX, calibrationY + y * d + y2));
+                    else
+                        convertToFloat(in, row.data(), width, pixelStride);
+                    for (int x = 0; x < width; x++)
+                        sum[x] += row[x];
+                }
             }
-        }
 
-        if(m_ActiveParameters.resort && m_ActiveParameters.keepNum > 0)
-        {
-            emit logOutput(QString("Keeping just the %1 brightest stars").arg(m_ActiveParameters.keepNum));
-            int numToRemove = starList.size() - m_ActiveParameters.keepNum;
-            if(numToRemove > 1)
+            float * out = dest + static_cast<size_t>(y) * destWidth;
+            if (d == 1)
             {
-                for(int i = 0; i < numToRemove; i++)
-                    starList.removeLast();
+                for (int x = 0; x < destWidth; x++)
+                    out[x] = sum[x] * scale;
+                continue;
+            }
+            for (int x = 0; x < destWidth; x++)
+            {
+                float total = 0;
+                for (int x2 = 0; x2 < d; x2++)
+                    total += sum[x * d + x2];
+                out[x] = total * scale;
             }
         }
-        emit logOutput(QString("Stars Found after Filtering: %1").arg(starList.size()));
     }
+};
+
+// This sets up a BinningKernel for the whole image, merging the channels if they are averaged or integrated,
+// otherwise binning the channel to use.  The caller sets where the result goes.
+template <typename T>
+static BinningKernel<T> makeBinningKernel(const FITSImage::Statistic &stats, const FITSImage::ImageView &view, int colorChannel,
+        const uint8_t *image, int d)
+{
+    const bool merge = stats.channels == 3 && (colorChannel == FITSImage::AVERAGE_RGB || colorChannel == FITSImage::INTEGRATED_RGB);
+    const int channel = (stats.channels < 3 || merge) ? 0 : colorChannel;
+
+    BinningKernel<T> kernel;
+    kernel.source = reinterpret_cast<T const *>(image) + static_cast<size_t>(view.channelStride) * channel;
+    kernel.channelSize = view.channelStride;
+    kernel.numChannels = merge ? 3 : 1;
+    kernel.width = stats.width;
+    kernel.stride = view.rowStride;
+    kernel.pixelStride = view.interleaved ? stats.channels : 1;
+    kernel.d = d;
+    //The average of the d x d pixels, of the channels too unless they are integrated
+    kernel.scale = 1.0f / (d * d) / ((merge && colorChannel == FITSImage::AVERAGE_RGB) ? 3 : 1);
+    kernel.dest = nullptr;
+    kernel.destWidth = stats.width / d;
+    kernel.calibration = nullptr;
+    kernel.calibrationX = stats.xOffset;
+    kernel.calibrationY = stats.yOffset;
+    return kernel;
 }
 
+// This runs a BinningKernel for the rows 0 to rows - 1 of its result.  The rows are independent, so they are split between the threads,
+// which are started with the task runner of this thread like SEP's.
 template <typename T>
-bool InternalExtractorSolver::getFloatBuffer(float * buffer, int x, int y, int w, int h)
+static void runBinningKernel(const BinningKernel<T> &kernel, int rows, int maxThreads)
 {
-    int channelShift = (m_Statistics.channels < 3 || usingDownsampledImage
-                        || usingMergedChannelImage) ? 0 : ( m_Statistics.samples_per_channel * m_Statistics.bytesPerPixel * m_ColorChannel );
-    auto * rawBuffer = reinterpret_cast<T const *>(m_ImageBuffer + channelShift);
-    float * floatPtr = buffer;
+    const int numThreads = std::max(1, std::min(maxThreads, rows / MIN_THREAD_ROWS));
+    sep_parallel_for(numThreads, numThreads, [&kernel, rows, numThreads](int piece)
+    {
+        kernel.run(rows * piece / numThreads, rows * (piece + 1) / numThreads);
+    });
+}
 
-    int x2 = x + w;
-    int y2 = y + h;
+template <typename T>
+static void masterToFloat(uint8_t const * master, float * out, size_t n)
+{
+    convertToFloat(reinterpret_cast<T const *>(master), out, n);
+}
 
-    for (int y1 = y; y1 < y2; y1++)
+QSharedPointer<const SharedField> SharedField::create(const QList<FITSImage::Star> &stars)
+{
+    if (stars.isEmpty())
+        return QSharedPointer<const SharedField>();
+    QSharedPointer<SharedField> shared(new SharedField());
+    shared->m_Stars = stars;
+    shared->m_X.resize(stars.size());
+    shared->m_Y.resize(stars.size());
+    for (int i = 0; i < stars.size(); i++)
     {
-        int offset = y1 * m_Statistics.width;
-        for (int x1 = x; x1 < x2; x1++)
-        {
-            *floatPtr++ = rawBuffer[offset + x1];
-        }
+        shared->m_X[i] = stars.at(i).x;
+        shared->m_Y[i] = stars.at(i).y;
     }
+    memset(&shared->m_Field, 0, sizeof(starxy_t));
+    shared->m_Field.x = shared->m_X.data();
+    shared->m_Field.y = shared->m_Y.data();
+    shared->m_Field.N = stars.size();
+    shared->m_VerifyField = verify_field_preprocess(&shared->m_Field);
+    if (!shared->m_VerifyField)
+        return QSharedPointer<const SharedField>();
+    return shared;
+}
 
-    return true;
+SharedField::~SharedField()
+{
+    verify_field_free(m_VerifyField);
 }
 
-bool InternalExtractorSolver::downsampleImage(int d)
+QSharedPointer<const CalibrationFrames> CalibrationFrames::create(const FITSImage::Statistic &masterstats, uint8_t const *bias,
+        uint8_t const *dark, uint8_t const *flat, double darkScale)
 {
-    switch (m_Statistics.dataType)
+    void (*toFloat)(uint8_t const *, float *, size_t) = nullptr;
+    switch (masterstats.dataType)
     {
         case SEP_TBYTE:
-            return downSampleImageType<uint8_t>(d);
+            toFloat = &masterToFloat<uint8_t>;
+            break;
         case TSHORT:
-            return downSampleImageType<int16_t>(d);
+            toFloat = &masterToFloat<int16_t>;
+            break;
         case TUSHORT:
-            return downSampleImageType<uint16_t>(d);
+            toFloat = &masterToFloat<uint16_t>;
+            break;
         case TLONG:
-            return downSampleImageType<int32_t>(d);
+            toFloat = &masterToFloat<int32_t>;
+            break;
         case TULONG:
-            return downSampleImageType<uint32_t>(d);
+            toFloat = &masterToFloat<uint32_t>;
+            break;
         case TFLOAT:
-            return downSampleImageType<float>(d);
+            toFloat = &masterToFloat<float>;
+            break;
         case TDOUBLE:
-            return downSampleImageType<double>(d);
+            toFloat = &masterToFloat<double>;
+            break;
         default:
-            return false;
+            break;
+    }
+    if (!toFloat || masterstats.channels != 1 || masterstats.width == 0 || masterstats.height == 0 || (!bias && !dark && !flat))
+        return QSharedPointer<const CalibrationFrames>();
+
+    QSharedPointer<CalibrationFrames> calibration(new CalibrationFrames());
+    calibration->m_Width = masterstats.width;
+    calibration->m_Height = masterstats.height;
+    const size_t n = static_cast<size_t>(masterstats.width) * masterstats.height;
+    std::vector<float> biasPixels(n, 0.0f), pixels(n);
+    if (bias)
+        toFloat(bias, biasPixels.data(), n);
+
+    // Only the thermal signal of the dark scales with the exposure, so its bias is taken off before it is scaled
+    calibration->m_Offset = biasPixels;
+    if (dark)
+    {
+        toFloat(dark, pixels.data(), n);
+        for (size_t i = 0; i < n; i++)
+            calibration->m_Offset[i] += static_cast<float>(darkScale * (pixels[i] - biasPixels[i]));
     }
-}
-
-template <typename T>
-bool InternalExtractorSolver::downSampleImageType(int d)
-{
-    int w = m_Statistics.width;
-    int h = m_Statistics.height;
-    int oldBufferSize = m_Statistics.samples_per_channel * m_Statistics.bytesPerPixel;
-    //It is d times smaller in width and height
-    int newBufferSize = oldBufferSize / (d * d);
-    if(downSampledBuffer)
-        delete [] downSampledBuffer;
-    downSampledBuffer = new uint8_t[newBufferSize];
-    int channelShift = ( m_Statistics.channels < 3
-                         || usingMergedChannelImage) ? 0 : ( m_Statistics.samples_per_channel * m_Statistics.bytesPerPixel * m_ColorChannel );
-    auto * sourceBuffer = reinterpret_cast<T const *>(m_ImageBuffer + channelShift);
-    auto * destinationBuffer = reinterpret_cast<T *>(downSampledBuffer);
 
-    for(int y = 0; y < h - d; y += d)
+    // The flat is normalized to its mean, and its dead pixels, which have no signal, are left as they are
+    calibration->m_Gain.assign(n, 1.0f);
+    if (flat)
     {
-        for (int x = 0; x < w - d; x += d)
+        toFloat(flat, pixels.data(), n);
+        double sum = 0;
+        size_t count = 0;
+        for (size_t i = 0; i < n; i++)
         {
-            //The sum of all the pixels in the sample
-            double total = 0;
-
-            for(int y2 = 0; y2 < d; y2++)
+            pixels[i] -= biasPixels[i];
+            if (pixels[i] > 0)
             {
-                //The offset for the current line of the sample to take, since we have to sample different rows
-                int currentLine = w * y2;
-
-                auto *sample = sourceBuffer + currentLine + x;
-                for(int x2 = 0; x2 < d; x2++)
-                {
-                    //This iterates the sample x2 spots to the right,
-                    total += *sample++;
-                }
+                sum += pixels[i];
+                count++;
             }
-            //This calculates the average pixel value and puts it in the new downsampled image.
-            int pixel = (x / d) + (y / d) * (w / d);
-            destinationBuffer[pixel] = total / (d * d);
         }
-        //Shifts the pointer by a whole line, d times
-        sourceBuffer += w * d;
+        const float mean = count > 0 ? static_cast<float>(sum / count) : 1.0f;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (pixels[i] > 0)
+                calibration->m_Gain[i] = mean / pixels[i];
+        }
     }
+    return calibration;
+}
 
-    m_ImageBuffer = downSampledBuffer;
-    m_Statistics.samples_per_channel /= (d * d);
-    m_Statistics.width /= d;
-    m_Statistics.height /= d;
-    if(scaleunit == ARCSEC_PER_PIX)
+template <typename T>
+bool InternalExtractorSolver::getFloatBuffer(float * buffer, int x, int y, int w, int h)
+{
+    if (buffer == nullptr)
+        return false;
+
+    // The prepared frame is already float and packed, see prepareFrame
+    if (m_PreparedFrame)
     {
-        scalelo *= d;
-        scalehi *= d;
+        rectToFloat(reinterpret_cast<T const *>(m_PreparedFrame), m_Statistics.width, 1, buffer, x, y, w, h);
+        return true;
     }
-    usingDownsampledImage = true;
+
+    size_t channelShift = (m_Statistics.channels < 3 || usingDownsampledImage
+                           || usingMergedChannelImage) ? 0 : static_cast<size_t>(m_ImageView.channelStride) * m_Statistics.bytesPerPixel * m_ColorChannel;
+    auto * rawBuffer = reinterpret_cast<T const *>(m_ImageBuffer + channelShift);
+    rectToFloat(rawBuffer, m_ImageView.rowStride, pixelStride(), buffer, x, y, w, h, calibration(), m_Statistics.xOffset,
+                m_Statistics.yOffset);
     return true;
 }
 
-bool InternalExtractorSolver::mergeImageChannels()
+template <typename T>
+bool InternalExtractorSolver::getStreamedFloatBuffer(float * buffer, int x, int y, int w, int h)
 {
-    switch (m_Statistics.dataType)
+    if (buffer == nullptr || !m_RowReader)
+        return false;
+
+    // Only the rows y to y + h are read, they are merged in the buffer of the first channel if the channels are merged
+    const bool merge = m_Statistics.channels == 3 && (m_ColorChannel == FITSImage::AVERAGE_RGB || m_ColorChannel == FITSImage::INTEGRATED_RGB);
+    const int channel = (m_Statistics.channels < 3 || merge) ? 0 : m_ColorChannel;
+    const size_t rowsSize = static_cast<size_t>(m_Statistics.width) * h;
+    const int numChannels = merge ? 3 : 1;
+    if (m_StreamBuffer.size() < rowsSize * sizeof(T) * numChannels)
+        m_StreamBuffer.resize(rowsSize * sizeof(T) * numChannels);
+
+    for (int c = 0; c < numChannels; c++)
     {
-        case SEP_TBYTE:
-            return mergeImageChannelsType<uint8_t>();
-        case TSHORT:
-            return mergeImageChannelsType<int16_t>();
-        case TUSHORT:
-            return mergeImageChannelsType<uint16_t>();
-        case TLONG:
-            return mergeImageChannelsType<int32_t>();
-        case TULONG:
-            return mergeImageChannelsType<uint32_t>();
-        case TFLOAT:
-            return mergeImageChannelsType<float>();
-        case TDOUBLE:
-            return mergeImageChannelsType<double>();
-        default:
+        if (!m_RowReader(merge ? c : channel, y, h, m_StreamBuffer.data() + rowsSize * sizeof(T) * c))
             return false;
     }
 
+    T * rows = reinterpret_cast<T *>(m_StreamBuffer.data());
+    if (merge)
+        mergeChannels(rows, rows + rowsSize, rows + 2 * rowsSize, rows, rowsSize, m_ColorChannel);
+    rectToFloat(static_cast<T const *>(rows), m_Statistics.width, 1, buffer, x, 0, w, h, calibration(), m_Statistics.xOffset,
+                m_Statistics.yOffset + y);
+    return true;
+}
+
+float *InternalExtractorSolver::floatBuffer(size_t size)
+{
+    return m_FloatBuffers->partition(size);
+}
+
+float *ExtractionBuffers::get(std::unique_ptr<float[]> &buffer, size_t &bufferSize, size_t size)
+{
+    if (size > bufferSize)
+    {
+        buffer.reset(new float[size]);
+        bufferSize = size;
+    }
+    return buffer.get();
+}
+
+bool InternalExtractorSolver::prepareFrame(int d)
+{
+    StageTimer timer(m_StageTimes.prepare);
+    return m_FrameKernels.prepareFrame && (this->*m_FrameKernels.prepareFrame)(d);
 }
 
 template <typename T>
-bool InternalExtractorSolver::mergeImageChannelsType()
+bool InternalExtractorSolver::prepareFrameType(int d)
 {
-    if(m_Statistics.channels != 3)
-        return false;
-    if(m_ColorChannel != FITSImage::INTEGRATED_RGB && m_ColorChannel != FITSImage::AVERAGE_RGB)
+    //It is d times smaller in width and height, the pixels left over on the right and bottom are dropped
+    const int outW = m_Statistics.width / d;
+    const int outH = m_Statistics.height / d;
+    if (outW == 0 || outH == 0)
         return false;
 
-    auto w = m_Statistics.width;
-    auto h = m_Statistics.height;
-    auto nextChannel = m_Statistics.samples_per_channel;
-    auto channelSize = m_Statistics.samples_per_channel * m_Statistics.bytesPerPixel;
+    BinningKernel<T> kernel = makeBinningKernel<T>(m_Statistics, m_ImageView, m_ColorChannel, m_ImageBuffer, d);
+    kernel.calibration = calibration();
+    kernel.dest = m_FloatBuffers->frame(static_cast<size_t>(outW) * outH);
+    runBinningKernel(kernel, outH, static_cast<int>(m_PartitionThreads));
+    rejectHotPixels(kernel.dest, outW, outH, m_ActiveParameters.hotPixelRejection);
+
+    m_PreparedFrame = kernel.dest;
+    usingMergedChannelImage = kernel.numChannels == 3;
+    if (d > 1)
+        useDownsampledImage(d);
+    return true;
+}
+
+//From now on the image is d times smaller for the solver, as it was for the star extraction
+void InternalExtractorSolver::useDownsampledImage(int d)
+{
+    const int outW = m_Statistics.width / d;
+    const int outH = m_Statistics.height / d;
+    m_Statistics.samples_per_channel = static_cast<uint32_t>(outW) * outH;
+    m_Statistics.width = outW;
+    m_Statistics.height = outH;
+    if(scaleunit == ARCSEC_PER_PIX)
+    {
+        scalelo *= d;
+        scalehi *= d;
+    }
+    usingDownsampledImage = true;
+}
+
+void InternalExtractorSolver::setExtractedStars(const QList<FITSImage::Star> &stars, int downsample)
+{
+    m_ExtractedStars = stars;
+    m_HasExtracted = true;
+    if(downsample > 1)
+        useDownsampledImage(downsample);
+}
+
+template <typename T>
+bool InternalExtractorSolver::getBinnedBuffer(float * buffer, int x, int y, int w, int h)
+{
+    const int d = m_ViewBinning;
+    BinningKernel<T> kernel = makeBinningKernel<T>(m_Statistics, m_ImageView, m_ColorChannel, m_ImageBuffer, d);
+    //Only the d x d blocks under the rectangle are read
+    kernel.source += static_cast<size_t>(y) * d * kernel.stride + static_cast<size_t>(x) * d * kernel.pixelStride;
+    kernel.calibration = calibration();
+    kernel.calibrationX += x * d;
+    kernel.calibrationY += y * d;
+    kernel.width = w * d;
+    kernel.dest = buffer;
+    kernel.destWidth = w;
+    runBinningKernel(kernel, h, static_cast<int>(m_PartitionThreads));
+    return true;
+}
 
-    if(mergedChannelBuffer)
-        delete [] mergedChannelBuffer;
+FITSImage::ImageView InternalExtractorSolver::resolveImageView(const FITSImage::Statistic &stats, const FITSImage::ImageView &view)
+{
+    FITSImage::ImageView resolved = view;
+    if(resolved.rowStride == 0)
+        resolved.rowStride = view.interleaved ? static_cast<uint32_t>(stats.width) * stats.channels : stats.width;
+    if(resolved.channelStride == 0)
+        resolved.channelStride = view.interleaved ? 1 : resolved.rowStride * stats.height;
+    return resolved;
+}
 
-    mergedChannelBuffer = new uint8_t[channelSize];
-    auto * source = reinterpret_cast<T const *>(m_ImageBuffer);
-    auto * dest = reinterpret_cast<T *>(mergedChannelBuffer);
+bool InternalExtractorSolver::isPackedView(const FITSImage::Statistic &stats, const FITSImage::ImageView &view)
+{
+    if(view.rowStride != stats.width)
+        return false;
+    return stats.channels == 1 || (!view.interleaved && view.channelStride == stats.samples_per_channel);
+}
 
-    for(int y = 0; y < h; y++)
+void InternalExtractorSolver::packImage(const FITSImage::Statistic &stats, const FITSImage::ImageView &view, const uint8_t *image,
+                                        std::vector<uint8_t> &packed)
+{
+    const size_t bytes = stats.bytesPerPixel;
+    const size_t pixelStride = view.interleaved ? stats.channels : 1;
+    const size_t rowBytes = static_cast<size_t>(stats.width) * bytes;
+    packed.resize(rowBytes * stats.height * stats.channels);
+    uint8_t *out = packed.data();
+    for(int c = 0; c < stats.channels; c++)
     {
-        for (int x = 0; x < w; x++)
+        for(int y = 0; y < stats.height; y++, out += rowBytes)
         {
-            double total  = 0;
-            int r = x + y * w;
-            int g = x + y * w + nextChannel;
-            int b = x + y * w + nextChannel * 2;
-            if(m_ColorChannel == FITSImage::INTEGRATED_RGB)
-                total = source[r] + source[g] + source[b];
-            if(m_ColorChannel == FITSImage::AVERAGE_RGB)
-                total = (source[r] + source[g] + source[b]) / 3.0;
-            dest[ x + y * w ] = static_cast<T>(total);
+            const uint8_t *row = image + (static_cast<size_t>(c) * view.channelStride + static_cast<size_t>(y) * view.rowStride) * bytes;
+            if(pixelStride == 1)
+                memcpy(out, row, rowBytes);
+            else
+                for(int x = 0; x < stats.width; x++)
+                    memcpy(out + x * bytes, row + x * pixelStride * bytes, bytes);
         }
     }
-
-    m_ImageBuffer = mergedChannelBuffer;
-    usingMergedChannelImage = true;
-    return true;
 }
 
 //This method prepares the job file.  It is based upon the methods parse_job_from_qfits_header and engine_read_job_file in engine.c of astrometry.net
@@ -1033,8 +3253,10 @@ bool InternalExtractorSolver::prepare_job()
 
     //These set the default tweak settings
     sp->do_tweak = TRUE;
-    sp->tweak_aborder = 2;
-    sp->tweak_abporder = 2;
+    sp->tweak_aborder = m_TweakOrder;
+    sp->tweak_abporder = m_TweakOrder;
+    sp->tweak_timelimit = m_ActiveParameters.tweak_time_limit / 1000.0;
+    sp->tweak_min_improvement = m_ActiveParameters.tweak_min_improvement;
 
     if (m_UseScale)
     {
@@ -1073,14 +3295,14 @@ bool InternalExtractorSolver::prepare_job()
 
         if(scaleunit == ARCMIN_WIDTH || scaleunit == DEG_WIDTH || scaleunit == FOCAL_MM)
         {
-            if(m_ActiveParameters.downsample == 1)
+            if(!usingDownsampledImage)
                 emit logOutput(QString("Image width %1 pixels; arcsec per pixel range: %2 to %3").arg (m_Statistics.width).arg (appl).arg (
                                    appu));
             else
                 emit logOutput(QString("Image width: %1 pixels, Downsampled Image width: %2 pixels; arcsec per pixel range: %3 to %4").arg(
                                    m_Statistics.width * m_ActiveParameters.downsample).arg (m_Statistics.width).arg (appl).arg (appu));
         }
-        if(m_ActiveParameters.downsample != 1 && scaleunit == ARCSEC_PER_PIX)
+        if(usingDownsampledImage && scaleunit == ARCSEC_PER_PIX)
             emit logOutput(QString("Downsampling is multiplying the pixel scale by: %1").arg(m_ActiveParameters.downsample));
     }
 
@@ -1090,15 +3312,162 @@ bool InternalExtractorSolver::prepare_job()
     return true;
 }
 
+// A WCSLIB WCS can't be handed to astrometry, and the prior may be for other pixels than the ones solved, so a TAN WCS is fit to it
+// over a grid of points.  The verification and the tweak of the solution correct the small differences this makes.
+bool InternalExtractorSolver::priorAsSIP(sip_t &sip)
+{
+    const int d = usingDownsampledImage ? m_ActiveParameters.downsample : 1;
+    const int n = 5;
+    double xyz[n * n * 3];
+    double xy[n * n * 2];
+    int count = 0;
+    for(int j = 0; j < n; j++)
+    {
+        for(int i = 0; i < n; i++)
+        {
+            const double x = m_Statistics.width * (i + 0.5) / n;
+            const double y = m_Statistics.height * (j + 0.5) / n;
+            FITSImage::wcs_point sky;
+            if(!m_PriorWCS.pixelToWCS(QPointF(x * d, y * d), sky))
+                continue;
+            radecdeg2xyzarr(sky.ra, sky.dec, xyz + 3 * count);
+            xy[2 * count] = x;
+            xy[2 * count + 1] = y;
+            count++;
+        }
+    }
+    tan_t tan;
+    memset(&tan, 0, sizeof(tan_t));
+    if(count < 3 || fit_tan_wcs(xyz, xy, count, &tan, nullptr))
+        return false;
+    tan.imagew = m_Statistics.width;
+    tan.imageh = m_Statistics.height;
+    sip_wrap_tan(&tan, &sip);
+    return true;
+}
+
+// The cache keeps its solutions in the pixels of the full resolution image, so they are scaled to the pixels being solved and back
+bool InternalExtractorSolver::hasCachedSolution()
+{
+    SolutionCache::TanWCS cached;
+    const int d = usingDownsampledImage ? m_ActiveParameters.downsample : 1;
+    return m_SolutionCache && m_SolutionCache->lookup(m_ExtractedStars, m_Statistics.width * d, m_Statistics.height * d, cached);
+}
+
+bool InternalExtractorSolver::cachedAsSIP(sip_t &sip)
+{
+    SolutionCache::TanWCS cached;
+    const int d = usingDownsampledImage ? m_ActiveParameters.downsample : 1;
+    if(!m_SolutionCache || isChildSolver
+            || !m_SolutionCache->lookup(m_ExtractedStars, m_Statistics.width * d, m_Statistics.height * d, cached))
+        return false;
+    tan_t tan;
+    memset(&tan, 0, sizeof(tan_t));
+    for(int i = 0; i < 2; i++)
+    {
+        tan.crval[i] = cached.crval[i];
+        tan.crpix[i] = cached.crpix[i] / d;
+        for(int j = 0; j < 2; j++)
+            tan.cd[i][j] = cached.cd[i][j] * d;
+    }
+    tan.imagew = m_Statistics.width;
+    tan.imageh = m_Statistics.height;
+    sip_wrap_tan(&tan, &sip);
+    return true;
+}
+
+void InternalExtractorSolver::rememberSolution(const sip_t &solution)
+{
+    if(!m_SolutionCache)
+        return;
+    SolutionCache::TanWCS tan;
+    const int d = usingDownsampledImage ? m_ActiveParameters.downsample : 1;
+    for(int i = 0; i < 2; i++)
+    {
+        tan.crval[i] = solution.wcstan.crval[i];
+        tan.crpix[i] = solution.wcstan.crpix[i] * d;
+        for(int j = 0; j < 2; j++)
+            tan.cd[i][j] = solution.wcstan.cd[i][j] / d;
+    }
+    tan.imagew = m_Statistics.width * d;
+    tan.imageh = m_Statistics.height * d;
+    m_SolutionCache->insert(m_ExtractedStars, tan);
+}
+
 //This method was adapted from the main method in engine-main.c in astrometry.net
+// The fewest stars in the center of the field that are worth solving on their own
+static const int MIN_CENTER_STARS = 20;
+
+int InternalExtractorSolver::runCenterFirstSolve()
+{
+    const double fraction = qMin(m_ActiveParameters.center_first_fraction, 1.0);
+    const QRectF center(m_Statistics.width * (1 - fraction) / 2, m_Statistics.height * (1 - fraction) / 2,
+                        m_Statistics.width * fraction, m_Statistics.height * fraction);
+    const QList<FITSImage::Star> allStars = m_ExtractedStars;
+    QList<FITSImage::Star> centerStars;
+    for(const FITSImage::Star &star : allStars)
+    {
+        if(center.contains(star.x, star.y))
+            centerStars.append(star);
+    }
+    if(centerStars.size() < MIN_CENTER_STARS || centerStars.size() == allStars.size())
+        return runInternalSolver();
+
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Searching for quads among the %1 stars in the central %2% of the field").arg(centerStars.size()).arg(
+                           qRound(fraction * 100)));
+    m_ExtractedStars = centerStars;
+    int result = runInternalSolver();
+    m_ExtractedStars = allStars;
+    if(result != 0)
+    {
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput("The center of the field did not solve, so the quads are searched among all of the stars");
+        return runInternalSolver();
+    }
+
+    // The solution of the center is verified with all of the stars, so only the tweak extends it to the edges
+    const sip_t centerWCS = wcs;
+    const FITSImage::Solution centerSolution = m_Solution;
+    const short centerIndex = solutionIndexNumber, centerHealpix = solutionHealpix;
+    const double centerLogOdds = solutionLogOdds;
+    setPriorWCS(getWCSData(), true);
+    m_TweakOrder = qMax(2, m_ActiveParameters.center_first_tweak_order);
+    m_HasSolved = false;
+    result = runInternalSolver();
+    m_HasPriorWCS = false;
+    m_PriorOnly = false;
+    m_TweakOrder = 2;
+    if(result != 0)
+    {
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput("All of the stars did not verify the solution of the center, so it is kept");
+        wcs = centerWCS;
+        m_Solution = centerSolution;
+        solutionIndexNumber = centerIndex;
+        solutionHealpix = centerHealpix;
+        solutionLogOdds = centerLogOdds;
+        m_HasWCS = true;
+        m_HasSolved = true;
+    }
+    return 0;
+}
+
 int InternalExtractorSolver::runInternalSolver()
 {
+    Tracer::Span span("runInternalSolver");
     if(!isChildSolver)
     {
         emit logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
         emit logOutput("Configuring StellarSolver");
     }
 
+    //The solve works in a slot of the thread pool if there is one.
+    //A pipelined solve doesn't take one, since it waits for the partitions of its extraction, which need the slots.
+    SolverThreadPool::Slot slot(m_Pipeline ? nullptr : threadPool.data(), urgency);
+    //This is before the indexes are loaded, so that a pinned child solver loads them in the memory of its own node
+    placeThread();
+
     //This creates and sets up the engine
     engine_t* engine = engine_new();
 
@@ -1106,6 +3475,7 @@ int InternalExtractorSolver::runInternalSolver()
     engine->inparallel = m_ActiveParameters.inParallel ? TRUE : FALSE;
     engine->minwidth = m_ActiveParameters.minwidth;
     engine->maxwidth = m_ActiveParameters.maxwidth;
+    engine->star_budget = m_ActiveParameters.indexStarBudget;
 
     log_init((log_level)m_AstrometryLogLevel);
 
@@ -1115,31 +3485,50 @@ int InternalExtractorSolver::runInternalSolver()
             logFile = fopen(m_LogFileName.toLatin1().constData(), "w");
         else
         {
-            if(!this->isChildSolver)
-            {
-                connect(&astroLogger, &AstrometryLogger::logOutput, this, &ExtractorSolver::logOutput);
-                setAstroLogger(&astroLogger);
-            }
+            //The child solvers log too, their log goes through the solver that made them
+            connect(&astroLogger, &AstrometryLogger::logOutput, this, &ExtractorSolver::logOutput, Qt::UniqueConnection);
+            setAstroLogger(&astroLogger);
         }
         if(logFile)
             log_to(logFile);
     }
-    for(const auto &onePath : indexFiles)
+    //A child solver of a parallel solve can be run again for another range, so the metrics are just for this run
+    m_Metrics.indexLoadMs = m_Metrics.searchMs = m_Metrics.verifyMs = m_Metrics.tweakMs = 0;
+    m_Metrics.quadsTried = m_Metrics.codesMatched = m_Metrics.verifications = 0;
+    m_Metrics.minorPageFaults = m_Metrics.majorPageFaults = 0;
+    m_Metrics.searchCounters = m_Metrics.verifyCounters = FITSImage::HardwareCounters();
+    m_Metrics.indexSearches.clear();
+    QElapsedTimer indexTimer;
+    indexTimer.start();
+
+    int numberOfIndexes = 0;
+    if(indexCatalog)
     {
-        engine_add_index(engine, onePath.toUtf8().data());
+        //The catalog keeps the indexes loaded between solves, so they only get loaded here the first time or when the index settings change.
+        //The indexes needed for this solve get added to the engine once the job's scales and position are set below.
+        numberOfIndexes = indexCatalog->acquire(indexFolderPaths, indexFiles);
     }
-    //These set the folders in which Astrometry.net will look for index files, based on the folers set before the solver was started.
-    for(const auto &onePath : indexFolderPaths)
+    else
     {
-        engine_add_search_path(engine, onePath.toLatin1().constData());
-    }
+        for(const auto &onePath : indexFiles)
+        {
+            engine_add_index(engine, onePath.toUtf8().data());
+        }
+        //These set the folders in which Astrometry.net will look for index files, based on the folers set before the solver was started.
+        for(const auto &onePath : indexFolderPaths)
+        {
+            engine_add_search_path(engine, onePath.toLatin1().constData());
+        }
 
-    //This actually adds the index files in the directories above.
-    if(indexFolderPaths.count() > 0)
-        engine_autoindex_search_paths(engine);
+        //This actually adds the index files in the directories above.
+        if(indexFolderPaths.count() > 0)
+            engine_autoindex_search_paths(engine);
+        numberOfIndexes = pl_size(engine->indexes);
+    }
+    qint64 indexLoadNs = indexTimer.nsecsElapsed();
 
     //This checks to see that index files were found in the paths above, if not, it prints this warning and aborts.
-    if (!pl_size(engine->indexes))
+    if (!numberOfIndexes)
     {
         emit logOutput(QString("\n\n"
                                "---------------------------------------------------------------------\n"
@@ -1149,32 +3538,103 @@ int InternalExtractorSolver::runInternalSolver()
                                "\n"));
         engine_free(engine);
         engine = nullptr;
+        if(indexCatalog)
+        {
+            indexCatalog->release();
+            //This makes the catalog search for index files again next time, in case some get added to the folders.
+            indexCatalog->clear();
+        }
         return -1;
     }
 
     prepare_job();
 
     blind_t* bp = &(job->bp);
+    // The astrometry code reads the token with an atomic load of the int inside it
+    static_assert(sizeof(std::atomic<int>) == sizeof(int), "the cancel token must have the layout of an int");
+    bp->solver.cancel_token = reinterpret_cast<const int *>(m_CancelToken.data());
+    bp->solver.refcatalog = m_ReferenceCatalog ? m_ReferenceCatalog->catalog() : nullptr;
+    bp->solver.float_search = m_ActiveParameters.floatQuadSearch;
+    bp->solver.bright_pass_stars = std::max(0, m_ActiveParameters.brightPassStars);
+    if(m_ActiveParameters.useGPU && OpenCLCodeMatcher::instance().isAvailable())
+    {
+        emit logOutput(OpenCLCodeMatcher::instance().description());
+        bp->solver.code_matcher = &OpenCLCodeMatcher::match;
+        bp->solver.code_matcher_data = &OpenCLCodeMatcher::instance();
+    }
+    //A solve that isn't split among child solvers has the other threads to verify the matches of its quads at the same time
+    if(!isChildSolver && m_ActiveParameters.multiAlgorithm == NOT_MULTI)
+    {
+        m_MatchVerifier.reset(new MatchVerifier(threadPool.data(), urgency));
+        bp->solver.verify_runner = &MatchVerifier::run;
+        bp->solver.verify_runner_data = m_MatchVerifier.get();
+        bp->solver.verify_workers = threadPool ? threadPool->maxThreads() : QThread::idealThreadCount();
+    }
+    bp->index_callback = &InternalExtractorSolver::recordIndexSearch;
+    bp->index_userdata = this;
+    if(isChildSolver && m_SharedBestLogOdds)
+    {
+        bp->solver.best_logodds_callback = &InternalExtractorSolver::updateBestLogOdds;
+        bp->solver.best_logodds_userdata = this;
+    }
 
     //This will set up the field file to solve as an xylist
-    double *xArray = new double[m_ExtractedStars.size()];
-    double *yArray = new double[m_ExtractedStars.size()];
-
-    int i = 0;
-    for(const auto &oneStar : m_ExtractedStars)
+    //A pipelined solve gets its field from growField before each depth range instead, since the stars are still being extracted
+    double *xArray = nullptr;
+    double *yArray = nullptr;
+    starxy_t* fieldToSolve = nullptr;
+    if(m_Pipeline)
+    {
+        bp->field_callback = &InternalExtractorSolver::growField;
+        bp->field_userdata = this;
+    }
+    else if(m_SharedField && m_SharedField->isFor(m_ExtractedStars))
+    {
+        //The field and its kdtree were made by the parent, see spawnChildSolver
+        bp->solver.fieldxy = m_SharedField->field();
+        bp->solver.shared_vf = m_SharedField->verifyField();
+    }
+    else
     {
-        xArray[i] = oneStar.x;
-        yArray[i] = oneStar.y;
-        i++;
+        xArray = new double[m_ExtractedStars.size()];
+        yArray = new double[m_ExtractedStars.size()];
+
+        int i = 0;
+        for(const auto &oneStar : m_ExtractedStars)
+        {
+            xArray[i] = oneStar.x;
+            yArray[i] = oneStar.y;
+            i++;
+        }
+
+        fieldToSolve = (starxy_t*)calloc(1, sizeof(starxy_t));
+        fieldToSolve->x = xArray;
+        fieldToSolve->y = yArray;
+        fieldToSolve->N = m_ExtractedStars.size();
+        fieldToSolve->flux = nullptr;
+        fieldToSolve->background = nullptr;
+        bp->solver.fieldxy = fieldToSolve;
     }
 
-    starxy_t* fieldToSolve = (starxy_t*)calloc(1, sizeof(starxy_t));
-    fieldToSolve->x = xArray;
-    fieldToSolve->y = yArray;
-    fieldToSolve->N = m_ExtractedStars.size();
-    fieldToSolve->flux = nullptr;
-    fieldToSolve->background = nullptr;
-    bp->solver.fieldxy = fieldToSolve;
+    //The prior WCS is verified by the engine before the first depth range, and solves the image without searching for quads if it still fits
+    sip_t prior;
+    if(m_HasPriorWCS && priorAsSIP(prior))
+    {
+        blind_add_verify_wcs(bp, &prior);
+        bp->verify_only = m_PriorOnly;
+        if(m_PriorOnly && !m_PriorTweak)
+            bp->solver.do_tweak = FALSE;
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(m_PriorOnly ? "Verifying the prior WCS without searching for quads" : "Verifying the prior WCS before searching for quads");
+    }
+    //Without a prior, the solution of the same star pattern seen before is verified the same way
+    else if(cachedAsSIP(prior))
+    {
+        blind_add_verify_wcs(bp, &prior);
+        bp->verify_only = m_PriorOnly;
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput("Verifying the cached solution of this star pattern before searching for quads");
+    }
 
     if(depthlo != -1 && depthhi != -1)
     {
@@ -1191,7 +3651,8 @@ int InternalExtractorSolver::runInternalSolver()
         }
         if (il_size(job->depths) == 0)
         {
-            if (engine->inparallel)
+            //A pipelined solve needs the depth ranges to start on the first stars
+            if (engine->inparallel && !m_Pipeline)
             {
                 // no limit.
                 il_append(job->depths, 0);
@@ -1206,6 +3667,9 @@ int InternalExtractorSolver::runInternalSolver()
     if (engine->minwidth <= 0.0 || engine->maxwidth <= 0.0 || engine->minwidth > engine->maxwidth)
     {
         emit logOutput(QString("\"minwidth\" and \"maxwidth\" must be positive and the maxwidth must be greater!\n"));
+        engine_free(engine);
+        if(indexCatalog)
+            indexCatalog->release();
         return -1;
     }
     ///This sets the scales based on the minwidth and maxwidth if the image scale isn't known
@@ -1218,10 +3682,24 @@ int InternalExtractorSolver::runInternalSolver()
         dl_append(job->scales, arcsecperpix);
     }
 
-    // These set the time limits for the solver
-    bp->timelimit = m_ActiveParameters.solverTimeLimit;
+    //This loads just the indexes from the catalog that can match the scale range and search position of this job
+    if(indexCatalog)
+    {
+        indexTimer.restart();
+        int added = indexCatalog->addIndexesTo(engine, job);
+        indexLoadNs += indexTimer.nsecsElapsed();
+        if(m_SSLogLevel == LOG_VERBOSE)
+            emit logOutput(QString("Using %1 index files for this scale range and search position").arg(added));
+    }
+    m_Metrics.indexLoadMs = indexLoadNs / 1e6;
+
+    // These set the time limits for the solver.  The solver checks the wall clock limit often enough for limits in milliseconds.
+    if(m_ActiveParameters.solverTimeLimitMS > 0)
+        bp->timelimit = m_ActiveParameters.solverTimeLimitMS / 1000.0;
+    else
+        bp->timelimit = m_ActiveParameters.solverTimeLimit;
 #ifndef _WIN32
-    bp->cpulimit = m_ActiveParameters.solverTimeLimit;
+    bp->cpulimit = bp->timelimit;
 #endif
 
     // If not running inparallel, set total limits = limits.
@@ -1235,22 +3713,62 @@ int InternalExtractorSolver::runInternalSolver()
                    " profile. . .");
 
     //This runs the job in the engine in the file engine.c
-    if (engine_run_job(engine, job))
-        emit logOutput("Failed to run job");
+    //The verifications can run on the threads of the verify runner, so their events are counted by the solver for each of them
+    const bool countHardware = m_CountHardwareEvents && PerfCounters::isAvailable();
+    uint64_t searchCounters[SSCOUNTERS_N] = {0};
+    uint64_t verifyCounters[SSCOUNTERS_N] = {0};
+    bp->solver.verify_counters = countHardware ? verifyCounters : nullptr;
+    int minorFaults, majorFaults;
+    threadPageFaults(minorFaults, majorFaults);
+    {
+        PerfCounters::Scope counters(searchCounters, countHardware);
+        if (engine_run_job(engine, job))
+            emit logOutput("Failed to run job");
+    }
+    int minorFaultsAfter, majorFaultsAfter;
+    threadPageFaults(minorFaultsAfter, majorFaultsAfter);
+    m_Metrics.minorPageFaults = minorFaultsAfter - minorFaults;
+    m_Metrics.majorPageFaults = majorFaultsAfter - majorFaults;
+    bp->solver.verify_counters = nullptr;
+    if (countHardware)
+    {
+        m_Metrics.hardwareCounted = true;
+        m_Metrics.searchCounters = PerfCounters::toCounters(searchCounters);
+        m_Metrics.verifyCounters = PerfCounters::toCounters(verifyCounters);
+    }
+
+    m_Metrics.searchMs = bp->search_time * 1000;
+    m_Metrics.verifyMs = bp->solver.verify_time * 1000;
+    m_Metrics.tweakMs = bp->solver.tweak_time * 1000;
+    m_Metrics.quadsTried = bp->total_quads_tried;
+    m_Metrics.codesMatched = bp->total_codes_matched;
+    m_Metrics.verifications = bp->total_verified;
+    m_Metrics.solverSimd = simdName(solver_simd(), SOLVER_SIMD_AVX2, SOLVER_SIMD_NEON);
 
     //Needs to close the file after the logging is done
     if(m_AstrometryLogLevel != SSolver::LOG_NONE && logFile)
         fclose(logFile);
-    if(m_AstrometryLogLevel != SSolver::LOG_NONE && !this->isChildSolver)
+    if(m_AstrometryLogLevel != SSolver::LOG_NONE && !m_LogToFile)
+    {
+        setAstroLogger(nullptr);
+        astroLogger.flush();
         disconnect(&astroLogger, &AstrometryLogger::logOutput, this, &ExtractorSolver::logOutput);
+    }
 
     //This deletes or frees the items that are no longer needed.
     engine_free(engine);
     engine = nullptr;
+    //The indexes stay loaded in the catalog for the next solve
+    if(indexCatalog)
+        indexCatalog->release();
     bl_free(job->scales);
     job->scales = nullptr;
     dl_free(job->depths);
     job->depths = nullptr;
+    if(m_Pipeline && bp->solver.fieldxy)
+        starxy_free(bp->solver.fieldxy);
+    bp->solver.fieldxy = nullptr;
+    bp->solver.shared_vf = nullptr;
     free(fieldToSolve);
     fieldToSolve = nullptr;
     delete[] xArray;
@@ -1323,7 +3841,9 @@ int InternalExtractorSolver::runInternalSolver()
         m_Solution = {fieldw, fieldh, ra, dec, orient, pixscale, parity, raErr, decErr};
         solutionIndexNumber = match.indexid;
         solutionHealpix = match.healpix;
+        solutionLogOdds = bp->solver.best_logodds;
         m_HasSolved = true;
+        rememberSolution(wcs);
         returnCode = 0;
     }
     else
@@ -1349,7 +3869,178 @@ int InternalExtractorSolver::runInternalSolver()
     return returnCode;
 }
 
+void InternalExtractorSolver::placeThread()
+{
+    if(!isChildSolver || m_ActiveParameters.threadPlacement == PLACE_ANYWHERE)
+        return;
+
+    // Only the cores of the thread pool can be used, if it has some
+    QVector<QVector<int>> nodes = SolverThreadPool::numaNodes();
+    if(threadPool && !threadPool->cores().isEmpty())
+    {
+        for(auto &cores : nodes)
+        {
+            cores.erase(std::remove_if(cores.begin(), cores.end(), [this](int core)
+            {
+                return !threadPool->cores().contains(core);
+            }), cores.end());
+        }
+        nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [](const QVector<int> &cores)
+        {
+            return cores.isEmpty();
+        }), nodes.end());
+    }
+    if(nodes.isEmpty())
+        return;
+
+    // The child solvers go to the nodes in turn, so that each node gets its share of them
+    const QVector<int> &node = nodes[m_ChildNumber % nodes.size()];
+    QVector<int> cores = node;
+    if(m_ActiveParameters.threadPlacement == PLACE_ON_CORES)
+        cores = QVector<int>() << node[(m_ChildNumber / nodes.size()) % node.size()];
+    SolverThreadPool::pinCurrentThread(cores);
+
+    if(m_SSLogLevel == LOG_VERBOSE)
+    {
+        QStringList coreList;
+        for(int core : cores)
+            coreList << QString::number(core);
+        emit logOutput(QString("Child Solver # %1 is pinned to the cores %2").arg(m_ChildNumber).arg(coreList.join(",")));
+    }
+}
+
 WCSData InternalExtractorSolver::getWCSData()
 {
-    return WCSData(wcs, m_ActiveParameters.downsample);
+    //With downsampleView the stars, and so the solution, are already in full resolution pixels
+    return WCSData(wcs, usingDownsampledImage ? m_ActiveParameters.downsample : 1);
+}
+
+// This copies a square tile of an image to float, for the coarse pass of estimateStars
+template <typename T>
+static void copyTile(const uint8_t *buffer, uint32_t width, uint32_t x, uint32_t y, uint32_t size, std::vector<float> &tile)
+{
+    const T *image = reinterpret_cast<const T *>(buffer);
+    for(uint32_t row = 0; row < size; row++)
+    {
+        const T *line = image + size_t(y + row) * width + x;
+        for(uint32_t column = 0; column < size; column++)
+            tile[row * size + column] = static_cast<float>(line[column]);
+    }
+}
+
+// This is how far from a peak along a line the pixels drop below half of it, interpolated between the pixels
+static double halfWidth(const std::vector<float> &tile, int size, int x, int y, int dx, int dy, float half)
+{
+    float previous = tile[y * size + x];
+    for(int step = 1; step <= 25; step++)
+    {
+        const int px = x + dx * step, py = y + dy * step;
+        if(px < 0 || py < 0 || px >= size || py >= size)
+            return -1;
+        const float value = tile[py * size + px];
+        if(value < half)
+            return step - 1 + (previous - half) / (previous - value);
+        previous = value;
+    }
+    return -1;
+}
+
+bool InternalExtractorSolver::estimateStars(const FITSImage::Statistic &stats, const uint8_t *buffer, double &fwhm, double &starsPerMegapixel)
+{
+    const uint32_t tileSize = 128;
+    const uint32_t tilesAcross = 4;
+    if(!buffer || stats.width < tileSize || stats.height < tileSize)
+        return false;
+
+    std::vector<float> tile(tileSize * tileSize), sorted;
+    std::vector<double> widths;
+    int peaks = 0, tiles = 0;
+    const double saturation = stats.max[0] > 0 ? 0.95 * stats.max[0] : std::numeric_limits<double>::max();
+    for(uint32_t ty = 0; ty < tilesAcross; ty++)
+    {
+        for(uint32_t tx = 0; tx < tilesAcross; tx++)
+        {
+            // The tiles are spread evenly over the image, they overlap on small images
+            const uint32_t x = (stats.width - tileSize) * (2 * tx + 1) / (2 * tilesAcross);
+            const uint32_t y = (stats.height - tileSize) * (2 * ty + 1) / (2 * tilesAcross);
+            switch (stats.dataType)
+            {
+                case SEP_TBYTE:
+                    copyTile<uint8_t>(buffer, stats.width, x, y, tileSize, tile);
+                    break;
+                case TSHORT:
+                    copyTile<int16_t>(buffer, stats.width, x, y, tileSize, tile);
+                    break;
+                case TUSHORT:
+                    copyTile<uint16_t>(buffer, stats.width, x, y, tileSize, tile);
+                    break;
+                case TLONG:
+                    copyTile<int32_t>(buffer, stats.width, x, y, tileSize, tile);
+                    break;
+                case TULONG:
+                    copyTile<uint32_t>(buffer, stats.width, x, y, tileSize, tile);
+                    break;
+                case TFLOAT:
+                    copyTile<float>(buffer, stats.width, x, y, tileSize, tile);
+                    break;
+                case TDOUBLE:
+                    copyTile<double>(buffer, stats.width, x, y, tileSize, tile);
+                    break;
+                default:
+                    return false;
+            }
+            tiles++;
+
+            // The background and its noise are the median and the median absolute deviation of the tile, which the stars hardly change
+            sorted = tile;
+            std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+            const float median = sorted[sorted.size() / 2];
+            for(float &value : sorted)
+                value = std::fabs(value - median);
+            std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+            const float sigma = qMax(1.4826f * sorted[sorted.size() / 2], 1e-6f);
+            const float threshold = median + 10 * sigma;
+
+            const int size = tileSize;
+            for(int py = 3; py < size - 3; py++)
+            {
+                for(int px = 3; px < size - 3; px++)
+                {
+                    const float peak = tile[py * size + px];
+                    if(peak < threshold || peak >= saturation)
+                        continue;
+                    // A peak is more than the pixels before it and at least as much as the ones after it, so a flat top counts once
+                    bool isPeak = true;
+                    for(int ny = -1; ny <= 1 && isPeak; ny++)
+                    {
+                        for(int nx = -1; nx <= 1; nx++)
+                        {
+                            const float neighbor = tile[(py + ny) * size + px + nx];
+                            const bool before = ny < 0 || (ny == 0 && nx < 0);
+                            if((ny || nx) && (before ? neighbor >= peak : neighbor > peak))
+                            {
+                                isPeak = false;
+                                break;
+                            }
+                        }
+                    }
+                    if(!isPeak)
+                        continue;
+                    peaks++;
+                    const float half = median + (peak - median) / 2;
+                    const double left = halfWidth(tile, size, px, py, -1, 0, half), right = halfWidth(tile, size, px, py, 1, 0, half);
+                    const double up = halfWidth(tile, size, px, py, 0, -1, half), down = halfWidth(tile, size, px, py, 0, 1, half);
+                    if(left >= 0 && right >= 0 && up >= 0 && down >= 0)
+                        widths.push_back((left + right + up + down) / 2);
+                }
+            }
+        }
+    }
+
+    if(widths.size() < 5)
+        return false;
+    std::nth_element(widths.begin(), widths.begin() + widths.size() / 2, widths.end());
+    fwhm = widths[widths.size() / 2];
+    starsPerMegapixel = peaks * 1e6 / (double(tiles) * tileSize * tileSize);
+    return true;
 }
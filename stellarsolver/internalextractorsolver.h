@@ -9,10 +9,13 @@
 
 #include "extractorsolver.h"
 #include "astrometrylogger.h"
+#include "solutioncache.h"
+#include "perfcounters.h"
 #include "qmutex.h"
 
 //SEP Includes
 #include "sep/sep.h"
+#include "sep/parallel.h"
 
 //Astrometry.net includes
 extern "C" {
@@ -20,9 +23,167 @@ extern "C" {
 }
 
 #include <QtConcurrent>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace SEP
+{
+struct sep_deblend_limits;
+}
+class StarSummary;
+class ReferenceCatalog;
+class MatchVerifier;
 
 using namespace SSolver;
 
+// These are the float images the star extraction works on.  They are kept so that extracting again does not allocate them again,
+// and StellarSolver hands them to the next InternalExtractorSolver, so that the next image of the same size doesn't either.
+class ExtractionBuffers
+{
+    public:
+        // The merged and downsampled image, see prepareFrame
+        float *frame(size_t size)
+        {
+            return get(m_Frame, m_FrameSize, size);
+        }
+        // The image of a partition, or the frame of the global background
+        float *partition(size_t size)
+        {
+            return get(m_Partition, m_PartitionSize, size);
+        }
+        // The memory the buffers use
+        size_t bytes() const
+        {
+            return (m_FrameSize + m_PartitionSize) * sizeof(float);
+        }
+
+    private:
+        static float *get(std::unique_ptr<float[]> &buffer, size_t &bufferSize, size_t size);
+        std::unique_ptr<float[]> m_Frame, m_Partition;
+        size_t m_FrameSize { 0 }, m_PartitionSize { 0 };
+};
+
+// This is a background map that the star extractions of several images of the same field share, like the planes of a data cube or the
+// frames of a video.  The first extraction that finds none makes it from its image, and the others subtract it from theirs instead of
+// estimating their own, which is the part of an extraction that reads every pixel twice.  The map is only used for images of the same
+// size with the same subframe, another size makes a new one.  Several extractions can share it at the same time.
+// For a sequence, the map can be made again every few images, or when the sky of an image moved too far from the one it was made from,
+// see setRefresh.
+class SharedBackground
+{
+    public:
+        // This forgets the map, so that the next extraction makes a new one, for instance every few frames of a video as the sky changes
+        void reset()
+        {
+            QMutexLocker locker(&m_Mutex);
+            m_Map.reset();
+            m_Uses = 0;
+        }
+
+        /**
+         * @brief setRefresh sets when the map is made again for the next image.  Both are off by default, so the map is kept until reset.
+         * @param frames The number of images a map is used for, 0 for no limit
+         * @param levelShift With more than 0, the level of the sky of each image is sampled, and a map is made again for an image whose
+         * level moved by more than levelShift times the RMS of the background from the one of the image the map was made from.
+         * The images whose level moved less get the map moved to their level, so a sky that brightens evenly is followed without a new map.
+         */
+        void setRefresh(int frames, double levelShift)
+        {
+            QMutexLocker locker(&m_Mutex);
+            m_RefreshFrames = frames;
+            m_LevelShift = levelShift;
+        }
+
+    private:
+        friend class InternalExtractorSolver;
+        QMutex m_Mutex;                         // This is held while the map is made, so the other extractions wait for it
+        std::shared_ptr<SEP::sep_bkg> m_Map;    // The extractions that use it keep it until they are done, even if it is replaced
+        int m_RefreshFrames { 0 };              // See setRefresh
+        double m_LevelShift { 0 };
+        int m_Uses { 0 };                       // The images the map was used for, the one it was made from included
+        float m_Level { 0 };                    // The sampled level of the image the map was made from
+};
+
+// These are the master bias, dark and flat frames that the star extraction calibrates the image with while it converts it to float,
+// so the calibrated image is never a buffer of its own.  They are combined once into an offset and a gain for each pixel, so that
+// calibrating a pixel is one subtraction and one multiplication.  They are only used for images with one channel, like mono and raw
+// Bayer frames, that are inside them, where the offsets of the image in its file place it, see FITSImage::Statistic::xOffset.
+class CalibrationFrames
+{
+    public:
+        /**
+         * @brief create combines the masters, each of which can be nullptr, with the dark scaled by darkScale for another exposure.
+         * The dark has the bias in it, like a master dark that was not bias subtracted, and so does the flat.
+         * @return nullptr if the masters don't have one channel or none are given
+         */
+        static QSharedPointer<const CalibrationFrames> create(const FITSImage::Statistic &masterstats, uint8_t const *bias,
+                uint8_t const *dark, uint8_t const *flat, double darkScale);
+
+        // Whether an image of imagestats can be calibrated with these masters
+        bool covers(const FITSImage::Statistic &imagestats) const
+        {
+            return imagestats.channels == 1 && imagestats.xOffset + imagestats.width <= m_Width
+                   && imagestats.yOffset + imagestats.height <= m_Height;
+        }
+        // The offsets and gains of the pixels from x, y of the masters on
+        const float *offset(int x, int y) const
+        {
+            return m_Offset.data() + static_cast<size_t>(y) * m_Width + x;
+        }
+        const float *gain(int x, int y) const
+        {
+            return m_Gain.data() + static_cast<size_t>(y) * m_Width + x;
+        }
+
+    private:
+        int m_Width { 0 };
+        int m_Height { 0 };
+        std::vector<float> m_Offset;    // The bias and the scaled dark, which are subtracted
+        std::vector<float> m_Gain;      // The mean of the flat divided by the flat, which the pixels are multiplied by
+};
+
+// This is the field that the child solvers of a parallel solve all solve, made once by the parent from the stars it extracted.
+// It is the star list of astrometry.net and the verify field preprocessed from it, with the kdtree and the grid hash of the stars,
+// so the children don't each convert the stars and build those again.  It is only read once it is made, and each child that uses
+// it keeps it until its solve is done.
+class SharedField
+{
+    public:
+        // This returns nullptr for no stars or if the verify field can't be made
+        static QSharedPointer<const SharedField> create(const QList<FITSImage::Star> &stars);
+        ~SharedField();
+
+        SharedField(const SharedField &) = delete;
+        SharedField &operator=(const SharedField &) = delete;
+
+        // Whether it was made from this star list, the children get shallow copies of the list of the parent
+        bool isFor(const QList<FITSImage::Star> &stars) const
+        {
+            return m_Stars.isSharedWith(stars);
+        }
+        // The solver only reads the field, even though astrometry.net doesn't declare it const
+        starxy_t *field() const
+        {
+            return const_cast<starxy_t *>(&m_Field);
+        }
+        const verify_field_t *verifyField() const
+        {
+            return m_VerifyField;
+        }
+
+    private:
+        SharedField() {}
+
+        QList<FITSImage::Star> m_Stars;
+        std::vector<double> m_X;
+        std::vector<double> m_Y;
+        starxy_t m_Field;
+        verify_field_t *m_VerifyField { nullptr };
+};
+
 class InternalExtractorSolver: public ExtractorSolver
 {
     public:
@@ -30,10 +191,12 @@ class InternalExtractorSolver: public ExtractorSolver
                                          const FITSImage::Statistic &imagestats,  uint8_t const *imageBuffer, QObject *parent = nullptr);
         ~InternalExtractorSolver();
 
+        class StarSelector;
+
         // This struct contains information about the image used by SEP
         typedef struct
         {
-            float *data;
+            float *data;            // This can point into a larger frame, then width and height are the size of that frame from this point on
             uint32_t width;
             uint32_t height;
             uint32_t subX;
@@ -42,6 +205,15 @@ class InternalExtractorSolver: public ExtractorSolver
             uint32_t subH;
             uint32_t keep;
             FITSImage::Background *background;
+            int threads;            // The number of threads SEP can use for the background, detection and photometry of this partition
+            const SEP::sep_bkg *sharedBackground;    // If this is set, the data already has this background subtracted, so the partition doesn't compute its own
+            StarSelector *selector; // If this is set, it decides which stars are big enough to keep across all of the partitions
+            uint32_t innerX1;       // The part of the partition inside the margins, only the stars in here count for the selector
+            uint32_t innerY1;
+            uint32_t innerX2;
+            uint32_t innerY2;
+            SEP::sep_deblend_limits *deblendLimits; // If this is set, it limits the deblending of all of the partitions
+            StarSummary *summary;   // If this is set, the stars inside the margins are added to it instead of being returned
         } ImageParams;
 
         /**
@@ -50,6 +222,195 @@ class InternalExtractorSolver: public ExtractorSolver
          */
         int extract() override;
 
+        /**
+         * @brief measureFocus is a fast mode for focusing, that only measures the HFR of stars that are already known.
+         * It finds each star again near its old position, using the background around it, and then runs sep_flux_radius on it.
+         * There is no background map, detection or deblending, so it only reads the pixels around the stars.
+         * @param stars The stars to measure, for instance from an earlier extraction.  If it is empty, the brightest star in the subframe is measured.
+         * @param measured If set, this gets the index in stars of each star that was measured
+         * @return whether or not it was successful, 0 means success
+         */
+        int measureFocus(const QList<FITSImage::Star> &stars, QVector<int> *measured = nullptr);
+
+        /**
+         * @brief estimateStars makes a quick coarse pass over a few tiles of an image to estimate the size of its stars and how many there are,
+         * for choosing how much to downsample it before the star extraction.  Only the bright stars that are not saturated are measured,
+         * from their widths at half of their peaks along the row and the column, so it gets by without a background map or a convolution.
+         * @param stats The statistics of the image
+         * @param buffer The image buffer, only its first channel is used
+         * @param fwhm This gets the median FWHM of the stars in pixels
+         * @param starsPerMegapixel This gets how many bright stars there are in a million pixels
+         * @return false if there were too few stars in the tiles for an estimate
+         */
+        static bool estimateStars(const FITSImage::Statistic &stats, const uint8_t *buffer, double &fwhm, double &starsPerMegapixel);
+
+        /**
+         * @brief setTrackStars makes the star extraction track these stars from the frame before, instead of finding them again
+         * @param stars The stars of the frame before
+         * @param shift How far the stars moved in the frame before, which is how far they are expected to move in this one
+         * @param fullExtractionStars The number of stars of the last full extraction, the tracking stops when too many of them are lost
+         */
+        void setTrackStars(const QList<FITSImage::Star> &stars, QPointF shift, int fullExtractionStars)
+        {
+            m_StarsToTrack = stars;
+            m_TrackShift = shift;
+            m_FullExtractionStars = fullExtractionStars;
+        }
+
+        /**
+         * @brief setPriorWCS makes the solve verify the WCS of an earlier solution first, as when the mount has not moved since,
+         * so the image is solved by matching its stars to the index stars where the WCS puts them, without searching for quads.
+         * @param wcs The earlier WCS, in the pixels of the full resolution image
+         * @param priorOnly If true, the solve fails when the WCS can't be verified, instead of going on to search for quads
+         * @param tweak If false, a WCS that is only verified isn't tweaked, so the solution is the WCS as it was given
+         */
+        void setPriorWCS(const WCSData &wcs, bool priorOnly, bool tweak = true)
+        {
+            m_PriorWCS = wcs;
+            m_HasPriorWCS = wcs.hasWCS;
+            m_PriorOnly = priorOnly;
+            m_PriorTweak = tweak;
+        }
+
+        /**
+         * @brief setSolutionCache makes the solve verify the solution of the star pattern it saw before, if the cache has one for
+         * the extracted stars and there is no prior WCS, and remember the solution it finds.  The child solvers only remember it.
+         * @param cache The cache, which can be shared by many solvers, or null for none
+         */
+        void setSolutionCache(const QSharedPointer<SolutionCache> &cache)
+        {
+            m_SolutionCache = cache;
+        }
+
+        /**
+         * @brief setReferenceCatalog makes the verifications of the solve get the index stars of the fields the catalog covers from it,
+         * instead of searching the star kd-trees of the indexes.  The child solvers share it.
+         * @param catalog The catalog, which is only read, or null for none
+         */
+        void setReferenceCatalog(const QSharedPointer<const ReferenceCatalog> &catalog)
+        {
+            m_ReferenceCatalog = catalog;
+        }
+
+        /**
+         * @brief hasCachedSolution gets whether the cache has a solution to verify for the extracted stars
+         */
+        bool hasCachedSolution();
+
+        /**
+         * @brief loadNextFrame makes this star extractor ready to extract the stars of another frame of the same size and layout,
+         * so that a stream of frames, as in a guiding loop, doesn't need a new InternalExtractorSolver for each of them.
+         * The results of the frame before are cleared and the float buffers and the merged channel buffer are kept.
+         * @param imagestats Information about the new frame, which must have the size, channels and data type of the one before
+         * @param imageBuffer The new frame
+         * @param view The layout of the new frame, see setImageView
+         * @return false if it is still running or it reads a streamed image, then it can't be used for the next frame
+         */
+        bool loadNextFrame(const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer, const FITSImage::ImageView &view);
+
+        /**
+         * @brief setFloatBuffers makes this use the float buffers of an earlier InternalExtractorSolver, they are only allocated again if they are too small
+         * @param buffers The buffers, which must not be used by another InternalExtractorSolver at the same time
+         */
+        void setFloatBuffers(const QSharedPointer<ExtractionBuffers> &buffers)
+        {
+            m_FloatBuffers = buffers;
+        }
+
+        /**
+         * @brief setSharedBackground makes the star extraction subtract a background map it shares with the extractions of other images,
+         * instead of estimating the background of its own image.  The whole area is then extracted as one frame, like with globalBackground.
+         * @param background The shared map, it is made by this extraction if it doesn't have one for an image of this size yet
+         */
+        void setSharedBackground(const QSharedPointer<SharedBackground> &background)
+        {
+            m_SharedBackground = background;
+        }
+
+        /**
+         * @brief setCalibrationFrames makes the star extraction calibrate the image with master frames while it converts it to float
+         * @param calibration The masters, they are not used if they don't cover the image, see CalibrationFrames::covers
+         */
+        void setCalibrationFrames(const QSharedPointer<const CalibrationFrames> &calibration)
+        {
+            m_Calibration = calibration;
+        }
+
+        /**
+         * @brief setImageView makes the star extraction read the image buffer with the layout of a view instead of the packed one, see StellarSolver::loadNewImageView
+         * @param view The layout, the region of interest must already be applied to the image buffer and to the statistics
+         */
+        void setImageView(const FITSImage::ImageView &view)
+        {
+            m_ImageView = resolveImageView(m_Statistics, view);
+        }
+
+        /**
+         * @brief resolveImageView fills in the strides of a view that are 0 with the ones of the packed layout of an image
+         */
+        static FITSImage::ImageView resolveImageView(const FITSImage::Statistic &stats, const FITSImage::ImageView &view);
+
+        /**
+         * @brief isPackedView gets whether a resolved view has the packed layout, the one the external extractors and solvers expect
+         */
+        static bool isPackedView(const FITSImage::Statistic &stats, const FITSImage::ImageView &view);
+
+        /**
+         * @brief packImage copies an image with the layout of a resolved view to a packed buffer
+         * @param stats Information about the image
+         * @param view The resolved layout of the image
+         * @param image The image
+         * @param packed The buffer the image is copied to, it is resized to fit
+         */
+        static void packImage(const FITSImage::Statistic &stats, const FITSImage::ImageView &view, const uint8_t *image,
+                              std::vector<uint8_t> &packed);
+
+        /**
+         * @brief setRowReader makes the star extraction read the image in bands of rows, instead of from the image buffer
+         * @param reader Reads the rows of the image, see FITSImage::RowReader
+         * @param bandRows The number of rows in each band, not counting the margins that overlap the next bands
+         */
+        void setRowReader(const FITSImage::RowReader &reader, uint32_t bandRows)
+        {
+            m_RowReader = reader;
+            m_StreamBandRows = bandRows;
+        }
+
+        /**
+         * @brief setExtractedStars gives this the stars of an earlier star extraction of the same image with the same extraction parameters,
+         * so that the solve can start right away instead of extracting them again
+         * @param stars The stars, which were already filtered for solving
+         * @param downsample How much the image was downsampled for that star extraction, the stars are in the pixels of the downsampled image
+         */
+        void setExtractedStars(const QList<FITSImage::Star> &stars, int downsample);
+
+        /**
+         * @brief extractionDownsample gets how much the image was downsampled for the last star extraction
+         * @return 1 if the stars are in the pixels of the image
+         */
+        int extractionDownsample() const
+        {
+            return usingDownsampledImage ? m_ActiveParameters.downsample : 1;
+        }
+
+        /**
+         * @brief wasTracked gets whether or not the last star extraction could just track the stars, see setTrackStars
+         * @return true means the stars were tracked, false means they were extracted from the whole image
+         */
+        bool wasTracked() const
+        {
+            return m_WasTracked;
+        }
+
+        /**
+         * @brief getTrackShift gets how far the stars moved in the last tracked frame
+         * @return The shift in pixels
+         */
+        QPointF getTrackShift() const
+        {
+            return m_TrackShift;
+        }
+
         /**
          * @brief abort will stop the InternalExtractor by setting a cancel variable and using the quit method.
          */
@@ -62,6 +423,17 @@ class InternalExtractorSolver: public ExtractorSolver
          */
         ExtractorSolver* spawnChildSolver(int n) override;
 
+        /**
+         * @brief shareBestLogOdds makes the child solvers spawned from now on share the best log odds of their solutions, so each of them
+         * drops the matches that can't beat a solution another one already has.  This is for the parallel solves that use the solution
+         * with the best log odds, or the first one, not for the ones that rank the solutions by the order of their ranges.
+         * @param share Whether the child solvers share it, each parallel solve starts over with no solution
+         */
+        void shareBestLogOdds(bool share)
+        {
+            m_SharedBestLogOdds.reset(share ? new std::atomic<double>(-std::numeric_limits<double>::infinity()) : nullptr);
+        }
+
         /**
          * @brief cleanupTempFiles is a method that is not used by the InternalExtractorSolver since there no longer any temp files
          */
@@ -83,18 +455,56 @@ class InternalExtractorSolver: public ExtractorSolver
         //This boolean gets set internally if we are using a Merged Channel image buffer
         bool usingMergedChannelImage = false;
 
+        /**
+         * @brief trackStars finds the stars set with setTrackStars again in small windows around where they are expected to be
+         * @return 0 if enough of them were found, otherwise a full star extraction is needed
+         */
+        int trackStars();
+
         /**
          * @brief runSEPExtractor is the method that actually runs internal SEP
          * @return
          */
         int runSEPExtractor();
 
+        /**
+         * @brief runStreamingExtractor runs internal SEP on an image that is read in bands of rows, see setRowReader
+         * @return whether or not it was successful, 0 means success
+         */
+        int runStreamingExtractor();
+
+        /**
+         * @brief runRegionExtractor runs internal SEP on each of the regions of setRegions at once, each one as a partition with its margins
+         * @return whether or not it was successful, 0 means success
+         */
+        int runRegionExtractor();
+
         /**
          * @brief applyStarFilters filters the stars list so that the list can be reduced for faster solving
          * @param starList
          */
         void applyStarFilters(QList<FITSImage::Star> &starList);
 
+        /**
+         * @brief saturationLevel is the pixel value above which applyStarFilters counts a star as saturated
+         * @return the level, or -1 if it cannot be told for the data type of the image
+         */
+        double saturationLevel() const;
+
+        /**
+         * @brief detectionSaturation is the peak above which the extraction leaves an object out before deblending and photometry,
+         * because applyStarFilters would remove it anyway
+         * @return the peak, or 0 if the saturation filter is off or needs the saturated stars, like for removing the brightest stars
+         */
+        double detectionSaturation() const;
+
+        /**
+         * @brief passesStarFilters checks a star against the filters of applyStarFilters that judge each star on its own,
+         * the size, ellipse and saturation filters
+         * @return Whether the star is kept
+         */
+        bool passesStarFilters(const FITSImage::Star &oneStar) const;
+
         /**
          * @brief extractPartition actually performs star extraction in separate threads for different parts of the image
          * @param parameters The details about the image partition
@@ -102,6 +512,22 @@ class InternalExtractorSolver: public ExtractorSolver
          */
         QList<FITSImage::Star> extractPartition(const ImageParams &parameters);
 
+        /**
+         * @brief poolRunner makes the task runner that starts the helper threads of SEP and of the binning on the free
+         * slots of the thread pool, so they never take more than maxThreads with the rest of the solve
+         * @return The runner, or an empty one without a pool of more than one thread, then they are threads of their own
+         */
+        SEP::sep_task_runner poolRunner() const;
+
+        /**
+         * @brief runPartition starts extractPartition on the thread pool if there is one, otherwise on the global thread pool
+         * @param parameters The partition to extract
+         * @param collect If this is set, the thread of the partition hands its stars to it, and the future gets no stars
+         * @return The future for the stars of the partition
+         */
+        QFuture<QList<FITSImage::Star>> runPartition(const ImageParams &parameters,
+                const std::function<void(const QList<FITSImage::Star> &)> &collect = nullptr);
+
         /**
          * @brief allocateDataBuffer allocates the space needed for the image buffer object used by SEP
          * @param data is the image buffer used by SEP being allocated
@@ -113,31 +539,161 @@ class InternalExtractorSolver: public ExtractorSolver
          */
         bool allocateDataBuffer(float *data, uint32_t x, uint32_t y, uint32_t w, uint32_t h);
 
+        // What measureInWindow found
+        enum WindowMeasurement
+        {
+            WINDOW_UNREADABLE,  // The pixels of the window couldn't be read
+            WINDOW_TOO_SMALL,   // The window at the edge of the image was too small to measure in
+            STAR_NOT_FOUND,     // The window was read, but the star wasn't found in it
+            STAR_MEASURED
+        };
+
+        /**
+         * @brief measureInWindow measures a star in a small window of the image around where it should be, like measureFocus does
+         * @param x The expected position of the star in 0 based pixels
+         * @param y The expected position of the star in 0 based pixels
+         * @param radius The radius to measure the flux and the HFR in
+         * @param star Gets the position, flux, magnitude, peak, HFR and area of the star, the rest of it is left as it was
+         * @param background Gets the background of the window if it was read
+         * @param buffer The buffer to read the window into, or nullptr for the pooled float buffer, which only one thread can use
+         */
+        WindowMeasurement measureInWindow(double x, double y, int radius, FITSImage::Star &star, float *background,
+                                          std::vector<float> *buffer = nullptr);
+
         /**
-         * @brief mergeImageChannels merges the R, G, and B channels of a 3 channel image
-         * to make one enhanced channel for star extraction or solving
+         * @brief measureAtFullResolution measures the stars that were detected on the binned view of detectionBinning again at full resolution,
+         * each in a small window around it.  The stars are split between the partition threads.  The stars that aren't found again, and
+         * the ones that are left when the time limit of the extraction is up, keep the measurements of the binned view.
+         * @param limits The deblend limits of the extraction, with its deadline
          */
-        bool mergeImageChannels();
+        void measureAtFullResolution(QList<FITSImage::Star> &stars, SEP::sep_deblend_limits *limits);
 
         /**
-         * @brief mergeImageChannelsType allows the mergeImageChannels method to handle different data types
+         * @brief readDataBuffer is like allocateDataBuffer, but it reads the rows of the partition with the row reader
+         * @return True if successfull, false otherwise.
          */
-        template <typename T> bool mergeImageChannelsType();
+        bool readDataBuffer(float *data, uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+
+        // The readers of the image for its pixel type, which are picked once when the frame is loaded, so each partition
+        // converts its pixels to float in its first pass over them without switching on the type again.  They are null for
+        // a type that isn't supported, then the partitions fail to load.
+        struct FrameKernels
+        {
+            bool (InternalExtractorSolver::*floatBuffer)(float *, int, int, int, int) = nullptr;
+            bool (InternalExtractorSolver::*streamedFloatBuffer)(float *, int, int, int, int) = nullptr;
+            bool (InternalExtractorSolver::*binnedBuffer)(float *, int, int, int, int) = nullptr;
+            bool (InternalExtractorSolver::*prepareFrame)(int) = nullptr;
+        };
+        FrameKernels m_FrameKernels;
+
+        /**
+         * @brief frameKernelsFor gets the readers of the image for a pixel type
+         * @param dataType The FITSImage data type of the image
+         */
+        static FrameKernels frameKernelsFor(int dataType);
+        template <typename T> static FrameKernels frameKernelsFor();
 
     private:
 
-        // The generic data buffer containing the downsampled image data
-        uint8_t *downSampledBuffer { nullptr };
+        // The float images SEP works on, see setFloatBuffers
+        QSharedPointer<ExtractionBuffers> m_FloatBuffers;
+
+        // The background map shared with the extractions of other images, see setSharedBackground
+        QSharedPointer<SharedBackground> m_SharedBackground;
+
+        // The master frames the image is calibrated with, see setCalibrationFrames
+        QSharedPointer<const CalibrationFrames> m_Calibration;
+
+        /**
+         * @brief calibration gets the master frames if they cover the image, otherwise nullptr
+         */
+        const CalibrationFrames *calibration() const
+        {
+            return m_Calibration && m_Calibration->covers(m_Statistics) ? m_Calibration.data() : nullptr;
+        }
+
+        // The layout of the image buffer, see setImageView.  The strides are always filled in.
+        FITSImage::ImageView m_ImageView;
+
+        // The distance between the pixels of one channel in a row of the image buffer
+        int pixelStride() const
+        {
+            return m_ImageView.interleaved ? m_Statistics.channels : 1;
+        }
+
+        // The merged and downsampled float image, if the image had to be prepared, see prepareFrame
+        float *m_PreparedFrame { nullptr };
+
+        // The factor the image is binned by while it is converted to float, with downsampleView, or 0 if it is not
+        int m_ViewBinning { 0 };
+
+        // The pixels of the part of the image that is extracted, so the threshold ladder gives each partition its share of the stars.
+        // It is 0 for the extractions of regions, which don't climb down the ladder.
+        double m_ExtractionArea { 0 };
+
+        // The binning of the view the stars are detected on for detectionBinning, or 0 if they are detected at the resolution they are measured at
+        int m_DetectionBinning { 0 };
+
+        // Which child solver of a parallel solve this is, see placeThread
+        int m_ChildNumber { 0 };
+
+        // The stars extracted so far for a pipelined solve, see runPipelinedSolve
+        struct StarPipeline;
+        std::unique_ptr<StarPipeline> m_Pipeline;
+        std::unique_ptr<MatchVerifier> m_MatchVerifier;  // Verifies the matches of a quad on the free threads of the pool, see MatchVerifier
+
+        // Streaming related, see setRowReader
+        FITSImage::RowReader m_RowReader;       // Reads the rows of the image when it is not in memory
+        uint32_t m_StreamBandRows { 0 };        // The rows of each band
+        std::vector<uint8_t> m_StreamBuffer;    // The rows of the band being read, kept for the next band
+
+        // Tracking related, see setTrackStars
+        QList<FITSImage::Star> m_StarsToTrack;  // The stars of the frame before
+        QPointF m_TrackShift;                   // How far they moved in the frame before, and then how far they moved in this one
+        int m_FullExtractionStars { 0 };        // The number of stars of the last full extraction, which the tracked stars are compared to
+        bool m_WasTracked { false };            // Whether the stars were tracked in the last star extraction
+
+        // Prior WCS related, see setPriorWCS
+        WCSData m_PriorWCS;                     // The WCS that is verified before searching for quads
+        bool m_HasPriorWCS { false };
+        bool m_PriorOnly { false };             // Whether the solve stops after verifying it
+        bool m_PriorTweak { true };             // Whether the verified WCS is tweaked when the solve stops after verifying it
+        int m_TweakOrder { 2 };                 // The SIP order of the tweak, it is higher for the extension of a solve of the center
 
-        // The generic data buffer containing an RGB image's merged channels data
-        uint8_t *mergedChannelBuffer { nullptr };
+        // Solution cache related, see setSolutionCache
+        QSharedPointer<SolutionCache> m_SolutionCache;
+
+        // Reference catalog related, see setReferenceCatalog
+        QSharedPointer<const ReferenceCatalog> m_ReferenceCatalog;
+
+        // The field of the child solvers, which the parent makes for its extracted stars when it spawns them, see SharedField
+        QSharedPointer<const SharedField> m_SharedField;
 
         // This is the number of threads used for star extraction with SEP
         uint32_t m_PartitionThreads = {16};
 
+        // These add up the nanoseconds that the stages of the star extraction took, the partitions add to them at the same time.
+        // They go into m_Metrics at the end of the extraction, see updateExtractionMetrics.
+        struct StageTimes
+        {
+            std::atomic<qint64> prepare { 0 };
+            std::atomic<qint64> background { 0 };
+            std::atomic<qint64> detection { 0 };
+            std::atomic<qint64> deblend { 0 };
+            std::atomic<qint64> photometry { 0 };
+            std::atomic<qint64> filter { 0 };
+        };
+        StageTimes m_StageTimes;
+        // The hardware events of the partitions of the extraction, added up over their threads, see setCountHardwareEvents
+        uint64_t m_ExtractionCounters[SSCOUNTERS_N] {};
+
         // Job File related
         job_t thejob;                   //This is the job file that will be created for astrometry.net to solve
         job_t* job = &thejob;           //This is a pointer to that job file
+        QSharedPointer<std::atomic<int>> m_CancelToken;  //The solver stops as soon as this is set, each child solver has its own so one range can be stopped alone
+        QList<QWeakPointer<std::atomic<int>>> m_ChildCancelTokens;  //The tokens of the child solvers, which abort sets too so it stops all of them
+        QMutex m_ChildCancelMutex;      //This guards m_ChildCancelTokens, abort can come from any thread
+        QSharedPointer<std::atomic<double>> m_SharedBestLogOdds;  //The best log odds of a solution of the child solvers, if they share it
 
         // Solution related
         MatchObj match;                 //This is where the match object gets stored once the solving is done.
@@ -154,6 +710,26 @@ class InternalExtractorSolver: public ExtractorSolver
 
         // InternalExtractorSolver Methods
 
+        /**
+         * @brief priorAsSIP fits a TAN WCS, in the pixels being solved, to the prior WCS, which can be a WCSLIB one
+         * @param sip The WCS for astrometry to verify
+         * @return false if the prior WCS could not be sampled over the image
+         */
+        bool priorAsSIP(sip_t &sip);
+
+        /**
+         * @brief cachedAsSIP gets the solution of the cache for the extracted stars, in the pixels being solved
+         * @param sip The WCS for astrometry to verify
+         * @return false if the cache has none
+         */
+        bool cachedAsSIP(sip_t &sip);
+
+        /**
+         * @brief rememberSolution puts the solution of the extracted stars in the cache, in the pixels of the full resolution image
+         * @param solution The solution, in the pixels being solved
+         */
+        void rememberSolution(const sip_t &solution);
+
         /**
          * @brief prepare_job prepares the job object used by the internal astrometry solver
          * @return true if successful
@@ -171,6 +747,14 @@ class InternalExtractorSolver: public ExtractorSolver
          */
         int runInternalSolver();
 
+        /**
+         * @brief runCenterFirstSolve solves the stars in the center of the field first, see Parameters::center_first_fraction, and then
+         * verifies that solution with all of the stars and tweaks it to a higher order.  If the center doesn't solve, all of the stars are
+         * searched as usual, and if all of the stars don't verify the solution of the center, it is kept.
+         * @return 0 if it solved, like runInternalSolver
+         */
+        int runCenterFirstSolve();
+
         /**
          * @brief cancelSEP will cancel a star extraction and wait for it to finish
          */
@@ -187,16 +771,113 @@ class InternalExtractorSolver: public ExtractorSolver
         template <typename T> bool getFloatBuffer(float * buffer, int x, int y, int w, int h);
 
         /**
-         * @brief downsampleImage downsamples the image by the requested factor
-         * @param d The factor to downsample by in both dimensions
+         * @brief getStreamedFloatBuffer is like getFloatBuffer, but it reads the rows y to y + h with the row reader
+         */
+        template <typename T> bool getStreamedFloatBuffer(float * buffer, int x, int y, int w, int h);
+
+        /**
+         * @brief logDeblending logs how many objects were deblended and skipped within the deblend limits
+         */
+        void logDeblending(const SEP::sep_deblend_limits &limits);
+
+        /**
+         * @brief runPipelinedSolve extracts the stars on a thread of its own while the solver starts on the first ones found,
+         * and the solver's field grows with the stars extracted since before each depth range, see growField
+         * @return 0 if it solved, like runInternalSolver
          */
-        bool downsampleImage(int d);
+        int runPipelinedSolve();
 
         /**
-         * @brief downSampleImageType allows the downsampling code to handle various data types
+         * @brief publishStars hands the stars of a partition to a pipelined solve after the filters of applyStarFilters that judge
+         * each star on its own.  They are merged by brightness with the stars the solver doesn't have yet.  It does nothing if the solve is not pipelined.
+         * @param stars The stars of the partition, in the coordinates of the image
+         */
+        void publishStars(QList<FITSImage::Star> stars);
+
+        /**
+         * @brief streamStars emits partitionStarsReady with the stars of a partition that pass the filters of applyStarFilters
+         * that judge each star on its own.  It does nothing unless setStreamPartitionStars is on.
+         * @param stars The new stars of the partition, in the coordinates of the image
+         */
+        void streamStars(QList<FITSImage::Star> stars, int partition, int partitions);
+
+        /**
+         * @brief waitForStarDemand is called by a progressive extraction before each wave of partitions after the first.  It waits
+         * until the solver wants more stars than the pipelined solve has, see growField.  It returns at once if the solve isn't pipelined.
+         * @return false if the solve is over or was aborted, so no more partitions are needed
+         */
+        bool waitForStarDemand();
+
+        /**
+         * @brief growField is the field_callback of a pipelined solve.  It waits until there are enough stars for the next depth range,
+         * or the extraction is done, and then gives the solver a field with all of the stars so far.
+         * @param bp The blind parameters of the job
+         * @param endobj The last star the depth range uses, 1-indexed, or 0 for all of them
+         * @param userdata The InternalExtractorSolver
+         */
+        static void growField(blind_t *bp, int endobj, void *userdata);
+
+        /**
+         * @brief recordIndexSearch is the index_callback of the solve, it adds the search of one index to the solve metrics
+         * @param bp The blind parameters of the job
+         * @param index The index that was searched, or nullptr if all of them were searched in parallel
+         * @param seconds The wall time of the search
+         * @param quadsTried The number of quads tried with the index
+         * @param userdata The InternalExtractorSolver
+         */
+        static void recordIndexSearch(blind_t *bp, const index_t *index, double seconds, int quadsTried, void *userdata);
+
+        /**
+         * @brief updateBestLogOdds is the best_logodds_callback of a child solver that shares the best log odds with the others, see shareBestLogOdds
+         * @param logodds The log odds of a verified match, it becomes the best if it solves the image and is better than the others
+         * @param userdata The InternalExtractorSolver
+         * @return The best log odds of a solution of any of the child solvers, or -infinity if none of them solved yet
+         */
+        static double updateBestLogOdds(double logodds, void *userdata);
+
+        /**
+         * @brief updateExtractionMetrics puts the stage times of the star extraction into the solve metrics
+         */
+        void updateExtractionMetrics();
+
+        /**
+         * @brief placeThread pins a child solver's thread to cores according to the threadPlacement parameter
+         */
+        void placeThread();
+
+        /**
+         * @brief floatBuffer returns the pooled float buffer, making it bigger if it is too small for the request
+         * @param size is the number of pixels needed
+         * @return a buffer of at least that many pixels, which belongs to the InternalExtractorSolver
+         */
+        float *floatBuffer(size_t size);
+
+        /**
+         * @brief prepareFrame merges the channels of an RGB image if they are averaged or integrated, and downsamples it,
+         * while converting it to float in one pass over the image.  The star extraction then works on that float frame.
+         * @param d The factor to downsample by in both dimensions, 1 only merges the channels
+         */
+        bool prepareFrame(int d);
+
+        /**
+         * @brief useDownsampledImage makes the image size and the search scale the ones of the image downsampled by d, as the stars are
+         * @param d The factor the image is downsampled by in both dimensions
+         */
+        void useDownsampledImage(int d);
+
+        /**
+         * @brief prepareFrameType allows prepareFrame to handle various data types
          * @param d The factor to downsample by in both dimensions
          */
-        template <typename T> bool downSampleImageType(int d);
+        template <typename T> bool prepareFrameType(int d);
+
+        /**
+         * @brief getBinnedBuffer is allocateDataBuffer for the binned view of downsampleView, it merges and bins only the
+         * pixels under a rectangle of the binned image
+         * @param buffer The buffer to fill, of at least w * h pixels
+         * @param x, y, w, h The rectangle in binned pixels
+         */
+        template <typename T> bool getBinnedBuffer(float * buffer, int x, int y, int w, int h);
 
 
 };
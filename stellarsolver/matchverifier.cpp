@@ -0,0 +1,79 @@
+/*  MatchVerifier, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "matchverifier.h"
+#include "solverthreadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+//QT Includes
+#include <QMutex>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <QtConcurrent>
+
+namespace
+{
+// The matches being verified, shared with the threads that may start after they are all done
+struct Batch
+{
+    int n { 0 };
+    void (*verify)(void *arg, int worker, int i) { nullptr };
+    void *arg { nullptr };
+    std::atomic<int> next { 0 };
+    std::atomic<int> done { 0 };
+    QMutex mutex;
+    QWaitCondition finished;
+};
+
+// Each worker takes the next match until there are none left
+void work(const std::shared_ptr<Batch> &batch, int worker)
+{
+    int i;
+    while((i = batch->next.fetch_add(1)) < batch->n)
+    {
+        batch->verify(batch->arg, worker, i);
+        if(batch->done.fetch_add(1) + 1 == batch->n)
+        {
+            QMutexLocker locker(&batch->mutex);
+            batch->finished.wakeAll();
+        }
+    }
+}
+}
+
+int MatchVerifier::run(void *userdata, int n, int nworkers, void (*verify)(void *arg, int worker, int i), void *arg)
+{
+    auto *verifier = static_cast<MatchVerifier *>(userdata);
+    if(n <= 0)
+        return 0;
+    auto batch = std::make_shared<Batch>();
+    batch->n = n;
+    batch->verify = verify;
+    batch->arg = arg;
+
+    for(int worker = 1; worker < std::min(nworkers, n); worker++)
+    {
+        auto helper = [batch, worker]()
+        {
+            work(batch, worker);
+        };
+        // The solve already holds a slot of its pool, so the helpers only get the slots that are free and don't wait for more
+        if(!verifier->m_Pool)
+            QtConcurrent::run(QThreadPool::globalInstance(), helper);
+        else if(!verifier->m_Pool->tryRun(helper, verifier->m_Urgency))
+            break;
+    }
+    work(batch, 0);
+
+    QMutexLocker locker(&batch->mutex);
+    while(batch->done.load() < n)
+        batch->finished.wait(&batch->mutex);
+    return 0;
+}
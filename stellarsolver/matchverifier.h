@@ -0,0 +1,39 @@
+/*  MatchVerifier, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include "parameters.h"
+
+class SolverThreadPool;
+
+/**
+ * @brief The MatchVerifier class verifies the matches of a quad on several threads at once for the solver, see solver_verify_runner_t.
+ * The thread of the solve verifies matches too.  The other threads come from the SolverThreadPool of the solve, and only as many as it has
+ * free slots right now, so a busy pool means the solve verifies the matches itself instead of waiting.  Without a pool they come from the
+ * global QThreadPool.  The solve doesn't wait for the threads that have not started yet when the matches are all verified, they find
+ * nothing left to do when they start.
+ */
+class MatchVerifier
+{
+    public:
+        /**
+         * @brief MatchVerifier makes a verifier for the solves that work in a slot of a pool
+         * @param pool is the pool of the solve, or nullptr for none
+         * @param urgency is the SolveUrgency of the slots the threads take
+         */
+        explicit MatchVerifier(SolverThreadPool *pool, SSolver::SolveUrgency urgency) : m_Pool(pool), m_Urgency(urgency) {}
+
+        /**
+         * @brief run is the solver_verify_runner_t of the solver, the userdata is the MatchVerifier
+         */
+        static int run(void *userdata, int n, int nworkers, void (*verify)(void *arg, int worker, int i), void *arg);
+
+    private:
+        SolverThreadPool *m_Pool;
+        SSolver::SolveUrgency m_Urgency;
+};
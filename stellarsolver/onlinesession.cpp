@@ -0,0 +1,122 @@
+/*  OnlineSession, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "onlinesession.h"
+#include <QNetworkAccessManager>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QUrl>
+#include <QVariantMap>
+
+OnlineSession::~OnlineSession()
+{
+    delete m_NetworkManager;
+}
+
+QNetworkAccessManager *OnlineSession::networkManager()
+{
+    if(!m_NetworkManager)
+        m_NetworkManager = new QNetworkAccessManager();
+    return m_NetworkManager;
+}
+
+void OnlineSession::requestSession(const QString &url, const QString &apiKey, QObject *context, const SessionCallback &callback)
+{
+    const QString loginKey = url + "\n" + apiKey;
+    Login &login = m_Logins[loginKey];
+    if(!login.sessionKey.isEmpty())
+    {
+        callback(login.sessionKey, QString());
+        return;
+    }
+    login.waiting.append(qMakePair(QPointer<QObject>(context), callback));
+    if(login.pending)
+        return;
+    login.pending = true;
+
+    QNetworkRequest request;
+    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+    QUrl loginURL(url);
+    loginURL.setPath("/api/login");
+    request.setUrl(loginURL);
+
+    QVariantMap apiReq;
+    apiReq.insert("apikey", apiKey);
+    QJsonDocument json_doc(QJsonObject::fromVariantMap(apiReq));
+    QString json_request = QString("request-json=%1").arg(QString(json_doc.toJson(QJsonDocument::Compact)));
+
+    QNetworkReply *reply = networkManager()->post(request, json_request.toUtf8());
+    QObject::connect(reply, &QNetworkReply::finished, m_NetworkManager, [this, loginKey, reply]()
+    {
+        reply->deleteLater();
+        if (reply->error() != QNetworkReply::NoError)
+        {
+            finishLogin(loginKey, QString(), reply->errorString());
+            return;
+        }
+        QJsonParseError parseError;
+        QVariantMap result = QJsonDocument::fromJson(reply->readAll(), &parseError).toVariant().toMap();
+        if (parseError.error != QJsonParseError::NoError)
+            finishLogin(loginKey, QString(), QString("JSON error during parsing (%1).").arg(parseError.errorString()));
+        else if (result["status"].toString() != "success")
+            finishLogin(loginKey, QString(), result["errormessage"].toString());
+        else
+            finishLogin(loginKey, result["session"].toString(), QString());
+    });
+}
+
+void OnlineSession::finishLogin(const QString &loginKey, const QString &sessionKey, const QString &error)
+{
+    Login &login = m_Logins[loginKey];
+    login.pending = false;
+    login.sessionKey = sessionKey;
+    // The callbacks can request another session, so they are taken off the list first
+    const QList<QPair<QPointer<QObject>, SessionCallback>> waiting = login.waiting;
+    login.waiting.clear();
+    for(const auto &solve : waiting)
+    {
+        if(solve.first)
+            solve.second(sessionKey, error);
+    }
+}
+
+void OnlineSession::invalidate(const QString &url, const QString &apiKey, const QString &sessionKey)
+{
+    auto login = m_Logins.find(url + "\n" + apiKey);
+    if(login != m_Logins.end() && login->sessionKey == sessionKey)
+        login->sessionKey.clear();
+}
+
+bool OnlineSession::findResult(const QByteArray &key, CachedResult &result) const
+{
+    auto cached = m_Results.constFind(key);
+    if(cached == m_Results.constEnd())
+        return false;
+    result = *cached;
+    return true;
+}
+
+void OnlineSession::storeResult(const QByteArray &key, const CachedResult &result)
+{
+    if(m_ResultCacheSize <= 0)
+        return;
+    if(m_Results.contains(key))
+        m_ResultOrder.removeOne(key);
+    m_Results.insert(key, result);
+    m_ResultOrder.append(key);
+    while(m_ResultOrder.size() > m_ResultCacheSize)
+        m_Results.remove(m_ResultOrder.takeFirst());
+}
+
+void OnlineSession::setResultCacheSize(int results)
+{
+    m_ResultCacheSize = qMax(0, results);
+    while(m_ResultOrder.size() > m_ResultCacheSize)
+        m_Results.remove(m_ResultOrder.takeFirst());
+}
@@ -0,0 +1,134 @@
+/*  OnlineSession, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QPair>
+#include <QPointer>
+#include <QObject>
+#include <QByteArray>
+
+#include <functional>
+
+#include "structuredefinitions.h"
+
+class QNetworkAccessManager;
+
+/**
+ * @brief The OnlineSession class keeps the connections to astrometry.net servers and their session keys between online solves.
+ * Without it, every online solve created its own QNetworkAccessManager, so it opened new connections to the server, and logged in again.
+ * The QNetworkAccessManager keeps its connections to a server alive and uses several of them at once, so the uploads and the status checks of the
+ * solves that share a session go over the same persistent connections, with as many in flight at a time as the manager allows for a server.
+ * The session key is requested once for each server and API key, the solves that start while the login is on its way wait for its reply.
+ * The session is owned by the StellarSolver (and can be shared between several StellarSolvers, like the ones of a batch), like the IndexCatalog.
+ * It also remembers the results of the last solves, keyed by the content of what was uploaded and the options of the upload, so that
+ * solving the same image or star list again with the same options gets the solution and the WCS without sending anything to the server.
+ * It is not thread safe, it has to be used from the thread that the StellarSolvers that share it live in.
+ */
+class OnlineSession
+{
+    public:
+        OnlineSession() = default;
+        ~OnlineSession();
+
+        /**
+         * @brief SessionCallback gets the session key, or an empty key and the reason that the login failed
+         */
+        typedef std::function<void(const QString &sessionKey, const QString &error)> SessionCallback;
+
+        /**
+         * @brief requestSession gets a session key for the API key on the server.  If there is one already the callback is called right away,
+         * otherwise it is called when the reply to the login arrives.
+         * @param url is the URL of the server, including the https://
+         * @param apiKey is the API key of the user
+         * @param context is the object that wants the session, the callback isn't called if it was deleted before the reply arrived
+         * @param callback is called with the session key
+         */
+        void requestSession(const QString &url, const QString &apiKey, QObject *context, const SessionCallback &callback);
+
+        /**
+         * @brief invalidate forgets a session key that the server doesn't accept anymore, so that the next request logs in again
+         * @param url is the URL of the server
+         * @param apiKey is the API key of the user
+         * @param sessionKey is the key that was rejected, if it was already replaced by a new one, the new one is kept
+         */
+        void invalidate(const QString &url, const QString &apiKey, const QString &sessionKey);
+
+        /**
+         * @brief networkManager gets the QNetworkAccessManager that the solves send their requests with, it is created on the first call
+         * @return The QNetworkAccessManager, which lives in the thread of the first call
+         */
+        QNetworkAccessManager *networkManager();
+
+        // This is the result of one online solve, what the server sent back for it
+        typedef struct CachedResult
+        {
+            FITSImage::Solution solution {};    // The solution, the search position is part of the key so its errors are the same
+            int jobID { 0 };                    // The job of the server that solved it
+            QByteArray wcs;                     // The WCS file, empty if it wasn't downloaded
+        } CachedResult;
+
+        /**
+         * @brief findResult gets the result of an earlier solve with the same upload
+         * @param key is the key of the upload, it is made by the OnlineSolver from the uploaded file and the options of the upload
+         * @param result gets the result if there is one
+         * @return false if there is no result for the key
+         */
+        bool findResult(const QByteArray &key, CachedResult &result) const;
+
+        /**
+         * @brief storeResult keeps the result of a solve, if there are already as many as the cache holds, the oldest one is forgotten
+         * @param key is the key of the upload
+         * @param result is the result of the solve
+         */
+        void storeResult(const QByteArray &key, const CachedResult &result);
+
+        /**
+         * @brief setResultCacheSize sets how many results are kept, the default is DEFAULT_RESULT_CACHE_SIZE, 0 turns the cache off
+         */
+        void setResultCacheSize(int results);
+
+        int resultCacheSize() const
+        {
+            return m_ResultCacheSize;
+        }
+
+        /**
+         * @brief clearResults forgets the results of all of the solves, for instance after the server's index files changed
+         */
+        void clearResults()
+        {
+            m_Results.clear();
+            m_ResultOrder.clear();
+        }
+
+        static const int DEFAULT_RESULT_CACHE_SIZE = 100;
+
+    private:
+        // This is the login to one server with one API key
+        struct Login
+        {
+            QString sessionKey;                                     // The session key, empty until the server sends it
+            bool pending { false };                                 // Whether the login request is on its way
+            QList<QPair<QPointer<QObject>, SessionCallback>> waiting; // The solves waiting for the reply to the login
+        };
+
+        /**
+         * @brief finishLogin reads the reply to a login and hands the session key to the solves that are waiting for it
+         */
+        void finishLogin(const QString &loginKey, const QString &sessionKey, const QString &error);
+
+        QHash<QString, Login> m_Logins;                     // The logins, keyed by the URL and the API key
+        QNetworkAccessManager *m_NetworkManager { nullptr };  // The network manager, which deletes the replies that are left when it is deleted
+        QHash<QByteArray, CachedResult> m_Results;          // The results of the last solves, keyed by their uploads
+        QList<QByteArray> m_ResultOrder;                    // The keys of the results, the oldest first
+        int m_ResultCacheSize { DEFAULT_RESULT_CACHE_SIZE };
+};
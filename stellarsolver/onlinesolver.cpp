@@ -8,6 +8,41 @@
 #include "onlinesolver.h"
 #include <QTimer>
 #include <QEventLoop>
+#include <QFileInfo>
+#include <QCryptographicHash>
+#include <QVector>
+#include <qmath.h>
+#include <algorithm>
+#include <vector>
+#include <fitsio.h>
+
+namespace
+{
+//This averages each block of binning by binning pixels of one channel of the image into one pixel of the upload
+template <typename T>
+void binPixels(const uint8_t *channel, int width, int binning, int binnedWidth, int binnedHeight, float *binned)
+{
+    const T *pixels = reinterpret_cast<const T *>(channel);
+    const float scale = 1.0f / (binning * binning);
+    for(int by = 0; by < binnedHeight; by++)
+    {
+        float *row = binned + static_cast<size_t>(by) * binnedWidth;
+        std::fill(row, row + binnedWidth, 0.0f);
+        for(int dy = 0; dy < binning; dy++)
+        {
+            const T *line = pixels + static_cast<size_t>(by * binning + dy) * width;
+            for(int bx = 0; bx < binnedWidth; bx++)
+            {
+                const T *block = line + bx * binning;
+                for(int dx = 0; dx < binning; dx++)
+                    row[bx] += block[dx];
+            }
+        }
+        for(int bx = 0; bx < binnedWidth; bx++)
+            row[bx] *= scale;
+    }
+}
+}
 
 OnlineSolver::OnlineSolver(ProcessType type, ExtractorType exType, SolverType solType, const FITSImage::Statistic &imagestats,
                            uint8_t const *imageBuffer, QObject *parent) : ExternalExtractorSolver(type, exType, solType, imagestats, imageBuffer,
@@ -15,9 +50,14 @@ OnlineSolver::OnlineSolver(ProcessType type, ExtractorType exType, SolverType so
 {
     connect(this, &OnlineSolver::timeToCheckJobs, this, &OnlineSolver::checkJobs);
     connect(this, &OnlineSolver::startupOnlineSolver, this, &OnlineSolver::authenticate);
+}
 
-    networkManager = new QNetworkAccessManager(this);
-    connect(networkManager, &QNetworkAccessManager::finished, this, &OnlineSolver::onResult);
+void OnlineSolver::watchReply(QNetworkReply *reply)
+{
+    connect(reply, &QNetworkReply::finished, this, [this, reply]()
+    {
+        onResult(reply);
+    });
 }
 
 void OnlineSolver::execute()
@@ -26,7 +66,15 @@ void OnlineSolver::execute()
         emit logOutput("The Online solver option does not support multithreading, since the server already does this internally, ignoring this option");
 
     if(m_ExtractorType == EXTRACTOR_BUILTIN)
+    {
+        if(m_ActiveParameters.reduceOnlineUpload && writeReducedUpload() != 0)
+        {
+            emit logOutput("Failed to write the reduced copy of the image, uploading the image itself");
+            reducedUploadPath.clear();
+            uploadBinning = 1;
+        }
         runOnlineSolver();
+    }
     else
     {
         delete xcol;
@@ -72,6 +120,15 @@ void OnlineSolver::runOnlineSolver()
     }
 
     m_WasAborted = false;
+    ignoreReplies = false;
+    retriedSession = false;
+    if(!onlineSession)
+        onlineSession.reset(new OnlineSession());
+
+    //The same image or star list with the same options gets the same answer from the server, so it isn't sent again
+    resultKey = onlineSession->resultCacheSize() > 0 ? makeResultKey() : QByteArray();
+    if(!resultKey.isEmpty() && useCachedResult())
+        return;
 
     solverTimer.start();
 
@@ -127,7 +184,7 @@ void OnlineSolver::run()
 
     if(timedOut)
     {
-        disconnect(networkManager, &QNetworkAccessManager::finished, this, &OnlineSolver::onResult);
+        ignoreReplies = true;
         emit logOutput("Solver timed out");
         emit finished(-1);
         return;
@@ -153,7 +210,7 @@ void OnlineSolver::run()
         starsAndWCSTimedOut = solverTimer.elapsed() / 1000.0 > starsAndWCSTimeLimit; //Wait 10 seconds for STARS and WCS, NO LONGER!
     }
 
-    disconnect(networkManager, &QNetworkAccessManager::finished, this, &OnlineSolver::onResult);
+    ignoreReplies = true;
 
     if(starsAndWCSTimedOut)
     {
@@ -165,7 +222,7 @@ void OnlineSolver::run()
 
 void OnlineSolver::abort()
 {
-    disconnect(networkManager, &QNetworkAccessManager::finished, this, &OnlineSolver::onResult);
+    ignoreReplies = true;
     workflowStage  = NO_STAGE;
     emit logOutput("Online Solver aborted.");
     emit finished(-1);
@@ -173,65 +230,247 @@ void OnlineSolver::abort()
     m_WasAborted = true;
 }
 
-//This will start up the first stage, Authentication
-void OnlineSolver::authenticate()
+void OnlineSolver::cleanupTempFiles()
 {
-    QNetworkRequest request;
-    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+    ExternalExtractorSolver::cleanupTempFiles();
+    if(cleanupTemporaryFiles && !reducedUploadPath.isEmpty())
+        QFile(reducedUploadPath).remove();
+}
 
-    // If pure IP, add http to it.
-    if (!astrometryAPIURL.startsWith("https"))
-        astrometryAPIURL = "https://" + astrometryAPIURL;
+int OnlineSolver::writeReducedUpload()
+{
+    reducedUploadPath.clear();
+    uploadBinning = 1;
+    if(m_ImageBuffer == nullptr)
+        return -1;
+
+    const int binning = qMax(1, m_ActiveParameters.downsample);
+    const int binnedWidth = m_Statistics.width / binning;
+    const int binnedHeight = m_Statistics.height / binning;
+    if(binnedWidth < 1 || binnedHeight < 1)
+        return -1;
+
+    //Like saveAsFITS, only the selected channel of an RGB image is uploaded
+    const long channelShift = (m_Statistics.channels < 3
+                               || usingMergedChannelImage) ? 0 : m_Statistics.samples_per_channel * m_Statistics.bytesPerPixel * m_ColorChannel;
+    const uint8_t *channel = m_ImageBuffer + channelShift;
+    const size_t pixelCount = static_cast<size_t>(binnedWidth) * binnedHeight;
+    QVector<float> binned(static_cast<int>(pixelCount));
+    switch(m_Statistics.dataType)
+    {
+        case SEP_TBYTE:
+            binPixels<uint8_t>(channel, m_Statistics.width, binning, binnedWidth, binnedHeight, binned.data());
+            break;
+        case TSHORT:
+            binPixels<int16_t>(channel, m_Statistics.width, binning, binnedWidth, binnedHeight, binned.data());
+            break;
+        case TUSHORT:
+            binPixels<uint16_t>(channel, m_Statistics.width, binning, binnedWidth, binnedHeight, binned.data());
+            break;
+        case TLONG:
+            binPixels<int32_t>(channel, m_Statistics.width, binning, binnedWidth, binnedHeight, binned.data());
+            break;
+        case TULONG:
+            binPixels<uint32_t>(channel, m_Statistics.width, binning, binnedWidth, binnedHeight, binned.data());
+            break;
+        case TFLOAT:
+            binPixels<float>(channel, m_Statistics.width, binning, binnedWidth, binnedHeight, binned.data());
+            break;
+        case TDOUBLE:
+            binPixels<double>(channel, m_Statistics.width, binning, binnedWidth, binnedHeight, binned.data());
+            break;
+        default:
+            return -1;
+    }
 
-    QUrl url(astrometryAPIURL);
-    url.setPath("/api/login");
-    request.setUrl(url);
+    //The stretch starts at the 1st percentile of a sample of the pixels, which is below the sky, and ends at the brightest pixel.
+    //At 8 bits it is a square root, so that the noise of the sky still has a few levels and the cores of the stars are not flat.
+    const size_t step = qMax<size_t>(1, pixelCount / 65536);
+    std::vector<float> sample;
+    sample.reserve(pixelCount / step + 1);
+    float high = binned[0];
+    for(size_t i = 0; i < pixelCount; i++)
+    {
+        high = qMax(high, binned[static_cast<int>(i)]);
+        if(i % step == 0)
+            sample.push_back(binned[static_cast<int>(i)]);
+    }
+    std::nth_element(sample.begin(), sample.begin() + sample.size() / 100, sample.end());
+    const float low = sample[sample.size() / 100];
+    const float range = high > low ? high - low : 1.0f;
+    const bool eightBits = m_ActiveParameters.onlineUploadBits == 8;
+    const float levels = eightBits ? 255.0f : 65535.0f;
+
+    QVector<uint8_t> bytes;
+    QVector<uint16_t> shorts;
+    if(eightBits)
+        bytes.resize(static_cast<int>(pixelCount));
+    else
+        shorts.resize(static_cast<int>(pixelCount));
+    for(size_t i = 0; i < pixelCount; i++)
+    {
+        float t = qBound(0.0f, (binned[static_cast<int>(i)] - low) / range, 1.0f);
+        if(eightBits)
+            bytes[static_cast<int>(i)] = static_cast<uint8_t>(qRound(qSqrt(t) * levels));
+        else
+            shorts[static_cast<int>(i)] = static_cast<uint16_t>(qRound(t * levels));
+    }
 
-    QVariantMap apiReq;
-    apiReq.insert("apikey", astrometryAPIKey);
-    QJsonObject json = QJsonObject::fromVariantMap(apiReq);
-    QJsonDocument json_doc(json);
+    //CFITSIO gzips a file whose name ends in .gz when it is closed, the server reads gzipped FITS files
+    const QString fileName = m_BasePath + "/" + m_BaseName + "_upload.fits.gz";
+    if(QFile::exists(fileName))
+        QFile(fileName).remove();
 
-    QString json_request = QString("request-json=%1").arg(QString(json_doc.toJson(QJsonDocument::Compact)));
-    networkManager->post(request, json_request.toUtf8());
+    int status = 0;
+    fitsfile *fptr { nullptr };
+    long naxes[2] = { binnedWidth, binnedHeight };
+    if (fits_create_file(&fptr, fileName.toLocal8Bit(), &status))
+    {
+        fits_report_error(stderr, status);
+        return status;
+    }
+    if (fits_create_img(fptr, eightBits ? BYTE_IMG : USHORT_IMG, 2, naxes, &status)
+            || fits_write_img(fptr, eightBits ? TBYTE : TUSHORT, 1, static_cast<LONGLONG>(pixelCount),
+                              eightBits ? static_cast<void *>(bytes.data()) : static_cast<void *>(shorts.data()), &status))
+    {
+        fits_report_error(stderr, status);
+        int closeStatus = 0;
+        fits_close_file(fptr, &closeStatus);
+        QFile(fileName).remove();
+        return status;
+    }
+    if(fits_close_file(fptr, &status))
+    {
+        emit logOutput(QString("Error closing file."));
+        return status;
+    }
 
-    workflowStage = AUTH_STAGE;
-    emit logOutput("Authenticating. . .");
+    reducedUploadPath = fileName;
+    uploadBinning = binning;
+    emit logOutput(QString("Uploading a copy of the image binned by %1 at %2 bits, %3 bytes").arg(binning).arg(eightBits ? 8 : 16).arg(
+                       QFileInfo(fileName).size()));
+    return 0;
+}
 
+bool OnlineSolver::writeWCS(const QByteArray &wcs)
+{
+    QString solutionFile = m_BasePath + "/" + m_BaseName + ".wcs";
+    QFile file(solutionFile);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        emit logOutput(("WCS File Write Error"));
+        return false;
+    }
+    file.write(wcs.data(), wcs.size());
+    file.close();
+    //The server solved the binned copy, so its pixels are binning pixels of the image on each side
+    if(uploadBinning > 1 && scaleWCSFile(solutionFile, uploadBinning) != 0)
+        emit logOutput("Failed to scale the WCS to the full resolution image");
+    loadWCS(); //Attempt to load WCS from the file
+    return true;
 }
 
-//This will start up the second stage, uploading the file
-void OnlineSolver::uploadFile()
+int OnlineSolver::scaleWCSFile(const QString &fileName, int binning)
 {
-    QNetworkRequest request;
+    int status = 0;
+    fitsfile *fptr { nullptr };
+    if (fits_open_diskfile(&fptr, fileName.toLocal8Bit(), READWRITE, &status))
+        return status;
 
-    QFile *fitsFile;
-    if(m_ExtractorType == EXTRACTOR_BUILTIN)
-        fitsFile = new QFile(fileToProcess);
-    else
-        fitsFile = new QFile(starXYLSFilePath);
-    bool rc = fitsFile->open(QIODevice::ReadOnly);
-    if (rc == false)
+    //Each keyword becomes value * factor + offset, a keyword that isn't in the header is left out
+    auto scaleKey = [&](const QString &key, double factor, double offset)
     {
-        emit logOutput(QString("Failed to open the file %1: %2").arg( fileToProcess, fitsFile->errorString()));
-        delete (fitsFile);
-        emit finished(-1);
-        return;
+        double value = 0;
+        if (fits_read_key(fptr, TDOUBLE, key.toLatin1().constData(), &value, nullptr, &status))
+        {
+            if(status == KEY_NO_EXIST)
+                status = 0;
+            return;
+        }
+        fits_update_key_dbl(fptr, key.toLatin1().constData(), value * factor + offset, -15, "&", &status);
+    };
+
+    //The center of the first binned pixel is at 0.5 + binning / 2 in the pixels of the image
+    scaleKey("CRPIX1", binning, 0.5 * (1 - binning));
+    scaleKey("CRPIX2", binning, 0.5 * (1 - binning));
+    scaleKey("CD1_1", 1.0 / binning, 0);
+    scaleKey("CD1_2", 1.0 / binning, 0);
+    scaleKey("CD2_1", 1.0 / binning, 0);
+    scaleKey("CD2_2", 1.0 / binning, 0);
+    scaleKey("IMAGEW", 0, m_Statistics.width);
+    scaleKey("IMAGEH", 0, m_Statistics.height);
+
+    //The coefficient of u^i v^j of the distortion is scaled by binning^(1 - i - j)
+    for(const QString &polynomial : {QString("A"), QString("B"), QString("AP"), QString("BP")})
+    {
+        int order = 0;
+        if (fits_read_key(fptr, TINT, (polynomial + "_ORDER").toLatin1().constData(), &order, nullptr, &status))
+        {
+            if(status == KEY_NO_EXIST)
+                status = 0;
+            continue;
+        }
+        for(int i = 0; i <= order; i++)
+            for(int j = 0; i + j <= order; j++)
+                scaleKey(QString("%1_%2_%3").arg(polynomial).arg(i).arg(j), qPow(binning, 1 - (i + j)), 0);
     }
 
-    QUrl url(astrometryAPIURL);
-    url.setPath("/api/upload");
-    request.setUrl(url);
+    int closeStatus = 0;
+    fits_close_file(fptr, &closeStatus);
+    return status ? status : closeStatus;
+}
 
-    QHttpMultiPart *reqEntity = new QHttpMultiPart(QHttpMultiPart::FormDataType);
+//This will start up the first stage, Authentication
+//The session key comes from the OnlineSession, which only logs in when it doesn't have one for this server and API key yet
+void OnlineSolver::authenticate()
+{
+    // If pure IP, add http to it.
+    if (!astrometryAPIURL.startsWith("https"))
+        astrometryAPIURL = "https://" + astrometryAPIURL;
+
+    workflowStage = AUTH_STAGE;
+    emit logOutput("Authenticating. . .");
+
+    onlineSession->requestSession(astrometryAPIURL, astrometryAPIKey, this, [this](const QString & key, const QString & error)
+    {
+        if (workflowStage != AUTH_STAGE || ignoreReplies)
+            return;
+        if (key.isEmpty())
+        {
+            if(!error.isEmpty())
+                emit logOutput(error);
+            emit logOutput(QString("%1 authentication failed. Check the validity of the API Key.").arg(astrometryAPIURL));
+            abort();
+            return;
+        }
+
+        sessionKey = key;
+
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Authentication to %1 is successful. Session: %2").arg(astrometryAPIURL, sessionKey));
+
+        uploadFile(); //Go to NEXT STAGE
+    });
+}
+
+QString OnlineSolver::uploadPath() const
+{
+    //Unless the server extracts the stars itself, only the table of the extracted stars is uploaded, which is a few kilobytes instead of the image
+    if(m_ExtractorType != EXTRACTOR_BUILTIN)
+        return starXYLSFilePath;
+    return reducedUploadPath.isEmpty() ? fileToProcess : reducedUploadPath;
+}
+
+QVariantMap OnlineSolver::uploadRequest() const
+{
+    const bool uploadStarList = m_ExtractorType != EXTRACTOR_BUILTIN;
 
     QVariantMap uploadReq;
     uploadReq.insert("publicly_visible", "n");
     uploadReq.insert("allow_modifications", "n");
-    uploadReq.insert("session", sessionKey);
     uploadReq.insert("allow_commercial_use", "n");
 
-    if(m_ExtractorType != EXTRACTOR_BUILTIN)
+    if(uploadStarList)
     {
         uploadReq.insert("image_width", m_Statistics.width);
         uploadReq.insert("image_height", m_Statistics.height);
@@ -241,8 +480,10 @@ void OnlineSolver::uploadFile()
     {
         uploadReq.insert("scale_type", "ul");
         uploadReq.insert("scale_units", getScaleUnitString());
-        uploadReq.insert("scale_lower", scalelo);
-        uploadReq.insert("scale_upper", scalehi);
+        //The pixels of a binned copy of the image are binning times as wide
+        const double pixelScale = scaleunit == ARCSEC_PER_PIX ? uploadBinning : 1;
+        uploadReq.insert("scale_lower", scalelo * pixelScale);
+        uploadReq.insert("scale_upper", scalehi * pixelScale);
     }
 
     if (m_UsePosition)
@@ -255,10 +496,72 @@ void OnlineSolver::uploadFile()
     //We would like the Coordinates found to be the center of the image
     uploadReq.insert("crpix_center", true);
 
-    if (m_ActiveParameters.downsample != 1)
+    //The star positions were already extracted from the whole image, so only the server's own extraction can be downsampled
+    //A reduced copy of the image is already binned by the downsample
+    if (!uploadStarList && reducedUploadPath.isEmpty() && m_ActiveParameters.downsample != 1)
         uploadReq.insert("downsample_factor", m_ActiveParameters.downsample);
 
     uploadReq.insert("parity", m_ActiveParameters.search_parity);
+    return uploadReq;
+}
+
+QByteArray OnlineSolver::makeResultKey() const
+{
+    QFile file(uploadPath());
+    if(!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if(!hash.addData(&file))
+        return QByteArray();
+    //The options are in the order of their names in the map, so the same options always make the same key
+    hash.addData(QJsonDocument(QJsonObject::fromVariantMap(uploadRequest())).toJson(QJsonDocument::Compact));
+    hash.addData(astrometryAPIURL.toUtf8());
+    return hash.result();
+}
+
+bool OnlineSolver::useCachedResult()
+{
+    OnlineSession::CachedResult cached;
+    if(!onlineSession->findResult(resultKey, cached))
+        return false;
+
+    emit logOutput(QString("The result of job %1 for this upload was cached, it is not sent to the server again.").arg(cached.jobID));
+    jobID = cached.jobID;
+    m_Solution = cached.solution;
+    m_HasSolved = true;
+
+    if(!cached.wcs.isEmpty())
+        writeWCS(cached.wcs);
+    workflowStage = NO_STAGE;
+    emit finished(0);
+    return true;
+}
+
+//This will start up the second stage, uploading the file
+void OnlineSolver::uploadFile()
+{
+    QNetworkRequest request;
+
+    const bool uploadStarList = m_ExtractorType != EXTRACTOR_BUILTIN;
+    const QString uploadPath = this->uploadPath();
+    QFile *fitsFile = new QFile(uploadPath);
+    bool rc = fitsFile->open(QIODevice::ReadOnly);
+    if (rc == false)
+    {
+        emit logOutput(QString("Failed to open the file %1: %2").arg( uploadPath, fitsFile->errorString()));
+        delete (fitsFile);
+        emit finished(-1);
+        return;
+    }
+
+    QUrl url(astrometryAPIURL);
+    url.setPath("/api/upload");
+    request.setUrl(url);
+
+    QHttpMultiPart *reqEntity = new QHttpMultiPart(QHttpMultiPart::FormDataType);
+
+    QVariantMap uploadReq = uploadRequest();
+    uploadReq.insert("session", sessionKey);
 
     QJsonObject json = QJsonObject::fromVariantMap(uploadReq);
     QJsonDocument json_doc(json);
@@ -273,7 +576,7 @@ void OnlineSolver::uploadFile()
 
     filePart.setHeader(QNetworkRequest::ContentTypeHeader, "application/octet-stream");
     filePart.setHeader(QNetworkRequest::ContentDispositionHeader,
-                       QString("form-data; name=\"file\"; filename=\"%1\"").arg(fileToProcess));
+                       QString("form-data; name=\"file\"; filename=\"%1\"").arg(QFileInfo(uploadPath).fileName()));
     filePart.setBodyDevice(fitsFile);
 
     // Re-parent so that it get deleted later
@@ -282,11 +585,15 @@ void OnlineSolver::uploadFile()
     reqEntity->append(jsonPart);
     reqEntity->append(filePart);
 
-    QNetworkReply *reply = networkManager->post(request, reqEntity);
+    QNetworkReply *reply = onlineSession->networkManager()->post(request, reqEntity);
     reqEntity->setParent(reply); //So that it can be deleted later
+    watchReply(reply);
 
     workflowStage = UPLOAD_STAGE;
-    emit logOutput(("Uploading file..."));
+    if(uploadStarList)
+        emit logOutput(QString("Uploading the list of %1 stars, %2 bytes...").arg(m_ExtractedStars.size()).arg(fitsFile->size()));
+    else
+        emit logOutput(("Uploading file..."));
 }
 
 //This will start up the third stage, waiting till processing is done
@@ -316,7 +623,7 @@ void OnlineSolver::checkJobCalibration()
     QNetworkRequest request;
     QUrl getCablirationResult = QUrl(QString("%1/api/jobs/%2/calibration").arg(astrometryAPIURL).arg(jobID));
     request.setUrl(getCablirationResult);
-    networkManager->get(request);
+    watchReply(onlineSession->networkManager()->get(request));
 
     workflowStage = JOB_CALIBRATION_STAGE;
     emit logOutput(("Requesting the results..."));
@@ -326,7 +633,7 @@ void OnlineSolver::checkJobCalibration()
 void OnlineSolver::getJobLogFile()
 {
     QString URL = QString("%1/joblog/%2").arg(astrometryAPIURL).arg(jobID);
-    networkManager->get(QNetworkRequest(QUrl(URL)));
+    watchReply(onlineSession->networkManager()->get(QNetworkRequest(QUrl(URL))));
 
     workflowStage = LOG_LOADING_STAGE;
     emit logOutput(("Downloading the Log file..."));
@@ -336,7 +643,7 @@ void OnlineSolver::getJobLogFile()
 void OnlineSolver::getJobWCSFile()
 {
     QString URL = QString("%1/wcs_file/%2").arg(astrometryAPIURL).arg(jobID);
-    networkManager->get(QNetworkRequest(QUrl(URL)));
+    watchReply(onlineSession->networkManager()->get(QNetworkRequest(QUrl(URL))));
 
     workflowStage = WCS_LOADING_STAGE;
     emit logOutput(("Downloading the WCS file..."));
@@ -351,14 +658,14 @@ void OnlineSolver::checkJobs()
         QNetworkRequest request;
         QUrl getJobID = QUrl(QString("%1/api/submissions/%2").arg(astrometryAPIURL).arg(subID));
         request.setUrl(getJobID);
-        networkManager->get(request);
+        watchReply(onlineSession->networkManager()->get(request));
     }
     if(workflowStage == JOB_MONITORING_STAGE)
     {
         QNetworkRequest request;
         QUrl getJobStatus = QUrl(QString("%1/api/jobs/%2").arg(astrometryAPIURL).arg(jobID));
         request.setUrl(getJobStatus);
-        networkManager->get(request);
+        watchReply(onlineSession->networkManager()->get(request));
     }
 }
 
@@ -370,6 +677,11 @@ void OnlineSolver::onResult(QNetworkReply *reply)
     QString status;
     QList<QVariant> jsonArray;
 
+    // The replies belong to the network manager of the session, which is not deleted with this solver
+    reply->deleteLater();
+    if (ignoreReplies)
+        return;
+
     if(m_SSLogLevel != LOG_OFF)
         emit logOutput("Reply Received");
 
@@ -410,27 +722,19 @@ void OnlineSolver::onResult(QNetworkReply *reply)
     }
     switch (workflowStage)
     {
-        case AUTH_STAGE:
-            status = result["status"].toString();
-            if (status != "success")
-            {
-                emit logOutput(QString("%1 authentication failed. Check the validity of the API Key.").arg(astrometryAPIURL));
-                abort();
-                return;
-            }
-
-            sessionKey = result["session"].toString();
-
-            if(m_SSLogLevel != LOG_OFF)
-                emit logOutput(QString("Authentication to %1 is successful. Session: %2").arg(astrometryAPIURL, sessionKey));
-
-            uploadFile(); //Go to NEXT STAGE
-            break;
-
         case UPLOAD_STAGE:
             status = result["status"].toString();
             if (status != "success")
             {
+                // A session key shared with the other solves can expire on the server, then it logs in again once
+                if (!retriedSession && result["errormessage"].toString().contains("session"))
+                {
+                    retriedSession = true;
+                    emit logOutput(("The session expired, authenticating again."));
+                    onlineSession->invalidate(astrometryAPIURL, astrometryAPIKey, sessionKey);
+                    authenticate();
+                    return;
+                }
                 emit logOutput(("Upload failed."));
                 abort();
                 return;
@@ -554,6 +858,8 @@ void OnlineSolver::onResult(QNetworkReply *reply)
                 decErr = (search_dec - dec) * 3600;
             }
             FITSImage::Parity par = (parity > 0) ? FITSImage::NEGATIVE : FITSImage::POSITIVE;
+            //The scale is of the pixels that were uploaded
+            pixscale /= uploadBinning;
             m_Solution = {fieldw, fieldh, ra, dec, orientation, pixscale, par, raErr, decErr};
             m_HasSolved = true;
 
@@ -588,17 +894,19 @@ void OnlineSolver::onResult(QNetworkReply *reply)
         case WCS_LOADING_STAGE:
         {
             QByteArray responseData = reply->readAll();
-            QString solutionFile = m_BasePath + "/" + m_BaseName + ".wcs";
-            QFile file(solutionFile);
-            if (!file.open(QIODevice::WriteOnly))
+            if(!resultKey.isEmpty())
+            {
+                OnlineSession::CachedResult cached;
+                cached.solution = m_Solution;
+                cached.jobID = jobID;
+                cached.wcs = responseData;
+                onlineSession->storeResult(resultKey, cached);
+            }
+            if (!writeWCS(responseData))
             {
-                emit logOutput(("WCS File Write Error"));
                 emit finished(0); //We still have the solution, this is not a failure!
                 return;
             }
-            file.write(responseData.data(), responseData.size());
-            file.close();
-            loadWCS(); //Attempt to load WCS from the file
             emit finished(0); //Success! We are completely done, whether or not the WCS loading was successful
             workflowStage = NO_STAGE;
         }
@@ -8,11 +8,13 @@
 #pragma once
 
 #include "externalextractorsolver.h"
+#include "onlinesession.h"
 
 #include <QFile>
 #include <QHttpMultiPart>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QNetworkAccessManager>
 #include <QNetworkRequest>
 #include <QNetworkReply>
 #include <QUrl>
@@ -36,6 +38,7 @@ class OnlineSolver : public ExternalExtractorSolver
         QString astrometryAPIKey;   // The API key used by the online solver to identify the user solving the image
         QString astrometryAPIURL;   // The URL of the online solver
         QString fileToProcess;      // The file path of the image to solve
+        QSharedPointer<OnlineSession> onlineSession; // The connections and session keys shared with the other online solves, one is made when it is not set
 
         // An enum to keep track of which stage in the solving we are on
         typedef enum
@@ -61,10 +64,15 @@ class OnlineSolver : public ExternalExtractorSolver
          */
         void abort() override;
 
+        /**
+         * @brief cleanupTempFiles removes the reduced copy of the image that was uploaded with the other temporary files
+         */
+        void cleanupTempFiles() override;
+
     public slots:
 
         /**
-         * @brief onResult is the slot that gets called when the server replies to a request
+         * @brief onResult is the slot that gets called when the server replies to a request sent by this solver
          * @param reply is the reply that was received
          */
         void onResult(QNetworkReply *reply);
@@ -78,12 +86,15 @@ class OnlineSolver : public ExternalExtractorSolver
 
         // This keeps track of which stage in the solve we are currently on
         WorkflowStage workflowStage { NO_STAGE };
-        // This is the network manager that handles all the online communication with the solver
-        QNetworkAccessManager *networkManager { nullptr };
         QString sessionKey;         // This is the session key reported by the online solver
+        bool retriedSession { false }; // Whether the upload was already retried with a new session key after the server rejected the shared one
+        bool ignoreReplies { false };  // This gets set when the replies the server still sends should not be handled anymore
         int subID { 0 };            // This is the submission id reported by the online solver
         int jobID { 0 };            // This is the job id issued by the online solver
         int job_retries { 0 };      // Keeps track of how many times it retried to start the solving task
+        QByteArray resultKey;       // The key of the upload in the result cache of the session, empty if the upload can't be read
+        QString reducedUploadPath;  // The reduced copy of the image that is uploaded instead of it, see Parameters::reduceOnlineUpload
+        int uploadBinning { 1 };    // How many pixels of the image are binned into one pixel of the upload on each axis
         QElapsedTimer solverTimer;  // This logs how long the online solver has been running
 
         /**
@@ -96,6 +107,55 @@ class OnlineSolver : public ExternalExtractorSolver
          */
         void run() override;
 
+        /**
+         * @brief watchReply has the reply to a request sent with the network manager of the session handled by onResult
+         * @param reply is the reply of the request that was sent
+         */
+        void watchReply(QNetworkReply *reply);
+
+        /**
+         * @brief writeReducedUpload writes the reduced copy of the image that is uploaded, binned by the downsample, stretched to
+         * the bits of Parameters::onlineUploadBits and gzipped, so that a large image is a small fraction of its size on the way to the server
+         * @return 0 if it was written, otherwise the image itself is uploaded
+         */
+        int writeReducedUpload();
+
+        /**
+         * @brief writeWCS writes the WCS file from the server, scales it to the full resolution image if a binned copy was uploaded, and loads it
+         * @param wcs is the WCS file that the server sent
+         * @return false if the file could not be written
+         */
+        bool writeWCS(const QByteArray &wcs);
+
+        /**
+         * @brief scaleWCSFile scales the pixels of the TAN projection and the SIP distortion of a WCS file by the binning of the upload,
+         * the same way as sip_scale in astrometry.net
+         * @return 0 if it was scaled, or the CFITSIO status
+         */
+        int scaleWCSFile(const QString &fileName, int binning);
+
+        /**
+         * @brief uploadPath gets the file that is uploaded, the table of the extracted stars or the image if the server extracts them
+         */
+        QString uploadPath() const;
+
+        /**
+         * @brief uploadRequest gets the options of the upload, without the session key
+         */
+        QVariantMap uploadRequest() const;
+
+        /**
+         * @brief makeResultKey makes the key of the upload in the result cache, a hash of the uploaded file, the options and the server
+         * @return The key, or an empty key if the file can't be read
+         */
+        QByteArray makeResultKey() const;
+
+        /**
+         * @brief useCachedResult finishes the solve with the result of an earlier solve of the same upload, if the session has one
+         * @return false if there is no result for the upload
+         */
+        bool useCachedResult();
+
         /**
          * @brief authenticate Starts Stage 1, authenticating with the online server
          */
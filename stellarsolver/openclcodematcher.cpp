@@ -0,0 +1,268 @@
+/*  OpenCLCodeMatcher, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "openclcodematcher.h"
+#include "opencldevice.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#ifdef HAVE_OPENCL
+#define CL_TARGET_OPENCL_VERSION 120
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+namespace
+{
+// The most values in a code, DCMAX of the solver, and MAX_CODE_DIM of the kernel
+const int MAX_CODE_DIM = 6;
+const size_t WORK_GROUP_SIZE = 64;
+
+// Each work item is one code of the tree, which it compares with all of the codes of the quads, QUERY_TILE at a time from local
+// memory.  The pairs within tol2 are (code of the quad, code of the tree), and "count" says how many there are even if they
+// don't all fit in "pairs".
+const char *matchSource = R"(
+#define QUERY_TILE 256
+#define MAX_CODE_DIM 6
+__kernel void matchCodes(__global const float *tree, int ntree, int dim, __global const float *queries, int nqueries,
+                         float tol2, __global int *count, int capacity, __global int2 *pairs)
+{
+    __local float tile[QUERY_TILE * MAX_CODE_DIM];
+    const int t = get_global_id(0);
+    const int lid = get_local_id(0);
+    const int lsize = get_local_size(0);
+    float code[MAX_CODE_DIM];
+    for(int d = 0; d < dim; d++)
+        code[d] = t < ntree ? tree[(size_t)t * dim + d] : 0.0f;
+    for(int q0 = 0; q0 < nqueries; q0 += QUERY_TILE)
+    {
+        const int nq = min(QUERY_TILE, nqueries - q0);
+        for(int i = lid; i < nq * dim; i += lsize)
+            tile[i] = queries[q0 * dim + i];
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if(t < ntree)
+        {
+            for(int q = 0; q < nq; q++)
+            {
+                float d2 = 0.0f;
+                for(int d = 0; d < dim; d++)
+                {
+                    const float diff = code[d] - tile[q * dim + d];
+                    d2 += diff * diff;
+                }
+                if(d2 <= tol2)
+                {
+                    const int k = atomic_inc(count);
+                    if(k < capacity)
+                        pairs[k] = (int2)(q0 + q, t);
+                }
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+)";
+}
+#endif
+
+OpenCLCodeMatcher &OpenCLCodeMatcher::instance()
+{
+    static OpenCLCodeMatcher matcher;
+    return matcher;
+}
+
+OpenCLCodeMatcher::OpenCLCodeMatcher()
+{
+    OpenCLDevice &device = OpenCLDevice::instance();
+#ifdef HAVE_OPENCL
+    m_Kernel = device.buildKernel(matchSource, "matchCodes", m_Description);
+    m_Available = m_Kernel != nullptr;
+    if(m_Available)
+        m_Description = QString("The codes of the larger index files are searched on %1 with OpenCL.").arg(device.description());
+#else
+    m_Description = device.description();
+#endif
+}
+
+OpenCLCodeMatcher::~OpenCLCodeMatcher()
+{
+#ifdef HAVE_OPENCL
+    for(const UploadedTree &uploaded : m_Trees)
+        clReleaseMemObject(static_cast<cl_mem>(uploaded.buffer));
+#endif
+    OpenCLDevice::releaseKernel(m_Kernel);
+}
+
+int OpenCLCodeMatcher::match(void *userdata, const kdtree_t *tree, const double *codes, int ncodes, int dimcode, double tol2,
+                             int *counts, u32 **matches, double **dists2)
+{
+    return static_cast<OpenCLCodeMatcher *>(userdata)->search(tree, codes, ncodes, dimcode, tol2, counts, matches, dists2);
+}
+
+void *OpenCLCodeMatcher::uploadTree(const kdtree_t *tree)
+{
+#ifdef HAVE_OPENCL
+    for(int i = 0; i < m_Trees.size(); i++)
+    {
+        const UploadedTree &uploaded = m_Trees.at(i);
+        if(uploaded.tree == tree && uploaded.ndata == tree->ndata && uploaded.ndim == tree->ndim
+                && uploaded.data == tree->data.any)
+        {
+            m_Trees.move(i, m_Trees.size() - 1);
+            return m_Trees.last().buffer;
+        }
+    }
+
+    const size_t values = static_cast<size_t>(tree->ndata) * tree->ndim;
+    const size_t bytes = values * sizeof(float);
+    if(bytes > MAX_TREE_BYTES)
+        return nullptr;
+    while(!m_Trees.isEmpty() && m_TreeBytes + bytes > MAX_TREE_BYTES)
+    {
+        UploadedTree oldest = m_Trees.takeFirst();
+        clReleaseMemObject(static_cast<cl_mem>(oldest.buffer));
+        m_TreeBytes -= oldest.bytes;
+    }
+
+    std::vector<double> data(values);
+    kdtree_copy_data_double(tree, 0, tree->ndata, data.data());
+    std::vector<float> floats(data.begin(), data.end());
+    cl_int err = CL_SUCCESS;
+    cl_mem buffer = clCreateBuffer(static_cast<cl_context>(OpenCLDevice::instance().context()),
+                                   CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, floats.data(), &err);
+    if(err != CL_SUCCESS)
+        return nullptr;
+    m_Trees.append({tree, tree->ndata, tree->ndim, tree->data.any, buffer, bytes});
+    m_TreeBytes += bytes;
+    return buffer;
+#else
+    Q_UNUSED(tree);
+    return nullptr;
+#endif
+}
+
+int OpenCLCodeMatcher::search(const kdtree_t *tree, const double *codes, int ncodes, int dimcode, double tol2, int *counts,
+                              u32 **matches, double **dists2)
+{
+#ifdef HAVE_OPENCL
+    if(!m_Available || !tree || tree->ndata < MIN_TREE_CODES || tree->ndim != dimcode || dimcode > MAX_CODE_DIM || ncodes <= 0)
+        return -1;
+
+    OpenCLDevice &device = OpenCLDevice::instance();
+    QMutexLocker locker(&device.mutex());
+    cl_mem treeBuffer = static_cast<cl_mem>(uploadTree(tree));
+    if(!treeBuffer)
+        return -1;
+    cl_context context = static_cast<cl_context>(device.context());
+    cl_command_queue queue = static_cast<cl_command_queue>(device.queue());
+    cl_kernel clKernel = static_cast<cl_kernel>(m_Kernel);
+
+    std::vector<float> queries(codes, codes + static_cast<size_t>(ncodes) * dimcode);
+    // The GPU compares in single precision, so it takes a little more than tol2 and the matches are checked in double below
+    const float gpuTol2 = static_cast<float>(tol2 * 1.01 + 1e-6);
+    const int ntree = tree->ndata;
+    int capacity = std::max(1024, ncodes * 16);
+    int found = 0;
+    std::vector<cl_int2> pairs;
+
+    cl_int err = CL_SUCCESS;
+    cl_mem queryBuffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, queries.size() * sizeof(float),
+                                        queries.data(), &err);
+    if(err != CL_SUCCESS)
+        return -1;
+    cl_mem countBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(int), nullptr, &err);
+    if(err != CL_SUCCESS)
+    {
+        clReleaseMemObject(queryBuffer);
+        return -1;
+    }
+
+    // If there are more pairs than fit, it runs again with room for all of them
+    for(int attempt = 0; attempt < 2 && err == CL_SUCCESS; attempt++)
+    {
+        cl_mem pairBuffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, static_cast<size_t>(capacity) * sizeof(cl_int2), nullptr,
+                                           &err);
+        if(err != CL_SUCCESS)
+            break;
+        const int zero = 0;
+        err = clEnqueueWriteBuffer(queue, countBuffer, CL_TRUE, 0, sizeof(int), &zero, 0, nullptr, nullptr);
+        err |= clSetKernelArg(clKernel, 0, sizeof(cl_mem), &treeBuffer);
+        err |= clSetKernelArg(clKernel, 1, sizeof(int), &ntree);
+        err |= clSetKernelArg(clKernel, 2, sizeof(int), &dimcode);
+        err |= clSetKernelArg(clKernel, 3, sizeof(cl_mem), &queryBuffer);
+        err |= clSetKernelArg(clKernel, 4, sizeof(int), &ncodes);
+        err |= clSetKernelArg(clKernel, 5, sizeof(float), &gpuTol2);
+        err |= clSetKernelArg(clKernel, 6, sizeof(cl_mem), &countBuffer);
+        err |= clSetKernelArg(clKernel, 7, sizeof(int), &capacity);
+        err |= clSetKernelArg(clKernel, 8, sizeof(cl_mem), &pairBuffer);
+        const size_t globalSize = (ntree + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE * WORK_GROUP_SIZE;
+        if(err == CL_SUCCESS)
+            err = clEnqueueNDRangeKernel(queue, clKernel, 1, nullptr, &globalSize, &WORK_GROUP_SIZE, 0, nullptr, nullptr);
+        if(err == CL_SUCCESS)
+            err = clEnqueueReadBuffer(queue, countBuffer, CL_TRUE, 0, sizeof(int), &found, 0, nullptr, nullptr);
+        if(err == CL_SUCCESS && found <= capacity)
+        {
+            pairs.resize(found);
+            if(found > 0)
+                err = clEnqueueReadBuffer(queue, pairBuffer, CL_TRUE, 0, found * sizeof(cl_int2), pairs.data(), 0, nullptr, nullptr);
+            clReleaseMemObject(pairBuffer);
+            break;
+        }
+        clReleaseMemObject(pairBuffer);
+        capacity = found;
+    }
+    clReleaseMemObject(countBuffer);
+    clReleaseMemObject(queryBuffer);
+    if(err != CL_SUCCESS || found > static_cast<int>(pairs.size()))
+        return -1;
+    locker.unlock();
+
+    // The matches of each code in the order of the tree, which is the order that the search of the tree finds them in
+    std::sort(pairs.begin(), pairs.end(), [](const cl_int2 & a, const cl_int2 & b)
+    {
+        return a.s[0] != b.s[0] ? a.s[0] < b.s[0] : a.s[1] < b.s[1];
+    });
+    *matches = static_cast<u32 *>(malloc(std::max<size_t>(1, pairs.size()) * sizeof(u32)));
+    *dists2 = static_cast<double *>(malloc(std::max<size_t>(1, pairs.size()) * sizeof(double)));
+    std::fill(counts, counts + ncodes, 0);
+    int nmatches = 0;
+    double code[MAX_CODE_DIM];
+    for(const cl_int2 &pair : pairs)
+    {
+        const int query = pair.s[0];
+        kdtree_copy_data_double(tree, pair.s[1], 1, code);
+        double d2 = 0;
+        for(int d = 0; d < dimcode; d++)
+        {
+            const double diff = code[d] - codes[static_cast<size_t>(query) * dimcode + d];
+            d2 += diff * diff;
+        }
+        if(d2 > tol2)
+            continue;
+        (*matches)[nmatches] = kdtree_permute(tree, pair.s[1]);
+        (*dists2)[nmatches] = d2;
+        nmatches++;
+        counts[query]++;
+    }
+    return 0;
+#else
+    Q_UNUSED(tree);
+    Q_UNUSED(codes);
+    Q_UNUSED(ncodes);
+    Q_UNUSED(dimcode);
+    Q_UNUSED(tol2);
+    Q_UNUSED(counts);
+    Q_UNUSED(matches);
+    Q_UNUSED(dists2);
+    return -1;
+#endif
+}
@@ -0,0 +1,89 @@
+/*  OpenCLCodeMatcher, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QList>
+#include <QString>
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/kdtree.h"
+}
+
+/**
+ * @brief The OpenCLCodeMatcher class searches the code trees of the index files for the codes of many quads at once on a GPU with
+ * OpenCL, see solver_code_matcher_t.  Each work item compares one code of the tree with all of the codes of the quads, so it does
+ * not follow the tree at all, which is only worth it for the trees with many codes, the others are still searched on the CPU.  The
+ * matches are checked again in double precision on the CPU and sorted into the order that the search of the tree finds them in,
+ * so the solver finds the same matches in the same order either way.  The codes of a tree are sent to the GPU the first time it is
+ * searched and kept there for the next solves.  It is only built with USE_OPENCL, otherwise it is never available.
+ */
+class OpenCLCodeMatcher
+{
+    public:
+        /**
+         * @brief instance gets the code matcher of the process, it finds the GPU the first time
+         */
+        static OpenCLCodeMatcher &instance();
+
+        /**
+         * @brief isAvailable gets whether there is a GPU to search the codes on
+         */
+        bool isAvailable() const
+        {
+            return m_Available;
+        }
+
+        /**
+         * @brief description gets why there is no GPU to search the codes on, or the device that it uses otherwise
+         */
+        QString description() const
+        {
+            return m_Description;
+        }
+
+        /**
+         * @brief match is the solver_code_matcher_t of the solver, with the OpenCLCodeMatcher as its userdata
+         */
+        static int match(void *userdata, const kdtree_t *tree, const double *codes, int ncodes, int dimcode, double tol2,
+                         int *counts, u32 **matches, double **dists2);
+
+        ~OpenCLCodeMatcher();
+
+    private:
+        OpenCLCodeMatcher();
+        OpenCLCodeMatcher(const OpenCLCodeMatcher &) = delete;
+        OpenCLCodeMatcher &operator=(const OpenCLCodeMatcher &) = delete;
+
+        // The codes of a tree on the GPU, a tree is the same one while its number of codes, dimension and data are.
+        struct UploadedTree
+        {
+            const kdtree_t *tree;
+            int ndata;
+            int ndim;
+            const void *data;
+            void *buffer;       // The cl_mem with the codes as floats
+            size_t bytes;
+        };
+
+        int search(const kdtree_t *tree, const double *codes, int ncodes, int dimcode, double tol2, int *counts, u32 **matches,
+                   double **dists2);
+        void *uploadTree(const kdtree_t *tree);
+
+        // Trees with fewer codes than this are faster to search on the CPU
+        static const int MIN_TREE_CODES = 20000;
+        // The most memory that the codes of the trees take on the GPU
+        static const size_t MAX_TREE_BYTES = static_cast<size_t>(512) * 1024 * 1024;
+
+        bool m_Available { false };
+        QString m_Description;
+        void *m_Kernel { nullptr };     // The cl_kernel of the search
+        QList<UploadedTree> m_Trees;    // The most recently used last
+        size_t m_TreeBytes { 0 };
+};
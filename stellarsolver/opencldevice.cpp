@@ -0,0 +1,138 @@
+/*  OpenCLDevice, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "opencldevice.h"
+
+#include <vector>
+
+#ifdef HAVE_OPENCL
+#define CL_TARGET_OPENCL_VERSION 120
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+#endif
+
+OpenCLDevice &OpenCLDevice::instance()
+{
+    static OpenCLDevice device;
+    return device;
+}
+
+OpenCLDevice::OpenCLDevice()
+{
+#ifdef HAVE_OPENCL
+    cl_uint numPlatforms = 0;
+    if(clGetPlatformIDs(0, nullptr, &numPlatforms) != CL_SUCCESS || numPlatforms == 0)
+    {
+        m_Description = "There is no OpenCL platform.";
+        return;
+    }
+    std::vector<cl_platform_id> platforms(numPlatforms);
+    clGetPlatformIDs(numPlatforms, platforms.data(), nullptr);
+
+    // Only a GPU is any help, an OpenCL device on the CPU would take the threads of the star extraction and the solver
+    cl_device_id device = nullptr;
+    for(cl_platform_id platform : platforms)
+    {
+        cl_uint numDevices = 0;
+        if(clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, &numDevices) == CL_SUCCESS && numDevices > 0)
+            break;
+        device = nullptr;
+    }
+    if(!device)
+    {
+        m_Description = "There is no OpenCL GPU.";
+        return;
+    }
+    m_Device = device;
+
+    char name[256] = {0};
+    clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name) - 1, name, nullptr);
+
+    cl_int err = CL_SUCCESS;
+    cl_context context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &err);
+    if(err != CL_SUCCESS)
+    {
+        m_Description = QString("The OpenCL context for %1 could not be created, error %2.").arg(name).arg(err);
+        return;
+    }
+    m_Context = context;
+    cl_command_queue queue = clCreateCommandQueue(context, device, 0, &err);
+    if(err != CL_SUCCESS)
+    {
+        m_Description = QString("The OpenCL command queue for %1 could not be created, error %2.").arg(name).arg(err);
+        return;
+    }
+    m_Queue = queue;
+    m_Available = true;
+    m_Description = QString(name);
+#else
+    m_Description = "StellarSolver was built without OpenCL.";
+#endif
+}
+
+OpenCLDevice::~OpenCLDevice()
+{
+#ifdef HAVE_OPENCL
+    if(m_Queue)
+        clReleaseCommandQueue(static_cast<cl_command_queue>(m_Queue));
+    if(m_Context)
+        clReleaseContext(static_cast<cl_context>(m_Context));
+#endif
+}
+
+void *OpenCLDevice::buildKernel(const char *source, const char *name, QString &error)
+{
+#ifdef HAVE_OPENCL
+    if(!m_Available)
+    {
+        error = m_Description;
+        return nullptr;
+    }
+    cl_device_id device = static_cast<cl_device_id>(m_Device);
+    cl_int err = CL_SUCCESS;
+    cl_program program = clCreateProgramWithSource(static_cast<cl_context>(m_Context), 1, &source, nullptr, &err);
+    if(err != CL_SUCCESS)
+    {
+        error = QString("The OpenCL program of %1 could not be created, error %2.").arg(name).arg(err);
+        return nullptr;
+    }
+    err = clBuildProgram(program, 1, &device, "-cl-fast-relaxed-math", nullptr, nullptr);
+    if(err != CL_SUCCESS)
+    {
+        error = QString("The OpenCL program of %1 could not be built for %2, error %3.").arg(name).arg(m_Description).arg(err);
+        clReleaseProgram(program);
+        return nullptr;
+    }
+    cl_kernel kernel = clCreateKernel(program, name, &err);
+    // The kernel keeps the program
+    clReleaseProgram(program);
+    if(err != CL_SUCCESS)
+    {
+        error = QString("The OpenCL kernel %1 could not be created, error %2.").arg(name).arg(err);
+        return nullptr;
+    }
+    return kernel;
+#else
+    Q_UNUSED(source);
+    Q_UNUSED(name);
+    error = m_Description;
+    return nullptr;
+#endif
+}
+
+void OpenCLDevice::releaseKernel(void *kernel)
+{
+#ifdef HAVE_OPENCL
+    if(kernel)
+        clReleaseKernel(static_cast<cl_kernel>(kernel));
+#else
+    Q_UNUSED(kernel);
+#endif
+}
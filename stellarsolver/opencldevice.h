@@ -0,0 +1,90 @@
+/*  OpenCLDevice, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QMutex>
+#include <QString>
+
+/**
+ * @brief The OpenCLDevice class is the GPU of the process that the OpenCL parts of StellarSolver run on, see OpenCLFilter and
+ * OpenCLCodeMatcher.  It finds the GPU and makes its context and command queue the first time it is used.  It is only built with
+ * USE_OPENCL, otherwise it is never available, and it is also not available when there is no GPU.  The OpenCL objects are void
+ * pointers so that the headers don't need OpenCL.
+ */
+class OpenCLDevice
+{
+    public:
+        /**
+         * @brief instance gets the device of the process
+         */
+        static OpenCLDevice &instance();
+
+        /**
+         * @brief isAvailable gets whether there is a GPU to run on
+         */
+        bool isAvailable() const
+        {
+            return m_Available;
+        }
+
+        /**
+         * @brief description gets why there is no GPU to run on, or the name of the one that it uses otherwise
+         */
+        QString description() const
+        {
+            return m_Description;
+        }
+
+        /**
+         * @brief buildKernel builds a program for the device and makes one of its kernels
+         * @param source The source of the program
+         * @param name The name of the kernel
+         * @param error Gets why it failed, if it does
+         * @return The cl_kernel, or nullptr if it could not be built.  It is released with releaseKernel.
+         */
+        void *buildKernel(const char *source, const char *name, QString &error);
+
+        /**
+         * @brief releaseKernel releases a kernel from buildKernel
+         */
+        static void releaseKernel(void *kernel);
+
+        // The cl_context and cl_command_queue of the device
+        void *context() const
+        {
+            return m_Context;
+        }
+        void *queue() const
+        {
+            return m_Queue;
+        }
+
+        /**
+         * @brief mutex is locked while the command queue is used, so the threads that use the device take turns
+         */
+        QMutex &mutex()
+        {
+            return m_Mutex;
+        }
+
+        ~OpenCLDevice();
+
+    private:
+        OpenCLDevice();
+        OpenCLDevice(const OpenCLDevice &) = delete;
+        OpenCLDevice &operator=(const OpenCLDevice &) = delete;
+
+        bool m_Available { false };
+        QString m_Description;
+        QMutex m_Mutex;
+
+        void *m_Device { nullptr };
+        void *m_Context { nullptr };
+        void *m_Queue { nullptr };
+};
@@ -0,0 +1,146 @@
+/*  OpenCLFilter, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "openclfilter.h"
+#include "opencldevice.h"
+
+#include <cmath>
+#include <vector>
+
+#ifdef HAVE_OPENCL
+#define CL_TARGET_OPENCL_VERSION 120
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+namespace
+{
+// Each work item is one pixel of the filtered image, out[y][x] = sum conv[cy][cx] * image[y + cy - convh / 2][x + cx - convw / 2]
+// like convolve() in sep/convolve.cpp, where the pixels outside of the image add nothing.
+const char *convolveSource = R"(
+__kernel void convolve(__global const float *image, int stride, int width, int height,
+                       __constant float *conv, int convw, int convh, __global float *filtered)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    if(x >= width || y >= height)
+        return;
+    const int x0 = x - convw / 2;
+    const int y0 = y - convh / 2;
+    float sum = 0.0f;
+    for(int cy = max(0, -y0); cy < min(convh, height - y0); cy++)
+    {
+        __global const float *line = image + (size_t)(y0 + cy) * stride;
+        for(int cx = max(0, -x0); cx < min(convw, width - x0); cx++)
+            sum += conv[cy * convw + cx] * line[x0 + cx];
+    }
+    filtered[(size_t)y * width + x] = sum;
+}
+)";
+}
+#endif
+
+OpenCLFilter &OpenCLFilter::instance()
+{
+    static OpenCLFilter filter;
+    return filter;
+}
+
+OpenCLFilter::OpenCLFilter()
+{
+    OpenCLDevice &device = OpenCLDevice::instance();
+#ifdef HAVE_OPENCL
+    m_Kernel = device.buildKernel(convolveSource, "convolve", m_Description);
+    m_Available = m_Kernel != nullptr;
+    if(m_Available)
+        m_Description = QString("The image is filtered on %1 with OpenCL.").arg(device.description());
+#else
+    m_Description = device.description();
+#endif
+}
+
+OpenCLFilter::~OpenCLFilter()
+{
+    OpenCLDevice::releaseKernel(m_Kernel);
+}
+
+bool OpenCLFilter::convolve(const float *image, int stride, int width, int height, const float *conv, int convw, int convh,
+                            float *filtered)
+{
+#ifdef HAVE_OPENCL
+    if(!m_Available || width <= 0 || height <= 0 || convw <= 0 || convh <= 0)
+        return false;
+
+    // The kernel is normalized like the one of sep_extract, so the threshold means the same
+    std::vector<float> kernel(convw * convh);
+    double sum = 0;
+    for(int i = 0; i < convw * convh; i++)
+        sum += fabs(conv[i]);
+    if(sum == 0)
+        return false;
+    for(int i = 0; i < convw * convh; i++)
+        kernel[i] = conv[i] / sum;
+
+    OpenCLDevice &device = OpenCLDevice::instance();
+    QMutexLocker locker(&device.mutex());
+    cl_context context = static_cast<cl_context>(device.context());
+    cl_command_queue queue = static_cast<cl_command_queue>(device.queue());
+    cl_kernel clKernel = static_cast<cl_kernel>(m_Kernel);
+
+    const size_t imageSize = (static_cast<size_t>(height - 1) * stride + width) * sizeof(float);
+    const size_t filteredSize = static_cast<size_t>(width) * height * sizeof(float);
+    cl_int err = CL_SUCCESS;
+    cl_mem imageBuffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, imageSize, const_cast<float *>(image), &err);
+    if(err != CL_SUCCESS)
+        return false;
+    cl_mem convBuffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, kernel.size() * sizeof(float),
+                                       kernel.data(), &err);
+    if(err != CL_SUCCESS)
+    {
+        clReleaseMemObject(imageBuffer);
+        return false;
+    }
+    cl_mem filteredBuffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, filteredSize, nullptr, &err);
+    if(err != CL_SUCCESS)
+    {
+        clReleaseMemObject(convBuffer);
+        clReleaseMemObject(imageBuffer);
+        return false;
+    }
+
+    err = clSetKernelArg(clKernel, 0, sizeof(cl_mem), &imageBuffer);
+    err |= clSetKernelArg(clKernel, 1, sizeof(int), &stride);
+    err |= clSetKernelArg(clKernel, 2, sizeof(int), &width);
+    err |= clSetKernelArg(clKernel, 3, sizeof(int), &height);
+    err |= clSetKernelArg(clKernel, 4, sizeof(cl_mem), &convBuffer);
+    err |= clSetKernelArg(clKernel, 5, sizeof(int), &convw);
+    err |= clSetKernelArg(clKernel, 6, sizeof(int), &convh);
+    err |= clSetKernelArg(clKernel, 7, sizeof(cl_mem), &filteredBuffer);
+    const size_t globalSize[2] = {static_cast<size_t>(width), static_cast<size_t>(height)};
+    if(err == CL_SUCCESS)
+        err = clEnqueueNDRangeKernel(queue, clKernel, 2, nullptr, globalSize, nullptr, 0, nullptr, nullptr);
+    if(err == CL_SUCCESS)
+        err = clEnqueueReadBuffer(queue, filteredBuffer, CL_TRUE, 0, filteredSize, filtered, 0, nullptr, nullptr);
+
+    clReleaseMemObject(filteredBuffer);
+    clReleaseMemObject(convBuffer);
+    clReleaseMemObject(imageBuffer);
+    return err == CL_SUCCESS;
+#else
+    Q_UNUSED(image);
+    Q_UNUSED(stride);
+    Q_UNUSED(width);
+    Q_UNUSED(height);
+    Q_UNUSED(conv);
+    Q_UNUSED(convw);
+    Q_UNUSED(convh);
+    Q_UNUSED(filtered);
+    return false;
+#endif
+}
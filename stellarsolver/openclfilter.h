@@ -0,0 +1,70 @@
+/*  OpenCLFilter, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QString>
+
+/**
+ * @brief The OpenCLFilter class convolves the background subtracted images of the star extraction with the convolution filter on
+ * a GPU with OpenCL, which is the most data parallel part of the star extraction.  The detection and deblending on the CPU then
+ * read the filtered image, see Extract::sep_set_filtered_image.  It is only built with USE_OPENCL, otherwise it is never available,
+ * and it is also not available when there is no GPU or its program doesn't build, so the star extraction convolves on the CPU instead.
+ * There is one of it for the process, the partitions that use it at the same time take turns on the OpenCLDevice.
+ */
+class OpenCLFilter
+{
+    public:
+        /**
+         * @brief instance gets the filter of the process, it finds the GPU the first time
+         */
+        static OpenCLFilter &instance();
+
+        /**
+         * @brief isAvailable gets whether there is a GPU to filter the images on
+         */
+        bool isAvailable() const
+        {
+            return m_Available;
+        }
+
+        /**
+         * @brief description gets why there is no GPU to filter on, or the device that it uses otherwise
+         */
+        QString description() const
+        {
+            return m_Description;
+        }
+
+        /**
+         * @brief convolve convolves an image with a kernel the way SEP does, with the kernel normalized by the sum of its absolute values,
+         * and the pixels outside of the image left out
+         * @param image The image, with its background subtracted
+         * @param stride The number of pixels from one row of the image to the next
+         * @param width The width of the image
+         * @param height The height of the image
+         * @param conv The kernel
+         * @param convw The width of the kernel
+         * @param convh The height of the kernel
+         * @param filtered The filtered image, width * height pixels
+         * @return false if it failed, then the image has to be filtered on the CPU
+         */
+        bool convolve(const float *image, int stride, int width, int height, const float *conv, int convw, int convh,
+                      float *filtered);
+
+        ~OpenCLFilter();
+
+    private:
+        OpenCLFilter();
+        OpenCLFilter(const OpenCLFilter &) = delete;
+        OpenCLFilter &operator=(const OpenCLFilter &) = delete;
+
+        bool m_Available { false };
+        QString m_Description;
+        void *m_Kernel { nullptr };     // The cl_kernel of the convolution
+};
@@ -8,12 +8,20 @@ bool SSolver::Parameters::operator==(const Parameters& o)
             kron_fact == o.kron_fact &&
             subpix == o.subpix &&
             r_min == o.r_min &&
+            apertureMaskBuckets == o.apertureMaskBuckets &&
+            windowedCentroids == o.windowedCentroids &&
+            psfModel == o.psfModel &&
             magzero == o.magzero &&
             minarea == o.minarea &&
             deblend_thresh == o.deblend_thresh &&
             deblend_contrast == o.deblend_contrast &&
+            deblend_min_pixels == o.deblend_min_pixels &&
+            deblend_min_elongation == o.deblend_min_elongation &&
+            deblend_time_limit == o.deblend_time_limit &&
+            extractionTimeLimit == o.extractionTimeLimit &&
             clean == o.clean &&
             clean_param == o.clean_param &&
+            hotPixelRejection == o.hotPixelRejection &&
 
             //These are StellarSolver parameters used for the creation of the convolution filter
             convFilterType == o.convFilterType &&
@@ -21,15 +29,22 @@ bool SSolver::Parameters::operator==(const Parameters& o)
 
             //Option to partition star extraction in separate threads or not
             partition == o.partition &&
+            globalBackground == o.globalBackground &&
+            backgroundSampling == o.backgroundSampling &&
+            useGPU == o.useGPU &&
 
             threshold_offset == o.threshold_offset &&
             threshold_bg_multiple == o.threshold_bg_multiple &&
+            thresholdLadderStars == o.thresholdLadderStars &&
+            thresholdLadderSteps == o.thresholdLadderSteps &&
+            thresholdLadderFactor == o.thresholdLadderFactor &&
 
             //StellarSolver Star Filter Settings
             maxSize == o.maxSize &&
             minSize == o.minSize &&
             maxEllipse == o.maxEllipse &&
             initialKeep == o.initialKeep &&
+            globalKeep == o.globalKeep &&
             keepNum == o.keepNum &&
             removeBrightest == o.removeBrightest &&
             removeDimmest == o.removeDimmest &&
@@ -37,17 +52,35 @@ bool SSolver::Parameters::operator==(const Parameters& o)
 
             //The setting for parallel thread solving
             multiAlgorithm == o.multiAlgorithm &&
+            threadPlacement == o.threadPlacement &&
 
             //Settings from the Astrometry Config file
             inParallel == o.inParallel &&
             solverTimeLimit == o.solverTimeLimit &&
+            solverTimeLimitMS == o.solverTimeLimitMS &&
+            externalExtractorTimeLimit == o.externalExtractorTimeLimit &&
             minwidth == o.minwidth &&
             maxwidth == o.maxwidth &&
+            indexStarBudget == o.indexStarBudget &&
+            floatQuadSearch == o.floatQuadSearch &&
+            brightPassStars == o.brightPassStars &&
+            viabilityMinStars == o.viabilityMinStars &&
+            viabilityMaxBackgroundRMS == o.viabilityMaxBackgroundRMS &&
+            viabilityMinStarSize == o.viabilityMinStarSize &&
+            viabilityMaxStarSize == o.viabilityMaxStarSize &&
+            viabilityMinSpread == o.viabilityMinSpread &&
 
             //Basic Astrometry settings
             resort == o.resort &&
             autoDownsample == o.autoDownsample &&
+            adaptiveDownsample == o.adaptiveDownsample &&
+            pipelineSolve == o.pipelineSolve &&
+            progressiveExtraction == o.progressiveExtraction &&
             downsample == o.downsample &&
+            downsampleView == o.downsampleView &&
+            detectionBinning == o.detectionBinning &&
+            reduceOnlineUpload == o.reduceOnlineUpload &&
+            onlineUploadBits == o.onlineUploadBits &&
             search_parity == o.search_parity &&
             search_radius == o.search_radius &&
 
@@ -55,7 +88,62 @@ bool SSolver::Parameters::operator==(const Parameters& o)
             //They need to be turned into a qstring because they are sometimes very close but not exactly the same
             QString::number(logratio_tosolve) == QString::number(o.logratio_tosolve) &&
             QString::number(logratio_tokeep) == QString::number(o.logratio_tokeep) &&
-            QString::number(logratio_totune) == QString::number(o.logratio_totune);
+            QString::number(logratio_totune) == QString::number(o.logratio_totune) &&
+
+            //Settings for the refinement of the solutions
+            tweak_time_limit == o.tweak_time_limit &&
+            tweak_min_improvement == o.tweak_min_improvement &&
+            center_first_fraction == o.center_first_fraction &&
+            center_first_tweak_order == o.center_first_tweak_order;
+}
+
+bool SSolver::Parameters::sameExtraction(const Parameters& o) const
+{
+    return  apertureShape == o.apertureShape &&
+            kron_fact == o.kron_fact &&
+            subpix == o.subpix &&
+            r_min == o.r_min &&
+            apertureMaskBuckets == o.apertureMaskBuckets &&
+            windowedCentroids == o.windowedCentroids &&
+            psfModel == o.psfModel &&
+            magzero == o.magzero &&
+            minarea == o.minarea &&
+            deblend_thresh == o.deblend_thresh &&
+            deblend_contrast == o.deblend_contrast &&
+            deblend_min_pixels == o.deblend_min_pixels &&
+            deblend_min_elongation == o.deblend_min_elongation &&
+            deblend_time_limit == o.deblend_time_limit &&
+            extractionTimeLimit == o.extractionTimeLimit &&
+            clean == o.clean &&
+            clean_param == o.clean_param &&
+            hotPixelRejection == o.hotPixelRejection &&
+            convFilterType == o.convFilterType &&
+            fwhm == o.fwhm &&
+            partition == o.partition &&
+            globalBackground == o.globalBackground &&
+            backgroundSampling == o.backgroundSampling &&
+            useGPU == o.useGPU &&
+            threshold_offset == o.threshold_offset &&
+            threshold_bg_multiple == o.threshold_bg_multiple &&
+            thresholdLadderStars == o.thresholdLadderStars &&
+            thresholdLadderSteps == o.thresholdLadderSteps &&
+            thresholdLadderFactor == o.thresholdLadderFactor &&
+
+            //The star filter is applied to the stars before they are solved
+            maxSize == o.maxSize &&
+            minSize == o.minSize &&
+            maxEllipse == o.maxEllipse &&
+            initialKeep == o.initialKeep &&
+            globalKeep == o.globalKeep &&
+            keepNum == o.keepNum &&
+            removeBrightest == o.removeBrightest &&
+            removeDimmest == o.removeDimmest &&
+            saturationLimit == o.saturationLimit &&
+
+            //The image is downsampled before the stars are extracted.  This is the downsample that was used, after autoDownsample
+            downsample == o.downsample &&
+            downsampleView == o.downsampleView &&
+            detectionBinning == o.detectionBinning;
 }
 
 QMap<QString, QVariant> SSolver::Parameters::convertToMap(const Parameters &params)
@@ -69,13 +157,21 @@ QMap<QString, QVariant> SSolver::Parameters::convertToMap(const Parameters &para
     settingsMap.insert("kron_fact", QVariant(params.kron_fact));
     settingsMap.insert("subpix", QVariant(params.subpix));
     settingsMap.insert("r_min", QVariant(params.r_min));
+    settingsMap.insert("apertureMaskBuckets", QVariant(params.apertureMaskBuckets));
+    settingsMap.insert("windowedCentroids", QVariant(params.windowedCentroids));
+    settingsMap.insert("psfModel", QVariant(params.psfModel));
     //params.inflags
     settingsMap.insert("magzero", QVariant(params.magzero));
     settingsMap.insert("minarea", QVariant(params.minarea));
     settingsMap.insert("deblend_thresh", QVariant(params.deblend_thresh));
     settingsMap.insert("deblend_contrast", QVariant(params.deblend_contrast));
+    settingsMap.insert("deblend_min_pixels", QVariant(params.deblend_min_pixels));
+    settingsMap.insert("deblend_min_elongation", QVariant(params.deblend_min_elongation));
+    settingsMap.insert("deblend_time_limit", QVariant(params.deblend_time_limit));
+    settingsMap.insert("extractionTimeLimit", QVariant(params.extractionTimeLimit));
     settingsMap.insert("clean", QVariant(params.clean));
     settingsMap.insert("clean_param", QVariant(params.clean_param));
+    settingsMap.insert("hotPixelRejection", QVariant(params.hotPixelRejection));
 
     //This is a StellarSolver parameter used for the creation of the convolution filter
     settingsMap.insert("convFilterType", QVariant(params.convFilterType));
@@ -83,15 +179,22 @@ QMap<QString, QVariant> SSolver::Parameters::convertToMap(const Parameters &para
 
     //Option to partition star extraction in separate threads or not
     settingsMap.insert("partition", QVariant(params.partition));
+    settingsMap.insert("globalBackground", QVariant(params.globalBackground));
+    settingsMap.insert("backgroundSampling", QVariant(params.backgroundSampling));
+    settingsMap.insert("useGPU", QVariant(params.useGPU));
 
     settingsMap.insert("threshold_offset", QVariant(params.threshold_offset));
     settingsMap.insert("threshold_bg_multiple", QVariant(params.threshold_bg_multiple));
+    settingsMap.insert("thresholdLadderStars", QVariant(params.thresholdLadderStars));
+    settingsMap.insert("thresholdLadderSteps", QVariant(params.thresholdLadderSteps));
+    settingsMap.insert("thresholdLadderFactor", QVariant(params.thresholdLadderFactor));
     
     //StellarSolver Star Filter Settings
     settingsMap.insert("maxSize", QVariant(params.maxSize));
     settingsMap.insert("minSize", QVariant(params.minSize));
     settingsMap.insert("maxEllipse", QVariant(params.maxEllipse));
     settingsMap.insert("initialKeep", QVariant(params.initialKeep));
+    settingsMap.insert("globalKeep", QVariant(params.globalKeep));
     settingsMap.insert("keepNum", QVariant(params.keepNum));
     settingsMap.insert("removeBrightest", QVariant(params.removeBrightest));
     settingsMap.insert("removeDimmest", QVariant(params.removeDimmest ));
@@ -99,17 +202,35 @@ QMap<QString, QVariant> SSolver::Parameters::convertToMap(const Parameters &para
 
     //A setting specifig to StellarSovler for choosing the algorithm to use to solve with parallel threads.
     settingsMap.insert("multiAlgo", QVariant(params.multiAlgorithm)) ;
+    settingsMap.insert("threadPlacement", QVariant(params.threadPlacement)) ;
 
     //Settings that usually get set by the Astrometry config file
     settingsMap.insert("maxwidth", QVariant(params.maxwidth)) ;
+    settingsMap.insert("indexStarBudget", QVariant(params.indexStarBudget));
+    settingsMap.insert("floatQuadSearch", QVariant(params.floatQuadSearch));
+    settingsMap.insert("brightPassStars", QVariant(params.brightPassStars));
+    settingsMap.insert("viabilityMinStars", QVariant(params.viabilityMinStars));
+    settingsMap.insert("viabilityMaxBackgroundRMS", QVariant(params.viabilityMaxBackgroundRMS));
+    settingsMap.insert("viabilityMinStarSize", QVariant(params.viabilityMinStarSize));
+    settingsMap.insert("viabilityMaxStarSize", QVariant(params.viabilityMaxStarSize));
+    settingsMap.insert("viabilityMinSpread", QVariant(params.viabilityMinSpread));
     settingsMap.insert("minwidth", QVariant(params.minwidth)) ;
     settingsMap.insert("inParallel", QVariant(params.inParallel)) ;
     settingsMap.insert("solverTimeLimit", QVariant(params.solverTimeLimit));
+    settingsMap.insert("solverTimeLimitMS", QVariant(params.solverTimeLimitMS));
+    settingsMap.insert("externalExtractorTimeLimit", QVariant(params.externalExtractorTimeLimit));
 
     //Astrometry Basic Parameters
     settingsMap.insert("resort", QVariant(params.resort)) ;
     settingsMap.insert("autoDownsample", QVariant(params.autoDownsample)) ;
+    settingsMap.insert("adaptiveDownsample", QVariant(params.adaptiveDownsample)) ;
+    settingsMap.insert("pipelineSolve", QVariant(params.pipelineSolve)) ;
+    settingsMap.insert("progressiveExtraction", QVariant(params.progressiveExtraction)) ;
     settingsMap.insert("downsample", QVariant(params.downsample)) ;
+    settingsMap.insert("downsampleView", QVariant(params.downsampleView)) ;
+    settingsMap.insert("detectionBinning", QVariant(params.detectionBinning));
+    settingsMap.insert("reduceOnlineUpload", QVariant(params.reduceOnlineUpload)) ;
+    settingsMap.insert("onlineUploadBits", QVariant(params.onlineUploadBits)) ;
     settingsMap.insert("search_radius", QVariant(params.search_radius)) ;
 
     //Astrometry settings that determine when to keep solutions or keep searching for better solutions
@@ -117,6 +238,12 @@ QMap<QString, QVariant> SSolver::Parameters::convertToMap(const Parameters &para
     settingsMap.insert("logratio_totune", QVariant(params.logratio_totune)) ;
     settingsMap.insert("logratio_tosolve", QVariant(params.logratio_tosolve)) ;
 
+    //Settings for the refinement of the solutions
+    settingsMap.insert("tweak_time_limit", QVariant(params.tweak_time_limit));
+    settingsMap.insert("tweak_min_improvement", QVariant(params.tweak_min_improvement));
+    settingsMap.insert("center_first_fraction", QVariant(params.center_first_fraction));
+    settingsMap.insert("center_first_tweak_order", QVariant(params.center_first_tweak_order));
+
     return settingsMap;
 
 }
@@ -133,16 +260,27 @@ SSolver::Parameters SSolver::Parameters::convertFromMap(const QMap<QString, QVar
     params.kron_fact = settingsMap.value("kron_fact", params.listName).toDouble();
     params.subpix = settingsMap.value("subpix", params.listName).toInt();
     params.r_min= settingsMap.value("r_min", params.listName).toDouble();
+    params.apertureMaskBuckets = settingsMap.value("apertureMaskBuckets", params.apertureMaskBuckets).toInt();
+    params.windowedCentroids = settingsMap.value("windowedCentroids", params.windowedCentroids).toBool();
+    params.psfModel = (PSFModelType)settingsMap.value("psfModel", params.psfModel).toInt();
     //params.inflags
     params.magzero = settingsMap.value("magzero", params.magzero).toDouble();
     params.minarea = settingsMap.value("minarea", params.minarea).toDouble();
     params.deblend_thresh = settingsMap.value("deblend_thresh", params.deblend_thresh).toInt();
     params.deblend_contrast = settingsMap.value("deblend_contrast", params.deblend_contrast).toDouble();
+    params.deblend_min_pixels = settingsMap.value("deblend_min_pixels", params.deblend_min_pixels).toInt();
+    params.deblend_min_elongation = settingsMap.value("deblend_min_elongation", params.deblend_min_elongation).toDouble();
+    params.deblend_time_limit = settingsMap.value("deblend_time_limit", params.deblend_time_limit).toDouble();
+    params.extractionTimeLimit = settingsMap.value("extractionTimeLimit", params.extractionTimeLimit).toDouble();
     params.clean = settingsMap.value("clean", params.clean).toInt();
     params.clean_param = settingsMap.value("clean_param", params.clean_param).toDouble();
+    params.hotPixelRejection = settingsMap.value("hotPixelRejection", params.hotPixelRejection).toDouble();
 
     params.threshold_offset = settingsMap.value("threshold_offset",params.threshold_offset).toDouble();
     params.threshold_bg_multiple = settingsMap.value("threshold_bg_multiple",params.threshold_bg_multiple).toDouble();
+    params.thresholdLadderStars = settingsMap.value("thresholdLadderStars", params.thresholdLadderStars).toInt();
+    params.thresholdLadderSteps = settingsMap.value("thresholdLadderSteps", params.thresholdLadderSteps).toInt();
+    params.thresholdLadderFactor = settingsMap.value("thresholdLadderFactor", params.thresholdLadderFactor).toDouble();
     
     //These are StellarSolver parameters used for the creation of the convolution filter
     params.fwhm = settingsMap.value("fwhm",params.fwhm).toDouble();
@@ -150,12 +288,16 @@ SSolver::Parameters SSolver::Parameters::convertFromMap(const QMap<QString, QVar
 
     //Option to partition star extraction in separate threads or not
     params.partition = settingsMap.value("partition", params.partition).toBool();
+    params.globalBackground = settingsMap.value("globalBackground", params.globalBackground).toBool();
+    params.backgroundSampling = settingsMap.value("backgroundSampling", params.backgroundSampling).toInt();
+    params.useGPU = settingsMap.value("useGPU", params.useGPU).toBool();
 
     //StellarSolver Star Filter Settings
     params.maxSize = settingsMap.value("maxSize", params.maxSize).toDouble();
     params.minSize = settingsMap.value("minSize", params.minSize).toDouble();
     params.maxEllipse = settingsMap.value("maxEllipse", params.maxEllipse).toDouble();
     params.initialKeep = settingsMap.value("initialKeep", params.initialKeep).toInt();
+    params.globalKeep = settingsMap.value("globalKeep", params.globalKeep).toBool();
     params.keepNum = settingsMap.value("keepNum", params.keepNum).toInt();
     params.removeBrightest = settingsMap.value("removeBrightest", params.removeBrightest).toDouble();
     params.removeDimmest = settingsMap.value("removeDimmest", params.removeDimmest ).toDouble();
@@ -163,17 +305,35 @@ SSolver::Parameters SSolver::Parameters::convertFromMap(const QMap<QString, QVar
 
     //This is a parameter specific to StellarSolver.  It determines the algorithm to use to run parallel threads for solving
     params.multiAlgorithm = (MultiAlgo)(settingsMap.value("multiAlgo", params.multiAlgorithm)).toInt();
+    params.threadPlacement = (ThreadPlacement)(settingsMap.value("threadPlacement", params.threadPlacement)).toInt();
 
     //Settings that usually get set by the Astrometry config file
     params.maxwidth = settingsMap.value("maxwidth", params.maxwidth).toDouble() ;
+    params.indexStarBudget = settingsMap.value("indexStarBudget", params.indexStarBudget).toDouble();
+    params.floatQuadSearch = settingsMap.value("floatQuadSearch", params.floatQuadSearch).toBool();
+    params.brightPassStars = settingsMap.value("brightPassStars", params.brightPassStars).toInt();
+    params.viabilityMinStars = settingsMap.value("viabilityMinStars", params.viabilityMinStars).toInt();
+    params.viabilityMaxBackgroundRMS = settingsMap.value("viabilityMaxBackgroundRMS", params.viabilityMaxBackgroundRMS).toDouble();
+    params.viabilityMinStarSize = settingsMap.value("viabilityMinStarSize", params.viabilityMinStarSize).toDouble();
+    params.viabilityMaxStarSize = settingsMap.value("viabilityMaxStarSize", params.viabilityMaxStarSize).toDouble();
+    params.viabilityMinSpread = settingsMap.value("viabilityMinSpread", params.viabilityMinSpread).toDouble();
     params.minwidth = settingsMap.value("minwidth", params.minwidth).toDouble() ;
     params.inParallel = settingsMap.value("inParallel", params.inParallel).toBool() ;
     params.solverTimeLimit = settingsMap.value("solverTimeLimit", params.solverTimeLimit).toInt();
+    params.solverTimeLimitMS = settingsMap.value("solverTimeLimitMS", params.solverTimeLimitMS).toInt();
+    params.externalExtractorTimeLimit = settingsMap.value("externalExtractorTimeLimit", params.externalExtractorTimeLimit).toInt();
 
     //Astrometry Basic Parameters
     params.resort = settingsMap.value("resort", params.resort).toBool();
     params.autoDownsample = settingsMap.value("autoDownsample", params.autoDownsample).toBool();
+    params.adaptiveDownsample = settingsMap.value("adaptiveDownsample", params.adaptiveDownsample).toBool();
+    params.pipelineSolve = settingsMap.value("pipelineSolve", params.pipelineSolve).toBool();
+    params.progressiveExtraction = settingsMap.value("progressiveExtraction", params.progressiveExtraction).toBool();
     params.downsample = settingsMap.value("downsample", params.downsample).toInt();
+    params.downsampleView = settingsMap.value("downsampleView", params.downsampleView).toBool();
+    params.detectionBinning = settingsMap.value("detectionBinning", params.detectionBinning).toInt();
+    params.reduceOnlineUpload = settingsMap.value("reduceOnlineUpload", params.reduceOnlineUpload).toBool();
+    params.onlineUploadBits = settingsMap.value("onlineUploadBits", params.onlineUploadBits).toInt();
     params.search_radius = settingsMap.value("search_radius", params.search_radius).toDouble() ;
 
     //Astrometry settings that determine when to keep solutions or keep searching for better solutions
@@ -181,6 +341,12 @@ SSolver::Parameters SSolver::Parameters::convertFromMap(const QMap<QString, QVar
     params.logratio_totune = settingsMap.value("logratio_totune", params.logratio_totune).toDouble() ;
     params.logratio_tosolve = settingsMap.value("logratio_tosolve", params.logratio_tosolve).toDouble();
 
+    //Settings for the refinement of the solutions
+    params.tweak_time_limit = settingsMap.value("tweak_time_limit", params.tweak_time_limit).toDouble();
+    params.tweak_min_improvement = settingsMap.value("tweak_min_improvement", params.tweak_min_improvement).toDouble();
+    params.center_first_fraction = settingsMap.value("center_first_fraction", params.center_first_fraction).toDouble();
+    params.center_first_tweak_order = settingsMap.value("center_first_tweak_order", params.center_first_tweak_order).toInt();
+
     return params;
 
 }
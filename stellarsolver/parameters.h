@@ -13,6 +13,13 @@ enum Shape
     SHAPE_CIRCLE,
     SHAPE_ELLIPSE
 };
+//This is the profile that is fitted to the stars for their HFR, PSF_NONE measures the HFR from the growth of their flux
+typedef enum
+{
+    PSF_NONE,
+    PSF_GAUSSIAN,
+    PSF_MOFFAT
+} PSFModelType;
 //This is the type of Convolution Filter to be Generated for use
 typedef enum
 {
@@ -24,6 +31,15 @@ typedef enum
     CONV_RING
 } ConvFilterType;
 
+//This decides which of the solves waiting for a slot of a SolverThreadPool gets the next free one, see StellarSolver::setSolveUrgency
+typedef enum
+{
+    URGENCY_BACKGROUND,     // Like the images of an archive, it only gets the slots that nothing else waits for
+    URGENCY_NORMAL,
+    URGENCY_CRITICAL,       // Like guiding, it gets the next free slot before the others
+    URGENCY_COUNT
+} SolveUrgency;
+
 //This is the type of Computer system for the default system paths
 typedef enum
 {
@@ -221,9 +237,17 @@ static QString getCommandString(SSolver::ProcessType processType, SSolver::Extra
 typedef enum {NOT_MULTI,    // This option does not use parallel solving
               MULTI_SCALES, // This option generates multiple threads based on different image scales
               MULTI_DEPTHS, // This option generates multiple threads based on different image "depths"
-              MULTI_AUTO    // This option generates multiple threads (or not) automatically based on the algorithm that is best
+              MULTI_AUTO,   // This option generates multiple threads (or not) automatically based on the algorithm that is best
+              MULTI_POSITIONS_AND_SCALES // This option generates multiple threads based on a grid of positions around the search position and different image scales
              } MultiAlgo;
 
+// These are the ways the child solvers of a parallel solve can be placed on the cores of the machine
+// When solving an image, this is one of the Parameters
+typedef enum {PLACE_ANYWHERE,   // The system places the child solvers
+              PLACE_ON_CORES,   // Each child solver is pinned to one core, spreading them over the NUMA nodes
+              PLACE_ON_NODES    // Each child solver is pinned to the cores of one NUMA node, spreading them over the nodes
+             } ThreadPlacement;
+
 //This gets a string for which Parallel Solving Algorithm we are using
 static QString getMultiAlgoString(SSolver::MultiAlgo multi)
 {
@@ -240,6 +264,10 @@ static QString getMultiAlgoString(SSolver::MultiAlgo multi)
         case MULTI_DEPTHS:
             return "Depths";
             break;
+
+        case MULTI_POSITIONS_AND_SCALES:
+            return "Positions and Scales";
+            break;
         default:
             return "";
             break;
@@ -329,6 +357,9 @@ class Parameters
         double kron_fact = 2.5;             // This sets the Kron Factor for use with the kron radius for flux calculations.
         int subpix = 5;                     // The subpix setting.  The instructions say to make it 5
         double r_min = 3.5;                 // The minimum radius for stars for flux calculations.
+        PSFModelType psfModel = PSF_NONE;   // If it is not PSF_NONE, the HFR of the stars comes from fitting this profile to them, and their a, b and theta from its shape, with a and b the sigmas of a Gaussian with the same FWHMs.  This is faster and less noisy than the flux radius for autofocus and image quality.
+        bool windowedCentroids = false;     // This gives the stars Gaussian weighted windowed centroids instead of their isophotal barycenters, for precise positions like guiding needs.  It skips the aperture photometry, so the fluxes are the isophotal ones.
+        int apertureMaskBuckets = 0;        // If it is more than 0, the circular apertures reuse weight masks for centers in the same 1/apertureMaskBuckets of a pixel, which is faster but approximate.
         short inflags = 0;                  // Note sure if we need them?
 
         //Star Extractor Extraction Parameters
@@ -338,8 +369,20 @@ class Parameters
         double minarea = 10;            // This is the minimum area in pixels for a star detection, smaller stars are ignored.
         int deblend_thresh = 32;        // The number of thresholds the intensity range is divided up into.
         double deblend_contrast = 0.005;// The percentage of flux a separate peak must # have to be considered a separate object.
+        // Only for extractions to solve, which just need clean positions: with any of these set, only the objects with at least deblend_min_pixels pixels
+        // or an elongation (a/b) of at least deblend_min_elongation are deblended, and none after deblend_time_limit ms of deblending per image.  0 is off.
+        int deblend_min_pixels = 0;
+        double deblend_min_elongation = 0;
+        double deblend_time_limit = 0;
+        // If it is more than 0, the extraction of an image stops after this many ms, for any process type, and returns the stars it found
+        // until then, with extractionTimedOut set in the metrics.  The detection, the deblending and the photometry all watch the time.
+        double extractionTimeLimit = 0;
         int clean = 1;                  // Attempts to 'clean' the image to remove artifacts caused by bright objects
         double clean_param = 1;         // The cleaning parameter, not sure what it does.
+        // If it is more than 0, the pixels that stand out from all but one of their neighbours by more than this many times the spread of the others,
+        // like hot pixels and cosmic ray hits on uncooled cameras, are clamped to their second brightest neighbour before the stars are detected.
+        // Around 5 keeps every star, a star in sharp focus is still spread over several pixels.  0 is off.
+        double hotPixelRejection = 0;
 
         // These are the variables used to generate the conv filter
         ConvFilterType convFilterType = CONV_DEFAULT;   //  This is the type of convolution filter to be used, it selects the formula used to make it.
@@ -347,10 +390,27 @@ class Parameters
 
         // Automatically partition the image to several threads to speed it up.
         bool partition = true;
+        // Compute the background once for the whole frame and share it with all of the partitions, instead of once per partition.
+        // Then they all use the same background map and the same extraction threshold.
+        bool globalBackground = false;
+        // If it is more than 1, the background statistics come from every backgroundSampling'th pixel of every backgroundSampling'th
+        // line, which is much faster on very large frames.  A row of background boxes where that is not enough is done with every pixel.
+        int backgroundSampling = 1;
+        // Convolve the image with the convolution filter on the GPU with OpenCL, if the library was built with it and there is a GPU.
+        // The star detection on the CPU reads the filtered image.  Otherwise the convolution is done on the CPU as always.
+        // The solver then also searches the code trees of the larger index files for the codes of many quads at once on the GPU,
+        // and checks the matches on the CPU in the same order as before.
+        bool useGPU = false;
 
         // gain
         double threshold_offset = 0;
         double threshold_bg_multiple = 2.0;
+        // If it is more than 0, a partition that detects fewer than its share of this many stars, by its part of the area, lowers
+        // threshold_bg_multiple by thresholdLadderFactor and detects them again, up to thresholdLadderSteps times.  The background
+        // is not estimated again and the image is only convolved once, so only the detection is repeated.
+        int thresholdLadderStars = 0;
+        int thresholdLadderSteps = 3;
+        double thresholdLadderFactor = 0.7;
   
         //Star Filter Parameters
             //Some of the following variables are based on semi-major (a) and semi-minor (b) axes as indicated.
@@ -358,6 +418,7 @@ class Parameters
         double minSize = 0;         // The minimum size of stars to include in the final list in pixels (a*b)
         double maxEllipse = 0;      // The maximum ratio (a/b) for stars to include, this eliminates oblong stars
         int initialKeep = 1000000;  // Number of stars to keep in the list before HFR.  This is based on star size.  This is most useful for SEP operations involving HFR like Focusing images, Guiding, and monitoring image HFR over time.  It is important to reduce the number of stars prior to doing HFR calculations
+        bool globalKeep = false;    // Keep the initialKeep biggest stars of the whole image instead of initialKeep divided evenly between the partitions.  Photometry is skipped for the stars that can't make it.
         int keepNum = 0;            // The number of brightest stars to keep in the list.  This is based on magnitude.  This is most useful for Solving because limiting the number of stars to the brightest ones greatly speeds up the solver.
         double removeBrightest = 0; // The percentage of brightest stars to remove from the list
         double removeDimmest = 0;   // The percentage of dimmest stars to remove from the list
@@ -366,11 +427,30 @@ class Parameters
         //Astrometry Config/Engine Parameters
             // Algorithm for running multiple threads on possibly multiple cores to solve faster
         MultiAlgo multiAlgorithm = MULTI_AUTO;
+            // Where the child solvers of a parallel solve run.  A pinned child touches the index data it uses first, so it ends up in the memory of its own node.
+        ThreadPlacement threadPlacement = PLACE_ANYWHERE;
             // Note: If the indices you are using take less than 2 GB of space, and you have at least as much physical memory as indices, you want inParallel enabled for sure.
+            // The internal solver memory maps one shared copy of the indices for all of its threads, so this only affects RAM usage for the external astrometry.net solver.
         bool inParallel = true;     // Check the indices in parallel? This loads them in memory at the same time.
         int solverTimeLimit = 600;  // Give up solving after the specified number of seconds of CPU time
+        int externalExtractorTimeLimit = 30;    // Give up on the external SExtractor, and on wcsinfo reading a solution, after this many seconds
+        int solverTimeLimitMS = 0;  // If more than 0, the internal solver gives up after this many milliseconds of wall clock time instead, for limits below a second
         double minwidth = 0.1;      // If no scale estimate is given, this is the limit on the minimum field width in degrees.
         double maxwidth = 180;      // If no scale estimate is given, this is the limit on the maximum field width in degrees.
+        double indexStarBudget = 0; // If more than 0, the internal solver makes quads of only as many of the brightest stars, for each band of scales, as this many
+                                    // times the stars its indexes can have in a field of that size, from the cut of each index.  Around 2 works well.
+        bool floatQuadSearch = false;   // Whether the internal solver checks the scales and the boxes of the quads with float copies of the star positions,
+                                        // which halves the memory they read.  The codes, the verification and the tweak are still done in double.
+        int brightPassStars = 0;    // If more than 0, the internal solver first tries the quads of this many of the brightest stars against only the quads of the
+                                    // brightest index stars, and searches all of the codes only if that fails.  Around 30 works well.  It needs the small code trees
+                                    // of the bright quads, which IndexCatalog::setBrightCodeTrees makes when the indexes are loaded.
+        // Before a solve, the stars of the extraction are checked for whether they can solve the frame at all, like when clouds came in,
+        // and if they can't the solve gives up right away, with the reason in the viability of the solve metrics.  Each check is off at 0.
+        int viabilityMinStars = 0;              // The fewest stars a frame needs
+        double viabilityMaxBackgroundRMS = 0;   // The noisiest background, in the units of the pixels
+        double viabilityMinStarSize = 0;        // The smallest median size of the stars, sqrt(a * b) in pixels, smaller ones are mostly noise and hot pixels
+        double viabilityMaxStarSize = 0;        // The largest median size of the stars, bigger ones are blurred by clouds or far out of focus
+        double viabilityMinSpread = 0;          // The smallest part of the cells of a 4 x 4 grid over the frame that need stars, from 0 to 1
 
 
         //Astrometry Basic Parameters
@@ -378,8 +458,28 @@ class Parameters
         bool resort = true;
             // Whether or not to automatically determine the downsample size based on the image size.
         bool autoDownsample = true;
+            // Whether the automatic downsample is chosen from the size of the stars and how many there are, from a quick pass over a few tiles of the image,
+            // instead of from the size of the image alone.  The FWHM of a Gaussian, Mexican Hat, Top Hat or Ring convolution filter is set to match the stars.
+        bool adaptiveDownsample = true;
+            // Whether to start solving with the brightest stars of the first partitions while the rest of the image is still being extracted.
+            // It only works with the internal solver, without solving in parallel, and without the filters that remove a percentage of the stars.
+        bool pipelineSolve = false;
+            // With pipelineSolve, whether the partitions are extracted a few at a time, spread over the image, and the extraction waits until the
+            // solver runs out of stars for its next depth range before it does more of them.  An easy field solves before most of the partitions are
+            // extracted, and the star list then only has the stars of the ones that were.
+        bool progressiveExtraction = false;
             // Factor to use for downsampling the image before SEP for plate solving.  Can speed it up.  This is not used for Source Extraction
         int downsample = 1;
+            // Whether to bin the image while it is converted to float for SEP, instead of making a downsampled image.  The stars are then in full resolution pixels.
+        bool downsampleView = false;
+            // If it is 2 or 4, the star extractions that don't solve detect the stars on the image binned by this much while it is converted
+            // to float, like downsampleView, and then measure the position, flux and HFR of each star again in a small window of the full
+            // resolution image.  For oversampled images, that saves most of the convolution and the scan of the empty sky, but keeps the HFR.
+        int detectionBinning = 1;
+            // Whether the online solver uploads a smaller copy of the image when the server extracts the stars.  It is binned by the downsample,
+            // stretched to onlineUploadBits bits (8 or 16) and gzipped.  The solution and the WCS are scaled back to the full resolution image.
+        bool reduceOnlineUpload = false;
+        int onlineUploadBits = 16;
         int search_parity = 2;          // Only check for matches with positive/negative parity (default: try both)
         double search_radius = 15;      // Only search in indexes within 'radius' of the field center given by RA and DEC
 
@@ -388,8 +488,18 @@ class Parameters
         double logratio_tokeep  = log(1e9); // Odds ratio at which to keep a solution (default: 1e9)
         double logratio_totune  = log(1e6); // Odds ratio at which to try tuning up a match that isn't good enough to solve (default: 1e6)
 
+        //Tweak Settings, for the refinement of the SIP distortion of a solution
+        double tweak_time_limit = 0;        // Stop fitting higher orders after this many ms of refining a solution, 0 is no limit
+        double tweak_min_improvement = 0;   // Move on once an iteration improves the residual of the matched stars by less than this fraction, 0 does all of them
+        double center_first_fraction = 0;   // If more than 0, the quads are first only searched among the stars in this fraction of the width and height around the center,
+                                            // where a distorted wide field is closest to a TAN projection, then the solution is verified and tweaked with all of the stars
+        int center_first_tweak_order = 4;   // The SIP order of the tweak with all of the stars after a solve of the center, the center itself is tweaked to order 2
+
         bool operator==(const Parameters &o);
 
+        // Whether a star extraction for solving with these parameters finds the same stars as with o, so that they only differ in the solver settings
+        bool sameExtraction(const Parameters &o) const;
+
         static QMap<QString, QVariant> convertToMap(const Parameters &params);
         static Parameters convertFromMap(const QMap<QString, QVariant> &settingsMap);
 
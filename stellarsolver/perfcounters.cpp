@@ -0,0 +1,159 @@
+/*  PerfCounters, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "perfcounters.h"
+
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+const uint64_t events[SSCOUNTERS_N] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+                                        PERF_COUNT_HW_BRANCH_MISSES
+                                      };
+
+// The counters of one thread.  They are in one group, so that they are read together with one call and are all counting at the
+// same time.  A CPU that doesn't have one of the events just leaves it out of the group, and its count stays 0.
+class ThreadCounters
+{
+    public:
+        ThreadCounters()
+        {
+            for(int e = 0; e < SSCOUNTERS_N; e++)
+            {
+                m_Slots[e] = -1;
+                const int fd = open(events[e], m_Leader);
+                if(fd < 0)
+                    continue;
+                if(m_Leader < 0)
+                    m_Leader = fd;
+                m_Slots[e] = m_Opened;
+                m_Fds[m_Opened++] = fd;
+            }
+            if(m_Leader >= 0)
+                ioctl(m_Leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+        ~ThreadCounters()
+        {
+            for(int i = 0; i < m_Opened; i++)
+                close(m_Fds[i]);
+        }
+
+        bool isOpen() const
+        {
+            return m_Leader >= 0;
+        }
+
+        bool read(uint64_t *counts) const
+        {
+            // With PERF_FORMAT_GROUP, this is the number of events and then their counts in the order they were opened
+            uint64_t values[1 + SSCOUNTERS_N];
+            if(m_Leader < 0 || ::read(m_Leader, values, sizeof(values)) < static_cast<ssize_t>(sizeof(uint64_t) * (1 + m_Opened)))
+                return false;
+            for(int e = 0; e < SSCOUNTERS_N; e++)
+                counts[e] = m_Slots[e] >= 0 ? values[1 + m_Slots[e]] : 0;
+            return true;
+        }
+
+    private:
+        static int open(uint64_t event, int leader)
+        {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = event;
+            // The group is enabled all at once by its leader
+            attr.disabled = leader < 0 ? 1 : 0;
+            // The events of the kernel need a lower perf_event_paranoid, and the time spent in the kernel is not the library's work
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            // The calling thread, on any CPU
+            return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC));
+        }
+
+        int m_Leader { -1 };
+        int m_Fds[SSCOUNTERS_N];
+        int m_Slots[SSCOUNTERS_N];  // The place of each event in the group, -1 if it couldn't be opened
+        int m_Opened { 0 };
+};
+
+const ThreadCounters &threadCounters()
+{
+    static thread_local ThreadCounters counters;
+    return counters;
+}
+}
+
+bool PerfCounters::isAvailable()
+{
+    static const bool available = threadCounters().isOpen();
+    return available;
+}
+
+int sscounters_begin(uint64_t *start)
+{
+    return threadCounters().read(start) ? 1 : 0;
+}
+
+void sscounters_end(uint64_t *total, const uint64_t *start)
+{
+    uint64_t now[SSCOUNTERS_N];
+    if(!threadCounters().read(now))
+        return;
+    for(int e = 0; e < SSCOUNTERS_N; e++)
+        __atomic_fetch_add(&total[e], now[e] - start[e], __ATOMIC_RELAXED);
+}
+
+#else
+
+bool PerfCounters::isAvailable()
+{
+    return false;
+}
+
+int sscounters_begin(uint64_t *start)
+{
+    memset(start, 0, sizeof(uint64_t) * SSCOUNTERS_N);
+    return 0;
+}
+
+void sscounters_end(uint64_t *total, const uint64_t *start)
+{
+    Q_UNUSED(total);
+    Q_UNUSED(start);
+}
+
+#endif
+
+PerfCounters::Scope::Scope(uint64_t *total, bool enabled) : m_Total(nullptr)
+{
+    if(enabled && sscounters_begin(m_Start))
+        m_Total = total;
+}
+
+PerfCounters::Scope::~Scope()
+{
+    if(m_Total)
+        sscounters_end(m_Total, m_Start);
+}
+
+FITSImage::HardwareCounters PerfCounters::toCounters(const uint64_t *total)
+{
+    FITSImage::HardwareCounters counters;
+    counters.cycles = total[0];
+    counters.instructions = total[1];
+    counters.cacheMisses = total[2];
+    counters.branchMisses = total[3];
+    return counters;
+}
@@ -0,0 +1,68 @@
+/*  PerfCounters, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <stdint.h>
+
+// The number of hardware events that are counted, in this order: cycles, instructions, cache misses and branch misses
+#define SSCOUNTERS_N 4
+
+#ifdef __cplusplus
+#include "structuredefinitions.h"
+
+/**
+ * @brief The PerfCounters class counts the hardware events of the stages of the star extraction and the solver with perf_event_open,
+ * so that the solve metrics can tell whether a stage is waiting for memory or computing.  It only counts on Linux, and only if the
+ * kernel lets the program count its own events, which it does unless kernel.perf_event_paranoid is set above 2 or the CPU or virtual
+ * machine has no counters.  Otherwise nothing is counted.  The counters of a thread are opened the first time it counts something and
+ * stay open until the thread exits, so counting a stage costs two reads of them.  Only the events in user space are counted.
+ */
+class PerfCounters
+{
+    public:
+        /**
+         * @brief isAvailable gets whether the hardware events can be counted on this system
+         */
+        static bool isAvailable();
+
+        /**
+         * @brief The Scope class adds the events of the calling thread from when it is made to when it is destroyed to a total of
+         * SSCOUNTERS_N counts.  The total can be added to from several threads at the same time.
+         */
+        class Scope
+        {
+            public:
+                // If enabled is false, or the events can't be counted, it does nothing
+                Scope(uint64_t *total, bool enabled);
+                ~Scope();
+            private:
+                uint64_t *m_Total;
+                uint64_t m_Start[SSCOUNTERS_N];
+        };
+
+        /**
+         * @brief toCounters gets the HardwareCounters of a total of SSCOUNTERS_N counts
+         */
+        static FITSImage::HardwareCounters toCounters(const uint64_t *total);
+};
+#endif
+
+#ifdef __cplusplus
+    #define PERFCOUNTERS_EXPORT_C extern "C"
+#else
+    #define PERFCOUNTERS_EXPORT_C
+#endif
+
+// This provides a C interface to the PerfCounters so that the events of the verifications of astrometry.net can be counted.
+// sscounters_begin reads the SSCOUNTERS_N counts of the calling thread into start, and returns 0 if they can't be counted.
+// sscounters_end adds the events since start to total, which can be added to from several threads at the same time.
+PERFCOUNTERS_EXPORT_C int sscounters_begin(uint64_t *start);
+PERFCOUNTERS_EXPORT_C void sscounters_end(uint64_t *total, const uint64_t *start);
+
+#endif // PERFCOUNTERS_H
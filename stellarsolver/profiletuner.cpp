@@ -0,0 +1,323 @@
+/*  ProfileTuner, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "profiletuner.h"
+
+#include <algorithm>
+#include <limits>
+
+//QT Includes
+#include <QFileInfo>
+#include <QSettings>
+#include <QStringList>
+
+namespace
+{
+// The steps of the star counts the tuner goes through, 0 is all of the stars
+const QList<int> keepNumSteps = {50, 100, 200, 400, 800, 1600, 0};
+const QList<int> initialKeepSteps = {250, 500, 1000, 2000, 4000, 1000000};
+// The parallel algorithms that don't need a position to search around
+const QList<int> multiAlgorithms = {SSolver::NOT_MULTI, SSolver::MULTI_SCALES, SSolver::MULTI_DEPTHS, SSolver::MULTI_AUTO};
+const int maxDownsample = 6;
+
+// A step as a number to compare, where 0 is all of the stars so it is more than any other step
+qint64 stepSize(int step)
+{
+    return step == 0 ? std::numeric_limits<qint64>::max() : step;
+}
+
+// The steps before and after the one nearest to a value, and the nearest one if the value isn't one of the steps
+QList<int> adjacentSteps(const QList<int> &steps, int value)
+{
+    int nearest = 0;
+    for(int i = 1; i < steps.count(); i++)
+    {
+        if(qAbs(stepSize(steps.at(i)) - stepSize(value)) < qAbs(stepSize(steps.at(nearest)) - stepSize(value)))
+            nearest = i;
+    }
+    QList<int> adjacent;
+    if(steps.at(nearest) != value)
+        adjacent.append(steps.at(nearest));
+    if(nearest > 0)
+        adjacent.append(steps.at(nearest - 1));
+    if(nearest < steps.count() - 1)
+        adjacent.append(steps.at(nearest + 1));
+    return adjacent;
+}
+}
+
+ProfileTuner::ProfileTuner(const QString &profilesFile) : m_ProfilesFile(profilesFile)
+{
+    load();
+}
+
+QString ProfileTuner::signature(const FITSImage::Statistic &stats, double pixelScale)
+{
+    // The pixel scale is rounded to 2 digits, so the small differences between the solutions of one setup don't split its history
+    const QString scale = pixelScale > 0 ? QString("%1\"/px").arg(QString::number(pixelScale, 'g', 2)) : QString("unknown scale");
+    return QString("%1x%2 %3").arg(stats.width).arg(stats.height).arg(scale);
+}
+
+QString ProfileTuner::historyFile() const
+{
+    const QFileInfo info(m_ProfilesFile);
+    return info.path() + "/" + info.completeBaseName() + "_history.ini";
+}
+
+// The key of the tuned settings of some parameters, a downsample of 0 is the automatic downsample
+QString ProfileTuner::trialKey(const SSolver::Parameters &params)
+{
+    return QString("%1;%2;%3;%4").arg(params.keepNum).arg(params.initialKeep).arg(params.autoDownsample ? 0 : params.downsample).arg(
+               params.multiAlgorithm);
+}
+
+SSolver::Parameters ProfileTuner::applyKey(SSolver::Parameters params, const QString &key)
+{
+    const QStringList values = key.split(';');
+    if(values.count() != 4)
+        return params;
+    params.keepNum = values.at(0).toInt();
+    params.initialKeep = values.at(1).toInt();
+    const int downsample = values.at(2).toInt();
+    params.autoDownsample = downsample == 0;
+    if(downsample > 0)
+        params.downsample = downsample;
+    params.multiAlgorithm = static_cast<SSolver::MultiAlgo>(values.at(3).toInt());
+    return params;
+}
+
+// The variations that change one of the tuned settings by one step
+QStringList ProfileTuner::neighbors(const QString &key)
+{
+    const QStringList values = key.split(';');
+    if(values.count() != 4)
+        return QStringList();
+    const int keepNum = values.at(0).toInt(), initialKeep = values.at(1).toInt();
+    const int downsample = values.at(2).toInt(), multi = values.at(3).toInt();
+    const QString pattern("%1;%2;%3;%4");
+    QStringList variations;
+    for(int step : adjacentSteps(keepNumSteps, keepNum))
+        variations << pattern.arg(step).arg(initialKeep).arg(downsample).arg(multi);
+    for(int step : adjacentSteps(initialKeepSteps, initialKeep))
+        variations << pattern.arg(keepNum).arg(step).arg(downsample).arg(multi);
+    if(downsample == 0)
+    {
+        for(int step = 1; step <= 3; step++)
+            variations << pattern.arg(keepNum).arg(initialKeep).arg(step).arg(multi);
+    }
+    else
+    {
+        if(downsample > 1)
+            variations << pattern.arg(keepNum).arg(initialKeep).arg(downsample - 1).arg(multi);
+        if(downsample < maxDownsample)
+            variations << pattern.arg(keepNum).arg(initialKeep).arg(downsample + 1).arg(multi);
+    }
+    for(int algorithm : multiAlgorithms)
+    {
+        if(algorithm != multi)
+            variations << pattern.arg(keepNum).arg(initialKeep).arg(downsample).arg(algorithm);
+    }
+    return variations;
+}
+
+double ProfileTuner::median(QList<double> times)
+{
+    if(times.isEmpty())
+        return 0;
+    std::sort(times.begin(), times.end());
+    const int middle = times.count() / 2;
+    return times.count() % 2 ? times.at(middle) : (times.at(middle - 1) + times.at(middle)) / 2;
+}
+
+// The fastest variation by median time of the ones that were tried enough and solve almost as often as the most successful one
+QString ProfileTuner::bestKey(const History &history) const
+{
+    double bestRate = 0;
+    for(const Trial &trial : history.trials)
+    {
+        if(trial.attempts >= MinTrials)
+            bestRate = qMax(bestRate, double(trial.solves) / trial.attempts);
+    }
+    QString best = history.firstKey;
+    double bestTime = -1;
+    for(auto it = history.trials.constBegin(); it != history.trials.constEnd(); ++it)
+    {
+        const Trial &trial = it.value();
+        if(trial.attempts < MinTrials || double(trial.solves) / trial.attempts < bestRate - 0.05)
+            continue;
+        const double time = median(trial.times);
+        if(bestTime < 0 || time < bestTime)
+        {
+            bestTime = time;
+            best = it.key();
+        }
+    }
+    return best;
+}
+
+SSolver::Parameters ProfileTuner::tunedProfile(const QString &signature, const SSolver::Parameters &base) const
+{
+    if(!m_History.contains(signature))
+        return base;
+    const History &history = m_History[signature];
+    SSolver::Parameters params = applyKey(base, bestKey(history));
+    // The widths that solved narrow the range of widths, with some room since the widths are searched in steps
+    if(history.minField > 0)
+    {
+        params.minwidth = qMax(base.minwidth, history.minField * 0.8);
+        params.maxwidth = qMin(base.maxwidth, history.maxField * 1.25);
+        if(params.minwidth >= params.maxwidth)
+        {
+            params.minwidth = base.minwidth;
+            params.maxwidth = base.maxwidth;
+        }
+    }
+    return params;
+}
+
+SSolver::Parameters ProfileTuner::suggest(const QString &signature, const SSolver::Parameters &base) const
+{
+    const SSolver::Parameters best = tunedProfile(signature, base);
+    if(!m_Exploring || !m_History.contains(signature))
+        return best;
+    const History &history = m_History[signature];
+    const QString key = trialKey(best);
+    if(history.trials.value(key).attempts < MinTrials)
+        return best;
+
+    // A variation that failed while the best one always solves isn't tried again, so the tuning doesn't cost many failed solves
+    const Trial &bestTrial = history.trials[key];
+    const bool bestAlwaysSolves = bestTrial.solves == bestTrial.attempts;
+    for(const QString &variation : neighbors(key))
+    {
+        const Trial trial = history.trials.value(variation);
+        if(trial.attempts >= MinTrials || (bestAlwaysSolves && trial.solves < trial.attempts))
+            continue;
+        return applyKey(best, variation);
+    }
+    return best;
+}
+
+void ProfileTuner::record(const QString &signature, const SSolver::Parameters &tried, bool solved, double solveMs,
+                          const FITSImage::Solution &solution, const QVariantMap &bandStatistics)
+{
+    History &history = m_History[signature];
+    const QString key = trialKey(tried);
+    if(history.firstKey.isEmpty())
+        history.firstKey = key;
+    Trial &trial = history.trials[key];
+    trial.attempts++;
+    if(solved)
+        trial.solves++;
+    trial.times.append(solveMs);
+    while(trial.times.count() > KeptTimes)
+        trial.times.removeFirst();
+
+    if(solved && solution.fieldWidth > 0)
+    {
+        const double width = solution.fieldWidth / 60.0;
+        history.minField = history.minField > 0 ? qMin(history.minField, width) : width;
+        history.maxField = qMax(history.maxField, width);
+    }
+    if(!bandStatistics.isEmpty())
+        history.bandStatistics = bandStatistics;
+    history.lastParameters = SSolver::Parameters::convertToMap(tried);
+}
+
+void ProfileTuner::record(StellarSolver &solver, const QString &signature)
+{
+    const bool solved = solver.solvingDone() && !solver.failed();
+    const QString imageSignature = signature.isEmpty() ?
+                                   ProfileTuner::signature(solver.getStatistics(), solved ? solver.getSolution().pixscale : 0) : signature;
+    record(imageSignature, solver.getCurrentParameters(), solved, solver.getSolveMetrics().totalMs, solver.getSolution(),
+           solver.getBandStatistics());
+}
+
+QVariantMap ProfileTuner::bandStatistics(const QString &signature) const
+{
+    return m_History.value(signature).bandStatistics;
+}
+
+void ProfileTuner::load()
+{
+    if(!QFileInfo::exists(historyFile()))
+        return;
+    QSettings settings(historyFile(), QSettings::IniFormat);
+    for(const QString &group : settings.childGroups())
+    {
+        settings.beginGroup(group);
+        History history;
+        history.firstKey = settings.value("firstKey").toString();
+        history.minField = settings.value("minField", 0).toDouble();
+        history.maxField = settings.value("maxField", 0).toDouble();
+        history.bandStatistics = settings.value("bandStatistics").toMap();
+        history.lastParameters = settings.value("lastParameters").toMap();
+        const QVariantMap trials = settings.value("trials").toMap();
+        for(auto it = trials.constBegin(); it != trials.constEnd(); ++it)
+        {
+            const QVariantList values = it.value().toList();
+            if(values.count() != 3)
+                continue;
+            Trial trial;
+            trial.attempts = values.at(0).toInt();
+            trial.solves = values.at(1).toInt();
+            for(const QVariant &time : values.at(2).toList())
+                trial.times.append(time.toDouble());
+            history.trials.insert(it.key(), trial);
+        }
+        // The signature is kept as a value since QSettings changes some of the characters of group names
+        m_History.insert(settings.value("signature", group).toString(), history);
+        settings.endGroup();
+    }
+}
+
+bool ProfileTuner::save() const
+{
+    QSettings historySettings(historyFile(), QSettings::IniFormat);
+    historySettings.clear();
+    int groupNumber = 0;
+    for(auto it = m_History.constBegin(); it != m_History.constEnd(); ++it)
+    {
+        const History &history = it.value();
+        historySettings.beginGroup(QString("Signature%1").arg(++groupNumber));
+        historySettings.setValue("signature", it.key());
+        historySettings.setValue("firstKey", history.firstKey);
+        historySettings.setValue("minField", history.minField);
+        historySettings.setValue("maxField", history.maxField);
+        historySettings.setValue("bandStatistics", history.bandStatistics);
+        historySettings.setValue("lastParameters", history.lastParameters);
+        QVariantMap trials;
+        for(auto trial = history.trials.constBegin(); trial != history.trials.constEnd(); ++trial)
+        {
+            QVariantList times;
+            for(double time : trial.value().times)
+                times.append(time);
+            trials.insert(trial.key(), QVariantList() << trial.value().attempts << trial.value().solves << QVariant(times));
+        }
+        historySettings.setValue("trials", trials);
+        historySettings.endGroup();
+    }
+    historySettings.sync();
+
+    // The learned profiles are saved like the other saved profiles, so loadSavedOptionsProfiles loads them with the rest
+    QSettings profileSettings(m_ProfilesFile, QSettings::IniFormat);
+    for(auto it = m_History.constBegin(); it != m_History.constEnd(); ++it)
+    {
+        if(it.value().lastParameters.isEmpty())
+            continue;
+        SSolver::Parameters params = tunedProfile(it.key(), SSolver::Parameters::convertFromMap(it.value().lastParameters));
+        params.listName = QString("Tuned %1").arg(it.key());
+        params.description = QString("Profile learned from the solves of %1 images").arg(it.key());
+        profileSettings.beginGroup(params.listName);
+        const QMap<QString, QVariant> map = SSolver::Parameters::convertToMap(params);
+        for(auto value = map.constBegin(); value != map.constEnd(); ++value)
+            profileSettings.setValue(value.key(), value.value());
+        profileSettings.endGroup();
+    }
+    profileSettings.sync();
+    return historySettings.status() == QSettings::NoError && profileSettings.status() == QSettings::NoError;
+}
@@ -0,0 +1,145 @@
+/*  ProfileTuner, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QString>
+#include <QHash>
+#include <QList>
+#include <QVariantMap>
+
+#include "stellarsolver.h"
+
+/**
+ * @brief The ProfileTuner class learns a Parameters profile for each camera and optics from how the solves with them went.
+ * The built in profiles are the same for every setup, but how many stars a solve needs, how much the image can be downsampled
+ * and which parallel algorithm is fastest depend on the size of the image and the pixel scale.  The tuner keeps the solve times
+ * and successes of each variation of keepNum, initialKeep, downsample and multiAlgorithm it tried for a signature of the image size
+ * and pixel scale.  suggest tries the variations next to the best one so far a few times each, and the best one is the one
+ * with the lowest median solve time whose success rate is within 5% of the best success rate.  The field widths that solved
+ * narrow minwidth and maxwidth, and the band statistics of the ranges of depths and scales are kept with the rest.
+ * The history is saved next to the profiles file, and the learned profiles are saved in the profiles file with the format
+ * of StellarSolver::loadSavedOptionsProfiles, so they can be loaded like any other saved profile.
+ */
+class ProfileTuner
+{
+    public:
+        /**
+         * @brief ProfileTuner makes a tuner that loads the history it saved before
+         * @param profilesFile is the file of the saved options profiles to save the learned profiles in, the history is saved next to it
+         */
+        explicit ProfileTuner(const QString &profilesFile);
+
+        /**
+         * @brief signature describes the camera and optics of an image, the size of the image and its pixel scale
+         * @param stats The statistics of the image
+         * @param pixelScale The pixel scale in arcseconds per pixel, or 0 if it is not known
+         * @return The signature, images with the same signature share their history
+         */
+        static QString signature(const FITSImage::Statistic &stats, double pixelScale);
+
+        /**
+         * @brief suggest gets the parameters to solve the next image of a signature with
+         * @param signature The signature of the image
+         * @param base The profile to start from the first time, and to take the settings that are not tuned from
+         * @return The parameters, which are the best ones so far unless a variation of them is tried
+         */
+        SSolver::Parameters suggest(const QString &signature, const SSolver::Parameters &base) const;
+
+        /**
+         * @brief tunedProfile gets the best parameters so far for a signature, without trying any variations
+         * @param signature The signature of the image
+         * @param base The profile to take the settings that are not tuned from
+         * @return The parameters
+         */
+        SSolver::Parameters tunedProfile(const QString &signature, const SSolver::Parameters &base) const;
+
+        /**
+         * @brief record records how a solve went
+         * @param signature The signature of the image
+         * @param tried The parameters that the image was solved with, after StellarSolver checked them
+         * @param solved Whether the image solved
+         * @param solveMs How many milliseconds the solve took
+         * @param solution The solution, its field width narrows the range of widths to search
+         * @param bandStatistics The band statistics of the solver, see StellarSolver::getBandStatistics
+         */
+        void record(const QString &signature, const SSolver::Parameters &tried, bool solved, double solveMs,
+                    const FITSImage::Solution &solution, const QVariantMap &bandStatistics = QVariantMap());
+
+        /**
+         * @brief record records how the last solve of a StellarSolver went, with the signature of its image and solution
+         * @param solver The StellarSolver, after it finished solving
+         * @param signature The signature of the image, or an empty string for the signature of the solver's image and solution
+         */
+        void record(StellarSolver &solver, const QString &signature = QString());
+
+        /**
+         * @brief bandStatistics gets the band statistics that were recorded for a signature, to give to StellarSolver::setBandStatistics
+         */
+        QVariantMap bandStatistics(const QString &signature) const;
+
+        /**
+         * @brief setExploring sets whether suggest tries the variations of the best parameters, by default it does until they were all tried
+         */
+        void setExploring(bool exploring)
+        {
+            m_Exploring = exploring;
+        }
+
+        /**
+         * @brief clear forgets the history of a signature, for instance when the optics changed but the image size and pixel scale didn't
+         */
+        void clear(const QString &signature)
+        {
+            m_History.remove(signature);
+        }
+
+        /**
+         * @brief save saves the history and the learned profiles
+         * @return Whether they were saved
+         */
+        bool save() const;
+
+        /**
+         * @brief historyFile gets the file the history is saved in, next to the profiles file
+         */
+        QString historyFile() const;
+
+    private:
+        // This is how one variation of the tuned settings has done
+        struct Trial
+        {
+            int attempts {0};                       // The number of solves with it
+            int solves {0};                         // The number of them that solved
+            QList<double> times;                    // The milliseconds of the last solves, for the median
+        };
+        // This is everything that was learned for one signature
+        struct History
+        {
+            QHash<QString, Trial> trials;           // The variations, see trialKey
+            QString firstKey;                       // The variation of the profile it started with
+            double minField {0};                    // The narrowest field width that solved in degrees, 0 if none solved
+            double maxField {0};                    // The widest field width that solved in degrees
+            QVariantMap bandStatistics;             // The band statistics of the last solve
+            QVariantMap lastParameters;             // The last parameters it was solved with, for its learned profile
+        };
+
+        static QString trialKey(const SSolver::Parameters &params);
+        static SSolver::Parameters applyKey(SSolver::Parameters params, const QString &key);
+        static QStringList neighbors(const QString &key);
+        static double median(QList<double> times);
+        QString bestKey(const History &history) const;
+        void load();
+
+        QString m_ProfilesFile;
+        QHash<QString, History> m_History;
+        bool m_Exploring {true};
+
+        static const int MinTrials = 3;             // The solves each variation gets before it can be the best
+        static const int KeptTimes = 15;            // The solve times of each variation that are kept for the median
+};
@@ -0,0 +1,327 @@
+/*  PSFFit, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "psffit.h"
+
+#include <algorithm>
+#include <cmath>
+
+//QT Includes
+#include <QVector>
+#include <QtConcurrent>
+
+namespace
+{
+// The parameters of the profiles.  The shape is Q = a11 * dx^2 + a22 * dy^2 + 2 * a12 * dx * dy.
+enum
+{
+    P_BACKGROUND,
+    P_AMPLITUDE,
+    P_X,
+    P_Y,
+    P_A11,
+    P_A22,
+    P_A12,
+    P_BETA,
+    MAX_PARAMETERS
+};
+
+// The box around a star is this many sigma on each side of it, within these many pixels
+const double BOX_SIGMAS = 4;
+const int MIN_BOX_HALF = 3;
+const int MAX_BOX_HALF = 30;
+// The fit has converged when an iteration improves the chi square by less than this fraction
+const double CONVERGED_CHANGE = 1e-6;
+// The fit gives up when the damping of the steps gets this big without improving
+const double MAX_LAMBDA = 1e10;
+const double MIN_BETA = 1.01;
+const double MAX_BETA = 20;
+
+// The pixels of the box around a star, by their positions relative to its estimated center
+struct Box
+{
+    std::vector<double> px, py, z;
+};
+
+struct Fitter
+{
+    Box box;
+    PSFFit::Model model;
+    int numParameters;
+    // The columns of the Jacobian and the residuals of each pixel of the box
+    std::vector<double> jacobian[MAX_PARAMETERS];
+    std::vector<double> residuals;
+
+    // The profile is only meaningful when its shape is a positive definite ellipse
+    bool valid(const double *p) const
+    {
+        if(!(p[P_A11] > 0 && p[P_A22] > 0 && p[P_A11] * p[P_A22] - p[P_A12] * p[P_A12] > 0 && p[P_AMPLITUDE] > 0))
+            return false;
+        return model == PSFFit::GAUSSIAN || (p[P_BETA] >= MIN_BETA && p[P_BETA] <= MAX_BETA);
+    }
+
+    // This is the chi square of the profile with the parameters p, and with withJacobian, it keeps the residuals and their derivatives
+    double evaluate(const double *p, bool withJacobian)
+    {
+        const int n = box.z.size();
+        double chi2 = 0;
+        for(int i = 0; i < n; i++)
+        {
+            const double dx = box.px[i] - p[P_X];
+            const double dy = box.py[i] - p[P_Y];
+            const double q = p[P_A11] * dx * dx + p[P_A22] * dy * dy + 2 * p[P_A12] * dx * dy;
+            double shape, dShape;
+            if(model == PSFFit::GAUSSIAN)
+            {
+                shape = exp(-0.5 * q);
+                dShape = -0.5 * p[P_AMPLITUDE] * shape;
+            }
+            else
+            {
+                const double u = 1 + q;
+                shape = pow(u, -p[P_BETA]);
+                dShape = -p[P_BETA] * p[P_AMPLITUDE] * shape / u;
+                if(withJacobian)
+                    jacobian[P_BETA][i] = -p[P_AMPLITUDE] * shape * log(u);
+            }
+            const double r = box.z[i] - p[P_BACKGROUND] - p[P_AMPLITUDE] * shape;
+            chi2 += r * r;
+            if(withJacobian)
+            {
+                residuals[i] = r;
+                jacobian[P_BACKGROUND][i] = 1;
+                jacobian[P_AMPLITUDE][i] = shape;
+                jacobian[P_X][i] = -dShape * 2 * (p[P_A11] * dx + p[P_A12] * dy);
+                jacobian[P_Y][i] = -dShape * 2 * (p[P_A22] * dy + p[P_A12] * dx);
+                jacobian[P_A11][i] = dShape * dx * dx;
+                jacobian[P_A22][i] = dShape * dy * dy;
+                jacobian[P_A12][i] = dShape * 2 * dx * dy;
+            }
+        }
+        return chi2;
+    }
+
+    // This solves (JtJ + lambda * diag(JtJ)) step = Jtr with a Cholesky decomposition, it returns false if it is singular
+    bool solve(const double *jtj, const double *jtr, double lambda, double *step) const
+    {
+        const int m = numParameters;
+        double l[MAX_PARAMETERS * MAX_PARAMETERS] = {0};
+        for(int i = 0; i < m; i++)
+        {
+            for(int j = 0; j <= i; j++)
+            {
+                double sum = jtj[i * m + j] + (i == j ? lambda * jtj[i * m + i] : 0);
+                for(int k = 0; k < j; k++)
+                    sum -= l[i * m + k] * l[j * m + k];
+                if(i == j)
+                {
+                    if(!(sum > 0))
+                        return false;
+                    l[i * m + i] = sqrt(sum);
+                }
+                else
+                    l[i * m + j] = sum / l[j * m + j];
+            }
+        }
+        double w[MAX_PARAMETERS];
+        for(int i = 0; i < m; i++)
+        {
+            double sum = jtr[i];
+            for(int k = 0; k < i; k++)
+                sum -= l[i * m + k] * w[k];
+            w[i] = sum / l[i * m + i];
+        }
+        for(int i = m - 1; i >= 0; i--)
+        {
+            double sum = w[i];
+            for(int k = i + 1; k < m; k++)
+                sum -= l[k * m + i] * step[k];
+            step[i] = sum / l[i * m + i];
+        }
+        return true;
+    }
+};
+
+inline double dot(const std::vector<double> &a, const std::vector<double> &b)
+{
+    double sum = 0;
+    const int n = a.size();
+    for(int i = 0; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+}
+
+PSFFit::Result PSFFit::fit(const float *data, int width, int height, int stride, double x, double y, double sigma, Model model,
+                           int maxIterations)
+{
+    Result result;
+    if(!data || !(sigma > 0) || !std::isfinite(x) || !std::isfinite(y))
+        return result;
+
+    Fitter fitter;
+    fitter.model = model;
+    fitter.numParameters = model == MOFFAT ? P_BETA + 1 : P_A12 + 1;
+
+    // The box is centered on the pixel of the estimated center, and the positions in it are relative to that pixel
+    const int cx = lround(x);
+    const int cy = lround(y);
+    const int half = std::max(MIN_BOX_HALF, std::min(MAX_BOX_HALF, static_cast<int>(ceil(BOX_SIGMAS * sigma))));
+    double peak = 0;
+    for(int j = std::max(0, cy - half); j <= std::min(height - 1, cy + half); j++)
+    {
+        for(int i = std::max(0, cx - half); i <= std::min(width - 1, cx + half); i++)
+        {
+            const float value = data[static_cast<size_t>(j) * stride + i];
+            if(!std::isfinite(value))
+                continue;
+            fitter.box.px.push_back(i - cx);
+            fitter.box.py.push_back(j - cy);
+            fitter.box.z.push_back(value);
+            if(std::abs(i - cx) <= 1 && std::abs(j - cy) <= 1)
+                peak = std::max(peak, static_cast<double>(value));
+        }
+    }
+    const int n = fitter.box.z.size();
+    if(n < 4 * fitter.numParameters || !(peak > 0))
+        return result;
+    fitter.residuals.resize(n);
+    for(int k = 0; k < fitter.numParameters; k++)
+        fitter.jacobian[k].resize(n);
+
+    // The Moffat profile starts with the same FWHM as the Gaussian of the estimated sigma
+    double p[MAX_PARAMETERS] = {0};
+    p[P_AMPLITUDE] = peak;
+    p[P_X] = x - cx;
+    p[P_Y] = y - cy;
+    if(model == GAUSSIAN)
+        p[P_A11] = p[P_A22] = 1 / (sigma * sigma);
+    else
+    {
+        p[P_BETA] = 3;
+        const double alpha = 2.3548 * sigma / (2 * sqrt(pow(2, 1 / p[P_BETA]) - 1));
+        p[P_A11] = p[P_A22] = 1 / (alpha * alpha);
+    }
+
+    const int m = fitter.numParameters;
+    double lambda = 1e-3;
+    double chi2 = fitter.evaluate(p, true);
+    for(result.iterations = 1; result.iterations <= maxIterations; result.iterations++)
+    {
+        double jtj[MAX_PARAMETERS * MAX_PARAMETERS], jtr[MAX_PARAMETERS];
+        for(int i = 0; i < m; i++)
+        {
+            jtr[i] = dot(fitter.jacobian[i], fitter.residuals);
+            for(int j = 0; j <= i; j++)
+                jtj[i * m + j] = jtj[j * m + i] = dot(fitter.jacobian[i], fitter.jacobian[j]);
+        }
+
+        // The damping goes up until a step improves the fit, and down again after it does
+        bool improved = false;
+        double trial[MAX_PARAMETERS], newChi2 = chi2;
+        while(!improved && lambda < MAX_LAMBDA)
+        {
+            double step[MAX_PARAMETERS] = {0};
+            if(fitter.solve(jtj, jtr, lambda, step))
+            {
+                std::copy(p, p + MAX_PARAMETERS, trial);
+                for(int k = 0; k < m; k++)
+                    trial[k] += step[k];
+                if(fitter.valid(trial))
+                {
+                    newChi2 = fitter.evaluate(trial, false);
+                    improved = newChi2 < chi2;
+                }
+            }
+            lambda = improved ? std::max(lambda / 10, 1e-9) : lambda * 10;
+        }
+        // When no step improves the fit any more, it is at the minimum
+        if(!improved)
+        {
+            result.converged = true;
+            break;
+        }
+        std::copy(trial, trial + MAX_PARAMETERS, p);
+        const double change = (chi2 - newChi2) / std::max(chi2, 1e-300);
+        chi2 = fitter.evaluate(p, true);
+        if(change < CONVERGED_CHANGE)
+        {
+            result.converged = true;
+            break;
+        }
+    }
+    result.iterations = std::min(result.iterations, maxIterations);
+
+    // The axes of the ellipse come from the eigenvalues of its shape, the small one is the major axis
+    const double mean = (p[P_A11] + p[P_A22]) / 2;
+    const double diff = sqrt((p[P_A11] - p[P_A22]) * (p[P_A11] - p[P_A22]) / 4 + p[P_A12] * p[P_A12]);
+    const double small = mean - diff, big = mean + diff;
+    if(!(small > 0) || !fitter.valid(p))
+    {
+        result.converged = false;
+        return result;
+    }
+    const double majorWidth = 1 / sqrt(small), minorWidth = 1 / sqrt(big);
+    double fwhmScale, hfrScale;
+    if(model == GAUSSIAN)
+    {
+        fwhmScale = 2 * sqrt(2 * log(2.0));
+        hfrScale = sqrt(2 * log(2.0));
+    }
+    else
+    {
+        fwhmScale = 2 * sqrt(pow(2, 1 / p[P_BETA]) - 1);
+        hfrScale = sqrt(pow(2, 1 / (p[P_BETA] - 1)) - 1);
+        result.beta = p[P_BETA];
+    }
+    double theta = 0.5 * atan2(2 * p[P_A12], p[P_A11] - p[P_A22]) + M_PI / 2;
+    if(theta > M_PI / 2)
+        theta -= M_PI;
+
+    result.x = cx + p[P_X];
+    result.y = cy + p[P_Y];
+    result.amplitude = p[P_AMPLITUDE];
+    result.background = p[P_BACKGROUND];
+    result.majorFWHM = fwhmScale * majorWidth;
+    result.minorFWHM = fwhmScale * minorWidth;
+    result.theta = theta;
+    result.FWHM = fwhmScale * sqrt(majorWidth * minorWidth);
+    result.HFR = hfrScale * sqrt(majorWidth * minorWidth);
+    result.ellipticity = 1 - minorWidth / majorWidth;
+
+    // A fit that wandered off of the box did not find this star
+    if(std::abs(p[P_X]) > half || std::abs(p[P_Y]) > half || result.FWHM > 2 * half)
+        result.converged = false;
+    return result;
+}
+
+std::vector<PSFFit::Result> PSFFit::fitStars(const float *data, int width, int height, int stride, const double *x,
+        const double *y, const double *sigma, int count, Model model, int threads, int maxIterations)
+{
+    std::vector<Result> results(std::max(count, 0));
+    auto fitChunk = [&](int chunk, int numChunks)
+    {
+        for(int i = chunk; i < count; i += numChunks)
+            results[i] = fit(data, width, height, stride, x[i], y[i], sigma[i], model, maxIterations);
+    };
+
+    // The stars are dealt out to the chunks in turn, so the chunks get a mix of big and small ones even if they are sorted by size
+    const int numChunks = std::max(1, std::min(threads, count));
+    if(numChunks == 1)
+        fitChunk(0, 1);
+    else
+    {
+        QVector<int> chunks;
+        for(int chunk = 0; chunk < numChunks; chunk++)
+            chunks.append(chunk);
+        QtConcurrent::blockingMap(chunks, [&fitChunk, numChunks](int chunk)
+        {
+            fitChunk(chunk, numChunks);
+        });
+    }
+    return results;
+}
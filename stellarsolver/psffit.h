@@ -0,0 +1,67 @@
+/*  PSFFit, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include <vector>
+
+/**
+ * @brief PSFFit fits an elliptical Gaussian or Moffat profile to each star with a small Levenberg-Marquardt fit, which gives
+ * the FWHM, HFR and ellipticity of the stars from all of their pixels.  This is less noisy at low SNR than measuring the HFR from
+ * the growth of the flux with sep_flux_radius, and it only uses a box of a few times the size of the star.  The pixels of the
+ * box are kept in arrays, so that the model, the residuals and the normal equations of each iteration are loops the compiler
+ * can vectorize, and the fit stops as soon as the chi square stops improving.
+ */
+namespace PSFFit
+{
+typedef enum
+{
+    GAUSSIAN,   // background + amplitude * exp(-Q / 2)
+    MOFFAT      // background + amplitude * (1 + Q) ^ -beta
+} Model;
+
+// The result of the fit of one star.  The axes are the FWHM along the major and minor axes of the star.
+typedef struct Result
+{
+    bool converged = false; // Whether the fit converged, otherwise the rest are not meaningful
+    int iterations = 0;     // The number of iterations the fit took
+    double x = 0;           // The center of the star, in the coordinates of the image
+    double y = 0;
+    double amplitude = 0;   // The peak of the star above the background
+    double background = 0;  // The background left in the box around the star
+    double majorFWHM = 0;   // The FWHM along the major axis
+    double minorFWHM = 0;   // The FWHM along the minor axis
+    double theta = 0;       // The angle of the major axis from the x axis, in radians
+    double beta = 0;        // The power of the Moffat profile, 0 for a Gaussian
+    double FWHM = 0;        // The FWHM of the circle with the same area as the ellipse at half maximum
+    double HFR = 0;         // The radius that has half of the flux of the fitted profile
+    double ellipticity = 0; // 1 - minor / major
+} Result;
+
+/**
+ * @brief fit fits a profile to one star
+ * @param data The image, which should have its background subtracted
+ * @param width The width of the image
+ * @param height The height of the image
+ * @param stride The number of pixels from one row of the image to the next
+ * @param x The estimated center of the star, where the center of the first pixel is 0
+ * @param y The estimated center of the star
+ * @param sigma The estimated size of the star, as the sigma of a Gaussian, which sets the box that is fitted
+ * @param model The profile to fit
+ * @param maxIterations The most iterations to do before giving up
+ * @return The fitted profile
+ */
+Result fit(const float *data, int width, int height, int stride, double x, double y, double sigma, Model model,
+           int maxIterations = 20);
+
+/**
+ * @brief fitStars fits a profile to each of the stars, with the stars split between up to threads threads of the global pool
+ * @return The fitted profiles of the stars, in their order
+ */
+std::vector<Result> fitStars(const float *data, int width, int height, int stride, const double *x, const double *y,
+                             const double *sigma, int count, Model model, int threads, int maxIterations = 20);
+}
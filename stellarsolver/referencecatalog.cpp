@@ -0,0 +1,157 @@
+/*  ReferenceCatalog, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "referencecatalog.h"
+
+#include "indexcatalog.h"
+#include "wcsdata.h"
+
+//QT Includes
+#include <QHash>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/mathutil.h"
+#include "astrometry/starutil.h"
+#include "astrometry/verify.h"
+}
+
+ReferenceCatalog::ReferenceCatalog()
+{
+}
+
+ReferenceCatalog::~ReferenceCatalog()
+{
+    clear();
+}
+
+int ReferenceCatalog::build(IndexCatalog &indexes, const QStringList &folderPaths, const QStringList &filePaths, double ra, double dec,
+                            double radius)
+{
+    clear();
+    m_Catalog = verify_ref_catalog_new();
+    if(!m_Catalog)
+        return 0;
+    m_RA = ra;
+    m_Dec = dec;
+    m_Radius = radius;
+    return indexes.addReferenceStars(folderPaths, filePaths, ra, dec, radius, m_Catalog);
+}
+
+void ReferenceCatalog::clear()
+{
+    verify_ref_catalog_free(m_Catalog);
+    m_Catalog = nullptr;
+    m_RA = m_Dec = m_Radius = 0;
+}
+
+int ReferenceCatalog::count() const
+{
+    int stars = 0;
+    for(int i = 0; m_Catalog && i < m_Catalog->nregions; i++)
+        stars += m_Catalog->regions[i].N;
+    return stars;
+}
+
+int ReferenceCatalog::indexes() const
+{
+    return m_Catalog ? m_Catalog->nregions : 0;
+}
+
+bool ReferenceCatalog::covers(double ra, double dec, double radius) const
+{
+    if(!m_Catalog || m_Catalog->nregions == 0)
+        return false;
+    double target[3], center[3];
+    radecdeg2xyzarr(m_RA, m_Dec, target);
+    radecdeg2xyzarr(ra, dec, center);
+    return distsq2deg(distsq(target, center, 3)) + radius <= m_Radius;
+}
+
+QList<FITSImage::Star> ReferenceCatalog::starsInImage(const WCSData &wcs, int width, int height, int maxStars) const
+{
+    QList<FITSImage::Star> stars;
+    if(!m_Catalog || !wcs.hasWCS)
+        return stars;
+
+    std::vector<double> ra, dec, mag;
+    bool hasMags = true;
+    for(int r = 0; r < m_Catalog->nregions; r++)
+    {
+        const verify_ref_region_t &region = m_Catalog->regions[r];
+        hasMags = hasMags && region.mag;
+        for(int i = 0; i < region.N; i++)
+        {
+            double starRA, starDec;
+            xyzarr2radecdeg(region.xyz + 3 * i, &starRA, &starDec);
+            ra.push_back(starRA);
+            dec.push_back(starDec);
+            mag.push_back(region.mag ? region.mag[i] : 0);
+        }
+    }
+    const int total = static_cast<int>(ra.size());
+    std::vector<double> x(total), y(total);
+    std::unique_ptr<bool[]> valid(new bool[std::max(1, total)]);
+    WCSData projection = wcs;
+    if(total == 0 || !projection.wcsToPixels(ra.data(), dec.data(), x.data(), y.data(), total, valid.get()))
+        return stars;
+
+    std::vector<int> order;
+    for(int i = 0; i < total; i++)
+    {
+        if(valid[i] && x[i] >= 0 && x[i] < width && y[i] >= 0 && y[i] < height)
+            order.push_back(i);
+    }
+    if(hasMags)
+    {
+        std::stable_sort(order.begin(), order.end(), [&mag](int a, int b)
+        {
+            return mag[a] < mag[b];
+        });
+    }
+
+    // The indexes of the different scales have many of the same stars, a star within a pixel of one that is listed is one of them
+    QHash<quint64, int> listed;
+    const auto cell = [](int cx, int cy)
+    {
+        return (static_cast<quint64>(static_cast<quint32>(cy)) << 32) | static_cast<quint32>(cx);
+    };
+    for(int i : order)
+    {
+        const int cx = static_cast<int>(x[i]), cy = static_cast<int>(y[i]);
+        bool duplicate = false;
+        for(int dy = -1; dy <= 1 && !duplicate; dy++)
+        {
+            for(int dx = -1; dx <= 1 && !duplicate; dx++)
+            {
+                auto other = listed.constFind(cell(cx + dx, cy + dy));
+                duplicate = other != listed.constEnd() && std::hypot(x[*other] - x[i], y[*other] - y[i]) < 1;
+            }
+        }
+        if(duplicate)
+            continue;
+        listed.insert(cell(cx, cy), i);
+
+        FITSImage::Star star;
+        memset(&star, 0, sizeof(star));
+        star.x = x[i];
+        star.y = y[i];
+        star.ra = ra[i];
+        star.dec = dec[i];
+        star.mag = mag[i];
+        stars.append(star);
+        if(maxStars > 0 && stars.size() >= maxStars)
+            break;
+    }
+    return stars;
+}
@@ -0,0 +1,111 @@
+/*  ReferenceCatalog, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QList>
+#include <QStringList>
+
+#include "structuredefinitions.h"
+
+class IndexCatalog;
+class WCSData;
+struct verify_ref_catalog_t;
+
+/**
+ * @brief The ReferenceCatalog class holds the index stars around a target for a session of imaging it, so that the solves of the session
+ * don't search the star kd-trees of the indexes again.  The stars of each index within the radius are copied once, as unit vectors
+ * sorted by their z, so the stars in the field of a solve are found in a range of them.  The verifications of the internal solver,
+ * those of a solve with a search position, of a verify only solve of a prior WCS and of a blind solve, get the stars from it whenever it
+ * covers their field, and search the kd-trees as before otherwise.  The stars can also be projected into an image with its WCS, as the
+ * reference stars to cross match its stars with, see starsInImage and StarMatcher.  It is only read once it is built, so any number of
+ * solves can use it at the same time.
+ */
+class ReferenceCatalog
+{
+    public:
+        ReferenceCatalog();
+        ~ReferenceCatalog();
+
+        ReferenceCatalog(const ReferenceCatalog &) = delete;
+        ReferenceCatalog &operator=(const ReferenceCatalog &) = delete;
+
+        /**
+         * @brief build copies the stars of the indexes around the target, it replaces the stars it had
+         * @param indexes The index catalog, which loads the indexes near the target if they aren't loaded yet
+         * @param folderPaths The index folders
+         * @param filePaths The individual index files
+         * @param ra The right ascension of the target in degrees
+         * @param dec The declination of the target in degrees
+         * @param radius The radius around the target in degrees, which should be the radius of the field and the margin the mount can be off by
+         * @return The number of stars
+         */
+        int build(IndexCatalog &indexes, const QStringList &folderPaths, const QStringList &filePaths, double ra, double dec, double radius);
+
+        /**
+         * @brief clear forgets the stars
+         */
+        void clear();
+
+        // The target and the radius it was built for
+        double ra() const
+        {
+            return m_RA;
+        }
+        double dec() const
+        {
+            return m_Dec;
+        }
+        double radius() const
+        {
+            return m_Radius;
+        }
+
+        /**
+         * @brief count gets the number of stars, of all of the indexes together, so the stars that are in several indexes are counted for each
+         */
+        int count() const;
+
+        /**
+         * @brief indexes gets the number of indexes whose stars it has
+         */
+        int indexes() const;
+
+        /**
+         * @brief covers gets whether a field is inside the region of the stars
+         * @param ra The right ascension of the center of the field in degrees
+         * @param dec The declination of the center of the field in degrees
+         * @param radius The radius of the field in degrees
+         */
+        bool covers(double ra, double dec, double radius) const;
+
+        /**
+         * @brief starsInImage projects the stars into an image, as the reference stars of a cross match of its stars.
+         * The stars that are in several indexes are only listed once.  The ones with catalog magnitudes are sorted brightest first.
+         * @param wcs The WCS of the image, for instance from StellarSolver::getWCSData
+         * @param width The width of the image in pixels
+         * @param height The height of the image in pixels
+         * @param maxStars The most stars to list, 0 for all of them
+         * @return The stars with their pixel and sky positions and their catalog magnitudes, they have no flux
+         */
+        QList<FITSImage::Star> starsInImage(const WCSData &wcs, int width, int height, int maxStars = 0) const;
+
+        /**
+         * @brief catalog gets the catalog for the verifications of astrometry.net, see astrometry/verify.h
+         */
+        const struct verify_ref_catalog_t *catalog() const
+        {
+            return m_Catalog;
+        }
+
+    private:
+        struct verify_ref_catalog_t *m_Catalog { nullptr };
+        double m_RA { 0 };
+        double m_Dec { 0 };
+        double m_Radius { 0 };
+};
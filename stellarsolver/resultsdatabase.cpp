@@ -0,0 +1,273 @@
+/*  ResultsDatabase, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "resultsdatabase.h"
+
+#include "starsummary.h"
+#include "stellarsolver.h"
+
+#ifdef HAVE_QTSQL
+//QT Includes
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+
+namespace
+{
+const char *createTable =
+    "CREATE TABLE IF NOT EXISTS images ("
+    "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+    "file TEXT NOT NULL UNIQUE, "
+    "width INTEGER, height INTEGER, "
+    "solved INTEGER, ra REAL, dec REAL, field_width REAL, field_height REAL, orientation REAL, pixscale REAL, parity INTEGER, "
+    "extracted INTEGER, num_stars INTEGER, median_hfr REAL, lower_quartile_hfr REAL, upper_quartile_hfr REAL, "
+    "median_eccentricity REAL, background REAL, background_rms REAL, "
+    "solve_ms REAL, extract_ms REAL, quads_tried INTEGER, verifications INTEGER)";
+
+const char *columns =
+    "file, width, height, solved, ra, dec, field_width, field_height, orientation, pixscale, parity, "
+    "extracted, num_stars, median_hfr, lower_quartile_hfr, upper_quartile_hfr, median_eccentricity, background, background_rms, "
+    "solve_ms, extract_ms, quads_tried, verifications";
+
+ResultsDatabase::ImageResult readRow(const QSqlQuery &query)
+{
+    ResultsDatabase::ImageResult result;
+    int c = 0;
+    result.fileName = query.value(c++).toString();
+    result.width = query.value(c++).toInt();
+    result.height = query.value(c++).toInt();
+    result.solved = query.value(c++).toBool();
+    result.solution.ra = query.value(c++).toDouble();
+    result.solution.dec = query.value(c++).toDouble();
+    result.solution.fieldWidth = query.value(c++).toDouble();
+    result.solution.fieldHeight = query.value(c++).toDouble();
+    result.solution.orientation = query.value(c++).toDouble();
+    result.solution.pixscale = query.value(c++).toDouble();
+    result.solution.parity = static_cast<FITSImage::Parity>(query.value(c++).toInt());
+    result.extracted = query.value(c++).toBool();
+    result.quality.numStars = query.value(c++).toInt();
+    result.quality.medianHFR = query.value(c++).toFloat();
+    result.quality.lowerQuartileHFR = query.value(c++).toFloat();
+    result.quality.upperQuartileHFR = query.value(c++).toFloat();
+    result.quality.medianEccentricity = query.value(c++).toFloat();
+    result.quality.background = query.value(c++).toFloat();
+    result.quality.backgroundRMS = query.value(c++).toFloat();
+    result.solveMs = query.value(c++).toDouble();
+    result.extractMs = query.value(c++).toDouble();
+    result.quadsTried = query.value(c++).toInt();
+    result.verifications = query.value(c++).toInt();
+    return result;
+}
+}
+#endif
+
+ResultsDatabase::ResultsDatabase()
+{
+    m_ConnectionName = QString("ResultsDatabase_%1").arg(reinterpret_cast<quintptr>(this));
+}
+
+ResultsDatabase::~ResultsDatabase()
+{
+    close();
+}
+
+bool ResultsDatabase::isAvailable()
+{
+#ifdef HAVE_QTSQL
+    return QSqlDatabase::isDriverAvailable("QSQLITE");
+#else
+    return false;
+#endif
+}
+
+bool ResultsDatabase::fail(const QString &error)
+{
+    m_LastError = error;
+    return false;
+}
+
+bool ResultsDatabase::open(const QString &fileName)
+{
+    close();
+#ifdef HAVE_QTSQL
+    if(!isAvailable())
+        return fail("The SQLite driver of QtSql is not installed");
+    bool ok;
+    // The database and the query have to be gone before the connection can be removed when it fails
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", m_ConnectionName);
+        db.setDatabaseName(fileName);
+        ok = db.open();
+        if(!ok)
+            m_LastError = db.lastError().text();
+        else
+        {
+            // WAL lets other programs read the results while they are written, and with it, NORMAL only syncs at the checkpoints
+            QSqlQuery query(db);
+            ok = query.exec("PRAGMA journal_mode=WAL") && query.exec("PRAGMA synchronous=NORMAL") && query.exec(createTable);
+            if(!ok)
+            {
+                m_LastError = query.lastError().text();
+                db.close();
+            }
+        }
+    }
+    if(!ok)
+    {
+        QSqlDatabase::removeDatabase(m_ConnectionName);
+        return false;
+    }
+    m_Open = true;
+    return true;
+#else
+    Q_UNUSED(fileName);
+    return fail("StellarSolver was built without QtSql, see USE_RESULTS_DATABASE");
+#endif
+}
+
+void ResultsDatabase::close()
+{
+    if(!m_Open)
+        return;
+    commit();
+#ifdef HAVE_QTSQL
+    QSqlDatabase::database(m_ConnectionName, false).close();
+    QSqlDatabase::removeDatabase(m_ConnectionName);
+#endif
+    m_Open = false;
+}
+
+bool ResultsDatabase::add(const ImageResult &result)
+{
+    if(!m_Open)
+        return fail("The database is not open");
+#ifdef HAVE_QTSQL
+    QSqlDatabase db = QSqlDatabase::database(m_ConnectionName, false);
+    if(!m_InTransaction)
+    {
+        if(!db.transaction())
+            return fail(db.lastError().text());
+        m_InTransaction = true;
+    }
+    QSqlQuery query(db);
+    query.prepare(QString("INSERT OR REPLACE INTO images (%1) VALUES (?%2)").arg(columns).arg(QString(", ?").repeated(22)));
+    query.addBindValue(result.fileName);
+    query.addBindValue(result.width);
+    query.addBindValue(result.height);
+    query.addBindValue(result.solved);
+    query.addBindValue(result.solution.ra);
+    query.addBindValue(result.solution.dec);
+    query.addBindValue(result.solution.fieldWidth);
+    query.addBindValue(result.solution.fieldHeight);
+    query.addBindValue(result.solution.orientation);
+    query.addBindValue(result.solution.pixscale);
+    query.addBindValue(static_cast<int>(result.solution.parity));
+    query.addBindValue(result.extracted);
+    query.addBindValue(result.quality.numStars);
+    query.addBindValue(result.quality.medianHFR);
+    query.addBindValue(result.quality.lowerQuartileHFR);
+    query.addBindValue(result.quality.upperQuartileHFR);
+    query.addBindValue(result.quality.medianEccentricity);
+    query.addBindValue(result.quality.background);
+    query.addBindValue(result.quality.backgroundRMS);
+    query.addBindValue(result.solveMs);
+    query.addBindValue(result.extractMs);
+    query.addBindValue(result.quadsTried);
+    query.addBindValue(result.verifications);
+    if(!query.exec())
+        return fail(query.lastError().text());
+    if(++m_Waiting >= m_ImagesPerTransaction)
+        return commit();
+    return true;
+#else
+    Q_UNUSED(result);
+    return false;
+#endif
+}
+
+bool ResultsDatabase::commit()
+{
+    if(!m_Open || !m_InTransaction)
+        return m_Open;
+#ifdef HAVE_QTSQL
+    QSqlDatabase db = QSqlDatabase::database(m_ConnectionName, false);
+    m_InTransaction = false;
+    m_Waiting = 0;
+    if(!db.commit())
+        return fail(db.lastError().text());
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool ResultsDatabase::find(const QString &fileName, ImageResult &result)
+{
+    if(!m_Open)
+        return fail("The database is not open");
+#ifdef HAVE_QTSQL
+    // The images that are waiting are in the transaction of this connection, so the query sees them
+    QSqlQuery query(QSqlDatabase::database(m_ConnectionName, false));
+    query.prepare(QString("SELECT %1 FROM images WHERE file = ?").arg(columns));
+    query.addBindValue(fileName);
+    if(!query.exec())
+        return fail(query.lastError().text());
+    if(!query.next())
+        return false;
+    result = readRow(query);
+    return true;
+#else
+    Q_UNUSED(fileName);
+    Q_UNUSED(result);
+    return false;
+#endif
+}
+
+QList<ResultsDatabase::ImageResult> ResultsDatabase::results(bool solvedOnly)
+{
+    QList<ImageResult> found;
+    if(!m_Open)
+        return found;
+#ifdef HAVE_QTSQL
+    QSqlQuery query(QSqlDatabase::database(m_ConnectionName, false));
+    query.setForwardOnly(true);
+    if(!query.exec(QString("SELECT %1 FROM images %2 ORDER BY id").arg(columns).arg(solvedOnly ? "WHERE solved = 1" : "")))
+    {
+        fail(query.lastError().text());
+        return found;
+    }
+    while(query.next())
+        found.append(readRow(query));
+#else
+    Q_UNUSED(solvedOnly);
+#endif
+    return found;
+}
+
+ResultsDatabase::ImageResult ResultsDatabase::fromSolver(const QString &fileName, const StellarSolver &solver)
+{
+    ImageResult result;
+    result.fileName = fileName;
+    result.width = solver.getStatistics().width;
+    result.height = solver.getStatistics().height;
+    result.solved = solver.solvingDone();
+    if(result.solved)
+        result.solution = solver.getSolution();
+    result.extracted = solver.extractionDone();
+    if(result.extracted)
+        result.quality = StarSummary::summarize(solver.getStarList(), solver.getBackground());
+    // The metrics are of the last process of the solver, which includes the extraction if it was a solve
+    const FITSImage::SolveMetrics &metrics = solver.getSolveMetrics();
+    if(static_cast<SSolver::ProcessType>(solver.property("ProcessType").toInt()) == SSolver::SOLVE)
+        result.solveMs = metrics.totalMs;
+    else
+        result.extractMs = metrics.totalMs;
+    result.quadsTried = metrics.quadsTried;
+    result.verifications = metrics.verifications;
+    return result;
+}
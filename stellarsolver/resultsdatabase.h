@@ -0,0 +1,130 @@
+/*  ResultsDatabase, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QList>
+#include <QString>
+
+#include "structuredefinitions.h"
+
+class StellarSolver;
+
+/**
+ * @brief The ResultsDatabase class keeps the results of the images of a batch in one SQLite file, so that a report on thousands of
+ * images is one query instead of reading the CSV and WCS files of each of them.  Each image is one row, with its solution, the summary
+ * of its stars and how long it took.  The rows are written in transactions of several images, and the database is in WAL mode, so
+ * adding an image costs about as much as appending to a file, and other programs can read the database while the batch is running.
+ * It needs QtSql with its SQLite driver, which the library is built with when USE_RESULTS_DATABASE is on, otherwise open fails.
+ * A ResultsDatabase can only be used from the thread that opened it, like a QSqlDatabase.
+ */
+class ResultsDatabase
+{
+    public:
+        // This is the row of one image
+        typedef struct ImageResult
+        {
+            QString fileName;                   // The image file, which identifies the row, adding the same one again replaces it
+            int width { 0 };                    // The size of the image in pixels
+            int height { 0 };
+            bool solved { false };              // Whether the image was solved, the solution is only set then
+            FITSImage::Solution solution {};
+            bool extracted { false };           // Whether the stars were extracted, the quality is only set then
+            FITSImage::ImageQuality quality;    // The star count, the HFR and the eccentricity of the stars and the background
+            double solveMs { 0 };               // How long the solve took, the retries included
+            double extractMs { 0 };             // How long the star extraction took
+            int quadsTried { 0 };               // How much work the solver did, see FITSImage::SolveMetrics
+            int verifications { 0 };
+        } ImageResult;
+
+        ResultsDatabase();
+        ~ResultsDatabase();
+
+        ResultsDatabase(const ResultsDatabase &) = delete;
+        ResultsDatabase &operator=(const ResultsDatabase &) = delete;
+
+        /**
+         * @brief isAvailable gets whether the library was built with QtSql and its SQLite driver is there
+         */
+        static bool isAvailable();
+
+        /**
+         * @brief open opens the database file, or creates it with its table if it doesn't exist
+         * @param fileName The SQLite file
+         * @return false if it could not be opened, see lastError
+         */
+        bool open(const QString &fileName);
+
+        /**
+         * @brief close commits the images that are waiting and closes the database
+         */
+        void close();
+
+        bool isOpen() const
+        {
+            return m_Open;
+        }
+
+        QString lastError() const
+        {
+            return m_LastError;
+        }
+
+        /**
+         * @brief setImagesPerTransaction sets how many images are written together, the default is DEFAULT_IMAGES_PER_TRANSACTION.
+         * The images that are waiting are lost if the program crashes, but a transaction for each image is much slower.
+         */
+        void setImagesPerTransaction(int images)
+        {
+            m_ImagesPerTransaction = qMax(1, images);
+        }
+
+        /**
+         * @brief add adds the result of an image, it is committed with the next full transaction or by commit or close
+         * @return false if it could not be written, see lastError
+         */
+        bool add(const ImageResult &result);
+
+        /**
+         * @brief commit writes the images that are waiting now
+         * @return false if they could not be written, see lastError
+         */
+        bool commit();
+
+        /**
+         * @brief find gets the result of an image file, with the images that are waiting
+         * @return false if the image isn't in the database
+         */
+        bool find(const QString &fileName, ImageResult &result);
+
+        /**
+         * @brief results gets the results of all of the images in the database, in the order they were added
+         * @param solvedOnly If true, only the solved images are returned
+         */
+        QList<ImageResult> results(bool solvedOnly = false);
+
+        /**
+         * @brief fromSolver makes the result of an image from a StellarSolver that solved it or extracted its stars, for instance
+         * in a slot for StellarSolver::batchImageSolved.  The quality is summarized from the star list when there is one.
+         * @param fileName The image file
+         * @param solver The StellarSolver
+         */
+        static ImageResult fromSolver(const QString &fileName, const StellarSolver &solver);
+
+        static const int DEFAULT_IMAGES_PER_TRANSACTION = 100;
+
+    private:
+        bool fail(const QString &error);
+
+        QString m_ConnectionName;
+        bool m_Open { false };
+        bool m_InTransaction { false };
+        int m_Waiting { 0 };
+        int m_ImagesPerTransaction { DEFAULT_IMAGES_PER_TRANSACTION };
+        QString m_LastError;
+};
@@ -69,7 +69,7 @@ int Analyze::analysemthresh(int objnb, objliststruct *objlist, int minarea,
     if(minarea <=0) //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
         return 1;
 
-    QMALLOC(heap, float, minarea, status);
+    AMALLOC(heap, float, minarea, status);
     heapt = heap;
 
     /*-- Find the minareath pixel in decreasing intensity for CLEANing */
@@ -110,7 +110,7 @@ int Analyze::analysemthresh(int objnb, objliststruct *objlist, int minarea,
     obj->mthresh = *heap;
 
 exit:
-    free(heap);
+    sep_arena_free(heap);
     return status;
 }
 
@@ -24,9 +24,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <atomic>
+#include <map>
+#include <tuple>
+#include <vector>
 #include "sep.h"
 #include "sepcore.h"
 #include "overlap.h"
+#include "parallel.h"
 
 namespace SEP
 {
@@ -159,23 +164,121 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2, double *r_ou
     *r_out2 = (*r_out2) * (*r_out2);
 }
 
+/*****************************************************************************/
+/* precomputed weight masks for circular apertures */
+
+#define APER_MASK_RMAX 64.0          /* larger circles are never masked */
+#define APER_MASK_CACHE_MAX (1<<20)  /* weights kept in the masks of a thread */
+
+static std::atomic<int> aper_mask_buckets(0);
+
+void sep_set_aper_mask_buckets(int buckets)
+{
+    aper_mask_buckets = buckets > 0 ? buckets : 0;
+}
+
+int sep_get_aper_mask_buckets()
+{
+    return aper_mask_buckets;
+}
+
+/* The weights of the pixels around a circle of radius r for sep_sum_circle().
+ * The fractional position of the center is rounded to the middle of one of
+ * buckets x buckets cells of a pixel, and the weights are computed for that
+ * center, so the objects that fall in the same cell with the same radius
+ * share a mask.  The mask covers (2*half+1)^2 pixels around the pixel of the
+ * center, starting at *mx, *my, and holds -1 for the pixels that
+ * sep_sum_circle() would skip.  Each thread keeps its own masks, so the
+ * threads of the batch functions need no locks.  Returns NULL when the masks
+ * are off or the circle is too big for one. */
+static const double *aper_circle_mask(double x, double y, double r, int subpix,
+                                      int *mx, int *my, int *mw)
+{
+    typedef std::tuple<double, int, int, int, int> mask_key;
+    thread_local std::map<mask_key, std::vector<double>> masks;
+    thread_local size_t nweights = 0;
+    double fx, fy, cx, cy, dx, dy, r2, r_in2, r_out2, rpix2;
+    int buckets, bx, by, half, w, i, j;
+
+    buckets = aper_mask_buckets;
+    if (buckets <= 0 || !(r <= APER_MASK_RMAX))
+        return NULL;
+
+    fx = floor(x);
+    fy = floor(y);
+    bx = (int)((x - fx) * buckets);
+    by = (int)((y - fy) * buckets);
+    bx = bx < buckets ? bx : buckets - 1;
+    by = by < buckets ? by : buckets - 1;
+    half = (int)ceil(r) + 1;
+    w = 2 * half + 1;
+    *mx = (int)fx - half;
+    *my = (int)fy - half;
+    *mw = w;
+
+    std::vector<double> &mask = masks[mask_key(r, subpix, buckets, bx, by)];
+    if (!mask.empty())
+        return mask.data();
+
+    if (nweights + w * w > APER_MASK_CACHE_MAX)
+    {
+        masks.clear();
+        nweights = 0;
+        return aper_circle_mask(x, y, r, subpix, mx, my, mw);
+    }
+
+    r2 = r * r;
+    oversamp_ann_circle(r, &r_in2, &r_out2);
+    cx = (bx + 0.5) / buckets;
+    cy = (by + 0.5) / buckets;
+    mask.resize(w * w);
+    for (j = 0; j < w; j++)
+        for (i = 0; i < w; i++)
+        {
+            dx = i - half - cx;
+            dy = j - half - cy;
+            rpix2 = dx * dx + dy * dy;
+            if (!(rpix2 < r_out2))
+                mask[j * w + i] = -1.0;
+            else if (rpix2 > r_in2)
+                mask[j * w + i] = subpix == 0 ?
+                                  circoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, r) :
+                                  subpixoverlap(dx, dy, 1.0, 1.0, 0.0, -1.0, r2, subpix);
+            else
+                mask[j * w + i] = 1.0;
+        }
+    nweights += w * w;
+    return mask.data();
+}
+
+static INLINE double aper_mask_weight(const double *mask, int i, int j, int w)
+{
+    return (i >= 0 && i < w && j >= 0 && j < w) ? mask[j * w + i] : -1.0;
+}
+
 /*****************************************************************************/
 /* circular aperture */
 
 #define APER_NAME sep_sum_circle
 #define APER_ARGS double r
-#define APER_DECL double r2, r_in2, r_out2
+#define APER_DECL                               \
+  double r2, r_in2, r_out2;                     \
+  const double *mask;                           \
+  int mx, my, mw
 #define APER_CHECKS                             \
   if (r < 0.0)                                  \
     return ILLEGAL_APER_PARAMS
-#define APER_INIT                               \
-  r2 = r*r;                                     \
-  oversamp_ann_circle(r, &r_in2, &r_out2)
+#define APER_INIT                                               \
+  r2 = r*r;                                                     \
+  oversamp_ann_circle(r, &r_in2, &r_out2);                      \
+  mask = aper_circle_mask(x, y, r, subpix, &mx, &my, &mw)
+#define APER_MASK_ON mask
+#define APER_MASK aper_mask_weight(mask, ix - mx, iy - my, mw)
 #define APER_BOXEXTENT boxextent(x, y, r, r, im->w, im->h,              \
                                  &xmin, &xmax, &ymin, &ymax, flag)
 #define APER_EXACT circoverlap(dx-0.5, dy-0.5, dx+0.5, dy+0.5, r)
 #define APER_RPIX2 dx*dx + dy*dy
-#define APER_RPIX2_SUBPIX dx1*dx1 + dy2
+#define APER_SUBPIX subpixoverlap(dx, dy, 1.0, 1.0, 0.0, -1.0, r2, subpix)
 #define APER_COMPARE1 rpix2 < r_out2
 #define APER_COMPARE2 rpix2 > r_in2
 #define APER_COMPARE3 rpix2 < r2
@@ -188,10 +291,12 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2, double *r_ou
 #undef APER_BOXEXTENT
 #undef APER_EXACT
 #undef APER_RPIX2
-#undef APER_RPIX2_SUBPIX
+#undef APER_SUBPIX
 #undef APER_COMPARE1
 #undef APER_COMPARE2
 #undef APER_COMPARE3
+#undef APER_MASK_ON
+#undef APER_MASK
 
 /*****************************************************************************/
 /* elliptical aperture */
@@ -213,7 +318,7 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2, double *r_ou
                                          &xmin, &xmax, &ymin, &ymax, flag)
 #define APER_EXACT ellipoverlap(dx-0.5, dy-0.5, dx+0.5, dy+0.5, a, b, theta)
 #define APER_RPIX2 cxx*dx*dx + cyy*dy*dy + cxy*dx*dy
-#define APER_RPIX2_SUBPIX cxx*dx1*dx1 + cyy*dy2 + cxy*dx1*dy
+#define APER_SUBPIX subpixoverlap(dx, dy, cxx, cyy, cxy, -1.0, r2, subpix)
 #define APER_COMPARE1 rpix2 < r_out2
 #define APER_COMPARE2 rpix2 > r_in2
 #define APER_COMPARE3 rpix2 < r2
@@ -226,7 +331,7 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2, double *r_ou
 #undef APER_BOXEXTENT
 #undef APER_EXACT
 #undef APER_RPIX2
-#undef APER_RPIX2_SUBPIX
+#undef APER_SUBPIX
 #undef APER_COMPARE1
 #undef APER_COMPARE2
 #undef APER_COMPARE3
@@ -250,7 +355,7 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2, double *r_ou
 #define APER_EXACT (circoverlap(dx-0.5, dy-0.5, dx+0.5, dy+0.5, rout) - \
                     circoverlap(dx-0.5, dy-0.5, dx+0.5, dy+0.5, rin))
 #define APER_RPIX2 dx*dx + dy*dy
-#define APER_RPIX2_SUBPIX dx1*dx1 + dy2
+#define APER_SUBPIX subpixoverlap(dx, dy, 1.0, 1.0, 0.0, rin2, rout2, subpix)
 #define APER_COMPARE1 (rpix2 < rout_out2) && (rpix2 > rin_in2)
 #define APER_COMPARE2 (rpix2 > rout_in2) || (rpix2 < rin_out2)
 #define APER_COMPARE3 (rpix2 < rout2) && (rpix2 > rin2)
@@ -263,7 +368,7 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2, double *r_ou
 #undef APER_BOXEXTENT
 #undef APER_EXACT
 #undef APER_RPIX2
-#undef APER_RPIX2_SUBPIX
+#undef APER_SUBPIX
 #undef APER_COMPARE1
 #undef APER_COMPARE2
 #undef APER_COMPARE3
@@ -292,7 +397,7 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2, double *r_ou
   (ellipoverlap(dx-0.5, dy-0.5, dx+0.5, dy+0.5, a*rout, b*rout, theta) - \
    ellipoverlap(dx-0.5, dy-0.5, dx+0.5, dy+0.5, a*rin, b*rin, theta))
 #define APER_RPIX2 cxx*dx*dx + cyy*dy*dy + cxy*dx*dy
-#define APER_RPIX2_SUBPIX cxx*dx1*dx1 + cyy*dy2 + cxy*dx1*dy
+#define APER_SUBPIX subpixoverlap(dx, dy, cxx, cyy, cxy, rin2, rout2, subpix)
 #define APER_COMPARE1 (rpix2 < rout_out2) && (rpix2 > rin_in2)
 #define APER_COMPARE2 (rpix2 > rout_in2) || (rpix2 < rin_out2)
 #define APER_COMPARE3 (rpix2 < rout2) && (rpix2 > rin2)
@@ -305,7 +410,7 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2, double *r_ou
 #undef APER_BOXEXTENT
 #undef APER_EXACT
 #undef APER_RPIX2
-#undef APER_RPIX2_SUBPIX
+#undef APER_SUBPIX
 #undef APER_COMPARE1
 #undef APER_COMPARE2
 #undef APER_COMPARE3
@@ -331,7 +436,7 @@ int sep_sum_circann_multi(sep_image *im,
     BYTE *datat, *errort, *maskt, *segt;
     converter convert, econvert, mconvert, sconvert;
     double rpix, r_out, r_out2, d, prevbinmargin, nextbinmargin, step, stepdens;
-    int j, ismasked;
+    int j, ismasked, alwaysoversamp;
 
     /* input checks */
     if (rmax < 0.0 || n < 1)
@@ -362,6 +467,8 @@ int sep_sum_circann_multi(sep_image *im,
     stepdens = 1.0 / step;
     prevbinmargin = 0.7072;
     nextbinmargin = step - 0.7072;
+    /* with bins narrower than two margins every pixel is close to a boundary, so d = 0 keeps the fmod out of the loop */
+    alwaysoversamp = nextbinmargin < prevbinmargin;   //# Modified for the StellarSolver Internal Library
     //j = 0;
     //d = 0.;       //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, these values were not used
     //ismasked = 0;
@@ -401,7 +508,7 @@ int sep_sum_circann_multi(sep_image *im,
     for (iy = ymin; iy < ymax; iy++)
     {
         /* set pointers to the start of this row */
-        pos = (iy % im->raw_h) * im->raw_w + xmin;
+        pos = (long)(iy % im->raw_h) * im->raw_w + xmin;   //# Modified for the StellarSolver Internal Library, the offset of a row is 64 bit
         datat = reinterpret_cast<uint8_t *>(im->data) + pos * size;
         if (errisarray)
             errort = reinterpret_cast<uint8_t *>(im->noise) + pos * esize;
@@ -468,7 +575,7 @@ int sep_sum_circann_multi(sep_image *im,
 
                 /* check if oversampling is needed (close to bin boundary?) */
                 rpix = sqrt(rpix2);
-                d = fmod(rpix, step);
+                d = alwaysoversamp ? 0.0 : fmod(rpix, step);
                 if (d < prevbinmargin || d > nextbinmargin)
                 {
                     dx += offset;
@@ -647,7 +754,7 @@ int sep_kron_radius(sep_image *im, double x, double y,
     for (iy = ymin; iy < ymax; iy++)
     {
         /* set pointers to the start of this row */
-        pos = (iy % im->raw_h) * im->raw_w + xmin;
+        pos = (long)(iy % im->raw_h) * im->raw_w + xmin;   //# Modified for the StellarSolver Internal Library, the offset of a row is 64 bit
         datat = reinterpret_cast<uint8_t *>(im->data)  + pos * size;
         if (im->mask)
             maskt = reinterpret_cast<uint8_t *>(im->mask) + pos * msize;
@@ -732,6 +839,129 @@ int sep_kron_radius(sep_image *im, double x, double y,
 }
 
 
+/*****************************************************************************/
+/* Batched aperture photometry */
+
+/* Runs measure(i) for all n objects on up to nthreads threads.  The objects
+ * are dealt out in turn, so the threads get a mix of big and small ones even
+ * if they are sorted by size.  Returns the first error. */
+template <typename F>
+static int aper_batch(int n, int nthreads, F measure)
+{
+    int i, t, s, status = RETURN_OK;
+
+    if (nthreads > n)
+        nthreads = n;
+    if (nthreads <= 1)
+    {
+        for (i = 0; i < n; i++)
+            if ((s = measure(i)) != RETURN_OK && status == RETURN_OK)
+                status = s;
+        return status;
+    }
+
+    std::vector<int> statuses(nthreads, RETURN_OK);
+    sep_parallel_for(nthreads, nthreads, [&](int piece)
+    {
+        int j, js;
+        for (j = piece; j < n; j += nthreads)
+            if ((js = measure(j)) != RETURN_OK && statuses[piece] == RETURN_OK)
+                statuses[piece] = js;
+    });
+    for (t = 0; t < nthreads; t++)
+        if (statuses[t] != RETURN_OK && status == RETURN_OK)
+            status = statuses[t];
+    return status;
+}
+
+int sep_kron_radius_batch(sep_image *im, int n, const double *x, const double *y,
+                          const double *cxx, const double *cyy, const double *cxy,
+                          double r, const int *id, double *kronrad, short *flag,
+                          int nthreads)
+{
+    return aper_batch(n, nthreads, [&](int i)
+    {
+        int status = sep_kron_radius(im, x[i], y[i], cxx[i], cyy[i], cxy[i], r,
+                                     id ? id[i] : 0, &kronrad[i], &flag[i]);
+        if (status != RETURN_OK)
+            kronrad[i] = 0.0;
+        return status;
+    });
+}
+
+int sep_sum_circle_batch(sep_image *im, int n, const double *x, const double *y,
+                         const double *r, const int *id, int subpix, short inflag,
+                         double *sum, double *sumerr, double *area, short *flag,
+                         int nthreads)
+{
+    return aper_batch(n, nthreads, [&](int i)
+    {
+        int status = sep_sum_circle(im, x[i], y[i], r[i], id ? id[i] : 0, subpix, inflag,
+                                    &sum[i], &sumerr[i], &area[i], &flag[i]);
+        if (status != RETURN_OK)
+            sum[i] = sumerr[i] = area[i] = 0.0;
+        return status;
+    });
+}
+
+int sep_sum_ellipse_batch(sep_image *im, int n, const double *x, const double *y,
+                          const double *a, const double *b, const double *theta,
+                          const double *r, const int *id, int subpix, short inflag,
+                          double *sum, double *sumerr, double *area, short *flag,
+                          int nthreads)
+{
+    return aper_batch(n, nthreads, [&](int i)
+    {
+        int status = sep_sum_ellipse(im, x[i], y[i], a[i], b[i], theta[i], r[i],
+                                     id ? id[i] : 0, subpix, inflag,
+                                     &sum[i], &sumerr[i], &area[i], &flag[i]);
+        if (status != RETURN_OK)
+            sum[i] = sumerr[i] = area[i] = 0.0;
+        return status;
+    });
+}
+
+int sep_flux_radius_batch(sep_image *im, int n, const double *x, const double *y,
+                          double rmax, const int *id, int subpix, short inflag,
+                          const double *fluxtot, const double *fluxfrac, int nfrac,
+                          double *r, short *flag, int nthreads)
+{
+    return aper_batch(n, nthreads, [&](int i)
+    {
+        double total = fluxtot ? fluxtot[i] : 0.0;
+        int k, status;
+        status = sep_flux_radius(im, x[i], y[i], rmax, id ? id[i] : 0, subpix, inflag,
+                                 fluxtot ? &total : NULL, const_cast<double *>(fluxfrac),
+                                 nfrac, r + (size_t)i * nfrac, &flag[i]);
+        if (status != RETURN_OK)
+            for (k = 0; k < nfrac; k++)
+                r[(size_t)i * nfrac + k] = 0.0;
+        return status;
+    });
+}
+
+int sep_windowed_batch(sep_image *im, int n, const double *x, const double *y,
+                       const double *sig, int subpix, short inflag,
+                       double *xout, double *yout, int *niter, short *flag,
+                       int nthreads)
+{
+    return aper_batch(n, nthreads, [&](int i)
+    {
+        int iters = 0;
+        int status = sep_windowed(im, x[i], y[i], sig[i], subpix, inflag,
+                                  &xout[i], &yout[i], &iters, &flag[i]);
+        /* an object that fails keeps its position */
+        if (status != RETURN_OK)
+        {
+            xout[i] = x[i];
+            yout[i] = y[i];
+        }
+        if (niter)
+            niter[i] = iters;
+        return status;
+    });
+}
+
 /* set array values within an ellipse (uc = unsigned char array) */
 void sep_set_ellipse(unsigned char *arr, int w, int h,
                      double x, double y, double cxx, double cyy, double cxy,
@@ -862,7 +1092,7 @@ int sep_windowed(sep_image *im,
         for (iy = ymin; iy < ymax; iy++)
         {
             /* set pointers to the start of this row */
-            pos = (iy % im->raw_h) * im->raw_w + xmin;
+            pos = (long)(iy % im->raw_h) * im->raw_w + xmin;   //# Modified for the StellarSolver Internal Library, the offset of a row is 64 bit
             datat = reinterpret_cast<uint8_t *>(im->data) + pos * size;
             if (errisarray)
                 errort = reinterpret_cast<uint8_t *>(im->noise) + pos * esize;
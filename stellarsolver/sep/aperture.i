@@ -11,10 +11,10 @@ int APER_NAME(sep_image *im,
               double *sum, double *sumerr, double *area, short *flag)
 {
     PIXTYPE pix, varpix;
-    double dx, dy, dx1, dy2, offset, scale, scale2, tmp;
+    double dx, dy, tmp;
     double tv, sigtv, totarea, maskarea, overlap, rpix2;
-    int ix, iy, xmin, xmax, ymin, ymax, sx, sy, status, size, esize, msize, ssize;
-    int ismasked;
+    int ix, iy, xmin, xmax, ymin, ymax, status, size, esize, msize, ssize;
+    int ismasked, inside;
     long pos;
     short errisarray, errisstd;
     BYTE *datat, *errort, *maskt, *segt;
@@ -34,9 +34,6 @@ int APER_NAME(sep_image *im,
     errort = reinterpret_cast<uint8_t*>(im->noise);
     *flag = 0;
     varpix = 0.0;
-    scale = 1.0 / subpix;
-    scale2 = scale * scale;
-    offset = 0.5 * (scale - 1.0);
     errisarray = 0;
     errisstd = 0;
 
@@ -88,35 +85,35 @@ int APER_NAME(sep_image *im,
         {
             dx = ix - x;
             dy = iy - y;
-            rpix2 = APER_RPIX2;
-            if (APER_COMPARE1)
+#ifdef APER_MASK
+            /* the weights of the pixels come from a precomputed mask, which
+               is negative outside of the oversampled annulus */
+            if (APER_MASK_ON)
             {
-                if (APER_COMPARE2)  /* might be partially in aperture */
+                overlap = APER_MASK;
+                inside = overlap >= 0.0;
+            }
+            else
+#endif
+            {
+                rpix2 = APER_RPIX2;
+                inside = APER_COMPARE1;
+                if (inside)
                 {
-                    if (subpix == 0)
-                        overlap = APER_EXACT;
-                    else
+                    if (APER_COMPARE2)  /* might be partially in aperture */
                     {
-                        dx += offset;
-                        dy += offset;
-                        overlap = 0.0;
-                        for (sy = subpix; sy--; dy += scale)
-                        {
-                            dx1 = dx;
-                            dy2 = dy * dy;
-                            for (sx = subpix; sx--; dx1 += scale)
-                            {
-                                rpix2 = APER_RPIX2_SUBPIX;
-                                if (APER_COMPARE3)
-                                    overlap += scale2;
-                            }
-                        }
+                        if (subpix == 0)
+                            overlap = APER_EXACT;
+                        else
+                            overlap = APER_SUBPIX;
                     }
+                    else
+                        /* definitely fully in aperture */
+                        overlap = 1.0;
                 }
-                else
-                    /* definitely fully in aperture */
-                    overlap = 1.0;
-
+            }
+            if (inside)
+            {
                 pix = convert(datat);
 
                 if (errisarray)
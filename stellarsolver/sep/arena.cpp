@@ -0,0 +1,249 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+*
+* This file is part of SEP
+*
+* Copyright 2014 SEP developers
+*
+* SEP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SEP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with SEP.  If not, see <http://www.gnu.org/licenses/>.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+namespace SEP
+{
+
+namespace
+{
+
+/* Every block starts with this, so that a freed block goes back on the list
+ * for its size.  The alignment keeps the memory after it aligned for any
+ * type, like malloc does. */
+struct alignas(16) BlockHeader
+{
+    size_t sizeclass;     /* the block holds ARENA_MIN_BLOCK << sizeclass bytes */
+    BlockHeader *next;    /* the next block on the free list */
+};
+
+const size_t ARENA_MIN_BLOCK = 32;
+const int ARENA_NCLASSES = 48;
+const size_t ARENA_FIRST_CHUNK = 1 << 20;
+
+/* The bytes in the chunks of all of the arenas, for the memory accounting */
+std::atomic<size_t> reservedBytes(0);
+
+struct Chunk
+{
+    char *base;
+    size_t size;
+    size_t used;
+};
+
+class Arena
+{
+    public:
+        ~Arena()
+        {
+            release();
+        }
+
+        void *allocate(size_t size)
+        {
+            size_t sizeclass = 0, capacity = ARENA_MIN_BLOCK;
+            while (capacity < size)
+            {
+                if (++sizeclass == ARENA_NCLASSES)
+                    return NULL;
+                capacity <<= 1;
+            }
+
+            BlockHeader *block = freelist[sizeclass];
+            if (block)
+            {
+                freelist[sizeclass] = block->next;
+                return block + 1;
+            }
+
+            const size_t need = sizeof(BlockHeader) + capacity;
+            if (chunks.empty() || chunks.back().used + need > chunks.back().size)
+            {
+                size_t chunksize = chunks.empty() ? ARENA_FIRST_CHUNK : 2 * chunks.back().size;
+                if (chunksize < need)
+                    chunksize = need;
+                Chunk chunk = {static_cast<char *>(malloc(chunksize)), chunksize, 0};
+                if (!chunk.base)
+                    return NULL;
+                chunks.push_back(chunk);
+                reservedBytes += chunksize;
+            }
+
+            Chunk &chunk = chunks.back();
+            block = reinterpret_cast<BlockHeader *>(chunk.base + chunk.used);
+            chunk.used += need;
+            block->sizeclass = sizeclass;
+            block->next = NULL;
+            return block + 1;
+        }
+
+        void deallocate(void *ptr)
+        {
+            BlockHeader *block = static_cast<BlockHeader *>(ptr) - 1;
+            block->next = freelist[block->sizeclass];
+            freelist[block->sizeclass] = block;
+        }
+
+        static size_t capacity(const void *ptr)
+        {
+            return ARENA_MIN_BLOCK << (static_cast<const BlockHeader *>(ptr) - 1)->sizeclass;
+        }
+
+        bool owns(const void *ptr) const
+        {
+            const char *p = static_cast<const char *>(ptr);
+            for (const Chunk &chunk : chunks)
+                if (p >= chunk.base && p < chunk.base + chunk.size)
+                    return true;
+            return false;
+        }
+
+        /* Makes all of the memory available again.  If the image needed more
+         * than one chunk, they are replaced by one chunk big enough for all of
+         * it, so the next image of the same size fits in it. */
+        void reset()
+        {
+            memset(freelist, 0, sizeof(freelist));
+            if (chunks.size() > 1)
+            {
+                size_t total = 0;
+                for (const Chunk &chunk : chunks)
+                    total += chunk.used;
+                release();
+                Chunk chunk = {static_cast<char *>(malloc(total)), total, 0};
+                if (chunk.base)
+                {
+                    chunks.push_back(chunk);
+                    reservedBytes += total;
+                }
+            }
+            else if (!chunks.empty())
+                chunks.back().used = 0;
+        }
+
+        void release()
+        {
+            for (const Chunk &chunk : chunks)
+            {
+                free(chunk.base);
+                reservedBytes -= chunk.size;
+            }
+            chunks.clear();
+            memset(freelist, 0, sizeof(freelist));
+        }
+
+        int depth = 0;
+
+    private:
+        std::vector<Chunk> chunks;
+        BlockHeader *freelist[ARENA_NCLASSES] = {};
+};
+
+Arena &threadArena()
+{
+    static thread_local Arena arena;
+    return arena;
+}
+
+}
+
+void *sep_arena_malloc(size_t size)
+{
+    Arena &arena = threadArena();
+    if (arena.depth == 0)
+        return malloc(size);
+    return arena.allocate(size);
+}
+
+void *sep_arena_calloc(size_t nel, size_t size)
+{
+    Arena &arena = threadArena();
+    if (arena.depth == 0)
+        return calloc(nel, size);
+    if (size && nel > (size_t)-1 / size)
+        return NULL;
+    void *ptr = arena.allocate(nel * size);
+    if (ptr)
+        memset(ptr, 0, nel * size);
+    return ptr;
+}
+
+void *sep_arena_realloc(void *ptr, size_t size)
+{
+    Arena &arena = threadArena();
+    if (!ptr)
+        return sep_arena_malloc(size);
+    if (!arena.owns(ptr))
+        return realloc(ptr, size);
+
+    const size_t capacity = Arena::capacity(ptr);
+    if (size <= capacity)
+        return ptr;
+    void *newptr = arena.allocate(size);
+    if (!newptr)
+        return NULL;
+    memcpy(newptr, ptr, capacity);
+    arena.deallocate(ptr);
+    return newptr;
+}
+
+void sep_arena_free(void *ptr)
+{
+    if (!ptr)
+        return;
+    Arena &arena = threadArena();
+    if (arena.owns(ptr))
+        arena.deallocate(ptr);
+    else
+        free(ptr);
+}
+
+ArenaScope::ArenaScope()
+{
+    threadArena().depth++;
+}
+
+ArenaScope::~ArenaScope()
+{
+    Arena &arena = threadArena();
+    if (--arena.depth == 0)
+        arena.reset();
+}
+
+void sep_arena_release()
+{
+    Arena &arena = threadArena();
+    if (arena.depth == 0)
+        arena.release();
+}
+
+size_t sep_arena_reserved()
+{
+    return reservedBytes.load();
+}
+
+}
@@ -0,0 +1,72 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+*
+* This file is part of SEP
+*
+* Copyright 2014 SEP developers
+*
+* SEP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SEP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with SEP.  If not, see <http://www.gnu.org/licenses/>.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#pragma once
+
+#include <stddef.h>
+
+/* Per thread memory arena for the extraction temporaries.
+ *
+ * sep_extract() and the Lutz, Deblend and Analyze code allocate a lot of
+ * small and medium buffers for every image they process.  While an
+ * ArenaScope is alive on a thread, those allocations come from memory that
+ * the thread keeps between images.  Freed blocks are reused within the image,
+ * and when the outermost scope ends, all of it is handed back to the arena at
+ * once.  The next image with the same geometry then finds everything it needs
+ * in a single block, without calling malloc at all.
+ *
+ * Without a scope, the sep_arena functions are just malloc, calloc, realloc
+ * and free, so SEP still works the same when it is used on its own.
+ * sep_arena_free() and sep_arena_realloc() also accept memory that came from
+ * the heap, so it does not matter which one a pointer was allocated with.
+ *
+ * Nothing allocated from the arena may be used after the scope ends, such as
+ * a catalog from sep_extract(); copy out what you need first.
+ */
+
+namespace SEP
+{
+
+void *sep_arena_malloc(size_t size);
+void *sep_arena_calloc(size_t nel, size_t size);
+void *sep_arena_realloc(void *ptr, size_t size);
+void sep_arena_free(void *ptr);
+
+/* Sets the arena of this thread up for extraction, and resets it when the
+ * outermost scope on the thread is destroyed.  Scopes can be nested. */
+class ArenaScope
+{
+    public:
+        ArenaScope();
+        ~ArenaScope();
+
+        ArenaScope(const ArenaScope &) = delete;
+        ArenaScope &operator=(const ArenaScope &) = delete;
+};
+
+/* Frees the memory the arena of this thread is keeping.  It only does
+ * something when no scope is active on the thread. */
+void sep_arena_release();
+
+/* The bytes the arenas of all of the threads are keeping, in use or not. */
+size_t sep_arena_reserved();
+
+}
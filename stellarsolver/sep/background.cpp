@@ -24,8 +24,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
 #include "sep.h"
 #include "sepcore.h"
+#include "parallel.h"
+#include "simd.h"
+#include "tracer.h"
 
 namespace SEP
 {
@@ -33,6 +37,7 @@ namespace SEP
 #define	BACK_MINGOODFRAC   0.5   /* min frac with good weights*/
 #define	QUANTIF_NSIGMA     5     /* histogram limits */
 #define	QUANTIF_NMAXLEVELS 4096  /* max nb of quantif. levels */
+#define	BACK_MINSAMPLES    256   /* min nb of samples in a sampled mesh */
 #define	QUANTIF_AMIN       4     /* min nb of "mode pixels" */
 
 /* Background info in a single mesh*/
@@ -44,15 +49,16 @@ typedef struct
     float	 qzero, qscale;		/* Position of histogram */
     float	 lcut, hcut;		/* Histogram cuts */
     int	 npix;			/* Number of pixels involved */
+    int	 nsample;		/* Number of pixels sampled */ //# Modified for the StellarSolver Internal Library
 } backstruct;
 
 /* internal helper functions */
 void backhisto(backstruct *backmesh,
                PIXTYPE *buf, PIXTYPE *wbuf, int bufsize,
-               int n, int w, int bw, PIXTYPE maskthresh);
+               int n, int w, int bw, PIXTYPE maskthresh, int step);
 void backstat(backstruct *backmesh,
               PIXTYPE *buf, PIXTYPE *wbuf, int bufsize,
-              int n, int w, int bw, PIXTYPE maskthresh);
+              int n, int w, int bw, PIXTYPE maskthresh, int step);
 int filterback(sep_bkg *bkg, int fw, int fh, double fthresh);
 float backguess(backstruct *bkg, float *mean, float *sigma);
 int makebackspline(sep_bkg *bkg, float *map, float *dmap);
@@ -60,11 +66,54 @@ int makebackspline(sep_bkg *bkg, float *map, float *dmap);
 
 int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
                    double fthresh, sep_bkg **bkg)
+{
+    return sep_background_mt(image, bw, bh, fw, fh, fthresh, 1, bkg);
+}
+
+//# Modified for the StellarSolver Internal Library, convert only the lines
+//# of a row of boxes that are sampled, every step'th line of the bufsize
+//# pixels that are w wide.
+static void convertlines(array_converter convert, BYTE *in, int elsize,
+                         int bufsize, int w, int step, PIXTYPE *out)
+{
+    int y, h;
+    if (step <= 1)
+    {
+        convert(in, bufsize, out);
+        return;
+    }
+    h = bufsize / w;
+    for (y = 0; y < h; y += step)
+        convert(in + (size_t)elsize * y * w, w, out + (size_t)y * w);
+}
+
+//# Modified for the StellarSolver Internal Library, a sampled row of boxes
+//# is only used when every box in it kept enough of its samples.  A box that
+//# is discarded, or one that loses most of its samples to the cuts, may be a
+//# masked or crowded part of the image, where the robust estimate needs all of
+//# the pixels, so then the row is done again with every pixel.
+static int backsampled_ok(const backstruct *backmesh, int nx)
+{
+    int m;
+    for (m = 0; m < nx; m++)
+        if (backmesh[m].mean <= -BIG ||
+                backmesh[m].npix < backmesh[m].nsample * BACK_MINGOODFRAC)
+            return 0;
+    return 1;
+}
+
+/* Compute the background statistics of the rows of background boxes number
+ * jstart, jstart + jstep, jstart + 2 * jstep, ... and store them in bkgout.
+ * Each call has its own buffers, so several calls can run at the same time
+ * on different rows.  The statistics use every step'th pixel of every
+ * step'th line of the boxes. */
+static int backrows(sep_image* image, int bw, int bh, int nx, int ny,
+                    int jstart, int jstep, int step, sep_bkg *bkgout)
 {
     BYTE *imt, *maskt;
     int npix;                   /* size of image */
-    int nx, ny, nb;             /* number of background boxes in x, y, total */
-    int bufsize;                /* size of a "row" of boxes in pixels (w*bh) */
+    int rowsize;                /* size of a "row" of boxes in pixels (w*bh) */
+    int bufsize;                /* size of the current "row" of boxes in pixels */
     int imgbufsize;             /* size of a "row" of boxes in pixels (raw_w*bh) for the whole image width */
     int elsize;                 /* size (in bytes) of an image array element */
     int melsize;                /* size (in bytes) of a mask array element */
@@ -72,57 +121,26 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
     PIXTYPE maskthresh;
     array_converter convert, mconvert;
     backstruct *backmesh, *bm;  /* info about each background "box" */
-    sep_bkg *bkgout;          /* output */
-    int j, k, m, status;
+    int j, k, m, s, status;
 
-    //status = RETURN_OK; //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
+    status = RETURN_OK;
     npix = image->w * image->h;
-    bufsize = image->w * bh;
+    rowsize = image->w * bh;
     imgbufsize = image->raw_w * bh;
     maskthresh = image->maskthresh;
     if (image->mask == NULL) maskthresh = 0.0;
+    elsize = melsize = 0;
 
-    backmesh = bm = NULL;
-    bkgout = NULL;
+    backmesh = NULL;
     buf = mbuf = buft = mbuft = NULL;
     convert = mconvert = NULL;
 
-    /* determine number of background boxes */
-    if ((nx = (image->w - 1) / bw + 1) < 1)
-        nx = 1;
-    if ((ny = (image->h - 1) / bh + 1) < 1)
-        ny = 1;
-    nb = nx * ny;
-
     /* Allocate temp memory & initialize */
-    backmesh = static_cast<backstruct*>(malloc(sizeof(backstruct) * nx));
+    QMALLOC(backmesh, backstruct, nx, status);
     bm = backmesh;
     for (m = nx; m--; bm++)
         bm->histo = NULL;
 
-    /* Allocate the returned struct */
-    bkgout = static_cast<sep_bkg*>(malloc(sizeof(sep_bkg)));
-    //QMALLOC(bkgout, sep_bkg, 1, status);
-    bkgout->w = image->w;
-    bkgout->h = image->h;
-    bkgout->nx = nx;
-    bkgout->ny = ny;
-    bkgout->n = nb;
-    bkgout->bw = bw;
-    bkgout->bh = bh;
-    bkgout->back = NULL;
-    bkgout->sigma = NULL;
-    bkgout->dback = NULL;
-    bkgout->dsigma = NULL;
-    QMALLOC(bkgout->back, float, nb, status);
-    QMALLOC(bkgout->sigma, float, nb, status);
-    QMALLOC(bkgout->dback, float, nb, status);
-    QMALLOC(bkgout->dsigma, float, nb, status);
-
-    /* cast input array pointers. These are used to step through the arrays. */
-    imt = (BYTE *)image->data;
-    maskt = (BYTE *)image->mask;
-
     /* get the correct array converter and element size, based on dtype code */
     status = get_array_converter(image->dtype, &convert, &elsize);
     if (status != RETURN_OK)
@@ -138,17 +156,13 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
        converted values */
     if (image->dtype != PIXDTYPE)
     {
-        QMALLOC(buf, PIXTYPE, bufsize, status);
+        QMALLOC(buf, PIXTYPE, rowsize, status);
         buft = buf;
-        if (status != RETURN_OK)
-            goto exit;
     }
     if (image->mask && (image->mdtype != PIXDTYPE))
     {
-        QMALLOC(mbuf, PIXTYPE, bufsize, status);
+        QMALLOC(mbuf, PIXTYPE, rowsize, status);
         mbuft = mbuf;
-        if (status != RETURN_OK)
-            goto exit;
     }
 
     /* loop over rows of background boxes.
@@ -158,28 +172,40 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
      * because the pixel buffers are only read in from disk in
      * increments of a row of background boxes at a time.)
      */
-    for (j = 0; j < ny; j++)
+    for (j = jstart; j < ny; j += jstep)
     {
         /* if the last row, modify the width appropriately*/
-        if (j == ny - 1 && npix % bufsize)
-            bufsize = npix % bufsize;
+        bufsize = rowsize;
+        if (j == ny - 1 && npix % rowsize)
+            bufsize = npix % rowsize;
 
-        /* convert this row to PIXTYPE and store in buffer(s)*/
-        if (image->dtype != PIXDTYPE)
-            convert(imt, bufsize, buft);
-        else
-            buft = (PIXTYPE *)imt;
+        /* array pointers to this row of background boxes */
+        imt = (BYTE *)image->data + (size_t)elsize * imgbufsize * j;
+        maskt = image->mask ? (BYTE *)image->mask + (size_t)melsize * imgbufsize * j : NULL;
 
-        if (image->mask)
+        /* Sampled first when asked to, then with every pixel if the
+         * samples were not enough for some box of the row */
+        for (s = step; ; s = 1)
         {
-            if (image->mdtype != PIXDTYPE)
-                mconvert(maskt, bufsize, mbuft);
+            /* convert this row to PIXTYPE and store in buffer(s)*/
+            if (image->dtype != PIXDTYPE)
+                convertlines(convert, imt, elsize, bufsize, image->w, s, buft);
             else
-                mbuft = (PIXTYPE *)maskt;
-        }
+                buft = (PIXTYPE *)imt;
+
+            if (image->mask)
+            {
+                if (image->mdtype != PIXDTYPE)
+                    convertlines(mconvert, maskt, melsize, bufsize, image->w, s, mbuft);
+                else
+                    mbuft = (PIXTYPE *)maskt;
+            }
 
-        /* Get clipped mean, sigma for all boxes in the row */
-        backstat(backmesh, buft, mbuft, bufsize, nx, image->w, bw, maskthresh);
+            /* Get clipped mean, sigma for all boxes in the row */
+            backstat(backmesh, buft, mbuft, bufsize, nx, image->w, bw, maskthresh, s);
+            if (s <= 1 || backsampled_ok(backmesh, nx))
+                break;
+        }
 
         /* Allocate histograms in each box in this row. */
         bm = backmesh;
@@ -188,7 +214,7 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
                 bm->histo = NULL;
             else
                 QCALLOC(bm->histo, LONG, bm->nlevels, status);
-        backhisto(backmesh, buft, mbuft, bufsize, nx, image->w, bw, maskthresh);
+        backhisto(backmesh, buft, mbuft, bufsize, nx, image->w, bw, maskthresh, s);
 
         /* Compute background statistics from the histograms */
         bm = backmesh;
@@ -199,23 +225,96 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
             free(bm->histo);
             bm->histo = NULL;
         }
-
-        /* increment array pointers to next row of background boxes */
-        //        imt += elsize * bufsize;
-        //        if (image->mask)
-        //            maskt += melsize * bufsize;
-        imt += elsize * imgbufsize;
-        if (image->mask)
-            maskt += melsize * imgbufsize;
     }
 
-    /* free memory */
+exit:
     free(buf);
-    buf = NULL;
+    buf = 0;                //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
     free(mbuf);
-    mbuf = NULL;
+    mbuf = 0;               //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
+    if (backmesh)
+    {
+        bm = backmesh;
+        for (m = 0; m < nx; m++, bm++)
+        {
+            free(bm->histo);
+            bm->histo = 0;  //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
+        }
+    }
     free(backmesh);
-    backmesh = NULL;
+    backmesh = 0;           //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
+    return status;
+}
+
+//# Modified for the StellarSolver Internal Library, the rows of background boxes can be done in parallel
+int sep_background_mt(sep_image* image, int bw, int bh, int fw, int fh,
+                      double fthresh, int nthreads, sep_bkg **bkg)
+{
+    return sep_background_sampled(image, bw, bh, fw, fh, fthresh, 1, nthreads, bkg);
+}
+
+//# Modified for the StellarSolver Internal Library, the statistics of the boxes can come from a sample of their pixels
+int sep_background_sampled(sep_image* image, int bw, int bh, int fw, int fh,
+                           double fthresh, int step, int nthreads, sep_bkg **bkg)
+{
+    Tracer::Span span("sep_background");
+    int nx, ny, nb;             /* number of background boxes in x, y, total */
+    sep_bkg *bkgout;          /* output */
+    int t, status;
+
+    status = RETURN_OK;
+    bkgout = NULL;
+
+    /* determine number of background boxes */
+    if ((nx = (image->w - 1) / bw + 1) < 1)
+        nx = 1;
+    if ((ny = (image->h - 1) / bh + 1) < 1)
+        ny = 1;
+    nb = nx * ny;
+
+    /* A full box keeps at least BACK_MINSAMPLES samples */
+    if (step > 1 && step * step * BACK_MINSAMPLES > bw * bh)
+        step = (int)sqrt((double)(bw * bh) / BACK_MINSAMPLES);
+    if (step < 1)
+        step = 1;
+
+    /* Allocate the returned struct */
+    QMALLOC(bkgout, sep_bkg, 1, status);
+    bkgout->w = image->w;
+    bkgout->h = image->h;
+    bkgout->nx = nx;
+    bkgout->ny = ny;
+    bkgout->n = nb;
+    bkgout->bw = bw;
+    bkgout->bh = bh;
+    bkgout->back = NULL;
+    bkgout->sigma = NULL;
+    bkgout->dback = NULL;
+    bkgout->dsigma = NULL;
+    QMALLOC(bkgout->back, float, nb, status);
+    QMALLOC(bkgout->sigma, float, nb, status);
+    QMALLOC(bkgout->dback, float, nb, status);
+    QMALLOC(bkgout->dsigma, float, nb, status);
+
+    /* The rows of boxes are independent, so each thread takes every
+     * nthreads'th row and fills in its part of the background map. */
+    if (nthreads > ny)
+        nthreads = ny;
+    if (nthreads <= 1)
+        status = backrows(image, bw, bh, nx, ny, 0, 1, step, bkgout);
+    else
+    {
+        std::vector<int> statuses(nthreads, RETURN_OK);
+        sep_parallel_for(nthreads, nthreads, [&](int piece)
+        {
+            statuses[piece] = backrows(image, bw, bh, nx, ny, piece, nthreads, step, bkgout);
+        });
+        for (t = 0; t < nthreads; t++)
+            if (statuses[t] != RETURN_OK)
+                status = statuses[t];
+    }
+    if (status != RETURN_OK)
+        goto exit;
 
     /* Median-filter and check suitability of the background map */
     if ((status = filterback(bkgout, fw, fh, fthresh)) != RETURN_OK)
@@ -234,21 +333,6 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
 
     /* If we encountered a problem, clean up any allocated memory */
 exit:
-    free(buf);
-    buf = 0;                //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(mbuf);
-    mbuf = 0;               //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    if (backmesh)
-    {
-        bm = backmesh;
-        for (m = 0; m < nx; m++, bm++)
-        {
-            free(bm->histo);
-            bm->histo = 0;  //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-        }
-    }
-    free(backmesh);
-    backmesh = 0;           //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
     sep_bkg_free(bkgout);
     bkgout = 0;             //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
     *bkg = NULL;
@@ -259,61 +343,70 @@ exit:
 /*
 Compute robust statistical estimators in a row of meshes.
 */
+//# Modified for the StellarSolver Internal Library, the statistics use every step'th pixel
+//# of every step'th line, starting one pixel further on each sampled line so that
+//# the samples don't all fall in the same columns.
 void backstat(backstruct *backmesh,
               PIXTYPE *buf, PIXTYPE *wbuf, int bufsize,
-              int n, int w, int bw, PIXTYPE maskthresh)
+              int n, int w, int bw, PIXTYPE maskthresh, int step)
 {
     backstruct	*bm;
-    double	pix, sig, mean, sigma, step; //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, removed wpix
+    double	pix, sig, mean, sigma, qstep; //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, removed wpix
     PIXTYPE	*buft, *wbuft;
     PIXTYPE       lcut, hcut;
-    int		m, h, x, y, npix, offset, lastbite; //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, removed wnpix
+    int		m, h, x, y, npix, nsample, lastbite; //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, removed wnpix
 
     h = bufsize / w; /* height of background boxes in this row */
     bm = backmesh;
-    offset = w - bw;
-    step = sqrt(2 / PI) * QUANTIF_NSIGMA / QUANTIF_AMIN;
+    qstep = sqrt(2 / PI) * QUANTIF_NSIGMA / QUANTIF_AMIN;
 
     for (m = n; m--; bm++, buf += bw)
     {
         if (!m && (lastbite = w % bw))
-        {
             bw = lastbite;
-            offset = w - bw;
-        }
 
         mean = sigma = 0.0;
-        buft = buf;
-        npix = 0;
+        npix = nsample = 0;
 
         /* We separate the weighted case at this level to avoid penalty in CPU */
         if (wbuf)
         {
-            wbuft = wbuf;
-            for (y = h; y--; buft += offset, wbuft += offset)
-                for (x = bw; x--;)
+            for (y = 0; y < h; y += step)
+            {
+                buft = buf + (size_t)y * w;
+                wbuft = wbuf + (size_t)y * w;
+                for (x = (y / step) % step; x < bw; x += step)
                 {
-                    pix = *(buft++);
-                    if (*(wbuft++) <= maskthresh && pix > -BIG) //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, removed wpix
+                    pix = buft[x];
+                    nsample++;
+                    if (wbuft[x] <= maskthresh && pix > -BIG) //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, removed wpix
                     {
                         mean += pix;
                         sigma += pix * pix;
                         npix++;
                     }
                 }
+            }
         }
         else
-            for (y = h; y--; buft += offset)
-                for (x = bw; x--;)
-                    if ((pix = *(buft++)) > -BIG)
+            for (y = 0; y < h; y += step)
+            {
+                buft = buf + (size_t)y * w;
+                for (x = (y / step) % step; x < bw; x += step)
+                {
+                    nsample++;
+                    if ((pix = buft[x]) > -BIG)
                     {
                         mean += pix;
                         sigma += pix * pix;
                         npix++;
                     }
+                }
+            }
 
         /*-- If not enough valid pixels, discard this mesh */
-        if ((float)npix < (float)(bw * h * BACK_MINGOODFRAC))
+        bm->nsample = nsample;
+        if ((float)npix < (float)(nsample * BACK_MINGOODFRAC))
         {
             bm->mean = bm->sigma = -BIG;
             if (wbuf)
@@ -327,29 +420,33 @@ void backstat(backstruct *backmesh,
         hcut = bm->hcut = (PIXTYPE)(mean + 2.0 * sigma);
         mean = sigma = 0.0;
         npix = 0; //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, removed wnpix
-        buft = buf;
 
         /* do statistics for this mesh again, with cuts */
         if (wbuf)
         {
-            wbuft = wbuf;
-            for (y = h; y--; buft += offset, wbuft += offset)
-                for (x = bw; x--;)
+            for (y = 0; y < h; y += step)
+            {
+                buft = buf + (size_t)y * w;
+                wbuft = wbuf + (size_t)y * w;
+                for (x = (y / step) % step; x < bw; x += step)
                 {
-                    pix = *(buft++);
-                    if (*(wbuft++) <= maskthresh && pix <= hcut && pix >= lcut) //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, removed wpix
+                    pix = buft[x];
+                    if (wbuft[x] <= maskthresh && pix <= hcut && pix >= lcut) //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, removed wpix
                     {
                         mean += pix;
                         sigma += pix * pix;
                         npix++;
                     }
                 }
+            }
         }
         else
-            for (y = h; y--; buft += offset)
-                for (x = bw; x--;)
+            for (y = 0; y < h; y += step)
+            {
+                buft = buf + (size_t)y * w;
+                for (x = (y / step) % step; x < bw; x += step)
                 {
-                    pix = *(buft++);
+                    pix = buft[x];
                     if (pix <= hcut && pix >= lcut)
                     {
                         mean += pix;
@@ -357,6 +454,7 @@ void backstat(backstruct *backmesh,
                         npix++;
                     }
                 }
+            }
 
         bm->npix = npix;
         mean /= (double)npix;
@@ -364,7 +462,7 @@ void backstat(backstruct *backmesh,
         sigma = sig > 0.0 ? sqrt(sig) : 0.0;
         bm->mean = mean;
         bm->sigma = sigma;
-        if ((bm->nlevels = (int)(step * npix + 1)) > QUANTIF_NMAXLEVELS)
+        if ((bm->nlevels = (int)(qstep * npix + 1)) > QUANTIF_NMAXLEVELS)
             bm->nlevels = QUANTIF_NMAXLEVELS;
         bm->qscale = sigma > 0.0 ? 2 * QUANTIF_NSIGMA * sigma / bm->nlevels : 1.0;
         bm->qzero = mean - QUANTIF_NSIGMA * sigma;
@@ -377,30 +475,102 @@ void backstat(backstruct *backmesh,
 
 }
 
+/* Add n pixels of one line to a histogram.  The vector versions compute the
+ * bins 8 (AVX2) or 4 (NEON) at a time with the same divide and add as the
+ * scalar loop, the histogram itself still has to be updated one bin at a time. */
+static void histoline_scalar(LONG *histo, const PIXTYPE *buf, int n,
+                             float qscale, float cste, int nlevels)
+{
+    int bin;
+    for (int x = 0; x < n; x++)
+    {
+        bin = (int)(buf[x] / qscale + cste);
+        if (bin >= 0 && bin < nlevels)
+            histo[bin]++;
+    }
+}
+
+#ifdef SEP_SIMD_X86
+SEP_TARGET_AVX2 static void histoline_avx2(LONG *histo, const PIXTYPE *buf, int n,
+        float qscale, float cste, int nlevels)
+{
+    const __m256 vq = _mm256_set1_ps(qscale);
+    const __m256 vc = _mm256_set1_ps(cste);
+    int bins[8];
+    int x = 0;
+    for (; x + 8 <= n; x += 8)
+    {
+        __m256 v = _mm256_add_ps(_mm256_div_ps(_mm256_loadu_ps(buf + x), vq), vc);
+        _mm256_storeu_si256((__m256i *)bins, _mm256_cvttps_epi32(v));
+        for (int k = 0; k < 8; k++)
+            if (bins[k] >= 0 && bins[k] < nlevels)
+                histo[bins[k]]++;
+    }
+    histoline_scalar(histo, buf + x, n - x, qscale, cste, nlevels);
+}
+#endif
+
+#ifdef SEP_SIMD_ARM
+static void histoline_neon(LONG *histo, const PIXTYPE *buf, int n,
+                           float qscale, float cste, int nlevels)
+{
+    const float32x4_t vq = vdupq_n_f32(qscale);
+    const float32x4_t vc = vdupq_n_f32(cste);
+    int bins[4];
+    int x = 0;
+    for (; x + 4 <= n; x += 4)
+    {
+        float32x4_t v = vaddq_f32(vdivq_f32(vld1q_f32(buf + x), vq), vc);
+        vst1q_s32(bins, vcvtq_s32_f32(v));
+        for (int k = 0; k < 4; k++)
+            if (bins[k] >= 0 && bins[k] < nlevels)
+                histo[bins[k]]++;
+    }
+    histoline_scalar(histo, buf + x, n - x, qscale, cste, nlevels);
+}
+#endif
+
+static void histoline(LONG *histo, const PIXTYPE *buf, int n,
+                      float qscale, float cste, int nlevels)
+{
+    switch (sep_simd())
+    {
+#ifdef SEP_SIMD_X86
+        case SEP_SIMD_AVX2:
+            histoline_avx2(histo, buf, n, qscale, cste, nlevels);
+            return;
+#endif
+#ifdef SEP_SIMD_ARM
+        case SEP_SIMD_NEON:
+            histoline_neon(histo, buf, n, qscale, cste, nlevels);
+            return;
+#endif
+        default:
+            histoline_scalar(histo, buf, n, qscale, cste, nlevels);
+    }
+}
+
 /******************************** backhisto *********************************/
 /*
 Fill histograms in a row of meshes.
 */
+//# Modified for the StellarSolver Internal Library, the histograms take the same samples as backstat
 void backhisto(backstruct *backmesh,
                PIXTYPE *buf, PIXTYPE *wbuf, int bufsize,
-               int n, int w, int bw, PIXTYPE maskthresh)
+               int n, int w, int bw, PIXTYPE maskthresh, int step)
 {
     backstruct	*bm;
     PIXTYPE	*buft, *wbuft;
     float	        qscale, cste; //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, removed wpix
     LONG		*histo;
-    int		h, m, x, y, nlevels, lastbite, offset, bin;
+    int		h, m, x, y, nlevels, lastbite, bin;
 
     h = bufsize / w;
     bm = backmesh;
-    offset = w - bw;
     for (m = 0; m++ < n; bm++, buf += bw)
     {
         if (m == n && (lastbite = w % bw))
-        {
             bw = lastbite;
-            offset = w - bw;
-        }
 
         /*-- Skip bad meshes */
         if (bm->mean <= -BIG)
@@ -417,29 +587,36 @@ void backhisto(backstruct *backmesh,
         histo = bm->histo;
         qscale = bm->qscale;
         cste = 0.499999 - bm->qzero / qscale;
-        buft = buf;
 
         if (wbuf)
         {
-            wbuft = wbuf;
-            for (y = h; y--; buft += offset, wbuft += offset)
-                for (x = bw; x--;)
+            for (y = 0; y < h; y += step)
+            {
+                buft = buf + (size_t)y * w;
+                wbuft = wbuf + (size_t)y * w;
+                for (x = (y / step) % step; x < bw; x += step)
                 {
-                    bin = (int)(*(buft++) / qscale + cste);
-                    if (*(wbuft++) <= maskthresh && bin < nlevels && bin >= 0) //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, removed wpix
+                    bin = (int)(buft[x] / qscale + cste);
+                    if (wbuft[x] <= maskthresh && bin < nlevels && bin >= 0) //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, removed wpix
                         (*(histo + bin))++;
                 }
+            }
             wbuf += bw;
         }
+        else if (step <= 1)
+            for (y = 0, buft = buf; y < h; y++, buft += w)
+                histoline(histo, buft, bw, qscale, cste, nlevels);
         else
-            for (y = h; y--; buft += offset)
-                for (x = bw; x--;)
+            for (y = 0; y < h; y += step)
+            {
+                buft = buf + (size_t)y * w;
+                for (x = (y / step) % step; x < bw; x += step)
                 {
-                    bin = (int)(*(buft++) / qscale + cste);
-
+                    bin = (int)(buft[x] / qscale + cste);
                     if (bin >= 0 && bin < nlevels)
-                        (*(histo + bin))++;
+                        histo[bin]++;
                 }
+            }
     }
     return;
 }
@@ -1095,6 +1272,12 @@ exit:
 }
 
 int sep_bkg_subarray(sep_bkg *bkg, void *arr, int dtype)
+{
+    return sep_bkg_subarray_mt(bkg, arr, dtype, 1);
+}
+
+/* Subtract the background from lines y0 to y1 - 1 of arr. */
+static int bkg_sublines(sep_bkg *bkg, void *arr, int dtype, int y0, int y1)
 {
     array_writer subtract_array;
     int y, status, size, width;
@@ -1102,9 +1285,7 @@ int sep_bkg_subarray(sep_bkg *bkg, void *arr, int dtype)
     BYTE *arrt;
 
     tmpline = NULL;
-    //status = RETURN_OK; //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
     width = bkg->w;
-    arrt = (BYTE *)arr;
 
     QMALLOC(tmpline, PIXTYPE, width, status);
 
@@ -1112,7 +1293,8 @@ int sep_bkg_subarray(sep_bkg *bkg, void *arr, int dtype)
     if (status != RETURN_OK)
         goto exit;
 
-    for (y = 0; y < bkg->h; y++, arrt += (width * size))
+    arrt = (BYTE *)arr + (size_t)y0 * width * size;
+    for (y = y0; y < y1; y++, arrt += (width * size))
     {
         if ((status = sep_bkg_line_flt(bkg, y, tmpline)) != RETURN_OK)
             goto exit;
@@ -1124,6 +1306,31 @@ exit:
     return status;
 }
 
+//# Modified for the StellarSolver Internal Library, the lines can be done in parallel
+int sep_bkg_subarray_mt(sep_bkg *bkg, void *arr, int dtype, int nthreads)
+{
+    int t, status;
+
+    if (nthreads > bkg->h)
+        nthreads = bkg->h;
+    if (nthreads <= 1)
+        return bkg_sublines(bkg, arr, dtype, 0, bkg->h);
+
+    /* each piece is a block of lines */
+    std::vector<int> statuses(nthreads, RETURN_OK);
+    sep_parallel_for(nthreads, nthreads, [&](int piece)
+    {
+        statuses[piece] = bkg_sublines(bkg, arr, dtype, (int)((long long)bkg->h * piece / nthreads),
+                                       (int)((long long)bkg->h * (piece + 1) / nthreads));
+    });
+
+    status = RETURN_OK;
+    for (t = 0; t < nthreads; t++)
+        if (statuses[t] != RETURN_OK)
+            status = statuses[t];
+    return status;
+}
+
 /*****************************************************************************/
 
 void sep_bkg_free(sep_bkg *bkg)
@@ -22,49 +22,246 @@ f* GNU Lesser General Public License for more details.
 
 #include "sep.h"
 #include "sepcore.h"
+#include "simd.h"
 
 #include <cmath>
 
 namespace SEP
 {
 
+/*------------------------ vectorized line kernels --------------------------*/
+
+/* These are the inner loops of convolve() and matched_filter().  The vector
+ * versions do the same multiplies, adds and divides in the same order as the
+ * scalar ones, so they give the same results, they just do 8 (AVX2) or 4 (NEON)
+ * pixels at a time.  The scalar versions are the reference implementation and
+ * are used for the ends of the lines and when the CPU has no vector unit.
+ */
+
+/* dst[k] += c * src[k] */
+static void line_axpy_scalar(PIXTYPE *dst, const PIXTYPE *src, float c, int n)
+{
+    for (int k = 0; k < n; k++)
+        dst[k] += c * src[k];
+}
+
+/* num[k] += c * im[k] / var[k],  denom[k] += c * c / var[k],  skipping var == 0 */
+static void line_matched_scalar(PIXTYPE *num, PIXTYPE *denom, const PIXTYPE *im, const PIXTYPE *noise,
+                                float c, int n, int noise_type)
+{
+    PIXTYPE varval;
+    for (int k = 0; k < n; k++)
+    {
+        varval = (noise_type == SEP_NOISE_VAR) ? noise[k] : noise[k] * noise[k];
+        if (varval != 0.0)
+        {
+            num[k]   += c * im[k] / varval;
+            denom[k] += c * c / varval;
+        }
+    }
+}
+
+#ifdef SEP_SIMD_X86
+SEP_TARGET_AVX2 static void line_axpy_avx2(PIXTYPE *dst, const PIXTYPE *src, float c, int n)
+{
+    const __m256 vc = _mm256_set1_ps(c);
+    int k = 0;
+    for (; k + 8 <= n; k += 8)
+    {
+        __m256 prod = _mm256_mul_ps(vc, _mm256_loadu_ps(src + k));
+        _mm256_storeu_ps(dst + k, _mm256_add_ps(_mm256_loadu_ps(dst + k), prod));
+    }
+    line_axpy_scalar(dst + k, src + k, c, n - k);
+}
+
+SEP_TARGET_AVX2 static void line_matched_avx2(PIXTYPE *num, PIXTYPE *denom, const PIXTYPE *im, const PIXTYPE *noise,
+        float c, int n, int noise_type)
+{
+    const __m256 vc = _mm256_set1_ps(c);
+    const __m256 vc2 = _mm256_set1_ps(c * c);
+    const __m256 zero = _mm256_setzero_ps();
+    int k = 0;
+    for (; k + 8 <= n; k += 8)
+    {
+        __m256 var = _mm256_loadu_ps(noise + k);
+        if (noise_type != SEP_NOISE_VAR)
+            var = _mm256_mul_ps(var, var);
+        /* the lanes where the variance is zero are left alone, like the scalar loop */
+        __m256 valid = _mm256_cmp_ps(var, zero, _CMP_NEQ_UQ);
+        __m256 dnum = _mm256_div_ps(_mm256_mul_ps(vc, _mm256_loadu_ps(im + k)), var);
+        __m256 ddenom = _mm256_div_ps(vc2, var);
+        _mm256_storeu_ps(num + k, _mm256_add_ps(_mm256_loadu_ps(num + k), _mm256_and_ps(valid, dnum)));
+        _mm256_storeu_ps(denom + k, _mm256_add_ps(_mm256_loadu_ps(denom + k), _mm256_and_ps(valid, ddenom)));
+    }
+    line_matched_scalar(num + k, denom + k, im + k, noise + k, c, n - k, noise_type);
+}
+#endif
+
+#ifdef SEP_SIMD_ARM
+static void line_axpy_neon(PIXTYPE *dst, const PIXTYPE *src, float c, int n)
+{
+    const float32x4_t vc = vdupq_n_f32(c);
+    int k = 0;
+    for (; k + 4 <= n; k += 4)
+    {
+        float32x4_t prod = vmulq_f32(vc, vld1q_f32(src + k));
+        vst1q_f32(dst + k, vaddq_f32(vld1q_f32(dst + k), prod));
+    }
+    line_axpy_scalar(dst + k, src + k, c, n - k);
+}
+
+static void line_matched_neon(PIXTYPE *num, PIXTYPE *denom, const PIXTYPE *im, const PIXTYPE *noise,
+                              float c, int n, int noise_type)
+{
+    const float32x4_t vc = vdupq_n_f32(c);
+    const float32x4_t vc2 = vdupq_n_f32(c * c);
+    int k = 0;
+    for (; k + 4 <= n; k += 4)
+    {
+        float32x4_t var = vld1q_f32(noise + k);
+        if (noise_type != SEP_NOISE_VAR)
+            var = vmulq_f32(var, var);
+        /* the lanes where the variance is zero are left alone, like the scalar loop */
+        uint32x4_t valid = vmvnq_u32(vceqq_f32(var, vdupq_n_f32(0.0f)));
+        float32x4_t dnum = vdivq_f32(vmulq_f32(vc, vld1q_f32(im + k)), var);
+        float32x4_t ddenom = vdivq_f32(vc2, var);
+        dnum = vreinterpretq_f32_u32(vandq_u32(valid, vreinterpretq_u32_f32(dnum)));
+        ddenom = vreinterpretq_f32_u32(vandq_u32(valid, vreinterpretq_u32_f32(ddenom)));
+        vst1q_f32(num + k, vaddq_f32(vld1q_f32(num + k), dnum));
+        vst1q_f32(denom + k, vaddq_f32(vld1q_f32(denom + k), ddenom));
+    }
+    line_matched_scalar(num + k, denom + k, im + k, noise + k, c, n - k, noise_type);
+}
+#endif
+
+static void line_axpy(PIXTYPE *dst, const PIXTYPE *src, float c, int n)
+{
+    switch (sep_simd())
+    {
+#ifdef SEP_SIMD_X86
+        case SEP_SIMD_AVX2:
+            line_axpy_avx2(dst, src, c, n);
+            return;
+#endif
+#ifdef SEP_SIMD_ARM
+        case SEP_SIMD_NEON:
+            line_axpy_neon(dst, src, c, n);
+            return;
+#endif
+        default:
+            line_axpy_scalar(dst, src, c, n);
+    }
+}
+
+static void line_matched(PIXTYPE *num, PIXTYPE *denom, const PIXTYPE *im, const PIXTYPE *noise,
+                         float c, int n, int noise_type)
+{
+    switch (sep_simd())
+    {
+#ifdef SEP_SIMD_X86
+        case SEP_SIMD_AVX2:
+            line_matched_avx2(num, denom, im, noise, c, n, noise_type);
+            return;
+#endif
+#ifdef SEP_SIMD_ARM
+        case SEP_SIMD_NEON:
+            line_matched_neon(num, denom, im, noise, c, n, noise_type);
+            return;
+#endif
+        default:
+            line_matched_scalar(num, denom, im, noise, c, n, noise_type);
+    }
+}
+
+/* Split a kernel into a column and a row vector, conv[cy*convw+cx] = col[cy] * row[cx],
+ * if it is separable like the Gaussian kernels from generateConvFilter().
+ * Returns 1 if it is separable, 0 if not or if it is too big for col and row.
+ * This is done once for the kernel of an extraction, see convolve().
+ */
+int separate_kernel(const float *conv, int convw, int convh, float *col, float *row)
+{
+    int i, cx, cy, pivot;
+    float pmax, pval, tol;
+
+    if (convw > CONV_SEPARABLE_MAX || convh > CONV_SEPARABLE_MAX || convw < 2 || convh < 2)
+        return 0;
+
+    /* use the biggest element as the pivot so the division is well behaved */
+    pivot = 0;
+    pmax = 0.0f;
+    for (i = 0; i < convw * convh; i++)
+        if (fabsf(conv[i]) > pmax)
+        {
+            pmax = fabsf(conv[i]);
+            pivot = i;
+        }
+    if (pmax == 0.0f)
+        return 0;
+
+    pval = conv[pivot];
+    for (cy = 0; cy < convh; cy++)
+        col[cy] = conv[cy * convw + pivot % convw];
+    for (cx = 0; cx < convw; cx++)
+        row[cx] = conv[(pivot / convw) * convw + cx] / pval;
+
+    tol = 1e-5f * pmax;
+    for (cy = 0; cy < convh; cy++)
+        for (cx = 0; cx < convw; cx++)
+            if (fabsf(col[cy] * row[cx] - conv[cy * convw + cx]) > tol)
+                return 0;
+    return 1;
+}
+
 /* Convolve one line of an image with a given kernel.
  *
  * buf : arraybuffer struct containing buffer of data to convolve, and image
          dimension metadata.
  * conv : convolution kernel
  * convw, convh : width and height of conv
+ * col, row : the column and row vectors of conv from separate_kernel(), or
+ *            NULL if it is not separable
+ * work : work buffer (buf->bw elements long), used when the kernel is separable
  * buf : output convolved line (buf->dw elements long)
+ *
+ * When the kernel is separable, the lines are first combined with the column
+ * vector and then the result is convolved with the row vector, which takes
+ * convw + convh passes over the line instead of convw * convh.
  */
-int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh, PIXTYPE *out)
+//# Modified for the StellarSolver Internal Library, the lines can be in the buffer or in the image itself, see convolve_rows()
+/* Convolve n pixels of the lines first, first + stride, ... first + (convh - 1) * stride,
+ * which are the lines under the kernel after it was cut off at the image bounds. */
+static void convolve_lines(const PIXTYPE *first, size_t stride, int n, const float *conv, int convw, int convh,
+                           const float *col, const float *row, PIXTYPE *work, PIXTYPE *out)
 {
-    int convw2, convn, cx, cy, i, dcx, y0;
-    PIXTYPE *line;    /* current line in input buffer */
+    int convw2, convn, cx, cy, i, dcx;
+    const PIXTYPE *line;  /* current line in input buffer */
     PIXTYPE *outend;  /* end of output buffer */
-    PIXTYPE *src, *dst, *dstend;
+    const PIXTYPE *src;
+    PIXTYPE *dst, *dstend;
 
-    //outend = out + buf->dw;
-    outend = out + (buf->bw - 1);
+    outend = out + n;
     convw2 = convw / 2;
-    y0 = y - convh / 2; /* start line in image */
 
-    /* Cut off top of kernel if it extends beyond image */
-    if (y0 + convh > buf->dh)
-        convh = buf->dh - y0;
+    memset(out, 0, n * sizeof(PIXTYPE)); /* initialize output to zero */
 
-    /* cut off bottom of kernel if it extends beyond image */
-    if (y0 < 0)
+    if (work && col && row)
     {
-        convh = convh + y0;
-        conv += convw * (-y0);
-        y0 = 0;
-    }
+        /* combine the lines with the column vector */
+        memset(work, 0, n * sizeof(PIXTYPE));
+        for (cy = 0; cy < convh; cy++)
+            line_axpy(work, first + stride * cy, col[cy], n);
 
-    /* check that buffer has needed lines */
-    if ((y0 < buf->yoff) || (y0 + convh > buf->yoff + buf->bh))
-        return LINE_NOT_IN_BUF;
-
-    memset(out, 0, (buf->bw - 1) * sizeof(PIXTYPE)); /* initialize output to zero */
+        /* and then convolve that with the row vector */
+        for (cx = 0; cx < convw; cx++)
+        {
+            dcx = cx - convw2;
+            if (dcx >= 0)
+                line_axpy(out, work + dcx, row[cx], n - dcx);
+            else
+                line_axpy(out - dcx, work, row[cx], n + dcx);
+        }
+        return;
+    }
 
     /* loop over pixels in the convolution kernel */
     convn = convw * convh;
@@ -72,7 +269,7 @@ int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh, PIXTYPE
     {
         cx = i % convw;  /* x index in conv kernel */
         cy = i / convw;  /* y index in conv kernel */
-        line = buf->bptr + buf->bw * (y0 - buf->yoff + cy); /* start of line */
+        line = first + stride * cy; /* start of line */
 
         /* get start and end positions in the source and target line */
         dcx = cx - convw2; /* offset of conv pixel from conv center;
@@ -91,13 +288,61 @@ int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh, PIXTYPE
         }
 
         /* multiply and add the values */
-        while (dst < dstend)
-            *(dst++) += conv[i] * *(src++);
+        if (dst < dstend)
+            line_axpy(dst, src, conv[i], (int)(dstend - dst));
     }
+}
+
+int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh, const float *col, const float *row,
+             PIXTYPE *work, PIXTYPE *out)
+{
+    int y0 = y - convh / 2; /* start line in image */
 
+    /* Cut off top of kernel if it extends beyond image */
+    if (y0 + convh > buf->dh)
+        convh = buf->dh - y0;
+
+    /* cut off bottom of kernel if it extends beyond image */
+    if (y0 < 0)
+    {
+        convh = convh + y0;
+        conv += convw * (-y0);
+        if (col)
+            col += -y0;
+        y0 = 0;
+    }
+
+    /* check that buffer has needed lines */
+    if ((y0 < buf->yoff) || (y0 + convh > buf->yoff + buf->bh))
+        return LINE_NOT_IN_BUF;
+
+    convolve_lines(buf->bptr + buf->bw * (y0 - buf->yoff), buf->bw, buf->bw - 1, conv, convw, convh, col, row, work, out);
     return RETURN_OK;
 }
 
+//# Modified for the StellarSolver Internal Library
+/* The same as convolve(), but for a float image that is read in place instead
+ * of through an arraybuffer.  data is the first line of the image, stride is
+ * the number of pixels from one line to the next, and w pixels of line y are
+ * convolved into out. */
+void convolve_rows(const PIXTYPE *data, size_t stride, int w, int h, int y, const float *conv, int convw, int convh,
+                   const float *col, const float *row, PIXTYPE *work, PIXTYPE *out)
+{
+    int y0 = y - convh / 2;
+
+    if (y0 + convh > h)
+        convh = h - y0;
+    if (y0 < 0)
+    {
+        convh = convh + y0;
+        conv += convw * (-y0);
+        if (col)
+            col += -y0;
+        y0 = 0;
+    }
+    convolve_lines(data + stride * y0, stride, w, conv, convw, convh, col, row, work, out);
+}
+
 
 /* Apply a matched filter to one line of an image with a given kernel.
  *
@@ -125,7 +370,6 @@ int matched_filter(arraybuffer *imbuf, arraybuffer *nbuf, int y,
                    PIXTYPE *work, PIXTYPE *out, int noise_type)
 {
     int convw2, convn, cx, cy, i, dcx, y0;
-    PIXTYPE imval, varval;
     PIXTYPE *imline, *nline;    /* current line in input buffer */
     PIXTYPE *outend;            /* end of output buffer */
     PIXTYPE *src_im, *src_n, *dst_num, *dst_denom, *dst_num_end;
@@ -189,20 +433,8 @@ int matched_filter(arraybuffer *imbuf, arraybuffer *nbuf, int y,
         }
 
         /* actually calculate values */
-        while (dst_num < dst_num_end)
-        {
-            imval = *src_im;
-            varval = (noise_type == SEP_NOISE_VAR) ? (*src_n) : (*src_n) * (*src_n);
-            if (varval != 0.0)
-            {
-                *dst_num   += conv[i] * imval / varval;
-                *dst_denom += conv[i] * conv[i] / varval;
-            }
-            src_im++;
-            src_n++;
-            dst_num++;
-            dst_denom++;
-        }
+        if (dst_num < dst_num_end)
+            line_matched(dst_num, dst_denom, src_im, src_n, conv[i], (int)(dst_num_end - dst_num), noise_type);
     }  /* close loop over convolution kernel */
 
     /* take the square root of the denominator (work) buffer and divide the
@@ -25,6 +25,7 @@
 #include "sepcore.h"
 #include "lutz.h"
 #include "analyse.h"
+#include "extract.h"
 
 #include <cmath>
 
@@ -107,6 +108,13 @@ int Deblend::deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
     ok[0] = (short)1;
     for (k = 1; k < xn; k++)
     {
+        //# Modified for the StellarSolver Internal Library, past the deadline of the extraction the object is kept whole
+        if (sep_limits_expired(limits))
+        {
+            status = addobjdeep(0, &debobjlist2, objlistout, plistsize);
+            goto exit;
+        }
+
         /*------ Calculate threshold */
         thresh = objlistin->obj[l].fdpeak;
         debobjlist.thresh = thresh > 0.0 ?
@@ -140,7 +148,7 @@ int Deblend::deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
                     }
                     if (h >= nbm - 1)
                         if (!(son = (short *)
-                                    realloc(son, xn * NSONMAX * (nbm += 16) * sizeof(short))))
+                                    sep_arena_realloc(son, xn * NSONMAX * (nbm += 16) * sizeof(short))))
                         {
                             status = MEMORY_ALLOC_ERROR;
                             goto exit;
@@ -192,24 +200,24 @@ exit:
     //                      "deblending. Decrease number of deblending thresholds "
     //                      "or increase the detection threshold.");
 
-    free(submap);
+    sep_arena_free(submap);
     submap = nullptr;
-    free(debobjlist2.obj);
+    sep_arena_free(debobjlist2.obj);
     debobjlist2.obj = 0;       //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(debobjlist2.plist);
+    sep_arena_free(debobjlist2.plist);
     debobjlist2.plist = 0;     //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
 
     for (k = 0; k < xn; k++)
     {
-        free(objlist[k].obj);
+        sep_arena_free(objlist[k].obj);
         objlist[k].obj = 0;    //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-        free(objlist[k].plist);
+        sep_arena_free(objlist[k].plist);
         objlist[k].plist = 0;  //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
     }
 
-    free(debobjlist.obj);
+    sep_arena_free(debobjlist.obj);
     debobjlist.obj = 0;        //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(debobjlist.plist);
+    sep_arena_free(debobjlist.plist);
     debobjlist.plist = 0;      //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
 
     return status;
@@ -223,9 +231,9 @@ Allocate the memory allocated by global pointers in refine.c
 int Deblend::allocdeblend(int deblend_nthresh)
 {
     int status = RETURN_OK;
-    QMALLOC(son, short,  deblend_nthresh * NSONMAX * NBRANCH, status);
-    QMALLOC(ok, short,  deblend_nthresh * NSONMAX, status);
-    QMALLOC(objlist, objliststruct, deblend_nthresh, status);
+    AMALLOC(son, short,  deblend_nthresh * NSONMAX * NBRANCH, status);
+    AMALLOC(ok, short,  deblend_nthresh * NSONMAX, status);
+    AMALLOC(objlist, objliststruct, deblend_nthresh, status);
 
     return status;
 exit:
@@ -239,11 +247,11 @@ Free the memory allocated by global pointers in refine.c
 */
 void Deblend::freedeblend(void)
 {
-    free(son);
+    sep_arena_free(son);
     son = NULL;
-    free(ok);
+    sep_arena_free(ok);
     ok = NULL;
-    free(objlist);
+    sep_arena_free(objlist);
     objlist = NULL;
     return;
 }
@@ -271,9 +279,9 @@ int Deblend::gatherup(objliststruct *objlistin, objliststruct *objlistout)
 
     objlistout->thresh = objlistin->thresh;
 
-    amp = static_cast<float *>(malloc(nobj * sizeof(float)));
-    p = static_cast<float *>(malloc(nobj * sizeof(float)));
-    n = static_cast<int *>(malloc(nobj * sizeof(int)));
+    amp = static_cast<float *>(sep_arena_malloc(nobj * sizeof(float)));
+    p = static_cast<float *>(sep_arena_malloc(nobj * sizeof(float)));
+    n = static_cast<int *>(sep_arena_malloc(nobj * sizeof(int)));
 
     Analyze a(plist_values);
     for (i = 1; i < nobj; i++)
@@ -282,7 +290,7 @@ int Deblend::gatherup(objliststruct *objlistin, objliststruct *objlistout)
     p[0] = 0.0;
     bmwidth = objin->xmax - (xs = objin->xmin) + 1;
     npix = bmwidth * (objin->ymax - (ys = objin->ymin) + 1);
-    if (!(bmp = (char *)calloc(1, npix * sizeof(char))))
+    if (!(bmp = (char *)sep_arena_calloc(1, npix * sizeof(char))))
     {
         bmp = NULL;
         status = MEMORY_ALLOC_ERROR;
@@ -314,7 +322,7 @@ int Deblend::gatherup(objliststruct *objlistin, objliststruct *objlistout)
 
     objout = objlistout->obj;		/* DO NOT MOVE !!! */
 
-    if (!(pixelout = (pliststruct *)realloc(objlistout->plist,
+    if (!(pixelout = (pliststruct *)sep_arena_realloc(objlistout->plist,
                                             (objlistout->npix + npix) * plistsize)))
     {
         status = MEMORY_ALLOC_ERROR;
@@ -349,7 +357,8 @@ int Deblend::gatherup(objliststruct *objlistin, objliststruct *objlistout)
             }
             if (p[nobj - 1] > 1.0e-31)
             {
-                drand = p[nobj - 1] * rand() / RAND_MAX;
+                //# Modified for the StellarSolver Internal Library, a seeded deblend does not share rand() with the other threads
+                drand = p[nobj - 1] * (seeded ? (int)(m_Random() % ((unsigned int)RAND_MAX + 1)) : rand()) / RAND_MAX;
                 for (i = 1; i < nobj && p[i] < drand; i++);
                 if (i == nobj)
                     i = iclst;
@@ -361,15 +370,15 @@ int Deblend::gatherup(objliststruct *objlistin, objliststruct *objlistout)
     }
 
     objlistout->npix = k;
-    if (!(objlistout->plist = (pliststruct *)realloc(pixelout,
+    if (!(objlistout->plist = (pliststruct *)sep_arena_realloc(pixelout,
                               objlistout->npix * plistsize)))
         status = MEMORY_ALLOC_ERROR;
 
 exit:
-    free(bmp);
-    free(amp);
-    free(p);
-    free(n);
+    sep_arena_free(bmp);
+    sep_arena_free(amp);
+    sep_arena_free(p);
+    sep_arena_free(n);
 
     return status;
 }
@@ -417,7 +426,7 @@ int *Deblend::createsubmap(objliststruct *objlistin, int no,
     *subh = obj->ymax - ymin + 1;
 
     n = w**subh;
-    if (!(submap = pix = (int *)malloc(n * sizeof(int))))
+    if (!(submap = pix = (int *)sep_arena_malloc(n * sizeof(int))))
         return nullptr;
     pt = pix;
     for (i = n; i--;)
@@ -25,12 +25,14 @@
 #include "sep.h"
 #include "sepcore.h"
 
+#include <random>
 
 namespace SEP
 {
 
 class Lutz;
 class Analyze;
+struct sep_deblend_limits;
 
 class Deblend
 {
@@ -41,6 +43,22 @@ class Deblend
         int deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
                     int deblend_nthresh, double deblend_mincont, int minarea, SEP::Lutz *lutz);
 
+        /* Makes the next deblend() share out the pixels between the objects
+         * with its own random numbers from seed instead of rand(), so that it
+         * gives the same result on any thread and in any order. */
+        void set_seed(unsigned int seed)
+        {
+            m_Random.seed(seed);
+            seeded = true;
+        }
+
+        /* Makes the next deblend() give up on splitting its object once the
+         * deadline of limits passed, see sep_deblend_limits.  NULL is no deadline. */
+        void set_limits(sep_deblend_limits *deblendLimits)
+        {
+            limits = deblendLimits;
+        }
+
     protected:
 
         int belong(int, objliststruct *, int, objliststruct *);
@@ -59,6 +77,9 @@ class Deblend
         objliststruct	debobjlist, debobjlist2;
         plistvalues plist_values;
         int plistsize;
+        std::minstd_rand m_Random;
+        bool seeded = false;
+        sep_deblend_limits *limits = nullptr;
 };
 
 }
@@ -24,13 +24,278 @@
 #include "lutz.h"
 #include "deblend.h"
 #include "analyse.h"
+#include "tracer.h"
 #include <cstdio>
 
 #include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace SEP
 {
 
+/* The objects that sortit() hands over to be deblended, in the order they
+ * were completed.  input is a copy of the pixels of the object, since the
+ * pixel list of the scan is reused, and output gets the analysed objects. */
+struct DeblendTask
+{
+    objliststruct input;
+    objliststruct output;
+    unsigned int seed;
+    int status;
+};
+
+/* What the deblend threads of one sep_extract() share with it.  The threads
+ * keep it alive too, since a thread that only starts after the extraction is
+ * over finds that there is nothing left to do and must not touch the queue. */
+struct DeblendShared
+{
+    DeblendShared(int w, int h, int deblend_nthresh, double deblend_mincont, int minarea, double gain,
+                  const plistvalues &values, sep_deblend_limits *limits)
+        : w(w), h(h), deblend_nthresh(deblend_nthresh), deblend_mincont(deblend_mincont), minarea(minarea), gain(gain),
+          values(values), limits(limits)
+    {
+    }
+
+    const int w, h, deblend_nthresh;
+    const double deblend_mincont;
+    const int minarea;
+    const double gain;
+    const plistvalues values;
+    sep_deblend_limits *limits;
+
+    std::mutex mutex;
+    std::condition_variable idle;       /* woken when a thread is done with a task */
+    std::deque<DeblendTask *> pending;
+    int running = 0;                    /* the threads that were started and didn't run out of tasks */
+    int busy = 0;                       /* the tasks being deblended on the threads */
+};
+
+/* The Deblend, Lutz and Analyze of one thread, since they keep state */
+struct DeblendWorker
+{
+    explicit DeblendWorker(const DeblendShared &shared)
+        : analyze(shared.values), lutz(shared.w, shared.h, &analyze, shared.values), deblend(shared.deblend_nthresh, shared.values)
+    {
+    }
+
+    Analyze analyze;
+    Lutz lutz;
+    Deblend deblend;
+};
+
+/* The threads that deblend and analyse the objects of one sep_extract() while
+ * it scans the rest of the image.  They are started with the task runner of
+ * sep_set_deblend_threads() when there are tasks for them, and stop when
+ * there are none left, so they only take a thread while they have work.  When
+ * the runner has no thread free and none is running, the object is deblended
+ * on the scanning thread right away.  The threads have no arena scope, so
+ * everything they allocate comes from the heap and can be freed on the
+ * scanning thread. */
+class DeblendQueue
+{
+    public:
+        DeblendQueue(int nthreads, const sep_task_runner &runner, int w, int h, int deblend_nthresh, double deblend_mincont,
+                     int minarea, double gain, const plistvalues &values, sep_deblend_limits *limits)
+            : nthreads(nthreads), runner(runner),
+              shared(std::make_shared<DeblendShared>(w, h, deblend_nthresh, deblend_mincont, minarea, gain, values, limits))
+        {
+        }
+
+        ~DeblendQueue()
+        {
+            finish();
+            for (auto &task : tasks)
+            {
+                free(task->input.obj);
+                free(task->input.plist);
+                free(task->output.obj);
+                free(task->output.plist);
+            }
+        }
+
+        /* Copies object 0 of objlist into a new task, which is deblended on
+         * the threads if deblend is true, and just analysed here if not. */
+        int add(objliststruct *objlist, bool deblend, Analyze *analyze)
+        {
+            std::unique_ptr<DeblendTask> task(new DeblendTask());
+            memset(task.get(), 0, sizeof(DeblendTask));
+            task->seed = (unsigned int)tasks.size() + 1;
+            task->input.thresh = task->output.thresh = objlist->thresh;
+            if ((task->status = addobjdeep(0, objlist, &task->input, shared->values.plistsize)) != RETURN_OK)
+                return task->status;
+            DeblendTask *added = task.get();
+            tasks.push_back(std::move(task));
+            if (!deblend)
+                return analyse(*shared, added, &added->input, analyze);
+
+            start_thread();
+            {
+                std::lock_guard<std::mutex> lock(shared->mutex);
+                if (shared->running > 0)
+                {
+                    shared->pending.push_back(added);
+                    return RETURN_OK;
+                }
+            }
+            return process(*shared, local_worker(), added);
+        }
+
+        /* Waits for the threads and adds the objects of all of the tasks to
+         * finalobjlist in their order. */
+        int merge(objliststruct *finalobjlist)
+        {
+            int i, status;
+            finish();
+            for (auto &task : tasks)
+            {
+                if (task->status != RETURN_OK)
+                    return task->status;
+                for (i = 0; i < task->output.nobj; i++)
+                    if ((status = addobjdeep(i, &task->output, finalobjlist, shared->values.plistsize)) != RETURN_OK)
+                        return status;
+            }
+            return RETURN_OK;
+        }
+
+    private:
+
+        /* The analysed objects of list go to the output of the task */
+        static int analyse(const DeblendShared &shared, DeblendTask *task, objliststruct *list, Analyze *analyze)
+        {
+            int i;
+            for (i = 0; i < list->nobj; i++)
+            {
+                analyze->analyse(i, list, 1, shared.gain);
+
+                /* this does nothing if DETECT_MAXAREA is 0 (and it currently is) */
+                if (DETECT_MAXAREA && list->obj[i].fdnpix > DETECT_MAXAREA)
+                    continue;
+
+                if ((task->status = addobjdeep(i, list, &task->output, shared.values.plistsize)) != RETURN_OK)
+                    break;
+            }
+            /* the copy of the pixels is not needed anymore */
+            free(task->input.plist);
+            task->input.plist = NULL;
+            return task->status;
+        }
+
+        static int process(DeblendShared &shared, DeblendWorker &worker, DeblendTask *task)
+        {
+            objliststruct deblended;
+            deblended.obj = NULL;
+            deblended.plist = NULL;
+            deblended.nobj = deblended.npix = 0;
+            const auto deblendStart = std::chrono::steady_clock::now();
+            worker.deblend.set_seed(task->seed);
+            worker.deblend.set_limits(shared.limits);
+            task->status = worker.deblend.deblend(&task->input, 0, &deblended, shared.deblend_nthresh, shared.deblend_mincont,
+                                                  shared.minarea, &worker.lutz);
+            if (shared.limits)
+            {
+                shared.limits->ndeblended++;
+                shared.limits->spent += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                            std::chrono::steady_clock::now() - deblendStart).count();
+            }
+            /* a failed deblend stops the extraction, like in sortit() */
+            if (task->status == RETURN_OK)
+                analyse(shared, task, &deblended, &worker.analyze);
+            sep_arena_free(deblended.plist);
+            sep_arena_free(deblended.obj);
+            return task->status;
+        }
+
+        /* Gets the next task, or NULL once there are none.  A thread that
+         * runs out of tasks stops, the next task starts another one. */
+        static DeblendTask *take(DeblendShared &shared, bool thread)
+        {
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            if (shared.pending.empty())
+            {
+                if (thread)
+                    shared.running--;
+                return NULL;
+            }
+            DeblendTask *task = shared.pending.front();
+            shared.pending.pop_front();
+            shared.busy++;
+            return task;
+        }
+
+        static void done(DeblendShared &shared)
+        {
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            shared.busy--;
+            shared.idle.notify_all();
+        }
+
+        void start_thread()
+        {
+            {
+                std::lock_guard<std::mutex> lock(shared->mutex);
+                if (shared->running >= nthreads)
+                    return;
+                shared->running++;
+            }
+            std::shared_ptr<DeblendShared> state = shared;
+            const std::function<void()> thread = [state]()
+            {
+                std::unique_ptr<DeblendWorker> worker;
+                while (DeblendTask *task = take(*state, true))
+                {
+                    if (!worker)
+                        worker.reset(new DeblendWorker(*state));
+                    process(*state, *worker, task);
+                    done(*state);
+                }
+            };
+            bool started = true;
+            if (runner)
+                started = runner(thread);
+            else
+                std::thread(thread).detach();
+            if (!started)
+            {
+                std::lock_guard<std::mutex> lock(shared->mutex);
+                shared->running--;
+            }
+        }
+
+        DeblendWorker &local_worker()
+        {
+            if (!local)
+                local.reset(new DeblendWorker(*shared));
+            return *local;
+        }
+
+        /* The tasks that no thread took yet are deblended here, and then it
+         * waits for the ones the threads are doing.  A thread that was started
+         * but has not run yet doesn't hold anything up, it finds no tasks. */
+        void finish()
+        {
+            DeblendTask *task;
+            while ((task = take(*shared, false)))
+            {
+                process(*shared, local_worker(), task);
+                done(*shared);
+            }
+            std::unique_lock<std::mutex> lock(shared->mutex);
+            shared->idle.wait(lock, [this] { return shared->busy == 0; });
+        }
+
+        const int nthreads;
+        const sep_task_runner runner;
+        std::shared_ptr<DeblendShared> shared;
+        std::unique_ptr<DeblendWorker> local;   /* the Deblend, Lutz and Analyze of the scanning thread */
+        std::vector<std::unique_ptr<DeblendTask>> tasks;
+};
+
 Extract::Extract()
 {
 
@@ -59,7 +324,7 @@ int Extract::arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int
 
     /* buffer array info */
     buf->bptr = NULL;
-    QMALLOC(buf->bptr, PIXTYPE, bufw * bufh, status);
+    AMALLOC(buf->bptr, PIXTYPE, bufw * bufh, status);
     buf->bw = bufw;
     buf->bh = bufh;
 
@@ -81,7 +346,7 @@ int Extract::arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int
     return status;
 
 exit:
-    free(buf->bptr);
+    sep_arena_free(buf->bptr);
     buf->bptr = NULL;
     return status;
 }
@@ -104,8 +369,9 @@ void Extract::arraybuffer_readline(arraybuffer *buf)
     //        buf->readline(buf->dptr + buf->elsize * buf->dw * y, buf->dw,
     //                      buf->lastline);
 
+    //# Modified for the StellarSolver Internal Library, the offset of a line is 64 bit
     if (y < buf->dh)
-        buf->readline(buf->dptr + buf->elsize * buf->dw * y, buf->bw - 1,
+        buf->readline(buf->dptr + (size_t)buf->elsize * buf->dw * y, buf->bw - 1,
                       buf->lastline);
 
     return;
@@ -114,7 +380,7 @@ void Extract::arraybuffer_readline(arraybuffer *buf)
 void Extract::arraybuffer_free(arraybuffer *buf)
 {
     if(buf && buf->bptr){    //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
-        free(buf->bptr);
+        sep_arena_free(buf->bptr);
         buf->bptr = NULL;
     }
 }
@@ -152,6 +418,18 @@ void Extract::apply_mask_line(arraybuffer *mbuf, arraybuffer *imbuf, arraybuffer
     }
 }
 
+//# Modified for the StellarSolver Internal Library
+/* Whether any of the n pixels of a filtered line is over the threshold, like
+ * luflag.  The maximum is taken without branches so that it vectorizes, and a
+ * NaN is never over the threshold, as in the Lutz loop. */
+static int line_above(const PIXTYPE *line, int n, PIXTYPE thresh)
+{
+    PIXTYPE high = -BIG;
+    for (int k = 0; k < n; k++)
+        high = line[k] > high ? line[k] : high;
+    return high > thresh;
+}
+
 /****************************** extract **************************************/
 int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
                          int minarea, float *conv, int convw, int convh,
@@ -159,6 +437,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
                          int clean_flag, double clean_param,
                          sep_catalog **catalog)
 {
+    Tracer::Span span("sep_extract");
     arraybuffer       dbuf, nbuf, mbuf;
     infostruct        curpixinfo, initinfo, freeinfo;
     objliststruct     objlist;
@@ -179,9 +458,12 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     objliststruct     *finalobjlist;
     pliststruct	    *pixel, *pixt;
     char              *marker;
-    PIXTYPE           *scan, *cdscan, *wscan, *dummyscan;
+    PIXTYPE           *scan, *cdbuf, *wscan, *dummyscan;
+    const PIXTYPE     *cdscan;
     PIXTYPE           *sigscan, *workscan;
     float             *convnorm;
+    float             convcol[CONV_SEPARABLE_MAX], convrow[CONV_SEPARABLE_MAX];
+    int               separable, usefiltered, inplace, lineactive, constthresh;
     int               *start, *end, *survives;
     pixstatus         *psstack;
     char              errtext[512];
@@ -190,7 +472,10 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     //status = RETURN_OK; //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
     pixel = NULL;
     convnorm = NULL;
-    scan = wscan = cdscan = dummyscan = NULL;
+    separable = 0;
+    scan = wscan = cdbuf = dummyscan = NULL;
+    cdscan = NULL;
+    dbuf.bptr = NULL;
     sigscan = workscan = NULL;
     info = NULL;
     store = NULL;
@@ -269,13 +554,13 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
 
     /*Allocate memory for buffers */
     stacksize = w + 1;
-    QMALLOC(info, infostruct, stacksize, status);
-    QCALLOC(store, infostruct, stacksize, status);
-    QMALLOC(marker, char, stacksize, status);
-    QMALLOC(dummyscan, PIXTYPE, stacksize, status);
-    QMALLOC(psstack, pixstatus, stacksize, status);
-    QCALLOC(start, int, stacksize, status);
-    QMALLOC(end, int, stacksize, status);
+    AMALLOC(info, infostruct, stacksize, status);
+    ACALLOC(store, infostruct, stacksize, status);
+    AMALLOC(marker, char, stacksize, status);
+    AMALLOC(dummyscan, PIXTYPE, stacksize, status);
+    AMALLOC(psstack, pixstatus, stacksize, status);
+    ACALLOC(start, int, stacksize, status);
+    AMALLOC(end, int, stacksize, status);
 
     //    if ((status = lutzalloc(w, h)) != RETURN_OK)
     //        goto exit;
@@ -288,9 +573,15 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
      * the buffer height equals the height of the convolution kernel.
      */
     bufh = conv ? convh : 1;
-    status = arraybuffer_init(&dbuf, image->data, image->dtype, image->raw_w, h, stacksize,
-                              bufh);
-    if (status != RETURN_OK) goto exit;
+    //# Modified for the StellarSolver Internal Library, a float image without a noise array or a mask is read in place,
+    //# the lines are convolved from the image itself and only the convolved line is kept
+    inplace = image->dtype == SEP_TFLOAT && !isvarnoise && !image->mask;
+    if (!inplace)
+    {
+        status = arraybuffer_init(&dbuf, image->data, image->dtype, image->raw_w, h, stacksize,
+                                  bufh);
+        if (status != RETURN_OK) goto exit;
+    }
     if (isvarnoise)
     {
         status = arraybuffer_init(&nbuf, image->noise, image->ndtype, image->raw_w, h,
@@ -307,7 +598,8 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     /* `scan` (or `wscan`) is always a pointer to the current line being
      * processed. It might be the only line in the buffer, or it might be the
      * middle line. */
-    scan = dbuf.midline;
+    if (!inplace)
+        scan = dbuf.midline;
     if (isvarnoise)
         wscan = nbuf.midline;
 
@@ -327,7 +619,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     curpixinfo.pixnb = 1;
 
     /* Init finalobjlist */
-    QMALLOC(finalobjlist, objliststruct, 1, status);
+    AMALLOC(finalobjlist, objliststruct, 1, status);
     finalobjlist->obj = NULL;
     finalobjlist->plist = NULL;
     finalobjlist->nobj = finalobjlist->npix = 0;
@@ -335,7 +627,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
 
     /* Allocate memory for the pixel list */
     plistinit((conv != NULL), (image->noise_type != SEP_NOISE_NONE));
-    if (!(pixel = objlist.plist = (pliststruct *)malloc(nposize = mem_pixstack * plistsize)))
+    if (!(pixel = objlist.plist = (pliststruct *)sep_arena_malloc(nposize = mem_pixstack * plistsize)))
     {
         status = MEMORY_ALLOC_ERROR;
         goto exit;
@@ -357,21 +649,27 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     if (conv)
     {
         /* allocate memory for convolved buffers */
-        QMALLOC(cdscan, PIXTYPE, stacksize, status);
+        AMALLOC(cdbuf, PIXTYPE, stacksize, status);
+        cdscan = cdbuf;
+        /* the work buffer is for separable kernels and for the matched filter */
+        AMALLOC(workscan, PIXTYPE, stacksize, status);
         if (filter_type == SEP_FILTER_MATCHED)
         {
-            QMALLOC(sigscan, PIXTYPE, stacksize, status);
-            QMALLOC(workscan, PIXTYPE, stacksize, status);
+            AMALLOC(sigscan, PIXTYPE, stacksize, status);
         }
 
         /* normalize the filter */
         convn = convw * convh;
-        QMALLOC(convnorm, PIXTYPE, convn, status);
+        AMALLOC(convnorm, PIXTYPE, convn, status);
         for (i = 0; i < convn; i++)
             sum += fabs(conv[i]);
         for (i = 0; i < convn; i++)
             convnorm[i] = conv[i] / sum;
+        //# Modified for the StellarSolver Internal Library, the kernel is separated once instead of for each line
+        separable = separate_kernel(convnorm, convw, convh, convcol, convrow);
     }
+    //# Modified for the StellarSolver Internal Library, the filtered lines can come from an image that was convolved already
+    usefiltered = conv && filtered_image && filter_type == SEP_FILTER_CONV && !image->mask;
 
     plist_values.plistexist_cdvalue = plistexist_cdvalue;
     plist_values.plistexist_thresh = plistexist_thresh;
@@ -385,11 +683,23 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     analyze.reset(new Analyze(plist_values));
     lutz.reset(new Lutz(image->w, image->h, analyze.get(), plist_values));
     deblend.reset(new Deblend(deblend_nthresh, plist_values));
+    deblend->set_limits(deblend_limits);
+    //# Modified for the StellarSolver Internal Library, the objects can be deblended on other threads while the scan goes on
+    if (deblend_threads > 1)
+        deblend_queue.reset(new DeblendQueue(deblend_threads, deblend_runner, image->w, image->h, deblend_nthresh, deblend_cont,
+                                             minarea, image->gain, plist_values, deblend_limits));
 
+    /* whether the last line left markers for this one, see the skips below */
+    lineactive = 0;
+    constthresh = !isvarthresh && filter_type == SEP_FILTER_CONV;
 
     /*----- MAIN LOOP ------ */
     for (yl = 0; yl <= h; yl++)
     {
+        //# Modified for the StellarSolver Internal Library, past the deadline of the extraction the scan goes
+        //# straight to the empty line at the end, which closes the objects it has
+        if (yl < h && sep_limits_expired(deblend_limits))
+            yl = h;
 
         ps = COMPLETE;
         cs = NONOBJECT;
@@ -399,7 +709,8 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
         {
             if (conv)
             {
-                free(cdscan);  // cdscan set to dummyscan below
+                sep_arena_free(cdbuf);  // cdscan set to dummyscan below
+                cdbuf = NULL;
                 if (filter_type == SEP_FILTER_MATCHED)
                 {
                     for (xl = 0; xl < stacksize; xl++)
@@ -411,6 +722,17 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
             cdscan = dummyscan;
         }
 
+        else if (inplace)
+        {
+            scan = (PIXTYPE *)image->data + (size_t)yl * image->raw_w;
+            if (!conv)
+                cdscan = scan;
+            else if (usefiltered)
+                cdscan = filtered_image + (size_t)yl * filtered_stride;
+            else
+                convolve_rows((const PIXTYPE *)image->data, image->raw_w, w, h, yl, convnorm, convw, convh,
+                              separable ? convcol : NULL, separable ? convrow : NULL, workscan, cdbuf);
+        }
         else
         {
             arraybuffer_readline(&dbuf);
@@ -425,7 +747,11 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
             /* filter the lines */
             if (conv)
             {
-                status = convolve(&dbuf, yl, convnorm, convw, convh, cdscan);
+                if (usefiltered)
+                    cdscan = filtered_image + (size_t)yl * filtered_stride;
+                else
+                    status = convolve(&dbuf, yl, convnorm, convw, convh, separable ? convcol : NULL,
+                                      separable ? convrow : NULL, workscan, cdbuf);
                 if (status != RETURN_OK)
                     goto exit;
 
@@ -445,10 +771,21 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
             }
         }
 
+        //# Modified for the StellarSolver Internal Library, with a constant threshold, a line with no pixel over it after a line
+        //# that left no markers has nothing for the Lutz loop to do, which is most of the lines of a star field
+        if (constthresh && !lineactive && !line_above(cdscan, w, thresh))
+            continue;
+        lineactive = 0;
+
         trunflag = (yl == 0 || yl == h - 1) ? SEP_OBJ_TRUNC : 0;
 
         for (xl = 0; xl <= w; xl++)
         {
+            //# Modified for the StellarSolver Internal Library, outside of a segment, the pixels under the threshold without a
+            //# marker don't change anything, so the loop goes straight to the next pixel over it or with a marker
+            if (constthresh && cs == NONOBJECT)
+                while (xl < w && !marker[xl] && !(cdscan[xl] > thresh))
+                    xl++;
             if (xl == w)
                 cdnewsymbol = -BIG;
             else
@@ -456,6 +793,8 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
 
             newmarker = marker[xl];  /* marker at this pixel */
             marker[xl] = 0;
+            if (newmarker)
+                lineactive = 1;
 
             curpixinfo.flag = trunflag;
 
@@ -495,6 +834,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
 
             if (luflag)
             {
+                lineactive = 1;
                 /* flag the current object if we're near the image bounds */
                 if (xl == 0 || xl == w - 1)
                     curpixinfo.flag |= SEP_OBJ_TRUNC;
@@ -544,7 +884,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
                     oldnposize = nposize;
                     mem_pixstack = (int)(mem_pixstack * 2);
                     nposize = mem_pixstack * plistsize;
-                    pixel = (pliststruct *)realloc(pixel, nposize);
+                    pixel = (pliststruct *)sep_arena_realloc(pixel, nposize);
                     objlist.plist = pixel;
                     if (!pixel)
                     {
@@ -692,6 +1032,14 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
 
     } /*---------------- End of the loop over the y's -----------------------*/
 
+    if (deblend_queue)
+    {
+        status = deblend_queue->merge(finalobjlist);
+        deblend_queue.reset();
+        if (status != RETURN_OK)
+            goto exit;
+    }
+
     /* convert `finalobjlist` to an array of `sepobj` structs */
     /* if cleaning, see which objects "survive" cleaning. */
     if (clean_flag)
@@ -704,42 +1052,44 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
                 goto exit;
         }
         if(finalobjlist->nobj > 0) //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, in case nobj is 0 or less.
-            QMALLOC(survives, int, finalobjlist->nobj, status);
+            AMALLOC(survives, int, finalobjlist->nobj, status);
         clean(finalobjlist, clean_param, survives);
     }
 
     /* convert to output catalog */
-    QCALLOC(cat, sep_catalog, 1, status);
+    ACALLOC(cat, sep_catalog, 1, status);
     status = convert_to_catalog(finalobjlist, survives, cat, w, 1);
     if (status != RETURN_OK) goto exit;
 
 exit:
+    /* the threads stop before the memory they might still be reading is freed */
+    deblend_queue.reset();
     if(finalobjlist)
     {
         if(finalobjlist->obj)
-            free(finalobjlist->obj);
+            sep_arena_free(finalobjlist->obj);
         finalobjlist->obj = 0;   //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
         if(finalobjlist->plist)
-            free(finalobjlist->plist);
+            sep_arena_free(finalobjlist->plist);
         finalobjlist->plist = 0; //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-        free(finalobjlist);
+        sep_arena_free(finalobjlist);
         finalobjlist = 0;        //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
     }
-    free(pixel);
+    sep_arena_free(pixel);
     pixel = 0;                   //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(info);
+    sep_arena_free(info);
     info = 0;                    //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(store);
+    sep_arena_free(store);
     store = 0;                   //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(marker);
+    sep_arena_free(marker);
     marker = 0;                  //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(psstack);
+    sep_arena_free(psstack);
     psstack = 0;                 //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(start);
+    sep_arena_free(start);
     start = 0;                   //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(end);
+    sep_arena_free(end);
     end = 0;                     //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(survives);
+    sep_arena_free(survives);
     survives = 0;                //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
     arraybuffer_free(&dbuf);
     if (image->noise)
@@ -747,26 +1097,23 @@ exit:
     if (image->mask)
         arraybuffer_free(&mbuf);
     if (conv){
-        free(convnorm);
+        sep_arena_free(convnorm);
         convnorm = 0;            //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
     }
     if (filter_type == SEP_FILTER_MATCHED)
     {
-        free(sigscan);
+        sep_arena_free(sigscan);
         sigscan = 0;             //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-        free(workscan);
-        workscan = 0;            //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
     }
+    sep_arena_free(workscan);              //# Modified for the StellarSolver Internal Library, it is used for separable kernels too
+    workscan = 0;
 
-    /* free cdscan if we didn't do it on the last `yl` line */
-    if (conv && (cdscan != dummyscan))
-    {
-        free(cdscan);
-        cdscan = 0;              //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    }
+    /* free cdbuf if we didn't do it on the last `yl` line */
+    sep_arena_free(cdbuf);
+    cdbuf = 0;                   //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
 
     //# Modified by Hy Murveit for the StellarSolver Internal Library, possible bug. Moved free(dummyscan) to here from earlier since it was referenced in the if above.
-    free(dummyscan);
+    sep_arena_free(dummyscan);
     dummyscan = 0;
 
     if (status != RETURN_OK)
@@ -781,10 +1128,454 @@ exit:
 }
 
 
+/****************************** extract_mt ***********************************/
+/* Multithreaded sep_extract for a single image.
+ *
+ * The image is cut into horizontal strips that are extracted at the same
+ * time.  The labeling in a strip cannot see the rows of its neighbours, so a
+ * strip only keeps the objects that stay `halo` rows away from the edges it
+ * shares with another strip: the convolution of those rows, and so the pixels
+ * above the threshold, are the same as in the whole image.  The objects near
+ * a shared edge are then extracted again from a band of rows around it, which
+ * is made taller until everything it keeps is that far from its own edges.
+ * The bands are small, so this is the "merge" step of the labeling.
+ *
+ * Deblending and cleaning only see the objects of one strip or band, and the
+ * objects come out in a different order, so the catalog is not bit for bit
+ * the one of sep_extract().
+ */
+
+#define EXTRACT_MT_MIN_STRIP 64   /* no strips with fewer rows than this */
+
+namespace
+{
+
+struct ExtractPiece
+{
+    int y0, y1;             /* rows of the image that were extracted */
+    sep_catalog *cat;       /* in piece coordinates, NULL if nothing was found */
+    int status;
+    std::vector<int> keep;  /* the objects of cat to put in the final catalog */
+};
+
+/* a view on the rows y0 to y1 of image */
+int image_rows(const sep_image *image, int y0, int y1, sep_image *rows)
+{
+    converter conv;
+    int size, status;
+
+    *rows = *image;
+    rows->h = y1 - y0;
+    rows->raw_h = y1 - y0;
+    if ((status = get_converter(image->dtype, &conv, &size)))
+        return status;
+    rows->data = static_cast<BYTE *>(image->data) + (size_t)y0 * image->raw_w * size;
+    if (image->noise)
+    {
+        if ((status = get_converter(image->ndtype, &conv, &size)))
+            return status;
+        rows->noise = static_cast<BYTE *>(image->noise) + (size_t)y0 * image->raw_w * size;
+    }
+    if (image->mask)
+    {
+        if ((status = get_converter(image->mdtype, &conv, &size)))
+            return status;
+        rows->mask = static_cast<BYTE *>(image->mask) + (size_t)y0 * image->raw_w * size;
+    }
+    if (image->segmap)
+    {
+        if ((status = get_converter(image->sdtype, &conv, &size)))
+            return status;
+        rows->segmap = static_cast<BYTE *>(image->segmap) + (size_t)y0 * image->raw_w * size;
+    }
+    return RETURN_OK;
+}
+
+/* does the object span any of the rows from y0 to y1 (image coordinates) */
+bool spans(const ExtractPiece &piece, int i, int y0, int y1)
+{
+    return piece.cat->ymin[i] + piece.y0 < y1 && piece.cat->ymax[i] + piece.y0 >= y0;
+}
+
+}
+
+int Extract::collect_catalogs(void *pieces, int npieces, int w, sep_catalog **catalog)
+{
+    ExtractPiece *piece = static_cast<ExtractPiece *>(pieces);
+    sep_catalog *cat = NULL;
+    int j, k, p, nobj = 0, totnpix = 0, status = RETURN_OK;
+    int *pixt;
+
+    for (p = 0; p < npieces; p++)
+    {
+        nobj += (int)piece[p].keep.size();
+        for (int i : piece[p].keep)
+            totnpix += piece[p].cat->npix[i];
+    }
+    *catalog = NULL;
+    if (nobj == 0)
+        return MEMORY_ALLOC_ERROR;  /* the same as sep_extract() when nothing is found */
+
+    ACALLOC(cat, sep_catalog, 1, status);
+    cat->nobj = nobj;
+    AMALLOC(cat->thresh, float, nobj, status);
+    AMALLOC(cat->npix, int, nobj, status);
+    AMALLOC(cat->tnpix, int, nobj, status);
+    AMALLOC(cat->xmin, int, nobj, status);
+    AMALLOC(cat->xmax, int, nobj, status);
+    AMALLOC(cat->ymin, int, nobj, status);
+    AMALLOC(cat->ymax, int, nobj, status);
+    AMALLOC(cat->x, double, nobj, status);
+    AMALLOC(cat->y, double, nobj, status);
+    AMALLOC(cat->x2, double, nobj, status);
+    AMALLOC(cat->y2, double, nobj, status);
+    AMALLOC(cat->xy, double, nobj, status);
+    AMALLOC(cat->errx2, double, nobj, status);
+    AMALLOC(cat->erry2, double, nobj, status);
+    AMALLOC(cat->errxy, double, nobj, status);
+    AMALLOC(cat->a, float, nobj, status);
+    AMALLOC(cat->b, float, nobj, status);
+    AMALLOC(cat->theta, float, nobj, status);
+    AMALLOC(cat->cxx, float, nobj, status);
+    AMALLOC(cat->cyy, float, nobj, status);
+    AMALLOC(cat->cxy, float, nobj, status);
+    AMALLOC(cat->cflux, float, nobj, status);
+    AMALLOC(cat->flux, float, nobj, status);
+    AMALLOC(cat->cpeak, float, nobj, status);
+    AMALLOC(cat->peak, float, nobj, status);
+    AMALLOC(cat->xcpeak, int, nobj, status);
+    AMALLOC(cat->ycpeak, int, nobj, status);
+    AMALLOC(cat->xpeak, int, nobj, status);
+    AMALLOC(cat->ypeak, int, nobj, status);
+    AMALLOC(cat->flag, short, nobj, status);
+    AMALLOC(cat->objectspix, int, totnpix, status);
+    AMALLOC(cat->pix, int*, nobj, status);
+
+    j = 0;
+    pixt = cat->objectspix;
+    for (p = 0; p < npieces; p++)
+    {
+        const sep_catalog *src = piece[p].cat;
+        const int dy = piece[p].y0;
+        for (int i : piece[p].keep)
+        {
+            cat->thresh[j] = src->thresh[i];
+            cat->npix[j] = src->npix[i];
+            cat->tnpix[j] = src->tnpix[i];
+            cat->xmin[j] = src->xmin[i];
+            cat->xmax[j] = src->xmax[i];
+            cat->ymin[j] = src->ymin[i] + dy;
+            cat->ymax[j] = src->ymax[i] + dy;
+            cat->x[j] = src->x[i];
+            cat->y[j] = src->y[i] + dy;
+            cat->x2[j] = src->x2[i];
+            cat->y2[j] = src->y2[i];
+            cat->xy[j] = src->xy[i];
+            cat->errx2[j] = src->errx2[i];
+            cat->erry2[j] = src->erry2[i];
+            cat->errxy[j] = src->errxy[i];
+            cat->a[j] = src->a[i];
+            cat->b[j] = src->b[i];
+            cat->theta[j] = src->theta[i];
+            cat->cxx[j] = src->cxx[i];
+            cat->cyy[j] = src->cyy[i];
+            cat->cxy[j] = src->cxy[i];
+            cat->cflux[j] = src->cflux[i];
+            cat->flux[j] = src->flux[i];
+            cat->cpeak[j] = src->cpeak[i];
+            cat->peak[j] = src->peak[i];
+            cat->xcpeak[j] = src->xcpeak[i];
+            cat->ycpeak[j] = src->ycpeak[i] + dy;
+            cat->xpeak[j] = src->xpeak[i];
+            cat->ypeak[j] = src->ypeak[i] + dy;
+            cat->flag[j] = src->flag[i];
+
+            /* the pixels are linear indices, one row is w of them */
+            cat->pix[j] = pixt;
+            for (k = 0; k < src->npix[i]; k++)
+                *(pixt++) = src->pix[i][k] + dy * w;
+            j++;
+        }
+    }
+
+    *catalog = cat;
+    return status;
+
+exit:
+    sep_catalog_free(cat);
+    return status;
+}
+
+int Extract::sep_extract_mt(sep_image *image, float thresh, int thresh_type,
+                            int minarea, float *conv, int convw, int convh,
+                            int filter_type, int deblend_nthresh, double deblend_cont,
+                            int clean_flag, double clean_param, int nthreads,
+                            sep_catalog **catalog)
+{
+    Tracer::Span span("sep_extract_mt");
+    const int h = image->h;
+    const int halo = (conv ? convh / 2 : 0) + 1;
+    int nstrips, k, p, status = RETURN_OK;
+
+    nstrips = std::min(nthreads, h / EXTRACT_MT_MIN_STRIP);
+    /* too few rows for strips, but the threads can still deblend the objects */
+    if (nstrips <= 1)
+    {
+        const int strip_threads = deblend_threads;
+        if (nthreads > 1)
+            deblend_threads = std::max(deblend_threads, nthreads);
+        status = sep_extract(image, thresh, thresh_type, minarea, conv, convw, convh, filter_type,
+                             deblend_nthresh, deblend_cont, clean_flag, clean_param, catalog);
+        deblend_threads = strip_threads;
+        return status;
+    }
+
+    /* Extracts the rows y0 to y1 of the image into piece.  Every piece gets
+     * its own Extract, since the Lutz, Deblend and Analyze objects keep state. */
+    auto extract_rows = [&](ExtractPiece & piece)
+    {
+        sep_image rows;
+        piece.cat = NULL;
+        piece.keep.clear();
+        if ((piece.status = image_rows(image, piece.y0, piece.y1, &rows)) != RETURN_OK)
+            return;
+        Extract extractor;
+        extractor.sep_set_extract_pixstack(sep_get_extract_pixstack());
+        extractor.sep_set_deblend_limits(deblend_limits);
+        extractor.sep_set_deblend_threads(deblend_threads, deblend_runner);
+        if (filtered_image)
+            extractor.sep_set_filtered_image(filtered_image + (size_t)piece.y0 * filtered_stride, filtered_stride);
+        piece.status = extractor.sep_extract(&rows, thresh, thresh_type, minarea, conv, convw, convh, filter_type,
+                                             deblend_nthresh, deblend_cont, clean_flag, clean_param, &piece.cat);
+        /* an empty catalog comes back as an error without a catalog */
+        if (piece.status == MEMORY_ALLOC_ERROR && piece.cat == NULL)
+            piece.status = RETURN_OK;
+    };
+    auto run_all = [&](std::vector<ExtractPiece> &pieces)
+    {
+        sep_parallel_for((int)pieces.size(), (int)pieces.size(), [&](int index)
+        {
+            extract_rows(pieces[index]);
+        });
+        for (auto &piece : pieces)
+            if (piece.status != RETURN_OK && status == RETURN_OK)
+                status = piece.status;
+    };
+
+    /* the rows where one strip ends and the next one begins */
+    std::vector<int> edges(nstrips + 1);
+    for (k = 0; k <= nstrips; k++)
+        edges[k] = (int)((long long)h * k / nstrips);
+
+    std::vector<ExtractPiece> strips(nstrips);
+    for (k = 0; k < nstrips; k++)
+    {
+        strips[k].y0 = edges[k];
+        strips[k].y1 = edges[k + 1];
+    }
+    run_all(strips);
+
+    /* Keep the objects of each strip that are away from the shared edges, and
+     * start the band of each shared edge with the objects that are not. */
+    std::vector<ExtractPiece> bands(nstrips - 1);
+    for (k = 1; k < nstrips; k++)
+    {
+        bands[k - 1].y0 = edges[k] - 2 * halo;
+        bands[k - 1].y1 = edges[k] + 2 * halo;
+    }
+    for (k = 0; status == RETURN_OK && k < nstrips; k++)
+    {
+        ExtractPiece &strip = strips[k];
+        for (int i = 0; strip.cat && i < strip.cat->nobj; i++)
+        {
+            const int ymin = strip.cat->ymin[i] + strip.y0, ymax = strip.cat->ymax[i] + strip.y0;
+            const bool top = k > 0 && ymin < edges[k] + halo;
+            const bool bottom = k < nstrips - 1 && ymax >= edges[k + 1] - halo;
+            if (top)
+                bands[k - 1].y1 = std::max(bands[k - 1].y1, ymax + 2 * halo);
+            if (bottom)
+                bands[k].y0 = std::min(bands[k].y0, ymin - 2 * halo);
+            if (!top && !bottom)
+                strip.keep.push_back(i);
+        }
+    }
+
+    /* Extract the bands until all of their objects near the shared edge are
+     * far enough from the edges of the band. */
+    std::vector<ExtractPiece> pending;
+    std::vector<int> pendingEdge;
+    for (k = 1; k < nstrips; k++)
+    {
+        pending.push_back(bands[k - 1]);
+        pendingEdge.push_back(k);
+    }
+    std::vector<ExtractPiece> done;
+    while (status == RETURN_OK && !pending.empty())
+    {
+        for (auto &band : pending)
+        {
+            band.y0 = std::max(band.y0, 0);
+            band.y1 = std::min(band.y1, h);
+        }
+        run_all(pending);
+
+        std::vector<ExtractPiece> again;
+        std::vector<int> againEdge;
+        for (p = 0; status == RETURN_OK && p < (int)pending.size(); p++)
+        {
+            ExtractPiece &band = pending[p];
+            const int edge = edges[pendingEdge[p]];
+            const int prevEdge = pendingEdge[p] > 1 ? edges[pendingEdge[p] - 1] : -1;
+            bool grow = false;
+            int y0 = band.y0, y1 = band.y1;
+            for (int i = 0; band.cat && i < band.cat->nobj; i++)
+            {
+                /* only the objects the strips left out near this edge, and
+                 * not the ones that the band of the edge before has */
+                if (!spans(band, i, edge - halo, edge + halo))
+                    continue;
+                if (prevEdge >= 0 && spans(band, i, prevEdge - halo, prevEdge + halo))
+                    continue;
+                const int ymin = band.cat->ymin[i] + band.y0, ymax = band.cat->ymax[i] + band.y0;
+                /* its real size is unknown if it is cut off, so the band grows by its own height */
+                if (band.y0 > 0 && ymin < band.y0 + halo)
+                {
+                    grow = true;
+                    y0 = std::min(y0, band.y0 - (band.y1 - band.y0));
+                }
+                if (band.y1 < h && ymax >= band.y1 - halo)
+                {
+                    grow = true;
+                    y1 = std::max(y1, band.y1 + (band.y1 - band.y0));
+                }
+                band.keep.push_back(i);
+            }
+            if (grow)
+            {
+                Extract::sep_catalog_free(band.cat);
+                band.cat = NULL;
+                band.keep.clear();
+                band.y0 = y0;
+                band.y1 = y1;
+                again.push_back(band);
+                againEdge.push_back(pendingEdge[p]);
+            }
+            else
+                done.push_back(band);
+        }
+        if (status != RETURN_OK)
+            done.insert(done.end(), pending.begin(), pending.end());
+        pending.swap(again);
+        pendingEdge.swap(againEdge);
+    }
+
+    if (status == RETURN_OK)
+    {
+        std::vector<ExtractPiece> all(strips);
+        all.insert(all.end(), done.begin(), done.end());
+        status = collect_catalogs(all.data(), (int)all.size(), image->w, catalog);
+    }
+    else
+        *catalog = NULL;
+
+    for (auto &piece : strips)
+        Extract::sep_catalog_free(piece.cat);
+    for (auto &piece : done)
+        Extract::sep_catalog_free(piece.cat);
+    for (auto &piece : pending)
+        Extract::sep_catalog_free(piece.cat);
+    return status;
+}
+
+//# Modified for the StellarSolver Internal Library
+int Extract::sep_filter_image(const sep_image *image, const float *conv, int convw, int convh,
+                              float *filtered, int nthreads)
+{
+    float convcol[CONV_SEPARABLE_MAX], convrow[CONV_SEPARABLE_MAX];
+    const int w = image->w, h = image->h;
+    double sum = 0.0;
+    int i, separable;
+
+    if (image->dtype != SEP_TFLOAT || image->mask)
+        return ILLEGAL_DTYPE;
+
+    std::vector<float> convnorm(convw * convh);
+    for (i = 0; i < convw * convh; i++)
+        sum += fabs(conv[i]);
+    for (i = 0; i < convw * convh; i++)
+        convnorm[i] = conv[i] / sum;
+    separable = separate_kernel(convnorm.data(), convw, convh, convcol, convrow);
+
+    auto filter_rows = [&](int y0, int y1)
+    {
+        std::vector<PIXTYPE> work(w);
+        for (int y = y0; y < y1; y++)
+            convolve_rows((const PIXTYPE *)image->data, image->raw_w, w, h, y, convnorm.data(), convw, convh,
+                          separable ? convcol : NULL, separable ? convrow : NULL, work.data(), filtered + (size_t)y * w);
+    };
+    nthreads = std::max(1, std::min(nthreads, h / EXTRACT_MT_MIN_STRIP));
+    sep_parallel_for(nthreads, nthreads, [&](int piece)
+    {
+        filter_rows((int)((long long)h * piece / nthreads), (int)((long long)h * (piece + 1) / nthreads));
+    });
+    return RETURN_OK;
+}
+
+
 /********************************* sortit ************************************/
 /*
 build the object structure.
 */
+/* Whether the preanalysed object of objlist is worth deblending within the
+ * deblend limits.  The elongation comes from its second moments, as the
+ * shape is not known before analyse(). */
+bool Extract::should_deblend(objliststruct *objlist) const
+{
+    const objstruct *object = &objlist->obj[0];
+    pliststruct *pixel = objlist->plist, *pixt;
+    double rv, mx, my, mx2, my2, mxy, val, half, root;
+    int x, y;
+
+    if (deblend_limits->maxtime > 0 && deblend_limits->spent >= deblend_limits->maxtime * 1e6)
+        return false;
+    if (sep_limits_expired(deblend_limits))
+        return false;
+    if (deblend_limits->minpix <= 0 && deblend_limits->minelong <= 0)
+        return true;
+    if (deblend_limits->minpix > 0 && object->fdnpix >= deblend_limits->minpix)
+        return true;
+    if (deblend_limits->minelong <= 0)
+        return false;
+
+    rv = mx = my = mx2 = my2 = mxy = 0.0;
+    for (pixt = pixel + object->firstpix; pixt >= pixel; pixt = pixel + PLIST(pixt, nextpix))
+    {
+        val = PLISTPIX(pixt, cdvalue);
+        if (val <= 0.0)
+            continue;
+        x = PLIST(pixt, x) - object->xmin;
+        y = PLIST(pixt, y) - object->ymin;
+        rv += val;
+        mx += val * x;
+        my += val * y;
+        mx2 += val * x * x;
+        my2 += val * y * y;
+        mxy += val * x * y;
+    }
+    if (rv <= 0.0)
+        return false;
+    mx /= rv;
+    my /= rv;
+    mx2 = mx2 / rv - mx * mx;
+    my2 = my2 / rv - my * my;
+    mxy = mxy / rv - mx * my;
+
+    /* a/b >= minelong, with a^2 and b^2 the eigenvalues of the moments */
+    half = 0.5 * (mx2 + my2);
+    root = sqrt(0.25 * (mx2 - my2) * (mx2 - my2) + mxy * mxy);
+    return half + root >= deblend_limits->minelong * deblend_limits->minelong * (half - root);
+}
+
 int Extract::sortit(infostruct *info, objliststruct *objlist, int minarea, objliststruct *finalobjlist, int deblend_nthresh,
                     double deblend_mincont, double gain)
 {
@@ -809,7 +1600,38 @@ int Extract::sortit(infostruct *info, objliststruct *objlist, int minarea, objli
 
     analyze->preanalyse(0, objlist);
 
-    status = deblend->deblend(objlist, 0, &objlistout, deblend_nthresh, deblend_mincont, minarea, lutz.get());
+    //# Modified for the StellarSolver Internal Library, saturated objects and small round objects are not deblended with deblend limits
+    if (deblend_limits && deblend_limits->saturation > 0 && obj.dpeak > deblend_limits->saturation)
+    {
+        deblend_limits->nsaturated++;
+        obj.flag |= SEP_OBJ_SATUR;
+        objlist2 = objlist;
+        status = RETURN_OK;
+    }
+    else if (deblend_limits && !should_deblend(objlist))
+    {
+        deblend_limits->nskipped++;
+        objlist2 = objlist;
+        status = RETURN_OK;
+    }
+    //# Modified for the StellarSolver Internal Library, the deblend threads take the object from here and merge it later
+    else if (deblend_queue)
+        return deblend_queue->add(objlist, true, analyze.get());
+    else
+    {
+        const auto deblendStart = std::chrono::steady_clock::now();
+        status = deblend->deblend(objlist, 0, &objlistout, deblend_nthresh, deblend_mincont, minarea, lutz.get());
+        if (deblend_limits)
+        {
+            deblend_limits->ndeblended++;
+            deblend_limits->spent += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         std::chrono::steady_clock::now() - deblendStart).count();
+        }
+        objlist2 = &objlistout;
+    }
+    /* the objects that are not deblended wait with the others for their turn in the catalog */
+    if (deblend_queue)
+        return deblend_queue->add(objlist, false, analyze.get());
     if (status)
     {
         /* formerly, this wasn't a fatal error, so a flag was set for
@@ -821,8 +1643,6 @@ int Extract::sortit(infostruct *info, objliststruct *objlist, int minarea, objli
             objlist2->obj[i].flag |= SEP_OBJ_DOVERFLOW;
         goto exit;
     }
-    else
-        objlist2 = &objlistout;
 
     /* Analyze the deblended objects and add to the final list */
     for (i = 0; i < objlist2->nobj; i++)
@@ -840,9 +1660,9 @@ int Extract::sortit(infostruct *info, objliststruct *objlist, int minarea, objli
     }
 
 exit:
-    free(objlistout.plist);
+    sep_arena_free(objlistout.plist);
     objlistout.plist = 0;  //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(objlistout.obj);
+    sep_arena_free(objlistout.obj);
     objlistout.obj = 0;    //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
     return status;
 }
@@ -897,6 +1717,162 @@ Fill a list with whether each object in the list survived the cleaning
 (assumes that mthresh has already been calculated for all objects in the list)
 */
 
+#define CLEAN_LEVELS 16  /* size classes of the objects in CleanGrid */
+
+namespace
+{
+
+/* The objects of a list sorted into square cells by their centers, so that
+ * clean() only compares each object with the ones that are close enough to
+ * matter, instead of with all of the others.  Two objects are close enough
+ * within CLEAN_ZONE times the sum of their a.  A few big objects would make
+ * every cell big, so the objects are split by size into levels, where each
+ * level doubles the a of the one before.  Each level has its own grid with
+ * cells sized for its biggest a, and an object looks for its neighbours in
+ * all of them. */
+class CleanGrid
+{
+    public:
+        explicit CleanGrid(const objliststruct *objlist) : obj(objlist->obj)
+        {
+            const int nobj = objlist->nobj;
+            std::vector<float> sizes(nobj);
+            std::vector<int> levelOf(nobj, -1);
+            int i, l;
+
+            for (i = 0; i < nobj; i++)
+                sizes[i] = obj[i].a;
+            std::nth_element(sizes.begin(), sizes.begin() + nobj / 2, sizes.end());
+            const float base = 2.0f * std::max(sizes[nobj / 2], 1e-3f);
+
+            for (i = 0; i < nobj; i++)
+            {
+                /* the ones without a center or a size are compared with all of the others */
+                if (!(obj[i].a >= 0 && obj[i].a < 1e30f) || !std::isfinite(obj[i].mx) || !std::isfinite(obj[i].my))
+                {
+                    unplaced.push_back(i);
+                    continue;
+                }
+                l = 0;
+                while (l < CLEAN_LEVELS - 1 && obj[i].a > base * (float)(1 << l))
+                    l++;
+                levelOf[i] = l;
+            }
+
+            std::vector<int> members;
+            for (l = 0; l < CLEAN_LEVELS; l++)
+            {
+                members.clear();
+                for (i = 0; i < nobj; i++)
+                    if (levelOf[i] == l)
+                        members.push_back(i);
+                if (!members.empty())
+                    levels.push_back(make_level(members));
+            }
+        }
+
+        /* The objects after i that can be close enough to i, in order */
+        void neighbours(int i, std::vector<int> &found) const
+        {
+            int cx0, cx1, cy0, cy1, cx, cy, k;
+
+            found.clear();
+            if (!std::binary_search(unplaced.begin(), unplaced.end(), i))
+            {
+                for (const Level &level : levels)
+                {
+                    /* a pixel more, so that the rounding of the cells never leaves one out */
+                    const double reach = (obj[i].a + level.amax) * CLEAN_ZONE + 1.0;
+                    cx0 = level.cell_index(obj[i].mx - reach - level.x0, level.columns);
+                    cx1 = level.cell_index(obj[i].mx + reach - level.x0, level.columns);
+                    cy0 = level.cell_index(obj[i].my - reach - level.y0, level.rows);
+                    cy1 = level.cell_index(obj[i].my + reach - level.y0, level.rows);
+                    for (cy = cy0; cy <= cy1; cy++)
+                        for (cx = cx0; cx <= cx1; cx++)
+                            for (k = level.start[cy * level.columns + cx]; k < level.start[cy * level.columns + cx + 1]; k++)
+                                if (level.members[k] > i)
+                                    found.push_back(level.members[k]);
+                }
+            }
+            else
+            {
+                for (const Level &level : levels)
+                    for (int j : level.members)
+                        if (j > i)
+                            found.push_back(j);
+            }
+            for (int j : unplaced)
+                if (j > i)
+                    found.push_back(j);
+            std::sort(found.begin(), found.end());
+        }
+
+    private:
+        struct Level
+        {
+            float amax = 0;
+            double x0 = 0, y0 = 0, scale = 1;
+            int columns = 1, rows = 1;
+            std::vector<int> start, members;
+
+            int cell_index(double offset, int cells) const
+            {
+                if (!(offset > 0))
+                    return 0;
+                return std::min(cells - 1, (int)std::min(offset * scale, (double)cells));
+            }
+        };
+
+        Level make_level(const std::vector<int> &objects) const
+        {
+            Level level;
+            double x1, y1, cell;
+            int cx, cy, c;
+
+            level.x0 = x1 = obj[objects[0]].mx;
+            level.y0 = y1 = obj[objects[0]].my;
+            for (int i : objects)
+            {
+                level.x0 = std::min(level.x0, obj[i].mx);
+                level.y0 = std::min(level.y0, obj[i].my);
+                x1 = std::max(x1, obj[i].mx);
+                y1 = std::max(y1, obj[i].my);
+                level.amax = std::max(level.amax, obj[i].a);
+            }
+
+            /* at least about one object per cell, so that small objects do not make a huge grid */
+            cell = std::max(std::max(2.0 * level.amax * CLEAN_ZONE, 1.0),
+                            std::sqrt((x1 - level.x0 + 1) * (y1 - level.y0 + 1) / objects.size()));
+            level.scale = 1.0 / cell;
+            level.columns = (int)((x1 - level.x0) * level.scale) + 1;
+            level.rows = (int)((y1 - level.y0) * level.scale) + 1;
+
+            /* a counting sort of the objects by their cells, which keeps them in order within each cell */
+            std::vector<int> cellOf(objects.size());
+            level.start.assign((size_t)level.columns * level.rows + 1, 0);
+            for (size_t k = 0; k < objects.size(); k++)
+            {
+                cx = std::min(level.columns - 1, (int)((obj[objects[k]].mx - level.x0) * level.scale));
+                cy = std::min(level.rows - 1, (int)((obj[objects[k]].my - level.y0) * level.scale));
+                cellOf[k] = cy * level.columns + cx;
+                level.start[cellOf[k] + 1]++;
+            }
+            for (c = 0; c < level.columns * level.rows; c++)
+                level.start[c + 1] += level.start[c];
+            level.members.resize(objects.size());
+            std::vector<int> fill(level.start.begin(), level.start.end() - 1);
+            for (size_t k = 0; k < objects.size(); k++)
+                level.members[fill[cellOf[k]]++] = objects[k];
+            return level;
+        }
+
+        const objstruct *obj;
+        std::vector<Level> levels;
+        std::vector<int> unplaced;      /* in order */
+};
+
+}
+
 void Extract::clean(objliststruct *objlist, double clean_param, int *survives)
 {
     objstruct     *obj1, *obj2;
@@ -909,6 +1885,12 @@ void Extract::clean(objliststruct *objlist, double clean_param, int *survives)
     /* initialize to all surviving */
     for (i = 0; i < objlist->nobj; i++)
         survives[i] = 1;
+    if (objlist->nobj < 2)
+        return;
+
+    //# Modified for the StellarSolver Internal Library, only the objects close enough to each other are compared
+    CleanGrid grid(objlist);
+    std::vector<int> neighbours;
 
     obj1 = objlist->obj;
     for (i = 0; i < objlist->nobj; i++, obj1++)
@@ -921,10 +1903,12 @@ void Extract::clean(objliststruct *objlist, double clean_param, int *survives)
         ampin = obj1->fdflux / (2 * unitareain * obj1->abcor);
         alphain = (pow(ampin / obj1->thresh, 1.0 / beta) - 1) * unitareain / obj1->fdnpix;
 
-        /* loop over remaining objects in list*/
-        obj2 = obj1 + 1;
-        for (j = i + 1; j < objlist->nobj; j++, obj2++)
+        /* loop over the remaining objects in the list that are near this one, in their order */
+        grid.neighbours(i, neighbours);
+        for (int k = 0; k < (int)neighbours.size(); k++)
         {
+            j = neighbours[k];
+            obj2 = objlist->obj + j;
             if (!survives[j])
                 continue;
 
@@ -969,39 +1953,39 @@ void Extract::clean(objliststruct *objlist, double clean_param, int *survives)
 
 void Extract::free_catalog_fields(sep_catalog *catalog)
 {
-    free(catalog->thresh);
-    free(catalog->npix);
-    free(catalog->tnpix);
-    free(catalog->xmin);
-    free(catalog->xmax);
-    free(catalog->ymin);
-    free(catalog->ymax);
-    free(catalog->x);
-    free(catalog->y);
-    free(catalog->x2);
-    free(catalog->y2);
-    free(catalog->xy);
-    free(catalog->errx2);
-    free(catalog->erry2);
-    free(catalog->errxy);
-    free(catalog->a);
-    free(catalog->b);
-    free(catalog->theta);
-    free(catalog->cxx);
-    free(catalog->cyy);
-    free(catalog->cxy);
-    free(catalog->cflux);
-    free(catalog->flux);
-    free(catalog->cpeak);
-    free(catalog->peak);
-    free(catalog->xcpeak);
-    free(catalog->ycpeak);
-    free(catalog->xpeak);
-    free(catalog->ypeak);
-    free(catalog->flag);
-
-    free(catalog->pix);
-    free(catalog->objectspix);
+    sep_arena_free(catalog->thresh);
+    sep_arena_free(catalog->npix);
+    sep_arena_free(catalog->tnpix);
+    sep_arena_free(catalog->xmin);
+    sep_arena_free(catalog->xmax);
+    sep_arena_free(catalog->ymin);
+    sep_arena_free(catalog->ymax);
+    sep_arena_free(catalog->x);
+    sep_arena_free(catalog->y);
+    sep_arena_free(catalog->x2);
+    sep_arena_free(catalog->y2);
+    sep_arena_free(catalog->xy);
+    sep_arena_free(catalog->errx2);
+    sep_arena_free(catalog->erry2);
+    sep_arena_free(catalog->errxy);
+    sep_arena_free(catalog->a);
+    sep_arena_free(catalog->b);
+    sep_arena_free(catalog->theta);
+    sep_arena_free(catalog->cxx);
+    sep_arena_free(catalog->cyy);
+    sep_arena_free(catalog->cxy);
+    sep_arena_free(catalog->cflux);
+    sep_arena_free(catalog->flux);
+    sep_arena_free(catalog->cpeak);
+    sep_arena_free(catalog->peak);
+    sep_arena_free(catalog->xcpeak);
+    sep_arena_free(catalog->ycpeak);
+    sep_arena_free(catalog->xpeak);
+    sep_arena_free(catalog->ypeak);
+    sep_arena_free(catalog->flag);
+
+    sep_arena_free(catalog->pix);
+    sep_arena_free(catalog->objectspix);
 
     memset(catalog, 0, sizeof(sep_catalog));
 }
@@ -1042,36 +2026,36 @@ int Extract::convert_to_catalog(objliststruct *objlist, int *survives, sep_catal
 
     /* allocate catalog fields */
     cat->nobj = nobj;
-    QMALLOC(cat->thresh, float, nobj, status);
-    QMALLOC(cat->npix, int, nobj, status);
-    QMALLOC(cat->tnpix, int, nobj, status);
-    QMALLOC(cat->xmin, int, nobj, status);
-    QMALLOC(cat->xmax, int, nobj, status);
-    QMALLOC(cat->ymin, int, nobj, status);
-    QMALLOC(cat->ymax, int, nobj, status);
-    QMALLOC(cat->x, double, nobj, status);
-    QMALLOC(cat->y, double, nobj, status);
-    QMALLOC(cat->x2, double, nobj, status);
-    QMALLOC(cat->y2, double, nobj, status);
-    QMALLOC(cat->xy, double, nobj, status);
-    QMALLOC(cat->errx2, double, nobj, status);
-    QMALLOC(cat->erry2, double, nobj, status);
-    QMALLOC(cat->errxy, double, nobj, status);
-    QMALLOC(cat->a, float, nobj, status);
-    QMALLOC(cat->b, float, nobj, status);
-    QMALLOC(cat->theta, float, nobj, status);
-    QMALLOC(cat->cxx, float, nobj, status);
-    QMALLOC(cat->cyy, float, nobj, status);
-    QMALLOC(cat->cxy, float, nobj, status);
-    QMALLOC(cat->cflux, float, nobj, status);
-    QMALLOC(cat->flux, float, nobj, status);
-    QMALLOC(cat->cpeak, float, nobj, status);
-    QMALLOC(cat->peak, float, nobj, status);
-    QMALLOC(cat->xcpeak, int, nobj, status);
-    QMALLOC(cat->ycpeak, int, nobj, status);
-    QMALLOC(cat->xpeak, int, nobj, status);
-    QMALLOC(cat->ypeak, int, nobj, status);
-    QMALLOC(cat->flag, short, nobj, status);
+    AMALLOC(cat->thresh, float, nobj, status);
+    AMALLOC(cat->npix, int, nobj, status);
+    AMALLOC(cat->tnpix, int, nobj, status);
+    AMALLOC(cat->xmin, int, nobj, status);
+    AMALLOC(cat->xmax, int, nobj, status);
+    AMALLOC(cat->ymin, int, nobj, status);
+    AMALLOC(cat->ymax, int, nobj, status);
+    AMALLOC(cat->x, double, nobj, status);
+    AMALLOC(cat->y, double, nobj, status);
+    AMALLOC(cat->x2, double, nobj, status);
+    AMALLOC(cat->y2, double, nobj, status);
+    AMALLOC(cat->xy, double, nobj, status);
+    AMALLOC(cat->errx2, double, nobj, status);
+    AMALLOC(cat->erry2, double, nobj, status);
+    AMALLOC(cat->errxy, double, nobj, status);
+    AMALLOC(cat->a, float, nobj, status);
+    AMALLOC(cat->b, float, nobj, status);
+    AMALLOC(cat->theta, float, nobj, status);
+    AMALLOC(cat->cxx, float, nobj, status);
+    AMALLOC(cat->cyy, float, nobj, status);
+    AMALLOC(cat->cxy, float, nobj, status);
+    AMALLOC(cat->cflux, float, nobj, status);
+    AMALLOC(cat->flux, float, nobj, status);
+    AMALLOC(cat->cpeak, float, nobj, status);
+    AMALLOC(cat->peak, float, nobj, status);
+    AMALLOC(cat->xcpeak, int, nobj, status);
+    AMALLOC(cat->ycpeak, int, nobj, status);
+    AMALLOC(cat->xpeak, int, nobj, status);
+    AMALLOC(cat->ypeak, int, nobj, status);
+    AMALLOC(cat->flag, short, nobj, status);
 
     /* fill output arrays */
     j = 0;  /* running index in output array */
@@ -1127,10 +2111,10 @@ int Extract::convert_to_catalog(objliststruct *objlist, int *survives, sep_catal
         for (i = 0; i < cat->nobj; i++) totnpix += cat->npix[i];
 
         /* allocate buffer for all objects' pixels */
-        QMALLOC(cat->objectspix, int, totnpix, status);
+        AMALLOC(cat->objectspix, int, totnpix, status);
 
         /* allocate array of pointers into the above buffer */
-        QMALLOC(cat->pix, int*, nobj, status);
+        AMALLOC(cat->pix, int*, nobj, status);
 
         pixel = objlist->plist;
 
@@ -1168,7 +2152,7 @@ void Extract::sep_catalog_free(sep_catalog *catalog)
 {
     if (catalog != NULL)
         free_catalog_fields(catalog);
-    free(catalog);
+    sep_arena_free(catalog);
 }
 
 }
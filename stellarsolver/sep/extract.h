@@ -24,9 +24,14 @@
 
 #include "sep.h"
 #include "sepcore.h"
+#include "parallel.h"
 
 #include <stdint.h>
 #include <cstring>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
 
 namespace SEP
 {
@@ -34,6 +39,47 @@ namespace SEP
 class Lutz;
 class Deblend;
 class Analyze;
+class DeblendQueue;
+
+/* Limits on the deblending of sep_extract(), for extractions that only need
+ * clean positions.  An object is only deblended if it has at least minpix
+ * pixels or is at least minelong times longer than it is wide, and none are
+ * once maxtime ms went into deblending.  A limit of 0 is off.  All of the
+ * extractions of one frame can share it, so that the time is for the frame.
+ * An object whose peak is over saturation is never deblended and is flagged
+ * SEP_OBJ_SATUR, since it is thrown away anyway.  A saturation of 0 is off.
+ * The extractions stop once the steady clock passes deadline, in ns since its
+ * epoch: the scan closes the objects it has, deblend() keeps the object it is
+ * splitting as it is, and no more objects are deblended, so the catalog has
+ * the objects found until then.  expired is set once one of them noticed.
+ * A deadline of 0 is off. */
+typedef struct sep_deblend_limits
+{
+    int minpix;
+    double minelong;
+    double maxtime;
+    double saturation;
+    std::atomic<long long> spent;     /* ns spent deblending so far */
+    std::atomic<int> ndeblended;      /* the objects that were deblended */
+    std::atomic<int> nskipped;        /* and the ones that were not */
+    std::atomic<int> nsaturated;      /* the saturated ones, which are not in nskipped */
+    long long deadline;
+    std::atomic<bool> expired;
+} sep_deblend_limits;
+
+/* Whether the deadline of limits passed, limits can be NULL */
+inline bool sep_limits_expired(sep_deblend_limits *limits)
+{
+    if (!limits || limits->deadline <= 0)
+        return false;
+    if (limits->expired.load(std::memory_order_relaxed))
+        return true;
+    if (std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+            < limits->deadline)
+        return false;
+    limits->expired = true;
+    return true;
+}
 
 class Extract
 {
@@ -48,6 +94,54 @@ class Extract
                         int clean_flag, double clean_param,
                         sep_catalog **catalog);
 
+        /* The same as sep_extract(), but the image is cut into strips that are
+         * extracted on up to `nthreads` threads, see extract.cpp.  It is for a
+         * single image that cannot be partitioned with margins. */
+        int sep_extract_mt(sep_image *image, float thresh, int thresh_type,
+                           int minarea, float *conv, int convw, int convh,
+                           int filter_type, int deblend_nthresh, double deblend_cont,
+                           int clean_flag, double clean_param, int nthreads,
+                           sep_catalog **catalog);
+
+        /* Limits the deblending of the next extractions, NULL deblends everything */
+        void sep_set_deblend_limits(sep_deblend_limits *limits)
+        {
+            deblend_limits = limits;
+        }
+
+        /* Makes the next extractions deblend the objects on up to `nthreads`
+         * other threads while the image is still being scanned.  The threads
+         * are started with runner, or as threads of their own if it is empty,
+         * and an object that no thread can take is deblended on the scanning
+         * thread.  Each object is deblended with its own random seed and the
+         * objects are added to the catalog in the order they were found, so
+         * the catalog is the same for any number of threads above 1.  0 or 1
+         * deblends them on the scanning thread, which is the default.  The
+         * strips of sep_extract_mt() each get the same threads. */
+        void sep_set_deblend_threads(int nthreads, const sep_task_runner &runner = sep_task_runner())
+        {
+            deblend_threads = nthreads;
+            deblend_runner = runner;
+        }
+
+        /* Makes the next extractions read the filtered lines from an image that
+         * was already convolved with the kernel, like the one from the GPU,
+         * instead of convolving them.  stride is the number of pixels from one
+         * line of it to the next.  It is only used for SEP_FILTER_CONV without
+         * a mask, NULL convolves the lines again. */
+        void sep_set_filtered_image(const float *filtered, int stride)
+        {
+            filtered_image = filtered;
+            filtered_stride = stride;
+        }
+
+        /* Convolves a float image without a mask with the kernel, normalized
+         * like sep_extract() normalizes it, into filtered, which has image->w
+         * pixels per line, for sep_set_filtered_image().  The lines are split
+         * between up to `nthreads` threads. */
+        static int sep_filter_image(const sep_image *image, const float *conv, int convw, int convh,
+                                    float *filtered, int nthreads);
+
         static void free_catalog_fields(sep_catalog *catalog);
         static void sep_catalog_free(sep_catalog *catalog);
 
@@ -67,6 +161,8 @@ class Extract
             return extract_pixstack;
         }
 
+        bool should_deblend(objliststruct *objlist) const;
+
         void plistinit(int hasconv, int hasvar);
         void clean(objliststruct *objlist, double clean_param, int *survives);
 
@@ -81,7 +177,9 @@ class Extract
         std::unique_ptr<Deblend> deblend;
         std::unique_ptr<Lutz> lutz;
         std::unique_ptr<Analyze> analyze;
+        std::unique_ptr<DeblendQueue> deblend_queue;
 
+        int collect_catalogs(void *pieces, int npieces, int w, sep_catalog **catalog);
         int convert_to_catalog(objliststruct *objlist, int *survives, sep_catalog *cat, int w, int include_pixels);
         void apply_mask_line(arraybuffer *mbuf, arraybuffer *imbuf, arraybuffer *nbuf);
 
@@ -91,6 +189,11 @@ class Extract
         size_t extract_pixstack = 300000;
         plistvalues plist_values;
         objstruct obj;
+        sep_deblend_limits *deblend_limits = NULL;
+        const float *filtered_image = NULL;
+        int filtered_stride = 0;
+        int deblend_threads = 0;
+        sep_task_runner deblend_runner;
 };
 
 }
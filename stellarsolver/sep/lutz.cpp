@@ -61,13 +61,13 @@ int Lutz::lutzalloc(int width, int height)
     xmin = ymin = 0;
     xmax = width - 1;
     ymax = height - 1;
-    QMALLOC(info, infostruct, stacksize, status);
-    QMALLOC(store, infostruct, stacksize, status);
-    QMALLOC(marker, char, stacksize, status);
-    QMALLOC(psstack, pixstatus, stacksize, status);
-    QMALLOC(start, int, stacksize, status);
-    QMALLOC(end, int, stacksize, status);
-    QMALLOC(discan, int, stacksize, status);
+    AMALLOC(info, infostruct, stacksize, status);
+    AMALLOC(store, infostruct, stacksize, status);
+    AMALLOC(marker, char, stacksize, status);
+    AMALLOC(psstack, pixstatus, stacksize, status);
+    AMALLOC(start, int, stacksize, status);
+    AMALLOC(end, int, stacksize, status);
+    AMALLOC(discan, int, stacksize, status);
     discant = discan;
     for (i = stacksize; i--;)
         *(discant++) = -1;
@@ -86,19 +86,19 @@ Free once for all memory space for buffers used by lutz().
 */
 void Lutz::lutzfree()
 {
-    free(discan);
+    sep_arena_free(discan);
     discan = NULL;
-    free(info);
+    sep_arena_free(info);
     info = NULL;
-    free(store);
+    sep_arena_free(store);
     store = NULL;
-    free(marker);
+    sep_arena_free(marker);
     marker = NULL;
-    free(psstack);
+    sep_arena_free(psstack);
     psstack = NULL;
-    free(start);
+    sep_arena_free(start);
     start = NULL;
-    free(end);
+    sep_arena_free(end);
     end = NULL;
     return;
 }
@@ -146,10 +146,10 @@ int Lutz::lutz(pliststruct *plistin,
     eny++;
 
     /*------Allocate memory to store object data */
-    free(objlist->obj);
+    sep_arena_free(objlist->obj);
     objlist->obj = 0;  //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
 
-    if (!(obj = objlist->obj = (objstruct *)malloc(nobjm * sizeof(objstruct))))
+    if (!(obj = objlist->obj = (objstruct *)sep_arena_malloc(nobjm * sizeof(objstruct))))
     {
         out = MEMORY_ALLOC_ERROR;
         plist = NULL;			/* To avoid gcc -Wall warnings */
@@ -157,11 +157,11 @@ int Lutz::lutz(pliststruct *plistin,
     }
 
     /*------Allocate memory for the pixel list */
-    free(objlist->plist);
+    sep_arena_free(objlist->plist);
     objlist->plist = 0;  //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
 
     if (!(objlist->plist
-            = (pliststruct *)malloc((eny - sty) * (enx - stx) * plistsize)))
+            = (pliststruct *)sep_arena_malloc((eny - sty) * (enx - stx) * plistsize)))
     {
         out = MEMORY_ALLOC_ERROR;
         plist = NULL;			/* To avoid gcc -Wall warnings */
@@ -276,7 +276,7 @@ int Lutz::lutz(pliststruct *plistin,
                             {
                                 if (objlist->nobj >= nobjm)
                                     if (!(obj = objlist->obj = (objstruct *)
-                                                               realloc(obj, (nobjm += nobjm / 2) *
+                                                               sep_arena_realloc(obj, (nobjm += nobjm / 2) *
                                                                        sizeof(objstruct))))
                                     {
                                         out = MEMORY_ALLOC_ERROR;
@@ -327,23 +327,23 @@ exit_lutz:
     if (objlist->nobj && out == RETURN_OK)
     {
         if (!(objlist->obj =
-                    (objstruct *)realloc(obj, objlist->nobj * sizeof(objstruct))))
+                    (objstruct *)sep_arena_realloc(obj, objlist->nobj * sizeof(objstruct))))
             out = MEMORY_ALLOC_ERROR;
     }
     else
     {
-        free(obj);
+        sep_arena_free(obj);
         objlist->obj = NULL;
     }
 
     if (cn && out == RETURN_OK)
     {
-        if (!(objlist->plist = (pliststruct *)realloc(plist, cn)))
+        if (!(objlist->plist = (pliststruct *)sep_arena_realloc(plist, cn)))
             out = MEMORY_ALLOC_ERROR;
     }
     else
     {
-        free(objlist->plist);
+        sep_arena_free(objlist->plist);
         objlist->plist = NULL;
     }
 
@@ -9,6 +9,8 @@
 
 #include <cmath>
 
+#include "simd.h"
+
 namespace SEP
 {
 #if defined(_MSC_VER)
@@ -585,4 +587,143 @@ static double ellipoverlap(double xmin, double ymin, double xmax, double ymax,
                     triangle_unitcircle_overlap(x1, y1, x4, y4, x3, y3));
 }
 
+/*****************************************************************************/
+/* Oversampled overlap of a pixel with an ellipse or an elliptical annulus.
+ *
+ * The pixel is split into subpix x subpix subpixels and the fraction of the
+ * subpixel centers with rin2 < cxx*dx^2 + cyy*dy^2 + cxy*dx*dy < rout2 is
+ * returned, where dx and dy are the offsets of the pixel center from the
+ * center of the ellipse.  A circle is cxx = cyy = 1, cxy = 0 and an aperture
+ * that is not an annulus has a negative rin2.
+ *
+ * The vector versions evaluate a row of subpixels at a time.  They use the
+ * same subpixel positions and the same arithmetic as the scalar version, so
+ * they count the same subpixels. */
+
+#define SUBPIX_MAX 64   /* larger subpix always use the scalar version */
+
+/* The offsets of the subpixel centers along a row.  They are summed up one
+ * subpixel at a time like the scalar loop does.  The row is padded to a
+ * multiple of 4 with NaN, which is never inside. */
+static INLINE int subpix_offsets(double dx, int subpix, double scale, double *xs)
+{
+    int sx, n;
+
+    for (sx = 0; sx < subpix; sx++, dx += scale)
+        xs[sx] = dx;
+    n = (subpix + 3) & ~3;
+    for (; sx < n; sx++)
+        xs[sx] = NAN;
+    return n;
+}
+
+static INLINE double subpixoverlap_scalar(double dx, double dy,
+                                          double cxx, double cyy, double cxy,
+                                          double rin2, double rout2, int subpix)
+{
+    double scale, dx1, dy2, rpix2;
+    int sx, sy, count = 0;
+
+    scale = 1.0 / subpix;
+    dx += 0.5 * (scale - 1.0);
+    dy += 0.5 * (scale - 1.0);
+    for (sy = subpix; sy--; dy += scale)
+    {
+        dx1 = dx;
+        dy2 = dy * dy;
+        for (sx = subpix; sx--; dx1 += scale)
+        {
+            rpix2 = cxx * dx1 * dx1 + cyy * dy2 + cxy * dx1 * dy;
+            if (rpix2 < rout2 && rpix2 > rin2)
+                count++;
+        }
+    }
+    return count * scale * scale;
+}
+
+#ifdef SEP_SIMD_X86
+SEP_TARGET_AVX2 static double subpixoverlap_avx2(double dx, double dy,
+                                                 double cxx, double cyy, double cxy,
+                                                 double rin2, double rout2, int subpix)
+{
+    static const int bits4[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+    double xs[SUBPIX_MAX + 3], scale;
+    int sx, sy, n, count = 0;
+    __m256d vcxx = _mm256_set1_pd(cxx), vcxy = _mm256_set1_pd(cxy);
+    __m256d vrin2 = _mm256_set1_pd(rin2), vrout2 = _mm256_set1_pd(rout2);
+
+    scale = 1.0 / subpix;
+    n = subpix_offsets(dx + 0.5 * (scale - 1.0), subpix, scale, xs);
+    dy += 0.5 * (scale - 1.0);
+    for (sy = subpix; sy--; dy += scale)
+    {
+        __m256d vdy = _mm256_set1_pd(dy);
+        __m256d vdy2 = _mm256_set1_pd(cyy * (dy * dy));
+        for (sx = 0; sx < n; sx += 4)
+        {
+            __m256d x1 = _mm256_loadu_pd(xs + sx);
+            __m256d rpix2 = _mm256_add_pd(
+                _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(vcxx, x1), x1), vdy2),
+                _mm256_mul_pd(_mm256_mul_pd(vcxy, x1), vdy));
+            __m256d in = _mm256_and_pd(_mm256_cmp_pd(rpix2, vrout2, _CMP_LT_OQ),
+                                       _mm256_cmp_pd(rpix2, vrin2, _CMP_GT_OQ));
+            count += bits4[_mm256_movemask_pd(in)];
+        }
+    }
+    return count * scale * scale;
+}
+#endif
+
+#ifdef SEP_SIMD_ARM
+static double subpixoverlap_neon(double dx, double dy,
+                                 double cxx, double cyy, double cxy,
+                                 double rin2, double rout2, int subpix)
+{
+    double xs[SUBPIX_MAX + 3], scale;
+    int sx, sy, n;
+    uint64x2_t count = vdupq_n_u64(0);
+    float64x2_t vcxx = vdupq_n_f64(cxx), vcxy = vdupq_n_f64(cxy);
+    float64x2_t vrin2 = vdupq_n_f64(rin2), vrout2 = vdupq_n_f64(rout2);
+
+    scale = 1.0 / subpix;
+    n = subpix_offsets(dx + 0.5 * (scale - 1.0), subpix, scale, xs);
+    dy += 0.5 * (scale - 1.0);
+    for (sy = subpix; sy--; dy += scale)
+    {
+        float64x2_t vdy = vdupq_n_f64(dy);
+        float64x2_t vdy2 = vdupq_n_f64(cyy * (dy * dy));
+        for (sx = 0; sx < n; sx += 2)
+        {
+            float64x2_t x1 = vld1q_f64(xs + sx);
+            float64x2_t rpix2 = vaddq_f64(vaddq_f64(vmulq_f64(vmulq_f64(vcxx, x1), x1), vdy2),
+                                          vmulq_f64(vmulq_f64(vcxy, x1), vdy));
+            /* the lanes that are inside are all ones, which is -1 */
+            count = vsubq_u64(count, vandq_u64(vcltq_f64(rpix2, vrout2), vcgtq_f64(rpix2, vrin2)));
+        }
+    }
+    return (double)vaddvq_u64(count) * scale * scale;
+}
+#endif
+
+static INLINE double subpixoverlap(double dx, double dy,
+                                   double cxx, double cyy, double cxy,
+                                   double rin2, double rout2, int subpix)
+{
+    if (subpix <= SUBPIX_MAX)
+        switch (sep_simd())
+        {
+#ifdef SEP_SIMD_X86
+            case SEP_SIMD_AVX2:
+                return subpixoverlap_avx2(dx, dy, cxx, cyy, cxy, rin2, rout2, subpix);
+#endif
+#ifdef SEP_SIMD_ARM
+            case SEP_SIMD_NEON:
+                return subpixoverlap_neon(dx, dy, cxx, cyy, cxy, rin2, rout2, subpix);
+#endif
+            default:
+                break;
+        }
+    return subpixoverlap_scalar(dx, dy, cxx, cyy, cxy, rin2, rout2, subpix);
+}
+
 }
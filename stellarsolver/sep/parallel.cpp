@@ -0,0 +1,140 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+*
+* This file is part of SEP
+*
+* Copyright 2014 SEP developers
+*
+* SEP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SEP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with SEP.  If not, see <http://www.gnu.org/licenses/>.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#include "parallel.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace SEP
+{
+
+namespace
+{
+
+/* The state of a loop that its helpers share.  A helper that starts after
+ * the loop returned finds no pieces left, and never touches the function. */
+struct ParallelLoop
+{
+    ParallelLoop(int npieces, const std::function<void(int)> &piece, const sep_task_runner &runner)
+        : npieces(npieces), piece(piece), runner(runner)
+    {
+    }
+
+    const int npieces;
+    const std::function<void(int)> piece;
+    const sep_task_runner runner;
+    std::atomic<int> next{0};   /* the next piece to take */
+    std::mutex mutex;
+    std::condition_variable finished;
+    int done = 0;               /* the pieces that are done, under mutex */
+};
+
+sep_task_runner &threadRunner()
+{
+    static thread_local sep_task_runner runner;
+    return runner;
+}
+
+/* Takes and runs pieces until none are left. */
+void runPieces(ParallelLoop &loop)
+{
+    int i;
+    while ((i = loop.next.fetch_add(1)) < loop.npieces)
+    {
+        loop.piece(i);
+        std::lock_guard<std::mutex> lock(loop.mutex);
+        if (++loop.done == loop.npieces)
+            loop.finished.notify_all();
+    }
+}
+
+}
+
+RunnerScope::RunnerScope(const sep_task_runner &runner)
+    : previous(threadRunner())
+{
+    threadRunner() = runner;
+}
+
+RunnerScope::~RunnerScope()
+{
+    threadRunner() = previous;
+}
+
+sep_task_runner sep_thread_runner()
+{
+    return threadRunner();
+}
+
+void sep_parallel_for(int npieces, int nthreads, const std::function<void(int)> &piece)
+{
+    int t;
+
+    if (nthreads > npieces)
+        nthreads = npieces;
+    if (nthreads <= 1)
+    {
+        for (t = 0; t < npieces; t++)
+            piece(t);
+        return;
+    }
+
+    const sep_task_runner &runner = threadRunner();
+    std::shared_ptr<ParallelLoop> loop = std::make_shared<ParallelLoop>(npieces, piece, runner);
+    if (!runner)
+    {
+        std::vector<std::thread> threads;
+        for (t = 1; t < nthreads; t++)
+            threads.emplace_back([loop]()
+        {
+            runPieces(*loop);
+        });
+        runPieces(*loop);
+        for (auto &thread : threads)
+            thread.join();
+        return;
+    }
+
+    /* a helper that the runner could not start means the pool is full */
+    const std::function<void()> helper = [loop]()
+    {
+        RunnerScope scope(loop->runner);
+        runPieces(*loop);
+    };
+    for (t = 1; t < nthreads; t++)
+        if (!runner(helper))
+            break;
+    runPieces(*loop);
+
+    /* only the pieces that a started helper took are left to wait for */
+    std::unique_lock<std::mutex> lock(loop->mutex);
+    loop->finished.wait(lock, [&]()
+    {
+        return loop->done == loop->npieces;
+    });
+}
+
+}
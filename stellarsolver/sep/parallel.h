@@ -0,0 +1,72 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+*
+* This file is part of SEP
+*
+* Copyright 2014 SEP developers
+*
+* SEP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SEP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with SEP.  If not, see <http://www.gnu.org/licenses/>.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#pragma once
+
+#include <functional>
+
+/* Parallel loops for the SEP functions that take a number of threads.
+ *
+ * sep_parallel_for() runs the pieces of a loop on the calling thread and on
+ * up to nthreads - 1 helpers.  The helpers are started with the task runner
+ * of the calling thread, if a RunnerScope set one, so a program can run them
+ * on its own pool: a helper that the runner can not start right away is not
+ * waited for, the caller and the helpers that did start take its pieces.
+ * While a helper runs, the same runner is set on its thread, so the SEP
+ * functions it calls start their helpers the same way.
+ *
+ * Without a runner, the helpers are threads of their own that are joined
+ * before sep_parallel_for() returns, so SEP still works the same when it is
+ * used on its own.
+ */
+
+namespace SEP
+{
+
+/* Starts a function on another thread and returns true, or returns false
+ * without running it when no thread is free right now.  It lets a program
+ * run the helper threads of SEP on its own pool. */
+typedef std::function<bool(const std::function<void()> &)> sep_task_runner;
+
+/* Sets the task runner of this thread, and puts back the one before it when
+ * it is destroyed.  Scopes can be nested, an empty runner unsets it. */
+class RunnerScope
+{
+    public:
+        explicit RunnerScope(const sep_task_runner &runner);
+        ~RunnerScope();
+
+        RunnerScope(const RunnerScope &) = delete;
+        RunnerScope &operator=(const RunnerScope &) = delete;
+
+    private:
+        sep_task_runner previous;
+};
+
+/* The task runner of this thread, or an empty one. */
+sep_task_runner sep_thread_runner();
+
+/* Runs piece(0) to piece(npieces - 1) on up to nthreads threads, the calling
+ * thread included, and returns when all of them are done.  Which thread runs
+ * a piece is not fixed, so the pieces must only depend on their index. */
+void sep_parallel_for(int npieces, int nthreads, const std::function<void(int)> &piece);
+
+}
@@ -38,6 +38,7 @@ namespace SEP
 #define SEP_OBJ_TRUNC        0x0002  /* object truncated at image boundary */
 #define SEP_OBJ_DOVERFLOW    0x0004  /* not currently used, but could be */
 #define SEP_OBJ_SINGU        0x0008  /* x,y fully correlated */
+#define SEP_OBJ_SATUR        0x0100  /* peak over the saturation of the deblend limits */  //# Modified for the StellarSolver Internal Library
 #define SEP_APER_TRUNC       0x0010
 #define SEP_APER_HASMASKED   0x0020
 #define SEP_APER_ALLMASKED   0x0040
@@ -161,6 +162,36 @@ int sep_background(sep_image *image,
                    double fthresh,   /* filter threshold                 */
                    sep_bkg **bkg);   /* OUTPUT                           */
 
+/* sep_background_mt()
+ *
+ * The same as sep_background(), but the statistics of the background tiles
+ * are computed on up to `nthreads` threads at the same time.
+ */
+int sep_background_mt(sep_image *image,
+                      int bw, int bh,   /* size of a single background tile */
+                      int fw, int fh,   /* filter size in tiles             */
+                      double fthresh,   /* filter threshold                 */
+                      int nthreads,     /* number of threads to use         */
+                      sep_bkg **bkg);   /* OUTPUT                           */
+
+/* sep_background_sampled()
+ *
+ * The same as sep_background_mt(), but the statistics of each tile come
+ * from every `step`th pixel of every `step`th line of it, which reads about
+ * 1 / step^2 of the image, for uses like threshold selection and monitoring
+ * the sky level that only need the background.  The step is capped so that
+ * a whole tile keeps at least 256 samples.  A row of tiles where any tile
+ * has too few good samples, like a masked or crowded one, is done again
+ * with every pixel.  A step of 1 is exactly sep_background_mt().
+ */
+int sep_background_sampled(sep_image *image,
+                           int bw, int bh,   /* size of a single background tile */
+                           int fw, int fh,   /* filter size in tiles             */
+                           double fthresh,   /* filter threshold                 */
+                           int step,         /* sampling step in pixels          */
+                           int nthreads,     /* number of threads to use         */
+                           sep_bkg **bkg);   /* OUTPUT                           */
+
 
 /* sep_bkg_global[rms]()
  *
@@ -201,6 +232,14 @@ int sep_bkg_array(sep_bkg *bkg, void *arr, int dtype);
 int sep_bkg_subarray(sep_bkg *bkg, void *arr, int dtype);
 int sep_bkg_rmsarray(sep_bkg *bkg, void *arr, int dtype);
 
+/* sep_bkg_subarray_mt()
+ *
+ * The same as sep_bkg_subarray(), but the lines are split between up to
+ * `nthreads` threads.  Each line is evaluated and subtracted in place, so
+ * no array for the whole background is needed.
+ */
+int sep_bkg_subarray_mt(sep_bkg *bkg, void *arr, int dtype, int nthreads);
+
 /* sep_bkg_free()
  *
  * Free memory associated with bkg.
@@ -239,6 +278,20 @@ int sep_sum_circle(sep_image *image,
                    short *flag);      /* OUTPUT: flags */
 
 
+/* sep_set_aper_mask_buckets()
+ * sep_get_aper_mask_buckets()
+ *
+ * Precomputed weight masks for sep_sum_circle().  With buckets > 0 the
+ * fractional position of the center of a circle is rounded to the middle of
+ * one of buckets x buckets cells of a pixel, and the weights of its pixels
+ * are computed once for each cell, radius and subpix, so measuring many
+ * objects with the same radius reuses them.  The rounding moves the circle
+ * by up to 0.5/buckets pixels, so the sums are approximate.  It is 0, off,
+ * by default.
+ */
+void sep_set_aper_mask_buckets(int buckets);
+int sep_get_aper_mask_buckets();
+
 int sep_sum_circann(sep_image *image,
                     double x, double y, double rin, double rout,
                     int id, int subpix, short inflags,
@@ -315,6 +368,48 @@ int sep_kron_radius(sep_image *im, double x, double y,
                     double cxx, double cyy, double cxy, double r, int id,
                     double *kronrad, short *flag);
 
+/* Batched aperture photometry
+ *
+ * The same as calling sep_kron_radius(), sep_sum_circle(), sep_sum_ellipse(),
+ * sep_flux_radius() or sep_windowed() for each of the n objects, with the per object inputs
+ * and outputs in arrays.  The objects are measured on up to `nthreads`
+ * threads at the same time.
+ *
+ * id :     array of segmentation ids, or NULL for 0 on every object.
+ * r :      (sep_flux_radius_batch) output array of n * nfrac radii, the
+ *          nfrac radii of object i start at r[i * nfrac].
+ * fluxtot: (sep_flux_radius_batch) array of total fluxes, or NULL to use
+ *          the flux within rmax for each object.
+ *
+ * The return value is the first error.  The other objects are still
+ * measured, and the outputs of an object with an error are set to zero.
+ */
+int sep_kron_radius_batch(sep_image *im, int n, const double *x, const double *y,
+                          const double *cxx, const double *cyy, const double *cxy,
+                          double r, const int *id, double *kronrad, short *flag,
+                          int nthreads);
+
+int sep_sum_circle_batch(sep_image *im, int n, const double *x, const double *y,
+                         const double *r, const int *id, int subpix, short inflag,
+                         double *sum, double *sumerr, double *area, short *flag,
+                         int nthreads);
+
+int sep_sum_ellipse_batch(sep_image *im, int n, const double *x, const double *y,
+                          const double *a, const double *b, const double *theta,
+                          const double *r, const int *id, int subpix, short inflag,
+                          double *sum, double *sumerr, double *area, short *flag,
+                          int nthreads);
+
+int sep_flux_radius_batch(sep_image *im, int n, const double *x, const double *y,
+                          double rmax, const int *id, int subpix, short inflag,
+                          const double *fluxtot, const double *fluxfrac, int nfrac,
+                          double *r, short *flag, int nthreads);
+
+int sep_windowed_batch(sep_image *im, int n, const double *x, const double *y,
+                       const double *sig, int subpix, short inflag,
+                       double *xout, double *yout, int *niter, short *flag,
+                       int nthreads);
+
 
 /* sep_windowed()
  *
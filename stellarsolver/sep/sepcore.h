@@ -25,6 +25,8 @@
 #include <cstring>
 #include <memory>
 
+#include "arena.h"
+
 namespace SEP
 {
 #define	RETURN_OK           0  /* must be zero */
@@ -73,6 +75,24 @@ typedef void (*array_writer)(float *ptr, int n, void *target);
       };								\
   }
 
+/* The same, but from the arena in arena.h.  This is used for the extraction
+ * temporaries, memory from them must be freed with sep_arena_free(). */
+#define	ACALLOC(ptr, typ, nel, status)				     	\
+  {if (!(ptr = (typ *)sep_arena_calloc((size_t)(nel),sizeof(typ))))	\
+      {									\
+    status = MEMORY_ALLOC_ERROR;					\
+    goto exit;							\
+      };								\
+  }
+
+#define	AMALLOC(ptr, typ, nel, status)					\
+  {if (!(ptr = (typ *)sep_arena_malloc((size_t)(nel)*sizeof(typ))))	\
+      {									\
+    status = MEMORY_ALLOC_ERROR;					\
+    goto exit;							\
+      };								\
+  }
+
 #define	UNKNOWN	        -1    /* flag for LUTZ */
 #define	CLEAN_ZONE      10.0  /* zone (in sigma) to consider for processing */
 #define CLEAN_STACKSIZE 3000  /* replaces prefs.clean_stacksize  */
@@ -204,7 +224,13 @@ int get_array_subtractor(int dtype, array_writer *f, int *size);
 
 int addobjdeep(int objnb, objliststruct *objl1, objliststruct *objl2, int plistsize);
 
-int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh, PIXTYPE *out);
+#define CONV_SEPARABLE_MAX 64  /* biggest kernel side that convolve() will separate */
+
+int separate_kernel(const float *conv, int convw, int convh, float *col, float *row);
+void convolve_rows(const PIXTYPE *data, size_t stride, int w, int h, int y, const float *conv, int convw, int convh,
+                   const float *col, const float *row, PIXTYPE *work, PIXTYPE *out);
+int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh, const float *col, const float *row,
+             PIXTYPE *work, PIXTYPE *out);
 int matched_filter(arraybuffer *imbuf, arraybuffer *nbuf, int y, float *conv, int convw, int convh,
                    PIXTYPE *work, PIXTYPE *out, int noise_type);
 
@@ -0,0 +1,62 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+*
+* This file is part of SEP
+*
+* Copyright 2014 SEP developers
+*
+* SEP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SEP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with SEP.  If not, see <http://www.gnu.org/licenses/>.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#pragma once
+
+/* Vector instructions used by the convolution and background code.
+ *
+ * The AVX2 functions are compiled with a target attribute, so no special
+ * compiler flags are needed, and they are only called when sep_simd() says
+ * the CPU has AVX2.  NEON is always there on 64 bit ARM.
+ */
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SEP_SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SEP_TARGET_AVX2
+#else
+#define SEP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define SEP_SIMD_ARM
+#include <arm_neon.h>
+#endif
+
+namespace SEP
+{
+
+enum
+{
+    SEP_SIMD_NONE = 0,
+    SEP_SIMD_AVX2,
+    SEP_SIMD_NEON
+};
+
+/* The vector instruction set to use, SEP_SIMD_NONE means the scalar code. */
+int sep_simd();
+
+/* Turns the vector code on or off.  It is on by default when the CPU supports
+ * it, off means the scalar reference code is used everywhere. */
+void set_sep_simd(int enable);
+
+}
@@ -21,6 +21,7 @@
 #include <string.h>
 #include "sep.h"
 #include "sepcore.h"
+#include "simd.h"
 
 #define DETAILSIZE 512
 
@@ -405,4 +406,43 @@ earlyexit:
     return MEMORY_ALLOC_ERROR;
 }
 
+/*****************************************************************************/
+/* vector instruction support */
+
+static int sep_simd_enabled = 1;
+
+/* Find out once which vector instructions this CPU has. */
+static int detect_simd()
+{
+#if defined(SEP_SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return SEP_SIMD_NONE;
+    __cpuid(info, 1);
+    /* AVX and OSXSAVE, and the OS has to save the YMM registers */
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+        return SEP_SIMD_NONE;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) ? SEP_SIMD_AVX2 : SEP_SIMD_NONE;
+#elif defined(SEP_SIMD_X86)
+    return __builtin_cpu_supports("avx2") ? SEP_SIMD_AVX2 : SEP_SIMD_NONE;
+#elif defined(SEP_SIMD_ARM)
+    return SEP_SIMD_NEON;
+#else
+    return SEP_SIMD_NONE;
+#endif
+}
+
+int sep_simd()
+{
+    static const int detected = detect_simd();
+    return sep_simd_enabled ? detected : SEP_SIMD_NONE;
+}
+
+void set_sep_simd(int enable)
+{
+    sep_simd_enabled = enable;
+}
+
 }
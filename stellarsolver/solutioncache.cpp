@@ -0,0 +1,281 @@
+/*  SolutionCache, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "solutioncache.h"
+
+#include <algorithm>
+#include <cmath>
+
+//QT Includes
+#include <QFileInfo>
+#include <QSettings>
+#include <QStringList>
+#include <QVariantList>
+
+namespace
+{
+// The width of the grid the code values are rounded to, the positions of the stars have to move by about this fraction of the
+// length of the quad to change the code
+const double codeStep = 0.01;
+// Quads smaller than this many pixels are too sensitive to the errors of the positions
+const double minQuadSize = 10;
+
+// A code value rounded to the grid, the values of the quads are between about -0.5 and 1.5 so they fit in a byte
+quint32 codeBin(double value)
+{
+    const int bin = static_cast<int>(std::floor(value / codeStep)) + 64;
+    return static_cast<quint32>(qBound(0, bin, 255));
+}
+
+QVariantList toList(const double *values, int count)
+{
+    QVariantList list;
+    for(int i = 0; i < count; i++)
+        list.append(values[i]);
+    return list;
+}
+
+void fromList(const QVariant &value, double *values, int count)
+{
+    const QVariantList list = value.toList();
+    for(int i = 0; i < count && i < list.count(); i++)
+        values[i] = list.at(i).toDouble();
+}
+}
+
+SolutionCache::SolutionCache(const QString &file) : m_File(file)
+{
+    load();
+}
+
+SolutionCache::~SolutionCache()
+{
+    if(m_Changed)
+        save();
+}
+
+QVector<quint32> SolutionCache::fingerprint(const QList<FITSImage::Star> &stars)
+{
+    QList<FITSImage::Star> brightest = stars;
+    std::sort(brightest.begin(), brightest.end(), [](const FITSImage::Star & a, const FITSImage::Star & b)
+    {
+        return a.flux > b.flux;
+    });
+    const int n = std::min(static_cast<int>(brightest.count()), static_cast<int>(FINGERPRINT_STARS));
+    QVector<quint32> codes;
+    if(n < 4)
+        return codes;
+
+    // Every quad of the brightest stars, where A and B are the stars furthest apart and C and D are in the frame where A is (0, 0)
+    // and B is (1, 0), like the codes of the index files, so the codes are the same whatever the position, rotation and scale.
+    for(int i = 0; i < n; i++)
+        for(int j = i + 1; j < n; j++)
+            for(int k = j + 1; k < n; k++)
+                for(int l = k + 1; l < n; l++)
+                {
+                    const FITSImage::Star *quad[4] = {&brightest.at(i), &brightest.at(j), &brightest.at(k), &brightest.at(l)};
+                    int a = 0, b = 1;
+                    double longest = -1;
+                    for(int p = 0; p < 4; p++)
+                        for(int q = p + 1; q < 4; q++)
+                        {
+                            const double dx = quad[q]->x - quad[p]->x;
+                            const double dy = quad[q]->y - quad[p]->y;
+                            if(dx * dx + dy * dy > longest)
+                            {
+                                longest = dx * dx + dy * dy;
+                                a = p;
+                                b = q;
+                            }
+                        }
+                    if(longest < minQuadSize * minQuadSize)
+                        continue;
+                    int others[2], o = 0;
+                    for(int p = 0; p < 4; p++)
+                        if(p != a && p != b)
+                            others[o++] = p;
+
+                    const double abx = quad[b]->x - quad[a]->x;
+                    const double aby = quad[b]->y - quad[a]->y;
+                    double cx[2], cy[2];
+                    for(int p = 0; p < 2; p++)
+                    {
+                        const double vx = quad[others[p]]->x - quad[a]->x;
+                        const double vy = quad[others[p]]->y - quad[a]->y;
+                        cx[p] = (vx * abx + vy * aby) / longest;
+                        cy[p] = (abx * vy - aby * vx) / longest;
+                    }
+                    // Swapping A and B turns (x, y) into (1 - x, -y), the order with the smaller sum of x is used, and C is the one
+                    // with the smaller x
+                    if(cx[0] + cx[1] > 1)
+                    {
+                        for(int p = 0; p < 2; p++)
+                        {
+                            cx[p] = 1 - cx[p];
+                            cy[p] = -cy[p];
+                        }
+                    }
+                    if(cx[1] < cx[0])
+                    {
+                        std::swap(cx[0], cx[1]);
+                        std::swap(cy[0], cy[1]);
+                    }
+                    codes.append(codeBin(cx[0]) << 24 | codeBin(cy[0]) << 16 | codeBin(cx[1]) << 8 | codeBin(cy[1]));
+                }
+    std::sort(codes.begin(), codes.end());
+    codes.erase(std::unique(codes.begin(), codes.end()), codes.end());
+    return codes;
+}
+
+int SolutionCache::sharedCodes(const QVector<quint32> &a, const QVector<quint32> &b)
+{
+    int shared = 0;
+    auto i = a.constBegin();
+    auto j = b.constBegin();
+    while(i != a.constEnd() && j != b.constEnd())
+    {
+        if(*i < *j)
+            ++i;
+        else if(*j < *i)
+            ++j;
+        else
+        {
+            shared++;
+            ++i;
+            ++j;
+        }
+    }
+    return shared;
+}
+
+bool SolutionCache::lookup(const QList<FITSImage::Star> &stars, double imagew, double imageh, TanWCS &wcs)
+{
+    const QVector<quint32> codes = fingerprint(stars);
+    if(codes.isEmpty())
+        return false;
+    QMutexLocker locker(&m_Mutex);
+    int best = -1;
+    int bestShared = MIN_SHARED_CODES - 1;
+    for(int i = 0; i < m_Entries.count(); i++)
+    {
+        const Entry &entry = m_Entries.at(i);
+        if(fabs(entry.wcs.imagew - imagew) > 1 || fabs(entry.wcs.imageh - imageh) > 1)
+            continue;
+        const int shared = sharedCodes(codes, entry.codes);
+        if(shared > bestShared)
+        {
+            best = i;
+            bestShared = shared;
+        }
+    }
+    if(best < 0)
+        return false;
+    m_Entries[best].used = QDateTime::currentDateTimeUtc();
+    m_Changed = true;
+    wcs = m_Entries.at(best).wcs;
+    return true;
+}
+
+void SolutionCache::insert(const QList<FITSImage::Star> &stars, const TanWCS &wcs)
+{
+    Entry entry;
+    entry.codes = fingerprint(stars);
+    if(entry.codes.count() < MIN_SHARED_CODES)
+        return;
+    entry.wcs = wcs;
+    entry.used = QDateTime::currentDateTimeUtc();
+
+    QMutexLocker locker(&m_Mutex);
+    // The solution of the same pattern is replaced, so a target that is solved every night is only remembered once
+    for(int i = m_Entries.count() - 1; i >= 0; i--)
+    {
+        const Entry &old = m_Entries.at(i);
+        if(fabs(old.wcs.imagew - wcs.imagew) <= 1 && fabs(old.wcs.imageh - wcs.imageh) <= 1
+                && sharedCodes(entry.codes, old.codes) >= MIN_SHARED_CODES)
+            m_Entries.removeAt(i);
+    }
+    m_Entries.append(entry);
+    if(m_Entries.count() > MAX_ENTRIES)
+    {
+        auto oldest = std::min_element(m_Entries.begin(), m_Entries.end(), [](const Entry & a, const Entry & b)
+        {
+            return a.used < b.used;
+        });
+        m_Entries.erase(oldest);
+    }
+    m_Changed = true;
+}
+
+int SolutionCache::count() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_Entries.count();
+}
+
+void SolutionCache::clear()
+{
+    QMutexLocker locker(&m_Mutex);
+    m_Entries.clear();
+    m_Changed = true;
+}
+
+void SolutionCache::load()
+{
+    if(m_File.isEmpty() || !QFileInfo::exists(m_File))
+        return;
+    QSettings settings(m_File, QSettings::IniFormat);
+    for(const QString &group : settings.childGroups())
+    {
+        settings.beginGroup(group);
+        Entry entry;
+        for(const QString &code : settings.value("codes").toString().split(' '))
+        {
+            bool ok = false;
+            const quint32 value = code.toUInt(&ok, 16);
+            if(ok)
+                entry.codes.append(value);
+        }
+        std::sort(entry.codes.begin(), entry.codes.end());
+        fromList(settings.value("crval"), entry.wcs.crval, 2);
+        fromList(settings.value("crpix"), entry.wcs.crpix, 2);
+        fromList(settings.value("cd"), &entry.wcs.cd[0][0], 4);
+        entry.wcs.imagew = settings.value("imagew", 0).toDouble();
+        entry.wcs.imageh = settings.value("imageh", 0).toDouble();
+        entry.used = settings.value("used").toDateTime();
+        settings.endGroup();
+        if(entry.codes.count() >= MIN_SHARED_CODES)
+            m_Entries.append(entry);
+    }
+}
+
+bool SolutionCache::save() const
+{
+    if(m_File.isEmpty())
+        return false;
+    QMutexLocker locker(&m_Mutex);
+    QSettings settings(m_File, QSettings::IniFormat);
+    settings.clear();
+    int groupNumber = 0;
+    for(const Entry &entry : m_Entries)
+    {
+        QStringList codes;
+        for(quint32 code : entry.codes)
+            codes.append(QString::number(code, 16));
+        settings.beginGroup(QString("Solution%1").arg(++groupNumber));
+        settings.setValue("codes", codes.join(' '));
+        settings.setValue("crval", toList(entry.wcs.crval, 2));
+        settings.setValue("crpix", toList(entry.wcs.crpix, 2));
+        settings.setValue("cd", toList(&entry.wcs.cd[0][0], 4));
+        settings.setValue("imagew", entry.wcs.imagew);
+        settings.setValue("imageh", entry.wcs.imageh);
+        settings.setValue("used", entry.used);
+        settings.endGroup();
+    }
+    settings.sync();
+    m_Changed = settings.status() != QSettings::NoError;
+    return !m_Changed;
+}
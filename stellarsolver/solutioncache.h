@@ -0,0 +1,114 @@
+/*  SolutionCache, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QDateTime>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+#include "structuredefinitions.h"
+
+/**
+ * @brief The SolutionCache class remembers the solutions of the star patterns that were solved before, so that the same targets
+ * solve night after night without searching the indexes.  The fingerprint of an image is the set of the quad codes of its brightest
+ * stars, which are the same whatever the position, rotation and scale of the stars, rounded to a grid.  When most of the stars are
+ * found again, many of the codes are the same, and the solution of the image it shares the most codes with is verified first.
+ * If it doesn't fit, the indexes are searched as usual.  The cache is saved to a file and loaded from it again.
+ * It is thread safe, so the StellarSolvers and the child solvers of a parallel solve can share one.
+ */
+class SolutionCache
+{
+    public:
+        /**
+         * @brief The TanWCS struct is a TAN projection in the pixels of the full resolution image, like the tan_t of astrometry.net
+         */
+        struct TanWCS
+        {
+            double crval[2] {0, 0};     // RA and Dec of the reference point in degrees
+            double crpix[2] {0, 0};     // The reference pixel
+            double cd[2][2] {{0, 0}, {0, 0}};   // The degrees per pixel matrix
+            double imagew {0};
+            double imageh {0};
+        };
+
+        /**
+         * @brief SolutionCache makes a cache that loads the solutions it saved before
+         * @param file is the file to save the cache in, or an empty string for a cache that is not saved
+         */
+        explicit SolutionCache(const QString &file = QString());
+
+        /**
+         * @brief ~SolutionCache saves the cache if it changed
+         */
+        ~SolutionCache();
+
+        /**
+         * @brief fingerprint gets the fingerprint of the brightest stars of an image
+         * @param stars The stars, in any order
+         * @return The sorted codes, empty if there are too few stars
+         */
+        static QVector<quint32> fingerprint(const QList<FITSImage::Star> &stars);
+
+        /**
+         * @brief lookup finds the solution of the image that shares the most codes with the stars
+         * @param stars The stars of the image to solve
+         * @param imagew, imageh The size of the full resolution image, only solutions of images of the same size are used
+         * @param wcs Gets the solution
+         * @return Whether there was one with at least MIN_SHARED_CODES codes in common, it is then the last one used
+         */
+        bool lookup(const QList<FITSImage::Star> &stars, double imagew, double imageh, TanWCS &wcs);
+
+        /**
+         * @brief insert remembers the solution of an image, it replaces the one of the same pattern if there was one
+         * @param stars The stars of the image that was solved
+         * @param wcs The solution
+         */
+        void insert(const QList<FITSImage::Star> &stars, const TanWCS &wcs);
+
+        /**
+         * @brief count gets how many solutions are remembered
+         */
+        int count() const;
+
+        /**
+         * @brief clear forgets all of the solutions
+         */
+        void clear();
+
+        /**
+         * @brief save saves the cache to its file
+         * @return Whether it was saved
+         */
+        bool save() const;
+
+        // The most solutions that are remembered, the ones used longest ago are forgotten first
+        static const int MAX_ENTRIES = 2000;
+        // The number of brightest stars the quads of the fingerprint are made from
+        static const int FINGERPRINT_STARS = 10;
+        // How many codes an image needs to have in common with a solution to try it
+        static const int MIN_SHARED_CODES = 8;
+
+    private:
+        struct Entry
+        {
+            QVector<quint32> codes;     // Sorted
+            TanWCS wcs;
+            QDateTime used;
+        };
+
+        static int sharedCodes(const QVector<quint32> &a, const QVector<quint32> &b);
+        void load();
+
+        QString m_File;
+        QList<Entry> m_Entries;
+        mutable QMutex m_Mutex;
+        mutable bool m_Changed { false };
+};
@@ -0,0 +1,257 @@
+/*  SolverThreadPool, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "solverthreadpool.h"
+#include <QDir>
+#include <QFile>
+#include <QRegularExpression>
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+// The cores that are this much slower than the fastest one are efficiency cores, the ones in between only boost a little less
+const double EFFICIENCY_SPEED = 0.9;
+
+// The speed of each core relative to the fastest one, read once.  A value the kernel doesn't give for one of the cores makes them all 1,
+// since the speeds can't be compared without it.
+QVector<double> readCoreSpeeds()
+{
+    const int count = QThread::idealThreadCount();
+    QVector<double> speeds(count, 1.0);
+#if defined(__linux__)
+    for(const char *name : {"cpu_capacity", "cpufreq/cpuinfo_max_freq"})
+    {
+        QVector<double> values;
+        for(int core = 0; core < count; core++)
+        {
+            QFile file(QString("/sys/devices/system/cpu/cpu%1/%2").arg(core).arg(name));
+            bool ok = false;
+            const double value = file.open(QIODevice::ReadOnly) ? QString::fromLatin1(file.readAll()).trimmed().toDouble(&ok) : 0;
+            if(!ok || value <= 0)
+                break;
+            values.append(value);
+        }
+        if(values.size() == count && count > 0)
+        {
+            const double fastest = *std::max_element(values.begin(), values.end());
+            for(int core = 0; core < count; core++)
+                speeds[core] = values[core] / fastest;
+            break;
+        }
+    }
+#endif
+    return speeds;
+}
+
+const QVector<double> &coreSpeeds()
+{
+    static const QVector<double> speeds = readCoreSpeeds();
+    return speeds;
+}
+}
+
+SolverThreadPool::SolverThreadPool(int maxThreads, QThread::Priority priority, const QVector<int> &cores)
+    : m_MaxThreads(maxThreads > 0 ? maxThreads : (cores.isEmpty() ? QThread::idealThreadCount() : cores.size())), m_Priority(priority),
+      m_Cores(cores), m_FreeSlots(m_MaxThreads)
+{
+    m_ThreadPool.setMaxThreadCount(m_MaxThreads);
+
+    // The threads can run on any of the cores, so the work that goes to a thread can be as slow as the slowest of them,
+    // and there are only as many of the cores working for the pool as it has threads
+    const QVector<int> poolCores = cores.isEmpty() ? coresOf(ANY_CORES) : cores;
+    double speed = 0;
+    m_SlowestSpeed = 1;
+    for(int core : poolCores)
+    {
+        speed += coreSpeed(core);
+        m_SlowestSpeed = std::min(m_SlowestSpeed, coreSpeed(core));
+    }
+    m_Capacity = poolCores.isEmpty() ? m_MaxThreads : speed * std::min(1.0, static_cast<double>(m_MaxThreads) / poolCores.size());
+}
+
+QSharedPointer<SolverThreadPool> SolverThreadPool::processPool()
+{
+    static QSharedPointer<SolverThreadPool> pool(new SolverThreadPool());
+    return pool;
+}
+
+QSharedPointer<SolverThreadPool> SolverThreadPool::powerSavingPool()
+{
+    static QSharedPointer<SolverThreadPool> pool([]()
+    {
+        const QVector<int> cores = coresOf(EFFICIENCY_CORES);
+        return new SolverThreadPool(cores.isEmpty() ? std::max(1, QThread::idealThreadCount() / 2) : cores.size(), QThread::LowestPriority,
+                                    cores);
+    }());
+    return pool;
+}
+
+int SolverThreadPool::waiting() const
+{
+    QMutexLocker locker(&m_Mutex);
+    int count = 0;
+    for(int u = 0; u < SSolver::URGENCY_COUNT; u++)
+        count += static_cast<int>(m_NextTicket[u] - m_Serving[u]);
+    return count;
+}
+
+void SolverThreadPool::acquire(SSolver::SolveUrgency urgency)
+{
+    QMutexLocker locker(&m_Mutex);
+    const quint64 ticket = m_NextTicket[urgency]++;
+    auto isNext = [this, urgency, ticket]()
+    {
+        if(m_FreeSlots == 0 || m_Serving[urgency] != ticket)
+            return false;
+        for(int u = urgency + 1; u < SSolver::URGENCY_COUNT; u++)
+        {
+            if(m_NextTicket[u] != m_Serving[u])
+                return false;
+        }
+        return true;
+    };
+    while(!isNext())
+        m_Released.wait(&m_Mutex);
+    m_Serving[urgency]++;
+    m_FreeSlots--;
+    // The next one in line may be able to take a slot too
+    if(m_FreeSlots > 0)
+        m_Released.wakeAll();
+}
+
+bool SolverThreadPool::tryAcquire(SSolver::SolveUrgency urgency)
+{
+    QMutexLocker locker(&m_Mutex);
+    if(m_FreeSlots == 0)
+        return false;
+    for(int u = urgency; u < SSolver::URGENCY_COUNT; u++)
+    {
+        if(m_NextTicket[u] != m_Serving[u])
+            return false;
+    }
+    m_FreeSlots--;
+    return true;
+}
+
+void SolverThreadPool::release()
+{
+    QMutexLocker locker(&m_Mutex);
+    m_FreeSlots++;
+    m_Released.wakeAll();
+}
+
+SolverThreadPool::Slot::Slot(SolverThreadPool *pool, SSolver::SolveUrgency urgency) : m_Pool(pool)
+{
+    if(!m_Pool)
+        return;
+    m_Pool->acquire(urgency);
+    m_Pool->setupThread();
+}
+
+SolverThreadPool::Slot::~Slot()
+{
+    if(m_Pool)
+        m_Pool->release();
+}
+
+// The threads of the QThreadPool are shared by the functions run on it, and a solver thread can be reused too,
+// so this is done each time a slot is taken rather than once for each thread.
+void SolverThreadPool::setupThread() const
+{
+    if(m_Priority != QThread::InheritPriority)
+        QThread::currentThread()->setPriority(m_Priority);
+
+    pinCurrentThread(m_Cores);
+}
+
+void SolverThreadPool::pinCurrentThread(const QVector<int> &cores)
+{
+    if(cores.isEmpty())
+        return;
+#if defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for(int core : cores)
+    {
+        if(core >= 0 && core < static_cast<int>(sizeof(DWORD_PTR) * 8))
+            mask |= static_cast<DWORD_PTR>(1) << core;
+    }
+    if(mask)
+        SetThreadAffinityMask(GetCurrentThread(), mask);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int core : cores)
+    {
+        if(core >= 0 && core < CPU_SETSIZE)
+            CPU_SET(core, &set);
+    }
+    if(CPU_COUNT(&set) > 0)
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+    // Other systems, like macOS, don't let a thread be pinned to cores, so it only gets the priority there.
+}
+
+QVector<QVector<int>> SolverThreadPool::numaNodes()
+{
+    QVector<QVector<int>> nodes;
+#if defined(__linux__)
+    // Each node has a list of its cores like 0-7,16-23
+    QDir nodeDir("/sys/devices/system/node");
+    const QStringList nodeNames = nodeDir.entryList(QStringList() << "node*", QDir::Dirs, QDir::Name);
+    for(const QString &nodeName : nodeNames)
+    {
+        if(!QRegularExpression("^node\\d+$").match(nodeName).hasMatch())
+            continue;
+        QFile cpuList(nodeDir.filePath(nodeName + "/cpulist"));
+        if(!cpuList.open(QIODevice::ReadOnly))
+            continue;
+        QVector<int> cores;
+        for(const QString &range : QString::fromLatin1(cpuList.readAll()).trimmed().split(','))
+        {
+            if(range.isEmpty())
+                continue;
+            const QStringList ends = range.split('-');
+            const int first = ends.first().toInt();
+            const int last = ends.last().toInt();
+            for(int core = first; core <= last; core++)
+                cores.append(core);
+        }
+        if(!cores.isEmpty())
+            nodes.append(cores);
+    }
+#endif
+    if(nodes.isEmpty())
+        nodes.append(coresOf(ANY_CORES));
+    return nodes;
+}
+
+QVector<int> SolverThreadPool::coresOf(CoreClass coreClass)
+{
+    const QVector<double> &speeds = coreSpeeds();
+    QVector<int> cores;
+    for(int core = 0; core < speeds.size(); core++)
+    {
+        const bool performance = speeds[core] >= EFFICIENCY_SPEED;
+        if(coreClass == ANY_CORES || (coreClass == PERFORMANCE_CORES) == performance)
+            cores.append(core);
+    }
+    return cores;
+}
+
+double SolverThreadPool::coreSpeed(int core)
+{
+    const QVector<double> &speeds = coreSpeeds();
+    return core >= 0 && core < speeds.size() ? speeds[core] : 1.0;
+}
@@ -0,0 +1,229 @@
+/*  SolverThreadPool, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QMutex>
+#include <QSharedPointer>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
+#include <QtConcurrent>
+
+#include "parameters.h"
+
+/**
+ * @brief The SolverThreadPool class limits how many threads the StellarSolvers that share it use at the same time.
+ * Without it, every StellarSolver runs its extraction partitions on the global thread pool and starts as many child solvers as there are cores,
+ * so several StellarSolvers running at once oversubscribe the machine.  The pool is owned by the StellarSolver (and can be shared between
+ * several StellarSolvers) and is handed to each ExtractorSolver, including the child solvers of a parallel solve.
+ * Every extraction partition and every solve takes one of its slots while it works, so no more than maxThreads of them run at once,
+ * and the threads doing the work get the priority and the cores that were set for the pool.
+ * The helper threads they start, for SEP, the binning of the image and the verification of the matches, are started with tryRun, so
+ * they only run in slots that are free at that moment and count against maxThreads like the rest.  The one thread that is not in a
+ * slot is the solver's own, which bins the image and makes the background of the whole frame before the partitions start, and
+ * otherwise waits for them; so the StellarSolvers sharing a pool run at most maxThreads threads in it, plus their own threads.
+ * When all of the slots are taken, the partitions and solves wait for one in the order of their SolveUrgency, and in the order they came
+ * within the same SolveUrgency, so a guiding solve gets the next free slot ahead of the solves of an archive running in the background.
+ * The StellarSolvers use processPool by default, so all of them in the program share its slots unless they are given a pool of their own.
+ * It is thread safe.
+ */
+class SolverThreadPool
+{
+    public:
+        /**
+         * @brief The CoreClass enum picks the cores of a machine with fast and slow cores, like the big.LITTLE ARM boards.
+         * The efficiency cores are the cores that are clearly slower than the fastest ones, on a machine whose cores are all alike they are none.
+         */
+        enum CoreClass
+        {
+            ANY_CORES,
+            PERFORMANCE_CORES,
+            EFFICIENCY_CORES
+        };
+
+        /**
+         * @brief SolverThreadPool creates a pool
+         * @param maxThreads is the number of partitions and solves that can work at the same time, 0 for the number of cores it may run on
+         * @param priority is the priority of the threads while they work for the pool
+         * @param cores is the list of the cores the threads may run on, or empty for any of them
+         */
+        explicit SolverThreadPool(int maxThreads = 0, QThread::Priority priority = QThread::InheritPriority,
+                                  const QVector<int> &cores = QVector<int>());
+
+        /**
+         * @brief processPool is the pool that the StellarSolvers of the program share by default, with one slot for each core
+         */
+        static QSharedPointer<SolverThreadPool> processPool();
+
+        /**
+         * @brief powerSavingPool is a pool with the lowest priority that only runs on the efficiency cores, with one slot for each of them.
+         * It is for the StellarSolvers that should draw less power, like the background solves on a battery powered field computer.
+         * On a machine without efficiency cores, or one that doesn't tell which they are, it is a pool of half of the cores.
+         */
+        static QSharedPointer<SolverThreadPool> powerSavingPool();
+
+        /**
+         * @brief waiting gets how many partitions and solves wait for a slot of the pool
+         */
+        int waiting() const;
+
+        /**
+         * @brief maxThreads is how many partitions and solves can work at the same time
+         */
+        int maxThreads() const
+        {
+            return m_MaxThreads;
+        }
+
+        /**
+         * @brief priority is the priority of the threads while they work for the pool
+         */
+        QThread::Priority priority() const
+        {
+            return m_Priority;
+        }
+
+        /**
+         * @brief cores is the list of the cores the threads may run on, it is empty if they can run on any of them
+         */
+        const QVector<int> &cores() const
+        {
+            return m_Cores;
+        }
+
+        /**
+         * @brief slowestSpeed is the speed of the slowest core the threads may run on, relative to the fastest core of the machine,
+         * so it is 1 on a machine whose cores are all alike.  A piece of work that lands on that core takes this much longer.
+         */
+        double slowestSpeed() const
+        {
+            return m_SlowestSpeed;
+        }
+
+        /**
+         * @brief capacity is how much work the threads of the pool get done together, in fastest cores, so it is maxThreads when the cores are alike
+         */
+        double capacity() const
+        {
+            return m_Capacity;
+        }
+
+        /**
+         * @brief The Slot class holds one slot of a pool for as long as it exists, and sets up the thread that made it for the pool.
+         * It does nothing if there is no pool, so that the code that uses it works the same without one.
+         */
+        class Slot
+        {
+            public:
+                explicit Slot(SolverThreadPool *pool, SSolver::SolveUrgency urgency = SSolver::URGENCY_NORMAL);
+                ~Slot();
+                Slot(const Slot &) = delete;
+                Slot &operator=(const Slot &) = delete;
+            private:
+                SolverThreadPool *m_Pool;
+        };
+
+        /**
+         * @brief numaNodes lists the cores of each NUMA node of the machine
+         * @return One list of cores for each node.  If the system doesn't tell, there is one node with all of the cores.
+         */
+        static QVector<QVector<int>> numaNodes();
+
+        /**
+         * @brief coresOf lists the cores of a CoreClass, see coreSpeed for how they are told apart
+         * @return The cores, which are all of them for ANY_CORES
+         */
+        static QVector<int> coresOf(CoreClass coreClass);
+
+        /**
+         * @brief coreSpeed gets the speed of a core relative to the fastest core of the machine.  On Linux it is the cpu_capacity
+         * of the scheduler, or the highest clock of the core if the kernel has no capacities.  Otherwise it is 1 for all of the cores.
+         */
+        static double coreSpeed(int core);
+
+        /**
+         * @brief pinCurrentThread lets the current thread run only on the given cores, on the systems that allow it
+         * @param cores is the list of cores, nothing is done if it is empty
+         */
+        static void pinCurrentThread(const QVector<int> &cores);
+
+        /**
+         * @brief tryRun runs a function on the threads of the pool, in a slot of the pool, if one is free now and nothing of the same or a
+         * higher SolveUrgency waits for one.  It never waits, so it is for extra helpers of a piece of work that can do without them.
+         * @param function is what to run
+         * @param urgency is the SolveUrgency of the slot
+         * @return Whether the function was started
+         */
+        template <typename Function>
+        bool tryRun(Function function, SSolver::SolveUrgency urgency = SSolver::URGENCY_NORMAL)
+        {
+            if(!tryAcquire(urgency))
+                return false;
+            QtConcurrent::run(&m_ThreadPool, [this, function]()
+            {
+                setupThread();
+                function();
+                release();
+            });
+            return true;
+        }
+
+        /**
+         * @brief run runs a function on the threads of the pool, in a slot of the pool
+         * @param function is what to run
+         * @param urgency is the SolveUrgency of the slot it waits for
+         * @return The future for the result of the function
+         */
+        template <typename Function>
+        auto run(Function function, SSolver::SolveUrgency urgency = SSolver::URGENCY_NORMAL) -> QFuture<decltype(function())>
+        {
+            return QtConcurrent::run(&m_ThreadPool, [this, function, urgency]()
+            {
+                Slot slot(this, urgency);
+                return function();
+            });
+        }
+
+    private:
+
+        /**
+         * @brief setupThread gives the current thread the priority and the cores of the pool
+         */
+        void setupThread() const;
+
+        /**
+         * @brief acquire waits until there is a free slot and no waiting slot comes before this one, and takes it
+         */
+        void acquire(SSolver::SolveUrgency urgency);
+
+        /**
+         * @brief tryAcquire takes a slot if one is free and nothing of the same or a higher urgency waits for one, without waiting
+         * @return Whether it took a slot
+         */
+        bool tryAcquire(SSolver::SolveUrgency urgency);
+
+        /**
+         * @brief release gives a slot back and wakes the waiting ones
+         */
+        void release();
+
+        int m_MaxThreads { 1 };
+        QThread::Priority m_Priority { QThread::InheritPriority };
+        QVector<int> m_Cores;
+        double m_SlowestSpeed { 1 };
+        double m_Capacity { 1 };
+        mutable QMutex m_Mutex;
+        QWaitCondition m_Released;
+        int m_FreeSlots { 0 };      // One for each partition or solve that can work at the same time
+        // The slots of each Urgency are taken in the order of their tickets, from the first one not served yet to the next one to give out
+        quint64 m_NextTicket[SSolver::URGENCY_COUNT] = {};
+        quint64 m_Serving[SSolver::URGENCY_COUNT] = {};
+        QThreadPool m_ThreadPool;   // The threads for the functions that are run on the pool
+};
@@ -0,0 +1,275 @@
+/*  StarCatalog, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "starcatalog.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+//QT Includes
+#include <QFile>
+#include <QtEndian>
+
+StarCatalog::StarCatalog(const QList<FITSImage::Star> &stars)
+{
+    reserve(stars.count());
+    for(const FITSImage::Star &star : stars)
+        append(star);
+}
+
+QList<FITSImage::Star> StarCatalog::toList() const
+{
+    QList<FITSImage::Star> stars;
+    stars.reserve(count());
+    for(int i = 0; i < count(); i++)
+        stars.append(star(i));
+    return stars;
+}
+
+void StarCatalog::reserve(int size)
+{
+    m_X.reserve(size);
+    m_Y.reserve(size);
+    m_Mag.reserve(size);
+    m_Flux.reserve(size);
+    m_Peak.reserve(size);
+    m_HFR.reserve(size);
+    m_A.reserve(size);
+    m_B.reserve(size);
+    m_Theta.reserve(size);
+    m_RA.reserve(size);
+    m_Dec.reserve(size);
+    m_NumPixels.reserve(size);
+}
+
+void StarCatalog::append(const FITSImage::Star &star)
+{
+    m_X.append(star.x);
+    m_Y.append(star.y);
+    m_Mag.append(star.mag);
+    m_Flux.append(star.flux);
+    m_Peak.append(star.peak);
+    m_HFR.append(star.HFR);
+    m_A.append(star.a);
+    m_B.append(star.b);
+    m_Theta.append(star.theta);
+    m_RA.append(star.ra);
+    m_Dec.append(star.dec);
+    m_NumPixels.append(star.numPixels);
+}
+
+FITSImage::Star StarCatalog::star(int i) const
+{
+    FITSImage::Star star;
+    star.x = m_X.at(i);
+    star.y = m_Y.at(i);
+    star.mag = m_Mag.at(i);
+    star.flux = m_Flux.at(i);
+    star.peak = m_Peak.at(i);
+    star.HFR = m_HFR.at(i);
+    star.a = m_A.at(i);
+    star.b = m_B.at(i);
+    star.theta = m_Theta.at(i);
+    star.ra = m_RA.at(i);
+    star.dec = m_Dec.at(i);
+    star.numPixels = m_NumPixels.at(i);
+    return star;
+}
+
+void StarCatalog::clear()
+{
+    *this = StarCatalog();
+}
+
+void StarCatalog::setSkyPositions(const double *ra, const double *dec)
+{
+    float *raColumn = m_RA.data();
+    float *decColumn = m_Dec.data();
+    for(int i = 0; i < count(); i++)
+    {
+        raColumn[i] = ra[i];
+        decColumn[i] = dec[i];
+    }
+}
+
+// A StarCatalog file is all little endian.  It starts with a header of 24 bytes:
+//  - the 8 characters "SSTARCAT"
+//  - the version of the format as a 32 bit integer, which is 1
+//  - the OptionalColumns in the file as a 32 bit integer
+//  - the number of stars as a 64 bit integer
+// Then each column follows as an array of that many values, with nothing between them, in this order:
+// x, y, mag, flux, peak, HFR, a, b, theta, ra, dec as 32 bit floats and numPixels as 32 bit integers.
+// The HFR column is only there with HFR_COLUMN and the ra and dec columns are only there with SKY_COLUMNS.
+// So the column of a property can be read or mapped from the file without reading any of the others.
+namespace
+{
+const char FileMagic[8] = {'S', 'S', 'T', 'A', 'R', 'C', 'A', 'T'};
+const quint32 FileVersion = 1;
+const int HeaderSize = 24;
+
+// The columns are written in blocks, so that a big endian machine can convert them without a copy of the whole column
+const int BlockSize = 4096;
+
+template <typename T>
+bool writeColumn(QFile &file, const QVector<T> &column)
+{
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    const qint64 bytes = static_cast<qint64>(column.count()) * sizeof(T);
+    return file.write(reinterpret_cast<const char *>(column.constData()), bytes) == bytes;
+#else
+    T block[BlockSize];
+    for(int first = 0; first < column.count(); first += BlockSize)
+    {
+        const int n = qMin(BlockSize, column.count() - first);
+        qToLittleEndian<T>(column.constData() + first, n, block);
+        if(file.write(reinterpret_cast<const char *>(block), n * sizeof(T)) != static_cast<qint64>(n * sizeof(T)))
+            return false;
+    }
+    return true;
+#endif
+}
+
+template <typename T>
+bool readColumn(QFile &file, QVector<T> &column, int count)
+{
+    column.resize(count);
+    const qint64 bytes = static_cast<qint64>(count) * sizeof(T);
+    if(file.read(reinterpret_cast<char *>(column.data()), bytes) != bytes)
+        return false;
+#if Q_BYTE_ORDER != Q_LITTLE_ENDIAN
+    qFromLittleEndian<T>(column.constData(), count, column.data());
+#endif
+    return true;
+}
+}
+
+bool StarCatalog::save(const QString &fileName, int optionalColumns) const
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+
+    char header[HeaderSize];
+    memcpy(header, FileMagic, sizeof(FileMagic));
+    qToLittleEndian<quint32>(FileVersion, header + 8);
+    qToLittleEndian<quint32>(optionalColumns & ALL_OPTIONAL_COLUMNS, header + 12);
+    qToLittleEndian<quint64>(count(), header + 16);
+    if(file.write(header, HeaderSize) != HeaderSize)
+        return false;
+
+    const bool hfr = optionalColumns & HFR_COLUMN, sky = optionalColumns & SKY_COLUMNS;
+    return writeColumn(file, m_X) && writeColumn(file, m_Y) && writeColumn(file, m_Mag) && writeColumn(file, m_Flux) &&
+           writeColumn(file, m_Peak) && (!hfr || writeColumn(file, m_HFR)) && writeColumn(file, m_A) && writeColumn(file, m_B) &&
+           writeColumn(file, m_Theta) && (!sky || writeColumn(file, m_RA)) && (!sky || writeColumn(file, m_Dec)) &&
+           writeColumn(file, m_NumPixels) && file.flush();
+}
+
+bool StarCatalog::load(const QString &fileName, int *optionalColumns)
+{
+    clear();
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    char header[HeaderSize];
+    if(file.read(header, HeaderSize) != HeaderSize || memcmp(header, FileMagic, sizeof(FileMagic)) != 0 ||
+            qFromLittleEndian<quint32>(header + 8) != FileVersion)
+        return false;
+    const int columns = qFromLittleEndian<quint32>(header + 12) & ALL_OPTIONAL_COLUMNS;
+    const quint64 stars = qFromLittleEndian<quint64>(header + 16);
+    const bool hfr = columns & HFR_COLUMN, sky = columns & SKY_COLUMNS;
+    // The size has to match, so that a truncated file or a different format isn't taken for a catalog
+    const quint64 numColumns = 9 + (hfr ? 1 : 0) + (sky ? 2 : 0);
+    if(stars > static_cast<quint64>(std::numeric_limits<int>::max()) ||
+            static_cast<quint64>(file.size()) != HeaderSize + stars * numColumns * 4)
+        return false;
+
+    const int n = static_cast<int>(stars);
+    bool ok = readColumn(file, m_X, n) && readColumn(file, m_Y, n) && readColumn(file, m_Mag, n) && readColumn(file, m_Flux, n) &&
+              readColumn(file, m_Peak, n) && (!hfr || readColumn(file, m_HFR, n)) && readColumn(file, m_A, n) &&
+              readColumn(file, m_B, n) && readColumn(file, m_Theta, n) && (!sky || readColumn(file, m_RA, n)) &&
+              (!sky || readColumn(file, m_Dec, n)) && readColumn(file, m_NumPixels, n);
+    if(!ok)
+    {
+        clear();
+        return false;
+    }
+    if(!hfr)
+        m_HFR.fill(0, n);
+    if(!sky)
+    {
+        m_RA.fill(0, n);
+        m_Dec.fill(0, n);
+    }
+    if(optionalColumns)
+        *optionalColumns = columns;
+    return true;
+}
+
+StarView::StarView(const StarCatalog &catalog) : m_Catalog(catalog)
+{
+}
+
+StarView::StarView(const StarCatalog &catalog, const QVector<int> &indexes) : m_Catalog(catalog), m_Indexes(indexes), m_All(false)
+{
+}
+
+QList<FITSImage::Star> StarView::toList() const
+{
+    QList<FITSImage::Star> stars;
+    stars.reserve(count());
+    for(int i = 0; i < count(); i++)
+        stars.append(star(i));
+    return stars;
+}
+
+StarView StarView::filtered(const std::function<bool(const StarCatalog &, int)> &keep) const
+{
+    QVector<int> indexes;
+    indexes.reserve(count());
+    for(int i = 0; i < count(); i++)
+    {
+        if(keep(m_Catalog, index(i)))
+            indexes.append(index(i));
+    }
+    return StarView(m_Catalog, indexes);
+}
+
+StarView StarView::withHFR() const
+{
+    const float *hfr = m_Catalog.HFR();
+    return filtered([hfr](const StarCatalog &, int i)
+    {
+        return hfr[i] > 0;
+    });
+}
+
+StarView StarView::inside(const QRectF &area) const
+{
+    const float *x = m_Catalog.x(), *y = m_Catalog.y();
+    return filtered([x, y, area](const StarCatalog &, int i)
+    {
+        return area.contains(x[i], y[i]);
+    });
+}
+
+StarView StarView::brightest(int maxStars) const
+{
+    QVector<int> indexes;
+    indexes.reserve(count());
+    for(int i = 0; i < count(); i++)
+        indexes.append(index(i));
+    const float *mag = m_Catalog.mag();
+    std::stable_sort(indexes.begin(), indexes.end(), [mag](int a, int b)
+    {
+        return mag[a] < mag[b];
+    });
+    if(maxStars > 0 && indexes.count() > maxStars)
+        indexes.resize(maxStars);
+    return StarView(m_Catalog, indexes);
+}
@@ -0,0 +1,264 @@
+/*  StarCatalog, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QList>
+#include <QRectF>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+#include "structuredefinitions.h"
+
+/**
+ * @brief The StarCatalog class holds a star list with each property of the stars in its own array.
+ * A QList<FITSImage::Star> keeps every star by itself, so going through one property of a big star list, like the positions
+ * for a WCS conversion or the magnitudes for a filter, reads all of the others too.  The columns here are contiguous arrays that
+ * can be handed to the array functions like WCSData::pixelsToWCS as they are.  The columns are implicitly shared, so copying a
+ * catalog or returning it doesn't copy the stars, and the pointers of the column accessors are views of them, not copies.
+ * The StellarSolver's star lists are still QLists, so that the existing API is unchanged, and this converts from and to them.
+ * A catalog can also be saved to a file with its columns one after the other, as they are in memory, which is much smaller and
+ * faster to write and to read than a CSV file of the same stars.
+ */
+class StarCatalog
+{
+    public:
+        // The columns that a star list doesn't always have, so that save can leave them out
+        typedef enum OptionalColumns
+        {
+            NO_OPTIONAL_COLUMNS = 0,
+            HFR_COLUMN = 1,             // The half flux radii, only if they were calculated
+            SKY_COLUMNS = 2,            // The right ascensions and declinations, only if the image was solved
+            ALL_OPTIONAL_COLUMNS = HFR_COLUMN | SKY_COLUMNS
+        } OptionalColumns;
+
+        StarCatalog() = default;
+
+        /**
+         * @brief StarCatalog makes a catalog of the stars in a star list
+         * @param stars The list of stars, for instance from StellarSolver::getStarList
+         */
+        explicit StarCatalog(const QList<FITSImage::Star> &stars);
+
+        /**
+         * @brief toList makes a star list of the stars in the catalog, for the functions that take a QList
+         * @return The list of stars
+         */
+        QList<FITSImage::Star> toList() const;
+
+        /**
+         * @brief reserve makes room for a number of stars, so appending them doesn't reallocate the columns
+         * @param size The number of stars
+         */
+        void reserve(int size);
+
+        /**
+         * @brief append adds a star at the end of the catalog
+         * @param star The star to add
+         */
+        void append(const FITSImage::Star &star);
+
+        /**
+         * @brief star gets one of the stars of the catalog
+         * @param i The index of the star
+         * @return The star, with all of its properties
+         */
+        FITSImage::Star star(int i) const;
+
+        int count() const
+        {
+            return m_X.count();
+        }
+
+        bool isEmpty() const
+        {
+            return m_X.isEmpty();
+        }
+
+        void clear();
+
+        // These are views of the columns, they stay valid until the catalog is changed
+        const float *x() const
+        {
+            return m_X.constData();
+        }
+        const float *y() const
+        {
+            return m_Y.constData();
+        }
+        const float *mag() const
+        {
+            return m_Mag.constData();
+        }
+        const float *flux() const
+        {
+            return m_Flux.constData();
+        }
+        const float *peak() const
+        {
+            return m_Peak.constData();
+        }
+        const float *HFR() const
+        {
+            return m_HFR.constData();
+        }
+        const float *a() const
+        {
+            return m_A.constData();
+        }
+        const float *b() const
+        {
+            return m_B.constData();
+        }
+        const float *theta() const
+        {
+            return m_Theta.constData();
+        }
+        const float *ra() const
+        {
+            return m_RA.constData();
+        }
+        const float *dec() const
+        {
+            return m_Dec.constData();
+        }
+        const int *numPixels() const
+        {
+            return m_NumPixels.constData();
+        }
+
+        /**
+         * @brief setSkyPositions sets the RA and DEC column, for instance from WCSData::pixelsToWCS
+         * @param ra The right ascensions of the stars in degrees, there must be count() of them
+         * @param dec The declinations of the stars in degrees, there must be count() of them
+         */
+        void setSkyPositions(const double *ra, const double *dec);
+
+        /**
+         * @brief save writes the catalog to a file in the StarCatalog format, which is a small header and then each column of the
+         * catalog as a little endian array.  The format is described in starcatalog.cpp.
+         * @param fileName The file to write
+         * @param optionalColumns The OptionalColumns to write, the others are left out
+         * @return false if the file could not be written
+         */
+        bool save(const QString &fileName, int optionalColumns = ALL_OPTIONAL_COLUMNS) const;
+
+        /**
+         * @brief load reads a catalog from a file that save wrote
+         * @param fileName The file to read
+         * @param optionalColumns Gets the OptionalColumns that are in the file, the ones that aren't are 0 in the catalog
+         * @return false if the file could not be read or isn't a StarCatalog file, the catalog is empty then
+         */
+        bool load(const QString &fileName, int *optionalColumns = nullptr);
+
+    private:
+        QVector<float> m_X;         // The x positions of the stars in Pixels
+        QVector<float> m_Y;         // The y positions of the stars in Pixels
+        QVector<float> m_Mag;       // The relative magnitudes of the stars
+        QVector<float> m_Flux;      // The total fluxes
+        QVector<float> m_Peak;      // The peak values
+        QVector<float> m_HFR;       // The half flux radii
+        QVector<float> m_A;         // The semi-major axes
+        QVector<float> m_B;         // The semi-minor axes
+        QVector<float> m_Theta;     // The angles of orientation
+        QVector<float> m_RA;        // The right ascensions
+        QVector<float> m_Dec;       // The declinations
+        QVector<int> m_NumPixels;   // The numbers of pixels the stars occupy
+};
+
+/**
+ * @brief The StarView class is a subset of the stars of a StarCatalog, like the stars with an HFR, the ones in a region or the
+ * brightest ones for a solve, without a copy of them.  It shares the columns of the catalog and only lists the indexes of its stars
+ * in it, so one extraction is stored once however many of its subsets are in use.  A view of the whole catalog doesn't even list
+ * those.  The views can be narrowed further, each one lists its stars in the order of the view it was made from unless it sorts them.
+ */
+class StarView
+{
+    public:
+        StarView() = default;
+
+        /**
+         * @brief StarView makes a view of all of the stars of a catalog
+         */
+        explicit StarView(const StarCatalog &catalog);
+
+        /**
+         * @brief StarView makes a view of some of the stars of a catalog
+         * @param catalog The catalog
+         * @param indexes The indexes of the stars of the view in the catalog
+         */
+        StarView(const StarCatalog &catalog, const QVector<int> &indexes);
+
+        int count() const
+        {
+            return m_All ? m_Catalog.count() : m_Indexes.count();
+        }
+
+        bool isEmpty() const
+        {
+            return count() == 0;
+        }
+
+        /**
+         * @brief index gets where a star of the view is in the catalog, for reading its columns
+         */
+        int index(int i) const
+        {
+            return m_All ? i : m_Indexes.at(i);
+        }
+
+        /**
+         * @brief star gets one of the stars of the view, with all of its properties
+         */
+        FITSImage::Star star(int i) const
+        {
+            return m_Catalog.star(index(i));
+        }
+
+        /**
+         * @brief catalog gets the catalog the stars of the view are in
+         */
+        const StarCatalog &catalog() const
+        {
+            return m_Catalog;
+        }
+
+        /**
+         * @brief toList makes a star list of the stars of the view, for the functions that take a QList
+         */
+        QList<FITSImage::Star> toList() const;
+
+        /**
+         * @brief filtered makes a view of the stars of this view for which keep returns true
+         * @param keep This gets the catalog and the index of a star in it
+         */
+        StarView filtered(const std::function<bool(const StarCatalog &, int)> &keep) const;
+
+        /**
+         * @brief withHFR makes a view of the stars whose half flux radius was calculated
+         */
+        StarView withHFR() const;
+
+        /**
+         * @brief inside makes a view of the stars whose positions are inside an area of the image
+         */
+        StarView inside(const QRectF &area) const;
+
+        /**
+         * @brief brightest makes a view of the brightest stars, by their magnitudes, brightest first
+         * @param maxStars The most stars to keep, 0 or less for all of them sorted
+         */
+        StarView brightest(int maxStars) const;
+
+    private:
+        StarCatalog m_Catalog;
+        QVector<int> m_Indexes;     // The stars of the view, in its order, unless it has all of them
+        bool m_All { true };
+};
@@ -0,0 +1,349 @@
+/*  StarfieldGenerator, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "starfieldgenerator.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <vector>
+#include <cmath>
+
+//QT Includes
+#include <QtMath>
+
+#include <fitsio.h>
+
+//Astrometry.net includes
+extern "C"
+{
+#include "astrometry/starkd.h"
+#include "astrometry/starutil.h"
+}
+
+namespace
+{
+// The full range of the data type, floating point images use the range of 16 bit images so they look like the images of cameras
+double dataRange(uint32_t dataType)
+{
+    return dataType == TBYTE ? 255.0 : 65535.0;
+}
+
+// A magnitude of the luminosity function of the sky, where there are 10^0.6 times more stars for each fainter magnitude.
+// u is uniform from 0 to 1, and the magnitude goes from 0 to range.
+double skyMagnitude(double u, double range)
+{
+    return log10(1 + u * (pow(10, 0.6 * range) - 1)) / 0.6;
+}
+
+template <typename T>
+void storePixels(const std::vector<float> &pixels, uint8_t *buffer, double maximum, bool clamp)
+{
+    T *out = reinterpret_cast<T *>(buffer);
+    for(size_t i = 0; i < pixels.size(); i++)
+    {
+        double value = pixels[i];
+        if(clamp)
+            value = qBound(0.0, std::round(value), maximum);
+        out[i] = static_cast<T>(value);
+    }
+}
+}
+
+StarfieldGenerator::StarfieldGenerator()
+{
+    dataType = TUSHORT;
+}
+
+tan_t StarfieldGenerator::tan() const
+{
+    tan_t wcs;
+    memset(&wcs, 0, sizeof(wcs));
+    wcs.crval[0] = ra;
+    wcs.crval[1] = dec;
+    // FITS pixels start at 1, like the pixels of the star extraction
+    wcs.crpix[0] = 0.5 + width / 2.0;
+    wcs.crpix[1] = 0.5 + height / 2.0;
+    wcs.imagew = width;
+    wcs.imageh = height;
+
+    // These give back the orientation in tan_get_orientation, with a negative determinant for positive parity
+    const double scale = pixelScale / 3600.0;
+    const double c = cos(deg2rad(orientation));
+    const double s = sin(deg2rad(orientation));
+    if(parity == FITSImage::NEGATIVE)
+    {
+        wcs.cd[0][0] = scale * c;
+        wcs.cd[0][1] = scale * s;
+        wcs.cd[1][0] = -scale * s;
+        wcs.cd[1][1] = scale * c;
+    }
+    else
+    {
+        wcs.cd[0][0] = -scale * c;
+        wcs.cd[0][1] = scale * s;
+        wcs.cd[1][0] = scale * s;
+        wcs.cd[1][1] = scale * c;
+    }
+    return wcs;
+}
+
+void StarfieldGenerator::addStar(double x, double y, double mag, double starRA, double starDEC)
+{
+    FITSImage::Star star;
+    memset(&star, 0, sizeof(star));
+    star.x = x;
+    star.y = y;
+    star.mag = mag;
+    star.ra = starRA;
+    star.dec = starDEC;
+    m_Stars.append(star);
+}
+
+int StarfieldGenerator::addIndexStars(const QString &indexFile, int maxStars)
+{
+    startree_t *starkd = startree_open(indexFile.toLocal8Bit().constData());
+    if(!starkd)
+        return -1;
+
+    // The radius of the circle around the field, the stars outside of the image are left out below
+    const double radius = pixelScale / 3600.0 * sqrt(double(width) * width + double(height) * height) / 2.0;
+    double *radec = nullptr;
+    int *inds = nullptr;
+    int count = 0;
+    startree_search_for_radec(starkd, ra, dec, radius, nullptr, &radec, &inds, &count);
+
+    // The magnitudes of the catalog if it has them.  Otherwise the stars of the index are sorted brightest first,
+    // so they get the magnitudes of the luminosity function in that order.
+    double *catalogMags = count > 0 ? startree_get_data_column(starkd, "mag", inds, count) : nullptr;
+    std::vector<double> mags(count);
+    if(catalogMags)
+        std::copy(catalogMags, catalogMags + count, mags.begin());
+    else
+    {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<double> uniform(0, 1);
+        std::vector<int> byIndex(count);
+        std::iota(byIndex.begin(), byIndex.end(), 0);
+        std::sort(byIndex.begin(), byIndex.end(), [inds](int a, int b)
+        {
+            return inds[a] < inds[b];
+        });
+        std::vector<double> sorted(count);
+        for(double &mag : sorted)
+            mag = skyMagnitude(uniform(random), magnitudeRange);
+        std::sort(sorted.begin(), sorted.end());
+        for(int i = 0; i < count; i++)
+            mags[byIndex[i]] = sorted[i];
+    }
+
+    std::vector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&mags](int a, int b)
+    {
+        return mags[a] < mags[b];
+    });
+
+    const tan_t wcs = tan();
+    int added = 0;
+    for(int i : order)
+    {
+        if(maxStars > 0 && added >= maxStars)
+            break;
+        double x, y;
+        if(!tan_radec2pixelxy(&wcs, radec[2 * i], radec[2 * i + 1], &x, &y))
+            continue;
+        if(x < 0.5 || y < 0.5 || x > width + 0.5 || y > height + 0.5)
+            continue;
+        addStar(x, y, mags[i], radec[2 * i], radec[2 * i + 1]);
+        added++;
+    }
+
+    if(catalogMags)
+        startree_free_data_column(starkd, catalogMags);
+    free(radec);
+    free(inds);
+    startree_close(starkd);
+
+    scaleStars();
+    return added;
+}
+
+void StarfieldGenerator::addRandomStars(int count)
+{
+    // The seed is mixed with the stars already added, so that adding stars twice doesn't put them in the same places
+    std::mt19937 random(seed + m_Stars.count());
+    std::uniform_real_distribution<double> uniform(0, 1);
+    const tan_t wcs = tan();
+    for(int i = 0; i < count; i++)
+    {
+        const double x = 0.5 + uniform(random) * width;
+        const double y = 0.5 + uniform(random) * height;
+        double starRA, starDEC;
+        tan_pixelxy2radec(&wcs, x, y, &starRA, &starDEC);
+        addStar(x, y, skyMagnitude(uniform(random), magnitudeRange), starRA, starDEC);
+    }
+    scaleStars();
+}
+
+void StarfieldGenerator::scaleStars()
+{
+    if(m_Stars.isEmpty())
+        return;
+    std::stable_sort(m_Stars.begin(), m_Stars.end(), [](const FITSImage::Star & a, const FITSImage::Star & b)
+    {
+        return a.mag < b.mag;
+    });
+    const float brightest = m_Stars.first().mag;
+
+    const double sigma = fwhm / (2 * sqrt(2 * log(2)));
+    const double range = dataRange(dataType);
+    for(FITSImage::Star &star : m_Stars)
+    {
+        star.peak = brightestPeak * range * pow(10, -0.4 * (star.mag - brightest));
+        star.flux = star.peak * 2 * M_PI * sigma * sigma;
+        star.HFR = fwhm / 2;
+        star.a = sigma;
+        star.b = sigma;
+        star.theta = 0;
+        star.numPixels = qMax(1, qRound(M_PI * fwhm * fwhm / 4));
+    }
+}
+
+uint8_t *StarfieldGenerator::render(FITSImage::Statistic &stats) const
+{
+    const double range = dataRange(dataType);
+    const size_t area = size_t(width) * height;
+    std::vector<float> pixels(area, background * range);
+
+    // Each star is drawn out to 4 sigma, where the Gaussian is down to 0.03% of the peak
+    const double sigma = fwhm / (2 * sqrt(2 * log(2)));
+    const int reach = qMax(1, int(ceil(4 * sigma)));
+    for(const FITSImage::Star &star : m_Stars)
+    {
+        // The pixel centers of the buffer are at 0, 1, 2..., the pixels of the star extraction start at 1
+        const double cx = star.x - 1;
+        const double cy = star.y - 1;
+        const int x0 = qMax(0, int(floor(cx)) - reach), x1 = qMin(int(width) - 1, int(ceil(cx)) + reach);
+        const int y0 = qMax(0, int(floor(cy)) - reach), y1 = qMin(int(height) - 1, int(ceil(cy)) + reach);
+        for(int y = y0; y <= y1; y++)
+        {
+            float *row = pixels.data() + size_t(y) * width;
+            const double dy = y - cy;
+            for(int x = x0; x <= x1; x++)
+            {
+                const double dx = x - cx;
+                row[x] += star.peak * exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+            }
+        }
+    }
+
+    std::mt19937 random(seed);
+    std::normal_distribution<double> normal(0, 1);
+    const double read = readNoise * range;
+    double sum = 0, sumSquares = 0;
+    double minimum = range, maximum = 0;
+    for(float &value : pixels)
+    {
+        const double photon = gain > 0 ? qMax(0.0, double(value)) / gain : 0;
+        value = qBound(0.0, value + normal(random) * sqrt(read * read + photon), range);
+        if(dataType != TFLOAT)
+            value = std::round(value);
+        sum += value;
+        sumSquares += double(value) * value;
+        minimum = qMin(minimum, double(value));
+        maximum = qMax(maximum, double(value));
+    }
+
+    stats = FITSImage::Statistic();
+    stats.dataType = dataType;
+    stats.bytesPerPixel = dataType == TBYTE ? 1 : dataType == TUSHORT ? 2 : 4;
+    stats.width = width;
+    stats.height = height;
+    stats.channels = 1;
+    stats.samples_per_channel = area;
+    stats.size = area * stats.bytesPerPixel;
+    stats.min[0] = minimum;
+    stats.max[0] = maximum;
+    stats.mean[0] = sum / area;
+    stats.stddev[0] = sqrt(qMax(0.0, sumSquares / area - stats.mean[0] * stats.mean[0]));
+    stats.SNR = stats.stddev[0] > 0 ? stats.mean[0] / stats.stddev[0] : 0;
+
+    uint8_t *buffer = new uint8_t[stats.size];
+    if(dataType == TBYTE)
+        storePixels<uint8_t>(pixels, buffer, range, true);
+    else if(dataType == TUSHORT)
+        storePixels<uint16_t>(pixels, buffer, range, true);
+    else
+        storePixels<float>(pixels, buffer, range, false);
+
+    // The pixels aren't needed after they are stored, so the median can reorder them
+    std::nth_element(pixels.begin(), pixels.begin() + area / 2, pixels.end());
+    stats.median[0] = pixels[area / 2];
+    return buffer;
+}
+
+FITSImage::Solution StarfieldGenerator::getSolution() const
+{
+    FITSImage::Solution solution;
+    solution.fieldWidth = width * pixelScale / 60.0;
+    solution.fieldHeight = height * pixelScale / 60.0;
+    solution.ra = ra;
+    solution.dec = dec;
+    solution.orientation = orientation;
+    solution.pixscale = pixelScale;
+    solution.parity = parity;
+    solution.raError = 0;
+    solution.decError = 0;
+    return solution;
+}
+
+WCSData StarfieldGenerator::getWCSData() const
+{
+    const tan_t wcs = tan();
+    sip_t sip;
+    sip_wrap_tan(&wcs, &sip);
+    return WCSData(sip, 1);
+}
+
+double StarfieldGenerator::completeness(const QList<FITSImage::Star> &drawn, const QList<FITSImage::Star> &found,
+                                        double radius, int brightest)
+{
+    const int counted = brightest > 0 ? qMin(brightest, drawn.count()) : drawn.count();
+    if(counted == 0)
+        return 0;
+
+    // The found stars are sorted by x, so only the ones within the radius in x are compared with each drawn star
+    std::vector<QPointF> positions;
+    positions.reserve(found.count());
+    for(const FITSImage::Star &star : found)
+        positions.push_back(QPointF(star.x, star.y));
+    std::sort(positions.begin(), positions.end(), [](const QPointF & a, const QPointF & b)
+    {
+        return a.x() < b.x();
+    });
+
+    int matched = 0;
+    for(int i = 0; i < counted; i++)
+    {
+        const FITSImage::Star &star = drawn.at(i);
+        auto it = std::lower_bound(positions.begin(), positions.end(), star.x - radius, [](const QPointF & p, double x)
+        {
+            return p.x() < x;
+        });
+        for(; it != positions.end() && it->x() <= star.x + radius; ++it)
+        {
+            const double dx = it->x() - star.x, dy = it->y() - star.y;
+            if(dx * dx + dy * dy <= radius * radius)
+            {
+                matched++;
+                break;
+            }
+        }
+    }
+    return double(matched) / counted;
+}
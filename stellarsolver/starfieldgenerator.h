@@ -0,0 +1,132 @@
+/*  StarfieldGenerator, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QString>
+#include <QList>
+
+#include "structuredefinitions.h"
+#include "wcsdata.h"
+
+/**
+ * @brief The StarfieldGenerator class makes synthetic star fields whose stars are known, for benchmarks and scaling tests.
+ * The stars are taken from the star catalog of astrometry.net index files around a pointing, so the images can be solved,
+ * or they are put at random positions.  Their brightnesses follow the catalog magnitudes, or the number of stars growing 0.6 dex
+ * for each magnitude like in the real sky if they have none.  They are drawn as Gaussian PSFs over a flat background with read noise
+ * and photon noise.  The image is made in memory, as a FITSImage::Statistic and a buffer like the ones StellarSolver takes,
+ * and the stars that were drawn are the ground truth to measure how many of them a star extraction finds, see completeness.
+ * The settings have to be set before the stars are added, and the same settings and seed always make the same image.
+ */
+class StarfieldGenerator
+{
+    public:
+        StarfieldGenerator();
+
+    // The Image
+        uint16_t width { 1280 };            // The width of the image in pixels
+        uint16_t height { 960 };            // The height of the image in pixels
+        uint32_t dataType { 0 };            // The data type of the image, TBYTE, TUSHORT or TFLOAT.  It is TUSHORT by default.
+
+    // The Field
+        double ra { 0 };                    // The Right Ascension of the center of the field in degrees
+        double dec { 0 };                   // The Declination of the center of the field in degrees
+        double pixelScale { 2 };            // The pixel scale in arcseconds per pixel
+        double orientation { 0 };           // The orientation of the field, up is this many degrees E of N like in FITSImage::Solution
+        FITSImage::Parity parity { FITSImage::POSITIVE };   // The parity of the field, positive like most FITS images or negative like most JPEGs
+
+    // The Stars and the Noise, the levels are parts of the full range of the data type, which is 0 to 65535 for float images
+        double fwhm { 3 };                  // The full width at half maximum of the stars in pixels
+        double brightestPeak { 0.9 };       // The peak of the brightest star
+        double magnitudeRange { 6 };        // The faintest stars are this many magnitudes fainter than the brightest one
+        double background { 0.02 };         // The level of the sky background
+        double readNoise { 0.002 };         // The sigma of the read noise
+        double gain { 1 };                  // The electrons for each unit of the data type, for the photon noise.  0 turns the photon noise off.
+        unsigned int seed { 1 };            // The seed of the random positions, magnitudes and noise
+
+    // The Methods
+        /**
+         * @brief addIndexStars adds the stars of an index file that are in the field, so the image can be solved with the index.
+         * The settings of the field have to be set before.
+         * @param indexFile The path of the astrometry.net index file
+         * @param maxStars The most stars to add, the brightest ones, 0 for all of them
+         * @return The number of stars added, or -1 if the file could not be read
+         */
+        int addIndexStars(const QString &indexFile, int maxStars = 0);
+
+        /**
+         * @brief addRandomStars adds stars at random positions in the field, for measuring how the extraction scales with the star density
+         * @param count The number of stars to add
+         */
+        void addRandomStars(int count);
+
+        /**
+         * @brief clearStars removes all of the stars that were added
+         */
+        void clearStars()
+        {
+            m_Stars.clear();
+        }
+
+        /**
+         * @brief getStars gets the stars that are drawn in the image, in the pixel coordinates of the star extraction.
+         * Their flux and peak are the ones they are drawn with, a and b are the sigma of the PSF and the HFR is the one of the PSF.
+         * @return The stars, brightest first
+         */
+        const QList<FITSImage::Star> &getStars() const
+        {
+            return m_Stars;
+        }
+
+        /**
+         * @brief render draws the stars over the background and the noise
+         * @param stats This is set to the information about the image
+         * @return The image buffer.  It is allocated with new[] and belongs to the caller, who has to delete[] it.
+         */
+        uint8_t *render(FITSImage::Statistic &stats) const;
+
+        /**
+         * @brief getSolution gets the solution of the field, which a solve of the image should find
+         * @return The solution
+         */
+        FITSImage::Solution getSolution() const;
+
+        /**
+         * @brief getWCSData gets the WCS of the field, for instance to save it with the image
+         * @return The WCS
+         */
+        WCSData getWCSData() const;
+
+        /**
+         * @brief completeness measures how many of the drawn stars a star extraction found
+         * @param drawn The stars that were drawn, from getStars
+         * @param found The stars that were found
+         * @param radius How far in pixels a found star can be from a drawn one to count as finding it
+         * @param brightest Only the brightest this many drawn stars count, since the faintest are lost in the noise anyway.  0 counts all of them.
+         * @return The part of the drawn stars that were found, from 0 to 1
+         */
+        static double completeness(const QList<FITSImage::Star> &drawn, const QList<FITSImage::Star> &found, double radius, int brightest = 0);
+
+    private:
+        /**
+         * @brief tan makes the TAN projection of the field from its settings
+         */
+        tan_t tan() const;
+
+        /**
+         * @brief addStar adds a star with a magnitude at a position in the pixels of the star extraction
+         */
+        void addStar(double x, double y, double mag, double starRA, double starDEC);
+
+        /**
+         * @brief scaleStars sorts the stars brightest first and sets their peaks and fluxes from how much fainter they are than the brightest one
+         */
+        void scaleStars();
+
+        QList<FITSImage::Star> m_Stars;     // The stars that are drawn, their magnitudes are the catalog or luminosity function ones
+};
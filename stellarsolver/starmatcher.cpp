@@ -0,0 +1,370 @@
+/*  StarMatcher, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "starmatcher.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// The times the matches are found again with the transform fit to the ones before
+const int REFINE_PASSES = 3;
+
+quint64 cellKey(int x, int y)
+{
+    return static_cast<quint64>(static_cast<quint32>(x)) << 32 | static_cast<quint32>(y);
+}
+
+int cellOf(double value, double size)
+{
+    return static_cast<int>(std::floor(value / size));
+}
+
+// The positions of the brightest stars of the list, brightest first
+std::vector<int> brightest(const QList<FITSImage::Star> &stars, int count)
+{
+    std::vector<int> order(stars.size());
+    for(int i = 0; i < stars.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&stars](int a, int b)
+    {
+        return stars.at(a).flux > stars.at(b).flux;
+    });
+    if(static_cast<int>(order.size()) > count)
+        order.resize(count);
+    return order;
+}
+
+// The shift, rotation and scale that map the points from onto the points to with the least squares
+StarMatcher::Transform fitSimilarity(const std::vector<QPointF> &from, const std::vector<QPointF> &to)
+{
+    const int n = static_cast<int>(from.size());
+    double fromX = 0, fromY = 0, toX = 0, toY = 0;
+    for(int i = 0; i < n; i++)
+    {
+        fromX += from[i].x();
+        fromY += from[i].y();
+        toX += to[i].x();
+        toY += to[i].y();
+    }
+    fromX /= n;
+    fromY /= n;
+    toX /= n;
+    toY /= n;
+
+    double dot = 0, cross = 0, norm = 0;
+    for(int i = 0; i < n; i++)
+    {
+        const double x = from[i].x() - fromX, y = from[i].y() - fromY;
+        const double X = to[i].x() - toX, Y = to[i].y() - toY;
+        dot += x * X + y * Y;
+        cross += x * Y - y * X;
+        norm += x * x + y * y;
+    }
+
+    StarMatcher::Transform transform;
+    if(norm > 0)
+    {
+        transform.m11 = transform.m22 = dot / norm;
+        transform.m21 = cross / norm;
+        transform.m12 = -transform.m21;
+    }
+    transform.dx = toX - (transform.m11 * fromX + transform.m12 * fromY);
+    transform.dy = toY - (transform.m21 * fromX + transform.m22 * fromY);
+    return transform;
+}
+
+double determinant(const double m[3][3])
+{
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+           - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+           + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+}
+
+// The affine transform that maps the points from onto the points to with the least squares, it falls back
+// to the similarity when the points are about on a line
+StarMatcher::Transform fitAffine(const std::vector<QPointF> &from, const std::vector<QPointF> &to)
+{
+    // The normal equations are the same for both coordinates, only the right hand sides differ
+    double normal[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+    double rightX[3] = {0, 0, 0}, rightY[3] = {0, 0, 0};
+    for(size_t i = 0; i < from.size(); i++)
+    {
+        const double row[3] = {from[i].x(), from[i].y(), 1};
+        for(int j = 0; j < 3; j++)
+        {
+            for(int k = 0; k < 3; k++)
+                normal[j][k] += row[j] * row[k];
+            rightX[j] += row[j] * to[i].x();
+            rightY[j] += row[j] * to[i].y();
+        }
+    }
+    const double det = determinant(normal);
+    if(std::fabs(det) < 1e-9 * std::fabs(normal[0][0] * normal[1][1] * normal[2][2]) || det == 0)
+        return fitSimilarity(from, to);
+
+    // Cramer's rule, each unknown is the determinant with its column replaced by the right hand side
+    double solutionX[3], solutionY[3];
+    for(int column = 0; column < 3; column++)
+    {
+        double mx[3][3], my[3][3];
+        for(int j = 0; j < 3; j++)
+        {
+            for(int k = 0; k < 3; k++)
+                mx[j][k] = my[j][k] = normal[j][k];
+            mx[j][column] = rightX[j];
+            my[j][column] = rightY[j];
+        }
+        solutionX[column] = determinant(mx) / det;
+        solutionY[column] = determinant(my) / det;
+    }
+
+    StarMatcher::Transform transform;
+    transform.m11 = solutionX[0];
+    transform.m12 = solutionX[1];
+    transform.dx = solutionX[2];
+    transform.m21 = solutionY[0];
+    transform.m22 = solutionY[1];
+    transform.dy = solutionY[2];
+    return transform;
+}
+}
+
+double StarMatcher::Transform::rotation() const
+{
+    return std::atan2(m21 - m12, m11 + m22) * 180.0 / M_PI;
+}
+
+double StarMatcher::Transform::scale() const
+{
+    return std::sqrt(std::fabs(m11 * m22 - m12 * m21));
+}
+
+StarMatcher::StarMatcher(const QList<FITSImage::Star> &reference, double matchRadius) : m_Reference(reference),
+    m_MatchRadius(matchRadius > 0 ? matchRadius : DEFAULT_MATCH_RADIUS)
+{
+    m_Cells.reserve(m_Reference.size());
+    for(int i = 0; i < m_Reference.size(); i++)
+        m_Cells.insert(cellKey(m_Reference.at(i).x, m_Reference.at(i).y), i);
+
+    m_Triangles = triangles(m_Reference);
+    m_TriangleCells.reserve(static_cast<int>(m_Triangles.size()));
+    for(size_t i = 0; i < m_Triangles.size(); i++)
+        m_TriangleCells.insert(::cellKey(cellOf(m_Triangles[i].ratio1, TRIANGLE_TOLERANCE),
+                                         cellOf(m_Triangles[i].ratio2, TRIANGLE_TOLERANCE)), static_cast<int>(i));
+}
+
+quint64 StarMatcher::cellKey(double x, double y) const
+{
+    return ::cellKey(cellOf(x, m_MatchRadius), cellOf(y, m_MatchRadius));
+}
+
+std::vector<StarMatcher::Triangle> StarMatcher::triangles(const QList<FITSImage::Star> &stars)
+{
+    const std::vector<int> bright = brightest(stars, TRIANGLE_STARS);
+    std::vector<Triangle> found;
+    const int n = static_cast<int>(bright.size());
+    found.reserve(n * (n - 1) * (n - 2) / 6);
+    for(int i = 0; i < n; i++)
+    {
+        for(int j = i + 1; j < n; j++)
+        {
+            for(int k = j + 1; k < n; k++)
+            {
+                const int corners[3] = {bright[i], bright[j], bright[k]};
+                double sides[3];
+                for(int c = 0; c < 3; c++)
+                {
+                    // The side across from each corner
+                    const FITSImage::Star &a = stars.at(corners[(c + 1) % 3]), &b = stars.at(corners[(c + 2) % 3]);
+                    sides[c] = std::hypot(a.x - b.x, a.y - b.y);
+                }
+                int order[3] = {0, 1, 2};
+                std::sort(order, order + 3, [&sides](int a, int b)
+                {
+                    return sides[a] > sides[b];
+                });
+                if(sides[order[0]] <= 0)
+                    continue;
+
+                Triangle triangle;
+                triangle.ratio1 = sides[order[1]] / sides[order[0]];
+                triangle.ratio2 = sides[order[2]] / sides[order[0]];
+                // When two sides are about as long, the order of the corners could be different in the other frame
+                if(1 - triangle.ratio1 < 2 * TRIANGLE_TOLERANCE || triangle.ratio1 - triangle.ratio2 < 2 * TRIANGLE_TOLERANCE)
+                    continue;
+                triangle.corners[0] = corners[order[2]];
+                triangle.corners[1] = corners[order[1]];
+                triangle.corners[2] = corners[order[0]];
+                const FITSImage::Star &a = stars.at(triangle.corners[0]), &b = stars.at(triangle.corners[1]),
+                                       &c = stars.at(triangle.corners[2]);
+                triangle.clockwise = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x) < 0;
+                found.push_back(triangle);
+            }
+        }
+    }
+    return found;
+}
+
+int StarMatcher::nearestReference(const QPointF &position, double radius) const
+{
+    int nearest = -1;
+    double nearestDistance = radius * radius;
+    const int reach = static_cast<int>(std::ceil(radius / m_MatchRadius));
+    const int cellX = cellOf(position.x(), m_MatchRadius), cellY = cellOf(position.y(), m_MatchRadius);
+    for(int cy = cellY - reach; cy <= cellY + reach; cy++)
+    {
+        for(int cx = cellX - reach; cx <= cellX + reach; cx++)
+        {
+            const quint64 key = ::cellKey(cx, cy);
+            for(auto cell = m_Cells.constFind(key); cell != m_Cells.constEnd() && cell.key() == key; ++cell)
+            {
+                const FITSImage::Star &reference = m_Reference.at(cell.value());
+                const double dx = reference.x - position.x(), dy = reference.y - position.y();
+                if(dx * dx + dy * dy <= nearestDistance)
+                {
+                    nearest = cell.value();
+                    nearestDistance = dx * dx + dy * dy;
+                }
+            }
+        }
+    }
+    return nearest;
+}
+
+QList<StarMatcher::Match> StarMatcher::matchStars(const QList<FITSImage::Star> &stars, const Transform &transform, double radius) const
+{
+    std::vector<Match> candidates;
+    candidates.reserve(stars.size());
+    for(int i = 0; i < stars.size(); i++)
+    {
+        const QPointF position = transform.map(stars.at(i).x, stars.at(i).y);
+        const int nearest = nearestReference(position, radius);
+        if(nearest >= 0)
+            candidates.push_back({i, nearest, std::hypot(m_Reference.at(nearest).x - position.x(), m_Reference.at(nearest).y - position.y())});
+    }
+
+    // When two stars are nearest to the same reference star, the nearer one gets it
+    std::sort(candidates.begin(), candidates.end(), [](const Match & a, const Match & b)
+    {
+        return a.distance < b.distance;
+    });
+    std::vector<bool> used(m_Reference.size(), false);
+    QList<Match> matches;
+    for(const Match &candidate : candidates)
+    {
+        if(used[candidate.reference])
+            continue;
+        used[candidate.reference] = true;
+        matches.append(candidate);
+    }
+    return matches;
+}
+
+StarMatcher::Transform StarMatcher::alignTriangles(const QList<FITSImage::Star> &stars, bool &aligned) const
+{
+    aligned = false;
+    Transform best;
+    const std::vector<int> bright = brightest(stars, TRIANGLE_STARS);
+    int bestScore = 0;
+
+    // Each pair of triangles with the same shape gives the transform that lines them up, which is scored by how many of the
+    // brightest stars it lines up with a reference star.  The triangles of the right transform line up most of them.
+    for(const Triangle &triangle : triangles(stars))
+    {
+        const int cellX = cellOf(triangle.ratio1, TRIANGLE_TOLERANCE), cellY = cellOf(triangle.ratio2, TRIANGLE_TOLERANCE);
+        for(int cy = cellY - 1; cy <= cellY + 1; cy++)
+        {
+            for(int cx = cellX - 1; cx <= cellX + 1; cx++)
+            {
+                const quint64 key = ::cellKey(cx, cy);
+                for(auto cell = m_TriangleCells.constFind(key); cell != m_TriangleCells.constEnd() && cell.key() == key; ++cell)
+                {
+                    const Triangle &reference = m_Triangles[cell.value()];
+                    if(reference.clockwise != triangle.clockwise
+                            || std::fabs(reference.ratio1 - triangle.ratio1) > TRIANGLE_TOLERANCE
+                            || std::fabs(reference.ratio2 - triangle.ratio2) > TRIANGLE_TOLERANCE)
+                        continue;
+
+                    std::vector<QPointF> from, to;
+                    for(int c = 0; c < 3; c++)
+                    {
+                        from.push_back(QPointF(stars.at(triangle.corners[c]).x, stars.at(triangle.corners[c]).y));
+                        to.push_back(QPointF(m_Reference.at(reference.corners[c]).x, m_Reference.at(reference.corners[c]).y));
+                    }
+                    const Transform transform = fitSimilarity(from, to);
+
+                    int score = 0;
+                    for(int star : bright)
+                        if(nearestReference(transform.map(stars.at(star).x, stars.at(star).y), m_MatchRadius) >= 0)
+                            score++;
+                    if(score > bestScore)
+                    {
+                        bestScore = score;
+                        best = transform;
+                        if(score == static_cast<int>(bright.size()))
+                        {
+                            aligned = true;
+                            return best;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    // The three corners always line up, so it takes at least one more star to trust the transform
+    aligned = bestScore >= MIN_MATCHES;
+    return best;
+}
+
+StarMatcher::Result StarMatcher::match(const QList<FITSImage::Star> &stars, bool affine, const Transform *guess) const
+{
+    Result result;
+    if(stars.size() < MIN_MATCHES || m_Reference.size() < MIN_MATCHES)
+        return result;
+
+    Transform transform;
+    if(guess)
+        transform = *guess;
+    else
+    {
+        bool aligned = false;
+        transform = alignTriangles(stars, aligned);
+        if(!aligned)
+            return result;
+    }
+
+    // A guess can be further off than the triangles are, so the first pass looks twice as far
+    QList<Match> matches;
+    for(int pass = 0; pass < REFINE_PASSES; pass++)
+    {
+        matches = matchStars(stars, transform, pass == 0 ? 2 * m_MatchRadius : m_MatchRadius);
+        if(matches.size() < MIN_MATCHES)
+            return result;
+        std::vector<QPointF> from, to;
+        from.reserve(matches.size());
+        to.reserve(matches.size());
+        for(const Match &match : matches)
+        {
+            from.push_back(QPointF(stars.at(match.star).x, stars.at(match.star).y));
+            to.push_back(QPointF(m_Reference.at(match.reference).x, m_Reference.at(match.reference).y));
+        }
+        transform = affine ? fitAffine(from, to) : fitSimilarity(from, to);
+    }
+
+    result.matches = matchStars(stars, transform, m_MatchRadius);
+    if(result.matches.size() < MIN_MATCHES)
+        return result;
+    double sum = 0;
+    for(const Match &match : result.matches)
+        sum += match.distance * match.distance;
+    result.rms = std::sqrt(sum / result.matches.size());
+    result.transform = transform;
+    result.success = true;
+    return result;
+}
@@ -0,0 +1,115 @@
+/*  StarMatcher, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QList>
+#include <QMultiHash>
+#include <QPointF>
+
+#include <vector>
+
+#include "structuredefinitions.h"
+
+/**
+ * @brief The StarMatcher class cross matches the stars of frames with the stars of a reference frame, for instance to measure the drift
+ * and the field rotation of consecutive guide frames.  The reference stars are put in a spatial hash once, so each frame is matched in
+ * about linear time, and the same matcher can be used for any number of frames, from several threads at once.
+ * Unless a guess of the transform is given, a frame is first aligned by the triangles of its brightest stars: the shape of a triangle,
+ * the ratios of its sides, doesn't change when the frame is shifted, rotated or scaled, so the triangles with the same shape in both
+ * frames give the candidate transforms, and the one that lines up the most of the brightest stars wins.  Then every star is matched to
+ * the nearest reference star and the transform is fit to all of the matches by least squares.
+ */
+class StarMatcher
+{
+    public:
+        /**
+         * @brief The Transform struct maps the positions of the stars of a frame to those of the reference frame:
+         * x' = m11 * x + m12 * y + dx, y' = m21 * x + m22 * y + dy
+         */
+        struct Transform
+        {
+            double m11 { 1 }, m12 { 0 }, m21 { 0 }, m22 { 1 };
+            double dx { 0 }, dy { 0 };
+
+            QPointF map(double x, double y) const
+            {
+                return QPointF(m11 * x + m12 * y + dx, m21 * x + m22 * y + dy);
+            }
+
+            // The rotation of the frame, in degrees counterclockwise
+            double rotation() const;
+
+            // How much bigger the reference frame is, the square root of the change of the area for an affine transform
+            double scale() const;
+        };
+
+        // A star of the frame and the reference star it matches, as their positions in the lists
+        struct Match
+        {
+            int star;
+            int reference;
+            double distance;    // How far apart they are after the transform, in pixels
+        };
+
+        // The result of matching a frame
+        struct Result
+        {
+            bool success { false };     // Whether enough of the stars matched
+            Transform transform;
+            QList<Match> matches;
+            double rms { 0 };           // The RMS of the distances of the matches, in pixels
+        };
+
+        /**
+         * @brief StarMatcher puts the reference stars in the spatial hash and finds the triangles of the brightest of them
+         * @param reference The stars of the reference frame
+         * @param matchRadius How far apart the same star in two aligned frames can be, in pixels
+         */
+        explicit StarMatcher(const QList<FITSImage::Star> &reference, double matchRadius = DEFAULT_MATCH_RADIUS);
+
+        /**
+         * @brief match matches the stars of a frame with the reference stars
+         * @param stars The stars of the frame
+         * @param affine Whether the transform is fit as an affine transform, otherwise it is a shift, a rotation and a scale
+         * @param guess The transform to start from instead of aligning the triangles, like the one of the frame before, it can be nullptr
+         * @return The transform and the matches, each star and each reference star is in at most one match
+         */
+        Result match(const QList<FITSImage::Star> &stars, bool affine = false, const Transform *guess = nullptr) const;
+
+        // The number of brightest stars of each frame whose triangles are compared
+        static const int TRIANGLE_STARS = 15;
+        // How much the ratios of the sides of the same triangle in two frames can differ
+        static constexpr double TRIANGLE_TOLERANCE = 0.01;
+        // The fewest matches a transform needs
+        static const int MIN_MATCHES = 4;
+        static constexpr double DEFAULT_MATCH_RADIUS = 3;
+
+    private:
+        // A triangle of three of the brightest stars, by its shape.  The corners are ordered by the sides, so the same
+        // corner is first in the same triangle of another frame: the longest and the middle side meet at the first one,
+        // the longest and the shortest at the second one.
+        struct Triangle
+        {
+            int corners[3];
+            double ratio1, ratio2;  // The middle and the shortest side over the longest one
+            bool clockwise;         // A mirrored triangle has the same shape, it can't be matched without a reflection
+        };
+
+        static std::vector<Triangle> triangles(const QList<FITSImage::Star> &stars);
+        quint64 cellKey(double x, double y) const;
+        int nearestReference(const QPointF &position, double radius) const;
+        QList<Match> matchStars(const QList<FITSImage::Star> &stars, const Transform &transform, double radius) const;
+        Transform alignTriangles(const QList<FITSImage::Star> &stars, bool &aligned) const;
+
+        QList<FITSImage::Star> m_Reference;
+        double m_MatchRadius;
+        QMultiHash<quint64, int> m_Cells;           // The reference stars in cells of m_MatchRadius
+        std::vector<Triangle> m_Triangles;          // The triangles of the brightest reference stars
+        QMultiHash<quint64, int> m_TriangleCells;   // Those triangles in cells of TRIANGLE_TOLERANCE of their ratios
+};
@@ -0,0 +1,234 @@
+/*  StarMerger, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "starmerger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+StarMerger::StarMerger(const QRect &area, double overlap) : m_Area(area), m_Overlap(std::max(0.0, overlap))
+{
+}
+
+void StarMerger::reserve(int stars)
+{
+    if(stars <= 0)
+        return;
+    m_Entries.reserve(stars);
+    m_Next.reserve(stars);
+    m_Cells.reserve(stars);
+}
+
+QList<FITSImage::Star> StarMerger::addPartition(const QList<FITSImage::Star> &stars, int dataX, int dataY, const QRect &inner,
+        const QRect &data)
+{
+    const int partition = m_Partitions++;
+    const Window bounds = window(inner, data);
+
+    QList<FITSImage::Star> added;
+    added.reserve(stars.size());
+    for(const FITSImage::Star &partitionStar : stars)
+    {
+        Entry entry;
+        if(!take(partitionStar, partition, dataX, dataY, bounds, &entry))
+            continue;
+
+        // Without an overlap, the partitions own different pixels, so there is nothing to merge
+        const int duplicate = m_Overlap > 0 ? findDuplicate(entry.star, partition) : -1;
+        if(duplicate >= 0)
+        {
+            if(entry.edge <= m_Entries[duplicate].edge)
+                continue;
+            m_Entries[duplicate].merged = true;
+            m_Count--;
+            insert(entry);
+            continue;
+        }
+        insert(entry);
+        added.append(entry.star);
+    }
+    return added;
+}
+
+QList<FITSImage::Star> StarMerger::stars() const
+{
+    QList<FITSImage::Star> merged;
+    merged.reserve(m_Count);
+    for(const Entry &entry : m_Entries)
+        if(!entry.merged)
+            merged.append(entry.star);
+    return merged;
+}
+
+void StarMerger::setPartitions(int partitions)
+{
+    m_Slots.assign(std::max(0, partitions), Slot());
+}
+
+void StarMerger::fillPartition(int slot, const QList<FITSImage::Star> &stars, int dataX, int dataY, const QRect &inner,
+                               const QRect &data)
+{
+    const Window bounds = window(inner, data);
+    std::vector<Entry> &entries = m_Slots[slot].entries;
+    entries.clear();
+    entries.reserve(stars.size());
+    for(const FITSImage::Star &partitionStar : stars)
+    {
+        Entry entry;
+        if(!take(partitionStar, slot, dataX, dataY, bounds, &entry))
+            continue;
+        entry.position = static_cast<int>(entries.size());
+        entries.push_back(entry);
+    }
+}
+
+QList<FITSImage::Star> StarMerger::mergePartitions()
+{
+    // The stars near the boundaries are merged in the order of the slots, the same way as addPartition merges them.
+    // Then the ones that were replaced by a star of a later partition are marked in their slots.
+    if(m_Overlap > 0)
+    {
+        for(Slot &slot : m_Slots)
+        {
+            for(const Entry &entry : slot.entries)
+            {
+                if(!entry.border)
+                    continue;
+                const int duplicate = findDuplicate(entry.star, entry.partition);
+                if(duplicate >= 0)
+                {
+                    if(entry.edge <= m_Entries[duplicate].edge)
+                    {
+                        slot.entries[entry.position].merged = true;
+                        slot.merged++;
+                        continue;
+                    }
+                    m_Entries[duplicate].merged = true;
+                    m_Count--;
+                }
+                insert(entry);
+            }
+        }
+        for(const Entry &entry : m_Entries)
+        {
+            Slot &slot = m_Slots[entry.partition];
+            if(entry.merged && !slot.entries[entry.position].merged)
+            {
+                slot.entries[entry.position].merged = true;
+                slot.merged++;
+            }
+        }
+    }
+
+    int total = 0;
+    for(const Slot &slot : m_Slots)
+        total += static_cast<int>(slot.entries.size()) - slot.merged;
+    QList<FITSImage::Star> merged;
+    merged.reserve(total);
+    for(const Slot &slot : m_Slots)
+        for(const Entry &entry : slot.entries)
+            if(!entry.merged)
+                merged.append(entry.star);
+    return merged;
+}
+
+StarMerger::Window StarMerger::window(const QRect &inner, const QRect &data) const
+{
+    Window bounds;
+    // The stars are taken from the inner pixels and the overlap past them, but never from outside of the area
+    bounds.left = std::max(m_Area.left() + 0.5, inner.left() + 0.5 - m_Overlap);
+    bounds.top = std::max(m_Area.top() + 0.5, inner.top() + 0.5 - m_Overlap);
+    bounds.right = std::min(m_Area.right() + 1.5, inner.right() + 1.5 + m_Overlap);
+    bounds.bottom = std::min(m_Area.bottom() + 1.5, inner.bottom() + 1.5 + m_Overlap);
+
+    // The edges of the data at the edges of the area are the same for every partition, so only the others tell them apart
+    const double far = std::numeric_limits<float>::max();
+    bounds.dataLeft = data.left() > m_Area.left() ? data.left() + 0.5 : -far;
+    bounds.dataTop = data.top() > m_Area.top() ? data.top() + 0.5 : -far;
+    bounds.dataRight = data.right() < m_Area.right() ? data.right() + 1.5 : far;
+    bounds.dataBottom = data.bottom() < m_Area.bottom() ? data.bottom() + 1.5 : far;
+
+    // The partition past a boundary takes the stars up to the overlap into this one, and its duplicates are within DUPLICATE_RADIUS of those
+    const double reach = m_Overlap + DUPLICATE_RADIUS;
+    bounds.coreLeft = inner.left() > m_Area.left() ? inner.left() + 0.5 + reach : -far;
+    bounds.coreTop = inner.top() > m_Area.top() ? inner.top() + 0.5 + reach : -far;
+    bounds.coreRight = inner.right() < m_Area.right() ? inner.right() + 1.5 - reach : far;
+    bounds.coreBottom = inner.bottom() < m_Area.bottom() ? inner.bottom() + 1.5 - reach : far;
+    return bounds;
+}
+
+bool StarMerger::take(const FITSImage::Star &star, int partition, int dataX, int dataY, const Window &bounds, Entry *entry) const
+{
+    entry->star = star;
+    entry->star.x += dataX;
+    entry->star.y += dataY;
+    const double x = entry->star.x, y = entry->star.y;
+    if(x < bounds.left || x >= bounds.right || y < bounds.top || y >= bounds.bottom)
+        return false;
+    entry->partition = partition;
+    entry->edge = static_cast<float>(std::min(std::min(x - bounds.dataLeft, bounds.dataRight - x), std::min(y - bounds.dataTop,
+                                     bounds.dataBottom - y)));
+    entry->merged = false;
+    entry->border = x < bounds.coreLeft || x >= bounds.coreRight || y < bounds.coreTop || y >= bounds.coreBottom;
+    entry->position = 0;
+    return true;
+}
+
+int StarMerger::findDuplicate(const FITSImage::Star &star, int partition) const
+{
+    const int cellX = static_cast<int>(std::floor(star.x / DUPLICATE_RADIUS));
+    const int cellY = static_cast<int>(std::floor(star.y / DUPLICATE_RADIUS));
+    int nearest = -1;
+    double nearestDistance = DUPLICATE_RADIUS * DUPLICATE_RADIUS;
+    for(int cy = cellY - 1; cy <= cellY + 1; cy++)
+    {
+        for(int cx = cellX - 1; cx <= cellX + 1; cx++)
+        {
+            auto cell = m_Cells.constFind(cellKey(cx, cy));
+            if(cell == m_Cells.constEnd())
+                continue;
+            for(int i = cell.value(); i >= 0; i = m_Next[i])
+            {
+                const Entry &other = m_Entries[i];
+                // Two stars close together in one partition were deblended, so they are really two stars
+                if(other.merged || other.partition == partition)
+                    continue;
+                const double dx = other.star.x - star.x;
+                const double dy = other.star.y - star.y;
+                if(dx * dx + dy * dy <= nearestDistance)
+                {
+                    nearest = i;
+                    nearestDistance = dx * dx + dy * dy;
+                }
+            }
+        }
+    }
+    return nearest;
+}
+
+void StarMerger::insert(const Entry &entry)
+{
+    const int index = static_cast<int>(m_Entries.size());
+    m_Entries.push_back(entry);
+    m_Count++;
+    if(m_Overlap <= 0)
+        return;
+    const quint64 key = cellKey(static_cast<int>(std::floor(entry.star.x / DUPLICATE_RADIUS)),
+                                static_cast<int>(std::floor(entry.star.y / DUPLICATE_RADIUS)));
+    auto cell = m_Cells.find(key);
+    if(cell == m_Cells.end())
+    {
+        m_Next.push_back(-1);
+        m_Cells.insert(key, index);
+    }
+    else
+    {
+        m_Next.push_back(cell.value());
+        cell.value() = index;
+    }
+}
@@ -0,0 +1,142 @@
+/*  StarMerger, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include <vector>
+
+//QT Includes
+#include <QHash>
+#include <QList>
+#include <QRect>
+
+#include "structuredefinitions.h"
+
+/**
+ * @brief The StarMerger class merges the stars of the partitions of an image into the stars of the image.  Each partition owns
+ * the pixels inside its margins, and a star belongs to the pixel its centroid is in, so each star is taken from exactly one
+ * partition and none are lost between them.  The partitions can also overlap, then the stars within the overlap of a boundary
+ * are taken from both sides and the ones found twice are merged with a spatial hash, keeping the one found furthest from the
+ * edge of its partition's data, which is the one measured with the most of its light.  This is linear in the number of stars.
+ * The stars are in the 1 based pixels of SEP, where pixel i goes from i + 0.5 to i + 1.5.
+ * The partitions can be added one after the other as they finish with addPartition, or each one can fill a slot of its own from its
+ * thread with fillPartition, and then mergePartitions merges them all at once.  Only the stars near the boundaries can have been found
+ * twice, so the rest of them are never hashed.
+ */
+class StarMerger
+{
+    public:
+        /**
+         * @brief StarMerger makes a merger for the stars of an area of the image
+         * @param area The pixels of the area the partitions cover, the stars outside of it are left out
+         * @param overlap How many pixels past its boundaries with the other partitions the stars of a partition are taken
+         */
+        explicit StarMerger(const QRect &area, double overlap = 0);
+
+        /**
+         * @brief reserve makes room for this many stars, so the merge doesn't have to grow its lists
+         */
+        void reserve(int stars);
+
+        /**
+         * @brief addPartition adds the stars of a partition
+         * @param stars The stars in the pixels of the partition's data
+         * @param dataX, dataY Where the partition's data starts in the image
+         * @param inner The pixels of the image the partition owns, the part inside its margins
+         * @param data The pixels of the image the partition was extracted from
+         * @return The stars that were new, in the pixels of the image, not the ones that were merged with a star found before
+         */
+        QList<FITSImage::Star> addPartition(const QList<FITSImage::Star> &stars, int dataX, int dataY, const QRect &inner,
+                                            const QRect &data);
+
+        /**
+         * @brief stars gets the merged stars, in the order they were added
+         */
+        QList<FITSImage::Star> stars() const;
+
+        /**
+         * @brief setPartitions makes a slot for each of the partitions, for fillPartition
+         */
+        void setPartitions(int partitions);
+
+        /**
+         * @brief fillPartition takes the stars of a partition into its slot, like addPartition but without merging them.  The partitions
+         * can fill their slots at the same time from different threads, since each one only writes its own.
+         * @param slot The slot of the partition, from 0 to the number of partitions given to setPartitions
+         * @param stars, dataX, dataY, inner, data As for addPartition
+         */
+        void fillPartition(int slot, const QList<FITSImage::Star> &stars, int dataX, int dataY, const QRect &inner, const QRect &data);
+
+        /**
+         * @brief mergePartitions merges the stars of the slots, the same way as adding the partitions in the order of their slots would
+         * @return The merged stars, in the order of the slots
+         */
+        QList<FITSImage::Star> mergePartitions();
+
+        /**
+         * @brief count gets how many merged stars there are
+         */
+        int count() const
+        {
+            return m_Count;
+        }
+
+        /**
+         * @brief owns gets whether a star is in a pixel from x1, y1 to x2, y2 inclusive, so it belongs to the partition with those inner pixels
+         */
+        static bool owns(float x, float y, int x1, int y1, int x2, int y2)
+        {
+            return x >= x1 + 0.5f && x < x2 + 1.5f && y >= y1 + 0.5f && y < y2 + 1.5f;
+        }
+
+        // The centroids of the same star found by two partitions that see different parts of it are at most this many pixels apart
+        static constexpr double DUPLICATE_RADIUS = 2;
+
+    private:
+        struct Entry
+        {
+            FITSImage::Star star;
+            int partition;
+            float edge;         // How far the star is from the edge of its partition's data that faces the other partitions
+            bool merged;        // Whether it was replaced by the same star found further from an edge
+            bool border;        // Whether it is close enough to a boundary to have been found by another partition too
+            int position;       // Where it is in its slot, see fillPartition
+        };
+
+        // The part of the image a partition takes its stars from
+        struct Window
+        {
+            double left, top, right, bottom;
+            double dataLeft, dataTop, dataRight, dataBottom;    // The edges of its data that face the other partitions
+            double coreLeft, coreTop, coreRight, coreBottom;    // No other partition takes a star close enough to one inside of these
+        };
+
+        struct Slot
+        {
+            std::vector<Entry> entries;
+            int merged { 0 };
+        };
+
+        Window window(const QRect &inner, const QRect &data) const;
+        bool take(const FITSImage::Star &star, int partition, int dataX, int dataY, const Window &bounds, Entry *entry) const;
+        int findDuplicate(const FITSImage::Star &star, int partition) const;
+        void insert(const Entry &entry);
+        static quint64 cellKey(int cellX, int cellY)
+        {
+            return static_cast<quint64>(static_cast<quint32>(cellX)) << 32 | static_cast<quint32>(cellY);
+        }
+
+        const QRect m_Area;
+        const double m_Overlap;
+        int m_Partitions { 0 };
+        int m_Count { 0 };
+        std::vector<Entry> m_Entries;
+        // The entries in each cell of DUPLICATE_RADIUS pixels are a chain through m_Next, from the last one added
+        QHash<quint64, int> m_Cells;
+        std::vector<int> m_Next;
+        std::vector<Slot> m_Slots;
+};
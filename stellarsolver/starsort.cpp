@@ -0,0 +1,204 @@
+/*  StarSort, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "starsort.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+//QT Includes
+#include <QThread>
+#include <QVector>
+#include <QtConcurrent>
+
+namespace
+{
+// The sortable bits of the key of a star and where the star was in the list
+template <typename Bits>
+struct Entry
+{
+    Bits key;
+    int index;
+};
+
+template <typename Bits>
+inline bool entryLess(const Entry<Bits> &a, const Entry<Bits> &b)
+{
+    return a.key < b.key || (a.key == b.key && a.index < b.index);
+}
+
+// This turns a float or double into an unsigned integer of the same size that sorts in the same order.
+// The negative numbers get all of their bits flipped and the positive ones just the sign bit, NaN gets the biggest value.
+template <typename Bits, typename Key>
+inline Bits sortableBits(Key key, bool descending)
+{
+    const Bits sign = Bits(1) << (sizeof(Bits) * 8 - 1);
+    if(std::isnan(key))
+        return ~Bits(0);
+    // -0 and 0 are equal, so they get the same bits
+    if(key == 0)
+        key = 0;
+    Bits bits;
+    memcpy(&bits, &key, sizeof(Bits));
+    bits = (bits & sign) ? ~bits : (bits | sign);
+    // No number gets all of the bits set when they are flipped, so NaN still goes last
+    return descending ? ~bits : bits;
+}
+
+// This runs the function for each chunk, on the threads of the global pool when there is more than one
+template <typename Function>
+void forEachChunk(const QVector<int> &chunks, Function function)
+{
+    if(chunks.size() == 1)
+        function(0);
+    else
+        QtConcurrent::blockingMap(chunks, [&function](int chunk)
+    {
+        function(chunk);
+    });
+}
+
+// A stable least significant digit radix sort, one byte of the keys at a time.  Each chunk of the entries counts its digits
+// and then moves its entries to where the counts of all of the chunks put them, so the chunks can be done in parallel.
+template <typename Bits>
+void radixSort(std::vector<Entry<Bits>> &entries)
+{
+    const int count = entries.size();
+    int numChunks = 1;
+    if(count >= StarSort::ParallelThreshold)
+        numChunks = qBound(1, QThread::idealThreadCount(), count / (StarSort::ParallelThreshold / 4));
+    const int chunkSize = (count + numChunks - 1) / numChunks;
+    QVector<int> chunks;
+    for(int chunk = 0; chunk < numChunks; chunk++)
+        chunks.append(chunk);
+
+    std::vector<Entry<Bits>> buffer(count);
+    Entry<Bits> *from = entries.data();
+    Entry<Bits> *to = buffer.data();
+    std::vector<std::array<int, 256>> counts(numChunks);
+    for(unsigned int shift = 0; shift < sizeof(Bits) * 8; shift += 8)
+    {
+        forEachChunk(chunks, [&](int chunk)
+        {
+            std::array<int, 256> &digits = counts[chunk];
+            digits.fill(0);
+            const int end = std::min(count, (chunk + 1) * chunkSize);
+            for(int i = chunk * chunkSize; i < end; i++)
+                digits[(from[i].key >> shift) & 0xFF]++;
+        });
+
+        // When all of the keys have the same digit, the entries are already in order for it
+        bool allSame = false;
+        for(int digit = 0; digit < 256 && !allSame; digit++)
+        {
+            int total = 0;
+            for(int chunk = 0; chunk < numChunks; chunk++)
+                total += counts[chunk][digit];
+            allSame = total == count;
+        }
+        if(allSame)
+            continue;
+
+        // The counts become where the entries of each digit of each chunk start
+        int start = 0;
+        for(int digit = 0; digit < 256; digit++)
+        {
+            for(int chunk = 0; chunk < numChunks; chunk++)
+            {
+                const int n = counts[chunk][digit];
+                counts[chunk][digit] = start;
+                start += n;
+            }
+        }
+
+        forEachChunk(chunks, [&](int chunk)
+        {
+            std::array<int, 256> &digits = counts[chunk];
+            const int end = std::min(count, (chunk + 1) * chunkSize);
+            for(int i = chunk * chunkSize; i < end; i++)
+                to[digits[(from[i].key >> shift) & 0xFF]++] = from[i];
+        });
+        std::swap(from, to);
+    }
+    if(from != entries.data())
+        entries.swap(buffer);
+}
+
+// This sorts the stars in perm, or all of them in order if it is null, and gives their positions in it in the sorted order
+template <typename Key>
+std::vector<int> sortedPositions(const Key *keys, const int *perm, int count, bool descending, int first)
+{
+    typedef typename std::conditional<sizeof(Key) == 4, uint32_t, uint64_t>::type Bits;
+    if(count <= 0)
+        return std::vector<int>();
+
+    std::vector<Entry<Bits>> entries(count);
+    for(int i = 0; i < count; i++)
+    {
+        entries[i].key = sortableBits<Bits>(keys[perm ? perm[i] : i], descending);
+        entries[i].index = i;
+    }
+
+    const bool partial = first >= 0 && first < count;
+    // A partial sort takes n log(first), so it is faster than a radix sort when only a few stars are needed
+    if(partial && (count < StarSort::RadixThreshold || first < count / 16))
+        std::partial_sort(entries.begin(), entries.begin() + first, entries.end(), entryLess<Bits>);
+    else if(count < StarSort::RadixThreshold)
+        std::sort(entries.begin(), entries.end(), entryLess<Bits>);
+    else
+        radixSort(entries);
+
+    std::vector<int> positions(partial ? first : count);
+    for(size_t i = 0; i < positions.size(); i++)
+        positions[i] = entries[i].index;
+    return positions;
+}
+
+template <typename Key>
+int *sortPermutation(const Key *keys, int count, bool descending, int *perm)
+{
+    if(!perm)
+    {
+        perm = static_cast<int *>(malloc(std::max(count, 1) * sizeof(int)));
+        if(!perm)
+            return nullptr;
+        for(int i = 0; i < count; i++)
+            perm[i] = i;
+    }
+    const std::vector<int> positions = sortedPositions(keys, perm, count, descending, -1);
+    std::vector<int> sorted(count);
+    for(int i = 0; i < count; i++)
+        sorted[i] = perm[positions[i]];
+    std::copy(sorted.begin(), sorted.end(), perm);
+    return perm;
+}
+}
+
+std::vector<int> StarSort::order(const float *keys, int count, bool descending, int first)
+{
+    return sortedPositions(keys, nullptr, count, descending, first);
+}
+
+std::vector<int> StarSort::order(const double *keys, int count, bool descending, int first)
+{
+    return sortedPositions(keys, nullptr, count, descending, first);
+}
+
+int* sssort_doubles(const double *keys, int count, int descending, int *perm)
+{
+    return sortPermutation(keys, count, descending != 0, perm);
+}
+
+int* sssort_floats(const float *keys, int count, int descending, int *perm)
+{
+    return sortPermutation(keys, count, descending != 0, perm);
+}
@@ -0,0 +1,54 @@
+/*  StarSort, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#ifndef STARSORT_H
+#define STARSORT_H
+
+#ifdef __cplusplus
+#include <vector>
+
+/**
+ * @brief StarSort sorts stars by a float or double key, such as their magnitudes, fluxes or sizes, and gives the order of the stars.
+ * The keys are turned into unsigned integers that sort the same way, so the sort compares integers inline instead of calling
+ * a comparison function for each pair like qsort and permuted_sort do.  Small lists are sorted with std::sort, and lists of
+ * RadixThreshold stars or more with a radix sort, which is split between the threads of the global pool from ParallelThreshold stars.
+ * All of them give the same order: stars with equal keys stay in the order they came in, and the stars with NaN keys go last.
+ */
+namespace StarSort
+{
+// The lists with this many stars or more get a radix sort
+static const int RadixThreshold = 4096;
+// The radix sorts of lists with this many stars or more are split between threads
+static const int ParallelThreshold = 1 << 17;
+
+/**
+ * @brief order gets the order of the stars sorted by their keys
+ * @param keys The key of each star
+ * @param count The number of stars
+ * @param descending Whether the biggest keys go first
+ * @param first If it is between 0 and count, only this many of the first stars in the order are needed, which can be faster
+ * @return The indexes of the stars in the sorted order, only the first ones if first was given
+ */
+std::vector<int> order(const float *keys, int count, bool descending, int first = -1);
+std::vector<int> order(const double *keys, int count, bool descending, int first = -1);
+}
+#endif
+
+#ifdef __cplusplus
+    #define STARSORT_EXPORT_C extern "C"
+#else
+    #define STARSORT_EXPORT_C
+#endif
+
+// This provides a C interface to the StarSort so that astrometry.net can sort its stars with it, like permuted_sort does.
+// The keys are in the order of the stars, and perm is sorted so that keys[perm[i]] are in order, where the stars that are
+// equal stay in the order they had in perm.  If perm is NULL, it is allocated with malloc and starts in the order of the keys.
+// It returns perm.
+STARSORT_EXPORT_C int* sssort_doubles(const double *keys, int count, int descending, int *perm);
+STARSORT_EXPORT_C int* sssort_floats(const float *keys, int count, int descending, int *perm);
+
+#endif // STARSORT_H
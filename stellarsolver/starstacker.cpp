@@ -0,0 +1,186 @@
+/*  StarStacker, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "starstacker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+//QT Includes
+#include <QHash>
+#include <QMultiHash>
+
+namespace
+{
+quint64 cellKey(int x, int y)
+{
+    return static_cast<quint64>(static_cast<quint32>(x)) << 32 | static_cast<quint32>(y);
+}
+
+int cellOf(double value)
+{
+    return static_cast<int>(std::floor(value / StarStacker::MATCH_RADIUS));
+}
+
+// The star of the list that is nearest to x, y within radius, or -1
+int nearestStar(const QList<FITSImage::Star> &stars, double x, double y, double radius)
+{
+    int nearest = -1;
+    double nearestDistance = radius * radius;
+    for(int i = 0; i < stars.size(); i++)
+    {
+        const double dx = stars.at(i).x - x, dy = stars.at(i).y - y;
+        if(dx * dx + dy * dy <= nearestDistance)
+        {
+            nearest = i;
+            nearestDistance = dx * dx + dy * dy;
+        }
+    }
+    return nearest;
+}
+}
+
+StarStacker::StarStacker(const QList<FITSImage::Star> &reference) : m_Reference(brightest(reference)), m_Stars(reference)
+{
+}
+
+QList<FITSImage::Star> StarStacker::brightest(const QList<FITSImage::Star> &stars)
+{
+    QList<FITSImage::Star> sorted = stars;
+    std::sort(sorted.begin(), sorted.end(), [](const FITSImage::Star & a, const FITSImage::Star & b)
+    {
+        return a.flux > b.flux;
+    });
+    if(sorted.size() > REGISTRATION_STARS)
+        sorted.erase(sorted.begin() + REGISTRATION_STARS, sorted.end());
+    return sorted;
+}
+
+bool StarStacker::registerFrame(const QList<FITSImage::Star> &stars, QPointF &shift) const
+{
+    const QList<FITSImage::Star> frame = brightest(stars);
+    if(frame.size() < MIN_VOTES || m_Reference.size() < MIN_VOTES)
+        return false;
+
+    // Every pair of a bright star of the first frame and one of this frame votes for the shift between them.  The pairs of the
+    // same stars all vote for about the same shift, the others are spread out, so the cell with the most votes around it wins.
+    QHash<quint64, int> votes;
+    votes.reserve(m_Reference.size() * frame.size());
+    for(const FITSImage::Star &reference : m_Reference)
+        for(const FITSImage::Star &star : frame)
+            votes[cellKey(cellOf(reference.x - star.x), cellOf(reference.y - star.y))]++;
+    int bestVotes = 0, bestX = 0, bestY = 0;
+    for(auto cell = votes.constBegin(); cell != votes.constEnd(); ++cell)
+    {
+        const int x = static_cast<qint32>(cell.key() >> 32), y = static_cast<qint32>(cell.key() & 0xffffffff);
+        int around = 0;
+        for(int dy = -1; dy <= 1; dy++)
+            for(int dx = -1; dx <= 1; dx++)
+                around += votes.value(cellKey(x + dx, y + dy), 0);
+        if(around > bestVotes)
+        {
+            bestVotes = around;
+            bestX = x;
+            bestY = y;
+        }
+    }
+    if(bestVotes < MIN_VOTES)
+        return false;
+
+    // The shift is refined from the stars that match with it, first within the cells around the best one and then within MATCH_RADIUS
+    shift = QPointF((bestX + 0.5) * MATCH_RADIUS, (bestY + 0.5) * MATCH_RADIUS);
+    for(const double radius : {2 * MATCH_RADIUS, MATCH_RADIUS})
+    {
+        double sumX = 0, sumY = 0;
+        int matches = 0;
+        for(const FITSImage::Star &star : frame)
+        {
+            const int match = nearestStar(m_Reference, star.x + shift.x(), star.y + shift.y(), radius);
+            if(match < 0)
+                continue;
+            sumX += m_Reference.at(match).x - star.x;
+            sumY += m_Reference.at(match).y - star.y;
+            matches++;
+        }
+        if(matches < MIN_VOTES)
+            return false;
+        shift = QPointF(sumX / matches, sumY / matches);
+    }
+    return true;
+}
+
+bool StarStacker::add(const QList<FITSImage::Star> &stars, QPointF *shift)
+{
+    QPointF frameShift;
+    if(!registerFrame(stars, frameShift))
+        return false;
+    if(shift)
+        *shift = frameShift;
+
+    QMultiHash<quint64, int> cells;
+    cells.reserve(m_Stars.size());
+    for(int i = 0; i < m_Stars.size(); i++)
+        cells.insert(cellKey(cellOf(m_Stars.at(i).x), cellOf(m_Stars.at(i).y)), i);
+
+    // Each merged star can only be matched by one star of the frame, the ones that aren't matched are new stars
+    std::vector<bool> matched(m_Stars.size(), false);
+    QList<FITSImage::Star> added;
+    for(FITSImage::Star star : stars)
+    {
+        star.x += frameShift.x();
+        star.y += frameShift.y();
+        int nearest = -1;
+        double nearestDistance = MATCH_RADIUS * MATCH_RADIUS;
+        const int cellX = cellOf(star.x), cellY = cellOf(star.y);
+        for(int cy = cellY - 1; cy <= cellY + 1; cy++)
+        {
+            for(int cx = cellX - 1; cx <= cellX + 1; cx++)
+            {
+                const quint64 key = cellKey(cx, cy);
+                for(auto cell = cells.constFind(key); cell != cells.constEnd() && cell.key() == key; ++cell)
+                {
+                    const FITSImage::Star &merged = m_Stars.at(cell.value());
+                    const double dx = merged.x - star.x, dy = merged.y - star.y;
+                    if(!matched[cell.value()] && dx * dx + dy * dy <= nearestDistance)
+                    {
+                        nearest = cell.value();
+                        nearestDistance = dx * dx + dy * dy;
+                    }
+                }
+            }
+        }
+        if(nearest < 0)
+        {
+            added.append(star);
+            continue;
+        }
+        matched[nearest] = true;
+
+        FITSImage::Star &merged = m_Stars[nearest];
+        const double oldFlux = std::max(0.0f, merged.flux), newFlux = std::max(0.0f, star.flux);
+        const double total = oldFlux + newFlux;
+        const double weight = total > 0 ? newFlux / total : 0.5;
+        merged.x += weight * (star.x - merged.x);
+        merged.y += weight * (star.y - merged.y);
+        merged.a += weight * (star.a - merged.a);
+        merged.b += weight * (star.b - merged.b);
+        merged.HFR += weight * (star.HFR - merged.HFR);
+        if(newFlux > oldFlux)
+            merged.theta = star.theta;
+        if(oldFlux > 0 && total > 0)
+            merged.mag -= 2.5 * log10(total / oldFlux);
+        else
+            merged.mag = star.mag;
+        merged.flux = total;
+        merged.peak += star.peak;
+        merged.numPixels = std::max(merged.numPixels, star.numPixels);
+    }
+    m_Stars.append(added);
+    m_Frames++;
+    return true;
+}
@@ -0,0 +1,68 @@
+/*  StarStacker, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QList>
+#include <QPointF>
+
+#include "structuredefinitions.h"
+
+/**
+ * @brief The StarStacker class merges the star lists of several short exposures of the same field into the star list of one longer
+ * exposure.  Each frame is registered onto the first by the shift that the most pairs of their brightest stars agree on, which is what
+ * the drift of a mount between short exposures mostly is, and then each of its stars is matched to the nearest merged star.  The flux
+ * of a matched star is added to it and its position, shape and HFR are averaged by flux, the stars that weren't matched are added.
+ */
+class StarStacker
+{
+    public:
+        /**
+         * @brief StarStacker starts a stack with the stars of the first frame, which the others are registered onto
+         */
+        explicit StarStacker(const QList<FITSImage::Star> &reference);
+
+        /**
+         * @brief add registers the stars of another frame and merges them into the stack
+         * @param stars The stars of the frame
+         * @param shift Gets how far the frame is shifted from the first one, if it isn't nullptr
+         * @return Whether the frame could be registered, it isn't merged otherwise
+         */
+        bool add(const QList<FITSImage::Star> &stars, QPointF *shift = nullptr);
+
+        /**
+         * @brief stars gets the merged stars
+         */
+        QList<FITSImage::Star> stars() const
+        {
+            return m_Stars;
+        }
+
+        /**
+         * @brief frames gets how many frames were merged, including the first one
+         */
+        int frames() const
+        {
+            return m_Frames;
+        }
+
+        // The number of brightest stars of each frame that the shift is found from
+        static const int REGISTRATION_STARS = 50;
+        // The fewest pairs of the brightest stars that have to agree on the shift
+        static const int MIN_VOTES = 4;
+        // How far apart the centroids of the same star in two registered frames can be, in pixels
+        static constexpr double MATCH_RADIUS = 3;
+
+    private:
+        static QList<FITSImage::Star> brightest(const QList<FITSImage::Star> &stars);
+        bool registerFrame(const QList<FITSImage::Star> &stars, QPointF &shift) const;
+
+        QList<FITSImage::Star> m_Reference;     // The brightest stars of the first frame
+        QList<FITSImage::Star> m_Stars;
+        int m_Frames { 1 };
+};
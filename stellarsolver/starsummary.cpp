@@ -0,0 +1,80 @@
+/*  StarSummary, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "starsummary.h"
+
+#include <algorithm>
+#include <cmath>
+
+StarSummary::StarSummary() : m_HFR(HFR_BINS, 0), m_Eccentricity(ECCENTRICITY_BINS, 0)
+{
+}
+
+void StarSummary::add(const FITSImage::Star &star)
+{
+    m_Count++;
+    if(star.HFR > 0)
+    {
+        const double position = log(star.HFR / MIN_HFR) / log(MAX_HFR / MIN_HFR) * HFR_BINS;
+        m_HFR[std::max(0, std::min(HFR_BINS - 1, static_cast<int>(position)))]++;
+        m_CountWithHFR++;
+    }
+    const double major = std::max(star.a, star.b), minor = std::min(star.a, star.b);
+    const double eccentricity = major > 0 ? sqrt(std::max(0.0, 1 - (minor * minor) / (major * major))) : 0;
+    m_Eccentricity[std::min(ECCENTRICITY_BINS - 1, static_cast<int>(eccentricity * ECCENTRICITY_BINS))]++;
+}
+
+void StarSummary::merge(const StarSummary &other)
+{
+    m_Count += other.m_Count;
+    m_CountWithHFR += other.m_CountWithHFR;
+    for(int i = 0; i < HFR_BINS; i++)
+        m_HFR[i] += other.m_HFR[i];
+    for(int i = 0; i < ECCENTRICITY_BINS; i++)
+        m_Eccentricity[i] += other.m_Eccentricity[i];
+}
+
+double StarSummary::quantile(const std::vector<int> &histogram, int total, double q, double lowest, double highest,
+                             bool logarithmic)
+{
+    if(total <= 0)
+        return 0;
+    const double target = q * total;
+    const int bins = histogram.size();
+    double below = 0;
+    for(int i = 0; i < bins; i++)
+    {
+        if(histogram[i] > 0 && below + histogram[i] >= target)
+        {
+            const double position = (i + std::max(0.0, target - below) / histogram[i]) / bins;
+            return logarithmic ? lowest * pow(highest / lowest, position) : lowest + (highest - lowest) * position;
+        }
+        below += histogram[i];
+    }
+    return highest;
+}
+
+FITSImage::ImageQuality StarSummary::quality(const FITSImage::Background &background) const
+{
+    FITSImage::ImageQuality quality;
+    quality.numStars = m_Count;
+    quality.medianHFR = quantile(m_HFR, m_CountWithHFR, 0.5, MIN_HFR, MAX_HFR, true);
+    quality.lowerQuartileHFR = quantile(m_HFR, m_CountWithHFR, 0.25, MIN_HFR, MAX_HFR, true);
+    quality.upperQuartileHFR = quantile(m_HFR, m_CountWithHFR, 0.75, MIN_HFR, MAX_HFR, true);
+    quality.medianEccentricity = quantile(m_Eccentricity, m_Count, 0.5, 0, 1, false);
+    quality.background = background.global;
+    quality.backgroundRMS = background.globalrms;
+    return quality;
+}
+
+FITSImage::ImageQuality StarSummary::summarize(const QList<FITSImage::Star> &stars, const FITSImage::Background &background)
+{
+    StarSummary summary;
+    for(const FITSImage::Star &star : stars)
+        summary.add(star);
+    return summary.quality(background);
+}
@@ -0,0 +1,64 @@
+/*  StarSummary, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+#include <vector>
+
+#include "structuredefinitions.h"
+
+/**
+ * @brief The StarSummary class keeps the aggregate statistics of a set of stars without keeping the stars.  The HFRs go in a
+ * histogram with logarithmic bins and the eccentricities in one with linear bins, so adding a star is constant time, the summary
+ * is a few kilobytes however many stars there are, and the summaries of the partitions of an image merge into the summary of it.
+ */
+class StarSummary
+{
+    public:
+        StarSummary();
+
+        // The HFRs between these go in the bins, the ones outside go in the first or last bin
+        static constexpr double MIN_HFR = 0.05;
+        static constexpr double MAX_HFR = 500;
+        static const int HFR_BINS = 2048;
+        static const int ECCENTRICITY_BINS = 1000;
+
+        /**
+         * @brief add adds a star to the summary
+         */
+        void add(const FITSImage::Star &star);
+
+        /**
+         * @brief merge adds the stars of another summary to this one
+         */
+        void merge(const StarSummary &other);
+
+        int count() const
+        {
+            return m_Count;
+        }
+
+        /**
+         * @brief quality gets the image quality of the stars of the summary
+         * @param background The background of the image, which is reported with the stars
+         */
+        FITSImage::ImageQuality quality(const FITSImage::Background &background) const;
+
+        /**
+         * @brief summarize gets the image quality of a list of stars, for the extractors that make a list anyway
+         */
+        static FITSImage::ImageQuality summarize(const QList<FITSImage::Star> &stars, const FITSImage::Background &background);
+
+    private:
+        // The value with the fraction q of the values of the histogram below it, interpolated within its bin
+        static double quantile(const std::vector<int> &histogram, int total, double q, double lowest, double highest, bool logarithmic);
+
+        int m_Count { 0 };
+        int m_CountWithHFR { 0 };
+        std::vector<int> m_HFR;
+        std::vector<int> m_Eccentricity;
+};
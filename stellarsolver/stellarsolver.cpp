@@ -17,8 +17,20 @@
 #include "extractorsolver.h"
 #include "externalextractorsolver.h"
 #include "onlinesolver.h"
-#include <QApplication>
+#include "starsummary.h"
+#include "starstacker.h"
+#include "tilestitcher.h"
+#include "tracer.h"
+#include "perfcounters.h"
+#include "referencecatalog.h"
+#include "sep/arena.h"
+#include <QEventLoop>
 #include <QSettings>
+#include <QStorageInfo>
+#include <QtMath>
+#include <QMutex>
+#include <QTimer>
+#include <algorithm>
 
 using namespace SSolver;
 
@@ -47,8 +59,25 @@ StellarSolver::~StellarSolver()
     // These lines make sure that before the StellarSolver is deleted, all parallel threads (if any) are shut down
     for(auto &solver : parallelSolvers)
       disconnect(solver, &ExtractorSolver::finished, this, &StellarSolver::finishParallelSolve);
+    for(auto &batchSolver : m_BatchSolvers)
+      disconnect(batchSolver, &StellarSolver::finished, this, nullptr);
+    for(auto &load : m_BatchLoads)
+      disconnect(load, &QFutureWatcher<BatchLoad>::finished, this, nullptr);
+    if(m_IndexPreload)
+    {
+      disconnect(m_IndexPreload, &QFutureWatcher<int>::finished, this, nullptr);
+      m_CancelIndexPreload->store(true);
+      m_IndexPreload->waitForFinished();
+    }
 
     abortAndWait();
+
+    // The batch solvers are children of this StellarSolver, but their image buffers have to be deleted after them
+    qDeleteAll(m_BatchSolvers);
+    for(auto &buffer : m_BatchBuffers)
+      delete[] buffer;
+    for(auto &load : m_BatchLoads)
+      delete[] load->result().imageBuffer;
 }
 
 void StellarSolver::registerMetaTypes()
@@ -56,6 +85,8 @@ void StellarSolver::registerMetaTypes()
     qRegisterMetaType<SolverType>("SolverType");
     qRegisterMetaType<ProcessType>("ProcessType");
     qRegisterMetaType<ExtractorType>("ExtractorType");
+    qRegisterMetaType<FITSImage::SolveMetrics>("FITSImage::SolveMetrics");
+    qRegisterMetaType<QList<FITSImage::Star>>("QList<FITSImage::Star>");
 }
 
 bool StellarSolver::loadNewImageBuffer(const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer)
@@ -65,8 +96,112 @@ bool StellarSolver::loadNewImageBuffer(const FITSImage::Statistic &imagestats, u
     if(isRunning())
         return false;
     m_ImageBuffer = imageBuffer;
+    m_ImageView = InternalExtractorSolver::resolveImageView(imagestats, FITSImage::ImageView());
+    m_RowReader = nullptr;
+    resetImage(imagestats);
+    return true;
+}
+
+bool StellarSolver::loadNextFrame(const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer)
+{
+    if(imageBuffer == nullptr)
+        return false;
+    if(isRunning())
+        return false;
+    const bool sameGeometry = m_ImageBuffer && !m_RowReader && InternalExtractorSolver::isPackedView(m_Statistics, m_ImageView)
+                              && imagestats.width == m_Statistics.width && imagestats.height == m_Statistics.height
+                              && imagestats.channels == m_Statistics.channels && imagestats.dataType == m_Statistics.dataType;
+    if(!sameGeometry)
+        return loadNewImageBuffer(imagestats, imageBuffer);
+
+    //Only the results of the last frame are forgotten, the search position and scale and the tracked stars are kept
+    m_ImageBuffer = imageBuffer;
+    m_Statistics = imagestats;
+    m_HasExtracted = false;
+    m_HasSolved = false;
+    m_HasFailed = false;
+    hasWCS = false;
+    background = {};
+    m_ExtractorStars.clear();
+    m_SolverStars.clear();
+    numStars = 0;
+    solution = {};
+    solutionIndexNumber = -1;
+    solutionHealpix = -1;
+    solutionLogOdds = 0;
+    m_ReuseExtractorSolver = true;
+    return true;
+}
+
+bool StellarSolver::loadNewImageView(const FITSImage::Statistic &imagestats, const FITSImage::ImageView &view, uint8_t const *imageBuffer)
+{
+    if(imageBuffer == nullptr)
+        return false;
+    if(isRunning())
+        return false;
+
+    FITSImage::ImageView resolved = InternalExtractorSolver::resolveImageView(imagestats, view);
+    const uint32_t pixelStride = view.interleaved ? imagestats.channels : 1;
+    const uint32_t roiWidth = view.roiWidth == 0 || view.roiHeight == 0 ? imagestats.width : view.roiWidth;
+    const uint32_t roiHeight = view.roiWidth == 0 || view.roiHeight == 0 ? imagestats.height : view.roiHeight;
+    const uint32_t roiX = roiWidth == imagestats.width && roiHeight == imagestats.height ? 0 : view.roiX;
+    const uint32_t roiY = roiWidth == imagestats.width && roiHeight == imagestats.height ? 0 : view.roiY;
+    if(roiX + roiWidth > imagestats.width || roiY + roiHeight > imagestats.height
+            || resolved.rowStride < static_cast<uint32_t>(imagestats.width) * pixelStride)
+    {
+        emit logOutput("The layout or the region of interest of the image view don't fit the image.");
+        return false;
+    }
+
+    //The region is processed as an image of its own that starts at its first pixel and has the strides of the whole buffer
+    FITSImage::Statistic stats = imagestats;
+    stats.width = roiWidth;
+    stats.height = roiHeight;
+    stats.samples_per_channel = roiWidth * roiHeight;
+    stats.xOffset += roiX;
+    stats.yOffset += roiY;
+    resolved.roiX = resolved.roiY = resolved.roiWidth = resolved.roiHeight = 0;
+
+    m_ImageBuffer = imageBuffer + (static_cast<size_t>(roiY) * resolved.rowStride + static_cast<size_t>(roiX) * pixelStride) *
+                    imagestats.bytesPerPixel;
+    m_ImageView = resolved;
+    m_RowReader = nullptr;
+    resetImage(stats);
+    return true;
+}
+
+const uint8_t *StellarSolver::packedImageBuffer()
+{
+    if(!m_ImageBuffer || InternalExtractorSolver::isPackedView(m_Statistics, m_ImageView))
+        return m_ImageBuffer;
+    if(m_PackedImage.empty())
+        InternalExtractorSolver::packImage(m_Statistics, m_ImageView, m_ImageBuffer, m_PackedImage);
+    return m_PackedImage.data();
+}
+
+bool StellarSolver::loadNewImageStream(const FITSImage::Statistic &imagestats, const FITSImage::RowReader &reader, uint32_t bandRows)
+{
+    if(!reader)
+        return false;
+    if(isRunning())
+        return false;
+    m_ImageBuffer = nullptr;
+    m_ImageView = FITSImage::ImageView();
+    m_RowReader = reader;
+    m_StreamBandRows = bandRows;
+    resetImage(imagestats);
+    return true;
+}
+
+void StellarSolver::resetImage(const FITSImage::Statistic &imagestats)
+{
+    //The stars of the last image can only be tracked into an image of the same size
+    if(imagestats.width != m_Statistics.width || imagestats.height != m_Statistics.height)
+        resetTracking();
     m_Statistics = imagestats;
     m_Subframe = QRect(0, 0, m_Statistics.width, m_Statistics.height);
+    std::vector<uint8_t>().swap(m_PackedImage);
+    m_ReuseExtractorSolver = false;
 
     //information that should be reset since it was about the last image
     m_HasExtracted = false;
@@ -91,31 +226,55 @@ bool StellarSolver::loadNewImageBuffer(const FITSImage::Statistic &imagestats, u
     solution = {};
     solutionIndexNumber = -1;
     solutionHealpix = -1;
-
-    return true;
+    solutionLogOdds = 0;
 }
 
 ExtractorSolver* StellarSolver::createExtractorSolver()
+{
+    return createExtractorSolver(m_SolverType, m_ExtractorType);
+}
+
+ExtractorSolver* StellarSolver::createExtractorSolver(SolverType solverType, ExtractorType extractorType)
 {
     ExtractorSolver *solver;
+    //A direct process can run on a thread other than the one of this StellarSolver, where it can't have children, m_ExtractorSolver owns it anyway
+    QObject *parent = m_RunDirectly ? nullptr : this;
 
-    if(m_ProcessType == SOLVE && m_SolverType == SOLVER_ONLINEASTROMETRY)
+    if(m_ProcessType == SOLVE && solverType == SOLVER_ONLINEASTROMETRY)
     {
-        OnlineSolver *onlineSolver = new OnlineSolver(m_ProcessType, m_ExtractorType, m_SolverType, m_Statistics, m_ImageBuffer,
-                this);
+        OnlineSolver *onlineSolver = new OnlineSolver(m_ProcessType, extractorType, solverType, m_Statistics, packedImageBuffer(),
+                parent);
         onlineSolver->fileToProcess = m_FileToProcess;
         onlineSolver->astrometryAPIKey = m_AstrometryAPIKey;
         onlineSolver->astrometryAPIURL = m_AstrometryAPIURL;
+        if(!m_OnlineSession)
+            m_OnlineSession.reset(new OnlineSession());
+        onlineSolver->onlineSession = m_OnlineSession;
         onlineSolver->externalPaths = m_ExternalPaths;
         solver = onlineSolver;
     }
-    else if((m_ProcessType == SOLVE && m_SolverType == SOLVER_STELLARSOLVER) || (m_ProcessType != SOLVE
-            && m_ExtractorType != EXTRACTOR_EXTERNAL))
-        solver = new InternalExtractorSolver(m_ProcessType, m_ExtractorType, m_SolverType, m_Statistics, m_ImageBuffer, this);
+    else if((m_ProcessType == SOLVE && solverType == SOLVER_STELLARSOLVER) || (m_ProcessType != SOLVE
+            && extractorType != EXTRACTOR_EXTERNAL))
+    {
+        InternalExtractorSolver *internalSolver = new InternalExtractorSolver(m_ProcessType, extractorType, solverType, m_Statistics,
+                m_ImageBuffer, parent);
+        if(m_RowReader)
+            internalSolver->setRowReader(m_RowReader, m_StreamBandRows);
+        else
+            internalSolver->setImageView(m_ImageView);
+        if(!m_ExtractionBuffers)
+            m_ExtractionBuffers.reset(new ExtractionBuffers());
+        internalSolver->setFloatBuffers(m_ExtractionBuffers);
+        if(m_SharedBackground)
+            internalSolver->setSharedBackground(m_SharedBackground);
+        if(m_Calibration)
+            internalSolver->setCalibrationFrames(m_Calibration);
+        solver = internalSolver;
+    }
     else
     {
-        ExternalExtractorSolver *extSolver = new ExternalExtractorSolver(m_ProcessType, m_ExtractorType, m_SolverType,
-                m_Statistics, m_ImageBuffer, this);
+        ExternalExtractorSolver *extSolver = new ExternalExtractorSolver(m_ProcessType, extractorType, solverType,
+                m_Statistics, packedImageBuffer(), parent);
         extSolver->fileToProcess = m_FileToProcess;
         extSolver->externalPaths = m_ExternalPaths;
         extSolver->cleanupTemporaryFiles = m_CleanupTemporaryFiles;
@@ -123,26 +282,122 @@ ExtractorSolver* StellarSolver::createExtractorSolver()
         solver = extSolver;
     }
 
+    configureExtractorSolver(solver, solverType);
+    return solver;
+}
+
+bool StellarSolver::reuseExtractorSolver()
+{
+    const bool reuse = m_ReuseExtractorSolver;
+    m_ReuseExtractorSolver = false;
+    //Only the star extractions with the internal star extractor keep nothing else about the frame, the solves are started fresh
+    if(!reuse || !m_ExtractorSolver || isRacing() || (m_ProcessType != EXTRACT && m_ProcessType != EXTRACT_WITH_HFR)
+            || m_ExtractorType == EXTRACTOR_EXTERNAL)
+        return false;
+    InternalExtractorSolver *internalSolver = dynamic_cast<InternalExtractorSolver *>(m_ExtractorSolver.data());
+    //A direct process needs a star extractor without a parent, see createExtractorSolver
+    if(!internalSolver || internalSolver->m_ProcessType != m_ProcessType || internalSolver->m_ExtractorType != m_ExtractorType
+            || internalSolver->parent() != (m_RunDirectly ? nullptr : this))
+        return false;
+    if(!internalSolver->loadNextFrame(m_Statistics, m_ImageBuffer, m_ImageView))
+        return false;
+    internalSolver->disconnect(this);
+    configureExtractorSolver(internalSolver, m_SolverType);
+    return true;
+}
+
+// This converts an image scale to arcseconds per pixel, the way the internal solver does it
+static double arcsecPerPixel(double scale, ScaleUnits units, int width)
+{
+    switch(units)
+    {
+        case DEG_WIDTH:
+            return scale * 3600.0 / width;
+        case ARCMIN_WIDTH:
+            return scale * 60.0 / width;
+        case FOCAL_MM:
+            // "35 mm" film is 36 mm wide.
+            return atan(36. / (2. * scale)) * 180.0 / M_PI * 3600.0 / width;
+        default:
+            return scale;
+    }
+}
+
+void StellarSolver::configureExtractorSolver(ExtractorSolver *solver, SolverType solverType)
+{
     if(useSubframe)
         solver->setUseSubframe(m_Subframe);
+    solver->setSummaryOnly(m_SummaryOnly && m_ProcessType != SOLVE);
+    solver->setStreamPartitionStars(m_StreamPartitionStars && !(m_SummaryOnly && m_ProcessType != SOLVE));
+    solver->setCountHardwareEvents(m_CountHardwareEvents);
+    solver->setRegions(m_ProcessType != SOLVE ? m_Regions : QList<QRect>());
     solver->m_ColorChannel = m_ColorChannel;
     solver->m_LogToFile = m_LogToFile;
     solver->m_LogFileName = m_LogFileName;
     solver->m_AstrometryLogLevel = m_AstrometryLogLevel;
     solver->m_SSLogLevel = m_SSLogLevel;
-    solver->m_BasePath = m_BasePath;
+    solver->m_BasePath = tempFilePath();
     solver->m_ActiveParameters = params;
     solver->convFilter = convFilter;
     solver->indexFolderPaths = indexFolderPaths;
     solver->indexFiles = m_IndexFilePaths;
+    if(m_ProcessType == SOLVE && solverType == SOLVER_STELLARSOLVER)
+    {
+        if(!m_IndexCatalog)
+            m_IndexCatalog.reset(new IndexCatalog());
+        solver->indexCatalog = m_IndexCatalog;
+    }
+    // The internal solver picks the indexes of each solve from the catalog, a local astrometry.net gets only the planned files
+    // instead of all of the index folders, so it doesn't open the index files of the other scales and of the rest of the sky
+    if(m_ProcessType == SOLVE && solverType == SOLVER_LOCALASTROMETRY && m_UseScale && m_IndexFilePaths.isEmpty()
+            && !indexFolderPaths.isEmpty() && m_Statistics.width > 0)
+    {
+        if(!m_IndexCatalog)
+            m_IndexCatalog.reset(new IndexCatalog());
+        const QStringList planned = m_IndexCatalog->coveringIndexFiles(indexFolderPaths, QStringList(),
+                                    arcsecPerPixel(m_ScaleLow, m_ScaleUnit, m_Statistics.width),
+                                    arcsecPerPixel(m_ScaleHigh, m_ScaleUnit, m_Statistics.width), m_Statistics.width, m_Statistics.height,
+                                    m_SearchRA, m_SearchDE, m_UsePosition ? params.search_radius : 0);
+        if(!planned.isEmpty())
+        {
+            solver->indexFolderPaths.clear();
+            solver->indexFiles = planned;
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput(QString("Solving with the %1 index files that cover the scale and position").arg(planned.count()));
+        }
+    }
+    solver->threadPool = m_ThreadPool;
+    solver->urgency = m_SolveUrgency;
     if(m_UseScale)
         solver->setSearchScale(m_ScaleLow, m_ScaleHigh, m_ScaleUnit);
     if(m_UsePosition)
         solver->setSearchPositionInDegrees(m_SearchRA, m_SearchDE);
+    //The child solvers of a parallel solve don't get the prior, it is verified once before they start, see start
+    if(m_UsePriorWCS && m_ProcessType == SOLVE && solverType == SOLVER_STELLARSOLVER)
+    {
+        InternalExtractorSolver *internalSolver = dynamic_cast<InternalExtractorSolver *>(solver);
+        if(internalSolver)
+            internalSolver->setPriorWCS(m_PriorWCS, m_PriorVerifyOnly, m_PriorTweak);
+    }
+    if(m_SolutionCache && m_ProcessType == SOLVE && solverType == SOLVER_STELLARSOLVER)
+    {
+        InternalExtractorSolver *internalSolver = dynamic_cast<InternalExtractorSolver *>(solver);
+        if(internalSolver)
+            internalSolver->setSolutionCache(m_SolutionCache);
+    }
+    if(m_ReferenceCatalog && m_ProcessType == SOLVE && solverType == SOLVER_STELLARSOLVER)
+    {
+        InternalExtractorSolver *internalSolver = dynamic_cast<InternalExtractorSolver *>(solver);
+        if(internalSolver)
+            internalSolver->setReferenceCatalog(m_ReferenceCatalog);
+    }
     if(m_SSLogLevel != LOG_OFF)
         connect(solver, &ExtractorSolver::logOutput, this, &StellarSolver::logOutput);
-
-    return solver;
+    if(m_StreamPartitionStars)
+    {
+        connect(solver, &ExtractorSolver::partitionStarsReady, this, &StellarSolver::partitionStarsReady);
+        connect(solver, &ExtractorSolver::partitionStarsComplete, this, &StellarSolver::partitionStarsComplete);
+    }
 }
 
 ExternalProgramPaths StellarSolver::getDefaultExternalPaths(ComputerSystemType system)
@@ -194,6 +449,21 @@ QStringList StellarSolver::getIndexFiles(const QStringList &directoryList, int i
     return indexFileList;
 }
 
+QStringList StellarSolver::planIndexFiles(const QStringList &directoryList, double scaleLow, double scaleHigh, ScaleUnits units,
+        int imageWidth, int imageHeight, double ra, double dec, double radius)
+{
+    if(imageWidth <= 0 || imageHeight <= 0)
+        return getIndexFiles(directoryList);
+    IndexCatalog catalog;
+    return catalog.coveringIndexFiles(directoryList, QStringList(), arcsecPerPixel(scaleLow, units, imageWidth),
+                                      arcsecPerPixel(scaleHigh, units, imageWidth), imageWidth, imageHeight, ra, dec, radius);
+}
+
+bool StellarSolver::hardwareEventsAvailable()
+{
+    return PerfCounters::isAvailable();
+}
+
 bool StellarSolver::extract(bool calculateHFR, QRect frame)
 {
     m_ProcessType = calculateHFR ? EXTRACT_WITH_HFR : EXTRACT;
@@ -210,6 +480,164 @@ bool StellarSolver::extract(bool calculateHFR, QRect frame)
     return m_HasExtracted;
 }
 
+bool StellarSolver::extractSummary(bool calculateHFR, QRect frame)
+{
+    m_SummaryOnly = true;
+    m_ImageQuality = FITSImage::ImageQuality();
+    const bool extracted = extract(calculateHFR, frame);
+    m_SummaryOnly = false;
+    return extracted;
+}
+
+bool StellarSolver::extractRegions(const QList<QRect> &regions, bool calculateHFR)
+{
+    m_Regions = regions;
+    m_RegionStarLists.clear();
+    const bool extracted = extract(calculateHFR);
+    m_Regions.clear();
+    return extracted;
+}
+
+void StellarSolver::setTrackStars(bool track, int fullExtractionInterval)
+{
+    m_TrackStars = track;
+    m_FullExtractionInterval = fullExtractionInterval;
+    resetTracking();
+}
+
+void StellarSolver::resetTracking()
+{
+    m_TrackedStars.clear();
+    m_TrackShift = QPointF();
+    m_FramesSinceFullExtraction = 0;
+    m_FullExtractionStars = 0;
+}
+
+void StellarSolver::updateTracking()
+{
+    InternalExtractorSolver *internalSolver = dynamic_cast<InternalExtractorSolver *>(m_ExtractorSolver.data());
+    if(internalSolver && internalSolver->wasTracked())
+    {
+        m_TrackShift = internalSolver->getTrackShift();
+        m_FramesSinceFullExtraction++;
+    }
+    else
+    {
+        m_TrackShift = QPointF();
+        m_FramesSinceFullExtraction = 0;
+        m_FullExtractionStars = m_ExtractorStars.size();
+    }
+    m_TrackedStars = m_ExtractorStars;
+}
+
+//The fields of the statistics that the loaded image is recognized by, they are computed from its pixels
+//This is an estimate of the memory a child solver of a parallel solve uses, its solver, field and matches, but not the indexes which are shared
+static const qint64 childSolverBytes = 32LL * 1024 * 1024;
+
+static bool sameImageStatistics(const FITSImage::Statistic &a, const FITSImage::Statistic &b)
+{
+    if(a.width != b.width || a.height != b.height || a.channels != b.channels || a.dataType != b.dataType
+            || a.xOffset != b.xOffset || a.yOffset != b.yOffset)
+        return false;
+    for(int c = 0; c < 3; c++)
+    {
+        if(a.min[c] != b.min[c] || a.max[c] != b.max[c] || a.mean[c] != b.mean[c] || a.median[c] != b.median[c])
+            return false;
+    }
+    return true;
+}
+
+bool StellarSolver::reuseStars()
+{
+    if(m_UseGivenStars && m_ProcessType == SOLVE)
+    {
+        InternalExtractorSolver *internalSolver = dynamic_cast<InternalExtractorSolver *>(m_ExtractorSolver.data());
+        if(!internalSolver)
+            return false;
+        internalSolver->setExtractedStars(m_GivenStars, 1);
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Solving with the %1 stars that were given instead of extracting them").arg(m_GivenStars.count()));
+        return true;
+    }
+    //Watney gets the list of the stars when they come from the internal star extractor, so it can solve with the reused ones too
+    const bool watneyWithStarList = m_SolverType == SOLVER_WATNEYASTROMETRY && m_ExtractorType == EXTRACTOR_INTERNAL;
+    if(!m_ReuseStars || !m_ReusableStars.valid || m_ProcessType != SOLVE || (m_SolverType != SOLVER_STELLARSOLVER && !isRacing()
+            && !watneyWithStarList) || m_RowReader)
+        return false;
+    InternalExtractorSolver *internalSolver = dynamic_cast<InternalExtractorSolver *>(m_ExtractorSolver.data());
+    const ReusableStars &kept = m_ReusableStars;
+    if(!internalSolver || kept.imageBuffer != m_ImageBuffer || !sameImageStatistics(kept.stats, m_Statistics)
+            || kept.colorChannel != m_ColorChannel || kept.useSubframe != useSubframe || (useSubframe && kept.subframe != m_Subframe)
+            || !kept.params.sameExtraction(params))
+        return false;
+
+    internalSolver->setExtractedStars(kept.stars, kept.downsample);
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Reusing the %1 stars extracted from this image for the last solve").arg(kept.stars.count()));
+    return true;
+}
+
+void StellarSolver::keepStarsForReuse()
+{
+    InternalExtractorSolver *internalSolver = dynamic_cast<InternalExtractorSolver *>(m_ExtractorSolver.data());
+    if(!m_ReuseStars || m_RowReader || !m_ImageBuffer || !internalSolver || !internalSolver->extractionDone()
+            || internalSolver->getNumStarsFound() == 0)
+        return;
+    m_ReusableStars.valid = true;
+    m_ReusableStars.imageBuffer = m_ImageBuffer;
+    m_ReusableStars.stats = m_Statistics;
+    m_ReusableStars.params = params;
+    m_ReusableStars.colorChannel = m_ColorChannel;
+    m_ReusableStars.useSubframe = useSubframe;
+    m_ReusableStars.subframe = m_Subframe;
+    m_ReusableStars.downsample = internalSolver->extractionDownsample();
+    m_ReusableStars.stars = internalSolver->getStarList();
+}
+
+bool StellarSolver::measureHFR(const QList<FITSImage::Star> &stars)
+{
+    if(m_isRunning)
+    {
+        emit logOutput("A process is already running, so the HFR cannot be measured now.");
+        return false;
+    }
+    if(m_ImageBuffer == nullptr)
+    {
+        emit logOutput("The HFR can only be measured in an image buffer that is loaded.");
+        return false;
+    }
+
+    // The focus mode is always done by the internal star extractor
+    m_ProcessType = EXTRACT_WITH_HFR;
+    const ExtractorType extractorType = m_ExtractorType;
+    m_ExtractorType = EXTRACTOR_INTERNAL;
+    m_ExtractorSolver.reset(createExtractorSolver());
+    m_ExtractorType = extractorType;
+
+    m_ExtractorStars.clear();
+    m_HasExtracted = false;
+    m_HasFailed = false;
+    m_SolveMetrics = FITSImage::SolveMetrics();
+    m_MetricsTimer.start();
+    const int result = static_cast<InternalExtractorSolver *>(m_ExtractorSolver.data())->measureFocus(stars);
+    numStars = m_ExtractorSolver->getNumStarsFound();
+    if(result == 0)
+    {
+        m_ExtractorStars = m_ExtractorSolver->getStarList();
+        background = m_ExtractorSolver->getBackground();
+        m_CalculateHFR = true;
+        m_StarsNeedSkyPositions = hasWCS;
+        m_HasExtracted = true;
+    }
+    else
+        m_HasFailed = true;
+
+    emit ready();
+    reportSolveMetrics(m_ExtractorSolver.data());
+    emit finished();
+    return m_HasExtracted;
+}
+
 bool StellarSolver::solve()
 {
     m_ProcessType = SOLVE;
@@ -223,8 +651,64 @@ bool StellarSolver::solve()
     return m_HasSolved;
 }
 
+StellarSolver::Result StellarSolver::extractDirectly(bool calculateHFR, QRect frame)
+{
+    m_ProcessType = calculateHFR ? EXTRACT_WITH_HFR : EXTRACT;
+    useSubframe = !frame.isNull() && frame.isValid();
+    if (useSubframe)
+        m_Subframe = frame;
+    return runDirectly();
+}
+
+StellarSolver::Result StellarSolver::solveDirectly()
+{
+    m_ProcessType = SOLVE;
+    return runDirectly();
+}
+
+StellarSolver::Result StellarSolver::runDirectly()
+{
+    // Everything start does is finished by the time it returns, since the ExtractorSolver runs on this thread
+    m_RunDirectly = true;
+    start();
+    m_RunDirectly = false;
+    return currentResult();
+}
+
+StellarSolver::Result StellarSolver::currentResult()
+{
+    Result result;
+    result.background = background;
+    result.metrics = m_SolveMetrics;
+    if(m_ProcessType == SOLVE)
+    {
+        result.success = m_HasSolved;
+        result.stars = m_SolverStars;
+        result.solution = solution;
+        result.logOdds = solutionLogOdds;
+        result.hasWCS = hasWCS;
+        if(hasWCS)
+            result.wcs = wcsData;
+    }
+    else
+    {
+        result.success = m_HasExtracted;
+        attachSkyPositions();
+        result.stars = m_ExtractorStars;
+        if(m_SummaryOnly)
+            result.quality = m_ImageQuality;
+    }
+    return result;
+}
+
 void StellarSolver::start()
 {
+    //A blind solve can start with a quick coarse attempt, see setCoarseSolve.  This starts again for the full solve when it is done.
+    if(m_CoarseTried)
+        m_CoarseTried = false;
+    else if(!m_RunDirectly && startCoarseSolve())
+        return;
+
     if(checkParameters() == false)
     {
         emit logOutput("There is an issue with your parameters. Terminating the process.");
@@ -238,8 +722,28 @@ void StellarSolver::start()
     //This is necessary before starting up so that the correct convolution filter gets passed to the ExtractorSolver
     updateConvolutionFilter();
 
-    m_ExtractorSolver.reset(createExtractorSolver());
+    m_SolveMetrics = FITSImage::SolveMetrics();
+    m_MetricsTimer.start();
+
+    //A race extracts the stars for all of the solvers with the internal star extractor
+    //The frames of a stream loaded with loadNextFrame are extracted by the same star extractor
+    if(!reuseExtractorSolver())
+        m_ExtractorSolver.reset(isRacing() ? createExtractorSolver(SOLVER_STELLARSOLVER, EXTRACTOR_INTERNAL) : createExtractorSolver());
+    warmExternalDatabases();
+
+    //In the tracking mode, the stars of the last extraction are measured again unless it is time for a full extraction
+    if(m_TrackStars && (m_ProcessType == EXTRACT || m_ProcessType == EXTRACT_WITH_HFR) && !m_TrackedStars.isEmpty()
+            && m_FramesSinceFullExtraction < m_FullExtractionInterval && m_ImageBuffer)
+    {
+        InternalExtractorSolver *internalSolver = dynamic_cast<InternalExtractorSolver *>(m_ExtractorSolver.data());
+        if(internalSolver)
+            internalSolver->setTrackStars(m_TrackedStars, m_TrackShift, m_FullExtractionStars);
+    }
 
+    const bool reusedStars = reuseStars();
+
+    m_CancelLatency = -1;
+    m_CancelTimer.invalidate();
     m_isRunning = true;
     m_HasFailed = false;
     if(m_ProcessType == EXTRACT || m_ProcessType == EXTRACT_WITH_HFR)
@@ -254,25 +758,35 @@ void StellarSolver::start()
         hasWCS = false;
     }
 
+    if(isRacing())
+    {
+        raceSolvers(reusedStars);
+        return;
+    }
+
     //These are the solvers that support parallelization, ASTAP and the online ones do not
-    if(params.multiAlgorithm != NOT_MULTI && m_ProcessType == SOLVE && (m_SolverType == SOLVER_STELLARSOLVER
-            || m_SolverType == SOLVER_LOCALASTROMETRY))
+    if(!m_RunDirectly && params.multiAlgorithm != NOT_MULTI && m_ProcessType == SOLVE && (m_SolverType == SOLVER_STELLARSOLVER
+            || m_SolverType == SOLVER_LOCALASTROMETRY) && !verifiesOnly())
     {
         //Note that it is good to do the Star Extraction before parallelization because it doesn't make sense to repeat this step in all the threads, especially since SEP is now also parallelized in StellarSolver.
-        if(m_ExtractorType != EXTRACTOR_BUILTIN)
+        if(m_ExtractorType != EXTRACTOR_BUILTIN && !reusedStars)
         {
             m_ExtractorSolver->extract();
-            if(m_ExtractorSolver->getNumStarsFound() == 0)
+            const bool noStars = m_ExtractorSolver->getNumStarsFound() == 0;
+            if(noStars || m_ExtractorSolver->checkViability() != FITSImage::FRAME_VIABLE)
             {
-                emit logOutput("No stars were found, so the image cannot be solved");
+                if(noStars)
+                    emit logOutput("No stars were found, so the image cannot be solved");
                 m_isRunning = false;
                 m_HasFailed = true;
                 emit ready();
+                reportSolveMetrics(m_ExtractorSolver.data());
                 emit finished();
                 return;
             }
+            keepStarsForReuse();
         }
-        //Note that converting the image to a FITS file if desired, doesn't need to be repeated in all the threads, but also CFITSIO fails when accessed by multiple parallel threads.
+        //Note that converting the image to a FITS file if desired, doesn't need to be repeated in all the threads, the child solvers all use this one.
         if(m_SolverType == SOLVER_LOCALASTROMETRY && m_ExtractorType == EXTRACTOR_BUILTIN)
         {
             ExternalExtractorSolver *extSolver = static_cast<ExternalExtractorSolver*> (m_ExtractorSolver.data());
@@ -290,18 +804,39 @@ void StellarSolver::start()
             ExternalExtractorSolver *extSolver = static_cast<ExternalExtractorSolver*> (m_ExtractorSolver.data());
             extSolver->generateAstrometryConfigFile();
         }
+        //The prior WCS, or else the cached solution of the stars, is verified once with all of the stars, and the parallel solve
+        //only starts if it doesn't fit any more
+        InternalExtractorSolver *internalSolver = dynamic_cast<InternalExtractorSolver *>(m_ExtractorSolver.data());
+        if(m_SolverType == SOLVER_STELLARSOLVER && internalSolver && (m_UsePriorWCS || internalSolver->hasCachedSolution()))
+        {
+            internalSolver->setPriorWCS(m_UsePriorWCS ? m_PriorWCS : WCSData(), true);
+            connect(m_ExtractorSolver.data(), &ExtractorSolver::finished, this, &StellarSolver::priorWCSFinished);
+            m_ExtractorSolver->start();
+            return;
+        }
         parallelSolve();
     }
     else if(m_SolverType == SOLVER_ONLINEASTROMETRY)
     {
-        OnlineSolver *onSolver = static_cast<OnlineSolver*> (m_ExtractorSolver.data());
-        int ret = onSolver->saveAsFITS();
-        if(ret != 0)
+        //With the internal extractor only the star list is uploaded, so the image doesn't need to be written to a file
+        if(m_ExtractorType != EXTRACTOR_INTERNAL)
         {
-            emit logOutput("Failed to save FITS File.");
-            return;
+            OnlineSolver *onSolver = static_cast<OnlineSolver*> (m_ExtractorSolver.data());
+            int ret = onSolver->saveAsFITS();
+            if(ret != 0)
+            {
+                emit logOutput("Failed to save FITS File.");
+                return;
+            }
         }
-        connect(m_ExtractorSolver.data(), &ExtractorSolver::finished, this, &StellarSolver::processFinished);
+        connect(m_ExtractorSolver.data(), &ExtractorSolver::finished, this, &StellarSolver::processFinished,
+                m_RunDirectly ? Qt::DirectConnection : Qt::AutoConnection);
+        m_ExtractorSolver->execute();
+    }
+    else if(m_RunDirectly)
+    {
+        //The calling thread may not be the one this StellarSolver lives in, so the result can't wait for the event loop of that one
+        connect(m_ExtractorSolver.data(), &ExtractorSolver::finished, this, &StellarSolver::processFinished, Qt::DirectConnection);
         m_ExtractorSolver->execute();
     }
     else
@@ -314,12 +849,50 @@ void StellarSolver::start()
 
 bool StellarSolver::checkParameters()
 {
-    if(m_ImageBuffer == nullptr)
+    if(m_ImageBuffer == nullptr && !m_RowReader && !(m_UseGivenStars && m_ProcessType == SOLVE))
     {
         emit logOutput("The image buffer is not loaded, please load an image before processing it");
         return false;
     }
 
+    if(isRacing())
+    {
+        if(m_RowReader)
+        {
+            emit logOutput("A streamed image can only be solved by the internal solver, so the solvers cannot race.");
+            return false;
+        }
+        if(params.multiAlgorithm != NOT_MULTI || params.pipelineSolve)
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput("Each of the racing solvers solves in one thread.  Disabling the multiAlgorithm and pipelineSolve options.");
+            params.multiAlgorithm = NOT_MULTI;
+            params.pipelineSolve = false;
+        }
+        //The stars are extracted once for all of the solvers, so there have to be enough of them for Watney, a keepNum of 0 keeps them all
+        if(m_RacingSolvers.contains(SOLVER_WATNEYASTROMETRY) && params.keepNum != 0 && params.keepNum < 300)
+        {
+            emit logOutput("The Watney Solver needs at least 300 stars. Adjusting keepNum to 300");
+            params.keepNum = 300;
+        }
+    }
+
+    if(m_RowReader)
+    {
+        // A streamed image is only read in bands by the internal star extractor
+        if(m_ProcessType == SOLVE && m_SolverType != SOLVER_STELLARSOLVER)
+        {
+            emit logOutput("A streamed image can only be solved by the internal solver.");
+            return false;
+        }
+        if(m_ExtractorType != EXTRACTOR_INTERNAL)
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput("A streamed image can only be extracted by the Internal SEP Star Extractor. Changing to Internal Star Extractor.");
+            m_ExtractorType = EXTRACTOR_INTERNAL;
+        }
+    }
+
     if(m_ProcessType == SOLVE && m_SolverType == SOLVER_WATNEYASTROMETRY && (m_Statistics.dataType == SEP_TFLOAT || m_Statistics.dataType == SEP_TDOUBLE))
     {
         emit logOutput("The Watney Solver cannot solve floating point images.");
@@ -345,10 +918,37 @@ bool StellarSolver::checkParameters()
         //Take whichever one is bigger
         int imageSize = m_Statistics.width > m_Statistics.height ? m_Statistics.width : m_Statistics.height;
         params.downsample = imageSize / 2048 + 1;
-        if(m_SSLogLevel != LOG_OFF)
+        double fwhm = 0, starsPerMegapixel = 0;
+        //The estimate reads a packed image, an image view gets the downsample for its size instead of being copied for it
+        if(params.adaptiveDownsample && m_ImageBuffer && !m_RowReader && InternalExtractorSolver::isPackedView(m_Statistics, m_ImageView)
+                && InternalExtractorSolver::estimateStars(m_Statistics, m_ImageBuffer, fwhm, starsPerMegapixel))
+        {
+            //The stars of the downsampled image should still be about 2 pixels wide to be found.  In a dense field the faint stars
+            //that more binning loses aren't needed, and in a sparse field every star counts, so its stars are kept wider.
+            const double stars = starsPerMegapixel * m_Statistics.width * m_Statistics.height / 1e6;
+            const double smallestFWHM = stars > 1000 ? 1.5 : (stars < 100 ? 2.5 : 2.0);
+            const int smallerSide = qMin(m_Statistics.width, m_Statistics.height);
+            params.downsample = qBound(1, static_cast<int>(fwhm / smallestFWHM), qMax(1, smallerSide / 512));
+            //The convolution filter is matched to the stars of the downsampled image, the default filter has a fixed size
+            if(params.convFilterType != CONV_DEFAULT && params.convFilterType != CONV_CUSTOM)
+                params.fwhm = qBound(1.0, fwhm / params.downsample, 10.0);
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput(QString("The stars are about %1 pixels wide with %2 bright stars in the image, automatically downsampling it by %3").arg(
+                                   fwhm, 0, 'f', 1).arg(qRound(stars)).arg(params.downsample));
+        }
+        else if(m_SSLogLevel != LOG_OFF)
             emit logOutput(QString("Automatically downsampling the image by %1").arg(params.downsample));
     }
 
+    if(m_RowReader && params.downsample != 1)
+    {
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput("A streamed image is not in memory to be downsampled.  Solving it at full size.");
+        params.downsample = 1;
+    }
+
+    applyMemoryBudget();
+
     if(m_ProcessType == SOLVE && m_SolverType != SOLVER_ASTAP)
     {
         if(m_SolverType == SOLVER_STELLARSOLVER && m_ExtractorType != EXTRACTOR_INTERNAL)
@@ -358,6 +958,13 @@ bool StellarSolver::checkParameters()
             m_ExtractorType = EXTRACTOR_INTERNAL;
         }
 
+        if(params.multiAlgorithm == MULTI_POSITIONS_AND_SCALES && !m_UsePosition)
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput("Solving on a grid of positions needs a search position.  Solving on multiple scales instead.");
+            params.multiAlgorithm = MULTI_SCALES;
+        }
+
         if(params.multiAlgorithm == MULTI_AUTO)
         {
             if(m_UseScale && m_UsePosition)
@@ -370,109 +977,1258 @@ bool StellarSolver::checkParameters()
                 params.multiAlgorithm = MULTI_SCALES;
         }
 
-        if(m_ProcessType == SOLVE && m_SolverType == SOLVER_WATNEYASTROMETRY && params.keepNum < 300)
+        if(params.pipelineSolve)
         {
-            emit logOutput("The Watney Solver needs at least 300 stars. Adjusting keepNum to 300");
-            params.keepNum = 300;
-        }
+            if(m_SolverType != SOLVER_STELLARSOLVER)
+                params.pipelineSolve = false;
+            else if(!params.resort || (params.removeBrightest > 0.0 && params.removeBrightest < 100.0)
+                    || (params.removeDimmest > 0.0 && params.removeDimmest < 100.0))
+            {
+                if(m_SSLogLevel != LOG_OFF)
+                    emit logOutput("A pipelined solve needs the stars sorted by brightness and cannot remove a percentage of them.  Disabling the pipelineSolve option.");
+                params.pipelineSolve = false;
+            }
+            else if(params.multiAlgorithm != NOT_MULTI)
+            {
+                if(m_SSLogLevel != LOG_OFF)
+                    emit logOutput("A pipelined solve runs one solver while the stars are extracted, so it does not solve in parallel.");
+                params.multiAlgorithm = NOT_MULTI;
+            }
+        }
+
+        //Watney either detects at most keepNum stars itself or gets the list of the kept stars, a keepNum of 0 keeps them all
+        if(m_ProcessType == SOLVE && m_SolverType == SOLVER_WATNEYASTROMETRY && params.keepNum != 0 && params.keepNum < 300)
+        {
+            emit logOutput("The Watney Solver needs at least 300 stars. Adjusting keepNum to 300");
+            params.keepNum = 300;
+        }
+
+        if(params.inParallel && m_SolverType == SOLVER_STELLARSOLVER)
+        {
+            // The internal solvers, including all the child solvers, share one read-only memory mapped copy of the index files in the IndexCatalog.
+            // The mapped pages belong to the file cache, so the system can drop them when it needs memory and no RAM check is needed.
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput("The indexes will be memory mapped once and shared by all of the solver threads.");
+        }
+        else if(params.inParallel)
+        {
+            if(enoughRAMisAvailableFor(indexFolderPaths))
+            {
+                if(m_SSLogLevel != LOG_OFF)
+                    emit logOutput("There should be enough RAM to load the indexes in parallel.");
+            }
+            else
+            {
+                if(m_SSLogLevel != LOG_OFF)
+                {
+                    emit logOutput("Not enough RAM is available on this system for loading the index files you have in parallel");
+                    emit logOutput("Disabling the inParallel option.");
+                }
+                params.inParallel = false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void StellarSolver::priorWCSFinished(int code)
+{
+    disconnect(m_ExtractorSolver.data(), &ExtractorSolver::finished, this, &StellarSolver::priorWCSFinished);
+    //The solve is over if the prior was verified, or if it was aborted while it was being verified
+    if((code == 0 && m_ExtractorSolver->solvingDone()) || m_CancelTimer.isValid())
+    {
+        processFinished(code);
+        return;
+    }
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(m_UsePriorWCS ? "The prior WCS could not be verified, so the quads will be searched" :
+                       "The cached solution could not be verified, so the quads will be searched");
+    parallelSolve();
+}
+
+//This allows us to start multiple threads to search simulaneously in separate threads/cores
+//to attempt to efficiently use modern multi core computers to speed up the solve
+void StellarSolver::parallelSolve()
+{
+    if(params.multiAlgorithm == NOT_MULTI || !(m_SolverType == SOLVER_STELLARSOLVER || m_SolverType == SOLVER_LOCALASTROMETRY))
+        return;
+    qDeleteAll(parallelSolvers);
+    parallelSolvers.clear();
+    m_ParallelWork.clear();
+    m_BestParallelSolver = nullptr;
+    m_BestParallelPriority = -1;
+    m_ParallelSolveNumber++;
+    m_ParallelSolversFinishedCount = 0;
+    //With a thread pool, there are no more child solvers than its threads, since only that many can solve at once anyway
+    int threads = m_ThreadPool ? m_ThreadPool->maxThreads() : QThread::idealThreadCount();
+
+    //With a memory budget, there are only as many child solvers as fit in what the indexes and the star extraction leave of it
+    if(m_MemoryBudget > 0)
+    {
+        const qint64 left = m_MemoryBudget - getMemoryUsage().totalBytes;
+        const int fitting = static_cast<int>(qBound<qint64>(1, left / childSolverBytes, threads));
+        if(fitting < threads)
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput(QString("Only %1 child solvers fit in the memory budget of %2 MB").arg(fitting).arg(m_MemoryBudget / (1024 * 1024)));
+            threads = fitting;
+        }
+    }
+
+    //The work is split into more pieces than there are threads and the child solvers take them from a queue as they finish,
+    //so that one child that finishes its range quickly doesn't sit idle while another is still working on a slow range.
+    //On a machine with slow efficiency cores, the ranges are smaller by how much slower they are, so the fast cores take more of them
+    //and the last range to land on a slow core doesn't hold up the end.
+    const double slowest = m_ThreadPool ? m_ThreadPool->slowestSpeed() : SolverThreadPool::processPool()->slowestSpeed();
+    int workItems = threads * static_cast<int>(ceil(m_ParallelWorkItemsPerThread / slowest));
+
+    if(params.multiAlgorithm == MULTI_SCALES)
+    {
+        //Attempt to search on multiple scales
+        //Note, originally I had each parallel solver getting equal ranges, but solves are faster on bigger scales
+        //So now I'm giving the bigger scale solvers more of a range to work with.
+        double minScale;
+        double maxScale;
+        ScaleUnits units;
+        if(m_UseScale)
+        {
+            minScale = m_ScaleLow;
+            maxScale = m_ScaleHigh;
+            units = m_ScaleUnit;
+        }
+        else
+        {
+            minScale = params.minwidth;
+            maxScale = params.maxwidth;
+            units = DEG_WIDTH;
+        }
+        double scaleConst = (maxScale - minScale) / pow(workItems, 2);
+        for(int item = 0; item < workItems; item++)
+        {
+            ParallelWorkItem work;
+            work.useScale = true;
+            work.scaleLow = minScale + scaleConst * pow(item, 2);
+            work.scaleHigh = minScale + scaleConst * pow(item + 1, 2);
+            work.scaleUnits = units;
+            work.band = QString("Scales %1 to %2 %3").arg(work.scaleLow, 0, 'g', 4).arg(work.scaleHigh, 0, 'g', 4).arg(
+                            SSolver::getScaleUnitString(units));
+            m_ParallelWork.append(work);
+        }
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Starting %1 threads to solve on %2 ranges of scales").arg(threads).arg(m_ParallelWork.count()));
+    }
+    //Note: it might be useful to do a parallel solve on multiple positions, but I am afraid
+    //that since it searches in a circle around the search position, it might be difficult to make it
+    //search a square grid without either missing sections of sky or overlapping search regions.
+    else if(params.multiAlgorithm == MULTI_DEPTHS)
+    {
+        //Attempt to search on multiple depths
+        int sourceNum = 200;
+        if(params.keepNum != 0)
+            sourceNum = params.keepNum;
+        int inc = sourceNum / workItems;
+        //We don't need an unnecessary number of work items
+        if(inc < 10)
+            inc = 10;
+        for(int i = 1; i < sourceNum; i += inc)
+        {
+            ParallelWorkItem work;
+            work.depthLow = i;
+            work.depthHigh = i + inc;
+            work.band = QString("Depths %1 to %2").arg(work.depthLow).arg(work.depthHigh);
+            m_ParallelWork.append(work);
+        }
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Starting %1 threads to solve on %2 ranges of depths").arg(qMin(threads, m_ParallelWork.count())).arg(m_ParallelWork.count()));
+    }
+
+    else if(params.multiAlgorithm == MULTI_POSITIONS_AND_SCALES)
+    {
+        //This covers the search circle with a grid of smaller circles and searches each one on several ranges of scales.
+        //The smaller circles are just big enough to cover their squares of the grid, so they overlap a little and no sky is missed.
+        const int gridSize = m_ParallelPositionGridSize;
+        const double radius = params.search_radius;
+        const double step = 2.0 * radius / gridSize;
+        const double cellRadius = step * M_SQRT1_2;
+        QList<QPointF> positions;
+        for(int row = 0; row < gridSize; row++)
+        {
+            for(int column = 0; column < gridSize; column++)
+            {
+                double dx = -radius + step * (column + 0.5);
+                double dy = -radius + step * (row + 0.5);
+                // This skips the cells that are completely outside the search circle
+                if(hypot(dx, dy) - cellRadius > radius)
+                    continue;
+                double dec = qBound(-90.0, m_SearchDE + dy, 90.0);
+                double cosDec = qMax(cos(qDegreesToRadians(dec)), 0.01);
+                double ra = fmod(m_SearchRA + dx / cosDec + 360.0, 360.0);
+                positions.append(QPointF(ra, dec));
+            }
+        }
+
+        double minScale;
+        double maxScale;
+        ScaleUnits units;
+        if(m_UseScale)
+        {
+            minScale = m_ScaleLow;
+            maxScale = m_ScaleHigh;
+            units = m_ScaleUnit;
+        }
+        else
+        {
+            minScale = params.minwidth;
+            maxScale = params.maxwidth;
+            units = DEG_WIDTH;
+        }
+        int scaleBins = qMax(1, workItems / positions.count());
+        double scaleConst = (maxScale - minScale) / pow(scaleBins, 2);
+        //The scales go in the outer loop, so that every position gets searched on the first range of scales before the next range.
+        for(int bin = 0; bin < scaleBins; bin++)
+        {
+            for(const auto &position : positions)
+            {
+                ParallelWorkItem work;
+                work.useScale = true;
+                work.scaleLow = minScale + scaleConst * pow(bin, 2);
+                work.scaleHigh = minScale + scaleConst * pow(bin + 1, 2);
+                work.scaleUnits = units;
+                work.usePosition = true;
+                work.ra = position.x();
+                work.dec = position.y();
+                work.radius = cellRadius;
+                //The positions change from one solve to the next, so the statistics are kept for the ranges of scales
+                work.band = QString("Scales %1 to %2 %3").arg(work.scaleLow, 0, 'g', 4).arg(work.scaleHigh, 0, 'g', 4).arg(
+                                SSolver::getScaleUnitString(units));
+                m_ParallelWork.append(work);
+            }
+        }
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Starting %1 threads to solve on %2 positions and %3 ranges of scales").arg(qMin(threads,
+                           m_ParallelWork.count())).arg(positions.count()).arg(scaleBins));
+    }
+
+    //A deterministic solve searches the ranges in the order they were made, which is also how their solutions are ranked
+    if(m_DeterministicParallel)
+    {
+        for(int item = 0; item < m_ParallelWork.count(); item++)
+            m_ParallelWork[item].priority = item;
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput("The parallel solve is deterministic, the first range in order that solves is used");
+    }
+    else
+        scheduleParallelWork(threads);
+    m_RunningWork.clear();
+    m_ParallelSolveTimer.start();
+    //Unless the ranges are ranked, a solution with worse log odds than one that was already found is never used,
+    //so the child solvers tell each other their best ones and drop the matches that can't beat them
+    InternalExtractorSolver *internalSolver = dynamic_cast<InternalExtractorSolver *>(m_ExtractorSolver.data());
+    if(internalSolver)
+        internalSolver->shareBestLogOdds(m_SolverType == SOLVER_STELLARSOLVER && !m_DeterministicParallel);
+    int childSolvers = qMin(threads, m_ParallelWork.count());
+    for(int thread = 0; thread < childSolvers; thread++)
+    {
+        ExtractorSolver *solver = m_ExtractorSolver->spawnChildSolver(thread);
+        connect(solver, &ExtractorSolver::finished, this, &StellarSolver::finishParallelSolve);
+        parallelSolvers.append(solver);
+    }
+    for(auto &solver : parallelSolvers)
+        startNextParallelWork(solver);
+}
+
+//This races several solvers against each other on the same stars, so an image that one of them can't solve doesn't have to be solved again with another.
+//The racing solvers are run like the child solvers of a parallel solve, with no work queue, so finishParallelSolve uses the first solution and aborts the others.
+void StellarSolver::raceSolvers(bool reusedStars)
+{
+    qDeleteAll(parallelSolvers);
+    parallelSolvers.clear();
+    m_ParallelWork.clear();
+    m_RunningWork.clear();
+    m_BestParallelSolver = nullptr;
+    m_ParallelSolversFinishedCount = 0;
+
+    InternalExtractorSolver *extractor = static_cast<InternalExtractorSolver *>(m_ExtractorSolver.data());
+    if(!reusedStars)
+    {
+        extractor->extract();
+        const bool noStars = extractor->getNumStarsFound() == 0;
+        if(noStars || extractor->checkViability() != FITSImage::FRAME_VIABLE)
+        {
+            if(noStars)
+                emit logOutput("No stars were found, so the image cannot be solved");
+            m_isRunning = false;
+            m_HasFailed = true;
+            emit ready();
+            reportSolveMetrics(extractor);
+            emit finished();
+            return;
+        }
+        keepStarsForReuse();
+    }
+
+    QList<SolverType> racers;
+    for(const SolverType solverType : m_RacingSolvers)
+    {
+        if(racers.contains(solverType))
+            continue;
+        if(solverType == SOLVER_ONLINEASTROMETRY)
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput("The online solver cannot race the others, since its jobs cannot be stopped.  Leaving it out.");
+            continue;
+        }
+        if(solverType == SOLVER_WATNEYASTROMETRY && (m_Statistics.dataType == SEP_TFLOAT || m_Statistics.dataType == SEP_TDOUBLE))
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput("The Watney Solver cannot solve floating point images.  Leaving it out of the race.");
+            continue;
+        }
+
+        //ASTAP always extracts its own stars, the others all solve with the stars that were just extracted
+        ExtractorSolver *solver = createExtractorSolver(solverType, solverType == SOLVER_ASTAP ? EXTRACTOR_BUILTIN : EXTRACTOR_INTERNAL);
+        InternalExtractorSolver *racer = static_cast<InternalExtractorSolver *>(solver);
+        ExternalExtractorSolver *extSolver = dynamic_cast<ExternalExtractorSolver *>(solver);
+        int ret = 0;
+        if(solverType != SOLVER_ASTAP)
+            racer->setExtractedStars(extractor->getStarList(), extractor->extractionDownsample());
+        //The solvers that are given the stars read them from a table that is written here, ASTAP converts the image to FITS in its own thread
+        if(extSolver && solverType != SOLVER_ASTAP)
+            ret = extSolver->writeStarExtractorTable();
+        if(ret != 0)
+        {
+            emit logOutput(QString("Failed to write the files for the %1, leaving it out of the race.").arg(SSolver::getCommandString(SOLVE,
+                           solver->m_ExtractorType, solverType).trimmed()));
+            delete solver;
+            continue;
+        }
+
+        connect(solver, &ExtractorSolver::finished, this, &StellarSolver::finishParallelSolve);
+        parallelSolvers.append(solver);
+        racers.append(solverType);
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Child Solver # %1: %2").arg(parallelSolvers.count()).arg(SSolver::getCommandString(SOLVE,
+                           solver->m_ExtractorType, solverType).trimmed()));
+    }
+
+    if(parallelSolvers.isEmpty())
+    {
+        emit logOutput("None of the racing solvers could be started, so the image cannot be solved");
+        m_isRunning = false;
+        m_HasFailed = true;
+        emit ready();
+        emit finished();
+        return;
+    }
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Racing %1 solvers on %2 stars").arg(parallelSolvers.count()).arg(extractor->getNumStarsFound()));
+
+    m_ParallelSolveTimer.start();
+    for(auto &solver : parallelSolvers)
+        solver->start();
+}
+
+bool StellarSolver::startNextParallelWork(ExtractorSolver *solver)
+{
+    if(m_ParallelWork.isEmpty() || m_HasSolved)
+        return false;
+
+    //All of the work has to be done within the time limit for the whole solve, not just for each range
+    qint64 timeLimit = params.solverTimeLimitMS > 0 ? params.solverTimeLimitMS : params.solverTimeLimit * 1000LL;
+    qint64 timeLeft = timeLimit - m_ParallelSolveTimer.elapsed();
+    if(timeLeft <= 0)
+    {
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("The time limit was reached with %1 ranges left to search").arg(m_ParallelWork.count()));
+        m_ParallelWork.clear();
+        return false;
+    }
+
+    ParallelWorkItem work = m_ParallelWork.takeFirst();
+    if(work.usePosition)
+    {
+        solver->setSearchPositionInDegrees(work.ra, work.dec);
+        solver->m_ActiveParameters.search_radius = work.radius;
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Child Solver # %1, RA %2, DEC %3, Radius %4").arg(whichSolver(solver)).arg(work.ra).arg(work.dec).arg(work.radius));
+    }
+    if(work.useScale)
+    {
+        solver->setSearchScale(work.scaleLow, work.scaleHigh, work.scaleUnits);
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Child Solver # %1, Low %2, High %3 %4").arg(whichSolver(solver)).arg(work.scaleLow).arg(work.scaleHigh).arg(
+                               SSolver::getScaleUnitString(work.scaleUnits)));
+    }
+    else
+    {
+        solver->depthlo = work.depthLow;
+        solver->depthhi = work.depthHigh;
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Child Solver # %1, Depth Low %2, Depth High %3").arg(whichSolver(solver)).arg(work.depthLow).arg(work.depthHigh));
+    }
+    //A range with a slice of the time gets a limit in milliseconds, the others keep the kind of limit the parameters have
+    if(work.timeSlice >= timeLeft)
+        work.timeSlice = 0;
+    if(work.timeSlice > 0)
+        solver->m_ActiveParameters.solverTimeLimitMS = work.timeSlice;
+    else if(params.solverTimeLimitMS > 0)
+        solver->m_ActiveParameters.solverTimeLimitMS = timeLeft;
+    else
+    {
+        solver->m_ActiveParameters.solverTimeLimitMS = 0;
+        solver->m_ActiveParameters.solverTimeLimit = (timeLeft + 999) / 1000;
+    }
+    work.started = m_ParallelSolveTimer.elapsed();
+    m_RunningWork.insert(solver, work);
+    solver->start();
+    return true;
+}
+
+void StellarSolver::useParallelSolution(ExtractorSolver *solver)
+{
+    numStars = solver->getNumStarsFound();
+    solution = solver->getSolution();
+    solutionIndexNumber = solver->getSolutionIndexNumber();
+    solutionHealpix = solver->getSolutionHealpix();
+    solutionLogOdds = solver->getSolutionLogOdds();
+    m_SolverStars = solver->getStarList();
+
+    //The child solvers in a grid of positions each had their own search position, so the errors need to be relative to the real one
+    if(params.multiAlgorithm == MULTI_POSITIONS_AND_SCALES && m_UsePosition)
+    {
+        solution.raError = (m_SearchRA - solution.ra) * 3600;
+        solution.decError = (m_SearchDE - solution.dec) * 3600;
+    }
+
+    if(solver->hasWCSData())
+    {
+        wcsData = solver->getWCSData();
+        hasWCS = true;
+        m_StarsNeedSkyPositions = m_ExtractorStars.count() > 0;
+        m_isRunning = false;
+    }
+    m_HasSolved = true;
+    m_ExtractorSolver->cleanupTempFiles();
+}
+
+bool StellarSolver::solveBatch(const QList<BatchImage> &images, const ImageLoader &loader, int maxConcurrent)
+{
+    if(isRunning() || images.isEmpty())
+        return false;
+    for(auto &image : images)
+    {
+        if(!image.imageBuffer && (image.fileName.isEmpty() || !loader))
+        {
+            emit logOutput("An image of the batch is not in memory and there is no way to load it, so the batch cannot be solved");
+            return false;
+        }
+    }
+
+    createSharedResources();
+    updateConvolutionFilter();
+    m_BatchImages = images;
+    m_BatchLoader = loader;
+    m_BatchNextImage = 0;
+    m_BatchRunning = 0;
+    m_BatchAborted = false;
+    m_BatchMaxConcurrent = maxConcurrent > 0 ? maxConcurrent : m_ThreadPool->maxThreads();
+
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Solving a batch of %1 images, %2 at a time").arg(m_BatchImages.count()).arg(m_BatchMaxConcurrent));
 
-        if(params.inParallel)
+    while(startNextBatchImage());
+    return true;
+}
+
+bool StellarSolver::addBatchImages(const QList<BatchImage> &images)
+{
+    if(m_BatchRunning == 0 || m_BatchAborted)
+        return false;
+    for(auto &image : images)
+    {
+        if(!image.imageBuffer && (image.fileName.isEmpty() || !m_BatchLoader))
+            return false;
+    }
+    m_BatchImages.append(images);
+    while(startNextBatchImage());
+    return true;
+}
+
+void StellarSolver::createSharedResources()
+{
+    // The StellarSolvers of the batch share these, so the index files are loaded once and the solves don't oversubscribe the machine
+    if(m_SolverType == SOLVER_STELLARSOLVER && !m_IndexCatalog)
+        m_IndexCatalog.reset(new IndexCatalog());
+    if(m_WarmExternalDatabases && !m_DatabaseCache)
+        m_DatabaseCache.reset(new ExternalDatabaseCache());
+    if(m_SolverType == SOLVER_ONLINEASTROMETRY && !m_OnlineSession)
+        m_OnlineSession.reset(new OnlineSession());
+    if(!m_ThreadPool)
+        m_ThreadPool.reset(new SolverThreadPool());
+}
+
+QFuture<StellarSolver::Result> StellarSolver::solveJob(const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer, int deadlineMS)
+{
+    return startJob(SOLVE, imagestats, imageBuffer, QRect(), deadlineMS);
+}
+
+QFuture<StellarSolver::Result> StellarSolver::extractJob(const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer,
+        bool calculateHFR, QRect frame, int deadlineMS)
+{
+    return startJob(calculateHFR ? EXTRACT_WITH_HFR : EXTRACT, imagestats, imageBuffer, frame, deadlineMS);
+}
+
+int StellarSolver::getJobDeadlineMisses() const
+{
+    QMutexLocker locker(&m_JobMutex);
+    return m_JobDeadlineMisses;
+}
+
+int StellarSolver::getJobDeadlines() const
+{
+    QMutexLocker locker(&m_JobMutex);
+    return m_JobDeadlines;
+}
+
+bool StellarSolver::solveFrames(const QList<BatchImage> &frames)
+{
+    if(m_isRunning || !m_ImageBuffer || m_RowReader)
+        return false;
+    if(m_SolverType != SOLVER_STELLARSOLVER && !isRacing())
+    {
+        emit logOutput("Only the internal solver can solve from the merged stars of several frames.");
+        return false;
+    }
+    for(const BatchImage &frame : frames)
+    {
+        if(!frame.imageBuffer || frame.stats.width != m_Statistics.width || frame.stats.height != m_Statistics.height)
+        {
+            emit logOutput("The frames to solve together must all be in memory and have the same size as the image.");
+            return false;
+        }
+    }
+
+    // The frames are extracted at the same time, on the threads of the SolverThreadPool
+    const QRect frameRect = useSubframe ? m_Subframe : QRect();
+    QFuture<Result> imageExtraction = extractJob(m_Statistics, packedImageBuffer(), false, frameRect);
+    QList<QFuture<Result>> extractions;
+    for(const BatchImage &frame : frames)
+        extractions.append(extractJob(frame.stats, frame.imageBuffer, false, frameRect));
+    const Result image = imageExtraction.result();
+    StarStacker stacker(image.stars);
+    for(int i = 0; i < extractions.size(); i++)
+    {
+        const Result result = extractions.at(i).result();
+        QPointF shift;
+        if(!image.success || !result.success || !stacker.add(result.stars, &shift))
+            emit logOutput(QString("Frame %1 could not be registered onto the image, so it is left out").arg(i + 1));
+        else if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Frame %1 is shifted by %2, %3 pixels from the image").arg(i + 1)
+                           .arg(shift.x(), 0, 'f', 2).arg(shift.y(), 0, 'f', 2));
+    }
+    if(!image.success || stacker.stars().isEmpty())
+    {
+        emit logOutput("No stars were found in the image, so the frames cannot be solved");
+        return false;
+    }
+    emit logOutput(QString("Merged the stars of %1 of %2 frames into %3 stars").arg(stacker.frames()).arg(frames.size() + 1)
+                   .arg(stacker.stars().size()));
+
+    // The image is solved with the merged stars instead of extracting its own, they are in the full resolution pixels of the image
+    m_GivenStars = stacker.stars();
+    m_UseGivenStars = true;
+    const bool solved = solve();
+    m_UseGivenStars = false;
+    m_GivenStars.clear();
+    return solved;
+}
+
+QList<StellarSolver::Result> StellarSolver::extractPlanes(const QList<BatchImage> &planes, bool calculateHFR, bool shareBackground)
+{
+    QList<Result> results;
+    for(const BatchImage &plane : planes)
+    {
+        if(!plane.imageBuffer)
+        {
+            emit logOutput("The planes to extract must all be in memory.");
+            return results;
+        }
+    }
+
+    // The jobs take the shared background when they are made, each call gets a new one since its planes are of another field
+    const QSharedPointer<SharedBackground> background = m_SharedBackground;
+    m_SharedBackground.reset(shareBackground ? new SharedBackground() : nullptr);
+    const QRect frameRect = useSubframe ? m_Subframe : QRect();
+    QList<QFuture<Result>> extractions;
+    for(const BatchImage &plane : planes)
+        extractions.append(extractJob(plane.stats, plane.imageBuffer, calculateHFR, frameRect));
+    m_SharedBackground = background;
+
+    for(auto &extraction : extractions)
+    {
+        Result result = extraction.result();
+        if(result.success)
+            result.quality = StarSummary::summarize(result.stars, result.background);
+        results.append(result);
+    }
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Extracted the stars of %1 planes").arg(planes.size()));
+    return results;
+}
+
+QList<FITSImage::ImageQuality> StellarSolver::scoreFrames(const FITSImage::Statistic &imagestats, const QList<const uint8_t *> &frames,
+        const FITSImage::ImageView &view, int backgroundWindow, int maxStars)
+{
+    QList<FITSImage::ImageQuality> qualities;
+    createSharedResources();
+    updateConvolutionFilter();
+
+    // The frames wait for a thread in the order they were given, so waiting for the oldest one keeps the others queued
+    const int inFlight = 2 * qMax(1, m_JobPool.maxThreadCount());
+    const int window = qMax(1, backgroundWindow);
+    QSharedPointer<SharedBackground> background;
+    QList<QFuture<Result>> scores;
+    for(int i = 0; i < frames.size(); i++)
+    {
+        if(i >= inFlight)
+            qualities.append(scores.at(i - inFlight).result().quality);
+        if(i % window == 0)
+            background.reset(new SharedBackground());
+
+        // A frame is small and there are many of them, so each one is extracted on one thread instead of in partitions
+        StellarSolver *solver = createBatchSolver(nullptr);
+        solver->m_ProcessType = EXTRACT_WITH_HFR;
+        solver->m_SummaryOnly = true;
+        solver->m_SharedBackground = background;
+        solver->params.partition = false;
+        solver->params.initialKeep = qMax(1, maxStars);
+        if(!solver->loadNewImageView(imagestats, view, frames.at(i)))
+        {
+            delete solver;
+            QFutureInterface<Result> failed;
+            failed.reportStarted();
+            failed.reportResult(Result());
+            failed.reportFinished();
+            scores.append(failed.future());
+            continue;
+        }
+        solver->useSubframe = useSubframe;
+        if(useSubframe)
+            solver->m_Subframe = m_Subframe;
+        scores.append(runJob(solver));
+    }
+    for(int i = qualities.size(); i < scores.size(); i++)
+        qualities.append(scores.at(i).result().quality);
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Scored %1 frames").arg(frames.size()));
+    return qualities;
+}
+
+int StellarSolver::buildReferenceCatalog(double ra, double dec, double radius)
+{
+    if(!m_IndexCatalog)
+        m_IndexCatalog.reset(new IndexCatalog());
+    QSharedPointer<ReferenceCatalog> catalog(new ReferenceCatalog());
+    const int stars = catalog->build(*m_IndexCatalog, indexFolderPaths, m_IndexFilePaths, ra, dec, radius);
+    // The solves that have the catalog before this one keep it until they are done
+    m_ReferenceCatalog = stars > 0 ? catalog : QSharedPointer<ReferenceCatalog>();
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("The reference catalog has %1 stars of %2 indexes within %3 degrees of the target").arg(stars).arg(
+                           catalog->indexes()).arg(radius));
+    return stars;
+}
+
+void StellarSolver::clearReferenceCatalog()
+{
+    m_ReferenceCatalog.reset();
+}
+
+void StellarSolver::setShareBackground(bool share, int refreshFrames, double levelShift)
+{
+    m_SharedBackground.reset(share ? new SharedBackground() : nullptr);
+    if(m_SharedBackground)
+        m_SharedBackground->setRefresh(refreshFrames, levelShift);
+}
+
+void StellarSolver::resetSharedBackground()
+{
+    if(m_SharedBackground)
+        m_SharedBackground->reset();
+}
+
+bool StellarSolver::setCalibrationFrames(const FITSImage::Statistic &masterstats, uint8_t const *bias, uint8_t const *dark,
+        uint8_t const *flat, double darkScale)
+{
+    m_Calibration = CalibrationFrames::create(masterstats, bias, dark, flat, darkScale);
+    if(!m_Calibration)
+        emit logOutput("The calibration frames must have one channel, and at least one of them must be given.");
+    return !m_Calibration.isNull();
+}
+
+void StellarSolver::clearCalibrationFrames()
+{
+    m_Calibration.reset();
+}
+
+bool StellarSolver::solveTiles(int columns, int rows, double overlap)
+{
+    if(m_isRunning || !m_ImageBuffer || m_RowReader)
+        return false;
+    if(m_SolverType != SOLVER_STELLARSOLVER)
+    {
+        emit logOutput("Only the internal solver can solve the tiles of an image.");
+        return false;
+    }
+    if(columns < 1 || rows < 1 || columns * rows < 2 || overlap < 0)
+    {
+        emit logOutput("The image must be split into at least two tiles to solve them.");
+        return false;
+    }
+    const int width = m_Statistics.width, height = m_Statistics.height;
+
+    m_ProcessType = SOLVE;
+    m_HasSolved = false;
+    m_HasFailed = false;
+    hasWCS = false;
+    m_SolverStars.clear();
+    m_isRunning = true;
+
+    // The stars are extracted once for all of the tiles
+    const Result image = extractJob(m_Statistics, packedImageBuffer()).result();
+    numStars = image.stars.size();
+    if(!image.success || image.stars.isEmpty())
+    {
+        emit logOutput("No stars were found, so the tiles cannot be solved");
+        m_isRunning = false;
+        m_HasFailed = true;
+        emit finished();
+        return false;
+    }
+
+    // The tiles have the pixel scale of the whole image, which is a much narrower range than their own widths would allow
+    const double scaleLow = m_UseScale ? arcsecPerPixel(m_ScaleLow, m_ScaleUnit, width) : params.minwidth * 3600.0 / width;
+    const double scaleHigh = m_UseScale ? arcsecPerPixel(m_ScaleHigh, m_ScaleUnit, width) : params.maxwidth * 3600.0 / width;
+    const int tileWidth = qMin(width, qCeil(width * (1 + overlap) / columns));
+    const int tileHeight = qMin(height, qCeil(height * (1 + overlap) / rows));
+
+    createSharedResources();
+    QList<QRect> tiles;
+    QList<QFuture<Result>> solves;
+    for(int row = 0; row < rows; row++)
+    {
+        for(int column = 0; column < columns; column++)
+        {
+            const int x = qBound(0, qRound(width * (column + 0.5) / columns - tileWidth / 2.0), width - tileWidth);
+            const int y = qBound(0, qRound(height * (row + 0.5) / rows - tileHeight / 2.0), height - tileHeight);
+            const QRect tile(x, y, tileWidth, tileHeight);
+            QList<FITSImage::Star> stars;
+            for(FITSImage::Star star : image.stars)
+            {
+                if(!QRectF(tile).contains(star.x, star.y))
+                    continue;
+                star.x -= x;
+                star.y -= y;
+                stars.append(star);
+            }
+            if(stars.size() < MIN_TILE_STARS)
+            {
+                if(m_SSLogLevel != LOG_OFF)
+                    emit logOutput(QString("The tile at %1, %2 has only %3 stars, so it is left out").arg(x).arg(y).arg(stars.size()));
+                continue;
+            }
+            FITSImage::Statistic stats = m_Statistics;
+            stats.width = tileWidth;
+            stats.height = tileHeight;
+            stats.samples_per_channel = tileWidth * tileHeight;
+            StellarSolver *solver = createStarsSolver(stats, stars);
+            solver->setSearchScale(scaleLow, scaleHigh, ARCSEC_PER_PIX);
+            // The search position is the center of the whole image, so the radius has to reach the centers of the tiles
+            if(m_UsePosition)
+                solver->params.search_radius = params.search_radius + scaleHigh * qSqrt(width * width + height * height) / 2 / 3600;
+            tiles.append(tile);
+            solves.append(runJob(solver));
+        }
+    }
+
+    TileStitcher stitcher(width, height);
+    for(int i = 0; i < solves.size(); i++)
+    {
+        const Result result = solves.at(i).result();
+        const QRect &tile = tiles.at(i);
+        if(!result.success || !result.hasWCS || !stitcher.add(tile, result.wcs))
+            emit logOutput(QString("The tile at %1, %2 could not be solved").arg(tile.x()).arg(tile.y()));
+        else if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("The tile at %1, %2 solved at RA %3, DEC %4").arg(tile.x()).arg(tile.y())
+                           .arg(result.solution.ra, 0, 'f', 3).arg(result.solution.dec, 0, 'f', 3));
+    }
+
+    sip_t sip;
+    if(!stitcher.stitch(sip))
+    {
+        emit logOutput(QString("The solutions of %1 tiles could not be stitched into one").arg(stitcher.tiles()));
+        m_isRunning = false;
+        m_HasFailed = true;
+        emit finished();
+        return false;
+    }
+    emit logOutput(QString("Stitched the solutions of %1 of %2 tiles").arg(stitcher.tiles() - stitcher.droppedTiles())
+                   .arg(columns * rows));
+
+    solution = TileStitcher::solution(sip);
+    if(m_UsePosition)
+    {
+        solution.raError = (m_SearchRA - solution.ra) * 3600;
+        solution.decError = (m_SearchDE - solution.dec) * 3600;
+    }
+    solutionIndexNumber = -1;
+    solutionHealpix = -1;
+    solutionLogOdds = 0;
+    wcsData = WCSData(sip, 1);
+    hasWCS = true;
+    m_SolverStars = image.stars;
+    m_StarsNeedSkyPositions = m_ExtractorStars.count() > 0;
+    m_HasSolved = true;
+    m_isRunning = false;
+    emit finished();
+    return true;
+}
+
+QFuture<StellarSolver::Result> StellarSolver::startJob(ProcessType type, const FITSImage::Statistic &imagestats,
+        uint8_t const *imageBuffer, QRect frame, int deadlineMS)
+{
+    createSharedResources();
+    updateConvolutionFilter();
+
+    // The StellarSolver of the job has a copy of the settings of this one, so they can change while the job runs.
+    // Loading the image forgets the search scale and position, so they are copied again after it, and so is the subframe.
+    StellarSolver *solver = createBatchSolver(nullptr);
+    solver->m_ProcessType = type;
+    solver->loadNewImageBuffer(imagestats, imageBuffer);
+    copySearch(solver);
+    solver->useSubframe = !frame.isNull() && frame.isValid();
+    if(solver->useSubframe)
+        solver->m_Subframe = frame;
+    return runJob(solver, deadlineMS);
+}
+
+QFuture<StellarSolver::Result> StellarSolver::solveStarsJob(const FITSImage::Statistic &imagestats, const QList<FITSImage::Star> &stars)
+{
+    if(m_SolverType != SOLVER_STELLARSOLVER || isRacing())
+    {
+        emit logOutput("Only the internal solver can solve a list of stars without the image.");
+        QFutureInterface<Result> failed;
+        failed.reportStarted();
+        failed.reportResult(Result());
+        failed.reportFinished();
+        return failed.future();
+    }
+    createSharedResources();
+    return runJob(createStarsSolver(imagestats, stars));
+}
+
+StellarSolver *StellarSolver::createStarsSolver(const FITSImage::Statistic &imagestats, const QList<FITSImage::Star> &stars)
+{
+    StellarSolver *solver = createBatchSolver(nullptr);
+    solver->m_ProcessType = SOLVE;
+    solver->m_ImageView = InternalExtractorSolver::resolveImageView(imagestats, FITSImage::ImageView());
+    solver->resetImage(imagestats);
+    copySearch(solver);
+    solver->m_GivenStars = stars;
+    solver->m_UseGivenStars = true;
+    return solver;
+}
+
+QFuture<StellarSolver::Result> StellarSolver::verifyStarsJob(const FITSImage::Statistic &imagestats, const QList<FITSImage::Star> &stars,
+        const WCSData &wcs, bool tweak)
+{
+    if(m_SolverType != SOLVER_STELLARSOLVER || !wcs.hasWCS)
+    {
+        emit logOutput("Only the internal solver can verify a WCS, and the WCS must be set.");
+        QFutureInterface<Result> failed;
+        failed.reportStarted();
+        failed.reportResult(Result());
+        failed.reportFinished();
+        return failed.future();
+    }
+    createSharedResources();
+
+    StellarSolver *solver = createStarsSolver(imagestats, stars);
+    solver->setPriorWCS(wcs, true, tweak);
+    //Only the indexes around the WCS can verify it, so the others aren't loaded
+    FITSImage::wcs_point center;
+    WCSData centerWCS = wcs;
+    if(!m_UsePosition && centerWCS.pixelToWCS(QPointF(imagestats.width / 2.0, imagestats.height / 2.0), center))
+        solver->setSearchPositionInDegrees(center.ra, center.dec);
+    return runJob(solver);
+}
+
+QFuture<StellarSolver::Result> StellarSolver::runJob(StellarSolver *solver, int deadlineMS)
+{
+    // It is made on this thread but works and is deleted on the one of the job, which can only pull it if it has no thread
+    solver->moveToThread(nullptr);
+    QueuedJob job;
+    job.solver = solver;
+    job.result.reportStarted();
+    {
+        QMutexLocker locker(&m_JobMutex);
+        if(!m_JobClock.isValid())
+            m_JobClock.start();
+        job.queuedAt = m_JobClock.elapsed();
+        job.deadline = deadlineMS > 0 ? job.queuedAt + deadlineMS : NO_DEADLINE;
+        // The jobs with the same deadline, like all of the ones without one, stay in the order they were given
+        auto after = std::upper_bound(m_QueuedJobs.begin(), m_QueuedJobs.end(), job.deadline, [](qint64 deadline, const QueuedJob & queued)
+        {
+            return deadline < queued.deadline;
+        });
+        m_QueuedJobs.insert(after, job);
+    }
+    // Each job adds one task to the pool, and each task runs whichever job is first in the queue when it gets a thread
+    QtConcurrent::run(&m_JobPool, [this]()
+    {
+        runNextJob();
+    });
+    return job.result.future();
+}
+
+void StellarSolver::runNextJob()
+{
+    QMutexLocker locker(&m_JobMutex);
+    QueuedJob job = m_QueuedJobs.takeFirst();
+    StellarSolver *solver = job.solver;
+    const bool solving = solver->m_ProcessType == SOLVE;
+    const qint64 startedAt = m_JobClock.elapsed();
+    bool faster = false;
+    if(job.deadline != NO_DEADLINE)
+    {
+        const double estimate = m_JobEstimateMs[solving];
+        faster = startedAt >= job.deadline || estimate > DEADLINE_RISK * (job.deadline - startedAt);
+    }
+    const double lastPixscale = m_LastJobPixscale;
+    locker.unlock();
+
+    solver->moveToThread(QThread::currentThread());
+    if(faster)
+    {
+        useFasterProfile(solver, lastPixscale);
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("A job has %1 ms left until its deadline, so it is done with the faster profile").arg(
+                               qMax<qint64>(0, job.deadline - startedAt)));
+    }
+    Result result = solver->runDirectly();
+    delete solver;
+
+    locker.relock();
+    const qint64 finishedAt = m_JobClock.elapsed();
+    result.metrics.queueMs = startedAt - job.queuedAt;
+    result.metrics.fasterProfile = faster;
+    if(job.deadline != NO_DEADLINE)
+    {
+        result.metrics.deadlineMs = job.deadline - job.queuedAt;
+        result.metrics.deadlineMissed = finishedAt > job.deadline;
+        m_JobDeadlines++;
+        if(result.metrics.deadlineMissed)
+            m_JobDeadlineMisses++;
+    }
+    // Only the jobs done with their own profile tell how long the next one would take with it
+    if(!faster)
+    {
+        double &estimate = m_JobEstimateMs[solving];
+        const double took = finishedAt - startedAt;
+        estimate = estimate > 0 ? 0.7 * estimate + 0.3 * took : took;
+    }
+    if(solving && result.success && result.solution.pixscale > 0)
+        m_LastJobPixscale = result.solution.pixscale;
+    locker.unlock();
+
+    job.result.reportResult(result);
+    job.result.reportFinished();
+}
+
+void StellarSolver::useFasterProfile(StellarSolver *solver, double lastPixscale)
+{
+    Parameters &faster = solver->params;
+    // The automatic downsample would pick imageSize / 2048 + 1, see the start of a solve
+    const int downsample = faster.autoDownsample ? qMax(solver->m_Statistics.width, solver->m_Statistics.height) / 2048 + 1 : faster.downsample;
+    faster.autoDownsample = false;
+    faster.downsample = qMax(2, 2 * downsample);
+    const int stars = FASTER_PROFILE_STARS;
+    faster.keepNum = faster.keepNum > 0 ? qMin(faster.keepNum, stars) : stars;
+    faster.initialKeep = qMin(faster.initialKeep, 10 * stars);
+    if(lastPixscale > 0 && solver->m_ProcessType == SOLVE)
+        solver->setSearchScale(lastPixscale * (1 - FASTER_PROFILE_SCALE_RANGE), lastPixscale * (1 + FASTER_PROFILE_SCALE_RANGE), ARCSEC_PER_PIX);
+    solver->m_SolveUrgency = URGENCY_CRITICAL;
+}
+
+void StellarSolver::copySearch(StellarSolver *solver) const
+{
+    solver->m_UseScale = m_UseScale;
+    solver->m_ScaleLow = m_ScaleLow;
+    solver->m_ScaleHigh = m_ScaleHigh;
+    solver->m_ScaleUnit = m_ScaleUnit;
+    solver->m_UsePosition = m_UsePosition;
+    solver->m_SearchRA = m_SearchRA;
+    solver->m_SearchDE = m_SearchDE;
+}
+
+StellarSolver *StellarSolver::createBatchSolver(QObject *parent)
+{
+    StellarSolver *solver = new StellarSolver(parent);
+    solver->m_ProcessType = SOLVE;
+    solver->m_ExtractorType = m_ExtractorType;
+    solver->m_SolverType = m_SolverType;
+    solver->m_CleanupTemporaryFiles = m_CleanupTemporaryFiles;
+    solver->m_UseMemoryTempFiles = m_UseMemoryTempFiles;
+    solver->m_AutoGenerateAstroConfig = m_AutoGenerateAstroConfig;
+    solver->m_OnlySendFITSFiles = m_OnlySendFITSFiles;
+    solver->m_ExternalPaths = m_ExternalPaths;
+    solver->m_AstrometryAPIKey = m_AstrometryAPIKey;
+    solver->m_AstrometryAPIURL = m_AstrometryAPIURL;
+    solver->m_OnlineSession = m_OnlineSession;
+    solver->indexFolderPaths = indexFolderPaths;
+    solver->m_IndexFilePaths = m_IndexFilePaths;
+    solver->m_IndexCatalog = m_IndexCatalog;
+    solver->m_MemoryBudget = m_MemoryBudget;
+    solver->m_RacingSolvers = m_RacingSolvers;
+    solver->m_WarmExternalDatabases = m_WarmExternalDatabases;
+    solver->m_ExternalDatabaseFolders = m_ExternalDatabaseFolders;
+    solver->m_DatabaseCache = m_DatabaseCache;
+    solver->m_ThreadPool = m_ThreadPool;
+    solver->m_SolveUrgency = m_SolveUrgency;
+    solver->m_SolutionCache = m_SolutionCache;
+    solver->m_ReferenceCatalog = m_ReferenceCatalog;
+    solver->m_SharedBackground = m_SharedBackground;
+    solver->m_Calibration = m_Calibration;
+    solver->m_ColorChannel = m_ColorChannel;
+    solver->params = params;
+    solver->convFilter = convFilter;
+    copySearch(solver);
+    // The StellarSolvers of the batch run at the same time, so they would all write to the same Astrometry log file
+    solver->m_LogToFile = false;
+    solver->m_AstrometryLogLevel = m_AstrometryLogLevel;
+    solver->m_SSLogLevel = m_SSLogLevel;
+    solver->m_BasePath = m_BasePath;
+    if(m_SSLogLevel != LOG_OFF)
+        connect(solver, &StellarSolver::logOutput, this, &StellarSolver::logOutput);
+    return solver;
+}
+
+void StellarSolver::preloadIndexes()
+{
+    if(m_IndexPreload)
+        return;
+    if(!m_IndexCatalog)
+        m_IndexCatalog.reset(new IndexCatalog());
+    if(!m_ThreadPool)
+        m_ThreadPool.reset(new SolverThreadPool());
+
+    m_CancelIndexPreload.reset(new std::atomic<bool>(false));
+    m_IndexPreload = new QFutureWatcher<int>(this);
+    connect(m_IndexPreload, &QFutureWatcher<int>::finished, this, [this]()
+    {
+        const int count = m_IndexPreload->result();
+        m_IndexPreload->deleteLater();
+        m_IndexPreload = nullptr;
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("Preloaded %1 indexes").arg(count));
+        emit indexesPreloaded(count);
+    });
+
+    // The destructor stops the preload and waits for it, so the preload can emit the progress of this StellarSolver
+    const QSharedPointer<IndexCatalog> catalog = m_IndexCatalog;
+    const QSharedPointer<std::atomic<bool>> cancel = m_CancelIndexPreload;
+    const QStringList folders = indexFolderPaths;
+    const QStringList files = m_IndexFilePaths;
+    m_IndexPreload->setFuture(m_ThreadPool->run([this, catalog, cancel, folders, files]()
+    {
+        return catalog->preload(folders, files, [this](int done, int total)
+        {
+            emit indexPreloadProgress(done, total);
+        }, cancel.data());
+    }));
+}
+
+bool StellarSolver::startCoarseSolve()
+{
+    if(!m_CoarseSolve || m_ProcessType != SOLVE || m_SolverType != SOLVER_STELLARSOLVER || isRacing() || verifiesOnly()
+            || !m_ImageBuffer || m_RowReader || (m_UseScale && m_UsePosition))
+        return false;
+
+    //The coarse attempt is a StellarSolver with the settings of this one, that shares its index catalog and threads
+    StellarSolver *coarse = createBatchSolver(this);
+    coarse->m_CoarseSolve = false;
+    coarse->loadNewImageBuffer(m_Statistics, m_ImageBuffer);
+    coarse->m_ImageView = m_ImageView;
+    coarse->params.autoDownsample = false;
+    coarse->params.downsample = qMax(params.downsample, m_CoarseDownsample);
+    coarse->params.keepNum = m_CoarseStars;
+    coarse->params.solverTimeLimitMS = m_CoarseTimeLimitMS;
+    coarse->params.pipelineSolve = false;
+    if(!m_CoarseIndexFiles.isEmpty())
+        coarse->m_IndexFilePaths = m_CoarseIndexFiles;
+    m_CoarseSolver = coarse;
+    m_CoarseAborted = false;
+    m_isRunning = true;
+    m_HasFailed = false;
+    m_HasSolved = false;
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Starting a coarse attempt with the image downsampled by %1 and %2 stars").arg(coarse->params.downsample).arg(
+                           m_CoarseStars));
+    connect(coarse, &StellarSolver::finished, this, &StellarSolver::coarseSolveFinished);
+    coarse->start();
+    return true;
+}
+
+void StellarSolver::coarseSolveFinished()
+{
+    StellarSolver *coarse = m_CoarseSolver;
+    m_CoarseSolver = nullptr;
+    if(!coarse)
+        return;
+    coarse->deleteLater();
+
+    if(m_CoarseAborted)
+    {
+        m_CoarseAborted = false;
+        m_isRunning = false;
+        m_HasFailed = true;
+        emit ready();
+        emit finished();
+        return;
+    }
+
+    if(coarse->solvingDone() && !coarse->failed())
+    {
+        const FITSImage::Solution &coarseSolution = coarse->getSolution();
+        m_CoarseRestore.active = true;
+        m_CoarseRestore.useScale = m_UseScale;
+        m_CoarseRestore.scaleLow = m_ScaleLow;
+        m_CoarseRestore.scaleHigh = m_ScaleHigh;
+        m_CoarseRestore.scaleUnit = m_ScaleUnit;
+        m_CoarseRestore.usePosition = m_UsePosition;
+        m_CoarseRestore.searchRA = m_SearchRA;
+        m_CoarseRestore.searchDE = m_SearchDE;
+        m_CoarseRestore.searchRadius = params.search_radius;
+        //The coarse solution is from few stars in a small image, so the full solve searches a little around it
+        if(!m_UseScale)
+            setSearchScale(coarseSolution.pixscale * 0.9, coarseSolution.pixscale * 1.1, ARCSEC_PER_PIX);
+        if(!m_UsePosition)
         {
-            if(enoughRAMisAvailableFor(indexFolderPaths))
-            {
-                if(m_SSLogLevel != LOG_OFF)
-                    emit logOutput("There should be enough RAM to load the indexes in parallel.");
-            }
-            else
-            {
-                if(m_SSLogLevel != LOG_OFF)
-                {
-                    emit logOutput("Not enough RAM is available on this system for loading the index files you have in parallel");
-                    emit logOutput("Disabling the inParallel option.");
-                }
-                params.inParallel = false;
-            }
+            setSearchPositionInDegrees(coarseSolution.ra, coarseSolution.dec);
+            params.search_radius = qMax(1.0, qMax(coarseSolution.fieldWidth, coarseSolution.fieldHeight) / 60.0);
         }
+        connect(this, &StellarSolver::finished, this, &StellarSolver::restoreCoarseSearch, Qt::UniqueConnection);
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("The coarse attempt solved at %1\"/px, the full solve searches around it").arg(coarseSolution.pixscale));
     }
+    else if(m_SSLogLevel != LOG_OFF)
+        emit logOutput("The coarse attempt did not solve, the full solve searches all of the scales and positions");
 
-    return true;
+    m_CoarseTried = true;
+    start();
 }
 
-//This allows us to start multiple threads to search simulaneously in separate threads/cores
-//to attempt to efficiently use modern multi core computers to speed up the solve
-void StellarSolver::parallelSolve()
+void StellarSolver::restoreCoarseSearch()
 {
-    if(params.multiAlgorithm == NOT_MULTI || !(m_SolverType == SOLVER_STELLARSOLVER || m_SolverType == SOLVER_LOCALASTROMETRY))
+    disconnect(this, &StellarSolver::finished, this, &StellarSolver::restoreCoarseSearch);
+    if(!m_CoarseRestore.active)
         return;
-    qDeleteAll(parallelSolvers);
-    parallelSolvers.clear();
-    m_ParallelSolversFinishedCount = 0;
-    int threads = QThread::idealThreadCount();
+    m_CoarseRestore.active = false;
+    m_UseScale = m_CoarseRestore.useScale;
+    m_ScaleLow = m_CoarseRestore.scaleLow;
+    m_ScaleHigh = m_CoarseRestore.scaleHigh;
+    m_ScaleUnit = m_CoarseRestore.scaleUnit;
+    m_UsePosition = m_CoarseRestore.usePosition;
+    m_SearchRA = m_CoarseRestore.searchRA;
+    m_SearchDE = m_CoarseRestore.searchDE;
+    params.search_radius = m_CoarseRestore.searchRadius;
+}
 
-    if(params.multiAlgorithm == MULTI_SCALES)
+bool StellarSolver::startNextBatchImage()
+{
+    if(m_BatchNextImage >= m_BatchImages.count() || m_BatchRunning >= m_BatchMaxConcurrent)
+        return false;
+
+    const int imageNumber = m_BatchNextImage++;
+    const BatchImage &image = m_BatchImages.at(imageNumber);
+    m_BatchRunning++;
+
+    if(image.imageBuffer)
     {
-        //Attempt to search on multiple scales
-        //Note, originally I had each parallel solver getting equal ranges, but solves are faster on bigger scales
-        //So now I'm giving the bigger scale solvers more of a range to work with.
-        double minScale;
-        double maxScale;
-        ScaleUnits units;
-        if(m_UseScale)
-        {
-            minScale = m_ScaleLow;
-            maxScale = m_ScaleHigh;
-            units = m_ScaleUnit;
-        }
-        else
+        solveBatchImage(imageNumber, image.stats, image.imageBuffer, nullptr);
+        return true;
+    }
+
+    // The image is loaded on the pool so that the loads count against its threads too, and the solve starts back on this thread
+    QFutureWatcher<BatchLoad> *load = new QFutureWatcher<BatchLoad>(this);
+    m_BatchLoads.append(load);
+    connect(load, &QFutureWatcher<BatchLoad>::finished, this, [this, load, imageNumber]()
+    {
+        m_BatchLoads.removeOne(load);
+        load->deleteLater();
+        BatchLoad result = load->result();
+        if(!result.imageBuffer)
         {
-            minScale = params.minwidth;
-            maxScale = params.maxwidth;
-            units = DEG_WIDTH;
+            emit logOutput(QString("Failed to load %1").arg(m_BatchImages.at(imageNumber).fileName));
+            finishBatchImage(imageNumber, nullptr);
         }
-        double scaleConst = (maxScale - minScale) / pow(threads, 2);
-        if(m_SSLogLevel != LOG_OFF)
-            emit logOutput(QString("Starting %1 threads to solve on multiple scales").arg(threads));
-        for(int thread = 0; thread < threads; thread++)
+        else if(m_BatchAborted)
         {
-            double low = minScale + scaleConst * pow(thread, 2);
-            double high = minScale + scaleConst * pow(thread + 1, 2);
-            ExtractorSolver *solver = m_ExtractorSolver->spawnChildSolver(thread);
-            connect(solver, &ExtractorSolver::finished, this, &StellarSolver::finishParallelSolve);
-            solver->setSearchScale(low, high, units);
-            parallelSolvers.append(solver);
-            if(m_SSLogLevel != LOG_OFF)
-                emit logOutput(QString("Solver # %1, Low %2, High %3 %4").arg(parallelSolvers.count()).arg(low).arg(high).arg(
-                                   getScaleUnitString()));
+            delete[] result.imageBuffer;
+            finishBatchImage(imageNumber, nullptr);
         }
-    }
-    //Note: it might be useful to do a parallel solve on multiple positions, but I am afraid
-    //that since it searches in a circle around the search position, it might be difficult to make it
-    //search a square grid without either missing sections of sky or overlapping search regions.
-    else if(params.multiAlgorithm == MULTI_DEPTHS)
+        else
+            solveBatchImage(imageNumber, result.stats, result.imageBuffer, result.imageBuffer);
+    });
+    const QString fileName = image.fileName;
+    const ImageLoader loader = m_BatchLoader;
+    load->setFuture(m_ThreadPool->run([fileName, loader]()
     {
-        //Attempt to search on multiple depths
-        int sourceNum = 200;
-        if(params.keepNum != 0)
-            sourceNum = params.keepNum;
-        int inc = sourceNum / threads;
-        //We don't need an unnecessary number of threads
-        if(inc < 10)
-            inc = 10;
-        if(m_SSLogLevel != LOG_OFF)
-            emit logOutput(QString("Starting %1 threads to solve on multiple depths").arg(sourceNum / inc));
-        for(int i = 1; i < sourceNum; i += inc)
-        {
-            ExtractorSolver *solver = m_ExtractorSolver->spawnChildSolver(i);
-            connect(solver, &ExtractorSolver::finished, this, &StellarSolver::finishParallelSolve);
-            solver->depthlo = i;
-            solver->depthhi = i + inc;
-            parallelSolvers.append(solver);
-            if(m_SSLogLevel != LOG_OFF)
-                emit logOutput(QString("Child Solver # %1, Depth Low %2, Depth High %3").arg(parallelSolvers.count()).arg(i).arg(i + inc));
-        }
+        BatchLoad result;
+        result.imageBuffer = loader(fileName, result.stats);
+        return result;
+    }));
+    return true;
+}
+
+void StellarSolver::solveBatchImage(int imageNumber, const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer, uint8_t *ownedBuffer)
+{
+    StellarSolver *solver = createBatchSolver(this);
+    solver->m_FileToProcess = m_BatchImages.at(imageNumber).fileName;
+    solver->loadNewImageBuffer(imagestats, imageBuffer);
+    m_BatchSolvers.append(solver);
+    if(ownedBuffer)
+        m_BatchBuffers.insert(solver, ownedBuffer);
+
+    connect(solver, &StellarSolver::finished, this, [this, solver, imageNumber]()
+    {
+        m_BatchSolvers.removeOne(solver);
+        finishBatchImage(imageNumber, solver);
+        // The solver has stopped, but it is deleted later since this is called from its signal
+        solver->deleteLater();
+        delete[] m_BatchBuffers.take(solver);
+    });
+    solver->start();
+}
+
+void StellarSolver::finishBatchImage(int imageNumber, StellarSolver *solver)
+{
+    m_BatchRunning--;
+    const bool solved = solver && solver->solvingDone();
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Image %1 of %2 of the batch %3").arg(imageNumber + 1).arg(m_BatchImages.count()).arg(
+                           solved ? "was solved" : "failed"));
+    emit batchImageSolved(imageNumber, solved, solver);
+
+    startNextBatchImage();
+
+    // The next image can finish right away, so the batch may already have been finished by the time that returns
+    if(m_BatchRunning == 0 && !m_BatchImages.isEmpty())
+    {
+        m_BatchImages.clear();
+        m_BatchLoader = ImageLoader();
+        emit batchFinished();
     }
-    for(auto &solver : parallelSolvers)
-        solver->start();
 }
 
 bool StellarSolver::parallelSolversAreRunning() const
@@ -485,6 +2241,8 @@ bool StellarSolver::parallelSolversAreRunning() const
 void StellarSolver::processFinished(int code)
 {
     numStars  = m_ExtractorSolver->getNumStarsFound();
+    if(m_ProcessType == SOLVE)
+        keepStarsForReuse();
     if(code == 0)
     {
         if(m_ProcessType == SOLVE && m_ExtractorSolver->solvingDone())
@@ -492,14 +2250,13 @@ void StellarSolver::processFinished(int code)
             solution = m_ExtractorSolver->getSolution();
             solutionIndexNumber = m_ExtractorSolver->getSolutionIndexNumber();
             solutionHealpix = m_ExtractorSolver->getSolutionHealpix();
+            solutionLogOdds = m_ExtractorSolver->getSolutionLogOdds();
             m_SolverStars = m_ExtractorSolver->getStarList();
             if(m_ExtractorSolver->hasWCSData())
             {
                 hasWCS = true;
                 wcsData = m_ExtractorSolver->getWCSData();
-                wcsData = m_ExtractorSolver->getWCSData();
-                if(m_ExtractorStars.count() > 0)
-                    wcsData.appendStarsRAandDEC(m_ExtractorStars);
+                m_StarsNeedSkyPositions = m_ExtractorStars.count() > 0;
             }
             m_HasSolved = true;
         }
@@ -508,17 +2265,46 @@ void StellarSolver::processFinished(int code)
             m_ExtractorStars = m_ExtractorSolver->getStarList();
             background = m_ExtractorSolver->getBackground();
             m_CalculateHFR = m_ExtractorSolver->isCalculatingHFR();
-            if(hasWCS)
-                wcsData.appendStarsRAandDEC(m_ExtractorStars);
+            if(m_SummaryOnly)
+            {
+                // The extractors that could not summarize the stars while they were measured made a list of them
+                if(!m_ExtractorSolver->getImageQuality(m_ImageQuality))
+                    m_ImageQuality = StarSummary::summarize(m_ExtractorStars, background);
+                numStars = m_ImageQuality.numStars;
+            }
+            m_StarsNeedSkyPositions = hasWCS;
+            if(!m_Regions.isEmpty())
+            {
+                m_RegionStarLists = m_ExtractorSolver->getRegionStars();
+                // The other extractors extracted the whole image, so its stars are sorted into the regions here
+                if(m_RegionStarLists.isEmpty())
+                {
+                    attachSkyPositions();
+                    for(const QRect &region : m_Regions)
+                    {
+                        QList<FITSImage::Star> regionStars;
+                        for(const FITSImage::Star &star : m_ExtractorStars)
+                        {
+                            if(QRectF(region).contains(star.x, star.y))
+                                regionStars.append(star);
+                        }
+                        m_RegionStarLists.append(regionStars);
+                    }
+                }
+            }
             m_HasExtracted = true;
+            if(m_TrackStars && !m_SummaryOnly && m_Regions.isEmpty())
+                updateTracking();
         }
     }
     else
         m_HasFailed = true;
 
     m_isRunning = false;
+    recordCancelLatency();
 
     emit ready();
+    reportSolveMetrics(m_ExtractorSolver.data());
     emit finished();
 }
 
@@ -532,70 +2318,347 @@ int StellarSolver::whichSolver(ExtractorSolver *solver)
     return 0;
 }
 
+//The ranges are ordered by how many times they solved for each second they were searched, so the ones that usually
+//solve the images of this camera and optics quickly go first.  A range that was never searched counts as solving half of the time.
+void StellarSolver::scheduleParallelWork(int threads)
+{
+    if(m_BandStatistics.isEmpty() || m_ParallelWork.isEmpty())
+        return;
+
+    int attempts = 0;
+    qint64 time = 0;
+    for(const BandStatistics &stats : qAsConst(m_BandStatistics))
+    {
+        attempts += stats.attempts;
+        time += stats.time;
+    }
+    const double averageTime = attempts > 0 ? qMax(1.0, (double) time / attempts) : 1.0;
+
+    QHash<QString, double> rates;
+    for(const ParallelWorkItem &work : qAsConst(m_ParallelWork))
+    {
+        const BandStatistics stats = m_BandStatistics.value(work.band);
+        const double solveRate = (stats.solves + 0.5) / (stats.attempts + 1.0);
+        const double attemptTime = stats.attempts > 0 ? qMax(1.0, (double) stats.time / stats.attempts) : averageTime;
+        rates.insert(work.band, solveRate / attemptTime);
+    }
+    std::stable_sort(m_ParallelWork.begin(), m_ParallelWork.end(), [&rates](const ParallelWorkItem & a, const ParallelWorkItem & b)
+    {
+        return rates.value(a.band) > rates.value(b.band);
+    });
+
+    //The ranges that never solved only get their share of the time limit, so they can't hold up the rest of the queue.
+    //If they are stopped by it, they go to the end of the queue and get searched again with the time that is left.
+    //Only the internal solver has limits in milliseconds, so the external one searches every range until it is done.
+    const qint64 timeLimit = params.solverTimeLimitMS > 0 ? params.solverTimeLimitMS : params.solverTimeLimit * 1000LL;
+    const qint64 timeShare = m_SolverType == SOLVER_STELLARSOLVER ? timeLimit * threads / m_ParallelWork.count() : 0;
+    int sliced = 0;
+    for(ParallelWorkItem &work : m_ParallelWork)
+    {
+        const BandStatistics stats = m_BandStatistics.value(work.band);
+        if(stats.attempts > 0 && stats.solves == 0 && timeShare > 0)
+        {
+            work.timeSlice = timeShare;
+            sliced++;
+        }
+    }
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Searching the ranges that solved the fastest before first, %1 ranges that never solved get %2 ms each").arg(
+                           sliced).arg(timeShare));
+}
+
+void StellarSolver::recordParallelWork(ExtractorSolver *solver, bool solved)
+{
+    if(!m_RunningWork.contains(solver))
+        return;
+    ParallelWorkItem work = m_RunningWork.take(solver);
+    //A range that was stopped because another one solved or the solve was aborted didn't get a fair try
+    if(!solved && (m_HasSolved || m_CancelTimer.isValid() || (m_DeterministicParallel && m_BestParallelSolver)))
+        return;
+
+    const qint64 time = m_ParallelSolveTimer.elapsed() - work.started;
+    BandStatistics &stats = m_BandStatistics[work.band];
+    stats.attempts++;
+    stats.time += time;
+    if(solved)
+        stats.solves++;
+    //The solver stops a little after its time limit, so a range that ran for nearly all of its slice was stopped by it
+    else if(work.timeSlice > 0 && time >= work.timeSlice * 9 / 10)
+    {
+        work.timeSlice = 0;
+        m_ParallelWork.append(work);
+    }
+}
+
+QVariantMap StellarSolver::getBandStatistics() const
+{
+    QVariantMap statistics;
+    for(auto it = m_BandStatistics.constBegin(); it != m_BandStatistics.constEnd(); ++it)
+        statistics.insert(it.key(), QVariantList() << it->attempts << it->solves << it->time);
+    return statistics;
+}
+
+void StellarSolver::setBandStatistics(const QVariantMap &statistics)
+{
+    m_BandStatistics.clear();
+    for(auto it = statistics.constBegin(); it != statistics.constEnd(); ++it)
+    {
+        const QVariantList values = it.value().toList();
+        if(values.count() < 3)
+            continue;
+        BandStatistics stats;
+        stats.attempts = values.at(0).toInt();
+        stats.solves = values.at(1).toInt();
+        stats.time = values.at(2).toLongLong();
+        m_BandStatistics.insert(it.key(), stats);
+    }
+}
+
+static void addHardwareCounters(FITSImage::HardwareCounters &total, const FITSImage::HardwareCounters &counters)
+{
+    total.cycles += counters.cycles;
+    total.instructions += counters.instructions;
+    total.cacheMisses += counters.cacheMisses;
+    total.branchMisses += counters.branchMisses;
+}
+
+//The times and counts add up, the searches of the indexes are appended
+static void addSolveMetrics(FITSImage::SolveMetrics &total, const FITSImage::SolveMetrics &metrics)
+{
+    total.prepareMs += metrics.prepareMs;
+    total.backgroundMs += metrics.backgroundMs;
+    total.detectionMs += metrics.detectionMs;
+    total.deblendMs += metrics.deblendMs;
+    total.photometryMs += metrics.photometryMs;
+    total.filterMs += metrics.filterMs;
+    total.extractionTimedOut = total.extractionTimedOut || metrics.extractionTimedOut;
+    total.indexLoadMs += metrics.indexLoadMs;
+    total.searchMs += metrics.searchMs;
+    total.verifyMs += metrics.verifyMs;
+    total.tweakMs += metrics.tweakMs;
+    total.quadsTried += metrics.quadsTried;
+    total.codesMatched += metrics.codesMatched;
+    total.verifications += metrics.verifications;
+    total.minorPageFaults += metrics.minorPageFaults;
+    total.majorPageFaults += metrics.majorPageFaults;
+    total.indexSearches.append(metrics.indexSearches);
+    if(metrics.hardwareCounted)
+    {
+        total.hardwareCounted = true;
+        addHardwareCounters(total.extractionCounters, metrics.extractionCounters);
+        addHardwareCounters(total.searchCounters, metrics.searchCounters);
+        addHardwareCounters(total.verifyCounters, metrics.verifyCounters);
+    }
+    //The child solvers all run on the same CPU
+    if(!metrics.extractionSimd.isEmpty())
+        total.extractionSimd = metrics.extractionSimd;
+    if(!metrics.solverSimd.isEmpty())
+        total.solverSimd = metrics.solverSimd;
+}
+
 //This slot listens for signals from the child solvers that they are in fact done with the solve
 void StellarSolver::finishParallelSolve(int success)
 {
     bool emitReady = false;
     bool emitFinished = false;
+    QList<QPointer<ExtractorSolver>> retired;
 
-    m_ParallelSolversFinishedCount++;
     ExtractorSolver *reportingSolver = qobject_cast<ExtractorSolver*>(sender());
     if(!reportingSolver)
         return;
-
-    if(success == 0 && !m_HasSolved)
+    //Racing solvers have no ranges, so they always use the first solution
+    const bool rankedWork = m_DeterministicParallel && m_RunningWork.contains(reportingSolver);
+    const int priority = m_RunningWork.value(reportingSolver).priority;
+    recordParallelWork(reportingSolver, success == 0);
+    //A child solver can be started again for another range, so its metrics are added up every time it finishes
+    addSolveMetrics(m_SolveMetrics, reportingSolver->getSolveMetrics());
+
+    if(success == 0 && !m_HasSolved && rankedWork)
+    {
+        //The solution of the earliest range wins, so the ranges after it can't matter any more, but the ones before it still can
+        if(!m_BestParallelSolver || priority < m_BestParallelPriority)
+        {
+            const bool first = !m_BestParallelSolver;
+            m_BestParallelSolver = reportingSolver;
+            m_BestParallelPriority = priority;
+            m_ParallelWork.clear();
+            int before = 0;
+            for(auto it = m_RunningWork.constBegin(); it != m_RunningWork.constEnd(); ++it)
+            {
+                if(it.value().priority < priority)
+                    before++;
+                else if(it.key()->isRunning())
+                    it.key()->abort();
+            }
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput(QString("Child solver: %1 solved range %2, waiting for the %3 ranges before it").arg(whichSolver(
+                                   reportingSolver)).arg(priority + 1).arg(before));
+            if(first && m_DeterministicWindowMs > 0)
+            {
+                const int solveNumber = m_ParallelSolveNumber;
+                QTimer::singleShot(m_DeterministicWindowMs, this, [this, solveNumber]()
+                {
+                    if(solveNumber != m_ParallelSolveNumber || m_HasSolved || m_RunningWork.isEmpty())
+                        return;
+                    if(m_SSLogLevel != LOG_OFF)
+                        emit logOutput("The window for the ranges before the solution is over, stopping them");
+                    startCancelTimer();
+                    for(auto &solver : parallelSolvers)
+                    {
+                        if(solver->isRunning())
+                            solver->abort();
+                    }
+                });
+            }
+        }
+    }
+    else if(success == 0 && !m_HasSolved && params.multiAlgorithm == MULTI_POSITIONS_AND_SCALES)
+    {
+        //In this mode, the ranges overlap on the sky, so more than one child solver can find a solution before the others stop.
+        //The first solution stops all of the other work, and then the one with the best log odds is used once they are all done.
+        if(!m_BestParallelSolver)
+        {
+            m_ParallelWork.clear();
+            startCancelTimer();
+            for(auto &solver : parallelSolvers)
+            {
+                if(solver != reportingSolver && solver->isRunning())
+                    solver->abort();
+            }
+            if(m_SSLogLevel != LOG_OFF)
+            {
+                emit logOutput(QString("Child solver: %1 solved with log odds %2").arg(whichSolver(reportingSolver)).arg(reportingSolver->getSolutionLogOdds()));
+                emit logOutput("Shutting down other child solvers");
+            }
+        }
+        if(!m_BestParallelSolver || reportingSolver->getSolutionLogOdds() > m_BestParallelSolver->getSolutionLogOdds())
+            m_BestParallelSolver = reportingSolver;
+    }
+    else if(success == 0 && !m_HasSolved)
     {
+        startCancelTimer();
         for(auto &solver : parallelSolvers)
         {
             disconnect(solver, &ExtractorSolver::logOutput, this, &StellarSolver::logOutput);
             if(solver != reportingSolver && solver->isRunning())
                 solver->abort();
         }
+        m_ParallelWork.clear();
         if(m_SSLogLevel != LOG_OFF)
         {
             emit logOutput(QString("Successfully solved with child solver: %1").arg(whichSolver(reportingSolver)));
             emit logOutput("Shutting down other child solvers");
         }
 
-        numStars = reportingSolver->getNumStarsFound();
-        solution = reportingSolver->getSolution();
-        solutionIndexNumber = reportingSolver->getSolutionIndexNumber();
-        solutionHealpix = reportingSolver->getSolutionHealpix();
-        m_SolverStars = reportingSolver->getStarList();
-
-        if(reportingSolver->hasWCSData())
-        {
-            wcsData = reportingSolver->getWCSData();
-            hasWCS = true;
-            if(m_ExtractorStars.count() > 0)
-                wcsData.appendStarsRAandDEC(m_ExtractorStars);
-            m_isRunning = false;
-        }
-        m_HasSolved = true;
-        m_ExtractorSolver->cleanupTempFiles();
+        useParallelSolution(reportingSolver);
         emitReady = true;
     }
     else
     {
         if(m_SSLogLevel != LOG_OFF && !m_HasSolved)
             emit logOutput(QString("Child solver: %1 did not solve or was aborted").arg(whichSolver(reportingSolver)));
+
+        //The child solver is done with its range, so it can take the next one from the queue if there is any work left.
+        //The finished signal gets emitted right before its thread ends, so this waits for that before restarting it.
+        reportingSolver->wait();
+        if(startNextParallelWork(reportingSolver))
+            return;
     }
 
+    m_ParallelSolversFinishedCount++;
     if(m_ParallelSolversFinishedCount == parallelSolvers.count())
     {
+        if(m_BestParallelSolver && !m_HasSolved)
+        {
+            if(m_SSLogLevel != LOG_OFF && m_DeterministicParallel)
+                emit logOutput(QString("Using the solution of range %1 from child solver: %2").arg(m_BestParallelPriority + 1).arg(
+                                   whichSolver(m_BestParallelSolver)));
+            else if(m_SSLogLevel != LOG_OFF)
+                emit logOutput(QString("Using the solution from child solver: %1 with the best log odds: %2").arg(whichSolver(m_BestParallelSolver)).arg(
+                                   m_BestParallelSolver->getSolutionLogOdds()));
+            useParallelSolution(m_BestParallelSolver);
+            emitReady = true;
+        }
+        m_BestParallelSolver = nullptr;
         m_isRunning = false;
+        recordCancelLatency();
         if(!m_HasSolved){
             m_HasFailed = true;
             emitReady = true; //Since this was emitted earlier if it had been solved
         }
-        qDeleteAll(parallelSolvers);
+        //The child solvers are deleted once the result is out, deleting them waits for their threads and frees their images and star lists
+        for(auto &solver : parallelSolvers)
+        {
+            disconnect(solver, nullptr, this, nullptr);
+            retired.append(solver);
+        }
         parallelSolvers.clear();
+        m_RunningWork.clear();
         m_ExtractorSolver->cleanupTempFiles();
         emitFinished=true;
     }
 
     if (emitReady) emit ready();
-    if (emitFinished) emit finished();
+    if (emitFinished)
+    {
+        //The child solvers already added theirs, so this adds the star extraction done before the parallel solve
+        reportSolveMetrics(m_ExtractorSolver.data());
+        emit finished();
+    }
+    //This StellarSolver could have been deleted by a slot of finished, which deletes its child solvers too
+    for(auto &solver : retired)
+    {
+        if(solver)
+            solver->deleteLater();
+    }
+}
+
+void StellarSolver::attachSkyPositions() const
+{
+    if(!m_StarsNeedSkyPositions)
+        return;
+    m_StarsNeedSkyPositions = false;
+    if(hasWCS && m_ExtractorStars.count() > 0)
+        wcsData.appendStarsRAandDEC(m_ExtractorStars);
+}
+
+const StarCatalog &StellarSolver::extractorCatalog() const
+{
+    attachSkyPositions();
+    //The list the catalog was made from stops being shared with the extracted stars as soon as those are replaced or changed
+    if(!m_CatalogedStars.isSharedWith(m_ExtractorStars))
+    {
+        m_ExtractorCatalog = StarCatalog(m_ExtractorStars);
+        m_CatalogedStars = m_ExtractorStars;
+    }
+    return m_ExtractorCatalog;
+}
+
+StarView StellarSolver::getSolverStarView() const
+{
+    //The solve used the stars of the extraction as they were, which get their sky positions in the catalog of the extraction
+    if(!m_SolverStars.isEmpty() && m_SolverStars.isSharedWith(m_ExtractorStars))
+        return getStarView();
+    if(!m_SolverCatalogedStars.isSharedWith(m_SolverStars))
+    {
+        m_SolverCatalog = StarCatalog(m_SolverStars);
+        m_SolverCatalogedStars = m_SolverStars;
+    }
+    return StarView(m_SolverCatalog);
+}
+
+QList<FITSImage::Star> StellarSolver::getStarListInFile() const
+{
+    attachSkyPositions();
+    QList<FITSImage::Star> stars = m_ExtractorStars;
+    if(m_Statistics.xOffset == 0 && m_Statistics.yOffset == 0)
+        return stars;
+    for(FITSImage::Star &star : stars)
+    {
+        star.x += m_Statistics.xOffset;
+        star.y += m_Statistics.yOffset;
+    }
+    return stars;
 }
 
 QString StellarSolver::raString(double ra)
@@ -635,10 +2698,26 @@ bool StellarSolver::pixelToWCS(const QPointF &pixelPoint, FITSImage::wcs_point &
 //This is the abort method.  It works in different ways for the different solvers.
 void StellarSolver::abort()
 {
+  startCancelTimer();
+  //This makes sure the child solvers don't pick up any more work in a parallel solve
+  m_ParallelWork.clear();
   for(auto &solver : parallelSolvers)
       solver->abort();
   if(m_ExtractorSolver)
       m_ExtractorSolver->abort();
+  //This stops the batch from starting any more images
+  if(m_BatchRunning > 0)
+  {
+      m_BatchAborted = true;
+      m_BatchNextImage = m_BatchImages.count();
+  }
+  for(auto &batchSolver : m_BatchSolvers)
+      batchSolver->abort();
+  if(m_CoarseSolver)
+  {
+      m_CoarseAborted = true;
+      m_CoarseSolver->abort();
+  }
 }
 
 //This is the abort and wait method, it is useful if you want the solver to be all shut down before moving on
@@ -649,6 +2728,42 @@ void StellarSolver::abortAndWait()
       solver->wait();
   if(m_ExtractorSolver)
       m_ExtractorSolver->wait();
+  for(auto &batchSolver : m_BatchSolvers)
+      batchSolver->abortAndWait();
+  if(m_CoarseSolver)
+      m_CoarseSolver->abortAndWait();
+  for(auto &load : m_BatchLoads)
+      load->waitForFinished();
+  recordCancelLatency();
+}
+
+void StellarSolver::startCancelTimer()
+{
+    if(isRunning() && !m_CancelTimer.isValid())
+        m_CancelTimer.start();
+}
+
+void StellarSolver::recordCancelLatency()
+{
+    //This gets called once every solver thread has finished, after that the timer is invalid so the finished signals that arrive after abortAndWait don't record it again
+    if(!m_CancelTimer.isValid())
+        return;
+    m_CancelLatency = m_CancelTimer.elapsed();
+    m_CancelTimer.invalidate();
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("All of the solver threads stopped %1 ms after they were cancelled").arg(m_CancelLatency));
+}
+
+void StellarSolver::reportSolveMetrics(const ExtractorSolver *solver)
+{
+    if(solver)
+        addSolveMetrics(m_SolveMetrics, solver->getSolveMetrics());
+    m_SolveMetrics.totalMs = m_MetricsTimer.isValid() ? m_MetricsTimer.nsecsElapsed() / 1e6 : 0;
+    emit solveMetrics(m_SolveMetrics);
+
+    const QString traceFile = Tracer::environmentFile();
+    if(!traceFile.isEmpty() && !Tracer::writeChromeTrace(traceFile))
+        emit logOutput(QString("Unable to write the trace to %1").arg(traceFile));
 }
 
 //This method checks all the solvers and the internal running boolean to determine if anything is running.
@@ -658,14 +2773,37 @@ bool StellarSolver::isRunning() const
         return true;
     if(m_ExtractorSolver && m_ExtractorSolver->isRunning())
         return true;
+    if(m_BatchRunning > 0)
+        return true;
     return m_isRunning;
 }
 
 //This method uses a fwhm value to generate the conv filter the star extractor will use.
+//The filters only depend on the type and the fwhm rounded up, so the ones generated before are kept and shared, QVector doesn't copy them.
 QVector<float> StellarSolver::generateConvFilter(SSolver::ConvFilterType filter, double fwhm)
+{
+    static QMutex cacheMutex;
+    static QHash<QPair<int, int>, QVector<float>> cache;
+    const int maxCachedFilters = 64;
+
+    const int size = abs(ceil(fwhm));
+    const QPair<int, int> key(filter, size);
+    QMutexLocker locker(&cacheMutex);
+    auto cached = cache.constFind(key);
+    if(cached != cache.constEnd())
+        return cached.value();
+
+    QVector<float> convFilter = makeConvFilter(filter, size);
+    if(cache.size() >= maxCachedFilters)
+        cache.clear();
+    if(filter != SSolver::CONV_CUSTOM)
+        cache.insert(key, convFilter);
+    return convFilter;
+}
+
+QVector<float> StellarSolver::makeConvFilter(SSolver::ConvFilterType filter, int size)
 {
     QVector<float> convFilter;
-    int size = abs(ceil(fwhm));
     double amplitude = 1.0;
     if(filter == SSolver::CONV_DEFAULT)
     {
@@ -743,7 +2881,6 @@ void StellarSolver::updateConvolutionFilter()
 {
     if(params.convFilterType == SSolver::CONV_CUSTOM)
         return;
-    convFilter.clear();
     convFilter = generateConvFilter(params.convFilterType, params.fwhm);
 }
 
@@ -976,6 +3113,84 @@ QStringList StellarSolver::getDefaultIndexFolderPaths()
     return indexFilePaths;
 }
 
+//These file systems are in RAM, so writing the image and the star lists for the external programs and reading back
+//their results doesn't touch the disk, which is slow and wears out on the SD cards of small field computers.
+QString StellarSolver::getMemoryTempPath(qint64 requiredBytes)
+{
+    QStringList candidates;
+#if defined(Q_OS_LINUX)
+    candidates << "/dev/shm";
+    const QString runtimeDir = QString::fromLocal8Bit(qgetenv("XDG_RUNTIME_DIR"));
+    if(!runtimeDir.isEmpty())
+        candidates << runtimeDir;
+#endif
+    for(const QString &candidate : candidates)
+    {
+        QStorageInfo storage(candidate);
+        if(!storage.isValid() || !storage.isReady() || storage.isReadOnly())
+            continue;
+        const QString type = storage.fileSystemType();
+        if(type != "tmpfs" && type != "ramfs")
+            continue;
+        if(storage.bytesAvailable() < requiredBytes)
+            continue;
+        //Each user gets their own directory, since /dev/shm is shared
+        const QString path = QDir(candidate).filePath("stellarsolver-" + QDir::home().dirName());
+        if(QDir().mkpath(path) && QFileInfo(path).isWritable())
+            return path;
+    }
+    return QString();
+}
+
+//None of the external solvers can take jobs once they are running, so each solve starts a new process that reads its databases again.
+//Keeping them mapped in this process keeps them in the page cache, so that is read from memory instead of the disk.
+void StellarSolver::warmExternalDatabases()
+{
+    if(!m_WarmExternalDatabases || m_ProcessType != SOLVE)
+        return;
+    QStringList folders = m_ExternalDatabaseFolders;
+    QStringList nameFilters;
+    if(m_SolverType == SOLVER_LOCALASTROMETRY)
+    {
+        folders << indexFolderPaths;
+        nameFilters << "*.fits" << "*.fit";
+    }
+    else if(m_SolverType == SOLVER_ASTAP)
+    {
+        //The databases are installed next to the program, or in /opt/astap on Linux
+        folders << QFileInfo(m_ExternalPaths.astapBinaryPath).absolutePath();
+        if(QFileInfo::exists("/opt/astap"))
+            folders << "/opt/astap";
+        nameFilters << "*.1476" << "*.290";
+    }
+    else if(m_SolverType == SOLVER_WATNEYASTROMETRY)
+        nameFilters << "*.qdb";
+    else
+        return;
+    if(folders.isEmpty())
+        return;
+
+    if(!m_DatabaseCache)
+        m_DatabaseCache.reset(new ExternalDatabaseCache());
+    m_DatabaseCache->warm(folders, nameFilters);
+}
+
+QString StellarSolver::tempFilePath()
+{
+    if(!m_UseMemoryTempFiles)
+        return m_BasePath;
+    //The image is written once for the external programs and there can be a few copies of it and of its star lists at a time
+    const qint64 imageBytes = (qint64) m_Statistics.samples_per_channel * m_Statistics.channels * m_Statistics.bytesPerPixel;
+    const QString memoryPath = getMemoryTempPath(4 * imageBytes + 16 * 1024 * 1024);
+    if(memoryPath.isEmpty())
+    {
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput("There is no RAM disk with enough space for the temporary files, so they go to " + m_BasePath);
+        return m_BasePath;
+    }
+    return memoryPath;
+}
+
 bool StellarSolver::appendStarsRAandDEC(QList<FITSImage::Star> &stars)
 {
     if(hasWCS)
@@ -1027,6 +3242,75 @@ bool StellarSolver::getAvailableRAM(double &availableRAM, double &totalRAM)
 }
 
 //This should determine if enough RAM is available to load all the index files in parallel
+FITSImage::MemoryUsage StellarSolver::getMemoryUsage() const
+{
+    FITSImage::MemoryUsage usage;
+    if(m_IndexCatalog)
+        usage.indexBytes = m_IndexCatalog->loadedBytes();
+    if(m_ExtractionBuffers)
+        usage.imageBytes = m_ExtractionBuffers->bytes();
+    usage.arenaBytes = SEP::sep_arena_reserved();
+    for(const ExtractorSolver *solver : parallelSolvers)
+    {
+        if(solver->isRunning())
+            usage.childBytes += childSolverBytes;
+    }
+    usage.totalBytes = usage.indexBytes + usage.imageBytes + usage.arenaBytes + usage.childBytes;
+    return usage;
+}
+
+qint64 StellarSolver::extractionBytes(int downsample) const
+{
+    //The float image and the image of a partition or the background each take a float a pixel of the downsampled image,
+    //and the temporaries of SEP in the arenas take about as much again.  A color image is merged to one channel at full size first.
+    const qint64 pixels = qint64(m_Statistics.width / qMax(1, downsample)) * (m_Statistics.height / qMax(1, downsample));
+    qint64 bytes = 3 * pixels * qint64(sizeof(float));
+    if(m_Statistics.channels == 3)
+        bytes += qint64(m_Statistics.samples_per_channel) * m_Statistics.bytesPerPixel;
+    return bytes;
+}
+
+void StellarSolver::applyMemoryBudget()
+{
+    if(m_MemoryBudget <= 0)
+        return;
+    const qint64 bytesInMB = 1024 * 1024;
+
+    //The star extraction gets up to half of the budget.  A streamed image is extracted a band at a time, so it needs less.
+    if(!m_RowReader)
+    {
+        if(m_ProcessType == SOLVE)
+        {
+            //A smaller image still solves, but it is not downsampled so far that the stars are lost
+            const int smallerSide = qMin(m_Statistics.width, m_Statistics.height);
+            int downsample = qMax(1, params.downsample);
+            while(extractionBytes(downsample) > m_MemoryBudget / 2 && smallerSide / (downsample + 1) >= 512)
+                downsample++;
+            if(downsample != params.downsample)
+            {
+                if(m_SSLogLevel != LOG_OFF)
+                    emit logOutput(QString("Downsampling the image by %1 so that the star extraction fits in the memory budget of %2 MB").arg(
+                                       downsample).arg(m_MemoryBudget / bytesInMB));
+                params.downsample = downsample;
+            }
+        }
+        if(extractionBytes(params.downsample) > m_MemoryBudget / 2 && m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("The star extraction of this image takes about %1 MB, which is more than half of the memory budget of %2 MB").arg(
+                               extractionBytes(params.downsample) / bytesInMB).arg(m_MemoryBudget / bytesInMB));
+    }
+
+    //The indexes that stay loaded between solves get what the star extraction leaves, the catalog loads the others as they are needed
+    if(m_ProcessType == SOLVE && m_SolverType == SOLVER_STELLARSOLVER)
+    {
+        if(!m_IndexCatalog)
+            m_IndexCatalog.reset(new IndexCatalog());
+        const qint64 indexShare = qMax<qint64>(1, m_MemoryBudget - extractionBytes(params.downsample));
+        const qint64 catalogBudget = m_IndexCatalog->getMemoryBudget();
+        if(catalogBudget == 0 || catalogBudget > indexShare)
+            m_IndexCatalog->setMemoryBudget(indexShare);
+    }
+}
+
 bool StellarSolver::enoughRAMisAvailableFor(const QStringList &indexFolders)
 {
     double totalSize = 0;
@@ -1043,6 +3327,13 @@ bool StellarSolver::enoughRAMisAvailableFor(const QStringList &indexFolders)
         }
 
     }
+    if(m_MemoryBudget > 0 && totalSize > m_MemoryBudget - extractionBytes(params.downsample))
+    {
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput(QString("The index files take %1 MB, which doesn't fit in the memory budget of %2 MB with the star extraction").arg(
+                               totalSize / (1024 * 1024)).arg(m_MemoryBudget / (1024 * 1024)));
+        return false;
+    }
     double availableRAM = 0;
     double totalRAM = 0;
     getAvailableRAM(availableRAM, totalRAM);
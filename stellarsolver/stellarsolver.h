@@ -11,6 +11,11 @@
 #include "structuredefinitions.h"
 #include "wcsdata.h"
 #include "extractorsolver.h"
+#include "indexcatalog.h"
+#include "externaldatabasecache.h"
+#include "onlinesession.h"
+#include "solverthreadpool.h"
+#include "solutioncache.h"
 #include "parameters.h"
 #include "version.h"
 
@@ -22,9 +27,22 @@
 #include <QVector>
 #include <QRect>
 #include <QPointer>
+#include <QElapsedTimer>
+#include <QFutureInterface>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QThreadPool>
+
+#include <limits>
+#include <vector>
 
 using namespace SSolver;
 
+class ExtractionBuffers;
+class SharedBackground;
+class CalibrationFrames;
+class ReferenceCatalog;
+
 class StellarSolver : public QObject
 {
         Q_OBJECT
@@ -37,6 +55,8 @@ class StellarSolver : public QObject
         Q_PROPERTY(bool UseScale MEMBER m_UseScale)
         Q_PROPERTY(bool AutoGenerateAstroConfig MEMBER m_AutoGenerateAstroConfig)
         Q_PROPERTY(bool CleanupTemporaryFiles MEMBER m_CleanupTemporaryFiles)
+        Q_PROPERTY(bool UseMemoryTempFiles MEMBER m_UseMemoryTempFiles)
+        Q_PROPERTY(bool WarmExternalDatabases MEMBER m_WarmExternalDatabases)
         Q_PROPERTY(bool OnlySendFITSFiles MEMBER m_OnlySendFITSFiles)
         Q_PROPERTY(bool LogToFile MEMBER m_LogToFile)
         Q_PROPERTY(SolverType SolverType MEMBER m_SolverType)
@@ -78,6 +98,42 @@ class StellarSolver : public QObject
          */
         bool loadNewImageBuffer(const FITSImage::Statistic &imagestats,  uint8_t const *imageBuffer);
 
+        /**
+         * @brief loadNextFrame loads the next frame of a stream of frames of the same size and type, as in a guiding loop.
+         * Unlike loadNewImageBuffer it keeps the search position and scale, and the star extraction of the next extraction reuses the
+         * star extractor of the last one instead of making a new one, with its buffers.  Only the pixels of the image change.
+         * If the frame doesn't have the size, channels and data type of the image that was loaded, or that image was loaded with a
+         * view that isn't packed or as a stream, this does the same as loadNewImageBuffer.
+         * @param imagestats Information about the imagebuffer provided
+         * @param imageBuffer The imagebuffer to be processed
+         * @return whether or not it succesfully loaded the new frame, see loadNewImageBuffer
+         */
+        bool loadNextFrame(const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer);
+
+        /**
+         * @brief loadNewImageView loads a new image buffer whose pixels are not packed one channel after the other, like a camera frame
+         * with padded rows or interleaved colors, and optionally only a region of interest of it, without copying it.
+         * The internal star extractor reads the buffer with its layout, the external and online solvers get a packed copy of it.
+         * @param imagestats Information about the whole image buffer, the width, height and channels are the ones of the whole buffer
+         * @param view The layout of the buffer and the region of interest to process, see FITSImage::ImageView.
+         * The stars are found in the pixels of the region, and xOffset and yOffset tell where it is, see getStarListInFile.
+         * @param imageBuffer The imagebuffer to be processed
+         * @return whether or not it succesfully loaded the new image.  It will not be successful if the layout or the region don't fit the buffer
+         * or if a process is running.
+         */
+        bool loadNewImageView(const FITSImage::Statistic &imagestats, const FITSImage::ImageView &view, uint8_t const *imageBuffer);
+
+        /**
+         * @brief loadNewImageStream loads a new image that is read in bands of rows as it is processed, instead of being in memory.
+         * This is for images too big to have in memory.  Only the internal star extractor and the internal solver can process it,
+         * without downsampling, and the stars can't be tracked or measured with measureHFR.
+         * @param imagestats Information about the image provided
+         * @param reader Reads the rows of the image, for instance from a FITS file with fileio
+         * @param bandRows The number of rows extracted at a time.  The float copy of one band and its margins is all that is in memory.
+         * @return whether or not it succesfully loaded the new image.  It will not be successful without a reader or if a process is running.
+         */
+        bool loadNewImageStream(const FITSImage::Statistic &imagestats, const FITSImage::RowReader &reader, uint32_t bandRows = 1024);
+
         /**
          * @brief getDefaultExternalPaths gets the default external program paths appropriate for the selected Computer System
          * @param system is the selected system setup
@@ -104,6 +160,24 @@ class StellarSolver : public QObject
          * @return The list of index files to use
          */
         static QStringList getIndexFiles(const QStringList &directoryList, int indexToUse = -1, int healpixToUse = -1);
+
+        /**
+         * @brief planIndexFiles gets the index files that can solve the images of an optical setup, so the rest of the installed ones can be skipped.
+         * It picks the scale series and healpix tiles the same way the internal solver picks its indexes, see IndexCatalog::coveringIndexFiles.
+         * The metadata of the index files is cached in the manifest of the index catalog, so only new or changed files get opened.
+         * @param directoryList This is the list of directory names to search for index files
+         * @param scaleLow The lowest image scale of the setup
+         * @param scaleHigh The highest image scale of the setup
+         * @param units The units of the scales
+         * @param imageWidth The width of the images in pixels
+         * @param imageHeight The height of the images in pixels
+         * @param ra The right ascension of the center of the sky region in degrees, it is only used with a radius
+         * @param dec The declination of the center of the sky region in degrees
+         * @param radius The radius of the sky region in degrees, or 0 for the whole sky
+         * @return The list of index files to use, sorted by scale
+         */
+        static QStringList planIndexFiles(const QStringList &directoryList, double scaleLow, double scaleHigh, ScaleUnits units,
+                                          int imageWidth, int imageHeight, double ra = 0, double dec = 0, double radius = 0);
   
         /**
          * @brief getCommandString gets the processType as a string explaining the command StellarSolver is Running
@@ -199,12 +273,146 @@ class StellarSolver : public QObject
          */
         bool extract(bool calculateHFR = false, QRect frame = QRect());
 
+        /**
+         * @brief extractSummary Performs Star Extraction on the image like extract, but only summarizes the stars, see getImageQuality.
+         * The internal star extractor adds the stars of each partition to the summary while they are measured, so the star list is
+         * never made and getStarList stays empty.  The filters that judge each star on its own apply, the ones that pick stars from the
+         * whole list, like keepNum and removeBrightest, do not.
+         * @param calculateHFR If true, it will also calculate the Half-Flux Radius of the stars for the HFR statistics.
+         * @param frame If set, it will only extract stars within this rectangular region of the image.
+         * @return A boolean that reports whether it was successful, true means success.
+         */
+        bool extractSummary(bool calculateHFR = true, QRect frame = QRect());
+
+        /**
+         * @brief setStreamPartitionStars makes the star extraction emit partitionStarsReady with the stars of each partition of the image
+         * as soon as it is done, instead of only having the stars when the whole image is done, for instance to draw them over a live view
+         * or to start working on the first stars early.  Then partitionStarsComplete has the final star list.  Only the internal star
+         * extractor streams the stars, and not in a summary extraction.
+         * @param stream Whether or not to stream the stars, false by default
+         */
+        void setStreamPartitionStars(bool stream)
+        {
+            m_StreamPartitionStars = stream;
+        }
+
+        /**
+         * @brief setCountHardwareEvents makes the internal star extractor and solver count the CPU cycles, instructions, cache misses and
+         * branch misses of the partitions of the extraction, the quad search and the verifications, which getSolveMetrics reports next to
+         * the time of each stage.  They tell whether a stage is limited by the memory or by the computing on a board.  The events
+         * are counted with perf_event_open, so only on Linux when the kernel allows it, see hardwareEventsAvailable.
+         * @param count Whether or not to count the events, false by default, since reading the counters costs a little for each stage
+         */
+        void setCountHardwareEvents(bool count)
+        {
+            m_CountHardwareEvents = count;
+        }
+
+        /**
+         * @brief hardwareEventsAvailable gets whether the hardware events can be counted on this system, see setCountHardwareEvents
+         */
+        static bool hardwareEventsAvailable();
+
+        /**
+         * @brief extractRegions Performs Star Extraction on several small regions of the image at once, like the guide stars of a multi star guider
+         * or the stars a focus monitor watches.  The internal star extractor converts and extracts only the pixels of each region and its margins,
+         * and extracts all of them on the thread pool in one pass, so there is one setup instead of one for each region.  The other extractors
+         * extract the whole image and the stars are sorted into the regions.  This is performed synchronously like extract, the stars of all of
+         * the regions are in the star list and the ones of each region are in getRegionStarLists.  The star filters apply to each region on its own.
+         * @param regions The regions of the image, the stars of a star in two overlapping regions are in both of them
+         * @param calculateHFR If true, it will also calculate the Half-Flux Radius of the stars.
+         * @return A boolean that reports whether it was successful, true means success.
+         */
+        bool extractRegions(const QList<QRect> &regions, bool calculateHFR = true);
+
+        /**
+         * @brief getRegionStarLists gets the stars of each of the regions of the last extractRegions, in the order of the regions
+         */
+        QList<QList<FITSImage::Star>> getRegionStarLists() const
+        {
+            return m_RegionStarLists;
+        }
+
+        /**
+         * @brief measureHFR is a fast mode for focusing.  It measures the Half-Flux Radius of stars that were already found, instead of extracting them again.
+         * Each star is found again close to where it was, and only its HFR is calculated, so it does not detect stars or estimate the background of the whole image.
+         * This is performed synchronously on the calling thread, and the results are in the star list, like after extract.
+         * @param stars The stars to measure, for instance the star list of an earlier extraction.  The subframe, if set, limits which of them are measured.
+         * If it is empty, the brightest star in the subframe is measured instead.
+         * @return A boolean that reports whether it was successful, true means success.
+         */
+        bool measureHFR(const QList<FITSImage::Star> &stars = QList<FITSImage::Star>());
+
+        /**
+         * @brief setTrackStars turns the tracking mode for consecutive frames, such as guide frames, on or off.
+         * In this mode, each star extraction starts from the stars of the one before it and only looks for them in small windows
+         * around where they are expected to be, like measureHFR does.  The whole image is extracted again every fullExtractionInterval frames,
+         * whenever too many of the stars are lost, and when an image of a different size is loaded.
+         * @param track Whether or not to track the stars
+         * @param fullExtractionInterval The number of frames that can be tracked before the whole image is extracted again
+         */
+        void setTrackStars(bool track, int fullExtractionInterval = 20);
+
+        /**
+         * @brief setReuseStars makes a plate solve of the same image with only different solver settings, such as the search scale,
+         * the search position or the parallel solving mode, reuse the stars of the last star extraction to solve it instead of extracting them again.
+         * The image is recognized by its buffer and its statistics, so this should only be turned on when the contents of an image
+         * buffer don't change while it is loaded, otherwise clearReusedStars must be called when they do.
+         * Only the internal solver can reuse stars, and a streamed image is always extracted again.
+         * @param reuse Whether or not to reuse the stars, false by default
+         */
+        void setReuseStars(bool reuse)
+        {
+            m_ReuseStars = reuse;
+            clearReusedStars();
+        }
+
+        /**
+         * @brief clearReusedStars forgets the stars kept for the next solve, see setReuseStars
+         */
+        void clearReusedStars()
+        {
+            m_ReusableStars = ReusableStars();
+        }
+
         /**
          * @brief solve Plate Solves the image.  This is performed synchronously and blocks the calling thread until the finished signal is emitted.
          * @return A boolean that reports whether it was successful, true means success.
          */
         bool solve();
 
+        /**
+         * @brief The Result struct is what an extraction or a plate solve found, returned by value by extractDirectly and solveDirectly
+         */
+        struct Result
+        {
+            bool success {false};               // Whether the extraction or the solve succeeded
+            QList<FITSImage::Star> stars;       // The stars that were extracted, or the ones the image was solved with
+            FITSImage::Background background;   // The background found during the star extraction
+            FITSImage::Solution solution;       // The solution of a plate solve
+            bool hasWCS {false};                // Whether wcs has the WCS of the solution
+            WCSData wcs;                        // The WCS of the solution, see getWCSData
+            FITSImage::SolveMetrics metrics;    // How long the stages took, see getSolveMetrics
+            double logOdds {0};                 // The log odds of the solution, see getSolutionLogOdds
+            FITSImage::ImageQuality quality;    // The summary of the stars of an extraction, only set by extractPlanes and scoreFrames
+        };
+
+        /**
+         * @brief extractDirectly Performs Star Extraction on the image on the calling thread, without signals, threads of its own or a nested event loop,
+         * so it can be used in programs that don't run a Qt event loop.  The star extraction itself still uses the threads of the global pool.
+         * @param calculateHFR If true, it will also calculated Half-Flux Radius for each detected star.
+         * @param frame If set, it will only extract stars within this rectangular region of the image.
+         * @return The result of the extraction, it is also in the getters like after extract
+         */
+        Result extractDirectly(bool calculateHFR = false, QRect frame = QRect());
+
+        /**
+         * @brief solveDirectly Plate Solves the image on the calling thread, like extractDirectly.  The child solvers of a parallel solve,
+         * the racing solvers and the coarse attempt are all started on threads of their own, so the solve is done by a single solver instead.
+         * @return The result of the solve, it is also in the getters like after solve
+         */
+        Result solveDirectly();
+
         /**
          * @brief start Starts a Star Extraction or Plate Solving proccess.  The process is performed asynchronously.  The calling program should then wait for the ready or finished signal.
          */
@@ -220,6 +428,207 @@ class StellarSolver : public QObject
          */
         void abortAndWait();
 
+        /**
+         * @brief The BatchImage struct is one of the images of a batch for solveBatch.  It is either in memory, in which case the
+         * imageBuffer must stay valid until the batchImageSolved signal for it, or in the file fileName that the ImageLoader of the batch reads.
+         */
+        struct BatchImage
+        {
+            FITSImage::Statistic stats;             // Information about the imageBuffer, if it is in memory
+            uint8_t const *imageBuffer {nullptr};   // The image if it is in memory, otherwise it gets loaded from fileName
+            QString fileName;                       // The file of the image.  The external and online solvers use it too, if it is set.
+        };
+
+        /**
+         * @brief ImageLoader loads an image file of a batch.  It is called on the threads of the SolverThreadPool, so it must be thread safe.
+         * It returns the image buffer allocated with new[], which the StellarSolver deletes when the image is done, or nullptr if it failed,
+         * and sets stats to the information about it.  fileio::batchImageLoader makes one for the files fileio can read.
+         */
+        typedef std::function<uint8_t *(const QString &fileName, FITSImage::Statistic &stats)> ImageLoader;
+
+        /**
+         * @brief solveBatch plate solves a list of images asynchronously, several of them at the same time.
+         * Each image is solved by a StellarSolver with the settings of this one, and they all share its IndexCatalog and its SolverThreadPool,
+         * which are created if they weren't set, so the index files are loaded only once and the solves together don't use more threads than the pool allows.
+         * The batchImageSolved signal is emitted for each image as it is done, and batchFinished when all of them are.
+         * @param images is the list of images to solve
+         * @param loader loads the images of the list that are not in memory, it is only needed if there are some
+         * @param maxConcurrent is how many images are loaded and solved at the same time, 0 for the number of threads of the SolverThreadPool
+         * @return false if it could not start, because the StellarSolver is running, the list is empty, or there is an image to load but no loader
+         */
+        bool solveBatch(const QList<BatchImage> &images, const ImageLoader &loader = ImageLoader(), int maxConcurrent = 0);
+
+        /**
+         * @brief addBatchImages adds images to the end of the batch that is being solved, so that they don't wait for it to finish.
+         * They are loaded with the ImageLoader of the batch, and their imageNumbers follow the ones of the images already in it.
+         * @param images is the list of images to add
+         * @return false if no batch is being solved or if there is an image to load but no loader, then solveBatch should be used instead
+         */
+        bool addBatchImages(const QList<BatchImage> &images);
+
+        /**
+         * @brief solveJob plate solves an image as a job of its own and returns a future for the result of the job.
+         * Each job is done by a StellarSolver with the settings that this one has when it is called, directly on a thread of its own like solveDirectly,
+         * and nothing of this StellarSolver changes when it is done, so one configuration can have many jobs in flight at the same time.
+         * The jobs share the IndexCatalog and the SolverThreadPool of this StellarSolver, which are created if they weren't set, like the images of a batch,
+         * so the index files are loaded only once and the jobs together don't use more threads than the pool allows.
+         * Deleting this StellarSolver waits for the jobs that are left.
+         * When more jobs are given than there are threads for them, the ones waiting start in the order of their deadlines, the earliest first,
+         * and the ones without a deadline after all of those, in the order they were given.  A job whose deadline is at risk, because the jobs
+         * of its kind took longer than the time it has left, is done with a faster profile: the image downsampled more, fewer of the brightest stars,
+         * and the scales around the pixel scale of the last job that solved, and its work gets the slots of the SolverThreadPool first.
+         * The metrics of the job tell whether it made its deadline, and getJobDeadlineMisses counts the ones that didn't.
+         * @param imagestats Information about the imageBuffer
+         * @param imageBuffer The image to solve, it must stay valid until the future is finished
+         * @param deadlineMS How many milliseconds from now the result is needed in, 0 for no deadline
+         * @return The future, which gets the stars, the solution, the WCS and the metrics of the job
+         */
+        QFuture<Result> solveJob(const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer, int deadlineMS = 0);
+
+        /**
+         * @brief extractJob extracts the stars of an image as a job of its own and returns a future for the result of the job, see solveJob
+         * @param imagestats Information about the imageBuffer
+         * @param imageBuffer The image to extract the stars of, it must stay valid until the future is finished
+         * @param calculateHFR If true, it will also calculated Half-Flux Radius for each detected star.
+         * @param frame If set, it will only extract stars within this rectangular region of the image.
+         * @param deadlineMS How many milliseconds from now the result is needed in, 0 for no deadline, see solveJob
+         * @return The future, which gets the stars, the background and the metrics of the job
+         */
+        QFuture<Result> extractJob(const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer, bool calculateHFR = false,
+                                   QRect frame = QRect(), int deadlineMS = 0);
+
+        /**
+         * @brief getJobDeadlineMisses gets how many of the jobs with a deadline finished after it, see solveJob
+         */
+        int getJobDeadlineMisses() const;
+
+        /**
+         * @brief getJobDeadlines gets how many jobs with a deadline have finished, the ones that missed it included
+         */
+        int getJobDeadlines() const;
+
+        /**
+         * @brief solveStarsJob plate solves a list of stars that were extracted before, for instance by another program, as a job of its own, see solveJob.
+         * The image is not needed, so only the internal solver can solve the stars.
+         * @param imagestats Information about the image the stars were extracted from, only its size is used
+         * @param stars The stars in the pixels of the image, in the order they should be tried in, which is the brightest first
+         * @return The future, which gets the stars, the solution, the WCS and the metrics of the job
+         */
+        QFuture<Result> solveStarsJob(const FITSImage::Statistic &imagestats, const QList<FITSImage::Star> &stars);
+
+        /**
+         * @brief verifyStarsJob verifies a known WCS against a list of stars as a job of its own, see solveStarsJob and setPriorWCS,
+         * without searching for quads, for instance to confirm where the mount points after a slew.  Without a search position,
+         * the indexes are picked around the center of the WCS.
+         * @param imagestats Information about the image the stars were extracted from, only its size is used
+         * @param stars The stars in the pixels of the image, the brightest first
+         * @param wcs The WCS to verify
+         * @param tweak If false, the WCS isn't refined, so only the log odds of the result tell how well it fits
+         * @return The future, which fails if the WCS doesn't fit the stars
+         */
+        QFuture<Result> verifyStarsJob(const FITSImage::Statistic &imagestats, const QList<FITSImage::Star> &stars, const WCSData &wcs,
+                                       bool tweak = true);
+
+        /**
+         * @brief solveFrames plate solves the loaded image and several more short exposures of the same field as if they were one long exposure,
+         * so a narrow field that needs a long exposure to show enough stars can be solved from a few short ones.  The stars of all of the frames are
+         * extracted at the same time as jobs of their own, see extractJob, each frame is registered onto the loaded image by the shift of its brightest
+         * stars, and the stars found in several frames are merged with their fluxes added, see StarStacker.  Then the loaded image is solved with the
+         * merged stars, so the solution is in its pixels.  This is performed synchronously like solve.  Only the internal solver can solve from the merged stars.
+         * @param frames The other frames, all in memory and of the same size as the loaded image, the frames that can't be registered are left out
+         * @return A boolean that reports whether it was successful, true means success.
+         */
+        bool solveFrames(const QList<BatchImage> &frames);
+
+        /**
+         * @brief extractPlanes extracts the stars of several images of the same field at once, like the planes of a data cube from lucky imaging
+         * or a time series, or the extensions of a multi-extension FITS file, see fileio::listFitsPlanes.  Each plane is extracted as a job of its
+         * own, see extractJob, so they all have the settings and the convolution filter of this StellarSolver and share its SolverThreadPool.
+         * With shareBackground, the internal star extractor estimates the background of the first plane it gets to and subtracts that map
+         * from the others, see setShareBackground.  This is performed synchronously like extract.
+         * @param planes The planes, all in memory
+         * @param calculateHFR If true, it will also calculate the Half-Flux Radius of the stars.
+         * @param shareBackground Whether the planes share one background map
+         * @return The result of each plane in the order of planes, with the summary of its stars in quality
+         */
+        QList<Result> extractPlanes(const QList<BatchImage> &planes, bool calculateHFR = true, bool shareBackground = true);
+
+        /**
+         * @brief setShareBackground makes the internal star extractions of this StellarSolver, and of its batches and jobs, share one background
+         * map, for images of the same field.  The first extraction of an image of a size makes the map and the others subtract it instead of
+         * estimating their own, which is the part of the extraction that reads each pixel twice.  The whole image is then extracted as one frame,
+         * like with the globalBackground parameter.  It is off by default, since the sky of most images is not the sky of the image before.
+         * For a sequence, where the sky changes slowly, the map can be made again every few images or when the sky moved too far from it.
+         * @param share Whether or not to share the background, turning it on again starts with a new map
+         * @param refreshFrames The number of images a map is used for before the next one makes a new one, 0 for no limit
+         * @param levelShift With more than 0, an image whose sky level moved by more than levelShift times the RMS of the background from
+         * the one the map was made from makes a new map, and the others get the map moved to their level, see SharedBackground::setRefresh
+         */
+        void setShareBackground(bool share, int refreshFrames = 0, double levelShift = 0);
+
+        /**
+         * @brief resetSharedBackground forgets the shared background map, so that the next extraction makes a new one, see setShareBackground
+         */
+        void resetSharedBackground();
+
+        /**
+         * @brief setCalibrationFrames makes the internal star extractions of this StellarSolver, and of its batches and jobs, calibrate
+         * the images with master frames while they convert them to float, so that calibrating costs no pass over the image and no buffer of
+         * its own.  Each pixel p becomes (p - bias - darkScale * (dark - bias)) * mean(flat - bias) / (flat - bias).  The masters are of the
+         * whole sensor, and the offsets of the image in its file place it in them, so they also calibrate subframes and regions of interest.
+         * They only calibrate images with one channel, like mono and raw Bayer frames.  The image buffer itself is not changed, so the external
+         * and online solvers get the image uncalibrated.  The masters are combined into an offset and a gain for each pixel when they are set
+         * and they don't have to be kept.
+         * @param masterstats Information about the masters, which all have this size and data type
+         * @param bias The master bias, or nullptr
+         * @param dark The master dark, with its bias, or nullptr
+         * @param flat The master flat, with its bias, or nullptr
+         * @param darkScale The exposure of the images divided by the exposure of the dark
+         * @return whether or not the masters could be used, they must have one channel and one of them must be given
+         */
+        bool setCalibrationFrames(const FITSImage::Statistic &masterstats, uint8_t const *bias, uint8_t const *dark, uint8_t const *flat,
+                                  double darkScale = 1);
+
+        /**
+         * @brief clearCalibrationFrames stops calibrating the images, see setCalibrationFrames
+         */
+        void clearCalibrationFrames();
+
+        /**
+         * @brief scoreFrames measures the star count and the HFR of each frame of a video, like the frames of a SER file for lucky imaging,
+         * so that the best ones can be picked.  The frames are extracted in parallel, one job each on its own thread, with the summary of the
+         * stars instead of their list, see extractSummary, and only the maxStars biggest stars of a frame get their HFR measured.
+         * The internal star extractor estimates the background of one frame of each window of backgroundWindow frames and subtracts it from the
+         * others in the window, so a slowly changing sky is followed without estimating it for every frame.  The frames are only read while
+         * their jobs run, so they can be the frames of a mapped file, see SerFile, and only a few times as many frames as there are threads
+         * are queued at once.  The subframe of this StellarSolver is used if it is set.  This is performed synchronously like extract.
+         * @param imagestats Information about each of the frames, they all have the same size and layout
+         * @param frames The frames
+         * @param view The layout of the frames, see loadNewImageView
+         * @param backgroundWindow The number of frames that share one background map, 1 for each frame to have its own
+         * @param maxStars The most stars to measure in each frame
+         * @return The quality of each frame in the order of frames, numStars is 0 if the extraction of a frame failed
+         */
+        QList<FITSImage::ImageQuality> scoreFrames(const FITSImage::Statistic &imagestats, const QList<const uint8_t *> &frames,
+                const FITSImage::ImageView &view = FITSImage::ImageView(), int backgroundWindow = 25, int maxStars = 50);
+
+        /**
+         * @brief solveTiles plate solves a wide field image, as from a fisheye or a mosaic, by solving overlapping tiles of it at the same time.
+         * The stars of the whole image are extracted once, the stars of each tile are solved as a job of its own, see solveStarsJob, with the
+         * pixel scale of the whole image, so each tile searches a narrow range of quad sizes, and the WCS of the solved tiles are stitched into
+         * one TAN WCS with SIP distortion for the whole image, see TileStitcher.  This is performed synchronously like solve.
+         * Only the internal solver can solve the tiles, and the whole field has to be narrower than about 150 degrees.
+         * The pixel scale comes from the search scale, or else from the minimum and maximum width in the parameters, which are for the whole image.
+         * @param columns The number of columns of tiles
+         * @param rows The number of rows of tiles
+         * @param overlap How much bigger each tile is than its share of the image, as a fraction of its share
+         * @return A boolean that reports whether it was successful, true means success.
+         */
+        bool solveTiles(int columns, int rows, double overlap = 0.2);
+
+        // The fewest stars a tile needs to be solved, see solveTiles
+        static const int MIN_TILE_STARS = 10;
+
         /**
          * @brief setParameters sets the Parameters for the StellarSolver based on a Parameters object you set up.
          * @param parameters The Parameters object
@@ -262,6 +671,128 @@ class StellarSolver : public QObject
             m_IndexFilePaths = indexFilePaths;
         };
 
+        /**
+         * @brief setIndexCatalog sets the IndexCatalog that keeps the index files loaded between internal solves.
+         * By default each StellarSolver creates its own the first time it solves, but several StellarSolvers can share one.
+         * @param catalog The IndexCatalog to use
+         */
+        void setIndexCatalog(const QSharedPointer<IndexCatalog> &catalog)
+        {
+            m_IndexCatalog = catalog;
+        }
+
+        /**
+         * @brief getIndexCatalog gets the IndexCatalog used by this StellarSolver, so it can be shared with another one
+         * @return The IndexCatalog, or a null pointer if the StellarSolver has not done an internal solve yet
+         */
+        QSharedPointer<IndexCatalog> getIndexCatalog() const
+        {
+            return m_IndexCatalog;
+        }
+
+        /**
+         * @brief preloadIndexes loads the index files of the index folders and index file paths into the IndexCatalog in the background
+         * and pins them, so that the first internal solve is as fast as the ones after it.  See IndexCatalog::preload.
+         * A program that only makes a StellarSolver when it solves can preload with one at startup and give its catalog to the
+         * StellarSolvers it makes later with setIndexCatalog.  It emits indexPreloadProgress after each index and indexesPreloaded at the end.
+         */
+        void preloadIndexes();
+
+        /**
+         * @brief isPreloadingIndexes gets whether preloadIndexes is still loading the indexes
+         */
+        bool isPreloadingIndexes() const
+        {
+            return m_IndexPreload != nullptr;
+        }
+
+        /**
+         * @brief setExternalDatabaseFolders sets more folders with star databases of the external solvers to keep in memory
+         * when WarmExternalDatabases is set, such as the folder of the quad database of Watney, which StellarSolver can't find on its own.
+         * The index folders of the local astrometry.net solver and the folder of the ASTAP program are always used.
+         * @param folders The list of folders
+         */
+        void setExternalDatabaseFolders(const QStringList &folders)
+        {
+            m_ExternalDatabaseFolders = folders;
+        }
+
+        /**
+         * @brief setDatabaseCache sets the ExternalDatabaseCache that keeps the star databases of the external solvers in memory between solves.
+         * By default each StellarSolver creates its own the first time it is needed, but several StellarSolvers can share one.
+         * @param cache The ExternalDatabaseCache to use
+         */
+        void setDatabaseCache(const QSharedPointer<ExternalDatabaseCache> &cache)
+        {
+            m_DatabaseCache = cache;
+        }
+
+        /**
+         * @brief getDatabaseCache gets the ExternalDatabaseCache used by this StellarSolver, so it can be shared with another one
+         * @return The ExternalDatabaseCache, or a null pointer if it was not needed yet
+         */
+        QSharedPointer<ExternalDatabaseCache> getDatabaseCache() const
+        {
+            return m_DatabaseCache;
+        }
+
+        /**
+         * @brief setOnlineSession sets the OnlineSession that keeps the connections to the online solver and its session key between solves.
+         * By default each StellarSolver creates its own the first time it solves online, and the StellarSolvers of a batch share the one of the batch,
+         * so the session key is reused and the uploads of the batch go over the same connections.  Several StellarSolvers in the same thread can share one.
+         * @param session The OnlineSession to use
+         */
+        void setOnlineSession(const QSharedPointer<OnlineSession> &session)
+        {
+            m_OnlineSession = session;
+        }
+
+        /**
+         * @brief getOnlineSession gets the OnlineSession used by this StellarSolver, so it can be shared with another one
+         * @return The OnlineSession, or a null pointer if the StellarSolver has not solved online yet
+         */
+        QSharedPointer<OnlineSession> getOnlineSession() const
+        {
+            return m_OnlineSession;
+        }
+
+        /**
+         * @brief setThreadPool sets the SolverThreadPool that the extraction partitions and the solves of this StellarSolver are scheduled on.
+         * By default it is SolverThreadPool::processPool, so all of the StellarSolvers of the program together don't use more threads than
+         * there are cores, and the ones that run when it is busy wait for a slot.  A pool of their own gives some of them separate slots.
+         * SolverThreadPool::powerSavingPool only runs on the efficiency cores of a machine that has them, to draw less power.
+         * @param pool The SolverThreadPool to use, or a null pointer for none, then this StellarSolver uses as many threads as there are cores
+         */
+        void setThreadPool(const QSharedPointer<SolverThreadPool> &pool)
+        {
+            m_ThreadPool = pool;
+        }
+
+        /**
+         * @brief getThreadPool gets the SolverThreadPool used by this StellarSolver, so it can be shared with another one
+         * @return The SolverThreadPool, or a null pointer if it was set to none
+         */
+        QSharedPointer<SolverThreadPool> getThreadPool() const
+        {
+            return m_ThreadPool;
+        }
+
+        /**
+         * @brief setSolveUrgency sets how soon the extraction partitions and the solves of this StellarSolver get a slot of the
+         * SolverThreadPool when all of its slots are taken.  A guiding solve should be URGENCY_CRITICAL, so it is not held up by the
+         * StellarSolvers of an archive running in the background with URGENCY_BACKGROUND.  The ones of the same urgency take turns.
+         * @param urgency The SolveUrgency, URGENCY_NORMAL by default
+         */
+        void setSolveUrgency(SolveUrgency urgency)
+        {
+            m_SolveUrgency = urgency;
+        }
+
+        SolveUrgency getSolveUrgency() const
+        {
+            return m_SolveUrgency;
+        }
+
         /**
          * @brief clearIndexFileAndFolderPaths Clears both the Index File paths and Index Folder paths in case they were set before.
          */
@@ -309,6 +840,87 @@ class StellarSolver : public QObject
             m_UsePosition = false;
         }
 
+        /**
+         * @brief setPriorWCS makes the internal solver verify an earlier solution first, as when the mount has not moved since the last image.
+         * The stars of the image are matched to the index stars where the WCS puts them and the WCS is refined from them,
+         * which takes a fraction of the time of a blind solve.  If they don't match, the quads are searched as usual.
+         * @param wcs The WCS of the earlier solution, for instance from getWCSData
+         * @param verifyOnly If true, the solve only verifies the WCS and fails if it doesn't fit, without searching for quads, starting the
+         * parallel solvers, racing the other solvers or making a coarse attempt.  That checks where a mount points after a slew and sync in milliseconds.
+         * @param tweak If false, a WCS that is only verified isn't refined, so the solution is the WCS itself and only the log odds tell how well it fits
+         */
+        void setPriorWCS(const WCSData &wcs, bool verifyOnly = false, bool tweak = true)
+        {
+            m_PriorWCS = wcs;
+            m_UsePriorWCS = wcs.hasWCS;
+            m_PriorVerifyOnly = verifyOnly;
+            m_PriorTweak = tweak;
+        }
+
+        /**
+         * @brief clearPriorWCS turns off the verification of the prior WCS if it was set previously
+         */
+        void clearPriorWCS()
+        {
+            m_UsePriorWCS = false;
+            m_PriorVerifyOnly = false;
+            m_PriorTweak = true;
+        }
+
+        /**
+         * @brief hasPriorWCS gets whether the solver will verify a prior WCS first, see setPriorWCS
+         */
+        bool hasPriorWCS() const
+        {
+            return m_UsePriorWCS;
+        }
+
+        /**
+         * @brief setSolutionCache makes the internal solver remember the solutions of the star patterns it solves, and verify the
+         * solution of a pattern it solved before first when there is no prior WCS, so that the same targets solve without a search.
+         * If it doesn't fit, the quads are searched as usual.  The cache can be shared by many StellarSolvers.  See SolutionCache.
+         * @param cache The SolutionCache, or a null pointer to turn it off, which is the default
+         */
+        void setSolutionCache(const QSharedPointer<SolutionCache> &cache)
+        {
+            m_SolutionCache = cache;
+        }
+
+        /**
+         * @brief getSolutionCache gets the SolutionCache of this StellarSolver, see setSolutionCache
+         */
+        QSharedPointer<SolutionCache> getSolutionCache() const
+        {
+            return m_SolutionCache;
+        }
+
+        /**
+         * @brief buildReferenceCatalog copies the index stars around a target into a ReferenceCatalog, for a session of imaging it.
+         * The solves of the internal solver then get the stars of their verifications from it instead of searching the star kd-trees of the
+         * indexes, which matters most for the solves with a search position and the verify only solves of a prior WCS, whose time is mostly
+         * spent verifying.  A field outside of the catalog is verified from the indexes as before.  The indexes are those of the index folders
+         * and files that are set.  This is performed synchronously, and it replaces the catalog that was built before.
+         * @param ra The right ascension of the target in degrees
+         * @param dec The declination of the target in degrees
+         * @param radius The radius around the target in degrees, the radius of the field and the margin the mount can be off by
+         * @return The number of stars of all of the indexes, 0 if there are none around the target
+         */
+        int buildReferenceCatalog(double ra, double dec, double radius);
+
+        /**
+         * @brief clearReferenceCatalog forgets the reference catalog, see buildReferenceCatalog
+         */
+        void clearReferenceCatalog();
+
+        /**
+         * @brief getReferenceCatalog gets the reference catalog, for instance to cross match the stars of an image with it, see
+         * ReferenceCatalog::starsInImage.  It is null if there is none.
+         */
+        QSharedPointer<const ReferenceCatalog> getReferenceCatalog() const
+        {
+            return m_ReferenceCatalog;
+        }
+
         /**
          * @brief clearSearchScale turns off the usage of the Search Scale if it was set previously
          */
@@ -372,6 +984,13 @@ class StellarSolver : public QObject
          */
         static QStringList getDefaultIndexFolderPaths();
 
+        /**
+         * @brief getMemoryTempPath gets a directory for temporary files on a file system that is kept in RAM, such as /dev/shm on Linux
+         * @param requiredBytes is how much space has to be free on it
+         * @return The path of the directory, or an empty string if there is no such file system with enough space, so the files should go to disk
+         */
+        static QString getMemoryTempPath(qint64 requiredBytes = 0);
+
 
         //Accessor Method for external classes
         /**
@@ -388,9 +1007,47 @@ class StellarSolver : public QObject
          */
         const QList<FITSImage::Star> &getStarList() const
         {
+            attachSkyPositions();
             return m_ExtractorStars;
         }
 
+        /**
+         * @brief getStarCatalog gets the stars found during star extraction with each of their properties in its own array,
+         * which is faster than the QList for going through one property of a big star list
+         * @return A StarCatalog of the stars, it doesn't change when the StellarSolver extracts again
+         */
+        StarCatalog getStarCatalog() const
+        {
+            return extractorCatalog();
+        }
+
+        /**
+         * @brief getStarView gets a view of the stars found during star extraction, which can be narrowed to the subsets that are needed,
+         * like StarView::withHFR, StarView::inside or StarView::brightest, without copying the stars.  The stars of an extraction are
+         * put in one StarCatalog when a catalog or a view of them is first asked for, and all of the views and catalogs of that extraction
+         * share it.
+         * @return A view of all of the stars, it doesn't change when the StellarSolver extracts again
+         */
+        StarView getStarView() const
+        {
+            return StarView(extractorCatalog());
+        }
+
+        /**
+         * @brief getSolverStarView gets a view of the stars used to plate solve the image, see getStarListFromSolve.  While the stars of
+         * the solve are still the very list of the last extraction, it is a view of the catalog of getStarView, otherwise the stars of the
+         * solve get a catalog of their own, which is kept until they change.
+         * @return A view of the stars of the last successful solve
+         */
+        StarView getSolverStarView() const;
+
+        /**
+         * @brief getStarListInFile gets the list of stars found during star extraction, at their positions in the whole image file.
+         * It is the same as getStarList unless only a subframe of the file was loaded, see FITSImage::Statistic::xOffset.
+         * @return A QList full of stars and their properties
+         */
+        QList<FITSImage::Star> getStarListInFile() const;
+
         /**
          * @brief getStarListFromSolve gets the list of stars used to plate solve the image
          * @return A QList full of stars and their properties
@@ -409,6 +1066,16 @@ class StellarSolver : public QObject
             return background;
         }
 
+        /**
+         * @brief getImageQuality gets the summary of the stars of the latest extractSummary, the star count, HFR quantiles,
+         * eccentricity and background
+         * @return The summary of the stars
+         */
+        const FITSImage::ImageQuality &getImageQuality() const
+        {
+            return m_ImageQuality;
+        }
+
         /**
          * @brief getSolution gets the Solution information from the latest plate solve
          * @return The Solution information
@@ -418,6 +1085,15 @@ class StellarSolver : public QObject
             return solution;
         }
 
+        /**
+         * @brief getStatistics gets the statistics of the image that was loaded
+         * @return The statistics
+         */
+        const FITSImage::Statistic &getStatistics() const
+        {
+            return m_Statistics;
+        }
+
         /**
          * @brief getSolutionIndexNumber gets the astrometry index file number used to solve the latest plate solve
          * @return The index number
@@ -436,6 +1112,155 @@ class StellarSolver : public QObject
             return solutionHealpix;
         };
 
+        /**
+         * @brief getSolutionLogOdds gets the log odds of the match in the latest plate solve of the internal solver, which tells how good the solution is.
+         * After a solve that only verified the prior WCS, see setPriorWCS, it tells how well the WCS fits the stars.
+         * @return The log odds, 0 if the solver doesn't report them
+         */
+        double getSolutionLogOdds() const
+        {
+            return solutionLogOdds;
+        }
+
+        /**
+         * @brief getCancelLatency gets how long it took for all of the solver threads to stop after the last abort,
+         * or after the first child solver in a parallel solve found a solution and the others were told to stop
+         * @return The time in milliseconds, -1 if nothing was cancelled since the last process was started
+         */
+        qint64 getCancelLatency() const
+        {
+            return m_CancelLatency;
+        }
+
+        /**
+         * @brief getSolveMetrics gets how long the stages of the last extraction or solve took and how much work the solver did.
+         * It is also sent with the solveMetrics signal right before the finished signal.
+         * @return The metrics, the stages that didn't run or that the solver doesn't report are 0
+         */
+        const FITSImage::SolveMetrics &getSolveMetrics() const
+        {
+            return m_SolveMetrics;
+        }
+
+        /**
+         * @brief getMemoryUsage gets how much memory StellarSolver is using now, the loaded indexes, the buffers of the star extraction
+         * and the child solvers of a parallel solve
+         * @return The memory, the arenas of the star extraction are the ones of the whole program since they belong to the threads
+         */
+        FITSImage::MemoryUsage getMemoryUsage() const;
+
+        /**
+         * @brief setMemoryBudget sets the most memory the extractions and solves should use, for computers with little RAM.
+         * To stay in it, StellarSolver downsamples the images it solves when their star extraction would take more than half of it,
+         * starts fewer child solvers in a parallel solve, keeps fewer indexes loaded between solves and doesn't load the index files
+         * of the external astrometry.net solver in parallel.  The star extraction of an image that is only extracted can't be made smaller,
+         * except by streaming it with setRowReader.  By default there is no budget.
+         * @param bytes The budget in bytes, 0 for no budget
+         */
+        void setMemoryBudget(qint64 bytes)
+        {
+            m_MemoryBudget = bytes;
+        }
+        qint64 getMemoryBudget() const
+        {
+            return m_MemoryBudget;
+        }
+
+        /**
+         * @brief getBandStatistics gets how the ranges of depths and scales of the parallel solves have done so far, so that they can be saved
+         * with the profile of the camera and optics and given back with setBandStatistics the next time.
+         * @return A map from the description of each range to a list of the number of times it was searched, the number of times it solved,
+         * and the total milliseconds it was searched for
+         */
+        QVariantMap getBandStatistics() const;
+
+        /**
+         * @brief setBandStatistics sets how the ranges of depths and scales did in earlier parallel solves, see getBandStatistics.
+         * The ranges that solved the most per second of searching are searched first, and the ones that never solved get a limited slice of the time.
+         */
+        void setBandStatistics(const QVariantMap &statistics);
+
+        /**
+         * @brief setDeterministicParallelSolve makes the parallel solves pick the same solution every time, for benchmarks and tests.
+         * The ranges are searched in the order they are made, without the reordering and the time slices of setBandStatistics,
+         * and the first range in that order that solves is used instead of the first one that finishes.  When a range solves,
+         * the ranges after it are dropped and stopped, and the solve waits for the ranges before it, which still use all of the cores.
+         * @param deterministic Whether the parallel solves are deterministic, false by default
+         * @param windowMs The most milliseconds to wait for the ranges before the first solution once there is one, after that
+         * they are stopped and the best solution so far is used.  0 waits for all of them, which is the only fully repeatable choice.
+         */
+        void setDeterministicParallelSolve(bool deterministic, qint64 windowMs = 0)
+        {
+            m_DeterministicParallel = deterministic;
+            m_DeterministicWindowMs = windowMs;
+        }
+        bool isDeterministicParallelSolve() const
+        {
+            return m_DeterministicParallel;
+        }
+
+        /**
+         * @brief clearBandStatistics forgets how the ranges did, for instance when the camera or the optics change
+         */
+        void clearBandStatistics()
+        {
+            m_BandStatistics.clear();
+        }
+
+        /**
+         * @brief setRacingSolvers makes the solves race several solvers against each other instead of using only the solver type.
+         * The stars are extracted once with the internal star extractor, all of the solvers start at the same time on that star list,
+         * except ASTAP which extracts its own stars, and the first one that solves is used while the others are aborted.
+         * The online solver can't race, since its jobs can't be stopped once they are sent.
+         * @param solvers The solvers to race, an empty list or just one solver turns racing off
+         */
+        void setRacingSolvers(const QList<SSolver::SolverType> &solvers)
+        {
+            m_RacingSolvers = solvers;
+        }
+
+        /**
+         * @brief getRacingSolvers gets the solvers that race against each other, see setRacingSolvers
+         * @return The list of solvers, empty if they don't race
+         */
+        const QList<SSolver::SolverType> &getRacingSolvers() const
+        {
+            return m_RacingSolvers;
+        }
+
+        /**
+         * @brief setCoarseSolve makes the blind solves of the internal solver start with a quick coarse attempt, to cut down how long
+         * the worst blind solves take.  The coarse attempt solves a heavily downsampled image with a few of the brightest stars,
+         * against the coarse index files if they are set, and gives up after a short time.  If it solves, the full solve only searches
+         * the scales and the position around its solution, otherwise the full solve searches everything as it would have.
+         * A solve that already has a scale and a position is not blind, so it doesn't make a coarse attempt.
+         * @param enabled Whether to make coarse attempts
+         * @param downsample How much the image is downsampled for the coarse attempt, at least
+         * @param stars How many of the brightest stars the coarse attempt uses
+         * @param timeLimitMS How many milliseconds the coarse attempt has to solve
+         */
+        void setCoarseSolve(bool enabled, int downsample = 4, int stars = 50, int timeLimitMS = 2000)
+        {
+            m_CoarseSolve = enabled;
+            m_CoarseDownsample = downsample;
+            m_CoarseStars = stars;
+            m_CoarseTimeLimitMS = timeLimitMS;
+        }
+        bool getCoarseSolve() const
+        {
+            return m_CoarseSolve;
+        }
+
+        /**
+         * @brief setCoarseIndexFiles sets the index files of the coarse attempt, see setCoarseSolve.  The series with the biggest quads
+         * that still fit in the image are the fastest, since the downsampled image has few stars.
+         * @param indexFiles The index files, an empty list for the same index files as the full solve
+         */
+        void setCoarseIndexFiles(const QStringList &indexFiles)
+        {
+            m_CoarseIndexFiles = indexFiles;
+        }
+
         /**
          * @brief extractionDone Whether or not star extraction has been completed
          * @return true means the star extraction is done
@@ -599,6 +1424,8 @@ class StellarSolver : public QObject
         bool m_HasFailed {false};           // This boolean is set when a process has failed
         bool hasWCS {false};                // This boolean gets set if the StellarSolver has WCS data to retrieve
         bool m_isRunning {false};           // Whether or not the StellarSolver is currently running
+        bool m_RunDirectly {false};         // Whether the process runs on the calling thread, see extractDirectly
+        bool m_ReuseExtractorSolver {false};    // Whether the next star extraction can reuse m_ExtractorSolver, see loadNextFrame
 
    //StellarSolver Options
 
@@ -610,6 +1437,7 @@ class StellarSolver : public QObject
         // External Process Options
         QString m_FileToProcess;                // The file that is being processed.
         bool m_CleanupTemporaryFiles {true};    // Whether or not to delete the temp files when finished
+        bool m_UseMemoryTempFiles {false};      // Whether to put the temp files on a RAM disk instead of the BasePath when there is one, see getMemoryTempPath
         bool m_AutoGenerateAstroConfig {true};  // Whether or not to generate the astrometry.cfg file. This is preferred so that it sends all the options requested.
         bool m_OnlySendFITSFiles {true};        // This is sometimes needed if the external solvers can't handle other file types
         ExternalProgramPaths m_ExternalPaths;   // System File Paths to external programs and files
@@ -617,14 +1445,56 @@ class StellarSolver : public QObject
         // Index File Options
         QStringList indexFolderPaths;           // This is the list of folder paths that the solver will use to search for index files
         QStringList m_IndexFilePaths;           // This is an alternative to the indexFolderPaths variable.  We can just load individual index files instead of searching for them
+        QSharedPointer<IndexCatalog> m_IndexCatalog;   // This keeps the index files loaded between solves
+        bool m_WarmExternalDatabases {false};   // Whether to keep the star databases of the external solvers in memory between solves
+        QStringList m_ExternalDatabaseFolders;  // More folders with star databases of the external solvers, see setExternalDatabaseFolders
+        QSharedPointer<ExternalDatabaseCache> m_DatabaseCache; // This keeps the star databases of the external solvers in memory between solves
+        QSharedPointer<SolverThreadPool> m_ThreadPool { SolverThreadPool::processPool() }; // This is shared by the StellarSolvers that should not use more threads than it allows
+        SolveUrgency m_SolveUrgency { URGENCY_NORMAL };  // How soon the work of this StellarSolver gets a slot of m_ThreadPool, see setSolveUrgency
+        QSharedPointer<ExtractionBuffers> m_ExtractionBuffers; // This keeps the float images of the internal star extractor between images
+        QSharedPointer<SharedBackground> m_SharedBackground;   // The background map the extractions share, see setShareBackground
+        QSharedPointer<const CalibrationFrames> m_Calibration; // The master frames the extractions calibrate with, see setCalibrationFrames
 
         // Online Options
         QString m_AstrometryAPIKey;
         QString m_AstrometryAPIURL;
+        QSharedPointer<OnlineSession> m_OnlineSession; // This keeps the connections and the session key of the online solver between solves
 
         // HFR Options
         bool m_CalculateHFR {false};          // Whether or not the HFR of the image should be calculated using sep_flux_radius.  Don't do it unless you need HFR
 
+        // Tracking Options
+        bool m_SummaryOnly {false};             // Whether the extraction only summarizes the stars, see extractSummary
+        bool m_StreamPartitionStars {false};    // Whether the stars of each partition are emitted as it is done, see setStreamPartitionStars
+        bool m_CountHardwareEvents {false};     // Whether the hardware events of the stages are counted, see setCountHardwareEvents
+        QList<QRect> m_Regions;                 // The regions of the extraction, see extractRegions
+        QList<QList<FITSImage::Star>> m_RegionStarLists;    // The stars of each of the regions of the last extractRegions
+        bool m_TrackStars {false};              // Whether or not star extraction tracks the stars of the last extraction, see setTrackStars
+        int m_FullExtractionInterval {20};      // The number of frames that can be tracked before the whole image is extracted again
+        int m_FramesSinceFullExtraction {0};    // The number of frames that were tracked since the whole image was extracted
+        QList<FITSImage::Star> m_TrackedStars;  // The stars of the last extraction, which are tracked into the next image
+        int m_FullExtractionStars {0};          // The number of stars of the last full extraction, which limits how many tracking can lose
+        QPointF m_TrackShift;                   // How far the stars moved in the last tracked frame
+
+        // Star Reuse Options, see setReuseStars
+        struct ReusableStars
+        {
+            bool valid { false };
+            uint8_t const *imageBuffer { nullptr };     // The image the stars were extracted from
+            FITSImage::Statistic stats;
+            Parameters params;                          // The parameters of the star extraction
+            int colorChannel { 0 };
+            bool useSubframe { false };
+            QRect subframe;
+            int downsample { 1 };                       // How much the image was downsampled for the star extraction
+            QList<FITSImage::Star> stars;               // The stars, filtered for solving
+        };
+        bool m_ReuseStars {false};
+        ReusableStars m_ReusableStars;
+        // The stars to solve instead of extracting them, see solveStarsJob and solveFrames.  The image buffer isn't needed then.
+        bool m_UseGivenStars {false};
+        QList<FITSImage::Star> m_GivenStars;
+
         // Subframing Options
         bool useSubframe {false};
         QRect m_Subframe;
@@ -653,24 +1523,153 @@ class StellarSolver : public QObject
         double m_SearchRA = HUGE_VAL;           // RA of field center for search, format: decimal degrees
         double m_SearchDE = HUGE_VAL;           // DEC of field center for search, format: decimal degrees
 
+        // The earlier solution to verify before searching for quads, see setPriorWCS.  This is not a saved parameter either.
+        bool m_UsePriorWCS {false};
+        bool m_PriorVerifyOnly {false};     // Whether the solve only verifies the prior WCS
+        bool m_PriorTweak {true};           // Whether a prior WCS that is only verified is tweaked
+        WCSData m_PriorWCS;
+        QSharedPointer<SolutionCache> m_SolutionCache;  // The solutions of the star patterns solved before, see setSolutionCache
+        QSharedPointer<const ReferenceCatalog> m_ReferenceCatalog;  // The index stars around the target, see buildReferenceCatalog
+
+        // The quick coarse attempt of a blind solve, see setCoarseSolve
+        bool m_CoarseSolve {false};
+        int m_CoarseDownsample {4};
+        int m_CoarseStars {50};
+        int m_CoarseTimeLimitMS {2000};
+        QStringList m_CoarseIndexFiles;
+        StellarSolver *m_CoarseSolver {nullptr};        // The coarse attempt that is running
+        bool m_CoarseTried {false};                     // Whether the coarse attempt of this solve is done, so the full solve starts
+        bool m_CoarseAborted {false};                   // Whether the solve was aborted during the coarse attempt
+        // The search settings from before the coarse attempt narrowed them, they are put back when the full solve is done
+        struct CoarseRestore
+        {
+            bool active {false};
+            bool useScale {false};
+            double scaleLow {0};
+            double scaleHigh {0};
+            ScaleUnits scaleUnit {DEG_WIDTH};
+            bool usePosition {false};
+            double searchRA {HUGE_VAL};
+            double searchDE {HUGE_VAL};
+            double searchRadius {0};
+        } m_CoarseRestore;
+
     // StellarSolver Variables
 
         FITSImage::Statistic m_Statistics;                  // This is information about the image
         const uint8_t *m_ImageBuffer { nullptr };           // The generic data buffer containing the image data
+        FITSImage::ImageView m_ImageView;                   // The layout of the image buffer, with the strides filled in, see loadNewImageView
+        std::vector<uint8_t> m_PackedImage;                 // The packed copy of an image buffer that isn't packed, for the solvers that need one
+        FITSImage::RowReader m_RowReader;                   // This reads the rows of the image instead, when it is streamed
+        uint32_t m_StreamBandRows {0};                      // The number of rows in each band of a streamed image
         QList<ExtractorSolver*> parallelSolvers;            // This is the list of parallel ExtractorSolvers when solving in parallel
         QScopedPointer<ExtractorSolver> m_ExtractorSolver;  // This is the single ExtractorSolver used when not working in parallel
-        WCSData wcsData;                    // This is the WCS information from the last solve.
+        mutable WCSData wcsData;            // This is the WCS information from the last solve, wcslib sets up its struct when a const getter converts the stars
         int m_ParallelSolversFinishedCount {0};             // This is the number of parallel solvers that are done.
 
+        // This is one range of scales or depths in a parallel solve, the child solvers take them from the queue one at a time.
+        struct ParallelWorkItem
+        {
+            bool useScale {false};                  // Whether this is a range of scales, otherwise it is a range of depths
+            double scaleLow {0};                    // The low end of the range of scales
+            double scaleHigh {0};                   // The high end of the range of scales
+            ScaleUnits scaleUnits {ARCMIN_WIDTH};   // The units of the range of scales
+            int depthLow {-1};                      // The low end of the range of depths
+            int depthHigh {-1};                     // The high end of the range of depths
+            bool usePosition {false};               // Whether this searches around its own position in a grid of positions
+            double ra {0};                          // The RA of the position to search around in degrees
+            double dec {0};                         // The DEC of the position to search around in degrees
+            double radius {0};                      // The search radius around the position in degrees
+            QString band;                           // This describes the range of depths or scales for its statistics
+            qint64 timeSlice {0};                   // The most milliseconds it gets to search for, 0 for the rest of the time limit
+            qint64 started {0};                     // When it was started in the parallel solve, in milliseconds
+            int priority {0};                       // Its place in the order the ranges were made, which ranks the solutions of a deterministic solve
+        };
+        // This is how one range of depths or scales has done in the parallel solves so far
+        struct BandStatistics
+        {
+            int attempts {0};                       // The number of times it was searched until it was done, it solved, or its time slice was over
+            int solves {0};                         // The number of times it solved
+            qint64 time {0};                        // The milliseconds it was searched for in all of the attempts
+        };
+        QList<ParallelWorkItem> m_ParallelWork;             // This is the queue of ranges that are waiting for a child solver in a parallel solve
+        QHash<ExtractorSolver*, ParallelWorkItem> m_RunningWork;    // This is the range each child solver is searching in a parallel solve
+        QHash<QString, BandStatistics> m_BandStatistics;    // This is how each range of depths or scales has done, see setBandStatistics
+        int m_ParallelWorkItemsPerThread {4};               // This is how many ranges the parallel solve is split into for each thread
+        QElapsedTimer m_ParallelSolveTimer;                 // This times the parallel solve so all of the ranges get searched within one time limit
+        int m_ParallelPositionGridSize {3};                 // This is how many positions across the search area the grid has when solving on positions and scales
+        QList<SSolver::SolverType> m_RacingSolvers;         // These are the solvers that race each other on the same stars, see setRacingSolvers
+        ExtractorSolver *m_BestParallelSolver {nullptr};    // This is the child solver with the best log odds so far when solving on positions and scales
+        // Deterministic parallel solve related, see setDeterministicParallelSolve
+        bool m_DeterministicParallel {false};
+        qint64 m_DeterministicWindowMs {0};
+        int m_BestParallelPriority {-1};                    // The priority of the range of m_BestParallelSolver in a deterministic solve
+        int m_ParallelSolveNumber {0};                      // This counts the parallel solves, so the window of an earlier one doesn't stop a later one
+        QElapsedTimer m_CancelTimer;                        // This times how long the solver threads take to stop after they are cancelled
+        qint64 m_CancelLatency {-1};                        // This is how long the solver threads took to stop after the last cancel, in milliseconds
+        FITSImage::SolveMetrics m_SolveMetrics;             // This is how long the stages of the last extraction or solve took, see getSolveMetrics
+        QElapsedTimer m_MetricsTimer;                       // This times the whole extraction or solve for the metrics
+        qint64 m_MemoryBudget {0};                          // This is the most memory the extractions and solves should use, see setMemoryBudget
+
+    // Batch Solving Variables
+
+        // This is the result of loading an image of the batch
+        struct BatchLoad
+        {
+            FITSImage::Statistic stats;
+            uint8_t *imageBuffer {nullptr};
+        };
+        QList<BatchImage> m_BatchImages;                    // This is the list of images of the batch being solved
+        ImageLoader m_BatchLoader;                          // This loads the images of the batch that are not in memory
+        int m_BatchNextImage {0};                           // This is the position of the next image of the batch to start
+        int m_BatchRunning {0};                             // This is the number of images of the batch that are being loaded or solved
+        int m_BatchMaxConcurrent {1};                       // This is how many images of the batch can be loaded or solved at the same time
+        bool m_BatchAborted {false};                        // This is set when the batch is aborted, so the images being loaded don't get solved
+        QList<QFutureWatcher<BatchLoad>*> m_BatchLoads;     // This is the list of the images of the batch being loaded
+        QFutureWatcher<int> *m_IndexPreload {nullptr};      // This watches the preload of the indexes, see preloadIndexes
+        QSharedPointer<std::atomic<bool>> m_CancelIndexPreload; // This stops the preload of the indexes when the StellarSolver is deleted
+        QList<StellarSolver*> m_BatchSolvers;               // This is the list of the StellarSolvers solving the images of the batch
+        QHash<StellarSolver*, uint8_t*> m_BatchBuffers;     // These are the image buffers that were loaded for the batch solvers, which get deleted with them
+        // A job of solveJob or extractJob that waits for a thread of m_JobPool
+        struct QueuedJob
+        {
+            StellarSolver *solver;
+            qint64 queuedAt;                    // When it was given, in the milliseconds of m_JobClock
+            qint64 deadline;                    // When it is needed, in the same milliseconds, NO_DEADLINE if it has none
+            QFutureInterface<Result> result;
+        };
+        static constexpr qint64 NO_DEADLINE = std::numeric_limits<qint64>::max();
+        // A job is at risk when the jobs of its kind took longer than this part of the time it has left
+        static constexpr double DEADLINE_RISK = 0.75;
+        // The faster profile solves with this many of the brightest stars, and searches the scales this far around the last pixel scale
+        static const int FASTER_PROFILE_STARS = 50;
+        static constexpr double FASTER_PROFILE_SCALE_RANGE = 0.1;
+        // These are above m_JobPool, so they are still there while it waits for the jobs when this StellarSolver is deleted
+        mutable QMutex m_JobMutex;                          // This guards the queue, the estimates and the counts of the jobs
+        QList<QueuedJob> m_QueuedJobs;                      // These are the jobs waiting for a thread, the earliest deadline first
+        QElapsedTimer m_JobClock;                           // This is the clock of the deadlines of the jobs
+        double m_JobEstimateMs[2] {0, 0};                   // How long the extraction and the solve jobs take with their own profile, a moving average
+        double m_LastJobPixscale {0};                       // The pixel scale of the last job that solved, for the faster profile
+        int m_JobDeadlines {0};                             // How many jobs with a deadline are done, see getJobDeadlines
+        int m_JobDeadlineMisses {0};                        // How many of them missed it, see getJobDeadlineMisses
+        QThreadPool m_JobPool;                              // These are the threads the jobs of solveJob and extractJob wait on, the work itself takes slots of m_ThreadPool
+
     // StellarSolver Results Information
 
         FITSImage::Background background;           // This is a report on the background levels found during star extraction
-        QList<FITSImage::Star> m_ExtractorStars;    // This is the list of stars that get extracted from the image
+        FITSImage::ImageQuality m_ImageQuality;     // This is the summary of the stars found during a summary extraction
+        mutable QList<FITSImage::Star> m_ExtractorStars; // This is the list of stars that get extracted from the image
+        mutable bool m_StarsNeedSkyPositions = false;   // The RA and DEC of the extracted stars are only calculated from the WCS when they are first read
+        mutable StarCatalog m_ExtractorCatalog;          // The extracted stars in columns, for the catalogs and views of them, see extractorCatalog
+        mutable QList<FITSImage::Star> m_CatalogedStars; // The list m_ExtractorCatalog was made from
+        mutable StarCatalog m_SolverCatalog;             // The same for the stars of the solve, when they are not the extracted ones
+        mutable QList<FITSImage::Star> m_SolverCatalogedStars;
         QList<FITSImage::Star> m_SolverStars;       // This is the list of stars that were extracted for the last successful solve
         int numStars = 0;                           // The number of stars found in the last operation
         FITSImage::Solution solution;               // This is the solution that comes back from the Solver
         short solutionIndexNumber = -1;             // This is the index number of the index used to solve the image.
         short solutionHealpix = -1;                 // This is the healpix of the index used to solve the image.
+        double solutionLogOdds = 0;                 // This is the log odds of the match that solved the image.
 
     // Logging Settings for Astrometry
         bool m_LogToFile {false};                       //This determines whether or not to save the output from Astrometry.net to a file
@@ -690,6 +1689,16 @@ class StellarSolver : public QObject
          */
         void registerMetaTypes();
 
+        /**
+         * @brief warmExternalDatabases has the ExternalDatabaseCache map and touch the star databases of the external solver, if WarmExternalDatabases is set
+         */
+        void warmExternalDatabases();
+
+        /**
+         * @brief tempFilePath gets the directory the temporary files of a process go to, the BasePath or a RAM disk if UseMemoryTempFiles is set
+         */
+        QString tempFilePath();
+
         /**
          * @brief parallelSolversAreRunning returns whether the parallel solvers are currently running
          * @return true if they are running
@@ -703,6 +1712,23 @@ class StellarSolver : public QObject
          */
         int whichSolver(ExtractorSolver *solver);
 
+        /**
+         * @brief startCancelTimer starts timing how long the running solver threads take to stop, if they are running and it isn't already being timed
+         */
+        void startCancelTimer();
+
+        /**
+         * @brief recordCancelLatency saves how long the solver threads took to stop, once they all have
+         */
+        void recordCancelLatency();
+
+        /**
+         * @brief reportSolveMetrics adds the metrics of the solver to the ones of this extraction or solve and emits them with the solveMetrics signal.
+         * It also writes the trace to the file of the STELLARSOLVER_TRACE environment variable when it is set.
+         * @param solver The solver that did the extraction, and the solve unless it was a parallel solve
+         */
+        void reportSolveMetrics(const ExtractorSolver *solver);
+
         /**
          * @brief snr gets the signal to noise ratio for a star with the specified background
          * @param background The specified background object which may have come from star extraction
@@ -718,11 +1744,175 @@ class StellarSolver : public QObject
          */
         void parallelSolve();
 
+        /**
+         * @brief isRacing gets whether this solve races several solvers against each other, see setRacingSolvers
+         */
+        bool isRacing() const
+        {
+            return m_ProcessType == SOLVE && m_RacingSolvers.count() > 1 && !m_RunDirectly && !verifiesOnly();
+        }
+
+        /**
+         * @brief verifiesOnly gets whether this solve only verifies the prior WCS with the internal solver, see setPriorWCS
+         */
+        bool verifiesOnly() const
+        {
+            return m_ProcessType == SOLVE && m_UsePriorWCS && m_PriorVerifyOnly && m_SolverType == SOLVER_STELLARSOLVER;
+        }
+
+        /**
+         * @brief runDirectly runs the process that is set up on the calling thread, see extractDirectly
+         * @return The result of the process
+         */
+        Result runDirectly();
+
+        /**
+         * @brief currentResult gets the result of the last process from the getters
+         */
+        Result currentResult();
+
+        /**
+         * @brief raceSolvers starts one solver of each racing type on the same stars, they are run like the child solvers of a parallel solve
+         * and finishParallelSolve keeps the first solution.
+         * @param reusedStars Whether the extractor already has the stars of the last solve, so they don't have to be extracted again
+         */
+        void raceSolvers(bool reusedStars);
+
+        /**
+         * @brief priorWCSFinished gets called when the prior WCS of a parallel solve has been verified, or could not be.
+         * The solve is done if it was verified, otherwise the parallel solve starts.
+         * @param code Whether the verification has failed or not.  0 means success.
+         */
+        void priorWCSFinished(int code);
+
+        /**
+         * @brief coarseSolveFinished gets called when the coarse attempt of a blind solve is done.
+         * If it solved, the scale and position are narrowed around its solution, then the full solve starts.
+         */
+        void coarseSolveFinished();
+
+        /**
+         * @brief scheduleParallelWork puts the ranges in the parallel solve queue that solved the fastest before first,
+         * and gives a slice of the time limit to the ones that were searched before and never solved
+         * @param threads is the number of child solvers that work through the queue
+         */
+        void scheduleParallelWork(int threads);
+
+        /**
+         * @brief recordParallelWork adds the result of the range a child solver was searching to its statistics,
+         * and puts the range back at the end of the queue if it was stopped by its time slice
+         * @param solver is the child solver that is done
+         * @param solved is whether it solved the image
+         */
+        void recordParallelWork(ExtractorSolver *solver, bool solved);
+
+        /**
+         * @brief startNextParallelWork gives the next range in the parallel solve queue to a child solver and starts it
+         * @param solver is the child solver that is ready for more work
+         * @return true if it was started, false if there is no more work or the time limit was reached
+         */
+        bool startNextParallelWork(ExtractorSolver *solver);
+
+        /**
+         * @brief useParallelSolution copies the solution found by a child solver into the StellarSolver
+         * @param solver is the child solver that solved the image
+         */
+        void useParallelSolution(ExtractorSolver *solver);
+
+        /**
+         * @brief attachSkyPositions calculates the RA and DEC of the extracted stars from the WCS the first time they are read after
+         * an extraction or a solve, so a caller that only wants the solution or the pixel positions doesn't pay for the conversion of every star
+         */
+        void attachSkyPositions() const;
+
+        /**
+         * @brief extractorCatalog gets the catalog of the extracted stars with their sky positions, it is only made again once they change
+         */
+        const StarCatalog &extractorCatalog() const;
+
+        /**
+         * @brief createBatchSolver creates a StellarSolver with the settings of this one to solve an image of the batch
+         * @param parent The parent of the new StellarSolver, this one for the batch and the coarse attempt, nullptr for a job
+         * @return The new StellarSolver
+         */
+        StellarSolver *createBatchSolver(QObject *parent);
+
+        /**
+         * @brief copySearch copies the search scale and position of this StellarSolver to another one, loading an image forgets them
+         */
+        void copySearch(StellarSolver *solver) const;
+
+        /**
+         * @brief createSharedResources creates the IndexCatalog, the SolverThreadPool and the other things the StellarSolvers of a batch
+         * or of the jobs share with this one, if they weren't set
+         */
+        void createSharedResources();
+
+        /**
+         * @brief startJob starts a job of solveJob or extractJob
+         */
+        QFuture<Result> startJob(ProcessType type, const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer, QRect frame,
+                                 int deadlineMS);
+
+        /**
+         * @brief runJob queues the StellarSolver of a job for a thread of m_JobPool, which deletes it when it is done, see runNextJob
+         * @param deadlineMS How many milliseconds from now the result is needed in, 0 for no deadline
+         */
+        QFuture<Result> runJob(StellarSolver *solver, int deadlineMS = 0);
+
+        /**
+         * @brief runNextJob runs the queued job with the earliest deadline on the calling thread of m_JobPool, with the faster profile
+         * if its deadline is at risk, and reports its result
+         */
+        void runNextJob();
+
+        /**
+         * @brief useFasterProfile changes the settings of the StellarSolver of a job to ones that extract and solve faster, see solveJob
+         * @param lastPixscale The pixel scale the last job solved at, 0 if none did
+         */
+        static void useFasterProfile(StellarSolver *solver, double lastPixscale);
+
+        /**
+         * @brief createStarsSolver creates the StellarSolver of a job that solves a list of stars without the image, see solveStarsJob
+         * @param imagestats Information about the image the stars were extracted from, only its size is used
+         * @param stars The stars to solve
+         * @return The new StellarSolver, for runJob
+         */
+        StellarSolver *createStarsSolver(const FITSImage::Statistic &imagestats, const QList<FITSImage::Star> &stars);
+
+        /**
+         * @brief startNextBatchImage loads or solves the next image of the batch, if there is one and fewer than m_BatchMaxConcurrent are running
+         * @return true if one was started
+         */
+        bool startNextBatchImage();
+
+        /**
+         * @brief solveBatchImage starts solving an image of the batch that is in memory
+         * @param imageNumber is the position of the image in the batch
+         * @param imagestats Information about the image
+         * @param imageBuffer The image, which was loaded for the batch if ownedBuffer is set
+         * @param ownedBuffer is the image buffer to delete when it is done, or nullptr if it is not owned by the batch
+         */
+        void solveBatchImage(int imageNumber, const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer, uint8_t *ownedBuffer);
+
+        /**
+         * @brief finishBatchImage reports that an image of the batch is done and starts the next one
+         * @param imageNumber is the position of the image in the batch
+         * @param solver is the StellarSolver that solved it, or nullptr if it could not be loaded
+         */
+        void finishBatchImage(int imageNumber, StellarSolver *solver);
+
         /**
          * @brief updateConvolutionFilter This will update the convolution filter when the StellarSolver gets set up
          */
         void updateConvolutionFilter();
 
+        /**
+         * @brief makeConvFilter computes a Convolution Filter for generateConvFilter, which keeps the ones it made
+         * @param size The half width of the filter, the fwhm rounded up
+         */
+        static QVector<float> makeConvFilter(SSolver::ConvFilterType filter, int size);
+
         /**
          * @brief appendStarsRAandDEC attaches the RA and DEC information to a star list
          * @param stars is the star list to process
@@ -742,6 +1932,67 @@ class StellarSolver : public QObject
          */
         ExtractorSolver* createExtractorSolver();
 
+        /**
+         * @brief createExtractorSolver creates an ExtractorSolver for another solver and star extractor than the ones that are set, for the races
+         * @return The newly created ExtractorSolver.
+         */
+        ExtractorSolver* createExtractorSolver(SSolver::SolverType solverType, SSolver::ExtractorType extractorType);
+
+        /**
+         * @brief packedImageBuffer gets the image buffer with the packed layout, a copy of it if it was loaded with a view that isn't packed
+         */
+        const uint8_t *packedImageBuffer();
+
+        /**
+         * @brief resetImage forgets everything about the last image when a new one is loaded
+         * @param imagestats Information about the new image
+         */
+        void resetImage(const FITSImage::Statistic &imagestats);
+
+        /**
+         * @brief reuseExtractorSolver gets m_ExtractorSolver ready for the frame loaded with loadNextFrame, if it can extract the stars
+         * of it the way they are extracted now
+         * @return true if it is reused, otherwise a new one has to be created
+         */
+        bool reuseExtractorSolver();
+
+        /**
+         * @brief configureExtractorSolver gives an ExtractorSolver the settings of this StellarSolver for the next process
+         */
+        void configureExtractorSolver(ExtractorSolver *solver, SSolver::SolverType solverType);
+
+        /**
+         * @brief reuseStars gives the new solver the stars kept from the last solve, if they were extracted from the same image the same way
+         * @return true if the solver got the stars and doesn't need to extract them
+         */
+        bool reuseStars();
+
+        /**
+         * @brief startCoarseSolve starts the coarse attempt of a blind solve, see setCoarseSolve
+         * @return true if it was started, then the full solve starts when it is done
+         */
+        bool startCoarseSolve();
+
+        /**
+         * @brief restoreCoarseSearch puts back the search scale and position the coarse attempt narrowed, when the full solve is done
+         */
+        void restoreCoarseSearch();
+
+        /**
+         * @brief keepStarsForReuse keeps the stars the solver extracted to solve, so the next solve of the image can reuse them
+         */
+        void keepStarsForReuse();
+
+        /**
+         * @brief resetTracking forgets the tracked stars, so the next extraction is done on the whole image
+         */
+        void resetTracking();
+
+        /**
+         * @brief updateTracking keeps the stars of the extraction that just finished to track them into the next image
+         */
+        void updateTracking();
+
         /**
          * @brief getAvailableRAM finds out the amount of available RAM on the system
          * @param availableRAM is the variable that will be set to the available RAM found
@@ -752,11 +2003,24 @@ class StellarSolver : public QObject
 
         /**
          * @brief enoughRAMisAvailableFor determines if there is enough RAM for the selected index files so that we don't try to load indexes inParallel unless it can handle it.
+         * This is only needed for the external astrometry.net solver, the internal solver shares a memory mapped copy of the indexes between its threads.
          * @param indexFolders is the list of index folders we will be searching for index files
          * @return true if it is successful
          */
         bool enoughRAMisAvailableFor(const QStringList &indexFolders);
 
+        /**
+         * @brief extractionBytes estimates the memory the star extraction of the image takes, the float images, the merged channels and the arenas
+         * @param downsample The downsample of the image
+         * @return The bytes
+         */
+        qint64 extractionBytes(int downsample) const;
+
+        /**
+         * @brief applyMemoryBudget changes the parameters and the index catalog so that the extraction and solve fit in the memory budget
+         */
+        void applyMemoryBudget();
+
     signals:
         /**
          * @brief logOutput signals that there is infomation that should be printed to a log file or log window
@@ -777,5 +2041,57 @@ class StellarSolver : public QObject
          */
         void finished();
 
+        /**
+         * @brief solveMetrics reports how long the stages of the extraction or solve took and how much work the solver did,
+         * whether it was successful or not.  It is emitted right before the finished signal.
+         * @param metrics The metrics, the same as getSolveMetrics
+         */
+        void solveMetrics(const FITSImage::SolveMetrics &metrics);
+
+        /**
+         * @brief partitionStarsReady reports the stars of a partition of the image as soon as it is extracted, see setStreamPartitionStars.
+         * A star found again by the next partition near their boundary is only in the first list, and the filters that pick stars from
+         * the whole list, like keepNum and removeBrightest, are not applied yet, so the final list can differ.
+         * @param stars The new stars of the partition, in the pixels of the image, after the filters that judge each star on its own
+         * @param partition The number of the partition, they come in order
+         * @param partitions How many partitions there are
+         */
+        void partitionStarsReady(const QList<FITSImage::Star> &stars, int partition, int partitions);
+
+        /**
+         * @brief partitionStarsComplete reports the final star list after the partitions were merged and filtered, see setStreamPartitionStars.
+         * It comes before ready.
+         * @param stars The star list, the same as getStarList
+         */
+        void partitionStarsComplete(const QList<FITSImage::Star> &stars);
+
+        /**
+         * @brief batchImageSolved an image of the batch started with solveBatch is done, whether it was solved or not.
+         * @param imageNumber is the position of the image in the list given to solveBatch
+         * @param solved is whether it was solved
+         * @param solver is the StellarSolver that solved it, to get the solution, the stars and the WCS data from.  It is nullptr if the image could not be loaded.
+         * It is deleted after the signal, so it should only be used in a direct connection.
+         */
+        void batchImageSolved(int imageNumber, bool solved, StellarSolver *solver);
+
+        /**
+         * @brief batchFinished all of the images of the batch are done, or the batch was aborted and its StellarSolvers have stopped.
+         */
+        void batchFinished();
+
+        /**
+         * @brief indexPreloadProgress reports how the preload of the indexes started with preloadIndexes is going.
+         * It is emitted from the thread that preloads them.
+         * @param done is how many indexes are done
+         * @param total is how many there are
+         */
+        void indexPreloadProgress(int done, int total);
+
+        /**
+         * @brief indexesPreloaded the preload of the indexes started with preloadIndexes is done
+         * @param count is how many indexes were loaded and pinned
+         */
+        void indexesPreloaded(int count);
+
 };
 
@@ -7,7 +7,9 @@
 //system includes
 #include <stdint.h>
 #include <math.h>
+#include <functional>
 #include <QString>
+#include <QList>
 
 namespace FITSImage
 {
@@ -70,8 +72,24 @@ typedef struct Statistic
     uint16_t width { 0 };               // width of the image in pixels
     uint16_t height { 0 };              // height of the image in pixels
     uint8_t channels { 1 };             // Mono Images have 1 channel, RGB has 3 channels
+    uint16_t xOffset { 0 };             // x position of the image in its file, when only a subframe of the file was loaded
+    uint16_t yOffset { 0 };             // y position of the image in its file, when only a subframe of the file was loaded
 } Statistic;
 
+// This describes how the pixels of an image buffer are laid out when they are not packed one channel after the other, so that frames
+// with padded rows or interleaved colors, like the ones of camera SDKs, can be processed without a copy, see StellarSolver::loadNewImageView.
+// The strides are counted in pixel values, not in bytes.
+typedef struct ImageView
+{
+    uint32_t rowStride { 0 };       // From the start of one row to the start of the next, 0 for width * channels if interleaved, otherwise width
+    uint32_t channelStride { 0 };   // From the start of one channel to the start of the next, 0 for 1 if interleaved, otherwise rowStride * height
+    bool interleaved { false };     // Whether the channels of each pixel are next to each other, RGBRGB..., instead of in planes
+    uint16_t roiX { 0 };            // The region of the buffer to process.  It is the whole buffer if roiWidth or roiHeight is 0.
+    uint16_t roiY { 0 };
+    uint16_t roiWidth { 0 };
+    uint16_t roiHeight { 0 };
+} ImageView;
+
 // This structure holds data about sources that are found within
 // an image.  It is returned by Source Extraction
 typedef struct Star
@@ -90,6 +108,19 @@ typedef struct Star
     int numPixels;  // The number of pixels occupied by the star in the image.
 } Star;
 
+// This struct holds the image quality of a frame, from the stars found in a summary extraction, see StellarSolver::extractSummary.
+// The quantiles come from histograms whose bins are about 0.5% of the HFR and 0.001 of the eccentricity wide.
+typedef struct ImageQuality
+{
+    int numStars { 0 };             // The number of stars that pass the filters of each star on its own
+    float medianHFR { 0 };          // The median HFR of the stars, 0 if the HFR was not calculated
+    float lowerQuartileHFR { 0 };   // The HFR that a quarter of the stars are smaller than
+    float upperQuartileHFR { 0 };   // The HFR that a quarter of the stars are bigger than
+    float medianEccentricity { 0 }; // The median of sqrt(1 - b^2 / a^2) of the stars, 0 for round stars
+    float background { 0 };         // The global mean of the background
+    float backgroundRMS { 0 };      // The global sigma of the background
+} ImageQuality;
+
 // This struct holds data about the background in an image
 // It is returned by source extraction
 typedef struct Background
@@ -100,6 +131,17 @@ typedef struct Background
     int num_stars_detected; // Number of stars detected before any reduction.
 } Background;
 
+// Why the stars of a frame can't solve it, see checkViability of the ExtractorSolver and the viability checks of the Parameters
+typedef enum
+{
+    FRAME_VIABLE,           // The stars can solve the frame, or it was not checked
+    FRAME_TOO_FEW_STARS,    // There are fewer than viabilityMinStars
+    FRAME_TOO_NOISY,        // The background is noisier than viabilityMaxBackgroundRMS
+    FRAME_SPURIOUS_STARS,   // The stars are smaller than viabilityMinStarSize, so they are mostly noise and hot pixels
+    FRAME_BLURRED_STARS,    // The stars are bigger than viabilityMaxStarSize
+    FRAME_STARS_CLUSTERED   // The stars are in less than viabilityMinSpread of the frame, like in a gap of the clouds
+} FrameViability;
+
 // This struct contains information about the astrometric solution
 // for an image.
 typedef struct Solution
@@ -122,5 +164,82 @@ typedef struct wcs_point
     float dec;          // The Declination in degrees
 } wcs_point;
 
+// This is how long one index was searched for quads during a solve.
+typedef struct IndexSearch
+{
+    int indexNumber;    // The index number, such as 4107, or -1 if all of the indexes were searched together in parallel
+    int healpix;        // The healpix of the index, -1 if it covers the whole sky or the indexes were searched in parallel
+    double searchMs;    // The wall time of the search in milliseconds, the verifications and tweaks of its matches included
+    int quadsTried;     // The number of quads that were tried with the index
+} IndexSearch;
+
+// These are the hardware events of a stage of an extraction or solve, which are only counted when StellarSolver::setCountHardwareEvents
+// is on and the system can count them, see PerfCounters.  The events are of the threads the stage ran on, and only in user space.
+typedef struct HardwareCounters
+{
+    uint64_t cycles { 0 };          // The CPU cycles, instructions / cycles is low when the stage waits for memory
+    uint64_t instructions { 0 };    // The instructions that were run
+    uint64_t cacheMisses { 0 };     // The memory accesses that missed the last level of the cache
+    uint64_t branchMisses { 0 };    // The branches that were mispredicted
+} HardwareCounters;
+
+// This struct reports how long the stages of a star extraction and solve took, and how much work the solver did.
+// It is returned with every extraction and solve, see StellarSolver::getSolveMetrics.  The times are wall times in milliseconds,
+// and the stages that didn't run are 0.  The background, detection, deblending and photometry are added up over the partitions
+// of the image, which are extracted at the same time, so they can add up to more than the extraction took.  In the same way,
+// the solver stages and counts are added up over the child solvers of a parallel solve.
+typedef struct SolveMetrics
+{
+    double totalMs { 0 };           // The whole extraction or solve, from the start until it finished
+    // Star Extraction
+    double prepareMs { 0 };         // Converting the image to float, merging the channels and downsampling it
+    double backgroundMs { 0 };      // Estimating the background and subtracting it
+    double detectionMs { 0 };       // The convolution, thresholding and labeling of the sources, without the deblending
+    double deblendMs { 0 };         // Deblending the sources
+    double photometryMs { 0 };      // Measuring the shapes, fluxes and HFRs of the stars
+    double filterMs { 0 };          // Filtering the extracted stars
+    bool extractionTimedOut { false };  // Whether the extraction ran out of its extractionTimeLimit, so it has only the stars found until then
+    FrameViability viability { FRAME_VIABLE };  // Why the stars couldn't solve the frame, so the solve gave up before it started
+    // Solving
+    double indexLoadMs { 0 };       // Finding and loading the index files for the scales and position of the solve
+    double searchMs { 0 };          // Searching the indexes for quads, the verifications and tweaks included
+    double verifyMs { 0 };          // Verifying the matches
+    double tweakMs { 0 };           // Tweaking the solutions
+    int quadsTried { 0 };           // The number of quads of field stars that were tried
+    int codesMatched { 0 };         // The number of them whose codes matched quads in the indexes
+    int verifications { 0 };        // The number of matches that were verified
+    int minorPageFaults { 0 };      // The page faults of the search that found the page in memory, on the solver threads and only on Linux
+    int majorPageFaults { 0 };      // The ones that had to wait for the index files to be read from the disk
+    QList<IndexSearch> indexSearches;   // The search of each index, in the order they were searched
+    // The vector instructions that were picked for this CPU when the library runs: "AVX2", "NEON" or "none" for the scalar code
+    QString extractionSimd;         // The conversion, convolution and background of the star extraction
+    QString solverSimd;             // The scale and box checks of the quads the solver builds
+    // Jobs, see StellarSolver::solveJob
+    double queueMs { 0 };           // How long the job waited for a thread
+    double deadlineMs { 0 };        // How long after it was given the job was needed, 0 if it had no deadline
+    bool deadlineMissed { false };  // Whether the job finished after its deadline
+    bool fasterProfile { false };   // Whether the job was done with the faster profile because its deadline was at risk
+    // Hardware events, see StellarSolver::setCountHardwareEvents, they are all 0 unless hardwareCounted is set
+    bool hardwareCounted { false };         // Whether the events were counted
+    HardwareCounters extractionCounters;    // The partitions of the star extraction, each on the thread that extracted it
+    HardwareCounters searchCounters;        // The quad search on the solver thread, with the verifications and tweaks that ran on it
+    HardwareCounters verifyCounters;        // The verifications of the matches, on all of the threads that verified them
+} SolveMetrics;
+
+// This struct reports how much memory StellarSolver is using, see StellarSolver::getMemoryUsage.  The sizes are in bytes.
+// The image given to StellarSolver is not counted, since it belongs to the program.
+typedef struct MemoryUsage
+{
+    qint64 indexBytes { 0 };    // The indexes loaded in the IndexCatalog, their memory mapped files and compact code trees
+    qint64 imageBytes { 0 };    // The float images of the star extraction, which are kept for the next image
+    qint64 arenaBytes { 0 };    // The memory the star extraction keeps for its temporaries, in the arenas of all of the threads of the program
+    qint64 childBytes { 0 };    // The estimated memory of the child solvers of the parallel solve that is running
+    qint64 totalBytes { 0 };    // All of the above
+} MemoryUsage;
+
+// This reads rows of an image that is not all in memory.  It fills buffer with the rows firstRow to firstRow + rows - 1
+// of the given channel, stored like in an image buffer of the Statistic's data type, and returns false if that failed.
+typedef std::function<bool(int channel, uint32_t firstRow, uint32_t rows, uint8_t *buffer)> RowReader;
+
 } // FITSImage
 
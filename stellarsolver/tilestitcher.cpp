@@ -0,0 +1,137 @@
+/*  TileStitcher, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "tilestitcher.h"
+
+#include <cmath>
+#include <cstring>
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/fit-wcs.h"
+#include "astrometry/sip-utils.h"
+#include "astrometry/starutil.h"
+}
+
+TileStitcher::TileStitcher(int width, int height) : m_Width(width), m_Height(height)
+{
+}
+
+bool TileStitcher::add(const QRect &tile, WCSData wcs)
+{
+    Tile sampled;
+    sampled.rect = tile;
+    for(int j = 0; j < GRID; j++)
+    {
+        for(int i = 0; i < GRID; i++)
+        {
+            const double x = tile.width() * (i + 0.5) / GRID;
+            const double y = tile.height() * (j + 0.5) / GRID;
+            FITSImage::wcs_point sky;
+            if(!wcs.pixelToWCS(QPointF(x, y), sky))
+                continue;
+            double xyz[3];
+            radecdeg2xyzarr(sky.ra, sky.dec, xyz);
+            sampled.xyz.insert(sampled.xyz.end(), xyz, xyz + 3);
+            sampled.xy.push_back(x + tile.x());
+            sampled.xy.push_back(y + tile.y());
+        }
+    }
+    // A corner of a tile can be behind the projection, but at least half of it has to convert
+    if(sampled.xy.size() < GRID * GRID)
+        return false;
+    m_Tiles.append(sampled);
+    return true;
+}
+
+bool TileStitcher::fit(const std::vector<int> &used, int order, sip_t &sip) const
+{
+    std::vector<double> xy, xyz;
+    for(int t : used)
+    {
+        xy.insert(xy.end(), m_Tiles.at(t).xy.begin(), m_Tiles.at(t).xy.end());
+        xyz.insert(xyz.end(), m_Tiles.at(t).xyz.begin(), m_Tiles.at(t).xyz.end());
+    }
+    const int count = static_cast<int>(xy.size() / 2);
+    memset(&sip, 0, sizeof(sip_t));
+    // The inverse polynomials are one order higher, like the tweak of the internal solver makes them
+    return fit_sip_wcs_2(xyz.data(), xy.data(), nullptr, count, order, order + 1, m_Width, m_Height, 1, nullptr, 1, &sip) == 0;
+}
+
+double TileStitcher::residual(const Tile &tile, const sip_t &sip) const
+{
+    const int count = static_cast<int>(tile.xy.size() / 2);
+    double sum = 0;
+    for(int i = 0; i < count; i++)
+    {
+        double ra, dec, x, y;
+        xyzarr2radecdeg(&tile.xyz[3 * i], &ra, &dec);
+        if(!sip_radec2pixelxy(&sip, ra, dec, &x, &y))
+            return HUGE_VAL;
+        const double dx = x - tile.xy[2 * i], dy = y - tile.xy[2 * i + 1];
+        sum += dx * dx + dy * dy;
+    }
+    return std::sqrt(sum / count);
+}
+
+bool TileStitcher::stitch(sip_t &sip, int order)
+{
+    m_Dropped = 0;
+    if(m_Tiles.isEmpty())
+        return false;
+    // One tile doesn't tell much about the distortion outside of it
+    if(m_Tiles.size() == 1)
+        order = qMin(order, 2);
+
+    std::vector<int> used;
+    for(int t = 0; t < m_Tiles.size(); t++)
+        used.push_back(t);
+    while(true)
+    {
+        if(!fit(used, order, sip))
+            return false;
+        int worst = -1;
+        double worstResidual = MAX_RESIDUAL;
+        for(size_t i = 0; i < used.size(); i++)
+        {
+            const double r = residual(m_Tiles.at(used[i]), sip);
+            if(r > worstResidual)
+            {
+                worst = static_cast<int>(i);
+                worstResidual = r;
+            }
+        }
+        if(worst < 0)
+            return true;
+        // Two tiles that don't agree can't tell which one is wrong
+        if(used.size() <= 2)
+            return false;
+        used.erase(used.begin() + worst);
+        m_Dropped++;
+    }
+}
+
+FITSImage::Solution TileStitcher::solution(const sip_t &sip)
+{
+    double ra, dec, fieldw, fieldh;
+    char *fieldunits;
+    sip_get_radec_center(&sip, &ra, &dec);
+    sip_get_field_size(&sip, &fieldw, &fieldh, &fieldunits);
+    if(strcmp(fieldunits, "degrees") == 0)
+    {
+        fieldw *= 60;
+        fieldh *= 60;
+    }
+    if(strcmp(fieldunits, "arcseconds") == 0)
+    {
+        fieldw /= 60;
+        fieldh /= 60;
+    }
+    // Note, negative determinant = positive parity.
+    const FITSImage::Parity parity = sip_det_cd(&sip) < 0 ? FITSImage::POSITIVE : FITSImage::NEGATIVE;
+    return {fieldw, fieldh, ra, dec, sip_get_orientation(&sip), sip_pixel_scale(&sip), parity, 0, 0};
+}
@@ -0,0 +1,93 @@
+/*  TileStitcher, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//QT Includes
+#include <QList>
+#include <QRect>
+
+#include <vector>
+
+#include "structuredefinitions.h"
+#include "wcsdata.h"
+
+/**
+ * @brief The TileStitcher class joins the solutions of overlapping tiles of a wide field image into one WCS of the whole image.
+ * The WCS of each tile is sampled over a grid of points in the tile, and a TAN WCS with SIP distortion polynomials is fit to
+ * the points of all of the tiles, so the distortion of the lens, which no single tile sees, ends up in the polynomials.
+ * A tile that was solved wrong doesn't fit the others, so the tile that fits the worst is left out until they all agree.
+ * The whole field has to fit in a TAN projection, which rules out the fields of about 150 degrees or wider.
+ */
+class TileStitcher
+{
+    public:
+        /**
+         * @brief TileStitcher starts joining the tiles of an image
+         * @param width The width of the whole image in pixels
+         * @param height The height of the whole image in pixels
+         */
+        TileStitcher(int width, int height);
+
+        /**
+         * @brief add samples the WCS of a tile
+         * @param tile Where the tile is in the whole image
+         * @param wcs The WCS of the tile, in the pixels of the tile
+         * @return false if too few points of the tile could be converted, it isn't added then
+         */
+        bool add(const QRect &tile, WCSData wcs);
+
+        /**
+         * @brief tiles gets how many tiles were added
+         */
+        int tiles() const
+        {
+            return m_Tiles.size();
+        }
+
+        /**
+         * @brief stitch fits the WCS of the whole image to the tiles, leaving out the ones that don't agree with the others
+         * @param sip Gets the WCS, in the pixels of the whole image
+         * @param order The order of the SIP polynomials, it is lowered for a single tile
+         * @return false if the fit failed, or if no two tiles agreed
+         */
+        bool stitch(sip_t &sip, int order = DEFAULT_ORDER);
+
+        /**
+         * @brief droppedTiles gets how many tiles stitch left out because they didn't fit the others
+         */
+        int droppedTiles() const
+        {
+            return m_Dropped;
+        }
+
+        /**
+         * @brief solution gets the center, the field size, the orientation, the pixel scale and the parity of a WCS, like the internal solver reports them
+         */
+        static FITSImage::Solution solution(const sip_t &sip);
+
+        // The points of each tile are a grid of GRID x GRID
+        static const int GRID = 8;
+        static const int DEFAULT_ORDER = 4;
+        // The RMS difference between a tile and the stitched WCS that leaves it out, in pixels
+        static constexpr double MAX_RESIDUAL = 5;
+
+    private:
+        struct Tile
+        {
+            QRect rect;
+            std::vector<double> xy;     // The points in the pixels of the whole image
+            std::vector<double> xyz;    // Where the WCS of the tile puts them on the unit sphere
+        };
+
+        bool fit(const std::vector<int> &used, int order, sip_t &sip) const;
+        double residual(const Tile &tile, const sip_t &sip) const;
+
+        int m_Width, m_Height;
+        QList<Tile> m_Tiles;
+        int m_Dropped { 0 };
+};
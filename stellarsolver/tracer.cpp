@@ -0,0 +1,182 @@
+/*  Tracer, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "tracer.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+//QT Includes
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+
+namespace
+{
+struct TraceEvent
+{
+    const char *name;
+    double start;       // Microseconds since the epoch of the trace
+    double duration;    // Microseconds
+};
+
+// The spans of one thread.  Each thread only locks its own buffer, so the threads don't wait on each other to record spans.
+struct ThreadEvents
+{
+    int threadID;
+    QMutex mutex;
+    std::vector<TraceEvent> events;
+};
+
+std::atomic<bool> &enabledFlag()
+{
+    static std::atomic<bool> enabled { !qEnvironmentVariableIsEmpty("STELLARSOLVER_TRACE") };
+    return enabled;
+}
+
+const std::chrono::steady_clock::time_point &epoch()
+{
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return start;
+}
+
+QMutex &registryMutex()
+{
+    static QMutex mutex;
+    return mutex;
+}
+
+// The buffers are kept after their threads finish, so the spans of the threads that are gone are still in the trace
+std::vector<std::shared_ptr<ThreadEvents>> &registry()
+{
+    static std::vector<std::shared_ptr<ThreadEvents>> buffers;
+    return buffers;
+}
+
+ThreadEvents &threadEvents()
+{
+    thread_local std::shared_ptr<ThreadEvents> local;
+    if(!local)
+    {
+        local = std::make_shared<ThreadEvents>();
+        QMutexLocker locker(&registryMutex());
+        local->threadID = static_cast<int>(registry().size()) + 1;
+        registry().push_back(local);
+    }
+    return *local;
+}
+
+double now()
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch()).count();
+}
+}
+
+void Tracer::setEnabled(bool enabled)
+{
+    enabledFlag().store(enabled, std::memory_order_relaxed);
+}
+
+bool Tracer::isEnabled()
+{
+    return enabledFlag().load(std::memory_order_relaxed);
+}
+
+void Tracer::clear()
+{
+    QMutexLocker locker(&registryMutex());
+    for(const std::shared_ptr<ThreadEvents> &buffer : registry())
+    {
+        QMutexLocker bufferLocker(&buffer->mutex);
+        buffer->events.clear();
+    }
+}
+
+QString Tracer::environmentFile()
+{
+    return QString::fromLocal8Bit(qgetenv("STELLARSOLVER_TRACE"));
+}
+
+QByteArray Tracer::toChromeTrace()
+{
+    const double pid = QCoreApplication::applicationPid();
+    QJsonArray traceEvents;
+    QMutexLocker locker(&registryMutex());
+    for(const std::shared_ptr<ThreadEvents> &buffer : registry())
+    {
+        QMutexLocker bufferLocker(&buffer->mutex);
+        if(buffer->events.empty())
+            continue;
+        QJsonObject threadName;
+        threadName["name"] = "thread_name";
+        threadName["ph"] = "M";
+        threadName["pid"] = pid;
+        threadName["tid"] = buffer->threadID;
+        threadName["args"] = QJsonObject{{"name", QString("Thread %1").arg(buffer->threadID)}};
+        traceEvents.append(threadName);
+        for(const TraceEvent &event : buffer->events)
+        {
+            QJsonObject span;
+            span["name"] = QString::fromUtf8(event.name);
+            span["ph"] = "X";
+            span["ts"] = event.start;
+            span["dur"] = event.duration;
+            span["pid"] = pid;
+            span["tid"] = buffer->threadID;
+            traceEvents.append(span);
+        }
+    }
+    QJsonObject trace;
+    trace["traceEvents"] = traceEvents;
+    trace["displayTimeUnit"] = "ms";
+    return QJsonDocument(trace).toJson(QJsonDocument::Compact);
+}
+
+bool Tracer::writeChromeTrace(const QString &fileName)
+{
+    // The solvers of a batch can finish at the same time and write the same file of the environment variable
+    static QMutex writeMutex;
+    QMutexLocker locker(&writeMutex);
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    const QByteArray json = toChromeTrace();
+    return file.write(json) == json.size();
+}
+
+Tracer::Span::Span(const char *name) : m_Name(name), m_Start(sstrace_begin())
+{
+}
+
+Tracer::Span::~Span()
+{
+    sstrace_end(m_Name, m_Start);
+}
+
+double sstrace_begin(void)
+{
+    if(!enabledFlag().load(std::memory_order_relaxed))
+        return -1;
+    return now();
+}
+
+void sstrace_end(const char *name, double start)
+{
+    // A span that started while tracing was on is recorded even if it was turned off since then
+    if(start < 0)
+        return;
+    const double end = now();
+    ThreadEvents &buffer = threadEvents();
+    QMutexLocker locker(&buffer.mutex);
+    buffer.events.push_back({name, start, end - start});
+}
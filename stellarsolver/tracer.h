@@ -0,0 +1,85 @@
+/*  Tracer, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#ifndef TRACER_H
+#define TRACER_H
+
+#ifdef __cplusplus
+//QT Includes
+#include <QString>
+#include <QByteArray>
+
+/**
+ * @brief The Tracer class records spans of time of the star extraction and the solver, with the threads they ran on,
+ * so that a trace of the parallel partitions and children can be looked at in chrome://tracing or https://ui.perfetto.dev.
+ * It is compiled in, but it is off unless setEnabled turns it on or the STELLARSOLVER_TRACE environment variable is set
+ * to the file to write the trace to, and then a span only costs a check of one flag.  When the environment variable is set,
+ * StellarSolver writes the trace of everything that ran so far to the file each time it finishes.
+ */
+class Tracer
+{
+    public:
+        /**
+         * @brief setEnabled turns the recording of spans on or off, the spans that were recorded are kept until clear
+         * @param enabled Whether to record spans
+         */
+        static void setEnabled(bool enabled);
+        static bool isEnabled();
+
+        /**
+         * @brief clear removes all of the spans that were recorded
+         */
+        static void clear();
+
+        /**
+         * @brief environmentFile gets the file of the STELLARSOLVER_TRACE environment variable
+         * @return The file, or an empty string if the variable is not set
+         */
+        static QString environmentFile();
+
+        /**
+         * @brief toChromeTrace makes the Chrome trace event JSON of the spans that were recorded
+         * @return The JSON
+         */
+        static QByteArray toChromeTrace();
+
+        /**
+         * @brief writeChromeTrace writes the Chrome trace event JSON of the spans that were recorded to a file
+         * @param fileName The file to write
+         * @return Whether the file was written
+         */
+        static bool writeChromeTrace(const QString &fileName);
+
+        /**
+         * @brief The Span class records the span of time from when it is made to when it is destroyed
+         */
+        class Span
+        {
+            public:
+                // The name has to stay valid until the trace is written, so it should be a string literal
+                explicit Span(const char *name);
+                ~Span();
+            private:
+                const char *m_Name;
+                double m_Start;
+        };
+};
+#endif
+
+#ifdef __cplusplus
+    #define TRACER_EXPORT_C extern "C"
+#else
+    #define TRACER_EXPORT_C
+#endif
+
+// This provides a C interface to the Tracer so that spans can be recorded from astrometry.net.
+// sstrace_begin gets the start of a span in microseconds, or a negative number when tracing is off, and sstrace_end records
+// the span if it was started.  The name has to stay valid until the trace is written, so it should be a string literal.
+TRACER_EXPORT_C double sstrace_begin(void);
+TRACER_EXPORT_C void sstrace_end(const char *name, double start);
+
+#endif // TRACER_H
@@ -1,10 +1,14 @@
 #include "wcsdata.h"
 #include <wcshdr.h>
 #include <wcsfix.h>
+#include <QVector>
+#include <QtConcurrent>
+#include <cmath>
 
 //Astrometry.net includes
 extern "C" {
 #include "astrometry/starutil.h"
+#include "astrometry/sip-utils.h"
 }
 
 WCSData::WCSData()
@@ -65,10 +69,23 @@ bool WCSData::wcsToPixel(const FITSImage::wcs_point &skyPoint, QPointF &pixelPoi
     {
         double x;
         double y;
+        if(hasInverseGrid())
+        {
+            // The linear pixel coordinates of the full size image are the ones of the downsampled image times the downsample
+            double px, py;
+            if(tan_radec2pixelxy(&wcs.wcstan, skyPoint.ra, skyPoint.dec, &x, &y) != TRUE)
+                return false;
+            if(interpolateInverse(x * d, y * d, px, py))
+            {
+                pixelPoint.setX(px);
+                pixelPoint.setY(py);
+                return true;
+            }
+        }
         if(sip_radec2pixelxy(&wcs, skyPoint.ra, skyPoint.dec, &x, &y) != TRUE)
             return false;
-        pixelPoint.setX(x);
-        pixelPoint.setY(y);
+        pixelPoint.setX(x * d);
+        pixelPoint.setY(y * d);
         return true;
     }
     else
@@ -85,41 +102,285 @@ bool WCSData::wcsToPixel(const FITSImage::wcs_point &skyPoint, QPointF &pixelPoi
     }
 }
 
-bool WCSData::appendStarsRAandDEC(QList<FITSImage::Star> &stars)
+// The points are converted in blocks of this many, each one by a thread, so the small arrays are done in one go
+static const int WCS_BLOCK_SIZE = 4096;
+
+bool WCSData::appendStarsRAandDEC(StarCatalog &stars)
+{
+    if(!hasWCS)
+        return false;
+    const int count = stars.count();
+    QVector<double> x(count), y(count), ra(count), dec(count);
+    const float *xColumn = stars.x();
+    const float *yColumn = stars.y();
+    for(int i = 0; i < count; i++)
+    {
+        x[i] = xColumn[i];
+        y[i] = yColumn[i];
+    }
+    if(!pixelsToWCS(x.constData(), y.constData(), ra.data(), dec.data(), count))
+        return false;
+    stars.setSkyPositions(ra.constData(), dec.constData());
+    return true;
+}
+
+// This scales the WCS of a downsampled solve to the full size image for the conversions of points.
+// pixelToWCS and wcsToPixel divide and multiply the points by the downsample, so CRPIX is scaled the same way,
+// rather than around the center of the first pixel like sip_scale does for the FITS headers.
+static sip_t scaleForPoints(const sip_t &wcs, int d)
+{
+    if(d <= 1)
+        return wcs;
+    sip_t scaled;
+    sip_scale(&wcs, &scaled, d);
+    scaled.wcstan.crpix[0] = wcs.wcstan.crpix[0] * d;
+    scaled.wcstan.crpix[1] = wcs.wcstan.crpix[1] * d;
+    return scaled;
+}
+
+// This splits the points between the threads of the global pool and waits for them
+template <typename Convert>
+static void convertInBlocks(int count, Convert convert)
+{
+    if(count <= WCS_BLOCK_SIZE)
+    {
+        convert(0, count);
+        return;
+    }
+    QVector<int> blockStarts;
+    for(int start = 0; start < count; start += WCS_BLOCK_SIZE)
+        blockStarts.append(start);
+    QtConcurrent::blockingMap(blockStarts, [count, &convert](int start)
+    {
+        convert(start, qMin(WCS_BLOCK_SIZE, count - start));
+    });
+}
+
+bool WCSData::pixelsToWCS(const double *x, const double *y, double *ra, double *dec, int count)
 {
     if(!hasWCS)
         return false;
+    if(count <= 0)
+        return true;
     if(internalWCS)
     {
-        for(auto &oneStar : stars)
+        // The WCS is scaled to the full size image once, instead of dividing each point by the downsample
+        const sip_t scaled = scaleForPoints(wcs, d);
+        convertInBlocks(count, [&](int start, int n)
         {
-            double ra = HUGE_VAL;
-            double dec = HUGE_VAL;
-            sip_pixelxy2radec(&wcs, oneStar.x / d, oneStar.y / d, &ra, &dec);
-            char rastr[32], decstr[32];
-            ra2hmsstring(ra, rastr);
-            dec2dmsstring(dec, decstr);
-            oneStar.ra = ra;
-            oneStar.dec = dec;
-        }
+            sip_pixelxy2radec_array(&scaled, x + start, y + start, n, ra + start, dec + start);
+        });
         return true;
     }
-    else
+
+    // wcsp2s converts all the points in one call, but wcslib may set up the struct in it, so it isn't shared between threads
+    QVector<double> pixcrd(2 * count), imgcrd(2 * count), world(2 * count), phi(count), theta(count);
+    QVector<int> stat(count);
+    for(int i = 0; i < count; i++)
     {
-        double imgcrd[2], phi = 0, pixcrd[2], theta = 0, world[2];
-        int stat[2];
+        pixcrd[2 * i] = x[i];
+        pixcrd[2 * i + 1] = y[i];
+    }
+    if(wcsp2s(m_wcs, count, 2, pixcrd.constData(), imgcrd.data(), phi.data(), theta.data(), world.data(), stat.data()) != 0)
+        return false;
+    for(int i = 0; i < count; i++)
+    {
+        ra[i] = world[2 * i];
+        dec[i] = world[2 * i + 1];
+    }
+    return true;
+}
 
-        for(auto &oneStar : stars)
+bool WCSData::wcsToPixels(const double *ra, const double *dec, double *x, double *y, int count, bool *valid)
+{
+    if(!hasWCS)
+        return false;
+    if(count <= 0)
+        return true;
+    if(internalWCS)
+    {
+        const sip_t scaled = scaleForPoints(wcs, d);
+        // With a grid, the points are only projected to the tangent plane, and the grid undistorts them
+        sip_t tanOnly;
+        sip_wrap_tan(&scaled.wcstan, &tanOnly);
+        const bool useGrid = hasInverseGrid();
+        QVector<anbool> ok(count);
+        QAtomicInt converted(0);
+        convertInBlocks(count, [&](int start, int n)
         {
-            pixcrd[0] = oneStar.x;
-            pixcrd[1] = oneStar.y;
-            if ((wcsp2s(m_wcs, 1, 2, &pixcrd[0], &imgcrd[0], &phi, &theta, &world[0], &stat[0])) != 0)
-                return false;
-            oneStar.ra = world[0];
-            oneStar.dec = world[1];
+            converted.fetchAndAddRelaxed(sip_radec2pixelxy_array(useGrid ? &tanOnly : &scaled, ra + start, dec + start, n, x + start, y + start,
+                                         ok.data() + start));
+            if(!useGrid)
+                return;
+            for(int i = start; i < start + n; i++)
+            {
+                if(ok[i] && !interpolateInverse(x[i], y[i], x[i], y[i]))
+                    sip_pixel_undistortion(&scaled, x[i], y[i], &x[i], &y[i]);
+            }
+        });
+        if(valid)
+        {
+            for(int i = 0; i < count; i++)
+                valid[i] = ok[i];
         }
+        return converted.load() > 0;
+    }
 
-        return true;
+    QVector<double> worldcrd(2 * count), imgcrd(2 * count), pixcrd(2 * count), phi(count), theta(count);
+    QVector<int> stat(count);
+    for(int i = 0; i < count; i++)
+    {
+        worldcrd[2 * i] = ra[i];
+        worldcrd[2 * i + 1] = dec[i];
+    }
+    // A status of 9 means that some of the points could not be converted, their stat says which
+    const int status = wcss2p(m_wcs, count, 2, worldcrd.constData(), phi.data(), theta.data(), imgcrd.data(), pixcrd.data(), stat.data());
+    if(status != 0 && status != 9)
+        return false;
+    bool any = false;
+    for(int i = 0; i < count; i++)
+    {
+        x[i] = pixcrd[2 * i];
+        y[i] = pixcrd[2 * i + 1];
+        if(valid)
+            valid[i] = stat[i] == 0;
+        any = any || stat[i] == 0;
+    }
+    return any;
+}
+
+bool WCSData::appendStarsRAandDEC(QList<FITSImage::Star> &stars)
+{
+    if(!hasWCS)
+        return false;
+    const int count = stars.count();
+    QVector<double> x(count), y(count), ra(count), dec(count);
+    for(int i = 0; i < count; i++)
+    {
+        x[i] = stars.at(i).x;
+        y[i] = stars.at(i).y;
+    }
+    if(!pixelsToWCS(x.constData(), y.constData(), ra.data(), dec.data(), count))
+        return false;
+    for(int i = 0; i < count; i++)
+    {
+        FITSImage::Star &oneStar = stars[i];
+        oneStar.ra = ra[i];
+        oneStar.dec = dec[i];
+    }
+    return true;
+}
+
+bool WCSData::getSIP(sip_t &sip) const
+{
+    if(!hasWCS || !internalWCS)
+        return false;
+    if(d > 1)
+        sip_scale(&wcs, &sip, d);
+    else
+        sip = wcs;
+    return true;
+}
+
+// This inverts the forward SIP polynomials at a point, starting from the inverse polynomials.  The distortion is
+// small compared to the pixels, so going back by the error of the forward polynomials converges in a few steps.
+static void invertDistortion(const sip_t &sip, double x, double y, double &px, double &py)
+{
+    sip_pixel_undistortion(&sip, x, y, &px, &py);
+    for(int i = 0; i < 20; i++)
+    {
+        double X, Y;
+        sip_pixel_distortion(&sip, px, py, &X, &Y);
+        px -= X - x;
+        py -= Y - y;
+        if(fabs(X - x) + fabs(Y - y) < 1e-6)
+            break;
     }
 }
 
+double WCSData::buildInverseGrid(int width, int height, int spacing)
+{
+    clearInverseGrid();
+    if(!hasWCS || !internalWCS || width < 1 || height < 1 || spacing < 1)
+        return -1;
+
+    const sip_t scaled = scaleForPoints(wcs, d);
+    InverseGrid grid;
+    // The grid goes one point past each edge, for the stars just outside of the image and the ones the distortion moves out
+    grid.spacing = spacing;
+    grid.x0 = -spacing;
+    grid.y0 = -spacing;
+    grid.columns = (width + spacing - 1) / spacing + 3;
+    grid.rows = (height + spacing - 1) / spacing + 3;
+    grid.dx.resize(grid.columns * grid.rows);
+    grid.dy.resize(grid.columns * grid.rows);
+
+    double *gridX = grid.dx.data();
+    double *gridY = grid.dy.data();
+    QVector<int> rows(grid.rows);
+    for(int r = 0; r < grid.rows; r++)
+        rows[r] = r;
+    QtConcurrent::blockingMap(rows, [&grid, &scaled, gridX, gridY](int r)
+    {
+        const double y = grid.y0 + r * grid.spacing;
+        for(int c = 0; c < grid.columns; c++)
+        {
+            const double x = grid.x0 + c * grid.spacing;
+            double px, py;
+            invertDistortion(scaled, x, y, px, py);
+            gridX[r * grid.columns + c] = px - x;
+            gridY[r * grid.columns + c] = py - y;
+        }
+    });
+    m_InverseGrid = grid;
+
+    // The interpolation is worst in the middle of the cells, so that is where the error is measured
+    QVector<double> rowErrors(grid.rows - 1);
+    QVector<int> cellRows(grid.rows - 1);
+    for(int r = 0; r < grid.rows - 1; r++)
+        cellRows[r] = r;
+    QtConcurrent::blockingMap(cellRows, [this, &scaled, &rowErrors](int r)
+    {
+        const InverseGrid &grid = m_InverseGrid;
+        const double y = grid.y0 + (r + 0.5) * grid.spacing;
+        double worst = 0;
+        for(int c = 0; c < grid.columns - 1; c++)
+        {
+            const double x = grid.x0 + (c + 0.5) * grid.spacing;
+            double px, py, gx, gy;
+            invertDistortion(scaled, x, y, px, py);
+            interpolateInverse(x, y, gx, gy);
+            worst = qMax(worst, hypot(gx - px, gy - py));
+        }
+        rowErrors[r] = worst;
+    });
+    double worst = 0;
+    for(double error : rowErrors)
+        worst = qMax(worst, error);
+    return worst;
+}
+
+void WCSData::clearInverseGrid()
+{
+    m_InverseGrid = InverseGrid();
+}
+
+bool WCSData::interpolateInverse(double x, double y, double &px, double &py) const
+{
+    const InverseGrid &grid = m_InverseGrid;
+    const double gx = (x - grid.x0) / grid.spacing;
+    const double gy = (y - grid.y0) / grid.spacing;
+    if(grid.columns < 2 || !(gx >= 0 && gy >= 0 && gx <= grid.columns - 1 && gy <= grid.rows - 1))
+        return false;
+    const int c = qMin(static_cast<int>(gx), grid.columns - 2);
+    const int r = qMin(static_cast<int>(gy), grid.rows - 2);
+    const double fx = gx - c;
+    const double fy = gy - r;
+    const int i = r * grid.columns + c;
+    const int below = i + grid.columns;
+    const double dx = (grid.dx[i] * (1 - fx) + grid.dx[i + 1] * fx) * (1 - fy) + (grid.dx[below] * (1 - fx) + grid.dx[below + 1] * fx) * fy;
+    const double dy = (grid.dy[i] * (1 - fx) + grid.dy[i + 1] * fx) * (1 - fy) + (grid.dy[below] * (1 - fx) + grid.dy[below + 1] * fx) * fy;
+    px = x + dx;
+    py = y + dy;
+    return true;
+}
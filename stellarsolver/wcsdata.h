@@ -2,8 +2,10 @@
 #define WCSDATA_H
 
 #include "structuredefinitions.h"
+#include "starcatalog.h"
 #include <QPointF>
 #include <QList>
+#include <QVector>
 
 extern "C" {
 #include "astrometry/sip.h"
@@ -34,6 +36,31 @@ public:
      */
     bool wcsToPixel(const FITSImage::wcs_point &skyPoint, QPointF &pixelPoint);
 
+    /**
+     * @brief pixelsToWCS converts arrays of image X, Y Pixel coordinates to RA, DEC sky coordinates, for instance for a catalog overlay.
+     * The big arrays are split between several threads for the WCS of the internal solver.
+     * @param x The X coordinates in pixels
+     * @param y The Y coordinates in pixels
+     * @param ra The Right Ascensions in degrees get put here
+     * @param dec The Declinations in degrees get put here
+     * @param count The number of points in each of the arrays
+     * @return A boolean to say whether it succeeded, true means it did
+     */
+    bool pixelsToWCS(const double *x, const double *y, double *ra, double *dec, int count);
+
+    /**
+     * @brief wcsToPixels converts arrays of RA, DEC sky coordinates to image X, Y Pixel coordinates
+     * The big arrays are split between several threads for the WCS of the internal solver.
+     * @param ra The Right Ascensions in degrees
+     * @param dec The Declinations in degrees
+     * @param x The X coordinates in pixels get put here
+     * @param y The Y coordinates in pixels get put here
+     * @param count The number of points in each of the arrays
+     * @param valid Whether each point could be converted gets put here, the ones behind the image can't.  It can be null.
+     * @return A boolean to say whether any point could be converted
+     */
+    bool wcsToPixels(const double *ra, const double *dec, double *x, double *y, int count, bool *valid = nullptr);
+
     /**
      * @brief appendStarsRAandDEC attaches the RA and DEC information to a star list
      * @param stars is the star list to process
@@ -41,6 +68,45 @@ public:
      */
     bool appendStarsRAandDEC(QList<FITSImage::Star> &stars);
 
+    /**
+     * @brief appendStarsRAandDEC attaches the RA and DEC information to the stars of a catalog, straight from its position columns
+     * @param stars is the star catalog to process
+     * @return true if it was successful
+     */
+    bool appendStarsRAandDEC(StarCatalog &stars);
+
+    /**
+     * @brief getSIP gets the WCS of the internal solver, scaled to the full size image if the image was downsampled for solving
+     * @param sip is where the WCS gets put
+     * @return false if there is none, which is also the case for the WCS loaded from the files of the external solvers
+     */
+    bool getSIP(sip_t &sip) const;
+
+    /**
+     * @brief buildInverseGrid precomputes where the SIP distortion of the internal solver's WCS puts the points of a grid over the image.
+     * wcsToPixel and wcsToPixels then interpolate the grid instead of evaluating the inverse polynomials, which also makes them match
+     * pixelToWCS more closely, since the grid is made by inverting the forward polynomials.  It is built once for a solution, and
+     * it must be built before the WCSData is shared between threads.  The points outside of the grid still use the inverse polynomials.
+     * @param width The width of the image in pixels
+     * @param height The height of the image in pixels
+     * @param spacing The space between the points of the grid in pixels
+     * @return The largest error of the interpolation in pixels, measured at the centers of the cells, or -1 if the grid can't be made
+     */
+    double buildInverseGrid(int width, int height, int spacing = 32);
+
+    /**
+     * @brief clearInverseGrid removes the grid made by buildInverseGrid
+     */
+    void clearInverseGrid();
+
+    /**
+     * @brief hasInverseGrid gets whether the sky to pixel conversions use a grid made by buildInverseGrid
+     */
+    bool hasInverseGrid() const
+    {
+        return m_InverseGrid.columns > 1;
+    }
+
 private:
 
     bool hasWCS = false;
@@ -52,6 +118,22 @@ private:
     sip_t wcs;  // This is an astrometry.net internal data structure for WCS
 
     int m_nwcs = 0;                  // This is a number associated with wcsinfo
+
+    // This is the undistortion of the internal WCS at the points of a grid, in the pixels of the full size image, see buildInverseGrid
+    struct InverseGrid
+    {
+        double x0 { 0 }, y0 { 0 };  // The linear pixel coordinates of the first point
+        double spacing { 1 };       // The space between the points
+        int columns { 0 }, rows { 0 };
+        QVector<double> dx, dy;     // What gets added to the linear pixel coordinates of each point
+    };
+    InverseGrid m_InverseGrid;
+
+    /**
+     * @brief interpolateInverse undistorts linear pixel coordinates of the full size image with the grid
+     * @return false if the point is outside of the grid
+     */
+    bool interpolateInverse(double x, double y, double &px, double &py) const;
    // wcsprm *m_wcs {nullptr};    // This is a struct used by wcslib for wcs info loaded from a file
 
 };
@@ -0,0 +1,914 @@
+// A program that keeps the index files loaded and solves and extracts the stars of the images that other programs on the same
+// computer send it, so they don't each load the indexes and keep a copy of them in memory.  Several of them on a cluster can also
+// solve together, each with the indexes that fit in its memory.
+//
+// Build with:
+// mkdir build
+// cd build
+// cmake -DCMAKE_BUILD_TYPE=RelWithDebInfo -DBUILD_SERVER=ON ..
+// make -j 4
+//
+// Examples:
+// StellarSolverServer -I /usr/share/astrometry
+// StellarSolverServer -I /usr/share/astrometry --name observatory --solve-profile 2
+//
+// Solving on several computers whose memory only holds some of the indexes each, see SolverServer:
+// StellarSolverServer -I /data/index --port 47000 --bind 0.0.0.0 --token secret --series 4100-4110     (the shard with the wide fields)
+// StellarSolverServer -I /data/index --port 47000 --bind 0.0.0.0 --token secret --series 5200-5206 --healpix 0-23
+//                                                                                        (the shards of the narrow fields, by healpix)
+// StellarSolverServer --token secret --shard node1:47000 --shard node2:47000 --shard node3:47000   (the coordinator)
+//
+// The requests are sent to the local socket of the name, which is a Unix domain socket or a named pipe on Windows, or to the TCP port.
+// The TCP port listens on --bind, which is this computer by default, and needs a --token, so only the programs that know it can use it.
+// Each request over TCP sends it as "token" until one of them was accepted, and the shards get the token of the coordinator.
+// The requests over TCP can't have the server read files, they send the image or the stars.
+// Each request is a line of JSON with a command, an id that is sent back with the reply, and where to get the image:
+// {"id": 1, "command": "solve", "file": "/data/light_001.fits"}
+// {"id": 2, "command": "solve", "width": 4656, "height": 3520, "dataType": "uint16", "imageBytes": 32778240}
+//     which is followed by the raw pixels of the image, one channel after the other.  The imageBytes have to be what the pixels need
+//     and at most --max-image-size, or the server replies with an error and closes the connection, since it can't find the next request.
+// {"id": 3, "command": "solve", "width": 4656, "height": 3520, "stars": [{"x": 100.5, "y": 200.25, "flux": 5000}, ...]}
+//     which solves stars that were already extracted, brightest first, with the internal solver
+// {"id": 4, "command": "extract", "file": "/data/light_001.fits", "hfr": true}
+// {"id": 5, "command": "status"}
+// A request can also have "profile" with the number of a built in profile, "channel", "scale": {"low": 1.2, "high": 1.4, "units": "arcsecperpix"},
+// and "position": {"ra": 83.8, "dec": -5.4} in degrees.  The reply is a line of JSON with the id, success, the solution, the WCS,
+// the stars and the metrics of the job, or an error.
+
+#include "solverserver.h"
+#include "ssolverutils/fileio.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+#include <QRegularExpression>
+#include <QFileInfo>
+#include <fitsio.h>
+#include <algorithm>
+#include <limits>
+
+// A request line that is longer than this without an end is not a request, the stars of a star list take about 50 bytes each
+static const int MAX_LINE_BYTES = 64 * 1024 * 1024;
+// The image is read into one QByteArray with the lines after it, so it can't be bigger than this
+static const qint64 MAX_IMAGE_BYTES = std::numeric_limits<int>::max() - MAX_LINE_BYTES;
+
+// This gets the numbers of a list of numbers and ranges of them like 4107,4110-4119
+static bool parseRanges(const QString &text, QSet<int> &numbers)
+{
+    for(const QString &part : text.split(','))
+    {
+        if(part.trimmed().isEmpty())
+            continue;
+        const QStringList range = part.split('-');
+        bool firstValid = false, lastValid = false;
+        const int first = range.first().toInt(&firstValid);
+        const int last = range.last().toInt(&lastValid);
+        if(range.size() > 2 || !firstValid || !lastValid || last < first)
+            return false;
+        for(int number = first; number <= last; number++)
+            numbers.insert(number);
+    }
+    return true;
+}
+
+// This opens a connection to another server, which is host:port for a server on another computer or the name of a local one.
+// connected is called with it once it is open and closed once it is closed or could not be opened, it is deleted after that.
+static QIODevice *connectToServer(const QString &address, QObject *parent, const std::function<void(QIODevice *)> &connected,
+                                  const std::function<void()> &closed)
+{
+    const int colon = address.lastIndexOf(':');
+    bool hasPort = false;
+    const quint16 port = colon > 0 ? address.mid(colon + 1).toUShort(&hasPort) : 0;
+    if(hasPort)
+    {
+        QTcpSocket *socket = new QTcpSocket(parent);
+        QObject::connect(socket, &QTcpSocket::connected, parent, [socket, connected]()
+        {
+            connected(socket);
+        });
+        QObject::connect(socket, &QTcpSocket::stateChanged, parent, [socket, closed](QAbstractSocket::SocketState state)
+        {
+            if(state != QAbstractSocket::UnconnectedState)
+                return;
+            closed();
+            socket->deleteLater();
+        });
+        socket->connectToHost(address.left(colon), port);
+        return socket;
+    }
+    QLocalSocket *socket = new QLocalSocket(parent);
+    QObject::connect(socket, &QLocalSocket::connected, parent, [socket, connected]()
+    {
+        connected(socket);
+    });
+    QObject::connect(socket, &QLocalSocket::stateChanged, parent, [socket, closed](QLocalSocket::LocalSocketState state)
+    {
+        if(state != QLocalSocket::UnconnectedState)
+            return;
+        closed();
+        socket->deleteLater();
+    });
+    socket->connectToServer(address);
+    return socket;
+}
+
+// This gets the FITS data type and the bytes of each pixel of the name of a data type
+static bool parseDataType(const QString &name, uint32_t &dataType, int &bytesPerPixel)
+{
+    static const QHash<QString, QPair<uint32_t, int>> types =
+    {
+        {"uint8", {TBYTE, 1}}, {"int16", {TSHORT, 2}}, {"uint16", {TUSHORT, 2}}, {"int32", {TLONG, 4}},
+        {"uint32", {TULONG, 4}}, {"float", {TFLOAT, 4}}, {"double", {TDOUBLE, 8}}
+    };
+    if(!types.contains(name))
+        return false;
+    dataType = types.value(name).first;
+    bytesPerPixel = types.value(name).second;
+    return true;
+}
+
+// This gets the statistics of the raw image of a request and the bytes its pixels need
+static bool parseImageStats(const QJsonObject &request, FITSImage::Statistic &stats, qint64 &expected, QString &error)
+{
+    stats.width = request.value("width").toInt();
+    stats.height = request.value("height").toInt();
+    stats.channels = request.value("channels").toInt(1);
+    stats.samples_per_channel = static_cast<uint32_t>(stats.width) * stats.height;
+    if(!parseDataType(request.value("dataType").toString("uint16"), stats.dataType, stats.bytesPerPixel))
+    {
+        error = "Unknown data type " + request.value("dataType").toString() + ", it can be uint8, int16, uint16, int32, uint32, float or double";
+        return false;
+    }
+    if(stats.width <= 0 || stats.height <= 0 || (stats.channels != 1 && stats.channels != 3))
+    {
+        error = QString("An image of %1 x %2 pixels of %3 channels can't be solved").arg(stats.width).arg(stats.height).arg(stats.channels);
+        return false;
+    }
+    expected = static_cast<qint64>(stats.width) * stats.height * stats.channels * stats.bytesPerPixel;
+    return true;
+}
+
+static QJsonObject starToJson(const FITSImage::Star &star, bool hasWCS)
+{
+    QJsonObject json;
+    json["x"] = star.x;
+    json["y"] = star.y;
+    json["mag"] = star.mag;
+    json["flux"] = star.flux;
+    json["peak"] = star.peak;
+    json["hfr"] = star.HFR;
+    json["a"] = star.a;
+    json["b"] = star.b;
+    json["theta"] = star.theta;
+    if(hasWCS)
+    {
+        json["ra"] = star.ra;
+        json["dec"] = star.dec;
+    }
+    return json;
+}
+
+static QJsonObject solutionToJson(const FITSImage::Solution &solution)
+{
+    QJsonObject json;
+    json["ra"] = solution.ra;
+    json["dec"] = solution.dec;
+    json["orientation"] = solution.orientation;
+    json["pixscale"] = solution.pixscale;
+    json["fieldWidth"] = solution.fieldWidth;
+    json["fieldHeight"] = solution.fieldHeight;
+    json["parity"] = FITSImage::getParityText(solution.parity);
+    json["raError"] = solution.raError;
+    json["decError"] = solution.decError;
+    return json;
+}
+
+// The WCS is the TAN projection and the SIP distortion of the internal solver, in the FITS keywords, with the SIP coefficients by their exponents
+static QJsonObject wcsToJson(const WCSData &wcs)
+{
+    QJsonObject json;
+    sip_t sip;
+    if(!wcs.getSIP(sip))
+        return json;
+    json["CRVAL1"] = sip.wcstan.crval[0];
+    json["CRVAL2"] = sip.wcstan.crval[1];
+    json["CRPIX1"] = sip.wcstan.crpix[0];
+    json["CRPIX2"] = sip.wcstan.crpix[1];
+    json["CD1_1"] = sip.wcstan.cd[0][0];
+    json["CD1_2"] = sip.wcstan.cd[0][1];
+    json["CD2_1"] = sip.wcstan.cd[1][0];
+    json["CD2_2"] = sip.wcstan.cd[1][1];
+    json["IMAGEW"] = sip.wcstan.imagew;
+    json["IMAGEH"] = sip.wcstan.imageh;
+    const auto coefficients = [](const double terms[SIP_MAXORDER][SIP_MAXORDER], int order, const QString &name, QJsonObject &json)
+    {
+        if(order < 2)
+            return;
+        json[name + "_ORDER"] = order;
+        for(int p = 0; p <= order; p++)
+            for(int q = 0; q <= order - p; q++)
+                if(terms[p][q] != 0)
+                    json[QString("%1_%2_%3").arg(name).arg(p).arg(q)] = terms[p][q];
+    };
+    coefficients(sip.a, sip.a_order, "A", json);
+    coefficients(sip.b, sip.b_order, "B", json);
+    coefficients(sip.ap, sip.ap_order, "AP", json);
+    coefficients(sip.bp, sip.bp_order, "BP", json);
+    return json;
+}
+
+// JSON numbers are doubles, which hold the counts exactly up to 2^53
+static QJsonObject countersToJson(const FITSImage::HardwareCounters &counters)
+{
+    QJsonObject json;
+    json["cycles"] = static_cast<double>(counters.cycles);
+    json["instructions"] = static_cast<double>(counters.instructions);
+    json["cacheMisses"] = static_cast<double>(counters.cacheMisses);
+    json["branchMisses"] = static_cast<double>(counters.branchMisses);
+    return json;
+}
+
+static QJsonObject metricsToJson(const FITSImage::SolveMetrics &metrics)
+{
+    QJsonObject json;
+    json["totalMs"] = metrics.totalMs;
+    json["prepareMs"] = metrics.prepareMs;
+    json["backgroundMs"] = metrics.backgroundMs;
+    json["detectionMs"] = metrics.detectionMs;
+    json["deblendMs"] = metrics.deblendMs;
+    json["photometryMs"] = metrics.photometryMs;
+    json["filterMs"] = metrics.filterMs;
+    json["indexLoadMs"] = metrics.indexLoadMs;
+    json["searchMs"] = metrics.searchMs;
+    json["verifyMs"] = metrics.verifyMs;
+    json["tweakMs"] = metrics.tweakMs;
+    json["quadsTried"] = metrics.quadsTried;
+    json["codesMatched"] = metrics.codesMatched;
+    json["verifications"] = metrics.verifications;
+    json["minorPageFaults"] = metrics.minorPageFaults;
+    json["majorPageFaults"] = metrics.majorPageFaults;
+    if(metrics.hardwareCounted)
+    {
+        json["extractionCounters"] = countersToJson(metrics.extractionCounters);
+        json["searchCounters"] = countersToJson(metrics.searchCounters);
+        json["verifyCounters"] = countersToJson(metrics.verifyCounters);
+    }
+    return json;
+}
+
+SolverServer::SolverServer(const ServerOptions &options, QObject *parent) : QObject(parent), m_Options(options)
+{
+    m_Solver.setIndexFolderPaths(m_Options.indexFolderPaths);
+    // A shard only loads the index files of its series and healpixes.  The files of a series that isn't split up by healpix
+    // cover the whole sky, so they are served whatever the healpixes are.
+    if(!m_Options.indexSeries.isEmpty() || !m_Options.healpixes.isEmpty())
+    {
+        static const QRegularExpression indexName("^index-(\\d+)(?:-(\\d+))?\\.fits?$");
+        QStringList files;
+        for(const QString &file : StellarSolver::getIndexFiles(m_Options.indexFolderPaths))
+        {
+            const QRegularExpressionMatch match = indexName.match(QFileInfo(file).fileName());
+            if(!match.hasMatch())
+                continue;
+            if(!m_Options.indexSeries.isEmpty() && !m_Options.indexSeries.contains(match.captured(1).toInt()))
+                continue;
+            if(!m_Options.healpixes.isEmpty() && !match.captured(2).isEmpty() && !m_Options.healpixes.contains(match.captured(2).toInt()))
+                continue;
+            files.append(file);
+        }
+        m_IndexFiles = files.count();
+        m_Solver.setIndexFolderPaths(QStringList());
+        m_Solver.setIndexFilePaths(files);
+        logOutput(QString("Serving %1 of the index files").arg(files.count()));
+    }
+    if(m_Options.quantizeIndexes)
+    {
+        // The catalog is made here so the indexes get quantized when they are loaded, the jobs share it anyway
+        QSharedPointer<IndexCatalog> catalog(new IndexCatalog());
+        catalog->setQuantizeIndexes(true);
+        m_Solver.setIndexCatalog(catalog);
+    }
+    m_Solver.setParameterProfile(m_Options.solveProfile);
+    m_Solver.setColorChannel(m_Options.colorChannel);
+    m_Solver.setCountHardwareEvents(m_Options.countHardwareEvents);
+    if(m_Options.quiet)
+        m_Solver.setSSLogLevel(SSolver::LOG_OFF);
+    connect(&m_Solver, &StellarSolver::logOutput, this, &SolverServer::logOutput);
+    connect(&m_Solver, &StellarSolver::indexesPreloaded, this, [this](int count)
+    {
+        logOutput(QString("Loaded %1 index files, they stay loaded for all of the requests").arg(count));
+    });
+    connect(&m_Server, &QLocalServer::newConnection, this, [this]()
+    {
+        while(QLocalSocket *socket = m_Server.nextPendingConnection())
+        {
+            connect(socket, &QLocalSocket::disconnected, this, [this, socket]()
+            {
+                m_Clients.remove(socket);
+                socket->deleteLater();
+            });
+            newConnection(socket, false);
+        }
+    });
+    connect(&m_TcpServer, &QTcpServer::newConnection, this, [this]()
+    {
+        while(QTcpSocket *socket = m_TcpServer.nextPendingConnection())
+        {
+            connect(socket, &QTcpSocket::disconnected, this, [this, socket]()
+            {
+                m_Clients.remove(socket);
+                socket->deleteLater();
+            });
+            newConnection(socket, true);
+        }
+    });
+}
+
+void SolverServer::logOutput(QString text)
+{
+    if(!m_Options.quiet)
+        printf("%s\n", text.toUtf8().data());
+    fflush(stdout);
+}
+
+bool SolverServer::listen()
+{
+    // A socket file that is left from a server that crashed would keep it from listening
+    QLocalServer::removeServer(m_Options.serverName);
+    m_Server.setSocketOptions(QLocalServer::UserAccessOption);
+    if(!m_Server.listen(m_Options.serverName))
+    {
+        fprintf(stderr, "Unable to listen on %s: %s\n", m_Options.serverName.toUtf8().data(), m_Server.errorString().toUtf8().data());
+        return false;
+    }
+    logOutput("Listening on " + m_Server.fullServerName());
+    if(m_Options.port)
+    {
+        const QHostAddress address(m_Options.bindAddress);
+        if(address.isNull())
+        {
+            fprintf(stderr, "%s is not an address to listen on\n", m_Options.bindAddress.toUtf8().data());
+            return false;
+        }
+        if(m_Options.token.isEmpty())
+        {
+            fprintf(stderr, "The TCP port needs a token, so the programs that don't know it can't use the server\n");
+            return false;
+        }
+        if(!m_TcpServer.listen(address, m_Options.port))
+        {
+            fprintf(stderr, "Unable to listen on port %d: %s\n", m_Options.port, m_TcpServer.errorString().toUtf8().data());
+            return false;
+        }
+        logOutput(QString("Listening on %1 port %2").arg(address.toString()).arg(m_Options.port));
+    }
+    // The coordinator doesn't solve, so it has no indexes to load
+    if(!m_Options.shards.isEmpty())
+        logOutput("Solving with the shards " + m_Options.shards.join(", "));
+    else if(m_Options.preloadIndexes)
+        m_Solver.preloadIndexes();
+    return true;
+}
+
+void SolverServer::newConnection(QIODevice *socket, bool remote)
+{
+    Client client;
+    client.remote = remote;
+    m_Clients.insert(socket, client);
+    connect(socket, &QIODevice::readyRead, this, [this, socket]()
+    {
+        readClient(socket);
+    });
+}
+
+void SolverServer::readClient(QIODevice *socket)
+{
+    if(!m_Clients.contains(socket))
+        return;
+    m_Clients[socket].buffer.append(socket->readAll());
+    while(true)
+    {
+        // A request or an error can close the connection, and then it is gone from m_Clients
+        auto found = m_Clients.find(socket);
+        if(found == m_Clients.end())
+            return;
+        Client &client = found.value();
+        if(client.imageBytes >= 0)
+        {
+            if(client.buffer.size() < client.imageBytes)
+                return;
+            const QByteArray image = client.buffer.left(client.imageBytes);
+            client.buffer.remove(0, client.imageBytes);
+            const QJsonObject request = client.request;
+            client.request = QJsonObject();
+            client.imageBytes = -1;
+            handleRequest(socket, request, image);
+            continue;
+        }
+
+        const int end = client.buffer.indexOf('\n');
+        if(end < 0)
+        {
+            if(client.buffer.size() > MAX_LINE_BYTES)
+            {
+                replyError(socket, QJsonObject(), "The request has no end of line");
+                socket->close();
+            }
+            return;
+        }
+        const QByteArray line = client.buffer.left(end).trimmed();
+        client.buffer.remove(0, end + 1);
+        if(line.isEmpty())
+            continue;
+
+        QJsonParseError parseError;
+        const QJsonDocument document = QJsonDocument::fromJson(line, &parseError);
+        if(!document.isObject())
+        {
+            replyError(socket, QJsonObject(), "The request is not a JSON object: " + parseError.errorString());
+            continue;
+        }
+        const QJsonObject request = document.object();
+        if(!authenticate(socket, request))
+        {
+            replyError(socket, request, "The request has no valid token");
+            socket->close();
+            return;
+        }
+        const qint64 imageBytes = request.value("imageBytes").toVariant().toLongLong();
+        if(imageBytes > 0)
+        {
+            // The size is checked before the image is read, a connection that sends something else can't be read any further
+            QString error;
+            if(!checkImageBytes(request, imageBytes, error))
+            {
+                replyError(socket, request, error);
+                socket->close();
+                return;
+            }
+            client.request = request;
+            client.imageBytes = imageBytes;
+            continue;
+        }
+        handleRequest(socket, request, QByteArray());
+    }
+}
+
+// The local socket is only open to the user of the server, the connections over TCP have to send the token once
+bool SolverServer::authenticate(QIODevice *socket, const QJsonObject &request)
+{
+    Client &client = m_Clients[socket];
+    if(!client.remote || client.authenticated)
+        return true;
+    // The bytes are all compared, so the time it takes doesn't tell how much of the token was right
+    const QByteArray token = m_Options.token.toUtf8();
+    const QByteArray sent = request.value("token").toString().toUtf8();
+    int difference = token.size() ^ sent.size();
+    for(int i = 0; i < token.size(); i++)
+        difference |= token.at(i) ^ (i < sent.size() ? sent.at(i) : 0);
+    client.authenticated = difference == 0;
+    return client.authenticated;
+}
+
+void SolverServer::handleRequest(QIODevice *socket, const QJsonObject &request, const QByteArray &image)
+{
+    const QString command = request.value("command").toString();
+    if(command == "status")
+    {
+        reply(socket, request, status());
+        return;
+    }
+    if(command != "solve" && command != "extract")
+    {
+        replyError(socket, request, "Unknown command " + command + ", it can be solve, extract or status");
+        return;
+    }
+
+    FITSImage::Statistic stats;
+    stats.width = request.value("width").toInt();
+    stats.height = request.value("height").toInt();
+    stats.channels = request.value("channels").toInt(1);
+    stats.samples_per_channel = static_cast<uint32_t>(stats.width) * stats.height;
+
+    // The stars of a star list were already extracted, so they are solved without the image
+    if(request.contains("stars"))
+    {
+        if(command != "solve" || stats.width <= 0 || stats.height <= 0)
+        {
+            replyError(socket, request, "A list of stars can only be solved, and it needs the width and height of the image");
+            return;
+        }
+        if(!m_Options.shards.isEmpty())
+        {
+            m_RunningJobs++;
+            distribute(socket, request, request, QJsonObject());
+            return;
+        }
+        QList<FITSImage::Star> stars;
+        for(const QJsonValue &value : request.value("stars").toArray())
+        {
+            const QJsonObject json = value.toObject();
+            FITSImage::Star star = {};
+            star.x = json.value("x").toDouble();
+            star.y = json.value("y").toDouble();
+            star.flux = json.value("flux").toDouble();
+            star.mag = json.value("mag").toDouble();
+            stars.append(star);
+        }
+        QString error;
+        if(!configure(request, true, error))
+        {
+            replyError(socket, request, error);
+            return;
+        }
+        QFutureWatcher<StellarSolver::Result> *watcher = new QFutureWatcher<StellarSolver::Result>(this);
+        QPointer<QIODevice> client(socket);
+        connect(watcher, &QFutureWatcher<StellarSolver::Result>::finished, this, [this, watcher, client, request]()
+        {
+            const StellarSolver::Result result = watcher->result();
+            QJsonObject answer;
+            answer["success"] = result.success;
+            if(result.success)
+            {
+                answer["solution"] = solutionToJson(result.solution);
+                if(result.hasWCS)
+                    answer["wcs"] = wcsToJson(result.wcs);
+            }
+            answer["metrics"] = metricsToJson(result.metrics);
+            m_RunningJobs--;
+            m_DoneJobs++;
+            if(client)
+                reply(client, request, answer);
+            watcher->deleteLater();
+        });
+        m_RunningJobs++;
+        watcher->setFuture(m_Solver.solveStarsJob(stats, stars));
+        configure(QJsonObject(), true, error);
+        return;
+    }
+
+    if(!image.isEmpty())
+    {
+        // readClient already checked the size with checkImageBytes
+        qint64 expected = 0;
+        QString error;
+        if(!parseImageStats(request, stats, expected, error))
+        {
+            replyError(socket, request, error);
+            return;
+        }
+        stats.size = image.size();
+        // The copy of the image in the lambda keeps it until the job is done
+        startJob(socket, request, stats, reinterpret_cast<uint8_t const *>(image.constData()), [image]() {});
+        return;
+    }
+
+    const QString fileName = request.value("file").toString();
+    if(fileName.isEmpty())
+    {
+        replyError(socket, request, "The request needs a file, an image or a list of stars");
+        return;
+    }
+    // A program on another computer could otherwise have any file the server can read loaded
+    if(m_Clients.value(socket).remote)
+    {
+        replyError(socket, request, "Files are only read for the requests of the local socket, send the image or the stars instead");
+        return;
+    }
+    // The file is read on another thread, so the requests of the other programs don't wait for it
+    struct LoadedImage
+    {
+        uint8_t *buffer { nullptr };
+        FITSImage::Statistic stats;
+    };
+    QFutureWatcher<LoadedImage> *loading = new QFutureWatcher<LoadedImage>(this);
+    QPointer<QIODevice> client(socket);
+    connect(loading, &QFutureWatcher<LoadedImage>::finished, this, [this, loading, client, request, fileName]()
+    {
+        const LoadedImage loaded = loading->result();
+        loading->deleteLater();
+        if(!loaded.buffer)
+        {
+            if(client)
+                replyError(client, request, "Unable to load the image " + fileName);
+            return;
+        }
+        uint8_t *buffer = loaded.buffer;
+        startJob(client, request, loaded.stats, buffer, [buffer]()
+        {
+            delete[] buffer;
+        });
+    });
+    const StellarSolver::ImageLoader loader = fileio::batchImageLoader();
+    loading->setFuture(QtConcurrent::run([loader, fileName]()
+    {
+        LoadedImage loaded;
+        loaded.buffer = loader(fileName, loaded.stats);
+        return loaded;
+    }));
+}
+
+bool SolverServer::checkImageBytes(const QJsonObject &request, qint64 imageBytes, QString &error) const
+{
+    FITSImage::Statistic stats;
+    qint64 expected = 0;
+    if(!parseImageStats(request, stats, expected, error))
+        return false;
+    if(imageBytes != expected)
+    {
+        error = QString("The image has %1 bytes, but %2 x %3 pixels of %4 channels need %5").arg(imageBytes)
+                .arg(stats.width).arg(stats.height).arg(stats.channels).arg(expected);
+        return false;
+    }
+    const qint64 maxBytes = std::min(m_Options.maxImageBytes, MAX_IMAGE_BYTES);
+    if(imageBytes > maxBytes)
+    {
+        error = QString("The image has %1 bytes, but the server only reads images of up to %2 bytes").arg(imageBytes).arg(maxBytes);
+        return false;
+    }
+    return true;
+}
+
+// This sets the settings of the request on the StellarSolver of the jobs, an empty request sets the ones the server started with
+bool SolverServer::configure(const QJsonObject &request, bool solve, QString &error)
+{
+    const int profiles = StellarSolver::getBuiltInProfiles().count();
+    const int profile = request.value("profile").toInt(solve ? m_Options.solveProfile : m_Options.extractProfile);
+    if(profile < 0 || profile >= profiles)
+    {
+        error = QString("There is no profile %1, the built in profiles are 0 to %2").arg(profile).arg(profiles - 1);
+        return false;
+    }
+    m_Solver.setParameterProfile(static_cast<SSolver::Parameters::ParametersProfile>(profile));
+    m_Solver.setColorChannel(request.value("channel").toInt(m_Options.colorChannel));
+
+    const QJsonObject scale = request.value("scale").toObject();
+    if(scale.isEmpty())
+        m_Solver.clearSearchScale();
+    else
+        m_Solver.setSearchScale(scale.value("low").toDouble(), scale.value("high").toDouble(), scale.value("units").toString("arcsecperpix"));
+    const QJsonObject position = request.value("position").toObject();
+    if(position.isEmpty())
+        m_Solver.clearSearchPosition();
+    else
+        m_Solver.setSearchPositionInDegrees(position.value("ra").toDouble(), position.value("dec").toDouble());
+    return true;
+}
+
+void SolverServer::startJob(QIODevice *socket, const QJsonObject &request, const FITSImage::Statistic &stats, uint8_t const *buffer,
+                            const std::function<void()> &release)
+{
+    const bool solve = request.value("command").toString() == "solve";
+    // The coordinator only extracts the stars, with the settings of the solve, and the shards solve them
+    const bool distributed = solve && !m_Options.shards.isEmpty();
+    QString error;
+    if(!configure(request, solve, error))
+    {
+        release();
+        if(socket)
+            replyError(socket, request, error);
+        return;
+    }
+
+    // The job copies the settings when it starts, so they are set back right away for the next request
+    QFuture<StellarSolver::Result> future = solve && !distributed ? m_Solver.solveJob(stats, buffer) :
+                                            m_Solver.extractJob(stats, buffer, request.value("hfr").toBool());
+    configure(QJsonObject(), true, error);
+
+    QFutureWatcher<StellarSolver::Result> *watcher = new QFutureWatcher<StellarSolver::Result>(this);
+    QPointer<QIODevice> client(socket);
+    connect(watcher, &QFutureWatcher<StellarSolver::Result>::finished, this, [this, watcher, client, request, stats, solve, distributed,
+                                                                                 release]()
+    {
+        const StellarSolver::Result result = watcher->result();
+        release();
+        watcher->deleteLater();
+        if(distributed && result.success)
+        {
+            QJsonObject shardRequest = request;
+            shardRequest.remove("file");
+            shardRequest.remove("imageBytes");
+            shardRequest["width"] = stats.width;
+            shardRequest["height"] = stats.height;
+            QJsonArray stars;
+            for(const FITSImage::Star &star : result.stars)
+            {
+                QJsonObject json;
+                json["x"] = star.x;
+                json["y"] = star.y;
+                json["mag"] = star.mag;
+                json["flux"] = star.flux;
+                stars.append(json);
+            }
+            shardRequest["stars"] = stars;
+            distribute(client, request, shardRequest, metricsToJson(result.metrics));
+            return;
+        }
+        QJsonObject answer;
+        answer["success"] = result.success;
+        if(solve && result.success)
+        {
+            answer["solution"] = solutionToJson(result.solution);
+            if(result.hasWCS)
+                answer["wcs"] = wcsToJson(result.wcs);
+        }
+        QJsonArray stars;
+        for(const FITSImage::Star &star : result.stars)
+            stars.append(starToJson(star, result.hasWCS));
+        answer["stars"] = stars;
+        answer["metrics"] = metricsToJson(result.metrics);
+        m_RunningJobs--;
+        m_DoneJobs++;
+        if(client)
+            reply(client, request, answer);
+    });
+    m_RunningJobs++;
+    watcher->setFuture(future);
+}
+
+// The stars are sent to all of the shards at once, and the reply of the first one that solves them is the reply of the request
+void SolverServer::distribute(QIODevice *socket, const QJsonObject &request, const QJsonObject &shardRequest, const QJsonObject &extractMetrics)
+{
+    QSharedPointer<FanOut> fanOut(new FanOut);
+    fanOut->client = socket;
+    fanOut->request = request;
+    fanOut->extractMetrics = extractMetrics;
+    fanOut->pending = m_Options.shards.count();
+
+    QJsonObject sent = shardRequest;
+    sent.remove("id");
+    sent["token"] = m_Options.token;
+    if(!sent.contains("profile"))
+        sent["profile"] = static_cast<int>(m_Options.solveProfile);
+    const QByteArray line = QJsonDocument(sent).toJson(QJsonDocument::Compact) + '\n';
+
+    for(const QString &shard : m_Options.shards)
+    {
+        // Each shard replies once, or its connection closes without a reply, whichever comes first is counted
+        QSharedPointer<QByteArray> buffer(new QByteArray);
+        QSharedPointer<bool> done(new bool(false));
+        QIODevice *connection = connectToServer(shard, this, [line](QIODevice * device)
+        {
+            device->write(line);
+        }, [this, fanOut, shard, done]()
+        {
+            if(*done)
+                return;
+            *done = true;
+            fanOut->errors.append("Unable to reach " + shard);
+            shardReplied(fanOut, shard, QJsonObject());
+        });
+        connect(connection, &QIODevice::readyRead, this, [this, connection, fanOut, shard, buffer, done]()
+        {
+            buffer->append(connection->readAll());
+            const int end = buffer->indexOf('\n');
+            if(end < 0 || *done)
+                return;
+            *done = true;
+            const QJsonObject answer = QJsonDocument::fromJson(buffer->left(end)).object();
+            if(!answer.value("success").toBool() && answer.contains("error"))
+                fanOut->errors.append(shard + ": " + answer.value("error").toString());
+            shardReplied(fanOut, shard, answer);
+            connection->close();
+        });
+    }
+}
+
+void SolverServer::shardReplied(const QSharedPointer<FanOut> &fanOut, const QString &shard, const QJsonObject &answer)
+{
+    fanOut->pending--;
+    if(fanOut->answered)
+        return;
+    if(answer.value("success").toBool())
+    {
+        // The shards that are still solving finish on their own, their replies are not needed any more
+        fanOut->answered = true;
+        QJsonObject solved = answer;
+        solved["shard"] = shard;
+        if(!fanOut->extractMetrics.isEmpty())
+            solved["extractMetrics"] = fanOut->extractMetrics;
+        m_RunningJobs--;
+        m_DoneJobs++;
+        if(fanOut->client)
+            reply(fanOut->client, fanOut->request, solved);
+        return;
+    }
+    if(fanOut->pending > 0)
+        return;
+    fanOut->answered = true;
+    m_RunningJobs--;
+    m_DoneJobs++;
+    if(fanOut->client)
+    {
+        QJsonObject failed;
+        failed["success"] = false;
+        if(!fanOut->errors.isEmpty())
+            failed["error"] = fanOut->errors.join("; ");
+        if(!fanOut->extractMetrics.isEmpty())
+            failed["extractMetrics"] = fanOut->extractMetrics;
+        reply(fanOut->client, fanOut->request, failed);
+    }
+}
+
+void SolverServer::reply(QIODevice *socket, const QJsonObject &request, QJsonObject answer)
+{
+    if(request.contains("id"))
+        answer["id"] = request.value("id");
+    socket->write(QJsonDocument(answer).toJson(QJsonDocument::Compact) + '\n');
+}
+
+void SolverServer::replyError(QIODevice *socket, const QJsonObject &request, const QString &error)
+{
+    QJsonObject answer;
+    answer["success"] = false;
+    answer["error"] = error;
+    reply(socket, request, answer);
+}
+
+QJsonObject SolverServer::status() const
+{
+    const FITSImage::MemoryUsage memory = m_Solver.getMemoryUsage();
+    QJsonObject json;
+    json["success"] = true;
+    json["version"] = StellarSolver::getVersionNumber();
+    json["preloadingIndexes"] = m_Solver.isPreloadingIndexes();
+    json["indexBytes"] = memory.indexBytes;
+    json["totalBytes"] = memory.totalBytes;
+    json["runningJobs"] = m_RunningJobs;
+    json["doneJobs"] = m_DoneJobs;
+    json["clients"] = m_Clients.count();
+    if(m_IndexFiles > 0)
+        json["indexFiles"] = m_IndexFiles;
+    if(!m_Options.shards.isEmpty())
+        json["shards"] = QJsonArray::fromStringList(m_Options.shards);
+    return json;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+    QCoreApplication::setApplicationName("StellarSolverServer");
+    QCoreApplication::setApplicationVersion(StellarSolver::getVersionNumber());
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Keeps the index files loaded and plate solves and extracts the stars of the images that other programs "
+                                     "send it over a local socket, so they share one copy of the indexes.  Several of them can also solve together, "
+                                     "each with some of the indexes, when all of them don't fit in the memory of one computer.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption indexOption(QStringList() << "I" << "index", "Add a directory of index files, the default ones are used if there are none.", "directory");
+    QCommandLineOption nameOption(QStringList() << "n" << "name", "The name of the local socket, stellarsolver by default.", "name", "stellarsolver");
+    QCommandLineOption solveProfileOption("solve-profile", "The number of the built in profile to solve with, 3 by default.", "profile", "3");
+    QCommandLineOption portOption(QStringList() << "p" << "port", "Also listen on this TCP port, for the shards of a coordinator and programs on other computers.", "port");
+    QCommandLineOption bindOption("bind", "The address the TCP port listens on, 127.0.0.1 by default, 0.0.0.0 for all of them.", "address", "127.0.0.1");
+    QCommandLineOption tokenOption("token", "The token the requests over TCP have to send, and that is sent to the shards.  "
+                                   "It can also be set with STELLARSOLVER_SERVER_TOKEN, which other users can't see.", "token");
+    QCommandLineOption seriesOption("series", "Only serve the index series of this list, like 4107,4110-4119, so this server is a shard.", "numbers");
+    QCommandLineOption healpixOption("healpix", "Only serve the healpixes of this list of the series that are split up by healpix, like 0-11.", "numbers");
+    QCommandLineOption shardOption("shard", "Solve on this shard instead of solving here, host:port or the name of a local server, it can be given more than once.", "address");
+    QCommandLineOption extractProfileOption("extract-profile", "The number of the built in profile to extract the stars with, 4 by default.", "profile", "4");
+    QCommandLineOption channelOption("channel", "The color channel of RGB images: 0 red, 1 green, 2 blue, 3 average, 4 integrated.", "channel", "1");
+    QCommandLineOption maxImageOption("max-image-size", "The largest raw image a request can send, in megabytes, 1024 by default.", "megabytes", "1024");
+    QCommandLineOption noPreloadOption("no-preload", "Load the index files when the first image is solved instead of when the server starts.");
+    QCommandLineOption quantizeOption("quantize", "Keep the codes of the index files in memory as 16 bit integers, a quarter of the memory of the doubles.");
+    QCommandLineOption hardwareEventsOption("hardware-events", "Count the CPU cycles, instructions, cache misses and branch misses of the stages in the metrics, on Linux.");
+    QCommandLineOption quietOption(QStringList() << "q" << "quiet", "Don't print the log.");
+    parser.addOptions(QList<QCommandLineOption>() << indexOption << nameOption << portOption << bindOption << tokenOption << seriesOption << healpixOption << shardOption
+                      << solveProfileOption << extractProfileOption << channelOption << maxImageOption << noPreloadOption << quantizeOption
+                      << hardwareEventsOption << quietOption);
+    parser.process(app);
+
+    ServerOptions options;
+    options.serverName = parser.value(nameOption);
+    options.port = parser.value(portOption).toUShort();
+    options.bindAddress = parser.value(bindOption);
+    options.token = parser.isSet(tokenOption) ? parser.value(tokenOption) : QString::fromLocal8Bit(qgetenv("STELLARSOLVER_SERVER_TOKEN"));
+    if(!parseRanges(parser.value(seriesOption), options.indexSeries) || !parseRanges(parser.value(healpixOption), options.healpixes))
+    {
+        fprintf(stderr, "The series and healpixes should be lists of numbers and ranges like 4107,4110-4119\n");
+        return 1;
+    }
+    options.shards = parser.values(shardOption);
+    options.indexFolderPaths = parser.values(indexOption);
+    if(options.indexFolderPaths.isEmpty())
+        options.indexFolderPaths = StellarSolver::getDefaultIndexFolderPaths();
+    const int profiles = StellarSolver::getBuiltInProfiles().count();
+    options.solveProfile = (SSolver::Parameters::ParametersProfile) qBound(0, parser.value(solveProfileOption).toInt(), profiles - 1);
+    options.extractProfile = (SSolver::Parameters::ParametersProfile) qBound(0, parser.value(extractProfileOption).toInt(), profiles - 1);
+    options.colorChannel = parser.value(channelOption).toInt();
+    options.maxImageBytes = parser.value(maxImageOption).toLongLong() * 1024 * 1024;
+    options.preloadIndexes = !parser.isSet(noPreloadOption);
+    options.quantizeIndexes = parser.isSet(quantizeOption);
+    options.countHardwareEvents = parser.isSet(hardwareEventsOption);
+    options.quiet = parser.isSet(quietOption);
+
+    SolverServer server(options);
+    if(!server.listen())
+        return 1;
+    return app.exec();
+}
@@ -0,0 +1,112 @@
+#ifndef SOLVERSERVER_H
+#define SOLVERSERVER_H
+
+#include <QObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QPointer>
+#include <QHash>
+#include <QSet>
+#include <QSharedPointer>
+#include "stellarsolver.h"
+
+// These are the settings the server starts with, each request can change the profile, the scale and the position for itself
+typedef struct ServerOptions
+{
+    QString serverName = "stellarsolver";
+    quint16 port = 0;                       // The TCP port for the programs and coordinators on other computers, 0 to only listen locally
+    QString bindAddress = "127.0.0.1";      // The address the TCP port listens on, only this computer by default
+    QString token;                          // The shared secret that the requests over TCP have to send, and that is sent to the shards
+    QStringList indexFolderPaths;
+    QSet<int> indexSeries;                  // The index numbers to serve, for instance 4107 or 5206, all of them if it is empty
+    QSet<int> healpixes;                    // The healpixes of the indexes that are split up by healpix to serve, all of them if it is empty
+    QStringList shards;                     // The servers to solve on, host:port or the name of a local server, it solves itself if it is empty
+    SSolver::Parameters::ParametersProfile solveProfile = SSolver::Parameters::PARALLEL_SMALLSCALE;
+    SSolver::Parameters::ParametersProfile extractProfile = SSolver::Parameters::ALL_STARS;
+    int colorChannel = FITSImage::GREEN;
+    qint64 maxImageBytes = 1024LL * 1024 * 1024;    // The largest raw image a request can send, a connection that announces more is closed
+    bool preloadIndexes = true;
+    bool quantizeIndexes = false;           // Whether the codes of the indexes are kept in memory as 16 bit integers, see IndexCatalog::setQuantizeIndexes
+    bool countHardwareEvents = false;       // Whether the metrics of the replies have the hardware events, see StellarSolver::setCountHardwareEvents
+    bool quiet = false;
+
+} ServerOptions;
+
+/**
+ * @brief The SolverServer class solves and extracts the stars of the images that other programs send it over a local socket,
+ * so the programs of one observatory PC share one copy of the index files, which stays loaded, and one SolverThreadPool.
+ * Each request is a line of JSON, followed by the raw image if it sends one, and each reply is a line of JSON with the same id.
+ * The requests are done as jobs of one StellarSolver, see StellarSolver::solveJob, so several of them run at the same time
+ * and their replies can come back in another order than the requests.
+ *
+ * Several servers can also solve together when the indexes don't fit in the memory of one computer.  Each shard serves some of the
+ * index series or healpixes over TCP, and the coordinator, which has the shards, extracts the stars of an image and sends the list of
+ * them to all of the shards at once.  Each shard solves the stars with its own indexes, and the first one that solves them wins.
+ * The connections over TCP have to send the token of the server, see authenticate, and only have images and stars solved, not files.
+ */
+class SolverServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SolverServer(const ServerOptions &options, QObject *parent = nullptr);
+
+    /**
+     * @brief listen starts accepting connections on the local socket of the server name and on the TCP port, and preloads the index files
+     * @return false if the socket could not be opened
+     */
+    bool listen();
+
+public slots:
+    void logOutput(QString text);
+
+private:
+    // This is what is known about a connection while the lines and the images of its requests are read
+    struct Client
+    {
+        QByteArray buffer;
+        QJsonObject request;        // The request whose image is still being read
+        qint64 imageBytes = -1;     // The size of that image, -1 if no image is being read
+        bool remote = false;        // Whether it came over TCP, so it has to send the token and can't have files read
+        bool authenticated = false; // Whether it sent the token
+    };
+
+    // This is a solve that the coordinator sent to all of the shards, which waits for the first one of them that solves it
+    struct FanOut
+    {
+        QPointer<QIODevice> client;
+        QJsonObject request;
+        QJsonObject extractMetrics;     // The metrics of the star extraction of the coordinator, if it extracted the stars
+        int pending = 0;                // The shards that haven't replied yet
+        bool answered = false;
+        QStringList errors;
+    };
+
+    void newConnection(QIODevice *socket, bool remote);
+    void readClient(QIODevice *socket);
+    bool authenticate(QIODevice *socket, const QJsonObject &request);
+    void handleRequest(QIODevice *socket, const QJsonObject &request, const QByteArray &image);
+    bool checkImageBytes(const QJsonObject &request, qint64 imageBytes, QString &error) const;
+    bool configure(const QJsonObject &request, bool solve, QString &error);
+    void startJob(QIODevice *socket, const QJsonObject &request, const FITSImage::Statistic &stats, uint8_t const *buffer,
+                  const std::function<void()> &release);
+    void distribute(QIODevice *socket, const QJsonObject &request, const QJsonObject &shardRequest, const QJsonObject &extractMetrics);
+    void shardReplied(const QSharedPointer<FanOut> &fanOut, const QString &shard, const QJsonObject &answer);
+    void reply(QIODevice *socket, const QJsonObject &request, QJsonObject answer);
+    void replyError(QIODevice *socket, const QJsonObject &request, const QString &error);
+    QJsonObject status() const;
+
+    ServerOptions m_Options;
+    QLocalServer m_Server;
+    QTcpServer m_TcpServer;
+    StellarSolver m_Solver;                 // The settings of the jobs, with the IndexCatalog and the SolverThreadPool they share
+    int m_IndexFiles = 0;                   // The number of index files this server serves, if it only serves some of them
+    QHash<QIODevice *, Client> m_Clients;
+    int m_RunningJobs = 0;
+    int m_DoneJobs = 0;
+};
+
+#endif // SOLVERSERVER_H
@@ -51,6 +51,14 @@ MainWindow::MainWindow() :
     this->show();
 
     //The Options at the top of the Window
+    connect(&refinedImageWatcher, &QFutureWatcher<QImage>::finished, this, [this]()
+    {
+        if(refinedImageWatcher.future().isResultReadyAt(0))
+        {
+            rawImage = refinedImageWatcher.result();
+            updateImage();
+        }
+    });
     connect(ui->ImageLoad, &QAbstractButton::clicked, this, &MainWindow::imageLoad );
     ui->ImageLoad->setToolTip("Loads an Image into the Viewer");
     connect(ui->ImageSave, &QAbstractButton::clicked, this, &MainWindow::imageSave );
@@ -207,6 +215,8 @@ MainWindow::MainWindow() :
     ui->openTemp->setToolTip("Opens the directory (above) to where the external solvers save their files");
     ui->wcsPath->setToolTip("The path to wcsinfo for the external Astrometry.net");
     ui->cleanupTemp->setToolTip("This option allows the program to clean up temporary files created when running various processes");
+    ui->warmDatabases->setToolTip("This keeps the index files of the local astrometry.net solver and the star databases of ASTAP mapped in memory between solves, so they don't get read from the disk again for every image");
+    ui->memoryTempFiles->setToolTip("This puts the temporary files of the external programs on a RAM disk such as /dev/shm if there is one with enough space, instead of in the Temp Path");
     ui->generateAstrometryConfig->setToolTip("Determines whether to generate an astrometry.cfg file based on the options in the options panel or to use the external config file above.");
     ui->onlineServer->setToolTip("This is the server that StellarSolver will use for the Online solves.  This will typically be nova.astrometry.net, but it could also be an ANSVR server or a custom one.");
     ui->apiKey->setToolTip("This is the api key used for astrometry.net online.  You can enter your own and then have access to your solves later.");
@@ -238,6 +248,9 @@ MainWindow::MainWindow() :
     ui->kron_fact->setToolTip("This sets the Kron Factor for use with the kron radius for flux calculations.");
     ui->subpix->setToolTip("The subpix setting.  The instructions say to make it 5");
     ui->r_min->setToolTip("The minimum radius for stars for flux calculations.");
+    ui->psfModel->setToolTip("This fits a Gaussian or Moffat profile to the stars for their HFR and shape, instead of measuring the HFR from the growth of their flux.");
+    ui->windowedCentroids->setToolTip("This gives the stars windowed centroids, which are more precise positions, and skips the aperture photometry.");
+    ui->apertureMaskBuckets->setToolTip("If it is more than 0, the circular apertures reuse weight masks for stars whose centers are in the same 1/buckets of a pixel.  This is faster, but the fluxes are approximate.");
     //no inflags???;
     ui->magzero->setToolTip("This is the 'zero' magnitude used for settting the magnitude scale for the stars in the image during star extraction.");
     ui->minarea->setToolTip("This is the minimum area in pixels for a star detection, smaller stars are ignored.");
@@ -245,6 +258,9 @@ MainWindow::MainWindow() :
     ui->thresh_offset->setToolTip("Add this offset to the detection threshold");
     ui->deblend_thresh->setToolTip("The number of thresholds the intensity range is divided up into");
     ui->deblend_contrast->setToolTip("The percentage of flux a separate peak must # have to be considered a separate object");
+    ui->deblend_min_pixels->setToolTip("When solving, only deblend the objects with at least this many pixels or the elongation below, 0 means no limit");
+    ui->deblend_min_elongation->setToolTip("When solving, only deblend the objects at least this elongated (a/b) or with the pixels above, 0 means no limit");
+    ui->deblend_time_limit->setToolTip("When solving, stop deblending after this many milliseconds of deblending in an image, 0 means no limit");
 
     ui->cleanCheckBox->setToolTip("Attempts to 'clean' the image to remove artifacts caused by bright objects");
     ui->clean_param->setToolTip("The cleaning parameter, not sure what it does.");
@@ -256,6 +272,9 @@ MainWindow::MainWindow() :
     ui->showConv->setToolTip("Loads the convolution filter into a window for viewing");
 
     ui->partition->setToolTip("Whether or not to partition the image during SEP operations for Internal SEP.  This can greatly speed up star extraction, but at the cost of possibly missing some objects.  For solving, Focusing, and guiding operations, this doesn't matter, but for doing science, you might want to turn it off.");
+    ui->globalBackground->setToolTip("Whether or not to compute the background once for the whole image and share it with all of the partitions, so they all use the same background and extraction threshold.");
+    ui->useGPU->setToolTip("The image is convolved with the filter, and the codes of the larger index files are searched for, on the GPU with OpenCL, if StellarSolver was built with it and there is a GPU.");
+    ui->backgroundSampling->setToolTip("The background is estimated from every Nth pixel of every Nth line.  1 uses every pixel, larger steps are much faster on large images, and the rows where the samples aren't enough use every pixel.");
 
     connect(ui->showConv,&QPushButton::clicked,this,[this](){
         if(!convInspector)
@@ -289,6 +308,7 @@ MainWindow::MainWindow() :
     ui->minSize->setToolTip("This is the minimum diameter of stars to include in pixels");
     ui->maxEllipse->setToolTip("Stars are typically round, this filter divides stars' semi major and minor axes and rejects stars with distorted shapes greater than this number (1 is perfectly round)");
     ui->initialKeep->setToolTip("Keep just this number of stars in the list based upon star size.  They will be the biggest in the list.  If there are less than this number, they will all be kept.  This filter is primarily for HFR operations, so they take less time.");
+    ui->globalKeep->setToolTip("Whether or not to keep the InitialKeep biggest stars of the whole image, instead of splitting InitialKeep evenly between the partitions.  Photometry is skipped for stars that are too small to make it, so this is faster on dense fields.");
     ui->keepNum->setToolTip("Keep just this number of star in the list based on magnitude.  They will be the brightest in the list.  If there are less than this number, they will all be kept.  This filter is mainly for the solver, so that it takes less time.");
     ui->brightestPercent->setToolTip("Removes the brightest % of stars from the image");
     ui->dimmestPercent->setToolTip("Removes the dimmest % of stars from the image");
@@ -297,7 +317,10 @@ MainWindow::MainWindow() :
     //Astrometry Settings
     ui->inParallel->setToolTip("Loads the Astrometry index files in parallel.  This can speed it up, but uses more resources");
     ui->multiAlgo->setToolTip("Allows solving in multiple threads or multiple cores with several algorithms");
+    ui->threadPlacement->setToolTip("Whether to pin the threads of a parallel solve to single cores or to the cores of one NUMA node each");
     ui->solverTimeLimit->setToolTip("This is the maximum time the Astrometry.net solver should spend on the image before giving up");
+    ui->externalExtractorTimeLimit->setToolTip("This is the maximum time in seconds the external SExtractor may run before it is stopped");
+    ui->solverTimeLimitMS->setToolTip("If this is more than 0, it replaces MaxTime with a wall clock limit in milliseconds, for solves that must finish in under a second");
     ui->minWidth->setToolTip("Sets a the minimum degree limit in the scales for Astrometry to search if the scale parameter isn't set");
     ui->maxWidth->setToolTip("Sets a the maximum degree limit in the scales for Astrometry to search if the scale parameter isn't set");
 
@@ -306,7 +329,10 @@ MainWindow::MainWindow() :
         ui->resortQT->setChecked(ui->resort->isChecked());
     });
     ui->autoDown->setToolTip("This determines whether to automatically downsample or use the parameter below.");
+    ui->adaptiveDownsample->setToolTip("This chooses the automatic downsample from the size of the stars and how many there are, instead of from the size of the image.");
     ui->downsample->setToolTip("This downsamples or bins the image to hopefully make it solve faster.");
+    ui->pipelineSolve->setToolTip("This starts solving with the brightest stars of the first partitions while the rest of the image is still being extracted.");
+    ui->downsampleView->setToolTip("This bins the image while it is converted for the star extraction, instead of making a downsampled image, and reports the stars in full resolution pixels.");
     ui->resort->setToolTip("This resorts the stars based on magnitude. It usually makes it solve faster.");
     ui->use_scale->setToolTip("Whether or not to use the estimated image scale below to try to speed up the solve");
     ui->scale_low->setToolTip("The minimum size for the estimated image scale");
@@ -337,6 +363,8 @@ MainWindow::MainWindow() :
     ui->oddsToKeep->setToolTip("The Astrometry oddsToKeep Parameter.  This may need to be changed or removed");
     ui->oddsToSolve->setToolTip("The Astrometry oddsToSolve Parameter.  This may need to be changed or removed");
     ui->oddsToTune->setToolTip("The Astrometry oddsToTune Parameter.  This may need to be changed or removed");
+    ui->tweakTimeLimit->setToolTip("The time in milliseconds after which the refinement of a solution stops fitting higher SIP orders, 0 means no limit");
+    ui->tweakMinImprovement->setToolTip("The refinement of a solution moves on once an iteration improves the residual of the matched stars by less than this fraction, 0 means it does all of the iterations");
 
     ui->logToFile->setToolTip("Whether the stellarsolver should just output to the log window or whether it should log to a file.");
     ui->logFileName->setToolTip("The name and path of the file to log to, if this is blank, it will automatically log to a file in the temp Directory with an automatically generated name.");
@@ -396,9 +424,14 @@ MainWindow::MainWindow() :
 
     //Behaviors and Settings for the StarTable
     connect(this, &MainWindow::readyForStarTable, this, &MainWindow::displayTable);
+    starTableModel = new StarTableModel(this);
+    ui->starTable->setModel(starTableModel);
     ui->starTable->setSelectionBehavior(QAbstractItemView::SelectRows);
-    connect(ui->starTable, &QTableWidget::itemSelectionChanged, this, &MainWindow::starClickedInTable);
+    ui->starTable->setSortingEnabled(true);
+    connect(ui->starTable->selectionModel(), &QItemSelectionModel::selectionChanged, this, &MainWindow::starClickedInTable);
     ui->starTable->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeToContents);
+    //The rows all have the same height, so the view doesn't measure them
+    ui->starTable->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
     connect(ui->exportStarTable, &QAbstractButton::clicked, this, &MainWindow::saveStarTable);
     ui->showStars->setToolTip("This toggles the stars circles on and off in the image");
     connect(ui->starOptions, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &MainWindow::updateImage);
@@ -420,6 +453,10 @@ MainWindow::MainWindow() :
     connect(ui->Image, &ImageLabel::mouseMoved, this, &MainWindow::mouseMovedOverImage);
     connect(ui->Image, &ImageLabel::mouseClicked, this, &MainWindow::mouseClickedInImage);
     connect(ui->Image, &ImageLabel::mouseDown, this, &MainWindow::mousePressedInImage);
+    ui->Image->setRenderer([this](QPainter & painter, const QRect & exposed)
+    {
+        drawImage(painter, exposed);
+    });
 
     //Behavior and settings for the Results Table
     setupResultsTable();
@@ -487,6 +524,8 @@ MainWindow::MainWindow() :
     ui->watneyPath->setText(programSettings.value("watneyBinaryPath", paths.watneyBinaryPath).toString());
     ui->wcsPath->setText(programSettings.value("wcsPath", paths.wcsPath).toString());
     ui->cleanupTemp->setChecked(programSettings.value("cleanupTemporaryFiles", extTemp.cleanupTemporaryFiles).toBool());
+    ui->memoryTempFiles->setChecked(programSettings.value("memoryTemporaryFiles", false).toBool());
+    ui->warmDatabases->setChecked(programSettings.value("warmExternalDatabases", false).toBool());
     ui->generateAstrometryConfig->setChecked(programSettings.value("autoGenerateAstroConfig",
             extTemp.autoGenerateAstroConfig).toBool());
     ui->onlineServer->setText(programSettings.value("onlineServer", "http://nova.astrometry.net").toString());
@@ -608,18 +647,17 @@ void MainWindow::loadOptionsProfile()
 MainWindow::~MainWindow()
 {
     delete ui;
+    refinedImageWatcher.waitForFinished();
     if(m_ImageBuffer)
-        delete[] m_ImageBuffer;
+        fileio::releaseImageBuffer(m_ImageBuffer);
 }
 
 //This method clears the stars and star displays
 void MainWindow::clearStars()
 {
-    ui->starTable->clearContents();
-    ui->starTable->setRowCount(0);
-    ui->starTable->setColumnCount(0);
     selectedStar = 0;
     stars.clear();
+    starTableModel->setStars(stars, false, false);
     updateImage();
 }
 
@@ -765,8 +803,8 @@ bool MainWindow::prepareForProcesses()
 //I wrote this method to display the table after star extraction has occured.
 void MainWindow::displayTable()
 {
-    sortStars();
     updateStarTableFromList();
+    sortStars();
 
     if(ui->horSplitter->sizes().size() - 1 < 10)
         ui->horSplitter->setSizes(QList<int>() << ui->optionsBox->width() << ui->horSplitter->width() / 2 << 200 );
@@ -966,6 +1004,8 @@ void MainWindow::setupExternalExtractorSolverIfNeeded()
     stellarSolver.setProperty("FileToProcess", fileToProcess);
     stellarSolver.setProperty("BasePath", ui->basePath->text());
     stellarSolver.setProperty("CleanupTemporaryFiles", ui->cleanupTemp->isChecked());
+    stellarSolver.setProperty("UseMemoryTempFiles", ui->memoryTempFiles->isChecked());
+    stellarSolver.setProperty("WarmExternalDatabases", ui->warmDatabases->isChecked());
     stellarSolver.setProperty("AutoGenerateAstroConfig", ui->generateAstrometryConfig->isChecked());
 
     // External File Paths
@@ -1023,6 +1063,9 @@ SSolver::Parameters MainWindow::getSettingsFromUI()
     params.kron_fact = ui->kron_fact->text().toDouble();
     params.subpix = ui->subpix->text().toInt() ;
     params.r_min = ui->r_min->text().toFloat();
+    params.apertureMaskBuckets = ui->apertureMaskBuckets->text().toInt();
+    params.windowedCentroids = ui->windowedCentroids->isChecked();
+    params.psfModel = (SSolver::PSFModelType) ui->psfModel->currentIndex();
     //params.inflags
     params.magzero = ui->magzero->text().toFloat();
     params.minarea = ui->minarea->text().toFloat();
@@ -1030,11 +1073,17 @@ SSolver::Parameters MainWindow::getSettingsFromUI()
     params.threshold_offset = ui->thresh_offset->text().toFloat();
     params.deblend_thresh = ui->deblend_thresh->text().toInt();
     params.deblend_contrast = ui->deblend_contrast->text().toFloat();
+    params.deblend_min_pixels = ui->deblend_min_pixels->text().toInt();
+    params.deblend_min_elongation = ui->deblend_min_elongation->text().toDouble();
+    params.deblend_time_limit = ui->deblend_time_limit->text().toDouble();
     params.clean = (ui->cleanCheckBox->isChecked()) ? 1 : 0;
     params.clean_param = ui->clean_param->text().toDouble();
     params.convFilterType = (SSolver::ConvFilterType)ui->convFilterType->currentIndex();
     params.fwhm = ui->fwhm->text().toInt();
     params.partition = ui->partition->isChecked();
+    params.globalBackground = ui->globalBackground->isChecked();
+    params.backgroundSampling = ui->backgroundSampling->text().toInt();
+    params.useGPU = ui->useGPU->isChecked();
 
     //Star Filter Settings
     params.resort = ui->resort->isChecked();
@@ -1042,6 +1091,7 @@ SSolver::Parameters MainWindow::getSettingsFromUI()
     params.minSize = ui->minSize->text().toDouble();
     params.maxEllipse = ui->maxEllipse->text().toDouble();
     params.initialKeep = ui->initialKeep->text().toInt();
+    params.globalKeep = ui->globalKeep->isChecked();
     params.keepNum = ui->keepNum->text().toInt();
     params.removeBrightest = ui->brightestPercent->text().toDouble();
     params.removeDimmest = ui->dimmestPercent->text().toDouble();
@@ -1053,11 +1103,17 @@ SSolver::Parameters MainWindow::getSettingsFromUI()
     params.minwidth = ui->minWidth->text().toDouble();
     params.inParallel = ui->inParallel->isChecked();
     params.multiAlgorithm = (SSolver::MultiAlgo)ui->multiAlgo->currentIndex();
+    params.threadPlacement = (SSolver::ThreadPlacement)ui->threadPlacement->currentIndex();
     params.solverTimeLimit = ui->solverTimeLimit->text().toInt();
+    params.solverTimeLimitMS = ui->solverTimeLimitMS->text().toInt();
+    params.externalExtractorTimeLimit = ui->externalExtractorTimeLimit->text().toInt();
 
     params.resort = ui->resort->isChecked();
     params.autoDownsample = ui->autoDown->isChecked();
+    params.adaptiveDownsample = ui->adaptiveDownsample->isChecked();
     params.downsample = ui->downsample->value();
+    params.downsampleView = ui->downsampleView->isChecked();
+    params.pipelineSolve = ui->pipelineSolve->isChecked();
     params.search_radius = ui->radius->text().toDouble();
 
     //Setting the settings to know when to stop or keep searching for solutions
@@ -1065,6 +1121,10 @@ SSolver::Parameters MainWindow::getSettingsFromUI()
     params.logratio_totune = ui->oddsToTune->text().toDouble();
     params.logratio_tosolve = ui->oddsToSolve->text().toDouble();
 
+    //Setting the limits of the refinement of the solution
+    params.tweak_time_limit = ui->tweakTimeLimit->text().toDouble();
+    params.tweak_min_improvement = ui->tweakMinImprovement->text().toDouble();
+
     return params;
 }
 
@@ -1079,6 +1139,9 @@ void MainWindow::sendSettingsToUI(SSolver::Parameters a)
     ui->kron_fact->setText(QString::number(a.kron_fact));
     ui->subpix->setText(QString::number(a.subpix));
     ui->r_min->setText(QString::number(a.r_min));
+    ui->apertureMaskBuckets->setText(QString::number(a.apertureMaskBuckets));
+    ui->windowedCentroids->setChecked(a.windowedCentroids);
+    ui->psfModel->setCurrentIndex(a.psfModel);
 
     ui->magzero->setText(QString::number(a.magzero));
     ui->minarea->setText(QString::number(a.minarea));
@@ -1086,12 +1149,18 @@ void MainWindow::sendSettingsToUI(SSolver::Parameters a)
     ui->thresh_offset->setText(QString::number(a.threshold_offset));
     ui->deblend_thresh->setText(QString::number(a.deblend_thresh));
     ui->deblend_contrast->setText(QString::number(a.deblend_contrast));
+    ui->deblend_min_pixels->setText(QString::number(a.deblend_min_pixels));
+    ui->deblend_min_elongation->setText(QString::number(a.deblend_min_elongation));
+    ui->deblend_time_limit->setText(QString::number(a.deblend_time_limit));
     ui->cleanCheckBox->setChecked(a.clean == 1);
     ui->clean_param->setText(QString::number(a.clean_param));
     ui->convFilterType->setCurrentIndex(a.convFilterType);
     connect(ui->convFilterType, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &MainWindow::settingJustChanged);
     ui->fwhm->setValue(a.fwhm);
     ui->partition->setChecked(a.partition);
+    ui->globalBackground->setChecked(a.globalBackground);
+    ui->backgroundSampling->setText(QString::number(a.backgroundSampling));
+    ui->useGPU->setChecked(a.useGPU);
 
     //Star Filter Settings
 
@@ -1099,6 +1168,7 @@ void MainWindow::sendSettingsToUI(SSolver::Parameters a)
     ui->minSize->setText(QString::number(a.minSize));
     ui->maxEllipse->setText(QString::number(a.maxEllipse));
     ui->initialKeep->setText(QString::number(a.initialKeep));
+    ui->globalKeep->setChecked(a.globalKeep);
     ui->keepNum->setText(QString::number(a.keepNum));
     ui->brightestPercent->setText(QString::number(a.removeBrightest));
     ui->dimmestPercent->setText(QString::number(a.removeDimmest));
@@ -1107,10 +1177,16 @@ void MainWindow::sendSettingsToUI(SSolver::Parameters a)
     //Astrometry Settings
 
     ui->autoDown->setChecked(a.autoDownsample);
+    ui->adaptiveDownsample->setChecked(a.adaptiveDownsample);
     ui->downsample->setValue(a.downsample);
+    ui->downsampleView->setChecked(a.downsampleView);
+    ui->pipelineSolve->setChecked(a.pipelineSolve);
     ui->inParallel->setChecked(a.inParallel);
     ui->multiAlgo->setCurrentIndex(a.multiAlgorithm);
+    ui->threadPlacement->setCurrentIndex(a.threadPlacement);
     ui->solverTimeLimit->setText(QString::number(a.solverTimeLimit));
+    ui->solverTimeLimitMS->setText(QString::number(a.solverTimeLimitMS));
+    ui->externalExtractorTimeLimit->setText(QString::number(a.externalExtractorTimeLimit));
     ui->minWidth->setText(QString::number(a.minwidth));
     ui->maxWidth->setText(QString::number(a.maxwidth));
     ui->radius->setText(QString::number(a.search_radius));
@@ -1121,6 +1197,10 @@ void MainWindow::sendSettingsToUI(SSolver::Parameters a)
     ui->oddsToKeep->setText(QString::number(a.logratio_tokeep));
     ui->oddsToSolve->setText(QString::number(a.logratio_tosolve));
     ui->oddsToTune->setText(QString::number(a.logratio_totune));
+
+    //Astrometry Tweak Settings
+    ui->tweakTimeLimit->setText(QString::number(a.tweak_time_limit));
+    ui->tweakMinImprovement->setText(QString::number(a.tweak_min_improvement));
 }
 
 
@@ -1318,6 +1398,7 @@ bool MainWindow::imageLoad()
 
     fileio imageLoader;
     imageLoader.logToSignal = true;
+    imageLoader.progressivePreview = true;
     connect(&imageLoader, &fileio::logOutput, this, &MainWindow::logOutput);
 
     if(imageLoader.loadImage(fileToProcess))
@@ -1355,6 +1436,7 @@ bool MainWindow::imageLoad()
         ui->fileNameDisplay->setText("Image: " + fileURL);
         rawImage = imageLoader.getRawQImage();
         autoScale();
+        refinedImageWatcher.setFuture(imageLoader.getRefinedQImage());
         hasWCSData = false;
         stellarSolver.loadNewImageBuffer(stats, m_ImageBuffer);
         return true;
@@ -1488,9 +1570,8 @@ void MainWindow::autoScale()
 }
 
 
-//This method is intended to get the position and size of the star for rendering purposes
-//It is used to draw circles/ellipses for the stars and to detect when the mouse is over a star
-QRect MainWindow::getStarSizeInImage(FITSImage::Star star, bool &accurate)
+//This method gets the size of the circle/ellipse drawn for the star in the pixels of the image
+QSizeF MainWindow::getStarSize(const FITSImage::Star &star, bool &accurate)
 {
     accurate = true;
     double width = 0;
@@ -1539,11 +1620,18 @@ QRect MainWindow::getStarSizeInImage(FITSImage::Star star, bool &accurate)
             height = 4 * HFR;
             break;
     }
+    return QSizeF(width, height);
+}
 
+//This method is intended to get the position and size of the star for rendering purposes
+//It is used to draw circles/ellipses for the stars and to detect when the mouse is over a star
+QRect MainWindow::getStarSizeInImage(FITSImage::Star star, bool &accurate)
+{
+    const QSizeF size = getStarSize(star, accurate);
     double starx = star.x * currentWidth / stats.width ;
     double stary = star.y * currentHeight / stats.height;
-    double starw = width * currentWidth / stats.width;
-    double starh = height * currentHeight / stats.height;
+    double starw = size.width() * currentWidth / stats.width;
+    double starh = size.height() * currentHeight / stats.height;
     return QRect(starx - starw, stary - starh, starw * 2, starh * 2);
 }
 
@@ -1560,12 +1648,47 @@ void MainWindow::updateImage()
     currentWidth  = static_cast<int> (w * (currentZoom));
     currentHeight = static_cast<int> (h * (currentZoom));
 
-    scaledImage = rawImage.scaled(currentWidth, currentHeight, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-    QPixmap renderedImage = QPixmap::fromImage(scaledImage);
+    //The tiles are only remade when the image changes, like when the stretched preview replaces the quick one
+    if(rawImage.cacheKey() != imageTiles.image().cacheKey())
+        imageTiles.setImage(rawImage);
+    if(!stars.isSharedWith(indexedStars) || indexedStarOption != ui->starOptions->currentIndex())
+        indexStars();
+
+    //The label only asks for the part of the image that is visible in the scroll area, see drawImage
+    ui->Image->setFixedSize(currentWidth, currentHeight);
+    ui->Image->update();
+}
+
+//This builds the grid of the stars, so only the stars near the visible part of the image are drawn or checked under the mouse
+void MainWindow::indexStars()
+{
+    indexedStars = stars;
+    indexedStarOption = ui->starOptions->currentIndex();
+    starGrid.build(stars, stats.width, stats.height);
+    starReach = 0;
+    for(const FITSImage::Star &star : stars)
+    {
+        bool accurate;
+        const QSizeF size = getStarSize(star, accurate);
+        starReach = std::max(starReach, std::max(size.width(), size.height()));
+    }
+}
+
+//This draws the part of the image that is exposed in the label, with the circles for the stars in it
+void MainWindow::drawImage(QPainter &p, const QRect &exposed)
+{
+    if(!imageLoaded || currentWidth <= 0 || currentHeight <= 0)
+        return;
+    imageTiles.draw(p, QSize(currentWidth, currentHeight), exposed);
     if(ui->showStars->isChecked())
     {
-        QPainter p(&renderedImage);
-        for(int starnum = 0 ; starnum < stars.size() ; starnum++)
+        //The stars whose circles can reach into the exposed part, in the pixels of the image, the pens are up to 4 pixels wide on the screen
+        const double scaleX = static_cast<double>(stats.width) / currentWidth;
+        const double scaleY = static_cast<double>(stats.height) / currentHeight;
+        const double reach = starReach + 3 * std::max(scaleX, scaleY) + 1;
+        const QRectF area(exposed.x() * scaleX - reach, exposed.y() * scaleY - reach,
+                          exposed.width() * scaleX + 2 * reach, exposed.height() * scaleY + 2 * reach);
+        for(int starnum : starGrid.find(area))
         {
             FITSImage::Star star = stars.at(starnum);
             bool accurate;
@@ -1612,18 +1735,15 @@ void MainWindow::updateImage()
             double h = subframe.height() * currentHeight / stats.height;
             p.drawRect(QRect(x, y, w, h));
         }
-        p.end();
     }
-
-    ui->Image->setPixmap(renderedImage);
-    ui->Image->setFixedSize(renderedImage.size());
 }
 
 //This method was copied and pasted from Fitsdata in KStars
 //It clears the image buffer out.
 void MainWindow::clearImageBuffers()
 {
-    delete[] m_ImageBuffer;
+    refinedImageWatcher.waitForFinished();
+    fileio::releaseImageBuffer(m_ImageBuffer);
     m_ImageBuffer = nullptr;
 }
 
@@ -1683,7 +1803,10 @@ void MainWindow::mouseMovedOverImage(QPoint location)
         ui->mouseInfo->setText(mouseText);
 
         bool starFound = false;
-        for(int i = 0 ; i < stars.size() ; i ++)
+        const int previousStar = selectedStar;
+        if(!stars.isSharedWith(indexedStars))
+            indexStars();
+        for(int i : starGrid.find(QRectF(x - starReach - 1, y - starReach - 1, 2 * starReach + 2, 2 * starReach + 2)))
         {
             FITSImage::Star star = stars.at(i);
             bool accurate;
@@ -1699,9 +1822,10 @@ void MainWindow::mouseMovedOverImage(QPoint location)
                 QToolTip::showText(QCursor::pos(), text, ui->Image);
                 selectedStar = i;
                 starFound = true;
-                updateImage();
             }
         }
+        if(selectedStar != previousStar)
+            updateImage();
         if(!starFound)
             QToolTip::hideText();
     }
@@ -1768,12 +1892,18 @@ void MainWindow::mouseClickedInImage(QPoint location)
     if(settingSubframe)
         settingSubframe = false;
 
-    for(int i = 0 ; i < stars.size() ; i ++)
+    if(currentWidth <= 0 || currentHeight <= 0)
+        return;
+    if(!stars.isSharedWith(indexedStars))
+        indexStars();
+    const double x = location.x() * static_cast<double>(stats.width) / currentWidth;
+    const double y = location.y() * static_cast<double>(stats.height) / currentHeight;
+    for(int i : starGrid.find(QRectF(x - starReach - 1, y - starReach - 1, 2 * starReach + 2, 2 * starReach + 2)))
     {
         bool accurate;
         QRect starInImage = getStarSizeInImage(stars.at(i), accurate);
-        if(starInImage.contains(location))
-            ui->starTable->selectRow(i);
+        if(starInImage.contains(location) && starTableModel->rowOf(i) >= 0)
+            ui->starTable->selectRow(starTableModel->rowOf(i));
     }
 }
 
@@ -1796,10 +1926,13 @@ void MainWindow::mousePressedInImage(QPoint location)
 //THis method responds to row selections in the table and higlights the star you select in the image
 void MainWindow::starClickedInTable()
 {
-    if(ui->starTable->selectedItems().count() > 0)
+    const QModelIndexList selectedRows = ui->starTable->selectionModel()->selectedRows();
+    if(selectedRows.count() > 0)
     {
-        QTableWidgetItem *currentItem = ui->starTable->selectedItems().first();
-        selectedStar = ui->starTable->row(currentItem);
+        const int starIndex = starTableModel->starAt(selectedRows.first().row());
+        if(starIndex < 0 || starIndex >= stars.size())
+            return;
+        selectedStar = starIndex;
         FITSImage::Star star = stars.at(selectedStar);
         double starx = star.x * currentWidth / stats.width ;
         double stary = star.y * currentHeight / stats.height;
@@ -1808,18 +1941,12 @@ void MainWindow::starClickedInTable()
     }
 }
 
-//This sorts the stars by magnitude for display purposes
+//This sorts the star table by magnitude for display purposes, the table sorts its rows, so the star list stays as it is
 void MainWindow::sortStars()
 {
-    if(stars.size() > 1)
-    {
-        //Note that a star is dimmer when the mag is greater!
-        //We want to sort in decreasing order though!
-        std::sort(stars.begin(), stars.end(), [](const FITSImage::Star & s1, const FITSImage::Star & s2)
-        {
-            return s1.mag < s2.mag;
-        });
-    }
+    //Note that a star is dimmer when the mag is greater!
+    //We want to sort in decreasing order though!
+    ui->starTable->sortByColumn(starTableModel->column(StarTableModel::MAG_AUTO), Qt::AscendingOrder);
 }
 
 //This is a helper function that I wrote for the methods below
@@ -1857,67 +1984,29 @@ bool setItemInColumn(QTableWidget *table, QString colName, QString value)
     return false;
 }
 
-//This copies the stars into the table
+//This shows the stars in the table, the model only makes the cells of the rows that are visible
 void MainWindow::updateStarTableFromList()
 {
-    QTableWidget *table = ui->starTable;
-    table->clearContents();
-    table->setRowCount(0);
-    table->setColumnCount(0);
     selectedStar = 0;
-    addColumnToTable(table, "MAG_AUTO");
-    addColumnToTable(table, "RA (J2000)");
-    addColumnToTable(table, "DEC (J2000)");
-    addColumnToTable(table, "X_IMAGE");
-    addColumnToTable(table, "Y_IMAGE");
-
-
-    addColumnToTable(table, "FLUX_AUTO");
-    addColumnToTable(table, "PEAK");
-    if(hasHFRData)
-        addColumnToTable(table, "HFR");
-
-    addColumnToTable(table, "a");
-    addColumnToTable(table, "b");
-    addColumnToTable(table, "theta");
-
-    for(int i = 0; i < stars.size(); i ++)
-    {
-        table->insertRow(table->rowCount());
-        FITSImage::Star star = stars.at(i);
-
-        setItemInColumn(table, "MAG_AUTO", QString::number(star.mag));
-        setItemInColumn(table, "X_IMAGE", QString::number(star.x));
-        setItemInColumn(table, "Y_IMAGE", QString::number(star.y));
-        if(hasWCSData)
-        {
-            setItemInColumn(table, "RA (J2000)", StellarSolver::raString(star.ra));
-            setItemInColumn(table, "DEC (J2000)", StellarSolver::decString(star.dec));
-        }
-
-        setItemInColumn(table, "FLUX_AUTO", QString::number(star.flux));
-        setItemInColumn(table, "PEAK", QString::number(star.peak));
-        if(hasHFRData)
-            setItemInColumn(table, "HFR", QString::number(star.HFR));
-
-        setItemInColumn(table, "a", QString::number(star.a));
-        setItemInColumn(table, "b", QString::number(star.b));
-        setItemInColumn(table, "theta", QString::number(star.theta));
-    }
+    starTableModel->setStars(stars, hasHFRData, hasWCSData);
     updateHiddenStarTableColumns();
 }
 
 void MainWindow::updateHiddenStarTableColumns()
 {
-    QTableWidget *table = ui->starTable;
-
-    setColumnHidden(table, "FLUX_AUTO", !showFluxInfo);
-    setColumnHidden(table, "PEAK", !showFluxInfo);
-    setColumnHidden(table, "RA (J2000)", !hasWCSData);
-    setColumnHidden(table, "DEC (J2000)", !hasWCSData);
-    setColumnHidden(table, "a", !showStarShapeInfo);
-    setColumnHidden(table, "b", !showStarShapeInfo);
-    setColumnHidden(table, "theta", !showStarShapeInfo);
+    auto setHidden = [this](StarTableModel::Column column, bool hidden)
+    {
+        const int c = starTableModel->column(column);
+        if(c >= 0)
+            ui->starTable->setColumnHidden(c, hidden);
+    };
+    setHidden(StarTableModel::FLUX_AUTO, !showFluxInfo);
+    setHidden(StarTableModel::PEAK, !showFluxInfo);
+    setHidden(StarTableModel::RA, !hasWCSData);
+    setHidden(StarTableModel::DEC, !hasWCSData);
+    setHidden(StarTableModel::A, !showStarShapeInfo);
+    setHidden(StarTableModel::B, !showStarShapeInfo);
+    setHidden(StarTableModel::THETA, !showStarShapeInfo);
 }
 
 
@@ -2202,7 +2291,7 @@ void MainWindow::saveResultsTable()
 //Then the user can analyze the solution information in more detail to try to analyze the stars found or try to perfect star extractor parameters
 void MainWindow::saveStarTable()
 {
-    if (ui->starTable->rowCount() == 0)
+    if (starTableModel->rowCount() == 0)
         return;
 
     QUrl exportFile = QFileDialog::getSaveFileUrl(this, "Export Star Table", dirPath,
@@ -2240,20 +2329,20 @@ void MainWindow::saveStarTable()
 
     QTextStream outstream(&file);
 
-    for (int c = 0; c < ui->starTable->columnCount(); c++)
+    for (int c = 0; c < starTableModel->columnCount(); c++)
     {
-        outstream << ui->starTable->horizontalHeaderItem(c)->text() << ',';
+        outstream << starTableModel->headerData(c, Qt::Horizontal).toString() << ',';
     }
     outstream << "\n";
 
-    for (int r = 0; r < ui->starTable->rowCount(); r++)
+    for (int r = 0; r < starTableModel->rowCount(); r++)
     {
-        for (int c = 0; c < ui->starTable->columnCount(); c++)
+        for (int c = 0; c < starTableModel->columnCount(); c++)
         {
-            QTableWidgetItem *cell = ui->starTable->item(r, c);
+            const QString cell = starTableModel->data(starTableModel->index(r, c)).toString();
 
-            if (cell)
-                outstream << cell->text() << ',';
+            if (!cell.isEmpty())
+                outstream << cell << ',';
             else
                 outstream << " " << ',';
         }
@@ -2326,6 +2415,8 @@ void MainWindow::closeEvent(QCloseEvent *event)
     programSettings.setValue("watneyBinaryPath", ui->watneyPath->text());
     programSettings.setValue("wcsPath", ui->wcsPath->text());
     programSettings.setValue("cleanupTemporaryFiles",  ui->cleanupTemp->isChecked());
+    programSettings.setValue("memoryTemporaryFiles",  ui->memoryTempFiles->isChecked());
+    programSettings.setValue("warmExternalDatabases",  ui->warmDatabases->isChecked());
     programSettings.setValue("autoGenerateAstroConfig", ui->generateAstrometryConfig->isChecked());
     programSettings.setValue("onlineServer", ui->onlineServer->text());
     programSettings.setValue("apiKey", ui->apiKey->text());
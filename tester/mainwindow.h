@@ -37,6 +37,7 @@
 #include <QLineEdit>
 #include <QElapsedTimer>
 #include <QTimer>
+#include <QFutureWatcher>
 #include <QTableWidget>
 
 //CFitsio Includes
@@ -45,6 +46,9 @@
 
 //KStars related includes
 #include "ssolverutils/stretch.h"
+#include "ssolverutils/tiledimage.h"
+#include "ssolverutils/stargrid.h"
+#include "startablemodel.h"
 #include "math.h"
 #include "ssolverutils/dms.h"
 #include "ssolverutils/bayer.h"
@@ -93,6 +97,7 @@ private:
     QString fileToProcess;
     QList<FITSImage::Star> stars;
     int selectedStar;
+    StarTableModel *starTableModel;
 
     QList<SSolver::Parameters> optionsList;
     bool optionsAreSaved = true;
@@ -126,7 +131,14 @@ private:
     FITSImage::Statistic stats;
     QList<fileio::Record> m_HeaderRecords;
     QImage rawImage;
-    QImage scaledImage;
+    // The full preview being stretched in the background, rawImage is the quick preview until it finishes
+    QFutureWatcher<QImage> refinedImageWatcher;
+    // The image is drawn from tiles of the zooms it was shown at, and only the stars found in the grid near the visible part are drawn
+    TiledImage imageTiles;
+    StarGrid starGrid;
+    QList<FITSImage::Star> indexedStars;    // The stars the grid was built from, it is rebuilt when stars isn't shared with it anymore
+    int indexedStarOption = -1;
+    double starReach = 0;                   // The furthest any circle/ellipse of a star goes from its center, in image pixels
     int currentWidth;
     int currentHeight;
     double currentZoom;
@@ -190,6 +202,8 @@ public slots:
     void panDown();
     void autoScale();
     void updateImage();
+    void drawImage(QPainter &painter, const QRect &exposed);
+    void indexStars();
 
     //These functions handle the star table
     void displayTable();
@@ -203,6 +217,7 @@ public slots:
     QString getValue(int x, int y, int channel);
     void mouseClickedInImage(QPoint location);
     void mousePressedInImage(QPoint location);
+    QSizeF getStarSize(const FITSImage::Star &star, bool &accurate);
     QRect getStarSizeInImage(FITSImage::Star star, bool &accurate);
 
     void reloadConvTable();
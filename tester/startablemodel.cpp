@@ -0,0 +1,143 @@
+/*  StarTableModel for StellarSolver Tester Application, developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "startablemodel.h"
+#include "stellarsolver.h"
+
+#include <algorithm>
+#include <numeric>
+
+StarTableModel::StarTableModel(QObject *parent) : QAbstractTableModel(parent)
+{
+}
+
+void StarTableModel::setStars(const QList<FITSImage::Star> &stars, bool hasHFRData, bool hasWCSData)
+{
+    beginResetModel();
+    m_Stars = stars;
+    m_HasWCSData = hasWCSData;
+    m_Columns = {MAG_AUTO, RA, DEC, X_IMAGE, Y_IMAGE, FLUX_AUTO, PEAK};
+    if(hasHFRData)
+        m_Columns.append(HFR);
+    m_Columns << A << B << THETA;
+    m_Order.resize(m_Stars.size());
+    std::iota(m_Order.begin(), m_Order.end(), 0);
+    m_Rows = m_Order;
+    endResetModel();
+}
+
+int StarTableModel::column(Column column) const
+{
+    return m_Columns.indexOf(column);
+}
+
+int StarTableModel::starAt(int row) const
+{
+    return row >= 0 && row < m_Order.size() ? m_Order.at(row) : -1;
+}
+
+int StarTableModel::rowOf(int star) const
+{
+    return star >= 0 && star < m_Rows.size() ? m_Rows.at(star) : -1;
+}
+
+int StarTableModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_Stars.size();
+}
+
+int StarTableModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_Columns.size();
+}
+
+double StarTableModel::value(const FITSImage::Star &star, Column column) const
+{
+    switch(column)
+    {
+        case MAG_AUTO:
+            return star.mag;
+        case RA:
+            return star.ra;
+        case DEC:
+            return star.dec;
+        case X_IMAGE:
+            return star.x;
+        case Y_IMAGE:
+            return star.y;
+        case FLUX_AUTO:
+            return star.flux;
+        case PEAK:
+            return star.peak;
+        case HFR:
+            return star.HFR;
+        case A:
+            return star.a;
+        case B:
+            return star.b;
+        case THETA:
+            return star.theta;
+    }
+    return 0;
+}
+
+QVariant StarTableModel::data(const QModelIndex &index, int role) const
+{
+    if(!index.isValid() || index.row() >= m_Order.size() || index.column() >= m_Columns.size())
+        return QVariant();
+    if(role != Qt::DisplayRole)
+        return QVariant();
+
+    const FITSImage::Star &star = m_Stars.at(m_Order.at(index.row()));
+    const Column column = m_Columns.at(index.column());
+    if(column == RA)
+        return m_HasWCSData ? StellarSolver::raString(star.ra) : QString();
+    if(column == DEC)
+        return m_HasWCSData ? StellarSolver::decString(star.dec) : QString();
+    return QString::number(value(star, column));
+}
+
+QVariant StarTableModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if(role != Qt::DisplayRole)
+        return QVariant();
+    if(orientation == Qt::Vertical)
+        return section + 1;
+    static const QStringList names = {"MAG_AUTO", "RA (J2000)", "DEC (J2000)", "X_IMAGE", "Y_IMAGE", "FLUX_AUTO", "PEAK", "HFR", "a", "b", "theta"};
+    if(section < 0 || section >= m_Columns.size())
+        return QVariant();
+    return names.at(m_Columns.at(section));
+}
+
+void StarTableModel::sort(int column, Qt::SortOrder order)
+{
+    if(column < 0 || column >= m_Columns.size())
+        return;
+    const Column sortColumn = m_Columns.at(column);
+    emit layoutAboutToBeChanged();
+    const QModelIndexList before = persistentIndexList();
+    QVector<int> starsBefore;
+    starsBefore.reserve(before.size());
+    for(const QModelIndex &index : before)
+        starsBefore.append(m_Order.at(index.row()));
+
+    //Only the order of the rows is sorted, the stars stay where they are in the list
+    std::stable_sort(m_Order.begin(), m_Order.end(), [this, sortColumn, order](int a, int b)
+    {
+        const double valueA = value(m_Stars.at(a), sortColumn), valueB = value(m_Stars.at(b), sortColumn);
+        return order == Qt::AscendingOrder ? valueA < valueB : valueA > valueB;
+    });
+    for(int row = 0; row < m_Order.size(); row++)
+        m_Rows[m_Order.at(row)] = row;
+
+    QModelIndexList after;
+    after.reserve(before.size());
+    for(int i = 0; i < before.size(); i++)
+        after.append(index(m_Rows.at(starsBefore.at(i)), before.at(i).column()));
+    changePersistentIndexList(before, after);
+    emit layoutChanged();
+}
@@ -0,0 +1,55 @@
+/*  StarTableModel for StellarSolver Tester Application, developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#ifndef STARTABLEMODEL_H
+#define STARTABLEMODEL_H
+
+//Includes for this project
+#include "structuredefinitions.h"
+
+//QT Includes
+#include <QAbstractTableModel>
+#include <QList>
+#include <QStringList>
+#include <QVector>
+
+//This is the model of the star table.  The table view only asks it for the cells of the rows that are visible, so nothing is made
+//for the other stars, and sorting just reorders the rows, not the stars, so the row of a star and the star of a row are both looked up.
+class StarTableModel : public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    explicit StarTableModel(QObject *parent = nullptr);
+
+    //The columns that the table can have, the HFR column is only there if the stars have HFRs
+    enum Column { MAG_AUTO, RA, DEC, X_IMAGE, Y_IMAGE, FLUX_AUTO, PEAK, HFR, A, B, THETA };
+
+    void setStars(const QList<FITSImage::Star> &stars, bool hasHFRData, bool hasWCSData);
+
+    //This gets the column number of one of the columns, or -1 if the table doesn't have it
+    int column(Column column) const;
+    //These get the star shown in a row and the row a star is shown in
+    int starAt(int row) const;
+    int rowOf(int star) const;
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
+private:
+    double value(const FITSImage::Star &star, Column column) const;
+
+    QList<FITSImage::Star> m_Stars;
+    bool m_HasWCSData = false;
+    QVector<Column> m_Columns;
+    QVector<int> m_Order;       //The star in each row
+    QVector<int> m_Rows;        //The row of each star
+};
+
+#endif // STARTABLEMODEL_H
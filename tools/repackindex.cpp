@@ -0,0 +1,117 @@
+// A program that repacks Astrometry.net index files as StellarSolver native index files, see IndexCatalog::repackIndex.
+// The native file of an index is written next to it, or in the output folder, with the .ssindex suffix instead of .fits.
+// When an index folder has both, StellarSolver only loads the native one, so the index files can be repacked in place.
+// The native files are in the byte order of the machine, so they should be repacked on the machine that uses them.
+//
+// Build with:
+// mkdir build
+// cd build
+// cmake -DCMAKE_BUILD_TYPE=RelWithDebInfo -DBUILD_TOOLS=ON ..
+// make -j 4
+//
+// Examples:
+// StellarSolverRepackIndex astrometry/index-4107.fits astrometry/index-4110.fits
+// StellarSolverRepackIndex --quantize-codes -o ~/ssindexes /usr/share/astrometry
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFileInfo>
+
+//Includes for this project
+#include "stellarsolver.h"
+#include "indexcatalog.h"
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/index.h"
+#include "astrometry/ssindex.h"
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+    QCoreApplication::setApplicationName("StellarSolverRepackIndex");
+    QCoreApplication::setApplicationVersion(StellarSolver::getVersionNumber());
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Repacks Astrometry.net index files as StellarSolver native index files.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("indexes", "The index files to repack, or folders of them.", "[indexes...]");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "The folder to write the native index files in, by default they go next to the index files.", "folder");
+    QCommandLineOption quantizeOption("quantize-codes", "Rebuild the code kd-trees with 16 bit codes, which makes them a quarter of the size.");
+    QCommandLineOption forceOption(QStringList() << "f" << "force", "Repack the index files that already have a native index file that is newer.");
+    parser.addOptions(QList<QCommandLineOption>() << outputOption << quantizeOption << forceOption);
+    parser.process(app);
+
+    if(parser.positionalArguments().isEmpty())
+        parser.showHelp(1);
+
+    QStringList sources;
+    for(const QString &argument : parser.positionalArguments())
+    {
+        const QFileInfo info(argument);
+        if(info.isDir())
+        {
+            const QFileInfoList files = QDir(argument).entryInfoList(QDir::Files, QDir::Name);
+            for(const QFileInfo &file : files)
+            {
+                const QByteArray path = file.absoluteFilePath().toUtf8();
+                if(!file.fileName().endsWith(SSINDEX_SUFFIX) && index_is_file_index(path.constData()))
+                    sources.append(file.absoluteFilePath());
+            }
+        }
+        else if(info.exists())
+            sources.append(info.absoluteFilePath());
+        else
+            fprintf(stderr, "%s does not exist\n", argument.toUtf8().constData());
+    }
+
+    const QString outputFolder = parser.value(outputOption);
+    if(!outputFolder.isEmpty() && !QDir().mkpath(outputFolder))
+    {
+        fprintf(stderr, "Unable to make the folder %s\n", outputFolder.toUtf8().constData());
+        return 1;
+    }
+
+    int failed = 0;
+    qint64 sourceBytes = 0;
+    qint64 nativeBytes = 0;
+    for(const QString &source : sources)
+    {
+        const QFileInfo info(source);
+        const QString folder = outputFolder.isEmpty() ? info.absolutePath() : outputFolder;
+        const QString destination = QDir(folder).filePath(info.completeBaseName() + SSINDEX_SUFFIX);
+        const QFileInfo existing(destination);
+        if(!parser.isSet(forceOption) && existing.exists() && existing.lastModified() >= info.lastModified())
+        {
+            fprintf(stderr, "%s is up to date\n", destination.toUtf8().constData());
+            continue;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        if(!IndexCatalog::repackIndex(source, destination, parser.isSet(quantizeOption)))
+        {
+            fprintf(stderr, "Unable to repack %s\n", source.toUtf8().constData());
+            failed++;
+            continue;
+        }
+        const qint64 size = QFileInfo(destination).size();
+        sourceBytes += info.size();
+        nativeBytes += size;
+        fprintf(stderr, "Repacked %s as %s, %.1f MB to %.1f MB in %.1f s\n", info.fileName().toUtf8().constData(),
+                QFileInfo(destination).fileName().toUtf8().constData(), info.size() / (1024.0 * 1024.0), size / (1024.0 * 1024.0),
+                timer.elapsed() / 1000.0);
+    }
+    if(nativeBytes > 0)
+        fprintf(stderr, "Repacked %.1f MB of index files as %.1f MB of native index files\n", sourceBytes / (1024.0 * 1024.0),
+                nativeBytes / (1024.0 * 1024.0));
+    return failed > 0 ? 1 : 0;
+}